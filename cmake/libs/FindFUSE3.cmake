@@ -0,0 +1,12 @@
+# Find the FUSE 3 library.
+#
+# FUSE3_FOUND - system has FUSE 3
+# FUSE3_INCLUDE_DIR - where to find fuse3/fuse.h
+# FUSE3_LIBRARIES - the libraries to link against FUSE 3
+
+FIND_PATH(FUSE3_INCLUDE_DIR fuse3/fuse.h)
+FIND_LIBRARY(FUSE3_LIBRARIES NAMES fuse3)
+
+INCLUDE(FindPackageHandleStandardArgs)
+FIND_PACKAGE_HANDLE_STANDARD_ARGS(FUSE3 DEFAULT_MSG FUSE3_LIBRARIES FUSE3_INCLUDE_DIR)
+MARK_AS_ADVANCED(FUSE3_INCLUDE_DIR FUSE3_LIBRARIES)
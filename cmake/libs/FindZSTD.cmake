@@ -0,0 +1,12 @@
+# Find the zstd compression library.
+#
+# ZSTD_FOUND - system has zstd
+# ZSTD_INCLUDE_DIR - where to find zstd.h
+# ZSTD_LIBRARIES - the libraries to link against zstd
+
+FIND_PATH(ZSTD_INCLUDE_DIR zstd.h)
+FIND_LIBRARY(ZSTD_LIBRARIES NAMES zstd libzstd zstd_static)
+
+INCLUDE(FindPackageHandleStandardArgs)
+FIND_PACKAGE_HANDLE_STANDARD_ARGS(ZSTD DEFAULT_MSG ZSTD_LIBRARIES ZSTD_INCLUDE_DIR)
+MARK_AS_ADVANCED(ZSTD_INCLUDE_DIR ZSTD_LIBRARIES)
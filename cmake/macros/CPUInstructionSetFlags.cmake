@@ -104,4 +104,32 @@ IF(CPU_i386 OR CPU_amd64)
 		SET(SSSE3_FLAG "-mssse3")
 		SET(SSE41_FLAG "-msse4.1")
 	ENDIF()
+
+	# AES-NI
+	IF(MSVC AND NOT CMAKE_CXX_COMPILER_ID STREQUAL "Clang")
+		# MSVC does not require anything special for AES-NI.
+	ELSE()
+		SET(AESNI_FLAG "-msse2 -maes")
+	ENDIF()
+
+	# SHA extensions and AVX2
+	IF(MSVC AND NOT CMAKE_CXX_COMPILER_ID STREQUAL "Clang")
+		SET(AVX2_FLAG "/arch:AVX2")
+	ELSE()
+		SET(SHANI_FLAG "-msse4.1 -msha")
+		SET(AVX2_FLAG "-mavx2")
+	ENDIF()
+
+	# PCLMULQDQ (CRC32 folding)
+	IF(MSVC AND NOT CMAKE_CXX_COMPILER_ID STREQUAL "Clang")
+		# MSVC does not require anything special for PCLMULQDQ.
+	ELSE()
+		SET(PCLMUL_FLAG "-msse4.1 -mpclmul")
+	ENDIF()
 ENDIF(CPU_i386 OR CPU_amd64)
+
+# arm64: Flags for the ARMv8 Cryptography Extensions and CRC32 instructions.
+IF(CPU_arm64 AND NOT MSVC)
+	SET(ARMV8_CRYPTO_FLAG "-march=armv8-a+crypto")
+	SET(ARMV8_CRC32_FLAG "-march=armv8-a+crc")
+ENDIF(CPU_arm64 AND NOT MSVC)
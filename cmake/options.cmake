@@ -14,6 +14,32 @@ ELSE(UNIX AND NOT APPLE)
 	SET(ENABLE_DBUS 0)
 ENDIF(UNIX AND NOT APPLE)
 
+# Enable the FUSE frontend (rvthfs) on Linux.
+IF(UNIX AND NOT APPLE)
+	OPTION(ENABLE_FUSE "Build rvthfs, a FUSE filesystem for RVT-H devices and disk images. (requires FUSE 3)" ON)
+ELSE()
+	SET(ENABLE_FUSE OFF CACHE INTERNAL "Build rvthfs, a FUSE filesystem for RVT-H devices and disk images. (requires FUSE 3)" FORCE)
+ENDIF()
+
+# Compression libraries for RVTZ, WIA, and RVZ disc images.
+OPTION(ENABLE_ZSTD "Enable zstd compression for RVTZ, WIA, and RVZ disc images." ON)
+OPTION(ENABLE_LZMA "Enable LZMA compression for RVTZ, WIA, and RVZ disc images." ON)
+OPTION(ENABLE_BZIP2 "Enable bzip2 decompression for WIA disc images." ON)
+
+# Read disc images from HTTP(S) URLs using range requests.
+OPTION(ENABLE_CURL "Enable reading disc images from HTTP(S) URLs. (requires libcurl)" ON)
+
+# Crypto backend for libwiicrypto's AES and RSA wrappers.
+# SHA-1 always uses nettle.
+# - nettle: GNU Nettle and GMP. (mini-GMP on Windows)
+# - openssl: OpenSSL libcrypto. (1.1.0 or later)
+SET(CRYPTO_BACKEND "nettle" CACHE STRING "Crypto backend for AES and RSA. (nettle, openssl)")
+SET_PROPERTY(CACHE CRYPTO_BACKEND PROPERTY STRINGS nettle openssl)
+
+# Span tracing in librvth. (rvthtool --trace)
+# If disabled, the trace spans compile to nothing.
+OPTION(ENABLE_TRACING "Enable span tracing in librvth. (rvthtool --trace)" ON)
+
 # Link-time optimization.
 # FIXME: Not working in clang builds and Ubuntu's gcc...
 IF(MSVC)
@@ -23,6 +49,11 @@ ELSE()
 ENDIF()
 OPTION(ENABLE_LTO "Enable link-time optimization in release builds." ${LTO_DEFAULT})
 
+# Benchmarks for libwiicrypto and librvth.
+# If BUILD_TESTING is also enabled, they're registered with CTest
+# as performance regression tests with the "perf" label.
+OPTION(BUILD_BENCHMARKS "Build the libwiicrypto and librvth benchmarks." OFF)
+
 # Split debug information into a separate file.
 # FIXME: macOS `strip` shows an error:
 # error: symbols referenced by indirect symbol table entries that can't be stripped in: [library]
@@ -0,0 +1,302 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * AsyncJob.cpp: Run an RvtH operation on a background thread.             *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "AsyncJob.hpp"
+
+// C includes (C++ namespace)
+#include <cerrno>
+#include <cstring>
+
+// C++ includes
+#include <chrono>
+
+/**
+ * Create a job. The job isn't started until start() is called.
+ * @param rvth	[in] RvtH object. (must remain valid until the job is deleted)
+ * @param fn	[in] Operation to run.
+ */
+AsyncJob::AsyncJob(RvtH *rvth, Function fn)
+	: m_rvth(rvth)
+	, m_fn(std::move(fn))
+	, m_started(false)
+	, m_finished(false)
+	, m_result(-EINPROGRESS)
+	, m_done(0)
+	, m_total(0)
+	, m_callback(nullptr)
+	, m_verifyCallback(nullptr)
+	, m_userdata(nullptr)
+{
+	memset(m_errorCount, 0, sizeof(m_errorCount));
+}
+
+/**
+ * Delete the job. If it's still running, it's cancelled,
+ * and this waits for it to finish.
+ */
+AsyncJob::~AsyncJob()
+{
+	if (m_thread.joinable()) {
+		m_token.cancel();
+		m_thread.join();
+	}
+}
+
+/** Jobs for common operations **/
+
+/**
+ * Extract a disc image. (See RvtH::extract().)
+ * @param rvth		[in] RvtH object.
+ * @param bank		[in] Bank number. (0-7)
+ * @param filename	[in] Destination filename.
+ * @param recrypt_key	[in] Key for recryption. (-1 for default; otherwise, see RVL_CryptoType_e)
+ * @param flags		[in] Flags. (See RvtH_Extract_Flags.)
+ * @param callback	[in,opt] Progress callback.
+ * @param userdata	[in,opt] User data for progress callback.
+ * @return Job. (not started)
+ */
+AsyncJob *AsyncJob::extract(RvtH *rvth, unsigned int bank, const TCHAR *filename,
+	int recrypt_key, unsigned int flags,
+	RvtH_Progress_Callback callback, void *userdata)
+{
+	AsyncJob *const job = new AsyncJob(rvth, [=](AsyncJob *pJob) {
+		return pJob->m_rvth->extract(bank, pJob->m_filename.c_str(), recrypt_key, flags,
+			progressCallback, pJob);
+	});
+	job->m_filename = filename;
+	job->m_callback = callback;
+	job->m_userdata = userdata;
+	return job;
+}
+
+/**
+ * Import a disc image. (See RvtH::import().)
+ * @param rvth		[in] RvtH object.
+ * @param bank		[in] Bank number. (0-7)
+ * @param filename	[in] Source GCM filename.
+ * @param ios_force	[in] IOS version to force. (-1 to use the existing IOS)
+ * @param flags		[in] Flags. (See RvtH_Import_Flags.)
+ * @param callback	[in,opt] Progress callback.
+ * @param userdata	[in,opt] User data for progress callback.
+ * @return Job. (not started)
+ */
+AsyncJob *AsyncJob::import(RvtH *rvth, unsigned int bank, const TCHAR *filename,
+	int ios_force, unsigned int flags,
+	RvtH_Progress_Callback callback, void *userdata)
+{
+	AsyncJob *const job = new AsyncJob(rvth, [=](AsyncJob *pJob) {
+		return pJob->m_rvth->import(bank, pJob->m_filename.c_str(),
+			progressCallback, pJob, ios_force, flags);
+	});
+	job->m_filename = filename;
+	job->m_callback = callback;
+	job->m_userdata = userdata;
+	return job;
+}
+
+/**
+ * Verify a bank. (See RvtH::verifyWiiPartitions().)
+ * The error counts can be retrieved using errorCount().
+ * @param rvth		[in] RvtH object.
+ * @param bank		[in] Bank number. (0-7)
+ * @param threads	[in] Number of worker threads. (0 for auto; 1 for single-threaded)
+ * @param flags		[in] Flags. (See RvtH_Verify_Flags.)
+ * @param callback	[in,opt] Progress callback.
+ * @param userdata	[in,opt] User data for progress callback.
+ * @return Job. (not started)
+ */
+AsyncJob *AsyncJob::verify(RvtH *rvth, unsigned int bank,
+	unsigned int threads, unsigned int flags,
+	RvtH_Verify_Progress_Callback callback, void *userdata)
+{
+	AsyncJob *const job = new AsyncJob(rvth, [=](AsyncJob *pJob) {
+		return pJob->m_rvth->verifyWiiPartitions(bank, pJob->m_errorCount,
+			verifyProgressCallback, pJob, threads, flags);
+	});
+	job->m_verifyCallback = callback;
+	job->m_userdata = userdata;
+	return job;
+}
+
+/**
+ * Recrypt the Wii partitions of a bank. (See RvtH::recryptWiiPartitions().)
+ * @param rvth		[in] RvtH object.
+ * @param bank		[in] Bank number. (0-7)
+ * @param cryptoType	[in] New encryption type.
+ * @param ios_force	[in] IOS version to force. (-1 to use the existing IOS)
+ * @param callback	[in,opt] Progress callback.
+ * @param userdata	[in,opt] User data for progress callback.
+ * @return Job. (not started)
+ */
+AsyncJob *AsyncJob::recrypt(RvtH *rvth, unsigned int bank,
+	RVL_CryptoType_e cryptoType, int ios_force,
+	RvtH_Progress_Callback callback, void *userdata)
+{
+	AsyncJob *const job = new AsyncJob(rvth, [=](AsyncJob *pJob) {
+		return pJob->m_rvth->recryptWiiPartitions(bank, cryptoType,
+			progressCallback, pJob, ios_force);
+	});
+	job->m_callback = callback;
+	job->m_userdata = userdata;
+	return job;
+}
+
+/**
+ * Start the job.
+ * @return 0 on success; -EBUSY if another job is running on the RvtH object,
+ *         or if this job was already started.
+ */
+int AsyncJob::start(void)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_started) {
+		return -EBUSY;
+	}
+
+	int ret = m_rvth->setCancelToken(&m_token);
+	if (ret != 0) {
+		return ret;
+	}
+
+	m_started = true;
+	m_thread = std::thread(&AsyncJob::run, this);
+	return 0;
+}
+
+/**
+ * Job thread.
+ */
+void AsyncJob::run(void)
+{
+	int ret;
+	if (m_token.isCancelled()) {
+		// Cancelled before the job was started.
+		ret = -ECANCELED;
+	} else {
+		ret = m_fn(this);
+		if (ret != 0 && m_token.isCancelled()) {
+			// The operation may have failed in an I/O or crypto
+			// stage that was interrupted, e.g. with a short read.
+			ret = -ECANCELED;
+		}
+	}
+	m_rvth->setCancelToken(nullptr);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_result = ret;
+	m_finished = true;
+	m_cond.notify_all();
+}
+
+/**
+ * Cancel the job.
+ * This returns immediately; use wait() to wait for the job to stop.
+ * If the job hasn't been started, it fails with -ECANCELED when started.
+ */
+void AsyncJob::cancel(void)
+{
+	m_token.cancel();
+}
+
+/**
+ * Has the job finished?
+ * @return True if finished.
+ */
+bool AsyncJob::isFinished(void) const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_finished;
+}
+
+/**
+ * Wait for the job to finish.
+ * @return Job result. (See result().)
+ */
+int AsyncJob::wait(void)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if (!m_started) {
+		return m_result;
+	}
+	m_cond.wait(lock, [this]() { return m_finished; });
+	return m_result;
+}
+
+/**
+ * Wait for the job to finish, with a timeout.
+ * @param timeout_ms	[in] Timeout, in milliseconds.
+ * @return True if the job finished; false on timeout.
+ */
+bool AsyncJob::waitFor(unsigned int timeout_ms)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	return m_cond.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+		[this]() { return m_finished; });
+}
+
+/**
+ * Get the job result.
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ *         -ECANCELED if cancelled; -EINPROGRESS if not finished.
+ */
+int AsyncJob::result(void) const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_result;
+}
+
+/**
+ * Get the job's latest progress.
+ * Units depend on the operation: LBAs, or for verification,
+ * groups in the partition that's being verified.
+ * @param pDone		[out] Amount processed.
+ * @param pTotal	[out] Total amount. (0 if not known yet)
+ */
+void AsyncJob::progress(uint64_t *pDone, uint64_t *pTotal) const
+{
+	*pTotal = m_total.load(std::memory_order_relaxed);
+	*pDone = m_done.load(std::memory_order_relaxed);
+}
+
+/**
+ * Progress callback that tracks the job's progress.
+ * The job's own callback, if any, is called afterwards.
+ * @param state		[in] Current progress.
+ * @param userdata	[in] AsyncJob
+ * @return True to continue; false if cancelled.
+ */
+bool AsyncJob::progressCallback(const RvtH_Progress_State *state, void *userdata)
+{
+	AsyncJob *const job = static_cast<AsyncJob*>(userdata);
+	job->m_total.store(state->lba_total, std::memory_order_relaxed);
+	job->m_done.store(state->lba_processed, std::memory_order_relaxed);
+
+	if (job->m_token.isCancelled()) {
+		return false;
+	}
+	return (!job->m_callback || job->m_callback(state, job->m_userdata));
+}
+
+/**
+ * Verification progress callback that tracks the job's progress.
+ * The job's own callback, if any, is called afterwards.
+ * @param state		[in] Current progress.
+ * @param userdata	[in] AsyncJob
+ * @return True to continue; false if cancelled.
+ */
+bool AsyncJob::verifyProgressCallback(const RvtH_Verify_Progress_State *state, void *userdata)
+{
+	AsyncJob *const job = static_cast<AsyncJob*>(userdata);
+	job->m_total.store(state->group_total, std::memory_order_relaxed);
+	job->m_done.store(state->group_cur, std::memory_order_relaxed);
+
+	if (job->m_token.isCancelled()) {
+		return false;
+	}
+	return (!job->m_verifyCallback || job->m_verifyCallback(state, job->m_userdata));
+}
@@ -0,0 +1,259 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * AsyncJob.hpp: Run an RvtH operation on a background thread.             *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_ASYNCJOB_HPP__
+#define __RVTHTOOL_LIBRVTH_ASYNCJOB_HPP__
+
+#include "rvth.hpp"
+#include "CancelToken.hpp"
+#include "tcharx.h"
+
+// C includes
+#include <stdint.h>
+
+// C++ includes
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/**
+ * Run an RvtH operation on a background thread.
+ *
+ * The job installs its own cancellation token on the RvtH object
+ * while it's running (see RvtH::setCancelToken()), so cancel() stops
+ * the operation within one I/O request or group. Only one job can run
+ * on an RvtH object at a time, but jobs on different RvtH objects can
+ * run concurrently.
+ *
+ * Progress callbacks are invoked on the job's thread. The latest
+ * progress can also be polled from any thread using progress().
+ *
+ * Usage:
+ *   AsyncJob *job = AsyncJob::extract(rvth, bank, filename, -1, 0);
+ *   int ret = job->start();
+ *   ...
+ *   job->cancel();		// optional
+ *   ret = job->wait();
+ *   delete job;
+ */
+class AsyncJob
+{
+	public:
+		/**
+		 * Operation to run.
+		 * To track progress, pass AsyncJob::progressCallback() or
+		 * AsyncJob::verifyProgressCallback() with the job as userdata.
+		 * @param job	[in] Job
+		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		typedef std::function<int(AsyncJob *job)> Function;
+
+		/**
+		 * Create a job. The job isn't started until start() is called.
+		 * @param rvth	[in] RvtH object. (must remain valid until the job is deleted)
+		 * @param fn	[in] Operation to run.
+		 */
+		AsyncJob(RvtH *rvth, Function fn);
+
+		/**
+		 * Delete the job. If it's still running, it's cancelled,
+		 * and this waits for it to finish.
+		 */
+		~AsyncJob();
+
+	private:
+		DISABLE_COPY(AsyncJob)
+
+	public:
+		/** Jobs for common operations **/
+		// NOTE: The callbacks are invoked on the job's thread.
+
+		/**
+		 * Extract a disc image. (See RvtH::extract().)
+		 * @param rvth		[in] RvtH object.
+		 * @param bank		[in] Bank number. (0-7)
+		 * @param filename	[in] Destination filename.
+		 * @param recrypt_key	[in] Key for recryption. (-1 for default; otherwise, see RVL_CryptoType_e)
+		 * @param flags		[in] Flags. (See RvtH_Extract_Flags.)
+		 * @param callback	[in,opt] Progress callback.
+		 * @param userdata	[in,opt] User data for progress callback.
+		 * @return Job. (not started)
+		 */
+		static AsyncJob *extract(RvtH *rvth, unsigned int bank, const TCHAR *filename,
+			int recrypt_key, unsigned int flags,
+			RvtH_Progress_Callback callback = nullptr, void *userdata = nullptr);
+
+		/**
+		 * Import a disc image. (See RvtH::import().)
+		 * @param rvth		[in] RvtH object.
+		 * @param bank		[in] Bank number. (0-7)
+		 * @param filename	[in] Source GCM filename.
+		 * @param ios_force	[in] IOS version to force. (-1 to use the existing IOS)
+		 * @param flags		[in] Flags. (See RvtH_Import_Flags.)
+		 * @param callback	[in,opt] Progress callback.
+		 * @param userdata	[in,opt] User data for progress callback.
+		 * @return Job. (not started)
+		 */
+		static AsyncJob *import(RvtH *rvth, unsigned int bank, const TCHAR *filename,
+			int ios_force, unsigned int flags,
+			RvtH_Progress_Callback callback = nullptr, void *userdata = nullptr);
+
+		/**
+		 * Verify a bank. (See RvtH::verifyWiiPartitions().)
+		 * The error counts can be retrieved using errorCount().
+		 * @param rvth		[in] RvtH object.
+		 * @param bank		[in] Bank number. (0-7)
+		 * @param threads	[in] Number of worker threads. (0 for auto; 1 for single-threaded)
+		 * @param flags		[in] Flags. (See RvtH_Verify_Flags.)
+		 * @param callback	[in,opt] Progress callback.
+		 * @param userdata	[in,opt] User data for progress callback.
+		 * @return Job. (not started)
+		 */
+		static AsyncJob *verify(RvtH *rvth, unsigned int bank,
+			unsigned int threads, unsigned int flags,
+			RvtH_Verify_Progress_Callback callback = nullptr, void *userdata = nullptr);
+
+		/**
+		 * Recrypt the Wii partitions of a bank. (See RvtH::recryptWiiPartitions().)
+		 * @param rvth		[in] RvtH object.
+		 * @param bank		[in] Bank number. (0-7)
+		 * @param cryptoType	[in] New encryption type.
+		 * @param ios_force	[in] IOS version to force. (-1 to use the existing IOS)
+		 * @param callback	[in,opt] Progress callback.
+		 * @param userdata	[in,opt] User data for progress callback.
+		 * @return Job. (not started)
+		 */
+		static AsyncJob *recrypt(RvtH *rvth, unsigned int bank,
+			RVL_CryptoType_e cryptoType, int ios_force,
+			RvtH_Progress_Callback callback = nullptr, void *userdata = nullptr);
+
+	public:
+		/**
+		 * Start the job.
+		 * @return 0 on success; -EBUSY if another job is running on the RvtH object,
+		 *         or if this job was already started.
+		 */
+		int start(void);
+
+		/**
+		 * Cancel the job.
+		 * This returns immediately; use wait() to wait for the job to stop.
+		 * If the job hasn't been started, it fails with -ECANCELED when started.
+		 */
+		void cancel(void);
+
+		/**
+		 * Has the job finished?
+		 * @return True if finished.
+		 */
+		bool isFinished(void) const;
+
+		/**
+		 * Wait for the job to finish.
+		 * @return Job result. (See result().)
+		 */
+		int wait(void);
+
+		/**
+		 * Wait for the job to finish, with a timeout.
+		 * @param timeout_ms	[in] Timeout, in milliseconds.
+		 * @return True if the job finished; false on timeout.
+		 */
+		bool waitFor(unsigned int timeout_ms);
+
+		/**
+		 * Get the job result.
+		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 *         -ECANCELED if cancelled; -EINPROGRESS if not finished.
+		 */
+		int result(void) const;
+
+		/**
+		 * Get the job's latest progress.
+		 * Units depend on the operation: LBAs, or for verification,
+		 * groups in the partition that's being verified.
+		 * @param pDone		[out] Amount processed.
+		 * @param pTotal	[out] Total amount. (0 if not known yet)
+		 */
+		void progress(uint64_t *pDone, uint64_t *pTotal) const;
+
+		/**
+		 * Get the verification error counts. (verify() jobs only)
+		 * Valid once the job has finished.
+		 * @return Error counts for all 5 hash tables.
+		 */
+		inline const unsigned int *errorCount(void) const
+		{
+			return m_errorCount;
+		}
+
+		/**
+		 * Get the job's cancellation token.
+		 * @return Cancellation token.
+		 */
+		inline const CancelToken *cancelToken(void) const
+		{
+			return &m_token;
+		}
+
+	public:
+		/**
+		 * Progress callback that tracks the job's progress.
+		 * The job's own callback, if any, is called afterwards.
+		 * @param state		[in] Current progress.
+		 * @param userdata	[in] AsyncJob
+		 * @return True to continue; false if cancelled.
+		 */
+		static bool progressCallback(const RvtH_Progress_State *state, void *userdata);
+
+		/**
+		 * Verification progress callback that tracks the job's progress.
+		 * The job's own callback, if any, is called afterwards.
+		 * @param state		[in] Current progress.
+		 * @param userdata	[in] AsyncJob
+		 * @return True to continue; false if cancelled.
+		 */
+		static bool verifyProgressCallback(const RvtH_Verify_Progress_State *state, void *userdata);
+
+	private:
+		/**
+		 * Job thread.
+		 */
+		void run(void);
+
+	private:
+		RvtH *const m_rvth;
+		Function m_fn;
+		CancelToken m_token;
+		std::thread m_thread;
+
+		// Job state. (protected by m_mutex)
+		mutable std::mutex m_mutex;
+		std::condition_variable m_cond;
+		bool m_started;
+		bool m_finished;
+		int m_result;
+
+		// Latest progress.
+		std::atomic<uint64_t> m_done;
+		std::atomic<uint64_t> m_total;
+
+		// Caller's progress callbacks.
+		RvtH_Progress_Callback m_callback;
+		RvtH_Verify_Progress_Callback m_verifyCallback;
+		void *m_userdata;
+
+		// Operation parameters and results.
+		std::tstring m_filename;
+		unsigned int m_errorCount[5];
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_ASYNCJOB_HPP__ */
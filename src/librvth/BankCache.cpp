@@ -0,0 +1,225 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * BankCache.cpp: Persistent cache for RVT-H bank metadata.                *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "config.librvth.h"
+
+#include "BankCache.hpp"
+#include "cache_dir.hpp"
+
+// C includes (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+// C++ includes
+#include <string>
+#include <vector>
+using std::tstring;
+using std::vector;
+
+// Cache file header.
+// NOTE: Entries are stored in host-endian, so the entry size
+// and version are checked to reject caches from other builds.
+static const char BANKCACHE_MAGIC[8] = {'R','V','T','H','B','N','K','C'};
+static const uint32_t BANKCACHE_VERSION = 2;
+typedef struct _BankCache_Header {
+	char magic[8];		// BANKCACHE_MAGIC
+	uint32_t version;	// BANKCACHE_VERSION
+	uint32_t entry_size;	// sizeof(BankCache::CacheEntry)
+	uint32_t bank_count;	// Number of entries
+	uint32_t key_size;	// Size of the device key that follows the header, in bytes
+} BankCache_Header;
+
+BankCache::BankCache()
+	: m_dirty(false)
+{ }
+
+/**
+ * Load the bank cache for an RVT-H Reader or HDD image.
+ * If the cache can't be loaded, all lookups will fail.
+ * @param f_img		[in] RefFile*
+ * @param bankCount	[in] Number of banks.
+ */
+void BankCache::load(RefFile *f_img, unsigned int bankCount)
+{
+	m_filename.clear();
+	m_key.clear();
+	m_entries.resize(bankCount);
+	memset(m_entries.data(), 0, m_entries.size() * sizeof(CacheEntry));
+	m_dirty = false;
+
+	m_key = rvth_get_device_key(f_img);
+	if (m_key.empty()) {
+		return;
+	}
+	m_filename = rvth_get_cache_filename(m_key, _T(".bin"));
+	if (m_filename.empty()) {
+		return;
+	}
+	const uint8_t *const key8 = reinterpret_cast<const uint8_t*>(m_key.data());
+	const size_t key_size = m_key.size() * sizeof(TCHAR);
+
+	// Load the existing cache file, if it's present.
+	FILE *f = _tfopen(m_filename.c_str(), _T("rb"));
+	if (!f) {
+		return;
+	}
+
+	BankCache_Header header;
+	vector<uint8_t> file_key;
+	vector<CacheEntry> entries(bankCount);
+	bool ok = (fread(&header, 1, sizeof(header), f) == sizeof(header) &&
+		!memcmp(header.magic, BANKCACHE_MAGIC, sizeof(header.magic)) &&
+		header.version == BANKCACHE_VERSION &&
+		header.entry_size == sizeof(CacheEntry) &&
+		header.bank_count == bankCount &&
+		header.key_size == key_size);
+	if (ok) {
+		// Make sure the device key matches in case of hash collisions.
+		file_key.resize(key_size);
+		ok = (fread(file_key.data(), 1, key_size, f) == key_size &&
+			!memcmp(file_key.data(), key8, key_size));
+	}
+	if (ok) {
+		ok = (fread(entries.data(), sizeof(CacheEntry), bankCount, f) == bankCount);
+	}
+	fclose(f);
+
+	if (ok) {
+		m_entries = std::move(entries);
+	}
+}
+
+/**
+ * Look up a bank entry in the cache.
+ *
+ * On success, all fields other than reader and ptbl are set.
+ * Use rvth_init_BankEntry_reader() to open the reader.
+ *
+ * @param bank		[in] Bank number.
+ * @param nhcd_entry	[in] Bank table entry read from the HDD.
+ * @param entry		[out] RvtH_BankEntry
+ * @return True if the bank entry was found; false if not.
+ */
+bool BankCache::lookup(unsigned int bank, const NHCD_BankEntry *nhcd_entry, RvtH_BankEntry *entry) const
+{
+	assert(bank < m_entries.size());
+	if (bank >= m_entries.size()) {
+		return false;
+	}
+
+	const CacheEntry &ce = m_entries[bank];
+	if (!ce.valid || memcmp(&ce.nhcd_entry, nhcd_entry, sizeof(ce.nhcd_entry)) != 0) {
+		// Not cached, or the bank has changed.
+		return false;
+	}
+
+	memset(entry, 0, sizeof(*entry));
+	entry->lba_start = ce.lba_start;
+	entry->lba_len = ce.lba_len;
+	entry->timestamp = static_cast<time_t>(ce.timestamp);
+	entry->type = ce.type;
+	entry->region_code = ce.region_code;
+	entry->is_deleted = !!ce.is_deleted;
+	entry->aplerr = ce.aplerr;
+	memcpy(entry->aplerr_val, ce.aplerr_val, sizeof(entry->aplerr_val));
+	memcpy(&entry->discHeader, &ce.discHeader, sizeof(entry->discHeader));
+	entry->crypto_type = ce.crypto_type;
+	entry->ios_version = ce.ios_version;
+	entry->ticket = ce.ticket;
+	entry->tmd = ce.tmd;
+	memcpy(entry->fingerprint, ce.fingerprint, sizeof(entry->fingerprint));
+	return true;
+}
+
+/**
+ * Store a bank entry in the cache.
+ * @param bank		[in] Bank number.
+ * @param nhcd_entry	[in] Bank table entry read from the HDD.
+ * @param entry		[in] Initialized RvtH_BankEntry
+ */
+void BankCache::store(unsigned int bank, const NHCD_BankEntry *nhcd_entry, const RvtH_BankEntry *entry)
+{
+	assert(bank < m_entries.size());
+	if (bank >= m_entries.size()) {
+		return;
+	}
+
+	CacheEntry &ce = m_entries[bank];
+	memset(&ce, 0, sizeof(ce));
+	memcpy(&ce.nhcd_entry, nhcd_entry, sizeof(ce.nhcd_entry));
+	ce.valid = 1;
+	ce.lba_start = entry->lba_start;
+	ce.lba_len = entry->lba_len;
+	ce.timestamp = static_cast<int64_t>(entry->timestamp);
+	ce.type = entry->type;
+	ce.region_code = entry->region_code;
+	ce.is_deleted = entry->is_deleted;
+	ce.aplerr = entry->aplerr;
+	memcpy(ce.aplerr_val, entry->aplerr_val, sizeof(ce.aplerr_val));
+	memcpy(&ce.discHeader, &entry->discHeader, sizeof(ce.discHeader));
+	ce.crypto_type = entry->crypto_type;
+	ce.ios_version = entry->ios_version;
+	ce.ticket = entry->ticket;
+	ce.tmd = entry->tmd;
+	memcpy(ce.fingerprint, entry->fingerprint, sizeof(ce.fingerprint));
+	m_dirty = true;
+}
+
+/**
+ * Remove a bank entry from the cache.
+ * @param bank		[in] Bank number.
+ */
+void BankCache::invalidate(unsigned int bank)
+{
+	assert(bank < m_entries.size());
+	if (bank >= m_entries.size() || !m_entries[bank].valid) {
+		return;
+	}
+
+	memset(&m_entries[bank], 0, sizeof(m_entries[bank]));
+	m_dirty = true;
+}
+
+/**
+ * Save the cache if it was modified.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int BankCache::save(void)
+{
+	if (!m_dirty) {
+		return 0;
+	} else if (m_filename.empty()) {
+		return -ENOENT;
+	}
+
+	BankCache_Header header;
+	memcpy(header.magic, BANKCACHE_MAGIC, sizeof(header.magic));
+	header.version = BANKCACHE_VERSION;
+	header.entry_size = sizeof(CacheEntry);
+	header.bank_count = static_cast<uint32_t>(m_entries.size());
+	header.key_size = static_cast<uint32_t>(m_key.size() * sizeof(TCHAR));
+
+	vector<uint8_t> data;
+	data.reserve(sizeof(header) + header.key_size + (m_entries.size() * sizeof(CacheEntry)));
+	const uint8_t *const p_header = reinterpret_cast<const uint8_t*>(&header);
+	const uint8_t *const p_key = reinterpret_cast<const uint8_t*>(m_key.data());
+	const uint8_t *const p_entries = reinterpret_cast<const uint8_t*>(m_entries.data());
+	data.insert(data.end(), p_header, p_header + sizeof(header));
+	data.insert(data.end(), p_key, p_key + header.key_size);
+	data.insert(data.end(), p_entries, p_entries + (m_entries.size() * sizeof(CacheEntry)));
+
+	int ret = rvth_write_cache_file(m_filename, data.data(), data.size());
+	if (ret != 0) {
+		return ret;
+	}
+
+	m_dirty = false;
+	return 0;
+}
@@ -0,0 +1,122 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * BankCache.hpp: Persistent cache for RVT-H bank metadata.                *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#pragma once
+
+#include "rvth.hpp"
+#include "nhcd_structs.h"
+#include "tcharx.h"
+
+// C includes
+#include <stdint.h>
+
+// C++ includes
+#include <string>
+#include <vector>
+
+class RefFile;
+
+/**
+ * Persistent cache for RVT-H bank metadata.
+ *
+ * Initializing a bank entry requires reading the disc header, partition
+ * table, ticket, TMD, and apploader, and verifying the ticket and TMD
+ * signatures. This is slow on RVT-H Readers connected over USB 2.0,
+ * so the results are cached in the user's cache directory.
+ *
+ * The cache file is selected by the RVT-H Reader's serial number (or the
+ * HDD image's filename) and the HDD size. Each bank's cached metadata is
+ * only used if the bank table entry matches the one that was cached,
+ * so writing, deleting, or undeleting a bank invalidates its entry.
+ *
+ * NOTE: The partition table is not cached. It's loaded on demand
+ * by rvth_ptbl_load().
+ */
+class BankCache
+{
+	public:
+		BankCache();
+
+	private:
+		DISABLE_COPY(BankCache)
+
+	public:
+		/**
+		 * Load the bank cache for an RVT-H Reader or HDD image.
+		 * If the cache can't be loaded, all lookups will fail.
+		 * @param f_img		[in] RefFile*
+		 * @param bankCount	[in] Number of banks.
+		 */
+		void load(RefFile *f_img, unsigned int bankCount);
+
+		/**
+		 * Look up a bank entry in the cache.
+		 *
+		 * On success, all fields other than reader and ptbl are set.
+		 * Use rvth_init_BankEntry_reader() to open the reader.
+		 *
+		 * @param bank		[in] Bank number.
+		 * @param nhcd_entry	[in] Bank table entry read from the HDD.
+		 * @param entry		[out] RvtH_BankEntry
+		 * @return True if the bank entry was found; false if not.
+		 */
+		bool lookup(unsigned int bank, const NHCD_BankEntry *nhcd_entry, RvtH_BankEntry *entry) const;
+
+		/**
+		 * Store a bank entry in the cache.
+		 * @param bank		[in] Bank number.
+		 * @param nhcd_entry	[in] Bank table entry read from the HDD.
+		 * @param entry		[in] Initialized RvtH_BankEntry
+		 */
+		void store(unsigned int bank, const NHCD_BankEntry *nhcd_entry, const RvtH_BankEntry *entry);
+
+		/**
+		 * Remove a bank entry from the cache.
+		 * @param bank		[in] Bank number.
+		 */
+		void invalidate(unsigned int bank);
+
+		/**
+		 * Save the cache if it was modified.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int save(void);
+
+	public:
+		/**
+		 * Cached bank entry.
+		 * Stored in host-endian; only the bank table entry is big-endian.
+		 */
+		struct CacheEntry {
+			NHCD_BankEntry nhcd_entry;	// Bank table entry (key)
+			uint32_t valid;			// 1 if valid; 0 if not
+
+			uint32_t lba_start;
+			uint32_t lba_len;
+			int64_t timestamp;
+			uint8_t type;
+			uint8_t region_code;
+			uint8_t is_deleted;
+			uint8_t aplerr;
+			uint32_t aplerr_val[3];
+
+			GCN_DiscHeader discHeader;
+
+			uint8_t crypto_type;
+			uint8_t ios_version;
+			RvtH_SigInfo ticket;
+			RvtH_SigInfo tmd;
+			uint8_t fingerprint[20];
+		};
+
+	private:
+		std::tstring m_filename;	// Cache filename (empty if unavailable)
+		std::tstring m_key;		// Device key (serial number or filename, plus size)
+		std::vector<CacheEntry> m_entries;
+		bool m_dirty;
+};
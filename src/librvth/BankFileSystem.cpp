@@ -0,0 +1,273 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * BankFileSystem.cpp: Filesystem of a GameCube or Wii bank.               *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "BankFileSystem.hpp"
+#include "PartitionDataReader.hpp"
+
+// libwiicrypto
+#include "libwiicrypto/gcn_structs.h"
+
+#include "byteswap.h"
+
+// C includes (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+// C++ includes
+#include <string>
+#include <utility>
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+// Maximum FST size. Larger FSTs are assumed to be invalid.
+static constexpr uint32_t FST_SIZE_MAX = 64U * 1024U * 1024U;
+
+/**
+ * Create a filesystem for a bank's user data.
+ * Use RvtH::openFileSystem() instead of calling this directly.
+ * @param pdr	[in] Partition data reader. (This object takes ownership.)
+ * @param aesw	[in,opt] AES context used by pdr. (This object takes ownership.)
+ * @param shift	[in] Offset shift. (0 for GameCube; 2 for Wii)
+ */
+BankFileSystem::BankFileSystem(PartitionDataReader *pdr, AesCtx *aesw, unsigned int shift)
+	: m_pdr(pdr)
+	, m_aesw(aesw)
+	, m_shift(shift)
+{
+	assert(pdr != nullptr);
+}
+
+BankFileSystem::~BankFileSystem()
+{
+	// Delete the reader before the AES context it uses.
+	m_pdr.reset();
+	if (m_aesw) {
+		aesw_free(m_aesw);
+	}
+}
+
+/**
+ * Read the system files and the FST.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int BankFileSystem::load(void)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_files.clear();
+	PartitionDataReader &pdr = *m_pdr;
+
+	// Read the boot block and the apploader header.
+	// bi2.bin (0x440) is between them, and is read anyway.
+	uint8_t sys[0x2460];
+	if (!pdr.read(sys, 0, sizeof(sys))) {
+		return (errno != 0 ? -errno : -EIO);
+	}
+	const GCN_Boot_Block *const bb2 = reinterpret_cast<const GCN_Boot_Block*>(&sys[0x420]);
+	const uint64_t dol_offset = static_cast<uint64_t>(be32_to_cpu(bb2->bootFilePosition)) << m_shift;
+	const uint64_t fst_offset = static_cast<uint64_t>(be32_to_cpu(bb2->FSTPosition)) << m_shift;
+	const uint64_t fst_size = static_cast<uint64_t>(be32_to_cpu(bb2->FSTLength)) << m_shift;
+	if (fst_size < sizeof(GCN_FST_Entry) || fst_size > FST_SIZE_MAX) {
+		// FST size is invalid.
+		errno = EIO;
+		return -EIO;
+	}
+
+	// Apploader: 32-byte header, code, and trailer.
+	uint32_t apl_size;
+	memcpy(&apl_size, &sys[0x2454], sizeof(apl_size));
+	uint32_t apl_trailer_size;
+	memcpy(&apl_trailer_size, &sys[0x2458], sizeof(apl_trailer_size));
+	const uint64_t apl_total = 0x20ULL + be32_to_cpu(apl_size) + be32_to_cpu(apl_trailer_size);
+
+	// Determine the size of main.dol from its section table.
+	DOL_Header dol;
+	if (!pdr.read(&dol, dol_offset, sizeof(dol))) {
+		return (errno != 0 ? -errno : -EIO);
+	}
+	uint64_t dol_size = sizeof(dol);
+	for (unsigned int i = 0; i < ARRAY_SIZE(dol.textData); i++) {
+		const uint64_t end = static_cast<uint64_t>(be32_to_cpu(dol.textData[i])) + be32_to_cpu(dol.textLen[i]);
+		if (end > dol_size) {
+			dol_size = end;
+		}
+	}
+	for (unsigned int i = 0; i < ARRAY_SIZE(dol.dataData); i++) {
+		const uint64_t end = static_cast<uint64_t>(be32_to_cpu(dol.dataData[i])) + be32_to_cpu(dol.dataLen[i]);
+		if (end > dol_size) {
+			dol_size = end;
+		}
+	}
+
+	// System files.
+	m_files.push_back({"sys/", 0, 0, true});
+	m_files.push_back({"sys/boot.bin", 0, 0x440, false});
+	m_files.push_back({"sys/bi2.bin", 0x440, 0x2000, false});
+	m_files.push_back({"sys/apploader.img", 0x2440, apl_total, false});
+	m_files.push_back({"sys/main.dol", dol_offset, dol_size, false});
+	m_files.push_back({"sys/fst.bin", fst_offset, fst_size, false});
+
+	// Read the FST.
+	unique_ptr<uint8_t[]> fst_buf(new uint8_t[static_cast<size_t>(fst_size)]);
+	if (!pdr.read(fst_buf.get(), fst_offset, static_cast<uint32_t>(fst_size))) {
+		return (errno != 0 ? -errno : -EIO);
+	}
+	const GCN_FST_Entry *const fst = reinterpret_cast<const GCN_FST_Entry*>(fst_buf.get());
+
+	// The root directory's "next entry index" is the total number of entries.
+	// The string table immediately follows the last entry.
+	const uint32_t fst_count = be32_to_cpu(fst[0].file_size);
+	if (fst_count == 0 || fst_count > fst_size / sizeof(GCN_FST_Entry)) {
+		// FST entry count is invalid.
+		errno = EIO;
+		return -EIO;
+	}
+	const char *const str_tbl = reinterpret_cast<const char*>(&fst[fst_count]);
+	const size_t str_tbl_size = static_cast<size_t>(fst_size) - (fst_count * sizeof(GCN_FST_Entry));
+
+	m_files.push_back({"files/", 0, 0, true});
+
+	// Directories that are still open: (next entry index, path)
+	vector<std::pair<uint32_t, string> > dirs;
+	dirs.emplace_back(fst_count, "files/");
+	for (uint32_t i = 1; i < fst_count; i++) {
+		while (dirs.size() > 1 && i >= dirs.back().first) {
+			dirs.pop_back();
+		}
+
+		const uint32_t type_name_offset = be32_to_cpu(fst[i].type_name_offset);
+		const uint32_t name_offset = type_name_offset & 0xFFFFFF;
+		if (name_offset >= str_tbl_size) {
+			// Name is out of range.
+			errno = EIO;
+			return -EIO;
+		}
+		const char *const name = &str_tbl[name_offset];
+		const size_t name_len = strnlen(name, str_tbl_size - name_offset);
+		if (name_len == 0 || memchr(name, '/', name_len) != nullptr) {
+			// Invalid name.
+			errno = EIO;
+			return -EIO;
+		}
+
+		string path = dirs.back().second;
+		path.append(name, name_len);
+		if ((type_name_offset >> 24) != 0) {
+			// Directory.
+			const uint32_t next = be32_to_cpu(fst[i].file_size);
+			if (next <= i || next > dirs.back().first) {
+				// Invalid directory.
+				errno = EIO;
+				return -EIO;
+			}
+			path += '/';
+			m_files.push_back({path, 0, 0, true});
+			dirs.emplace_back(next, std::move(path));
+		} else {
+			// File.
+			m_files.push_back({std::move(path),
+				static_cast<uint64_t>(be32_to_cpu(fst[i].file_offset)) << m_shift,
+				be32_to_cpu(fst[i].file_size), false});
+		}
+	}
+
+	return 0;
+}
+
+
+/**
+ * Find a file or directory.
+ * @param path	[in] Path. (A leading '/' and a trailing '/' for directories are optional.)
+ * @return File or directory, or nullptr if not found.
+ */
+const RvtH_FST_File *BankFileSystem::find(const char *path) const
+{
+	assert(path != nullptr);
+	if (path[0] == '/') {
+		path++;
+	}
+	size_t len = strlen(path);
+	if (len > 0 && path[len-1] == '/') {
+		len--;
+	}
+
+	// Directories are listed with a trailing '/'.
+	for (const RvtH_FST_File &file : m_files) {
+		const size_t cmp_len = (file.is_dir ? file.path.size() - 1 : file.path.size());
+		if (cmp_len == len && !file.path.compare(0, len, path, len)) {
+			return &file;
+		}
+	}
+	return nullptr;
+}
+
+/**
+ * Read data from a file.
+ * @param file		[in] File.
+ * @param buf		[out] Output buffer.
+ * @param offset	[in] Offset in the file.
+ * @param size		[in] Number of bytes to read.
+ * @return Number of bytes read (less than size at the end of the file), or negative POSIX error code on error.
+ */
+int64_t BankFileSystem::read(const RvtH_FST_File *file, void *buf, uint64_t offset, uint32_t size)
+{
+	assert(file != nullptr);
+	if (file->is_dir) {
+		return -EISDIR;
+	} else if (offset >= file->size) {
+		return 0;
+	}
+	if (size > file->size - offset) {
+		size = static_cast<uint32_t>(file->size - offset);
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	errno = 0;
+	if (!m_pdr->read(buf, file->offset + offset, size)) {
+		return (errno != 0 ? -errno : -EIO);
+	}
+	return size;
+}
+
+/**
+ * Read the user data directly by partition offset.
+ * This doesn't require the FST to be loaded.
+ * NOTE: Offsets are in bytes. Wii disc offsets, e.g. in the FST
+ * or in DI commands, must be shifted left by 2 first.
+ * @param buf		[out] Output buffer.
+ * @param offset	[in] Offset in the user data.
+ * @param size		[in] Number of bytes to read.
+ * @return Number of bytes read (less than size at the end of the data), or negative POSIX error code on error.
+ */
+int64_t BankFileSystem::readData(void *buf, uint64_t offset, uint32_t size)
+{
+	const uint64_t data_size = m_pdr->size();
+	if (offset >= data_size) {
+		return 0;
+	}
+	if (size > data_size - offset) {
+		size = static_cast<uint32_t>(data_size - offset);
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	errno = 0;
+	if (!m_pdr->read(buf, offset, size)) {
+		return (errno != 0 ? -errno : -EIO);
+	}
+	return size;
+}
+
+/**
+ * Get the size of the user data.
+ * @return Size of the user data, in bytes.
+ */
+uint64_t BankFileSystem::dataSize(void) const
+{
+	return m_pdr->size();
+}
@@ -0,0 +1,110 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * BankFileSystem.hpp: Filesystem of a GameCube or Wii bank.               *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#pragma once
+
+#include "rvth.hpp"
+#include "aesw.h"
+
+// C includes
+#include <stdint.h>
+
+// C++ includes
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class PartitionDataReader;
+
+/**
+ * Filesystem of a bank: The user data of a GameCube disc,
+ * or of the game partition of a Wii disc.
+ *
+ * The file list is built from the boot block and the FST.
+ * File data is only read when requested; for encrypted Wii
+ * partitions, only the groups overlapping a read are decrypted.
+ *
+ * Use RvtH::openFileSystem() to open a bank's filesystem, or
+ * RvtH::openPartitionData() for raw access to the user data only.
+ * read() and readData() are thread-safe.
+ */
+class BankFileSystem
+{
+	public:
+		/**
+		 * Create a filesystem for a bank's user data.
+		 * Use RvtH::openFileSystem() instead of calling this directly.
+		 * @param pdr	[in] Partition data reader. (This object takes ownership.)
+		 * @param aesw	[in,opt] AES context used by pdr. (This object takes ownership.)
+		 * @param shift	[in] Offset shift. (0 for GameCube; 2 for Wii)
+		 */
+		BankFileSystem(PartitionDataReader *pdr, AesCtx *aesw, unsigned int shift);
+		~BankFileSystem();
+
+	private:
+		DISABLE_COPY(BankFileSystem)
+
+	public:
+		/**
+		 * Read the system files and the FST.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int load(void);
+
+		/**
+		 * Get the files and directories.
+		 * System files are in "sys/", and files in the FST are in "files/".
+		 * @return Files and directories, in FST order.
+		 */
+		inline const std::vector<RvtH_FST_File> &files(void) const
+		{
+			return m_files;
+		}
+
+		/**
+		 * Find a file or directory.
+		 * @param path	[in] Path. (A leading '/' and a trailing '/' for directories are optional.)
+		 * @return File or directory, or nullptr if not found.
+		 */
+		const RvtH_FST_File *find(const char *path) const;
+
+		/**
+		 * Read data from a file.
+		 * @param file		[in] File.
+		 * @param buf		[out] Output buffer.
+		 * @param offset	[in] Offset in the file.
+		 * @param size		[in] Number of bytes to read.
+		 * @return Number of bytes read (less than size at the end of the file), or negative POSIX error code on error.
+		 */
+		int64_t read(const RvtH_FST_File *file, void *buf, uint64_t offset, uint32_t size);
+
+		/**
+		 * Read the user data directly by partition offset.
+		 * This doesn't require the FST to be loaded.
+		 * NOTE: Offsets are in bytes. Wii disc offsets, e.g. in the FST
+		 * or in DI commands, must be shifted left by 2 first.
+		 * @param buf		[out] Output buffer.
+		 * @param offset	[in] Offset in the user data.
+		 * @param size		[in] Number of bytes to read.
+		 * @return Number of bytes read (less than size at the end of the data), or negative POSIX error code on error.
+		 */
+		int64_t readData(void *buf, uint64_t offset, uint32_t size);
+
+		/**
+		 * Get the size of the user data.
+		 * @return Size of the user data, in bytes.
+		 */
+		uint64_t dataSize(void) const;
+
+	private:
+		std::unique_ptr<PartitionDataReader> m_pdr;
+		AesCtx *m_aesw;
+		unsigned int m_shift;
+		std::vector<RvtH_FST_File> m_files;
+		std::mutex m_mutex;	// Protects m_pdr.
+};
@@ -0,0 +1,253 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * BufferPool.cpp: Reusable pool of aligned I/O buffers.                   *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "config.librvth.h"
+#include "BufferPool.hpp"
+#include "aligned_malloc.h"
+
+// C includes
+#ifdef HAVE_MADVISE
+#  include <sys/mman.h>
+#endif /* HAVE_MADVISE */
+
+// C includes (C++ namespace)
+#include <cassert>
+#include <cerrno>
+
+// C++ includes
+using std::lock_guard;
+using std::mutex;
+
+// Size classes.
+static const size_t class_size[] = {
+	1U << 20,	// 1 MB
+	2U << 20,	// 2 MB
+};
+
+// Default alignment for pooled buffers.
+#define POOL_ALIGNMENT_DEFAULT 4096
+
+// Default maximum number of unused buffers per size class.
+#define POOL_MAX_CACHED_DEFAULT 32
+
+BufferPool::BufferPool()
+	: m_cachedBytes(0)
+	, m_maxCachedBytes(0)
+	, m_maxCached(POOL_MAX_CACHED_DEFAULT)
+	, m_hugePages(false)
+{ }
+
+BufferPool::~BufferPool()
+{
+	trim();
+}
+
+/**
+ * Get the process-wide buffer pool.
+ * @return BufferPool
+ */
+BufferPool *BufferPool::instance(void)
+{
+	static BufferPool pool;
+	return &pool;
+}
+
+/**
+ * Get the size class for a buffer.
+ * @param size		[in] Size, in bytes.
+ * @param alignment	[in] Alignment. (0 for default)
+ * @return Size class, or -1 if the buffer isn't pooled.
+ */
+int BufferPool::sizeClass(size_t size, size_t alignment)
+{
+	// NOTE: This must not depend on m_hugePages, since the
+	// setting may be changed while buffers are in use.
+	if (alignment > POOL_ALIGNMENT_DEFAULT) {
+		// Alignment is too large.
+		return -1;
+	}
+
+	for (int i = 0; i < CLASS_MAX; i++) {
+		if (size <= class_size[i]) {
+			return i;
+		}
+	}
+
+	// Buffer is too large.
+	return -1;
+}
+
+/**
+ * Allocate a buffer.
+ * The buffer must be freed using free() with the same
+ * size and alignment.
+ *
+ * NOTE: Buffers taken from the pool are not zero-initialized.
+ *
+ * @param size		[in] Size, in bytes.
+ * @param alignment	[in,opt] Minimum alignment. (0 for 4 KB; must be a power of two)
+ * @return Buffer, or nullptr on error.
+ */
+uint8_t *BufferPool::alloc(size_t size, size_t alignment)
+{
+	assert((alignment & (alignment - 1)) == 0);
+	if (alignment == 0) {
+		alignment = POOL_ALIGNMENT_DEFAULT;
+	} else if (alignment < sizeof(void*)) {
+		alignment = sizeof(void*);
+	}
+
+	const int cls = sizeClass(size, alignment);
+	bool hugePages = false;
+	if (cls >= 0) {
+		lock_guard<mutex> lock(m_mutex);
+		std::vector<uint8_t*> &freeList = m_free[cls];
+		if (!freeList.empty()) {
+			uint8_t *const buf = freeList.back();
+			freeList.pop_back();
+			m_cachedBytes -= class_size[cls];
+			return buf;
+		}
+
+		// Allocate a new buffer for this size class.
+		size = class_size[cls];
+		alignment = POOL_ALIGNMENT_DEFAULT;
+		if (cls == CLASS_2M && m_hugePages) {
+			alignment = class_size[CLASS_2M];
+			hugePages = true;
+		}
+	}
+
+	uint8_t *const buf = static_cast<uint8_t*>(aligned_malloc(alignment, size));
+	if (!buf) {
+		errno = ENOMEM;
+		return nullptr;
+	}
+#if defined(HAVE_MADVISE) && defined(MADV_HUGEPAGE)
+	if (hugePages) {
+		// Failure isn't fatal; the buffer just won't use huge pages.
+		madvise(buf, size, MADV_HUGEPAGE);
+	}
+#else /* !(HAVE_MADVISE && MADV_HUGEPAGE) */
+	UNUSED(hugePages);
+#endif /* HAVE_MADVISE && MADV_HUGEPAGE */
+	return buf;
+}
+
+/**
+ * Return a buffer to the pool.
+ * @param buf		[in] Buffer from alloc().
+ * @param size		[in] Size that was passed to alloc().
+ * @param alignment	[in,opt] Alignment that was passed to alloc().
+ */
+void BufferPool::free(uint8_t *buf, size_t size, size_t alignment)
+{
+	if (!buf) {
+		return;
+	}
+	if (alignment != 0 && alignment < sizeof(void*)) {
+		alignment = sizeof(void*);
+	}
+
+	const int cls = sizeClass(size, alignment);
+	if (cls >= 0) {
+		lock_guard<mutex> lock(m_mutex);
+		std::vector<uint8_t*> &freeList = m_free[cls];
+		if (freeList.size() < m_maxCached &&
+		    (m_maxCachedBytes == 0 || m_cachedBytes + class_size[cls] <= m_maxCachedBytes))
+		{
+			freeList.push_back(buf);
+			m_cachedBytes += class_size[cls];
+			return;
+		}
+	}
+
+	aligned_free(buf);
+}
+
+/**
+ * Release all unused buffers.
+ */
+void BufferPool::trim(void)
+{
+	lock_guard<mutex> lock(m_mutex);
+	for (std::vector<uint8_t*> &freeList : m_free) {
+		for (uint8_t *buf : freeList) {
+			aligned_free(buf);
+		}
+		freeList.clear();
+	}
+	m_cachedBytes = 0;
+}
+
+/**
+ * Should 2 MB buffers be backed by huge pages?
+ * Disabled by default.
+ *
+ * Changing this setting releases the unused 2 MB buffers.
+ *
+ * @param enable True to enable; false to disable.
+ */
+void BufferPool::setHugePages(bool enable)
+{
+	lock_guard<mutex> lock(m_mutex);
+	if (m_hugePages == enable) {
+		return;
+	}
+	m_hugePages = enable;
+
+	std::vector<uint8_t*> &freeList = m_free[CLASS_2M];
+	for (uint8_t *buf : freeList) {
+		aligned_free(buf);
+	}
+	m_cachedBytes -= freeList.size() * class_size[CLASS_2M];
+	freeList.clear();
+}
+
+/**
+ * Set the maximum number of unused buffers to keep per size class.
+ * Excess buffers are released immediately.
+ * @param count Maximum number of unused buffers.
+ */
+void BufferPool::setMaxCached(unsigned int count)
+{
+	lock_guard<mutex> lock(m_mutex);
+	m_maxCached = count;
+	for (int i = 0; i < CLASS_MAX; i++) {
+		std::vector<uint8_t*> &freeList = m_free[i];
+		while (freeList.size() > count) {
+			aligned_free(freeList.back());
+			freeList.pop_back();
+			m_cachedBytes -= class_size[i];
+		}
+	}
+}
+
+/**
+ * Set the maximum total size of unused buffers, in bytes.
+ * Excess buffers are released immediately.
+ * @param bytes Maximum total size of unused buffers. (0 for no limit)
+ */
+void BufferPool::setMaxCachedBytes(size_t bytes)
+{
+	lock_guard<mutex> lock(m_mutex);
+	m_maxCachedBytes = bytes;
+	if (bytes == 0) {
+		return;
+	}
+
+	// Release the larger buffers first.
+	for (int i = CLASS_MAX - 1; i >= 0 && m_cachedBytes > bytes; i--) {
+		std::vector<uint8_t*> &freeList = m_free[i];
+		while (!freeList.empty() && m_cachedBytes > bytes) {
+			aligned_free(freeList.back());
+			freeList.pop_back();
+			m_cachedBytes -= class_size[i];
+		}
+	}
+}
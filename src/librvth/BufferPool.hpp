@@ -0,0 +1,242 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * BufferPool.hpp: Reusable pool of aligned I/O buffers.                   *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#pragma once
+
+#include "common.h"
+
+// C includes
+#include <stddef.h>
+#include <stdint.h>
+
+// C++ includes
+#include <mutex>
+#include <vector>
+
+/**
+ * Reusable pool of aligned I/O buffers.
+ *
+ * Copying, encrypting, and verifying banks use many 1 MB and 2 MB
+ * buffers. Instead of allocating new buffers for every operation,
+ * buffers are returned to a process-wide pool and reused.
+ *
+ * Buffers of up to 1 MB are taken from the 1 MB size class, and
+ * buffers of up to 2 MB are taken from the 2 MB size class. Pooled
+ * buffers are aligned to at least 4 KB. If huge pages are enabled,
+ * the 2 MB buffers are aligned to 2 MB and backed by huge pages
+ * where supported. Larger buffers, and buffers that require a larger
+ * alignment, are allocated directly and are not pooled.
+ *
+ * The pool is thread-safe.
+ */
+class BufferPool
+{
+	protected:
+		BufferPool();
+		~BufferPool();
+
+	private:
+		DISABLE_COPY(BufferPool)
+
+	public:
+		/**
+		 * Get the process-wide buffer pool.
+		 * @return BufferPool
+		 */
+		static BufferPool *instance(void);
+
+	public:
+		/**
+		 * Allocate a buffer.
+		 * The buffer must be freed using free() with the same
+		 * size and alignment.
+		 *
+		 * NOTE: Buffers taken from the pool are not zero-initialized.
+		 *
+		 * @param size		[in] Size, in bytes.
+		 * @param alignment	[in,opt] Minimum alignment. (0 for 4 KB; must be a power of two)
+		 * @return Buffer, or nullptr on error.
+		 */
+		uint8_t *alloc(size_t size, size_t alignment = 0);
+
+		/**
+		 * Return a buffer to the pool.
+		 * @param buf		[in] Buffer from alloc().
+		 * @param size		[in] Size that was passed to alloc().
+		 * @param alignment	[in,opt] Alignment that was passed to alloc().
+		 */
+		void free(uint8_t *buf, size_t size, size_t alignment = 0);
+
+		/**
+		 * Release all unused buffers.
+		 */
+		void trim(void);
+
+		/**
+		 * Should 2 MB buffers be backed by huge pages?
+		 * Disabled by default.
+		 *
+		 * Changing this setting releases the unused 2 MB buffers.
+		 *
+		 * @param enable True to enable; false to disable.
+		 */
+		void setHugePages(bool enable);
+
+		/**
+		 * Are 2 MB buffers backed by huge pages?
+		 * @return True if enabled; false if not.
+		 */
+		inline bool hugePages(void) const
+		{
+			return m_hugePages;
+		}
+
+		/**
+		 * Set the maximum number of unused buffers to keep per size class.
+		 * Excess buffers are released immediately.
+		 * @param count Maximum number of unused buffers.
+		 */
+		void setMaxCached(unsigned int count);
+
+		/**
+		 * Set the maximum total size of unused buffers, in bytes.
+		 * Excess buffers are released immediately.
+		 * @param bytes Maximum total size of unused buffers. (0 for no limit)
+		 */
+		void setMaxCachedBytes(size_t bytes);
+
+	private:
+		/**
+		 * Get the size class for a buffer.
+		 * @param size		[in] Size, in bytes.
+		 * @param alignment	[in] Alignment. (0 for default)
+		 * @return Size class, or -1 if the buffer isn't pooled.
+		 */
+		static int sizeClass(size_t size, size_t alignment);
+
+	private:
+		enum {
+			CLASS_1M,	// 1 MB buffers
+			CLASS_2M,	// 2 MB buffers
+
+			CLASS_MAX
+		};
+
+		std::mutex m_mutex;
+		std::vector<uint8_t*> m_free[CLASS_MAX];	// Unused buffers
+		size_t m_cachedBytes;				// Total size of unused buffers
+		size_t m_maxCachedBytes;			// 0 for no limit
+		unsigned int m_maxCached;
+		bool m_hugePages;
+};
+
+/**
+ * Buffer from the process-wide BufferPool.
+ * The buffer is returned to the pool when this object is destroyed.
+ */
+class PoolBuffer
+{
+	public:
+		PoolBuffer()
+			: m_buf(nullptr)
+			, m_size(0)
+			, m_alignment(0)
+		{ }
+
+		/**
+		 * Allocate a buffer from the pool.
+		 * Check get() or operator bool() for allocation failure.
+		 * @param size		[in] Size, in bytes.
+		 * @param alignment	[in,opt] Minimum alignment. (0 for 4 KB)
+		 */
+		explicit PoolBuffer(size_t size, size_t alignment = 0)
+			: m_buf(nullptr)
+			, m_size(0)
+			, m_alignment(0)
+		{
+			reset(size, alignment);
+		}
+
+		~PoolBuffer()
+		{
+			reset();
+		}
+
+		PoolBuffer(PoolBuffer &&other)
+			: m_buf(other.m_buf)
+			, m_size(other.m_size)
+			, m_alignment(other.m_alignment)
+		{
+			other.m_buf = nullptr;
+		}
+
+		PoolBuffer &operator=(PoolBuffer &&other)
+		{
+			if (this != &other) {
+				reset();
+				m_buf = other.m_buf;
+				m_size = other.m_size;
+				m_alignment = other.m_alignment;
+				other.m_buf = nullptr;
+			}
+			return *this;
+		}
+
+	private:
+		DISABLE_COPY(PoolBuffer)
+
+	public:
+		/**
+		 * Return the current buffer to the pool and
+		 * optionally allocate a new buffer.
+		 * @param size		[in,opt] Size, in bytes. (0 for no buffer)
+		 * @param alignment	[in,opt] Minimum alignment. (0 for 4 KB)
+		 * @return True on success; false if allocation failed.
+		 */
+		bool reset(size_t size = 0, size_t alignment = 0)
+		{
+			if (m_buf) {
+				BufferPool::instance()->free(m_buf, m_size, m_alignment);
+				m_buf = nullptr;
+			}
+			if (size == 0) {
+				return true;
+			}
+
+			m_buf = BufferPool::instance()->alloc(size, alignment);
+			m_size = size;
+			m_alignment = alignment;
+			return (m_buf != nullptr);
+		}
+
+		inline uint8_t *get(void) const
+		{
+			return m_buf;
+		}
+
+		template<typename T>
+		inline T *as(void) const
+		{
+			return reinterpret_cast<T*>(m_buf);
+		}
+
+		inline size_t size(void) const
+		{
+			return (m_buf ? m_size : 0);
+		}
+
+		inline explicit operator bool(void) const
+		{
+			return (m_buf != nullptr);
+		}
+
+	private:
+		uint8_t *m_buf;
+		size_t m_size;
+		size_t m_alignment;
+};
@@ -0,0 +1,67 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * CancelToken.hpp: Cancellation token for RvtH operations.                *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_CANCELTOKEN_HPP__
+#define __RVTHTOOL_LIBRVTH_CANCELTOKEN_HPP__
+
+#include "libwiicrypto/common.h"
+
+// C++ includes
+#include <atomic>
+
+/**
+ * Cancellation token.
+ *
+ * Install the token on an RvtH object using RvtH::setCancelToken(),
+ * then call cancel() from any thread to stop the operation that's
+ * running on that object. The token is checked before each read and
+ * write of the device or disk image file, and before each group is
+ * encrypted or verified, so the operation stops within one I/O request
+ * or group instead of waiting for the next progress callback.
+ */
+class CancelToken
+{
+	public:
+		CancelToken()
+			: m_cancelled(false)
+		{ }
+
+	private:
+		DISABLE_COPY(CancelToken)
+
+	public:
+		/**
+		 * Request cancellation.
+		 */
+		inline void cancel(void)
+		{
+			m_cancelled.store(true, std::memory_order_release);
+		}
+
+		/**
+		 * Has cancellation been requested?
+		 * @return True if cancelled.
+		 */
+		inline bool isCancelled(void) const
+		{
+			return m_cancelled.load(std::memory_order_acquire);
+		}
+
+		/**
+		 * Clear the cancellation request, so the token can be reused.
+		 */
+		inline void reset(void)
+		{
+			m_cancelled.store(false, std::memory_order_release);
+		}
+
+	private:
+		std::atomic<bool> m_cancelled;
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_CANCELTOKEN_HPP__ */
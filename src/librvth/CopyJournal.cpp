@@ -0,0 +1,322 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * CopyJournal.cpp: Progress journals for resumable extract and import.    *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "config.librvth.h"
+
+#include "CopyJournal.hpp"
+#include "cache_dir.hpp"
+#include "StatsCounters.hpp"
+
+// For LBA_TO_BYTES()
+#include "nhcd_structs.h"
+
+// Reader class
+#include "reader/Reader.hpp"
+
+// C includes (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+// C++ includes
+#include <algorithm>
+#include <string>
+#include <vector>
+using std::tstring;
+using std::vector;
+
+// Number of segments that are read back before resuming,
+// including the last segment.
+#define RESUME_SAMPLE_COUNT 4
+
+// Journal file header.
+// NOTE: Everything is stored in host-endian, so the version is
+// checked to reject journals from other builds.
+static const char COPYJNL_MAGIC[8] = {'R','V','T','H','C','J','N','L'};
+static const uint32_t COPYJNL_VERSION = 1;
+typedef struct _CopyJournal_Header {
+	char magic[8];		// COPYJNL_MAGIC
+	uint32_t version;	// COPYJNL_VERSION
+	uint32_t key_size;	// Size of the source key that follows the header, in bytes
+	uint32_t flags;		// Options that affect the destination data
+	uint32_t segment_lba_len;	// CopyJournal::SEGMENT_LBA_LEN
+
+	// Source bank entry.
+	uint32_t lba_start;
+	uint32_t lba_len;
+	int64_t timestamp;
+	uint32_t type;
+	GCN_DiscHeader discHeader;
+
+	uint32_t lba_copy_len;	// Number of LBAs being copied
+	uint32_t seg_count;	// Number of segment digests (durable LBAs == seg_count * segment_lba_len)
+} CopyJournal_Header;
+
+CopyJournal::CopyJournal()
+	: m_entry(nullptr)
+	, m_lba_copy_len(0)
+	, m_flags(0)
+	, m_savedCount(0)
+	, m_segPos(0)
+{
+	sha1_init(&m_sha1);
+}
+
+/**
+ * Get the journal filename for an extracted disc image.
+ * @param image_filename	[in] Disc image filename
+ * @return Journal filename ("<image_filename>.rjnl")
+ */
+tstring CopyJournal::filenameForImage(const TCHAR *image_filename)
+{
+	tstring filename(image_filename);
+	filename += _T(".rjnl");
+	return filename;
+}
+
+/**
+ * Get the journal filename for a bank on an RVT-H Reader or disk image.
+ * The journal is stored in the user's cache directory.
+ * @param f_dest	[in] RefFile* of the RVT-H Reader or disk image
+ * @param bank		[in] Bank number
+ * @return Journal filename, or empty string if the cache directory isn't available.
+ */
+tstring CopyJournal::filenameForBank(RefFile *f_dest, unsigned int bank)
+{
+	tstring key = rvth_get_device_key(f_dest);
+	if (key.empty()) {
+		return key;
+	}
+	TCHAR buf[32];
+	_sntprintf(buf, ARRAY_SIZE(buf), _T(":bank%u"), bank);
+	key += buf;
+	return rvth_get_cache_filename(key, _T(".cjnl"));
+}
+
+/**
+ * Open the journal for a copy.
+ * If a journal exists and it matches the source, it's loaded.
+ * @param filename	[in] Journal filename
+ * @param f_src		[in] RefFile* of the source image
+ * @param bank_src	[in] Source bank number
+ * @param entry_src	[in] Source bank entry
+ * @param lba_copy_len	[in] Number of LBAs that will be copied
+ * @param flags		[in] Options that affect the destination data (must match the journal)
+ */
+void CopyJournal::open(const tstring &filename, RefFile *f_src, unsigned int bank_src,
+	const RvtH_BankEntry *entry_src, uint32_t lba_copy_len, unsigned int flags)
+{
+	m_filename = filename;
+	m_key.clear();
+	m_entry = entry_src;
+	m_lba_copy_len = lba_copy_len;
+	m_flags = flags;
+	m_segments.clear();
+	m_savedCount = 0;
+	sha1_init(&m_sha1);
+	m_segPos = 0;
+
+	if (m_filename.empty()) {
+		return;
+	}
+	m_key = rvth_get_device_key(f_src);
+	if (m_key.empty()) {
+		// The source can't be identified.
+		m_filename.clear();
+		return;
+	}
+	TCHAR buf[32];
+	_sntprintf(buf, ARRAY_SIZE(buf), _T(":bank%u"), bank_src);
+	m_key += buf;
+
+	// Load the existing journal, if it's present.
+	FILE *f = _tfopen(m_filename.c_str(), _T("rb"));
+	if (!f) {
+		return;
+	}
+
+	const uint8_t *const key8 = reinterpret_cast<const uint8_t*>(m_key.data());
+	const size_t key_size = m_key.size() * sizeof(TCHAR);
+
+	CopyJournal_Header header;
+	vector<uint8_t> file_key;
+	vector<uint8_t> segments;
+	bool ok = (fread(&header, 1, sizeof(header), f) == sizeof(header) &&
+		!memcmp(header.magic, COPYJNL_MAGIC, sizeof(header.magic)) &&
+		header.version == COPYJNL_VERSION &&
+		header.key_size == key_size &&
+		header.flags == flags &&
+		header.segment_lba_len == SEGMENT_LBA_LEN &&
+		header.lba_start == entry_src->lba_start &&
+		header.lba_len == entry_src->lba_len &&
+		header.timestamp == static_cast<int64_t>(entry_src->timestamp) &&
+		header.type == entry_src->type &&
+		!memcmp(&header.discHeader, &entry_src->discHeader, sizeof(header.discHeader)) &&
+		header.lba_copy_len == lba_copy_len &&
+		header.seg_count <= lba_copy_len / SEGMENT_LBA_LEN);
+	if (ok) {
+		// Make sure the source key matches in case of hash collisions.
+		file_key.resize(key_size);
+		ok = (fread(file_key.data(), 1, key_size, f) == key_size &&
+			!memcmp(file_key.data(), key8, key_size));
+	}
+	if (ok) {
+		segments.resize(header.seg_count * SHA1_DIGEST_SIZE);
+		ok = (fread(segments.data(), 1, segments.size(), f) == segments.size());
+	}
+	fclose(f);
+
+	if (ok) {
+		m_segments = std::move(segments);
+		m_savedCount = header.seg_count;
+	}
+}
+
+/**
+ * Determine where to resume copying.
+ *
+ * A sample of the journaled segments is read back from the
+ * destination and compared. Segments after the first one
+ * that doesn't match are discarded.
+ *
+ * @param reader_dest	[in] Destination reader
+ * @param buf		[in] Scratch buffer
+ * @param buf_lba_len	[in] Size of buf, in LBAs
+ * @param lba_align	[in] Alignment of the resume point, in LBAs (copy chunk size)
+ * @return LBA to resume copying from. (0 to start over)
+ */
+uint32_t CopyJournal::resume(Reader *reader_dest, uint8_t *buf, uint32_t buf_lba_len, uint32_t lba_align)
+{
+	assert(buf_lba_len > 0);
+	assert(lba_align > 0);
+	size_t seg_count = m_segments.size() / SHA1_DIGEST_SIZE;
+
+	// Compare the sampled segments in order, always including the
+	// last one, since it's the most likely to be incomplete.
+	for (unsigned int i = 0; i < RESUME_SAMPLE_COUNT && seg_count > 0; i++) {
+		const size_t seg = (seg_count - 1) * i / (RESUME_SAMPLE_COUNT - 1);
+		if (i > 0 && seg == (seg_count - 1) * (i - 1) / (RESUME_SAMPLE_COUNT - 1)) {
+			// Already checked.
+			continue;
+		}
+
+		struct sha1_ctx sha1;
+		sha1_init(&sha1);
+		const uint32_t lba_seg = static_cast<uint32_t>(seg) * SEGMENT_LBA_LEN;
+		bool ok = true;
+		for (uint32_t lba = 0; lba < SEGMENT_LBA_LEN && ok; lba += buf_lba_len) {
+			const uint32_t lba_len = std::min(buf_lba_len, SEGMENT_LBA_LEN - lba);
+			errno = 0;
+			ok = (reader_dest->read(buf, lba_seg + lba, lba_len) == lba_len);
+			if (ok) {
+				StatsTimer timer(StatsCounters::TIMER_SHA1);
+				sha1_update(&sha1, LBA_TO_BYTES(lba_len), buf);
+			}
+		}
+		uint8_t digest[SHA1_DIGEST_SIZE];
+		sha1_digest(&sha1, sizeof(digest), digest);
+		if (!ok || memcmp(digest, &m_segments[seg * SHA1_DIGEST_SIZE], sizeof(digest)) != 0) {
+			// Resume at this segment.
+			seg_count = seg;
+			break;
+		}
+	}
+
+	// The resume point must be aligned to the copy chunk size.
+	while (seg_count > 0 && (seg_count * SEGMENT_LBA_LEN) % lba_align != 0) {
+		seg_count--;
+	}
+
+	m_segments.resize(seg_count * SHA1_DIGEST_SIZE);
+	m_savedCount = std::min(m_savedCount, seg_count);
+	sha1_init(&m_sha1);
+	m_segPos = 0;
+	return static_cast<uint32_t>(seg_count) * SEGMENT_LBA_LEN;
+}
+
+/**
+ * Add data that was written to the destination.
+ * Data must be added in order, starting at the resume point.
+ * @param data	[in] Data
+ * @param size	[in] Size of data, in bytes
+ */
+void CopyJournal::update(const uint8_t *data, size_t size)
+{
+	static const uint64_t seg_size = LBA_TO_BYTES(static_cast<uint64_t>(SEGMENT_LBA_LEN));
+
+	StatsTimer timer(StatsCounters::TIMER_SHA1);
+	while (size > 0) {
+		const size_t len = static_cast<size_t>(std::min<uint64_t>(size, seg_size - m_segPos));
+		sha1_update(&m_sha1, len, data);
+		m_segPos += len;
+		data += len;
+		size -= len;
+
+		if (m_segPos == seg_size) {
+			// Segment is complete.
+			const size_t pos = m_segments.size();
+			m_segments.resize(pos + SHA1_DIGEST_SIZE);
+			sha1_digest(&m_sha1, SHA1_DIGEST_SIZE, &m_segments[pos]);
+			m_segPos = 0;
+		}
+	}
+}
+
+/**
+ * Save the journal.
+ * The destination must be flushed first, since the
+ * completed segments are recorded as durable.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int CopyJournal::save(void)
+{
+	if (m_filename.empty() || !m_entry) {
+		return -ENOENT;
+	}
+
+	CopyJournal_Header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, COPYJNL_MAGIC, sizeof(header.magic));
+	header.version = COPYJNL_VERSION;
+	header.key_size = static_cast<uint32_t>(m_key.size() * sizeof(TCHAR));
+	header.flags = m_flags;
+	header.segment_lba_len = SEGMENT_LBA_LEN;
+	header.lba_start = m_entry->lba_start;
+	header.lba_len = m_entry->lba_len;
+	header.timestamp = static_cast<int64_t>(m_entry->timestamp);
+	header.type = m_entry->type;
+	memcpy(&header.discHeader, &m_entry->discHeader, sizeof(header.discHeader));
+	header.lba_copy_len = m_lba_copy_len;
+	header.seg_count = static_cast<uint32_t>(m_segments.size() / SHA1_DIGEST_SIZE);
+
+	vector<uint8_t> data;
+	data.reserve(sizeof(header) + header.key_size + m_segments.size());
+	const uint8_t *const p_header = reinterpret_cast<const uint8_t*>(&header);
+	const uint8_t *const p_key = reinterpret_cast<const uint8_t*>(m_key.data());
+	data.insert(data.end(), p_header, p_header + sizeof(header));
+	data.insert(data.end(), p_key, p_key + header.key_size);
+	data.insert(data.end(), m_segments.begin(), m_segments.end());
+
+	const int ret = rvth_write_cache_file(m_filename, data.data(), data.size());
+	if (ret == 0) {
+		m_savedCount = header.seg_count;
+	}
+	return ret;
+}
+
+/**
+ * Delete the journal file.
+ * This should be done once the copy has finished.
+ */
+void CopyJournal::remove(void)
+{
+	if (!m_filename.empty()) {
+		::_tremove(m_filename.c_str());
+	}
+}
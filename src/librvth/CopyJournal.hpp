@@ -0,0 +1,154 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * CopyJournal.hpp: Progress journals for resumable extract and import.    *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#pragma once
+
+#include "rvth.hpp"
+#include "tcharx.h"
+
+// C includes
+#include <stdint.h>
+
+// nettle
+#include <nettle/sha1.h>
+
+// C++ includes
+#include <string>
+#include <vector>
+
+class RefFile;
+class Reader;
+
+/**
+ * Progress journal for resumable copies.
+ *
+ * Importing a dual-layer image to an RVT-H Reader over USB 2.0 takes a
+ * long time, and if the copy fails near the end, it has to be restarted
+ * from the beginning. The journal records how much of the destination
+ * has been written and flushed, along with the SHA-1 of each 64 MB
+ * segment of the data that was written, so a later copy can resume.
+ *
+ * A journal is only used if the source bank and the options that affect
+ * the destination data are unchanged. Before resuming, a few of the
+ * recorded segments are read back from the destination and compared,
+ * including the last one. The copy resumes at the first segment that
+ * doesn't match.
+ */
+class CopyJournal
+{
+	public:
+		CopyJournal();
+
+	private:
+		DISABLE_COPY(CopyJournal)
+
+	public:
+		// Segment size, in LBAs. (64 MB)
+		static const uint32_t SEGMENT_LBA_LEN = 64U * 1024U * 1024U / 512U;
+
+		/**
+		 * Get the journal filename for an extracted disc image.
+		 * @param image_filename	[in] Disc image filename
+		 * @return Journal filename ("<image_filename>.rjnl")
+		 */
+		static std::tstring filenameForImage(const TCHAR *image_filename);
+
+		/**
+		 * Get the journal filename for a bank on an RVT-H Reader or disk image.
+		 * The journal is stored in the user's cache directory.
+		 * @param f_dest	[in] RefFile* of the RVT-H Reader or disk image
+		 * @param bank		[in] Bank number
+		 * @return Journal filename, or empty string if the cache directory isn't available.
+		 */
+		static std::tstring filenameForBank(RefFile *f_dest, unsigned int bank);
+
+		/**
+		 * Open the journal for a copy.
+		 * If a journal exists and it matches the source, it's loaded.
+		 * @param filename	[in] Journal filename
+		 * @param f_src		[in] RefFile* of the source image
+		 * @param bank_src	[in] Source bank number
+		 * @param entry_src	[in] Source bank entry
+		 * @param lba_copy_len	[in] Number of LBAs that will be copied
+		 * @param flags		[in] Options that affect the destination data (must match the journal)
+		 */
+		void open(const std::tstring &filename, RefFile *f_src, unsigned int bank_src,
+			const RvtH_BankEntry *entry_src, uint32_t lba_copy_len, unsigned int flags);
+
+		/**
+		 * Was an existing journal loaded?
+		 * @return True if the copy can be resumed.
+		 */
+		inline bool isResumable(void) const
+		{
+			return !m_segments.empty();
+		}
+
+		/**
+		 * Determine where to resume copying.
+		 *
+		 * A sample of the journaled segments is read back from the
+		 * destination and compared. Segments after the first one
+		 * that doesn't match are discarded.
+		 *
+		 * @param reader_dest	[in] Destination reader
+		 * @param buf		[in] Scratch buffer
+		 * @param buf_lba_len	[in] Size of buf, in LBAs
+		 * @param lba_align	[in] Alignment of the resume point, in LBAs (copy chunk size)
+		 * @return LBA to resume copying from. (0 to start over)
+		 */
+		uint32_t resume(Reader *reader_dest, uint8_t *buf, uint32_t buf_lba_len, uint32_t lba_align);
+
+		/**
+		 * Add data that was written to the destination.
+		 * Data must be added in order, starting at the resume point.
+		 * @param data	[in] Data
+		 * @param size	[in] Size of data, in bytes
+		 */
+		void update(const uint8_t *data, size_t size);
+
+		/**
+		 * Have any segments been completed since the journal was last saved?
+		 * @return True if the journal should be saved.
+		 */
+		inline bool isDirty(void) const
+		{
+			return (m_segments.size() / SHA1_DIGEST_SIZE) > m_savedCount;
+		}
+
+		/**
+		 * Save the journal.
+		 * The destination must be flushed first, since the
+		 * completed segments are recorded as durable.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int save(void);
+
+		/**
+		 * Delete the journal file.
+		 * This should be done once the copy has finished.
+		 */
+		void remove(void);
+
+	private:
+		std::tstring m_filename;	// Journal filename (empty if unavailable)
+		std::tstring m_key;		// Source device key, plus the bank number
+
+		// Source bank entry and copy parameters. (key)
+		const RvtH_BankEntry *m_entry;
+		uint32_t m_lba_copy_len;
+		unsigned int m_flags;
+
+		// SHA-1 of each completed segment.
+		std::vector<uint8_t> m_segments;
+		size_t m_savedCount;	// Number of segments in the journal file
+
+		// Current segment.
+		struct sha1_ctx m_sha1;
+		uint64_t m_segPos;	// Bytes added to the current segment
+};
@@ -0,0 +1,383 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * DatIndex.cpp: Hash index of a redump-style DAT file.                    *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "DatIndex.hpp"
+
+// C includes (C++ namespace)
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// C++ includes
+#include <string>
+using std::string;
+
+DatIndex::DatIndex()
+{ }
+
+/**
+ * Get the index key of a SHA-1.
+ * @param sha1 SHA-1
+ * @return Index key
+ */
+static inline uint64_t sha1_key(const uint8_t *sha1)
+{
+	uint64_t key;
+	memcpy(&key, sha1, sizeof(key));
+	return key;
+}
+
+/**
+ * Find an XML tag.
+ * @param p	[in] Start of the search
+ * @param end	[in,opt] End of the search, or nullptr to search until the end of the string
+ * @param name	[in] Tag name
+ * @return Pointer to the '<', or nullptr if not found.
+ */
+static const char *find_tag(const char *p, const char *end, const char *name)
+{
+	const size_t len = strlen(name);
+	while ((p = strchr(p, '<')) != nullptr && (!end || p < end)) {
+		if (!strncmp(p + 1, name, len)) {
+			const char c = p[1 + len];
+			if (c == '>' || c == '/' || c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+				return p;
+			}
+		}
+		p++;
+	}
+	return nullptr;
+}
+
+/**
+ * Decode XML entities in a string.
+ * @param p	[in] Start of the string
+ * @param end	[in] End of the string
+ * @return Decoded string.
+ */
+static string xml_decode(const char *p, const char *end)
+{
+	static const struct {
+		const char *entity;
+		char c;
+	} entities[] = {
+		{"&amp;", '&'}, {"&lt;", '<'}, {"&gt;", '>'},
+		{"&quot;", '"'}, {"&apos;", '\''},
+	};
+
+	string str;
+	str.reserve(end - p);
+	while (p < end) {
+		if (*p != '&') {
+			str += *p++;
+			continue;
+		}
+
+		bool found = false;
+		for (const auto &e : entities) {
+			const size_t len = strlen(e.entity);
+			if (static_cast<size_t>(end - p) >= len && !strncmp(p, e.entity, len)) {
+				str += e.c;
+				p += len;
+				found = true;
+				break;
+			}
+		}
+		if (!found && end - p > 2 && p[1] == '#') {
+			// Numeric character reference. Encoded as UTF-8.
+			char *num_end;
+			const bool hex = (p[2] == 'x' || p[2] == 'X');
+			const unsigned long cp = strtoul(p + (hex ? 3 : 2), &num_end, hex ? 16 : 10);
+			if (num_end < end && *num_end == ';' && cp > 0 && cp <= 0x10FFFF) {
+				if (cp < 0x80) {
+					str += static_cast<char>(cp);
+				} else if (cp < 0x800) {
+					str += static_cast<char>(0xC0 | (cp >> 6));
+					str += static_cast<char>(0x80 | (cp & 0x3F));
+				} else if (cp < 0x10000) {
+					str += static_cast<char>(0xE0 | (cp >> 12));
+					str += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+					str += static_cast<char>(0x80 | (cp & 0x3F));
+				} else {
+					str += static_cast<char>(0xF0 | (cp >> 18));
+					str += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+					str += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+					str += static_cast<char>(0x80 | (cp & 0x3F));
+				}
+				p = num_end + 1;
+				found = true;
+			}
+		}
+		if (!found) {
+			// Not a valid entity. Copy it as-is.
+			str += *p++;
+		}
+	}
+	return str;
+}
+
+/**
+ * Get an attribute from an XML tag.
+ * @param tag		[in] Start of the tag
+ * @param tag_end	[in] End of the tag
+ * @param name		[in] Attribute name
+ * @param value		[out] Attribute value
+ * @return True if the attribute was found; false if not.
+ */
+static bool get_attr(const char *tag, const char *tag_end, const char *name, string &value)
+{
+	const size_t len = strlen(name);
+	for (const char *p = tag; p + len < tag_end; p++) {
+		if ((*p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') ||
+		    strncmp(p + 1, name, len) != 0)
+		{
+			continue;
+		}
+
+		const char *q = p + 1 + len;
+		while (q < tag_end && (*q == ' ' || *q == '\t')) q++;
+		if (q >= tag_end || *q != '=') {
+			continue;
+		}
+		q++;
+		while (q < tag_end && (*q == ' ' || *q == '\t')) q++;
+		if (q >= tag_end || (*q != '"' && *q != '\'')) {
+			continue;
+		}
+
+		const char quote = *q++;
+		const char *const val_end = static_cast<const char*>(memchr(q, quote, tag_end - q));
+		if (!val_end) {
+			return false;
+		}
+		value = xml_decode(q, val_end);
+		return true;
+	}
+	return false;
+}
+
+/**
+ * Parse a hexadecimal string.
+ * @param str	[in] Hexadecimal string
+ * @param out	[out] Output buffer
+ * @param len	[in] Length of the output buffer, in bytes (the string must be exactly twice as long)
+ * @return True on success; false if the string isn't valid.
+ */
+static bool parse_hex(const string &str, uint8_t *out, size_t len)
+{
+	if (str.size() != len * 2) {
+		return false;
+	}
+	for (size_t i = 0; i < len; i++) {
+		uint8_t b = 0;
+		for (unsigned int j = 0; j < 2; j++) {
+			const char c = str[i*2 + j];
+			b <<= 4;
+			if (c >= '0' && c <= '9') {
+				b |= (c - '0');
+			} else if (c >= 'a' && c <= 'f') {
+				b |= (c - 'a' + 10);
+			} else if (c >= 'A' && c <= 'F') {
+				b |= (c - 'A' + 10);
+			} else {
+				return false;
+			}
+		}
+		out[i] = b;
+	}
+	return true;
+}
+
+/**
+ * Add a string to the string pool.
+ * @param str	[in] String
+ * @return Offset of the string in the pool.
+ */
+uint32_t DatIndex::addString(const string &str)
+{
+	const uint32_t offset = static_cast<uint32_t>(m_strings.size());
+	m_strings.insert(m_strings.end(), str.c_str(), str.c_str() + str.size() + 1);
+	return offset;
+}
+
+/**
+ * Parse a DAT file.
+ * @param data	[in] DAT file contents (NULL-terminated)
+ */
+void DatIndex::parse(const char *data)
+{
+	string value;
+
+	// DAT name.
+	const char *header = find_tag(data, nullptr, "header");
+	if (header) {
+		const char *const header_end = strstr(header, "</header>");
+		const char *name = find_tag(header, header_end, "name");
+		if (name) {
+			name = strchr(name, '>');
+			const char *const name_end = (name ? strstr(name, "</name>") : nullptr);
+			if (name_end && (!header_end || name_end < header_end)) {
+				m_name = xml_decode(name + 1, name_end);
+			}
+		}
+	}
+
+	const char *game = data;
+	while ((game = find_tag(game, nullptr, "game")) != nullptr) {
+		const char *const game_tag_end = strchr(game, '>');
+		if (!game_tag_end) {
+			break;
+		}
+		const char *game_end = strstr(game_tag_end, "</game>");
+		if (!game_end) {
+			game_end = game_tag_end + strlen(game_tag_end);
+		}
+
+		// The title is only added to the string pool if
+		// the game has at least one usable ROM entry.
+		string title;
+		get_attr(game, game_tag_end, "name", title);
+		uint32_t title_offset = ~0U;
+
+		const char *rom = game_tag_end;
+		while ((rom = find_tag(rom, game_end, "rom")) != nullptr) {
+			const char *const rom_tag_end = strchr(rom, '>');
+			if (!rom_tag_end || rom_tag_end > game_end) {
+				break;
+			}
+
+			Entry entry;
+			entry.has_sha1 = (get_attr(rom, rom_tag_end, "sha1", value) &&
+				parse_hex(value, entry.sha1, sizeof(entry.sha1)));
+			uint8_t crc32[4];
+			const bool has_crc32 = (get_attr(rom, rom_tag_end, "crc", value) &&
+				parse_hex(value, crc32, sizeof(crc32)));
+			if (!entry.has_sha1 && !has_crc32) {
+				// No usable digests.
+				rom = rom_tag_end;
+				continue;
+			}
+			entry.crc32 = (has_crc32
+				? ((crc32[0] << 24) | (crc32[1] << 16) | (crc32[2] << 8) | crc32[3])
+				: 0);
+			entry.size = (get_attr(rom, rom_tag_end, "size", value)
+				? strtoull(value.c_str(), nullptr, 10)
+				: 0);
+
+			if (title_offset == ~0U) {
+				title_offset = addString(title);
+			}
+			entry.title = title_offset;
+			entry.rom_name = addString(get_attr(rom, rom_tag_end, "name", value) ? value : string());
+
+			const uint32_t idx = static_cast<uint32_t>(m_entries.size());
+			if (entry.has_sha1) {
+				m_bySha1.emplace(sha1_key(entry.sha1), idx);
+			}
+			if (has_crc32) {
+				m_byCrc32.emplace(entry.crc32, idx);
+			}
+			m_entries.push_back(entry);
+			rom = rom_tag_end;
+		}
+
+		game = game_end;
+	}
+}
+
+/**
+ * Load a DAT file.
+ * Any previously loaded entries are discarded.
+ * @param filename	[in] DAT filename
+ * @return 0 on success; negative POSIX error code on error. (-EBADMSG if the file has no ROM entries)
+ */
+int DatIndex::load(const TCHAR *filename)
+{
+	m_name.clear();
+	m_entries.clear();
+	m_strings.clear();
+	m_bySha1.clear();
+	m_byCrc32.clear();
+
+	errno = 0;
+	FILE *f = _tfopen(filename, _T("rb"));
+	if (!f) {
+		int err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		return -err;
+	}
+
+	// Read the entire file.
+	string data;
+	char buf[65536];
+	size_t size;
+	while ((size = fread(buf, 1, sizeof(buf), f)) > 0) {
+		data.append(buf, size);
+	}
+	const bool read_error = (ferror(f) != 0);
+	fclose(f);
+	if (read_error) {
+		errno = EIO;
+		return -EIO;
+	}
+
+	parse(data.c_str());
+	if (m_entries.empty()) {
+		// Not a DAT file, or no ROM entries with digests.
+		errno = EBADMSG;
+		return -EBADMSG;
+	}
+	return 0;
+}
+
+/**
+ * Find the DAT entry for a disc image.
+ * Entries with a SHA-1 are matched using the SHA-1.
+ * Entries without one are matched using the CRC32 and size.
+ * @param digests	[in] Disc image digests
+ * @param size		[in] Disc image size, in bytes
+ * @param pMatch	[out,opt] Matched DAT entry
+ * @return Match type.
+ */
+DatIndex::MatchType DatIndex::find(const RvtH_Image_Digests *digests, uint64_t size, Match *pMatch) const
+{
+	const Entry *found = nullptr;
+	MatchType type = MATCH_NONE;
+
+	auto range = m_bySha1.equal_range(sha1_key(digests->sha1));
+	for (auto iter = range.first; iter != range.second; ++iter) {
+		const Entry &entry = m_entries[iter->second];
+		if (!memcmp(entry.sha1, digests->sha1, sizeof(entry.sha1))) {
+			found = &entry;
+			type = MATCH_SHA1;
+			break;
+		}
+	}
+
+	if (!found) {
+		auto range = m_byCrc32.equal_range(digests->crc32);
+		for (auto iter = range.first; iter != range.second; ++iter) {
+			const Entry &entry = m_entries[iter->second];
+			if (!entry.has_sha1 && (entry.size == 0 || entry.size == size)) {
+				found = &entry;
+				type = MATCH_CRC32;
+				break;
+			}
+		}
+	}
+
+	if (found && pMatch) {
+		pMatch->title = &m_strings[found->title];
+		pMatch->rom_name = &m_strings[found->rom_name];
+		pMatch->size = found->size;
+	}
+	return type;
+}
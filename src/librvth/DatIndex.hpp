@@ -0,0 +1,125 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * DatIndex.hpp: Hash index of a redump-style DAT file.                    *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_DATINDEX_HPP__
+#define __RVTHTOOL_LIBRVTH_DATINDEX_HPP__
+
+#include "rvth.hpp"
+#include "tcharx.h"
+
+// C includes
+#include <stddef.h>
+#include <stdint.h>
+
+// C++ includes
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Hash index of a redump-style (Logiqx XML) DAT file.
+ *
+ * Each <rom> entry is indexed by its SHA-1 and its CRC32, so the
+ * digests calculated while extracting, importing, or identifying
+ * a bank can be matched to a title without searching the DAT.
+ * Titles and ROM names are stored in a single string pool.
+ */
+class DatIndex
+{
+	public:
+		DatIndex();
+
+	private:
+		DISABLE_COPY(DatIndex)
+
+	public:
+		enum MatchType {
+			MATCH_NONE,	// No match
+			MATCH_CRC32,	// CRC32 and size match (DAT entry has no SHA-1)
+			MATCH_SHA1,	// SHA-1 matches
+		};
+
+		// Matched DAT entry.
+		struct Match {
+			const char *title;	// Game name
+			const char *rom_name;	// ROM filename
+			uint64_t size;		// ROM size, in bytes (0 if not specified)
+		};
+
+		/**
+		 * Load a DAT file.
+		 * Any previously loaded entries are discarded.
+		 * @param filename	[in] DAT filename
+		 * @return 0 on success; negative POSIX error code on error. (-EBADMSG if the file has no ROM entries)
+		 */
+		int load(const TCHAR *filename);
+
+		/**
+		 * Get the DAT name from the DAT header.
+		 * @return DAT name, or an empty string if not specified.
+		 */
+		inline const char *name(void) const
+		{
+			return m_name.c_str();
+		}
+
+		/**
+		 * Get the number of indexed ROM entries.
+		 * @return Number of ROM entries.
+		 */
+		inline size_t size(void) const
+		{
+			return m_entries.size();
+		}
+
+		/**
+		 * Find the DAT entry for a disc image.
+		 * Entries with a SHA-1 are matched using the SHA-1.
+		 * Entries without one are matched using the CRC32 and size.
+		 * @param digests	[in] Disc image digests
+		 * @param size		[in] Disc image size, in bytes
+		 * @param pMatch	[out,opt] Matched DAT entry
+		 * @return Match type.
+		 */
+		MatchType find(const RvtH_Image_Digests *digests, uint64_t size, Match *pMatch) const;
+
+	private:
+		/**
+		 * Parse a DAT file.
+		 * @param data	[in] DAT file contents (NULL-terminated)
+		 */
+		void parse(const char *data);
+
+		/**
+		 * Add a string to the string pool.
+		 * @param str	[in] String
+		 * @return Offset of the string in the pool.
+		 */
+		uint32_t addString(const std::string &str);
+
+	private:
+		struct Entry {
+			uint8_t sha1[20];
+			bool has_sha1;
+			uint32_t crc32;
+			uint64_t size;
+			uint32_t title;		// Offset in m_strings
+			uint32_t rom_name;	// Offset in m_strings
+		};
+
+		std::string m_name;		// DAT name
+		std::vector<Entry> m_entries;
+		std::vector<char> m_strings;	// String pool (NULL-terminated strings)
+
+		// Entry indexes. The SHA-1 index is keyed
+		// by the first 8 bytes of the SHA-1.
+		std::unordered_multimap<uint64_t, uint32_t> m_bySha1;
+		std::unordered_multimap<uint32_t, uint32_t> m_byCrc32;
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_DATINDEX_HPP__ */
@@ -0,0 +1,238 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * DeviceReconnect.cpp: Reopen RVT-H Readers after USB disconnects.        *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "config.librvth.h"
+
+#include "DeviceReconnect.hpp"
+
+// C includes (C++ namespace)
+#include <cerrno>
+#include <cstdlib>
+
+// C++ includes
+#include <chrono>
+#include <memory>
+#include <thread>
+using std::tstring;
+using std::unique_ptr;
+
+// Interval between device scans while waiting for a reconnect.
+#define RECONNECT_POLL_MS 250
+
+// Maximum number of times an operation is run again after reconnecting.
+#define RECONNECT_MAX_ATTEMPTS 16
+
+/**
+ * Start watching for the RVT-H Reader to be reconnected.
+ * @param device_name	[in] Device name
+ */
+DeviceReconnect::DeviceReconnect(const TCHAR *device_name)
+	: m_listener(nullptr)
+	, m_name(device_name)
+	, m_disconnected(false)
+{
+#ifdef HAVE_QUERY
+	TCHAR *const serial = rvth_get_device_serial_number(device_name, nullptr);
+	if (!serial) {
+		// Not an RVT-H Reader device.
+		return;
+	}
+	m_serial = serial;
+	free(serial);
+
+	// NOTE: If the listener isn't available, disconnects are
+	// detected by scanning for the device's serial number.
+	m_listener = rvth_listen_for_devices_fd(listenerCallback, this);
+#endif /* HAVE_QUERY */
+}
+
+DeviceReconnect::~DeviceReconnect()
+{
+#ifdef HAVE_QUERY
+	if (m_listener) {
+		rvth_listener_stop(m_listener);
+	}
+#endif /* HAVE_QUERY */
+}
+
+/**
+ * Find the device by its serial number.
+ * @param pName	[out] Device name
+ * @return True if the device is connected and readable.
+ */
+bool DeviceReconnect::findDevice(tstring *pName) const
+{
+#ifdef HAVE_QUERY
+	RvtH_QueryEntry *const devs = rvth_query_devices(nullptr);
+	bool found = false;
+	for (const RvtH_QueryEntry *entry = devs; entry != nullptr; entry = entry->next) {
+		if (!entry->device_name || !entry->usb_serial || m_serial != entry->usb_serial) {
+			continue;
+		}
+#ifndef _WIN32
+		if (!entry->is_readable) {
+			// Permissions might not have been set up yet.
+			continue;
+		}
+#endif /* !_WIN32 */
+		*pName = entry->device_name;
+		found = true;
+		break;
+	}
+	rvth_query_free(devs);
+	return found;
+#else /* !HAVE_QUERY */
+	((void)pName);
+	return false;
+#endif /* HAVE_QUERY */
+}
+
+/**
+ * Process pending device events.
+ */
+void DeviceReconnect::processEvents(void)
+{
+#ifdef HAVE_QUERY
+	if (m_listener) {
+		rvth_listener_process_events(m_listener);
+	}
+#endif /* HAVE_QUERY */
+}
+
+/**
+ * Device listener callback.
+ * @param listener	[in] Listener
+ * @param entry		[in] Device that was added or removed
+ * @param state		[in] Device state
+ * @param userdata	[in] DeviceReconnect*
+ */
+void DeviceReconnect::listenerCallback(RvtH_ListenForDevices *listener,
+	const RvtH_QueryEntry *entry, RvtH_Listen_State_e state, void *userdata)
+{
+	((void)listener);
+	DeviceReconnect *const d = static_cast<DeviceReconnect*>(userdata);
+	if (!entry->device_name) {
+		return;
+	}
+
+	switch (state) {
+		case RVTH_LISTEN_DISCONNECTED:
+			// Only the device name is available.
+			if (d->m_name == entry->device_name) {
+				d->m_disconnected = true;
+			}
+			break;
+		case RVTH_LISTEN_CONNECTED:
+			if (entry->usb_serial && d->m_serial == entry->usb_serial) {
+				d->m_name = entry->device_name;
+				d->m_disconnected = false;
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+/**
+ * Was an error caused by the device being disconnected?
+ * @param err	[in] Error code (negative POSIX or RvtH_Errors)
+ * @return True if the device was disconnected.
+ */
+bool DeviceReconnect::isDisconnected(int err)
+{
+	if (!isEnabled()) {
+		return false;
+	}
+	switch (err) {
+		case -EIO:
+		case -ENODEV:
+		case -ENXIO:
+		case -ENOENT:
+			break;
+		default:
+			// Not an I/O error.
+			return false;
+	}
+
+	processEvents();
+	if (m_disconnected) {
+		return true;
+	}
+
+	// If the device is missing or it was reconnected with a different
+	// name before the listener reported it, it was disconnected.
+	tstring name;
+	return (!findDevice(&name) || name != m_name);
+}
+
+/**
+ * Wait for the device to be reconnected.
+ * @param timeout_ms	[in] Timeout, in milliseconds
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int DeviceReconnect::waitForReconnect(unsigned int timeout_ms)
+{
+	if (!isEnabled()) {
+		return -ENOTSUP;
+	}
+
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+	while (true) {
+		processEvents();
+
+		// If a disconnect was reported for the current name, the old
+		// device node may still be listed until it's removed, so the
+		// device has to be reported as connected again first.
+		tstring name;
+		if (findDevice(&name) && (!m_disconnected || name != m_name)) {
+			m_name = std::move(name);
+			m_disconnected = false;
+			return 0;
+		}
+
+		if (std::chrono::steady_clock::now() >= deadline) {
+			return -ETIMEDOUT;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(RECONNECT_POLL_MS));
+	}
+}
+
+/**
+ * Open the device and run an operation. If it fails because
+ * the device was disconnected, wait for the device to be
+ * reconnected, then reopen it and run the operation again.
+ *
+ * If reconnecting isn't enabled, the operation is only run once.
+ *
+ * @param fn		[in] Operation function
+ * @param timeout_ms	[in] Reconnect timeout, in milliseconds
+ * @return Error code from the last attempt, or from opening the device.
+ */
+int DeviceReconnect::run(const OperationFn &fn, unsigned int timeout_ms)
+{
+	int ret;
+	for (unsigned int attempt = 0; ; attempt++) {
+		unique_ptr<RvtH> rvth(new RvtH(m_name.c_str(), &ret));
+		if (ret == 0 && !rvth->isOpen()) {
+			ret = -EIO;
+		}
+		if (ret == 0) {
+			ret = fn(rvth.get(), attempt);
+		}
+		rvth.reset();
+
+		if (ret == 0 || attempt >= RECONNECT_MAX_ATTEMPTS || !isDisconnected(ret)) {
+			break;
+		}
+		if (waitForReconnect(timeout_ms) != 0) {
+			// The device didn't come back.
+			break;
+		}
+	}
+	return ret;
+}
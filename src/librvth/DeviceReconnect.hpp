@@ -0,0 +1,138 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * DeviceReconnect.hpp: Reopen RVT-H Readers after USB disconnects.        *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_DEVICERECONNECT_HPP__
+#define __RVTHTOOL_LIBRVTH_DEVICERECONNECT_HPP__
+
+#include "rvth.hpp"
+#include "query.h"
+#include "tcharx.h"
+
+// C++ includes
+#include <functional>
+#include <string>
+
+/**
+ * Reconnect handling for RVT-H Readers.
+ *
+ * RVT-H Readers on long USB cables occasionally disconnect and
+ * re-enumerate, possibly with a different device name, and every
+ * in-flight operation fails. The device is identified by its USB
+ * serial number, so when it reappears, it can be reopened and the
+ * operation can be run again. Operations that were started with
+ * RVTH_EXTRACT_RESUME, RVTH_IMPORT_RESUME, or RVTH_VERIFY_CHECKPOINT
+ * continue from their last checkpoint, since the journals and
+ * checkpoints are keyed by the serial number, not the device name.
+ *
+ * Reconnecting is only available for RVT-H Reader devices with
+ * a serial number, and only if device querying is supported.
+ *
+ * NOTE: Device events are processed by the thread that calls
+ * isDisconnected() and waitForReconnect(), so an instance must
+ * only be used by one thread.
+ */
+class DeviceReconnect
+{
+	public:
+		/**
+		 * Start watching for the RVT-H Reader to be reconnected.
+		 * @param device_name	[in] Device name
+		 */
+		explicit DeviceReconnect(const TCHAR *device_name);
+		~DeviceReconnect();
+
+	private:
+		DISABLE_COPY(DeviceReconnect)
+
+	public:
+		/**
+		 * Can the device be reopened if it's disconnected?
+		 * @return True if the device has a serial number.
+		 */
+		inline bool isEnabled(void) const
+		{
+			return !m_serial.empty();
+		}
+
+		/**
+		 * Get the current device name.
+		 * This changes if the device is reconnected with a different name.
+		 * @return Device name
+		 */
+		inline const std::tstring &deviceName(void) const
+		{
+			return m_name;
+		}
+
+		/**
+		 * Was an error caused by the device being disconnected?
+		 * @param err	[in] Error code (negative POSIX or RvtH_Errors)
+		 * @return True if the device was disconnected.
+		 */
+		bool isDisconnected(int err);
+
+		/**
+		 * Wait for the device to be reconnected.
+		 * @param timeout_ms	[in] Timeout, in milliseconds
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int waitForReconnect(unsigned int timeout_ms);
+
+		/**
+		 * Operation function for run().
+		 * @param rvth		[in] RvtH, opened on the current device name
+		 * @param attempt	[in] Attempt number (0 for the first attempt)
+		 * @return Error code (negative POSIX or RvtH_Errors)
+		 */
+		typedef std::function<int(RvtH *rvth, unsigned int attempt)> OperationFn;
+
+		/**
+		 * Open the device and run an operation. If it fails because
+		 * the device was disconnected, wait for the device to be
+		 * reconnected, then reopen it and run the operation again.
+		 *
+		 * If reconnecting isn't enabled, the operation is only run once.
+		 *
+		 * @param fn		[in] Operation function
+		 * @param timeout_ms	[in] Reconnect timeout, in milliseconds
+		 * @return Error code from the last attempt, or from opening the device.
+		 */
+		int run(const OperationFn &fn, unsigned int timeout_ms);
+
+	private:
+		/**
+		 * Find the device by its serial number.
+		 * @param pName	[out] Device name
+		 * @return True if the device is connected and readable.
+		 */
+		bool findDevice(std::tstring *pName) const;
+
+		/**
+		 * Process pending device events.
+		 */
+		void processEvents(void);
+
+		/**
+		 * Device listener callback.
+		 * @param listener	[in] Listener
+		 * @param entry		[in] Device that was added or removed
+		 * @param state		[in] Device state
+		 * @param userdata	[in] DeviceReconnect*
+		 */
+		static void listenerCallback(RvtH_ListenForDevices *listener,
+			const RvtH_QueryEntry *entry, RvtH_Listen_State_e state, void *userdata);
+
+	private:
+		std::tstring m_serial;		// USB serial number (empty if unavailable)
+		RvtH_ListenForDevices *m_listener;	// Device listener (nullptr if unavailable)
+
+		std::tstring m_name;		// Current device name
+		bool m_disconnected;		// A disconnect was reported for m_name
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_DEVICERECONNECT_HPP__ */
@@ -0,0 +1,94 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * EncryptedZeroGroup.cpp: Encrypted all-zero group for a title key.       *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "EncryptedZeroGroup.hpp"
+#include "BufferPool.hpp"
+
+// libwiicrypto
+#include "libwiicrypto/wii_hash_tree.h"
+
+// Encryption
+#include "aesw.h"
+
+// C includes (C++ namespace)
+#include <cassert>
+#include <cstring>
+
+/**
+ * Encrypt a zeroed group.
+ * Check isValid() afterwards.
+ * @param title_key	[in] Decrypted title key.
+ */
+EncryptedZeroGroup::EncryptedZeroGroup(const uint8_t title_key[16])
+	: m_valid(false)
+{
+	memset(m_H3, 0, sizeof(m_H3));
+
+	// Build the hash tree for a zeroed group.
+	PoolBuffer buf(GROUP_SIZE_ENC);
+	Wii_Disc_Sector_t *const sbuf = buf.as<Wii_Disc_Sector_t>();
+	if (!sbuf) {
+		return;
+	}
+	memset(sbuf, 0, GROUP_SIZE_ENC);
+	wii_hash_tree_build_group(sbuf, m_H3);
+
+	// All sectors are identical, so only the first one
+	// needs to be encrypted.
+	AesCtx *const aesw = aesw_new();
+	if (!aesw) {
+		return;
+	}
+	aesw_set_key(aesw, title_key, 16);
+
+	uint8_t iv[16];
+	memset(iv, 0, sizeof(iv));
+	aesw_set_iv(aesw, iv, sizeof(iv));
+	aesw_encrypt(aesw, reinterpret_cast<uint8_t*>(&sbuf->hashes), sizeof(sbuf->hashes));
+
+	// User data IV is stored within the encrypted H2 table.
+	aesw_set_iv(aesw, &sbuf->hashes.H2[7][4], 16);
+	aesw_encrypt(aesw, sbuf->data, sizeof(sbuf->data));
+	aesw_free(aesw);
+
+	memcpy(&m_sector, sbuf, sizeof(m_sector));
+	m_valid = true;
+}
+
+/**
+ * Copy the encrypted zeroed group to a buffer.
+ * @param pSectors	[out] Output buffer. (64 sectors)
+ */
+void EncryptedZeroGroup::copyTo(Wii_Disc_Sector_t *pSectors) const
+{
+	assert(m_valid);
+	for (unsigned int i = 0; i < 64; i++) {
+		memcpy(&pSectors[i], &m_sector, sizeof(m_sector));
+	}
+}
+
+/**
+ * Check if encrypted sectors match the encrypted zeroed group.
+ * @param pSectors	[in] Encrypted sectors.
+ * @param count		[in] Number of sectors. (up to 64)
+ * @return True if all sectors match; false if not.
+ */
+bool EncryptedZeroGroup::matches(const Wii_Disc_Sector_t *pSectors, unsigned int count) const
+{
+	assert(count <= 64);
+	if (!m_valid) {
+		return false;
+	}
+
+	for (unsigned int i = 0; i < count; i++) {
+		if (memcmp(&pSectors[i], &m_sector, sizeof(m_sector)) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
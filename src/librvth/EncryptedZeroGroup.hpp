@@ -0,0 +1,78 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * EncryptedZeroGroup.hpp: Encrypted all-zero group for a title key.       *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#pragma once
+
+#include "common.h"
+#include "libwiicrypto/wii_sector.h"
+
+// C includes
+#include <stdint.h>
+
+/**
+ * Encrypted all-zero group for a title key.
+ *
+ * A group of zeroed user data always has the same hash tree, and
+ * since the user data IV is taken from the encrypted H2 table, it
+ * also has the same ciphertext for a given title key. All 64 sectors
+ * in the group are identical, so only one sector is stored.
+ *
+ * This lets zeroed groups be encrypted with memcpy() and verified
+ * with memcmp() instead of SHA-1 and AES.
+ */
+class EncryptedZeroGroup
+{
+	public:
+		/**
+		 * Encrypt a zeroed group.
+		 * Check isValid() afterwards.
+		 * @param title_key	[in] Decrypted title key.
+		 */
+		explicit EncryptedZeroGroup(const uint8_t title_key[16]);
+
+	private:
+		DISABLE_COPY(EncryptedZeroGroup)
+
+	public:
+		/**
+		 * Was the zeroed group encrypted successfully?
+		 * @return True if valid; false if not.
+		 */
+		inline bool isValid(void) const
+		{
+			return m_valid;
+		}
+
+		/**
+		 * Get the H3 hash of the zeroed group.
+		 * @return H3 hash
+		 */
+		inline const uint8_t *H3(void) const
+		{
+			return m_H3;
+		}
+
+		/**
+		 * Copy the encrypted zeroed group to a buffer.
+		 * @param pSectors	[out] Output buffer. (64 sectors)
+		 */
+		void copyTo(Wii_Disc_Sector_t *pSectors) const;
+
+		/**
+		 * Check if encrypted sectors match the encrypted zeroed group.
+		 * @param pSectors	[in] Encrypted sectors.
+		 * @param count		[in] Number of sectors. (up to 64)
+		 * @return True if all sectors match; false if not.
+		 */
+		bool matches(const Wii_Disc_Sector_t *pSectors, unsigned int count) const;
+
+	private:
+		Wii_Disc_Sector_t m_sector;	// Encrypted zeroed sector
+		uint8_t m_H3[RVL_SHA1_DIGEST_SIZE];
+		bool m_valid;
+};
@@ -0,0 +1,475 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * HashIndex.cpp: Per-group hash index for extracted disc images.          *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "HashIndex.hpp"
+#include "ptbl.h"
+
+#include "reader/Reader.hpp"
+#include "BufferPool.hpp"
+
+// libwiicrypto
+#include "libwiicrypto/wii_structs.h"
+
+#include "byteswap.h"
+
+// C includes (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+// C++ includes
+#include <algorithm>
+using std::tstring;
+using std::unique_ptr;
+using std::vector;
+
+// Index file format.
+// All fields are big-endian.
+//
+// Layout:
+// - HashIndex_Header
+// - For each partition:
+//   - HashIndex_PtHeader
+//   - Wii_Disc_H3_t (if HASHINDEX_PT_FLAG_H3 is set)
+//   - group_count * SHA-1 digests
+static const char HASHINDEX_MAGIC[8] = {'R','V','T','H','H','I','D','X'};
+static const uint32_t HASHINDEX_VERSION = 1;
+typedef struct _HashIndex_Header {
+	char magic[8];		// HASHINDEX_MAGIC
+	uint32_t version;	// HASHINDEX_VERSION
+	uint32_t group_size;	// Group size, in bytes (HashIndex::GROUP_SIZE)
+	uint32_t pt_count;	// Number of partitions
+	uint32_t reserved[3];
+} HashIndex_Header;
+ASSERT_STRUCT(HashIndex_Header, 32);
+
+typedef enum {
+	HASHINDEX_PT_FLAG_H3	= (1U << 0),	// H3 table is present
+} HashIndex_PtFlags;
+
+typedef struct _HashIndex_PtHeader {
+	uint32_t type;		// Partition type
+	uint32_t lba_start;	// Starting LBA of the partition
+	uint32_t lba_len;	// Length of the partition, in LBAs
+	uint32_t data_lba;	// Starting LBA of the partition data, relative to lba_start
+	uint32_t data_len;	// Length of the partition data, in LBAs
+	uint32_t group_count;	// Number of group digests
+	uint32_t flags;		// HashIndex_PtFlags
+	uint32_t reserved;
+} HashIndex_PtHeader;
+ASSERT_STRUCT(HashIndex_PtHeader, 32);
+
+static_assert(sizeof(std::array<uint8_t, RVL_SHA1_DIGEST_SIZE>) == RVL_SHA1_DIGEST_SIZE,
+	"Group digests must be stored contiguously");
+
+// Maximum number of groups in a partition.
+// (Limited by the size of the H3 table.)
+#define HASHINDEX_MAX_GROUPS (sizeof(((Wii_Disc_H3_t*)0)->h3) / sizeof(((Wii_Disc_H3_t*)0)->h3[0]))
+
+HashIndex::HashIndex()
+	: m_pos(0)
+	, m_cur_pt(0)
+	, m_cur_group(0)
+	, m_group_started(false)
+{ }
+
+/**
+ * Get the number of bytes in a group.
+ * The last group may be partial.
+ * @param g Group index
+ * @return Number of bytes in the group.
+ */
+uint32_t HashIndex::Partition::groupSize(unsigned int g) const
+{
+	const uint64_t data_size = LBA_TO_BYTES(static_cast<uint64_t>(data_len));
+	const uint64_t group_start = static_cast<uint64_t>(g) * GROUP_SIZE;
+	if (group_start >= data_size) {
+		return 0;
+	}
+	return static_cast<uint32_t>(std::min<uint64_t>(GROUP_SIZE, data_size - group_start));
+}
+
+/**
+ * Initialize an index for a bank.
+ * The partition table and partition headers are read from the bank.
+ * @param entry	[in] Bank entry
+ * @return 0 on success; negative POSIX error code or RvtH_Errors code on error.
+ */
+int HashIndex::init(RvtH_BankEntry *entry)
+{
+	m_partitions.clear();
+	m_pos = 0;
+	m_cur_pt = 0;
+	m_cur_group = 0;
+	m_group_started = false;
+
+	if (!entry || !entry->reader) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	if (entry->type == RVTH_BankType_GCN) {
+		// GameCube images don't have partitions.
+		// Index the entire image.
+		Partition pt;
+		pt.type = TYPE_IMAGE;
+		pt.lba_start = 0;
+		pt.lba_len = entry->lba_len;
+		pt.data_lba = 0;
+		pt.data_len = entry->lba_len;
+		m_partitions.push_back(std::move(pt));
+		sha1_init(&m_sha1);
+		return 0;
+	}
+
+	int ret = rvth_ptbl_load(entry);
+	if (ret != 0) {
+		return ret;
+	}
+
+	Reader *const reader = entry->reader;
+	const bool encrypted = (entry->crypto_type != RVL_CryptoType_None);
+
+	for (unsigned int i = 0; i < entry->pt_count; i++) {
+		const pt_entry_t *const pte = &entry->ptbl[i];
+		if (pte->lba_len == 0) {
+			continue;
+		}
+
+		const RVL_PartitionHeader *const pt_hdr = rvth_ptbl_get_header(entry, pte);
+		if (!pt_hdr) {
+			// Read error.
+			int err = errno;
+			if (err == 0) {
+				err = EIO;
+				errno = EIO;
+			}
+			m_partitions.clear();
+			return -err;
+		}
+
+		Partition pt;
+		pt.type = pte->type;
+		pt.lba_start = pte->lba_start;
+		pt.lba_len = pte->lba_len;
+		pt.data_lba = BYTES_TO_LBA(static_cast<uint64_t>(be32_to_cpu(pt_hdr->data_offset)) << 2);
+		if (pt.data_lba == 0 || pt.data_lba >= pt.lba_len) {
+			// Invalid data offset. Skip this partition.
+			continue;
+		}
+		const uint32_t data_len_max = pt.lba_len - pt.data_lba;
+		if (pt_hdr->data_size != 0) {
+			const uint64_t data_lba_len = BYTES_TO_LBA(static_cast<uint64_t>(be32_to_cpu(pt_hdr->data_size)) << 2);
+			pt.data_len = static_cast<uint32_t>(std::min<uint64_t>(data_lba_len, data_len_max));
+		} else {
+			pt.data_len = data_len_max;
+		}
+		if (pt.data_len == 0) {
+			continue;
+		}
+
+		// Number of groups, limited by the H3 table size.
+		const uint64_t group_count =
+			(LBA_TO_BYTES(static_cast<uint64_t>(pt.data_len)) + GROUP_SIZE - 1) / GROUP_SIZE;
+		if (group_count > HASHINDEX_MAX_GROUPS) {
+			pt.data_len = BYTES_TO_LBA(static_cast<uint64_t>(HASHINDEX_MAX_GROUPS) * GROUP_SIZE);
+		}
+
+		// Read the H3 table.
+		// Unencrypted partitions don't have any hashes.
+		const uint32_t h3_tbl_lba = BYTES_TO_LBA(static_cast<uint64_t>(be32_to_cpu(pt_hdr->h3_table_offset)) << 2);
+		if (encrypted && h3_tbl_lba != 0 &&
+		    h3_tbl_lba + BYTES_TO_LBA(sizeof(Wii_Disc_H3_t)) <= pt.lba_len)
+		{
+			PoolBuffer H3_buf(sizeof(Wii_Disc_H3_t));
+			if (H3_buf.as<Wii_Disc_H3_t>() &&
+			    reader->read(H3_buf.get(), pte->lba_start + h3_tbl_lba,
+					BYTES_TO_LBA(sizeof(Wii_Disc_H3_t))) == BYTES_TO_LBA(sizeof(Wii_Disc_H3_t)))
+			{
+				pt.H3.reset(new Wii_Disc_H3_t);
+				memcpy(pt.H3.get(), H3_buf.get(), sizeof(Wii_Disc_H3_t));
+			}
+		}
+
+		m_partitions.push_back(std::move(pt));
+	}
+
+	// Partitions must be in order and must not overlap,
+	// since the image is hashed sequentially.
+	std::sort(m_partitions.begin(), m_partitions.end(),
+		[](const Partition &a, const Partition &b) {
+			return (a.lba_start < b.lba_start);
+		});
+	uint64_t lba_next = 0;
+	for (auto iter = m_partitions.begin(); iter != m_partitions.end(); ) {
+		const uint64_t data_start = static_cast<uint64_t>(iter->lba_start) + iter->data_lba;
+		if (data_start < lba_next) {
+			// Overlapping partition.
+			iter = m_partitions.erase(iter);
+			continue;
+		}
+		lba_next = data_start + iter->data_len;
+		++iter;
+	}
+
+	sha1_init(&m_sha1);
+	return 0;
+}
+
+/**
+ * Hash the next block of data in the image.
+ * Data must be passed in order, starting at LBA 0.
+ * @param data	[in] Data
+ * @param size	[in] Size of data, in bytes
+ */
+void HashIndex::update(const uint8_t *data, size_t size)
+{
+	while (size > 0 && m_cur_pt < m_partitions.size()) {
+		Partition &pt = m_partitions[m_cur_pt];
+		const uint32_t group_size = pt.groupSize(m_cur_group);
+		if (group_size == 0) {
+			// Finished with this partition.
+			m_cur_pt++;
+			m_cur_group = 0;
+			continue;
+		}
+
+		const uint64_t group_start = LBA_TO_BYTES(static_cast<uint64_t>(pt.lba_start) + pt.data_lba) +
+			(static_cast<uint64_t>(m_cur_group) * GROUP_SIZE);
+		const uint64_t group_end = group_start + group_size;
+		if (m_pos < group_start) {
+			// Skip data before the group.
+			const size_t skip = static_cast<size_t>(std::min<uint64_t>(size, group_start - m_pos));
+			data += skip;
+			size -= skip;
+			m_pos += skip;
+			continue;
+		}
+
+		// Hash data in this group.
+		const size_t hash_len = static_cast<size_t>(std::min<uint64_t>(size, group_end - m_pos));
+		sha1_update(&m_sha1, hash_len, data);
+		m_group_started = true;
+		data += hash_len;
+		size -= hash_len;
+		m_pos += hash_len;
+
+		if (m_pos == group_end) {
+			// Finished with this group.
+			std::array<uint8_t, RVL_SHA1_DIGEST_SIZE> digest;
+			sha1_digest(&m_sha1, digest.size(), digest.data());
+			pt.groups.push_back(digest);
+			m_group_started = false;
+			m_cur_group++;
+		}
+	}
+
+	// Data after the last partition isn't indexed.
+	m_pos += size;
+}
+
+/**
+ * Save the index to a file.
+ * If the image was shorter than expected, the groups that
+ * were never completely hashed are saved as partial groups.
+ * @param filename	[in] Index filename
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int HashIndex::save(const TCHAR *filename)
+{
+	if (m_group_started && m_cur_pt < m_partitions.size()) {
+		// Finish the partial group.
+		std::array<uint8_t, RVL_SHA1_DIGEST_SIZE> digest;
+		sha1_digest(&m_sha1, digest.size(), digest.data());
+		m_partitions[m_cur_pt].groups.push_back(digest);
+		m_group_started = false;
+		m_cur_group++;
+	}
+
+	errno = 0;
+	FILE *f = _tfopen(filename, _T("wb"));
+	if (!f) {
+		int err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		return -err;
+	}
+
+	HashIndex_Header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, HASHINDEX_MAGIC, sizeof(header.magic));
+	header.version = cpu_to_be32(HASHINDEX_VERSION);
+	header.group_size = cpu_to_be32(GROUP_SIZE);
+	header.pt_count = cpu_to_be32(static_cast<uint32_t>(m_partitions.size()));
+	bool ok = (fwrite(&header, 1, sizeof(header), f) == sizeof(header));
+
+	for (auto iter = m_partitions.cbegin(); ok && iter != m_partitions.cend(); ++iter) {
+		HashIndex_PtHeader pt_header;
+		memset(&pt_header, 0, sizeof(pt_header));
+		pt_header.type = cpu_to_be32(iter->type);
+		pt_header.lba_start = cpu_to_be32(iter->lba_start);
+		pt_header.lba_len = cpu_to_be32(iter->lba_len);
+		pt_header.data_lba = cpu_to_be32(iter->data_lba);
+		pt_header.data_len = cpu_to_be32(iter->data_len);
+		pt_header.group_count = cpu_to_be32(static_cast<uint32_t>(iter->groups.size()));
+		pt_header.flags = cpu_to_be32(iter->H3 ? HASHINDEX_PT_FLAG_H3 : 0);
+		ok = (fwrite(&pt_header, 1, sizeof(pt_header), f) == sizeof(pt_header));
+		if (ok && iter->H3) {
+			ok = (fwrite(iter->H3.get(), 1, sizeof(Wii_Disc_H3_t), f) == sizeof(Wii_Disc_H3_t));
+		}
+		if (ok && !iter->groups.empty()) {
+			ok = (fwrite(iter->groups.data(), RVL_SHA1_DIGEST_SIZE, iter->groups.size(), f) == iter->groups.size());
+		}
+	}
+
+	int err = (ok ? 0 : (errno != 0 ? errno : EIO));
+	if (fclose(f) != 0 && err == 0) {
+		err = (errno != 0 ? errno : EIO);
+	}
+	if (err != 0) {
+		_tremove(filename);
+		errno = err;
+		return -err;
+	}
+	return 0;
+}
+
+/**
+ * Load an index file.
+ * @param filename	[in] Index filename
+ * @return 0 on success; negative POSIX error code on error. (-EBADMSG if the file is invalid)
+ */
+int HashIndex::load(const TCHAR *filename)
+{
+	m_partitions.clear();
+	m_pos = 0;
+	m_cur_pt = 0;
+	m_cur_group = 0;
+	m_group_started = false;
+
+	errno = 0;
+	FILE *f = _tfopen(filename, _T("rb"));
+	if (!f) {
+		int err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		return -err;
+	}
+
+	HashIndex_Header header;
+	bool ok = (fread(&header, 1, sizeof(header), f) == sizeof(header) &&
+		!memcmp(header.magic, HASHINDEX_MAGIC, sizeof(header.magic)) &&
+		be32_to_cpu(header.version) == HASHINDEX_VERSION &&
+		be32_to_cpu(header.group_size) == GROUP_SIZE);
+	const uint32_t pt_count = (ok ? be32_to_cpu(header.pt_count) : 0);
+
+	vector<Partition> partitions;
+	for (uint32_t i = 0; ok && i < pt_count; i++) {
+		HashIndex_PtHeader pt_header;
+		if (fread(&pt_header, 1, sizeof(pt_header), f) != sizeof(pt_header)) {
+			ok = false;
+			break;
+		}
+
+		Partition pt;
+		pt.type = be32_to_cpu(pt_header.type);
+		pt.lba_start = be32_to_cpu(pt_header.lba_start);
+		pt.lba_len = be32_to_cpu(pt_header.lba_len);
+		pt.data_lba = be32_to_cpu(pt_header.data_lba);
+		pt.data_len = be32_to_cpu(pt_header.data_len);
+		const uint32_t group_count = be32_to_cpu(pt_header.group_count);
+		const uint32_t pt_flags = be32_to_cpu(pt_header.flags);
+		if (group_count > HASHINDEX_MAX_GROUPS || pt.groupSize(group_count) != 0) {
+			// Too many groups for the partition size.
+			ok = false;
+			break;
+		}
+
+		if (pt_flags & HASHINDEX_PT_FLAG_H3) {
+			pt.H3.reset(new Wii_Disc_H3_t);
+			if (fread(pt.H3.get(), 1, sizeof(Wii_Disc_H3_t), f) != sizeof(Wii_Disc_H3_t)) {
+				ok = false;
+				break;
+			}
+		}
+
+		pt.groups.resize(group_count);
+		if (group_count > 0 &&
+		    fread(pt.groups.data(), RVL_SHA1_DIGEST_SIZE, group_count, f) != group_count)
+		{
+			ok = false;
+			break;
+		}
+		partitions.push_back(std::move(pt));
+	}
+	fclose(f);
+
+	if (!ok) {
+		errno = EBADMSG;
+		return -EBADMSG;
+	}
+
+	m_partitions = std::move(partitions);
+	m_cur_pt = static_cast<unsigned int>(m_partitions.size());
+	return 0;
+}
+
+/**
+ * Find the groups that differ between two indexes.
+ * Partitions are matched by their location in the image.
+ * Groups that only exist in one of the indexes are included.
+ * @param other		[in] Other index
+ * @param pt_idx	[in] Partition index in this index
+ * @param groups	[out] Group indexes that differ
+ * @return 0 on success; -ENOENT if the partition isn't in the other index.
+ */
+int HashIndex::diffGroups(const HashIndex &other, unsigned int pt_idx, vector<unsigned int> &groups) const
+{
+	groups.clear();
+	const Partition *const pt = partition(pt_idx);
+	if (!pt) {
+		return -ERANGE;
+	}
+
+	const Partition *pt_other = nullptr;
+	for (const Partition &p : other.m_partitions) {
+		if (p.lba_start == pt->lba_start && p.data_lba == pt->data_lba) {
+			pt_other = &p;
+			break;
+		}
+	}
+	if (!pt_other) {
+		return -ENOENT;
+	}
+
+	const size_t count = std::max(pt->groups.size(), pt_other->groups.size());
+	for (size_t g = 0; g < count; g++) {
+		if (g >= pt->groups.size() || g >= pt_other->groups.size() ||
+		    pt->groups[g] != pt_other->groups[g] ||
+		    pt->groupSize(static_cast<unsigned int>(g)) != pt_other->groupSize(static_cast<unsigned int>(g)))
+		{
+			groups.push_back(static_cast<unsigned int>(g));
+		}
+	}
+	return 0;
+}
+
+/**
+ * Get the index filename for a disc image.
+ * @param image_filename	[in] Disc image filename
+ * @return Index filename ("<image_filename>.hidx")
+ */
+tstring HashIndex::filenameForImage(const TCHAR *image_filename)
+{
+	tstring filename(image_filename);
+	filename += _T(".hidx");
+	return filename;
+}
@@ -0,0 +1,165 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * HashIndex.hpp: Per-group hash index for extracted disc images.          *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_HASHINDEX_HPP__
+#define __RVTHTOOL_LIBRVTH_HASHINDEX_HPP__
+
+#include "rvth.hpp"
+#include "libwiicrypto/wii_sector.h"
+#include "tcharx.h"
+
+// C includes
+#include <stdint.h>
+
+// C++ includes
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Nettle SHA-1
+#include <nettle/sha1.h>
+
+/**
+ * Per-group hash index for an extracted disc image.
+ *
+ * For each Wii partition, the index stores the SHA-1 of every 2 MB
+ * group of partition data as it appears in the image (i.e. encrypted,
+ * if the image is encrypted), plus the partition's H3 table.
+ * Two dumps can then be compared group-by-group using only their
+ * index files, and a local file only needs to be rehashed (but not
+ * decrypted) to find the groups that differ from the index.
+ *
+ * The index file format is versioned and stored in big-endian,
+ * so index files can be shared between systems.
+ *
+ * Building an index:
+ * - init() with the source bank entry. (Reads the partition headers.)
+ * - update() with all of the data in the image, in order.
+ * - save()
+ */
+class HashIndex
+{
+	public:
+		HashIndex();
+
+	private:
+		DISABLE_COPY(HashIndex)
+
+	public:
+		// Size of a group, in bytes.
+		static const uint32_t GROUP_SIZE = 0x200000;
+
+		// Partition type for GameCube images, which are
+		// indexed as a single partition covering the image.
+		static const uint32_t TYPE_IMAGE = 0xFFFFFFFFU;
+
+		// Indexed partition.
+		struct Partition {
+			uint32_t type;		// Partition type
+			uint32_t lba_start;	// Starting LBA of the partition
+			uint32_t lba_len;	// Length of the partition, in LBAs
+			uint32_t data_lba;	// Starting LBA of the partition data, relative to the partition
+			uint32_t data_len;	// Length of the partition data, in LBAs
+			std::unique_ptr<Wii_Disc_H3_t> H3;	// H3 table (nullptr if not available)
+			std::vector<std::array<uint8_t, RVL_SHA1_DIGEST_SIZE> > groups;	// Group digests
+
+			/**
+			 * Get the number of bytes in a group.
+			 * The last group may be partial.
+			 * @param g Group index
+			 * @return Number of bytes in the group.
+			 */
+			uint32_t groupSize(unsigned int g) const;
+		};
+
+		/** Building an index **/
+
+		/**
+		 * Initialize an index for a bank.
+		 * The partition table and partition headers are read from the bank.
+		 * @param entry	[in] Bank entry
+		 * @return 0 on success; negative POSIX error code or RvtH_Errors code on error.
+		 */
+		int init(RvtH_BankEntry *entry);
+
+		/**
+		 * Hash the next block of data in the image.
+		 * Data must be passed in order, starting at LBA 0.
+		 * @param data	[in] Data
+		 * @param size	[in] Size of data, in bytes
+		 */
+		void update(const uint8_t *data, size_t size);
+
+		/**
+		 * Save the index to a file.
+		 * If the image was shorter than expected, the groups that
+		 * were never completely hashed are saved as partial groups.
+		 * @param filename	[in] Index filename
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int save(const TCHAR *filename);
+
+		/** Reading an index **/
+
+		/**
+		 * Load an index file.
+		 * @param filename	[in] Index filename
+		 * @return 0 on success; negative POSIX error code on error. (-EBADMSG if the file is invalid)
+		 */
+		int load(const TCHAR *filename);
+
+		/**
+		 * Get the number of indexed partitions.
+		 * @return Number of partitions
+		 */
+		inline unsigned int partitionCount(void) const
+		{
+			return static_cast<unsigned int>(m_partitions.size());
+		}
+
+		/**
+		 * Get an indexed partition.
+		 * @param pt_idx	[in] Partition index
+		 * @return Partition, or nullptr if out of range.
+		 */
+		inline const Partition *partition(unsigned int pt_idx) const
+		{
+			return (pt_idx < m_partitions.size() ? &m_partitions[pt_idx] : nullptr);
+		}
+
+		/**
+		 * Find the groups that differ between two indexes.
+		 * Partitions are matched by their location in the image.
+		 * Groups that only exist in one of the indexes are included.
+		 * @param other		[in] Other index
+		 * @param pt_idx	[in] Partition index in this index
+		 * @param groups	[out] Group indexes that differ
+		 * @return 0 on success; -ENOENT if the partition isn't in the other index.
+		 */
+		int diffGroups(const HashIndex &other, unsigned int pt_idx, std::vector<unsigned int> &groups) const;
+
+		/**
+		 * Get the index filename for a disc image.
+		 * @param image_filename	[in] Disc image filename
+		 * @return Index filename ("<image_filename>.hidx")
+		 */
+		static std::tstring filenameForImage(const TCHAR *image_filename);
+
+	private:
+		std::vector<Partition> m_partitions;	// Sorted by lba_start
+
+		// Build state.
+		uint64_t m_pos;			// Current position in the image, in bytes
+		unsigned int m_cur_pt;		// Partition being hashed
+		unsigned int m_cur_group;	// Group being hashed
+		bool m_group_started;		// True if the current group has been partially hashed
+		struct sha1_ctx m_sha1;
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_HASHINDEX_HPP__ */
@@ -0,0 +1,696 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * HttpFile.cpp: Read-only file on an HTTP server. (range requests)        *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "config.librvth.h"
+
+#include "HttpFile.hpp"
+#include "StatsCounters.hpp"
+
+// C includes (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+/**
+ * Is a filename an HTTP(S) URL?
+ * @param filename	[in] Filename.
+ * @return True if the filename starts with "http://" or "https://".
+ */
+bool HttpFile::isUrl(const TCHAR *filename)
+{
+	return (!_tcsnicmp(filename, _T("http://"), 7) ||
+		!_tcsnicmp(filename, _T("https://"), 8));
+}
+
+#ifdef HAVE_CURL
+
+// libcurl
+#include <curl/curl.h>
+
+// C++ includes
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <system_error>
+using std::lock_guard;
+using std::mutex;
+using std::string;
+using std::unique_lock;
+using std::vector;
+
+// Maximum time to wait for a block before checking for cancellation.
+static constexpr std::chrono::milliseconds WAIT_MAX(50);
+
+// Maximum time for the download thread to wait for network activity.
+static const int POLL_TIMEOUT_MS = 1000;
+
+// Number of attempts for each block before the read fails.
+static const unsigned int MAX_ATTEMPTS = 3;
+
+static std::once_flag curl_init_flag;
+
+/**
+ * Receive buffer for a range request.
+ */
+struct RangeBuffer {
+	vector<uint8_t> *data;	// Received data
+	size_t expected;	// Expected length, in bytes
+};
+
+/**
+ * libcurl write callback. Appends the data to a RangeBuffer.
+ * The transfer is aborted if the server sends more than the requested range,
+ * e.g. if it ignored the Range header.
+ * @param ptr		[in] Data
+ * @param size		[in] Always 1
+ * @param nmemb		[in] Number of bytes
+ * @param userdata	[in] RangeBuffer*
+ * @return Number of bytes handled.
+ */
+static size_t rangeWriteCallback(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+	RangeBuffer *const buf = static_cast<RangeBuffer*>(userdata);
+	const size_t len = size * nmemb;
+	if (buf->data->size() + len > buf->expected) {
+		return 0;
+	}
+	buf->data->insert(buf->data->end(), ptr, ptr + len);
+	return len;
+}
+
+/**
+ * libcurl header callback. Gets the file size from the Content-Range header.
+ * @param ptr		[in] Header line (not NULL-terminated)
+ * @param size		[in] Always 1
+ * @param nmemb		[in] Length of the header line
+ * @param userdata	[in,out] off64_t*: File size (-1 if not found)
+ * @return Number of bytes handled.
+ */
+static size_t contentRangeCallback(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+	off64_t *const pTotal = static_cast<off64_t*>(userdata);
+	const size_t len = size * nmemb;
+	const string line(ptr, len);
+
+	if (!strncasecmp(line.c_str(), "HTTP/", 5)) {
+		// New response, e.g. after a redirect.
+		*pTotal = -1;
+	} else if (!strncasecmp(line.c_str(), "Content-Range:", 14)) {
+		// Format: "Content-Range: bytes 0-0/12345"
+		const size_t slash = line.find('/');
+		if (slash != string::npos) {
+			char *endptr = nullptr;
+			const long long total = strtoll(line.c_str() + slash + 1, &endptr, 10);
+			if (endptr != line.c_str() + slash + 1 && total > 0) {
+				*pTotal = static_cast<off64_t>(total);
+			}
+		}
+	}
+	return len;
+}
+
+/**
+ * Convert a libcurl error code to a POSIX error code.
+ * @param result	[in] libcurl error code
+ * @return POSIX error code
+ */
+static int curlErrorToPosix(CURLcode result)
+{
+	switch (result) {
+		case CURLE_OK:
+			return 0;
+		case CURLE_UNSUPPORTED_PROTOCOL:
+			return EPROTONOSUPPORT;
+		case CURLE_URL_MALFORMAT:
+			return EINVAL;
+		case CURLE_COULDNT_RESOLVE_HOST:
+		case CURLE_COULDNT_RESOLVE_PROXY:
+			return EHOSTUNREACH;
+		case CURLE_COULDNT_CONNECT:
+			return ECONNREFUSED;
+		case CURLE_OPERATION_TIMEDOUT:
+			return ETIMEDOUT;
+		case CURLE_OUT_OF_MEMORY:
+			return ENOMEM;
+		case CURLE_SEND_ERROR:
+		case CURLE_RECV_ERROR:
+		case CURLE_GOT_NOTHING:
+		case CURLE_PARTIAL_FILE:
+			return ECONNRESET;
+		default:
+			return EIO;
+	}
+}
+
+/**
+ * Check the result of a range request.
+ * @param easy		[in] libcurl easy handle
+ * @param result	[in] libcurl result
+ * @param buf		[in] Receive buffer
+ * @return 0 on success; POSIX error code on error.
+ */
+static int checkRangeResponse(CURL *easy, CURLcode result, const RangeBuffer &buf)
+{
+	long code = 0;
+	curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &code);
+	if (result == CURLE_WRITE_ERROR && code == 200) {
+		// The server sent the whole file instead of the range.
+		return ENOTSUP;
+	} else if (result != CURLE_OK) {
+		return curlErrorToPosix(result);
+	}
+
+	switch (code) {
+		case 206:
+			// Partial Content
+			break;
+		case 200:
+			// Range requests aren't supported.
+			return ENOTSUP;
+		case 401:
+		case 403:
+			return EACCES;
+		case 404:
+		case 410:
+			return ENOENT;
+		default:
+			return EIO;
+	}
+
+	return (buf.data->size() == buf.expected ? 0 : EIO);
+}
+
+/**
+ * Can a failed range request be retried?
+ * @param err	[in] POSIX error code
+ * @return True if the error may be temporary.
+ */
+static inline bool isRetryable(int err)
+{
+	return (err == EIO || err == ECONNRESET || err == ETIMEDOUT);
+}
+
+/**
+ * Create a libcurl easy handle with the common options.
+ * @param url	[in] URL
+ * @return Easy handle, or nullptr on error.
+ */
+static CURL *createEasy(const string &url)
+{
+	CURL *const easy = curl_easy_init();
+	if (!easy) {
+		return nullptr;
+	}
+
+	curl_easy_setopt(easy, CURLOPT_URL, url.c_str());
+	curl_easy_setopt(easy, CURLOPT_FOLLOWLOCATION, 1L);
+	curl_easy_setopt(easy, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(easy, CURLOPT_CONNECTTIMEOUT, 30L);
+	// Fail if a transfer stalls for a minute.
+	curl_easy_setopt(easy, CURLOPT_LOW_SPEED_LIMIT, 1L);
+	curl_easy_setopt(easy, CURLOPT_LOW_SPEED_TIME, 60L);
+	curl_easy_setopt(easy, CURLOPT_USERAGENT, "rvthtool");
+	curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, rangeWriteCallback);
+	return easy;
+}
+
+HttpFile::HttpFile()
+	: m_size(0)
+	, m_mtime(-1)
+	, m_useCounter(0)
+	, m_nextOffset(0)
+	, m_readAhead(true)
+	, m_stop(false)
+	, m_multi(nullptr)
+{ }
+
+HttpFile::~HttpFile()
+{
+	if (m_thread.joinable()) {
+		{
+			lock_guard<mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		wake();
+		m_thread.join();
+	}
+	if (m_multi) {
+		curl_multi_cleanup(static_cast<CURLM*>(m_multi));
+	}
+}
+
+/**
+ * Open a file on an HTTP server.
+ * The server is asked for the file size and modification time.
+ * @param url	[in] URL.
+ * @return HttpFile*, or nullptr on error. (check errno)
+ */
+HttpFile *HttpFile::open(const TCHAR *url)
+{
+	assert(url != nullptr);
+	std::call_once(curl_init_flag, []() {
+		curl_global_init(CURL_GLOBAL_DEFAULT);
+	});
+
+	// URLs are ASCII. Other characters must be percent-encoded.
+	string s_url;
+	for (const TCHAR *p = url; *p != 0; p++) {
+		if (static_cast<unsigned int>(*p) >= 0x80) {
+			errno = EINVAL;
+			return nullptr;
+		}
+		s_url += static_cast<char>(*p);
+	}
+
+	// Request the first byte. This checks that range requests
+	// are supported, and the response has the file size.
+	CURL *const easy = createEasy(s_url);
+	if (!easy) {
+		errno = ENOMEM;
+		return nullptr;
+	}
+	vector<uint8_t> data;
+	RangeBuffer buf = {&data, 1};
+	off64_t total = -1;
+	curl_easy_setopt(easy, CURLOPT_RANGE, "0-0");
+	curl_easy_setopt(easy, CURLOPT_WRITEDATA, &buf);
+	curl_easy_setopt(easy, CURLOPT_HEADERFUNCTION, contentRangeCallback);
+	curl_easy_setopt(easy, CURLOPT_HEADERDATA, &total);
+	curl_easy_setopt(easy, CURLOPT_FILETIME, 1L);
+	const CURLcode result = curl_easy_perform(easy);
+	int err = checkRangeResponse(easy, result, buf);
+	curl_off_t filetime = -1;
+	curl_easy_getinfo(easy, CURLINFO_FILETIME_T, &filetime);
+	curl_easy_cleanup(easy);
+	if (err == 0 && total <= 0) {
+		// No file size.
+		err = EIO;
+	}
+	if (err != 0) {
+		errno = err;
+		return nullptr;
+	}
+
+	CURLM *const multi = curl_multi_init();
+	if (!multi) {
+		errno = ENOMEM;
+		return nullptr;
+	}
+
+	HttpFile *const file = new HttpFile();
+	file->m_url = std::move(s_url);
+	file->m_size = total;
+	file->m_mtime = static_cast<time_t>(filetime);
+	file->m_multi = multi;
+	try {
+		file->m_thread = std::thread(&HttpFile::fetchThread, file);
+	} catch (const std::system_error&) {
+		delete file;
+		errno = EAGAIN;
+		return nullptr;
+	}
+	return file;
+}
+
+/**
+ * Wake up the download thread.
+ */
+void HttpFile::wake(void)
+{
+	curl_multi_wakeup(static_cast<CURLM*>(m_multi));
+}
+
+/**
+ * Get a block, and queue it for downloading if it isn't cached.
+ * NOTE: m_mutex must be held by the caller.
+ * @param index		[in] Block index.
+ * @param urgent	[in] True if a read is waiting for this block.
+ * @return Block.
+ */
+HttpFile::BlockPtr HttpFile::requestBlock_int(uint64_t index, bool urgent)
+{
+	auto iter = m_blocks.find(index);
+	if (iter != m_blocks.end()) {
+		BlockPtr block = iter->second;
+		if (urgent && !block->urgent && block->state == Block::State::Queued) {
+			// Move the read-ahead block to the front of the line.
+			auto qiter = std::find(m_aheadQueue.begin(), m_aheadQueue.end(), block);
+			if (qiter != m_aheadQueue.end()) {
+				m_aheadQueue.erase(qiter);
+			}
+			m_urgentQueue.push_back(block);
+		}
+		block->urgent |= urgent;
+		return block;
+	}
+
+	evict_int();
+	BlockPtr block = std::make_shared<Block>();
+	block->index = index;
+	block->lastUse = ++m_useCounter;
+	block->urgent = urgent;
+	m_blocks.emplace(index, block);
+	if (urgent) {
+		m_urgentQueue.push_back(block);
+	} else {
+		m_aheadQueue.push_back(block);
+	}
+	return block;
+}
+
+/**
+ * Drop the blocks in the read-ahead queue.
+ * NOTE: m_mutex must be held by the caller.
+ */
+void HttpFile::dropReadAhead_int(void)
+{
+	for (const BlockPtr &block : m_aheadQueue) {
+		m_blocks.erase(block->index);
+	}
+	m_aheadQueue.clear();
+}
+
+/**
+ * Evict the least recently used blocks if the cache is full.
+ * NOTE: m_mutex must be held by the caller.
+ */
+void HttpFile::evict_int(void)
+{
+	while (m_blocks.size() >= CACHE_BLOCKS) {
+		// Blocks that are still queued or downloading can't be evicted.
+		auto lru = m_blocks.end();
+		for (auto iter = m_blocks.begin(); iter != m_blocks.end(); ++iter) {
+			if (iter->second->state == Block::State::Done &&
+			    (lru == m_blocks.end() || iter->second->lastUse < lru->second->lastUse))
+			{
+				lru = iter;
+			}
+		}
+		if (lru == m_blocks.end()) {
+			break;
+		}
+		m_blocks.erase(lru);
+	}
+}
+
+/**
+ * Read data from the file at the specified offset.
+ * @param ptr		[out] Read buffer.
+ * @param size		[in] Number of bytes to read.
+ * @param offset	[in] File offset.
+ * @return Number of bytes read. (If less than size, check errno.)
+ */
+size_t HttpFile::pread(void *ptr, size_t size, off64_t offset)
+{
+	if (offset < 0) {
+		errno = EINVAL;
+		return 0;
+	} else if (offset >= m_size || size == 0) {
+		// End of file.
+		return 0;
+	}
+	if (static_cast<off64_t>(size) > m_size - offset) {
+		size = static_cast<size_t>(m_size - offset);
+	}
+	const uint64_t first = static_cast<uint64_t>(offset) / BLOCK_SIZE;
+	const uint64_t last = static_cast<uint64_t>(offset + size - 1) / BLOCK_SIZE;
+
+	unique_lock<mutex> lock(m_mutex);
+
+	// Request all of the blocks first so they're downloaded in parallel.
+	vector<BlockPtr> blocks;
+	blocks.reserve(static_cast<size_t>(last - first + 1));
+	for (uint64_t i = first; i <= last; i++) {
+		blocks.push_back(requestBlock_int(i, true));
+	}
+	if (offset == m_nextOffset && m_readAhead) {
+		// Sequential read. Extend the read-ahead window.
+		const uint64_t count = static_cast<uint64_t>(m_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+		const uint64_t end = std::min<uint64_t>(last + 1 + READAHEAD_BLOCKS, count);
+		for (uint64_t i = last + 1; i < end; i++) {
+			requestBlock_int(i, false);
+		}
+	} else if (offset != m_nextOffset) {
+		// Random read. Read-ahead blocks that haven't been
+		// started yet probably won't be needed.
+		const uint64_t keep_end = last + 1 + (m_readAhead ? READAHEAD_BLOCKS : 0);
+		for (auto iter = m_aheadQueue.begin(); iter != m_aheadQueue.end(); ) {
+			const uint64_t index = (*iter)->index;
+			if (index <= last || index >= keep_end) {
+				m_blocks.erase(index);
+				iter = m_aheadQueue.erase(iter);
+			} else {
+				++iter;
+			}
+		}
+	}
+	m_nextOffset = offset + size;
+	lock.unlock();
+	wake();
+
+	uint8_t *const ptr8 = static_cast<uint8_t*>(ptr);
+	size_t total = 0;
+	for (const BlockPtr &block : blocks) {
+		lock.lock();
+		while (block->state != Block::State::Done) {
+			if (StatsCounters::cancelled()) {
+				errno = ECANCELED;
+				return total;
+			}
+			m_cond.wait_for(lock, WAIT_MAX);
+		}
+		block->lastUse = ++m_useCounter;
+		lock.unlock();
+		if (block->err != 0) {
+			errno = block->err;
+			return total;
+		}
+
+		// Block data isn't modified once it's done.
+		const off64_t pos = offset + static_cast<off64_t>(total);
+		const size_t skip = static_cast<size_t>(pos - static_cast<off64_t>(block->index * BLOCK_SIZE));
+		const size_t len = std::min(size - total, block->data.size() - skip);
+		memcpy(ptr8 + total, block->data.data() + skip, len);
+		total += len;
+	}
+	return total;
+}
+
+/**
+ * Start downloading a region that will be read soon.
+ * @param offset	[in] Starting offset
+ * @param len		[in] Length, in bytes
+ */
+void HttpFile::prefetch(off64_t offset, off64_t len)
+{
+	if (offset < 0 || len <= 0 || offset >= m_size) {
+		return;
+	}
+	const uint64_t first = static_cast<uint64_t>(offset) / BLOCK_SIZE;
+	uint64_t end = static_cast<uint64_t>(std::min(offset + len, m_size) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	// Don't prefetch more than the read-ahead window.
+	end = std::min<uint64_t>(end, first + READAHEAD_BLOCKS);
+
+	{
+		lock_guard<mutex> lock(m_mutex);
+		for (uint64_t i = first; i < end; i++) {
+			requestBlock_int(i, false);
+		}
+	}
+	wake();
+}
+
+/**
+ * Enable or disable the read-ahead window.
+ * It should be disabled for random access.
+ * @param enable	[in] True to enable read-ahead; false to disable it.
+ */
+void HttpFile::setReadAhead(bool enable)
+{
+	lock_guard<mutex> lock(m_mutex);
+	m_readAhead = enable;
+	if (!enable) {
+		dropReadAhead_int();
+	}
+}
+
+/**
+ * Download thread function.
+ */
+void HttpFile::fetchThread(void)
+{
+	CURLM *const multi = static_cast<CURLM*>(m_multi);
+
+	// Each connection has its own easy handle,
+	// so connections are reused between blocks.
+	struct Transfer {
+		CURL *easy;
+		BlockPtr block;
+		RangeBuffer buf;
+		unsigned int attempts;
+		char range[64];
+	};
+	std::array<Transfer, CONNECTIONS> transfers;
+	for (Transfer &t : transfers) {
+		t.easy = nullptr;
+		t.attempts = 0;
+	}
+
+	auto startTransfer = [this, multi](Transfer &t) -> int {
+		if (!t.easy) {
+			t.easy = createEasy(m_url);
+			if (!t.easy) {
+				return ENOMEM;
+			}
+		}
+		const off64_t start = static_cast<off64_t>(t.block->index * BLOCK_SIZE);
+		const size_t len = static_cast<size_t>(std::min<off64_t>(BLOCK_SIZE, m_size - start));
+		t.block->data.clear();
+		t.block->data.reserve(len);
+		t.buf.data = &t.block->data;
+		t.buf.expected = len;
+		snprintf(t.range, sizeof(t.range), "%lld-%lld",
+			static_cast<long long>(start), static_cast<long long>(start + len - 1));
+		curl_easy_setopt(t.easy, CURLOPT_RANGE, t.range);
+		curl_easy_setopt(t.easy, CURLOPT_WRITEDATA, &t.buf);
+		return (curl_multi_add_handle(multi, t.easy) == CURLM_OK ? 0 : EIO);
+	};
+
+	// Mark a transfer's block as finished.
+	// NOTE: m_mutex must be held.
+	auto finishBlock_int = [this](Transfer &t, int err) {
+		t.block->err = err;
+		t.block->state = Block::State::Done;
+		if (err != 0) {
+			// Don't cache the error, so the block can be read again later.
+			auto iter = m_blocks.find(t.block->index);
+			if (iter != m_blocks.end() && iter->second == t.block) {
+				m_blocks.erase(iter);
+			}
+		}
+		t.block.reset();
+		m_cond.notify_all();
+	};
+
+	unique_lock<mutex> lock(m_mutex);
+	while (!m_stop) {
+		// Start downloading queued blocks on idle connections.
+		for (Transfer &t : transfers) {
+			if (t.block) {
+				continue;
+			}
+			std::deque<BlockPtr> &queue = (!m_urgentQueue.empty() ? m_urgentQueue : m_aheadQueue);
+			if (queue.empty()) {
+				break;
+			}
+			t.block = std::move(queue.front());
+			queue.pop_front();
+			t.block->state = Block::State::Active;
+			t.attempts = 0;
+			const int err = startTransfer(t);
+			if (err != 0) {
+				finishBlock_int(t, err);
+			}
+		}
+		lock.unlock();
+
+		int running = 0;
+		curl_multi_perform(multi, &running);
+
+		CURLMsg *msg;
+		int msgs_left = 0;
+		while ((msg = curl_multi_info_read(multi, &msgs_left)) != nullptr) {
+			if (msg->msg != CURLMSG_DONE) {
+				continue;
+			}
+			auto iter = std::find_if(transfers.begin(), transfers.end(),
+				[msg](const Transfer &t) { return t.easy == msg->easy_handle; });
+			assert(iter != transfers.end());
+			if (iter == transfers.end()) {
+				continue;
+			}
+			Transfer &t = *iter;
+			const CURLcode result = msg->data.result;
+			curl_multi_remove_handle(multi, t.easy);
+
+			int err = checkRangeResponse(t.easy, result, t.buf);
+			if (err != 0 && isRetryable(err) && ++t.attempts < MAX_ATTEMPTS) {
+				// Try again.
+				err = startTransfer(t);
+				if (err == 0) {
+					continue;
+				}
+			}
+
+			lock.lock();
+			finishBlock_int(t, err);
+			lock.unlock();
+		}
+
+		curl_multi_poll(multi, nullptr, 0, POLL_TIMEOUT_MS, nullptr);
+		lock.lock();
+	}
+	lock.unlock();
+
+	for (Transfer &t : transfers) {
+		if (t.easy) {
+			if (t.block) {
+				curl_multi_remove_handle(multi, t.easy);
+			}
+			curl_easy_cleanup(t.easy);
+		}
+	}
+}
+
+#else /* !HAVE_CURL */
+
+// HTTP support isn't available.
+
+HttpFile::HttpFile()
+	: m_size(0)
+	, m_mtime(-1)
+	, m_useCounter(0)
+	, m_nextOffset(0)
+	, m_readAhead(false)
+	, m_stop(true)
+	, m_multi(nullptr)
+{ }
+
+HttpFile::~HttpFile()
+{ }
+
+HttpFile *HttpFile::open(const TCHAR *url)
+{
+	UNUSED(url);
+	errno = EPROTONOSUPPORT;
+	return nullptr;
+}
+
+size_t HttpFile::pread(void *ptr, size_t size, off64_t offset)
+{
+	UNUSED(ptr);
+	UNUSED(size);
+	UNUSED(offset);
+	errno = EBADF;
+	return 0;
+}
+
+void HttpFile::prefetch(off64_t offset, off64_t len)
+{
+	UNUSED(offset);
+	UNUSED(len);
+}
+
+void HttpFile::setReadAhead(bool enable)
+{
+	UNUSED(enable);
+}
+
+#endif /* HAVE_CURL */
@@ -0,0 +1,192 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * HttpFile.hpp: Read-only file on an HTTP server. (range requests)        *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_HTTPFILE_HPP__
+#define __RVTHTOOL_LIBRVTH_HTTPFILE_HPP__
+
+#include "libwiicrypto/common.h"
+#include "tcharx.h"
+
+// C includes
+#include <stdint.h>
+
+// C includes (C++ namespace)
+#include <ctime>
+
+// C++ includes
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Read-only file on an HTTP(S) server, e.g. a disc image in an
+ * artifact store. Used by RefFile for "http://" and "https://"
+ * filenames, so all of the disc image formats can be read from it.
+ *
+ * The file is read in fixed-size blocks using range requests.
+ * Blocks are downloaded by a background thread using several
+ * connections at once, and recently used blocks are cached.
+ *
+ * If the file is read sequentially, the blocks following the last
+ * read are downloaded ahead of time (read-ahead window), so copying
+ * the image doesn't wait for each request. The read-ahead window is
+ * dropped when the reads stop being sequential.
+ *
+ * The server must support range requests.
+ * Requires libcurl. (HAVE_CURL)
+ */
+class HttpFile
+{
+	public:
+		/**
+		 * Open a file on an HTTP server.
+		 * The server is asked for the file size and modification time.
+		 * @param url	[in] URL.
+		 * @return HttpFile*, or nullptr on error. (check errno)
+		 */
+		static HttpFile *open(const TCHAR *url);
+
+		~HttpFile();
+
+	private:
+		HttpFile();
+		DISABLE_COPY(HttpFile)
+
+	public:
+		/**
+		 * Is a filename an HTTP(S) URL?
+		 * @param filename	[in] Filename.
+		 * @return True if the filename starts with "http://" or "https://".
+		 */
+		static bool isUrl(const TCHAR *filename);
+
+		/**
+		 * Get the size of the file.
+		 * @return Size of the file.
+		 */
+		inline off64_t size(void) const
+		{
+			return m_size;
+		}
+
+		/**
+		 * Get the file's modification time.
+		 * @return File modification time, or -1 if the server didn't send it.
+		 */
+		inline time_t mtime(void) const
+		{
+			return m_mtime;
+		}
+
+		/**
+		 * Read data from the file at the specified offset.
+		 * @param ptr		[out] Read buffer.
+		 * @param size		[in] Number of bytes to read.
+		 * @param offset	[in] File offset.
+		 * @return Number of bytes read. (If less than size, check errno.)
+		 */
+		size_t pread(void *ptr, size_t size, off64_t offset);
+
+		/**
+		 * Start downloading a region that will be read soon.
+		 * @param offset	[in] Starting offset
+		 * @param len		[in] Length, in bytes
+		 */
+		void prefetch(off64_t offset, off64_t len);
+
+		/**
+		 * Enable or disable the read-ahead window.
+		 * It should be disabled for random access.
+		 * @param enable	[in] True to enable read-ahead; false to disable it.
+		 */
+		void setReadAhead(bool enable);
+
+	public:
+		// Block size, in bytes.
+		static const unsigned int BLOCK_SIZE = 1024*1024;
+		// Number of concurrent connections.
+		static const unsigned int CONNECTIONS = 4;
+		// Size of the read-ahead window, in blocks.
+		static const unsigned int READAHEAD_BLOCKS = 16;
+		// Maximum number of cached blocks.
+		// The cache may be exceeded while blocks are being downloaded.
+		static const unsigned int CACHE_BLOCKS = READAHEAD_BLOCKS * 2 + CONNECTIONS;
+
+	private:
+		struct Block {
+			enum class State : uint8_t {
+				Queued,		// Waiting for a connection
+				Active,		// Downloading
+				Done,		// Finished (check err)
+			};
+
+			uint64_t index = 0;		// Block index
+			std::vector<uint8_t> data;	// Block data
+			uint64_t lastUse = 0;		// Last use, for evicting blocks
+			int err = 0;			// POSIX error code (0 if OK)
+			State state = State::Queued;
+			bool urgent = false;		// True if a read is waiting for this block
+		};
+		typedef std::shared_ptr<Block> BlockPtr;
+
+		/**
+		 * Get a block, and queue it for downloading if it isn't cached.
+		 * NOTE: m_mutex must be held by the caller.
+		 * @param index		[in] Block index.
+		 * @param urgent	[in] True if a read is waiting for this block.
+		 * @return Block.
+		 */
+		BlockPtr requestBlock_int(uint64_t index, bool urgent);
+
+		/**
+		 * Drop the blocks in the read-ahead queue.
+		 * NOTE: m_mutex must be held by the caller.
+		 */
+		void dropReadAhead_int(void);
+
+		/**
+		 * Evict the least recently used blocks if the cache is full.
+		 * NOTE: m_mutex must be held by the caller.
+		 */
+		void evict_int(void);
+
+		/**
+		 * Wake up the download thread.
+		 */
+		void wake(void);
+
+		/**
+		 * Download thread function.
+		 */
+		void fetchThread(void);
+
+	private:
+		std::string m_url;	// URL
+		off64_t m_size;		// File size
+		time_t m_mtime;		// Modification time (-1 if unknown)
+
+		std::mutex m_mutex;
+		std::condition_variable m_cond;	// Signaled when a block is finished
+		std::unordered_map<uint64_t, BlockPtr> m_blocks;	// Cached and queued blocks
+		std::deque<BlockPtr> m_urgentQueue;	// Blocks that reads are waiting for
+		std::deque<BlockPtr> m_aheadQueue;	// Read-ahead blocks
+		uint64_t m_useCounter;	// Incremented each time a block is used
+		off64_t m_nextOffset;	// Offset following the last read, for detecting sequential reads
+		bool m_readAhead;	// Is read-ahead enabled?
+		bool m_stop;		// Stop the download thread
+
+		void *m_multi;		// CURLM*
+		std::thread m_thread;	// Download thread
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_HTTPFILE_HPP__ */
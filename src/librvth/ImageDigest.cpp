@@ -0,0 +1,298 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * ImageDigest.cpp: Streaming CRC32/MD5/SHA-1 digests for disc images.     *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "ImageDigest.hpp"
+
+// libwiicrypto
+#include "libwiicrypto/crc32w.h"
+
+// C includes (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+// C++ includes
+#include <string>
+#include <system_error>
+using std::lock_guard;
+using std::mutex;
+using std::tstring;
+using std::unique_lock;
+
+/** ImageDigest **/
+
+/**
+ * Start the digest threads.
+ * @param buf_size	[in] Buffer size. (Larger updates are split.)
+ * @param depth		[in] Number of buffers. (minimum 2)
+ */
+ImageDigest::ImageDigest(size_t buf_size, unsigned int depth)
+	: m_buf_size(buf_size)
+	, m_crc32(0)
+	, m_submitted(0)
+	, m_finished(false)
+	, m_async(false)
+	, m_stats(StatsCounters::current())
+{
+	assert(buf_size != 0);
+	md5_init(&m_md5);
+	sha1_init(&m_sha1);
+	if (buf_size == 0) {
+		return;
+	}
+	if (depth < 2) {
+		depth = 2;
+	}
+
+	m_slots.resize(depth);
+	for (Slot &slot : m_slots) {
+		slot.buf.reset(buf_size);
+		if (!slot.buf) {
+			// Error allocating memory.
+			m_slots.clear();
+			return;
+		}
+	}
+
+	// Start one thread per digest.
+	// If the threads can't be started, the digests
+	// will be calculated synchronously in update().
+	try {
+		m_threads.reserve(DIGEST_MAX);
+		for (unsigned int i = 0; i < DIGEST_MAX; i++) {
+			m_threads.emplace_back(&ImageDigest::digestThread, this, static_cast<DigestType>(i));
+		}
+		m_async = true;
+	} catch (const std::system_error&) {
+		// Stop the threads that were started.
+		{
+			lock_guard<mutex> lock(m_mutex);
+			m_finished = true;
+			m_cond.notify_all();
+		}
+		for (std::thread &thread : m_threads) {
+			thread.join();
+		}
+		m_threads.clear();
+		m_finished = false;
+	}
+}
+
+/**
+ * Create the digests without buffers or threads.
+ * Data must be added with updateDigest(), e.g. by a Pipeline
+ * stage for each digest, so the data doesn't have to be copied.
+ */
+ImageDigest::ImageDigest()
+	: m_buf_size(0)
+	, m_crc32(0)
+	, m_submitted(0)
+	, m_finished(false)
+	, m_async(false)
+	, m_stats(StatsCounters::current())
+{
+	md5_init(&m_md5);
+	sha1_init(&m_sha1);
+}
+
+ImageDigest::~ImageDigest()
+{
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_finished = true;
+		m_cond.notify_all();
+	}
+	for (std::thread &thread : m_threads) {
+		thread.join();
+	}
+}
+
+/**
+ * Hash a block of data.
+ * @param type Digest type
+ * @param data Data
+ * @param size Size of data, in bytes
+ */
+void ImageDigest::hashBlock(DigestType type, const uint8_t *data, size_t size)
+{
+	switch (type) {
+		case DIGEST_CRC32:
+			m_crc32 = crc32w_update(m_crc32, data, size);
+			break;
+		case DIGEST_MD5:
+			md5_update(&m_md5, size, data);
+			break;
+		case DIGEST_SHA1: {
+			StatsTimer timer(StatsCounters::TIMER_SHA1);
+			sha1_update(&m_sha1, size, data);
+			break;
+		}
+		default:
+			assert(!"Invalid digest type.");
+			break;
+	}
+}
+
+/**
+ * Digest thread function.
+ * @param type Digest type
+ */
+void ImageDigest::digestThread(DigestType type)
+{
+	StatsScope scope(m_stats);
+	const unsigned int slot_count = static_cast<unsigned int>(m_slots.size());
+	uint64_t seq = 0;
+
+	unique_lock<mutex> lock(m_mutex);
+	while (true) {
+		m_cond.wait(lock, [&]() { return seq < m_submitted || m_finished; });
+		if (seq >= m_submitted) {
+			// Finished.
+			break;
+		}
+
+		// The buffer isn't modified until all threads have hashed it.
+		Slot &slot = m_slots[seq % slot_count];
+		lock.unlock();
+		hashBlock(type, slot.buf.get(), slot.size);
+		lock.lock();
+
+		assert(slot.pending > 0);
+		if (--slot.pending == 0) {
+			m_cond.notify_all();
+		}
+		seq++;
+	}
+}
+
+/**
+ * Add data to the digests.
+ * Blocks if all buffers are still being hashed.
+ * @param data	[in] Data
+ * @param size	[in] Size of data, in bytes
+ */
+void ImageDigest::update(const uint8_t *data, size_t size)
+{
+	assert(isOpen());
+	assert(!m_finished);
+	if (!isOpen()) {
+		return;
+	}
+
+	if (!m_async) {
+		for (unsigned int i = 0; i < DIGEST_MAX; i++) {
+			hashBlock(static_cast<DigestType>(i), data, size);
+		}
+		return;
+	}
+
+	const unsigned int slot_count = static_cast<unsigned int>(m_slots.size());
+	while (size > 0) {
+		const size_t block_size = (size < m_buf_size) ? size : m_buf_size;
+		Slot &slot = m_slots[m_submitted % slot_count];
+
+		unique_lock<mutex> lock(m_mutex);
+		m_cond.wait(lock, [&]() { return slot.pending == 0; });
+		lock.unlock();
+
+		memcpy(slot.buf.get(), data, block_size);
+		slot.size = block_size;
+
+		lock.lock();
+		slot.pending = DIGEST_MAX;
+		m_submitted++;
+		m_cond.notify_all();
+		lock.unlock();
+
+		data += block_size;
+		size -= block_size;
+	}
+}
+
+/**
+ * Wait for all data to be hashed and get the digests.
+ * No more data can be added after calling this function.
+ * @param digests	[out] Digests
+ */
+void ImageDigest::finish(RvtH_Image_Digests *digests)
+{
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_finished = true;
+		m_cond.notify_all();
+	}
+	for (std::thread &thread : m_threads) {
+		thread.join();
+	}
+	m_threads.clear();
+
+	digests->crc32 = m_crc32;
+	md5_digest(&m_md5, sizeof(digests->md5), digests->md5);
+	sha1_digest(&m_sha1, sizeof(digests->sha1), digests->sha1);
+}
+
+/**
+ * Write a digest sidecar file for a disc image.
+ * The sidecar file is named "<image_filename>.digests".
+ * @param image_filename	[in] Disc image filename
+ * @param digests		[in] Digests
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int ImageDigest::writeSidecar(const TCHAR *image_filename, const RvtH_Image_Digests *digests)
+{
+	tstring filename(image_filename);
+	filename += _T(".digests");
+
+	// Only the filename is written, not the full path.
+	const TCHAR *basename = image_filename;
+	for (const TCHAR *p = image_filename; *p != 0; p++) {
+		if (*p == _T('/')
+#ifdef _WIN32
+		    || *p == _T('\\') || *p == _T(':')
+#endif /* _WIN32 */
+		) {
+			basename = p + 1;
+		}
+	}
+
+	errno = 0;
+	FILE *f = _tfopen(filename.c_str(), _T("w"));
+	if (!f) {
+		int err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		return -err;
+	}
+
+	char s_md5[sizeof(digests->md5)*2 + 1];
+	char s_sha1[sizeof(digests->sha1)*2 + 1];
+	for (size_t i = 0; i < sizeof(digests->md5); i++) {
+		snprintf(&s_md5[i*2], 3, "%02x", digests->md5[i]);
+	}
+	for (size_t i = 0; i < sizeof(digests->sha1); i++) {
+		snprintf(&s_sha1[i*2], 3, "%02x", digests->sha1[i]);
+	}
+
+	// NOTE: These are the digests of the disc image as it was copied.
+	// Recryption and SDK headers aren't included.
+	_ftprintf(f, _T("File:  %s\n"), basename);
+	fprintf(f, "CRC32: %08x\n", digests->crc32);
+	fprintf(f, "MD5:   %s\n", s_md5);
+	fprintf(f, "SHA-1: %s\n", s_sha1);
+
+	int ret = 0;
+	if (ferror(f)) {
+		ret = -EIO;
+	}
+	if (fclose(f) != 0 && ret == 0) {
+		ret = -EIO;
+	}
+	return ret;
+}
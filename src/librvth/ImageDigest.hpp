@@ -0,0 +1,156 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * ImageDigest.hpp: Streaming CRC32/MD5/SHA-1 digests for disc images.     *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_IMAGEDIGEST_HPP__
+#define __RVTHTOOL_LIBRVTH_IMAGEDIGEST_HPP__
+
+#include "rvth.hpp"
+#include "BufferPool.hpp"
+#include "StatsCounters.hpp"
+
+// Digests
+#include <nettle/md5.h>
+#include <nettle/sha1.h>
+
+// C includes
+#include <stdint.h>
+
+// C includes (C++ namespace)
+#include <cassert>
+
+// C++ includes
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Streaming CRC32, MD5, and SHA-1 digests for disc images.
+ *
+ * Data passed to update() is copied into a ring of buffers, and each
+ * digest is calculated by its own background thread, so hashing runs
+ * in parallel with the copy loop that's reading and writing the image.
+ */
+class ImageDigest
+{
+	public:
+		/**
+		 * Start the digest threads.
+		 * @param buf_size	[in] Buffer size. (Larger updates are split.)
+		 * @param depth		[in] Number of buffers. (minimum 2)
+		 */
+		explicit ImageDigest(size_t buf_size, unsigned int depth = 4);
+
+		/**
+		 * Create the digests without buffers or threads.
+		 * Data must be added with updateDigest(), e.g. by a Pipeline
+		 * stage for each digest, so the data doesn't have to be copied.
+		 */
+		ImageDigest();
+		~ImageDigest();
+
+	private:
+		DISABLE_COPY(ImageDigest)
+
+	public:
+		enum DigestType {
+			DIGEST_CRC32,
+			DIGEST_MD5,
+			DIGEST_SHA1,
+
+			DIGEST_MAX
+		};
+
+		/**
+		 * Were the buffers allocated successfully?
+		 * @return True if the digests can be calculated; false if not.
+		 */
+		inline bool isOpen(void) const
+		{
+			return !m_slots.empty();
+		}
+
+		/**
+		 * Add data to the digests.
+		 * Blocks if all buffers are still being hashed.
+		 * @param data	[in] Data
+		 * @param size	[in] Size of data, in bytes
+		 */
+		void update(const uint8_t *data, size_t size);
+
+		/**
+		 * Add data to a single digest.
+		 * Only for digests created without buffers. Each digest may be
+		 * updated from a different thread, but the data for a digest
+		 * must be added in order.
+		 * @param type	[in] Digest type
+		 * @param data	[in] Data
+		 * @param size	[in] Size of data, in bytes
+		 */
+		inline void updateDigest(DigestType type, const uint8_t *data, size_t size)
+		{
+			assert(m_slots.empty());
+			hashBlock(type, data, size);
+		}
+
+		/**
+		 * Wait for all data to be hashed and get the digests.
+		 * No more data can be added after calling this function.
+		 * @param digests	[out] Digests
+		 */
+		void finish(RvtH_Image_Digests *digests);
+
+		/**
+		 * Write a digest sidecar file for a disc image.
+		 * The sidecar file is named "<image_filename>.digests".
+		 * @param image_filename	[in] Disc image filename
+		 * @param digests		[in] Digests
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		static int writeSidecar(const TCHAR *image_filename, const RvtH_Image_Digests *digests);
+
+	private:
+		/**
+		 * Digest thread function.
+		 * @param type Digest type
+		 */
+		void digestThread(DigestType type);
+
+		/**
+		 * Hash a block of data.
+		 * @param type Digest type
+		 * @param data Data
+		 * @param size Size of data, in bytes
+		 */
+		void hashBlock(DigestType type, const uint8_t *data, size_t size);
+
+	private:
+		struct Slot {
+			PoolBuffer buf;
+			size_t size = 0;
+			unsigned int pending = 0;	// Number of digest threads still using this buffer
+		};
+		std::vector<Slot> m_slots;
+		size_t m_buf_size;
+
+		// Digest state.
+		uint32_t m_crc32;
+		struct md5_ctx m_md5;
+		struct sha1_ctx m_sha1;
+
+		std::mutex m_mutex;
+		std::condition_variable m_cond;
+		uint64_t m_submitted;			// Number of buffers submitted
+		bool m_finished;			// No more buffers will be submitted
+
+		std::vector<std::thread> m_threads;
+		bool m_async;				// False if the threads couldn't be started
+		StatsCounters *m_stats;			// Counters of the operation that created this object
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_IMAGEDIGEST_HPP__ */
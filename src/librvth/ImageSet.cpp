@@ -0,0 +1,169 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * ImageSet.cpp: Open many disc images concurrently.                       *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "ImageSet.hpp"
+#include "rvth.hpp"
+#include "TitleKeyStore.hpp"
+#include "ThreadPool.hpp"
+#include "Trace.hpp"
+
+// C includes (C++ namespace)
+#include <cassert>
+#include <cerrno>
+
+// C++ includes
+#include <atomic>
+#include <mutex>
+#include <thread>
+using std::lock_guard;
+using std::mutex;
+
+// Maximum number of concurrent workers.
+// Too many concurrent opens would thrash a hard drive.
+static const unsigned int IMAGE_SET_MAX_THREADS = 16;
+
+/**
+ * Create an empty image set.
+ * @param threads	[in,opt] Number of worker threads (0 for auto; 1 for single-threaded)
+ */
+ImageSet::ImageSet(unsigned int threads)
+	: m_threads(threads)
+	, m_titleKeys(std::make_shared<TitleKeyStore>())
+{ }
+
+/**
+ * Close all images that haven't been released.
+ */
+ImageSet::~ImageSet()
+{
+	for (RvtH *rvth : m_images) {
+		delete rvth;
+	}
+}
+
+/**
+ * Open disc images or RVT-H disk images and add them to the set.
+ * Image indexes continue from the images that were already added.
+ * @param filenames	[in] Filenames.
+ * @param count		[in] Number of filenames.
+ * @param ready		[in,opt] Ready function.
+ * @param level		[in,opt] Bank entry initialization level. (See RvtH_BankInit_Level.)
+ * @return Number of images that were opened; -ECANCELED if the ready function stopped it.
+ */
+int ImageSet::open(const TCHAR *const *filenames, unsigned int count,
+	const ReadyFunc &ready, RvtH_BankInit_Level level)
+{
+	RVTH_TRACE_SPAN("ImageSet::open");
+
+	const unsigned int base = static_cast<unsigned int>(m_images.size());
+	m_images.resize(base + count, nullptr);
+	m_errors.resize(base + count, -ECANCELED);
+
+	// Determine the number of worker threads.
+	unsigned int threads = m_threads;
+	if (threads == 0) {
+		threads = std::thread::hardware_concurrency();
+		if (threads == 0) {
+			threads = 1;
+		}
+	}
+	if (threads > IMAGE_SET_MAX_THREADS) {
+		threads = IMAGE_SET_MAX_THREADS;
+	}
+	if (threads > count) {
+		threads = count;
+	}
+
+	// Each worker opens one image at a time. The images' bank entries
+	// are initialized on the same worker, since the workers already
+	// keep the disk busy.
+	mutex ready_mutex;
+	std::atomic<unsigned int> next(0);
+	std::atomic<bool> stopped(false);
+	unsigned int opened = 0;
+	auto worker_fn = [&]() {
+		unsigned int idx;
+		while (!stopped.load(std::memory_order_relaxed) &&
+		       (idx = next.fetch_add(1, std::memory_order_relaxed)) < count)
+		{
+			int err = 0;
+			RvtH *rvth = new RvtH(filenames[idx], &err);
+			if (err != 0 || !rvth->isOpen()) {
+				delete rvth;
+				rvth = nullptr;
+				if (err == 0) {
+					err = -EIO;
+				}
+			} else {
+				rvth->setTitleKeyStore(m_titleKeys);
+				rvth->initBankEntries(1, level);
+			}
+
+			lock_guard<mutex> lock(ready_mutex);
+			m_images[base + idx] = rvth;
+			m_errors[base + idx] = err;
+			if (rvth) {
+				opened++;
+			}
+			if (ready && !stopped.load(std::memory_order_relaxed) &&
+			    !ready(base + idx, rvth, err))
+			{
+				stopped.store(true, std::memory_order_relaxed);
+			}
+		}
+	};
+
+	ThreadPool::instance().run(threads, worker_fn);
+
+	return (stopped ? -ECANCELED : static_cast<int>(opened));
+}
+
+/**
+ * Get the number of images in the set.
+ * @return Number of images.
+ */
+unsigned int ImageSet::count(void) const
+{
+	return static_cast<unsigned int>(m_images.size());
+}
+
+/**
+ * Get an image.
+ * @param index	[in] Image index.
+ * @return RvtH object, or nullptr if it couldn't be opened or was released.
+ */
+RvtH *ImageSet::image(unsigned int index) const
+{
+	assert(index < m_images.size());
+	return m_images[index];
+}
+
+/**
+ * Get the error code from opening an image.
+ * @param index	[in] Image index.
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int ImageSet::error(unsigned int index) const
+{
+	assert(index < m_errors.size());
+	return m_errors[index];
+}
+
+/**
+ * Release an image from the set.
+ * The caller takes ownership of the RvtH object.
+ * @param index	[in] Image index.
+ * @return RvtH object, or nullptr if it couldn't be opened or was released.
+ */
+RvtH *ImageSet::release(unsigned int index)
+{
+	assert(index < m_images.size());
+	RvtH *const rvth = m_images[index];
+	m_images[index] = nullptr;
+	return rvth;
+}
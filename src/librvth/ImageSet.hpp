@@ -0,0 +1,115 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * ImageSet.hpp: Open many disc images concurrently.                       *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_IMAGESET_HPP__
+#define __RVTHTOOL_LIBRVTH_IMAGESET_HPP__
+
+#include "libwiicrypto/common.h"
+#include "rvth_enums.h"
+#include "tcharx.h"
+
+// C++ includes
+#include <functional>
+#include <memory>
+#include <vector>
+
+class RvtH;
+class TitleKeyStore;
+
+/**
+ * Set of RvtH objects, e.g. for indexing a directory of disc images.
+ *
+ * open() opens the images concurrently on the shared ThreadPool,
+ * and initializes their bank entries. Each image is reported
+ * to the ready function as soon as it's open, so the caller can
+ * process it while the remaining images are being opened.
+ *
+ * All images in the set share a title key store. (See TitleKeyStore.)
+ * Certificates are shared by all RvtH objects anyway. (See cert_store.h.)
+ */
+class ImageSet
+{
+	public:
+		/**
+		 * Ready function. Called for each image when it's open, in the
+		 * order the images finish opening, which may differ from the
+		 * order of the filenames. Calls are serialized, but they're made
+		 * on the worker threads. The ready function may call release().
+		 * @param index	[in] Image index.
+		 * @param rvth	[in] RvtH object, or nullptr on error. (Owned by the ImageSet.)
+		 * @param err	[in] Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 * @return True to continue; false to stop opening images.
+		 */
+		typedef std::function<bool(unsigned int index, RvtH *rvth, int err)> ReadyFunc;
+
+		/**
+		 * Create an empty image set.
+		 * @param threads	[in,opt] Number of worker threads (0 for auto; 1 for single-threaded)
+		 */
+		explicit ImageSet(unsigned int threads = 0);
+
+		/**
+		 * Close all images that haven't been released.
+		 */
+		~ImageSet();
+
+	private:
+		DISABLE_COPY(ImageSet)
+
+	public:
+		/**
+		 * Open disc images or RVT-H disk images and add them to the set.
+		 * Image indexes continue from the images that were already added.
+		 * @param filenames	[in] Filenames.
+		 * @param count		[in] Number of filenames.
+		 * @param ready		[in,opt] Ready function.
+		 * @param level		[in,opt] Bank entry initialization level. (See RvtH_BankInit_Level.)
+		 * @return Number of images that were opened; -ECANCELED if the ready function stopped it.
+		 */
+		int open(const TCHAR *const *filenames, unsigned int count,
+			const ReadyFunc &ready = nullptr,
+			RvtH_BankInit_Level level = RVTH_BANK_INIT_HEADER);
+
+		/**
+		 * Get the number of images in the set.
+		 * @return Number of images.
+		 */
+		unsigned int count(void) const;
+
+		/**
+		 * Get an image.
+		 * @param index	[in] Image index.
+		 * @return RvtH object, or nullptr if it couldn't be opened or was released.
+		 */
+		RvtH *image(unsigned int index) const;
+
+		/**
+		 * Get the error code from opening an image.
+		 * @param index	[in] Image index.
+		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		int error(unsigned int index) const;
+
+		/**
+		 * Release an image from the set.
+		 * The caller takes ownership of the RvtH object. Images that
+		 * have been processed can be released and deleted early, so
+		 * a large set doesn't keep all of its files open.
+		 * @param index	[in] Image index.
+		 * @return RvtH object, or nullptr if it couldn't be opened or was released.
+		 */
+		RvtH *release(unsigned int index);
+
+	private:
+		unsigned int m_threads;
+		std::shared_ptr<TitleKeyStore> m_titleKeys;
+		std::vector<RvtH*> m_images;
+		std::vector<int> m_errors;
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_IMAGESET_HPP__ */
@@ -0,0 +1,240 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * IoScheduler.cpp: Elevator-ordered I/O scheduling for a device.          *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "IoScheduler.hpp"
+#include "StatsCounters.hpp"
+
+// C includes (C++ namespace)
+#include <cassert>
+
+// C++ includes
+#include <algorithm>
+#include <map>
+using std::lock_guard;
+using std::map;
+using std::mutex;
+using std::shared_ptr;
+using std::unique_lock;
+using std::weak_ptr;
+using std::chrono::milliseconds;
+
+const size_t IoScheduler::MAX_BATCH_SIZE;
+
+// Reads up to this size are considered interactive,
+// e.g. bank metadata, and get the shortest deadline.
+static const size_t INTERACTIVE_SIZE = 64U*1024;
+
+// Request deadlines.
+static constexpr milliseconds DEADLINE_INTERACTIVE(50);
+static constexpr milliseconds DEADLINE_READ(500);
+static constexpr milliseconds DEADLINE_WRITE(2000);
+static constexpr milliseconds DEADLINE_LOW(5000);
+
+// Schedulers for each device. (protected by s_schedMutex)
+static mutex s_schedMutex;
+static map<uint64_t, weak_ptr<IoScheduler> > s_sched;
+
+IoScheduler::IoScheduler()
+	: m_running(0)
+	, m_batchEnd(0)
+	, m_batchSize(0)
+{ }
+
+/**
+ * Get the I/O scheduler for a device.
+ * The scheduler is created if the device doesn't have one yet.
+ * @param dev	[in] Device identifier. (device number, or drive number on Windows)
+ * @return I/O scheduler.
+ */
+shared_ptr<IoScheduler> IoScheduler::forDevice(uint64_t dev)
+{
+	lock_guard<mutex> lock(s_schedMutex);
+
+	// Remove schedulers for devices that are no longer open.
+	for (auto iter = s_sched.begin(); iter != s_sched.end(); ) {
+		if (iter->second.expired()) {
+			iter = s_sched.erase(iter);
+		} else {
+			++iter;
+		}
+	}
+
+	weak_ptr<IoScheduler> &entry = s_sched[dev];
+	shared_ptr<IoScheduler> sched = entry.lock();
+	if (!sched) {
+		sched = std::make_shared<IoScheduler>();
+		entry = sched;
+	}
+	return sched;
+}
+
+/**
+ * Wait until a request is dispatched.
+ * @param sched	[in,opt] I/O scheduler. (If nullptr, the request isn't scheduled.)
+ * @param offset	[in] Device offset.
+ * @param size		[in] Number of bytes to transfer.
+ * @param write		[in] True for a write; false for a read.
+ */
+IoScheduler::Ticket::Ticket(IoScheduler *sched, off64_t offset, size_t size, bool write)
+	: m_sched(size > 0 ? sched : nullptr)
+{
+	if (!m_sched) {
+		return;
+	}
+
+	// Low priority operations only get ahead of the
+	// elevator order if they've waited for a long time.
+	StatsCounters *const stats = StatsCounters::current();
+	const RvtH_IO_Priority prio = (stats
+		? stats->ioThrottle()->priority()
+		: RVTH_IOPRIO_NORMAL);
+
+	clock::duration deadline;
+	if (prio != RVTH_IOPRIO_NORMAL) {
+		deadline = DEADLINE_LOW;
+	} else if (write) {
+		deadline = DEADLINE_WRITE;
+	} else if (size <= INTERACTIVE_SIZE) {
+		deadline = DEADLINE_INTERACTIVE;
+	} else {
+		deadline = DEADLINE_READ;
+	}
+
+	m_req.offset = offset;
+	m_req.size = size;
+	m_req.deadline = clock::now() + deadline;
+	m_req.dispatched = false;
+	m_sched->submit(&m_req);
+}
+
+IoScheduler::Ticket::~Ticket()
+{
+	if (m_sched) {
+		m_sched->complete(&m_req);
+	}
+}
+
+/**
+ * Queue a request and wait until it's dispatched.
+ * @param req	[in,out] Request.
+ */
+void IoScheduler::submit(Request *req)
+{
+	unique_lock<mutex> lock(m_mutex);
+	const clock::time_point now = clock::now();
+	if (m_running == 0 && m_queue.empty()) {
+		// The device is idle.
+		m_batchSize = 0;
+		start_int(req);
+		return;
+	} else if (canJoinBatch_int(req, now)) {
+		// The request continues the current batch.
+		start_int(req);
+		return;
+	}
+
+	m_queue.push_back(req);
+	m_cond.wait(lock, [req] { return req->dispatched; });
+}
+
+/**
+ * Mark a dispatched request as complete.
+ * If it was the last request in the batch, the next batch is dispatched.
+ * @param req	[in] Request.
+ */
+void IoScheduler::complete(const Request *req)
+{
+	assert(req->dispatched);
+	((void)req);
+
+	lock_guard<mutex> lock(m_mutex);
+	assert(m_running > 0);
+	if (--m_running == 0 && !m_queue.empty()) {
+		dispatch_int(clock::now());
+	}
+}
+
+/**
+ * Can a request be added to the current batch?
+ * NOTE: m_mutex must be held by the caller.
+ * @param req	[in] Request.
+ * @param now	[in] Current time.
+ * @return True if the request continues the batch and no other request is overdue.
+ */
+bool IoScheduler::canJoinBatch_int(const Request *req, clock::time_point now) const
+{
+	if (m_running == 0 || req->offset != m_batchEnd ||
+	    req->size > MAX_BATCH_SIZE - std::min(m_batchSize, MAX_BATCH_SIZE))
+	{
+		return false;
+	}
+	return std::none_of(m_queue.cbegin(), m_queue.cend(),
+		[now](const Request *queued) { return queued->deadline <= now; });
+}
+
+/**
+ * Dispatch the next batch of queued requests.
+ * NOTE: m_mutex must be held by the caller, and no batch may be running.
+ * @param now	[in] Current time.
+ */
+void IoScheduler::dispatch_int(clock::time_point now)
+{
+	assert(m_running == 0);
+	assert(!m_queue.empty());
+
+	// Overdue requests are dispatched first, oldest deadline first.
+	// Otherwise, continue upwards from the end of the previous batch,
+	// and wrap around to the lowest offset at the end. (C-LOOK)
+	auto next = std::min_element(m_queue.begin(), m_queue.end(),
+		[](const Request *a, const Request *b) { return a->deadline < b->deadline; });
+	if ((*next)->deadline > now) {
+		const off64_t pos = m_batchEnd;
+		next = std::min_element(m_queue.begin(), m_queue.end(),
+			[pos](const Request *a, const Request *b) {
+				const bool a_ahead = (a->offset >= pos);
+				const bool b_ahead = (b->offset >= pos);
+				if (a_ahead != b_ahead) {
+					return a_ahead;
+				}
+				return a->offset < b->offset;
+			});
+	}
+
+	m_batchSize = 0;
+	start_int(*next);
+	m_queue.erase(next);
+
+	// Add queued requests that continue the batch.
+	bool found;
+	do {
+		found = false;
+		for (auto iter = m_queue.begin(); iter != m_queue.end(); ++iter) {
+			if (canJoinBatch_int(*iter, now)) {
+				start_int(*iter);
+				m_queue.erase(iter);
+				found = true;
+				break;
+			}
+		}
+	} while (found);
+
+	m_cond.notify_all();
+}
+
+/**
+ * Dispatch a request as part of the current batch.
+ * NOTE: m_mutex must be held by the caller.
+ * @param req	[in,out] Request.
+ */
+void IoScheduler::start_int(Request *req)
+{
+	req->dispatched = true;
+	m_running++;
+	m_batchSize += req->size;
+	m_batchEnd = req->offset + static_cast<off64_t>(req->size);
+}
@@ -0,0 +1,150 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * IoScheduler.hpp: Elevator-ordered I/O scheduling for a device.          *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_IOSCHEDULER_HPP__
+#define __RVTHTOOL_LIBRVTH_IOSCHEDULER_HPP__
+
+#include "libwiicrypto/common.h"
+
+// C includes
+#include <stddef.h>
+#include <stdint.h>
+
+// C++ includes
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * I/O scheduler for a device, shared by every RefFile that has the
+ * device open in this process.
+ *
+ * Each read and write of the device takes a Ticket, which waits until
+ * the scheduler dispatches the request. Requests are dispatched one
+ * batch at a time, in ascending offset order (C-LOOK), so concurrent
+ * jobs on different banks don't make the HDD seek back and forth.
+ * Requests that start where the current batch ends, e.g. the next
+ * chunks of a sequential copy, are added to the batch instead of
+ * waiting, up to MAX_BATCH_SIZE bytes, and run concurrently so the
+ * OS can merge them into one stream.
+ *
+ * Every request has a deadline that depends on its size and on the
+ * operation's I/O priority. Small reads, e.g. bank metadata for an
+ * interactive query, have the shortest deadline. Once a request's
+ * deadline has passed, it's dispatched before the elevator order.
+ *
+ * The I/O itself is done by the thread that took the Ticket, so it's
+ * still counted in that thread's StatsCounters and bandwidth limit.
+ */
+class IoScheduler
+{
+	public:
+		IoScheduler();
+
+	private:
+		DISABLE_COPY(IoScheduler)
+
+	public:
+		// Maximum size of a batch of consecutive requests.
+		static const size_t MAX_BATCH_SIZE = 16U*1024*1024;
+
+		/**
+		 * Get the I/O scheduler for a device.
+		 * The scheduler is created if the device doesn't have one yet.
+		 * @param dev	[in] Device identifier. (device number, or drive number on Windows)
+		 * @return I/O scheduler.
+		 */
+		static std::shared_ptr<IoScheduler> forDevice(uint64_t dev);
+
+	private:
+		typedef std::chrono::steady_clock clock;
+
+		struct Request {
+			off64_t offset;			// Starting offset
+			size_t size;			// Size, in bytes
+			clock::time_point deadline;	// Dispatched before the elevator order after this
+			bool dispatched;		// Has the request been dispatched?
+		};
+
+	public:
+		/**
+		 * Scheduled access to the device, for one read or write.
+		 * The constructor waits until the request is dispatched,
+		 * and the destructor marks it as complete.
+		 */
+		class Ticket
+		{
+			public:
+				/**
+				 * Wait until a request is dispatched.
+				 * @param sched	[in,opt] I/O scheduler. (If nullptr, the request isn't scheduled.)
+				 * @param offset	[in] Device offset.
+				 * @param size		[in] Number of bytes to transfer.
+				 * @param write		[in] True for a write; false for a read.
+				 */
+				Ticket(IoScheduler *sched, off64_t offset, size_t size, bool write);
+				~Ticket();
+
+			private:
+				DISABLE_COPY(Ticket)
+
+			private:
+				IoScheduler *const m_sched;
+				Request m_req;
+		};
+
+	private:
+		/**
+		 * Queue a request and wait until it's dispatched.
+		 * @param req	[in,out] Request.
+		 */
+		void submit(Request *req);
+
+		/**
+		 * Mark a dispatched request as complete.
+		 * If it was the last request in the batch, the next batch is dispatched.
+		 * @param req	[in] Request.
+		 */
+		void complete(const Request *req);
+
+		/**
+		 * Can a request be added to the current batch?
+		 * NOTE: m_mutex must be held by the caller.
+		 * @param req	[in] Request.
+		 * @param now	[in] Current time.
+		 * @return True if the request continues the batch and no other request is overdue.
+		 */
+		bool canJoinBatch_int(const Request *req, clock::time_point now) const;
+
+		/**
+		 * Dispatch the next batch of queued requests.
+		 * NOTE: m_mutex must be held by the caller, and no batch may be running.
+		 * @param now	[in] Current time.
+		 */
+		void dispatch_int(clock::time_point now);
+
+		/**
+		 * Dispatch a request as part of the current batch.
+		 * NOTE: m_mutex must be held by the caller.
+		 * @param req	[in,out] Request.
+		 */
+		void start_int(Request *req);
+
+	private:
+		std::mutex m_mutex;
+		std::condition_variable m_cond;
+		std::vector<Request*> m_queue;	// Requests that haven't been dispatched
+
+		unsigned int m_running;		// Number of dispatched requests that aren't complete
+		off64_t m_batchEnd;		// Offset following the current batch (elevator position)
+		size_t m_batchSize;		// Size of the current batch, in bytes
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_IOSCHEDULER_HPP__ */
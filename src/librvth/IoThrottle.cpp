@@ -0,0 +1,148 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * IoThrottle.cpp: I/O priority and bandwidth limit for an operation.      *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "IoThrottle.hpp"
+
+#ifdef _WIN32
+#  include <windows.h>
+#elif defined(__linux__)
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#endif
+
+// C++ includes
+#include <algorithm>
+#include <thread>
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+
+// Maximum burst, as a fraction of a second. (1/8 second)
+static constexpr steady_clock::duration BURST_TIME = std::chrono::milliseconds(125);
+
+// Maximum time to sleep before checking for cancellation.
+static constexpr steady_clock::duration SLEEP_MAX = std::chrono::milliseconds(50);
+
+#ifdef __linux__
+// ioprio values. (linux/ioprio.h isn't available on older systems.)
+#define RVTH_IOPRIO_CLASS_SHIFT		13
+#define RVTH_IOPRIO_CLASS_BE		2
+#define RVTH_IOPRIO_CLASS_IDLE		3
+#define RVTH_IOPRIO_WHO_PROCESS		1
+#define RVTH_IOPRIO_VALUE(cls, data)	(((cls) << RVTH_IOPRIO_CLASS_SHIFT) | (data))
+#endif /* __linux__ */
+
+IoThrottle::IoThrottle()
+	: m_priority(RVTH_IOPRIO_NORMAL)
+	, m_rate(0)
+{ }
+
+/**
+ * Set the bandwidth limit.
+ * @param bytes_per_sec Bandwidth limit, in bytes per second. (0 for no limit)
+ */
+void IoThrottle::setRate(uint64_t bytes_per_sec)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_rate.store(bytes_per_sec, std::memory_order_relaxed);
+	m_next = steady_clock::time_point();
+}
+
+/**
+ * Prepare the calling thread for a read or write.
+ * The thread's I/O priority is set, and if a bandwidth limit
+ * is set, this waits until the transfer is allowed, or until
+ * the operation is cancelled.
+ * @param bytes		[in] Number of bytes to transfer.
+ * @param cancel	[in,opt] Cancellation token.
+ */
+void IoThrottle::acquire(uint64_t bytes, const CancelToken *cancel)
+{
+	applyThreadPriority(m_priority.load(std::memory_order_relaxed));
+
+	const uint64_t rate = m_rate.load(std::memory_order_relaxed);
+	if (rate == 0) {
+		// No bandwidth limit.
+		return;
+	}
+
+	// Take this transfer's share of the bucket.
+	// If the bucket doesn't have enough, wait until it's refilled.
+	const nanoseconds cost(static_cast<int64_t>(
+		static_cast<double>(bytes) * 1e9 / static_cast<double>(rate)));
+	steady_clock::time_point now = steady_clock::now();
+	steady_clock::time_point start;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_next = std::max(m_next, now - BURST_TIME);
+		start = m_next;
+		m_next += cost;
+	}
+
+	while (now < start) {
+		if (cancel && cancel->isCancelled()) {
+			// The caller checks for cancellation before the transfer.
+			return;
+		}
+		std::this_thread::sleep_for(std::min<steady_clock::duration>(start - now, SLEEP_MAX));
+		now = steady_clock::now();
+	}
+}
+
+#ifdef __linux__
+/**
+ * Get the Linux ioprio value for an I/O priority,
+ * e.g. for io_uring submissions.
+ * @param prio I/O priority. (See RvtH_IO_Priority.)
+ * @return ioprio value. (0 for the default priority)
+ */
+uint16_t IoThrottle::linuxIoprio(RvtH_IO_Priority prio)
+{
+	switch (prio) {
+		default:
+		case RVTH_IOPRIO_NORMAL:
+			// Default priority, based on the CPU nice value.
+			return 0;
+		case RVTH_IOPRIO_LOW:
+			// Lowest best-effort priority.
+			return RVTH_IOPRIO_VALUE(RVTH_IOPRIO_CLASS_BE, 7);
+		case RVTH_IOPRIO_IDLE:
+			// Only when no other I/O is pending on the device.
+			return RVTH_IOPRIO_VALUE(RVTH_IOPRIO_CLASS_IDLE, 0);
+	}
+}
+#endif /* __linux__ */
+
+/**
+ * Set the calling thread's I/O priority if it was changed.
+ * @param prio I/O priority. (See RvtH_IO_Priority.)
+ */
+void IoThrottle::applyThreadPriority(RvtH_IO_Priority prio)
+{
+	// Threads start with the normal priority.
+	static thread_local RvtH_IO_Priority t_prio = RVTH_IOPRIO_NORMAL;
+	if (prio == t_prio) {
+		return;
+	}
+
+	// NOTE: Errors are ignored, since the I/O still works
+	// at the previous priority.
+#ifdef _WIN32
+	// Background mode lowers the thread's I/O and memory priority.
+	// There's only one background level, so LOW and IDLE are the same.
+	const bool bg_old = (t_prio != RVTH_IOPRIO_NORMAL);
+	const bool bg_new = (prio != RVTH_IOPRIO_NORMAL);
+	if (bg_old != bg_new) {
+		SetThreadPriority(GetCurrentThread(),
+			(bg_new ? THREAD_MODE_BACKGROUND_BEGIN : THREAD_MODE_BACKGROUND_END));
+	}
+#elif defined(__linux__) && defined(SYS_ioprio_set)
+	// NOTE: ioprio is per thread on Linux.
+	syscall(SYS_ioprio_set, RVTH_IOPRIO_WHO_PROCESS, 0, linuxIoprio(prio));
+#endif
+	t_prio = prio;
+}
@@ -0,0 +1,109 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * IoThrottle.hpp: I/O priority and bandwidth limit for an operation.      *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_IOTHROTTLE_HPP__
+#define __RVTHTOOL_LIBRVTH_IOTHROTTLE_HPP__
+
+#include "libwiicrypto/common.h"
+#include "CancelToken.hpp"
+#include "rvth_enums.h"
+
+// C includes
+#include <stdint.h>
+
+// C++ includes
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+/**
+ * I/O priority and bandwidth limit for the operations on an RvtH object.
+ * (See RvtH_CopyParams::io_priority and RvtH_CopyParams::bw_limit.)
+ *
+ * acquire() is called before each read and write of the device or disk
+ * image file by every thread that works on the operation. (See
+ * StatsCounters::throttleIO().) It sets the calling thread's I/O priority
+ * if it doesn't match, and then waits until the bandwidth limit allows
+ * the transfer.
+ *
+ * The bandwidth limit is a token bucket shared by all of the threads,
+ * so an operation's reader threads don't multiply the limit. Up to
+ * 1/8 second of unused bandwidth can be used as a burst.
+ */
+class IoThrottle
+{
+	public:
+		IoThrottle();
+
+	private:
+		DISABLE_COPY(IoThrottle)
+
+	public:
+		/**
+		 * Set the I/O priority.
+		 * @param prio I/O priority. (See RvtH_IO_Priority.)
+		 */
+		inline void setPriority(RvtH_IO_Priority prio)
+		{
+			m_priority.store(prio, std::memory_order_relaxed);
+		}
+
+		/**
+		 * Get the I/O priority.
+		 * @return I/O priority. (See RvtH_IO_Priority.)
+		 */
+		inline RvtH_IO_Priority priority(void) const
+		{
+			return m_priority.load(std::memory_order_relaxed);
+		}
+
+		/**
+		 * Set the bandwidth limit.
+		 * @param bytes_per_sec Bandwidth limit, in bytes per second. (0 for no limit)
+		 */
+		void setRate(uint64_t bytes_per_sec);
+
+		/**
+		 * Prepare the calling thread for a read or write.
+		 * The thread's I/O priority is set, and if a bandwidth limit
+		 * is set, this waits until the transfer is allowed, or until
+		 * the operation is cancelled.
+		 * @param bytes		[in] Number of bytes to transfer.
+		 * @param cancel	[in,opt] Cancellation token.
+		 */
+		void acquire(uint64_t bytes, const CancelToken *cancel);
+
+#ifdef __linux__
+		/**
+		 * Get the Linux ioprio value for an I/O priority,
+		 * e.g. for io_uring submissions.
+		 * @param prio I/O priority. (See RvtH_IO_Priority.)
+		 * @return ioprio value. (0 for the default priority)
+		 */
+		static uint16_t linuxIoprio(RvtH_IO_Priority prio);
+#endif /* __linux__ */
+
+	private:
+		/**
+		 * Set the calling thread's I/O priority if it was changed.
+		 * @param prio I/O priority. (See RvtH_IO_Priority.)
+		 */
+		static void applyThreadPriority(RvtH_IO_Priority prio);
+
+	private:
+		std::atomic<RvtH_IO_Priority> m_priority;
+		std::atomic<uint64_t> m_rate;	// Bytes per second (0 for no limit)
+
+		// Token bucket state. (protected by m_mutex)
+		// The bucket is empty at m_next, and full 1/8 second
+		// before it. Each transfer moves m_next forward.
+		std::mutex m_mutex;
+		std::chrono::steady_clock::time_point m_next;
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_IOTHROTTLE_HPP__ */
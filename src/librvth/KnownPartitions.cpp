@@ -0,0 +1,205 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * KnownPartitions.cpp: Database of known-good update partitions.          *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "config.librvth.h"
+
+#include "KnownPartitions.hpp"
+#include "cache_dir.hpp"
+
+// C includes (C++ namespace)
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+// C++ includes
+#include <algorithm>
+#include <string>
+#include <vector>
+using std::lock_guard;
+using std::mutex;
+using std::tstring;
+using std::vector;
+
+// Database filename, in the cache directory.
+static const TCHAR KNOWNPARTITIONS_FILENAME[] = _T("known_partitions.bin");
+
+// Maximum number of entries.
+// There are only a few dozen System Menu updates, so a larger
+// file is most likely corrupted.
+static const uint32_t KNOWNPARTITIONS_MAX_ENTRIES = 4096;
+
+// Database file header.
+// NOTE: Entries are stored in host-endian, so the entry size
+// and version are checked to reject databases from other builds.
+static const char KNOWNPARTITIONS_MAGIC[8] = {'R','V','T','H','K','N','P','T'};
+static const uint32_t KNOWNPARTITIONS_VERSION = 1;
+typedef struct _KnownPartitions_Header {
+	char magic[8];		// KNOWNPARTITIONS_MAGIC
+	uint32_t version;	// KNOWNPARTITIONS_VERSION
+	uint32_t entry_size;	// sizeof(KnownPartitions::Entry)
+	uint32_t entry_count;	// Number of entries
+	uint32_t reserved;
+} KnownPartitions_Header;
+
+/**
+ * Compare two entries for sorting.
+ * @param a Entry A
+ * @param b Entry B
+ * @return True if a < b.
+ */
+static inline bool entry_less(const KnownPartitions::Entry &a, const KnownPartitions::Entry &b)
+{
+	const int cmp = memcmp(a.content_hash, b.content_hash, sizeof(a.content_hash));
+	return (cmp != 0 ? cmp < 0 : a.data_size < b.data_size);
+}
+
+KnownPartitions::KnownPartitions()
+	: m_loaded(false)
+	, m_dirty(false)
+{ }
+
+/**
+ * Get the process-wide known partitions database.
+ * The database is loaded on first use.
+ * @return KnownPartitions
+ */
+KnownPartitions *KnownPartitions::instance(void)
+{
+	static KnownPartitions db;
+	return &db;
+}
+
+/**
+ * Load the database from the cache directory.
+ * m_mutex must be locked by the caller.
+ */
+void KnownPartitions::load(void)
+{
+	m_loaded = true;
+	m_filename = rvth_get_cache_directory();
+	if (m_filename.empty()) {
+		return;
+	}
+#ifdef _WIN32
+	m_filename += _T('\\');
+#else /* !_WIN32 */
+	m_filename += '/';
+#endif /* _WIN32 */
+	m_filename += KNOWNPARTITIONS_FILENAME;
+
+	// Load the existing database, if it's present.
+	FILE *f = _tfopen(m_filename.c_str(), _T("rb"));
+	if (!f) {
+		return;
+	}
+
+	KnownPartitions_Header header;
+	vector<Entry> entries;
+	bool ok = (fread(&header, 1, sizeof(header), f) == sizeof(header) &&
+		!memcmp(header.magic, KNOWNPARTITIONS_MAGIC, sizeof(header.magic)) &&
+		header.version == KNOWNPARTITIONS_VERSION &&
+		header.entry_size == sizeof(Entry) &&
+		header.entry_count <= KNOWNPARTITIONS_MAX_ENTRIES);
+	if (ok) {
+		entries.resize(header.entry_count);
+		ok = (fread(entries.data(), sizeof(Entry), entries.size(), f) == entries.size());
+	}
+	fclose(f);
+
+	if (ok) {
+		// The file should already be sorted, but it might
+		// have been edited by something else.
+		std::sort(entries.begin(), entries.end(), entry_less);
+		m_entries = std::move(entries);
+	}
+}
+
+/**
+ * Is a partition in the database?
+ * @param content_hash	[in] TMD content hash (H4; SHA-1 of the H3 table)
+ * @param data_size	[in] Partition data size, in bytes
+ * @return True if the partition is known to be good; false if not.
+ */
+bool KnownPartitions::contains(const uint8_t content_hash[20], uint64_t data_size)
+{
+	Entry key;
+	memset(&key, 0, sizeof(key));
+	memcpy(key.content_hash, content_hash, sizeof(key.content_hash));
+	key.data_size = data_size;
+
+	lock_guard<mutex> lock(m_mutex);
+	if (!m_loaded) {
+		load();
+	}
+	return std::binary_search(m_entries.cbegin(), m_entries.cend(), key, entry_less);
+}
+
+/**
+ * Add a partition to the database.
+ * The partition must have passed a full verification without errors.
+ * @param content_hash	[in] TMD content hash (H4; SHA-1 of the H3 table)
+ * @param data_size	[in] Partition data size, in bytes
+ */
+void KnownPartitions::add(const uint8_t content_hash[20], uint64_t data_size)
+{
+	Entry key;
+	memset(&key, 0, sizeof(key));
+	memcpy(key.content_hash, content_hash, sizeof(key.content_hash));
+	key.data_size = data_size;
+
+	lock_guard<mutex> lock(m_mutex);
+	if (!m_loaded) {
+		load();
+	}
+	auto iter = std::lower_bound(m_entries.begin(), m_entries.end(), key, entry_less);
+	if (iter != m_entries.end() && !entry_less(key, *iter)) {
+		// Already in the database.
+		return;
+	} else if (m_entries.size() >= KNOWNPARTITIONS_MAX_ENTRIES) {
+		// Database is full.
+		return;
+	}
+	m_entries.insert(iter, key);
+	m_dirty = true;
+}
+
+/**
+ * Save the database if it was modified.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int KnownPartitions::save(void)
+{
+	lock_guard<mutex> lock(m_mutex);
+	if (!m_dirty) {
+		return 0;
+	} else if (m_filename.empty()) {
+		return -ENOENT;
+	}
+
+	KnownPartitions_Header header;
+	memcpy(header.magic, KNOWNPARTITIONS_MAGIC, sizeof(header.magic));
+	header.version = KNOWNPARTITIONS_VERSION;
+	header.entry_size = sizeof(Entry);
+	header.entry_count = static_cast<uint32_t>(m_entries.size());
+	header.reserved = 0;
+
+	vector<uint8_t> data;
+	data.reserve(sizeof(header) + (m_entries.size() * sizeof(Entry)));
+	const uint8_t *const p_header = reinterpret_cast<const uint8_t*>(&header);
+	const uint8_t *const p_entries = reinterpret_cast<const uint8_t*>(m_entries.data());
+	data.insert(data.end(), p_header, p_header + sizeof(header));
+	data.insert(data.end(), p_entries, p_entries + (m_entries.size() * sizeof(Entry)));
+
+	int ret = rvth_write_cache_file(m_filename, data.data(), data.size());
+	if (ret != 0) {
+		return ret;
+	}
+
+	m_dirty = false;
+	return 0;
+}
@@ -0,0 +1,100 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * KnownPartitions.hpp: Database of known-good update partitions.          *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#pragma once
+
+#include "libwiicrypto/common.h"
+#include "tcharx.h"
+
+// C includes
+#include <stdint.h>
+
+// C++ includes
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Database of known-good update partitions.
+ *
+ * Most Wii discs have one of a small number of System Menu update
+ * partitions. When an update partition passes a full verification
+ * without any errors, its TMD content hash (H4) and data size are
+ * added to the database, which is stored in the user's cache directory.
+ *
+ * If RVTH_VERIFY_SKIP_KNOWN_PARTITIONS is set, the user data of a
+ * known partition isn't decrypted and hashed again. Its H4 hash and
+ * the H3, H2, and H1 hashes are still checked, so any change to the
+ * partition's data that is reflected in the hash tree is detected.
+ *
+ * The database is shared by all RvtH objects in the process.
+ */
+class KnownPartitions
+{
+	public:
+		KnownPartitions();
+
+	private:
+		DISABLE_COPY(KnownPartitions)
+
+	public:
+		/**
+		 * Get the process-wide known partitions database.
+		 * The database is loaded on first use.
+		 * @return KnownPartitions
+		 */
+		static KnownPartitions *instance(void);
+
+	public:
+		/**
+		 * Is a partition in the database?
+		 * @param content_hash	[in] TMD content hash (H4; SHA-1 of the H3 table)
+		 * @param data_size	[in] Partition data size, in bytes
+		 * @return True if the partition is known to be good; false if not.
+		 */
+		bool contains(const uint8_t content_hash[20], uint64_t data_size);
+
+		/**
+		 * Add a partition to the database.
+		 * The partition must have passed a full verification without errors.
+		 * @param content_hash	[in] TMD content hash (H4; SHA-1 of the H3 table)
+		 * @param data_size	[in] Partition data size, in bytes
+		 */
+		void add(const uint8_t content_hash[20], uint64_t data_size);
+
+		/**
+		 * Save the database if it was modified.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int save(void);
+
+	private:
+		/**
+		 * Load the database from the cache directory.
+		 * m_mutex must be locked by the caller.
+		 */
+		void load(void);
+
+	public:
+		/**
+		 * Known partition.
+		 * Stored in host-endian.
+		 */
+		struct Entry {
+			uint8_t content_hash[20];	// TMD content hash (H4)
+			uint32_t reserved;
+			uint64_t data_size;		// Partition data size, in bytes
+		};
+
+	private:
+		std::mutex m_mutex;
+		std::tstring m_filename;	// Database filename (empty if unavailable)
+		std::vector<Entry> m_entries;	// Sorted by content hash, then data size
+		bool m_loaded;
+		bool m_dirty;
+};
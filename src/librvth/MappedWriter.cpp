@@ -0,0 +1,216 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * MappedWriter.cpp: Write a disc image through a memory-mapped window.    *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "config.librvth.h"
+#include "MappedWriter.hpp"
+#include "StatsCounters.hpp"
+#include "reader/Reader.hpp"
+
+// For LBA_TO_BYTES()
+#include "nhcd_structs.h"
+
+// C includes
+#ifdef HAVE_MADVISE
+#  include <sys/mman.h>
+#endif /* HAVE_MADVISE */
+
+// C includes (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+// C++ includes
+#include <algorithm>
+
+// Default window size.
+#define MAPPED_WINDOW_SIZE_DEFAULT (64U*1024*1024)
+
+/**
+ * Create a mapped writer for a disc image.
+ * @param reader	[in] Destination reader. (must be preallocated)
+ * @param window_size	[in,opt] Window size, in bytes. (0 for default)
+ */
+MappedWriter::MappedWriter(Reader *reader, size_t window_size)
+	: m_reader(reader)
+	, m_file(nullptr)
+	, m_offset(0)
+	, m_lba_len(0)
+	, m_window_size(window_size != 0 ? window_size : MAPPED_WINDOW_SIZE_DEFAULT)
+	, m_win(nullptr)
+	, m_win_offset(0)
+	, m_win_size(0)
+	, m_err(0)
+{
+	assert(reader != nullptr);
+	RefFile *const file = reader->file();
+	if (!file || file->isRemote() || file->isStream() || file->isDevice()) {
+		// Only local files can be mapped.
+		return;
+	}
+
+	switch (file->durability()) {
+		case RVTH_DURABILITY_INTERVAL:
+		case RVTH_DURABILITY_WRITE_THROUGH:
+			// These sync as the data is written,
+			// which isn't possible with a mapping.
+			return;
+		default:
+			break;
+	}
+
+	// The image must be stored contiguously, and the file
+	// must already extend to the end of the image.
+	const uint32_t lba_len = reader->lba_len();
+	off64_t offset;
+	if (lba_len == 0 || !reader->fileOffset(0, lba_len, &offset)) {
+		return;
+	} else if (file->size() < offset + LBA_TO_BYTES(lba_len)) {
+		return;
+	}
+
+	m_file = file;
+	m_offset = offset;
+	m_lba_len = lba_len;
+}
+
+/**
+ * Unmap the window, starting its write-back.
+ */
+MappedWriter::~MappedWriter()
+{
+	unmapWindow(false);
+}
+
+/**
+ * Unmap the current window.
+ * @param wait	[in] If true, wait for the window to be written back.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int MappedWriter::unmapWindow(bool wait)
+{
+	if (!m_win) {
+		return 0;
+	}
+
+	const int ret = RefFile::flushMap(m_win, m_win_size, wait);
+	if (ret != 0 && m_err == 0) {
+		m_err = ret;
+	}
+	RefFile::unmap(m_win, m_win_size);
+	m_win = nullptr;
+	m_win_offset = 0;
+	m_win_size = 0;
+	return ret;
+}
+
+/**
+ * Get a writable view of a range of LBAs.
+ * The view remains valid until the next call to view()
+ * or write(), or until the writer is finished.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Pointer to the mapped data, or nullptr on error. (check errno)
+ */
+uint8_t *MappedWriter::view(uint32_t lba_start, uint32_t lba_len)
+{
+	assert(isOpen());
+	if (!isOpen()) {
+		errno = EBADF;
+		return nullptr;
+	} else if (lba_start > m_lba_len || lba_len > m_lba_len - lba_start) {
+		// Out of range.
+		errno = EIO;
+		return nullptr;
+	}
+
+	const off64_t offset = m_offset + LBA_TO_BYTES(lba_start);
+	const off64_t size = LBA_TO_BYTES(lba_len);
+	if (m_win && offset >= m_win_offset &&
+	    offset + size <= m_win_offset + static_cast<off64_t>(m_win_size))
+	{
+		// Range is in the current window.
+		return m_win + (offset - m_win_offset);
+	}
+
+	// Move the window. The previous window is written back
+	// in the background.
+	unmapWindow(false);
+
+	const off64_t img_end = m_offset + LBA_TO_BYTES(m_lba_len);
+	const off64_t align = static_cast<off64_t>(RefFile::mapAlignment());
+	const off64_t win_offset = offset - (offset % align);
+	const off64_t win_end = std::min(img_end,
+		std::max(offset + size, win_offset + static_cast<off64_t>(m_window_size)));
+	const size_t win_size = static_cast<size_t>(win_end - win_offset);
+
+	uint8_t *const win = m_file->mapWritable(win_offset, win_size);
+	if (!win) {
+		return nullptr;
+	}
+#if defined(HAVE_MADVISE) && defined(MADV_SEQUENTIAL)
+	// Failure isn't fatal; this only affects paging.
+	madvise(win, win_size, MADV_SEQUENTIAL);
+#endif /* HAVE_MADVISE && MADV_SEQUENTIAL */
+
+	m_win = win;
+	m_win_offset = win_offset;
+	m_win_size = win_size;
+	return m_win + (offset - m_win_offset);
+}
+
+/**
+ * Write data to the disc image.
+ * If the range can't be mapped, the Reader is used instead.
+ * @param ptr		[in] Write buffer.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Number of LBAs written, or 0 on error.
+ */
+uint32_t MappedWriter::write(const void *ptr, uint32_t lba_start, uint32_t lba_len)
+{
+	uint8_t *const dest = (isOpen() ? view(lba_start, lba_len) : nullptr);
+	if (!dest) {
+		// Can't be mapped. Write it normally.
+		return m_reader->write(ptr, lba_start, lba_len);
+	}
+
+	const size_t size = static_cast<size_t>(LBA_TO_BYTES(lba_len));
+	if (dest != ptr) {
+		memcpy(dest, ptr, size);
+	}
+	StatsCounters::addIO(size, true, false);
+	return lba_len;
+}
+
+/**
+ * Write back the current window and sync the disc image.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int MappedWriter::sync(void)
+{
+	if (m_win) {
+		// The window stays mapped.
+		const int ret = RefFile::flushMap(m_win, m_win_size, true);
+		if (ret != 0 && m_err == 0) {
+			m_err = ret;
+		}
+	}
+	m_reader->sync();
+	return m_err;
+}
+
+/**
+ * Write back and unmap the current window.
+ * The writer can still be used afterwards.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int MappedWriter::finish(void)
+{
+	unmapWindow(true);
+	return m_err;
+}
@@ -0,0 +1,119 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * MappedWriter.hpp: Write a disc image through a memory-mapped window.    *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_MAPPEDWRITER_HPP__
+#define __RVTHTOOL_LIBRVTH_MAPPEDWRITER_HPP__
+
+#include "libwiicrypto/common.h"
+#include "RefFile.hpp"
+
+// C includes
+#include <stdint.h>
+
+class Reader;
+
+/**
+ * Write a preallocated disc image through a sliding memory-mapped window.
+ *
+ * Data is copied directly into the page cache instead of going through
+ * stdio and a seek and write for each chunk, and view() lets a producer
+ * write its output into the mapping without a separate buffer. When the
+ * window moves on, write-back of the previous window is started without
+ * waiting for it.
+ *
+ * Only plain images on local files are supported, and the file must
+ * already be allocated up to the end of the image (see
+ * Reader::preallocate()), since a write to a hole on a full file system
+ * would crash instead of returning an error. Durability policies that
+ * sync during the copy aren't supported either. If the image can't be
+ * mapped, isOpen() returns false, and the caller should use the
+ * Reader's write functions instead.
+ */
+class MappedWriter
+{
+	public:
+		/**
+		 * Create a mapped writer for a disc image.
+		 * @param reader	[in] Destination reader. (must be preallocated)
+		 * @param window_size	[in,opt] Window size, in bytes. (0 for default)
+		 */
+		explicit MappedWriter(Reader *reader, size_t window_size = 0);
+
+		/**
+		 * Unmap the window, starting its write-back.
+		 */
+		~MappedWriter();
+
+	private:
+		DISABLE_COPY(MappedWriter)
+
+	public:
+		/**
+		 * Can the disc image be written through a mapping?
+		 * @return True if it can; false if not.
+		 */
+		inline bool isOpen(void) const
+		{
+			return (m_file != nullptr);
+		}
+
+		/**
+		 * Get a writable view of a range of LBAs.
+		 * The view remains valid until the next call to view()
+		 * or write(), or until the writer is finished.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Pointer to the mapped data, or nullptr on error. (check errno)
+		 */
+		uint8_t *view(uint32_t lba_start, uint32_t lba_len);
+
+		/**
+		 * Write data to the disc image.
+		 * If the range can't be mapped, the Reader is used instead.
+		 * @param ptr		[in] Write buffer.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Number of LBAs written, or 0 on error.
+		 */
+		uint32_t write(const void *ptr, uint32_t lba_start, uint32_t lba_len);
+
+		/**
+		 * Write back the current window and sync the disc image.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int sync(void);
+
+		/**
+		 * Write back and unmap the current window.
+		 * The writer can still be used afterwards.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int finish(void);
+
+	private:
+		/**
+		 * Unmap the current window.
+		 * @param wait	[in] If true, wait for the window to be written back.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int unmapWindow(bool wait);
+
+	private:
+		Reader *m_reader;
+		RefFile *m_file;		// nullptr if the image can't be mapped
+		off64_t m_offset;		// File offset of LBA 0
+		uint32_t m_lba_len;		// Image length, in LBAs
+		size_t m_window_size;		// Default window size, in bytes
+
+		uint8_t *m_win;			// Current window (nullptr if none)
+		off64_t m_win_offset;		// File offset of the current window
+		size_t m_win_size;		// Size of the current window, in bytes
+		int m_err;			// First write-back error
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_MAPPEDWRITER_HPP__ */
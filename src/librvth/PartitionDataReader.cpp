@@ -0,0 +1,218 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * PartitionDataReader.cpp: Read the user data of a disc partition.        *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "PartitionDataReader.hpp"
+#include "StatsCounters.hpp"
+
+// For LBA_TO_BYTES()
+#include "nhcd_structs.h"
+
+// Reader class
+#include "reader/Reader.hpp"
+
+// libwiicrypto
+#include "libwiicrypto/wii_sector.h"
+
+// C includes (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+// C++ includes
+#include <iterator>
+
+// Sectors per group.
+static constexpr uint32_t GROUP_SECTORS = GROUP_SIZE_ENC / SECTOR_SIZE_ENC;
+
+PartitionDataReader::PartitionDataReader(Reader *reader, AesCtx *aesw, uint32_t data_lba, uint32_t data_lba_len,
+	unsigned int cache_groups)
+	: m_reader(reader)
+	, m_aesw(aesw)
+	, m_data_lba(data_lba)
+	, m_data_lba_len(data_lba_len)
+	, m_cache_groups(cache_groups > 0 ? cache_groups : 1)
+{
+	assert(reader != nullptr);
+}
+
+PartitionDataReader::~PartitionDataReader()
+{ }
+
+/**
+ * Get the size of the user data.
+ * @return Size of the user data, in bytes.
+ */
+uint64_t PartitionDataReader::size(void) const
+{
+	if (!m_aesw) {
+		return LBA_TO_BYTES(m_data_lba_len);
+	}
+	return static_cast<uint64_t>(m_data_lba_len / BYTES_TO_LBA(SECTOR_SIZE_ENC)) * SECTOR_SIZE_DEC;
+}
+
+/**
+ * Get a decrypted group, reading and decrypting the specified
+ * sectors if they aren't cached.
+ * @param group_idx	[in] Group index.
+ * @param first		[in] First sector needed, relative to the group.
+ * @param last		[in] Last sector needed, relative to the group.
+ * @return Group, or nullptr on error. (errno is set)
+ */
+const PartitionDataReader::Group *PartitionDataReader::getGroup(uint32_t group_idx, uint32_t first, uint32_t last)
+{
+	static const uint32_t SECTOR_LBA = BYTES_TO_LBA(SECTOR_SIZE_ENC);
+	assert(first <= last);
+	assert(last < GROUP_SECTORS);
+
+	auto iter = m_groups.begin();
+	for (; iter != m_groups.end(); ++iter) {
+		if (iter->idx == group_idx) {
+			// Move the group to the front of the list.
+			m_groups.splice(m_groups.begin(), m_groups, iter);
+			break;
+		}
+	}
+	if (iter == m_groups.end()) {
+		// Reuse the least recently used group if the cache is full.
+		if (m_groups.size() < m_cache_groups) {
+			m_groups.emplace_front();
+			m_groups.front().data.reset(new uint8_t[GROUP_SIZE_ENC]);
+		} else {
+			m_groups.splice(m_groups.begin(), m_groups, std::prev(m_groups.end()));
+		}
+
+		Group &group = m_groups.front();
+		const uint32_t sector_total = m_data_lba_len / SECTOR_LBA;
+		uint32_t count = sector_total - (group_idx * GROUP_SECTORS);
+		if (count > GROUP_SECTORS) {
+			count = GROUP_SECTORS;
+		}
+		group.idx = group_idx;
+		group.sector_count = count;
+		group.loaded = 0;
+	}
+	Group &group = m_groups.front();
+	assert(last < group.sector_count);
+
+	// Read and decrypt each run of sectors that isn't loaded yet.
+	for (uint32_t i = first; i <= last; ) {
+		if (group.loaded & (1ULL << i)) {
+			i++;
+			continue;
+		}
+		uint32_t run_end = i + 1;
+		while (run_end <= last && !(group.loaded & (1ULL << run_end))) {
+			run_end++;
+		}
+
+		errno = 0;
+		const uint32_t lba_len = (run_end - i) * SECTOR_LBA;
+		const uint32_t lba_size = m_reader->read(&group.data[i * SECTOR_SIZE_ENC],
+			m_data_lba + (((group_idx * GROUP_SECTORS) + i) * SECTOR_LBA), lba_len);
+		if (lba_size != lba_len) {
+			// Read error.
+			if (errno == 0) {
+				errno = EIO;
+			}
+			return nullptr;
+		}
+
+		// IV is stored in the encrypted hash area.
+		StatsTimer timer(StatsCounters::TIMER_AES);
+		Wii_Disc_Sector_t *sector = reinterpret_cast<Wii_Disc_Sector_t*>(group.data.get()) + i;
+		for (; i < run_end; i++, sector++) {
+			aesw_set_iv(m_aesw, &sector->hashes.H2[7][4], 16);
+			aesw_decrypt(m_aesw, sector->data, sizeof(sector->data));
+			group.loaded |= (1ULL << i);
+		}
+	}
+	return &group;
+}
+
+/**
+ * Read user data from the partition.
+ * @param buf		[out] Output buffer.
+ * @param offset	[in] Offset in the user data.
+ * @param size		[in] Number of bytes to read.
+ * @return True on success; false on error. (errno is set)
+ */
+bool PartitionDataReader::read(void *buf, uint64_t offset, uint32_t size)
+{
+	if (offset > this->size() || size > this->size() - offset) {
+		// Out of range.
+		errno = EIO;
+		return false;
+	}
+
+	uint8_t *buf8 = static_cast<uint8_t*>(buf);
+	if (!m_aesw) {
+		// Unencrypted data. Read whole LBAs using the sector buffer.
+		static const uint32_t BUF_LBA = BYTES_TO_LBA(GROUP_SIZE_ENC);
+		if (!m_buf) {
+			m_buf.reset(new uint8_t[GROUP_SIZE_ENC]);
+		}
+		while (size > 0) {
+			const uint32_t lba = static_cast<uint32_t>(offset / LBA_SIZE);
+			const uint32_t lba_offset = static_cast<uint32_t>(offset % LBA_SIZE);
+			uint32_t lba_len = BYTES_TO_LBA(static_cast<uint64_t>(lba_offset) + size + LBA_SIZE - 1);
+			if (lba_len > BUF_LBA) {
+				lba_len = BUF_LBA;
+			}
+
+			errno = 0;
+			const uint32_t lba_size = m_reader->read(m_buf.get(), m_data_lba + lba, lba_len);
+			if (lba_size != lba_len) {
+				// Read error.
+				if (errno == 0) {
+					errno = EIO;
+				}
+				return false;
+			}
+
+			uint32_t copy_len = static_cast<uint32_t>(LBA_TO_BYTES(lba_len)) - lba_offset;
+			if (copy_len > size) {
+				copy_len = size;
+			}
+			memcpy(buf8, &m_buf[lba_offset], copy_len);
+			buf8 += copy_len;
+			offset += copy_len;
+			size -= copy_len;
+		}
+		return true;
+	}
+
+	while (size > 0) {
+		// Get all of the sectors needed from this group at once.
+		const uint32_t sector_idx = static_cast<uint32_t>(offset / SECTOR_SIZE_DEC);
+		const uint32_t group_idx = sector_idx / GROUP_SECTORS;
+		uint32_t last_idx = static_cast<uint32_t>((offset + size - 1) / SECTOR_SIZE_DEC);
+		if (last_idx / GROUP_SECTORS != group_idx) {
+			last_idx = (group_idx * GROUP_SECTORS) + GROUP_SECTORS - 1;
+		}
+		const Group *const group = getGroup(group_idx,
+			sector_idx % GROUP_SECTORS, last_idx % GROUP_SECTORS);
+		if (!group) {
+			return false;
+		}
+
+		const Wii_Disc_Sector_t *sector =
+			reinterpret_cast<const Wii_Disc_Sector_t*>(group->data.get()) + (sector_idx % GROUP_SECTORS);
+		for (uint32_t i = sector_idx; i <= last_idx; i++, sector++) {
+			const uint32_t sector_offset = static_cast<uint32_t>(offset % SECTOR_SIZE_DEC);
+			uint32_t copy_len = SECTOR_SIZE_DEC - sector_offset;
+			if (copy_len > size) {
+				copy_len = size;
+			}
+			memcpy(buf8, &sector->data[sector_offset], copy_len);
+			buf8 += copy_len;
+			offset += copy_len;
+			size -= copy_len;
+		}
+	}
+	return true;
+}
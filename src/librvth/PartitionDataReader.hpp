@@ -0,0 +1,99 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * PartitionDataReader.hpp: Read the user data of a disc partition.        *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#pragma once
+
+#include "common.h"
+#include "aesw.h"
+
+// C includes
+#include <stdint.h>
+
+// C++ includes
+#include <list>
+#include <memory>
+
+class Reader;
+
+/**
+ * Reads the user data of a disc partition by offset.
+ *
+ * For encrypted Wii partitions, only the sectors overlapping a read
+ * are read and decrypted, so a small random read costs one 32 KB
+ * sector instead of a 2 MB group. The most recently used groups are
+ * kept in a bounded cache along with the sectors that were decrypted,
+ * so small reads near each other, e.g. from a filesystem frontend or
+ * a debugger, don't read or decrypt the same sector again.
+ *
+ * GameCube discs and unencrypted Wii partitions store the user data
+ * contiguously without hash blocks, so it's read directly.
+ *
+ * This class is not thread-safe.
+ */
+class PartitionDataReader
+{
+	public:
+		/**
+		 * @param reader	[in] Reader.
+		 * @param aesw		[in,opt] AES context with the title key set, or NULL if the data is unencrypted.
+		 * @param data_lba	[in] Starting LBA of the partition data.
+		 * @param data_lba_len	[in] Length of the partition data, in LBAs.
+		 * @param cache_groups	[in,opt] Number of decrypted groups to cache. (minimum 1)
+		 */
+		PartitionDataReader(Reader *reader, AesCtx *aesw, uint32_t data_lba, uint32_t data_lba_len,
+			unsigned int cache_groups = 1);
+		~PartitionDataReader();
+
+	private:
+		DISABLE_COPY(PartitionDataReader)
+
+	public:
+		/**
+		 * Read user data from the partition.
+		 * @param buf		[out] Output buffer.
+		 * @param offset	[in] Offset in the user data.
+		 * @param size		[in] Number of bytes to read.
+		 * @return True on success; false on error. (errno is set)
+		 */
+		bool read(void *buf, uint64_t offset, uint32_t size);
+
+		/**
+		 * Get the size of the user data.
+		 * @return Size of the user data, in bytes.
+		 */
+		uint64_t size(void) const;
+
+	private:
+		// Decrypted group.
+		struct Group {
+			uint32_t idx;				// Group index
+			uint32_t sector_count;			// Number of sectors in the group (less than 64 for the last group)
+			uint64_t loaded;			// Bitfield of sectors that have been read and decrypted
+			std::unique_ptr<uint8_t[]> data;	// Encrypted hash blocks and decrypted user data
+		};
+
+		/**
+		 * Get a decrypted group, reading and decrypting the specified
+		 * sectors if they aren't cached.
+		 * @param group_idx	[in] Group index.
+		 * @param first		[in] First sector needed, relative to the group.
+		 * @param last		[in] Last sector needed, relative to the group.
+		 * @return Group, or nullptr on error. (errno is set)
+		 */
+		const Group *getGroup(uint32_t group_idx, uint32_t first, uint32_t last);
+
+	private:
+		Reader *const m_reader;
+		AesCtx *const m_aesw;
+		const uint32_t m_data_lba;
+		const uint32_t m_data_lba_len;
+		const unsigned int m_cache_groups;
+
+		std::list<Group> m_groups;		// Cached groups (most recently used first)
+		std::unique_ptr<uint8_t[]> m_buf;	// Bounce buffer for unencrypted data
+};
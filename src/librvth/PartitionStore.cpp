@@ -0,0 +1,536 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * PartitionStore.cpp: Content-addressed store for Wii partitions.         *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "PartitionStore.hpp"
+#include "ptbl.h"
+#include "zero_scan.h"
+
+#include "reader/Reader.hpp"
+#include "BufferPool.hpp"
+#include "RefFile.hpp"
+
+// libwiicrypto
+#include "libwiicrypto/wii_structs.h"
+#include "libwiicrypto/wii_sector.h"
+
+#include "byteswap.h"
+#include "nhcd_structs.h"
+
+// Nettle SHA-1
+#include <nettle/sha1.h>
+
+// C includes
+#include <sys/stat.h>
+#ifdef _WIN32
+#  include <direct.h>
+#endif /* _WIN32 */
+
+// C includes (C++ namespace)
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+// C++ includes
+#include <algorithm>
+using std::tstring;
+using std::vector;
+
+// Reference file format.
+// Text file; the first line is the magic and version,
+// followed by one line per stored partition:
+// [type] [lba_start] [lba_len] [content hash] [H3 table hash]
+static const char PREFS_MAGIC[] = "RVTHPREF 1";
+
+// Maximum partition data offset. (partition header and H3 table)
+// This is usually 0x20000.
+#define PART_DATA_OFFSET_MAX (1024U * 1024U)
+
+// Copy chunk size.
+#define COPY_CHUNK_SIZE (1024U * 1024U)
+
+PartitionStore::PartitionStore(const TCHAR *dir)
+	: m_dir(dir)
+{ }
+
+/**
+ * Parse the start of a partition.
+ * @param prefix	[in] Start of the partition, up to at least the data offset
+ * @param size		[in] Size of prefix, in bytes
+ * @param lba_max	[in] Maximum length of the partition, in LBAs
+ * @param ref		[out] Partition reference (only lba_len and the hashes are set)
+ * @return 0 on success; -EIO if the partition header is invalid.
+ */
+static int parse_prefix(const uint8_t *prefix, size_t size, uint32_t lba_max, PartitionRef *ref)
+{
+	if (size < sizeof(RVL_PartitionHeader)) {
+		return -EIO;
+	}
+	const RVL_PartitionHeader *const pt_hdr = reinterpret_cast<const RVL_PartitionHeader*>(prefix);
+
+	// TMD must be located within the partition header.
+	const unsigned int tmd_offset = be32_to_cpu(pt_hdr->tmd_offset) << 2;
+	const unsigned int tmd_size = be32_to_cpu(pt_hdr->tmd_size);
+	if (tmd_offset == 0 || tmd_offset > sizeof(RVL_PartitionHeader) ||
+	    tmd_size < (sizeof(RVL_TMD_Header) + sizeof(RVL_Content_Entry)) ||
+	    tmd_offset + sizeof(RVL_TMD_Header) + sizeof(RVL_Content_Entry) > sizeof(RVL_PartitionHeader))
+	{
+		// TMD offset and/or size is invalid.
+		return -EIO;
+	}
+	const RVL_TMD_Header *const pTmd = reinterpret_cast<const RVL_TMD_Header*>(prefix + tmd_offset);
+	if (pTmd->nbr_cont != cpu_to_be16(1)) {
+		// Disc partitions should only have one content in the TMD!
+		return -EIO;
+	}
+	const RVL_Content_Entry *const pContentEntry = reinterpret_cast<const RVL_Content_Entry*>(
+		prefix + tmd_offset + sizeof(RVL_TMD_Header));
+
+	// H3 table must be located before the partition data.
+	const uint64_t h3_offset = static_cast<uint64_t>(be32_to_cpu(pt_hdr->h3_table_offset)) << 2;
+	const uint64_t data_offset = static_cast<uint64_t>(be32_to_cpu(pt_hdr->data_offset)) << 2;
+	const uint64_t data_size = static_cast<uint64_t>(be32_to_cpu(pt_hdr->data_size)) << 2;
+	if (h3_offset < sizeof(RVL_PartitionHeader) ||
+	    h3_offset + sizeof(Wii_Disc_H3_t) > data_offset ||
+	    data_offset > size || data_size == 0)
+	{
+		return -EIO;
+	}
+
+	const uint64_t lba_len = (data_offset + data_size + LBA_SIZE - 1) / LBA_SIZE;
+	if (lba_len > lba_max) {
+		// Partition data is truncated.
+		return -EIO;
+	}
+	ref->lba_len = static_cast<uint32_t>(lba_len);
+
+	memcpy(ref->content_hash, pContentEntry->sha1_hash, sizeof(ref->content_hash));
+	struct sha1_ctx sha1;
+	sha1_init(&sha1);
+	sha1_update(&sha1, sizeof(Wii_Disc_H3_t), prefix + h3_offset);
+	sha1_digest(&sha1, sizeof(ref->h3_hash), ref->h3_hash);
+	return 0;
+}
+
+/**
+ * Get the reference for a partition in a disc image.
+ * This reads the partition header and the H3 table.
+ * @param entry		[in] Bank entry
+ * @param pte		[in] Partition table entry (from entry->ptbl)
+ * @param ref		[out] Partition reference
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int PartitionStore::getRef(RvtH_BankEntry *entry, const pt_entry_t *pte, PartitionRef *ref)
+{
+	const RVL_PartitionHeader *const pt_hdr = rvth_ptbl_get_header(entry, pte);
+	if (!pt_hdr) {
+		// Read error.
+		int err = errno;
+		if (err == 0) {
+			err = EIO;
+			errno = EIO;
+		}
+		return -err;
+	}
+
+	// Read everything up to the partition data.
+	// The partition header is already cached, so only the rest is read.
+	const uint64_t data_offset = static_cast<uint64_t>(be32_to_cpu(pt_hdr->data_offset)) << 2;
+	if (data_offset < sizeof(RVL_PartitionHeader) || data_offset > PART_DATA_OFFSET_MAX) {
+		errno = EIO;
+		return -EIO;
+	}
+	const uint32_t prefix_lba_len = BYTES_TO_LBA(data_offset + LBA_SIZE - 1);
+	PoolBuffer prefix(LBA_TO_BYTES(prefix_lba_len));
+	if (!prefix) {
+		errno = ENOMEM;
+		return -ENOMEM;
+	}
+	static const uint32_t pt_hdr_lba_len = BYTES_TO_LBA(sizeof(RVL_PartitionHeader));
+	memcpy(prefix.get(), pt_hdr, sizeof(*pt_hdr));
+	const uint32_t rest_lba_len = prefix_lba_len - pt_hdr_lba_len;
+	const uint32_t lba_size = (rest_lba_len == 0) ? 0 : entry->reader->read(
+		prefix.get() + sizeof(*pt_hdr),
+		pte->lba_start + pt_hdr_lba_len, rest_lba_len);
+	if (lba_size != rest_lba_len) {
+		// Read error.
+		int err = errno;
+		if (err == 0) {
+			err = EIO;
+			errno = EIO;
+		}
+		return -err;
+	}
+
+	memset(ref, 0, sizeof(*ref));
+	ref->type = pte->type;
+	ref->lba_start = pte->lba_start;
+	int ret = parse_prefix(prefix.get(), LBA_TO_BYTES(prefix_lba_len), pte->lba_len, ref);
+	if (ret != 0) {
+		errno = -ret;
+	}
+	return ret;
+}
+
+/**
+ * Append a hexadecimal string to a tstring.
+ * @param str	[in/out] String
+ * @param data	[in] Data
+ * @param size	[in] Size of data
+ */
+static void append_hex(tstring &str, const uint8_t *data, size_t size)
+{
+	static const TCHAR hex[] = _T("0123456789abcdef");
+	for (size_t i = 0; i < size; i++) {
+		str += hex[data[i] >> 4];
+		str += hex[data[i] & 0x0F];
+	}
+}
+
+/**
+ * Get the filename of a stored partition.
+ * @param ref	[in] Partition reference
+ * @return Filename
+ */
+tstring PartitionStore::filename(const PartitionRef &ref) const
+{
+	tstring filename = m_dir;
+#ifdef _WIN32
+	filename += _T('\\');
+#else /* !_WIN32 */
+	filename += '/';
+#endif /* _WIN32 */
+	append_hex(filename, ref.content_hash, sizeof(ref.content_hash));
+	filename += _T('-');
+	append_hex(filename, ref.h3_hash, sizeof(ref.h3_hash));
+	filename += _T(".part");
+	return filename;
+}
+
+/**
+ * Check if a partition is in the store.
+ * @param ref	[in] Partition reference
+ * @return True if the partition is stored; false if not.
+ */
+bool PartitionStore::contains(const PartitionRef &ref) const
+{
+	RefFile *const file = new RefFile(filename(ref).c_str());
+	const bool ret = (file->isOpen() && file->size() == LBA_TO_BYTES(ref.lba_len));
+	file->unref();
+	return ret;
+}
+
+/**
+ * Copy a partition from a disc image to the store.
+ * If the partition is already stored, nothing is copied.
+ * @param reader	[in] Reader for the disc image
+ * @param ref		[in] Partition reference
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int PartitionStore::store(Reader *reader, const PartitionRef &ref)
+{
+	if (contains(ref)) {
+		// Already stored.
+		return 0;
+	}
+
+	// Create the store directory if it doesn't exist.
+#ifdef _WIN32
+	int ret = _tmkdir(m_dir.c_str());
+#else /* !_WIN32 */
+	int ret = _tmkdir(m_dir.c_str(), 0755);
+#endif /* _WIN32 */
+	if (ret != 0 && errno != EEXIST) {
+		int err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		return -err;
+	}
+
+	PoolBuffer buf(COPY_CHUNK_SIZE);
+	if (!buf) {
+		errno = ENOMEM;
+		return -ENOMEM;
+	}
+
+	// The partition is written to a temporary file, which is then
+	// renamed, so an interrupted copy isn't mistaken for a stored partition.
+	const tstring filename = this->filename(ref);
+	const tstring tmp_filename = filename + _T(".tmp");
+	errno = 0;
+	FILE *f = _tfopen(tmp_filename.c_str(), _T("wb"));
+	if (!f) {
+		int err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		return -err;
+	}
+
+	int err = 0;
+	const uint32_t lba_count_buf = BYTES_TO_LBA(COPY_CHUNK_SIZE);
+	for (uint32_t lba = 0; lba < ref.lba_len; lba += lba_count_buf) {
+		const uint32_t lba_count = std::min(lba_count_buf, ref.lba_len - lba);
+		if (reader->read(buf.get(), ref.lba_start + lba, lba_count) != lba_count) {
+			// Read error.
+			err = (errno != 0 ? errno : EIO);
+			break;
+		}
+		const size_t size = static_cast<size_t>(LBA_TO_BYTES(lba_count));
+		if (fwrite(buf.get(), 1, size, f) != size) {
+			// Write error.
+			err = (errno != 0 ? errno : EIO);
+			break;
+		}
+	}
+	if (fclose(f) != 0 && err == 0) {
+		err = (errno != 0 ? errno : EIO);
+	}
+
+#ifdef _WIN32
+	// rename() doesn't replace existing files on Windows.
+	if (err == 0) {
+		_tremove(filename.c_str());
+	}
+#endif /* _WIN32 */
+	if (err == 0 && _trename(tmp_filename.c_str(), filename.c_str()) != 0) {
+		err = (errno != 0 ? errno : EIO);
+	}
+	if (err != 0) {
+		_tremove(tmp_filename.c_str());
+		errno = err;
+		return -err;
+	}
+	return 0;
+}
+
+/**
+ * Copy a stored partition to a disc image.
+ * Empty blocks are skipped, so the destination must be zeroed.
+ * @param ref		[in] Partition reference
+ * @param reader	[in] Writable reader for the disc image
+ * @return 0 on success; negative POSIX error code on error. (-EBADMSG if the stored partition doesn't match)
+ */
+int PartitionStore::restore(const PartitionRef &ref, Reader *reader) const
+{
+	RefFile *const file = new RefFile(filename(ref).c_str());
+	if (!file->isOpen()) {
+		int err = file->lastError();
+		if (err == 0) {
+			err = ENOENT;
+		}
+		file->unref();
+		errno = err;
+		return -err;
+	}
+	if (file->size() != LBA_TO_BYTES(ref.lba_len)) {
+		// Stored partition is the wrong size.
+		file->unref();
+		errno = EBADMSG;
+		return -EBADMSG;
+	}
+
+	PoolBuffer buf(COPY_CHUNK_SIZE);
+	if (!buf) {
+		file->unref();
+		errno = ENOMEM;
+		return -ENOMEM;
+	}
+
+	int err = 0;
+	const uint32_t lba_count_buf = BYTES_TO_LBA(COPY_CHUNK_SIZE);
+	for (uint32_t lba = 0; lba < ref.lba_len; lba += lba_count_buf) {
+		const uint32_t lba_count = std::min(lba_count_buf, ref.lba_len - lba);
+		const size_t size = static_cast<size_t>(LBA_TO_BYTES(lba_count));
+		if (file->pread(buf.get(), size, LBA_TO_BYTES(lba)) != size) {
+			// Read error.
+			err = (errno != 0 ? errno : EIO);
+			break;
+		}
+
+		if (lba == 0) {
+			// Make sure the stored partition matches the reference.
+			PartitionRef stored_ref;
+			if (parse_prefix(buf.get(), size, ref.lba_len, &stored_ref) != 0 ||
+			    stored_ref.lba_len != ref.lba_len ||
+			    memcmp(stored_ref.content_hash, ref.content_hash, sizeof(ref.content_hash)) != 0 ||
+			    memcmp(stored_ref.h3_hash, ref.h3_hash, sizeof(ref.h3_hash)) != 0)
+			{
+				err = EBADMSG;
+				break;
+			}
+		}
+
+		// Write the non-empty 4 KB blocks.
+		// Contiguous non-empty blocks are written using a single write.
+		uint32_t run_start = 0, run_len = 0;
+		for (uint32_t blk = 0; blk < lba_count && err == 0; blk += 8) {
+			const uint32_t blk_len = std::min(8U, lba_count - blk);
+			if (!rvth_is_zero(buf.get() + LBA_TO_BYTES(blk), static_cast<size_t>(LBA_TO_BYTES(blk_len)))) {
+				if (run_len == 0) {
+					run_start = blk;
+				}
+				run_len += blk_len;
+				if (blk + blk_len < lba_count)
+					continue;
+			}
+			if (run_len != 0) {
+				if (reader->write(buf.get() + LBA_TO_BYTES(run_start), ref.lba_start + lba + run_start, run_len) != run_len) {
+					// Write error.
+					err = (errno != 0 ? errno : EIO);
+				}
+				run_len = 0;
+			}
+		}
+		if (err != 0)
+			break;
+	}
+
+	file->unref();
+	if (err != 0) {
+		errno = err;
+		return -err;
+	}
+	return 0;
+}
+
+/** Reference files **/
+
+/**
+ * Get the reference filename for a disc image.
+ * @param image_filename	[in] Disc image filename
+ * @return Reference filename ("<image>.prefs")
+ */
+tstring PartitionStore::refsFilenameForImage(const TCHAR *image_filename)
+{
+	tstring filename(image_filename);
+	filename += _T(".prefs");
+	return filename;
+}
+
+/**
+ * Convert a hexadecimal string to binary.
+ * @param str	[in] Hexadecimal string (size * 2 characters)
+ * @param data	[out] Data
+ * @param size	[in] Size of data
+ * @return True on success; false if the string is invalid.
+ */
+static bool parse_hex(const char *str, uint8_t *data, size_t size)
+{
+	for (size_t i = 0; i < size * 2; i++) {
+		const char chr = str[i];
+		uint8_t nybble;
+		if (chr >= '0' && chr <= '9') {
+			nybble = chr - '0';
+		} else if (chr >= 'a' && chr <= 'f') {
+			nybble = chr - 'a' + 10;
+		} else if (chr >= 'A' && chr <= 'F') {
+			nybble = chr - 'A' + 10;
+		} else {
+			return false;
+		}
+		if (i & 1) {
+			data[i / 2] |= nybble;
+		} else {
+			data[i / 2] = nybble << 4;
+		}
+	}
+	return (str[size * 2] == '\0');
+}
+
+/**
+ * Save partition references to a file.
+ * @param filename	[in] Reference filename
+ * @param refs		[in] Partition references
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int PartitionStore::saveRefs(const TCHAR *filename, const vector<PartitionRef> &refs)
+{
+	errno = 0;
+	FILE *f = _tfopen(filename, _T("w"));
+	if (!f) {
+		int err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		return -err;
+	}
+
+	bool ok = (fprintf(f, "%s\n", PREFS_MAGIC) > 0);
+	for (auto iter = refs.cbegin(); ok && iter != refs.cend(); ++iter) {
+		char s_content_hash[sizeof(iter->content_hash)*2 + 1];
+		char s_h3_hash[sizeof(iter->h3_hash)*2 + 1];
+		for (size_t i = 0; i < sizeof(iter->content_hash); i++) {
+			snprintf(&s_content_hash[i*2], 3, "%02x", iter->content_hash[i]);
+		}
+		for (size_t i = 0; i < sizeof(iter->h3_hash); i++) {
+			snprintf(&s_h3_hash[i*2], 3, "%02x", iter->h3_hash[i]);
+		}
+		ok = (fprintf(f, "%u %u %u %s %s\n", iter->type, iter->lba_start, iter->lba_len,
+			s_content_hash, s_h3_hash) > 0);
+	}
+
+	int err = (ok ? 0 : (errno != 0 ? errno : EIO));
+	if (fclose(f) != 0 && err == 0) {
+		err = (errno != 0 ? errno : EIO);
+	}
+	if (err != 0) {
+		_tremove(filename);
+		errno = err;
+		return -err;
+	}
+	return 0;
+}
+
+/**
+ * Load partition references from a file.
+ * @param filename	[in] Reference filename
+ * @param refs		[out] Partition references
+ * @return 0 on success; negative POSIX error code on error. (-EBADMSG if the file is invalid)
+ */
+int PartitionStore::loadRefs(const TCHAR *filename, vector<PartitionRef> &refs)
+{
+	refs.clear();
+
+	errno = 0;
+	FILE *f = _tfopen(filename, _T("r"));
+	if (!f) {
+		int err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		return -err;
+	}
+
+	char line[256];
+	bool ok = (fgets(line, sizeof(line), f) != nullptr);
+	if (ok) {
+		line[strcspn(line, "\r\n")] = '\0';
+		ok = !strcmp(line, PREFS_MAGIC);
+	}
+	while (ok && fgets(line, sizeof(line), f) != nullptr) {
+		char s_content_hash[64], s_h3_hash[64];
+		PartitionRef ref;
+		ok = (sscanf(line, "%u %u %u %63s %63s", &ref.type, &ref.lba_start, &ref.lba_len,
+				s_content_hash, s_h3_hash) == 5 &&
+		      ref.lba_len != 0 &&
+		      parse_hex(s_content_hash, ref.content_hash, sizeof(ref.content_hash)) &&
+		      parse_hex(s_h3_hash, ref.h3_hash, sizeof(ref.h3_hash)));
+		if (ok) {
+			refs.push_back(ref);
+		}
+	}
+	fclose(f);
+
+	if (!ok) {
+		refs.clear();
+		errno = EBADMSG;
+		return -EBADMSG;
+	}
+	return 0;
+}
@@ -0,0 +1,136 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * PartitionStore.hpp: Content-addressed store for Wii partitions.         *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_PARTITIONSTORE_HPP__
+#define __RVTHTOOL_LIBRVTH_PARTITIONSTORE_HPP__
+
+#include "rvth.hpp"
+#include "tcharx.h"
+
+// C includes
+#include <stdint.h>
+
+// C++ includes
+#include <string>
+#include <vector>
+
+struct _pt_entry_t;
+
+/**
+ * Reference to a partition in a partition store.
+ * This indicates where the partition is located in the disc image,
+ * and which stored partition has its contents.
+ */
+struct PartitionRef {
+	uint32_t type;			// Partition type
+	uint32_t lba_start;		// Starting LBA of the partition in the disc image
+	uint32_t lba_len;		// Length of the partition, in LBAs (header, H3 table, and data)
+	uint8_t content_hash[20];	// TMD content hash (H4)
+	uint8_t h3_hash[20];		// SHA-1 of the H3 table
+};
+
+/**
+ * Content-addressed store for Wii partitions.
+ *
+ * Most discs have the same System Menu update partitions, so archiving
+ * many dumps stores many copies of the same data. Archival extraction
+ * (RVTH_EXTRACT_STORE_UPDATES) writes each update partition to the store
+ * once, leaves it out of the extracted image, and writes a .prefs file
+ * with references to the stored partitions next to the image.
+ * RvtH::reconstruct() rebuilds the full disc image.
+ *
+ * Stored partitions are keyed by the TMD content hash and the SHA-1
+ * of the H3 table, and contain the encrypted partition as it appears
+ * in the disc image: partition header, H3 table, and partition data.
+ */
+class PartitionStore
+{
+	public:
+		/**
+		 * Open a partition store.
+		 * The directory is created when the first partition is stored.
+		 * @param dir	[in] Store directory
+		 */
+		explicit PartitionStore(const TCHAR *dir);
+
+	private:
+		DISABLE_COPY(PartitionStore)
+
+	public:
+		/**
+		 * Get the reference for a partition in a disc image.
+		 * This reads the partition header and the H3 table.
+		 * @param entry		[in] Bank entry
+		 * @param pte		[in] Partition table entry (from entry->ptbl)
+		 * @param ref		[out] Partition reference
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		static int getRef(RvtH_BankEntry *entry, const struct _pt_entry_t *pte, PartitionRef *ref);
+
+		/**
+		 * Get the filename of a stored partition.
+		 * @param ref	[in] Partition reference
+		 * @return Filename
+		 */
+		std::tstring filename(const PartitionRef &ref) const;
+
+		/**
+		 * Check if a partition is in the store.
+		 * @param ref	[in] Partition reference
+		 * @return True if the partition is stored; false if not.
+		 */
+		bool contains(const PartitionRef &ref) const;
+
+		/**
+		 * Copy a partition from a disc image to the store.
+		 * If the partition is already stored, nothing is copied.
+		 * @param reader	[in] Reader for the disc image
+		 * @param ref		[in] Partition reference
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int store(Reader *reader, const PartitionRef &ref);
+
+		/**
+		 * Copy a stored partition to a disc image.
+		 * Empty blocks are skipped, so the destination must be zeroed.
+		 * @param ref		[in] Partition reference
+		 * @param reader	[in] Writable reader for the disc image
+		 * @return 0 on success; negative POSIX error code on error. (-EBADMSG if the stored partition doesn't match)
+		 */
+		int restore(const PartitionRef &ref, Reader *reader) const;
+
+		/** Reference files **/
+
+		/**
+		 * Get the reference filename for a disc image.
+		 * @param image_filename	[in] Disc image filename
+		 * @return Reference filename ("<image>.prefs")
+		 */
+		static std::tstring refsFilenameForImage(const TCHAR *image_filename);
+
+		/**
+		 * Save partition references to a file.
+		 * @param filename	[in] Reference filename
+		 * @param refs		[in] Partition references
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		static int saveRefs(const TCHAR *filename, const std::vector<PartitionRef> &refs);
+
+		/**
+		 * Load partition references from a file.
+		 * @param filename	[in] Reference filename
+		 * @param refs		[out] Partition references
+		 * @return 0 on success; negative POSIX error code on error. (-EBADMSG if the file is invalid)
+		 */
+		static int loadRefs(const TCHAR *filename, std::vector<PartitionRef> &refs);
+
+	private:
+		std::tstring m_dir;	// Store directory
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_PARTITIONSTORE_HPP__ */
@@ -0,0 +1,362 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * Pipeline.cpp: Staged chunk pipeline for bulk operations.                *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "Pipeline.hpp"
+#include "reader/Reader.hpp"
+
+// For LBA_TO_BYTES()
+#include "nhcd_structs.h"
+
+// C includes (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+// C++ includes
+#include <algorithm>
+#include <system_error>
+#include <thread>
+using std::lock_guard;
+using std::mutex;
+using std::unique_lock;
+using std::vector;
+
+/** ChunkQueue **/
+
+/**
+ * Add a chunk to the queue.
+ * @param chunk	[in] Chunk (moved)
+ */
+void Pipeline::ChunkQueue::push(Chunk &&chunk)
+{
+	lock_guard<mutex> lock(m_mutex);
+	if (m_aborted) {
+		// Nothing will take the chunk.
+		return;
+	}
+	m_chunks.push_back(std::move(chunk));
+	m_cond.notify_one();
+}
+
+/**
+ * Take the next chunk from the queue.
+ * Blocks until a chunk is available.
+ * @param chunk	[out] Chunk
+ * @return True if a chunk was taken; false if the queue was closed or aborted.
+ */
+bool Pipeline::ChunkQueue::pop(Chunk &chunk)
+{
+	unique_lock<mutex> lock(m_mutex);
+	m_cond.wait(lock, [this]() { return !m_chunks.empty() || m_closed || m_aborted; });
+	if (m_aborted || m_chunks.empty()) {
+		return false;
+	}
+	chunk = std::move(m_chunks.front());
+	m_chunks.pop_front();
+	return true;
+}
+
+/**
+ * Close the queue. The chunks that are
+ * already queued can still be taken.
+ */
+void Pipeline::ChunkQueue::close(void)
+{
+	lock_guard<mutex> lock(m_mutex);
+	m_closed = true;
+	m_cond.notify_all();
+}
+
+/**
+ * Abort the queue. pop() will fail immediately.
+ */
+void Pipeline::ChunkQueue::abort(void)
+{
+	lock_guard<mutex> lock(m_mutex);
+	m_aborted = true;
+	m_chunks.clear();
+	m_cond.notify_all();
+}
+
+/** Pipeline **/
+
+/**
+ * Create a pipeline.
+ * @param buf_size	[in] Chunk buffer size, in bytes.
+ * @param depth		[in] Number of chunk buffers. (minimum 2)
+ * @param alignment	[in,opt] Chunk buffer alignment. (0 for 4 KB)
+ */
+Pipeline::Pipeline(size_t buf_size, unsigned int depth, size_t alignment)
+	: m_stop(false)
+	, m_err(0)
+	, m_stats(StatsCounters::current())
+{
+	assert(buf_size != 0);
+	if (buf_size == 0) {
+		return;
+	}
+	if (depth < 2) {
+		depth = 2;
+	}
+
+	// Source stage. (set by setSource())
+	m_stages.emplace_back();
+
+	m_bufs.reserve(depth);
+	for (unsigned int i = 0; i < depth; i++) {
+		m_bufs.emplace_back(buf_size, alignment);
+		if (!m_bufs.back()) {
+			// Error allocating memory.
+			m_bufs.clear();
+			return;
+		}
+	}
+}
+
+Pipeline::~Pipeline()
+{ }
+
+/**
+ * Set the source stage.
+ * @param fn	[in] Source function
+ */
+void Pipeline::setSource(StageFn fn)
+{
+	if (m_stages.empty()) {
+		m_stages.emplace_back();
+	}
+	m_stages[0] = std::move(fn);
+}
+
+/**
+ * Add a stage after the previous one.
+ * @param fn	[in] Stage function
+ */
+void Pipeline::addStage(StageFn fn)
+{
+	if (m_stages.empty()) {
+		m_stages.emplace_back();
+	}
+	m_stages.emplace_back(std::move(fn));
+}
+
+/**
+ * Has the pipeline been stopped, or the operation cancelled?
+ * @return True if stopped.
+ */
+bool Pipeline::stopped(void)
+{
+	if (m_stop.load(std::memory_order_acquire)) {
+		return true;
+	} else if (StatsCounters::cancelled()) {
+		fail(-ECANCELED);
+		return true;
+	}
+	return false;
+}
+
+/**
+ * Stop the pipeline because of an error.
+ * Only the first error is kept.
+ * @param err	[in] Negative POSIX error code
+ */
+void Pipeline::fail(int err)
+{
+	assert(err < 0);
+	int expected = 0;
+	m_err.compare_exchange_strong(expected, (err < 0 ? err : -EIO));
+	m_stop.store(true, std::memory_order_release);
+	for (auto &queue : m_queues) {
+		queue->abort();
+	}
+}
+
+/**
+ * Cancel the pipeline.
+ * This can be called from any thread, including from a stage.
+ */
+void Pipeline::cancel(void)
+{
+	fail(-ECANCELED);
+}
+
+/**
+ * Run a stage until its input is finished.
+ * @param idx	[in] Stage index (0 for the source)
+ */
+void Pipeline::runStage(unsigned int idx)
+{
+	StatsScope scope(m_stats);
+	const unsigned int stage_count = static_cast<unsigned int>(m_stages.size());
+	const StageFn &fn = m_stages[idx];
+	ChunkQueue &in = *m_queues[idx];
+	ChunkQueue &out = *m_queues[(idx + 1) % stage_count];
+
+	// The source takes free buffers from the last stage.
+	Chunk chunk;
+	while (in.pop(chunk)) {
+		if (stopped())
+			break;
+
+		const int ret = fn(chunk);
+		if (ret < 0 || (idx != 0 && ret != 0)) {
+			fail(ret < 0 ? ret : -EIO);
+			break;
+		} else if (idx == 0 && ret == 0) {
+			// No more chunks.
+			break;
+		}
+		out.push(std::move(chunk));
+	}
+
+	if (idx + 1 < stage_count) {
+		// Let the next stage finish the queued chunks.
+		out.close();
+	}
+}
+
+/**
+ * Run all stages on the calling thread, one chunk at a time.
+ * Used if the stage threads can't be started.
+ */
+void Pipeline::runSync(void)
+{
+	const unsigned int stage_count = static_cast<unsigned int>(m_stages.size());
+	Chunk chunk;
+	while (m_queues[0]->pop(chunk)) {
+		if (stopped())
+			break;
+
+		int ret = m_stages[0](chunk);
+		if (ret <= 0) {
+			if (ret < 0) {
+				fail(ret);
+			}
+			break;
+		}
+		for (unsigned int i = 1; i < stage_count && ret == 0; i++) {
+			if (stopped())
+				return;
+			ret = m_stages[i](chunk);
+		}
+		if (ret != 0) {
+			fail(ret < 0 ? ret : -EIO);
+			break;
+		}
+		m_queues[0]->push(std::move(chunk));
+	}
+}
+
+/**
+ * Run the pipeline until the source is finished.
+ * At least one stage must have been added.
+ * @return 0 on success; negative POSIX error code on error. (-ECANCELED if cancelled)
+ */
+int Pipeline::run(void)
+{
+	assert(m_stages.size() >= 2);
+	assert(m_stages[0] != nullptr);
+	if (!isOpen()) {
+		return -ENOMEM;
+	} else if (m_stages.size() < 2 || !m_stages[0]) {
+		return -EINVAL;
+	} else if (m_stop.load(std::memory_order_acquire)) {
+		// Cancelled before starting.
+		return m_err.load();
+	}
+
+	// Queue the free buffers for the source.
+	const unsigned int stage_count = static_cast<unsigned int>(m_stages.size());
+	m_queues.clear();
+	m_queues.reserve(stage_count);
+	for (unsigned int i = 0; i < stage_count; i++) {
+		m_queues.emplace_back(new ChunkQueue());
+	}
+	for (PoolBuffer &buf : m_bufs) {
+		Chunk chunk;
+		chunk.buf = std::move(buf);
+		m_queues[0]->push(std::move(chunk));
+	}
+	m_bufs.clear();
+
+	// Start a thread for each stage except for the last one.
+	vector<std::thread> threads;
+	threads.reserve(stage_count - 1);
+	try {
+		for (unsigned int i = 0; i < stage_count - 1; i++) {
+			threads.emplace_back(&Pipeline::runStage, this, i);
+		}
+	} catch (const std::system_error &e) {
+		if (threads.empty()) {
+			// Unable to start any threads.
+			// Run the stages on this thread.
+			runSync();
+			return m_err.load();
+		}
+		// Stop the threads that were started.
+		const int err = e.code().value();
+		fail(err > 0 ? -err : -EAGAIN);
+	}
+
+	// The last stage runs on the calling thread.
+	if (!m_stop.load(std::memory_order_acquire)) {
+		runStage(stage_count - 1);
+	}
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+	return m_err.load();
+}
+
+/**
+ * Create a source stage that reads consecutive chunks from a Reader.
+ * The last chunk may be shorter than the buffer.
+ * @param reader	[in] Source reader.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Number of LBAs to read.
+ * @param lba_chunk	[in] Chunk size, in LBAs. (must fit in the chunk buffers)
+ * @param used		[in,opt] Chunk map. Chunks marked as unused are
+ *			zero-filled without reading the source.
+ * @return Source function.
+ */
+Pipeline::StageFn Pipeline::readerSource(Reader *reader, uint32_t lba_start, uint32_t lba_len,
+	uint32_t lba_chunk, const vector<bool> *used)
+{
+	assert(reader != nullptr);
+	assert(lba_chunk != 0);
+
+	vector<bool> used_map;
+	if (used) {
+		used_map = *used;
+	}
+	uint32_t chunk_idx = 0;
+	return [=](Chunk &chunk) mutable -> int {
+		const uint64_t lba_pos = static_cast<uint64_t>(chunk_idx) * lba_chunk;
+		if (lba_chunk == 0 || lba_pos >= lba_len) {
+			// No more chunks.
+			return 0;
+		}
+		const uint32_t len = static_cast<uint32_t>(std::min<uint64_t>(lba_chunk, lba_len - lba_pos));
+		assert(LBA_TO_BYTES(static_cast<uint64_t>(len)) <= chunk.buf.size());
+
+		chunk.lba_start = lba_start + static_cast<uint32_t>(lba_pos);
+		chunk.lba_len = len;
+		if (chunk_idx < used_map.size() && !used_map[chunk_idx]) {
+			// Unused chunk.
+			memset(chunk.buf.get(), 0, static_cast<size_t>(LBA_TO_BYTES(len)));
+		} else {
+			errno = 0;
+			if (reader->read(chunk.buf.get(), chunk.lba_start, len) != len) {
+				const int err = (errno != 0 ? errno : EIO);
+				return -err;
+			}
+		}
+		chunk_idx++;
+		return 1;
+	};
+}
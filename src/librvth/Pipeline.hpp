@@ -0,0 +1,225 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * Pipeline.hpp: Staged chunk pipeline for bulk operations.                *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_PIPELINE_HPP__
+#define __RVTHTOOL_LIBRVTH_PIPELINE_HPP__
+
+#include "BufferPool.hpp"
+#include "StatsCounters.hpp"
+
+// C includes
+#include <stdint.h>
+
+// C++ includes
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class Reader;
+
+/**
+ * Staged chunk pipeline.
+ *
+ * Bulk operations read a bank in chunks, run each chunk through some
+ * transforms (decryption, compression) and then hand it to one or more
+ * sinks (writing, hashing). A pipeline has a source stage that fills
+ * chunks, followed by the other stages in order. Each stage runs on its
+ * own thread, except for the last one, which runs on the calling thread
+ * so progress callbacks are invoked from there.
+ *
+ * Stages are connected by queues, and chunks are moved from one stage
+ * to the next, so chunk buffers are never copied. A stage may replace a
+ * chunk's buffer, e.g. if a transform writes its output to a different
+ * buffer. Once the last stage is done with a chunk, its buffer goes
+ * back to the source. The number of buffers limits the memory used,
+ * and the source waits for a free buffer if the later stages fall
+ * behind.
+ *
+ * If a stage fails, or the pipeline or the operation's CancelToken is
+ * cancelled, all stages stop after the chunk they're processing, and
+ * run() returns the first error.
+ */
+class Pipeline
+{
+	public:
+		/**
+		 * Chunk of data passed between stages.
+		 */
+		struct Chunk {
+			PoolBuffer buf;		// Chunk buffer
+			uint32_t lba_start;	// Starting LBA
+			uint32_t lba_len;	// Length, in LBAs
+
+			Chunk()
+				: lba_start(0)
+				, lba_len(0)
+			{ }
+		};
+
+		/**
+		 * Stage function.
+		 *
+		 * The source stage fills the chunk and returns 1, or returns 0
+		 * once there are no more chunks. The other stages process the
+		 * chunk and return 0.
+		 *
+		 * @param chunk	[in,out] Chunk
+		 * @return Described above; negative POSIX error code on error.
+		 */
+		typedef std::function<int(Chunk &chunk)> StageFn;
+
+		/**
+		 * Create a pipeline.
+		 * @param buf_size	[in] Chunk buffer size, in bytes.
+		 * @param depth		[in] Number of chunk buffers. (minimum 2)
+		 * @param alignment	[in,opt] Chunk buffer alignment. (0 for 4 KB)
+		 */
+		Pipeline(size_t buf_size, unsigned int depth, size_t alignment = 0);
+		~Pipeline();
+
+	private:
+		DISABLE_COPY(Pipeline)
+
+	public:
+		/**
+		 * Were the chunk buffers allocated successfully?
+		 * @return True if the pipeline is usable; false if not.
+		 */
+		inline bool isOpen(void) const
+		{
+			return !m_bufs.empty();
+		}
+
+		/**
+		 * Set the source stage.
+		 * @param fn	[in] Source function
+		 */
+		void setSource(StageFn fn);
+
+		/**
+		 * Add a stage after the previous one.
+		 * @param fn	[in] Stage function
+		 */
+		void addStage(StageFn fn);
+
+		/**
+		 * Run the pipeline until the source is finished.
+		 * At least one stage must have been added.
+		 * @return 0 on success; negative POSIX error code on error. (-ECANCELED if cancelled)
+		 */
+		int run(void);
+
+		/**
+		 * Cancel the pipeline.
+		 * This can be called from any thread, including from a stage.
+		 */
+		void cancel(void);
+
+		/**
+		 * Create a source stage that reads consecutive chunks from a Reader.
+		 * The last chunk may be shorter than the buffer.
+		 * @param reader	[in] Source reader.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Number of LBAs to read.
+		 * @param lba_chunk	[in] Chunk size, in LBAs. (must fit in the chunk buffers)
+		 * @param used		[in,opt] Chunk map. Chunks marked as unused are
+		 *			zero-filled without reading the source.
+		 * @return Source function.
+		 */
+		static StageFn readerSource(Reader *reader, uint32_t lba_start, uint32_t lba_len,
+			uint32_t lba_chunk, const std::vector<bool> *used = nullptr);
+
+	private:
+		/**
+		 * Bounded queue of chunks between two stages.
+		 */
+		class ChunkQueue
+		{
+			public:
+				ChunkQueue()
+					: m_closed(false)
+					, m_aborted(false)
+				{ }
+
+			private:
+				DISABLE_COPY(ChunkQueue)
+
+			public:
+				/**
+				 * Add a chunk to the queue.
+				 * @param chunk	[in] Chunk (moved)
+				 */
+				void push(Chunk &&chunk);
+
+				/**
+				 * Take the next chunk from the queue.
+				 * Blocks until a chunk is available.
+				 * @param chunk	[out] Chunk
+				 * @return True if a chunk was taken; false if the queue was closed or aborted.
+				 */
+				bool pop(Chunk &chunk);
+
+				/**
+				 * Close the queue. The chunks that are
+				 * already queued can still be taken.
+				 */
+				void close(void);
+
+				/**
+				 * Abort the queue. pop() will fail immediately.
+				 */
+				void abort(void);
+
+			private:
+				std::mutex m_mutex;
+				std::condition_variable m_cond;
+				std::deque<Chunk> m_chunks;
+				bool m_closed;
+				bool m_aborted;
+		};
+
+		/**
+		 * Run a stage until its input is finished.
+		 * @param idx	[in] Stage index (0 for the source)
+		 */
+		void runStage(unsigned int idx);
+
+		/**
+		 * Run all stages on the calling thread, one chunk at a time.
+		 * Used if the stage threads can't be started.
+		 */
+		void runSync(void);
+
+		/**
+		 * Has the pipeline been stopped, or the operation cancelled?
+		 * @return True if stopped.
+		 */
+		bool stopped(void);
+
+		/**
+		 * Stop the pipeline because of an error.
+		 * Only the first error is kept.
+		 * @param err	[in] Negative POSIX error code
+		 */
+		void fail(int err);
+
+	private:
+		std::vector<PoolBuffer> m_bufs;		// Chunk buffers, until run() is called
+		std::vector<StageFn> m_stages;		// [0] is the source
+		std::vector<std::unique_ptr<ChunkQueue> > m_queues;	// Input queue of each stage; [0] has the free buffers
+
+		std::atomic<bool> m_stop;
+		std::atomic<int> m_err;
+		StatsCounters *m_stats;			// Counters of the operation that created this object
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_PIPELINE_HPP__ */
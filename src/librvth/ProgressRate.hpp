@@ -0,0 +1,99 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * ProgressRate.hpp: Progress throughput and ETA estimation.               *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_PROGRESSRATE_HPP__
+#define __RVTHTOOL_LIBRVTH_PROGRESSRATE_HPP__
+
+#include "rvth.hpp"
+#include "nhcd_structs.h"	// LBA_TO_BYTES()
+
+// C includes
+#include <stdint.h>
+
+// C++ includes
+#include <chrono>
+
+/**
+ * Progress throughput and ETA estimation.
+ *
+ * Fills in RvtH_Progress_State::bytes_per_sec and eta_sec
+ * from lba_processed and lba_total. The throughput is an
+ * exponential moving average of the rate between samples
+ * at least 250 ms apart, so throttled and unthrottled
+ * callbacks get the same smoothing.
+ */
+class ProgressRate
+{
+	public:
+		ProgressRate()
+			: m_last_lba(0)
+			, m_bytes_per_sec(0.0)
+			, m_first(true)
+		{ }
+
+	private:
+		DISABLE_COPY(ProgressRate)
+
+	private:
+		// Weight of the newest rate sample.
+		static constexpr double ALPHA = 0.3;
+
+	public:
+		/**
+		 * Update the throughput and ETA in a progress state.
+		 * @param state Progress state (lba_processed and lba_total must be set)
+		 */
+		void update(RvtH_Progress_State *state)
+		{
+			// Minimum time between rate samples.
+			constexpr std::chrono::milliseconds min_sample(250);
+
+			const auto now = std::chrono::steady_clock::now();
+			const uint32_t lba = state->lba_processed;
+
+			if (m_first || lba < m_last_lba) {
+				// First update, or progress went backwards, e.g. when
+				// starting the next stage. Restart the sample interval,
+				// but keep the current rate estimate.
+				m_first = false;
+				m_last_time = now;
+				m_last_lba = lba;
+			} else {
+				const auto elapsed = now - m_last_time;
+				if (elapsed >= min_sample) {
+					const double secs = std::chrono::duration<double>(elapsed).count();
+					const double rate = static_cast<double>(
+						LBA_TO_BYTES(static_cast<uint64_t>(lba - m_last_lba))) / secs;
+					m_bytes_per_sec = (m_bytes_per_sec > 0.0)
+						? (ALPHA * rate) + ((1.0 - ALPHA) * m_bytes_per_sec)
+						: rate;
+					m_last_time = now;
+					m_last_lba = lba;
+				}
+			}
+
+			state->bytes_per_sec = m_bytes_per_sec;
+			if (lba >= state->lba_total) {
+				state->eta_sec = 0;
+			} else if (m_bytes_per_sec > 0.0) {
+				const double bytes_left = static_cast<double>(
+					LBA_TO_BYTES(static_cast<uint64_t>(state->lba_total - lba)));
+				state->eta_sec = static_cast<int64_t>(bytes_left / m_bytes_per_sec + 0.5);
+			} else {
+				state->eta_sec = -1;
+			}
+		}
+
+	private:
+		std::chrono::steady_clock::time_point m_last_time;
+		uint32_t m_last_lba;
+		double m_bytes_per_sec;
+		bool m_first;
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_PROGRESSRATE_HPP__ */
@@ -0,0 +1,88 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * ProgressThrottle.hpp: Progress callback throttling.                     *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_PROGRESSTHROTTLE_HPP__
+#define __RVTHTOOL_LIBRVTH_PROGRESSTHROTTLE_HPP__
+
+#include "rvth.hpp"
+
+// C includes
+#include <stdint.h>
+
+// C++ includes
+#include <chrono>
+
+/**
+ * Progress callback throttling. (See RvtH_ProgressParams.)
+ *
+ * Progress is measured in bytes. Updates that must always be
+ * delivered, e.g. the final update, should call delivered()
+ * instead of ready() so the intervals are measured from them.
+ */
+class ProgressThrottle
+{
+	public:
+		explicit ProgressThrottle(const RvtH_ProgressParams *params)
+			: m_interval(params->interval_ms)
+			, m_interval_bytes(params->interval_bytes)
+			, m_last_bytes(0)
+			, m_first(true)
+		{ }
+
+	private:
+		DISABLE_COPY(ProgressThrottle)
+
+	public:
+		/**
+		 * Check if an intermediate progress update should be delivered.
+		 * If it should, the intervals are restarted.
+		 * @param bytes Amount of data processed, in bytes.
+		 * @return True if the update should be delivered; false if not.
+		 */
+		bool ready(uint64_t bytes)
+		{
+			if (m_first || (m_interval.count() == 0 && m_interval_bytes == 0)) {
+				delivered(bytes);
+				return true;
+			}
+
+			// NOTE: If progress went backwards, e.g. when starting
+			// the next partition, the update is always delivered.
+			bool ok = (m_interval_bytes != 0 &&
+				(bytes < m_last_bytes || bytes - m_last_bytes >= m_interval_bytes));
+			if (!ok && m_interval.count() != 0) {
+				ok = (std::chrono::steady_clock::now() - m_last_time >= m_interval);
+			}
+			if (ok) {
+				delivered(bytes);
+			}
+			return ok;
+		}
+
+		/**
+		 * Restart the intervals after an update was delivered unconditionally.
+		 * @param bytes Amount of data processed, in bytes.
+		 */
+		void delivered(uint64_t bytes)
+		{
+			m_first = false;
+			m_last_bytes = bytes;
+			if (m_interval.count() != 0) {
+				m_last_time = std::chrono::steady_clock::now();
+			}
+		}
+
+	private:
+		std::chrono::milliseconds m_interval;
+		uint64_t m_interval_bytes;
+		uint64_t m_last_bytes;
+		std::chrono::steady_clock::time_point m_last_time;
+		bool m_first;
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_PROGRESSTHROTTLE_HPP__ */
@@ -0,0 +1,220 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * ReadbackVerifier.cpp: Pipelined read-back verification for imports.     *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "ReadbackVerifier.hpp"
+#include "RefFile.hpp"
+#include "rvth_error.h"
+
+// For LBA_TO_BYTES()
+#include "nhcd_structs.h"
+
+// Reader class
+#include "reader/Reader.hpp"
+
+// C includes (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+// C++ includes
+#include <system_error>
+using std::lock_guard;
+using std::mutex;
+using std::unique_lock;
+
+/**
+ * Start the read-back thread.
+ * @param reader	[in] Destination reader
+ * @param lba_chunk	[in] Maximum chunk size, in LBAs
+ * @param lba_window	[in] Distance that reads trail the writer by, in LBAs
+ * @param alignment	[in] Read buffer alignment
+ */
+ReadbackVerifier::ReadbackVerifier(Reader *reader, uint32_t lba_chunk, uint32_t lba_window, unsigned int alignment)
+	: m_reader(reader)
+	, m_buf(LBA_TO_BYTES(static_cast<size_t>(lba_chunk)), alignment)
+	, m_lba_window(lba_window)
+	, m_lba_durable(0)
+	, m_finished(false)
+	, m_err(0)
+	, m_stats(StatsCounters::current())
+{
+	assert(lba_chunk != 0);
+	if (!m_buf) {
+		// Error allocating memory.
+		return;
+	}
+
+	try {
+		m_thread = std::thread(&ReadbackVerifier::readbackThread, this);
+	} catch (const std::system_error&) {
+		// Thread couldn't be started. isOpen() will return false.
+	}
+}
+
+ReadbackVerifier::~ReadbackVerifier()
+{
+	if (m_thread.joinable()) {
+		// Chunks that haven't been read back yet are discarded.
+		{
+			lock_guard<mutex> lock(m_mutex);
+			m_pending.clear();
+			m_finished = true;
+			m_cond.notify_all();
+		}
+		m_thread.join();
+	}
+}
+
+/**
+ * Add a chunk that was written to the destination.
+ * Chunks must be added in order.
+ * @param data		[in] Data that was written
+ * @param lba_start	[in] Starting LBA
+ * @param lba_len	[in] Length, in LBAs (up to lba_chunk)
+ */
+void ReadbackVerifier::written(const uint8_t *data, uint32_t lba_start, uint32_t lba_len)
+{
+	assert(isOpen());
+	assert(LBA_TO_BYTES(static_cast<size_t>(lba_len)) <= m_buf.size());
+
+	Chunk chunk;
+	chunk.lba_start = lba_start;
+	chunk.lba_len = lba_len;
+	{
+		StatsTimer timer(StatsCounters::TIMER_SHA1);
+		struct sha1_ctx sha1;
+		sha1_init(&sha1);
+		sha1_update(&sha1, LBA_TO_BYTES(static_cast<size_t>(lba_len)), data);
+		sha1_digest(&sha1, sizeof(chunk.digest), chunk.digest);
+	}
+
+	lock_guard<mutex> lock(m_mutex);
+	assert(m_pending.empty() || m_pending.back().lba_start + m_pending.back().lba_len <= lba_start);
+	if (m_err == 0) {
+		m_pending.push_back(chunk);
+	}
+}
+
+/**
+ * The destination was flushed. Chunks that end at or before
+ * lba_durable can be read back once they're outside the window.
+ * @param lba_durable	[in] End of the flushed data, in LBAs
+ */
+void ReadbackVerifier::checkpoint(uint32_t lba_durable)
+{
+	lock_guard<mutex> lock(m_mutex);
+	if (lba_durable > m_lba_durable) {
+		m_lba_durable = lba_durable;
+		m_cond.notify_all();
+	}
+}
+
+/**
+ * Has a chunk failed verification?
+ * @return True if a mismatch or read error was found.
+ */
+bool ReadbackVerifier::failed(void) const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return (m_err != 0);
+}
+
+/**
+ * Read back the remaining flushed chunks and stop the thread.
+ * @return 0 on success; RVTH_ERROR_READBACK_MISMATCH if data didn't match;
+ *         negative POSIX error code if a chunk couldn't be read.
+ */
+int ReadbackVerifier::finish(void)
+{
+	if (m_thread.joinable()) {
+		{
+			lock_guard<mutex> lock(m_mutex);
+			m_finished = true;
+			m_cond.notify_all();
+		}
+		m_thread.join();
+	}
+	return m_err;
+}
+
+/**
+ * Read back a chunk and compare its digest.
+ * @param lba_start	[in] Starting LBA
+ * @param lba_len	[in] Length, in LBAs
+ * @param digest	[in] SHA-1 of the data that was written
+ * @return 0 if it matches; RVTH_ERROR_READBACK_MISMATCH or negative POSIX error code if not.
+ */
+int ReadbackVerifier::verifyChunk(uint32_t lba_start, uint32_t lba_len, const uint8_t *digest)
+{
+	const size_t size = LBA_TO_BYTES(static_cast<size_t>(lba_len));
+
+	// Make sure the chunk is read from the media, not the page cache.
+	// NOTE: The chunk was flushed, so nothing is lost if this fails.
+	off64_t offset;
+	if (m_reader->fileOffset(lba_start, lba_len, &offset)) {
+		m_reader->file()->dropCache(offset, size);
+	}
+
+	errno = 0;
+	if (m_reader->read(m_buf.get(), lba_start, lba_len) != lba_len) {
+		return (errno != 0 ? -errno : -EIO);
+	}
+
+	uint8_t rdigest[SHA1_DIGEST_SIZE];
+	{
+		StatsTimer timer(StatsCounters::TIMER_SHA1);
+		struct sha1_ctx sha1;
+		sha1_init(&sha1);
+		sha1_update(&sha1, size, m_buf.get());
+		sha1_digest(&sha1, sizeof(rdigest), rdigest);
+	}
+	return (memcmp(rdigest, digest, sizeof(rdigest)) == 0 ? 0 : RVTH_ERROR_READBACK_MISMATCH);
+}
+
+/**
+ * Read-back thread function.
+ */
+void ReadbackVerifier::readbackThread(void)
+{
+	StatsScope scope(m_stats);
+
+	unique_lock<mutex> lock(m_mutex);
+	while (true) {
+		// The oldest chunk is read back once it's durable and the
+		// writer is a window past it, or once writing has finished.
+		auto ready = [this]() -> bool {
+			if (m_pending.empty()) {
+				return false;
+			}
+			const Chunk &chunk = m_pending.front();
+			const uint64_t lba_end = static_cast<uint64_t>(chunk.lba_start) + chunk.lba_len;
+			if (lba_end > m_lba_durable) {
+				return false;
+			}
+			return (m_finished || lba_end + m_lba_window <= m_lba_durable);
+		};
+		m_cond.wait(lock, [&]() { return ready() || m_finished; });
+		if (!ready()) {
+			// Finished, and all durable chunks were read back.
+			break;
+		}
+
+		const Chunk chunk = m_pending.front();
+		m_pending.pop_front();
+		lock.unlock();
+		const int ret = verifyChunk(chunk.lba_start, chunk.lba_len, chunk.digest);
+		lock.lock();
+
+		if (ret != 0) {
+			// Stop at the first failure.
+			m_err = ret;
+			m_pending.clear();
+			break;
+		}
+	}
+}
@@ -0,0 +1,133 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * ReadbackVerifier.hpp: Pipelined read-back verification for imports.     *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_READBACKVERIFIER_HPP__
+#define __RVTHTOOL_LIBRVTH_READBACKVERIFIER_HPP__
+
+#include "rvth.hpp"
+#include "BufferPool.hpp"
+#include "StatsCounters.hpp"
+
+// nettle
+#include <nettle/sha1.h>
+
+// C includes
+#include <stdint.h>
+
+// C++ includes
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+class Reader;
+
+/**
+ * Pipelined read-back verification.
+ *
+ * The SHA-1 of each chunk is calculated when it's written. A background
+ * thread reads the chunk back from the destination once it has been
+ * flushed and the writer is at least one window past it, and compares
+ * the digests, so the destination is verified while the rest of the
+ * image is still being written. The chunk is dropped from the page
+ * cache first, so it's read back from the media.
+ */
+class ReadbackVerifier
+{
+	public:
+		/**
+		 * Start the read-back thread.
+		 * @param reader	[in] Destination reader
+		 * @param lba_chunk	[in] Maximum chunk size, in LBAs
+		 * @param lba_window	[in] Distance that reads trail the writer by, in LBAs
+		 * @param alignment	[in] Read buffer alignment
+		 */
+		ReadbackVerifier(Reader *reader, uint32_t lba_chunk, uint32_t lba_window, unsigned int alignment);
+		~ReadbackVerifier();
+
+	private:
+		DISABLE_COPY(ReadbackVerifier)
+
+	public:
+		/**
+		 * Was the read-back thread started?
+		 * @return True if chunks can be verified; false if not.
+		 */
+		inline bool isOpen(void) const
+		{
+			return m_thread.joinable();
+		}
+
+		/**
+		 * Add a chunk that was written to the destination.
+		 * Chunks must be added in order.
+		 * @param data		[in] Data that was written
+		 * @param lba_start	[in] Starting LBA
+		 * @param lba_len	[in] Length, in LBAs (up to lba_chunk)
+		 */
+		void written(const uint8_t *data, uint32_t lba_start, uint32_t lba_len);
+
+		/**
+		 * The destination was flushed. Chunks that end at or before
+		 * lba_durable can be read back once they're outside the window.
+		 * @param lba_durable	[in] End of the flushed data, in LBAs
+		 */
+		void checkpoint(uint32_t lba_durable);
+
+		/**
+		 * Has a chunk failed verification?
+		 * @return True if a mismatch or read error was found.
+		 */
+		bool failed(void) const;
+
+		/**
+		 * Read back the remaining flushed chunks and stop the thread.
+		 * @return 0 on success; RVTH_ERROR_READBACK_MISMATCH if data didn't match;
+		 *         negative POSIX error code if a chunk couldn't be read.
+		 */
+		int finish(void);
+
+	private:
+		/**
+		 * Read-back thread function.
+		 */
+		void readbackThread(void);
+
+		/**
+		 * Read back a chunk and compare its digest.
+		 * @param lba_start	[in] Starting LBA
+		 * @param lba_len	[in] Length, in LBAs
+		 * @param digest	[in] SHA-1 of the data that was written
+		 * @return 0 if it matches; RVTH_ERROR_READBACK_MISMATCH or negative POSIX error code if not.
+		 */
+		int verifyChunk(uint32_t lba_start, uint32_t lba_len, const uint8_t *digest);
+
+	private:
+		struct Chunk {
+			uint32_t lba_start;
+			uint32_t lba_len;
+			uint8_t digest[SHA1_DIGEST_SIZE];
+		};
+
+		Reader *m_reader;
+		PoolBuffer m_buf;
+		uint32_t m_lba_window;
+
+		mutable std::mutex m_mutex;
+		std::condition_variable m_cond;
+		std::deque<Chunk> m_pending;		// Chunks that haven't been read back yet
+		uint32_t m_lba_durable;			// End of the flushed data
+		bool m_finished;			// No more chunks will be added
+
+		int m_err;				// First error (0 if none)
+
+		std::thread m_thread;
+		StatsCounters *m_stats;			// Counters of the operation that created this object
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_READBACKVERIFIER_HPP__ */
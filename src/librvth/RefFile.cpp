@@ -2,7 +2,7 @@
  * RVT-H Tool (librvth)                                                    *
  * RefFile.cpp: Reference-counted FILE*.                                   *
  *                                                                         *
- * Copyright (c) 2018-2022 by David Korth.                                 *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
@@ -10,19 +10,31 @@
 #include "config.libc.h"
 
 #include "RefFile.hpp"
+#include "HttpFile.hpp"
+#include "IoScheduler.hpp"
+#include "StatsCounters.hpp"
 
 // C includes
 #include <stdlib.h>
 
 // C includes (C++ namespace)
+#include <cassert>
 #include <cctype>
 #include <cerrno>
 #include <cstring>
 
+// C++ includes
+#include <algorithm>
+#include <mutex>
+using std::shared_lock;
+using std::shared_timed_mutex;
+using std::unique_lock;
+
 // OS-specific includes
 #ifdef _WIN32
 #  include <windows.h>
 #  include <io.h>
+#  include <fcntl.h>
 #  include <winioctl.h>
 #  include "libwiicrypto/win32/w32time.h"
 #else /* !_WIN32 */
@@ -31,8 +43,16 @@
 #  include <sys/stat.h>
 #  include <fcntl.h>
 #  include <unistd.h>
+#  ifdef HAVE_MMAP
+#    include <sys/mman.h>
+#  endif /* HAVE_MMAP */
+#  ifdef HAVE_PREADV
+#    include <sys/uio.h>
+#  endif /* HAVE_PREADV */
 #  ifdef __linux__
 #    include <linux/fs.h>
+#    include <linux/falloc.h>
+#    include <sys/vfs.h>
 #  endif /* __linux__ */
 #endif /* !_WIN32 */
 
@@ -50,6 +70,8 @@
  * @param create If true, create the file if it doesn't exist.
  *               File will be opened in read/write mode.
  *               File will be truncated if it already exists.
+ *               If the filename is "-", standard output is used
+ *               as a write-only stream. (See isStream().)
  *
  * @return RefFile*, or NULL if an error occurred.
  */
@@ -57,7 +79,20 @@ RefFile::RefFile(const TCHAR *filename, bool create)
 	: m_refCount(1)
 	, m_lastError(0)
 	, m_file(nullptr)
+	, m_http(nullptr)
 	, m_isWritable(false)
+	, m_isStream(false)
+#ifdef _WIN32
+	, m_hDirect(nullptr)
+#else /* !_WIN32 */
+	, m_fdDirect(-1)
+#endif /* _WIN32 */
+	, m_directAlign(0)
+	, m_accessHint(AccessHint::Normal)
+	, m_durability(RVTH_DURABILITY_CHECKPOINT)
+	, m_syncInterval(0)
+	, m_unsynced(0)
+	, m_nextPos(0)
 {
 	if (!filename) {
 		// No filename...
@@ -68,6 +103,47 @@ RefFile::RefFile(const TCHAR *filename, bool create)
 	// Save the filename.
 	m_filename = filename;
 
+	if (HttpFile::isUrl(filename)) {
+		// File on an HTTP server. (read-only)
+		if (create) {
+			m_lastError = EROFS;
+			return;
+		}
+		m_http = HttpFile::open(filename);
+		if (!m_http) {
+			m_lastError = (errno != 0 ? errno : EIO);
+		}
+		return;
+	}
+
+	if (create && !_tcscmp(filename, _T("-"))) {
+		// Write to standard output.
+		// The descriptor is duplicated so closing this file
+		// doesn't close stdout.
+		fflush(stdout);
+#ifdef _WIN32
+		_setmode(_fileno(stdout), _O_BINARY);
+		const int fd = _dup(_fileno(stdout));
+		m_file = (fd >= 0 ? _fdopen(fd, "wb") : nullptr);
+		if (!m_file && fd >= 0) {
+			_close(fd);
+		}
+#else /* !_WIN32 */
+		const int fd = dup(fileno(stdout));
+		m_file = (fd >= 0 ? fdopen(fd, "wb") : nullptr);
+		if (!m_file && fd >= 0) {
+			::close(fd);
+		}
+#endif /* _WIN32 */
+		if (!m_file) {
+			m_lastError = (errno != 0 ? errno : EBADF);
+			return;
+		}
+		m_isWritable = true;
+		m_isStream = true;
+		return;
+	}
+
 	// Open the file.
 	const TCHAR *const mode = (create ? _T("wb+") : _T("rb"));
 	m_file = _tfopen(filename, mode);
@@ -83,13 +159,28 @@ RefFile::RefFile(const TCHAR *filename, bool create)
 	// If the file was opened with 'create',
 	// it should be considered writable.
 	m_isWritable = create;
+
+	// Device files share an I/O scheduler with the
+	// other RefFiles that have the device open.
+	if (!create && isDevice_int()) {
+		uint64_t dev;
+#ifdef _WIN32
+		dev = _tcstoul(&filename[17], nullptr, 10);
+#else /* !_WIN32 */
+		struct stat sb;
+		dev = (fstat(fileno(m_file), &sb) == 0 ? static_cast<uint64_t>(sb.st_rdev) : 0);
+#endif /* _WIN32 */
+		m_ioSched = IoScheduler::forDevice(dev);
+	}
 }
 
 RefFile::~RefFile()
 {
+	closeDirect_int();
 	if (m_file) {
 		fclose(m_file);
 	}
+	delete m_http;
 }
 
 /**
@@ -99,9 +190,15 @@ RefFile::~RefFile()
  */
 int RefFile::makeWritable(void)
 {
+	// Other threads must not use m_file while it's being reopened.
+	unique_lock<shared_timed_mutex> lock(m_ioLock);
+
 	if (m_isWritable) {
 		// File is already writable.
 		return 0;
+	} else if (m_http) {
+		// Remote files are read-only.
+		return -EROFS;
 	} else if (!m_file) {
 		// File is not open.
 		return -EBADF;
@@ -123,6 +220,12 @@ int RefFile::makeWritable(void)
 	if (m_file) {
 		// File reopened as writable.
 		m_isWritable = true;
+		if (m_directAlign != 0) {
+			// Reopen the direct I/O handle as writable, too.
+			// If that fails, buffered I/O will be used.
+			closeDirect_int();
+			openDirect_int();
+		}
 	} else {
 		// Could not reopen as writable.
 		ret = -errno;
@@ -143,6 +246,17 @@ int RefFile::makeWritable(void)
  * @return True if this is a device file; false if it isn't.
  */
 bool RefFile::isDevice(void) const
+{
+	shared_lock<shared_timed_mutex> lock(m_ioLock);
+	return isDevice_int();
+}
+
+/**
+ * Check if the file is a device file. (internal function)
+ * NOTE: m_ioLock must be held by the caller.
+ * @return True if this is a device file; false if it isn't.
+ */
+bool RefFile::isDevice_int(void) const
 {
 	if (!m_file) {
 		// No file...
@@ -183,26 +297,289 @@ bool RefFile::isDevice(void) const
 }
 
 /**
- * Try to make this file a sparse file.
- * @param size If not zero, try to set the file to this size.
+ * Enable or disable direct I/O. (O_DIRECT or FILE_FLAG_NO_BUFFERING)
+ * Direct I/O is only supported for device files.
+ * @param enable True to enable direct I/O; false to disable it.
  * @return 0 on success; negative POSIX error code on error.
  */
-int RefFile::makeSparse(off64_t size)
+int RefFile::setDirectIO(bool enable)
+{
+	// Other threads must not use the direct I/O handle while it's being changed.
+	unique_lock<shared_timed_mutex> lock(m_ioLock);
+
+	if (!enable) {
+		closeDirect_int();
+		return 0;
+	} else if (m_directAlign != 0) {
+		// Direct I/O is already enabled.
+		return 0;
+	} else if (!m_file) {
+		// File is not open.
+		return -EBADF;
+	} else if (!isDevice_int()) {
+		// Direct I/O is only used for devices.
+		return -ENOTSUP;
+	}
+
+	return openDirect_int();
+}
+
+/**
+ * Open the direct I/O handle. (internal function)
+ * NOTE: m_ioLock must be held exclusively by the caller.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int RefFile::openDirect_int(void)
+{
+	// Default to 4 KB alignment if the sector size can't be determined.
+	// This works for both 512-byte and 4 KB sector devices.
+	unsigned int align = 4096;
+
+#if defined(_WIN32)
+	HANDLE hDirect = CreateFile(m_filename.c_str(),
+		GENERIC_READ | (m_isWritable ? GENERIC_WRITE : 0),
+		FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+		OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, nullptr);
+	if (hDirect == INVALID_HANDLE_VALUE) {
+		return -EIO;
+	}
+
+	DISK_GEOMETRY dg;
+	DWORD dwBytesReturned = 0;
+	if (DeviceIoControl(hDirect, IOCTL_DISK_GET_DRIVE_GEOMETRY,
+	    nullptr, 0, &dg, (DWORD)sizeof(dg), &dwBytesReturned, nullptr) &&
+	    dwBytesReturned == sizeof(dg) && dg.BytesPerSector >= 512)
+	{
+		align = dg.BytesPerSector;
+	}
+	m_hDirect = hDirect;
+#elif defined(O_DIRECT)
+	const int fd = open(m_filename.c_str(),
+		(m_isWritable ? O_RDWR : O_RDONLY) | O_DIRECT | O_CLOEXEC);
+	if (fd < 0) {
+		return -errno;
+	}
+
+#  ifdef BLKSSZGET
+	int sector_size = 0;
+	if (ioctl(fd, BLKSSZGET, &sector_size) == 0 && sector_size >= 512) {
+		align = static_cast<unsigned int>(sector_size);
+	}
+#  endif /* BLKSSZGET */
+	m_fdDirect = fd;
+#else
+	// Direct I/O isn't available on this system.
+	UNUSED(align);
+	return -ENOTSUP;
+#endif
+
+	m_directAlign = align;
+	return 0;
+}
+
+/**
+ * Close the direct I/O handle. (internal function)
+ * NOTE: m_ioLock must be held exclusively by the caller.
+ */
+void RefFile::closeDirect_int(void)
 {
 #ifdef _WIN32
-	wchar_t root_dir[4];		// Root directory.
-	wchar_t *p_root_dir;		// Pointer to root_dir, or NULL if relative.
+	if (m_hDirect) {
+		CloseHandle(static_cast<HANDLE>(m_hDirect));
+		m_hDirect = nullptr;
+	}
+#else /* !_WIN32 */
+	if (m_fdDirect >= 0) {
+		close(m_fdDirect);
+		m_fdDirect = -1;
+	}
+#endif /* _WIN32 */
+	m_directAlign = 0;
+}
+
+/**
+ * Call posix_fadvise() on the buffered file. (internal function)
+ * @param offset	[in] Starting offset
+ * @param len		[in] Length, in bytes (0 for the rest of the file)
+ * @param advice	[in] POSIX_FADV_* value
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int RefFile::fadvise_int(off64_t offset, off64_t len, int advice)
+{
+	if (m_http) {
+		// Remote files aren't in the page cache.
+		return 0;
+	}
+#ifdef HAVE_POSIX_FADVISE
+	shared_lock<shared_timed_mutex> lock(m_ioLock);
+	if (!m_file) {
+		return -EBADF;
+	}
+	// NOTE: posix_fadvise() returns the error code instead of setting errno.
+	const int ret = posix_fadvise(fileno(m_file), static_cast<off_t>(offset),
+		static_cast<off_t>(len), advice);
+	return -ret;
+#else /* !HAVE_POSIX_FADVISE */
+	UNUSED(offset);
+	UNUSED(len);
+	UNUSED(advice);
+	return 0;
+#endif /* HAVE_POSIX_FADVISE */
+}
+
+#ifndef HAVE_POSIX_FADVISE
+// Placeholder values for systems without posix_fadvise().
+#  define POSIX_FADV_NORMAL	0
+#  define POSIX_FADV_RANDOM	1
+#  define POSIX_FADV_SEQUENTIAL	2
+#  define POSIX_FADV_WILLNEED	3
+#  define POSIX_FADV_DONTNEED	4
+#  define POSIX_FADV_NOREUSE	5
+#endif /* !HAVE_POSIX_FADVISE */
+
+/**
+ * Convert an access hint to a POSIX_FADV_* value.
+ * @param hint Access hint
+ * @return POSIX_FADV_* value
+ */
+static inline int hintToAdvice(RefFile::AccessHint hint)
+{
+	switch (hint) {
+		default:
+		case RefFile::AccessHint::Normal:
+			return POSIX_FADV_NORMAL;
+		case RefFile::AccessHint::Sequential:
+			return POSIX_FADV_SEQUENTIAL;
+		case RefFile::AccessHint::Random:
+			return POSIX_FADV_RANDOM;
+	}
+}
+
+/**
+ * Set the access hint for the whole file.
+ * This hint is restored by endScan().
+ * @param hint	[in] Access hint
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int RefFile::setAccessHint(AccessHint hint)
+{
+	m_accessHint = hint;
+	if (m_http) {
+		m_http->setReadAhead(hint != AccessHint::Random);
+		return 0;
+	}
+	return fadvise_int(0, 0, hintToAdvice(hint));
+}
+
+/**
+ * Indicate that a region will be read sequentially once.
+ * Call endScan() when the scan is finished.
+ * @param offset	[in] Starting offset
+ * @param len		[in] Length, in bytes (0 for the rest of the file)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int RefFile::beginScan(off64_t offset, off64_t len)
+{
+	// NOTE: Linux ignores POSIX_FADV_NOREUSE prior to 6.3,
+	// so cached data is also dropped using dropCache().
+	int ret = fadvise_int(offset, len, POSIX_FADV_SEQUENTIAL);
+	if (ret == 0) {
+		ret = fadvise_int(offset, len, POSIX_FADV_NOREUSE);
+	}
+	return ret;
+}
+
+/**
+ * Indicate that a sequential scan is finished.
+ * The access hint set by setAccessHint() is restored.
+ * @param offset	[in] Starting offset
+ * @param len		[in] Length, in bytes (0 for the rest of the file)
+ */
+void RefFile::endScan(off64_t offset, off64_t len)
+{
+	fadvise_int(offset, len, hintToAdvice(m_accessHint));
+}
+
+/**
+ * Drop cached data for a region that won't be read again.
+ * Dirty data is written back first.
+ * @param offset	[in] Starting offset
+ * @param len		[in] Length, in bytes
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int RefFile::dropCache(off64_t offset, off64_t len)
+{
+	assert(len > 0);
+	if (len <= 0) {
+		return -EINVAL;
+	}
+	return fadvise_int(offset, len, POSIX_FADV_DONTNEED);
+}
+
+/**
+ * Indicate that a region will be read soon.
+ * The OS may start reading it into the page cache in the background.
+ * @param offset	[in] Starting offset
+ * @param len		[in] Length, in bytes
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int RefFile::prefetch(off64_t offset, off64_t len)
+{
+	assert(len > 0);
+	if (len <= 0) {
+		return -EINVAL;
+	}
+	if (m_http) {
+		// Start downloading the region.
+		m_http->prefetch(offset, len);
+		return 0;
+	}
+	return fadvise_int(offset, len, POSIX_FADV_WILLNEED);
+}
+
+#ifndef _WIN32
+/**
+ * Duplicate the file descriptor for asynchronous I/O.
+ * The duplicate isn't affected if this file is reopened or closed.
+ * The caller must close() the duplicate.
+ * @param direct	[in] If true, duplicate the direct I/O file descriptor.
+ * @return File descriptor, or -1 on error. (-1 if direct is true and direct I/O is disabled)
+ */
+int RefFile::dupFd(bool direct) const
+{
+	shared_lock<shared_timed_mutex> lock(m_ioLock);
+	const int fd = (direct ? m_fdDirect : (m_file ? fileno(m_file) : -1));
+	if (fd < 0) {
+		errno = EBADF;
+		return -1;
+	}
+	return fcntl(fd, F_DUPFD_CLOEXEC, 0);
+}
+#endif /* !_WIN32 */
+
+#ifdef _WIN32
+/**
+ * Get information about the volume containing a file.
+ * @param filename	[in] Filename
+ * @param pdwFlags	[out] File system flags
+ * @param fsName	[out,opt] File system name
+ * @param fsNameLen	[in] Size of fsName, in TCHARs
+ * @return True on success; false on error.
+ */
+static bool getVolumeInfo(const std::tstring &filename, DWORD *pdwFlags, TCHAR *fsName, DWORD fsNameLen)
+{
+	TCHAR root_dir[4];		// Root directory.
+	TCHAR *p_root_dir;		// Pointer to root_dir, or NULL if relative.
 
-	// Check if the file system supports sparse files.
 	// TODO: Handle mount points?
-	if (m_filename.size() >= 3 &&
-	    _istalpha(m_filename[0]) && m_filename[1] == _T(':') &&
-	    (m_filename[2] == _T('\\') || m_filename[2] == _T('/')))
+	if (filename.size() >= 3 &&
+	    _istalpha(filename[0]) && filename[1] == _T(':') &&
+	    (filename[2] == _T('\\') || filename[2] == _T('/')))
 	{
 		// Absolute pathname.
-		root_dir[0] = m_filename[0];
-		root_dir[1] = L':';
-		root_dir[2] = L'\\';
+		root_dir[0] = filename[0];
+		root_dir[1] = _T(':');
+		root_dir[2] = _T('\\');
 		root_dir[3] = 0;
 		p_root_dir = root_dir;
 	}
@@ -212,10 +589,26 @@ int RefFile::makeSparse(off64_t size)
 		p_root_dir = nullptr;
 	}
 
+	return !!GetVolumeInformation(p_root_dir, nullptr, 0, nullptr, nullptr,
+		pdwFlags, fsName, fsNameLen);
+}
+#endif /* _WIN32 */
+
+/**
+ * Try to make this file a sparse file.
+ * @param size If not zero, try to set the file to this size.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int RefFile::makeSparse(off64_t size)
+{
+	shared_lock<shared_timed_mutex> lock(m_ioLock);
+
+#ifdef _WIN32
+	// Check if the file system supports sparse files.
 	DWORD dwFileSystemFlags;
-	BOOL bRet = GetVolumeInformation(p_root_dir, nullptr, 0, nullptr, nullptr,
-		&dwFileSystemFlags, nullptr, 0);
-	if (bRet != 0 && (dwFileSystemFlags & FILE_SUPPORTS_SPARSE_FILES)) {
+	if (getVolumeInfo(m_filename, &dwFileSystemFlags, nullptr, 0) &&
+	    (dwFileSystemFlags & FILE_SUPPORTS_SPARSE_FILES))
+	{
 		// File system supports sparse files.
 		// Mark the file as sparse.
 		HANDLE h_extract = (HANDLE)_get_osfhandle(_fileno(m_file));
@@ -264,112 +657,495 @@ int RefFile::makeSparse(off64_t size)
 }
 
 /**
- * Get the size of the file.
- * @return Size of file, or -1 on error.
+ * Allocate disk space for the whole file up front.
+ * The file is set to the specified size. Allocating the file
+ * in one step keeps it contiguous on file systems that would
+ * otherwise fragment it, e.g. ext4 and NTFS.
+ *
+ * NOTE: On Windows, the allocated area may contain stale data
+ * if the process has SE_MANAGE_VOLUME_NAME. The caller must
+ * write the entire file.
+ *
+ * @param size File size.
+ * @return 0 on success; negative POSIX error code on error. (-ENOTSUP if not supported)
  */
-off64_t RefFile::size(void)
+int RefFile::preallocate(off64_t size)
 {
+	shared_lock<shared_timed_mutex> lock(m_ioLock);
 	if (!m_file) {
-		// No file...
-		return -1;
+		return -EBADF;
+	} else if (size <= 0) {
+		return -EINVAL;
 	}
 
-	// If this is a device, try OS-specific device size functions first.
-	// NOTE: _fseeki64(fp, 0, SEEK_END) isn't working on
-	// device files on Windows for some reason...
-	if (this->isDevice()) {
 #ifdef _WIN32
-		// Windows version.
-		HANDLE hDevice = (HANDLE)_get_osfhandle(_fileno(m_file));
-		if (hDevice && hDevice != INVALID_HANDLE_VALUE) {
-			// Reference: https://docs.microsoft.com/en-us/windows/desktop/api/winioctl/ni-winioctl-ioctl_disk_get_length_info
-			GET_LENGTH_INFORMATION gli;
-			DWORD dwBytesReturned = 0;
-			BOOL bRet = DeviceIoControl(hDevice,
-				IOCTL_DISK_GET_LENGTH_INFO,	// dwIoControlCode
-				nullptr,			// lpInBuffer
-				0,				// nInBufferSize
-				(LPVOID)&gli,			// output buffer
-				(DWORD)sizeof(gli),		// size of output buffer
-				&dwBytesReturned,		// number of bytes returned
-				nullptr);			// OVERLAPPED structure
-			if (bRet && dwBytesReturned == sizeof(gli)) {
-				// Size obtained successfully.
-				return gli.Length.QuadPart;
-			}
-		}
-#elif defined(__linux__)
-		// Linux version.
-		// Reference: http://www.microhowto.info/howto/get_the_size_of_a_linux_block_special_device_in_c.html
-		off64_t ret = -1;
-		if (ioctl(fileno(m_file), BLKGETSIZE64, &ret) == 0) {
-			// Size obtained successfully.
-			return ret;
-		}
-#endif
+	HANDLE hFile = (HANDLE)_get_osfhandle(_fileno(m_file));
+	if (!hFile || hFile == INVALID_HANDLE_VALUE) {
+		return -EBADF;
 	}
 
-	// Not a device, or the OS-specific device size function failed.
-	// Use this->seeko() / this->tello().
-	off64_t orig_pos = this->tello();
-	if (orig_pos < 0) {
-		// Error.
-		return -1;
+	// Extend the file. NTFS allocates the clusters immediately,
+	// but they're zeroed when written past the valid data length.
+	LARGE_INTEGER liSize, liZero;
+	liSize.QuadPart = size;
+	liZero.QuadPart = 0;
+	if (!SetFilePointerEx(hFile, liSize, nullptr, FILE_BEGIN) || !SetEndOfFile(hFile)) {
+		const DWORD dwError = GetLastError();
+		SetFilePointerEx(hFile, liZero, nullptr, FILE_BEGIN);
+		m_lastError = (dwError == ERROR_DISK_FULL ? ENOSPC : EIO);
+		return -m_lastError;
 	}
-	int err = this->seeko(0, SEEK_END);
-	if (err != 0) {
-		// Error.
-		return -1;
+	SetFilePointerEx(hFile, liZero, nullptr, FILE_BEGIN);
+
+	// Skip zeroing the clusters if possible.
+	// This requires SE_MANAGE_VOLUME_NAME, so errors are ignored.
+	SetFileValidData(hFile, size);
+	return 0;
+#elif defined(HAVE_FALLOCATE) || defined(HAVE_POSIX_FALLOCATE)
+	const int fd = fileno(m_file);
+	int err;
+#  ifdef HAVE_FALLOCATE
+	// Linux: Fails if the file system can't allocate unwritten extents.
+	err = (fallocate(fd, 0, 0, size) == 0 ? 0 : errno);
+	if (err == EOPNOTSUPP) {
+		err = ENOTSUP;
 	}
-	off64_t ret = this->tello();
-	err = this->seeko(orig_pos, SEEK_SET);
+#  else /* !HAVE_FALLOCATE */
+	// NOTE: posix_fallocate() returns the error code directly.
+	// Some C libraries emulate it by writing zeroes if the file system
+	// doesn't support it, which is no better than writing the file.
+	err = posix_fallocate(fd, 0, size);
+	if (err == EINVAL) {
+		err = ENOTSUP;
+	}
+#  endif /* HAVE_FALLOCATE */
 	if (err != 0) {
-		// Error.
-		return -1;
+		if (err != ENOTSUP) {
+			m_lastError = err;
+		}
+		return -err;
 	}
-	return ret;
+	return 0;
+#else
+	// Not supported.
+	((void)size);
+	return -ENOTSUP;
+#endif
 }
 
 /**
- * Get the file's modification time.
- * @return File modification time, or -1 on error.
+ * Deallocate a region of the file.
+ * The region reads as zero afterwards, and the file size isn't changed.
+ * @param offset	[in] Starting offset
+ * @param len		[in] Length, in bytes
+ * @return 0 on success; negative POSIX error code on error. (-ENOTSUP if not supported)
  */
-time_t RefFile::mtime(void)
+int RefFile::punchHole(off64_t offset, off64_t len)
 {
+	shared_lock<shared_timed_mutex> lock(m_ioLock);
 	if (!m_file) {
-		// No file...
-		return -1;
+		return -EBADF;
+	} else if (offset < 0 || len <= 0) {
+		return -EINVAL;
 	}
 
-#if defined(_WIN32)
-	HANDLE h_file = (HANDLE)_get_osfhandle(_fileno(m_file));
-	assert(h_file != nullptr);
-	assert(h_file != INVALID_HANDLE_VALUE);
-	if (!h_file || h_file == INVALID_HANDLE_VALUE) {
-		// Can't get the underlying HANDLE...
-		return -1;
+#ifdef _WIN32
+	HANDLE hFile = (HANDLE)_get_osfhandle(_fileno(m_file));
+	if (!hFile || hFile == INVALID_HANDLE_VALUE) {
+		return -EBADF;
 	}
 
-	FILETIME ft_mtime;
-	BOOL bRet = GetFileTime(h_file, nullptr, nullptr, &ft_mtime);
-	if (!bRet) {
-		// GetFileTime() failed.
-		return -1;
+	// FSCTL_SET_ZERO_DATA only deallocates clusters in sparse files.
+	DWORD bytesReturned;
+	FILE_SET_SPARSE_BUFFER fssb;
+	fssb.SetSparse = TRUE;
+	if (!DeviceIoControl(hFile, FSCTL_SET_SPARSE,
+		&fssb, sizeof(fssb), nullptr, 0, &bytesReturned, nullptr))
+	{
+		return -ENOTSUP;
 	}
 
-	return FileTimeToUnixTime(&ft_mtime);
-#elif defined(HAVE_STATX)
-	struct statx sbx;
-	int ret = statx(fileno(m_file), "", AT_EMPTY_PATH, STATX_MTIME, &sbx);
-	if (ret != 0 || !(sbx.stx_mask & STATX_MTIME)) {
-		// statx() failed and/or did not return the mtime.
-		return -1;
+	FILE_ZERO_DATA_INFORMATION fzdi;
+	fzdi.FileOffset.QuadPart = offset;
+	fzdi.BeyondFinalZero.QuadPart = offset + len;
+	if (!DeviceIoControl(hFile, FSCTL_SET_ZERO_DATA,
+		&fzdi, sizeof(fzdi), nullptr, 0, &bytesReturned, nullptr))
+	{
+		return -EIO;
 	}
-	return sbx.stx_mtime.tv_sec;
+	return 0;
+#elif defined(HAVE_FALLOCATE) && defined(FALLOC_FL_PUNCH_HOLE)
+	if (fallocate(fileno(m_file), FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, len) != 0) {
+		const int err = errno;
+		return -(err == EOPNOTSUPP ? ENOTSUP : err);
+	}
+	return 0;
 #else
-	struct stat sb;
-	int ret = fstat(fileno(m_file), &sb);
-	if (ret != 0) {
+	// Not supported.
+	((void)offset);
+	((void)len);
+	return -ENOTSUP;
+#endif
+}
+
+/**
+ * Zero a region of the file without writing a buffer.
+ *
+ * Devices are zeroed using BLKZEROOUT on Linux, which lets the
+ * device unmap or zero the blocks itself if it supports it.
+ * Files are zeroed by deallocating the region.
+ *
+ * If -ENOTSUP is returned, the caller should write zeroes instead.
+ *
+ * @param offset	[in] Starting offset (must be a multiple of 512)
+ * @param len		[in] Length, in bytes (must be a multiple of 512)
+ * @return 0 on success; negative POSIX error code on error. (-ENOTSUP if not supported)
+ */
+int RefFile::zeroRange(off64_t offset, off64_t len)
+{
+	shared_lock<shared_timed_mutex> lock(m_ioLock);
+	if (!m_file) {
+		return -EBADF;
+	} else if (offset < 0 || len <= 0 || (offset % 512) != 0 || (len % 512) != 0) {
+		return -EINVAL;
+	}
+
+#ifdef _WIN32
+	if (isDevice_int()) {
+		// FSCTL_SET_ZERO_DATA only works on files.
+		return -ENOTSUP;
+	}
+
+	HANDLE hFile = (HANDLE)_get_osfhandle(_fileno(m_file));
+	if (!hFile || hFile == INVALID_HANDLE_VALUE) {
+		return -EBADF;
+	}
+
+	// NOTE: The clusters are only deallocated if the file is sparse.
+	// Otherwise, the file system writes the zeroes.
+	DWORD bytesReturned;
+	FILE_ZERO_DATA_INFORMATION fzdi;
+	fzdi.FileOffset.QuadPart = offset;
+	fzdi.BeyondFinalZero.QuadPart = offset + len;
+	if (!DeviceIoControl(hFile, FSCTL_SET_ZERO_DATA,
+		&fzdi, sizeof(fzdi), nullptr, 0, &bytesReturned, nullptr))
+	{
+		return -ENOTSUP;
+	}
+	return 0;
+#elif defined(__linux__)
+	const int fd = fileno(m_file);
+	int ret;
+	if (isDevice_int()) {
+#  ifdef BLKZEROOUT
+		// NOTE: BLKDISCARD isn't used directly, since discarded
+		// blocks aren't guaranteed to read back as zero.
+		// BLKZEROOUT unmaps the blocks if the device guarantees it.
+		uint64_t range[2] = {static_cast<uint64_t>(offset), static_cast<uint64_t>(len)};
+		ret = ioctl(fd, BLKZEROOUT, range);
+#  else /* !BLKZEROOUT */
+		errno = ENOTSUP;
+		ret = -1;
+#  endif /* BLKZEROOUT */
+	} else {
+#  if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_PUNCH_HOLE)
+		ret = fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, len);
+#  else
+		errno = ENOTSUP;
+		ret = -1;
+#  endif
+	}
+	if (ret != 0) {
+		const int err = errno;
+		return -((err == EOPNOTSUPP || err == ENOTTY || err == EINVAL) ? ENOTSUP : err);
+	}
+	return 0;
+#else
+	// Not supported.
+	return -ENOTSUP;
+#endif
+}
+
+/**
+ * Find the allocated data in a region of the file.
+ *
+ * Holes in sparse files are always read as zeroes, so they
+ * can be skipped without reading them. This uses SEEK_DATA and
+ * SEEK_HOLE, or FSCTL_QUERY_ALLOCATED_RANGES on Windows.
+ * Devices aren't supported.
+ *
+ * @param offset	[in] Starting offset
+ * @param len		[in] Length, in bytes
+ * @param ranges	[out] Allocated ranges ({offset, length}), sorted by offset
+ * @return 0 on success; negative POSIX error code on error. (-ENOTSUP if not supported)
+ */
+int RefFile::dataRanges(off64_t offset, off64_t len, std::vector<std::pair<off64_t, off64_t> > &ranges)
+{
+	// The file pointer may be moved, so this needs exclusive access.
+	unique_lock<shared_timed_mutex> lock(m_ioLock);
+	ranges.clear();
+	if (!m_file) {
+		return -EBADF;
+	} else if (offset < 0 || len < 0) {
+		return -EINVAL;
+	} else if (this->isDevice_int()) {
+		return -ENOTSUP;
+	}
+	const off64_t end = offset + len;
+
+#ifdef _WIN32
+	HANDLE hFile = (HANDLE)_get_osfhandle(_fileno(m_file));
+	if (!hFile || hFile == INVALID_HANDLE_VALUE) {
+		return -EBADF;
+	}
+
+	// Ranges are returned in batches.
+	FILE_ALLOCATED_RANGE_BUFFER query;
+	FILE_ALLOCATED_RANGE_BUFFER out[64];
+	query.FileOffset.QuadPart = offset;
+	query.Length.QuadPart = len;
+	while (query.Length.QuadPart > 0) {
+		DWORD bytesReturned = 0;
+		const BOOL bRet = DeviceIoControl(hFile, FSCTL_QUERY_ALLOCATED_RANGES,
+			&query, sizeof(query), out, sizeof(out), &bytesReturned, nullptr);
+		if (!bRet && GetLastError() != ERROR_MORE_DATA) {
+			ranges.clear();
+			return -ENOTSUP;
+		}
+
+		const unsigned int count = bytesReturned / sizeof(out[0]);
+		for (unsigned int i = 0; i < count; i++) {
+			const off64_t start = std::max<off64_t>(out[i].FileOffset.QuadPart, offset);
+			const off64_t stop = std::min<off64_t>(out[i].FileOffset.QuadPart + out[i].Length.QuadPart, end);
+			if (stop > start) {
+				ranges.emplace_back(start, stop - start);
+			}
+		}
+		if (bRet || count == 0) {
+			break;
+		}
+
+		// Continue after the last range.
+		const off64_t next = out[count-1].FileOffset.QuadPart + out[count-1].Length.QuadPart;
+		query.FileOffset.QuadPart = next;
+		query.Length.QuadPart = end - next;
+	}
+	return 0;
+#elif defined(SEEK_DATA) && defined(SEEK_HOLE)
+	const int fd = fileno(m_file);
+	const off64_t orig_pos = lseek(fd, 0, SEEK_CUR);
+	if (orig_pos < 0) {
+		return -errno;
+	}
+
+	int ret = 0;
+	for (off64_t pos = offset; pos < end; ) {
+		const off64_t data = lseek(fd, pos, SEEK_DATA);
+		if (data < 0) {
+			// ENXIO: No more data.
+			const int err = errno;
+			if (err != ENXIO) {
+				ret = -(err == EINVAL ? ENOTSUP : err);
+			}
+			break;
+		} else if (data >= end) {
+			break;
+		}
+		off64_t hole = lseek(fd, data, SEEK_HOLE);
+		if (hole < 0) {
+			const int err = errno;
+			ret = -(err == EINVAL ? ENOTSUP : err);
+			break;
+		}
+		hole = std::min(hole, end);
+		ranges.emplace_back(data, hole - data);
+		pos = hole;
+	}
+
+	// Restore the file pointer.
+	lseek(fd, orig_pos, SEEK_SET);
+	if (ret != 0) {
+		ranges.clear();
+	}
+	return ret;
+#else
+	// Not supported.
+	((void)end);
+	return -ENOTSUP;
+#endif
+}
+
+/**
+ * Check if new files on this file system should be preallocated
+ * instead of written sparsely.
+ *
+ * Sparse writes fragment files on file systems that allocate
+ * blocks in write order (ext4, NTFS) or don't support sparse
+ * files at all (FAT, exFAT). Copy-on-write and extent-based file
+ * systems with delayed allocation (Btrfs, XFS, ReFS) don't
+ * benefit from preallocation.
+ *
+ * @return True if preallocation is preferred; false if not.
+ */
+bool RefFile::prefersPreallocation(void)
+{
+#ifdef _WIN32
+	DWORD dwFileSystemFlags;
+	TCHAR fsName[MAX_PATH+1];
+	if (!getVolumeInfo(m_filename, &dwFileSystemFlags, fsName, ARRAY_SIZE(fsName))) {
+		return false;
+	}
+	return (!_tcsicmp(fsName, _T("NTFS")) ||
+		!_tcsicmp(fsName, _T("FAT")) ||
+		!_tcsicmp(fsName, _T("FAT32")) ||
+		!_tcsicmp(fsName, _T("exFAT")));
+#elif defined(__linux__)
+	shared_lock<shared_timed_mutex> lock(m_ioLock);
+	if (!m_file) {
+		return false;
+	}
+
+	// NOTE: Not using <linux/magic.h>, since older
+	// versions don't have all of these.
+	struct statfs sfs;
+	if (fstatfs(fileno(m_file), &sfs) != 0) {
+		return false;
+	}
+	switch (static_cast<uint32_t>(sfs.f_type)) {
+		case 0xEF53:		// ext2/ext3/ext4
+		case 0x4D44:		// FAT
+		case 0x2011BAB0:	// exFAT
+		case 0x5346544E:	// NTFS (ntfs3)
+			return true;
+		default:
+			return false;
+	}
+#else
+	// Assume sparse files are handled well.
+	return false;
+#endif
+}
+
+/**
+ * Get the size of the file.
+ * @return Size of file, or -1 on error.
+ */
+off64_t RefFile::size(void)
+{
+	if (m_http) {
+		return m_http->size();
+	}
+
+	// The file pointer may be moved, so this needs exclusive access.
+	unique_lock<shared_timed_mutex> lock(m_ioLock);
+
+	if (!m_file) {
+		// No file...
+		return -1;
+	}
+
+	// If this is a device, try OS-specific device size functions first.
+	// NOTE: _fseeki64(fp, 0, SEEK_END) isn't working on
+	// device files on Windows for some reason...
+	if (this->isDevice_int()) {
+#ifdef _WIN32
+		// Windows version.
+		HANDLE hDevice = (HANDLE)_get_osfhandle(_fileno(m_file));
+		if (hDevice && hDevice != INVALID_HANDLE_VALUE) {
+			// Reference: https://docs.microsoft.com/en-us/windows/desktop/api/winioctl/ni-winioctl-ioctl_disk_get_length_info
+			GET_LENGTH_INFORMATION gli;
+			DWORD dwBytesReturned = 0;
+			BOOL bRet = DeviceIoControl(hDevice,
+				IOCTL_DISK_GET_LENGTH_INFO,	// dwIoControlCode
+				nullptr,			// lpInBuffer
+				0,				// nInBufferSize
+				(LPVOID)&gli,			// output buffer
+				(DWORD)sizeof(gli),		// size of output buffer
+				&dwBytesReturned,		// number of bytes returned
+				nullptr);			// OVERLAPPED structure
+			if (bRet && dwBytesReturned == sizeof(gli)) {
+				// Size obtained successfully.
+				return gli.Length.QuadPart;
+			}
+		}
+#elif defined(__linux__)
+		// Linux version.
+		// Reference: http://www.microhowto.info/howto/get_the_size_of_a_linux_block_special_device_in_c.html
+		off64_t ret = -1;
+		if (ioctl(fileno(m_file), BLKGETSIZE64, &ret) == 0) {
+			// Size obtained successfully.
+			return ret;
+		}
+#endif
+	}
+
+	// Not a device, or the OS-specific device size function failed.
+	// Use this->seeko() / this->tello().
+	off64_t orig_pos = this->tello();
+	if (orig_pos < 0) {
+		// Error.
+		return -1;
+	}
+	int err = this->seeko(0, SEEK_END);
+	if (err != 0) {
+		// Error.
+		return -1;
+	}
+	off64_t ret = this->tello();
+	err = this->seeko(orig_pos, SEEK_SET);
+	if (err != 0) {
+		// Error.
+		return -1;
+	}
+	return ret;
+}
+
+/**
+ * Get the file's modification time.
+ * @return File modification time, or -1 on error.
+ */
+time_t RefFile::mtime(void)
+{
+	if (m_http) {
+		return m_http->mtime();
+	}
+
+	shared_lock<shared_timed_mutex> lock(m_ioLock);
+
+	if (!m_file) {
+		// No file...
+		return -1;
+	}
+
+#if defined(_WIN32)
+	HANDLE h_file = (HANDLE)_get_osfhandle(_fileno(m_file));
+	assert(h_file != nullptr);
+	assert(h_file != INVALID_HANDLE_VALUE);
+	if (!h_file || h_file == INVALID_HANDLE_VALUE) {
+		// Can't get the underlying HANDLE...
+		return -1;
+	}
+
+	FILETIME ft_mtime;
+	BOOL bRet = GetFileTime(h_file, nullptr, nullptr, &ft_mtime);
+	if (!bRet) {
+		// GetFileTime() failed.
+		return -1;
+	}
+
+	return FileTimeToUnixTime(&ft_mtime);
+#elif defined(HAVE_STATX)
+	struct statx sbx;
+	int ret = statx(fileno(m_file), "", AT_EMPTY_PATH, STATX_MTIME, &sbx);
+	if (ret != 0 || !(sbx.stx_mask & STATX_MTIME)) {
+		// statx() failed and/or did not return the mtime.
+		return -1;
+	}
+	return sbx.stx_mtime.tv_sec;
+#else
+	struct stat sb;
+	int ret = fstat(fileno(m_file), &sb);
+	if (ret != 0) {
 		// fstat() failed.
 		return -1;
 	}
@@ -377,13 +1153,830 @@ time_t RefFile::mtime(void)
 #endif
 }
 
+/**
+ * Count a read or a write for the current operation. (See RvtH_Stats.)
+ * @param offset	[in] File offset.
+ * @param size		[in] Number of bytes transferred.
+ * @param write		[in] True for a write; false for a read.
+ */
+void RefFile::countIO(off64_t offset, size_t size, bool write)
+{
+	const off64_t prevPos = m_nextPos.exchange(offset + static_cast<off64_t>(size), std::memory_order_relaxed);
+	StatsCounters::addIO(size, write, prevPos != offset);
+
+	if (write && size > 0) {
+		const uint64_t unsynced = m_unsynced.fetch_add(size, std::memory_order_relaxed) + size;
+		if (m_durability == RVTH_DURABILITY_WRITE_THROUGH ||
+		    (m_durability == RVTH_DURABILITY_INTERVAL && unsynced >= m_syncInterval))
+		{
+			syncFile_int();
+		}
+	}
+}
+
+/**
+ * Read data from the file at the specified offset.
+ * @param ptr		[out] Read buffer.
+ * @param size		[in] Number of bytes to read.
+ * @param offset	[in] File offset.
+ * @return Number of bytes read. (If less than size, check errno.)
+ */
+size_t RefFile::pread(void *ptr, size_t size, off64_t offset)
+{
+	uint8_t *ptr8 = static_cast<uint8_t*>(ptr);
+	size_t total = 0;
+
+	// NOTE: The file isn't locked while waiting for the bandwidth limit.
+	StatsCounters::throttleIO(size);
+	shared_lock<shared_timed_mutex> lock(m_ioLock);
+	if (!m_file && !m_http) {
+		errno = EBADF;
+		return 0;
+	}
+	if (StatsCounters::cancelled()) {
+		errno = ECANCELED;
+		return 0;
+	}
+
+	const bool direct = canUseDirect(ptr, size, offset);
+	IoScheduler::Ticket ticket(m_ioSched.get(), offset, size, false);
+	StatsTimer timer(StatsCounters::TIMER_IO);
+	ReadLatencyTimer latency(offset, size);
+	if (m_http) {
+		total = m_http->pread(ptr, size, offset);
+		countIO(offset, total, false);
+		return total;
+	}
+#ifdef _WIN32
+	HANDLE hFile = (direct
+		? static_cast<HANDLE>(m_hDirect)
+		: (HANDLE)_get_osfhandle(_fileno(m_file)));
+	while (total < size) {
+		// ReadFile() can only read up to 4 GB at a time.
+		const size_t left = size - total;
+		const DWORD toRead = (left > 0x40000000U) ? 0x40000000U : static_cast<DWORD>(left);
+		const uint64_t pos = static_cast<uint64_t>(offset) + total;
+
+		// NOTE: The handle isn't opened with FILE_FLAG_OVERLAPPED,
+		// so ReadFile() is still synchronous, but the offset in the
+		// OVERLAPPED structure is used instead of the file pointer.
+		OVERLAPPED ov;
+		memset(&ov, 0, sizeof(ov));
+		ov.Offset = static_cast<DWORD>(pos);
+		ov.OffsetHigh = static_cast<DWORD>(pos >> 32);
+
+		DWORD dwRead = 0;
+		if (!ReadFile(hFile, ptr8 + total, toRead, &dwRead, &ov)) {
+			const DWORD dwErr = GetLastError();
+			errno = (dwErr == ERROR_HANDLE_EOF) ? 0 : EIO;
+			break;
+		} else if (dwRead == 0) {
+			// End of file.
+			break;
+		}
+		total += dwRead;
+	}
+#else /* !_WIN32 */
+	const int fd = (direct ? m_fdDirect : fileno(m_file));
+	while (total < size) {
+		const ssize_t ret = ::pread(fd, ptr8 + total, size - total,
+			static_cast<off_t>(offset + total));
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		} else if (ret == 0) {
+			// End of file.
+			break;
+		}
+		total += static_cast<size_t>(ret);
+	}
+#endif /* _WIN32 */
+
+	countIO(offset, total, false);
+	return total;
+}
+
+/**
+ * Read data from the file at the specified offset
+ * into multiple buffers. (scatter read)
+ * The buffers are filled in order from a contiguous range
+ * of the file, using as few system calls as possible.
+ * @param iov		[in] Buffers.
+ * @param count		[in] Number of buffers.
+ * @param offset	[in] File offset.
+ * @return Number of bytes read. (If less than the total size, check errno.)
+ */
+size_t RefFile::preadv(const IoVec *iov, unsigned int count, off64_t offset)
+{
+#ifdef HAVE_PREADV
+	if (!m_http) {
+		return preadv_int(iov, count, offset);
+	}
+#endif /* HAVE_PREADV */
+
+	// Read each buffer separately.
+	size_t total = 0;
+	for (unsigned int i = 0; i < count; i++) {
+		const size_t size = pread(iov[i].ptr, iov[i].size, offset + total);
+		total += size;
+		if (size != iov[i].size)
+			break;
+	}
+	return total;
+}
+
+#ifdef HAVE_PREADV
+/**
+ * Read data from the file into multiple buffers using preadv(). (internal function)
+ * @param iov		[in] Buffers.
+ * @param count		[in] Number of buffers.
+ * @param offset	[in] File offset.
+ * @return Number of bytes read. (If less than the total size, check errno.)
+ */
+size_t RefFile::preadv_int(const IoVec *iov, unsigned int count, off64_t offset)
+{
+	// Maximum number of buffers per system call.
+	// (POSIX requires IOV_MAX to be at least 16.)
+	static constexpr unsigned int PREADV_MAX = 16;
+
+	size_t size = 0;
+	bool direct = true;
+	for (unsigned int i = 0; i < count; i++) {
+		direct = direct && canUseDirect(iov[i].ptr, iov[i].size, offset + size);
+		size += iov[i].size;
+	}
+
+	StatsCounters::throttleIO(size);
+	shared_lock<shared_timed_mutex> lock(m_ioLock);
+	if (!m_file) {
+		errno = EBADF;
+		return 0;
+	}
+	if (StatsCounters::cancelled()) {
+		errno = ECANCELED;
+		return 0;
+	}
+
+	IoScheduler::Ticket ticket(m_ioSched.get(), offset, size, false);
+	StatsTimer timer(StatsCounters::TIMER_IO);
+	ReadLatencyTimer latency(offset, size);
+	const int fd = (direct ? m_fdDirect : fileno(m_file));
+
+	// Current buffer, and the number of bytes already read into it.
+	unsigned int idx = 0;
+	size_t idx_done = 0;
+	size_t total = 0;
+	while (idx < count) {
+		struct iovec vec[PREADV_MAX];
+		int vec_count = 0;
+		for (unsigned int i = idx; i < count && vec_count < static_cast<int>(PREADV_MAX); i++) {
+			const size_t skip = (i == idx ? idx_done : 0);
+			vec[vec_count].iov_base = static_cast<uint8_t*>(iov[i].ptr) + skip;
+			vec[vec_count].iov_len = iov[i].size - skip;
+			vec_count++;
+		}
+
+		const ssize_t ret = ::preadv(fd, vec, vec_count, static_cast<off_t>(offset + total));
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		} else if (ret == 0) {
+			// End of file.
+			break;
+		}
+
+		// Advance past the buffers that were filled.
+		total += static_cast<size_t>(ret);
+		size_t left = static_cast<size_t>(ret);
+		while (left > 0) {
+			const size_t n = std::min(left, iov[idx].size - idx_done);
+			idx_done += n;
+			left -= n;
+			if (idx_done == iov[idx].size) {
+				idx++;
+				idx_done = 0;
+			}
+		}
+		// Skip empty buffers.
+		while (idx < count && iov[idx].size == 0) {
+			idx++;
+		}
+	}
+
+	countIO(offset, total, false);
+	return total;
+}
+#endif /* HAVE_PREADV */
+
+/**
+ * Write data to the file at the specified offset.
+ * @param ptr		[in] Write buffer.
+ * @param size		[in] Number of bytes to write.
+ * @param offset	[in] File offset.
+ * @return Number of bytes written. (If less than size, check errno.)
+ */
+size_t RefFile::pwrite(const void *ptr, size_t size, off64_t offset)
+{
+	const uint8_t *ptr8 = static_cast<const uint8_t*>(ptr);
+	size_t total = 0;
+
+	StatsCounters::throttleIO(size);
+	shared_lock<shared_timed_mutex> lock(m_ioLock);
+	if (!m_file) {
+		errno = EBADF;
+		return 0;
+	}
+	if (StatsCounters::cancelled()) {
+		errno = ECANCELED;
+		return 0;
+	}
+
+	const bool direct = canUseDirect(ptr, size, offset);
+	IoScheduler::Ticket ticket(m_ioSched.get(), offset, size, true);
+	StatsTimer timer(StatsCounters::TIMER_IO);
+#ifdef _WIN32
+	HANDLE hFile = (direct
+		? static_cast<HANDLE>(m_hDirect)
+		: (HANDLE)_get_osfhandle(_fileno(m_file)));
+	while (total < size) {
+		// WriteFile() can only write up to 4 GB at a time.
+		const size_t left = size - total;
+		const DWORD toWrite = (left > 0x40000000U) ? 0x40000000U : static_cast<DWORD>(left);
+		const uint64_t pos = static_cast<uint64_t>(offset) + total;
+
+		OVERLAPPED ov;
+		memset(&ov, 0, sizeof(ov));
+		ov.Offset = static_cast<DWORD>(pos);
+		ov.OffsetHigh = static_cast<DWORD>(pos >> 32);
+
+		DWORD dwWritten = 0;
+		if (!WriteFile(hFile, ptr8 + total, toWrite, &dwWritten, &ov) || dwWritten == 0) {
+			errno = EIO;
+			break;
+		}
+		total += dwWritten;
+	}
+#else /* !_WIN32 */
+	const int fd = (direct ? m_fdDirect : fileno(m_file));
+	while (total < size) {
+		const ssize_t ret = ::pwrite(fd, ptr8 + total, size - total,
+			static_cast<off_t>(offset + total));
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		} else if (ret == 0) {
+			errno = EIO;
+			break;
+		}
+		total += static_cast<size_t>(ret);
+	}
+#endif /* _WIN32 */
+
+	countIO(offset, total, true);
+	return total;
+}
+
+/**
+ * Write data to a stream at the current position.
+ * This is the only way to write to a stream. (See isStream().)
+ * @param ptr		[in] Write buffer.
+ * @param size		[in] Number of bytes to write.
+ * @return Number of bytes written. (If less than size, check errno.)
+ */
+size_t RefFile::write(const void *ptr, size_t size)
+{
+	const uint8_t *ptr8 = static_cast<const uint8_t*>(ptr);
+	size_t total = 0;
+
+	StatsCounters::throttleIO(size);
+	shared_lock<shared_timed_mutex> lock(m_ioLock);
+	if (!m_file) {
+		errno = EBADF;
+		return 0;
+	}
+	if (StatsCounters::cancelled()) {
+		errno = ECANCELED;
+		return 0;
+	}
+
+	StatsTimer timer(StatsCounters::TIMER_IO);
+#ifdef _WIN32
+	HANDLE hFile = (HANDLE)_get_osfhandle(_fileno(m_file));
+	while (total < size) {
+		// WriteFile() can only write up to 4 GB at a time.
+		const size_t left = size - total;
+		const DWORD toWrite = (left > 0x40000000U) ? 0x40000000U : static_cast<DWORD>(left);
+
+		DWORD dwWritten = 0;
+		if (!WriteFile(hFile, ptr8 + total, toWrite, &dwWritten, nullptr) || dwWritten == 0) {
+			errno = (GetLastError() == ERROR_NO_DATA) ? EPIPE : EIO;
+			break;
+		}
+		total += dwWritten;
+	}
+#else /* !_WIN32 */
+	const int fd = fileno(m_file);
+	while (total < size) {
+		const ssize_t ret = ::write(fd, ptr8 + total, size - total);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		} else if (ret == 0) {
+			errno = EIO;
+			break;
+		}
+		total += static_cast<size_t>(ret);
+	}
+#endif /* _WIN32 */
+
+	StatsCounters::addIO(total, true, false);
+	return total;
+}
+
+/**
+ * Can the OS not copy a range between these files at all?
+ * These errors mean the next method should be tried.
+ * @param err	[in] POSIX error code.
+ * @return True if the copy method isn't supported for these files.
+ */
+static inline bool isCopyUnsupported(int err)
+{
+	return (err == ENOTSUP || err == EOPNOTSUPP || err == EXDEV ||
+		err == EINVAL || err == ENOSYS || err == ENOTTY);
+}
+
+/**
+ * Copy a range of another file into this file
+ * without reading the data into user space.
+ *
+ * The blocks are shared with the source file if the file
+ * system supports it. (FICLONERANGE, or block cloning on ReFS)
+ * Otherwise, if mode is CopyMode::Any, the data is copied by
+ * the kernel using copy_file_range(), or splice() if one of
+ * the files is a device. The copy may stop short, e.g. if the
+ * end of the range isn't aligned to the file system's blocks,
+ * so the caller must copy the rest of the range itself.
+ *
+ * Streams and remote files aren't supported.
+ *
+ * @param src		[in] Source file. (must not be this file)
+ * @param src_offset	[in] Source file offset.
+ * @param offset	[in] Destination file offset.
+ * @param len		[in] Number of bytes to copy.
+ * @param mode		[in] Copy mode.
+ * @return Number of bytes copied. (If less than len, check errno; ENOTSUP if the OS can't copy it.)
+ */
+off64_t RefFile::copyRange(RefFile *src, off64_t src_offset, off64_t offset, off64_t len, CopyMode mode)
+{
+	assert(src != this);
+	if (!src || src == this || src_offset < 0 || offset < 0 || len <= 0) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	// Cloned blocks must start on a file system block boundary.
+	// The end of the range only has to be aligned if it isn't
+	// the end of the source file.
+	static const off64_t CLONE_ALIGN = 4096;
+
+	StatsCounters::throttleIO(static_cast<uint64_t>(len));
+	shared_lock<shared_timed_mutex> lock(m_ioLock);
+	shared_lock<shared_timed_mutex> srcLock(src->m_ioLock);
+	if (!m_file) {
+		errno = EBADF;
+		return 0;
+	} else if (!src->m_file || m_isStream) {
+		// Remote files and streams have to be copied using a buffer.
+		errno = ENOTSUP;
+		return 0;
+	}
+	if (StatsCounters::cancelled()) {
+		errno = ECANCELED;
+		return 0;
+	}
+
+	StatsTimer timer(StatsCounters::TIMER_IO);
+	off64_t total = 0;
+	int err = ENOTSUP;
+#ifdef _WIN32
+	// Windows can only copy whole files in the kernel (CopyFileEx()),
+	// so CopyMode::Any is the same as CopyMode::Clone here.
+	UNUSED(mode);
+#  ifdef FSCTL_DUPLICATE_EXTENTS_TO_FILE
+	HANDLE hFile = (HANDLE)_get_osfhandle(_fileno(m_file));
+	HANDLE hSrcFile = (HANDLE)_get_osfhandle(_fileno(src->m_file));
+	if (hFile && hFile != INVALID_HANDLE_VALUE && hSrcFile && hSrcFile != INVALID_HANDLE_VALUE &&
+	    (src_offset % CLONE_ALIGN) == 0 && (offset % CLONE_ALIGN) == 0)
+	{
+		DWORD bytesReturned;
+		DUPLICATE_EXTENTS_DATA ded;
+		ded.FileHandle = hSrcFile;
+		ded.SourceFileOffset.QuadPart = src_offset;
+		ded.TargetFileOffset.QuadPart = offset;
+		ded.ByteCount.QuadPart = len;
+		BOOL bRet = DeviceIoControl(hFile, FSCTL_DUPLICATE_EXTENTS_TO_FILE,
+			&ded, sizeof(ded), nullptr, 0, &bytesReturned, nullptr);
+		if (!bRet && len > CLONE_ALIGN && (len % CLONE_ALIGN) != 0) {
+			ded.ByteCount.QuadPart = len - (len % CLONE_ALIGN);
+			bRet = DeviceIoControl(hFile, FSCTL_DUPLICATE_EXTENTS_TO_FILE,
+				&ded, sizeof(ded), nullptr, 0, &bytesReturned, nullptr);
+		}
+		if (bRet) {
+			total = ded.ByteCount.QuadPart;
+		}
+	}
+#  endif /* FSCTL_DUPLICATE_EXTENTS_TO_FILE */
+#else /* !_WIN32 */
+	const int fd_in = fileno(src->m_file);
+	const int fd_out = fileno(m_file);
+#  if !defined(FICLONERANGE) && !defined(HAVE_COPY_FILE_RANGE) && !defined(HAVE_SPLICE)
+	// No kernel copy functions.
+	UNUSED(fd_in);
+	UNUSED(fd_out);
+	UNUSED(mode);
+#  endif
+
+#  ifdef FICLONERANGE
+	if ((src_offset % CLONE_ALIGN) == 0 && (offset % CLONE_ALIGN) == 0) {
+		struct file_clone_range fcr;
+		fcr.src_fd = fd_in;
+		fcr.src_offset = static_cast<uint64_t>(src_offset);
+		fcr.src_length = static_cast<uint64_t>(len);
+		fcr.dest_offset = static_cast<uint64_t>(offset);
+		int ret = ioctl(fd_out, FICLONERANGE, &fcr);
+		if (ret != 0 && errno == EINVAL && len > CLONE_ALIGN && (len % CLONE_ALIGN) != 0) {
+			fcr.src_length = static_cast<uint64_t>(len - (len % CLONE_ALIGN));
+			ret = ioctl(fd_out, FICLONERANGE, &fcr);
+		}
+		if (ret == 0) {
+			total = static_cast<off64_t>(fcr.src_length);
+		}
+	}
+#  endif /* FICLONERANGE */
+
+#  ifdef HAVE_COPY_FILE_RANGE
+	while (mode == CopyMode::Any && total < len) {
+		loff_t off_in = src_offset + total;
+		loff_t off_out = offset + total;
+		const ssize_t ret = copy_file_range(fd_in, &off_in, fd_out, &off_out,
+			static_cast<size_t>(len - total), 0);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			err = errno;
+			break;
+		} else if (ret == 0) {
+			// End of the source file.
+			err = 0;
+			break;
+		}
+		total += ret;
+	}
+#  endif /* HAVE_COPY_FILE_RANGE */
+
+#  ifdef HAVE_SPLICE
+	// copy_file_range() only works with regular files,
+	// so devices are copied through a pipe.
+	int pipefd[2];
+	if (mode == CopyMode::Any && total < len && isCopyUnsupported(err) && pipe2(pipefd, O_CLOEXEC) == 0) {
+		size_t pipe_size = 65536;
+#    ifdef F_SETPIPE_SZ
+		// A larger pipe needs fewer system calls.
+		const int ret = fcntl(pipefd[1], F_SETPIPE_SZ, 1024*1024);
+		if (ret > 0) {
+			pipe_size = static_cast<size_t>(ret);
+		}
+#    endif /* F_SETPIPE_SZ */
+
+		while (total < len) {
+			loff_t off_in = src_offset + total;
+			const size_t toCopy = static_cast<size_t>(std::min<off64_t>(len - total, pipe_size));
+			const ssize_t n = splice(fd_in, &off_in, pipefd[1], nullptr, toCopy, SPLICE_F_MOVE);
+			if (n < 0) {
+				if (errno == EINTR)
+					continue;
+				err = errno;
+				break;
+			} else if (n == 0) {
+				// End of the source file.
+				err = 0;
+				break;
+			}
+
+			// Empty the pipe into the destination file.
+			loff_t off_out = offset + total;
+			ssize_t left = n;
+			while (left > 0) {
+				const ssize_t ret = splice(pipefd[0], nullptr, fd_out, &off_out,
+					static_cast<size_t>(left), SPLICE_F_MOVE);
+				if (ret < 0) {
+					if (errno == EINTR)
+						continue;
+					err = errno;
+					break;
+				} else if (ret == 0) {
+					err = EIO;
+					break;
+				}
+				left -= ret;
+			}
+			total += n - left;
+			if (left > 0)
+				break;
+		}
+		::close(pipefd[0]);
+		::close(pipefd[1]);
+	}
+#  endif /* HAVE_SPLICE */
+#endif /* _WIN32 */
+
+	if (total > 0) {
+		src->countIO(src_offset, static_cast<size_t>(total), false);
+		countIO(offset, static_cast<size_t>(total), true);
+	}
+	if (total < len) {
+		errno = (isCopyUnsupported(err) ? ENOTSUP : err);
+	}
+	return total;
+}
+
+/**
+ * Get the required alignment for map() offsets.
+ * @return Mapping alignment, in bytes.
+ */
+size_t RefFile::mapAlignment(void)
+{
+#ifdef _WIN32
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	return si.dwAllocationGranularity;
+#elif defined(HAVE_MMAP)
+	const long page_size = sysconf(_SC_PAGESIZE);
+	return (page_size > 0) ? static_cast<size_t>(page_size) : 4096U;
+#else /* !HAVE_MMAP */
+	return 4096U;
+#endif
+}
+
+/**
+ * Map a region of the file into memory. (read-only)
+ * The mapping remains valid if the file is reopened or closed.
+ * Use unmap() to unmap it.
+ *
+ * NOTE: Accessing a mapped region beyond the end of the file
+ * may crash, so the caller must keep the region within size().
+ *
+ * @param offset	[in] File offset. (Must be a multiple of mapAlignment().)
+ * @param size		[in] Size of the region, in bytes.
+ * @return Mapped region, or nullptr on error. (check errno)
+ */
+const uint8_t *RefFile::map(off64_t offset, size_t size) const
+{
+	assert(offset >= 0);
+	assert(size != 0);
+	if (offset < 0 || size == 0) {
+		errno = EINVAL;
+		return nullptr;
+	}
+
+	shared_lock<shared_timed_mutex> lock(m_ioLock);
+	if (!m_file) {
+		errno = EBADF;
+		return nullptr;
+	}
+
+#ifdef _WIN32
+	HANDLE hFile = (HANDLE)_get_osfhandle(_fileno(m_file));
+	HANDLE hMapping = CreateFileMapping(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!hMapping) {
+		errno = EIO;
+		return nullptr;
+	}
+
+	// NOTE: The view keeps the file mapping object open,
+	// so the mapping handle can be closed immediately.
+	const uint64_t pos = static_cast<uint64_t>(offset);
+	void *const ptr = MapViewOfFile(hMapping, FILE_MAP_READ,
+		static_cast<DWORD>(pos >> 32), static_cast<DWORD>(pos), size);
+	CloseHandle(hMapping);
+	if (!ptr) {
+		errno = ENOMEM;
+		return nullptr;
+	}
+	return static_cast<const uint8_t*>(ptr);
+#elif defined(HAVE_MMAP)
+	// NOTE: The mapping keeps its own reference to the file,
+	// so it isn't affected if m_file is reopened.
+	void *const ptr = mmap(nullptr, size, PROT_READ, MAP_SHARED,
+		fileno(m_file), static_cast<off_t>(offset));
+	if (ptr == MAP_FAILED) {
+		return nullptr;
+	}
+	return static_cast<const uint8_t*>(ptr);
+#else /* !HAVE_MMAP */
+	// Memory mapping isn't available.
+	errno = ENOTSUP;
+	return nullptr;
+#endif
+}
+
+/**
+ * Unmap a region that was mapped using map().
+ * @param ptr		[in] Mapped region.
+ * @param size		[in] Size of the region, in bytes.
+ */
+void RefFile::unmap(const uint8_t *ptr, size_t size)
+{
+	if (!ptr)
+		return;
+
+#ifdef _WIN32
+	UNUSED(size);
+	UnmapViewOfFile(ptr);
+#elif defined(HAVE_MMAP)
+	munmap(const_cast<uint8_t*>(ptr), size);
+#else /* !HAVE_MMAP */
+	UNUSED(ptr);
+	UNUSED(size);
+#endif
+}
+
+/**
+ * Map a region of the file into memory for writing.
+ * Writes to the region go directly to the page cache.
+ * Use flushMap() to write them back, and unmap() to unmap it.
+ *
+ * NOTE: Writing to a mapped region beyond the end of the file,
+ * or to a hole in a sparse file if the file system is full,
+ * crashes, so the file should be preallocated first.
+ *
+ * @param offset	[in] File offset. (Must be a multiple of mapAlignment().)
+ * @param size		[in] Size of the region, in bytes.
+ * @return Mapped region, or nullptr on error. (check errno)
+ */
+uint8_t *RefFile::mapWritable(off64_t offset, size_t size)
+{
+	assert(offset >= 0);
+	assert(size != 0);
+	if (offset < 0 || size == 0) {
+		errno = EINVAL;
+		return nullptr;
+	}
+
+	shared_lock<shared_timed_mutex> lock(m_ioLock);
+	if (!m_file || m_isStream) {
+		errno = EBADF;
+		return nullptr;
+	}
+
+	// Data written using stdio must be in the file first.
+	if (::fflush(m_file) != 0) {
+		return nullptr;
+	}
+
+#ifdef _WIN32
+	HANDLE hFile = (HANDLE)_get_osfhandle(_fileno(m_file));
+	HANDLE hMapping = CreateFileMapping(hFile, nullptr, PAGE_READWRITE, 0, 0, nullptr);
+	if (!hMapping) {
+		errno = EACCES;
+		return nullptr;
+	}
+
+	// NOTE: The view keeps the file mapping object open,
+	// so the mapping handle can be closed immediately.
+	const uint64_t pos = static_cast<uint64_t>(offset);
+	void *const ptr = MapViewOfFile(hMapping, FILE_MAP_WRITE,
+		static_cast<DWORD>(pos >> 32), static_cast<DWORD>(pos), size);
+	CloseHandle(hMapping);
+	if (!ptr) {
+		errno = ENOMEM;
+		return nullptr;
+	}
+	return static_cast<uint8_t*>(ptr);
+#elif defined(HAVE_MMAP)
+	// NOTE: This fails with EACCES if the file isn't open for reading.
+	void *const ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		fileno(m_file), static_cast<off_t>(offset));
+	if (ptr == MAP_FAILED) {
+		return nullptr;
+	}
+	return static_cast<uint8_t*>(ptr);
+#else /* !HAVE_MMAP */
+	// Memory mapping isn't available.
+	errno = ENOTSUP;
+	return nullptr;
+#endif
+}
+
+/**
+ * Write back a region that was mapped using mapWritable().
+ * @param ptr		[in] Mapped region.
+ * @param size		[in] Size of the region, in bytes.
+ * @param wait		[in] If true, wait for the data to be written.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int RefFile::flushMap(uint8_t *ptr, size_t size, bool wait)
+{
+	if (!ptr)
+		return 0;
+
+#ifdef _WIN32
+	// FlushViewOfFile() always starts the write-back without waiting.
+	UNUSED(wait);
+	if (!FlushViewOfFile(ptr, size)) {
+		return -EIO;
+	}
+	return 0;
+#elif defined(HAVE_MMAP)
+	if (msync(ptr, size, (wait ? MS_SYNC : MS_ASYNC)) != 0) {
+		const int err = errno;
+		return (err != 0 ? -err : -EIO);
+	}
+	return 0;
+#else /* !HAVE_MMAP */
+	UNUSED(ptr);
+	UNUSED(size);
+	UNUSED(wait);
+	return -ENOTSUP;
+#endif
+}
+
+/**
+ * Flush the file at a checkpoint, e.g. after writing a copy chunk.
+ * The file is also synced to the media if the durability policy
+ * requires it. (See setDurability().)
+ * @return 0 on success; non-zero on error.
+ */
 int RefFile::flush(void)
 {
+	if (!m_file) {
+		// Nothing to flush, e.g. for remote files.
+		return 0;
+	}
+	shared_lock<shared_timed_mutex> lock(m_ioLock);
+	int ret = ::fflush(m_file);
+	if (ret != 0 || m_isStream) return ret;
+
+	if (m_durability != RVTH_DURABILITY_CHECKPOINT) {
+		// INTERVAL and WRITE_THROUGH are synced as the data is written.
+		// NONE and END_OF_JOB are synced by sync(), if at all.
+		return 0;
+	}
+	return syncFile_int();
+}
+
+/**
+ * Sync the file to the media at the end of a job, or after
+ * writing metadata such as the bank table.
+ * If the durability policy is NONE, only the stdio buffer is flushed.
+ * @return 0 on success; non-zero on error.
+ */
+int RefFile::sync(void)
+{
+	if (!m_file) {
+		// Nothing to sync, e.g. for remote files.
+		return 0;
+	}
+	shared_lock<shared_timed_mutex> lock(m_ioLock);
 	int ret = ::fflush(m_file);
-	if (ret != 0) return ret;
+	if (ret != 0 || m_isStream || m_durability == RVTH_DURABILITY_NONE) {
+		return ret;
+	}
+	return syncFile_int();
+}
+
+/**
+ * Set the durability policy for writes to this file.
+ * NOTE: Not thread-safe. Set it before other threads write to the file.
+ * @param durability	[in] Durability policy
+ * @param interval	[in] Sync interval for RVTH_DURABILITY_INTERVAL, in bytes
+ */
+void RefFile::setDurability(RvtH_Durability durability, uint64_t interval)
+{
+	assert(durability >= RVTH_DURABILITY_CHECKPOINT && durability < RVTH_DURABILITY_MAX);
+	m_durability = durability;
+	m_syncInterval = interval;
+}
+
+/**
+ * Sync the file to the media. (internal function)
+ * The stdio buffer must be flushed first.
+ * @return 0 on success; non-zero on error.
+ */
+int RefFile::syncFile_int(void)
+{
+	m_unsynced.store(0, std::memory_order_relaxed);
 #ifdef _WIN32
 	return !FlushFileBuffers((HANDLE)_get_osfhandle(_fileno(m_file)));
-#else /* !_WIN32 */
+#elif defined(HAVE_FDATASYNC)
+	// File metadata such as the modification time isn't needed
+	// to read the data back, so it doesn't have to be synced.
+	return ::fdatasync(fileno(m_file));
+#else /* !HAVE_FDATASYNC */
 	return ::fsync(fileno(m_file));
 #endif /* _WIN32 */
 }
@@ -9,6 +9,7 @@
 #pragma once
 
 #include "libwiicrypto/common.h"
+#include "rvth_enums.h"
 #include "tcharx.h"
 
 // C includes
@@ -20,8 +21,45 @@
 #include <cstdio>
 
 // C++ includes
+#include <atomic>
+#include <memory>
+#include <shared_mutex>
 #include <string>
+#include <utility>
+#include <vector>
 
+class HttpFile;
+class IoScheduler;
+
+/**
+ * Reference-counted file.
+ *
+ * Multiple Readers may share a single RefFile, e.g. one Reader for
+ * each bank of an RVT-H HDD image. Reference counting is atomic, and
+ * pread() and pwrite() may be called from multiple threads at once.
+ * Functions that reopen the file or move the stdio file pointer
+ * (makeWritable(), setDirectIO(), size()) block until concurrent
+ * I/O is finished.
+ *
+ * Device files can optionally use direct I/O, which bypasses the
+ * OS page cache. pread() and pwrite() use direct I/O if the buffer,
+ * size, and offset are aligned to directIOAlignment(); otherwise,
+ * the regular buffered file is used.
+ *
+ * Reads and writes of device files are ordered by the device's
+ * IoScheduler, which is shared by all RefFiles for the device,
+ * so concurrent operations on different banks don't compete
+ * for the HDD's head position.
+ *
+ * Access hints (posix_fadvise()) tell the OS how the file will be
+ * read: randomly for bank metadata, or sequentially for long scans.
+ * Long scans can also drop cached data behind the read position,
+ * since it won't be needed again.
+ *
+ * Filenames starting with "http://" or "https://" are opened as
+ * read-only remote files using HttpFile. Only the positional read
+ * functions, size(), and mtime() are supported for remote files.
+ */
 class RefFile
 {
 	public:
@@ -36,6 +74,8 @@ class RefFile
 		 * @param create If true, create the file if it doesn't exist.
 		 *               File will be opened in read/write mode.
 		 *               File will be truncated if it already exists.
+		 *               If the filename is "-", standard output is used
+		 *               as a write-only stream. (See isStream().)
 		 *
 		 * @return RefFile*, or NULL if an error occurred.
 		 */
@@ -53,8 +93,7 @@ class RefFile
 		 */
 		inline RefFile *ref(void)
 		{
-			// TODO: Atomic increment?
-			m_refCount++;
+			m_refCount.fetch_add(1, std::memory_order_relaxed);
 			return this;
 		}
 
@@ -63,9 +102,9 @@ class RefFile
 		 */
 		inline void unref(void)
 		{
-			// TODO: Atomic decrement?
-			assert(m_refCount > 0);
-			if (--m_refCount <= 0) {
+			const int prev = m_refCount.fetch_sub(1, std::memory_order_acq_rel);
+			assert(prev > 0);
+			if (prev <= 1) {
 				// Delete the object.
 				delete this;
 			}
@@ -77,7 +116,7 @@ class RefFile
 		 */
 		inline bool isOpen(void) const
 		{
-			return (m_file != nullptr);
+			return (m_file != nullptr || m_http != nullptr);
 		}
 
 		/**
@@ -101,6 +140,177 @@ class RefFile
 		 */
 		bool isDevice(void) const;
 
+		/**
+		 * Is this file a write-only stream? (standard output)
+		 * Streams can't seek, so only write() can be used.
+		 * @return True if this is a stream; false if it isn't.
+		 */
+		inline bool isStream(void) const
+		{
+			return m_isStream;
+		}
+
+		/**
+		 * Is this file on an HTTP server? (See HttpFile.)
+		 * Remote files are read-only and can't be memory-mapped.
+		 * @return True if this is a remote file; false if it isn't.
+		 */
+		inline bool isRemote(void) const
+		{
+			return (m_http != nullptr);
+		}
+
+	private:
+		/**
+		 * Check if the file is a device file. (internal function)
+		 * NOTE: m_ioLock must be held by the caller.
+		 * @return True if this is a device file; false if it isn't.
+		 */
+		bool isDevice_int(void) const;
+
+	public:
+		/**
+		 * Enable or disable direct I/O. (O_DIRECT or FILE_FLAG_NO_BUFFERING)
+		 * Direct I/O is only supported for device files.
+		 * @param enable True to enable direct I/O; false to disable it.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int setDirectIO(bool enable);
+
+		/**
+		 * Is direct I/O enabled?
+		 * @return True if enabled; false if not.
+		 */
+		inline bool isDirectIO(void) const
+		{
+			return (m_directAlign != 0);
+		}
+
+		/**
+		 * Get the required buffer, size, and offset alignment for direct I/O.
+		 * @return Alignment, in bytes, or 0 if direct I/O is disabled.
+		 */
+		inline unsigned int directIOAlignment(void) const
+		{
+			return m_directAlign;
+		}
+
+	private:
+		/**
+		 * Open the direct I/O handle. (internal function)
+		 * NOTE: m_ioLock must be held exclusively by the caller.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int openDirect_int(void);
+
+		/**
+		 * Close the direct I/O handle. (internal function)
+		 * NOTE: m_ioLock must be held exclusively by the caller.
+		 */
+		void closeDirect_int(void);
+
+		/**
+		 * Can direct I/O be used for a transfer? (internal function)
+		 * @param ptr		[in] Buffer.
+		 * @param size		[in] Number of bytes.
+		 * @param offset	[in] File offset.
+		 * @return True if direct I/O is enabled and the transfer is aligned.
+		 */
+		inline bool canUseDirect(const void *ptr, size_t size, off64_t offset) const
+		{
+			const unsigned int align = m_directAlign;
+			return (align != 0 &&
+				(reinterpret_cast<uintptr_t>(ptr) % align) == 0 &&
+				(size % align) == 0 &&
+				(static_cast<uint64_t>(offset) % align) == 0);
+		}
+
+	public:
+		/** Access hints **/
+		// NOTE: On Windows, caching hints can only be set when a file
+		// is opened, so these functions don't do anything.
+
+		enum class AccessHint : uint8_t {
+			Normal,		// No specific access pattern
+			Sequential,	// Sequential access
+			Random,		// Random access (disables read-ahead)
+		};
+
+		/**
+		 * Set the access hint for the whole file.
+		 * This hint is restored by endScan().
+		 * @param hint	[in] Access hint
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int setAccessHint(AccessHint hint);
+
+		/**
+		 * Get the access hint for the whole file.
+		 * @return Access hint
+		 */
+		inline AccessHint accessHint(void) const
+		{
+			return m_accessHint;
+		}
+
+		/**
+		 * Indicate that a region will be read sequentially once.
+		 * Call endScan() when the scan is finished.
+		 * @param offset	[in] Starting offset
+		 * @param len		[in] Length, in bytes (0 for the rest of the file)
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int beginScan(off64_t offset, off64_t len);
+
+		/**
+		 * Indicate that a sequential scan is finished.
+		 * The access hint set by setAccessHint() is restored.
+		 * @param offset	[in] Starting offset
+		 * @param len		[in] Length, in bytes (0 for the rest of the file)
+		 */
+		void endScan(off64_t offset, off64_t len);
+
+		/**
+		 * Drop cached data for a region that won't be read again.
+		 * Dirty data is written back first.
+		 * @param offset	[in] Starting offset
+		 * @param len		[in] Length, in bytes
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int dropCache(off64_t offset, off64_t len);
+
+		/**
+		 * Indicate that a region will be read soon.
+		 * The OS may start reading it into the page cache in the background.
+		 * @param offset	[in] Starting offset
+		 * @param len		[in] Length, in bytes
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int prefetch(off64_t offset, off64_t len);
+
+	private:
+		/**
+		 * Call posix_fadvise() on the buffered file. (internal function)
+		 * @param offset	[in] Starting offset
+		 * @param len		[in] Length, in bytes (0 for the rest of the file)
+		 * @param advice	[in] POSIX_FADV_* value
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int fadvise_int(off64_t offset, off64_t len, int advice);
+
+#ifndef _WIN32
+	public:
+		/**
+		 * Duplicate the file descriptor for asynchronous I/O.
+		 * The duplicate isn't affected if this file is reopened or closed.
+		 * The caller must close() the duplicate.
+		 * @param direct	[in] If true, duplicate the direct I/O file descriptor.
+		 * @return File descriptor, or -1 on error. (-1 if direct is true and direct I/O is disabled)
+		 */
+		int dupFd(bool direct) const;
+#endif /* !_WIN32 */
+
+	public:
 		/**
 		 * Try to make this file a sparse file.
 		 * @param size If not zero, try to set the file to this size.
@@ -108,6 +318,74 @@ class RefFile
 		 */
 		int makeSparse(off64_t size = 0);
 
+		/**
+		 * Allocate disk space for the whole file up front.
+		 * The file is set to the specified size. Allocating the file
+		 * in one step keeps it contiguous on file systems that would
+		 * otherwise fragment it, e.g. ext4 and NTFS.
+		 *
+		 * NOTE: On Windows, the allocated area may contain stale data
+		 * if the process has SE_MANAGE_VOLUME_NAME. The caller must
+		 * write the entire file.
+		 *
+		 * @param size File size.
+		 * @return 0 on success; negative POSIX error code on error. (-ENOTSUP if not supported)
+		 */
+		int preallocate(off64_t size);
+
+		/**
+		 * Deallocate a region of the file.
+		 * The region reads as zero afterwards, and the file size isn't changed.
+		 * @param offset	[in] Starting offset
+		 * @param len		[in] Length, in bytes
+		 * @return 0 on success; negative POSIX error code on error. (-ENOTSUP if not supported)
+		 */
+		int punchHole(off64_t offset, off64_t len);
+
+		/**
+		 * Zero a region of the file without writing a buffer.
+		 *
+		 * Devices are zeroed using BLKZEROOUT on Linux, which lets the
+		 * device unmap or zero the blocks itself if it supports it.
+		 * Files are zeroed by deallocating the region.
+		 *
+		 * If -ENOTSUP is returned, the caller should write zeroes instead.
+		 *
+		 * @param offset	[in] Starting offset (must be a multiple of 512)
+		 * @param len		[in] Length, in bytes (must be a multiple of 512)
+		 * @return 0 on success; negative POSIX error code on error. (-ENOTSUP if not supported)
+		 */
+		int zeroRange(off64_t offset, off64_t len);
+
+		/**
+		 * Find the allocated data in a region of the file.
+		 *
+		 * Holes in sparse files are always read as zeroes, so they
+		 * can be skipped without reading them. This uses SEEK_DATA and
+		 * SEEK_HOLE, or FSCTL_QUERY_ALLOCATED_RANGES on Windows.
+		 * Devices aren't supported.
+		 *
+		 * @param offset	[in] Starting offset
+		 * @param len		[in] Length, in bytes
+		 * @param ranges	[out] Allocated ranges ({offset, length}), sorted by offset
+		 * @return 0 on success; negative POSIX error code on error. (-ENOTSUP if not supported)
+		 */
+		int dataRanges(off64_t offset, off64_t len, std::vector<std::pair<off64_t, off64_t> > &ranges);
+
+		/**
+		 * Check if new files on this file system should be preallocated
+		 * instead of written sparsely.
+		 *
+		 * Sparse writes fragment files on file systems that allocate
+		 * blocks in write order (ext4, NTFS) or don't support sparse
+		 * files at all (FAT, exFAT). Copy-on-write and extent-based file
+		 * systems with delayed allocation (Btrfs, XFS, ReFS) don't
+		 * benefit from preallocation.
+		 *
+		 * @return True if preallocation is preferred; false if not.
+		 */
+		bool prefersPreallocation(void);
+
 		/**
 		 * Get the size of the file.
 		 * @return Size of file, or -1 on error.
@@ -123,16 +401,9 @@ class RefFile
 	public:
 		/** Convenience wrappers for stdio functions. **/
 		// NOTE: These functions set errno, **NOT** m_lastError!
-
-		inline size_t read(void *ptr, size_t size, size_t nmemb)
-		{
-			return ::fread(ptr, size, nmemb, m_file);
-		}
-
-		inline size_t write(const void *ptr, size_t size, size_t nmemb)
-		{
-			return ::fwrite(ptr, size, nmemb, m_file);
-		}
+		// NOTE: Data I/O must use pread() and pwrite().
+		// NOTE: These functions are not thread-safe, since they use
+		// the stdio file pointer. Only use them while opening a file.
 
 		inline int seeko(off64_t offset, int whence)
 		{
@@ -144,27 +415,214 @@ class RefFile
 			return ::ftello(m_file);
 		}
 
+		/**
+		 * Flush the file at a checkpoint, e.g. after writing a copy chunk.
+		 * The file is also synced to the media if the durability policy
+		 * requires it. (See setDurability().)
+		 * @return 0 on success; non-zero on error.
+		 */
 		int flush(void);
 
+		/**
+		 * Sync the file to the media at the end of a job, or after
+		 * writing metadata such as the bank table.
+		 * If the durability policy is NONE, only the stdio buffer is flushed.
+		 * @return 0 on success; non-zero on error.
+		 */
+		int sync(void);
+
+		/**
+		 * Set the durability policy for writes to this file.
+		 * NOTE: Not thread-safe. Set it before other threads write to the file.
+		 * @param durability	[in] Durability policy
+		 * @param interval	[in] Sync interval for RVTH_DURABILITY_INTERVAL, in bytes
+		 */
+		void setDurability(RvtH_Durability durability, uint64_t interval);
+
+		/**
+		 * Get the durability policy for writes to this file.
+		 * @return Durability policy
+		 */
+		inline RvtH_Durability durability(void) const
+		{
+			return m_durability;
+		}
+
+	private:
+		/**
+		 * Sync the file to the media. (internal function)
+		 * The stdio buffer must be flushed first.
+		 * @return 0 on success; non-zero on error.
+		 */
+		int syncFile_int(void);
+
+	public:
 		inline void rewind(void)
 		{
 			::rewind(m_file);
 		}
 
-		/** Convenience wrappers **/
+		/** Positional I/O **/
+		// These functions don't use or change the stdio file pointer,
+		// so multiple Readers sharing this RefFile don't need to seek
+		// before each access.
+		// NOTE: These functions set errno, **NOT** m_lastError!
+		// NOTE 2: If the current thread's operation was cancelled,
+		// nothing is transferred, and errno is set to ECANCELED.
+		// (See RvtH::setCancelToken().)
 
-		inline size_t seekoAndRead(off64_t offset, int whence, void *ptr, size_t size, size_t nmemb)
-		{
-			int ret = this->seeko(offset, whence);
-			if (ret != 0) {
-				if (errno == 0) {
-					errno = EIO;
-				}
-				return 0;
-			}
+		/**
+		 * Read data from the file at the specified offset.
+		 * @param ptr		[out] Read buffer.
+		 * @param size		[in] Number of bytes to read.
+		 * @param offset	[in] File offset.
+		 * @return Number of bytes read. (If less than size, check errno.)
+		 */
+		size_t pread(void *ptr, size_t size, off64_t offset);
 
-			return this->read(ptr, size, nmemb);
-		}
+		/**
+		 * Buffer for preadv().
+		 */
+		struct IoVec {
+			void *ptr;	// Read buffer
+			size_t size;	// Number of bytes to read
+		};
+
+		/**
+		 * Read data from the file at the specified offset
+		 * into multiple buffers. (scatter read)
+		 * The buffers are filled in order from a contiguous range
+		 * of the file, using as few system calls as possible.
+		 * @param iov		[in] Buffers.
+		 * @param count		[in] Number of buffers.
+		 * @param offset	[in] File offset.
+		 * @return Number of bytes read. (If less than the total size, check errno.)
+		 */
+		size_t preadv(const IoVec *iov, unsigned int count, off64_t offset);
+
+	private:
+		/**
+		 * Read data from the file into multiple buffers using preadv(). (internal function)
+		 * @param iov		[in] Buffers.
+		 * @param count		[in] Number of buffers.
+		 * @param offset	[in] File offset.
+		 * @return Number of bytes read. (If less than the total size, check errno.)
+		 */
+		size_t preadv_int(const IoVec *iov, unsigned int count, off64_t offset);
+
+	public:
+
+		/**
+		 * Write data to the file at the specified offset.
+		 * @param ptr		[in] Write buffer.
+		 * @param size		[in] Number of bytes to write.
+		 * @param offset	[in] File offset.
+		 * @return Number of bytes written. (If less than size, check errno.)
+		 */
+		size_t pwrite(const void *ptr, size_t size, off64_t offset);
+
+		/**
+		 * Write data to a stream at the current position.
+		 * This is the only way to write to a stream. (See isStream().)
+		 * @param ptr		[in] Write buffer.
+		 * @param size		[in] Number of bytes to write.
+		 * @return Number of bytes written. (If less than size, check errno.)
+		 */
+		size_t write(const void *ptr, size_t size);
+
+		/**
+		 * How copyRange() may copy the data.
+		 */
+		enum class CopyMode : uint8_t {
+			Clone,		// Only share the source's blocks (reflink)
+			Any,		// Share the blocks, or copy the data in the kernel
+		};
+
+		/**
+		 * Copy a range of another file into this file
+		 * without reading the data into user space.
+		 *
+		 * The blocks are shared with the source file if the file
+		 * system supports it. (FICLONERANGE, or block cloning on ReFS)
+		 * Otherwise, if mode is CopyMode::Any, the data is copied by
+		 * the kernel using copy_file_range(), or splice() if one of
+		 * the files is a device. The copy may stop short, e.g. if the
+		 * end of the range isn't aligned to the file system's blocks,
+		 * so the caller must copy the rest of the range itself.
+		 *
+		 * Streams and remote files aren't supported.
+		 *
+		 * @param src		[in] Source file. (must not be this file)
+		 * @param src_offset	[in] Source file offset.
+		 * @param offset	[in] Destination file offset.
+		 * @param len		[in] Number of bytes to copy.
+		 * @param mode		[in] Copy mode.
+		 * @return Number of bytes copied. (If less than len, check errno; ENOTSUP if the OS can't copy it.)
+		 */
+		off64_t copyRange(RefFile *src, off64_t src_offset, off64_t offset, off64_t len, CopyMode mode);
+
+	private:
+		/**
+		 * Count a read or a write for the current operation. (See RvtH_Stats.)
+		 * @param offset	[in] File offset.
+		 * @param size		[in] Number of bytes transferred.
+		 * @param write		[in] True for a write; false for a read.
+		 */
+		void countIO(off64_t offset, size_t size, bool write);
+
+	public:
+		/** Memory mapping **/
+
+		/**
+		 * Get the required alignment for map() offsets.
+		 * @return Mapping alignment, in bytes.
+		 */
+		static size_t mapAlignment(void);
+
+		/**
+		 * Map a region of the file into memory. (read-only)
+		 * The mapping remains valid if the file is reopened or closed.
+		 * Use unmap() to unmap it.
+		 *
+		 * NOTE: Accessing a mapped region beyond the end of the file
+		 * may crash, so the caller must keep the region within size().
+		 *
+		 * @param offset	[in] File offset. (Must be a multiple of mapAlignment().)
+		 * @param size		[in] Size of the region, in bytes.
+		 * @return Mapped region, or nullptr on error. (check errno)
+		 */
+		const uint8_t *map(off64_t offset, size_t size) const;
+
+		/**
+		 * Unmap a region that was mapped using map().
+		 * @param ptr		[in] Mapped region.
+		 * @param size		[in] Size of the region, in bytes.
+		 */
+		static void unmap(const uint8_t *ptr, size_t size);
+
+		/**
+		 * Map a region of the file into memory for writing.
+		 * Writes to the region go directly to the page cache.
+		 * Use flushMap() to write them back, and unmap() to unmap it.
+		 *
+		 * NOTE: Writing to a mapped region beyond the end of the file,
+		 * or to a hole in a sparse file if the file system is full,
+		 * crashes, so the file should be preallocated first.
+		 *
+		 * @param offset	[in] File offset. (Must be a multiple of mapAlignment().)
+		 * @param size		[in] Size of the region, in bytes.
+		 * @return Mapped region, or nullptr on error. (check errno)
+		 */
+		uint8_t *mapWritable(off64_t offset, size_t size);
+
+		/**
+		 * Write back a region that was mapped using mapWritable().
+		 * @param ptr		[in] Mapped region.
+		 * @param size		[in] Size of the region, in bytes.
+		 * @param wait		[in] If true, wait for the data to be written.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		static int flushMap(uint8_t *ptr, size_t size, bool wait);
 
 		/** Convenience wrappers for various RefFile fields. **/
 
@@ -179,9 +637,38 @@ class RefFile
 		}
 
 	private:
-		int m_refCount;			// Reference count
-		int m_lastError;		// Last error code
+		std::atomic<int> m_refCount;	// Reference count
+		std::atomic<int> m_lastError;	// Last error code
 		FILE *m_file;			// FILE pointer
+		HttpFile *m_http;		// Remote file, or nullptr
+
+		// I/O lock.
+		// Shared: pread(), pwrite(), and other functions that use m_file.
+		// Exclusive: Functions that reopen m_file or move its file pointer.
+		// NOTE: std::shared_timed_mutex is used for C++14 compatibility.
+		mutable std::shared_timed_mutex m_ioLock;
 		std::tstring m_filename;	// Filename for reopening as writable
 		bool m_isWritable;		// Is the file writable?
+		bool m_isStream;		// Is the file a stream? (standard output)
+
+		// Direct I/O handle. (Opened separately from m_file.)
+#ifdef _WIN32
+		void *m_hDirect;		// HANDLE opened with FILE_FLAG_NO_BUFFERING, or nullptr
+#else /* !_WIN32 */
+		int m_fdDirect;			// File descriptor opened with O_DIRECT, or -1
+#endif /* _WIN32 */
+		unsigned int m_directAlign;	// Direct I/O alignment (0 if direct I/O is disabled)
+		AccessHint m_accessHint;	// Access hint for the whole file
+
+		// Durability policy. (See setDurability().)
+		RvtH_Durability m_durability;
+		uint64_t m_syncInterval;		// Sync interval for RVTH_DURABILITY_INTERVAL, in bytes
+		std::atomic<uint64_t> m_unsynced;	// Bytes written since the file was last synced
+
+		// Offset following the last pread() or pwrite(),
+		// for counting seeks. (See RvtH_Stats.)
+		std::atomic<off64_t> m_nextPos;
+
+		// I/O scheduler for device files, or nullptr.
+		std::shared_ptr<IoScheduler> m_ioSched;
 };
@@ -0,0 +1,194 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * StatsCounters.cpp: Per-operation performance counters.                  *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "StatsCounters.hpp"
+
+// For LBA_SIZE
+#include "nhcd_structs.h"
+
+// C includes (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+// C++ includes
+#include <algorithm>
+
+// Counters for the operation running on the current thread.
+thread_local StatsCounters *StatsCounters::ms_current = nullptr;
+
+/**
+ * Reset all counters to 0.
+ */
+void StatsCounters::reset(void)
+{
+	bytes_read = 0;
+	bytes_written = 0;
+	read_calls = 0;
+	write_calls = 0;
+	seeks = 0;
+	sparse_bytes = 0;
+	cache_hits = 0;
+	cache_misses = 0;
+	for (std::atomic<uint64_t> &timer : ns) {
+		timer = 0;
+	}
+
+	// NOTE: The slow read threshold isn't reset.
+	for (std::atomic<uint64_t> &bucket : latency_hist) {
+		bucket = 0;
+	}
+	latency_max_ns = 0;
+	latency_total_ns = 0;
+	slow_reads = 0;
+	std::lock_guard<std::mutex> lock(m_slowMutex);
+	m_slowRanges.clear();
+}
+
+/**
+ * Get the trace span name for a timer.
+ * @param timer Timer.
+ * @return Span name.
+ */
+const char *StatsCounters::timerName(Timer timer)
+{
+	static const char *const names[TIMER_MAX] = {
+		"io", "aes", "sha1", "zero_scan",
+	};
+	assert(timer >= 0 && timer < TIMER_MAX);
+	return names[timer];
+}
+
+/**
+ * Get the current counter values.
+ * @param stats	[out] Counter values.
+ */
+void StatsCounters::get(RvtH_Stats *stats) const
+{
+	stats->bytes_read = bytes_read.load(std::memory_order_relaxed);
+	stats->bytes_written = bytes_written.load(std::memory_order_relaxed);
+	stats->read_calls = read_calls.load(std::memory_order_relaxed);
+	stats->write_calls = write_calls.load(std::memory_order_relaxed);
+	stats->seeks = seeks.load(std::memory_order_relaxed);
+	stats->sparse_bytes = sparse_bytes.load(std::memory_order_relaxed);
+	stats->cache_hits = cache_hits.load(std::memory_order_relaxed);
+	stats->cache_misses = cache_misses.load(std::memory_order_relaxed);
+	stats->io_ns = ns[TIMER_IO].load(std::memory_order_relaxed);
+	stats->aes_ns = ns[TIMER_AES].load(std::memory_order_relaxed);
+	stats->sha1_ns = ns[TIMER_SHA1].load(std::memory_order_relaxed);
+	stats->zero_scan_ns = ns[TIMER_ZERO_SCAN].load(std::memory_order_relaxed);
+}
+
+/**
+ * Set the slow read threshold.
+ * Read latency is only measured if this is set.
+ * @param ms Threshold, in milliseconds. (0 to disable)
+ */
+void StatsCounters::setSlowReadThreshold(unsigned int ms)
+{
+	slow_read_ns.store(static_cast<uint64_t>(ms) * 1000000ULL, std::memory_order_relaxed);
+}
+
+/**
+ * Get the read latency statistics.
+ * @param latency	[out] Read latency statistics.
+ * @return 0 on success; -ENOTSUP if read latency isn't being measured.
+ */
+int StatsCounters::getReadLatency(RvtH_Read_Latency *latency) const
+{
+	const uint64_t threshold = slow_read_ns.load(std::memory_order_relaxed);
+	if (threshold == 0) {
+		return -ENOTSUP;
+	}
+
+	latency->reads = 0;
+	for (unsigned int i = 0; i < RVTH_LATENCY_BUCKETS; i++) {
+		latency->hist[i] = latency_hist[i].load(std::memory_order_relaxed);
+		latency->reads += latency->hist[i];
+	}
+	latency->max_us = latency_max_ns.load(std::memory_order_relaxed) / 1000;
+	latency->total_us = latency_total_ns.load(std::memory_order_relaxed) / 1000;
+	latency->slow_reads = slow_reads.load(std::memory_order_relaxed);
+	latency->slow_read_ms = static_cast<unsigned int>(threshold / 1000000ULL);
+
+	std::lock_guard<std::mutex> lock(m_slowMutex);
+	latency->slow_count = static_cast<unsigned int>(m_slowRanges.size());
+	if (!m_slowRanges.empty()) {
+		memcpy(latency->slow, m_slowRanges.data(), m_slowRanges.size() * sizeof(m_slowRanges[0]));
+	}
+	return 0;
+}
+
+/**
+ * Set the cancellation token.
+ * @param token	[in,opt] Cancellation token. (nullptr to remove it)
+ * @return 0 on success; -EBUSY if a different token is already set.
+ */
+int StatsCounters::setCancelToken(const CancelToken *token)
+{
+	if (!token) {
+		m_cancel.store(nullptr, std::memory_order_release);
+		return 0;
+	}
+
+	const CancelToken *expected = nullptr;
+	if (!m_cancel.compare_exchange_strong(expected, token, std::memory_order_acq_rel) &&
+	    expected != token)
+	{
+		return -EBUSY;
+	}
+	return 0;
+}
+
+/**
+ * Add a read to the latency histogram.
+ * If it's slower than the threshold, it's recorded as a slow read.
+ * @param offset	[in] Starting offset in the device or disk image file.
+ * @param bytes		[in] Number of bytes requested.
+ * @param ns		[in] Latency, in nanoseconds.
+ */
+void StatsCounters::addReadLatency(int64_t offset, uint64_t bytes, uint64_t ns)
+{
+	const uint64_t us = ns / 1000;
+	unsigned int bucket = 0;
+	while (bucket < RVTH_LATENCY_BUCKETS-1 && us >= RVTH_LATENCY_BUCKET_LIMIT_US(bucket)) {
+		bucket++;
+	}
+	latency_hist[bucket].fetch_add(1, std::memory_order_relaxed);
+	latency_total_ns.fetch_add(ns, std::memory_order_relaxed);
+
+	uint64_t max_ns = latency_max_ns.load(std::memory_order_relaxed);
+	while (ns > max_ns && !latency_max_ns.compare_exchange_weak(max_ns, ns, std::memory_order_relaxed)) { }
+
+	if (ns < slow_read_ns.load(std::memory_order_relaxed)) {
+		return;
+	}
+	slow_reads.fetch_add(1, std::memory_order_relaxed);
+
+	// Record the slow read, merging it with the previous
+	// range if it continues that range.
+	// NOTE: LBAs are 32-bit, so offsets past 2 TB are clamped.
+	const uint64_t lba_start64 = static_cast<uint64_t>(offset) / LBA_SIZE;
+	const uint32_t lba_start = static_cast<uint32_t>(std::min<uint64_t>(lba_start64, UINT32_MAX));
+	const uint32_t lba_len = static_cast<uint32_t>(std::min<uint64_t>(
+		(bytes + LBA_SIZE - 1) / LBA_SIZE, UINT32_MAX - lba_start));
+	const uint32_t latency_ms = static_cast<uint32_t>(std::min<uint64_t>(ns / 1000000ULL, UINT32_MAX));
+
+	std::lock_guard<std::mutex> lock(m_slowMutex);
+	if (!m_slowRanges.empty()) {
+		RvtH_Slow_Read &last = m_slowRanges.back();
+		if (last.lba_start + last.lba_len == lba_start) {
+			last.lba_len += lba_len;
+			last.latency_ms = std::max(last.latency_ms, latency_ms);
+			return;
+		}
+	}
+	if (m_slowRanges.size() < RVTH_SLOW_READS_MAX) {
+		m_slowRanges.push_back({lba_start, lba_len, latency_ms});
+	}
+}
@@ -0,0 +1,364 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * StatsCounters.hpp: Per-operation performance counters.                  *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_STATSCOUNTERS_HPP__
+#define __RVTHTOOL_LIBRVTH_STATSCOUNTERS_HPP__
+
+#include "rvth.hpp"
+#include "CancelToken.hpp"
+#include "IoThrottle.hpp"
+#include "Trace.hpp"
+
+// C includes
+#include <stdint.h>
+
+// C++ includes
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+/**
+ * Performance counters for an RvtH object. (See RvtH_Stats.)
+ *
+ * Counters are updated by whichever thread does the work, so the
+ * counters to update are tracked per thread: an RvtH operation
+ * installs its counters using StatsScope, and worker threads started
+ * by the operation install the same counters. Code that doesn't know
+ * which RvtH object it's working for, e.g. RefFile, updates the
+ * current thread's counters, if any.
+ *
+ * Since the counters are installed on every thread that works on an
+ * operation, they also carry the operation's cancellation token,
+ * I/O priority, and bandwidth limit.
+ */
+class StatsCounters
+{
+	public:
+		StatsCounters()
+			: slow_read_ns(0)
+			, m_cancel(nullptr)
+		{
+			reset();
+		}
+
+	private:
+		DISABLE_COPY(StatsCounters)
+
+	public:
+		enum Timer {
+			TIMER_IO,
+			TIMER_AES,
+			TIMER_SHA1,
+			TIMER_ZERO_SCAN,
+
+			TIMER_MAX
+		};
+
+		/**
+		 * Reset all counters to 0.
+		 */
+		void reset(void);
+
+		/**
+		 * Get the current counter values.
+		 * @param stats	[out] Counter values.
+		 */
+		void get(RvtH_Stats *stats) const;
+
+		/**
+		 * Set the slow read threshold.
+		 * Read latency is only measured if this is set.
+		 * @param ms Threshold, in milliseconds. (0 to disable)
+		 */
+		void setSlowReadThreshold(unsigned int ms);
+
+		/**
+		 * Get the read latency statistics.
+		 * @param latency	[out] Read latency statistics.
+		 * @return 0 on success; -ENOTSUP if read latency isn't being measured.
+		 */
+		int getReadLatency(RvtH_Read_Latency *latency) const;
+
+		/**
+		 * Set the cancellation token.
+		 * @param token	[in,opt] Cancellation token. (nullptr to remove it)
+		 * @return 0 on success; -EBUSY if a different token is already set.
+		 */
+		int setCancelToken(const CancelToken *token);
+
+		/**
+		 * Get the cancellation token.
+		 * @return Cancellation token, or nullptr if none is set.
+		 */
+		inline const CancelToken *cancelToken(void) const
+		{
+			return m_cancel.load(std::memory_order_acquire);
+		}
+
+		/**
+		 * Get the I/O priority and bandwidth limit.
+		 * @return IoThrottle
+		 */
+		inline IoThrottle *ioThrottle(void)
+		{
+			return &m_throttle;
+		}
+
+		/**
+		 * Get the trace span name for a timer.
+		 * @param timer Timer.
+		 * @return Span name.
+		 */
+		static const char *timerName(Timer timer);
+
+		/**
+		 * Get the counters for the current thread.
+		 * @return Counters, or nullptr if no operation is running on this thread.
+		 */
+		static inline StatsCounters *current(void)
+		{
+			return ms_current;
+		}
+
+		/**
+		 * Has the current thread's operation been cancelled?
+		 * @return True if cancelled; false if not, or if no operation is running on this thread.
+		 */
+		static inline bool cancelled(void)
+		{
+			const StatsCounters *const stats = current();
+			if (!stats)
+				return false;
+			const CancelToken *const token = stats->m_cancel.load(std::memory_order_acquire);
+			return (token && token->isCancelled());
+		}
+
+		/**
+		 * Apply the current thread's I/O priority and bandwidth limit
+		 * before a read or a write. (See IoThrottle::acquire().)
+		 * @param bytes	[in] Number of bytes to transfer.
+		 */
+		static inline void throttleIO(uint64_t bytes)
+		{
+			StatsCounters *const stats = current();
+			if (stats) {
+				stats->m_throttle.acquire(bytes, stats->cancelToken());
+			}
+		}
+
+	public:
+		/**
+		 * Count a read or a write for the current thread.
+		 * @param bytes	[in] Number of bytes transferred.
+		 * @param write	[in] True for a write; false for a read.
+		 * @param seek	[in] True if the access didn't continue the previous one.
+		 */
+		static inline void addIO(uint64_t bytes, bool write, bool seek)
+		{
+			StatsCounters *const stats = current();
+			if (!stats)
+				return;
+			if (write) {
+				stats->bytes_written.fetch_add(bytes, std::memory_order_relaxed);
+				stats->write_calls.fetch_add(1, std::memory_order_relaxed);
+			} else {
+				stats->bytes_read.fetch_add(bytes, std::memory_order_relaxed);
+				stats->read_calls.fetch_add(1, std::memory_order_relaxed);
+			}
+			if (seek) {
+				stats->seeks.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+
+		/**
+		 * Count data that was skipped because it's empty, for the current thread.
+		 * @param bytes	[in] Number of bytes skipped.
+		 */
+		static inline void addSparse(uint64_t bytes)
+		{
+			StatsCounters *const stats = current();
+			if (stats) {
+				stats->sparse_bytes.fetch_add(bytes, std::memory_order_relaxed);
+			}
+		}
+
+		/**
+		 * Count a block cache lookup for the current thread.
+		 * @param hit	[in] True if the block was cached.
+		 */
+		static inline void addCacheLookup(bool hit)
+		{
+			StatsCounters *const stats = current();
+			if (stats) {
+				(hit ? stats->cache_hits : stats->cache_misses).fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+
+		/**
+		 * Get the counters for the current thread if read latency is being measured.
+		 * @return Counters, or nullptr if read latency isn't being measured.
+		 */
+		static inline StatsCounters *currentForLatency(void)
+		{
+			StatsCounters *const stats = current();
+			return (stats && stats->slow_read_ns.load(std::memory_order_relaxed) != 0 ? stats : nullptr);
+		}
+
+		/**
+		 * Add a read to the latency histogram.
+		 * If it's slower than the threshold, it's recorded as a slow read.
+		 * @param offset	[in] Starting offset in the device or disk image file.
+		 * @param bytes		[in] Number of bytes requested.
+		 * @param ns		[in] Latency, in nanoseconds.
+		 */
+		void addReadLatency(int64_t offset, uint64_t bytes, uint64_t ns);
+
+	public:
+		std::atomic<uint64_t> bytes_read;
+		std::atomic<uint64_t> bytes_written;
+		std::atomic<uint64_t> read_calls;
+		std::atomic<uint64_t> write_calls;
+		std::atomic<uint64_t> seeks;
+		std::atomic<uint64_t> sparse_bytes;
+		std::atomic<uint64_t> cache_hits;
+		std::atomic<uint64_t> cache_misses;
+		std::atomic<uint64_t> ns[TIMER_MAX];
+
+		// Read latency. (only if slow_read_ns != 0)
+		std::atomic<uint64_t> slow_read_ns;
+		std::atomic<uint64_t> latency_hist[RVTH_LATENCY_BUCKETS];
+		std::atomic<uint64_t> latency_max_ns;
+		std::atomic<uint64_t> latency_total_ns;
+		std::atomic<uint64_t> slow_reads;
+
+	private:
+		// Slow read ranges.
+		mutable std::mutex m_slowMutex;
+		std::vector<RvtH_Slow_Read> m_slowRanges;
+
+		// Cancellation token.
+		std::atomic<const CancelToken*> m_cancel;
+
+		// I/O priority and bandwidth limit.
+		IoThrottle m_throttle;
+
+	private:
+		friend class StatsScope;
+		static thread_local StatsCounters *ms_current;
+};
+
+/**
+ * Install counters for the current thread.
+ *
+ * If the thread already has counters, they're kept, so nested
+ * operations, e.g. recrypting the destination image of an extract,
+ * are counted by the outermost operation.
+ */
+class StatsScope
+{
+	public:
+		explicit StatsScope(StatsCounters *stats)
+			: m_installed(!StatsCounters::ms_current && stats)
+		{
+			if (m_installed) {
+				StatsCounters::ms_current = stats;
+			}
+		}
+
+		~StatsScope()
+		{
+			if (m_installed) {
+				StatsCounters::ms_current = nullptr;
+			}
+		}
+
+	private:
+		DISABLE_COPY(StatsScope)
+
+	private:
+		bool m_installed;
+};
+
+/**
+ * Time a block of code using the current thread's counters.
+ * If a trace is being recorded, the block is also recorded as a span.
+ */
+class StatsTimer
+{
+	public:
+		explicit StatsTimer(StatsCounters::Timer timer)
+			: m_stats(StatsCounters::current())
+			, m_timer(timer)
+#ifdef ENABLE_TRACING
+			, m_span(StatsCounters::timerName(timer))
+#endif /* ENABLE_TRACING */
+		{
+			if (m_stats) {
+				m_start = std::chrono::steady_clock::now();
+			}
+		}
+
+		~StatsTimer()
+		{
+			if (m_stats) {
+				const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+					std::chrono::steady_clock::now() - m_start).count();
+				m_stats->ns[m_timer].fetch_add(static_cast<uint64_t>(ns), std::memory_order_relaxed);
+			}
+		}
+
+	private:
+		DISABLE_COPY(StatsTimer)
+
+	private:
+		StatsCounters *const m_stats;
+		const StatsCounters::Timer m_timer;
+		std::chrono::steady_clock::time_point m_start;
+#ifdef ENABLE_TRACING
+		TraceSpan m_span;
+#endif /* ENABLE_TRACING */
+};
+
+/**
+ * Measure the latency of a read using the current thread's counters.
+ * Nothing is measured unless a slow read threshold is set.
+ */
+class ReadLatencyTimer
+{
+	public:
+		ReadLatencyTimer(int64_t offset, uint64_t bytes)
+			: m_stats(StatsCounters::currentForLatency())
+			, m_offset(offset)
+			, m_bytes(bytes)
+		{
+			if (m_stats) {
+				m_start = std::chrono::steady_clock::now();
+			}
+		}
+
+		~ReadLatencyTimer()
+		{
+			if (m_stats) {
+				const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+					std::chrono::steady_clock::now() - m_start).count();
+				m_stats->addReadLatency(m_offset, m_bytes, static_cast<uint64_t>(ns));
+			}
+		}
+
+	private:
+		DISABLE_COPY(ReadLatencyTimer)
+
+	private:
+		StatsCounters *const m_stats;
+		const int64_t m_offset;
+		const uint64_t m_bytes;
+		std::chrono::steady_clock::time_point m_start;
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_STATSCOUNTERS_HPP__ */
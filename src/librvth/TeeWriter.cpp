@@ -0,0 +1,222 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * TeeWriter.cpp: Write a stream of chunks to multiple sinks.              *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "TeeWriter.hpp"
+
+// For LBA_TO_BYTES()
+#include "nhcd_structs.h"
+
+// C includes (C++ namespace)
+#include <cassert>
+#include <cerrno>
+
+// C++ includes
+#include <chrono>
+#include <system_error>
+using std::lock_guard;
+using std::mutex;
+using std::unique_lock;
+
+// Maximum time to wait for a full queue before checking for cancellation.
+static constexpr std::chrono::milliseconds WAIT_MAX(50);
+
+/**
+ * Create a tee writer.
+ * @param queue_max	[in] Maximum number of bytes queued for each sink.
+ */
+TeeWriter::TeeWriter(size_t queue_max)
+	: m_queue_max(queue_max)
+	, m_finished(false)
+	, m_stats(StatsCounters::current())
+{ }
+
+/**
+ * Stop the sink threads.
+ * Chunks that are still queued aren't written.
+ */
+TeeWriter::~TeeWriter()
+{
+	cancel();
+}
+
+/**
+ * Add a sink and start its thread.
+ * All sinks must be added before the first push().
+ * @param func	[in] Sink function.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int TeeWriter::addSink(SinkFunc func)
+{
+	std::unique_ptr<Sink> sink(new Sink());
+	sink->func = std::move(func);
+	try {
+		sink->thread = std::thread(&TeeWriter::sinkThread, this, sink.get());
+	} catch (const std::system_error&) {
+		return -EAGAIN;
+	}
+	lock_guard<mutex> lock(m_mutex);
+	m_sinks.push_back(std::move(sink));
+	return 0;
+}
+
+/**
+ * Get the number of sinks.
+ * @return Number of sinks.
+ */
+unsigned int TeeWriter::sinkCount(void) const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return static_cast<unsigned int>(m_sinks.size());
+}
+
+/**
+ * Sink thread function.
+ * @param sink	[in] Sink
+ */
+void TeeWriter::sinkThread(Sink *sink)
+{
+	StatsScope scope(m_stats);
+
+	unique_lock<mutex> lock(m_mutex);
+	while (true) {
+		m_cond.wait(lock, [&]() { return !sink->queue.empty() || m_finished; });
+		if (sink->queue.empty()) {
+			// Finished.
+			break;
+		}
+
+		// The chunk stays in the queue until it's written,
+		// so it counts against the queue limit.
+		const ChunkPtr chunk = sink->queue.front();
+		lock.unlock();
+		const int ret = sink->func(*chunk);
+		lock.lock();
+
+		if (!sink->queue.empty()) {
+			// NOTE: The queue is cleared if the writer is deleted.
+			sink->queue.pop_front();
+			sink->queued -= LBA_TO_BYTES(chunk->lba_len);
+		}
+		if (ret != 0) {
+			// Drop this sink. The queued chunks are released,
+			// and push() won't queue any more chunks for it.
+			sink->result = ret;
+			sink->queue.clear();
+			sink->queued = 0;
+			m_cond.notify_all();
+			break;
+		}
+		m_cond.notify_all();
+	}
+}
+
+/**
+ * Queue a chunk for all sinks.
+ * Blocks while a sink has queue_max bytes queued.
+ * @param chunk	[in] Chunk
+ * @return 0 on success; -ECANCELED if the operation was cancelled; -EIO if all sinks failed.
+ */
+int TeeWriter::push(const ChunkPtr &chunk)
+{
+	assert(!m_finished);
+	const size_t size = LBA_TO_BYTES(chunk->lba_len);
+
+	unique_lock<mutex> lock(m_mutex);
+	bool any_ok = false;
+	for (auto &sink : m_sinks) {
+		// Wait for room in this sink's queue.
+		// A chunk is always accepted by an empty queue.
+		while (sink->result == 0 && sink->queued != 0 && sink->queued + size > m_queue_max) {
+			if (StatsCounters::cancelled()) {
+				return -ECANCELED;
+			}
+			m_cond.wait_for(lock, WAIT_MAX);
+		}
+		if (sink->result != 0) {
+			// Sink failed.
+			continue;
+		}
+
+		sink->queue.push_back(chunk);
+		sink->queued += size;
+		if (sink->queued > sink->peak) {
+			sink->peak = sink->queued;
+		}
+		any_ok = true;
+	}
+	m_cond.notify_all();
+	return (any_ok ? 0 : -EIO);
+}
+
+/**
+ * Wait for all queued chunks to be written and stop the sink threads.
+ * No more chunks can be pushed after calling this function.
+ */
+void TeeWriter::finish(void)
+{
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_finished = true;
+		m_cond.notify_all();
+	}
+	for (auto &sink : m_sinks) {
+		if (sink->thread.joinable()) {
+			sink->thread.join();
+		}
+	}
+}
+
+/**
+ * Stop the sink threads without writing the queued chunks.
+ * Sinks that still had chunks queued fail with -ECANCELED.
+ */
+void TeeWriter::cancel(void)
+{
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_finished = true;
+		for (auto &sink : m_sinks) {
+			if (sink->result == 0 && !sink->queue.empty()) {
+				sink->result = -ECANCELED;
+			}
+			sink->queue.clear();
+			sink->queued = 0;
+		}
+		m_cond.notify_all();
+	}
+	for (auto &sink : m_sinks) {
+		if (sink->thread.joinable()) {
+			sink->thread.join();
+		}
+	}
+}
+
+/**
+ * Get the result of a sink.
+ * @param index	[in] Sink index.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int TeeWriter::result(unsigned int index) const
+{
+	lock_guard<mutex> lock(m_mutex);
+	assert(index < m_sinks.size());
+	return m_sinks[index]->result;
+}
+
+/**
+ * Get the largest amount of data queued for a sink.
+ * This shows how far a slow sink fell behind.
+ * @param index	[in] Sink index.
+ * @return Peak queued bytes.
+ */
+size_t TeeWriter::peakQueued(unsigned int index) const
+{
+	lock_guard<mutex> lock(m_mutex);
+	assert(index < m_sinks.size());
+	return m_sinks[index]->peak;
+}
@@ -0,0 +1,150 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * TeeWriter.hpp: Write a stream of chunks to multiple sinks.              *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_TEEWRITER_HPP__
+#define __RVTHTOOL_LIBRVTH_TEEWRITER_HPP__
+
+#include "libwiicrypto/common.h"
+#include "BufferPool.hpp"
+#include "StatsCounters.hpp"
+
+// C includes
+#include <stdint.h>
+
+// C++ includes
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Write a stream of chunks to multiple sinks, e.g. the destination
+ * images of an extract to several files. (See RvtH::extractTee().)
+ *
+ * Each sink is written by its own thread. Chunks are shared by all of
+ * the sinks, and each sink has its own queue, so a slow sink falls
+ * behind without holding up the others. push() only blocks if a sink
+ * already has queue_max bytes queued. A sink that fails is dropped,
+ * and the other sinks continue.
+ */
+class TeeWriter
+{
+	public:
+		/**
+		 * Chunk of data to write.
+		 */
+		struct Chunk {
+			PoolBuffer buf;		// Data
+			uint32_t lba_start;	// Starting LBA
+			uint32_t lba_len;	// Length, in LBAs
+			bool is_empty = false;	// True if the chunk is known to be empty (zero-filled)
+		};
+		typedef std::shared_ptr<const Chunk> ChunkPtr;
+
+		/**
+		 * Sink function. Called on the sink's thread for each chunk, in order.
+		 * @param chunk	[in] Chunk
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		typedef std::function<int(const Chunk &chunk)> SinkFunc;
+
+		/**
+		 * Create a tee writer.
+		 * @param queue_max	[in] Maximum number of bytes queued for each sink.
+		 */
+		explicit TeeWriter(size_t queue_max);
+
+		/**
+		 * Stop the sink threads.
+		 * Chunks that are still queued aren't written.
+		 */
+		~TeeWriter();
+
+	private:
+		DISABLE_COPY(TeeWriter)
+
+	public:
+		/**
+		 * Add a sink and start its thread.
+		 * All sinks must be added before the first push().
+		 * @param func	[in] Sink function.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int addSink(SinkFunc func);
+
+		/**
+		 * Get the number of sinks.
+		 * @return Number of sinks.
+		 */
+		unsigned int sinkCount(void) const;
+
+		/**
+		 * Queue a chunk for all sinks.
+		 * Blocks while a sink has queue_max bytes queued.
+		 * @param chunk	[in] Chunk
+		 * @return 0 on success; -ECANCELED if the operation was cancelled; -EIO if all sinks failed.
+		 */
+		int push(const ChunkPtr &chunk);
+
+		/**
+		 * Wait for all queued chunks to be written and stop the sink threads.
+		 * No more chunks can be pushed after calling this function.
+		 */
+		void finish(void);
+
+		/**
+		 * Stop the sink threads without writing the queued chunks.
+		 * Sinks that still had chunks queued fail with -ECANCELED.
+		 */
+		void cancel(void);
+
+		/**
+		 * Get the result of a sink.
+		 * @param index	[in] Sink index.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int result(unsigned int index) const;
+
+		/**
+		 * Get the largest amount of data queued for a sink.
+		 * This shows how far a slow sink fell behind.
+		 * @param index	[in] Sink index.
+		 * @return Peak queued bytes.
+		 */
+		size_t peakQueued(unsigned int index) const;
+
+	private:
+		struct Sink {
+			SinkFunc func;
+			std::deque<ChunkPtr> queue;
+			size_t queued = 0;	// Bytes in queue
+			size_t peak = 0;	// Peak bytes in queue
+			int result = 0;		// Error code (0 if OK)
+			std::thread thread;
+		};
+
+		/**
+		 * Sink thread function.
+		 * @param sink	[in] Sink
+		 */
+		void sinkThread(Sink *sink);
+
+	private:
+		std::vector<std::unique_ptr<Sink> > m_sinks;
+		size_t m_queue_max;
+
+		mutable std::mutex m_mutex;
+		std::condition_variable m_cond;
+		bool m_finished;		// No more chunks will be pushed
+		StatsCounters *m_stats;		// Counters of the operation that created this object
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_TEEWRITER_HPP__ */
@@ -0,0 +1,176 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * ThreadPool.cpp: Process-wide worker thread pool.                        *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "ThreadPool.hpp"
+#include "StatsCounters.hpp"
+
+// C includes (C++ namespace)
+#include <cassert>
+
+// C++ includes
+#include <algorithm>
+#include <system_error>
+using std::lock_guard;
+using std::mutex;
+using std::unique_lock;
+
+/**
+ * Tasks queued by a single run() call.
+ */
+struct ThreadPool::Group {
+	const std::function<void()> *func;
+	StatsCounters *stats;	// Counters of the thread that called run()
+	unsigned int unstarted;	// Tasks that haven't started yet
+	unsigned int running;	// Tasks that are running
+};
+
+ThreadPool::ThreadPool()
+	: m_threadCount(0)
+	, m_reserved(0)
+	, m_reservations(0)
+{
+	unsigned int threads = std::thread::hardware_concurrency();
+	if (threads == 0) {
+		threads = 1;
+	}
+
+	// If a thread can't be started, the pool is smaller.
+	// run() still works with no pool threads at all.
+	m_threads.reserve(threads);
+	for (unsigned int i = 0; i < threads; i++) {
+		try {
+			m_threads.emplace_back(&ThreadPool::poolThread, this);
+		} catch (const std::system_error&) {
+			break;
+		}
+	}
+	m_threadCount = static_cast<unsigned int>(m_threads.size());
+}
+
+/**
+ * Get the process-wide thread pool.
+ * The pool threads are started on first use.
+ * @return Thread pool.
+ */
+ThreadPool &ThreadPool::instance(void)
+{
+	// The pool is intentionally leaked. Its threads may still be
+	// running tasks for detached threads, e.g. daemon requests,
+	// when the process exits.
+	static ThreadPool *const pool = new ThreadPool();
+	return *pool;
+}
+
+/**
+ * Pool thread function.
+ */
+void ThreadPool::poolThread(void)
+{
+	unique_lock<mutex> lock(m_mutex);
+	while (true) {
+		// Find the highest-priority group with a task that hasn't started.
+		Group *group = nullptr;
+		m_cond.wait(lock, [&]() {
+			for (const auto &queue : m_queue) {
+				if (!queue.empty()) {
+					return true;
+				}
+			}
+			return false;
+		});
+		for (auto &queue : m_queue) {
+			if (!queue.empty()) {
+				group = queue.front();
+				if (--group->unstarted == 0) {
+					queue.pop_front();
+				}
+				break;
+			}
+		}
+		assert(group != nullptr);
+		group->running++;
+
+		lock.unlock();
+		{
+			StatsScope scope(group->stats);
+			(*group->func)();
+		}
+		lock.lock();
+
+		// NOTE: The group is owned by run(), which may return
+		// as soon as this task is no longer running.
+		group->running--;
+		m_cond.notify_all();
+	}
+}
+
+/**
+ * Run a worker function on up to `workers` threads.
+ * The calling thread runs the function, and workers-1 tasks
+ * are queued for the pool threads.
+ * @param workers	[in] Maximum number of concurrent workers, including the calling thread.
+ * @param func		[in] Worker function.
+ * @param prio		[in,opt] Priority of the pool tasks.
+ */
+void ThreadPool::run(unsigned int workers, const std::function<void()> &func, Priority prio)
+{
+	assert(prio >= PRIORITY_HIGH && prio < PRIORITY_MAX);
+	if (workers <= 1 || m_threadCount == 0) {
+		func();
+		return;
+	}
+
+	Group group;
+	group.func = &func;
+	group.stats = StatsCounters::current();
+	group.unstarted = std::min(workers - 1, m_threadCount);
+	group.running = 0;
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_queue[prio].push_back(&group);
+	}
+	m_cond.notify_all();
+
+	func();
+
+	// Remove the tasks that haven't started. Since this thread's
+	// worker returned, there's no work left for them.
+	unique_lock<mutex> lock(m_mutex);
+	if (group.unstarted > 0) {
+		auto &queue = m_queue[prio];
+		queue.erase(std::remove(queue.begin(), queue.end(), &group), queue.end());
+		group.unstarted = 0;
+	}
+	m_cond.wait(lock, [&]() { return group.running == 0; });
+}
+
+/**
+ * Reserve CPU threads.
+ * @param threads	[in] Number of threads requested.
+ */
+ThreadPool::Reservation::Reservation(unsigned int threads)
+{
+	ThreadPool &pool = ThreadPool::instance();
+	lock_guard<mutex> lock(pool.m_mutex);
+
+	const unsigned int cpus = std::max(pool.m_threadCount, 1U);
+	const unsigned int avail = (cpus > pool.m_reserved ? cpus - pool.m_reserved : 0);
+	const unsigned int fair = cpus / (pool.m_reservations + 1);
+	m_count = std::max(std::min(threads, std::max(avail, fair)), 1U);
+
+	pool.m_reserved += m_count;
+	pool.m_reservations++;
+}
+
+ThreadPool::Reservation::~Reservation()
+{
+	ThreadPool &pool = ThreadPool::instance();
+	lock_guard<mutex> lock(pool.m_mutex);
+	pool.m_reserved -= m_count;
+	pool.m_reservations--;
+}
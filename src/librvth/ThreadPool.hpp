@@ -0,0 +1,143 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * ThreadPool.hpp: Process-wide worker thread pool.                        *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_THREADPOOL_HPP__
+#define __RVTHTOOL_LIBRVTH_THREADPOOL_HPP__
+
+#include "libwiicrypto/common.h"
+
+// C++ includes
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Process-wide worker thread pool, sized to the number of CPUs.
+ *
+ * Operations that split their work into a shared list of items, e.g.
+ * initializing the banks of an RVT-H Reader or opening an ImageSet,
+ * use run() instead of starting their own threads, so concurrent
+ * operations share the pool's threads instead of oversubscribing the
+ * machine.
+ *
+ * Pipelines that need their workers to run concurrently, e.g. the
+ * group hashing workers of a verify, still have their own threads,
+ * since a pool task might not start until another operation's task
+ * finishes. They use a Reservation to limit their number of threads
+ * while other pipelines are running.
+ */
+class ThreadPool
+{
+	public:
+		/**
+		 * Task priority. Queued tasks with a higher priority are
+		 * started first; tasks that are already running continue.
+		 */
+		enum Priority {
+			PRIORITY_HIGH	= 0,	// Interactive operations, e.g. listing banks
+			PRIORITY_NORMAL	= 1,	// Default
+			PRIORITY_LOW	= 2,	// Background operations
+
+			PRIORITY_MAX
+		};
+
+	private:
+		// The pool is never destroyed. (See instance().)
+		ThreadPool();
+		DISABLE_COPY(ThreadPool)
+
+	public:
+		/**
+		 * Get the process-wide thread pool.
+		 * The pool threads are started on first use.
+		 * @return Thread pool.
+		 */
+		static ThreadPool &instance(void);
+
+		/**
+		 * Get the number of threads in the pool.
+		 * @return Number of threads.
+		 */
+		unsigned int threadCount(void) const { return m_threadCount; }
+
+		/**
+		 * Run a worker function on up to `workers` threads.
+		 *
+		 * The calling thread runs the function, and workers-1 tasks
+		 * are queued for the pool threads. The function must be a
+		 * worker loop that takes items from shared state until there
+		 * are none left, since the calling thread may end up doing all
+		 * of the work: When its own call returns, queued tasks that
+		 * haven't started yet are removed instead of being run.
+		 *
+		 * The pool tasks run with the calling thread's StatsCounters.
+		 * run() can be nested, e.g. from a worker function.
+		 *
+		 * @param workers	[in] Maximum number of concurrent workers, including the calling thread.
+		 * @param func		[in] Worker function.
+		 * @param prio		[in,opt] Priority of the pool tasks.
+		 */
+		void run(unsigned int workers, const std::function<void()> &func, Priority prio = PRIORITY_NORMAL);
+
+	public:
+		/**
+		 * Reservation of CPU threads for a pipeline with its own threads.
+		 *
+		 * A pipeline that's started while other pipelines are running
+		 * gets the CPUs that aren't reserved, or its fair share of all
+		 * of the CPUs if that's more, but always at least one thread.
+		 */
+		class Reservation
+		{
+			public:
+				/**
+				 * Reserve CPU threads.
+				 * @param threads	[in] Number of threads requested.
+				 */
+				explicit Reservation(unsigned int threads);
+				~Reservation();
+
+			private:
+				DISABLE_COPY(Reservation)
+
+			public:
+				/**
+				 * Get the number of threads that were granted.
+				 * @return Number of threads. (at least 1)
+				 */
+				unsigned int count(void) const { return m_count; }
+
+			private:
+				unsigned int m_count;
+		};
+
+	private:
+		struct Group;
+
+		/**
+		 * Pool thread function.
+		 */
+		void poolThread(void);
+
+	private:
+		unsigned int m_threadCount;
+		std::vector<std::thread> m_threads;
+
+		std::mutex m_mutex;
+		std::condition_variable m_cond;		// Signaled when a task is queued or finished
+		std::deque<Group*> m_queue[PRIORITY_MAX];	// Groups with tasks that haven't started
+
+		// CPU reservations. (See Reservation.)
+		unsigned int m_reserved;	// Threads reserved
+		unsigned int m_reservations;	// Active reservations
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_THREADPOOL_HPP__ */
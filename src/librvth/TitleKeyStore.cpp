@@ -0,0 +1,41 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * TitleKeyStore.cpp: Thread-safe title key cache.                         *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "TitleKeyStore.hpp"
+
+using std::lock_guard;
+using std::mutex;
+
+TitleKeyStore::TitleKeyStore()
+	: m_cache(nullptr)
+{ }
+
+TitleKeyStore::~TitleKeyStore()
+{
+	title_key_cache_free(m_cache);
+}
+
+/**
+ * Decrypt a Wii title key.
+ * @param ticket	[in] Ticket.
+ * @param titleKey	[out] Output buffer for the title key. (Must be 16 bytes.)
+ * @param crypto_type	[out] Encryption type. (See RVL_CryptoType_e.)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int TitleKeyStore::decrypt(const RVL_Ticket *ticket, uint8_t *titleKey, uint8_t *crypto_type)
+{
+	lock_guard<mutex> lock(m_mutex);
+	if (!m_cache) {
+		m_cache = title_key_cache_new();
+		if (!m_cache) {
+			// Can't allocate the cache. Decrypt it directly.
+			return decrypt_title_key(ticket, titleKey, crypto_type);
+		}
+	}
+	return title_key_cache_decrypt(m_cache, ticket, titleKey, crypto_type, nullptr);
+}
@@ -0,0 +1,53 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * TitleKeyStore.hpp: Thread-safe title key cache.                         *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_TITLEKEYSTORE_HPP__
+#define __RVTHTOOL_LIBRVTH_TITLEKEYSTORE_HPP__
+
+#include "libwiicrypto/common.h"
+#include "libwiicrypto/title_key.h"
+
+// C includes
+#include <stdint.h>
+
+// C++ includes
+#include <mutex>
+
+/**
+ * Thread-safe wrapper for a TitleKeyCache.
+ *
+ * Each RvtH object has its own store by default. (See RvtH::decryptTitleKey().)
+ * A store can be shared by several RvtH objects with RvtH::setTitleKeyStore(),
+ * e.g. by ImageSet, so a title key that was decrypted for one disc image
+ * isn't decrypted again for another disc image of the same title.
+ */
+class TitleKeyStore
+{
+	public:
+		TitleKeyStore();
+		~TitleKeyStore();
+
+	private:
+		DISABLE_COPY(TitleKeyStore)
+
+	public:
+		/**
+		 * Decrypt a Wii title key.
+		 * @param ticket	[in] Ticket.
+		 * @param titleKey	[out] Output buffer for the title key. (Must be 16 bytes.)
+		 * @param crypto_type	[out] Encryption type. (See RVL_CryptoType_e.)
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int decrypt(const RVL_Ticket *ticket, uint8_t *titleKey, uint8_t *crypto_type);
+
+	private:
+		std::mutex m_mutex;
+		TitleKeyCache *m_cache;	// Allocated on demand
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_TITLEKEYSTORE_HPP__ */
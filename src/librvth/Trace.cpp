@@ -0,0 +1,241 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * Trace.cpp: Span tracing. (Chrome trace event format)                    *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "Trace.hpp"
+
+// C includes (C++ namespace)
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+
+#ifdef ENABLE_TRACING
+
+// C++ includes
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+using std::shared_ptr;
+using std::vector;
+
+// Maximum number of spans per thread.
+// Spans after this are dropped, so a long operation
+// doesn't use an unbounded amount of memory.
+#define TRACE_MAX_SPANS_PER_THREAD (1U << 20)
+
+namespace {
+
+// Recorded span.
+struct TraceEvent {
+	const char *name;
+	uint64_t start;		// Start time (ns)
+	uint64_t dur;		// Duration (ns)
+	uint64_t bytes;		// Bytes processed (0 if not applicable)
+};
+
+// Spans recorded by a single thread.
+// The mutex is only contended while the trace is being written.
+struct TraceThread {
+	std::mutex mutex;
+	vector<TraceEvent> events;
+	unsigned int tid;	// Thread ID in the trace file (1-based)
+	unsigned int gen;	// Trace generation
+	uint64_t dropped;	// Spans dropped due to TRACE_MAX_SPANS_PER_THREAD
+};
+
+// Trace state. Protected by trace_mutex.
+std::mutex trace_mutex;
+FILE *trace_file = nullptr;
+uint64_t trace_epoch = 0;
+vector<shared_ptr<TraceThread> > trace_threads;
+
+// Trace generation. Incremented each time a trace is started,
+// so threads don't record spans in a previous trace's buffers.
+std::atomic<unsigned int> trace_gen(0);
+
+// Buffer for the current thread.
+thread_local shared_ptr<TraceThread> tls_thread;
+
+/**
+ * Get the current thread's buffer, creating it if necessary.
+ * @return Buffer, or nullptr if a trace isn't being recorded.
+ */
+TraceThread *get_thread_buffer(void)
+{
+	const unsigned int gen = trace_gen.load(std::memory_order_acquire);
+	if (tls_thread && tls_thread->gen == gen) {
+		return tls_thread.get();
+	}
+
+	std::lock_guard<std::mutex> lock(trace_mutex);
+	if (!trace_file || gen != trace_gen.load(std::memory_order_relaxed)) {
+		// Trace was stopped or restarted.
+		return nullptr;
+	}
+	tls_thread = std::make_shared<TraceThread>();
+	tls_thread->tid = static_cast<unsigned int>(trace_threads.size() + 1);
+	tls_thread->gen = gen;
+	tls_thread->dropped = 0;
+	trace_threads.push_back(tls_thread);
+	return tls_thread.get();
+}
+
+}
+
+std::atomic<bool> TraceLog::ms_enabled(false);
+
+/**
+ * Get the current time for a span.
+ * @return Current time, in nanoseconds.
+ */
+uint64_t TraceLog::now(void)
+{
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+/**
+ * Record a complete span for the current thread.
+ * @param name	[in] Span name. (must be a string literal)
+ * @param start	[in] Start time, from now().
+ * @param bytes	[in] Bytes processed. (0 if not applicable)
+ */
+void TraceLog::addSpan(const char *name, uint64_t start, uint64_t bytes)
+{
+	const uint64_t end = now();
+	if (!enabled())
+		return;
+	TraceThread *const th = get_thread_buffer();
+	if (!th)
+		return;
+
+	std::lock_guard<std::mutex> lock(th->mutex);
+	if (th->events.size() >= TRACE_MAX_SPANS_PER_THREAD) {
+		th->dropped++;
+		return;
+	}
+	th->events.push_back({name, start, end - start, bytes});
+}
+
+#endif /* ENABLE_TRACING */
+
+/**
+ * Start recording a trace.
+ *
+ * Spans are recorded in memory by each thread, and written to the
+ * file as Chrome trace event JSON when rvth_trace_stop() is called.
+ * The file can be opened in Perfetto or chrome://tracing.
+ *
+ * If librvth was built without ENABLE_TRACING, this fails with -ENOTSUP.
+ *
+ * @param filename	[in] Trace filename.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rvth_trace_start(const TCHAR *filename)
+{
+#ifdef ENABLE_TRACING
+	if (!filename || filename[0] == 0) {
+		return -EINVAL;
+	}
+
+	std::lock_guard<std::mutex> lock(trace_mutex);
+	if (trace_file) {
+		// Already recording.
+		return -EBUSY;
+	}
+
+	// Open the file now so errors are reported
+	// before the operation starts.
+	trace_file = _tfopen(filename, _T("w"));
+	if (!trace_file) {
+		const int err = errno;
+		return (err != 0 ? -err : -EIO);
+	}
+
+	trace_threads.clear();
+	trace_epoch = TraceLog::now();
+	trace_gen.fetch_add(1, std::memory_order_release);
+	TraceLog::ms_enabled.store(true, std::memory_order_release);
+	return 0;
+#else /* !ENABLE_TRACING */
+	UNUSED(filename);
+	return -ENOTSUP;
+#endif /* ENABLE_TRACING */
+}
+
+/**
+ * Start recording a trace if the RVTH_TRACE environment variable is set.
+ * RVTH_TRACE contains the trace filename.
+ * @return 0 on success or if RVTH_TRACE isn't set; negative POSIX error code on error.
+ */
+int rvth_trace_start_from_env(void)
+{
+	const TCHAR *const filename = _tgetenv(_T("RVTH_TRACE"));
+	if (!filename || filename[0] == 0) {
+		return 0;
+	}
+	return rvth_trace_start(filename);
+}
+
+/**
+ * Stop recording and write the trace file.
+ * @return 0 on success; negative POSIX error code on error. (-EBADF if not recording)
+ */
+int rvth_trace_stop(void)
+{
+#ifdef ENABLE_TRACING
+	std::lock_guard<std::mutex> lock(trace_mutex);
+	if (!trace_file) {
+		return -EBADF;
+	}
+	TraceLog::ms_enabled.store(false, std::memory_order_release);
+
+	// Timestamps are in microseconds, relative to the start of the trace.
+	FILE *const f = trace_file;
+	uint64_t dropped = 0;
+	fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+		"{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"librvth\"}}", f);
+	for (const shared_ptr<TraceThread> &th : trace_threads) {
+		std::lock_guard<std::mutex> th_lock(th->mutex);
+		for (const TraceEvent &ev : th->events) {
+			const uint64_t start = (ev.start > trace_epoch ? ev.start - trace_epoch : 0);
+			fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"rvth\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+				"\"ts\":%llu.%03u,\"dur\":%llu.%03u",
+				ev.name, th->tid,
+				static_cast<unsigned long long>(start / 1000),
+				static_cast<unsigned int>(start % 1000),
+				static_cast<unsigned long long>(ev.dur / 1000),
+				static_cast<unsigned int>(ev.dur % 1000));
+			if (ev.bytes != 0) {
+				fprintf(f, ",\"args\":{\"bytes\":%llu}}",
+					static_cast<unsigned long long>(ev.bytes));
+			} else {
+				fputc('}', f);
+			}
+		}
+		dropped += th->dropped;
+		th->events.clear();
+		th->events.shrink_to_fit();
+	}
+	fprintf(f, "\n],\"otherData\":{\"dropped_spans\":%llu}}\n",
+		static_cast<unsigned long long>(dropped));
+	trace_threads.clear();
+
+	int ret = 0;
+	if (ferror(f)) {
+		ret = -EIO;
+	}
+	if (fclose(f) != 0 && ret == 0) {
+		ret = (errno != 0 ? -errno : -EIO);
+	}
+	trace_file = nullptr;
+	return ret;
+#else /* !ENABLE_TRACING */
+	return -EBADF;
+#endif /* ENABLE_TRACING */
+}
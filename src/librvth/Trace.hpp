@@ -0,0 +1,123 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * Trace.hpp: Span tracing. (Chrome trace event format)                    *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_TRACE_HPP__
+#define __RVTHTOOL_LIBRVTH_TRACE_HPP__
+
+#include "config.librvth.h"
+#include "rvth_trace.h"
+#include "libwiicrypto/common.h"
+
+// C includes
+#include <stdint.h>
+
+#ifdef ENABLE_TRACING
+
+// C++ includes
+#include <atomic>
+
+/**
+ * Trace recorder. (See rvth_trace.h.)
+ *
+ * Each thread records its spans in its own buffer, so recording
+ * a span doesn't contend with other threads. The buffers are
+ * written to the trace file when the trace is stopped.
+ */
+class TraceLog
+{
+	private:
+		TraceLog() = delete;
+		~TraceLog() = delete;
+		DISABLE_COPY(TraceLog)
+
+	public:
+		/**
+		 * Is a trace being recorded?
+		 * @return True if a trace is being recorded.
+		 */
+		static inline bool enabled(void)
+		{
+			return ms_enabled.load(std::memory_order_relaxed);
+		}
+
+		/**
+		 * Get the current time for a span.
+		 * @return Current time, in nanoseconds.
+		 */
+		static uint64_t now(void);
+
+		/**
+		 * Record a complete span for the current thread.
+		 * @param name	[in] Span name. (must be a string literal)
+		 * @param start	[in] Start time, from now().
+		 * @param bytes	[in] Bytes processed. (0 if not applicable)
+		 */
+		static void addSpan(const char *name, uint64_t start, uint64_t bytes);
+
+	private:
+		friend int ::rvth_trace_start(const TCHAR *filename);
+		friend int ::rvth_trace_stop(void);
+		static std::atomic<bool> ms_enabled;
+};
+
+/**
+ * Record a span for the lifetime of this object.
+ */
+class TraceSpan
+{
+	public:
+		explicit TraceSpan(const char *name, uint64_t bytes = 0)
+			: m_name(TraceLog::enabled() ? name : nullptr)
+			, m_bytes(bytes)
+			, m_start(m_name ? TraceLog::now() : 0)
+		{ }
+
+		~TraceSpan()
+		{
+			if (m_name) {
+				TraceLog::addSpan(m_name, m_start, m_bytes);
+			}
+		}
+
+	private:
+		DISABLE_COPY(TraceSpan)
+
+	private:
+		const char *const m_name;
+		const uint64_t m_bytes;
+		const uint64_t m_start;
+};
+
+#define RVTH_TRACE_CONCAT2(a, b) a##b
+#define RVTH_TRACE_CONCAT(a, b) RVTH_TRACE_CONCAT2(a, b)
+
+/**
+ * Record a span until the end of the current scope.
+ * @param name Span name. (string literal)
+ */
+#define RVTH_TRACE_SPAN(name) \
+	TraceSpan RVTH_TRACE_CONCAT(rvth_trace_span_, __LINE__)(name)
+
+/**
+ * Record a span until the end of the current scope,
+ * with the number of bytes processed.
+ * @param name Span name. (string literal)
+ * @param bytes Bytes processed.
+ */
+#define RVTH_TRACE_SPAN_BYTES(name, bytes) \
+	TraceSpan RVTH_TRACE_CONCAT(rvth_trace_span_, __LINE__)((name), (bytes))
+
+#else /* !ENABLE_TRACING */
+
+// Tracing is disabled. Spans compile to nothing.
+#define RVTH_TRACE_SPAN(name) do { } while (0)
+#define RVTH_TRACE_SPAN_BYTES(name, bytes) do { } while (0)
+
+#endif /* ENABLE_TRACING */
+
+#endif /* __RVTHTOOL_LIBRVTH_TRACE_HPP__ */
@@ -0,0 +1,225 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * VerifyCache.cpp: Persistent cache for RVT-H bank verification results.  *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "config.librvth.h"
+
+#include "VerifyCache.hpp"
+#include "cache_dir.hpp"
+
+// C includes (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+// C++ includes
+#include <string>
+#include <vector>
+using std::tstring;
+using std::vector;
+
+// Cache file header.
+// NOTE: Entries are stored in host-endian, so the entry size
+// and version are checked to reject caches from other builds.
+static const char VERIFYCACHE_MAGIC[8] = {'R','V','T','H','V','R','F','C'};
+static const uint32_t VERIFYCACHE_VERSION = 1;
+typedef struct _VerifyCache_Header {
+	char magic[8];		// VERIFYCACHE_MAGIC
+	uint32_t version;	// VERIFYCACHE_VERSION
+	uint32_t entry_size;	// sizeof(VerifyCache::CacheEntry)
+	uint32_t bank_count;	// Number of entries
+	uint32_t key_size;	// Size of the device key that follows the header, in bytes
+} VerifyCache_Header;
+
+VerifyCache::VerifyCache()
+	: m_dirty(false)
+{ }
+
+/**
+ * Load the verification cache for an RVT-H Reader or HDD image.
+ * If the cache can't be loaded, all lookups will fail.
+ * @param f_img		[in] RefFile*
+ * @param bankCount	[in] Number of banks.
+ */
+void VerifyCache::load(RefFile *f_img, unsigned int bankCount)
+{
+	m_filename.clear();
+	m_key.clear();
+	m_entries.resize(bankCount);
+	memset(m_entries.data(), 0, m_entries.size() * sizeof(CacheEntry));
+	m_dirty = false;
+
+	m_key = rvth_get_device_key(f_img);
+	if (m_key.empty()) {
+		return;
+	}
+	m_filename = rvth_get_cache_filename(m_key, _T(".vres"));
+	if (m_filename.empty()) {
+		return;
+	}
+	const uint8_t *const key8 = reinterpret_cast<const uint8_t*>(m_key.data());
+	const size_t key_size = m_key.size() * sizeof(TCHAR);
+
+	// Load the existing cache file, if it's present.
+	FILE *f = _tfopen(m_filename.c_str(), _T("rb"));
+	if (!f) {
+		return;
+	}
+
+	VerifyCache_Header header;
+	vector<uint8_t> file_key;
+	vector<CacheEntry> entries(bankCount);
+	bool ok = (fread(&header, 1, sizeof(header), f) == sizeof(header) &&
+		!memcmp(header.magic, VERIFYCACHE_MAGIC, sizeof(header.magic)) &&
+		header.version == VERIFYCACHE_VERSION &&
+		header.entry_size == sizeof(CacheEntry) &&
+		header.bank_count == bankCount &&
+		header.key_size == key_size);
+	if (ok) {
+		// Make sure the device key matches in case of hash collisions.
+		file_key.resize(key_size);
+		ok = (fread(file_key.data(), 1, key_size, f) == key_size &&
+			!memcmp(file_key.data(), key8, key_size));
+	}
+	if (ok) {
+		ok = (fread(entries.data(), sizeof(CacheEntry), bankCount, f) == bankCount);
+	}
+	fclose(f);
+
+	if (ok) {
+		m_entries = std::move(entries);
+	}
+}
+
+/**
+ * Look up a verification result in the cache.
+ * @param bank		[in] Bank number.
+ * @param entry		[in] Bank entry
+ * @param content_hash	[in] SHA-1 of the TMD content hashes of all partitions
+ * @param flags		[in] Verification flags (a quick result only matches RVTH_VERIFY_QUICK, and a result that skipped known partitions only matches RVTH_VERIFY_QUICK or RVTH_VERIFY_SKIP_KNOWN_PARTITIONS)
+ * @param result	[out] Cached verification result
+ * @return True if the result was found; false if not.
+ */
+bool VerifyCache::lookup(unsigned int bank, const RvtH_BankEntry *entry,
+	const uint8_t content_hash[20], unsigned int flags,
+	RvtH_Verify_Cached_Result *result) const
+{
+	assert(bank < m_entries.size());
+	if (bank >= m_entries.size()) {
+		return false;
+	}
+
+	const CacheEntry &ce = m_entries[bank];
+	if (!ce.valid ||
+	    ce.lba_start != entry->lba_start ||
+	    ce.lba_len != entry->lba_len ||
+	    ce.timestamp != static_cast<int64_t>(entry->timestamp) ||
+	    ce.type != entry->type ||
+	    memcmp(ce.content_hash, content_hash, sizeof(ce.content_hash)) != 0)
+	{
+		// Not cached, or the bank has changed.
+		return false;
+	}
+
+	if ((ce.flags & RVTH_VERIFY_QUICK) && !(flags & RVTH_VERIFY_QUICK)) {
+		// Only a quick verification result is cached.
+		return false;
+	}
+	if ((ce.flags & RVTH_VERIFY_SKIP_KNOWN_PARTITIONS) &&
+	    !(flags & (RVTH_VERIFY_SKIP_KNOWN_PARTITIONS | RVTH_VERIFY_QUICK)))
+	{
+		// The cached result didn't check the user data of known partitions.
+		return false;
+	}
+
+	result->verify_time = static_cast<time_t>(ce.verify_time);
+	result->flags = ce.flags;
+	memcpy(result->error_count, ce.error_count, sizeof(result->error_count));
+	return true;
+}
+
+/**
+ * Store a verification result in the cache.
+ * @param bank		[in] Bank number.
+ * @param entry		[in] Bank entry
+ * @param content_hash	[in] SHA-1 of the TMD content hashes of all partitions
+ * @param result	[in] Verification result
+ */
+void VerifyCache::store(unsigned int bank, const RvtH_BankEntry *entry,
+	const uint8_t content_hash[20], const RvtH_Verify_Cached_Result *result)
+{
+	assert(bank < m_entries.size());
+	if (bank >= m_entries.size()) {
+		return;
+	}
+
+	CacheEntry &ce = m_entries[bank];
+	memset(&ce, 0, sizeof(ce));
+	ce.valid = 1;
+	ce.lba_start = entry->lba_start;
+	ce.lba_len = entry->lba_len;
+	ce.timestamp = static_cast<int64_t>(entry->timestamp);
+	ce.type = entry->type;
+	memcpy(ce.content_hash, content_hash, sizeof(ce.content_hash));
+	ce.flags = (result->flags & (RVTH_VERIFY_QUICK | RVTH_VERIFY_SKIP_KNOWN_PARTITIONS));
+	ce.verify_time = static_cast<int64_t>(result->verify_time);
+	memcpy(ce.error_count, result->error_count, sizeof(ce.error_count));
+	m_dirty = true;
+}
+
+/**
+ * Remove a verification result from the cache.
+ * @param bank		[in] Bank number.
+ */
+void VerifyCache::invalidate(unsigned int bank)
+{
+	assert(bank < m_entries.size());
+	if (bank >= m_entries.size() || !m_entries[bank].valid) {
+		return;
+	}
+
+	memset(&m_entries[bank], 0, sizeof(m_entries[bank]));
+	m_dirty = true;
+}
+
+/**
+ * Save the cache if it was modified.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int VerifyCache::save(void)
+{
+	if (!m_dirty) {
+		return 0;
+	} else if (m_filename.empty()) {
+		return -ENOENT;
+	}
+
+	VerifyCache_Header header;
+	memcpy(header.magic, VERIFYCACHE_MAGIC, sizeof(header.magic));
+	header.version = VERIFYCACHE_VERSION;
+	header.entry_size = sizeof(CacheEntry);
+	header.bank_count = static_cast<uint32_t>(m_entries.size());
+	header.key_size = static_cast<uint32_t>(m_key.size() * sizeof(TCHAR));
+
+	vector<uint8_t> data;
+	data.reserve(sizeof(header) + header.key_size + (m_entries.size() * sizeof(CacheEntry)));
+	const uint8_t *const p_header = reinterpret_cast<const uint8_t*>(&header);
+	const uint8_t *const p_key = reinterpret_cast<const uint8_t*>(m_key.data());
+	const uint8_t *const p_entries = reinterpret_cast<const uint8_t*>(m_entries.data());
+	data.insert(data.end(), p_header, p_header + sizeof(header));
+	data.insert(data.end(), p_key, p_key + header.key_size);
+	data.insert(data.end(), p_entries, p_entries + (m_entries.size() * sizeof(CacheEntry)));
+
+	int ret = rvth_write_cache_file(m_filename, data.data(), data.size());
+	if (ret != 0) {
+		return ret;
+	}
+
+	m_dirty = false;
+	return 0;
+}
@@ -0,0 +1,113 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * VerifyCache.hpp: Persistent cache for RVT-H bank verification results.  *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#pragma once
+
+#include "rvth.hpp"
+#include "tcharx.h"
+
+// C includes
+#include <stdint.h>
+
+// C++ includes
+#include <string>
+#include <vector>
+
+class RefFile;
+
+/**
+ * Persistent cache for RVT-H bank verification results.
+ *
+ * Verifying a bank reads and hashes the entire bank, but banks are
+ * rarely rewritten, so the results are cached in the user's cache
+ * directory.
+ *
+ * The cache file is selected by the device key, like BankCache.
+ * Each bank's result is only used if the bank's NHCD timestamp and
+ * location are unchanged, and if the SHA-1 of all of its partitions'
+ * TMD content hashes (H4) matches the one that was cached.
+ */
+class VerifyCache
+{
+	public:
+		VerifyCache();
+
+	private:
+		DISABLE_COPY(VerifyCache)
+
+	public:
+		/**
+		 * Load the verification cache for an RVT-H Reader or HDD image.
+		 * If the cache can't be loaded, all lookups will fail.
+		 * @param f_img		[in] RefFile*
+		 * @param bankCount	[in] Number of banks.
+		 */
+		void load(RefFile *f_img, unsigned int bankCount);
+
+		/**
+		 * Look up a verification result in the cache.
+		 * @param bank		[in] Bank number.
+		 * @param entry		[in] Bank entry
+		 * @param content_hash	[in] SHA-1 of the TMD content hashes of all partitions
+		 * @param flags		[in] Verification flags (a quick result only matches RVTH_VERIFY_QUICK, and a result that skipped known partitions only matches RVTH_VERIFY_QUICK or RVTH_VERIFY_SKIP_KNOWN_PARTITIONS)
+		 * @param result	[out] Cached verification result
+		 * @return True if the result was found; false if not.
+		 */
+		bool lookup(unsigned int bank, const RvtH_BankEntry *entry,
+			const uint8_t content_hash[20], unsigned int flags,
+			RvtH_Verify_Cached_Result *result) const;
+
+		/**
+		 * Store a verification result in the cache.
+		 * @param bank		[in] Bank number.
+		 * @param entry		[in] Bank entry
+		 * @param content_hash	[in] SHA-1 of the TMD content hashes of all partitions
+		 * @param result	[in] Verification result
+		 */
+		void store(unsigned int bank, const RvtH_BankEntry *entry,
+			const uint8_t content_hash[20], const RvtH_Verify_Cached_Result *result);
+
+		/**
+		 * Remove a verification result from the cache.
+		 * @param bank		[in] Bank number.
+		 */
+		void invalidate(unsigned int bank);
+
+		/**
+		 * Save the cache if it was modified.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int save(void);
+
+	public:
+		/**
+		 * Cached verification result.
+		 * Stored in host-endian.
+		 */
+		struct CacheEntry {
+			uint32_t valid;			// 1 if valid; 0 if not
+
+			// Bank entry. (key)
+			uint32_t lba_start;
+			uint32_t lba_len;
+			int64_t timestamp;
+			uint32_t type;
+			uint8_t content_hash[20];	// SHA-1 of all TMD content hashes
+
+			// Verification result.
+			uint32_t flags;			// Verification flags (RVTH_VERIFY_QUICK, RVTH_VERIFY_SKIP_KNOWN_PARTITIONS)
+			int64_t verify_time;		// Time of the verification
+			uint32_t error_count[5];
+		};
+
+	private:
+		std::tstring m_filename;	// Cache filename (empty if unavailable)
+		std::tstring m_key;		// Device key (serial number or filename, plus size)
+		std::vector<CacheEntry> m_entries;
+		bool m_dirty;
+};
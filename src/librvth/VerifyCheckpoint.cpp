@@ -0,0 +1,248 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * VerifyCheckpoint.cpp: Checkpoints for resumable verification.           *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "config.librvth.h"
+
+#include "VerifyCheckpoint.hpp"
+#include "cache_dir.hpp"
+
+// C includes (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+// C++ includes
+#include <string>
+#include <vector>
+using std::tstring;
+using std::vector;
+
+#define H3_DIGEST_SIZE 20
+
+// Checkpoint file header.
+// NOTE: Everything is stored in host-endian, so the version and
+// error size are checked to reject checkpoints from other builds.
+static const char VERIFYCKPT_MAGIC[8] = {'R','V','T','H','V','C','K','P'};
+static const uint32_t VERIFYCKPT_VERSION = 1;
+typedef struct _VerifyCheckpoint_Header {
+	char magic[8];		// VERIFYCKPT_MAGIC
+	uint32_t version;	// VERIFYCKPT_VERSION
+	uint32_t error_size;	// sizeof(VerifyCheckpoint::Error)
+	uint32_t key_size;	// Size of the device key that follows the header, in bytes
+	uint32_t flags;		// Verification flags
+
+	// Bank entry.
+	uint32_t lba_start;
+	uint32_t lba_len;
+	int64_t timestamp;
+	uint32_t type;
+	GCN_DiscHeader discHeader;
+
+	// Resume point.
+	uint32_t pt_idx;	// Current partition index
+	uint32_t group_cur;	// Number of groups verified in the current partition
+
+	uint32_t pt_count;	// Number of H3 table digests (pt_idx + 1)
+	uint32_t error_count;	// Number of errors
+} VerifyCheckpoint_Header;
+
+VerifyCheckpoint::VerifyCheckpoint()
+	: m_bank(0)
+	, m_flags(0)
+	, m_entry(nullptr)
+	, m_resume_pt_idx(~0U)
+	, m_resume_group(0)
+{ }
+
+/**
+ * Load the checkpoint for a bank.
+ * If the checkpoint doesn't match the bank, it's ignored.
+ * @param f_img		[in] RefFile*
+ * @param bank		[in] Bank number
+ * @param entry		[in] Bank entry
+ * @param flags		[in] Verification flags (must match the checkpoint)
+ */
+void VerifyCheckpoint::load(RefFile *f_img, unsigned int bank, const RvtH_BankEntry *entry, unsigned int flags)
+{
+	m_filename.clear();
+	m_key.clear();
+	m_bank = bank;
+	m_flags = flags;
+	m_entry = entry;
+	m_h3_digests.clear();
+	m_errors.clear();
+	m_resume_pt_idx = ~0U;
+	m_resume_group = 0;
+
+	m_key = rvth_get_device_key(f_img);
+	if (m_key.empty()) {
+		return;
+	}
+	TCHAR buf[32];
+	_sntprintf(buf, ARRAY_SIZE(buf), _T(":bank%u"), bank);
+	m_key += buf;
+	m_filename = rvth_get_cache_filename(m_key, _T(".vckp"));
+	if (m_filename.empty()) {
+		return;
+	}
+
+	// Load the existing checkpoint, if it's present.
+	FILE *f = _tfopen(m_filename.c_str(), _T("rb"));
+	if (!f) {
+		return;
+	}
+
+	const uint8_t *const key8 = reinterpret_cast<const uint8_t*>(m_key.data());
+	const size_t key_size = m_key.size() * sizeof(TCHAR);
+
+	VerifyCheckpoint_Header header;
+	vector<uint8_t> file_key;
+	vector<uint8_t> h3_digests;
+	vector<Error> errors;
+	bool ok = (fread(&header, 1, sizeof(header), f) == sizeof(header) &&
+		!memcmp(header.magic, VERIFYCKPT_MAGIC, sizeof(header.magic)) &&
+		header.version == VERIFYCKPT_VERSION &&
+		header.error_size == sizeof(Error) &&
+		header.key_size == key_size &&
+		header.flags == flags &&
+		header.lba_start == entry->lba_start &&
+		header.lba_len == entry->lba_len &&
+		header.timestamp == static_cast<int64_t>(entry->timestamp) &&
+		header.type == entry->type &&
+		!memcmp(&header.discHeader, &entry->discHeader, sizeof(header.discHeader)) &&
+		header.pt_count == header.pt_idx + 1 &&
+		header.pt_count <= entry->pt_count);
+	if (ok) {
+		// Make sure the device key matches in case of hash collisions.
+		file_key.resize(key_size);
+		ok = (fread(file_key.data(), 1, key_size, f) == key_size &&
+			!memcmp(file_key.data(), key8, key_size));
+	}
+	if (ok) {
+		h3_digests.resize(header.pt_count * H3_DIGEST_SIZE);
+		ok = (fread(h3_digests.data(), 1, h3_digests.size(), f) == h3_digests.size());
+	}
+	if (ok) {
+		errors.resize(header.error_count);
+		ok = (fread(errors.data(), sizeof(Error), errors.size(), f) == errors.size());
+	}
+	fclose(f);
+
+	if (ok) {
+		m_h3_digests = std::move(h3_digests);
+		m_errors = std::move(errors);
+		m_resume_pt_idx = header.pt_idx;
+		m_resume_group = header.group_cur;
+	}
+}
+
+/**
+ * Check if a partition's results from the checkpoint can be reused.
+ *
+ * Partitions must be checked in order. If a partition's H3 table
+ * has changed, the checkpoint is discarded from that partition on.
+ *
+ * @param pt_idx	[in] Partition index
+ * @param h3_digest	[in] SHA-1 of the partition's H3 table
+ * @param pGroupStart	[out] First group that still needs to be verified
+ * @return True if the partition's results can be reused; false if not.
+ */
+bool VerifyCheckpoint::resumePartition(unsigned int pt_idx, const uint8_t h3_digest[20], unsigned int *pGroupStart)
+{
+	*pGroupStart = 0;
+
+	bool resume = false;
+	if (m_resume_pt_idx != ~0U && pt_idx <= m_resume_pt_idx) {
+		assert(m_h3_digests.size() > pt_idx * H3_DIGEST_SIZE);
+		resume = !memcmp(&m_h3_digests[pt_idx * H3_DIGEST_SIZE], h3_digest, H3_DIGEST_SIZE);
+	}
+
+	if (!resume) {
+		// Nothing to resume, or the partition has changed.
+		// Discard the checkpoint from this partition on.
+		m_resume_pt_idx = ~0U;
+		for (auto iter = m_errors.begin(); iter != m_errors.end(); ++iter) {
+			if (iter->pt_idx >= pt_idx) {
+				m_errors.erase(iter, m_errors.end());
+				break;
+			}
+		}
+	} else if (pt_idx == m_resume_pt_idx) {
+		*pGroupStart = m_resume_group;
+	} else {
+		// Partition was completely verified.
+		*pGroupStart = ~0U;
+	}
+
+	// Save the H3 table digest.
+	m_h3_digests.resize(pt_idx * H3_DIGEST_SIZE);
+	m_h3_digests.insert(m_h3_digests.end(), h3_digest, h3_digest + H3_DIGEST_SIZE);
+	return resume;
+}
+
+/**
+ * Save the checkpoint.
+ * @param pt_idx	[in] Current partition index
+ * @param group_cur	[in] Number of groups in the current partition that have been verified
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int VerifyCheckpoint::save(unsigned int pt_idx, unsigned int group_cur)
+{
+	if (m_filename.empty() || !m_entry) {
+		return -ENOENT;
+	}
+	// NOTE: Partitions after the current one may have been checked
+	// already, since all partitions are prepared before verification.
+	// Only the digests up to the current partition are saved.
+	const size_t h3_digests_size = (pt_idx + 1) * H3_DIGEST_SIZE;
+	assert(m_h3_digests.size() >= h3_digests_size);
+	if (m_h3_digests.size() < h3_digests_size) {
+		return -EINVAL;
+	}
+
+	VerifyCheckpoint_Header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, VERIFYCKPT_MAGIC, sizeof(header.magic));
+	header.version = VERIFYCKPT_VERSION;
+	header.error_size = sizeof(Error);
+	header.key_size = static_cast<uint32_t>(m_key.size() * sizeof(TCHAR));
+	header.flags = m_flags;
+	header.lba_start = m_entry->lba_start;
+	header.lba_len = m_entry->lba_len;
+	header.timestamp = static_cast<int64_t>(m_entry->timestamp);
+	header.type = m_entry->type;
+	memcpy(&header.discHeader, &m_entry->discHeader, sizeof(header.discHeader));
+	header.pt_idx = pt_idx;
+	header.group_cur = group_cur;
+	header.pt_count = pt_idx + 1;
+	header.error_count = static_cast<uint32_t>(m_errors.size());
+
+	vector<uint8_t> data;
+	data.reserve(sizeof(header) + header.key_size + h3_digests_size + (m_errors.size() * sizeof(Error)));
+	const uint8_t *const p_header = reinterpret_cast<const uint8_t*>(&header);
+	const uint8_t *const p_key = reinterpret_cast<const uint8_t*>(m_key.data());
+	const uint8_t *const p_errors = reinterpret_cast<const uint8_t*>(m_errors.data());
+	data.insert(data.end(), p_header, p_header + sizeof(header));
+	data.insert(data.end(), p_key, p_key + header.key_size);
+	data.insert(data.end(), m_h3_digests.begin(), m_h3_digests.begin() + h3_digests_size);
+	data.insert(data.end(), p_errors, p_errors + (m_errors.size() * sizeof(Error)));
+
+	return rvth_write_cache_file(m_filename, data.data(), data.size());
+}
+
+/**
+ * Delete the checkpoint file.
+ * This should be done once verification has finished.
+ */
+void VerifyCheckpoint::remove(void)
+{
+	if (!m_filename.empty()) {
+		::_tremove(m_filename.c_str());
+	}
+}
@@ -0,0 +1,131 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * VerifyCheckpoint.hpp: Checkpoints for resumable verification.           *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#pragma once
+
+#include "rvth.hpp"
+#include "tcharx.h"
+
+// C includes
+#include <stdint.h>
+
+// C++ includes
+#include <string>
+#include <vector>
+
+class RefFile;
+
+/**
+ * Checkpoint for resumable verification.
+ *
+ * Verifying a dual-layer bank on an RVT-H Reader connected over USB 2.0
+ * takes a long time. The checkpoint stores the current partition and
+ * group, along with all errors reported so far, so verification can be
+ * resumed if it's interrupted.
+ *
+ * Checkpoints are stored in the user's cache directory, and are selected
+ * by the device key and bank number. A checkpoint is only used if the
+ * bank entry is unchanged, and each partition's results are only reused
+ * if its H3 table is unchanged.
+ */
+class VerifyCheckpoint
+{
+	public:
+		VerifyCheckpoint();
+
+	private:
+		DISABLE_COPY(VerifyCheckpoint)
+
+	public:
+		/**
+		 * Error report.
+		 * Stored in host-endian.
+		 */
+		struct Error {
+			uint32_t pt_idx;	// Partition index
+			uint32_t group;		// Group index (0 for H4)
+			uint8_t hash_level;	// 0, 1, 2, 3, 4
+			uint8_t sector;		// Sector 0-63 in the group
+			uint8_t kb;		// Kilobyte 1-31 (H0 only)
+			uint8_t err_type;	// Error type (see RvtH_Verify_Error_Type)
+			uint8_t is_zero;	// 1 if the sector is zeroed
+			uint8_t reserved[3];
+		};
+
+		/**
+		 * Load the checkpoint for a bank.
+		 * If the checkpoint doesn't match the bank, it's ignored.
+		 * @param f_img		[in] RefFile*
+		 * @param bank		[in] Bank number
+		 * @param entry		[in] Bank entry
+		 * @param flags		[in] Verification flags (must match the checkpoint)
+		 */
+		void load(RefFile *f_img, unsigned int bank, const RvtH_BankEntry *entry, unsigned int flags);
+
+		/**
+		 * Check if a partition's results from the checkpoint can be reused.
+		 *
+		 * Partitions must be checked in order. If a partition's H3 table
+		 * has changed, the checkpoint is discarded from that partition on.
+		 *
+		 * @param pt_idx	[in] Partition index
+		 * @param h3_digest	[in] SHA-1 of the partition's H3 table
+		 * @param pGroupStart	[out] First group that still needs to be verified
+		 * @return True if the partition's results can be reused; false if not.
+		 */
+		bool resumePartition(unsigned int pt_idx, const uint8_t h3_digest[20], unsigned int *pGroupStart);
+
+		/**
+		 * Get all errors in the checkpoint.
+		 * @return Errors, in partition and group order.
+		 */
+		const std::vector<Error> &errors(void) const
+		{
+			return m_errors;
+		}
+
+		/**
+		 * Add an error report.
+		 * @param err		[in] Error report
+		 */
+		void addError(const Error &err)
+		{
+			m_errors.push_back(err);
+		}
+
+		/**
+		 * Save the checkpoint.
+		 * @param pt_idx	[in] Current partition index
+		 * @param group_cur	[in] Number of groups in the current partition that have been verified
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int save(unsigned int pt_idx, unsigned int group_cur);
+
+		/**
+		 * Delete the checkpoint file.
+		 * This should be done once verification has finished.
+		 */
+		void remove(void);
+
+	private:
+		std::tstring m_filename;	// Checkpoint filename (empty if unavailable)
+		std::tstring m_key;		// Device key, plus the bank number
+
+		// Bank entry. (key)
+		unsigned int m_bank;
+		unsigned int m_flags;
+		const RvtH_BankEntry *m_entry;
+
+		// H3 table digests for all partitions that have been checked.
+		std::vector<uint8_t> m_h3_digests;
+		std::vector<Error> m_errors;
+
+		// Resume point. (~0U if there's nothing to resume.)
+		unsigned int m_resume_pt_idx;
+		unsigned int m_resume_group;
+};
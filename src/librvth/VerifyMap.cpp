@@ -0,0 +1,444 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * VerifyMap.cpp: Persistent per-group verification status.               *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "config.librvth.h"
+
+#include "VerifyMap.hpp"
+#include "cache_dir.hpp"
+#include "nhcd_structs.h"
+
+#include "libwiicrypto/wii_sector.h"
+
+// C includes (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+// C++ includes
+#include <algorithm>
+#include <string>
+#include <vector>
+using std::tstring;
+using std::vector;
+
+const unsigned int VerifyMap::KEY_HASH_SIZE;
+
+// Map file header.
+// NOTE: Records are stored in host-endian, so the record sizes
+// and version are checked to reject maps from other builds.
+static const char VERIFYMAP_MAGIC[8] = {'R','V','T','H','V','M','A','P'};
+static const uint32_t VERIFYMAP_VERSION = 1;
+typedef struct _VerifyMap_Header {
+	char magic[8];		// VERIFYMAP_MAGIC
+	uint32_t version;	// VERIFYMAP_VERSION
+	uint32_t record_sizes;	// sizeof(VerifyMap_BankRecord) << 16 | sizeof(VerifyMap_PartitionRecord)
+	uint32_t bank_count;	// Number of bank records
+	uint32_t key_size;	// Size of the device key that follows the header, in bytes
+} VerifyMap_Header;
+
+// Bank record. Followed by pt_count partition records.
+typedef struct _VerifyMap_BankRecord {
+	int64_t timestamp;
+	uint32_t lba_start;
+	uint32_t lba_len;
+	uint32_t type;
+	uint32_t pt_count;	// 0 if the bank has no map
+} VerifyMap_BankRecord;
+
+// Partition record. Followed by the group status bits.
+typedef struct _VerifyMap_PartitionRecord {
+	uint32_t lba_data;
+	uint32_t group_count;
+	uint8_t key_hash[VerifyMap::KEY_HASH_SIZE];
+} VerifyMap_PartitionRecord;
+
+static const uint32_t VERIFYMAP_RECORD_SIZES =
+	(static_cast<uint32_t>(sizeof(VerifyMap_BankRecord)) << 16) |
+	 static_cast<uint32_t>(sizeof(VerifyMap_PartitionRecord));
+
+// Number of LBAs per 2 MB group.
+#define LBAS_PER_GROUP BYTES_TO_LBA(GROUP_SIZE_ENC)
+
+// Sanity limits for loading the map.
+static const uint32_t VERIFYMAP_MAX_PARTITIONS = 4*32;
+static const uint32_t VERIFYMAP_MAX_GROUPS = 8192;
+
+/**
+ * Get the size of the status bits for a partition.
+ * @param group_count	[in] Number of groups
+ * @return Size, in bytes.
+ */
+static inline size_t bits_size(uint32_t group_count)
+{
+	return (group_count + 3) / 4;
+}
+
+VerifyMap::VerifyMap()
+	: m_dirty(false)
+{ }
+
+/**
+ * Does a bank's map belong to a bank entry?
+ * @param b	[in] Bank map
+ * @param entry	[in] Bank entry
+ * @return True if it does.
+ */
+bool VerifyMap::matches(const Bank &b, const RvtH_BankEntry *entry)
+{
+	return b.valid &&
+		b.lba_start == entry->lba_start &&
+		b.lba_len == entry->lba_len &&
+		b.timestamp == static_cast<int64_t>(entry->timestamp) &&
+		b.type == entry->type;
+}
+
+/**
+ * Set a bank map's key from a bank entry.
+ * @param b	[in,out] Bank map
+ * @param entry	[in] Bank entry
+ */
+void VerifyMap::setKey(Bank &b, const RvtH_BankEntry *entry)
+{
+	b.valid = true;
+	b.lba_start = entry->lba_start;
+	b.lba_len = entry->lba_len;
+	b.timestamp = static_cast<int64_t>(entry->timestamp);
+	b.type = entry->type;
+}
+
+/**
+ * Load the verification map for an RVT-H Reader or HDD image.
+ * If the map can't be loaded, all lookups will fail.
+ * @param f_img		[in] RefFile*
+ * @param bankCount	[in] Number of banks.
+ */
+void VerifyMap::load(RefFile *f_img, unsigned int bankCount)
+{
+	m_filename.clear();
+	m_key.clear();
+	m_banks.assign(bankCount, Bank());
+	for (Bank &b : m_banks) {
+		b.valid = false;
+		b.tracking = false;
+	}
+	m_dirty = false;
+
+	m_key = rvth_get_device_key(f_img);
+	if (m_key.empty()) {
+		return;
+	}
+	m_filename = rvth_get_cache_filename(m_key, _T(".vmap"));
+	if (m_filename.empty()) {
+		return;
+	}
+	const uint8_t *const key8 = reinterpret_cast<const uint8_t*>(m_key.data());
+	const size_t key_size = m_key.size() * sizeof(TCHAR);
+
+	// Load the existing map file, if it's present.
+	FILE *f = _tfopen(m_filename.c_str(), _T("rb"));
+	if (!f) {
+		return;
+	}
+
+	VerifyMap_Header header;
+	vector<uint8_t> file_key;
+	bool ok = (fread(&header, 1, sizeof(header), f) == sizeof(header) &&
+		!memcmp(header.magic, VERIFYMAP_MAGIC, sizeof(header.magic)) &&
+		header.version == VERIFYMAP_VERSION &&
+		header.record_sizes == VERIFYMAP_RECORD_SIZES &&
+		header.bank_count == bankCount &&
+		header.key_size == key_size);
+	if (ok) {
+		// Make sure the device key matches in case of hash collisions.
+		file_key.resize(key_size);
+		ok = (fread(file_key.data(), 1, key_size, f) == key_size &&
+			!memcmp(file_key.data(), key8, key_size));
+	}
+
+	vector<Bank> banks(bankCount);
+	for (unsigned int bank = 0; ok && bank < bankCount; bank++) {
+		VerifyMap_BankRecord br;
+		ok = (fread(&br, 1, sizeof(br), f) == sizeof(br) &&
+			br.pt_count <= VERIFYMAP_MAX_PARTITIONS);
+		if (!ok)
+			break;
+
+		Bank &b = banks[bank];
+		b.valid = (br.pt_count > 0);
+		b.lba_start = br.lba_start;
+		b.lba_len = br.lba_len;
+		b.timestamp = br.timestamp;
+		b.type = br.type;
+		b.tracking = false;
+		b.partitions.resize(br.pt_count);
+		for (Partition &pt : b.partitions) {
+			VerifyMap_PartitionRecord pr;
+			ok = (fread(&pr, 1, sizeof(pr), f) == sizeof(pr) &&
+				pr.group_count <= VERIFYMAP_MAX_GROUPS);
+			if (!ok)
+				break;
+
+			pt.lba_data = pr.lba_data;
+			pt.group_count = pr.group_count;
+			memcpy(pt.key_hash, pr.key_hash, sizeof(pt.key_hash));
+			pt.bits.resize(bits_size(pr.group_count));
+			ok = (fread(pt.bits.data(), 1, pt.bits.size(), f) == pt.bits.size());
+			if (!ok)
+				break;
+		}
+	}
+	fclose(f);
+
+	if (ok) {
+		m_banks = std::move(banks);
+	}
+}
+
+/**
+ * Get the group status of a partition.
+ * @param bank		[in] Bank number.
+ * @param entry		[in] Bank entry
+ * @param lba_data	[in] LBA of the partition's first group, relative to the bank
+ * @param group_count	[in] Number of groups
+ * @param key_hash	[in] Hash of the partition's title key
+ * @param status	[out] Status of each group (GroupStatus)
+ * @return True if the partition was found; false if not.
+ */
+bool VerifyMap::getGroups(unsigned int bank, const RvtH_BankEntry *entry,
+	uint32_t lba_data, uint32_t group_count, const uint8_t key_hash[KEY_HASH_SIZE],
+	vector<uint8_t> &status) const
+{
+	assert(bank < m_banks.size());
+	if (bank >= m_banks.size() || !matches(m_banks[bank], entry)) {
+		// No map, or the bank has changed.
+		return false;
+	}
+
+	for (const Partition &pt : m_banks[bank].partitions) {
+		if (pt.lba_data != lba_data || pt.group_count != group_count ||
+		    memcmp(pt.key_hash, key_hash, sizeof(pt.key_hash)) != 0)
+		{
+			continue;
+		}
+
+		status.resize(group_count);
+		for (uint32_t g = 0; g < group_count; g++) {
+			status[g] = (pt.bits[g / 4] >> ((g % 4) * 2)) & 3;
+		}
+		return true;
+	}
+
+	// Partition not found.
+	return false;
+}
+
+/**
+ * Set the group status of a partition.
+ * If the bank's map is for a different bank entry, it's discarded.
+ * @param bank		[in] Bank number.
+ * @param entry		[in] Bank entry
+ * @param lba_data	[in] LBA of the partition's first group, relative to the bank
+ * @param group_count	[in] Number of groups
+ * @param key_hash	[in] Hash of the partition's title key
+ * @param status	[in] Status of each group (GroupStatus)
+ */
+void VerifyMap::setGroups(unsigned int bank, const RvtH_BankEntry *entry,
+	uint32_t lba_data, uint32_t group_count, const uint8_t key_hash[KEY_HASH_SIZE],
+	const vector<uint8_t> &status)
+{
+	assert(bank < m_banks.size());
+	assert(status.size() >= group_count);
+	if (bank >= m_banks.size() || group_count > VERIFYMAP_MAX_GROUPS) {
+		return;
+	}
+
+	Bank &b = m_banks[bank];
+	if (!matches(b, entry)) {
+		// Start a new map for this bank.
+		b.partitions.clear();
+		b.tracking = false;
+		setKey(b, entry);
+	}
+
+	// Find the partition, or add it if it isn't in the map.
+	auto iter = std::find_if(b.partitions.begin(), b.partitions.end(),
+		[lba_data](const Partition &pt) { return pt.lba_data == lba_data; });
+	if (iter == b.partitions.end()) {
+		if (b.partitions.size() >= VERIFYMAP_MAX_PARTITIONS) {
+			return;
+		}
+		b.partitions.emplace_back();
+		iter = b.partitions.end() - 1;
+	}
+
+	Partition &pt = *iter;
+	pt.lba_data = lba_data;
+	pt.group_count = group_count;
+	memcpy(pt.key_hash, key_hash, sizeof(pt.key_hash));
+	pt.bits.assign(bits_size(group_count), 0);
+	for (uint32_t g = 0; g < group_count; g++) {
+		pt.bits[g / 4] |= (status[g] & 3) << ((g % 4) * 2);
+	}
+	m_dirty = true;
+}
+
+/**
+ * Start tracking writes to a bank.
+ * If the bank's map is for a different bank entry, it's discarded.
+ * @param bank		[in] Bank number.
+ * @param entry		[in] Bank entry, before anything is written
+ */
+void VerifyMap::beginWrite(unsigned int bank, const RvtH_BankEntry *entry)
+{
+	assert(bank < m_banks.size());
+	if (bank >= m_banks.size()) {
+		return;
+	}
+
+	Bank &b = m_banks[bank];
+	if (matches(b, entry)) {
+		b.tracking = true;
+	} else if (b.valid) {
+		b.valid = false;
+		b.tracking = false;
+		b.partitions.clear();
+		m_dirty = true;
+	}
+}
+
+/**
+ * Mark a range of a bank as written.
+ * The groups that overlap the range will be verified again.
+ * @param bank		[in] Bank number.
+ * @param lba_start	[in] Starting LBA, relative to the bank
+ * @param lba_len	[in] Length, in LBAs
+ */
+void VerifyMap::markWritten(unsigned int bank, uint32_t lba_start, uint32_t lba_len)
+{
+	assert(bank < m_banks.size());
+	if (bank >= m_banks.size() || !m_banks[bank].valid || lba_len == 0) {
+		return;
+	}
+
+	const uint64_t lba_end = static_cast<uint64_t>(lba_start) + lba_len;
+	for (Partition &pt : m_banks[bank].partitions) {
+		const uint64_t pt_end = pt.lba_data + (static_cast<uint64_t>(pt.group_count) * LBAS_PER_GROUP);
+		if (lba_end <= pt.lba_data || lba_start >= pt_end) {
+			continue;
+		}
+
+		const uint32_t g_first = (lba_start > pt.lba_data)
+			? (lba_start - pt.lba_data) / LBAS_PER_GROUP
+			: 0;
+		const uint32_t g_last = static_cast<uint32_t>(
+			(std::min(lba_end, pt_end) - pt.lba_data - 1) / LBAS_PER_GROUP);
+		for (uint32_t g = g_first; g <= g_last; g++) {
+			pt.bits[g / 4] &= ~(3 << ((g % 4) * 2));
+		}
+		m_dirty = true;
+	}
+}
+
+/**
+ * Stop tracking writes to a bank.
+ * If the bank table entry wasn't written, the bank's map is kept
+ * for the current bank entry, with the written groups marked.
+ * @param bank		[in] Bank number.
+ */
+void VerifyMap::endWrite(unsigned int bank)
+{
+	assert(bank < m_banks.size());
+	if (bank >= m_banks.size()) {
+		return;
+	}
+	m_banks[bank].tracking = false;
+}
+
+/**
+ * A bank table entry was written.
+ * If writes to the bank were being tracked, the bank's map is
+ * moved to the new bank entry. Otherwise, it's discarded.
+ * @param bank		[in] Bank number.
+ * @param entry		[in] New bank entry
+ */
+void VerifyMap::bankWritten(unsigned int bank, const RvtH_BankEntry *entry)
+{
+	assert(bank < m_banks.size());
+	if (bank >= m_banks.size() || !m_banks[bank].valid) {
+		return;
+	}
+
+	Bank &b = m_banks[bank];
+	if (b.tracking) {
+		setKey(b, entry);
+		b.tracking = false;
+	} else {
+		b.valid = false;
+		b.partitions.clear();
+	}
+	m_dirty = true;
+}
+
+/**
+ * Save the map if it was modified.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int VerifyMap::save(void)
+{
+	if (!m_dirty) {
+		return 0;
+	} else if (m_filename.empty()) {
+		return -ENOENT;
+	}
+
+	VerifyMap_Header header;
+	memcpy(header.magic, VERIFYMAP_MAGIC, sizeof(header.magic));
+	header.version = VERIFYMAP_VERSION;
+	header.record_sizes = VERIFYMAP_RECORD_SIZES;
+	header.bank_count = static_cast<uint32_t>(m_banks.size());
+	header.key_size = static_cast<uint32_t>(m_key.size() * sizeof(TCHAR));
+
+	vector<uint8_t> data;
+	auto append = [&data](const void *p, size_t size) {
+		const uint8_t *const p8 = static_cast<const uint8_t*>(p);
+		data.insert(data.end(), p8, p8 + size);
+	};
+	append(&header, sizeof(header));
+	append(m_key.data(), header.key_size);
+	for (const Bank &b : m_banks) {
+		VerifyMap_BankRecord br;
+		memset(&br, 0, sizeof(br));
+		if (b.valid && !b.partitions.empty()) {
+			br.timestamp = b.timestamp;
+			br.lba_start = b.lba_start;
+			br.lba_len = b.lba_len;
+			br.type = b.type;
+			br.pt_count = static_cast<uint32_t>(b.partitions.size());
+		}
+		append(&br, sizeof(br));
+
+		for (unsigned int i = 0; i < br.pt_count; i++) {
+			const Partition &pt = b.partitions[i];
+			VerifyMap_PartitionRecord pr;
+			pr.lba_data = pt.lba_data;
+			pr.group_count = pt.group_count;
+			memcpy(pr.key_hash, pt.key_hash, sizeof(pr.key_hash));
+			append(&pr, sizeof(pr));
+			append(pt.bits.data(), pt.bits.size());
+		}
+	}
+
+	int ret = rvth_write_cache_file(m_filename, data.data(), data.size());
+	if (ret != 0) {
+		return ret;
+	}
+
+	m_dirty = false;
+	return 0;
+}
@@ -0,0 +1,179 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * VerifyMap.hpp: Persistent per-group verification status.               *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#pragma once
+
+#include "rvth.hpp"
+#include "tcharx.h"
+
+// C includes
+#include <stdint.h>
+
+// C++ includes
+#include <string>
+#include <vector>
+
+class RefFile;
+
+/**
+ * Persistent per-group verification status for RVT-H banks.
+ *
+ * VerifyCache only has a result for the whole bank, so any change to
+ * the bank means verifying all of it again. This map has the result of
+ * each 2 MB group of each partition, stored as 2 bits per group, so a
+ * later verification only has to check the groups that were written or
+ * had errors since the last one.
+ *
+ * Like VerifyCache, the map is selected by the device key, and a bank's
+ * map is only used if its NHCD timestamp and location are unchanged.
+ * librvth keeps the map valid across its own writes to a bank if they
+ * are tracked: beginWrite() before writing anything, markWritten() for
+ * each range of group data that was written, and then bankWritten()
+ * once the bank table entry is written. Untracked writes to a bank
+ * discard its map.
+ *
+ * Each partition is identified by the location of its group data, the
+ * group count, and a hash of the decrypted title key.
+ */
+class VerifyMap
+{
+	public:
+		VerifyMap();
+
+	private:
+		DISABLE_COPY(VerifyMap)
+
+	public:
+		// Group status.
+		enum GroupStatus : uint8_t {
+			GROUP_UNKNOWN	= 0,	// Not verified, or written since it was verified
+			GROUP_CLEAN	= 1,	// No errors
+			GROUP_BAD	= 2,	// Errors
+			GROUP_ZEROED	= 3,	// No errors; the group is encrypted zeroes
+		};
+
+		// Size of the title key hash.
+		static const unsigned int KEY_HASH_SIZE = 8;
+
+		/**
+		 * Load the verification map for an RVT-H Reader or HDD image.
+		 * If the map can't be loaded, all lookups will fail.
+		 * @param f_img		[in] RefFile*
+		 * @param bankCount	[in] Number of banks.
+		 */
+		void load(RefFile *f_img, unsigned int bankCount);
+
+		/**
+		 * Get the group status of a partition.
+		 * @param bank		[in] Bank number.
+		 * @param entry		[in] Bank entry
+		 * @param lba_data	[in] LBA of the partition's first group, relative to the bank
+		 * @param group_count	[in] Number of groups
+		 * @param key_hash	[in] Hash of the partition's title key
+		 * @param status	[out] Status of each group (GroupStatus)
+		 * @return True if the partition was found; false if not.
+		 */
+		bool getGroups(unsigned int bank, const RvtH_BankEntry *entry,
+			uint32_t lba_data, uint32_t group_count, const uint8_t key_hash[KEY_HASH_SIZE],
+			std::vector<uint8_t> &status) const;
+
+		/**
+		 * Set the group status of a partition.
+		 * If the bank's map is for a different bank entry, it's discarded.
+		 * @param bank		[in] Bank number.
+		 * @param entry		[in] Bank entry
+		 * @param lba_data	[in] LBA of the partition's first group, relative to the bank
+		 * @param group_count	[in] Number of groups
+		 * @param key_hash	[in] Hash of the partition's title key
+		 * @param status	[in] Status of each group (GroupStatus)
+		 */
+		void setGroups(unsigned int bank, const RvtH_BankEntry *entry,
+			uint32_t lba_data, uint32_t group_count, const uint8_t key_hash[KEY_HASH_SIZE],
+			const std::vector<uint8_t> &status);
+
+		/**
+		 * Start tracking writes to a bank.
+		 * If the bank's map is for a different bank entry, it's discarded.
+		 * @param bank		[in] Bank number.
+		 * @param entry		[in] Bank entry, before anything is written
+		 */
+		void beginWrite(unsigned int bank, const RvtH_BankEntry *entry);
+
+		/**
+		 * Mark a range of a bank as written.
+		 * The groups that overlap the range will be verified again.
+		 * @param bank		[in] Bank number.
+		 * @param lba_start	[in] Starting LBA, relative to the bank
+		 * @param lba_len	[in] Length, in LBAs
+		 */
+		void markWritten(unsigned int bank, uint32_t lba_start, uint32_t lba_len);
+
+		/**
+		 * Stop tracking writes to a bank.
+		 * If the bank table entry wasn't written, the bank's map is kept
+		 * for the current bank entry, with the written groups marked.
+		 * @param bank		[in] Bank number.
+		 */
+		void endWrite(unsigned int bank);
+
+		/**
+		 * A bank table entry was written.
+		 * If writes to the bank were being tracked, the bank's map is
+		 * moved to the new bank entry. Otherwise, it's discarded.
+		 * @param bank		[in] Bank number.
+		 * @param entry		[in] New bank entry
+		 */
+		void bankWritten(unsigned int bank, const RvtH_BankEntry *entry);
+
+		/**
+		 * Save the map if it was modified.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int save(void);
+
+	private:
+		struct Partition {
+			uint32_t lba_data;		// LBA of the first group, relative to the bank
+			uint32_t group_count;		// Number of groups
+			uint8_t key_hash[KEY_HASH_SIZE];	// Hash of the title key
+			std::vector<uint8_t> bits;	// 2 bits per group (GroupStatus)
+		};
+
+		struct Bank {
+			// Bank entry. (key)
+			bool valid;
+			uint32_t lba_start;
+			uint32_t lba_len;
+			int64_t timestamp;
+			uint32_t type;
+
+			bool tracking;			// Writes are being tracked (not saved)
+			std::vector<Partition> partitions;
+		};
+
+		/**
+		 * Does a bank's map belong to a bank entry?
+		 * @param b	[in] Bank map
+		 * @param entry	[in] Bank entry
+		 * @return True if it does.
+		 */
+		static bool matches(const Bank &b, const RvtH_BankEntry *entry);
+
+		/**
+		 * Set a bank map's key from a bank entry.
+		 * @param b	[in,out] Bank map
+		 * @param entry	[in] Bank entry
+		 */
+		static void setKey(Bank &b, const RvtH_BankEntry *entry);
+
+	private:
+		std::tstring m_filename;	// Map filename (empty if unavailable)
+		std::tstring m_key;		// Device key (serial number or filename, plus size)
+		std::vector<Bank> m_banks;
+		bool m_dirty;
+};
@@ -0,0 +1,366 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * VirtualFS.cpp: Read-only virtual filesystem view of an RVT-H image.     *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "VirtualFS.hpp"
+#include "BankFileSystem.hpp"
+
+// For LBA_TO_BYTES()
+#include "nhcd_structs.h"
+
+// Reader class
+#include "reader/Reader.hpp"
+
+// C includes (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+// C++ includes
+#include <mutex>
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+// Bounce buffer size for disc image reads.
+static constexpr uint32_t GCM_BUF_SIZE = 1024U * 1024U;
+
+struct VirtualFS::Bank {
+	unsigned int bank;		// Bank number (0-based)
+	string name;			// Directory name, e.g. "bank1"
+	Reader *reader;			// Bank reader
+	uint64_t size;			// Disc image size, in bytes
+	time_t timestamp;		// Bank timestamp (-1 if unknown)
+
+	std::mutex mutex;		// Serializes access to this bank
+	bool fs_opened;			// True if opening the filesystem was attempted
+	int fs_err;			// Error from opening the filesystem
+	unique_ptr<BankFileSystem> fs;	// Bank filesystem
+	unique_ptr<uint8_t[]> gcm_buf;	// Bounce buffer for disc image reads
+};
+
+/**
+ * Create a virtual filesystem view.
+ * @param rvth		[in] RvtH object. (Must remain open while this object exists.)
+ * @param cache_groups	[in] Number of decrypted groups to cache per bank.
+ */
+VirtualFS::VirtualFS(RvtH *rvth, unsigned int cache_groups)
+	: m_rvth(rvth)
+	, m_cache_groups(cache_groups)
+{
+	assert(rvth != nullptr);
+
+	const unsigned int bank_count = rvth->bankCount();
+	for (unsigned int i = 0; i < bank_count; i++) {
+		const RvtH_BankEntry *const entry = rvth->bankEntry(i);
+		if (!entry || !entry->reader || entry->lba_len == 0 || entry->is_deleted) {
+			continue;
+		}
+		switch (entry->type) {
+			case RVTH_BankType_GCN:
+			case RVTH_BankType_Wii_SL:
+			case RVTH_BankType_Wii_DL:
+				break;
+			default:
+				continue;
+		}
+
+		unique_ptr<Bank> bank(new Bank);
+		char name[16];
+		snprintf(name, sizeof(name), "bank%u", i + 1);
+		bank->bank = i;
+		bank->name = name;
+		bank->reader = entry->reader;
+		bank->size = LBA_TO_BYTES(entry->lba_len);
+		bank->timestamp = entry->timestamp;
+		bank->fs_opened = false;
+		bank->fs_err = 0;
+		m_banks.push_back(std::move(bank));
+	}
+}
+
+VirtualFS::~VirtualFS()
+{ }
+
+/**
+ * Parse a path.
+ * @param path		[in] Absolute path.
+ * @param pBank		[out] Bank, or nullptr for the root directory.
+ * @param is_gcm	[out] True if the path is the bank's disc image.
+ * @param fs_path	[out] Path within the bank's filesystem. (empty for the bank's root directory)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int VirtualFS::parsePath(const char *path, Bank **pBank, bool *is_gcm, string &fs_path)
+{
+	assert(path != nullptr);
+	while (*path == '/') {
+		path++;
+	}
+	*pBank = nullptr;
+	*is_gcm = false;
+	fs_path.clear();
+	if (*path == '\0') {
+		// Root directory.
+		return 0;
+	}
+
+	const char *const slash = strchr(path, '/');
+	const string name = (slash ? string(path, slash - path) : string(path));
+	for (const unique_ptr<Bank> &bank : m_banks) {
+		if (name == bank->name) {
+			*pBank = bank.get();
+			if (slash) {
+				fs_path = slash + 1;
+				while (!fs_path.empty() && fs_path.back() == '/') {
+					fs_path.pop_back();
+				}
+			}
+			return 0;
+		} else if (!slash && name.size() == bank->name.size() + 4 &&
+		           !name.compare(0, bank->name.size(), bank->name) &&
+		           !name.compare(bank->name.size(), 4, ".gcm"))
+		{
+			*pBank = bank.get();
+			*is_gcm = true;
+			return 0;
+		}
+	}
+
+	return -ENOENT;
+}
+
+/**
+ * Open a bank's filesystem if it isn't open yet.
+ * NOTE: The bank's mutex must be held by the caller.
+ * @param bank	[in] Bank.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int VirtualFS::openBankFS(Bank *bank)
+{
+	if (!bank->fs_opened) {
+		BankFileSystem *fs = nullptr;
+		int ret = m_rvth->openFileSystem(bank->bank, &fs, m_cache_groups);
+		if (ret > 0) {
+			// RvtH_Errors: The bank doesn't have a readable filesystem.
+			ret = -EIO;
+		}
+		bank->fs.reset(fs);
+		bank->fs_err = ret;
+		bank->fs_opened = true;
+	}
+	return bank->fs_err;
+}
+
+/**
+ * Get the attributes of a file or directory.
+ * @param path	[in] Absolute path.
+ * @param st	[out] Attributes.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int VirtualFS::stat(const char *path, Stat *st)
+{
+	Bank *bank;
+	bool is_gcm;
+	string fs_path;
+	int ret = parsePath(path, &bank, &is_gcm, fs_path);
+	if (ret != 0) {
+		return ret;
+	}
+
+	st->mtime = -1;
+	if (!bank) {
+		// Root directory.
+		st->is_dir = true;
+		st->size = 0;
+		return 0;
+	}
+
+	st->mtime = bank->timestamp;
+	if (is_gcm) {
+		st->is_dir = false;
+		st->size = bank->size;
+		return 0;
+	} else if (fs_path.empty()) {
+		// Bank directory. The filesystem isn't opened until it's listed.
+		st->is_dir = true;
+		st->size = 0;
+		return 0;
+	}
+
+	std::lock_guard<std::mutex> lock(bank->mutex);
+	ret = openBankFS(bank);
+	if (ret != 0) {
+		return ret;
+	}
+	const RvtH_FST_File *const file = bank->fs->find(fs_path.c_str());
+	if (!file) {
+		return -ENOENT;
+	}
+	st->is_dir = file->is_dir;
+	st->size = file->size;
+	return 0;
+}
+
+/**
+ * List the entries in a directory.
+ * @param path	[in] Absolute path.
+ * @param names	[out] Entry names. ("." and ".." are not included.)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int VirtualFS::readDir(const char *path, vector<string> &names)
+{
+	Bank *bank;
+	bool is_gcm;
+	string fs_path;
+	int ret = parsePath(path, &bank, &is_gcm, fs_path);
+	if (ret != 0) {
+		return ret;
+	}
+
+	names.clear();
+	if (!bank) {
+		// Root directory.
+		for (const unique_ptr<Bank> &b : m_banks) {
+			names.push_back(b->name + ".gcm");
+			names.push_back(b->name);
+		}
+		return 0;
+	} else if (is_gcm) {
+		return -ENOTDIR;
+	}
+
+	std::lock_guard<std::mutex> lock(bank->mutex);
+	ret = openBankFS(bank);
+	if (ret != 0) {
+		return ret;
+	}
+
+	// Find the direct children of the directory.
+	string prefix;
+	if (!fs_path.empty()) {
+		const RvtH_FST_File *const dir = bank->fs->find(fs_path.c_str());
+		if (!dir) {
+			return -ENOENT;
+		} else if (!dir->is_dir) {
+			return -ENOTDIR;
+		}
+		prefix = dir->path;
+	}
+	for (const RvtH_FST_File &file : bank->fs->files()) {
+		if (file.path.size() <= prefix.size() || file.path.compare(0, prefix.size(), prefix) != 0) {
+			continue;
+		}
+		string name = file.path.substr(prefix.size());
+		if (file.is_dir) {
+			name.pop_back();
+		}
+		if (name.find('/') == string::npos) {
+			names.push_back(std::move(name));
+		}
+	}
+	return 0;
+}
+
+/**
+ * Read data from a bank's disc image.
+ * NOTE: The bank's mutex must be held by the caller.
+ * @param bank		[in] Bank.
+ * @param buf		[out] Output buffer.
+ * @param offset	[in] Offset in the disc image.
+ * @param size		[in] Number of bytes to read.
+ * @return Number of bytes read, or negative POSIX error code on error.
+ */
+int64_t VirtualFS::readGcm(Bank *bank, void *buf, uint64_t offset, uint32_t size)
+{
+	if (offset >= bank->size) {
+		return 0;
+	}
+	if (size > bank->size - offset) {
+		size = static_cast<uint32_t>(bank->size - offset);
+	}
+
+	uint8_t *buf8 = static_cast<uint8_t*>(buf);
+	uint32_t total = 0;
+	while (total < size) {
+		const uint32_t lba = static_cast<uint32_t>(offset / LBA_SIZE);
+		const uint32_t lba_offset = static_cast<uint32_t>(offset % LBA_SIZE);
+		const uint32_t remain = size - total;
+
+		if (lba_offset == 0 && remain >= LBA_SIZE) {
+			// Aligned: Read whole LBAs directly into the output buffer.
+			const uint32_t lba_len = BYTES_TO_LBA(remain);
+			errno = 0;
+			if (bank->reader->read(buf8, lba, lba_len) != lba_len) {
+				return (errno != 0 ? -errno : -EIO);
+			}
+			const uint32_t len = static_cast<uint32_t>(LBA_TO_BYTES(lba_len));
+			buf8 += len;
+			offset += len;
+			total += len;
+			continue;
+		}
+
+		// Unaligned: Use the bounce buffer.
+		if (!bank->gcm_buf) {
+			bank->gcm_buf.reset(new uint8_t[GCM_BUF_SIZE]);
+		}
+		uint32_t lba_len = BYTES_TO_LBA(static_cast<uint64_t>(lba_offset) + remain + LBA_SIZE - 1);
+		if (lba_len > BYTES_TO_LBA(GCM_BUF_SIZE)) {
+			lba_len = BYTES_TO_LBA(GCM_BUF_SIZE);
+		}
+		errno = 0;
+		if (bank->reader->read(bank->gcm_buf.get(), lba, lba_len) != lba_len) {
+			return (errno != 0 ? -errno : -EIO);
+		}
+		uint32_t len = static_cast<uint32_t>(LBA_TO_BYTES(lba_len)) - lba_offset;
+		if (len > remain) {
+			len = remain;
+		}
+		memcpy(buf8, &bank->gcm_buf[lba_offset], len);
+		buf8 += len;
+		offset += len;
+		total += len;
+	}
+	return total;
+}
+
+/**
+ * Read data from a file.
+ * @param path		[in] Absolute path.
+ * @param buf		[out] Output buffer.
+ * @param offset	[in] Offset in the file.
+ * @param size		[in] Number of bytes to read.
+ * @return Number of bytes read (less than size at the end of the file), or negative POSIX error code on error.
+ */
+int64_t VirtualFS::read(const char *path, void *buf, uint64_t offset, uint32_t size)
+{
+	Bank *bank;
+	bool is_gcm;
+	string fs_path;
+	int ret = parsePath(path, &bank, &is_gcm, fs_path);
+	if (ret != 0) {
+		return ret;
+	} else if (!bank || (!is_gcm && fs_path.empty())) {
+		return -EISDIR;
+	}
+
+	std::lock_guard<std::mutex> lock(bank->mutex);
+	if (is_gcm) {
+		return readGcm(bank, buf, offset, size);
+	}
+
+	ret = openBankFS(bank);
+	if (ret != 0) {
+		return ret;
+	}
+	const RvtH_FST_File *const file = bank->fs->find(fs_path.c_str());
+	if (!file) {
+		return -ENOENT;
+	}
+	return bank->fs->read(file, buf, offset, size);
+}
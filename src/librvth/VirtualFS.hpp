@@ -0,0 +1,122 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * VirtualFS.hpp: Read-only virtual filesystem view of an RVT-H image.     *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#pragma once
+
+#include "rvth.hpp"
+
+// C includes
+#include <stdint.h>
+#include <time.h>
+
+// C++ includes
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * Read-only virtual filesystem view of an RVT-H device, disk image,
+ * or standalone disc image, for use by filesystem frontends.
+ *
+ * Layout:
+ * - /bank1.gcm: Disc image of bank 1, exactly as stored.
+ * - /bank1/sys/, /bank1/files/: Filesystem of bank 1. (See BankFileSystem.)
+ *   For Wii banks, this is the decrypted game partition.
+ *
+ * Only banks containing a GameCube or Wii disc image are listed.
+ * A bank's filesystem is opened the first time it's accessed, and
+ * each bank caches a bounded number of decrypted groups.
+ *
+ * All functions are thread-safe. Requests for the same bank are
+ * serialized; requests for different banks may run concurrently.
+ */
+class VirtualFS
+{
+	public:
+		/**
+		 * Create a virtual filesystem view.
+		 * @param rvth		[in] RvtH object. (Must remain open while this object exists.)
+		 * @param cache_groups	[in] Number of decrypted groups to cache per bank.
+		 */
+		explicit VirtualFS(RvtH *rvth, unsigned int cache_groups = 16);
+		~VirtualFS();
+
+	private:
+		DISABLE_COPY(VirtualFS)
+
+	public:
+		// File or directory attributes.
+		struct Stat {
+			bool is_dir;		// True if this is a directory
+			uint64_t size;		// Size, in bytes (0 for directories)
+			time_t mtime;		// Modification time (bank timestamp; -1 if unknown)
+		};
+
+		/**
+		 * Get the attributes of a file or directory.
+		 * @param path	[in] Absolute path.
+		 * @param st	[out] Attributes.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int stat(const char *path, Stat *st);
+
+		/**
+		 * List the entries in a directory.
+		 * @param path	[in] Absolute path.
+		 * @param names	[out] Entry names. ("." and ".." are not included.)
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int readDir(const char *path, std::vector<std::string> &names);
+
+		/**
+		 * Read data from a file.
+		 * @param path		[in] Absolute path.
+		 * @param buf		[out] Output buffer.
+		 * @param offset	[in] Offset in the file.
+		 * @param size		[in] Number of bytes to read.
+		 * @return Number of bytes read (less than size at the end of the file), or negative POSIX error code on error.
+		 */
+		int64_t read(const char *path, void *buf, uint64_t offset, uint32_t size);
+
+	private:
+		struct Bank;
+
+		/**
+		 * Parse a path.
+		 * @param path		[in] Absolute path.
+		 * @param pBank		[out] Bank, or nullptr for the root directory.
+		 * @param is_gcm	[out] True if the path is the bank's disc image.
+		 * @param fs_path	[out] Path within the bank's filesystem. (empty for the bank's root directory)
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int parsePath(const char *path, Bank **pBank, bool *is_gcm, std::string &fs_path);
+
+		/**
+		 * Open a bank's filesystem if it isn't open yet.
+		 * NOTE: The bank's mutex must be held by the caller.
+		 * @param bank	[in] Bank.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int openBankFS(Bank *bank);
+
+		/**
+		 * Read data from a bank's disc image.
+		 * NOTE: The bank's mutex must be held by the caller.
+		 * @param bank		[in] Bank.
+		 * @param buf		[out] Output buffer.
+		 * @param offset	[in] Offset in the disc image.
+		 * @param size		[in] Number of bytes to read.
+		 * @return Number of bytes read, or negative POSIX error code on error.
+		 */
+		int64_t readGcm(Bank *bank, void *buf, uint64_t offset, uint32_t size);
+
+	private:
+		RvtH *const m_rvth;
+		const unsigned int m_cache_groups;
+		std::vector<std::unique_ptr<Bank> > m_banks;	// Banks with disc images
+};
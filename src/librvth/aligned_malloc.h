@@ -0,0 +1,69 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * aligned_malloc.h: Aligned memory allocation functions.                  *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_ALIGNED_MALLOC_H__
+#define __RVTHTOOL_LIBRVTH_ALIGNED_MALLOC_H__
+
+#include <stddef.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#  include <malloc.h>
+#endif /* _WIN32 */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Allocate an aligned block of memory.
+ * The block must be freed using aligned_free().
+ * @param alignment	[in] Alignment. (Must be a power of two and a multiple of sizeof(void*).)
+ * @param size		[in] Size, in bytes.
+ * @return Aligned memory block, or NULL on error.
+ */
+static inline void *aligned_malloc(size_t alignment, size_t size)
+{
+#ifdef _WIN32
+	return _aligned_malloc(size, alignment);
+#else /* !_WIN32 */
+	void *ptr;
+	if (posix_memalign(&ptr, alignment, size) != 0) {
+		return NULL;
+	}
+	return ptr;
+#endif /* _WIN32 */
+}
+
+/**
+ * Free a block of memory allocated using aligned_malloc().
+ * @param ptr	[in] Aligned memory block.
+ */
+static inline void aligned_free(void *ptr)
+{
+#ifdef _WIN32
+	_aligned_free(ptr);
+#else /* !_WIN32 */
+	free(ptr);
+#endif /* _WIN32 */
+}
+
+#ifdef __cplusplus
+}
+
+/**
+ * Deleter for std::unique_ptr<> with memory allocated using aligned_malloc().
+ */
+struct aligned_deleter {
+	inline void operator()(void *ptr) const
+	{
+		aligned_free(ptr);
+	}
+};
+#endif /* __cplusplus */
+
+#endif /* __RVTHTOOL_LIBRVTH_ALIGNED_MALLOC_H__ */
@@ -2,7 +2,7 @@
  * RVT-H Tool (librvth)                                                    *
  * bank_init.cpp: RvtH_BankEntry initialization functions.                 *
  *                                                                         *
- * Copyright (c) 2018-2022 by David Korth.                                 *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
@@ -19,33 +19,199 @@
 #include "rvth_time.h"
 #include "rvth_error.h"
 #include "reader/Reader.hpp"
+#include "Trace.hpp"
+
+// Nettle SHA-1
+#include <nettle/sha1.h>
 
 // C includes. (C++ namespace)
 #include <cassert>
 #include <cerrno>
 #include <cstring>
 
+// C++ includes
+#include <memory>
+#include <vector>
+using std::unique_ptr;
+using std::vector;
+
+/**
+ * Metadata windows for bank initialization.
+ *
+ * The sectors parsed by the initialization stages are read into
+ * per-bank buffers using a single Reader::readv() call, so the
+ * stages don't each do their own small reads. Ranges that aren't
+ * in a window are read from the Reader as usual.
+ */
+class BankMetadata
+{
+	public:
+		/**
+		 * @param reader	[in,opt] Disc image reader.
+		 */
+		explicit BankMetadata(Reader *reader)
+			: m_reader(reader)
+		{ }
+
+	private:
+		DISABLE_COPY(BankMetadata)
+
+	public:
+		struct LbaRange {
+			uint32_t lba_start;	// Starting LBA
+			uint32_t lba_len;	// Length, in LBAs
+		};
+
+		/**
+		 * Read windows of the disc image.
+		 * Windows that can't be read completely are discarded.
+		 * @param ranges	[in] Windows to read.
+		 * @param count		[in] Number of windows.
+		 */
+		void prefetch(const LbaRange *ranges, unsigned int count);
+
+		/**
+		 * Get a read-only view of data in the disc image.
+		 * If the data isn't in a window, it's read from the Reader.
+		 * @param buf		[out] Fallback buffer. (Must be at least lba_len LBAs.)
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Pointer to the data, or nullptr on error.
+		 */
+		const void *view(void *buf, uint32_t lba_start, uint32_t lba_len)
+		{
+			const void *const data = find(lba_start, lba_len);
+			if (data || !m_reader) {
+				return data;
+			}
+			return m_reader->readView(buf, lba_start, lba_len);
+		}
+
+		/**
+		 * Find a range of LBAs in the windows.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Pointer to the data, or nullptr if it isn't in a window.
+		 */
+		const void *find(uint32_t lba_start, uint32_t lba_len) const;
+
+	private:
+		Reader *const m_reader;
+
+		struct Window {
+			uint32_t lba_start;
+			uint32_t lba_len;
+			unique_ptr<uint8_t[]> buf;
+		};
+		vector<Window> m_windows;
+};
+
+/**
+ * Read windows of the disc image.
+ * Windows that can't be read completely are discarded.
+ * @param ranges	[in] Windows to read.
+ * @param count		[in] Number of windows.
+ */
+void BankMetadata::prefetch(const LbaRange *ranges, unsigned int count)
+{
+	RVTH_TRACE_SPAN("bank_init/metadata");
+	if (!m_reader)
+		return;
+
+	vector<Window> windows;
+	vector<Reader::ReadRange> rr;
+	windows.reserve(count);
+	rr.reserve(count);
+	for (unsigned int i = 0; i < count; i++) {
+		const LbaRange &range = ranges[i];
+		if (range.lba_len == 0 ||
+		    range.lba_start >= m_reader->lba_len() ||
+		    range.lba_len > m_reader->lba_len() - range.lba_start)
+		{
+			// Out of range. (e.g. a small GameCube bank)
+			continue;
+		}
+
+		Window window;
+		window.lba_start = range.lba_start;
+		window.lba_len = range.lba_len;
+		window.buf.reset(new uint8_t[LBA_TO_BYTES(range.lba_len)]);
+
+		Reader::ReadRange r;
+		r.ptr = window.buf.get();
+		r.lba_start = range.lba_start;
+		r.lba_len = range.lba_len;
+		r.lba_read = 0;
+
+		windows.push_back(std::move(window));
+		rr.push_back(r);
+	}
+	if (rr.empty())
+		return;
+
+	m_reader->readv(rr.data(), static_cast<unsigned int>(rr.size()));
+	for (size_t i = 0; i < windows.size(); i++) {
+		if (rr[i].lba_read == rr[i].lba_len) {
+			m_windows.push_back(std::move(windows[i]));
+		}
+	}
+}
+
+/**
+ * Find a range of LBAs in the windows.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Pointer to the data, or nullptr if it isn't in a window.
+ */
+const void *BankMetadata::find(uint32_t lba_start, uint32_t lba_len) const
+{
+	for (const Window &window : m_windows) {
+		if (lba_start >= window.lba_start &&
+		    lba_start - window.lba_start + static_cast<uint64_t>(lba_len) <= window.lba_len)
+		{
+			return &window.buf[LBA_TO_BYTES(lba_start - window.lba_start)];
+		}
+	}
+	return nullptr;
+}
+
+/**
+ * Read the metadata windows for a bank:
+ * - Disc header, boot block, and boot info. (LBAs 0-2)
+ * - Wii: Volume group and partition tables, through the region settings.
+ * The partition header, main.dol header, and FST depend on
+ * these, so they're read later.
+ * @param meta	[in,out] Metadata windows.
+ * @param type	[in] Bank type. (See RvtH_BankType_e.)
+ */
+static void prefetch_bank_metadata(BankMetadata &meta, uint8_t type)
+{
+	static const BankMetadata::LbaRange meta_ranges[] = {
+		{0, BYTES_TO_LBA(GCN_Boot_Info_ADDRESS) + 1},
+		{BYTES_TO_LBA(RVL_VolumeGroupTable_ADDRESS),
+		 BYTES_TO_LBA(RVL_RegionSetting_ADDRESS - RVL_VolumeGroupTable_ADDRESS) + 1},
+	};
+	meta.prefetch(meta_ranges,
+		(type == RVTH_BankType_Wii_SL || type == RVTH_BankType_Wii_DL) ? 2 : 1);
+}
+
 /**
  * Set the region field in an RvtH_BankEntry.
  * The reader field must have already been set.
  * @param entry		[in,out] RvtH_BankEntry
+ * @param meta		[in] Metadata windows.
  * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
  */
-int rvth_init_BankEntry_region(RvtH_BankEntry *entry)
+static int init_BankEntry_region(RvtH_BankEntry *entry, BankMetadata &meta)
 {
-	uint32_t lba_size;
+	RVTH_TRACE_SPAN("bank_init/region");
+
 	uint32_t lba_region;
 	bool is_wii = false;
 
-	// Sector buffer.
-	union {
-		uint8_t u8[LBA_SIZE];
-		struct {
-			uint8_t bi2_pad[0x40];
-			GCN_Boot_Info bi2;
-		};
-		RVL_RegionSetting rvl_region;
-	} sector_buf;
+	// Sector buffer. (fallback for BankMetadata::view())
+	uint8_t sector_buf[LBA_SIZE];
+	const uint8_t *sector;
 
 	assert(entry->reader != NULL);
 
@@ -80,35 +246,55 @@ int rvth_init_BankEntry_region(RvtH_BankEntry *entry)
 	}
 
 	// Read the LBA containing the region code.
-	lba_size = entry->reader->read(sector_buf.u8, lba_region, 1);
-	if (lba_size != 1) {
+	sector = static_cast<const uint8_t*>(meta.view(sector_buf, lba_region, 1));
+	if (!sector) {
 		// Error reading the region code.
 		return -EIO;
 	}
 
 	// FIXME: region_code is a 32-bit value,
 	// but only the first few bits are used...
-	entry->region_code = (is_wii
-		? (uint8_t)be32_to_cpu(sector_buf.rvl_region.region_code)
-		: (uint8_t)be32_to_cpu(sector_buf.bi2.region_code)
-		);
+	if (is_wii) {
+		const RVL_RegionSetting *const rvl_region = reinterpret_cast<const RVL_RegionSetting*>(
+			&sector[RVL_RegionSetting_ADDRESS % LBA_SIZE]);
+		entry->region_code = (uint8_t)be32_to_cpu(rvl_region->region_code);
+	} else {
+		const GCN_Boot_Info *const bi2 = reinterpret_cast<const GCN_Boot_Info*>(
+			&sector[GCN_Boot_Info_ADDRESS % LBA_SIZE]);
+		entry->region_code = (uint8_t)be32_to_cpu(bi2->region_code);
+	}
 	return 0;
 }
 
+/**
+ * Set the region field in an RvtH_BankEntry.
+ * The reader field must have already been set.
+ * @param entry		[in,out] RvtH_BankEntry
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int rvth_init_BankEntry_region(RvtH_BankEntry *entry)
+{
+	assert(entry->reader != NULL);
+	BankMetadata meta(entry->reader);
+	return init_BankEntry_region(entry, meta);
+}
+
 /**
  * Set the crypto_type and sig_type fields in an RvtH_BankEntry.
  * The reader and discHeader fields must have already been set.
  * @param entry		[in,out] RvtH_BankEntry
+ * @param meta		[in] Metadata windows.
  * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
  */
-int rvth_init_BankEntry_crypto(RvtH_BankEntry *entry)
+static int init_BankEntry_crypto(RvtH_BankEntry *entry, BankMetadata &meta)
 {
+	RVTH_TRACE_SPAN("bank_init/crypto");
+
 	const pt_entry_t *game_pte;	// Game partition entry.
-	uint32_t lba_size;
 	uint32_t tmd_size;
 
 	// Partition header.
-	RVL_PartitionHeader header;
+	const RVL_PartitionHeader *header;
 	const RVL_TMD_Header *tmdHeader;
 
 	assert(entry->reader != NULL);
@@ -150,6 +336,15 @@ int rvth_init_BankEntry_crypto(RvtH_BankEntry *entry)
 		entry->crypto_type = RVL_CryptoType_None;
 	}
 
+	// Load the partition table from the metadata windows.
+	// If it isn't in a window, rvth_ptbl_find_game() will read it.
+	if (!entry->ptbl) {
+		const void *const pt = meta.find(BYTES_TO_LBA(RVL_VolumeGroupTable_ADDRESS), 2);
+		if (pt) {
+			rvth_ptbl_load_buf(entry, pt);
+		}
+	}
+
 	// Find the game partition.
 	// TODO: Error checking.
 	game_pte = rvth_ptbl_find_game(entry);
@@ -159,15 +354,15 @@ int rvth_init_BankEntry_crypto(RvtH_BankEntry *entry)
 	}
 
 	// Found the game partition.
-	// Read the partition header.
-	lba_size = entry->reader->read(&header, game_pte->lba_start, BYTES_TO_LBA(sizeof(header)));
-	if (lba_size != BYTES_TO_LBA(sizeof(header))) {
+	// Get the partition header.
+	header = rvth_ptbl_get_header(entry, game_pte);
+	if (!header) {
 		// Error reading the partition header.
 		return -EIO;
 	}
 
 	// Check the ticket signature issuer.
-	switch (cert_get_issuer_from_name(header.ticket.issuer)) {
+	switch (cert_get_issuer_from_name(header->ticket.issuer)) {
 		case RVL_CERT_ISSUER_PPKI_TICKET:
 			// Retail certificate.
 			entry->ticket.sig_type = RVL_SigType_Retail;
@@ -183,11 +378,11 @@ int rvth_init_BankEntry_crypto(RvtH_BankEntry *entry)
 
 	// Validate the signature.
 	entry->ticket.sig_status = sig_verify(
-		(const uint8_t*)&header.ticket, sizeof(header.ticket));
+		(const uint8_t*)&header->ticket, sizeof(header->ticket));
 
 	// Check the TMD signature issuer.
-	// TODO: Verify header.tmd_offset?
-	tmdHeader = (const RVL_TMD_Header*)header.data;
+	// TODO: Verify header->tmd_offset?
+	tmdHeader = (const RVL_TMD_Header*)header->data;
 	switch (cert_get_issuer_from_name(tmdHeader->issuer)) {
 		case RVL_CERT_ISSUER_PPKI_TMD:
 			// Retail certificate.
@@ -203,10 +398,10 @@ int rvth_init_BankEntry_crypto(RvtH_BankEntry *entry)
 	}
 
 	// Check the TMD size.
-	tmd_size = be32_to_cpu(header.tmd_size);
-	if (tmd_size <= sizeof(header.data)) {
+	tmd_size = be32_to_cpu(header->tmd_size);
+	if (tmd_size <= sizeof(header->data)) {
 		// TMD is not too big. We can validate the signature.
-		entry->tmd.sig_status = sig_verify(header.data, tmd_size);
+		entry->tmd.sig_status = sig_verify(header->data, tmd_size);
 	}
 
 	// Get the required IOS version.
@@ -226,7 +421,7 @@ int rvth_init_BankEntry_crypto(RvtH_BankEntry *entry)
 		switch (entry->ticket.sig_type) {
 			case RVL_SigType_Retail:
 				// Retail has a few keys.
-				switch (header.ticket.common_key_index) {
+				switch (header->ticket.common_key_index) {
 					case 0:
 						entry->crypto_type = RVL_CryptoType_Retail;
 						break;
@@ -245,7 +440,7 @@ int rvth_init_BankEntry_crypto(RvtH_BankEntry *entry)
 			case RVL_SigType_Debug:
 				// There's only one debug key.
 				// FIXME: Debug vWii key?
-				if (header.ticket.common_key_index == 0) {
+				if (header->ticket.common_key_index == 0) {
 					entry->crypto_type = RVL_CryptoType_Debug;
 				} else {
 					entry->crypto_type = RVL_CryptoType_Unknown;
@@ -262,6 +457,19 @@ int rvth_init_BankEntry_crypto(RvtH_BankEntry *entry)
 	return 0;
 }
 
+/**
+ * Set the crypto_type and sig_type fields in an RvtH_BankEntry.
+ * The reader and discHeader fields must have already been set.
+ * @param entry		[in,out] RvtH_BankEntry
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int rvth_init_BankEntry_crypto(RvtH_BankEntry *entry)
+{
+	assert(entry->reader != NULL);
+	BankMetadata meta(entry->reader);
+	return init_BankEntry_crypto(entry, meta);
+}
+
 /**
  * Check the address limit for a DOL header.
  * @param dol DOL header.
@@ -307,19 +515,23 @@ static bool dol_check_address_limit(const DOL_Header *dol, uint32_t limit)
  * Set the aplerr field in an RvtH_BankEntry.
  * The reader field must have already been set.
  * @param entry		[in,out] RvtH_BankEntry
+ * @param meta		[in] Metadata windows.
  * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
  */
-int rvth_init_BankEntry_AppLoader(RvtH_BankEntry *entry)
+static int init_BankEntry_AppLoader(RvtH_BankEntry *entry, BankMetadata &meta)
 {
-	uint32_t lba_size;
+	RVTH_TRACE_SPAN("bank_init/apploader");
+
 	uint32_t lba_start = 0;
 	uint8_t shift = 0;
 	bool is_wii = false;
 	bool fst_after_dol = false;
 	unsigned int i;
+	const pt_entry_t *game_pte = nullptr;
 
-	// Sector buffer.
+	// Sector buffer. (fallback for BankMetadata::view())
 	uint8_t sector_buf[LBA_SIZE*2];
+	const uint8_t *sector;
 
 	// Physical memory size is 24 MB.
 	static const uint32_t physMemSize = 24*1024*1024;
@@ -369,7 +581,7 @@ int rvth_init_BankEntry_AppLoader(RvtH_BankEntry *entry)
 		case RVTH_BankType_Wii_DL: {
 			// Find the game partition.
 			// TODO: Error checking.
-			const pt_entry_t *game_pte = rvth_ptbl_find_game(entry);
+			game_pte = rvth_ptbl_find_game(entry);
 			if (!game_pte) {
 				// No game partition...
 				return RVTH_ERROR_NO_GAME_PARTITION;
@@ -389,20 +601,14 @@ int rvth_init_BankEntry_AppLoader(RvtH_BankEntry *entry)
 	}
 
 	if (is_wii) {
-		// Read the partition header to determine the data offset.
-		// 0x2B8: Data offset >> 2 (LBA 1)
-		uint64_t data_offset;
-		lba_size = entry->reader->read(sector_buf, lba_start + 1, 1);
-		if (lba_size != 1) {
-			// Error reading the boot block and boot info.
+		// Get the partition header to determine the data offset.
+		const RVL_PartitionHeader *const pthdr = rvth_ptbl_get_header(entry, game_pte);
+		if (!pthdr) {
+			// Error reading the partition header.
 			return -EIO;
 		}
 
-		// TODO: Optimize this?
-		data_offset = (sector_buf[0x0B8] << 24) |
-			      (sector_buf[0x0B9] << 16) |
-			      (sector_buf[0x0BA] <<  8) |
-			       sector_buf[0x0BB];
+		uint64_t data_offset = be32_to_cpu(pthdr->data_offset);
 		data_offset <<= shift;
 		lba_start += BYTES_TO_LBA(data_offset);
 	}
@@ -416,12 +622,12 @@ int rvth_init_BankEntry_AppLoader(RvtH_BankEntry *entry)
 
 	// Read the boot block and boot info.
 	// Start address: 0x420 (LBA 2)
-	lba_size = entry->reader->read(sector_buf, lba_start + 2, 1);
-	if (lba_size != 1) {
+	sector = static_cast<const uint8_t*>(meta.view(sector_buf, lba_start + 2, 1));
+	if (!sector) {
 		// Error reading the boot block and boot info.
 		return -EIO;
 	}
-	memcpy(&boot, &sector_buf[0x020], sizeof(boot));
+	memcpy(&boot, &sector[0x020], sizeof(boot));
 
 	// BI2 fields.
 	debugMonSize = be32_to_cpu(boot.bi2.debugMonSize);
@@ -474,13 +680,18 @@ int rvth_init_BankEntry_AppLoader(RvtH_BankEntry *entry)
 
 	// Load the DOL header.
 	dolOffset = (off64_t)be32_to_cpu(boot.bb2.bootFilePosition) << shift;
-	lba_size = entry->reader->read(sector_buf, lba_start + BYTES_TO_LBA(dolOffset), 2);
-	if (lba_size != 2) {
+	if (lba_start + BYTES_TO_LBA(dolOffset) + 2 > entry->lba_len) {
+		// DOL header is out of range.
+		return -EIO;
+	}
+	// NOTE: The DOL offset is in the boot block, so this can't be prefetched.
+	sector = static_cast<const uint8_t*>(meta.view(sector_buf, lba_start + BYTES_TO_LBA(dolOffset), 2));
+	if (!sector) {
 		// Error reading the DOL header.
 		return -EIO;
 	}
 
-	memcpy(&dol, &sector_buf[dolOffset % LBA_SIZE], sizeof(dol));
+	memcpy(&dol, &sector[dolOffset % LBA_SIZE], sizeof(dol));
 
 	if (boot.bi2.dolLimit != cpu_to_be32(0)) {
 		// Calculate the total size of all sections.
@@ -584,6 +795,161 @@ int rvth_init_BankEntry_AppLoader(RvtH_BankEntry *entry)
 	return 0;
 }
 
+/**
+ * Set the aplerr field in an RvtH_BankEntry.
+ * The reader field must have already been set.
+ * @param entry		[in,out] RvtH_BankEntry
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int rvth_init_BankEntry_AppLoader(RvtH_BankEntry *entry)
+{
+	assert(entry->reader != NULL);
+	BankMetadata meta(entry->reader);
+	return init_BankEntry_AppLoader(entry, meta);
+}
+
+/**
+ * Set the fingerprint field in an RvtH_BankEntry.
+ *
+ * The fingerprint identifies the build in a disc image without
+ * reading the data area. It's the SHA-1 of:
+ * - Disc header: ID6, disc number, revision, and game title.
+ * - GameCube: Boot block. (main.dol and FST locations and sizes)
+ * - Wii: The game partition's title ID, title version, and TMD
+ *   content table. For disc partitions, the content hash is the
+ *   SHA-1 of the H3 table, so the H3 table doesn't need to be read.
+ *
+ * Signatures and encryption aren't included, so recrypted and
+ * unencrypted copies of a build have the same fingerprint.
+ *
+ * The reader, type, and discHeader fields must have already been set.
+ * @param entry		[in,out] RvtH_BankEntry
+ * @param meta		[in] Metadata windows.
+ */
+static void init_BankEntry_fingerprint(RvtH_BankEntry *entry, BankMetadata &meta)
+{
+	memset(entry->fingerprint, 0, sizeof(entry->fingerprint));
+
+	struct sha1_ctx sha1;
+	sha1_init(&sha1);
+	const GCN_DiscHeader *const discHeader = &entry->discHeader;
+	sha1_update(&sha1, sizeof(discHeader->id6), reinterpret_cast<const uint8_t*>(discHeader->id6));
+	sha1_update(&sha1, 1, &discHeader->disc_number);
+	sha1_update(&sha1, 1, &discHeader->revision);
+	sha1_update(&sha1, sizeof(discHeader->game_title), reinterpret_cast<const uint8_t*>(discHeader->game_title));
+
+	if (entry->type == RVTH_BankType_GCN) {
+		// Boot block: main.dol and FST locations and sizes.
+		uint8_t sbuf[LBA_SIZE];
+		const uint8_t *const data = static_cast<const uint8_t*>(
+			meta.view(sbuf, BYTES_TO_LBA(GCN_Boot_Block_ADDRESS), 1));
+		if (!data) {
+			return;
+		}
+		sha1_update(&sha1, 4 * sizeof(uint32_t), &data[GCN_Boot_Block_ADDRESS % LBA_SIZE]);
+	} else {
+		// Game partition TMD.
+		const pt_entry_t *const game_pte = rvth_ptbl_find_game(entry);
+		const RVL_PartitionHeader *const header =
+			(game_pte ? rvth_ptbl_get_header(entry, game_pte) : nullptr);
+		if (!header) {
+			return;
+		}
+
+		const unsigned int tmd_offset = be32_to_cpu(header->tmd_offset) << 2;
+		const unsigned int tmd_size = be32_to_cpu(header->tmd_size);
+		if (tmd_offset < offsetof(RVL_PartitionHeader, data) ||
+		    tmd_offset > sizeof(*header) - sizeof(RVL_TMD_Header) ||
+		    tmd_size < sizeof(RVL_TMD_Header))
+		{
+			// TMD is invalid.
+			return;
+		}
+		const RVL_TMD_Header *const tmdHeader =
+			reinterpret_cast<const RVL_TMD_Header*>(&header->u8[tmd_offset]);
+		const unsigned int nbr_cont = be16_to_cpu(tmdHeader->nbr_cont);
+		const size_t cont_size = nbr_cont * sizeof(RVL_Content_Entry);
+		if (sizeof(RVL_TMD_Header) + cont_size > tmd_size ||
+		    tmd_offset + sizeof(RVL_TMD_Header) + cont_size > sizeof(*header))
+		{
+			// Content table is out of range.
+			return;
+		}
+
+		sha1_update(&sha1, sizeof(tmdHeader->title_id), reinterpret_cast<const uint8_t*>(&tmdHeader->title_id));
+		sha1_update(&sha1, sizeof(tmdHeader->title_version), reinterpret_cast<const uint8_t*>(&tmdHeader->title_version));
+		sha1_update(&sha1, sizeof(tmdHeader->nbr_cont), reinterpret_cast<const uint8_t*>(&tmdHeader->nbr_cont));
+		sha1_update(&sha1, cont_size, &header->u8[tmd_offset + sizeof(RVL_TMD_Header)]);
+	}
+
+	sha1_digest(&sha1, sizeof(entry->fingerprint), entry->fingerprint);
+}
+
+/**
+ * Check the encryption, signatures, and AppLoader.
+ * @param entry		[in,out] RvtH_BankEntry
+ * @param meta		[in] Metadata windows.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int init_BankEntry_full(RvtH_BankEntry *entry, BankMetadata &meta)
+{
+	RVTH_TRACE_SPAN("bank_init/full");
+
+	if (!entry->reader || entry->type <= RVTH_BankType_Unknown ||
+	    entry->type == RVTH_BankType_Wii_DL_Bank2)
+	{
+		// Nothing else to initialize.
+		return 0;
+	}
+
+	// TODO: Error handling.
+	// Initialize the encryption status.
+	init_BankEntry_crypto(entry, meta);
+	// Initialize the AppLoader error status.
+	init_BankEntry_AppLoader(entry, meta);
+	// Initialize the build fingerprint.
+	init_BankEntry_fingerprint(entry, meta);
+
+	// We're done here.
+	return 0;
+}
+
+/**
+ * Determine the maximum LBA length for a bank's disc image reader.
+ * - GCN or Wii SL: Full bank size.
+ * - Wii DL: Dual-layer bank size.
+ * - First bank in extended bank table: Smaller bank size.
+ * @param type		[in] Bank type. (See RvtH_BankType_e.)
+ * @param lba_start	[in] Starting LBA.
+ * @return Maximum LBA length.
+ */
+static uint32_t rvth_get_reader_lba_len(uint8_t type, uint32_t lba_start)
+{
+	if (lba_start < NHCD_BANKTABLE_ADDRESS_LBA) {
+		// Bank starts before the bank table.
+		// This is a relocated Bank 1 on a device with
+		// an extended bank table, so it can only support
+		// GCN disc images.
+		return NHCD_EXTBANKTABLE_BANK_1_SIZE_LBA;
+	}
+
+	// Use the default LBA length based on bank type.
+	switch (type) {
+		default:
+		case RVTH_BankType_Empty:
+		case RVTH_BankType_Unknown:
+		case RVTH_BankType_GCN:
+		case RVTH_BankType_Wii_SL:
+		case RVTH_BankType_Wii_DL_Bank2:
+			// Full bank.
+			return NHCD_BANK_WII_SL_SIZE_RVTR_LBA;
+
+		case RVTH_BankType_Wii_DL:
+			// Dual-layer bank.
+			return NHCD_BANK_WII_DL_SIZE_RVTR_LBA;
+	}
+}
+
 /**
  * Initialize an RVT-H bank entry from an opened HDD image.
  * @param entry			[out] RvtH_BankEntry
@@ -592,14 +958,19 @@ int rvth_init_BankEntry_AppLoader(RvtH_BankEntry *entry)
  * @param lba_start		[in] Starting LBA.
  * @param lba_len		[in] Length, in LBAs.
  * @param nhcd_timestamp	[in] Timestamp string pointer from the bank table.
+ * @param level			[in] Initialization level. (See RvtH_BankInit_Level.)
  * @return 0 on success; negative POSIX error code on error.
  */
 int rvth_init_BankEntry(RvtH_BankEntry *entry, RefFile *f_img,
 	uint8_t type, uint32_t lba_start, uint32_t lba_len,
-	const char *nhcd_timestamp)
+	const char *nhcd_timestamp, RvtH_BankInit_Level level)
 {
+	RVTH_TRACE_SPAN("bank_init");
+
 	uint32_t reader_lba_len;
 	bool isDeleted;
+	off64_t sector0_offset;
+	const void *sector0 = nullptr;
 
 	int ret;	// errno or RvtH_Errors
 
@@ -619,9 +990,29 @@ int rvth_init_BankEntry(RvtH_BankEntry *entry, RefFile *f_img,
 		return 0;
 	}
 
+	// Initialize the disc image reader.
+	// NOTE: The bank type might change below if the bank is deleted,
+	// but the maximum LBA length is the same for all types that
+	// rvth_disc_header_get() can return for an empty bank.
+	// TODO: Error handling.
+	reader_lba_len = rvth_get_reader_lba_len(type, lba_start);
+	entry->reader = Reader::open(f_img, lba_start, reader_lba_len);
+
+	// Read the bank's metadata in a single pass.
+	BankMetadata meta(entry->reader);
+	prefetch_bank_metadata(meta, type);
+
+	// The prefetched disc header can only be used if the Reader
+	// starts at the bank's first LBA. (no SDK header or container)
+	if (entry->reader && entry->reader->fileOffset(0, 1, &sector0_offset) &&
+	    sector0_offset == LBA_TO_BYTES(lba_start))
+	{
+		sector0 = meta.find(0, 1);
+	}
+
 	// Read the GCN disc header.
 	// TODO: For non-deleted banks, verify the magic number?
-	ret = rvth_disc_header_get(f_img, lba_start, &entry->discHeader, &isDeleted);
+	ret = rvth_disc_header_get(f_img, lba_start, &entry->discHeader, &isDeleted, sector0);
 	if (ret < 0) {
 		// Error...
 		// TODO: Mark the bank as invalid?
@@ -638,36 +1029,7 @@ int rvth_init_BankEntry(RvtH_BankEntry *entry, RefFile *f_img,
 		entry->type = type;
 	}
 
-	// Determine the maximum LBA length for the Reader:
-	// - GCN or Wii SL: Full bank size.
-	// - Wii DL: Dual-layer bank size.
-	// - First bank in extended bank table: Smaller bank size.
-	if (lba_start < NHCD_BANKTABLE_ADDRESS_LBA) {
-		// Bank starts before the bank table.
-		// This is a relocated Bank 1 on a device with
-		// an extended bank table, so it can only support
-		// GCN disc images.
-		reader_lba_len = NHCD_EXTBANKTABLE_BANK_1_SIZE_LBA;
-	} else {
-		// Use the default LBA length based on bank type.
-		switch (type) {
-			default:
-			case RVTH_BankType_Empty:
-			case RVTH_BankType_Unknown:
-			case RVTH_BankType_GCN:
-			case RVTH_BankType_Wii_SL:
-			case RVTH_BankType_Wii_DL_Bank2:
-				// Full bank.
-				reader_lba_len = NHCD_BANK_WII_SL_SIZE_RVTR_LBA;
-				break;
-
-			case RVTH_BankType_Wii_DL:
-				// Dual-layer bank.
-				reader_lba_len = NHCD_BANK_WII_DL_SIZE_RVTR_LBA;
-				break;
-		}
-	}
-
+	assert(reader_lba_len == rvth_get_reader_lba_len(type, lba_start));
 	if (lba_len == 0) {
 		// Empty bank. Assume the length matches the bank,
 		// except for GameCube.
@@ -679,11 +1041,7 @@ int rvth_init_BankEntry(RvtH_BankEntry *entry, RefFile *f_img,
 	// Set the bank entry's LBA length.
 	entry->lba_len = lba_len;
 
-	// Initialize the disc image reader.
-	// TODO: Error handling.
-	entry->reader = Reader::open(f_img, lba_start, reader_lba_len);
-
-	if (type == RVTH_BankType_Empty) {
+	if (type == RVTH_BankType_Empty || !entry->reader) {
 		// We're done here.
 		return 0;
 	}
@@ -695,12 +1053,90 @@ int rvth_init_BankEntry(RvtH_BankEntry *entry, RefFile *f_img,
 
 	// TODO: Error handling.
 	// Initialize the region code.
-	rvth_init_BankEntry_region(entry);
-	// Initialize the encryption status.
-	rvth_init_BankEntry_crypto(entry);
-	// Initialize the AppLoader error status.
-	rvth_init_BankEntry_AppLoader(entry);
+	init_BankEntry_region(entry, meta);
+	if (level == RVTH_BANK_INIT_HEADER) {
+		// The rest will be initialized by rvth_init_BankEntry_full().
+		return 0;
+	}
 
-	// We're done here.
+	return init_BankEntry_full(entry, meta);
+}
+
+/**
+ * Finish initializing an RVT-H bank entry that was initialized
+ * with RVTH_BANK_INIT_HEADER: Check the encryption, signatures,
+ * and AppLoader.
+ * @param entry		[in,out] RvtH_BankEntry
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rvth_init_BankEntry_full(RvtH_BankEntry *entry)
+{
+	if (!entry->reader) {
+		// Nothing else to initialize.
+		return 0;
+	}
+
+	BankMetadata meta(entry->reader);
+	if (entry->type >= RVTH_BankType_GCN && entry->type != RVTH_BankType_Wii_DL_Bank2) {
+		// NOTE: Not needed if there's nothing else to initialize.
+		prefetch_bank_metadata(meta, entry->type);
+	}
+	return init_BankEntry_full(entry, meta);
+}
+
+/**
+ * Initialize the region code, encryption, signatures, and AppLoader
+ * of a bank entry for a standalone disc image.
+ * The reader and discHeader fields must have already been set.
+ * @param entry		[in,out] RvtH_BankEntry
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rvth_init_BankEntry_image(RvtH_BankEntry *entry)
+{
+	assert(entry->reader != NULL);
+	if (entry->type <= RVTH_BankType_Unknown) {
+		// Nothing to initialize.
+		return 0;
+	}
+
+	BankMetadata meta(entry->reader);
+	prefetch_bank_metadata(meta, entry->type);
+
+	// TODO: Error handling.
+	init_BankEntry_region(entry, meta);
+	return init_BankEntry_full(entry, meta);
+}
+
+/**
+ * Open the disc image reader for an RVT-H bank entry that was
+ * loaded from the bank cache.
+ * All fields other than reader and ptbl must have already been set.
+ * @param entry		[in,out] RvtH_BankEntry
+ * @param f_img		[in] RefFile*
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rvth_init_BankEntry_reader(RvtH_BankEntry *entry, RefFile *f_img)
+{
+	RVTH_TRACE_SPAN("bank_init/reader");
+
+	assert(entry->reader == nullptr);
+	assert(entry->ptbl == nullptr);
+	if (entry->type == RVTH_BankType_Unknown ||
+	    entry->type >= RVTH_BankType_MAX)
+	{
+		// Unknown entry type.
+		// rvth_init_BankEntry() doesn't open a reader for these.
+		return 0;
+	}
+
+	entry->reader = Reader::open(f_img, entry->lba_start,
+		rvth_get_reader_lba_len(entry->type, entry->lba_start));
+	if (!entry->reader) {
+		int err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		return -err;
+	}
 	return 0;
 }
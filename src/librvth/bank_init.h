@@ -2,7 +2,7 @@
  * RVT-H Tool (librvth)                                                    *
  * bank_init.h: RvtH_BankEntry initialization functions.                   *
  *                                                                         *
- * Copyright (c) 2018 by David Korth.                                      *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
@@ -55,11 +55,40 @@ int rvth_init_BankEntry_AppLoader(RvtH_BankEntry *entry);
  * @param lba_start		[in] Starting LBA.
  * @param lba_len		[in] Length, in LBAs.
  * @param nhcd_timestamp	[in] Timestamp string pointer from the bank table.
+ * @param level			[in] Initialization level. (See RvtH_BankInit_Level.)
  * @return 0 on success; negative POSIX error code on error.
  */
 int rvth_init_BankEntry(RvtH_BankEntry *entry, RefFile *f_img,
 	uint8_t type, uint32_t lba_start, uint32_t lba_len,
-	const char *nhcd_timestamp);
+	const char *nhcd_timestamp, RvtH_BankInit_Level level);
+
+/**
+ * Finish initializing an RVT-H bank entry that was initialized
+ * with RVTH_BANK_INIT_HEADER: Check the encryption, signatures,
+ * and AppLoader.
+ * @param entry		[in,out] RvtH_BankEntry
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rvth_init_BankEntry_full(RvtH_BankEntry *entry);
+
+/**
+ * Initialize the region code, encryption, signatures, and AppLoader
+ * of a bank entry for a standalone disc image.
+ * The reader and discHeader fields must have already been set.
+ * @param entry		[in,out] RvtH_BankEntry
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rvth_init_BankEntry_image(RvtH_BankEntry *entry);
+
+/**
+ * Open the disc image reader for an RVT-H bank entry that was
+ * loaded from the bank cache.
+ * All fields other than reader and ptbl must have already been set.
+ * @param entry		[in,out] RvtH_BankEntry
+ * @param f_img		[in] RefFile*
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rvth_init_BankEntry_reader(RvtH_BankEntry *entry, RefFile *f_img);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,415 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * bench.cpp: Measure the throughput of each stage of the copy pipelines.  *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "rvth.hpp"
+#include "rvth_error.h"
+
+// For LBA_TO_BYTES()
+#include "nhcd_structs.h"
+
+// Reader class
+#include "reader/Reader.hpp"
+#include "reader/AsyncReader.hpp"
+
+#include "RefFile.hpp"
+#include "BufferPool.hpp"
+
+// libwiicrypto
+#include "libwiicrypto/sha1w.h"
+#include "libwiicrypto/wii_hash_tree.h"
+#include "libwiicrypto/wii_sector.h"
+
+// Encryption
+#include "aesw.h"
+
+// C includes (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+// C++ includes
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <random>
+#include <vector>
+using std::vector;
+
+typedef std::chrono::steady_clock bench_clock;
+
+// Sequential reads: Stop after this much data or this much time.
+static constexpr uint32_t BENCH_SEQ_READ_MAX = 512U * 1024U * 1024U;
+static constexpr double BENCH_SEQ_READ_TIME = 5.0;
+// Random reads: One Wii sector per read.
+static constexpr uint32_t BENCH_RAND_READ_SIZE = 32U * 1024U;
+static constexpr unsigned int BENCH_RAND_READ_MAX = 1024;
+static constexpr double BENCH_RAND_READ_TIME = 3.0;
+// Crypto: One group per iteration.
+static constexpr double BENCH_CRYPTO_TIME = 0.5;
+// Writes
+static constexpr uint32_t BENCH_WRITE_SIZE = 256U * 1024U * 1024U;
+
+/**
+ * Get the number of seconds since a starting time.
+ * @param start Starting time
+ * @return Seconds
+ */
+static inline double elapsed_since(bench_clock::time_point start)
+{
+	const std::chrono::duration<double> elapsed = bench_clock::now() - start;
+	return std::max(elapsed.count(), 1e-6);
+}
+
+/**
+ * Drop cached data for a Reader, so reads come from the device.
+ * @param reader	[in] Reader
+ */
+static void drop_reader_cache(Reader *reader)
+{
+	off64_t offset;
+	if (reader->fileOffset(0, reader->lba_len(), &offset)) {
+		reader->file()->dropCache(offset, LBA_TO_BYTES(reader->lba_len()));
+	}
+}
+
+/**
+ * Measure the sequential read throughput of a Reader.
+ * Reads are submitted using AsyncReader, as when extracting.
+ * @param reader	[in] Reader
+ * @param cp		[in] Resolved copy parameters
+ * @param pRate		[out] Throughput, in bytes per second
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int bench_seq_read(Reader *reader, const RvtH_CopyParams *cp, double *pRate)
+{
+	const uint32_t lba_count_buf = BYTES_TO_LBA(cp->buf_size);
+	uint32_t lba_end = std::min(reader->lba_len(), BYTES_TO_LBA(BENCH_SEQ_READ_MAX));
+	lba_end -= (lba_end % lba_count_buf);
+	if (lba_end == 0) {
+		// Bank is too small.
+		return -EINVAL;
+	}
+
+	vector<PoolBuffer> bufs;
+	bufs.reserve(cp->buf_count);
+	for (unsigned int i = 0; i < cp->buf_count; i++) {
+		bufs.emplace_back(cp->buf_size, cp->alignment);
+		if (!bufs.back()) {
+			return -ENOMEM;
+		}
+	}
+
+	int ret = 0;
+	uint64_t bytes = 0;
+	const auto start = bench_clock::now();
+	{
+		// Keep all of the buffers in flight. When a read finishes,
+		// its buffer is reused for the next read.
+		AsyncReader aio(reader, cp->buf_count);
+		uint32_t lba = 0;
+		bool stop = false;
+		std::function<void(uint8_t*)> submit_next = [&](uint8_t *buf) {
+			if (stop || lba >= lba_end) {
+				return;
+			}
+			aio.submit(buf, lba, lba_count_buf, [&, buf](uint32_t lba_read) {
+				if (lba_read != lba_count_buf) {
+					// Read error.
+					if (ret == 0) {
+						ret = (errno != 0 ? -errno : -EIO);
+					}
+					stop = true;
+					return;
+				}
+				bytes += LBA_TO_BYTES(lba_read);
+				if (elapsed_since(start) >= BENCH_SEQ_READ_TIME) {
+					stop = true;
+				}
+				submit_next(buf);
+			});
+			lba += lba_count_buf;
+		};
+		for (PoolBuffer &buf : bufs) {
+			submit_next(buf.get());
+		}
+		aio.run();
+	}
+
+	*pRate = bytes / elapsed_since(start);
+	return ret;
+}
+
+/**
+ * Measure the random read throughput of a Reader.
+ * Areas that are known to be empty (CISO, WBFS) are skipped.
+ * @param reader	[in] Reader
+ * @param cp		[in] Resolved copy parameters
+ * @param pRate		[out] Throughput, in bytes per second
+ * @param pIops		[out] Reads per second
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int bench_rand_read(Reader *reader, const RvtH_CopyParams *cp, double *pRate, double *pIops)
+{
+	const uint32_t lba_count = BYTES_TO_LBA(BENCH_RAND_READ_SIZE);
+	const uint32_t slots = reader->lba_len() / lba_count;
+	if (slots == 0) {
+		// Bank is too small.
+		return -EINVAL;
+	}
+
+	PoolBuffer buf(BENCH_RAND_READ_SIZE, cp->alignment);
+	if (!buf) {
+		return -ENOMEM;
+	}
+
+	std::mt19937 rng(std::random_device{}());
+	std::uniform_int_distribution<uint32_t> dist(0, slots - 1);
+
+	int ret = 0;
+	unsigned int reads = 0;
+	const auto start = bench_clock::now();
+	for (unsigned int attempt = 0; attempt < BENCH_RAND_READ_MAX * 4 && reads < BENCH_RAND_READ_MAX; attempt++) {
+		const uint32_t lba = dist(rng) * lba_count;
+		if (reader->isRangeEmpty(lba, lba_count)) {
+			// Not stored in the image.
+			continue;
+		}
+		if (reader->read(buf.get(), lba, lba_count) != lba_count) {
+			// Read error.
+			ret = (errno != 0 ? -errno : -EIO);
+			break;
+		}
+		reads++;
+		if (elapsed_since(start) >= BENCH_RAND_READ_TIME) {
+			break;
+		}
+	}
+
+	const double elapsed = elapsed_since(start);
+	*pRate = (static_cast<double>(reads) * BENCH_RAND_READ_SIZE) / elapsed;
+	*pIops = reads / elapsed;
+	return ret;
+}
+
+/**
+ * Measure the throughput of a crypto function.
+ * The function is called repeatedly for at least BENCH_CRYPTO_TIME seconds.
+ * @tparam Func		Function type
+ * @param bytes		[in] Bytes processed per call
+ * @param func		[in] Function
+ * @return Throughput, in bytes per second
+ */
+template<typename Func>
+static double bench_crypto(size_t bytes, Func func)
+{
+	// Warm up the caches.
+	func();
+
+	uint64_t total = 0;
+	const auto start = bench_clock::now();
+	do {
+		func();
+		total += bytes;
+	} while (elapsed_since(start) < BENCH_CRYPTO_TIME);
+	return total / elapsed_since(start);
+}
+
+/**
+ * Measure the throughput of the libwiicrypto backends.
+ * @param results	[out] Benchmark results (crypto fields)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int bench_crypto_all(RvtH_Bench_Results *results)
+{
+	static constexpr unsigned int SECTORS = WII_HASH_TREE_SECTORS_PER_GROUP;
+	PoolBuffer gdata(sizeof(Wii_Disc_Sector_t) * SECTORS);
+	if (!gdata) {
+		return -ENOMEM;
+	}
+
+	// Encrypted data is effectively random.
+	std::mt19937 rng(0x52565448);
+	uint32_t *const p32 = reinterpret_cast<uint32_t*>(gdata.get());
+	const size_t count32 = (sizeof(Wii_Disc_Sector_t) * SECTORS) / sizeof(uint32_t);
+	for (size_t i = 0; i < count32; i++) {
+		p32[i] = rng();
+	}
+
+	errno = 0;
+	AesCtx *const aesw = aesw_new();
+	if (!aesw) {
+		int ret = -errno;
+		if (ret == 0) {
+			ret = -EIO;
+		}
+		return ret;
+	}
+	uint8_t key[16], iv[16];
+	memset(key, 0x5A, sizeof(key));
+	memset(iv, 0, sizeof(iv));
+	aesw_set_key(aesw, key, sizeof(key));
+
+	Wii_Disc_Sector_t *const sectors = gdata.as<Wii_Disc_Sector_t>();
+	const size_t user_size = sizeof(sectors[0].data) * SECTORS;
+
+	// AES-128-CBC decryption of one group.
+	results->aes_decrypt = bench_crypto(sizeof(Wii_Disc_Sector_t) * SECTORS, [&] {
+		aesw_set_iv(aesw, iv, sizeof(iv));
+		aesw_decrypt(aesw, gdata.get(), sizeof(Wii_Disc_Sector_t) * SECTORS);
+	});
+
+	// SHA-1 of 1 KB blocks. (H0 hashes of one group)
+	static constexpr unsigned int H0_BLOCKS = 31 * SECTORS;
+	vector<uint8_t> digests(H0_BLOCKS * SHA1W_DIGEST_SIZE);
+	results->sha1 = bench_crypto(H0_BLOCKS * 0x400, [&] {
+		for (unsigned int i = 0; i < SECTORS; i++) {
+			sha1w_hash_strided(sectors[i].data, 0x400, 0x400, 31, &digests[i * 31 * SHA1W_DIGEST_SIZE]);
+		}
+	});
+
+	// Combined decryption and H0 hashing, as used when verifying.
+	// NOTE: The user data is decrypted in place on each iteration,
+	// which doesn't affect the throughput.
+	uint8_t (*const H0)[31][RVL_SHA1_DIGEST_SIZE] =
+		reinterpret_cast<uint8_t(*)[31][RVL_SHA1_DIGEST_SIZE]>(digests.data());
+	results->verify = bench_crypto(user_size, [&] {
+		wii_hash_tree_decrypt_calc_H0(aesw, sectors, SECTORS, H0);
+	});
+
+	aesw_free(aesw);
+	results->aes_impl = aesw_get_impl_name();
+	results->sha1_impl = sha1w_get_impl_name();
+	return 0;
+}
+
+/**
+ * Measure the write throughput of a new file.
+ * The file is deleted afterwards.
+ * @param filename	[in] Filename (must not exist)
+ * @param cp		[in] Resolved copy parameters
+ * @param pRate		[out] Throughput, in bytes per second
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int bench_write(const TCHAR *filename, const RvtH_CopyParams *cp, double *pRate)
+{
+	// Don't overwrite an existing file or device.
+	FILE *f_test = _tfopen(filename, _T("rb"));
+	if (f_test) {
+		fclose(f_test);
+		errno = EEXIST;
+		return -EEXIST;
+	}
+
+	PoolBuffer buf(cp->buf_size, cp->alignment);
+	if (!buf) {
+		return -ENOMEM;
+	}
+	// Use incompressible data, as when writing encrypted images.
+	std::mt19937 rng(0x52565448);
+	uint32_t *const p32 = reinterpret_cast<uint32_t*>(buf.get());
+	for (size_t i = 0; i < cp->buf_size / sizeof(uint32_t); i++) {
+		p32[i] = rng();
+	}
+
+	RefFile *const f_dest = new RefFile(filename, true);
+	if (!f_dest->isOpen()) {
+		const int err = f_dest->lastError();
+		f_dest->unref();
+		errno = err;
+		return -err;
+	}
+
+	int ret = 0;
+	uint64_t bytes = 0;
+	const auto start = bench_clock::now();
+	for (off64_t offset = 0; offset < BENCH_WRITE_SIZE; offset += cp->buf_size) {
+		if (f_dest->pwrite(buf.get(), cp->buf_size, offset) != cp->buf_size) {
+			// Write error.
+			ret = (errno != 0 ? -errno : -EIO);
+			break;
+		}
+		bytes += cp->buf_size;
+	}
+	// Include the time it takes to write the data to the disk.
+	if (ret == 0 && f_dest->sync() != 0) {
+		ret = (errno != 0 ? -errno : -EIO);
+	}
+	*pRate = bytes / elapsed_since(start);
+
+	f_dest->unref();
+	_tremove(filename);
+	return ret;
+}
+
+/**
+ * Measure the throughput of each stage of the extract and verify pipelines.
+ *
+ * - Sequential and random reads of the bank, using the same Reader
+ *   and copy parameters as extracting. Cached data for the bank is
+ *   dropped first, so the reads come from the device if possible.
+ * - AES decryption, SHA-1, and combined verification throughput of the
+ *   active libwiicrypto implementations, using one thread.
+ * - Write throughput of a new file, if a filename is specified.
+ *
+ * @param bank			[in] Bank number (0-7)
+ * @param write_filename	[in,opt] Temporary file for measuring writes (must not exist; deleted afterwards)
+ * @param results		[out] Benchmark results
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int RvtH::benchmark(unsigned int bank, const TCHAR *write_filename, RvtH_Bench_Results *results)
+{
+	assert(results != nullptr);
+	memset(results, 0, sizeof(*results));
+
+	if (bank >= m_bankCount) {
+		errno = ERANGE;
+		return -ERANGE;
+	}
+	const RvtH_BankEntry *const entry = getBankEntry(bank);
+	if (!entry->reader || entry->lba_len == 0) {
+		errno = EIO;
+		return RVTH_ERROR_BANK_EMPTY;
+	}
+	Reader *const reader = entry->reader;
+
+	// Resolve the copy parameters as if extracting to a regular file.
+	// NOTE: This may measure the device to select the buffer size.
+	RvtH_CopyParams cp;
+	resolveCopyParams(reader, m_file, &cp);
+	results->buf_size = cp.buf_size;
+
+	drop_reader_cache(reader);
+	int ret = bench_seq_read(reader, &cp, &results->seq_read);
+	if (ret != 0) {
+		errno = -ret;
+		return ret;
+	}
+
+	drop_reader_cache(reader);
+	ret = bench_rand_read(reader, &cp, &results->rand_read, &results->rand_iops);
+	if (ret != 0) {
+		errno = -ret;
+		return ret;
+	}
+
+	ret = bench_crypto_all(results);
+	if (ret != 0) {
+		errno = -ret;
+		return ret;
+	}
+
+	if (write_filename) {
+		ret = bench_write(write_filename, &cp, &results->write);
+		if (ret != 0) {
+			errno = -ret;
+			return ret;
+		}
+	}
+
+	return 0;
+}
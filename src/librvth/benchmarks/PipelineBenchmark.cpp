@@ -0,0 +1,448 @@
+/***************************************************************************
+ * RVT-H Tool (librvth/benchmarks)                                         *
+ * PipelineBenchmark.cpp: Reader and pipeline benchmarks.                  *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "SynthImage.hpp"
+#include "libwiicrypto/aesw.h"
+#include "libwiicrypto/sha1w.h"
+#include "libwiicrypto/wii_sector.h"
+#include "libwiicrypto/benchmarks/BenchRunner.hpp"
+
+#include "librvth/rvth.hpp"
+#include "librvth/BankFileSystem.hpp"
+#include "librvth/rvth_error.h"
+#include "librvth/RefFile.hpp"
+#include "librvth/nhcd_structs.h"
+
+// Reader classes
+#include "librvth/reader/PlainReader.hpp"
+#include "librvth/reader/MmapReader.hpp"
+#include "librvth/reader/CisoReader.hpp"
+#include "librvth/reader/WbfsReader.hpp"
+
+// C includes (C++ namespace)
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// C++ includes
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+using std::tstring;
+using std::unique_ptr;
+using std::vector;
+
+// Output format version.
+// Increment this if the output format changes.
+#define BENCH_FORMAT_VERSION 2
+
+// Read size for the Reader benchmarks.
+#define BENCH_READ_SIZE (1024U * 1024U)
+
+/**
+ * Synthetic disc image used by the benchmarks.
+ */
+struct BenchImage {
+	const char *name;	// Short name, e.g. "wii.ciso"
+	tstring filename;	// Filename
+	bool isWii;		// True for Wii; false for GameCube
+	uint64_t size;		// Disc image size, in bytes
+	uint64_t file_size;	// File size, in bytes (smaller than size for CISO and WBFS)
+};
+
+/**
+ * Get the reference benchmark for an image.
+ * This is reading the plain disc image for the same system with
+ * PlainReader, so the other benchmarks are compared relative to
+ * the speed of the disk (or page cache) on this machine.
+ * @param image	[in] Image.
+ * @return Reference benchmark name.
+ */
+static inline const char *bench_ref(const BenchImage &image)
+{
+	return (image.isWii ? "read/PlainReader/wii.gcm" : "read/PlainReader/gcn.gcm");
+}
+
+/**
+ * Get the size of a file.
+ * @param filename	[in] Filename.
+ * @return File size, or 0 on error.
+ */
+static uint64_t get_file_size(const TCHAR *filename)
+{
+	RefFile *const file = new RefFile(filename);
+	const off64_t size = (file->isOpen() ? file->size() : 0);
+	file->unref();
+	return (size > 0 ? static_cast<uint64_t>(size) : 0);
+}
+
+/**
+ * Reader factory.
+ * @param file RefFile
+ * @return Reader
+ */
+typedef Reader *(*ReaderFactory)(RefFile *file);
+
+/**
+ * Read an entire disc image using a Reader.
+ * @param filename	[in] Filename.
+ * @param factory	[in] Reader factory.
+ * @param buf		[in] Read buffer. (BENCH_READ_SIZE)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int read_image(const TCHAR *filename, ReaderFactory factory, uint8_t *buf)
+{
+	RefFile *const file = new RefFile(filename);
+	if (!file->isOpen()) {
+		const int err = file->lastError();
+		file->unref();
+		return (err != 0 ? -err : -EIO);
+	}
+	unique_ptr<Reader> reader(factory(file));
+	file->unref();
+	if (!reader->isOpen()) {
+		return -EIO;
+	}
+
+	const uint32_t lba_len = reader->lba_len();
+	for (uint32_t lba = 0; lba < lba_len; lba += BYTES_TO_LBA(BENCH_READ_SIZE)) {
+		const uint32_t n = std::min(lba_len - lba, BYTES_TO_LBA(BENCH_READ_SIZE));
+		if (reader->read(buf, lba, n) != n) {
+			return (errno != 0 ? -errno : -EIO);
+		}
+	}
+	return 0;
+}
+
+/**
+ * Reader benchmarks.
+ * Each image is read sequentially in 1 MiB chunks.
+ * @param runner	[in] Benchmark runner.
+ * @param images	[in] Images.
+ */
+static void bench_readers(BenchRunner &runner, const vector<BenchImage> &images)
+{
+	struct ReaderInfo {
+		const char *name;
+		const char *ext;	// Image extension that this reader handles
+		ReaderFactory factory;
+	};
+	static const ReaderInfo readers[] = {
+		{"PlainReader", ".gcm",  [](RefFile *file) -> Reader* { return new PlainReader(file, 0, 0); }},
+		{"MmapReader",  ".gcm",  [](RefFile *file) -> Reader* { return new MmapReader(file, 0, 0); }},
+		{"CisoReader",  ".ciso", [](RefFile *file) -> Reader* { return new CisoReader(file, 0, 0); }},
+		{"WbfsReader",  ".wbfs", [](RefFile *file) -> Reader* { return new WbfsReader(file, 0, 0); }},
+	};
+
+	vector<uint8_t> buf(BENCH_READ_SIZE);
+	for (const BenchImage &image : images) {
+		const char *const ext = strchr(image.name, '.');
+		for (const ReaderInfo &info : readers) {
+			if (strcmp(ext, info.ext) != 0)
+				continue;
+
+			char name[64];
+			snprintf(name, sizeof(name), "read/%s/%s", info.name, image.name);
+			const char *const ref = bench_ref(image);
+			runner.run(name, image.size, [&]() -> int {
+				return read_image(image.filename.c_str(), info.factory, buf.data());
+			}, (strcmp(name, ref) != 0 ? ref : nullptr));
+		}
+	}
+}
+
+/**
+ * Verification benchmarks.
+ * Includes opening the image, since the bank entry is cached.
+ * @param runner	[in] Benchmark runner.
+ * @param images	[in] Images.
+ */
+static void bench_verify(BenchRunner &runner, const vector<BenchImage> &images)
+{
+	for (const BenchImage &image : images) {
+		if (!image.isWii)
+			continue;
+
+		char name[64];
+		snprintf(name, sizeof(name), "verify/%s", image.name);
+		runner.run(name, image.size, [&]() -> int {
+			int ret = 0;
+			unique_ptr<RvtH> rvth(new RvtH(image.filename.c_str(), &ret));
+			if (!rvth->isOpen()) {
+				return (ret != 0 ? ret : -EIO);
+			}
+			unsigned int error_count[5];
+			ret = rvth->verifyWiiPartitions(0, error_count);
+			if (ret != 0) {
+				return ret;
+			}
+			for (unsigned int count : error_count) {
+				if (count != 0) {
+					// Synthetic images should always verify.
+					return -EIO;
+				}
+			}
+			return 0;
+		}, bench_ref(image));
+	}
+}
+
+/**
+ * Random partition data read benchmarks.
+ * Each operation reads 4 KB at a random offset in the game partition.
+ * - warm: All offsets are in the decrypted group cache.
+ * - cold: Offsets are spread over the whole partition, so most reads
+ *         have to read and decrypt a sector.
+ * @param runner	[in] Benchmark runner.
+ * @param images	[in] Images.
+ */
+static void bench_partition_read(BenchRunner &runner, const vector<BenchImage> &images)
+{
+	static const unsigned int CACHE_GROUPS = 8;
+	static const uint32_t READ_SIZE = 4096;
+
+	uint8_t buf[READ_SIZE];
+	for (const BenchImage &image : images) {
+		if (!image.isWii)
+			continue;
+
+		int ret = 0;
+		unique_ptr<RvtH> rvth(new RvtH(image.filename.c_str(), &ret));
+		if (!rvth->isOpen()) {
+			continue;
+		}
+		BankFileSystem *pFs = nullptr;
+		ret = rvth->openPartitionData(0, &pFs, CACHE_GROUPS);
+		if (ret != 0) {
+			continue;
+		}
+		unique_ptr<BankFileSystem> fs(pFs);
+		const uint64_t data_size = fs->dataSize();
+		if (data_size < READ_SIZE) {
+			continue;
+		}
+
+		// Warm reads stay within the cached groups.
+		static const uint64_t WARM_RANGE = (uint64_t)CACHE_GROUPS * GROUP_SIZE_DEC;
+		for (unsigned int warm = 0; warm < 2; warm++) {
+			uint64_t range = data_size - READ_SIZE;
+			if (warm && range > WARM_RANGE) {
+				range = WARM_RANGE;
+			}
+			if (warm) {
+				// Load the groups first.
+				for (uint64_t offset = 0; offset < range; offset += SECTOR_SIZE_DEC) {
+					fs->readData(buf, offset, READ_SIZE);
+				}
+			}
+
+			uint64_t seed = 1;
+			char name[64];
+			snprintf(name, sizeof(name), "partition_read/4KB/%s/%s", (warm ? "warm" : "cold"), image.name);
+			runner.run(name, READ_SIZE, [&]() -> int {
+				seed = (seed * 6364136223846793005ULL) + 1442695040888963407ULL;
+				const int64_t size = fs->readData(buf, (seed >> 16) % range, READ_SIZE);
+				return (size == READ_SIZE ? 0 : (size < 0 ? static_cast<int>(size) : -EIO));
+			}, bench_ref(image));
+		}
+	}
+}
+
+/**
+ * copyToGcm() benchmarks.
+ * Each image is copied to a new plain disc image.
+ * @param runner	[in] Benchmark runner.
+ * @param images	[in] Images.
+ * @param dest_filename	[in] Destination filename.
+ */
+static void bench_copyToGcm(BenchRunner &runner, const vector<BenchImage> &images,
+	const TCHAR *dest_filename)
+{
+	for (const BenchImage &image : images) {
+		char name[64];
+		snprintf(name, sizeof(name), "copyToGcm/%s", image.name);
+		runner.run(name, image.size, [&]() -> int {
+			int ret = 0;
+			unique_ptr<RvtH> rvth(new RvtH(image.filename.c_str(), &ret));
+			if (!rvth->isOpen()) {
+				return (ret != 0 ? ret : -EIO);
+			}
+			const RvtH_BankEntry *const entry = rvth->bankEntry(0, &ret);
+			if (!entry) {
+				return (ret != 0 ? ret : -EIO);
+			}
+			unique_ptr<RvtH> rvth_dest(new RvtH(dest_filename, entry->lba_len, &ret));
+			if (!rvth_dest->isOpen()) {
+				return (ret != 0 ? ret : -EIO);
+			}
+			return rvth->copyToGcm(rvth_dest.get(), 0);
+		}, bench_ref(image));
+	}
+	_tremove(dest_filename);
+}
+
+/**
+ * Print usage information.
+ * @param argv0 Program name.
+ */
+static void print_help(const TCHAR *argv0)
+{
+	_ftprintf(stderr, _T("Usage: %s [options] [filter]\n")
+		_T("\n")
+		_T("Options:\n")
+		_T("  --dir=DIR          Directory for the synthetic disc images. (default: .)\n")
+		_T("  --size=MB          Size of the game data, in MiB. (default: 64)\n")
+		_T("  --sparse=PERCENT   Percentage of each image that's empty. (default: 50)\n")
+		_T("  --min-time=SECONDS Minimum time per benchmark. (default: 0.5)\n")
+		_T("  --baseline=FILE    Compare the results to the output of a previous run.\n")
+		_T("  --tolerance=PERCENT Allowed slowdown compared to the baseline. (default: 25)\n")
+		_T("  --keep             Don't delete the disc images afterwards.\n")
+		_T("\n")
+		_T("Only benchmarks whose names contain the filter are run.\n"), argv0);
+}
+
+int RVTH_CDECL _tmain(int argc, TCHAR *argv[])
+{
+	BenchRunner runner;
+	const TCHAR *baseline = nullptr;
+	double tolerance = 25.0;
+
+	SynthImageParams params;
+	params.data_mb = 64;
+	params.sparse_pct = 50;
+
+	tstring dir(_T("."));
+	bool keep = false;
+	static char filter_buf[256];
+
+	for (int i = 1; i < argc; i++) {
+		const TCHAR *const arg = argv[i];
+		if (!_tcsncmp(arg, _T("--dir="), 6)) {
+			dir = &arg[6];
+		} else if (!_tcsncmp(arg, _T("--size="), 7)) {
+			params.data_mb = static_cast<unsigned int>(_tcstoul(&arg[7], nullptr, 10));
+		} else if (!_tcsncmp(arg, _T("--sparse="), 9)) {
+			params.sparse_pct = static_cast<unsigned int>(_tcstoul(&arg[9], nullptr, 10));
+		} else if (!_tcsncmp(arg, _T("--min-time="), 11)) {
+			runner.setMinTime(_tcstod(&arg[11], nullptr));
+		} else if (!_tcsncmp(arg, _T("--baseline="), 11)) {
+			baseline = &arg[11];
+		} else if (!_tcsncmp(arg, _T("--tolerance="), 12)) {
+			tolerance = _tcstod(&arg[12], nullptr);
+		} else if (!_tcscmp(arg, _T("--keep"))) {
+			keep = true;
+		} else if (!_tcscmp(arg, _T("--help")) || !_tcscmp(arg, _T("-h"))) {
+			print_help(argv[0]);
+			return EXIT_SUCCESS;
+		} else if (arg[0] == _T('-')) {
+			print_help(argv[0]);
+			return EXIT_FAILURE;
+		} else {
+			// Benchmark names are ASCII.
+			size_t j;
+			for (j = 0; arg[j] != 0 && j < sizeof(filter_buf) - 1; j++) {
+				filter_buf[j] = static_cast<char>(arg[j]);
+			}
+			filter_buf[j] = '\0';
+			runner.setFilter(filter_buf);
+		}
+	}
+	if (params.data_mb == 0 || params.sparse_pct > 95 ||
+	    tolerance < 0.0 || runner.minTime() <= 0.0)
+	{
+		print_help(argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (baseline) {
+		const int ret = runner.loadBaseline(baseline, tolerance);
+		if (ret != 0) {
+			_ftprintf(stderr, _T("*** ERROR: Unable to load baseline %s: "), baseline);
+			fprintf(stderr, "%s\n", strerror(-ret));
+			return EXIT_FAILURE;
+		}
+	}
+	if (dir.empty() || dir[dir.size()-1] != DIR_SEP_CHR) {
+		dir += DIR_SEP_CHR;
+	}
+
+	// Create the synthetic disc images.
+	vector<BenchImage> images;
+	const struct {
+		const char *name;
+		const TCHAR *filename;
+		bool isWii;
+	} image_list[] = {
+		{"wii.gcm",  _T("rvth-bench-wii.gcm"),  true},
+		{"wii.ciso", _T("rvth-bench-wii.ciso"), true},
+		{"wii.wbfs", _T("rvth-bench-wii.wbfs"), true},
+		{"gcn.gcm",  _T("rvth-bench-gcn.gcm"),  false},
+		{"gcn.ciso", _T("rvth-bench-gcn.ciso"), false},
+	};
+	const auto start = std::chrono::steady_clock::now();
+	int ret = 0;
+	for (const auto &p : image_list) {
+		BenchImage image;
+		image.name = p.name;
+		image.filename = dir + p.filename;
+		image.isWii = p.isWii;
+
+		if (strstr(p.name, ".gcm")) {
+			ret = (p.isWii ? synth_image_create_wii(image.filename.c_str(), &params)
+			               : synth_image_create_gcn(image.filename.c_str(), &params));
+		} else {
+			// Convert the plain image created previously.
+			const BenchImage *const src = (p.isWii ? &images[0] : &images[3]);
+			ret = synth_image_convert(src->filename.c_str(), image.filename.c_str());
+		}
+		image.file_size = get_file_size(image.filename.c_str());
+		image.size = (strstr(p.name, ".gcm") ? image.file_size : images[p.isWii ? 0 : 3].size);
+		images.emplace_back(std::move(image));
+		if (ret != 0) {
+			fprintf(stderr, "*** ERROR: Unable to create %s: %s\n", p.name,
+				(ret < 0 ? strerror(-ret) : "RvtH error"));
+			break;
+		}
+	}
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	if (ret == 0) {
+		// The image parameters and crypto implementations must match
+		// the baseline for the results to be compared.
+		char buf[64];
+		runner.printHeader("librvth pipeline", BENCH_FORMAT_VERSION);
+		snprintf(buf, sizeof(buf), "%u MiB", params.data_mb);
+		runner.printParam("data", buf);
+		snprintf(buf, sizeof(buf), "%u%%", params.sparse_pct);
+		runner.printParam("sparse", buf);
+		runner.printParam("aes", aesw_get_impl_name());
+		runner.printParam("sha1", sha1w_get_impl_name());
+		printf("# setup: %.1f s\n", elapsed.count());
+		for (const BenchImage &image : images) {
+			printf("# image %s: %llu bytes\n", image.name,
+				static_cast<unsigned long long>(image.file_size));
+		}
+		fputs("# MiB/s is relative to the disc image size.\n", stdout);
+		runner.printColumns();
+
+		bench_readers(runner, images);
+		bench_verify(runner, images);
+		bench_partition_read(runner, images);
+		bench_copyToGcm(runner, images, (dir + _T("rvth-bench-copy.gcm")).c_str());
+		ret = runner.finish();
+	}
+
+	if (!keep) {
+		for (const BenchImage &image : images) {
+			_tremove(image.filename.c_str());
+		}
+	}
+	return (ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
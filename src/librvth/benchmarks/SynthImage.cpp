@@ -0,0 +1,388 @@
+/***************************************************************************
+ * RVT-H Tool (librvth/benchmarks)                                         *
+ * SynthImage.cpp: Synthetic disc image generator.                         *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "SynthImage.hpp"
+
+#include "librvth/rvth.hpp"
+#include "librvth/RefFile.hpp"
+#include "librvth/nhcd_structs.h"
+
+// libwiicrypto
+#include "libwiicrypto/byteswap.h"
+#include "libwiicrypto/wii_sector.h"
+
+// C includes (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+// C++ includes
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+using std::tstring;
+using std::unique_ptr;
+using std::vector;
+
+// Disc layout. The game partition starts at the usual address.
+#define SYNTH_GAME_PARTITION_ADDRESS	0x50000U
+#define SYNTH_PARTITION_HEADER_SIZE	0x8000U		// unencrypted
+#define SYNTH_H3_TABLE_SIZE		0x18000U	// encrypted
+#define SYNTH_TMD_OFFSET		0x2C0U
+
+// Test title key. (encrypted with the debug common key)
+static const uint8_t synth_enc_title_key[16] = {
+	0x52,0x56,0x54,0x2D,0x48,0x20,0x54,0x65,
+	0x73,0x74,0x20,0x4B,0x65,0x79,0x21,0x00
+};
+
+/**
+ * Fill a buffer with a non-repeating pattern.
+ * Every 512-byte LBA has different contents.
+ * @param buf		[out] Buffer.
+ * @param size		[in] Size of buf. (multiple of 8)
+ * @param seed		[in] Seed, e.g. the byte offset of buf.
+ */
+static void synth_fill(uint8_t *buf, size_t size, uint64_t seed)
+{
+	assert(size % 8 == 0);
+
+	// xorshift64*
+	uint64_t x = seed ^ 0x9E3779B97F4A7C15ULL;
+	if (x == 0) {
+		x = 1;
+	}
+	for (; size >= 8; size -= 8, buf += 8) {
+		x ^= x >> 12;
+		x ^= x << 25;
+		x ^= x >> 27;
+		const uint64_t v = x * 0x2545F4914F6CDD1DULL;
+		memcpy(buf, &v, sizeof(v));
+	}
+}
+
+/**
+ * Get the total image size, including empty space.
+ * @param data_size	[in] Size of the used area, in bytes.
+ * @param sparse_pct	[in] Percentage of the image that's empty.
+ * @return Total image size, in bytes. (multiple of the LBA size)
+ */
+static uint64_t synth_total_size(uint64_t data_size, unsigned int sparse_pct)
+{
+	if (sparse_pct > 95) {
+		sparse_pct = 95;
+	}
+	uint64_t total = (data_size * 100 + (100 - sparse_pct - 1)) / (100 - sparse_pct);
+	return LBA_TO_BYTES(BYTES_TO_LBA(total + LBA_SIZE - 1));
+}
+
+/**
+ * Create a new file for a synthetic disc image.
+ * @param filename	[in] Filename.
+ * @param size		[in] Image size, in bytes.
+ * @param pErr		[out] Error code. (negative POSIX error code)
+ * @return RefFile*, or nullptr on error.
+ */
+static RefFile *synth_create_file(const TCHAR *filename, uint64_t size, int *pErr)
+{
+	RefFile *const file = new RefFile(filename, true);
+	if (!file->isOpen()) {
+		int err = file->lastError();
+		if (err == 0) {
+			err = EIO;
+		}
+		file->unref();
+		*pErr = -err;
+		return nullptr;
+	}
+
+	// Set the file size. The empty space isn't written.
+	// NOTE: Ignoring errors, since some file systems
+	// don't support sparse files.
+	file->makeSparse(static_cast<off64_t>(size));
+	*pErr = 0;
+	return file;
+}
+
+/**
+ * Write data to a synthetic disc image.
+ * @param file		[in] RefFile.
+ * @param ptr		[in] Data.
+ * @param size		[in] Size of data.
+ * @param offset	[in] Byte offset.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int synth_pwrite(RefFile *file, const void *ptr, size_t size, off64_t offset)
+{
+	errno = 0;
+	if (file->pwrite(ptr, size, offset) != size) {
+		int err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		return -err;
+	}
+	return 0;
+}
+
+/**
+ * Initialize a disc header.
+ * @param discHeader	[out] Disc header.
+ * @param isWii		[in] True for Wii; false for GameCube.
+ */
+static void synth_init_disc_header(GCN_DiscHeader *discHeader, bool isWii)
+{
+	memset(discHeader, 0, sizeof(*discHeader));
+	memcpy(discHeader->id6, (isWii ? "RSYE01" : "GSYE01"), sizeof(discHeader->id6));
+	if (isWii) {
+		discHeader->magic_wii = cpu_to_be32(WII_MAGIC);
+	} else {
+		discHeader->magic_gcn = cpu_to_be32(GCN_MAGIC);
+	}
+	static const char title[] = "librvth synthetic benchmark image";
+	memcpy(discHeader->game_title, title, sizeof(title));
+}
+
+/**
+ * Create a synthetic GameCube disc image.
+ *
+ * The disc image has a valid disc header, followed by the
+ * game data, which is filled with a non-repeating pattern.
+ * The empty space at the end of the image isn't written.
+ *
+ * @param filename	[in] Filename. (plain disc image)
+ * @param params	[in] Image parameters.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int synth_image_create_gcn(const TCHAR *filename, const SynthImageParams *params)
+{
+	if (!filename || !params || params->data_mb == 0) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	const uint64_t data_size = static_cast<uint64_t>(params->data_mb) * 1024U * 1024U;
+	int ret;
+	RefFile *const file = synth_create_file(filename,
+		synth_total_size(data_size, params->sparse_pct), &ret);
+	if (!file) {
+		return ret;
+	}
+
+	// The first 32 KB only has the disc header.
+	vector<uint8_t> buf(GROUP_SIZE_DEC);
+	memset(buf.data(), 0, 32768);
+	synth_init_disc_header(reinterpret_cast<GCN_DiscHeader*>(buf.data()), false);
+	ret = synth_pwrite(file, buf.data(), 32768, 0);
+
+	// Game data.
+	for (uint64_t offset = 32768; ret == 0 && offset < data_size; offset += buf.size()) {
+		const size_t size = static_cast<size_t>(std::min<uint64_t>(buf.size(), data_size - offset));
+		synth_fill(buf.data(), size, offset);
+		ret = synth_pwrite(file, buf.data(), size, offset);
+	}
+
+	file->unref();
+	return ret;
+}
+
+/**
+ * Create an unencrypted Wii disc image with a single game partition.
+ * This is the same layout as unencrypted RVT-H images.
+ * @param filename	[in] Filename.
+ * @param group_count	[in] Number of groups in the game partition.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int synth_create_wii_unencrypted(const TCHAR *filename, unsigned int group_count)
+{
+	const uint64_t pt_data_size = static_cast<uint64_t>(group_count) * GROUP_SIZE_DEC;
+	int ret;
+	RefFile *const file = synth_create_file(filename,
+		SYNTH_GAME_PARTITION_ADDRESS + SYNTH_PARTITION_HEADER_SIZE + pt_data_size, &ret);
+	if (!file) {
+		return ret;
+	}
+
+	vector<uint8_t> buf(GROUP_SIZE_DEC);
+	memset(buf.data(), 0, SYNTH_PARTITION_HEADER_SIZE);
+
+	// Disc header. The disc is unencrypted and unhashed.
+	GCN_DiscHeader discHeader;
+	synth_init_disc_header(&discHeader, true);
+	discHeader.hash_verify = 1;
+	discHeader.disc_noCrypt = 1;
+	ret = synth_pwrite(file, &discHeader, sizeof(discHeader), 0);
+
+	// Volume group and partition table.
+	if (ret == 0) {
+		uint8_t sbuf[LBA_SIZE];
+		memset(sbuf, 0, sizeof(sbuf));
+		RVL_VolumeGroupTable *const vgtbl = reinterpret_cast<RVL_VolumeGroupTable*>(sbuf);
+		RVL_PartitionTableEntry *const pt = reinterpret_cast<RVL_PartitionTableEntry*>(&sbuf[sizeof(*vgtbl)]);
+		vgtbl->vg[0].count = cpu_to_be32(1);
+		vgtbl->vg[0].addr = cpu_to_be32((RVL_VolumeGroupTable_ADDRESS + sizeof(*vgtbl)) >> 2);
+		pt->addr = cpu_to_be32(SYNTH_GAME_PARTITION_ADDRESS >> 2);
+		pt->type = cpu_to_be32(0);
+		ret = synth_pwrite(file, sbuf, sizeof(sbuf), RVL_VolumeGroupTable_ADDRESS);
+	}
+
+	// Region setting.
+	if (ret == 0) {
+		RVL_RegionSetting region;
+		memset(&region, 0, sizeof(region));
+		region.region_code = cpu_to_be32(GCN_REGION_USA);
+		ret = synth_pwrite(file, &region, sizeof(region), RVL_RegionSetting_ADDRESS);
+	}
+
+	// Partition header.
+	if (ret == 0) {
+		RVL_PartitionHeader *const pthdr = reinterpret_cast<RVL_PartitionHeader*>(buf.data());
+		RVL_TitleID_t title_id;
+		title_id.hi = cpu_to_be32(0x00010000);
+		title_id.lo = cpu_to_be32(0x52535945);	// "RSYE"
+
+		// Ticket.
+		RVL_Ticket *const ticket = &pthdr->ticket;
+		ticket->signature_type = cpu_to_be32(RVL_SIGNATURE_TYPE_RSA2048_SHA1);
+		strcpy(ticket->issuer, "Root-CA00000002-XS00000006");
+		memcpy(ticket->enc_title_key, synth_enc_title_key, sizeof(ticket->enc_title_key));
+		ticket->title_id = title_id;
+		ticket->common_key_index = RVL_COMMON_KEY_INDEX_DEFAULT;
+
+		// TMD.
+		// copyToGcm_doCrypt() sets the content size and H3 table hash.
+		RVL_TMD_Header *const tmd = reinterpret_cast<RVL_TMD_Header*>(&buf[SYNTH_TMD_OFFSET]);
+		tmd->signature_type = cpu_to_be32(RVL_SIGNATURE_TYPE_RSA2048_SHA1);
+		strcpy(tmd->issuer, "Root-CA00000002-CP00000007");
+		tmd->sys_version.hi = cpu_to_be32(0x00000001);
+		tmd->sys_version.lo = cpu_to_be32(36);	// IOS36
+		tmd->title_id = title_id;
+		tmd->nbr_cont = cpu_to_be16(1);
+		RVL_Content_Entry *const content = reinterpret_cast<RVL_Content_Entry*>(&buf[SYNTH_TMD_OFFSET + sizeof(*tmd)]);
+		content->type = cpu_to_be16(RVL_CONTENT_TYPE_DEFAULT);
+
+		pthdr->tmd_size = cpu_to_be32(sizeof(*tmd) + sizeof(*content));
+		pthdr->tmd_offset = cpu_to_be32(SYNTH_TMD_OFFSET >> 2);
+		pthdr->data_offset = cpu_to_be32(SYNTH_PARTITION_HEADER_SIZE >> 2);
+		ret = synth_pwrite(file, buf.data(), SYNTH_PARTITION_HEADER_SIZE, SYNTH_GAME_PARTITION_ADDRESS);
+	}
+
+	// Game partition data.
+	// The first sector starts with a copy of the disc header. (boot.bin)
+	const off64_t data_addr = SYNTH_GAME_PARTITION_ADDRESS + SYNTH_PARTITION_HEADER_SIZE;
+	for (unsigned int g = 0; ret == 0 && g < group_count; g++) {
+		synth_fill(buf.data(), buf.size(), static_cast<uint64_t>(g) * GROUP_SIZE_DEC);
+		if (g == 0) {
+			memcpy(buf.data(), &discHeader, sizeof(discHeader));
+		}
+		ret = synth_pwrite(file, buf.data(), buf.size(), data_addr + static_cast<off64_t>(g) * GROUP_SIZE_DEC);
+	}
+
+	file->unref();
+	return ret;
+}
+
+/**
+ * Create a synthetic Wii disc image.
+ *
+ * An unencrypted image with a single game partition is created first,
+ * using a debug ticket with a test title key. It's then encrypted with
+ * RvtH::copyToGcm_doCrypt(), which builds the H0-H4 hash trees, so
+ * the disc image passes verification.
+ *
+ * NOTE: The ticket and TMD signatures aren't valid.
+ *
+ * @param filename	[in] Filename. (plain disc image)
+ * @param params	[in] Image parameters.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int synth_image_create_wii(const TCHAR *filename, const SynthImageParams *params)
+{
+	if (!filename || !params || params->data_mb == 0) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	// Round up to whole groups.
+	const unsigned int group_count = (params->data_mb + 1) / 2;
+	if (group_count > ARRAY_SIZE(((Wii_Disc_H3_t*)nullptr)->h3)) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	// Create the unencrypted image.
+	tstring tmp_filename(filename);
+	tmp_filename += _T(".dec.tmp");
+	int ret = synth_create_wii_unencrypted(tmp_filename.c_str(), group_count);
+	if (ret != 0) {
+		_tremove(tmp_filename.c_str());
+		return ret;
+	}
+
+	// Encrypt it.
+	const uint64_t used_size = SYNTH_GAME_PARTITION_ADDRESS + SYNTH_PARTITION_HEADER_SIZE +
+		SYNTH_H3_TABLE_SIZE + static_cast<uint64_t>(group_count) * GROUP_SIZE_ENC;
+	const uint64_t total_size = synth_total_size(used_size, params->sparse_pct);
+	{
+		unique_ptr<RvtH> rvth_src(new RvtH(tmp_filename.c_str(), &ret));
+		if (!rvth_src->isOpen()) {
+			_tremove(tmp_filename.c_str());
+			return (ret != 0 ? ret : -EIO);
+		}
+		unique_ptr<RvtH> rvth_dest(new RvtH(filename, static_cast<uint32_t>(BYTES_TO_LBA(total_size)), &ret));
+		if (!rvth_dest->isOpen()) {
+			_tremove(tmp_filename.c_str());
+			return (ret != 0 ? ret : -EIO);
+		}
+		ret = rvth_src->copyToGcm_doCrypt(rvth_dest.get(), 0);
+	}
+	_tremove(tmp_filename.c_str());
+	if (ret != 0) {
+		return ret;
+	}
+
+	// Add the empty space at the end of the image.
+	RefFile *const file = new RefFile(filename);
+	if (!file->isOpen()) {
+		ret = -file->lastError();
+		file->unref();
+		return (ret != 0 ? ret : -EIO);
+	}
+	ret = file->makeWritable();
+	if (ret == 0 && file->size() < static_cast<off64_t>(total_size)) {
+		file->makeSparse(static_cast<off64_t>(total_size));
+		if (file->size() < static_cast<off64_t>(total_size)) {
+			// makeSparse() doesn't work on all file systems,
+			// so write the last LBA to set the file size.
+			static const uint8_t zero_lba[LBA_SIZE] = {0};
+			ret = synth_pwrite(file, zero_lba, sizeof(zero_lba),
+				static_cast<off64_t>(total_size) - LBA_SIZE);
+		}
+	}
+	file->unref();
+	return ret;
+}
+
+/**
+ * Convert a disc image to a different container format.
+ * The format is selected based on the destination file extension,
+ * e.g. ".ciso" or ".wbfs".
+ * @param src_filename	[in] Source disc image.
+ * @param dest_filename	[in] Destination disc image.
+ * @return 0 on success; negative POSIX error code or positive RvtH_Errors code on error.
+ */
+int synth_image_convert(const TCHAR *src_filename, const TCHAR *dest_filename)
+{
+	int ret = 0;
+	unique_ptr<RvtH> rvth(new RvtH(src_filename, &ret));
+	if (!rvth->isOpen()) {
+		return (ret != 0 ? ret : -EIO);
+	}
+	return rvth->extract(0, dest_filename, -1, 0);
+}
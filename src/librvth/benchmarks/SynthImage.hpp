@@ -0,0 +1,62 @@
+/***************************************************************************
+ * RVT-H Tool (librvth/benchmarks)                                         *
+ * SynthImage.hpp: Synthetic disc image generator.                         *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_BENCHMARKS_SYNTHIMAGE_HPP__
+#define __RVTHTOOL_LIBRVTH_BENCHMARKS_SYNTHIMAGE_HPP__
+
+#include "tcharx.h"
+#include <stdint.h>
+
+/**
+ * Synthetic disc image parameters.
+ */
+struct SynthImageParams {
+	unsigned int data_mb;		// Size of the game data, in MiB. (rounded up to 2 MiB for Wii)
+	unsigned int sparse_pct;	// Percentage of the disc image that's empty space after the game data. (0-95)
+};
+
+/**
+ * Create a synthetic GameCube disc image.
+ *
+ * The disc image has a valid disc header, followed by the
+ * game data, which is filled with a non-repeating pattern.
+ * The empty space at the end of the image isn't written.
+ *
+ * @param filename	[in] Filename. (plain disc image)
+ * @param params	[in] Image parameters.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int synth_image_create_gcn(const TCHAR *filename, const SynthImageParams *params);
+
+/**
+ * Create a synthetic Wii disc image.
+ *
+ * An unencrypted image with a single game partition is created first,
+ * using a debug ticket with a test title key. It's then encrypted with
+ * RvtH::copyToGcm_doCrypt(), which builds the H0-H4 hash trees, so
+ * the disc image passes verification.
+ *
+ * NOTE: The ticket and TMD signatures aren't valid.
+ *
+ * @param filename	[in] Filename. (plain disc image)
+ * @param params	[in] Image parameters.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int synth_image_create_wii(const TCHAR *filename, const SynthImageParams *params);
+
+/**
+ * Convert a disc image to a different container format.
+ * The format is selected based on the destination file extension,
+ * e.g. ".ciso" or ".wbfs".
+ * @param src_filename	[in] Source disc image.
+ * @param dest_filename	[in] Destination disc image.
+ * @return 0 on success; negative POSIX error code or positive RvtH_Errors code on error.
+ */
+int synth_image_convert(const TCHAR *src_filename, const TCHAR *dest_filename);
+
+#endif /* __RVTHTOOL_LIBRVTH_BENCHMARKS_SYNTHIMAGE_HPP__ */
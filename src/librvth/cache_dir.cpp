@@ -0,0 +1,223 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * cache_dir.cpp: rvthtool cache directory functions.                      *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "config.librvth.h"
+
+#include "cache_dir.hpp"
+#include "RefFile.hpp"
+
+#ifdef HAVE_QUERY
+#  include "query.h"
+#endif /* HAVE_QUERY */
+
+// C includes
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#  include <direct.h>
+#endif /* _WIN32 */
+
+// C includes (C++ namespace)
+#include <cerrno>
+#include <cstdio>
+
+// C++ includes
+#include <string>
+using std::tstring;
+
+/**
+ * Create a directory if it doesn't exist.
+ * @param path Directory.
+ * @return True if the directory exists; false if not.
+ */
+static bool mkdir_if_missing(const tstring &path)
+{
+#ifdef _WIN32
+	int ret = _tmkdir(path.c_str());
+#else /* !_WIN32 */
+	int ret = _tmkdir(path.c_str(), 0755);
+#endif /* _WIN32 */
+	return (ret == 0 || errno == EEXIST);
+}
+
+/**
+ * Get the rvthtool cache directory, creating it if necessary.
+ * @return Cache directory, or empty string if it isn't available.
+ */
+tstring rvth_get_cache_directory(void)
+{
+	tstring dir;
+
+#ifdef _WIN32
+	const TCHAR *const localAppData = _tgetenv(_T("LOCALAPPDATA"));
+	if (!localAppData || localAppData[0] == _T('\0')) {
+		return dir;
+	}
+	dir = localAppData;
+	dir += _T("\\rvthtool");
+#else /* !_WIN32 */
+	// XDG_CACHE_HOME must be an absolute path.
+	const char *const xdg_cache_home = getenv("XDG_CACHE_HOME");
+	if (xdg_cache_home && xdg_cache_home[0] == '/') {
+		dir = xdg_cache_home;
+	} else {
+		const char *const home = getenv("HOME");
+		if (!home || home[0] != '/') {
+			return dir;
+		}
+		dir = home;
+		dir += "/.cache";
+	}
+	if (!mkdir_if_missing(dir)) {
+		return tstring();
+	}
+	dir += "/rvthtool";
+#endif /* _WIN32 */
+
+	if (!mkdir_if_missing(dir)) {
+		return tstring();
+	}
+	return dir;
+}
+
+/**
+ * Get the device key for an RVT-H Reader or disk image.
+ * This is the RVT-H Reader's serial number (or the image's full path),
+ * followed by the device size.
+ * @param f_img		[in] RefFile*
+ * @return Device key, or empty string on error.
+ */
+tstring rvth_get_device_key(RefFile *f_img)
+{
+	tstring key;
+
+	const off64_t size = f_img->size();
+	if (size <= 0) {
+		return key;
+	}
+
+#ifdef HAVE_QUERY
+	if (f_img->isDevice()) {
+		// Use the RVT-H Reader's serial number, since the
+		// device name may change when it's reconnected.
+		TCHAR *const serial = rvth_get_device_serial_number(f_img->filename(), nullptr);
+		if (serial) {
+			key = _T("serial:");
+			key += serial;
+			free(serial);
+		}
+	}
+#endif /* HAVE_QUERY */
+
+	if (key.empty() && f_img->isRemote()) {
+		// Use the URL.
+		key = _T("url:");
+		key += f_img->filename();
+	} else if (key.empty()) {
+		// Use the full path.
+#ifdef _WIN32
+		TCHAR *const fullpath = _tfullpath(nullptr, f_img->filename(), 0);
+#else /* !_WIN32 */
+		char *const fullpath = realpath(f_img->filename(), nullptr);
+#endif /* _WIN32 */
+		if (!fullpath) {
+			return key;
+		}
+		key = _T("file:");
+		key += fullpath;
+		free(fullpath);
+	}
+
+	TCHAR buf[32];
+	_sntprintf(buf, ARRAY_SIZE(buf), _T(":%lld"), static_cast<long long>(size));
+	key += buf;
+	return key;
+}
+
+/**
+ * Get the filename of a cache file for a device key.
+ * The filename is the FNV-1a hash of the device key, plus a suffix.
+ * @param key		[in] Device key
+ * @param suffix	[in] Filename suffix, e.g. ".bin"
+ * @return Full path to the cache file, or empty string if the cache directory isn't available.
+ */
+tstring rvth_get_cache_filename(const tstring &key, const TCHAR *suffix)
+{
+	tstring filename = rvth_get_cache_directory();
+	if (filename.empty()) {
+		return filename;
+	}
+
+	uint64_t hash = 0xCBF29CE484222325ULL;
+	const uint8_t *const key8 = reinterpret_cast<const uint8_t*>(key.data());
+	const size_t key_size = key.size() * sizeof(TCHAR);
+	for (size_t i = 0; i < key_size; i++) {
+		hash ^= key8[i];
+		hash *= 0x100000001B3ULL;
+	}
+	TCHAR buf[32];
+	_sntprintf(buf, ARRAY_SIZE(buf), _T("%016llx"), static_cast<unsigned long long>(hash));
+
+#ifdef _WIN32
+	filename += _T('\\');
+#else /* !_WIN32 */
+	filename += '/';
+#endif /* _WIN32 */
+	filename += buf;
+	filename += suffix;
+	return filename;
+}
+
+/**
+ * Write a cache file.
+ * The data is written to a temporary file, which is then renamed,
+ * so a concurrent reader never sees a partially-written file.
+ * @param filename	[in] Cache filename
+ * @param data		[in] Data
+ * @param size		[in] Size of data, in bytes
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rvth_write_cache_file(const tstring &filename, const void *data, size_t size)
+{
+	const tstring tmp_filename = filename + _T(".tmp");
+	FILE *f = _tfopen(tmp_filename.c_str(), _T("wb"));
+	if (!f) {
+		int err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		return -err;
+	}
+
+	bool ok = (fwrite(data, 1, size, f) == size);
+	int err = (ok ? 0 : errno);
+	if (fclose(f) != 0 && ok) {
+		ok = false;
+		err = errno;
+	}
+	if (ok) {
+#ifdef _WIN32
+		// rename() doesn't replace existing files on Windows.
+		_tremove(filename.c_str());
+#endif /* _WIN32 */
+		ok = (_trename(tmp_filename.c_str(), filename.c_str()) == 0);
+		if (!ok) {
+			err = errno;
+		}
+	}
+	if (!ok) {
+		_tremove(tmp_filename.c_str());
+		if (err == 0) {
+			err = EIO;
+		}
+		return -err;
+	}
+
+	return 0;
+}
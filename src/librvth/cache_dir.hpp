@@ -0,0 +1,54 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * cache_dir.hpp: rvthtool cache directory functions.                      *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#pragma once
+
+#include "tcharx.h"
+
+// C includes
+#include <stddef.h>
+
+// C++ includes
+#include <string>
+
+class RefFile;
+
+/**
+ * Get the rvthtool cache directory, creating it if necessary.
+ * @return Cache directory, or empty string if it isn't available.
+ */
+std::tstring rvth_get_cache_directory(void);
+
+/**
+ * Get the device key for an RVT-H Reader or disk image.
+ * This is the RVT-H Reader's serial number (or the image's full path),
+ * followed by the device size.
+ * @param f_img		[in] RefFile*
+ * @return Device key, or empty string on error.
+ */
+std::tstring rvth_get_device_key(RefFile *f_img);
+
+/**
+ * Get the filename of a cache file for a device key.
+ * The filename is the FNV-1a hash of the device key, plus a suffix.
+ * @param key		[in] Device key
+ * @param suffix	[in] Filename suffix, e.g. ".bin"
+ * @return Full path to the cache file, or empty string if the cache directory isn't available.
+ */
+std::tstring rvth_get_cache_filename(const std::tstring &key, const TCHAR *suffix);
+
+/**
+ * Write a cache file.
+ * The data is written to a temporary file, which is then renamed,
+ * so a concurrent reader never sees a partially-written file.
+ * @param filename	[in] Cache filename
+ * @param data		[in] Data
+ * @param size		[in] Size of data, in bytes
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rvth_write_cache_file(const std::tstring &filename, const void *data, size_t size);
@@ -0,0 +1,576 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * compare.cpp: Compare two banks.                                         *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "rvth.hpp"
+#include "ptbl.h"
+#include "rvth_error.h"
+#include "BufferPool.hpp"
+#include "HashIndex.hpp"
+#include "ProgressRate.hpp"
+#include "ProgressThrottle.hpp"
+#include "StatsCounters.hpp"
+
+#include "nhcd_structs.h"
+
+// Disc image reader.
+#include "reader/Reader.hpp"
+#include "reader/ReadAheadQueue.hpp"
+
+// libwiicrypto
+#include "libwiicrypto/aesw.h"
+#include "libwiicrypto/wii_sector.h"
+
+// C includes (C++ namespace)
+#include <cerrno>
+#include <cstring>
+
+// C++ includes
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <vector>
+using std::unique_ptr;
+using std::vector;
+
+// Ranges of LBAs. ({lba_start, lba_len}, sorted)
+typedef vector<std::pair<uint32_t, uint32_t> > LbaRanges;
+
+// Block size for narrowing down differences, in LBAs.
+static constexpr uint32_t COMPARE_BLOCK_LBA = BYTES_TO_LBA(32U * 1024U);
+
+// Number of LBAs in an encrypted Wii sector.
+static constexpr uint32_t SECTOR_LBA = BYTES_TO_LBA(SECTOR_SIZE_ENC);
+// Number of sectors in a group.
+static constexpr unsigned int GROUP_SECTORS = GROUP_SIZE_ENC / SECTOR_SIZE_ENC;
+
+/**
+ * Check if a bank can be compared.
+ * @param entry	[in] Bank entry.
+ * @return 0 if the bank can be compared; otherwise, RvtH_Errors code.
+ */
+static int checkBankType(const RvtH_BankEntry *entry)
+{
+	switch (entry->type) {
+		case RVTH_BankType_GCN:
+		case RVTH_BankType_Wii_SL:
+		case RVTH_BankType_Wii_DL:
+			return 0;
+
+		case RVTH_BankType_Unknown:
+		default:
+			errno = EIO;
+			return RVTH_ERROR_BANK_UNKNOWN;
+
+		case RVTH_BankType_Empty:
+			errno = ENOENT;
+			return RVTH_ERROR_BANK_EMPTY;
+
+		case RVTH_BankType_Wii_DL_Bank2:
+			errno = EIO;
+			return RVTH_ERROR_BANK_DL_2;
+	}
+}
+
+/**
+ * Add a range of LBAs, merging it with the last range if they're adjacent.
+ * Ranges must be added in order.
+ * @param ranges	[in,out] Ranges.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ */
+static void addRange(LbaRanges &ranges, uint32_t lba_start, uint32_t lba_len)
+{
+	if (!ranges.empty() && ranges.back().first + ranges.back().second == lba_start) {
+		ranges.back().second += lba_len;
+	} else {
+		ranges.emplace_back(lba_start, lba_len);
+	}
+}
+
+/**
+ * Count the LBAs of a range that are within a set of ranges.
+ * @param ranges	[in] Ranges.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Number of LBAs within the ranges.
+ */
+static uint32_t countInRanges(const LbaRanges &ranges, uint32_t lba_start, uint32_t lba_len)
+{
+	const uint64_t lba_end = static_cast<uint64_t>(lba_start) + lba_len;
+	auto iter = std::upper_bound(ranges.cbegin(), ranges.cend(), lba_start,
+		[](uint32_t lba, const std::pair<uint32_t, uint32_t> &range) {
+			return lba < range.first;
+		});
+	if (iter != ranges.cbegin()) {
+		--iter;
+	}
+
+	uint32_t count = 0;
+	for (; iter != ranges.cend() && iter->first < lba_end; ++iter) {
+		const uint64_t start = std::max<uint64_t>(iter->first, lba_start);
+		const uint64_t end = std::min<uint64_t>(static_cast<uint64_t>(iter->first) + iter->second, lba_end);
+		if (end > start) {
+			count += static_cast<uint32_t>(end - start);
+		}
+	}
+	return count;
+}
+
+/**
+ * Add a difference, merging it with the last difference if they're
+ * adjacent and of the same type.
+ * @param diffs		[in,out] Differences.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @param type		[in] Type of difference. (See RvtH_Compare_Type.)
+ * @param pt_index	[in] Partition index, or -1.
+ */
+static void addDiff(vector<RvtH_Compare_Diff> &diffs, uint32_t lba_start, uint32_t lba_len,
+	uint8_t type, int pt_index)
+{
+	if (!diffs.empty()) {
+		RvtH_Compare_Diff &last = diffs.back();
+		if (last.type == type && last.pt_index == pt_index &&
+		    last.lba_start + last.lba_len == lba_start)
+		{
+			last.lba_len += lba_len;
+			return;
+		}
+	}
+
+	RvtH_Compare_Diff diff;
+	diff.lba_start = lba_start;
+	diff.lba_len = lba_len;
+	diff.type = type;
+	diff.pt_index = pt_index;
+	diffs.push_back(diff);
+}
+
+/**
+ * Find the LBAs of a chunk that differ between two banks.
+ *
+ * The chunk is compared with a single memcmp() first, which is
+ * vectorized by the C library, so identical chunks are handled
+ * quickly. Differing chunks are narrowed down by block, then by LBA.
+ *
+ * @param buf_a		[in] Data from the first bank.
+ * @param buf_b		[in] Data from the second bank.
+ * @param lba_start	[in] Starting LBA of the chunk.
+ * @param lba_len	[in] Length of the chunk, in LBAs.
+ * @param skip		[in] LBAs to ignore.
+ * @param diffs		[in,out] Differences.
+ */
+static void diffChunk(const uint8_t *buf_a, const uint8_t *buf_b,
+	uint32_t lba_start, uint32_t lba_len, const LbaRanges &skip,
+	vector<RvtH_Compare_Diff> &diffs)
+{
+	if (!memcmp(buf_a, buf_b, static_cast<size_t>(LBA_TO_BYTES(lba_len)))) {
+		// Chunk is identical.
+		return;
+	}
+
+	for (uint32_t blk = 0; blk < lba_len; blk += COMPARE_BLOCK_LBA) {
+		const uint32_t blk_len = std::min(COMPARE_BLOCK_LBA, lba_len - blk);
+		if (!memcmp(&buf_a[LBA_TO_BYTES(blk)], &buf_b[LBA_TO_BYTES(blk)],
+		            static_cast<size_t>(LBA_TO_BYTES(blk_len))) ||
+		    countInRanges(skip, lba_start + blk, blk_len) == blk_len)
+		{
+			continue;
+		}
+
+		for (uint32_t lba = blk; lba < blk + blk_len; lba++) {
+			if (memcmp(&buf_a[LBA_TO_BYTES(lba)], &buf_b[LBA_TO_BYTES(lba)], LBA_SIZE) != 0 &&
+			    countInRanges(skip, lba_start + lba, 1) == 0)
+			{
+				addDiff(diffs, lba_start + lba, 1, RVTH_COMPARE_RAW, -1);
+			}
+		}
+	}
+}
+
+/**
+ * A Wii partition that's compared using its H3 table.
+ */
+struct H3Partition {
+	const HashIndex::Partition *pa;	// Partition in the first bank
+	const HashIndex::Partition *pb;	// Partition in the second bank
+	int pt_index;			// Partition index in the first bank
+	bool same_key;			// True if both banks use the same title key (or are unencrypted)
+	AesCtx *aesw_a;			// AES context for the first bank (nullptr if unencrypted)
+	AesCtx *aesw_b;			// AES context for the second bank (nullptr if unencrypted)
+};
+
+/**
+ * Create an AES context for a title key.
+ * @param title_key	[in] Title key. (16 bytes)
+ * @return AES context, or nullptr on error.
+ */
+static AesCtx *newTitleKeyAes(const uint8_t *title_key)
+{
+	AesCtx *const aesw = aesw_new();
+	if (aesw) {
+		aesw_set_key(aesw, title_key, 16);
+	}
+	return aesw;
+}
+
+/**
+ * Decrypt the sectors of a group in place.
+ * @param aesw		[in,opt] AES context. (nullptr if unencrypted)
+ * @param gdata		[in,out] Group data.
+ * @param sectors	[in] Number of sectors.
+ */
+static void decryptGroup(AesCtx *aesw, Wii_Disc_Sector_t *gdata, unsigned int sectors)
+{
+	if (!aesw) {
+		return;
+	}
+
+	static const uint8_t zero_iv[16] = {0};
+	StatsTimer timer(StatsCounters::TIMER_AES);
+	for (unsigned int i = 0; i < sectors; i++) {
+		// The data IV is stored in the encrypted hash area,
+		// so the data must be decrypted first.
+		Wii_Disc_Sector_t *const sector = &gdata[i];
+		aesw_set_iv(aesw, &sector->hashes.H2[7][4], 16);
+		aesw_decrypt(aesw, sector->data, sizeof(sector->data));
+		aesw_set_iv(aesw, zero_iv, sizeof(zero_iv));
+		aesw_decrypt(aesw, reinterpret_cast<uint8_t*>(&sector->hashes), sizeof(sector->hashes));
+	}
+}
+
+/**
+ * Compare a bank with a bank in another RVT-H device or disc image.
+ *
+ * Wii partitions that are at the same location in both banks are
+ * compared using their H3 tables first. Only the groups whose H3
+ * entries differ are decrypted, and the differing sectors are
+ * reported as RVTH_COMPARE_DECRYPTED. Groups with matching H3 entries
+ * are compared directly if both banks use the same title key; if the
+ * title keys differ, they're assumed to be identical, so banks with
+ * different encryption keys can be compared.
+ *
+ * Everything else is read from both banks concurrently, in large
+ * chunks, and compared directly. Differences are merged into
+ * contiguous regions, sorted by LBA.
+ *
+ * @param bank		[in] Bank number in this object (0-7)
+ * @param other		[in] Other RvtH object (may be this object)
+ * @param bank_other	[in] Bank number in the other object (0-7)
+ * @param diffs		[out] Differences (empty if the banks are identical)
+ * @param callback	[in,opt] Progress callback (RVTH_PROGRESS_COMPARE)
+ * @param userdata	[in,opt] User data for progress callback
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int RvtH::compareBank(unsigned int bank, RvtH *other, unsigned int bank_other,
+	vector<RvtH_Compare_Diff> &diffs,
+	RvtH_Progress_Callback callback, void *userdata)
+{
+	diffs.clear();
+	if (!other) {
+		errno = EINVAL;
+		return -EINVAL;
+	} else if (bank >= m_bankCount || bank_other >= other->m_bankCount) {
+		errno = ERANGE;
+		return -ERANGE;
+	} else if (other == this && bank == bank_other) {
+		// Comparing a bank with itself.
+		return 0;
+	}
+
+	StatsScope scope(m_stats);
+	RvtH_BankEntry *const entry_a = getBankEntry(bank);
+	RvtH_BankEntry *const entry_b = other->getBankEntry(bank_other);
+	int ret = checkBankType(entry_a);
+	if (ret == 0) {
+		ret = checkBankType(entry_b);
+	}
+	if (ret != 0) {
+		return ret;
+	}
+
+	const uint32_t lba_common = std::min(entry_a->lba_len, entry_b->lba_len);
+
+	// Find the Wii partitions that can be compared using H3 tables.
+	// Partitions must be at the same location in both banks.
+	HashIndex idx_a, idx_b;
+	vector<H3Partition> h3_pts;
+	auto freeKeys = [&h3_pts]() {
+		for (const H3Partition &h3p : h3_pts) {
+			aesw_free(h3p.aesw_a);
+			aesw_free(h3p.aesw_b);
+		}
+	};
+	if (entry_a->type != RVTH_BankType_GCN && entry_b->type != RVTH_BankType_GCN &&
+	    idx_a.init(entry_a) == 0 && idx_b.init(entry_b) == 0)
+	{
+		for (unsigned int i = 0; i < idx_a.partitionCount(); i++) {
+			const HashIndex::Partition *const pa = idx_a.partition(i);
+			if (!pa->H3) {
+				continue;
+			}
+			const HashIndex::Partition *pb = nullptr;
+			for (unsigned int j = 0; j < idx_b.partitionCount(); j++) {
+				const HashIndex::Partition *const p = idx_b.partition(j);
+				if (p->lba_start == pa->lba_start && p->data_lba == pa->data_lba && p->H3) {
+					pb = p;
+					break;
+				}
+			}
+			if (!pb) {
+				continue;
+			}
+
+			// Find the partition table entries for the title keys.
+			const pt_entry_t *pte_a = nullptr, *pte_b = nullptr;
+			int pt_index = -1;
+			for (unsigned int j = 0; j < entry_a->pt_count; j++) {
+				if (entry_a->ptbl[j].lba_start == pa->lba_start) {
+					pte_a = &entry_a->ptbl[j];
+					pt_index = static_cast<int>(j);
+					break;
+				}
+			}
+			for (unsigned int j = 0; j < entry_b->pt_count; j++) {
+				if (entry_b->ptbl[j].lba_start == pb->lba_start) {
+					pte_b = &entry_b->ptbl[j];
+					break;
+				}
+			}
+			const RVL_PartitionHeader *const hdr_a = (pte_a ? rvth_ptbl_get_header(entry_a, pte_a) : nullptr);
+			const RVL_PartitionHeader *const hdr_b = (pte_b ? rvth_ptbl_get_header(entry_b, pte_b) : nullptr);
+			if (!hdr_a || !hdr_b) {
+				// Compare the partition directly.
+				continue;
+			}
+
+			// Decrypt the title keys.
+			// If a title key can't be decrypted, the partition is compared directly.
+			const bool enc_a = (entry_a->crypto_type != RVL_CryptoType_None);
+			const bool enc_b = (entry_b->crypto_type != RVL_CryptoType_None);
+			uint8_t key_a[16], key_b[16];
+			uint8_t crypto_type;
+			if ((enc_a && decryptTitleKey(&hdr_a->ticket, key_a, &crypto_type) != 0) ||
+			    (enc_b && other->decryptTitleKey(&hdr_b->ticket, key_b, &crypto_type) != 0))
+			{
+				continue;
+			}
+
+			H3Partition h3p;
+			h3p.pa = pa;
+			h3p.pb = pb;
+			h3p.pt_index = pt_index;
+			h3p.same_key = (enc_a == enc_b && (!enc_a || !memcmp(key_a, key_b, sizeof(key_a))));
+			h3p.aesw_a = (enc_a ? newTitleKeyAes(key_a) : nullptr);
+			h3p.aesw_b = (enc_b ? newTitleKeyAes(key_b) : nullptr);
+			if ((enc_a && !h3p.aesw_a) || (enc_b && !h3p.aesw_b)) {
+				aesw_free(h3p.aesw_a);
+				aesw_free(h3p.aesw_b);
+				continue;
+			}
+			h3_pts.push_back(h3p);
+		}
+	}
+
+	// Progress: Every LBA in the common range is counted once,
+	// either when its group is compared or when its chunk is compared.
+	RvtH_Progress_State state;
+	ProgressRate rate;
+	ProgressThrottle throttle(&m_progressParams);
+	uint32_t lba_processed = 0;
+	if (callback) {
+		state.rvth = this;
+		state.rvth_gcm = other;
+		state.bank_rvth = bank;
+		state.bank_gcm = bank_other;
+		state.type = RVTH_PROGRESS_COMPARE;
+		state.lba_processed = 0;
+		state.lba_total = lba_common;
+		state.digests = nullptr;
+	}
+	auto progress = [&](bool force) -> bool {
+		if (StatsCounters::cancelled()) {
+			return false;
+		}
+		if (!callback || !(force || throttle.ready(LBA_TO_BYTES(static_cast<uint64_t>(lba_processed))))) {
+			return true;
+		}
+		state.lba_processed = lba_processed;
+		rate.update(&state);
+		return callback(&state, userdata);
+	};
+	if (!progress(true)) {
+		freeKeys();
+		errno = ECANCELED;
+		return -ECANCELED;
+	}
+
+	// Pass 1: Compare the H3 partitions.
+	// LBAs compared here are skipped in pass 2.
+	LbaRanges skip;
+	static const uint32_t group_lba = BYTES_TO_LBA(HashIndex::GROUP_SIZE);
+	PoolBuffer gdata_a, gdata_b;
+	for (const H3Partition &h3p : h3_pts) {
+		const uint32_t data_start = h3p.pa->lba_start + h3p.pa->data_lba;
+		if (data_start >= lba_common) {
+			continue;
+		}
+
+		// Only complete sectors within both banks are compared.
+		const uint32_t data_len = std::min(std::min(h3p.pa->data_len, h3p.pb->data_len),
+			lba_common - data_start);
+		const uint32_t group_count = (data_len + group_lba - 1) / group_lba;
+		for (uint32_t g = 0; g < group_count; g++) {
+			const uint32_t group_start = data_start + (g * group_lba);
+			const unsigned int sectors = std::min(group_lba, data_len - (g * group_lba)) / SECTOR_LBA;
+			if (sectors == 0) {
+				break;
+			}
+			const uint32_t lba_len = sectors * SECTOR_LBA;
+			if (sectors == GROUP_SECTORS &&
+			    !memcmp(h3p.pa->H3->h3[g], h3p.pb->H3->h3[g], sizeof(h3p.pa->H3->h3[g])))
+			{
+				// The H3 entries match, so the group doesn't have to be decrypted.
+				// If the title keys match, the encrypted data should also match,
+				// so it's compared directly in pass 2. Otherwise, the encrypted
+				// data can't be compared, so the H3 entries are trusted.
+				if (!h3p.same_key) {
+					addRange(skip, group_start, lba_len);
+					lba_processed += lba_len;
+				}
+				continue;
+			}
+			addRange(skip, group_start, lba_len);
+			lba_processed += lba_len;
+
+			// Read the group from both banks concurrently.
+			if (!gdata_a) {
+				gdata_a.reset(sizeof(Wii_Disc_Sector_t) * GROUP_SECTORS);
+				gdata_b.reset(sizeof(Wii_Disc_Sector_t) * GROUP_SECTORS);
+				if (!gdata_a || !gdata_b) {
+					freeKeys();
+					errno = ENOMEM;
+					return -ENOMEM;
+				}
+			}
+			uint32_t lba_read_b = 0;
+			std::thread th_b([&]() {
+				StatsScope thread_scope(m_stats);
+				lba_read_b = entry_b->reader->read(gdata_b.get(), group_start, lba_len);
+			});
+			const uint32_t lba_read_a = entry_a->reader->read(gdata_a.get(), group_start, lba_len);
+			th_b.join();
+			if (lba_read_a != lba_len || lba_read_b != lba_len) {
+				// Read error.
+				freeKeys();
+				const int err = (errno != 0 ? errno : EIO);
+				errno = err;
+				return -err;
+			}
+
+			Wii_Disc_Sector_t *const sa = gdata_a.as<Wii_Disc_Sector_t>();
+			Wii_Disc_Sector_t *const sb = gdata_b.as<Wii_Disc_Sector_t>();
+			decryptGroup(h3p.aesw_a, sa, sectors);
+			decryptGroup(h3p.aesw_b, sb, sectors);
+			for (unsigned int i = 0; i < sectors; i++) {
+				if (memcmp(&sa[i], &sb[i], sizeof(sa[i])) != 0) {
+					addDiff(diffs, group_start + (i * SECTOR_LBA), SECTOR_LBA,
+						RVTH_COMPARE_DECRYPTED, h3p.pt_index);
+				}
+			}
+
+			if (!progress(false)) {
+				freeKeys();
+				errno = ECANCELED;
+				return -ECANCELED;
+			}
+		}
+	}
+	freeKeys();
+
+	// Pass 2: Compare everything else directly.
+	// Each bank is read by its own read-ahead thread.
+	RvtH_CopyParams cp;
+	resolveCopyParams(entry_a->reader, other->m_file, &cp);
+	const uint32_t lba_chunk = BYTES_TO_LBA(cp.buf_size);
+	const size_t chunk_count = (static_cast<size_t>(lba_common) + lba_chunk - 1) / lba_chunk;
+	// Chunks that are unallocated in a bank's image are known to be
+	// empty, so they aren't read. If they're unallocated in both banks,
+	// they're identical, so they aren't compared.
+	vector<uint8_t> empty_a, empty_b;
+	entry_a->reader->getEmptyMap(0, lba_chunk, static_cast<unsigned int>(chunk_count), empty_a);
+	entry_b->reader->getEmptyMap(0, lba_chunk, static_cast<unsigned int>(chunk_count), empty_b);
+
+	vector<bool> used(chunk_count), read_a(chunk_count), read_b(chunk_count);
+	bool any_used = false;
+	for (size_t c = 0; c < chunk_count; c++) {
+		const uint32_t lba_start = static_cast<uint32_t>(c * lba_chunk);
+		const uint32_t lba_len = std::min(lba_chunk, lba_common - lba_start);
+		if (empty_a[c] && empty_b[c]) {
+			lba_processed += lba_len - countInRanges(skip, lba_start, lba_len);
+			continue;
+		}
+		used[c] = (countInRanges(skip, lba_start, lba_len) != lba_len);
+		read_a[c] = used[c] && !empty_a[c];
+		read_b[c] = used[c] && !empty_b[c];
+		any_used |= used[c];
+	}
+
+	if (any_used) {
+		ReadAheadQueue queue_a(entry_a->reader, 0, lba_common, lba_chunk, cp.buf_count, &read_a, cp.alignment);
+		ReadAheadQueue queue_b(entry_b->reader, 0, lba_common, lba_chunk, cp.buf_count, &read_b, cp.alignment);
+		if (!queue_a.isOpen() || !queue_b.isOpen()) {
+			errno = ENOMEM;
+			return -ENOMEM;
+		}
+
+		vector<RvtH_Compare_Diff> raw_diffs;
+		for (size_t c = 0; c < chunk_count; c++) {
+			uint32_t lba_start = 0, lba_len = 0;
+			const uint8_t *const buf_a = queue_a.next(&lba_start, &lba_len);
+			const uint8_t *const buf_b = queue_b.next();
+			if (!buf_a || !buf_b) {
+				// Read error.
+				const int err = (errno != 0 ? errno : EIO);
+				errno = err;
+				return -err;
+			}
+			if (!used[c]) {
+				continue;
+			}
+
+			diffChunk(buf_a, buf_b, lba_start, lba_len, skip, raw_diffs);
+			lba_processed += lba_len - countInRanges(skip, lba_start, lba_len);
+			if (lba_processed < lba_common && !progress(false)) {
+				errno = ECANCELED;
+				return -ECANCELED;
+			}
+		}
+
+		// Merge the differences from both passes.
+		vector<RvtH_Compare_Diff> h3_diffs;
+		h3_diffs.swap(diffs);
+		diffs.reserve(h3_diffs.size() + raw_diffs.size());
+		std::merge(h3_diffs.cbegin(), h3_diffs.cend(), raw_diffs.cbegin(), raw_diffs.cend(),
+			std::back_inserter(diffs),
+			[](const RvtH_Compare_Diff &a, const RvtH_Compare_Diff &b) {
+				return a.lba_start < b.lba_start;
+			});
+	}
+
+	// Data that's only in the longer bank.
+	if (entry_a->lba_len != entry_b->lba_len) {
+		addDiff(diffs, lba_common,
+			std::max(entry_a->lba_len, entry_b->lba_len) - lba_common,
+			RVTH_COMPARE_LENGTH, -1);
+	}
+
+	lba_processed = lba_common;
+	progress(true);
+	return 0;
+}
@@ -144,10 +144,12 @@ static uint32_t rvth_find_GamePartition_int(const ptbl_t *pt)
  * @param lba_start	[in] Starting LBA.
  * @param discHeader	[out] GCN disc header. (Not filled in if empty or unknown types.)
  * @param pIsDeleted	[out,opt] Set to true if the image appears to be "deleted".
+ * @param sector0	[in,opt] First LBA of the disc image, if it was already read.
  * @return Bank type, or negative POSIX error code. (See RvtH_BankType_e.)
  */
 int rvth_disc_header_get(RefFile *f_img, uint32_t lba_start,
-	GCN_DiscHeader *discHeader, bool *pIsDeleted)
+	GCN_DiscHeader *discHeader, bool *pIsDeleted,
+	const void *sector0)
 {
 	int ret = 0;	// errno setting
 	size_t size;
@@ -165,6 +167,7 @@ int rvth_disc_header_get(RefFile *f_img, uint32_t lba_start,
 	// Wii partition header.
 	RVL_PartitionHeader *pthdr = NULL;
 	int64_t data_offset;
+	off64_t data_addr;
 	const uint8_t *common_key;
 	uint8_t title_key[16];
 	uint8_t iv[16];
@@ -181,13 +184,13 @@ int rvth_disc_header_get(RefFile *f_img, uint32_t lba_start,
 	memset(discHeader, 0, sizeof(*discHeader));
 
 	// Read the disc header.
-	ret = f_img->seeko(LBA_TO_BYTES(lba_start), SEEK_SET);
-	if (ret != 0) {
-		// Seek error.
-		goto end;
-	}
 	errno = 0;
-	size = f_img->read(sbuf.u8, 1, sizeof(sbuf.u8));
+	if (sector0) {
+		memcpy(sbuf.u8, sector0, sizeof(sbuf.u8));
+		size = sizeof(sbuf.u8);
+	} else {
+		size = f_img->pread(sbuf.u8, sizeof(sbuf.u8), LBA_TO_BYTES(lba_start));
+	}
 	if (size != sizeof(sbuf.u8)) {
 		// Read error.
 		ret = -errno;
@@ -231,17 +234,8 @@ int rvth_disc_header_get(RefFile *f_img, uint32_t lba_start,
 	bankType = ret;
 
 	// Get the volume group table.
-	ret = f_img->seeko(LBA_TO_BYTES(lba_start) + RVL_VolumeGroupTable_ADDRESS, SEEK_SET);
-	if (ret != 0) {
-		// Seek error.
-		ret = -errno;
-		if (ret == 0) {
-			ret = -EIO;
-		}
-		goto end;
-	}
 	errno = 0;
-	size = f_img->read(sbuf.u8, 1, sizeof(sbuf.u8));
+	size = f_img->pread(sbuf.u8, sizeof(sbuf.u8), LBA_TO_BYTES(lba_start) + RVL_VolumeGroupTable_ADDRESS);
 	if (size != sizeof(sbuf.u8)) {
 		// Read error.
 		ret = -errno;
@@ -271,17 +265,8 @@ int rvth_disc_header_get(RefFile *f_img, uint32_t lba_start,
 		}
 		goto end;
 	}
-	ret = f_img->seeko(LBA_TO_BYTES(lba_start + game_lba), SEEK_SET);
-	if (ret != 0) {
-		// Seek error.
-		ret = -errno;
-		if (ret == 0) {
-			ret = -EIO;
-		}
-		goto end;
-	}
 	errno = 0;
-	size = f_img->read(pthdr, 1, sizeof(*pthdr));
+	size = f_img->pread(pthdr, sizeof(*pthdr), LBA_TO_BYTES(lba_start + game_lba));
 	if (size != sizeof(*pthdr)) {
 		// Read error.
 		ret = -errno;
@@ -300,17 +285,9 @@ int rvth_disc_header_get(RefFile *f_img, uint32_t lba_start,
 	}
 
 	// Read the first LBA of the partition.
-	ret = f_img->seeko(LBA_TO_BYTES(lba_start + game_lba) + data_offset, SEEK_SET);
-	if (ret != 0) {
-		// Seek error.
-		ret = -errno;
-		if (ret == 0) {
-			ret = -EIO;
-		}
-		goto end;
-	}
+	data_addr = LBA_TO_BYTES(lba_start + game_lba) + data_offset;
 	errno = 0;
-	size = f_img->read(sbuf.u8, 1, sizeof(sbuf.u8));
+	size = f_img->pread(sbuf.u8, sizeof(sbuf.u8), data_addr);
 	if (size != sizeof(sbuf.u8)) {
 		// Read error.
 		ret = -errno;
@@ -393,7 +370,7 @@ int rvth_disc_header_get(RefFile *f_img, uint32_t lba_start,
 	// Read the next LBA. This contains encrypted hashes,
 	// including the IV for the user data.
 	errno = 0;
-	size = f_img->read(sbuf.u8, 1, sizeof(sbuf.u8));
+	size = f_img->pread(sbuf.u8, sizeof(sbuf.u8), data_addr + LBA_SIZE);
 	if (size != sizeof(sbuf.u8)) {
 		// Read error.
 		ret = -errno;
@@ -406,7 +383,7 @@ int rvth_disc_header_get(RefFile *f_img, uint32_t lba_start,
 
 	// Read the first LBA of user data.
 	errno = 0;
-	size = f_img->read(sbuf.u8, 1, sizeof(sbuf.u8));
+	size = f_img->pread(sbuf.u8, sizeof(sbuf.u8), data_addr + (2 * LBA_SIZE));
 	if (size != sizeof(sbuf.u8)) {
 		// Read error.
 		ret = -errno;
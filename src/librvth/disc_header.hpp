@@ -45,9 +45,11 @@ int rvth_disc_header_identify(const struct _GCN_DiscHeader *discHeader);
  * @param lba_start	[in] Starting LBA.
  * @param discHeader	[out] GCN disc header. (Not filled in if empty or unknown types.)
  * @param pIsDeleted	[out,opt] Set to true if the image appears to be "deleted".
+ * @param sector0	[in,opt] First LBA of the disc image, if it was already read.
  * @return Bank type, or negative POSIX error code. (See RvtH_BankType_e.)
  */
 int rvth_disc_header_get(RefFile *f_img, uint32_t lba_start,
-	struct _GCN_DiscHeader *discHeader, bool *pIsDeleted);
+	struct _GCN_DiscHeader *discHeader, bool *pIsDeleted,
+	const void *sector0 = nullptr);
 
 #endif /* __RVTHTOOL_LIBRVTH_DISC_HEADER_H__ */
@@ -9,15 +9,34 @@
 #include "rvth.hpp"
 #include "ptbl.h"
 #include "rvth_error.h"
+#include "scrub.h"
+#include "BankCache.hpp"
+#include "BufferPool.hpp"
+#include "CopyJournal.hpp"
+#include "ReadbackVerifier.hpp"
+#include "HashIndex.hpp"
+#include "ImageDigest.hpp"
+#include "MappedWriter.hpp"
+#include "PartitionStore.hpp"
+#include "Pipeline.hpp"
+#include "ProgressRate.hpp"
+#include "ProgressThrottle.hpp"
+#include "StatsCounters.hpp"
+#include "TeeWriter.hpp"
+#include "ThreadPool.hpp"
+#include "VerifyCache.hpp"
+#include "VerifyMap.hpp"
 
 #include "byteswap.h"
 #include "nhcd_structs.h"
 
 // Disc image reader.
 #include "reader/Reader.hpp"
+#include "reader/ReadAheadQueue.hpp"
 
 // libwiicrypto
 #include "libwiicrypto/sig_tools.h"
+#include "libwiicrypto/wii_sector.h"
 
 // C includes
 #include <stdlib.h>
@@ -30,10 +49,18 @@
 #include <ctime>
 
 // C++ includes
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 using std::unique_ptr;
 using std::string;
+using std::vector;
 using std::wstring;
 
 // for disk free space
@@ -43,9 +70,291 @@ using std::wstring;
 #  include <sys/statvfs.h>
 #endif /* _WIN32 */
 
-// Buffer size
-static constexpr unsigned int BUF_SIZE = 1U * 1024U * 1024U;
-static constexpr unsigned int LBA_COUNT_BUF = BYTES_TO_LBA(BUF_SIZE);
+// Default buffer size
+static constexpr unsigned int BUF_SIZE_DEFAULT = 1U * 1024U * 1024U;
+// Default buffer size if only the destination is a device
+static constexpr unsigned int BUF_SIZE_DEVICE_DEST = 4U * 1024U * 1024U;
+// Default number of chunk buffers
+static constexpr unsigned int BUF_COUNT_DEFAULT = 3;
+// Default buffer alignment (4 KB page)
+static constexpr unsigned int BUF_ALIGNMENT_DEFAULT = 4096;
+// Default minimum hole size for sparse writes
+static constexpr unsigned int HOLE_SIZE_DEFAULT = 64U * 1024U;
+// Default sync interval for RVTH_DURABILITY_INTERVAL, in MB
+static constexpr unsigned int SYNC_INTERVAL_DEFAULT = 256;
+// Default distance that read-back verification trails the writer by, in MB
+static constexpr unsigned int READBACK_WINDOW_DEFAULT = 64;
+// Block size for differential import comparisons (one encrypted Wii sector)
+static constexpr unsigned int DIFF_BLOCK_SIZE = 32U * 1024U;
+// Amount of the next source image to prefetch for multi-bank imports
+static constexpr off64_t IMPORT_PREFETCH_SIZE = 64LL * 1024 * 1024;
+// Maximum amount of data queued for each destination of a tee extract
+static constexpr size_t TEE_QUEUE_MAX = 256U * 1024U * 1024U;
+
+/**
+ * Measure the read throughput of a source device for a few buffer sizes.
+ *
+ * The first few MB of the source are read using each buffer size.
+ * A larger buffer size is only selected if it's at least 10% faster.
+ *
+ * @param reader	[in] Source reader.
+ * @param alignment	[in] Buffer alignment.
+ * @return Buffer size, in bytes.
+ */
+static unsigned int tuneBufferSize(Reader *reader, unsigned int alignment)
+{
+	static const unsigned int buf_sizes[] = {
+		1U * 1024U * 1024U,
+		4U * 1024U * 1024U,
+		8U * 1024U * 1024U,
+	};
+	static constexpr unsigned int SAMPLE_SIZE = 8U * 1024U * 1024U;
+	if (reader->lba_len() < BYTES_TO_LBA(SAMPLE_SIZE) * ARRAY_SIZE(buf_sizes)) {
+		// Source is too small to measure.
+		return BUF_SIZE_DEFAULT;
+	}
+
+	PoolBuffer buf(SAMPLE_SIZE, alignment);
+	if (!buf) {
+		return BUF_SIZE_DEFAULT;
+	}
+
+	// Each buffer size reads a different area, since the
+	// OS will cache areas that have already been read.
+	unsigned int best_size = BUF_SIZE_DEFAULT;
+	double best_rate = 0;
+	uint32_t lba = 0;
+	for (unsigned int buf_size : buf_sizes) {
+		const uint32_t lba_count_buf = BYTES_TO_LBA(buf_size);
+		const auto start = std::chrono::steady_clock::now();
+		for (unsigned int i = 0; i < SAMPLE_SIZE / buf_size; i++, lba += lba_count_buf) {
+			if (reader->read(buf.get(), lba, lba_count_buf) != lba_count_buf) {
+				// Read error. Use the default buffer size.
+				return BUF_SIZE_DEFAULT;
+			}
+		}
+		const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		const double rate = SAMPLE_SIZE / std::max(elapsed.count(), 1e-6);
+		if (rate > best_rate * 1.1) {
+			best_rate = rate;
+			best_size = buf_size;
+		}
+	}
+
+	return best_size;
+}
+
+/**
+ * Set the copy buffer parameters for extracting and importing.
+ *
+ * If the buffer size is 0, it's selected automatically:
+ * - If neither image is a device, 1 MB buffers are used.
+ * - If the source is a device, the read throughput of the
+ *   first few MB is measured for a few buffer sizes.
+ * - If only the destination is a device, 4 MB buffers are used.
+ * - If the source image is stored in blocks (CISO, WBFS, RVTZ),
+ *   the buffer size is rounded up to a multiple of the block size.
+ *
+ * @param params	[in] Copy parameters.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int RvtH::setCopyParams(const RvtH_CopyParams *params)
+{
+	if (!params) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	if (params->buf_size != 0 &&
+	    (params->buf_size % RVTH_COPY_BUF_SIZE_MIN != 0 ||
+	     params->buf_size > RVTH_COPY_BUF_SIZE_MAX))
+	{
+		// Invalid buffer size.
+		errno = EINVAL;
+		return -EINVAL;
+	}
+	if (params->buf_count != 0 &&
+	    (params->buf_count < 2 || params->buf_count > RVTH_COPY_BUF_COUNT_MAX))
+	{
+		// Invalid buffer count.
+		errno = EINVAL;
+		return -EINVAL;
+	}
+	if (params->alignment != 0 &&
+	    ((params->alignment & (params->alignment - 1)) != 0 ||
+	     params->alignment > RVTH_COPY_ALIGNMENT_MAX))
+	{
+		// Invalid alignment.
+		errno = EINVAL;
+		return -EINVAL;
+	}
+	if (params->hole_size != 0 &&
+	    (params->hole_size % RVTH_COPY_HOLE_SIZE_MIN != 0 ||
+	     params->hole_size > RVTH_COPY_BUF_SIZE_MAX))
+	{
+		// Invalid hole size.
+		errno = EINVAL;
+		return -EINVAL;
+	}
+	if (params->mem_budget != 0 && params->mem_budget < RVTH_MEM_BUDGET_MIN) {
+		// Memory budget is too small.
+		errno = EINVAL;
+		return -EINVAL;
+	}
+	if (params->io_priority >= RVTH_IOPRIO_MAX) {
+		// Invalid I/O priority.
+		errno = EINVAL;
+		return -EINVAL;
+	}
+	if (params->readback_window > RVTH_READBACK_WINDOW_MAX) {
+		// Read-back window is too large.
+		errno = EINVAL;
+		return -EINVAL;
+	}
+	if (params->durability >= RVTH_DURABILITY_MAX) {
+		// Invalid durability policy.
+		errno = EINVAL;
+		return -EINVAL;
+	}
+	if (params->block_cache != 0 && params->block_cache != RVTH_BLOCK_CACHE_DISABLED &&
+	    (params->block_cache % 32U != 0 || params->block_cache > RVTH_BLOCK_CACHE_MAX))
+	{
+		// Invalid block cache size.
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	m_copyParams = *params;
+	m_stats->setSlowReadThreshold(params->slow_read_ms);
+	m_stats->ioThrottle()->setPriority(static_cast<RvtH_IO_Priority>(params->io_priority));
+	m_stats->ioThrottle()->setRate(static_cast<uint64_t>(params->bw_limit) * 1024U);
+	if (params->mem_budget != 0) {
+		BufferPool::instance()->setMaxCachedBytes(static_cast<size_t>(params->mem_budget) << 20);
+	}
+	m_file->setDurability(static_cast<RvtH_Durability>(params->durability),
+		static_cast<uint64_t>(params->sync_interval != 0 ? params->sync_interval : SYNC_INTERVAL_DEFAULT) << 20);
+	if (m_file->isDevice()) {
+		// Errors are ignored, since buffered I/O still works.
+		m_file->setDirectIO(params->direct_io != 0);
+	}
+	return 0;
+}
+
+/**
+ * Resolve the copy buffer parameters for a copy operation.
+ * Automatic values are replaced with the actual values.
+ * @param reader_src	[in] Source reader.
+ * @param file_dest	[in] Destination file.
+ * @param params	[out] Resolved copy parameters.
+ */
+void RvtH::resolveCopyParams(Reader *reader_src, const RefFile *file_dest, RvtH_CopyParams *params) const
+{
+	*params = m_copyParams;
+	if (params->buf_count == 0) {
+		params->buf_count = BUF_COUNT_DEFAULT;
+	}
+	if (params->alignment == 0) {
+		params->alignment = BUF_ALIGNMENT_DEFAULT;
+	}
+	if (params->hole_size == 0) {
+		params->hole_size = HOLE_SIZE_DEFAULT;
+	}
+	if (params->readback_window == 0) {
+		params->readback_window = READBACK_WINDOW_DEFAULT;
+	}
+	if (params->sync_interval == 0) {
+		params->sync_interval = SYNC_INTERVAL_DEFAULT;
+	}
+
+	// Direct I/O requires sector-aligned buffers.
+	// NOTE: Sector sizes are powers of two, and buffer sizes
+	// are multiples of 64 KB, so only the alignment is adjusted.
+	const unsigned int dio_align = std::max(m_file->directIOAlignment(), file_dest->directIOAlignment());
+	if (params->alignment < dio_align) {
+		params->alignment = dio_align;
+	}
+	const bool is_device = file_dest->isDevice();
+
+	if (params->buf_size == 0) {
+		if (m_file->isDevice()) {
+			params->buf_size = tuneBufferSize(reader_src, params->alignment);
+		} else if (is_device) {
+			params->buf_size = BUF_SIZE_DEVICE_DEST;
+		} else {
+			params->buf_size = BUF_SIZE_DEFAULT;
+		}
+
+		// Use whole source blocks (CISO, WBFS, RVTZ) per chunk, so every
+		// chunk read maps to whole blocks instead of splitting a block
+		// across two chunks. Chunks start at LBA 0, as do the blocks.
+		const uint64_t block_size = LBA_TO_BYTES(static_cast<uint64_t>(reader_src->blockSizeLba()));
+		if (block_size != 0 && block_size % RVTH_COPY_BUF_SIZE_MIN == 0 &&
+		    block_size <= RVTH_COPY_BUF_SIZE_MAX)
+		{
+			const uint64_t aligned = ((params->buf_size + block_size - 1) / block_size) * block_size;
+			if (aligned <= RVTH_COPY_BUF_SIZE_MAX) {
+				params->buf_size = static_cast<unsigned int>(aligned);
+			}
+		}
+	}
+
+	if (params->mem_budget != 0) {
+		// Fit the copy buffers in the memory budget.
+		// Use fewer buffers first, since two are enough to
+		// overlap reading and writing, then smaller buffers.
+		const uint64_t budget = static_cast<uint64_t>(params->mem_budget) << 20;
+		const unsigned int count_max = static_cast<unsigned int>(
+			std::max<uint64_t>(2, budget / params->buf_size));
+		if (params->buf_count > count_max) {
+			params->buf_count = count_max;
+		}
+		if (static_cast<uint64_t>(params->buf_count) * params->buf_size > budget) {
+			// Keep whole source blocks if they still fit.
+			const uint64_t size_max = budget / params->buf_count;
+			const uint64_t block_size = LBA_TO_BYTES(static_cast<uint64_t>(reader_src->blockSizeLba()));
+			const uint64_t unit = (block_size != 0 && block_size % RVTH_COPY_BUF_SIZE_MIN == 0 &&
+				block_size <= size_max) ? block_size : RVTH_COPY_BUF_SIZE_MIN;
+			params->buf_size = static_cast<unsigned int>(std::max<uint64_t>(RVTH_COPY_BUF_SIZE_MIN,
+				size_max - (size_max % unit)));
+		}
+	}
+}
+
+/**
+ * Limit the number of worker threads to the memory budget.
+ * @param threads		[in] Number of worker threads.
+ * @param bytes_per_thread	[in] Buffer memory used by each worker, in bytes.
+ * @return Number of worker threads that fit in the budget. (at least 1)
+ */
+unsigned int RvtH::budgetThreads(unsigned int threads, size_t bytes_per_thread) const
+{
+	if (m_copyParams.mem_budget == 0) {
+		return std::max(1U, threads);
+	}
+
+	const uint64_t budget = static_cast<uint64_t>(m_copyParams.mem_budget) << 20;
+	const uint64_t fit = budget / bytes_per_thread;
+	return static_cast<unsigned int>(std::max<uint64_t>(1, std::min<uint64_t>(threads, fit)));
+}
+
+/**
+ * Apply the durability policy to the destination of a copy operation.
+ * Does nothing if m_sharedDurability is set.
+ * @param reader_dest	[in] Destination reader.
+ */
+void RvtH::applyDurability(Reader *reader_dest) const
+{
+	if (m_sharedDurability) {
+		// The owner of the shared file set the policy already.
+		return;
+	}
+
+	const unsigned int interval = (m_copyParams.sync_interval != 0
+		? m_copyParams.sync_interval : SYNC_INTERVAL_DEFAULT);
+	reader_dest->setDurability(static_cast<RvtH_Durability>(m_copyParams.durability),
+		static_cast<uint64_t>(interval) << 20);
+}
 
 /**
  * Get the free disk space on the volume containing `filename`.
@@ -129,99 +438,90 @@ static int64_t getDiskFreeSpace_lba(const TCHAR *filename)
 }
 
 /**
- * Copy a bank from this RVT-H HDD or standalone disc image to a writable standalone disc image.
- * @param rvth_dest	[out] Destination RvtH object.
- * @param bank_src	[in] Source bank number. (0-7)
- * @param callback	[in,opt] Progress callback.
- * @param userdata	[in,opt] User data for progress callback.
- * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ * Check if a block is completely within an omitted partition.
+ * @param pOmit		[in,opt] Omitted partitions
+ * @param lba		[in] Starting LBA of the block
+ * @param count		[in] Number of LBAs in the block
+ * @return True if the block is omitted; false if not.
  */
-int RvtH::copyToGcm(RvtH *rvth_dest, unsigned int bank_src, RvtH_Progress_Callback callback, void *userdata)
+static bool isOmitted(const vector<PartitionRef> *pOmit, uint32_t lba, uint32_t count)
 {
-	uint32_t lba_copy_len;	// Total number of LBAs to copy. (entry_src->lba_len)
-	uint32_t lba_count;
-	uint32_t lba_buf_max;	// Highest LBA that can be written using the buffer.
-	uint32_t lba_nonsparse;	// Last LBA written that wasn't sparse.
-
-	// Callback state.
-	RvtH_Progress_State state;
-
-	int ret = 0;	// errno or RvtH_Errors
-	int err = 0;	// errno setting
-
-	// Destination disc image.
-	RvtH_BankEntry *entry_dest;
-
-	if (!rvth_dest) {
-		errno = EINVAL;
-		return -EINVAL;
-	} else if (bank_src >= m_bankCount) {
-		errno = ERANGE;
-		return -ERANGE;
-	} else if (rvth_dest->isHDD() || rvth_dest->bankCount() != 1) {
-		// Destination is not a standalone disc image.
-		// Copying to HDDs will be handled differently.
-		errno = EIO;
-		return RVTH_ERROR_IS_HDD_IMAGE;
+	if (!pOmit) {
+		return false;
 	}
-
-	// Check if the source bank can be extracted.
-	const RvtH_BankEntry *const entry_src = &m_entries[bank_src];
-	switch (entry_src->type) {
-		case RVTH_BankType_GCN:
-		case RVTH_BankType_Wii_SL:
-		case RVTH_BankType_Wii_DL:
-			// Bank can be extracted.
-			break;
-
-		case RVTH_BankType_Unknown:
-		default:
-			// Unknown bank status...
-			errno = EIO;
-			return RVTH_ERROR_BANK_UNKNOWN;
-
-		case RVTH_BankType_Empty:
-			// Bank is empty.
-			errno = ENOENT;
-			return RVTH_ERROR_BANK_EMPTY;
-
-		case RVTH_BankType_Wii_DL_Bank2:
-			// Second bank of a dual-layer Wii disc image.
-			// TODO: Automatically select the first bank?
-			errno = EIO;
-			return RVTH_ERROR_BANK_DL_2;
+	for (const PartitionRef &ref : *pOmit) {
+		if (lba >= ref.lba_start && lba + count <= ref.lba_start + ref.lba_len) {
+			return true;
+		}
 	}
+	return false;
+}
 
-	// Allocate the memory buffer.
-	uint8_t *const buf = (uint8_t*)malloc(BUF_SIZE);
-	if (!buf) {
-		// Error allocating memory.
-		err = errno;
-		if (err == 0) {
-			err = ENOMEM;
+/**
+ * Add a range of empty LBAs to a hole list.
+ * Adjacent ranges are merged.
+ * @param holes		[in,out] Hole list. ({lba_start, lba_len})
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ */
+static void addHole(vector<std::pair<uint32_t, uint32_t> > &holes, uint32_t lba_start, uint32_t lba_len)
+{
+	if (!holes.empty()) {
+		std::pair<uint32_t, uint32_t> &last = holes.back();
+		if (last.first + last.second == lba_start) {
+			last.second += lba_len;
+			return;
 		}
-		ret = -err;
-		goto end;
 	}
+	holes.emplace_back(lba_start, lba_len);
+}
 
-	// FIXME: If the file existed and wasn't 0 bytes,
-	// either truncate it or don't do sparse writes.
-
-	// Make this a sparse file.
-	entry_dest = &rvth_dest->m_entries[0];
-	ret = rvth_dest->m_file->makeSparse(LBA_TO_BYTES(entry_dest->lba_len));
-	if (ret != 0) {
-		// Error managing the sparse file.
-		// TODO: Delete the file?
-		err = rvth_dest->m_file->lastError();
-		if (err == 0) {
-			err = ENOMEM;
+/**
+ * Deallocate the empty areas of a preallocated destination image.
+ * Small holes don't save much space and split the file's
+ * extents, so only holes of at least 1 MB are deallocated.
+ * Errors are ignored, since the data is already correct.
+ * @param reader	[in] Destination reader.
+ * @param holes		[in] Hole list. ({lba_start, lba_len})
+ */
+static void discardHoles(Reader *reader, const vector<std::pair<uint32_t, uint32_t> > &holes)
+{
+	static constexpr uint32_t HOLE_MIN_LBA = BYTES_TO_LBA(1024U*1024U);
+	for (const auto &hole : holes) {
+		if (hole.second < HOLE_MIN_LBA) {
+			continue;
+		}
+		if (reader->discard(hole.first, hole.second) != 0) {
+			break;
 		}
-		ret = -err;
-		goto end;
 	}
+}
 
-	// Copy the bank table information.
+/**
+ * Restore the disc header in the first chunk of a bank
+ * if it was zeroed by the RVT-H's "Flush" function.
+ * TODO: Also check for NDDEMO?
+ * @param buf		[in,out] First chunk of the bank.
+ * @param entry_src	[in] Source bank entry.
+ */
+static void restoreDiscHeader(uint8_t *buf, const RvtH_BankEntry *entry_src)
+{
+	const GCN_DiscHeader *const origHdr = reinterpret_cast<const GCN_DiscHeader*>(buf);
+	if (origHdr->magic_wii != be32_to_cpu(WII_MAGIC) &&
+	    origHdr->magic_gcn != be32_to_cpu(GCN_MAGIC))
+	{
+		// Missing magic number. Need to restore the disc header.
+		memcpy(buf, &entry_src->discHeader, sizeof(entry_src->discHeader));
+	}
+}
+
+/**
+ * Copy the bank table information to a destination bank entry.
+ * @param entry_dest	[out] Destination bank entry.
+ * @param entry_src	[in] Source bank entry.
+ */
+static void copyBankInfo(RvtH_BankEntry *entry_dest, const RvtH_BankEntry *entry_src)
+{
 	entry_dest->type	= entry_src->type;
 	entry_dest->region_code	= entry_src->region_code;
 	entry_dest->is_deleted	= false;
@@ -239,610 +539,1075 @@ int RvtH::copyToGcm(RvtH *rvth_dest, unsigned int bank_src, RvtH_Progress_Callba
 	} else {
 		entry_dest->timestamp = time(nullptr);
 	}
+}
 
-	// Number of LBAs to copy.
-	lba_copy_len = entry_src->lba_len;
+/**
+ * Write a buffer to a reader, skipping runs of empty blocks.
+ *
+ * Non-empty blocks are gathered into runs, and each run is written
+ * using a single write. Runs of empty blocks shorter than hole_lba_min
+ * are written as part of the surrounding run, so holes are only left
+ * where they're large enough to be worth the extra write call.
+ * Omitted blocks are never written.
+ *
+ * @param reader	[in] Destination reader.
+ * @param buf		[in] Buffer.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length of the buffer, in LBAs.
+ * @param lba_block	[in] Block size for empty block checks, in LBAs.
+ * @param hole_lba_min	[in] Minimum hole size, in LBAs.
+ * @param pOmit		[in,opt] Partitions to leave out of the destination image.
+ * @param pErr		[out,opt] Set to a negative POSIX error code if a write fails.
+ * @return LBA following the last LBA written, or 0 if nothing was written.
+ */
+static uint32_t writeSkipEmpty(Reader *reader, const uint8_t *buf, uint32_t lba_start, uint32_t lba_len,
+	uint32_t lba_block, uint32_t hole_lba_min, const vector<PartitionRef> *pOmit = nullptr,
+	int *pErr = nullptr)
+{
+	auto writeRun = [&](uint32_t lba_run, uint32_t lba_end) {
+		const uint32_t len = lba_end - lba_run;
+		if (reader->write(&buf[LBA_TO_BYTES(lba_run)], lba_start + lba_run, len) != len) {
+			if (pErr && *pErr == 0) {
+				*pErr = (errno != 0 ? -errno : -EIO);
+			}
+		}
+	};
 
-	if (callback) {
-		// Initialize the callback state.
-		state.rvth = this;
-		state.rvth_gcm = rvth_dest;
-		state.bank_rvth = bank_src;
-		state.bank_gcm = 0;
-		state.type = RVTH_PROGRESS_EXTRACT;
-		state.lba_processed = 0;
-		state.lba_total = lba_copy_len;
+	uint32_t lba_written = 0;	// LBA following the last LBA written
+	uint32_t lba_run = 0;		// Start of the current run
+	uint32_t lba_data_end = 0;	// End of the last non-empty block in the current run
+	uint32_t lba_skipped = lba_len;	// LBAs that weren't written because they're empty
+	bool in_run = false;
+
+	for (uint32_t lba = 0; lba < lba_len; lba += lba_block) {
+		const uint32_t lba_cur = std::min(lba_block, lba_len - lba);
+		const bool omitted = isOmitted(pOmit, lba_start + lba, lba_cur);
+		if (!omitted && RvtH::isBlockEmpty(&buf[LBA_TO_BYTES(lba)],
+			static_cast<unsigned int>(LBA_TO_BYTES(lba_cur))))
+		{
+			// Empty block. Decided when the next non-empty block is found.
+			continue;
+		}
+
+		if (in_run && (omitted || lba - lba_data_end >= hole_lba_min)) {
+			// End of the current run.
+			writeRun(lba_run, lba_data_end);
+			lba_written = lba_start + lba_data_end;
+			lba_skipped -= (lba_data_end - lba_run);
+			in_run = false;
+		}
+		if (omitted) {
+			// Stored elsewhere. (RVTH_EXTRACT_STORE_UPDATES)
+			lba_skipped -= lba_cur;
+			continue;
+		}
+
+		if (!in_run) {
+			// Start of a new run.
+			lba_run = lba;
+			in_run = true;
+		}
+		lba_data_end = lba + lba_cur;
 	}
 
-	// TODO: Optimize seeking? (Reader::write() seeks every time.)
-	lba_buf_max = entry_dest->lba_len & ~(LBA_COUNT_BUF-1);
-	lba_nonsparse = 0;
-	for (lba_count = 0; lba_count < lba_buf_max; lba_count += LBA_COUNT_BUF) {
-		if (callback) {
-			bool bRet;
-			state.lba_processed = lba_count;
-			bRet = callback(&state, userdata);
-			if (!bRet) {
-				// Stop processing.
-				err = ECANCELED;
-				ret = -ECANCELED;
-				goto end;
+	if (in_run) {
+		// Write the last run.
+		writeRun(lba_run, lba_data_end);
+		lba_written = lba_start + lba_data_end;
+		lba_skipped -= (lba_data_end - lba_run);
+	}
+	StatsCounters::addSparse(LBA_TO_BYTES(static_cast<uint64_t>(lba_skipped)));
+	return lba_written;
+}
+
+/**
+ * Write a buffer to a sparse image file, deallocating runs of empty blocks.
+ *
+ * Like writeSkipEmpty(), but the destination may have old data, so
+ * runs of empty blocks of at least hole_lba_min are deallocated instead
+ * of being skipped. Shorter runs are written as part of the surrounding
+ * data. If the destination can't deallocate a range, zeroes are written.
+ *
+ * @param reader	[in] Destination reader.
+ * @param buf		[in] Buffer.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length of the buffer, in LBAs.
+ * @param lba_block	[in] Block size for empty block checks, in LBAs.
+ * @param hole_lba_min	[in] Minimum hole size, in LBAs.
+ * @param pErr		[out,opt] Set to a negative POSIX error code if a write fails.
+ */
+static void writeSparse(Reader *reader, const uint8_t *buf, uint32_t lba_start, uint32_t lba_len,
+	uint32_t lba_block, uint32_t hole_lba_min, int *pErr = nullptr)
+{
+	auto writeRange = [&](uint32_t lba_from, uint32_t lba_to) {
+		const uint32_t len = lba_to - lba_from;
+		if (reader->write(&buf[LBA_TO_BYTES(lba_from)], lba_start + lba_from, len) != len) {
+			if (pErr && *pErr == 0) {
+				*pErr = (errno != 0 ? -errno : -EIO);
 			}
 		}
+	};
+	auto discardRange = [&](uint32_t lba_from, uint32_t lba_to) {
+		if (lba_from >= lba_to) {
+			return;
+		}
+		if (reader->discard(lba_start + lba_from, lba_to - lba_from) == 0) {
+			StatsCounters::addSparse(LBA_TO_BYTES(static_cast<uint64_t>(lba_to - lba_from)));
+		} else {
+			// Can't deallocate the range. Write the zeroes.
+			writeRange(lba_from, lba_to);
+		}
+	};
 
-		// TODO: Error handling.
-		entry_src->reader->read(buf, lba_count, LBA_COUNT_BUF);
+	uint32_t lba_done = 0;		// LBAs before this have been written or deallocated
+	uint32_t lba_run = 0;		// Start of the current run
+	uint32_t lba_data_end = 0;	// End of the last non-empty block in the current run
+	bool in_run = false;
 
-		if (lba_count == 0) {
-			// Make sure we copy the disc header in if the
-			// header was zeroed by the RVT-H's "Flush" function.
-			// TODO: Move this outside of the `for` loop.
-			// TODO: Also check for NDDEMO?
-			const GCN_DiscHeader *const origHdr = (const GCN_DiscHeader*)buf;
-			if (origHdr->magic_wii != be32_to_cpu(WII_MAGIC) &&
-			    origHdr->magic_gcn != be32_to_cpu(GCN_MAGIC))
-			{
-				// Missing magic number. Need to restore the disc header.
-				memcpy(buf, &entry_src->discHeader, sizeof(entry_src->discHeader));
-			}
+	for (uint32_t lba = 0; lba < lba_len; lba += lba_block) {
+		const uint32_t lba_cur = std::min(lba_block, lba_len - lba);
+		if (RvtH::isBlockEmpty(&buf[LBA_TO_BYTES(lba)],
+			static_cast<unsigned int>(LBA_TO_BYTES(lba_cur))))
+		{
+			// Empty block. Decided when the next non-empty block is found.
+			continue;
 		}
 
-		// Check for empty 4 KB blocks.
-		for (unsigned int sprs = 0; sprs < BUF_SIZE; sprs += 4096) {
-			if (!isBlockEmpty(&buf[sprs], 4096)) {
-				// 4 KB block is not empty.
-				lba_nonsparse = lba_count + (sprs / 512);
-				entry_dest->reader->write(&buf[sprs], lba_nonsparse, 8);
-				//entry_dest->reader->flush();
-				lba_nonsparse += 7;
+		if (in_run && lba - lba_data_end >= hole_lba_min) {
+			// End of the current run.
+			writeRange(lba_run, lba_data_end);
+			lba_done = lba_data_end;
+			in_run = false;
+		}
+		if (!in_run) {
+			// Start of a new run. Short holes are written as zeroes.
+			if (lba - lba_done >= hole_lba_min) {
+				discardRange(lba_done, lba);
+				lba_run = lba;
+			} else {
+				lba_run = lba_done;
 			}
+			in_run = true;
 		}
+		lba_data_end = lba + lba_cur;
 	}
 
-	// Process any remaining LBAs.
-	if (lba_count < lba_copy_len) {
-		const unsigned int lba_left = lba_copy_len - lba_count;
-		const unsigned int sz_left = static_cast<unsigned int>(BYTES_TO_LBA(lba_left));
+	if (in_run) {
+		// Write the last run.
+		if (lba_len - lba_data_end < hole_lba_min) {
+			lba_data_end = lba_len;
+		}
+		writeRange(lba_run, lba_data_end);
+		lba_done = lba_data_end;
+	}
+	discardRange(lba_done, lba_len);
+}
 
-		if (callback) {
-			bool bRet;
-			state.lba_processed = lba_count;
-			bRet = callback(&state, userdata);
-			if (!bRet) {
-				// Stop processing.
-				err = ECANCELED;
-				ret = -ECANCELED;
-				goto end;
-			}
-		}
-		entry_src->reader->read(buf, lba_count, lba_left);
+// Size of each range copied by the OS, in LBAs.
+// Progress and cancellation are checked between ranges.
+static const uint32_t OS_COPY_LBA = BYTES_TO_LBA(32*1024*1024);
 
-		// Check for empty 512-byte blocks.
-		for (unsigned int sprs = 0; sprs < sz_left; sprs += 512) {
-			if (!isBlockEmpty(&buf[sprs], 512)) {
-				// 512-byte block is not empty.
-				lba_nonsparse = lba_count + (sprs / 512);
-				entry_dest->reader->write(&buf[sprs], lba_nonsparse, 1);
-				//entry_dest->reader->flush();
+/**
+ * Copy a range of LBAs between two plain images using the OS,
+ * without reading the data into user space. (See RefFile::copyRange().)
+ * Parts of the range that the OS didn't copy, e.g. an unaligned
+ * end when cloning, are copied using the buffer.
+ * @param dest		[in] Destination reader.
+ * @param src		[in] Source reader.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @param mode		[in] Copy mode.
+ * @param buf		[in] Copy buffer.
+ * @param lba_count_buf	[in] Length of the copy buffer, in LBAs.
+ * @param allowFail	[in] If true, return -ENOTSUP if the OS can't copy any of the range.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int copyRangeOS(Reader *dest, Reader *src, uint32_t lba_start, uint32_t lba_len,
+	RefFile::CopyMode mode, uint8_t *buf, uint32_t lba_count_buf, bool allowFail)
+{
+	off64_t src_offset, dest_offset;
+	off64_t copied = 0;
+	if (src->fileOffset(lba_start, lba_len, &src_offset) &&
+	    dest->fileOffset(lba_start, lba_len, &dest_offset))
+	{
+		const off64_t len = LBA_TO_BYTES(lba_len);
+		errno = 0;
+		copied = dest->file()->copyRange(src->file(), src_offset, dest_offset, len, mode);
+		if (copied < len) {
+			const int err = errno;
+			if (err != ENOTSUP) {
+				return -(err != 0 ? err : EIO);
 			}
 		}
 	}
+	if (copied == 0 && allowFail) {
+		return -ENOTSUP;
+	}
 
-	if (callback) {
-		bool bRet;
-		state.lba_processed = lba_copy_len;
-		bRet = callback(&state, userdata);
-		if (!bRet) {
-			// Stop processing.
-			err = ECANCELED;
-			ret = -ECANCELED;
-			goto end;
+	// Copy the rest of the range using the buffer.
+	// NOTE: A partially-copied LBA is copied again.
+	const uint32_t lba_end = lba_start + lba_len;
+	for (uint32_t lba = lba_start + BYTES_TO_LBA(copied); lba < lba_end; lba += lba_count_buf) {
+		const uint32_t lba_cur = std::min(lba_count_buf, lba_end - lba);
+		errno = 0;
+		if (src->read(buf, lba, lba_cur) != lba_cur ||
+		    dest->write(buf, lba, lba_cur) != lba_cur)
+		{
+			return (errno != 0 ? -errno : -EIO);
 		}
 	}
+	return 0;
+}
 
-	// lba_nonsparse should be equal to lba_copy_len-1.
-	if (lba_nonsparse != lba_copy_len-1) {
-		// Last LBA was sparse.
-		// We'll need to write an actual zero block.
-		// TODO: Maybe not needed if ftruncate() succeeded?
-		// TODO: Check for errors.
-		memset(buf, 0, 512);
-		entry_dest->reader->write(buf, lba_copy_len-1, 1);
-		//entry_dest->reader->flush();
-	}
+/**
+ * Share the blocks of a plain image with another plain image
+ * if both are on a file system that supports it. (reflinks)
+ * Unallocated extents in the source image are left sparse.
+ *
+ * NOTE: Copying the data in the kernel isn't used here, since it
+ * would allocate the empty blocks that sparse writes skip.
+ *
+ * @param dest		[in] Destination reader.
+ * @param src		[in] Source reader.
+ * @param lba_len	[in] Number of LBAs to copy.
+ * @param buf		[in] Copy buffer. (See copyRangeOS().)
+ * @param lba_count_buf	[in] Length of the copy buffer, in LBAs.
+ * @param progress	[in] Called with the current LBA before each range. Returns false to cancel.
+ * @param pLbaEnd	[out] LBA following the last LBA written, or 0 if nothing was written.
+ * @return 0 on success; -ENOTSUP if the blocks can't be shared; negative POSIX error code on error.
+ */
+static int cloneExtents(Reader *dest, Reader *src, uint32_t lba_len,
+	uint8_t *buf, uint32_t lba_count_buf,
+	const std::function<bool(uint32_t lba)> &progress, uint32_t *pLbaEnd)
+{
+	vector<Reader::Extent> extents;
+	src->extents(0, lba_len, extents);
+	uint64_t sparse = 0;
+	bool first = true;
+	*pLbaEnd = 0;
+	for (const Reader::Extent &extent : extents) {
+		if (!extent.allocated) {
+			sparse += LBA_TO_BYTES(static_cast<uint64_t>(extent.lba_len));
+			continue;
+		}
 
-	// Flush the destination device.
-	entry_dest->reader->flush();
+		const uint32_t lba_end = extent.lba_start + extent.lba_len;
+		for (uint32_t lba = extent.lba_start; lba < lba_end; lba += OS_COPY_LBA) {
+			if (!progress(lba)) {
+				return -ECANCELED;
+			}
 
-end:
-	free(buf);
-	if (err != 0) {
-		errno = err;
+			const uint32_t lba_cur = std::min(OS_COPY_LBA, lba_end - lba);
+			const int ret = copyRangeOS(dest, src, lba, lba_cur,
+				RefFile::CopyMode::Clone, buf, lba_count_buf, first);
+			if (ret != 0) {
+				return ret;
+			}
+			first = false;
+			*pLbaEnd = lba + lba_cur;
+		}
 	}
-	return ret;
+
+	StatsCounters::addSparse(sparse);
+	return 0;
 }
 
 /**
- * Extract a disc image from this RVT-H disk image.
- * Compatibility wrapper; this function creates a new RvtH
- * using the GCM constructor and then copyToGcm().
- * @param bank		[in] Bank number. (0-7)
- * @param filename	[in] Destination filename.
- * @param recrypt_key	[in] Key for recryption. (-1 for default; otherwise, see RVL_CryptoType_e)
- * @param flags		[in] Flags. (See RvtH_Extract_Flags.)
- * @param callback	[in,opt] Progress callback.
- * @param userdata	[in,opt] User data for progress callback.
- * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ * Find the chunks of a differential import that are known to be
+ * identical in the source and destination banks.
+ *
+ * Encrypted Wii partitions are compared using their H3 tables, so the
+ * destination doesn't have to be read. A 2 MB group is identical if the
+ * partition is at the same location in both images, both partitions
+ * have the same ticket (and therefore the same title key), and the
+ * group's H3 entries match. A chunk is identical if it's entirely
+ * within identical groups.
+ *
+ * @param entry_src	[in] Source bank entry.
+ * @param entry_dest	[in] Destination bank entry. (before importing)
+ * @param lba_chunk	[in] Chunk size, in LBAs.
+ * @param chunk_count	[in] Number of chunks.
+ * @return Identical chunks, or an empty vector if none are known to be identical.
  */
-int RvtH::extract(unsigned int bank, const TCHAR *filename,
-	int recrypt_key, unsigned int flags, RvtH_Progress_Callback callback, void *userdata)
+static vector<bool> findIdenticalChunks(RvtH_BankEntry *entry_src, RvtH_BankEntry *entry_dest,
+	uint32_t lba_chunk, size_t chunk_count)
 {
-	if (!filename || filename[0] == 0) {
-		errno = EINVAL;
-		return -EINVAL;
-	} else if (bank >= m_bankCount) {
-		// Bank number is out of range.
-		errno = ERANGE;
-		return -ERANGE;
+	vector<bool> identical;
+	HashIndex idx_src, idx_dest;
+	if (idx_src.init(entry_src) != 0 || idx_dest.init(entry_dest) != 0) {
+		return identical;
 	}
 
-	// TODO: If recryption is needed, validate parts of the partitions,
-	// e.g. certificate chain length, before copying.
+	PoolBuffer tik_src(LBA_TO_BYTES(2));
+	PoolBuffer tik_dest(LBA_TO_BYTES(2));
+	if (!tik_src || !tik_dest) {
+		return identical;
+	}
+	static_assert(sizeof(RVL_Ticket) <= LBA_SIZE * 2, "RVL_Ticket is larger than 2 LBAs");
 
-	// TODO: If recrypt_key == the original key,
-	// handle it as -1.
+	// Ranges of identical groups. ({lba_start, lba_len})
+	// Partitions are sorted by address, so the ranges are also sorted.
+	vector<std::pair<uint32_t, uint32_t> > ranges;
+	static const uint32_t group_lba = BYTES_TO_LBA(HashIndex::GROUP_SIZE);
+	for (unsigned int i = 0; i < idx_src.partitionCount(); i++) {
+		const HashIndex::Partition *const ps = idx_src.partition(i);
+		if (!ps->H3) {
+			continue;
+		}
+		const HashIndex::Partition *pd = nullptr;
+		for (unsigned int j = 0; j < idx_dest.partitionCount(); j++) {
+			const HashIndex::Partition *const p = idx_dest.partition(j);
+			if (p->lba_start == ps->lba_start && p->data_lba == ps->data_lba && p->H3) {
+				pd = p;
+				break;
+			}
+		}
+		if (!pd) {
+			continue;
+		}
 
-	// Create a standalone disc image.
-	RvtH_BankEntry *const entry = &m_entries[bank];
-	const bool unenc_to_enc = (entry->type >= RVTH_BankType_Wii_SL &&
-				   entry->crypto_type == RVL_CryptoType_None &&
-				   recrypt_key > RVL_CryptoType_Unknown);
-	uint32_t gcm_lba_len;
-	if (unenc_to_enc) {
-		// Converting from unencrypted to encrypted.
-		// Need to convert 31k sectors to 32k.
-		uint32_t lba_tmp;
-		const pt_entry_t *game_pte = rvth_ptbl_find_game(entry);
-		if (!game_pte) {
-			// No game partition...
-			errno = EIO;
-			return RVTH_ERROR_NO_GAME_PARTITION;
+		// The tickets must match. Otherwise, the title keys
+		// might be different, so the encrypted data is different.
+		if (entry_src->reader->read(tik_src.get(), ps->lba_start, 2) != 2 ||
+		    entry_dest->reader->read(tik_dest.get(), pd->lba_start, 2) != 2 ||
+		    memcmp(tik_src.get(), tik_dest.get(), sizeof(RVL_Ticket)) != 0)
+		{
+			continue;
 		}
 
-		// TODO: Read the partition header to determine the data offset.
-		// Assuming 0x8000 partition header size for now.
-		lba_tmp = game_pte->lba_len - BYTES_TO_LBA(0x8000);
-		gcm_lba_len = (lba_tmp / 3968 * 4096);
-		if (lba_tmp % 3968 != 0) {
-			gcm_lba_len += 4096;
+		// Only check complete groups.
+		const uint32_t data_start = ps->lba_start + ps->data_lba;
+		const uint32_t group_count = std::min(ps->data_len, pd->data_len) / group_lba;
+		for (uint32_t g = 0; g < group_count; g++) {
+			if (memcmp(ps->H3->h3[g], pd->H3->h3[g], sizeof(ps->H3->h3[g])) != 0) {
+				continue;
+			}
+			addHole(ranges, data_start + (g * group_lba), group_lba);
 		}
-		// Assuming 0x8000 header + 0x18000 H3 table.
-		gcm_lba_len += BYTES_TO_LBA(0x20000) + game_pte->lba_start;
-	} else {
-		// Use the bank size as-is.
-		gcm_lba_len = entry->lba_len;
+	}
+	if (ranges.empty()) {
+		return identical;
 	}
 
-	if (flags & RVTH_EXTRACT_PREPEND_SDK_HEADER) {
-		if (entry->type == RVTH_BankType_GCN) {
-			// FIXME: Not supported.
-			errno = ENOTSUP;
-			return RVTH_ERROR_NDEV_GCN_NOT_SUPPORTED;
+	// Check which chunks are entirely within an identical range.
+	identical.resize(chunk_count);
+	auto iter = ranges.cbegin();
+	for (size_t c = 0; c < chunk_count; c++) {
+		const uint64_t lba_start = static_cast<uint64_t>(c) * lba_chunk;
+		const uint64_t lba_end = lba_start + lba_chunk;
+		while (iter != ranges.cend() &&
+		       static_cast<uint64_t>(iter->first) + iter->second <= lba_start)
+		{
+			++iter;
 		}
-		// Prepend 32k to the GCM.
-		gcm_lba_len += BYTES_TO_LBA(32768);
+		if (iter == ranges.cend()) {
+			break;
+		}
+		identical[c] = (iter->first <= lba_start &&
+			static_cast<uint64_t>(iter->first) + iter->second >= lba_end);
 	}
+	return identical;
+}
 
-	// Check that we have enough free disk space.
-	// NOTE: We're not checking for sparse sectors.
-	int64_t diskFreeSpace_lba = getDiskFreeSpace_lba(filename);
-	if (diskFreeSpace_lba < 0) {
-		// Error...
-		int ret = static_cast<int>(diskFreeSpace_lba);
-		errno = -ret;
-		return ret;
-	} else if (diskFreeSpace_lba < gcm_lba_len) {
-		// Not enough free disk space.
-		errno = ENOSPC;
-		return -ENOSPC;
+/**
+ * Write the blocks of a buffer that differ from the destination.
+ *
+ * The destination is read and compared block-by-block. Differing
+ * blocks are gathered into runs, and each run is written using a
+ * single write. If the destination can't be read, the entire buffer
+ * is written.
+ *
+ * @param reader	[in] Destination reader.
+ * @param buf		[in] Buffer.
+ * @param dbuf		[in] Scratch buffer for the destination data. (same size as buf)
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length of the buffer, in LBAs.
+ * @param lba_block	[in] Block size for comparisons, in LBAs.
+ * @return Number of LBAs written.
+ */
+static uint32_t writeDiff(Reader *reader, const uint8_t *buf, uint8_t *dbuf,
+	uint32_t lba_start, uint32_t lba_len, uint32_t lba_block)
+{
+	if (reader->read(dbuf, lba_start, lba_len) != lba_len) {
+		// Read error. Write the entire buffer.
+		reader->write(buf, lba_start, lba_len);
+		return lba_len;
 	}
 
-	int ret = 0;
-	unique_ptr<RvtH> rvth_dest(new RvtH(filename, gcm_lba_len, &ret));
-	if (!rvth_dest->isOpen()) {
-		// Error creating the standalone disc image.
-		errno = EIO;
-		if (ret == 0) {
-			ret = -EIO;
+	uint32_t lba_written = 0;
+	uint32_t lba_run = 0;		// Start of the current run
+	bool in_run = false;
+	for (uint32_t lba = 0; lba < lba_len; lba += lba_block) {
+		const uint32_t lba_cur = std::min(lba_block, lba_len - lba);
+		const bool same = (memcmp(&buf[LBA_TO_BYTES(lba)], &dbuf[LBA_TO_BYTES(lba)],
+			static_cast<size_t>(LBA_TO_BYTES(lba_cur))) == 0);
+		if (same && in_run) {
+			// End of the current run.
+			reader->write(&buf[LBA_TO_BYTES(lba_run)], lba_start + lba_run, lba - lba_run);
+			lba_written += lba - lba_run;
+			in_run = false;
+		} else if (!same && !in_run) {
+			// Start of a new run.
+			lba_run = lba;
+			in_run = true;
 		}
-		return ret;
 	}
 
-	if (flags & RVTH_EXTRACT_PREPEND_SDK_HEADER) {
-		// Prepend 32k to the GCM.
-		size_t size;
-		Reader *const reader = rvth_dest->m_entries[0].reader;
-		uint8_t *const sdk_header = static_cast<uint8_t*>(calloc(1, SDK_HEADER_SIZE_BYTES));
-		if (!sdk_header) {
-			int ret = -errno;
-			if (ret == 0) {
-				ret = -ENOMEM;
-			}
-			return ret;
-		}
+	if (in_run) {
+		// Write the last run.
+		reader->write(&buf[LBA_TO_BYTES(lba_run)], lba_start + lba_run, lba_len - lba_run);
+		lba_written += lba_len - lba_run;
+	}
+	return lba_written;
+}
 
-		// TODO: Get headers for GC1L and NN2L.
-		// TODO: Optimize by using 32-bit writes?
-		switch (entry->type) {
-			case RVTH_BankType_GCN:
-				// FIXME; GameCube GCM seems to use the same values,
-				// but it doesn't load with NDEV.
-				// Checksum field is always 0xAB0B.
-				// TODO: Delete the file?
-				return RVTH_ERROR_NDEV_GCN_NOT_SUPPORTED;
-			case RVTH_BankType_Wii_SL:
-			case RVTH_BankType_Wii_DL:
-				// 0x0000: FF FF 00 00
-				sdk_header[0x0000] = 0xFF;
-				sdk_header[0x0001] = 0xFF;
-				// 0x082C: 00 00 E0 06
-				sdk_header[0x082E] = 0xE0;
-				sdk_header[0x082F] = 0x06;
-				// TODO: Checksum at 0x0830? (If 00 00, seems to work for all discs.)
-				// 0x0844: 01 00 00 00
-				sdk_header[0x0844] = 0x01;
-				break;
-			default:
-				// Should not get here...
-				assert(!"Incorrect bank type.");
-				free(sdk_header);
-				return RVTH_ERROR_BANK_UNKNOWN;
-		}
-
-		size = reader->write(sdk_header, 0, SDK_HEADER_SIZE_LBA);
-		reader->flush();
-		if (size != SDK_HEADER_SIZE_LBA) {
-			// Write error.
-			int ret = -errno;
-			if (ret == 0) {
-				ret = -EIO;
-			}
-			free(sdk_header);
-			return ret;
-		}
-		free(sdk_header);
+/**
+ * Check if a bank can be extracted.
+ * errno is set on error.
+ * @param entry	[in] Bank entry.
+ * @return 0 if the bank can be extracted; RvtH_Errors if not.
+ */
+static int checkExtractable(const RvtH_BankEntry *entry)
+{
+	switch (entry->type) {
+		case RVTH_BankType_GCN:
+		case RVTH_BankType_Wii_SL:
+		case RVTH_BankType_Wii_DL:
+			// Bank can be extracted.
+			return 0;
+
+		case RVTH_BankType_Unknown:
+		default:
+			// Unknown bank status...
+			errno = EIO;
+			return RVTH_ERROR_BANK_UNKNOWN;
+
+		case RVTH_BankType_Empty:
+			// Bank is empty.
+			errno = ENOENT;
+			return RVTH_ERROR_BANK_EMPTY;
 
-		// Remove the SDK header from the reader's offsets.
-		reader->lba_adjust(SDK_HEADER_SIZE_LBA);
+		case RVTH_BankType_Wii_DL_Bank2:
+			// Second bank of a dual-layer Wii disc image.
+			// TODO: Automatically select the first bank?
+			errno = EIO;
+			return RVTH_ERROR_BANK_DL_2;
 	}
+}
 
-	// Copy the bank from the source image to the destination GCM.
-	if (unenc_to_enc) {
-		ret = copyToGcm_doCrypt(rvth_dest.get(), bank, callback, userdata);
-	} else {
-		ret = copyToGcm(rvth_dest.get(), bank, callback, userdata);
+/**
+ * Check if an SDK header can be prepended to an extracted image.
+ * errno is set on error.
+ * @param entry		[in] Source bank entry.
+ * @param filename	[in] Destination filename.
+ * @return 0 if it can; negative POSIX error code or RvtH_Errors if not.
+ */
+static int checkSdkHeader(const RvtH_BankEntry *entry, const TCHAR *filename)
+{
+	if (Reader::formatFromFilename(filename) != RVTH_ImageFormat_Plain) {
+		// SDK headers are only supported for plain disc images.
+		errno = ENOTSUP;
+		return -ENOTSUP;
 	}
-	if (ret == 0 && recrypt_key > RVL_CryptoType_Unknown) {
-		// Recrypt the disc image.
-		if (entry->crypto_type != recrypt_key) {
-			ret = rvth_dest->recryptWiiPartitions(0,
-				static_cast<RVL_CryptoType_e>(recrypt_key), callback, userdata);
-		}
+	if (entry->type == RVTH_BankType_GCN) {
+		// FIXME; GameCube GCM seems to use the same values,
+		// but it doesn't load with NDEV.
+		// Checksum field is always 0xAB0B.
+		errno = ENOTSUP;
+		return RVTH_ERROR_NDEV_GCN_NOT_SUPPORTED;
 	}
+	return 0;
+}
 
-	return ret;
+/**
+ * Write an SDK header at the start of a new disc image,
+ * and move the reader's LBA 0 to the end of the header.
+ *
+ * The header is written through the destination's reader like the
+ * image data, so it's the first write of the sequential stream; it
+ * isn't flushed on its own, and the image data doesn't need a seek.
+ *
+ * @param reader	[in] Destination reader. (LBA 0 must be the start of the file.)
+ * @param type		[in] Bank type. (See RvtH_BankType_e.)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int writeSdkHeader(Reader *reader, uint8_t type)
+{
+	assert(type == RVTH_BankType_Wii_SL || type == RVTH_BankType_Wii_DL);
+	UNUSED(type);
+
+	PoolBuffer sdk_header(SDK_HEADER_SIZE_BYTES);
+	if (!sdk_header) {
+		return -ENOMEM;
+	}
+	uint8_t *const buf = sdk_header.get();
+	memset(buf, 0, SDK_HEADER_SIZE_BYTES);
+
+	// TODO: Get headers for GC1L and NN2L.
+	// 0x0000: FF FF 00 00
+	buf[0x0000] = 0xFF;
+	buf[0x0001] = 0xFF;
+	// 0x082C: 00 00 E0 06
+	buf[0x082E] = 0xE0;
+	buf[0x082F] = 0x06;
+	// TODO: Checksum at 0x0830? (If 00 00, seems to work for all discs.)
+	// 0x0844: 01 00 00 00
+	buf[0x0844] = 0x01;
+
+	errno = 0;
+	if (reader->write(buf, 0, SDK_HEADER_SIZE_LBA) != SDK_HEADER_SIZE_LBA) {
+		// Write error.
+		return (errno != 0 ? -errno : -EIO);
+	}
+
+	// Remove the SDK header from the reader's offsets.
+	reader->lba_adjust(SDK_HEADER_SIZE_LBA);
+	return 0;
 }
 
 /**
- * Copy a bank from this HDD or standalone disc image to an RVT-H system.
- * @param rvth_dest	[in] Destination RvtH object.
- * @param bank_dest	[in] Destination bank number. (0-7)
+ * Copy a bank from this RVT-H HDD or standalone disc image to a writable standalone disc image.
+ * @param rvth_dest	[out] Destination RvtH object.
  * @param bank_src	[in] Source bank number. (0-7)
+ * @param flags		[in] Flags. (See RvtH_Extract_Flags; only RVTH_EXTRACT_SCRUB, RVTH_EXTRACT_DIGESTS, RVTH_EXTRACT_SPARSE, and RVTH_EXTRACT_PREALLOCATE are used.)
  * @param callback	[in,opt] Progress callback.
  * @param userdata	[in,opt] User data for progress callback.
+ * @param pDigests	[out,opt] Image digests. (Only set if RVTH_EXTRACT_DIGESTS is set.)
+ * @param pHashIndex	[in,out,opt] Initialized hash index to update with the copied data.
+ * @param pOmit		[in,opt] Partitions to leave out of the destination image. (They're still read for the digests and hash index.)
+ * @param rvth_base	[in,opt] Base image. Groups that are identical in the base image are copied from it instead.
+ * @param journal	[in,out,opt] Opened progress journal. If it was loaded, copying resumes where the journal left off.
  * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
  */
-int RvtH::copyToHDD(RvtH *rvth_dest, unsigned int bank_dest,
-	unsigned int bank_src, RvtH_Progress_Callback callback, void *userdata)
+int RvtH::copyToGcm(RvtH *rvth_dest, unsigned int bank_src, unsigned int flags,
+	RvtH_Progress_Callback callback, void *userdata, RvtH_Image_Digests *pDigests,
+	HashIndex *pHashIndex, const vector<PartitionRef> *pOmit, RvtH *rvth_base,
+	CopyJournal *journal)
 {
+	StatsScope scope(m_stats);
 	uint32_t lba_copy_len;	// Total number of LBAs to copy. (entry_src->lba_len)
 	uint32_t lba_count;
 	uint32_t lba_buf_max;	// Highest LBA that can be written using the buffer.
+	uint32_t lba_nonsparse;	// Last LBA written that wasn't sparse.
 
 	// Callback state.
 	RvtH_Progress_State state;
+	ProgressRate rate;
+	ProgressThrottle throttle(&m_progressParams);
+
+	// Image digests. (RVTH_EXTRACT_DIGESTS)
+	unique_ptr<ImageDigest> digest;
+	RvtH_Image_Digests digests;
 
 	int ret = 0;	// errno or RvtH_Errors
+	int err = 0;	// errno setting
+
+	// Destination disc image.
+	RvtH_BankEntry *entry_dest;
+
+	// Preallocated destination: Written through a memory-mapped
+	// window if possible. (Otherwise, this uses the Reader.)
+	unique_ptr<MappedWriter> mapped;
+
+	// Copy buffer parameters.
+	RvtH_CopyParams cp;
+	uint32_t lba_count_buf;
 
 	if (!rvth_dest) {
 		errno = EINVAL;
 		return -EINVAL;
-	} else if (bank_src >= m_bankCount ||
-		   bank_dest >= rvth_dest->bankCount())
-	{
+	} else if (bank_src >= m_bankCount) {
 		errno = ERANGE;
 		return -ERANGE;
-	} else if (!rvth_dest->isHDD()) {
-		// Destination is not an HDD.
+	} else if (rvth_dest->isHDD() || rvth_dest->bankCount() != 1) {
+		// Destination is not a standalone disc image.
+		// Copying to HDDs will be handled differently.
 		errno = EIO;
-		return RVTH_ERROR_NOT_HDD_IMAGE;
+		return RVTH_ERROR_IS_HDD_IMAGE;
 	}
 
-	// Check if the source bank can be imported.
-	const RvtH_BankEntry *const entry_src = &m_entries[bank_src];
-	switch (entry_src->type) {
-		case RVTH_BankType_GCN:
-		case RVTH_BankType_Wii_SL:
-		case RVTH_BankType_Wii_DL:
-			// Bank can be imported.
-			break;
+	// Check if the source bank can be extracted.
+	const RvtH_BankEntry *const entry_src = getBankEntry(bank_src);
+	ret = checkExtractable(entry_src);
+	if (ret != 0) {
+		return ret;
+	}
 
-		case RVTH_BankType_Unknown:
-		default:
-			// Unknown bank status...
-			errno = EIO;
-			return RVTH_ERROR_BANK_UNKNOWN;
+	// Chunk map for scrubbing. (empty if all chunks are copied)
+	vector<bool> used;
 
-		case RVTH_BankType_Empty:
-			// Bank is empty.
-			errno = ENOENT;
-			return RVTH_ERROR_BANK_EMPTY;
+	// Delta extract: Chunks that are identical in the base image.
+	// (empty if all chunks are read from the source)
+	vector<bool> fromBase;
+	Reader *reader_base = nullptr;
 
-		case RVTH_BankType_Wii_DL_Bank2:
-			// Second bank of a dual-layer Wii disc image.
-			// TODO: Automatically select the first bank?
-			errno = EIO;
-			return RVTH_ERROR_BANK_DL_2;
-	}
+	// Preallocated destination: Every block is written in order,
+	// and empty areas are deallocated after copying.
+	// Each hole is {lba_start, lba_len}.
+	bool prealloc = false;
+	vector<std::pair<uint32_t, uint32_t> > holes;
 
-	// Get the bank count of the destination RVT-H device.
-	unsigned int bank_count_dest = rvth_dest->bankCount();
-	// Destination bank entry.
-	RvtH_BankEntry *const entry_dest = &rvth_dest->m_entries[bank_dest];
+	// Resumed copy: First LBA that still needs to be copied.
+	uint32_t lba_resume = 0;
 
-	// Source image length cannot be larger than a single bank.
-	RvtH_BankEntry *entry_dest2 = nullptr;
-	if (entry_src->type == RVTH_BankType_Wii_DL) {
-		// Special cases for DL:
-		// - Destination bank must not be the last bank.
-		// - For extended bank tables, destination bank must not be the first bank.
-		// - Both the selected bank and the next bank must be empty or deleted.
-		if (bank_count_dest > 8) {
-			// Extended bank table.
-			if (bank_dest == 0) {
-				// Cannot use bank 0.
-				errno = EINVAL;
-				return RVTH_ERROR_IMPORT_DL_EXT_NO_BANK1;
-			}
+	// Determine the buffer size.
+	resolveCopyParams(entry_src->reader, rvth_dest->m_file, &cp);
+	lba_count_buf = BYTES_TO_LBA(cp.buf_size);
+	const uint32_t hole_lba_min = BYTES_TO_LBA(cp.hole_size);
+
+	// Allocate the memory buffer.
+	PoolBuffer pool_buf(cp.buf_size, cp.alignment);
+	uint8_t *const buf = pool_buf.get();
+	if (!buf) {
+		// Error allocating memory.
+		err = errno;
+		if (err == 0) {
+			err = ENOMEM;
 		}
+		ret = -err;
+		goto end;
+	}
 
-		// Cannot use the last bank for DL images.
-		if (bank_dest == bank_count_dest-1) {
-			errno = EINVAL;
-			return RVTH_ERROR_IMPORT_DL_LAST_BANK;
+	if (flags & RVTH_EXTRACT_DIGESTS) {
+		// Digests are calculated in the background.
+		digest.reset(new ImageDigest(cp.buf_size));
+		if (!digest->isOpen()) {
+			err = ENOMEM;
+			ret = -ENOMEM;
+			goto end;
 		}
+	}
 
-		// Check that the first bank is empty or deleted.
-		// NOTE: Checked below, but we should check this before
-		// checking the second bank.
-		if (entry_dest->type != RVTH_BankType_Empty &&
-		    !entry_dest->is_deleted)
-		{
-			errno = EEXIST;
-			return RVTH_ERROR_BANK_NOT_EMPTY_OR_DELETED;
+	if (flags & RVTH_EXTRACT_SCRUB) {
+		// Determine which chunks contain used data.
+		// Unused chunks won't be read, so they'll be sparse
+		// in the destination image.
+		ret = rvth_scrub_build_chunk_map(getBankEntry(bank_src), lba_count_buf, used);
+		if (ret != 0) {
+			err = errno;
+			goto end;
 		}
+	}
 
-		// Check that the second bank is empty or deleted.
-		entry_dest2 = &rvth_dest->m_entries[bank_dest+1];
-		if (entry_dest2->type != RVTH_BankType_Empty &&
-		    !entry_dest2->is_deleted)
-		{
-			errno = EEXIST;
-			return RVTH_ERROR_BANK2DL_NOT_EMPTY_OR_DELETED;
+	if (rvth_base) {
+		// Find the chunks that are identical in the base image using
+		// the H3 tables, so they don't have to be read from the source.
+		RvtH_BankEntry *const entry_base = rvth_base->getBankEntry(0);
+		if (entry_base->type == entry_src->type && entry_base->reader) {
+			fromBase = findIdenticalChunks(getBankEntry(bank_src), entry_base,
+				lba_count_buf, entry_src->lba_len / lba_count_buf);
+			reader_base = entry_base->reader;
 		}
+	}
 
-		// Verify that the two banks are contiguous.
-		// FIXME: This should always be the case except for bank 1 on
-		// devices with non-extended bank tables. lba_len is reduced
-		// if the bank originally had a GameCube image, so we can't
-		// check this right now.
-		/*if (entry_dest->lba_start + entry_dest->lba_len != entry_dest2->lba_start) {
-			// Not contiguous.
-			errno = EIO;
-			return RVTH_ERROR_IMPORT_DL_NOT_CONTIGUOUS;
-		}*/
+	// FIXME: If the file existed and wasn't 0 bytes,
+	// either truncate it or don't do sparse writes.
 
-		// Verify that the image fits in two banks.
-		if (entry_src->lba_len > NHCD_BANK_SIZE_LBA*2) {
-			// Image is too big.
-			errno = ENOSPC;
-			return RVTH_ERROR_IMAGE_TOO_BIG;
+	// Allocate the destination file.
+	// A resumed copy uses the existing file as-is.
+	entry_dest = &rvth_dest->m_entries[0];
+	if (journal && journal->isResumable()) {
+		lba_resume = journal->resume(entry_dest->reader, buf, lba_count_buf, lba_count_buf);
+	}
+	if (lba_resume > 0) {
+		// Resumed copy. The existing file is written in place.
+		prealloc = false;
+	} else if (flags & RVTH_EXTRACT_PREALLOCATE) {
+		prealloc = true;
+	} else if (!(flags & RVTH_EXTRACT_SPARSE)) {
+		// Check the destination file system.
+		prealloc = rvth_dest->m_file->prefersPreallocation();
+	}
+	if (prealloc) {
+		ret = entry_dest->reader->preallocate();
+		if (ret == -ENOTSUP) {
+			// Not supported by this image format or file system.
+			// Write a sparse file instead.
+			prealloc = false;
+		} else if (ret != 0) {
+			// Error preallocating the file, e.g. ENOSPC.
+			err = -ret;
+			goto end;
 		}
-	} else if (entry_src->lba_len > NHCD_BANK_SIZE_LBA) {
-		// Single-layer image is too big for this bank.
-		errno = ENOSPC;
-		return RVTH_ERROR_IMAGE_TOO_BIG;
-	} else if (bank_dest == 0) {
-		// Special handling for bank 1 if the bank table is extended.
-		// TODO: entry_dest->lba_len should be the full bank size
-		// if the bank is empty or deleted.
-		// TODO: Add a separate field, lba_max_len?
-		if (bank_count_dest > 8) {
-			// Image cannot be larger than NHCD_EXTBANKTABLE_BANK_1_SIZE_LBA.
-			if (entry_src->lba_len > NHCD_EXTBANKTABLE_BANK_1_SIZE_LBA) {
-				errno = ENOSPC;
-				return RVTH_ERROR_IMAGE_TOO_BIG;
-			}
+	}
+	if (prealloc) {
+		// All blocks are allocated now, so the image can be
+		// written through a mapping without running out of space.
+		mapped.reset(new MappedWriter(entry_dest->reader));
+	} else {
+		// Make this a sparse file.
+		ret = entry_dest->reader->makeSparse();
+	}
+	if (ret != 0) {
+		// Error managing the sparse file.
+		// TODO: Delete the file?
+		err = rvth_dest->m_file->lastError();
+		if (err == 0) {
+			err = ENOMEM;
 		}
+		ret = -err;
+		goto end;
 	}
 
-	// Destination bank must be either empty or deleted.
-	if (entry_dest->type != RVTH_BankType_Empty &&
-	    !entry_dest->is_deleted)
-	{
-		errno = EEXIST;
-		return RVTH_ERROR_BANK_NOT_EMPTY_OR_DELETED;
+	// Copy the bank table information.
+	copyBankInfo(entry_dest, entry_src);
+
+	// Number of LBAs to copy.
+	lba_copy_len = entry_src->lba_len;
+
+	if (callback) {
+		// Initialize the callback state.
+		state.rvth = this;
+		state.rvth_gcm = rvth_dest;
+		state.bank_rvth = bank_src;
+		state.bank_gcm = 0;
+		state.type = RVTH_PROGRESS_EXTRACT;
+		state.lba_processed = 0;
+		state.lba_total = lba_copy_len;
+		state.digests = nullptr;
 	}
 
-	// Make the destination RVT-H object writable.
-	ret = rvth_dest->makeWritable();
-	if (ret != 0) {
-		// Could not make the RVT-H object writable.
-		int err;
-		if (ret < 0) {
+	// TODO: Optimize seeking? (Reader::write() seeks every time.)
+	lba_buf_max = entry_dest->lba_len - (entry_dest->lba_len % lba_count_buf);
+	lba_nonsparse = 0;
+	if (!digest && !pHashIndex && !journal && used.empty() && fromBase.empty() &&
+	    (!pOmit || pOmit->empty()))
+	{
+		// Share the source image's blocks if possible.
+		uint32_t lba_end = 0;
+		ret = cloneExtents(entry_dest->reader, entry_src->reader, lba_copy_len,
+			buf, lba_count_buf, [&](uint32_t lba) -> bool {
+				if (!callback || !throttle.ready(LBA_TO_BYTES(static_cast<uint64_t>(lba))))
+					return true;
+				state.lba_processed = lba;
+				rate.update(&state);
+				return callback(&state, userdata);
+			}, &lba_end);
+		if (ret == -ENOTSUP) {
+			// Not supported. Copy the image using the buffer.
+			ret = 0;
+		} else if (ret != 0) {
 			err = -ret;
+			goto end;
 		} else {
-			err = EROFS;
+			if (lba_end != 0) {
+				lba_nonsparse = lba_end - 1;
+			}
+
+			// Restore the disc header if it was zeroed.
+			const uint32_t lba_hdr = BYTES_TO_LBA(sizeof(GCN_DiscHeader) + LBA_SIZE - 1);
+			errno = 0;
+			if (entry_src->reader->read(buf, 0, lba_hdr) != lba_hdr) {
+				err = (errno != 0 ? errno : EIO);
+				ret = -err;
+				goto end;
+			}
+			GCN_DiscHeader origHdr;
+			memcpy(&origHdr, buf, sizeof(origHdr));
+			restoreDiscHeader(buf, entry_src);
+			if (memcmp(&origHdr, buf, sizeof(origHdr)) != 0) {
+				entry_dest->reader->write(buf, 0, lba_hdr);
+				lba_nonsparse = std::max(lba_nonsparse, lba_hdr - 1);
+			}
+			goto copied;
 		}
-		errno = err;
-		return err;
 	}
+	{
+		// Chunks that are unallocated in the source image are known
+		// to be empty, so they aren't read or scanned for empty blocks.
+		// The first chunk is always processed, since the disc header
+		// might have to be restored.
+		vector<uint8_t> emptyMap;
+		if (entry_src->reader->getEmptyMap(0, lba_count_buf, lba_buf_max / lba_count_buf, emptyMap) != 0) {
+			emptyMap[0] = 0;
+		} else {
+			emptyMap.clear();
+		}
 
-	// Reset the reader for the bank.
-	if (entry_dest->reader) {
-		delete entry_dest->reader;
-		entry_dest->reader = nullptr;
-	}
-	// NOTE: Using the source LBA length, since we might be
-	// importing a dual-layer Wii image.
-	entry_dest->reader = Reader::open(rvth_dest->m_file,
-		entry_dest->lba_start, entry_src->lba_len);
-	if (!entry_dest->reader) {
-		// Cannot create a reader...
-		int err = errno;
-		if (err == 0) {
-			err = EIO;
+		// Chunks that are copied from the base image
+		// don't need to be read from the source.
+		vector<bool> readMap;
+		if (!fromBase.empty() || !emptyMap.empty()) {
+			readMap = used;
+			readMap.resize(lba_buf_max / lba_count_buf, used.empty());
+			for (size_t i = 0; i < readMap.size(); i++) {
+				readMap[i] = readMap[i] &&
+					!(i < fromBase.size() && fromBase[i]) &&
+					!(i < emptyMap.size() && emptyMap[i]);
+			}
+		}
+		const vector<bool> *pReadMap = (!readMap.empty() ? &readMap : (!used.empty() ? &used : nullptr));
+		vector<bool> resumeMap;
+		if (pReadMap && lba_resume > 0) {
+			// The read map starts at the resume point.
+			const size_t skip = std::min<size_t>(lba_resume / lba_count_buf, pReadMap->size());
+			resumeMap.assign(pReadMap->begin() + skip, pReadMap->end());
+			pReadMap = &resumeMap;
 		}
-		errno = err;
-		return err;
-	}
 
-	if (entry_dest2) {
-		// Clear the second bank entry.
-		if (entry_dest2->reader) {
-			delete entry_dest2->reader;
-			entry_dest2->reader = nullptr;
+		// Read ahead from the source while the current chunk is being
+		// checked for sparse blocks and written to the destination.
+		ReadAheadQueue raq(entry_src->reader, lba_resume, lba_buf_max - lba_resume, lba_count_buf, cp.buf_count,
+			pReadMap, cp.alignment);
+		if (!raq.isOpen()) {
+			// Error allocating memory.
+			err = ENOMEM;
+			ret = -ENOMEM;
+			goto end;
 		}
-		entry_dest2->timestamp = -1;
-		entry_dest2->type = RVTH_BankType_Wii_DL_Bank2;
-		entry_dest2->region_code = 0xFF;
-		entry_dest2->is_deleted = false;
-		free(entry_dest2->ptbl);
-		entry_dest2->ptbl = nullptr;
 
-		// NOTE: We don't need to write the second bank table entry for,
-		// DL images, since it should already be empty and/or deleted.
-		// It has to be updated in memory for qrvthtool, though.
-	}
+		for (lba_count = lba_resume; lba_count < lba_buf_max; lba_count += lba_count_buf) {
+			if (journal && journal->isDirty()) {
+				// Record the completed segments once they're on disk.
+				// Errors are ignored; the copy can still finish.
+				if (mapped) {
+					mapped->sync();
+				} else {
+					entry_dest->reader->sync();
+				}
+				journal->save();
+			}
+			if (callback && throttle.ready(LBA_TO_BYTES(static_cast<uint64_t>(lba_count)))) {
+				bool bRet;
+				state.lba_processed = lba_count;
+				rate.update(&state);
+				bRet = callback(&state, userdata);
+				if (!bRet) {
+					// Stop processing.
+					err = ECANCELED;
+					ret = -ECANCELED;
+					goto end;
+				}
+			}
 
-	// Allocate the memory buffer.
-	unique_ptr<uint8_t[]> buf(new uint8_t[BUF_SIZE]);
+			uint8_t *const rbuf = raq.next();
+			if (!rbuf) {
+				// Read error.
+				err = (errno != 0 ? errno : EIO);
+				ret = -err;
+				goto end;
+			}
 
-	// Copy the bank table information.
-	entry_dest->lba_len	= entry_src->lba_len;
-	entry_dest->type	= entry_src->type;
-	entry_dest->region_code	= entry_src->region_code;
-	entry_dest->is_deleted	= false;
-	entry_dest->crypto_type	= entry_src->crypto_type;
-	entry_dest->ios_version	= entry_src->ios_version;
-	entry_dest->ticket	= entry_src->ticket;
-	entry_dest->tmd		= entry_src->tmd;
+			const size_t chunk = lba_count / lba_count_buf;
+			const bool is_empty = (chunk > 0 &&
+				((chunk < emptyMap.size() && emptyMap[chunk]) || (!used.empty() && !used[chunk])));
+			if (!is_empty && chunk < fromBase.size() && fromBase[chunk] && (used.empty() || used[chunk])) {
+				// Chunk is identical in the base image.
+				if (reader_base->read(rbuf, lba_count, lba_count_buf) != lba_count_buf) {
+					// Read error. Read the chunk from the source instead.
+					entry_src->reader->read(rbuf, lba_count, lba_count_buf);
+				}
+			}
 
-	// Copy the disc header.
-	memcpy(&entry_dest->discHeader, &entry_src->discHeader, sizeof(entry_dest->discHeader));
+			if (lba_count == 0) {
+				// Make sure we copy the disc header in if the
+				// header was zeroed by the RVT-H's "Flush" function.
+				// TODO: Move this outside of the `for` loop.
+				restoreDiscHeader(rbuf, entry_src);
+			}
+			if (digest) {
+				digest->update(rbuf, cp.buf_size);
+			}
+			if (pHashIndex) {
+				pHashIndex->update(rbuf, cp.buf_size);
+			}
+			if (journal) {
+				journal->update(rbuf, cp.buf_size);
+			}
 
-	// Timestamp.
-	if (entry_src->timestamp >= 0) {
-		entry_dest->timestamp = entry_src->timestamp;
-	} else {
-		entry_dest->timestamp = time(nullptr);
-	}
+			if (is_empty) {
+				// Chunk is known to be empty. (rbuf is zero-filled.)
+				StatsCounters::addSparse(cp.buf_size);
+				if (prealloc) {
+					addHole(holes, lba_count, lba_count_buf);
+					mapped->write(rbuf, lba_count, lba_count_buf);
+					lba_nonsparse = lba_count + lba_count_buf - 1;
+				}
+				continue;
+			}
 
-	// NOTE: We're only writing up to the source image file size.
-	// There's no point in wiping the rest of the bank.
-	lba_copy_len = entry_src->lba_len;
+			if (prealloc) {
+				// Write the entire buffer, zeroing the omitted blocks,
+				// and keep track of the empty blocks.
+				for (unsigned int sprs = 0; sprs < cp.buf_size; sprs += 4096) {
+					const uint32_t lba_blk = lba_count + (sprs / 512);
+					if (isOmitted(pOmit, lba_blk, 8)) {
+						// Stored elsewhere. (RVTH_EXTRACT_STORE_UPDATES)
+						memset(&rbuf[sprs], 0, 4096);
+						addHole(holes, lba_blk, 8);
+					} else if (RvtH::isBlockEmpty(&rbuf[sprs], 4096)) {
+						addHole(holes, lba_blk, 8);
+						StatsCounters::addSparse(4096);
+					}
+				}
+				mapped->write(rbuf, lba_count, lba_count_buf);
+				lba_nonsparse = lba_count + lba_count_buf - 1;
+				continue;
+			}
 
-	if (callback) {
-		// Initialize the callback state.
-		state.rvth = rvth_dest;
-		state.rvth_gcm = this;
-		state.bank_rvth = bank_dest;
-		state.bank_gcm = bank_src;
-		state.type = RVTH_PROGRESS_IMPORT;
-		state.lba_processed = 0;
-		state.lba_total = lba_copy_len;
+			// Write the non-empty 4 KB blocks, gathering them into runs.
+			const uint32_t lba_end = writeSkipEmpty(entry_dest->reader, rbuf, lba_count, lba_count_buf,
+				BYTES_TO_LBA(4096), hole_lba_min, pOmit);
+			if (lba_end != 0) {
+				lba_nonsparse = lba_end - 1;
+			}
+		}
 	}
 
-	// TODO: Special indicator.
-	// TODO: Optimize seeking? (Reader::write() seeks every time.)
-	lba_buf_max = entry_dest->lba_len & ~(LBA_COUNT_BUF-1);
-	for (lba_count = 0; lba_count < lba_buf_max; lba_count += LBA_COUNT_BUF) {
+	// Process any remaining LBAs.
+	if (lba_count < lba_copy_len) {
+		const unsigned int lba_left = lba_copy_len - lba_count;
+		const unsigned int sz_left = static_cast<unsigned int>(LBA_TO_BYTES(lba_left));
+
 		if (callback) {
 			bool bRet;
 			state.lba_processed = lba_count;
+			rate.update(&state);
 			bRet = callback(&state, userdata);
 			if (!bRet) {
 				// Stop processing.
-				errno = ECANCELED;
-				return -ECANCELED;
+				err = ECANCELED;
+				ret = -ECANCELED;
+				goto end;
 			}
 		}
+		entry_src->reader->read(buf, lba_count, lba_left);
+		if (digest) {
+			digest->update(buf, sz_left);
+		}
+		if (pHashIndex) {
+			pHashIndex->update(buf, sz_left);
+		}
 
-		// TODO: Restore the disc header here if necessary?
-		// GCMs being imported generally won't have the first
-		// 16 KB zeroed out...
-
-		// TODO: Error handling.
-		entry_src->reader->read(buf.get(), lba_count, LBA_COUNT_BUF);
-		entry_dest->reader->write(buf.get(), lba_count, LBA_COUNT_BUF);
-		entry_dest->reader->flush();
+		if (prealloc) {
+			// Write all of the remaining LBAs, zeroing the omitted blocks.
+			// The remainder is smaller than the copy buffer, so
+			// empty blocks aren't deallocated here.
+			for (unsigned int sprs = 0; sprs < sz_left; sprs += 512) {
+				if (isOmitted(pOmit, lba_count + (sprs / 512), 1)) {
+					memset(&buf[sprs], 0, 512);
+				}
+			}
+			mapped->write(buf, lba_count, lba_left);
+			lba_nonsparse = lba_copy_len - 1;
+		} else {
+			// Write the non-empty 512-byte blocks, gathering them into runs.
+			const uint32_t lba_end = writeSkipEmpty(entry_dest->reader, buf, lba_count, lba_left,
+				1, hole_lba_min, pOmit);
+			if (lba_end != 0) {
+				lba_nonsparse = lba_end - 1;
+			}
+		}
 	}
 
-	// Process any remaining LBAs.
-	if (lba_count < lba_copy_len) {
-		const unsigned int lba_left = lba_copy_len - lba_count;
-		entry_src->reader->read(buf.get(), lba_count, lba_left);
-		entry_dest->reader->write(buf.get(), lba_count, lba_left);
-		entry_dest->reader->flush();
+copied:
+	if (mapped) {
+		// Write back the last window.
+		ret = mapped->finish();
+		if (ret != 0) {
+			err = -ret;
+			goto end;
+		}
+	}
+	if (digest) {
+		// Wait for the digests to finish.
+		digest->finish(&digests);
+		if (pDigests) {
+			*pDigests = digests;
+		}
 	}
 
 	if (callback) {
 		bool bRet;
 		state.lba_processed = lba_copy_len;
+		state.digests = (digest ? &digests : nullptr);
+		rate.update(&state);
 		bRet = callback(&state, userdata);
+		state.digests = nullptr;
 		if (!bRet) {
 			// Stop processing.
-			errno = ECANCELED;
-			return -ECANCELED;
+			err = ECANCELED;
+			ret = -ECANCELED;
+			goto end;
 		}
 	}
 
+	// lba_nonsparse should be equal to lba_copy_len-1.
+	if (lba_nonsparse != lba_copy_len-1) {
+		// Last LBA was sparse.
+		// We'll need to write an actual zero block.
+		// TODO: Maybe not needed if ftruncate() succeeded?
+		// TODO: Check for errors.
+		memset(buf, 0, 512);
+		entry_dest->reader->write(buf, lba_copy_len-1, 1);
+		//entry_dest->reader->flush();
+	}
+
 	// Flush the destination device.
-	entry_dest->reader->flush();
+	entry_dest->reader->sync();
 
-	// Update the bank table.
-	// TODO: Check for errors.
-	rvth_dest->writeBankEntry(bank_dest);
+	if (prealloc) {
+		// Deallocate the empty areas.
+		discardHoles(entry_dest->reader, holes);
+	}
+	if (journal) {
+		// The copy is complete.
+		journal->remove();
+	}
 
-	// Finished importing the disc image.
-	return 0;
+end:
+	if (err != 0) {
+		errno = err;
+	}
+	return ret;
 }
 
 /**
- * Import a disc image into this RVT-H disk image.
- * Compatibility wrapper; this function creates an RvtH object for the
- * RVT-H disk image and then copyToHDD().
+ * Extract a disc image from this RVT-H disk image.
+ * Compatibility wrapper; this function creates a new RvtH
+ * using the GCM constructor and then copyToGcm().
  * @param bank		[in] Bank number. (0-7)
- * @param filename	[in] Source GCM filename.
+ * @param filename	[in] Destination filename.
+ * @param recrypt_key	[in] Key for recryption. (-1 for default; otherwise, see RVL_CryptoType_e)
+ * @param flags		[in] Flags. (See RvtH_Extract_Flags.)
  * @param callback	[in,opt] Progress callback.
  * @param userdata	[in,opt] User data for progress callback.
- * @param ios_force	[in,opt] IOS version to force. (-1 to use the existing IOS)
+ * @param store_dir	[in,opt] Partition store directory. (Required for RVTH_EXTRACT_STORE_UPDATES.)
+ * @param base_filename	[in,opt] Base image, e.g. an older dump. Identical groups are copied from it.
  * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
  */
-int RvtH::import(unsigned int bank, const TCHAR *filename,
-	RvtH_Progress_Callback callback, void *userdata,
-	int ios_force)
+int RvtH::extract(unsigned int bank, const TCHAR *filename,
+	int recrypt_key, unsigned int flags, RvtH_Progress_Callback callback, void *userdata,
+	const TCHAR *store_dir, const TCHAR *base_filename)
+{
+	return extract_int(bank, filename, recrypt_key, flags, callback, userdata,
+		store_dir, base_filename, nullptr);
+}
+
+/**
+ * Extract a disc image from this RVT-H disk image.
+ * If ppRecrypt is specified, the destination image isn't recrypted.
+ * Instead, if it needs to be recrypted, it's returned in ppRecrypt,
+ * and the caller must recrypt it and delete it.
+ * @param bank		[in] Bank number. (0-7)
+ * @param filename	[in] Destination filename.
+ * @param recrypt_key	[in] Key for recryption. (-1 for default; otherwise, see RVL_CryptoType_e)
+ * @param flags		[in] Flags. (See RvtH_Extract_Flags.)
+ * @param callback	[in,opt] Progress callback.
+ * @param userdata	[in,opt] User data for progress callback.
+ * @param store_dir	[in,opt] Partition store directory. (Required for RVTH_EXTRACT_STORE_UPDATES.)
+ * @param base_filename	[in,opt] Base image, e.g. an older dump. Identical groups are copied from it.
+ * @param ppRecrypt	[out,opt] Destination image to recrypt. (nullptr if it doesn't need to be recrypted)
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int RvtH::extract_int(unsigned int bank, const TCHAR *filename,
+	int recrypt_key, unsigned int flags, RvtH_Progress_Callback callback, void *userdata,
+	const TCHAR *store_dir, const TCHAR *base_filename, RvtH **ppRecrypt)
 {
+	StatsScope scope(m_stats);
+	if (ppRecrypt) {
+		*ppRecrypt = nullptr;
+	}
 	if (!filename || filename[0] == 0) {
 		errno = EINVAL;
 		return -EINVAL;
@@ -852,56 +1617,2721 @@ int RvtH::import(unsigned int bank, const TCHAR *filename,
 		return -ERANGE;
 	}
 
-	// Open the standalone disc image.
+	// TODO: If recryption is needed, validate parts of the partitions,
+	// e.g. certificate chain length, before copying.
+
+	// TODO: If recrypt_key == the original key,
+	// handle it as -1.
+
+	// Create a standalone disc image.
+	RvtH_BankEntry *const entry = getBankEntry(bank);
+	const bool unenc_to_enc = (entry->type >= RVTH_BankType_Wii_SL &&
+				   entry->crypto_type == RVL_CryptoType_None &&
+				   recrypt_key > RVL_CryptoType_Unknown);
+	// Unencrypted Wii images are copied as-is if decryption is requested.
+	const bool enc_to_dec = ((flags & RVTH_EXTRACT_DECRYPT) &&
+				 entry->type >= RVTH_BankType_Wii_SL &&
+				 entry->crypto_type != RVL_CryptoType_None);
+	if (flags & RVTH_EXTRACT_DECRYPT) {
+		if (entry->type == RVTH_BankType_GCN) {
+			// No encryption for GameCube.
+			errno = EIO;
+			return RVTH_ERROR_NOT_WII_IMAGE;
+		} else if (recrypt_key > RVL_CryptoType_Unknown || base_filename ||
+			   (flags & (RVTH_EXTRACT_DIGESTS | RVTH_EXTRACT_HASH_INDEX | RVTH_EXTRACT_STORE_UPDATES)))
+		{
+			// The decrypted image isn't the same as the source image.
+			errno = ENOTSUP;
+			return -ENOTSUP;
+		}
+	}
+
+	// "-" writes the disc image to standard output.
+	// The image is written in a single sequential pass, so anything
+	// that rewrites the image or writes files next to it can't be used.
+	const bool to_stream = !_tcscmp(filename, _T("-"));
+	if (to_stream) {
+		if (unenc_to_enc ||
+		    (recrypt_key > RVL_CryptoType_Unknown && entry->crypto_type != recrypt_key) ||
+		    (flags & (RVTH_EXTRACT_STORE_UPDATES | RVTH_EXTRACT_HASH_INDEX)))
+		{
+			errno = ENOTSUP;
+			return -ENOTSUP;
+		}
+	} else if (Reader::formatFromFilename(filename) == RVTH_ImageFormat_RVTZ) {
+		// RVTZ chunks are compressed as they're written,
+		// so recryption can't go back and rewrite them.
+		if (unenc_to_enc ||
+		    (recrypt_key > RVL_CryptoType_Unknown && entry->crypto_type != recrypt_key))
+		{
+			errno = ENOTSUP;
+			return -ENOTSUP;
+		}
+	}
+	uint32_t gcm_lba_len;
+	if (unenc_to_enc) {
+		// Converting from unencrypted to encrypted.
+		// Need to convert 31k sectors to 32k.
+		uint32_t lba_tmp;
+		const pt_entry_t *game_pte = rvth_ptbl_find_game(entry);
+		if (!game_pte) {
+			// No game partition...
+			errno = EIO;
+			return RVTH_ERROR_NO_GAME_PARTITION;
+		}
+
+		// TODO: Read the partition header to determine the data offset.
+		// Assuming 0x8000 partition header size for now.
+		lba_tmp = game_pte->lba_len - BYTES_TO_LBA(0x8000);
+		gcm_lba_len = (lba_tmp / 3968 * 4096);
+		if (lba_tmp % 3968 != 0) {
+			gcm_lba_len += 4096;
+		}
+		// Assuming 0x8000 header + 0x18000 H3 table.
+		gcm_lba_len += BYTES_TO_LBA(0x20000) + game_pte->lba_start;
+	} else if (enc_to_dec) {
+		// Converting from encrypted to unencrypted.
+		// Need to convert 32k sectors to 31k.
+		const pt_entry_t *game_pte = rvth_ptbl_find_game(entry);
+		if (!game_pte) {
+			// No game partition...
+			errno = EIO;
+			return RVTH_ERROR_NO_GAME_PARTITION;
+		}
+		const RVL_PartitionHeader *const pthdr = rvth_ptbl_get_header(entry, game_pte);
+		if (!pthdr) {
+			const int err = (errno != 0 ? errno : EIO);
+			errno = err;
+			return -err;
+		}
+		const uint32_t data_lba = BYTES_TO_LBA(static_cast<uint64_t>(be32_to_cpu(pthdr->data_offset)) << 2);
+		if (data_lba >= game_pte->lba_len) {
+			errno = EIO;
+			return RVTH_ERROR_PARTITION_HEADER_CORRUPTED;
+		}
+
+		const uint32_t lba_tmp = game_pte->lba_len - data_lba;
+		gcm_lba_len = (lba_tmp + BYTES_TO_LBA(SECTOR_SIZE_ENC) - 1) / BYTES_TO_LBA(SECTOR_SIZE_ENC)
+			* BYTES_TO_LBA(SECTOR_SIZE_DEC);
+		gcm_lba_len += BYTES_TO_LBA(sizeof(RVL_PartitionHeader)) + game_pte->lba_start;
+	} else {
+		// Use the bank size as-is.
+		gcm_lba_len = entry->lba_len;
+	}
+
+	if (flags & RVTH_EXTRACT_PREPEND_SDK_HEADER) {
+		const int ret = checkSdkHeader(entry, filename);
+		if (ret != 0) {
+			return ret;
+		}
+		// Prepend 32k to the GCM.
+		gcm_lba_len += SDK_HEADER_SIZE_LBA;
+	}
+
+	vector<PartitionRef> stored;
+	if (flags & RVTH_EXTRACT_STORE_UPDATES) {
+		if (!store_dir || store_dir[0] == 0) {
+			errno = EINVAL;
+			return -EINVAL;
+		}
+		if (unenc_to_enc || recrypt_key > RVL_CryptoType_Unknown ||
+		    (flags & (RVTH_EXTRACT_PREPEND_SDK_HEADER | RVTH_EXTRACT_SCRUB)))
+		{
+			// The stored partitions must match the extracted image as-is.
+			errno = ENOTSUP;
+			return -ENOTSUP;
+		}
+		if (entry->type < RVTH_BankType_Wii_SL) {
+			// Only Wii disc images have update partitions.
+			errno = EIO;
+			return RVTH_ERROR_NOT_WII_IMAGE;
+		}
+
+		// Copy the update partitions to the store.
+		// This is done before creating the destination image
+		// so a store error doesn't leave a partial image behind.
+		int ret = rvth_ptbl_load(entry);
+		if (ret != 0) {
+			return ret;
+		}
+		PartitionStore store(store_dir);
+		for (unsigned int i = 0; i < entry->pt_count; i++) {
+			const pt_entry_t *const pte = &entry->ptbl[i];
+			if (pte->type != 1) {
+				// Not an update partition.
+				continue;
+			}
+
+			PartitionRef ref;
+			ret = PartitionStore::getRef(entry, pte, &ref);
+			if (ret == 0) {
+				ret = store.store(entry->reader, ref);
+			}
+			if (ret != 0) {
+				return ret;
+			}
+			stored.push_back(ref);
+		}
+	}
+
+	// Open the base image for delta extraction.
+	unique_ptr<RvtH> rvth_base;
+	if (base_filename) {
+		if (unenc_to_enc) {
+			// Recrypted data can't be copied from the base image.
+			errno = ENOTSUP;
+			return -ENOTSUP;
+		} else if (!_tcscmp(base_filename, filename)) {
+			// The destination image would overwrite the base image.
+			errno = EINVAL;
+			return -EINVAL;
+		}
+
+		int ret = 0;
+		rvth_base.reset(new RvtH(base_filename, &ret));
+		if (!rvth_base->isOpen()) {
+			// Error opening the base image.
+			if (ret == 0) {
+				ret = -EIO;
+			}
+			return ret;
+		} else if (rvth_base->isHDD() || rvth_base->bankCount() != 1) {
+			// Not a standalone disc image.
+			errno = EINVAL;
+			return RVTH_ERROR_IS_HDD_IMAGE;
+		}
+	}
+
+	// Resumable extraction: The copy's progress is recorded in a
+	// sidecar journal. Only plain images can be written in place.
+	unique_ptr<CopyJournal> journal;
+	if (flags & RVTH_EXTRACT_RESUME) {
+		if (to_stream || unenc_to_enc || enc_to_dec ||
+		    Reader::formatFromFilename(filename) != RVTH_ImageFormat_Plain ||
+		    (flags & (RVTH_EXTRACT_DIGESTS | RVTH_EXTRACT_HASH_INDEX | RVTH_EXTRACT_STORE_UPDATES)))
+		{
+			// The digests and indexes need the whole image,
+			// and other formats and conversions aren't
+			// written sequentially.
+			errno = ENOTSUP;
+			return -ENOTSUP;
+		}
+		journal.reset(new CopyJournal());
+		journal->open(CopyJournal::filenameForImage(filename), m_file, bank, entry, entry->lba_len,
+			flags & (RVTH_EXTRACT_SCRUB | RVTH_EXTRACT_PREPEND_SDK_HEADER));
+	}
+	const bool resume = (journal && journal->isResumable());
+
+	// Check that we have enough free disk space.
+	// NOTE: We're not checking for sparse sectors.
+	// If resuming, the image already has most of its space.
+	if (!to_stream && !resume) {
+		int64_t diskFreeSpace_lba = getDiskFreeSpace_lba(filename);
+		if (diskFreeSpace_lba < 0) {
+			// Error...
+			int ret = static_cast<int>(diskFreeSpace_lba);
+			errno = -ret;
+			return ret;
+		} else if (diskFreeSpace_lba < gcm_lba_len) {
+			// Not enough free disk space.
+			errno = ENOSPC;
+			return -ENOSPC;
+		}
+	}
+
 	int ret = 0;
-	unique_ptr<RvtH> rvth_src(new RvtH(filename, &ret));
-	if (!rvth_src->isOpen()) {
-		// Error opening the standalone disc image.
+	unique_ptr<RvtH> rvth_dest(new RvtH(filename, gcm_lba_len, &ret, resume));
+	if (resume && !rvth_dest->isOpen()) {
+		// The image is gone. Start over.
+		// Resuming will fail when the journal is checked.
+		ret = 0;
+		rvth_dest.reset(new RvtH(filename, gcm_lba_len, &ret));
+	}
+	if (!rvth_dest->isOpen()) {
+		// Error creating the standalone disc image.
+		errno = EIO;
 		if (ret == 0) {
 			ret = -EIO;
 		}
 		return ret;
-	} else if (rvth_src->isHDD() || rvth_src->bankCount() > 1) {
-		// Not a standalone disc image.
+	}
+	applyDurability(rvth_dest->m_entries[0].reader);
+
+	if (flags & RVTH_EXTRACT_PREPEND_SDK_HEADER) {
+		// Prepend 32k to the GCM.
+		ret = writeSdkHeader(rvth_dest->m_entries[0].reader, entry->type);
+		if (ret != 0) {
+			return ret;
+		}
+	}
+
+	// Copy the bank from the source image to the destination GCM.
+	RvtH_Image_Digests digests;
+	if (unenc_to_enc) {
+		ret = copyToGcm_doCrypt(rvth_dest.get(), bank, callback, userdata);
+	} else if (enc_to_dec) {
+		ret = copyToGcm_doDecrypt(rvth_dest.get(), bank, callback, userdata);
+	} else {
+		// The hash index reads the partition headers from the source,
+		// so it must be initialized before copying starts.
+		unique_ptr<HashIndex> hashIndex;
+		if (flags & RVTH_EXTRACT_HASH_INDEX) {
+			hashIndex.reset(new HashIndex());
+			ret = hashIndex->init(entry);
+			if (ret != 0) {
+				return ret;
+			}
+		}
+
+		ret = copyToGcm(rvth_dest.get(), bank, flags, callback, userdata, &digests, hashIndex.get(),
+			((flags & RVTH_EXTRACT_STORE_UPDATES) ? &stored : nullptr), rvth_base.get(),
+			journal.get());
+		if (ret == 0 && (flags & RVTH_EXTRACT_DIGESTS) && !to_stream) {
+			// Write the digests to a sidecar file.
+			// Errors are ignored, since the digests were also
+			// reported in the final progress update.
+			ImageDigest::writeSidecar(filename, &digests);
+		}
+		if (ret == 0 && hashIndex) {
+			ret = hashIndex->save(HashIndex::filenameForImage(filename).c_str());
+		}
+		if (ret == 0 && (flags & RVTH_EXTRACT_STORE_UPDATES)) {
+			ret = PartitionStore::saveRefs(
+				PartitionStore::refsFilenameForImage(filename).c_str(), stored);
+		}
+	}
+	if (ret == 0 && recrypt_key > RVL_CryptoType_Unknown) {
+		// Recrypt the disc image.
+		if (entry->crypto_type != recrypt_key) {
+			if (ppRecrypt) {
+				// The caller will recrypt the disc image.
+				*ppRecrypt = rvth_dest.release();
+				return 0;
+			}
+			ret = rvth_dest->recryptWiiPartitions(0,
+				static_cast<RVL_CryptoType_e>(recrypt_key), callback, userdata);
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * Extract multiple banks from this RVT-H disk image.
+ *
+ * The banks are read one at a time, in the order they're stored on
+ * the device, so the device is read sequentially. This also applies
+ * to discs in a WBFS partition. If the images are recrypted, each
+ * image is recrypted on a worker thread while the next bank is being
+ * read. Recryption on the worker thread doesn't report progress.
+ * If a job fails, the remaining jobs are still run.
+ *
+ * @param jobs		[in,out] Extract jobs.
+ * @param count		[in] Number of jobs.
+ * @param recrypt_key	[in] Key for recryption. (-1 for default; otherwise, see RVL_CryptoType_e)
+ * @param flags		[in] Flags. (See RvtH_Extract_Flags.)
+ * @param callback	[in,opt] Progress callback.
+ * @param userdata	[in,opt] User data for progress callback.
+ * @param store_dir	[in,opt] Partition store directory. (Required for RVTH_EXTRACT_STORE_UPDATES.)
+ * @return Error code of the first job that failed, or 0 if all jobs succeeded.
+ *         (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int RvtH::extractBanks(RvtH_Extract_Job *jobs, unsigned int count,
+	int recrypt_key, unsigned int flags,
+	RvtH_Progress_Callback callback, void *userdata,
+	const TCHAR *store_dir)
+{
+	StatsScope scope(m_stats);
+	if (!jobs || count == 0) {
 		errno = EINVAL;
-		return RVTH_ERROR_IS_HDD_IMAGE;
-	} else if (rvth_src->bankCount() == 0) {
-		// Unrecognized file format.
-		// TODO: Distinguish between unrecognized and no banks.
+		return -EINVAL;
+	}
+
+	// Validate the jobs.
+	for (unsigned int i = 0; i < count; i++) {
+		jobs[i].result = -ECANCELED;
+		if (!jobs[i].filename || jobs[i].filename[0] == 0) {
+			errno = EINVAL;
+			return -EINVAL;
+		} else if (jobs[i].bank >= m_bankCount) {
+			// Bank number is out of range.
+			errno = ERANGE;
+			return -ERANGE;
+		}
+	}
+
+	// Run the jobs in the order the banks are stored in the file.
+	// Bank numbers are usually in this order already, but discs
+	// in a WBFS partition are ordered by their first WBFS block.
+	vector<unsigned int> order(count);
+	vector<off64_t> physStart(count);
+	for (unsigned int i = 0; i < count; i++) {
+		order[i] = i;
+		const Reader *const reader = m_entries[jobs[i].bank].reader;
+		physStart[i] = (reader ? reader->physicalStart() : 0);
+	}
+	std::stable_sort(order.begin(), order.end(), [&physStart](unsigned int a, unsigned int b) {
+		return physStart[a] < physStart[b];
+	});
+
+	// Recryption of the previous image.
+	// Only one image is recrypted at a time, so the worker
+	// doesn't fall behind by more than one bank.
+	std::thread recrypt_thread;
+
+	for (unsigned int i : order) {
+		RvtH *rvth_recrypt = nullptr;
+		jobs[i].result = extract_int(jobs[i].bank, jobs[i].filename, recrypt_key, flags,
+			callback, userdata, store_dir, nullptr, &rvth_recrypt);
+		if (!rvth_recrypt) {
+			continue;
+		}
+
+		// Recrypt this image while the next bank is being read.
+		if (recrypt_thread.joinable()) {
+			recrypt_thread.join();
+		}
+		int *const pResult = &jobs[i].result;
+		StatsCounters *const stats = m_stats;
+		recrypt_thread = std::thread([rvth_recrypt, recrypt_key, pResult, stats]() {
+			StatsScope scope(stats);
+			*pResult = rvth_recrypt->recryptWiiPartitions(0,
+				static_cast<RVL_CryptoType_e>(recrypt_key));
+			delete rvth_recrypt;
+		});
+	}
+	if (recrypt_thread.joinable()) {
+		recrypt_thread.join();
+	}
+
+	for (unsigned int i = 0; i < count; i++) {
+		if (jobs[i].result != 0) {
+			return jobs[i].result;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Extract a disc image from this RVT-H disk image to multiple destinations.
+ *
+ * The bank is read from the device once. Each destination is written
+ * by its own thread with its own queue, so a slow destination falls
+ * behind by up to its queue limit without holding up the device read.
+ * If a destination fails, the other destinations continue.
+ *
+ * Destinations can be anything that extract() can create, including
+ * "-" for standard output, but the bank can't be recrypted.
+ *
+ * @param bank		[in] Bank number. (0-7)
+ * @param filenames	[in] Destination filenames.
+ * @param count		[in] Number of destinations.
+ * @param flags		[in] Flags. (See RvtH_Extract_Flags; only RVTH_EXTRACT_PREPEND_SDK_HEADER, RVTH_EXTRACT_SCRUB, RVTH_EXTRACT_DIGESTS, RVTH_EXTRACT_SPARSE, and RVTH_EXTRACT_PREALLOCATE are supported.)
+ * @param callback	[in,opt] Progress callback.
+ * @param userdata	[in,opt] User data for progress callback.
+ * @param results	[out,opt] Array of `count` error codes, one for each destination.
+ * @return Error code of the first destination that failed, or 0 if all destinations succeeded.
+ *         (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int RvtH::extractTee(unsigned int bank, const TCHAR *const *filenames, unsigned int count,
+	unsigned int flags, RvtH_Progress_Callback callback, void *userdata, int *results)
+{
+	StatsScope scope(m_stats);
+	if (!filenames || count == 0) {
 		errno = EINVAL;
-		return RVTH_ERROR_NO_BANKS;
+		return -EINVAL;
 	}
 
-	// Copy the bank from the source GCM to the HDD.
-	// TODO: HDD to HDD?
-	// NOTE: `bank` parameter starts at 0, not 1.
-	ret = rvth_src->copyToHDD(this, bank, 0, callback, userdata);
+	// Validate the parameters.
+	// If they're invalid, all of the destinations fail with the same error.
+	int ret = 0;
+	if (bank >= m_bankCount) {
+		// Bank number is out of range.
+		ret = -ERANGE;
+	} else if (flags & (RVTH_EXTRACT_STORE_UPDATES | RVTH_EXTRACT_HASH_INDEX)) {
+		// These write extra data for a single destination.
+		ret = -ENOTSUP;
+	}
+
+	// Each file can only be written once, and there's only one stdout.
+	unsigned int streams = 0;
+	for (unsigned int i = 0; i < count && ret == 0; i++) {
+		if (!filenames[i] || filenames[i][0] == 0) {
+			ret = -EINVAL;
+			break;
+		}
+		if (!_tcscmp(filenames[i], _T("-"))) {
+			streams++;
+		}
+		for (unsigned int j = 0; j < i; j++) {
+			if (!_tcscmp(filenames[i], filenames[j])) {
+				ret = -EINVAL;
+				break;
+			}
+		}
+	}
+	if (streams > 1) {
+		ret = -EINVAL;
+	}
+
+	// Check if the source bank can be extracted.
+	const RvtH_BankEntry *const entry_src = (ret == 0 ? getBankEntry(bank) : nullptr);
 	if (ret == 0) {
-		// Must convert to debug realsigned for use on RVT-H.
-		const RvtH_BankEntry *const entry = this->bankEntry(bank);
-		if (entry &&
-			(entry->type == RVTH_BankType_Wii_SL ||
-			 entry->type == RVTH_BankType_Wii_DL) &&
-			(entry->crypto_type == RVL_CryptoType_Retail ||
-			 entry->crypto_type == RVL_CryptoType_Korean ||
-			 entry->crypto_type == RVL_CryptoType_vWii ||
-		         entry->ticket.sig_status != RVL_SigStatus_OK ||
-			 entry->tmd.sig_status != RVL_SigStatus_OK ||
-			 (ios_force >= 3 && entry->ios_version != ios_force)))
-		{
-			// One of the following conditions:
-			// - Encryption: Retail, Korean, or vWii
-			// - Signature: Invalid
-			// - IOS requested does not match the TMD IOS
-			// Convert to Debug.
-			ret = recryptWiiPartitions(bank, RVL_CryptoType_Debug, callback, userdata, ios_force);
+		ret = checkExtractable(entry_src);
+	}
+	if (ret != 0) {
+		if (results) {
+			std::fill(results, results + count, ret);
 		}
-		else
-		{
-			// No recryption needed.
-			// Write the identifier to indicate that this bank was imported.
-			ret = recryptID(bank);
+		if (ret < 0) {
+			errno = -ret;
 		}
+		return ret;
 	}
-	return ret;
+	const uint32_t lba_copy_len = entry_src->lba_len;
+
+	// Each destination gets its own SDK header, if requested.
+	// The header is written through the destination's reader, so the
+	// chunks are written at the same LBAs as without the header.
+	const bool sdk_header = !!(flags & RVTH_EXTRACT_PREPEND_SDK_HEADER);
+	const uint32_t lba_dest_len = lba_copy_len + (sdk_header ? SDK_HEADER_SIZE_LBA : 0);
+
+	// Destination disc images.
+	struct TeeDest {
+		unique_ptr<RvtH> rvth;
+		bool to_stream = false;
+		bool prealloc = false;		// See copyToGcm().
+		vector<std::pair<uint32_t, uint32_t> > holes;
+		uint32_t lba_nonsparse = 0;	// Last LBA written that wasn't sparse.
+		int sink = -1;			// TeeWriter sink index
+		int ret = -ECANCELED;		// Error code
+	};
+	vector<TeeDest> dests(count);
+
+	// Create the destination disc images.
+	// Errors are recorded for each destination.
+	RvtH *rvth_first = nullptr;
+	for (unsigned int i = 0; i < count; i++) {
+		TeeDest &dest = dests[i];
+		dest.to_stream = !_tcscmp(filenames[i], _T("-"));
+		if (sdk_header) {
+			ret = checkSdkHeader(entry_src, filenames[i]);
+			if (ret != 0) {
+				dest.ret = ret;
+				continue;
+			}
+		}
+
+		// Check that we have enough free disk space.
+		// NOTE: We're not checking for sparse sectors, or for
+		// other destinations on the same volume.
+		if (!dest.to_stream) {
+			const int64_t diskFreeSpace_lba = getDiskFreeSpace_lba(filenames[i]);
+			if (diskFreeSpace_lba < 0) {
+				dest.ret = static_cast<int>(diskFreeSpace_lba);
+				continue;
+			} else if (diskFreeSpace_lba < lba_dest_len) {
+				dest.ret = -ENOSPC;
+				continue;
+			}
+		}
+
+		ret = 0;
+		dest.rvth.reset(new RvtH(filenames[i], lba_dest_len, &ret));
+		if (!dest.rvth->isOpen()) {
+			// Error creating the standalone disc image.
+			dest.rvth.reset();
+			dest.ret = (ret != 0 ? ret : -EIO);
+			continue;
+		}
+
+		// Allocate the destination file.
+		Reader *const reader = dest.rvth->m_entries[0].reader;
+		applyDurability(reader);
+		if (flags & RVTH_EXTRACT_PREALLOCATE) {
+			dest.prealloc = true;
+		} else if (!(flags & RVTH_EXTRACT_SPARSE)) {
+			dest.prealloc = dest.rvth->m_file->prefersPreallocation();
+		}
+		ret = 0;
+		if (dest.prealloc) {
+			ret = reader->preallocate();
+			if (ret == -ENOTSUP) {
+				// Write a sparse file instead.
+				dest.prealloc = false;
+				ret = 0;
+			}
+		}
+		if (ret == 0 && !dest.prealloc) {
+			ret = reader->makeSparse();
+		}
+		if (ret == 0 && sdk_header) {
+			ret = writeSdkHeader(reader, entry_src->type);
+		}
+		if (ret != 0) {
+			dest.rvth.reset();
+			dest.ret = ret;
+			continue;
+		}
+
+		// Copy the bank table information.
+		copyBankInfo(&dest.rvth->m_entries[0], entry_src);
+		if (!rvth_first) {
+			rvth_first = dest.rvth.get();
+		}
+	}
+
+	// Image digests. (RVTH_EXTRACT_DIGESTS)
+	unique_ptr<ImageDigest> digest;
+	RvtH_Image_Digests digests;
+
+	// Chunk map for scrubbing. (empty if all chunks are copied)
+	vector<bool> used;
+
+	RvtH_CopyParams cp;
+	uint32_t lba_count_buf = 0;
+	ret = 0;
+	if (!rvth_first) {
+		// No destinations were created.
+		goto end;
+	}
+
+	// Determine the buffer size.
+	// Direct I/O destinations may need a larger alignment than the first one.
+	resolveCopyParams(entry_src->reader, rvth_first->m_file, &cp);
+	for (const TeeDest &dest : dests) {
+		if (dest.rvth) {
+			RvtH_CopyParams cp_dest;
+			resolveCopyParams(entry_src->reader, dest.rvth->m_file, &cp_dest);
+			cp.alignment = std::max(cp.alignment, cp_dest.alignment);
+		}
+	}
+	lba_count_buf = BYTES_TO_LBA(cp.buf_size);
+
+	if (flags & RVTH_EXTRACT_DIGESTS) {
+		// Digests are calculated in the background.
+		digest.reset(new ImageDigest(cp.buf_size));
+		if (!digest->isOpen()) {
+			ret = -ENOMEM;
+			goto end;
+		}
+	}
+
+	if (flags & RVTH_EXTRACT_SCRUB) {
+		// Determine which chunks contain used data.
+		ret = rvth_scrub_build_chunk_map(getBankEntry(bank), lba_count_buf, used);
+		if (ret != 0) {
+			goto end;
+		}
+	}
+
+	{
+		// Chunks that are unallocated in the source image are
+		// known to be empty, so they aren't read or scanned.
+		vector<uint8_t> emptyMap;
+		if (entry_src->reader->getEmptyMap(0, lba_count_buf, lba_copy_len / lba_count_buf, emptyMap) == 0) {
+			emptyMap.clear();
+		}
+
+		// Chunks are shared by all of the destinations, so the memory
+		// used is the size of the longest queue, not the total.
+		size_t queue_max = TEE_QUEUE_MAX;
+		if (cp.mem_budget != 0) {
+			queue_max = static_cast<size_t>(cp.mem_budget) << 20;
+		}
+
+		const uint32_t hole_lba_min = BYTES_TO_LBA(cp.hole_size);
+		TeeWriter tee(std::max<size_t>(queue_max, cp.buf_size));
+		for (TeeDest &dest : dests) {
+			if (!dest.rvth) {
+				continue;
+			}
+			TeeDest *const pDest = &dest;
+			ret = tee.addSink([pDest, lba_copy_len, hole_lba_min](const TeeWriter::Chunk &chunk) -> int {
+				Reader *const reader = pDest->rvth->m_entries[0].reader;
+				const uint8_t *const cbuf = chunk.buf.get();
+				const uint32_t lba_block = (chunk.lba_len % BYTES_TO_LBA(4096) == 0 ? BYTES_TO_LBA(4096) : 1);
+				const unsigned int block_size = static_cast<unsigned int>(LBA_TO_BYTES(lba_block));
+
+				if (chunk.is_empty) {
+					// Chunk is known to be empty.
+					StatsCounters::addSparse(LBA_TO_BYTES(chunk.lba_len));
+					if (pDest->prealloc) {
+						addHole(pDest->holes, chunk.lba_start, chunk.lba_len);
+						if (reader->write(cbuf, chunk.lba_start, chunk.lba_len) != chunk.lba_len) {
+							return (errno != 0 ? -errno : -EIO);
+						}
+						pDest->lba_nonsparse = chunk.lba_start + chunk.lba_len - 1;
+					}
+				} else if (pDest->prealloc) {
+					// Write the entire chunk and keep track of the empty blocks.
+					for (uint32_t lba = 0; lba < chunk.lba_len; lba += lba_block) {
+						if (RvtH::isBlockEmpty(&cbuf[LBA_TO_BYTES(lba)], block_size)) {
+							addHole(pDest->holes, chunk.lba_start + lba, lba_block);
+							StatsCounters::addSparse(block_size);
+						}
+					}
+					if (reader->write(cbuf, chunk.lba_start, chunk.lba_len) != chunk.lba_len) {
+						return (errno != 0 ? -errno : -EIO);
+					}
+					pDest->lba_nonsparse = chunk.lba_start + chunk.lba_len - 1;
+				} else {
+					// Write the non-empty blocks, gathering them into runs.
+					int err = 0;
+					const uint32_t lba_end = writeSkipEmpty(reader, cbuf, chunk.lba_start, chunk.lba_len,
+						lba_block, hole_lba_min, nullptr, &err);
+					if (err != 0) {
+						return err;
+					}
+					if (lba_end != 0) {
+						pDest->lba_nonsparse = lba_end - 1;
+					}
+				}
+
+				if (chunk.lba_start + chunk.lba_len < lba_copy_len) {
+					return 0;
+				}
+
+				// Last chunk. Finish writing this destination here,
+				// so the destinations are finished concurrently.
+				if (pDest->lba_nonsparse != lba_copy_len-1) {
+					// Last LBA was sparse.
+					// We'll need to write an actual zero block.
+					PoolBuffer zero(LBA_TO_BYTES(1));
+					if (!zero) {
+						return -ENOMEM;
+					}
+					memset(zero.get(), 0, LBA_TO_BYTES(1));
+					if (reader->write(zero.get(), lba_copy_len-1, 1) != 1) {
+						return (errno != 0 ? -errno : -EIO);
+					}
+				}
+				reader->sync();
+				if (pDest->prealloc) {
+					// Deallocate the empty areas.
+					discardHoles(reader, pDest->holes);
+				}
+				return 0;
+			});
+			if (ret != 0) {
+				dest.rvth.reset();
+				dest.ret = ret;
+				continue;
+			}
+			dest.sink = static_cast<int>(tee.sinkCount() - 1);
+		}
+
+		// Callback state.
+		RvtH_Progress_State state;
+		ProgressRate rate;
+		ProgressThrottle throttle(&m_progressParams);
+		if (callback) {
+			state.rvth = this;
+			state.rvth_gcm = rvth_first;
+			state.bank_rvth = bank;
+			state.bank_gcm = 0;
+			state.type = RVTH_PROGRESS_EXTRACT;
+			state.lba_processed = 0;
+			state.lba_total = lba_copy_len;
+			state.digests = nullptr;
+		}
+
+		// Read the bank once. The chunks are written to the
+		// destinations on the sink threads while the next
+		// chunk is being read.
+		ret = 0;
+		for (uint32_t lba_count = 0; lba_count < lba_copy_len; lba_count += lba_count_buf) {
+			if (callback && throttle.ready(LBA_TO_BYTES(static_cast<uint64_t>(lba_count)))) {
+				state.lba_processed = lba_count;
+				rate.update(&state);
+				if (!callback(&state, userdata)) {
+					// Stop processing.
+					ret = -ECANCELED;
+					break;
+				}
+			}
+
+			const uint32_t lba_len = std::min(lba_count_buf, lba_copy_len - lba_count);
+			std::shared_ptr<TeeWriter::Chunk> chunk = std::make_shared<TeeWriter::Chunk>();
+			chunk->lba_start = lba_count;
+			chunk->lba_len = lba_len;
+			if (!chunk->buf.reset(cp.buf_size, cp.alignment)) {
+				ret = -ENOMEM;
+				break;
+			}
+			uint8_t *const cbuf = chunk->buf.get();
+
+			const size_t idx = lba_count / lba_count_buf;
+			if (idx > 0 && lba_len == lba_count_buf &&
+			    ((idx < used.size() && !used[idx]) || (idx < emptyMap.size() && emptyMap[idx])))
+			{
+				// Unused chunk (RVTH_EXTRACT_SCRUB), or unallocated in the source image.
+				memset(cbuf, 0, cp.buf_size);
+				chunk->is_empty = true;
+			} else if (entry_src->reader->read(cbuf, lba_count, lba_len) != lba_len) {
+				// Read error.
+				ret = (errno != 0 ? -errno : -EIO);
+				break;
+			}
+
+			if (lba_count == 0) {
+				// Make sure we copy the disc header in if the
+				// header was zeroed by the RVT-H's "Flush" function.
+				restoreDiscHeader(cbuf, entry_src);
+			}
+			if (digest) {
+				digest->update(cbuf, LBA_TO_BYTES(lba_len));
+			}
+
+			ret = tee.push(chunk);
+			if (ret != 0) {
+				// Cancelled, or all of the destinations failed.
+				break;
+			}
+		}
+
+		if (ret == 0) {
+			// Wait for the destinations to finish writing.
+			tee.finish();
+		} else {
+			tee.cancel();
+		}
+		for (TeeDest &dest : dests) {
+			if (dest.sink >= 0) {
+				dest.ret = tee.result(static_cast<unsigned int>(dest.sink));
+				if (dest.ret == 0 && ret != 0) {
+					// The destination is incomplete.
+					dest.ret = ret;
+				}
+			}
+		}
+
+		if (ret == 0 && digest) {
+			// Wait for the digests to finish.
+			digest->finish(&digests);
+			for (unsigned int i = 0; i < count; i++) {
+				if (dests[i].ret == 0 && !dests[i].to_stream) {
+					// Errors are ignored, since the digests are also
+					// reported in the final progress update.
+					ImageDigest::writeSidecar(filenames[i], &digests);
+				}
+			}
+		}
+
+		if (ret == 0 && callback) {
+			state.lba_processed = lba_copy_len;
+			state.digests = (digest ? &digests : nullptr);
+			rate.update(&state);
+			callback(&state, userdata);
+			state.digests = nullptr;
+		}
+	}
+
+end:
+	if (ret != 0) {
+		// The operation failed for all destinations that were created.
+		for (TeeDest &dest : dests) {
+			if (dest.rvth && dest.sink < 0) {
+				dest.ret = ret;
+			}
+		}
+	}
+
+	int ret_first = 0;
+	for (unsigned int i = 0; i < count; i++) {
+		if (results) {
+			results[i] = dests[i].ret;
+		}
+		if (ret_first == 0 && dests[i].ret != 0) {
+			ret_first = dests[i].ret;
+		}
+	}
+	if (ret_first < 0) {
+		errno = -ret_first;
+	}
+	return ret_first;
+}
+
+/**
+ * Convert this standalone disc image to another container format,
+ * e.g. WBFS to a plain disc image, or a plain disc image to CISO.
+ *
+ * The image is copied as-is from its Reader to a new Reader for the
+ * destination, without any bank processing: the bank type isn't
+ * checked, the disc header isn't restored, and nothing is recrypted.
+ * The destination format is selected by the file extension.
+ * (See Reader::create().)
+ *
+ * Unallocated areas of the source image aren't read, empty blocks
+ * aren't written, and chunks are read ahead while the current chunk
+ * is being written. Digests are calculated on a worker thread, and
+ * RVTZ images are compressed on worker threads. If both images are
+ * plain files on a file system that supports it, the source image's
+ * blocks are shared instead of copied.
+ *
+ * @param filename	[in] Destination filename. ("-" for standard output)
+ * @param flags		[in] Flags. (See RvtH_Extract_Flags; only RVTH_EXTRACT_DIGESTS, RVTH_EXTRACT_SPARSE, and RVTH_EXTRACT_PREALLOCATE are used.)
+ * @param callback	[in,opt] Progress callback. (RVTH_PROGRESS_CONVERT)
+ * @param userdata	[in,opt] User data for progress callback.
+ * @param pDigests	[out,opt] Image digests. (Only set if RVTH_EXTRACT_DIGESTS is set.)
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int RvtH::convert(const TCHAR *filename, unsigned int flags,
+	RvtH_Progress_Callback callback, void *userdata, RvtH_Image_Digests *pDigests)
+{
+	StatsScope scope(m_stats);
+	if (!filename || filename[0] == 0) {
+		errno = EINVAL;
+		return -EINVAL;
+	} else if (isHDD() || m_bankCount != 1) {
+		// Only standalone disc images can be converted.
+		errno = EINVAL;
+		return RVTH_ERROR_IS_HDD_IMAGE;
+	}
+
+	Reader *const reader_src = m_entries[0].reader;
+	if (!reader_src || reader_src->lba_len() == 0) {
+		errno = EIO;
+		return -EIO;
+	}
+	const uint32_t lba_copy_len = reader_src->lba_len();
+
+	// Create the destination image.
+	RefFile *const file_dest = new RefFile(filename, true);
+	if (!file_dest->isOpen()) {
+		int err = file_dest->lastError();
+		if (err == 0) {
+			err = EIO;
+		}
+		file_dest->unref();
+		errno = err;
+		return -err;
+	}
+	unique_ptr<Reader> reader_dest(Reader::create(file_dest,
+		lba_copy_len, Reader::formatFromFilename(filename)));
+	file_dest->unref();
+	if (!reader_dest) {
+		int err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		errno = err;
+		return -err;
+	}
+	applyDurability(reader_dest.get());
+
+	// Determine the buffer size.
+	RvtH_CopyParams cp;
+	resolveCopyParams(reader_src, reader_dest->file(), &cp);
+	const uint32_t lba_count_buf = BYTES_TO_LBA(cp.buf_size);
+	const uint32_t hole_lba_min = BYTES_TO_LBA(cp.hole_size);
+
+	PoolBuffer pool_buf(cp.buf_size, cp.alignment);
+	uint8_t *const buf = pool_buf.get();
+	if (!buf) {
+		errno = ENOMEM;
+		return -ENOMEM;
+	}
+
+	// Image digests. (calculated in the background)
+	unique_ptr<ImageDigest> digest;
+	if (flags & RVTH_EXTRACT_DIGESTS) {
+		digest.reset(new ImageDigest(cp.buf_size));
+		if (!digest->isOpen()) {
+			errno = ENOMEM;
+			return -ENOMEM;
+		}
+	}
+
+	// Allocate the destination file.
+	// Preallocated files are written in order, and the
+	// empty areas are deallocated after copying.
+	bool prealloc = false;
+	vector<std::pair<uint32_t, uint32_t> > holes;
+	int ret = 0;
+	if (flags & RVTH_EXTRACT_PREALLOCATE) {
+		prealloc = true;
+	} else if (!(flags & RVTH_EXTRACT_SPARSE)) {
+		prealloc = reader_dest->file()->prefersPreallocation();
+	}
+	if (prealloc) {
+		ret = reader_dest->preallocate();
+		if (ret == -ENOTSUP) {
+			prealloc = false;
+		} else if (ret != 0) {
+			errno = -ret;
+			return ret;
+		}
+	}
+	if (!prealloc) {
+		ret = reader_dest->makeSparse();
+		if (ret != 0) {
+			errno = -ret;
+			return ret;
+		}
+	}
+
+	// Callback state.
+	RvtH_Progress_State state;
+	ProgressRate rate;
+	ProgressThrottle throttle(&m_progressParams);
+	if (callback) {
+		state.rvth = this;
+		state.rvth_gcm = nullptr;
+		state.bank_rvth = 0;
+		state.bank_gcm = ~0U;
+		state.type = RVTH_PROGRESS_CONVERT;
+		state.lba_processed = 0;
+		state.lba_total = lba_copy_len;
+		state.digests = nullptr;
+	}
+	auto progress = [&](uint32_t lba) -> bool {
+		if (!callback || !throttle.ready(LBA_TO_BYTES(static_cast<uint64_t>(lba))))
+			return true;
+		state.lba_processed = lba;
+		rate.update(&state);
+		return callback(&state, userdata);
+	};
+
+	uint32_t lba_end = 0;	// LBA following the last LBA written
+	int werr = 0;		// Write error
+	ret = -ENOTSUP;
+	if (!digest) {
+		// Share the source image's blocks if possible.
+		ret = cloneExtents(reader_dest.get(), reader_src, lba_copy_len,
+			buf, lba_count_buf, progress, &lba_end);
+		if (ret != 0 && ret != -ENOTSUP) {
+			errno = -ret;
+			return ret;
+		}
+	}
+	if (ret == -ENOTSUP) {
+		// Copy the image using the buffer.
+		const uint32_t lba_buf_max = lba_copy_len - (lba_copy_len % lba_count_buf);
+
+		// Chunks that are unallocated in the source image
+		// aren't read or scanned for empty blocks.
+		vector<uint8_t> emptyMap;
+		vector<bool> readMap;
+		if (reader_src->getEmptyMap(0, lba_count_buf, lba_buf_max / lba_count_buf, emptyMap) != 0) {
+			readMap.resize(emptyMap.size());
+			for (size_t i = 0; i < readMap.size(); i++) {
+				readMap[i] = !emptyMap[i];
+			}
+		}
+
+		ReadAheadQueue raq(reader_src, 0, lba_buf_max, lba_count_buf, cp.buf_count,
+			(readMap.empty() ? nullptr : &readMap), cp.alignment);
+		if (!raq.isOpen()) {
+			errno = ENOMEM;
+			return -ENOMEM;
+		}
+
+		for (uint32_t lba_count = 0; lba_count < lba_copy_len; lba_count += lba_count_buf) {
+			if (!progress(lba_count)) {
+				errno = ECANCELED;
+				return -ECANCELED;
+			}
+
+			// The remaining LBAs are read without the read-ahead queue.
+			const uint32_t lba_cur = std::min(lba_count_buf, lba_copy_len - lba_count);
+			const size_t sz_cur = static_cast<size_t>(LBA_TO_BYTES(lba_cur));
+			uint8_t *rbuf;
+			if (lba_count < lba_buf_max) {
+				rbuf = raq.next();
+				if (!rbuf) {
+					// Read error.
+					const int err = (errno != 0 ? errno : EIO);
+					errno = err;
+					return -err;
+				}
+			} else {
+				errno = 0;
+				if (reader_src->read(buf, lba_count, lba_cur) != lba_cur) {
+					const int err = (errno != 0 ? errno : EIO);
+					errno = err;
+					return -err;
+				}
+				rbuf = buf;
+			}
+			if (digest) {
+				digest->update(rbuf, sz_cur);
+			}
+
+			const size_t chunk = lba_count / lba_count_buf;
+			if (chunk < emptyMap.size() && emptyMap[chunk]) {
+				// Chunk is known to be empty. (rbuf is zero-filled.)
+				StatsCounters::addSparse(sz_cur);
+				if (!prealloc) {
+					continue;
+				}
+				addHole(holes, lba_count, lba_cur);
+			} else if (prealloc) {
+				// Write the entire buffer, and keep track of the empty blocks.
+				for (size_t sprs = 0; sprs + 4096 <= sz_cur; sprs += 4096) {
+					if (RvtH::isBlockEmpty(&rbuf[sprs], 4096)) {
+						addHole(holes, lba_count + BYTES_TO_LBA(sprs), BYTES_TO_LBA(4096));
+						StatsCounters::addSparse(4096);
+					}
+				}
+			} else {
+				// Write the non-empty blocks.
+				const uint32_t lba_written = writeSkipEmpty(reader_dest.get(), rbuf, lba_count, lba_cur,
+					(lba_cur == lba_count_buf ? BYTES_TO_LBA(4096) : 1), hole_lba_min, nullptr, &werr);
+				if (werr != 0) {
+					errno = -werr;
+					return werr;
+				}
+				if (lba_written != 0) {
+					lba_end = lba_written;
+				}
+				continue;
+			}
+
+			errno = 0;
+			if (reader_dest->write(rbuf, lba_count, lba_cur) != lba_cur) {
+				const int err = (errno != 0 ? errno : EIO);
+				errno = err;
+				return -err;
+			}
+			lba_end = lba_count + lba_cur;
+		}
+	}
+
+	RvtH_Image_Digests digests;
+	if (digest) {
+		// Wait for the digests to finish.
+		digest->finish(&digests);
+		if (pDigests) {
+			*pDigests = digests;
+		}
+	}
+
+	if (callback) {
+		state.lba_processed = lba_copy_len;
+		state.digests = (digest ? &digests : nullptr);
+		rate.update(&state);
+		const bool bRet = callback(&state, userdata);
+		state.digests = nullptr;
+		if (!bRet) {
+			errno = ECANCELED;
+			return -ECANCELED;
+		}
+	}
+
+	if (lba_end != lba_copy_len) {
+		// The last LBA was empty, so it wasn't written.
+		// Write a zero block to set the image size.
+		memset(buf, 0, LBA_SIZE);
+		reader_dest->write(buf, lba_copy_len - 1, 1);
+	}
+
+	// Flush the destination image.
+	// Container headers are written here.
+	reader_dest->sync();
+	if (prealloc) {
+		// Deallocate the empty areas.
+		discardHoles(reader_dest.get(), holes);
+	}
+	return 0;
+}
+
+/**
+ * Calculate the digests of a bank without extracting it.
+ *
+ * The digests are the same as the digests calculated by extract()
+ * without recryption or an SDK header: the disc header is restored
+ * if it was zeroed, and the entire bank is hashed. They can then be
+ * matched against a DAT file. (See DatIndex.)
+ *
+ * Unallocated areas of the image aren't read. Reading and each of
+ * the digests run as separate pipeline stages, so they overlap.
+ *
+ * @param bank		[in] Bank number. (0-7)
+ * @param pDigests	[out] Image digests.
+ * @param callback	[in,opt] Progress callback. (RVTH_PROGRESS_IDENTIFY)
+ * @param userdata	[in,opt] User data for progress callback.
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int RvtH::digestBank(unsigned int bank, RvtH_Image_Digests *pDigests,
+	RvtH_Progress_Callback callback, void *userdata)
+{
+	StatsScope scope(m_stats);
+	if (!pDigests) {
+		errno = EINVAL;
+		return -EINVAL;
+	} else if (bank >= m_bankCount) {
+		errno = ERANGE;
+		return -ERANGE;
+	}
+
+	// Check if the bank can be extracted.
+	RvtH_BankEntry *const entry = getBankEntry(bank);
+	int ret = checkExtractable(entry);
+	if (ret != 0) {
+		return ret;
+	}
+	Reader *const reader = entry->reader;
+	const uint32_t lba_len = entry->lba_len;
+
+	// Determine the buffer size.
+	RvtH_CopyParams cp;
+	resolveCopyParams(reader, m_file, &cp);
+	const uint32_t lba_count_buf = BYTES_TO_LBA(cp.buf_size);
+
+	// Chunks that are unallocated in the image are known to be
+	// empty, so they're hashed as zeroes without reading them.
+	// The first chunk is always read, since the disc header
+	// might have to be restored.
+	const uint32_t chunk_count = (lba_len + lba_count_buf - 1) / lba_count_buf;
+	vector<uint8_t> emptyMap;
+	vector<bool> readMap;
+	if (reader->getEmptyMap(0, lba_count_buf, chunk_count, emptyMap) != 0) {
+		readMap.resize(emptyMap.size());
+		for (size_t i = 0; i < readMap.size(); i++) {
+			readMap[i] = (i == 0 || !emptyMap[i]);
+		}
+	}
+
+	// Each digest is calculated by its own pipeline stage,
+	// so the chunks are hashed in place without copying them.
+	// There's one extra buffer for each stage.
+	Pipeline pipeline(cp.buf_size, std::max(cp.buf_count, 2U) + 3, cp.alignment);
+	if (!pipeline.isOpen()) {
+		errno = ENOMEM;
+		return -ENOMEM;
+	}
+	ImageDigest digest;
+
+	// Callback state.
+	RvtH_Progress_State state;
+	ProgressRate rate;
+	ProgressThrottle throttle(&m_progressParams);
+	if (callback) {
+		state.rvth = this;
+		state.rvth_gcm = nullptr;
+		state.bank_rvth = bank;
+		state.bank_gcm = ~0U;
+		state.type = RVTH_PROGRESS_IDENTIFY;
+		state.lba_processed = 0;
+		state.lba_total = lba_len;
+		state.digests = nullptr;
+	}
+
+	Pipeline::StageFn readChunk = Pipeline::readerSource(reader, 0, lba_len, lba_count_buf,
+		(readMap.empty() ? nullptr : &readMap));
+	pipeline.setSource([&](Pipeline::Chunk &chunk) -> int {
+		const int ret = readChunk(chunk);
+		if (ret > 0 && chunk.lba_start == 0) {
+			// Make sure we hash the disc header if the
+			// header was zeroed by the RVT-H's "Flush" function.
+			restoreDiscHeader(chunk.buf.get(), entry);
+		}
+		return ret;
+	});
+	pipeline.addStage([&digest](Pipeline::Chunk &chunk) -> int {
+		digest.updateDigest(ImageDigest::DIGEST_CRC32, chunk.buf.get(),
+			static_cast<size_t>(LBA_TO_BYTES(chunk.lba_len)));
+		return 0;
+	});
+	pipeline.addStage([&digest](Pipeline::Chunk &chunk) -> int {
+		digest.updateDigest(ImageDigest::DIGEST_MD5, chunk.buf.get(),
+			static_cast<size_t>(LBA_TO_BYTES(chunk.lba_len)));
+		return 0;
+	});
+	// The last stage runs on this thread, so it also reports progress.
+	pipeline.addStage([&](Pipeline::Chunk &chunk) -> int {
+		if (callback && throttle.ready(LBA_TO_BYTES(static_cast<uint64_t>(chunk.lba_start)))) {
+			state.lba_processed = chunk.lba_start;
+			rate.update(&state);
+			if (!callback(&state, userdata)) {
+				// Stop processing.
+				return -ECANCELED;
+			}
+		}
+		digest.updateDigest(ImageDigest::DIGEST_SHA1, chunk.buf.get(),
+			static_cast<size_t>(LBA_TO_BYTES(chunk.lba_len)));
+		return 0;
+	});
+
+	ret = pipeline.run();
+	if (ret != 0) {
+		errno = -ret;
+		return ret;
+	}
+
+	digest.finish(pDigests);
+	if (callback) {
+		state.lba_processed = lba_len;
+		state.digests = pDigests;
+		rate.update(&state);
+		const bool bRet = callback(&state, userdata);
+		state.digests = nullptr;
+		if (!bRet) {
+			errno = ECANCELED;
+			return -ECANCELED;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Check if a bank from this HDD or standalone disc image can be copied
+ * to an RVT-H system. Nothing is written.
+ * Only the bank entries are used, i.e. the disc headers and the image
+ * sizes from the readers, so this doesn't read any image data.
+ * errno is set on error.
+ * @param rvth_dest	[in] Destination RvtH object.
+ * @param bank_dest	[in] Destination bank number. (0-7)
+ * @param bank_src	[in] Source bank number. (0-7)
+ * @param flags		[in] Flags. (See RvtH_Import_Flags.)
+ * @return 0 if the bank can be copied; negative POSIX error code or RvtH_Errors if not.
+ */
+int RvtH::checkCopyToHDD(RvtH *rvth_dest, unsigned int bank_dest,
+	unsigned int bank_src, unsigned int flags)
+{
+	if (!rvth_dest) {
+		errno = EINVAL;
+		return -EINVAL;
+	} else if (bank_src >= m_bankCount ||
+		   bank_dest >= rvth_dest->bankCount())
+	{
+		errno = ERANGE;
+		return -ERANGE;
+	} else if (!rvth_dest->isHDD()) {
+		// Destination is not an HDD.
+		errno = EIO;
+		return RVTH_ERROR_NOT_HDD_IMAGE;
+	} else if ((flags & RVTH_IMPORT_RESUME) && (flags & RVTH_IMPORT_DIGESTS)) {
+		// The digests need the whole image.
+		errno = ENOTSUP;
+		return -ENOTSUP;
+	}
+
+	// Check if the source bank can be imported.
+	const RvtH_BankEntry *const entry_src = getBankEntry(bank_src);
+	switch (entry_src->type) {
+		case RVTH_BankType_GCN:
+		case RVTH_BankType_Wii_SL:
+		case RVTH_BankType_Wii_DL:
+			// Bank can be imported.
+			break;
+
+		case RVTH_BankType_Unknown:
+		default:
+			// Unknown bank status...
+			errno = EIO;
+			return RVTH_ERROR_BANK_UNKNOWN;
+
+		case RVTH_BankType_Empty:
+			// Bank is empty.
+			errno = ENOENT;
+			return RVTH_ERROR_BANK_EMPTY;
+
+		case RVTH_BankType_Wii_DL_Bank2:
+			// Second bank of a dual-layer Wii disc image.
+			// TODO: Automatically select the first bank?
+			errno = EIO;
+			return RVTH_ERROR_BANK_DL_2;
+	}
+
+	// Get the bank count of the destination RVT-H device.
+	const unsigned int bank_count_dest = rvth_dest->bankCount();
+	// Destination bank entry.
+	const RvtH_BankEntry *const entry_dest = rvth_dest->getBankEntry(bank_dest);
+
+	// For differential imports, the destination bank may already
+	// have an image of the same type, which will be overwritten.
+	const bool diff = !!(flags & RVTH_IMPORT_DIFFERENTIAL);
+	const bool dest_writable = (entry_dest->type == RVTH_BankType_Empty ||
+		entry_dest->is_deleted || (diff && entry_dest->type == entry_src->type));
+
+	// Source image length cannot be larger than a single bank.
+	if (entry_src->type == RVTH_BankType_Wii_DL) {
+		// Special cases for DL:
+		// - Destination bank must not be the last bank.
+		// - For extended bank tables, destination bank must not be the first bank.
+		// - Both the selected bank and the next bank must be empty or deleted.
+		if (bank_count_dest > 8) {
+			// Extended bank table.
+			if (bank_dest == 0) {
+				// Cannot use bank 0.
+				errno = EINVAL;
+				return RVTH_ERROR_IMPORT_DL_EXT_NO_BANK1;
+			}
+		}
+
+		// Cannot use the last bank for DL images.
+		if (bank_dest == bank_count_dest-1) {
+			errno = EINVAL;
+			return RVTH_ERROR_IMPORT_DL_LAST_BANK;
+		}
+
+		// Check that the first bank is empty or deleted.
+		// NOTE: Checked below, but we should check this before
+		// checking the second bank.
+		if (!dest_writable) {
+			errno = EEXIST;
+			return RVTH_ERROR_BANK_NOT_EMPTY_OR_DELETED;
+		}
+
+		// Check that the second bank is empty or deleted.
+		// If a dual-layer image is being overwritten, the second
+		// bank belongs to that image.
+		const RvtH_BankEntry *const entry_dest2 = rvth_dest->getBankEntry(bank_dest+1);
+		if (entry_dest2->type != RVTH_BankType_Empty &&
+		    !entry_dest2->is_deleted &&
+		    !(diff && entry_dest->type == RVTH_BankType_Wii_DL &&
+		      entry_dest2->type == RVTH_BankType_Wii_DL_Bank2))
+		{
+			errno = EEXIST;
+			return RVTH_ERROR_BANK2DL_NOT_EMPTY_OR_DELETED;
+		}
+
+		// Verify that the two banks are contiguous.
+		// FIXME: This should always be the case except for bank 1 on
+		// devices with non-extended bank tables. lba_len is reduced
+		// if the bank originally had a GameCube image, so we can't
+		// check this right now.
+		/*if (entry_dest->lba_start + entry_dest->lba_len != entry_dest2->lba_start) {
+			// Not contiguous.
+			errno = EIO;
+			return RVTH_ERROR_IMPORT_DL_NOT_CONTIGUOUS;
+		}*/
+
+		// Verify that the image fits in two banks.
+		if (entry_src->lba_len > NHCD_BANK_SIZE_LBA*2) {
+			// Image is too big.
+			errno = ENOSPC;
+			return RVTH_ERROR_IMAGE_TOO_BIG;
+		}
+	} else if (entry_src->lba_len > NHCD_BANK_SIZE_LBA) {
+		// Single-layer image is too big for this bank.
+		errno = ENOSPC;
+		return RVTH_ERROR_IMAGE_TOO_BIG;
+	} else if (bank_dest == 0) {
+		// Special handling for bank 1 if the bank table is extended.
+		// TODO: entry_dest->lba_len should be the full bank size
+		// if the bank is empty or deleted.
+		// TODO: Add a separate field, lba_max_len?
+		if (bank_count_dest > 8) {
+			// Image cannot be larger than NHCD_EXTBANKTABLE_BANK_1_SIZE_LBA.
+			if (entry_src->lba_len > NHCD_EXTBANKTABLE_BANK_1_SIZE_LBA) {
+				errno = ENOSPC;
+				return RVTH_ERROR_IMAGE_TOO_BIG;
+			}
+		}
+	}
+
+	// Destination bank must be either empty or deleted.
+	if (!dest_writable) {
+		errno = EEXIST;
+		return RVTH_ERROR_BANK_NOT_EMPTY_OR_DELETED;
+	}
+	return 0;
+}
+
+/**
+ * Copy a bank from this HDD or standalone disc image to an RVT-H system.
+ *
+ * If the destination is an RVT-H disk image file, it's kept sparse:
+ * empty blocks are deallocated instead of written.
+ *
+ * @param rvth_dest	[in] Destination RvtH object.
+ * @param bank_dest	[in] Destination bank number. (0-7)
+ * @param bank_src	[in] Source bank number. (0-7)
+ * @param flags		[in] Flags. (See RvtH_Import_Flags.)
+ * @param callback	[in,opt] Progress callback.
+ * @param userdata	[in,opt] User data for progress callback.
+ * @param pDigests	[out,opt] Image digests. (Only set if RVTH_IMPORT_DIGESTS is set.)
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int RvtH::copyToHDD(RvtH *rvth_dest, unsigned int bank_dest,
+	unsigned int bank_src, unsigned int flags,
+	RvtH_Progress_Callback callback, void *userdata,
+	RvtH_Image_Digests *pDigests)
+{
+	StatsScope scope(m_stats);
+	uint32_t lba_copy_len;	// Total number of LBAs to copy. (entry_src->lba_len)
+	uint32_t lba_count;
+	uint32_t lba_buf_max;	// Highest LBA that can be written using the buffer.
+
+	// Callback state.
+	RvtH_Progress_State state;
+	ProgressRate rate;
+	ProgressThrottle throttle(&m_progressParams);
+
+	int ret = 0;	// errno or RvtH_Errors
+
+	// Check if the bank can be copied before anything is written.
+	ret = checkCopyToHDD(rvth_dest, bank_dest, bank_src, flags);
+	if (ret != 0) {
+		return ret;
+	}
+
+	// NOTE: Not const, since differential imports load the partition table.
+	RvtH_BankEntry *const entry_src = getBankEntry(bank_src);
+	RvtH_BankEntry *const entry_dest = rvth_dest->getBankEntry(bank_dest);
+	const bool diff = !!(flags & RVTH_IMPORT_DIFFERENTIAL);
+
+	// HDD image files are kept sparse: empty blocks are deallocated
+	// instead of written, so the file only grows with the data.
+	// (Differential imports only write what changed.)
+	const bool sparse = !diff && !rvth_dest->m_file->isDevice();
+
+	// Dual-layer images also use the next bank.
+	RvtH_BankEntry *const entry_dest2 = (entry_src->type == RVTH_BankType_Wii_DL)
+		? rvth_dest->getBankEntry(bank_dest+1)
+		: nullptr;
+
+	// Make the destination RVT-H object writable.
+	ret = rvth_dest->makeWritable();
+	if (ret != 0) {
+		// Could not make the RVT-H object writable.
+		int err;
+		if (ret < 0) {
+			err = -ret;
+		} else {
+			err = EROFS;
+		}
+		errno = err;
+		return err;
+	}
+
+	// Determine the buffer size.
+	RvtH_CopyParams cp;
+	resolveCopyParams(entry_src->reader, rvth_dest->m_file, &cp);
+	const uint32_t lba_count_buf = BYTES_TO_LBA(cp.buf_size);
+	const uint32_t hole_lba_min = BYTES_TO_LBA(cp.hole_size);
+
+	// NOTE: We're only writing up to the source image file size.
+	// There's no point in wiping the rest of the bank.
+	lba_copy_len = entry_src->lba_len;
+	lba_buf_max = lba_copy_len - (lba_copy_len % lba_count_buf);
+
+	// Differential import: Find the chunks that are known to be
+	// identical using the H3 tables. This must be done before the
+	// destination bank entry is overwritten.
+	// Other chunks are compared with the destination before writing.
+	vector<bool> identical;
+	PoolBuffer dbuf;
+	if (diff) {
+		if (entry_dest->type != RVTH_BankType_Empty && entry_dest->reader) {
+			identical = findIdenticalChunks(entry_src, entry_dest,
+				lba_count_buf, lba_buf_max / lba_count_buf);
+		}
+		if (!dbuf.reset(cp.buf_size, cp.alignment)) {
+			errno = ENOMEM;
+			return -ENOMEM;
+		}
+	}
+
+	// Keep the destination's verification map for the groups that
+	// aren't written. Only differential imports know which ones those are.
+	BankWriteScope trackWrites(rvth_dest, bank_dest);
+	if (!diff) {
+		rvth_dest->markBankWritten(bank_dest, 0, lba_copy_len);
+	}
+
+	// The destination's partition table will be reloaded
+	// from the new image when it's needed.
+	rvth_ptbl_free(entry_dest);
+
+	// Reset the reader for the bank.
+	if (entry_dest->reader) {
+		delete entry_dest->reader;
+		entry_dest->reader = nullptr;
+	}
+	// NOTE: Using the source LBA length, since we might be
+	// importing a dual-layer Wii image.
+	entry_dest->reader = Reader::open(rvth_dest->m_file,
+		entry_dest->lba_start, entry_src->lba_len);
+	if (!entry_dest->reader) {
+		// Cannot create a reader...
+		int err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		errno = err;
+		return err;
+	}
+	applyDurability(entry_dest->reader);
+	if (sparse) {
+		// Needed for deallocation on Windows.
+		rvth_dest->m_file->makeSparse();
+	}
+
+	if (entry_dest2) {
+		// Clear the second bank entry.
+		if (entry_dest2->reader) {
+			delete entry_dest2->reader;
+			entry_dest2->reader = nullptr;
+		}
+		entry_dest2->timestamp = -1;
+		entry_dest2->type = RVTH_BankType_Wii_DL_Bank2;
+		entry_dest2->region_code = 0xFF;
+		entry_dest2->is_deleted = false;
+		rvth_ptbl_free(entry_dest2);
+
+		// NOTE: We don't need to write the second bank table entry for,
+		// DL images, since it should already be empty and/or deleted.
+		// It has to be updated in memory for qrvthtool, though.
+	}
+
+	// Allocate the memory buffer.
+	PoolBuffer buf(cp.buf_size, cp.alignment);
+	if (!buf) {
+		errno = ENOMEM;
+		return -ENOMEM;
+	}
+
+	// Image digests. (calculated in the background)
+	unique_ptr<ImageDigest> digest;
+	if (flags & RVTH_IMPORT_DIGESTS) {
+		digest.reset(new ImageDigest(cp.buf_size));
+		if (!digest->isOpen()) {
+			errno = ENOMEM;
+			return -ENOMEM;
+		}
+	}
+
+	// Resumable import: The copy's progress is recorded in a journal in
+	// the cache directory. The bank table entry isn't written until the
+	// copy is complete, so an interrupted import can be resumed.
+	unique_ptr<CopyJournal> journal;
+	uint32_t lba_resume = 0;
+	if (flags & RVTH_IMPORT_RESUME) {
+		journal.reset(new CopyJournal());
+		journal->open(CopyJournal::filenameForBank(rvth_dest->m_file, bank_dest),
+			m_file, bank_src, entry_src, lba_copy_len, 0);
+		if (journal->isResumable()) {
+			lba_resume = journal->resume(entry_dest->reader, buf.get(), lba_count_buf, lba_count_buf);
+		}
+	}
+
+	// Read-back verification. (runs in the background)
+	// The destination is flushed after each chunk, so each
+	// flush is a checkpoint for the chunks that were written.
+	unique_ptr<ReadbackVerifier> readback;
+	if (flags & RVTH_IMPORT_READBACK) {
+		const uint32_t lba_window = BYTES_TO_LBA(static_cast<uint64_t>(cp.readback_window) << 20);
+		readback.reset(new ReadbackVerifier(entry_dest->reader, lba_count_buf, lba_window, cp.alignment));
+		if (!readback->isOpen()) {
+			errno = ENOMEM;
+			return -ENOMEM;
+		}
+	}
+
+	// Copy the bank table information.
+	entry_dest->lba_len	= entry_src->lba_len;
+	entry_dest->type	= entry_src->type;
+	entry_dest->region_code	= entry_src->region_code;
+	entry_dest->is_deleted	= false;
+	entry_dest->crypto_type	= entry_src->crypto_type;
+	entry_dest->ios_version	= entry_src->ios_version;
+	entry_dest->ticket	= entry_src->ticket;
+	entry_dest->tmd		= entry_src->tmd;
+
+	// Copy the disc header.
+	memcpy(&entry_dest->discHeader, &entry_src->discHeader, sizeof(entry_dest->discHeader));
+
+	// Timestamp.
+	if (entry_src->timestamp >= 0) {
+		entry_dest->timestamp = entry_src->timestamp;
+	} else {
+		entry_dest->timestamp = time(nullptr);
+	}
+
+	if (callback) {
+		// Initialize the callback state.
+		state.rvth = rvth_dest;
+		state.rvth_gcm = this;
+		state.bank_rvth = bank_dest;
+		state.bank_gcm = bank_src;
+		state.type = RVTH_PROGRESS_IMPORT;
+		state.lba_processed = 0;
+		state.lba_total = lba_copy_len;
+		state.digests = nullptr;
+	}
+
+	// TODO: Special indicator.
+	// TODO: Optimize seeking? (Reader::write() seeks every time.)
+
+	// Chunks that are entirely unallocated in the source image,
+	// e.g. unallocated CISO/WBFS blocks or holes in a sparse file,
+	// are known to be empty, so they don't need to be read or scanned.
+	vector<bool> used;
+	vector<uint8_t> emptyMap;
+	if (entry_src->reader->getEmptyMap(0, lba_count_buf, lba_buf_max / lba_count_buf, emptyMap) != 0) {
+		used.resize(emptyMap.size());
+		for (size_t i = 0; i < used.size(); i++) {
+			used[i] = !emptyMap[i];
+		}
+	}
+
+	if (!diff && !digest && !journal && !readback && !(flags & RVTH_IMPORT_SKIP_EMPTY)) {
+		// If both images are plain, let the OS copy the image.
+		// The blocks are shared if the file system supports it.
+		// Sparse destinations are only cloned, since copying
+		// would allocate the empty blocks.
+		const RefFile::CopyMode mode = (sparse ? RefFile::CopyMode::Clone : RefFile::CopyMode::Any);
+		bool first = true;
+		for (lba_count = 0; lba_count < lba_copy_len; lba_count += OS_COPY_LBA) {
+			if (callback && throttle.ready(LBA_TO_BYTES(static_cast<uint64_t>(lba_count)))) {
+				bool bRet;
+				state.lba_processed = lba_count;
+				rate.update(&state);
+				bRet = callback(&state, userdata);
+				if (!bRet) {
+					// Stop processing.
+					errno = ECANCELED;
+					return -ECANCELED;
+				}
+			}
+
+			const uint32_t lba_cur = std::min(OS_COPY_LBA, lba_copy_len - lba_count);
+			ret = copyRangeOS(entry_dest->reader, entry_src->reader, lba_count, lba_cur,
+				mode, buf.get(), lba_count_buf, first);
+			if (ret == -ENOTSUP && first) {
+				// Not supported. Copy the image using the buffer.
+				ret = 0;
+				break;
+			} else if (ret != 0) {
+				errno = -ret;
+				return ret;
+			}
+			first = false;
+			entry_dest->reader->flush();
+		}
+		if (!first) {
+			goto copied;
+		}
+	}
+
+	{
+		// Read ahead from the source while the current chunk
+		// is being written to the destination.
+		// The chunk map starts at the resume point.
+		if (!used.empty() && lba_resume > 0) {
+			used.erase(used.begin(), used.begin() + std::min<size_t>(lba_resume / lba_count_buf, used.size()));
+		}
+		ReadAheadQueue raq(entry_src->reader, lba_resume, lba_buf_max - lba_resume, lba_count_buf, cp.buf_count,
+			(used.empty() ? nullptr : &used), cp.alignment);
+		if (!raq.isOpen()) {
+			// Error allocating memory.
+			errno = ENOMEM;
+			return -ENOMEM;
+		}
+
+		for (lba_count = lba_resume; lba_count < lba_buf_max; lba_count += lba_count_buf) {
+			if (callback && throttle.ready(LBA_TO_BYTES(static_cast<uint64_t>(lba_count)))) {
+				bool bRet;
+				state.lba_processed = lba_count;
+				rate.update(&state);
+				bRet = callback(&state, userdata);
+				if (!bRet) {
+					// Stop processing.
+					errno = ECANCELED;
+					return -ECANCELED;
+				}
+			}
+
+			// TODO: Restore the disc header here if necessary?
+			// GCMs being imported generally won't have the first
+			// 16 KB zeroed out...
+
+			const uint8_t *const rbuf = raq.next();
+			if (!rbuf) {
+				// Read error.
+				const int err = (errno != 0 ? errno : EIO);
+				errno = err;
+				return -err;
+			}
+			if (digest) {
+				digest->update(rbuf, cp.buf_size);
+			}
+			if (journal) {
+				journal->update(rbuf, cp.buf_size);
+			}
+			if (diff) {
+				// Differential import: Only write the blocks that changed.
+				if ((identical.empty() || !identical[lba_count / lba_count_buf]) &&
+				    writeDiff(entry_dest->reader, rbuf, dbuf.get(),
+						lba_count, lba_count_buf, BYTES_TO_LBA(DIFF_BLOCK_SIZE)) > 0)
+				{
+					rvth_dest->markBankWritten(bank_dest, lba_count, lba_count_buf);
+				}
+			} else if (!used.empty() && !used[(lba_count - lba_resume) / lba_count_buf]) {
+				// Chunk is known to be empty. (rbuf is zero-filled.)
+				if (sparse) {
+					if (entry_dest->reader->discard(lba_count, lba_count_buf) != 0) {
+						entry_dest->reader->write(rbuf, lba_count, lba_count_buf);
+					}
+				} else if (!(flags & RVTH_IMPORT_SKIP_EMPTY)) {
+					entry_dest->reader->write(rbuf, lba_count, lba_count_buf);
+				}
+			} else if (sparse) {
+				writeSparse(entry_dest->reader, rbuf, lba_count, lba_count_buf,
+					BYTES_TO_LBA(4096), hole_lba_min);
+			} else if (flags & RVTH_IMPORT_SKIP_EMPTY) {
+				writeSkipEmpty(entry_dest->reader, rbuf, lba_count, lba_count_buf,
+					BYTES_TO_LBA(4096), hole_lba_min);
+			} else {
+				entry_dest->reader->write(rbuf, lba_count, lba_count_buf);
+			}
+			if (readback) {
+				readback->written(rbuf, lba_count, lba_count_buf);
+			}
+			if (journal || readback) {
+				// The journal and read-back verification
+				// need the chunk to be on the media.
+				entry_dest->reader->sync();
+			} else {
+				entry_dest->reader->flush();
+			}
+			if (journal && journal->isDirty()) {
+				// Record the completed segments.
+				// Errors are ignored; the import can still finish.
+				journal->save();
+			}
+			if (readback) {
+				readback->checkpoint(lba_count + lba_count_buf);
+				if (readback->failed()) {
+					// Don't keep writing to a bad destination.
+					goto copied;
+				}
+			}
+		}
+	}
+
+	// Process any remaining LBAs.
+	if (lba_count < lba_copy_len) {
+		const unsigned int lba_left = lba_copy_len - lba_count;
+		entry_src->reader->read(buf.get(), lba_count, lba_left);
+		if (digest) {
+			digest->update(buf.get(), static_cast<size_t>(LBA_TO_BYTES(lba_left)));
+		}
+		if (diff) {
+			if (writeDiff(entry_dest->reader, buf.get(), dbuf.get(),
+				lba_count, lba_left, BYTES_TO_LBA(DIFF_BLOCK_SIZE)) > 0)
+			{
+				rvth_dest->markBankWritten(bank_dest, lba_count, lba_left);
+			}
+		} else if (sparse) {
+			writeSparse(entry_dest->reader, buf.get(), lba_count, lba_left,
+				BYTES_TO_LBA(4096), hole_lba_min);
+		} else if (flags & RVTH_IMPORT_SKIP_EMPTY) {
+			writeSkipEmpty(entry_dest->reader, buf.get(), lba_count, lba_left,
+				BYTES_TO_LBA(4096), hole_lba_min);
+		} else {
+			entry_dest->reader->write(buf.get(), lba_count, lba_left);
+		}
+		if (readback) {
+			readback->written(buf.get(), lba_count, lba_left);
+		}
+		entry_dest->reader->sync();
+		if (readback) {
+			readback->checkpoint(lba_copy_len);
+		}
+	}
+
+copied:
+	if (readback) {
+		// Wait for the remaining chunks to be read back.
+		// The bank table entry isn't written if they don't match.
+		ret = readback->finish();
+		if (ret != 0) {
+			errno = (ret < 0 ? -ret : EIO);
+			return ret;
+		}
+	}
+
+	RvtH_Image_Digests digests;
+	if (digest) {
+		// Wait for the digests to finish.
+		digest->finish(&digests);
+		if (pDigests) {
+			*pDigests = digests;
+		}
+	}
+
+	if (callback) {
+		bool bRet;
+		state.lba_processed = lba_copy_len;
+		state.digests = (digest ? &digests : nullptr);
+		rate.update(&state);
+		bRet = callback(&state, userdata);
+		state.digests = nullptr;
+		if (!bRet) {
+			// Stop processing.
+			errno = ECANCELED;
+			return -ECANCELED;
+		}
+	}
+
+	// Flush the destination device.
+	entry_dest->reader->sync();
+
+	// Update the bank table.
+	// TODO: Check for errors.
+	rvth_dest->writeBankEntry(bank_dest);
+	if (journal) {
+		journal->remove();
+	}
+
+	// Finished importing the disc image.
+	return 0;
+}
+
+/**
+ * Import a disc image into this RVT-H disk image.
+ * Compatibility wrapper; this function creates an RvtH object for the
+ * RVT-H disk image and then copyToHDD().
+ * @param bank		[in] Bank number. (0-7)
+ * @param filename	[in] Source GCM filename.
+ * @param callback	[in,opt] Progress callback.
+ * @param userdata	[in,opt] User data for progress callback.
+ * @param ios_force	[in,opt] IOS version to force. (-1 to use the existing IOS)
+ * @param flags		[in,opt] Flags. (See RvtH_Import_Flags.)
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int RvtH::import(unsigned int bank, const TCHAR *filename,
+	RvtH_Progress_Callback callback, void *userdata,
+	int ios_force, unsigned int flags)
+{
+	StatsScope scope(m_stats);
+	if (!filename || filename[0] == 0) {
+		errno = EINVAL;
+		return -EINVAL;
+	} else if (bank >= m_bankCount) {
+		// Bank number is out of range.
+		errno = ERANGE;
+		return -ERANGE;
+	}
+
+	// Open the standalone disc image.
+	int ret = 0;
+	unique_ptr<RvtH> rvth_src(openImportSource(filename, false, &ret));
+	if (!rvth_src) {
+		// Error opening the standalone disc image.
+		return ret;
+	}
+
+	return importFrom_int(bank, rvth_src.get(), filename, callback, userdata, ios_force, flags);
+}
+
+/**
+ * Open a standalone disc image for importing.
+ * @param filename	[in] Source GCM filename.
+ * @param prefetch	[in] If true, initialize the bank entry and prefetch the start of the image.
+ * @param pErr		[out] Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ * @return RvtH object, or nullptr on error.
+ */
+RvtH *RvtH::openImportSource(const TCHAR *filename, bool prefetch, int *pErr)
+{
+	int ret = 0;
+	unique_ptr<RvtH> rvth_src(new RvtH(filename, &ret));
+	if (!rvth_src->isOpen()) {
+		// Error opening the standalone disc image.
+		if (ret == 0) {
+			ret = -EIO;
+		}
+		*pErr = ret;
+		return nullptr;
+	} else if (rvth_src->isHDD() || rvth_src->bankCount() > 1) {
+		// Not a standalone disc image.
+		errno = EINVAL;
+		*pErr = RVTH_ERROR_IS_HDD_IMAGE;
+		return nullptr;
+	} else if (rvth_src->bankCount() == 0) {
+		// Unrecognized file format.
+		// TODO: Distinguish between unrecognized and no banks.
+		errno = EINVAL;
+		*pErr = RVTH_ERROR_NO_BANKS;
+		return nullptr;
+	}
+
+	if (prefetch) {
+		// Initialize the bank entry now, since that reads the
+		// disc header, partition tables, tickets, and TMDs.
+		// Then ask the OS to start reading the image data.
+		rvth_src->getBankEntry(0);
+		rvth_src->m_file->prefetch(0, IMPORT_PREFETCH_SIZE);
+	}
+
+	*pErr = 0;
+	return rvth_src.release();
+}
+
+/**
+ * Does an imported Wii image have to be recrypted for use on the RVT-H?
+ * @param entry		[in] Bank entry.
+ * @param ios_force	[in] IOS version to force. (-1 to use the existing IOS)
+ * @return True if the image must be converted to debug realsigned.
+ */
+static bool needsRecrypt(const RvtH_BankEntry *entry, int ios_force)
+{
+	// One of the following conditions:
+	// - Encryption: Retail, Korean, or vWii
+	// - Signature: Invalid
+	// - IOS requested does not match the TMD IOS
+	return (entry->type == RVTH_BankType_Wii_SL ||
+		entry->type == RVTH_BankType_Wii_DL) &&
+	       (entry->crypto_type == RVL_CryptoType_Retail ||
+		entry->crypto_type == RVL_CryptoType_Korean ||
+		entry->crypto_type == RVL_CryptoType_vWii ||
+		entry->ticket.sig_status != RVL_SigStatus_OK ||
+		entry->tmd.sig_status != RVL_SigStatus_OK ||
+		(ios_force >= 3 && entry->ios_version != ios_force));
+}
+
+/**
+ * Check if a disc image can be imported into this RVT-H disk image.
+ * Nothing is written, and only the image's metadata is read.
+ * @param bank		[in] Bank number. (0-7)
+ * @param filename	[in] Source GCM filename.
+ * @param ios_force	[in,opt] IOS version to force. (-1 to use the existing IOS)
+ * @param flags		[in,opt] Flags. (See RvtH_Import_Flags.)
+ * @return 0 if the image can be imported; otherwise, the error import() would fail with.
+ *         (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int RvtH::checkImport(unsigned int bank, const TCHAR *filename,
+	int ios_force, unsigned int flags)
+{
+	StatsScope scope(m_stats);
+	if (!filename || filename[0] == 0) {
+		errno = EINVAL;
+		return -EINVAL;
+	} else if (bank >= m_bankCount) {
+		// Bank number is out of range.
+		errno = ERANGE;
+		return -ERANGE;
+	}
+
+	int ret = 0;
+	unique_ptr<RvtH> rvth_src(openImportSource(filename, false, &ret));
+	if (!rvth_src) {
+		// Error opening the standalone disc image.
+		return ret;
+	}
+	return checkImport_int(bank, rvth_src.get(), ios_force, flags);
+}
+
+/**
+ * Check if an opened standalone disc image can be imported into this RVT-H disk image.
+ * Nothing is written. Only the disc header, the partition table, and the
+ * image size from the reader's block map are used, so this is fast even
+ * for images that are on slow storage.
+ * @param bank		[in] Bank number. (0-7)
+ * @param rvth_src	[in] Source disc image, opened by openImportSource().
+ * @param ios_force	[in] IOS version to force. (-1 to use the existing IOS)
+ * @param flags		[in] Flags. (See RvtH_Import_Flags.)
+ * @return 0 if the image can be imported; otherwise, the error import() would fail with.
+ *         (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int RvtH::checkImport_int(unsigned int bank, RvtH *rvth_src, int ios_force, unsigned int flags)
+{
+	// Bank type, size, and destination checks.
+	int ret = rvth_src->checkCopyToHDD(this, bank, 0, flags);
+	if (ret != 0) {
+		return ret;
+	}
+
+	RvtH_BankEntry *const entry = rvth_src->getBankEntry(0);
+	if (!needsRecrypt(entry, ios_force)) {
+		// Copied as-is.
+		return 0;
+	}
+
+	// The image will be recrypted after it's copied.
+	// Check the conditions that recryptWiiPartitions() would fail on.
+	if (entry->crypto_type <= RVL_CryptoType_None) {
+		// Not encrypted. Cannot be converted to debug realsigned.
+		errno = EIO;
+		return RVTH_ERROR_IS_UNENCRYPTED;
+	}
+	ret = rvth_ptbl_load(entry);
+	if (ret != 0 || entry->pt_count == 0 || !entry->ptbl) {
+		// Unable to load the partition table.
+		if (ret == 0) {
+			ret = RVTH_ERROR_PARTITION_TABLE_CORRUPTED;
+		}
+		errno = (ret < 0 ? -ret : EIO);
+		return ret;
+	}
+	return 0;
+}
+
+/**
+ * Import an opened standalone disc image into this RVT-H disk image.
+ * @param bank		[in] Bank number. (0-7)
+ * @param rvth_src	[in] Source disc image, opened by openImportSource().
+ * @param filename	[in] Source GCM filename.
+ * @param callback	[in,opt] Progress callback.
+ * @param userdata	[in,opt] User data for progress callback.
+ * @param ios_force	[in] IOS version to force. (-1 to use the existing IOS)
+ * @param flags		[in] Flags. (See RvtH_Import_Flags.)
+ * @param pNeedsID	[out,opt] If specified, the identifier isn't written. Instead, this is set to true if it needs to be written.
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int RvtH::importFrom_int(unsigned int bank, RvtH *rvth_src, const TCHAR *filename,
+	RvtH_Progress_Callback callback, void *userdata,
+	int ios_force, unsigned int flags, bool *pNeedsID)
+{
+	if (pNeedsID) {
+		*pNeedsID = false;
+	}
+
+	// Make sure the image can be imported before anything is written.
+	int ret = checkImport_int(bank, rvth_src, ios_force, flags);
+	if (ret != 0) {
+		return ret;
+	}
+
+	// Copy the bank from the source GCM to the HDD.
+	// The copy and progress parameters were set on this object, so use them
+	// for the source object.
+	// TODO: HDD to HDD?
+	// NOTE: `bank` parameter starts at 0, not 1.
+	rvth_src->m_copyParams = m_copyParams;
+	rvth_src->m_progressParams = m_progressParams;
+	RvtH_Image_Digests digests;
+	ret = rvth_src->copyToHDD(this, bank, 0, flags, callback, userdata, &digests);
+	if (ret == 0 && (flags & RVTH_IMPORT_DIGESTS)) {
+		// Write the digests to a sidecar file next to the source image.
+		// Errors are ignored, since the digests were also
+		// reported in the final progress update.
+		ImageDigest::writeSidecar(filename, &digests);
+	}
+	if (ret == 0) {
+		// Must convert to debug realsigned for use on RVT-H.
+		const RvtH_BankEntry *const entry = this->bankEntry(bank);
+		if (entry && needsRecrypt(entry, ios_force)) {
+			// Convert to Debug.
+			ret = recryptWiiPartitions(bank, RVL_CryptoType_Debug, callback, userdata, ios_force);
+		}
+		else
+		{
+			// No recryption needed.
+			// Write the identifier to indicate that this bank was imported.
+			if (pNeedsID) {
+				*pNeedsID = true;
+			} else {
+				ret = recryptID(bank);
+			}
+		}
+	}
+	return ret;
+}
+
+/**
+ * Import multiple disc images into this RVT-H disk image.
+ *
+ * The jobs are run in order. While one image is being imported, the
+ * next image is opened and its data is prefetched in the background.
+ * The bank table is updated once, after all of the images have been
+ * imported. If a job fails, the remaining jobs are skipped, and the
+ * bank table entries for the images that were imported are written.
+ *
+ * @param jobs		[in,out] Import jobs.
+ * @param count		[in] Number of jobs.
+ * @param callback	[in,opt] Progress callback.
+ * @param userdata	[in,opt] User data for progress callback.
+ * @param ios_force	[in,opt] IOS version to force. (-1 to use the existing IOS)
+ * @param flags		[in,opt] Flags. (See RvtH_Import_Flags.)
+ * @return Error code of the first job that failed, or the bank table write.
+ *         (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int RvtH::importBanks(RvtH_Import_Job *jobs, unsigned int count,
+	RvtH_Progress_Callback callback, void *userdata,
+	int ios_force, unsigned int flags)
+{
+	StatsScope scope(m_stats);
+	if (!jobs || count == 0) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	// Validate the jobs.
+	for (unsigned int i = 0; i < count; i++) {
+		jobs[i].result = -ECANCELED;
+		if (!jobs[i].filename || jobs[i].filename[0] == 0) {
+			errno = EINVAL;
+			return -EINVAL;
+		} else if (jobs[i].bank >= m_bankCount) {
+			// Bank number is out of range.
+			errno = ERANGE;
+			return -ERANGE;
+		}
+		for (unsigned int j = 0; j < i; j++) {
+			if (jobs[j].bank == jobs[i].bank) {
+				// Same bank was specified twice.
+				errno = EINVAL;
+				return -EINVAL;
+			}
+		}
+	}
+
+	// Check all of the source images before anything is written.
+	// Only their metadata is read, so this is fast.
+	int ret = 0;
+	for (unsigned int i = 0; i < count; i++) {
+		unique_ptr<RvtH> rvth_src(openImportSource(jobs[i].filename, false, &ret));
+		if (rvth_src) {
+			ret = checkImport_int(jobs[i].bank, rvth_src.get(), ios_force, flags);
+		}
+		if (ret != 0) {
+			jobs[i].result = ret;
+			return ret;
+		}
+	}
+
+	// Stage the bank table updates so they're written at once.
+	// If the caller started a transaction, the updates are
+	// written when the caller commits it.
+	const bool own_txn = !m_txnActive;
+	if (own_txn) {
+		ret = beginBankTableTransaction();
+		if (ret != 0) {
+			return ret;
+		}
+	}
+
+	// Open the first source image.
+	int ret_src = 0;
+	unique_ptr<RvtH> rvth_src(openImportSource(jobs[0].filename, false, &ret_src));
+
+	// Banks that need the import identifier.
+	// The identifiers are written together after all of the images are imported.
+	vector<unsigned int> id_banks;
+	vector<unsigned int> id_jobs;
+
+	for (unsigned int i = 0; i < count; i++) {
+		// Open the next source image in the background.
+		unique_ptr<RvtH> rvth_next;
+		int ret_next = 0;
+		std::thread prefetch_thread;
+		if (i + 1 < count) {
+			const TCHAR *const next_filename = jobs[i+1].filename;
+			StatsCounters *const stats = m_stats;
+			prefetch_thread = std::thread([&rvth_next, &ret_next, next_filename, stats]() {
+				StatsScope scope(stats);
+				rvth_next.reset(openImportSource(next_filename, true, &ret_next));
+			});
+		}
+
+		if (rvth_src) {
+			bool needsID = false;
+			jobs[i].result = importFrom_int(jobs[i].bank, rvth_src.get(), jobs[i].filename,
+				callback, userdata, ios_force, flags, &needsID);
+			if (jobs[i].result == 0 && needsID) {
+				id_banks.push_back(jobs[i].bank);
+				id_jobs.push_back(i);
+			}
+		} else {
+			jobs[i].result = ret_src;
+		}
+		rvth_src.reset();
+
+		if (prefetch_thread.joinable()) {
+			prefetch_thread.join();
+		}
+		if (jobs[i].result != 0) {
+			// Skip the remaining jobs.
+			ret = jobs[i].result;
+			break;
+		}
+
+		rvth_src = std::move(rvth_next);
+		ret_src = ret_next;
+	}
+
+	if (!id_banks.empty()) {
+		// Write the identifiers.
+		vector<int> id_results(id_banks.size());
+		recryptIDBanks(id_banks.data(), static_cast<unsigned int>(id_banks.size()), id_results.data());
+		for (size_t i = 0; i < id_jobs.size(); i++) {
+			jobs[id_jobs[i]].result = id_results[i];
+			if (ret == 0) {
+				ret = id_results[i];
+			}
+		}
+	}
+
+	// Write the bank table entries for the images that were imported.
+	if (own_txn) {
+		const int ret_commit = commitBankTableTransaction();
+		if (ret == 0) {
+			ret = ret_commit;
+		}
+	}
+	return ret;
+}
+
+/**
+ * Serializes the progress callbacks of importBanksParallel().
+ */
+struct ParallelProgress {
+	RvtH_Progress_Callback callback;
+	void *userdata;
+	std::mutex mutex;
+	bool cancelled;
+
+	static bool callback_fn(const RvtH_Progress_State *state, void *userdata)
+	{
+		ParallelProgress *const pp = static_cast<ParallelProgress*>(userdata);
+		std::lock_guard<std::mutex> lock(pp->mutex);
+		if (!pp->cancelled && !pp->callback(state, pp->userdata)) {
+			// Cancel all of the jobs.
+			pp->cancelled = true;
+		}
+		return !pp->cancelled;
+	}
+};
+
+/**
+ * Import multiple disc images into this RVT-H disk image concurrently.
+ *
+ * Each job is run on its own worker thread, so this should only
+ * be used if the RVT-H disk image is on storage that handles
+ * concurrent writes well, e.g. an image file on an SSD. All of
+ * the source images are opened before any data is written.
+ *
+ * Jobs with the bank number set to RVTH_IMPORT_BANK_AUTO are
+ * assigned to the next free banks, in order. Dual-layer Wii
+ * images use two banks.
+ *
+ * The bank table is updated once, after all of the jobs have
+ * finished. If a job fails, the other jobs continue, and the
+ * bank table entries for the images that were imported are written.
+ *
+ * NOTE: Progress callbacks are serialized, but they're called
+ * from the worker threads. Check bank_rvth to see which job
+ * the update is for.
+ *
+ * @param jobs		[in,out] Import jobs.
+ * @param count		[in] Number of jobs.
+ * @param callback	[in,opt] Progress callback.
+ * @param userdata	[in,opt] User data for progress callback.
+ * @param ios_force	[in,opt] IOS version to force. (-1 to use the existing IOS)
+ * @param flags		[in,opt] Flags. (See RvtH_Import_Flags.)
+ * @return Error code of the first job that failed, or the bank table write.
+ *         (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int RvtH::importBanksParallel(RvtH_Import_Job *jobs, unsigned int count,
+	RvtH_Progress_Callback callback, void *userdata,
+	int ios_force, unsigned int flags)
+{
+	StatsScope scope(m_stats);
+	if (!jobs || count == 0) {
+		errno = EINVAL;
+		return -EINVAL;
+	} else if (!isHDD()) {
+		// Standalone disc image. No bank table.
+		errno = EINVAL;
+		return RVTH_ERROR_NOT_HDD_IMAGE;
+	} else if (m_txnActive) {
+		// The worker objects stage their own bank table entries,
+		// so this can't be part of the caller's transaction.
+		errno = EBUSY;
+		return -EBUSY;
+	}
+
+	// Validate the jobs.
+	vector<bool> bank_used(m_bankCount, false);
+	for (unsigned int i = 0; i < count; i++) {
+		jobs[i].result = -ECANCELED;
+		if (!jobs[i].filename || jobs[i].filename[0] == 0) {
+			errno = EINVAL;
+			return -EINVAL;
+		} else if (jobs[i].bank == RVTH_IMPORT_BANK_AUTO) {
+			continue;
+		} else if (jobs[i].bank >= m_bankCount) {
+			// Bank number is out of range.
+			errno = ERANGE;
+			return -ERANGE;
+		} else if (bank_used[jobs[i].bank]) {
+			// Same bank was specified twice.
+			errno = EINVAL;
+			return -EINVAL;
+		}
+		bank_used[jobs[i].bank] = true;
+	}
+
+	// Open all of the source images.
+	vector<unique_ptr<RvtH> > sources(count);
+	for (unsigned int i = 0; i < count; i++) {
+		int ret = 0;
+		sources[i].reset(openImportSource(jobs[i].filename, true, &ret));
+		if (!sources[i]) {
+			jobs[i].result = ret;
+			return ret;
+		}
+	}
+
+	// Assign the next free banks to the automatic jobs.
+	unsigned int next_bank = 0;
+	for (unsigned int i = 0; i < count; i++) {
+		if (jobs[i].bank != RVTH_IMPORT_BANK_AUTO) {
+			continue;
+		}
+
+		const unsigned int bank_count =
+			(sources[i]->bankEntry(0)->type == RVTH_BankType_Wii_DL ? 2 : 1);
+		for (; next_bank + bank_count <= m_bankCount; next_bank++) {
+			bool is_free = true;
+			for (unsigned int j = 0; j < bank_count && is_free; j++) {
+				const RvtH_BankEntry *const entry = bankEntry(next_bank + j);
+				is_free = !bank_used[next_bank + j] && entry &&
+					(entry->type == RVTH_BankType_Empty || entry->is_deleted);
+			}
+			if (is_free) {
+				break;
+			}
+		}
+		if (next_bank + bank_count > m_bankCount) {
+			// No free banks left.
+			jobs[i].result = -ENOSPC;
+			errno = ENOSPC;
+			return -ENOSPC;
+		}
+
+		jobs[i].bank = next_bank;
+		for (unsigned int j = 0; j < bank_count; j++) {
+			bank_used[next_bank + j] = true;
+		}
+		next_bank += bank_count;
+	}
+
+	// Check all of the jobs before anything is written.
+	int ret;
+	for (unsigned int i = 0; i < count; i++) {
+		ret = checkImport_int(jobs[i].bank, sources[i].get(), ios_force, flags);
+		if (ret != 0) {
+			jobs[i].result = ret;
+			return ret;
+		}
+	}
+
+	// Make the RVT-H object writable before the workers share the file.
+	ret = this->makeWritable();
+	if (ret != 0) {
+		return ret;
+	}
+
+	// Set the durability policy once. The workers write to the same
+	// file concurrently, so they must not change it. (See countIO().)
+	const unsigned int sync_interval = (m_copyParams.sync_interval != 0
+		? m_copyParams.sync_interval : SYNC_INTERVAL_DEFAULT);
+	m_file->setDurability(static_cast<RvtH_Durability>(m_copyParams.durability),
+		static_cast<uint64_t>(sync_interval) << 20);
+
+	// Each job imports into its own RvtH object for the same file,
+	// since importing changes the destination's bank entries.
+	// The workers stage their bank table entries, and the staged
+	// entries are written together after all of the jobs finish.
+	vector<unique_ptr<RvtH> > workers(count);
+	for (unsigned int i = 0; i < count; i++) {
+		workers[i].reset(new RvtH(m_file, &ret));
+		if (!workers[i]->isOpen()) {
+			if (ret == 0) {
+				ret = -EIO;
+			}
+			jobs[i].result = ret;
+			return ret;
+		}
+
+		// The caches are saved by this object.
+		RvtH *const worker = workers[i].get();
+		delete worker->m_bankCache;
+		worker->m_bankCache = nullptr;
+		delete worker->m_verifyCache;
+		worker->m_verifyCache = nullptr;
+		delete worker->m_verifyMap;
+		worker->m_verifyMap = nullptr;
+
+		worker->m_copyParams = m_copyParams;
+		worker->m_sharedDurability = true;
+		worker->m_progressParams = m_progressParams;
+		ret = worker->beginBankTableTransaction();
+		if (ret != 0) {
+			jobs[i].result = ret;
+			return ret;
+		}
+	}
+
+	ParallelProgress pp;
+	pp.callback = callback;
+	pp.userdata = userdata;
+	pp.cancelled = false;
+
+	std::atomic<unsigned int> next(0);
+	auto worker_fn = [&]() {
+		unsigned int i;
+		while ((i = next.fetch_add(1, std::memory_order_relaxed)) < count) {
+			RvtH *const worker = workers[i].get();
+			bool needsID = false;
+			jobs[i].result = worker->importFrom_int(jobs[i].bank, sources[i].get(), jobs[i].filename,
+				(callback ? ParallelProgress::callback_fn : nullptr), &pp,
+				ios_force, flags, &needsID);
+			if (jobs[i].result == 0 && needsID) {
+				jobs[i].result = worker->recryptID(jobs[i].bank);
+			}
+			sources[i].reset();
+		}
+	};
+
+	ThreadPool::instance().run(count, worker_fn);
+
+	// Stage the bank table entries of the jobs that succeeded.
+	ret = beginBankTableTransaction();
+	if (ret != 0) {
+		return ret;
+	}
+	int ret_jobs = 0;
+	for (unsigned int i = 0; i < count; i++) {
+		if (jobs[i].result != 0) {
+			if (ret_jobs == 0) {
+				ret_jobs = jobs[i].result;
+			}
+			continue;
+		}
+
+		const RvtH *const worker = workers[i].get();
+		for (unsigned int bank = 0; bank < m_bankCount; bank++) {
+			if (worker->m_txnDirty[bank]) {
+				m_txnEntries[bank] = worker->m_txnEntries[bank];
+				m_txnDirty[bank] = true;
+			}
+		}
+	}
+	workers.clear();
+
+	// This object's bank entries weren't changed by the workers,
+	// so reload the banks that were imported.
+	const vector<bool> changed = m_txnDirty;
+	ret = commitBankTableTransaction();
+	{
+		std::lock_guard<std::mutex> lock(m_bankInitMutex);
+		for (unsigned int bank = 0; bank < m_bankCount; bank++) {
+			// A dual-layer Wii image also changes the following bank.
+			if (changed[bank] || (bank > 0 && changed[bank-1])) {
+				reloadBankEntry_int(bank);
+			}
+		}
+	}
+	return (ret_jobs != 0 ? ret_jobs : ret);
+}
+
+/**
+ * Clone this RVT-H device or disk image to another RVT-H device or disk image.
+ *
+ * Every bank with a disc image is copied to the same bank number in
+ * the destination using copyToHDD(), so the source is read ahead while
+ * the destination is written. Empty and deleted banks aren't copied.
+ * The bank table is updated once, after all of the banks have been copied.
+ *
+ * When the banks have been copied, each one is compared with the
+ * source using compareBank(), which reads both units at the same time.
+ * Banks that don't match are deleted in the destination.
+ *
+ * Both units must have the same number of banks. Destination banks
+ * that receive a disc image must be empty or deleted, as must the
+ * destination banks that are empty or deleted in the source.
+ *
+ * @param rvth_dest	[in] Destination RvtH object.
+ * @param flags		[in,opt] Flags. (See RvtH_Import_Flags; only RVTH_IMPORT_SKIP_EMPTY is used.)
+ * @param callback	[in,opt] Progress callback. (RVTH_PROGRESS_IMPORT, then RVTH_PROGRESS_COMPARE)
+ * @param userdata	[in,opt] User data for progress callback.
+ * @return Error code of the first bank that failed, or the bank table write.
+ *         (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ *         RVTH_ERROR_READBACK_MISMATCH if a bank doesn't match the source.
+ */
+int RvtH::cloneHDD(RvtH *rvth_dest, unsigned int flags,
+	RvtH_Progress_Callback callback, void *userdata)
+{
+	StatsScope scope(m_stats);
+	if (!rvth_dest || rvth_dest == this) {
+		errno = EINVAL;
+		return -EINVAL;
+	} else if (!isHDD() || !rvth_dest->isHDD()) {
+		// Standalone disc image. No bank table.
+		errno = EINVAL;
+		return RVTH_ERROR_NOT_HDD_IMAGE;
+	} else if (rvth_dest->bankCount() != m_bankCount) {
+		// Bank tables have different sizes.
+		errno = EINVAL;
+		return RVTH_ERROR_INVALID_BANK_COUNT;
+	}
+	flags &= RVTH_IMPORT_SKIP_EMPTY;
+
+	// Find the banks to copy, and check them before anything is written.
+	// Only the bank entries are used, so this doesn't read any image data.
+	int ret = 0;
+	vector<unsigned int> banks;
+	for (unsigned int bank = 0; bank < m_bankCount; bank++) {
+		const RvtH_BankEntry *const entry = getBankEntry(bank);
+		if (entry->type == RVTH_BankType_Empty || entry->is_deleted) {
+			// Nothing to copy. The destination bank must not have a
+			// disc image, since it would be left in the clone.
+			const RvtH_BankEntry *const entry_dest = rvth_dest->getBankEntry(bank);
+			if (entry_dest->type != RVTH_BankType_Empty &&
+			    entry_dest->type != RVTH_BankType_Wii_DL_Bank2 &&
+			    !entry_dest->is_deleted)
+			{
+				errno = EEXIST;
+				return RVTH_ERROR_BANK_NOT_EMPTY_OR_DELETED;
+			}
+			continue;
+		} else if (entry->type == RVTH_BankType_Wii_DL_Bank2) {
+			// Copied with the first bank.
+			continue;
+		}
+
+		ret = checkCopyToHDD(rvth_dest, bank, bank, flags);
+		if (ret != 0) {
+			return ret;
+		}
+		banks.push_back(bank);
+	}
+
+	// Stage the bank table updates so they're written at once.
+	// If the caller started a transaction, the updates are
+	// written when the caller commits it.
+	const bool own_txn = !rvth_dest->m_txnActive;
+	if (own_txn) {
+		ret = rvth_dest->beginBankTableTransaction();
+		if (ret != 0) {
+			return ret;
+		}
+	}
+
+	// Copy the banks.
+	// If a bank fails, the remaining banks are skipped.
+	size_t copied = 0;
+	for (; copied < banks.size(); copied++) {
+		ret = copyToHDD(rvth_dest, banks[copied], banks[copied], flags, callback, userdata);
+		if (ret != 0) {
+			break;
+		}
+	}
+
+	// Compare the banks that were copied with the source.
+	if (ret == 0) {
+		for (size_t i = 0; i < copied; i++) {
+			vector<RvtH_Compare_Diff> diffs;
+			int ret_cmp = compareBank(banks[i], rvth_dest, banks[i], diffs, callback, userdata);
+			if (ret_cmp == 0 && !diffs.empty()) {
+				// Don't leave a bad copy in the bank table.
+				rvth_dest->deleteBank(banks[i]);
+				ret_cmp = RVTH_ERROR_READBACK_MISMATCH;
+			}
+			if (ret == 0) {
+				ret = ret_cmp;
+			}
+			if (ret_cmp == -ECANCELED) {
+				break;
+			}
+		}
+	}
+
+	// Write the bank table entries for the banks that were copied.
+	if (own_txn) {
+		const int ret_commit = rvth_dest->commitBankTableTransaction();
+		if (ret == 0) {
+			ret = ret_commit;
+		}
+	}
+	if (ret == RVTH_ERROR_READBACK_MISMATCH) {
+		errno = EIO;
+	}
+	return ret;
+}
+
+/**
+ * Reconstruct a full disc image from this archived disc image.
+ * This must be a standalone disc image that was extracted using
+ * RVTH_EXTRACT_STORE_UPDATES. The image is copied to the destination,
+ * and the stored partitions listed in its .prefs file are copied
+ * from the partition store.
+ * NOTE: SDK headers aren't copied to the destination.
+ * @param filename	[in] Destination filename.
+ * @param store_dir	[in] Partition store directory.
+ * @param callback	[in,opt] Progress callback.
+ * @param userdata	[in,opt] User data for progress callback.
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int RvtH::reconstruct(const TCHAR *filename, const TCHAR *store_dir,
+	RvtH_Progress_Callback callback, void *userdata)
+{
+	StatsScope scope(m_stats);
+	if (!filename || filename[0] == 0 || !store_dir || store_dir[0] == 0) {
+		errno = EINVAL;
+		return -EINVAL;
+	} else if (isHDD() || m_bankCount != 1) {
+		// Not a standalone disc image.
+		errno = EINVAL;
+		return RVTH_ERROR_IS_HDD_IMAGE;
+	}
+
+	// Load the partition references.
+	vector<PartitionRef> refs;
+	int ret = PartitionStore::loadRefs(
+		PartitionStore::refsFilenameForImage(m_file->filename()).c_str(), refs);
+	if (ret != 0) {
+		return ret;
+	}
+
+	// Make sure all of the referenced partitions are stored
+	// before creating the destination image.
+	RvtH_BankEntry *const entry = getBankEntry(0);
+	const PartitionStore store(store_dir);
+	for (const PartitionRef &ref : refs) {
+		if (ref.lba_start + ref.lba_len > entry->lba_len || !store.contains(ref)) {
+			errno = ENOENT;
+			return -ENOENT;
+		}
+	}
+
+	// Check that we have enough free disk space.
+	// NOTE: We're not checking for sparse sectors.
+	int64_t diskFreeSpace_lba = getDiskFreeSpace_lba(filename);
+	if (diskFreeSpace_lba < 0) {
+		// Error...
+		ret = static_cast<int>(diskFreeSpace_lba);
+		errno = -ret;
+		return ret;
+	} else if (diskFreeSpace_lba < entry->lba_len) {
+		// Not enough free disk space.
+		errno = ENOSPC;
+		return -ENOSPC;
+	}
+
+	unique_ptr<RvtH> rvth_dest(new RvtH(filename, entry->lba_len, &ret));
+	if (!rvth_dest->isOpen()) {
+		// Error creating the standalone disc image.
+		errno = EIO;
+		if (ret == 0) {
+			ret = -EIO;
+		}
+		return ret;
+	}
+	applyDurability(rvth_dest->m_entries[0].reader);
+
+	// Copy the archived image, then fill in the stored partitions.
+	// The omitted partitions are empty in the archived image,
+	// so they're sparse in the destination.
+	ret = copyToGcm(rvth_dest.get(), 0, 0, callback, userdata);
+	if (ret != 0) {
+		return ret;
+	}
+	Reader *const reader = rvth_dest->m_entries[0].reader;
+	for (const PartitionRef &ref : refs) {
+		ret = store.restore(ref, reader);
+		if (ret != 0) {
+			return ret;
+		}
+	}
+	reader->sync();
+	return 0;
 }
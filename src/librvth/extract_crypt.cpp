@@ -1,8 +1,8 @@
 /***************************************************************************
  * RVT-H Tool (librvth)                                                    *
- * extract_crypt.cpp: Extract and encrypt an unencrypted image.            *
+ * extract_crypt.cpp: Extract and encrypt or decrypt a Wii image.          *
  *                                                                         *
- * Copyright (c) 2018-2022 by David Korth.                                 *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
@@ -22,6 +22,8 @@
 #include "libwiicrypto/sig_tools.h"
 #include "libwiicrypto/wii_sector.h"
 #include "libwiicrypto/title_key.h"
+#include "libwiicrypto/wii_hash_tree.h"
+#include "libwiicrypto/wii_group_crypt.h"
 
 // C includes
 #include <stdlib.h>
@@ -31,6 +33,32 @@
 #include <cerrno>
 #include <cstring>
 
+// C++ includes
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+using std::unique_ptr;
+using std::vector;
+
+// Buffer pool
+#include "BufferPool.hpp"
+
+// Zeroed groups
+#include "EncryptedZeroGroup.hpp"
+
+// Progress callback throttling
+#include "ProgressRate.hpp"
+#include "ProgressThrottle.hpp"
+#include "StatsCounters.hpp"
+#include "ThreadPool.hpp"
+#include "Trace.hpp"
+#include "zero_scan.h"
+
 // Encryption
 #include "aesw.h"
 #include <nettle/sha1.h>
@@ -44,19 +72,20 @@
  * @param outSize	[in] Size of out_buf. (Must have 4,096 LBAs, or 2,097,152 bytes.)
  * @param pH3		[in] Output buffer for the H3 hash.
  * @param H3_size;	[in] Size of pH3. (Must be SHA1_DIGEST_SIZE bytes.)
+ * @param zero_group	[in,opt] Encrypted zeroed group for this title key.
  * @return 0 on success; negative POSIX error code on error.
  */
 static int rvth_encrypt_group(AesCtx *aesw, const uint8_t *pInBuf,
 	size_t inSize, uint8_t *pOutBuf, size_t outSize,
-	uint8_t *pH3, size_t H3_size)
+	uint8_t *pH3, size_t H3_size,
+	const EncryptedZeroGroup *zero_group)
 {
-	struct sha1_ctx sha1;
-	unsigned int i, j;
-	uint8_t iv[16];
+	RVTH_TRACE_SPAN_BYTES("encrypt_group", inSize);
+
+	unsigned int i;
 
 	// Disc sector pointers.
 	Wii_Disc_Sector_t *const sbuf = (Wii_Disc_Sector_t*)pOutBuf;
-	Wii_Disc_Sector_t *sbuf_tmp;
 
 	assert(aesw);
 	assert(pInBuf);
@@ -75,86 +104,424 @@ static int rvth_encrypt_group(AesCtx *aesw, const uint8_t *pInBuf,
 		return -EINVAL;
 	}
 
-	// Initialize the SHA-1 context.
-	sha1_init(&sha1);
+	bool is_zero = false;
+	if (zero_group) {
+		StatsTimer timer(StatsCounters::TIMER_ZERO_SCAN);
+		is_zero = rvth_is_zero(pInBuf, inSize);
+	}
+	if (is_zero) {
+		// Zeroed group. The hash tree and ciphertext
+		// are the same for every zeroed group.
+		zero_group->copyTo(sbuf);
+		memcpy(pH3, zero_group->H3(), SHA1_DIGEST_SIZE);
+		return 0;
+	}
 
-	// Copy the user data and calculate the H0 hashes.
-	for (i = 0; i < 64; i++, pInBuf += SECTOR_SIZE_DEC) {
-		// Copy user data.
-		uint8_t *pH0 = sbuf[i].hashes.H0[0];
-		uint8_t *pData = sbuf[i].data;
-		memcpy(pData, pInBuf, SECTOR_SIZE_DEC);
-
-		// Calculate the H0 hashes.
-		for (j = 0; j < 31; j++, pData += 1024, pH0 += SHA1_DIGEST_SIZE) {
-			sha1_update(&sha1, 1024, pData);
-			sha1_digest(&sha1, SHA1_DIGEST_SIZE, pH0);
+	// Copy the user data.
+	const Wii_Disc_Group_Dec_t *const gdec = reinterpret_cast<const Wii_Disc_Group_Dec_t*>(pInBuf);
+	for (i = 0; i < 64; i++) {
+		memcpy(sbuf[i].data, gdec->data[i], SECTOR_SIZE_DEC);
+	}
+
+	// Calculate the H0, H1, H2, and H3 hashes.
+	{
+		StatsTimer timer(StatsCounters::TIMER_SHA1);
+		wii_hash_tree_build_group(sbuf, pH3);
+	}
+
+	// Encrypt the hashes and user data.
+	StatsTimer timer(StatsCounters::TIMER_AES);
+	return wii_group_encrypt_in_place(aesw, reinterpret_cast<Wii_Disc_Group_t*>(pOutBuf), 1);
+}
+
+/**
+ * Decrypt a group of Wii sectors.
+ * The hashes are discarded, so the user data is in the unencrypted
+ * RVT-R layout. Zeroed groups, e.g. in scrubbed images, are left as
+ * zeroes instead of being decrypted.
+ * @param aesw AES context. (Key must be set to the decrypted title key.)
+ * @param pInBuf	[in] Input buffer.
+ * @param inSize	[in] Size of in_buf. (Must have 4,096 LBAs, or 2,097,152 bytes.)
+ * @param pOutBuf	[out] Output buffer.
+ * @param outSize	[in] Size of out_buf. (Must have 3,968 LBAs, or 2,031,616 bytes.)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int rvth_decrypt_group(AesCtx *aesw, const uint8_t *pInBuf,
+	size_t inSize, uint8_t *pOutBuf, size_t outSize)
+{
+	RVTH_TRACE_SPAN_BYTES("decrypt_group", inSize);
+
+	assert(aesw);
+	assert(pInBuf);
+	assert(inSize == GROUP_SIZE_ENC);
+	assert(pOutBuf);
+	assert(outSize == GROUP_SIZE_DEC);
+
+	if (!aesw || !pInBuf || inSize != GROUP_SIZE_ENC ||
+	    !pOutBuf || outSize != GROUP_SIZE_DEC)
+	{
+		// Invalid parameters.
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	bool is_zero;
+	{
+		StatsTimer timer(StatsCounters::TIMER_ZERO_SCAN);
+		is_zero = rvth_is_zero(pInBuf, inSize);
+	}
+	if (is_zero) {
+		memset(pOutBuf, 0, outSize);
+		return 0;
+	}
+
+	// Decrypt the user data.
+	StatsTimer timer(StatsCounters::TIMER_AES);
+	return wii_group_decrypt(aesw, reinterpret_cast<const Wii_Disc_Group_t*>(pInBuf),
+		reinterpret_cast<Wii_Disc_Group_Dec_t*>(pOutBuf), 1);
+}
+
+// Group sizes, in LBAs.
+#define LBA_COUNT_DEC BYTES_TO_LBA(GROUP_SIZE_DEC)
+#define LBA_COUNT_ENC BYTES_TO_LBA(GROUP_SIZE_ENC)
+
+// Maximum number of encryption worker threads.
+#define CRYPT_MAX_THREADS 16
+
+/**
+ * Read a group.
+ * If fewer than lba_group LBAs are available, the group is padded with zeroes.
+ * @param reader	[in] Reader
+ * @param lba_start	[in] Starting LBA
+ * @param lba_len	[in] Number of LBAs available
+ * @param buf		[out] Group buffer (must be lba_group LBAs)
+ * @param lba_group	[in] Group size, in LBAs (LBA_COUNT_DEC or LBA_COUNT_ENC)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int read_group(Reader *reader, uint32_t lba_start, uint32_t lba_len,
+	uint8_t *buf, uint32_t lba_group)
+{
+	const uint32_t lba_read = std::min<uint32_t>(lba_len, lba_group);
+
+	errno = 0;
+	if (reader->read(buf, lba_start, lba_read) != lba_read) {
+		// Read error.
+		int ret = -errno;
+		if (ret == 0) {
+			ret = -EIO;
 		}
+		return ret;
+	}
 
-		// Zero out the post-H0 padding.
-		memset(sbuf[i].hashes.pad_H0, 0, sizeof(sbuf[i].hashes.pad_H0));
+	if (lba_read < lba_group) {
+		// Pad the group.
+		memset(&buf[LBA_TO_BYTES(lba_read)], 0, LBA_TO_BYTES(lba_group - lba_read));
 	}
+	return 0;
+}
 
-	// Calculate the H1 hashes for each subgroup of 8 sectors.
-	for (i = 0; i < 64; i += 8) {
-		// First sector in the subgroup.
-		Wii_Disc_Sector_t *const sbuf0 = &sbuf[i];
-		uint8_t *pH1 = sbuf0->hashes.H1[0];
+/**
+ * Group encryption and decryption pipeline.
+ *
+ * A reader thread reads groups into a bounded set of slots, and worker
+ * threads encrypt or decrypt the groups out of order. When encrypting,
+ * each group's H3 hash is stored directly in the H3 table at the
+ * group's index. The calling thread writes the output groups in group
+ * order, so progress callbacks are always invoked from the calling thread.
+ */
+class CryptGroupPipeline {
+	public:
+		enum class Mode {
+			Encrypt,	// Unencrypted groups -> encrypted groups
+			Decrypt,	// Encrypted groups -> unencrypted groups
+		};
+
+		/**
+		 * Output group handler.
+		 * Called from the calling thread in group order.
+		 * @param g		[in] Group index
+		 * @param buf_out	[in] Output group (GROUP_SIZE_ENC bytes if encrypting; GROUP_SIZE_DEC if decrypting)
+		 * @return 0 to continue; negative POSIX error code to stop.
+		 */
+		typedef std::function<int(unsigned int g, const uint8_t *buf_out)> WriteFn;
+
+		/**
+		 * Create a group encryption or decryption pipeline.
+		 * @param threads	[in] Number of worker threads (must be >= 2)
+		 * @param mode		[in] Encrypt or decrypt
+		 */
+		explicit CryptGroupPipeline(unsigned int threads, Mode mode = Mode::Encrypt)
+			: m_threads(threads)
+			, m_mode(mode)
+			, m_slots(threads * 2)
+		{
+			for (GroupSlot &slot : m_slots) {
+				slot.buf_dec.reset(GROUP_SIZE_DEC);
+				slot.buf_enc.reset(GROUP_SIZE_ENC);
+			}
+		}
 
-		// Hash the H0 tables and store the results
-		// in the first sector's H1 table.
-		for (j = i; j < i+8; j++, pH1 += SHA1_DIGEST_SIZE) {
-			sha1_update(&sha1, sizeof(sbuf[j].hashes.H0), sbuf[j].hashes.H0[0]);
-			sha1_digest(&sha1, SHA1_DIGEST_SIZE, pH1);
+	private:
+		DISABLE_COPY(CryptGroupPipeline)
+
+	public:
+		/**
+		 * Encrypt or decrypt all groups in a partition.
+		 * @param reader	[in] Source reader
+		 * @param lba_start	[in] Starting LBA of the source data
+		 * @param lba_len	[in] Length of the source data, in LBAs
+		 * @param title_key	[in] Decrypted title key
+		 * @param zero_group	[in,opt] Encrypted zeroed group for this title key (encrypting only)
+		 * @param H3_tbl	[out] H3 table (encrypting only; must be nullptr if decrypting)
+		 * @param write_fn	[in] Output group handler
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int run(Reader *reader, uint32_t lba_start, uint32_t lba_len,
+			const uint8_t title_key[16], const EncryptedZeroGroup *zero_group,
+			Wii_Disc_H3_t *H3_tbl, const WriteFn &write_fn);
+
+	private:
+		// Group slot status.
+		enum class SlotStatus {
+			Free,		// Available for reading
+			Reading,	// Reader thread is reading the group
+			Ready,		// Group has been read; waiting for a worker
+			Busy,		// Worker is encrypting or decrypting the group
+			Done,		// Output group is available
+		};
+
+		struct GroupSlot {
+			PoolBuffer buf_dec;			// Unencrypted group
+			PoolBuffer buf_enc;			// Encrypted group
+			unsigned int g = ~0U;			// Group index
+			int err = 0;				// Read or crypto error
+			SlotStatus status = SlotStatus::Free;
+		};
+
+		unsigned int m_threads;
+		Mode m_mode;
+		vector<GroupSlot> m_slots;
+
+		// Shared state. Protected by m_mutex.
+		std::mutex m_mutex;
+		std::condition_variable m_cond;
+		std::deque<unsigned int> m_ready;	// Slot indexes ready for a worker
+		bool m_readDone = false;
+		bool m_abort = false;
+};
+
+/**
+ * Encrypt or decrypt all groups in a partition.
+ * @param reader	[in] Source reader
+ * @param lba_start	[in] Starting LBA of the source data
+ * @param lba_len	[in] Length of the source data, in LBAs
+ * @param title_key	[in] Decrypted title key
+ * @param zero_group	[in,opt] Encrypted zeroed group for this title key (encrypting only)
+ * @param H3_tbl	[out] H3 table (encrypting only; must be nullptr if decrypting)
+ * @param write_fn	[in] Output group handler
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int CryptGroupPipeline::run(Reader *reader, uint32_t lba_start, uint32_t lba_len,
+	const uint8_t title_key[16], const EncryptedZeroGroup *zero_group,
+	Wii_Disc_H3_t *H3_tbl, const WriteFn &write_fn)
+{
+	// Initialize the AES contexts. (one per worker)
+	vector<AesCtx*> aesw_ctxs;
+	aesw_ctxs.reserve(m_threads);
+	for (unsigned int i = 0; i < m_threads; i++) {
+		errno = 0;
+		AesCtx *const aesw = aesw_new();
+		if (!aesw) {
+			int ret = -errno;
+			if (ret == 0) {
+				ret = -ENOMEM;
+			}
+			for (AesCtx *p : aesw_ctxs) {
+				aesw_free(p);
+			}
+			return ret;
 		}
-		memset(sbuf0->hashes.pad_H1, 0, sizeof(sbuf0->hashes.pad_H1));
+		aesw_set_key(aesw, title_key, 16);
+		aesw_ctxs.push_back(aesw);
+	}
 
-		// Copy the H1 hashes to each sector in the subgroup.
-		for (j = i+1; j < i+8; j++) {
-			memcpy(sbuf[j].hashes.H1, sbuf0->hashes.H1, sizeof(sbuf[j].hashes.H1));
-			memset(sbuf[j].hashes.pad_H1, 0, sizeof(sbuf[j].hashes.pad_H1));
+	// Reset the shared state.
+	for (GroupSlot &slot : m_slots) {
+		slot.g = ~0U;
+		slot.status = SlotStatus::Free;
+	}
+	m_ready.clear();
+	m_readDone = false;
+	m_abort = false;
+
+	const bool decrypt = (m_mode == Mode::Decrypt);
+	const uint32_t lba_group = (decrypt ? LBA_COUNT_ENC : LBA_COUNT_DEC);
+	const unsigned int slot_count = static_cast<unsigned int>(m_slots.size());
+	const unsigned int group_count = (lba_len + lba_group - 1) / lba_group;
+
+	// Reader thread: Read groups into free slots.
+	// The threads count I/O and crypto time for this thread's operation.
+	StatsCounters *const stats = StatsCounters::current();
+
+	std::thread reader_thread([&]() {
+		StatsScope scope(stats);
+		uint32_t lba = 0;
+		for (unsigned int g = 0; g < group_count; g++, lba += lba_group) {
+			const unsigned int idx = g % slot_count;
+			GroupSlot &slot = m_slots[idx];
+
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_cond.wait(lock, [&]() { return m_abort || slot.status == SlotStatus::Free; });
+			if (m_abort)
+				break;
+			slot.status = SlotStatus::Reading;
+			lock.unlock();
+
+			uint8_t *const buf_in = (decrypt ? slot.buf_enc.get() : slot.buf_dec.get());
+			const int err = read_group(reader, lba_start + lba, lba_len - lba, buf_in, lba_group);
+
+			lock.lock();
+			slot.g = g;
+			slot.err = err;
+			if (err != 0) {
+				// Read error. The calling thread will
+				// handle it once it reaches this group.
+				slot.status = SlotStatus::Done;
+				m_cond.notify_all();
+				break;
+			}
+			slot.status = SlotStatus::Ready;
+			m_ready.push_back(idx);
+			m_cond.notify_all();
 		}
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_readDone = true;
+		m_cond.notify_all();
+	});
+
+	// Worker threads: Encrypt or decrypt groups as they become available.
+	vector<std::thread> workers;
+	workers.reserve(m_threads);
+	for (unsigned int i = 0; i < m_threads; i++) {
+		AesCtx *const aesw = aesw_ctxs[i];
+		workers.emplace_back([this, stats, aesw, decrypt, zero_group, H3_tbl]() {
+			StatsScope scope(stats);
+			std::unique_lock<std::mutex> lock(m_mutex);
+			while (true) {
+				m_cond.wait(lock, [this]() {
+					return m_abort || !m_ready.empty() || m_readDone;
+				});
+				if (m_abort || m_ready.empty())
+					break;
+
+				const unsigned int idx = m_ready.front();
+				m_ready.pop_front();
+				GroupSlot &slot = m_slots[idx];
+				slot.status = SlotStatus::Busy;
+				lock.unlock();
+
+				// Each group has its own H3 table entry,
+				// so no locking is needed here.
+				int err;
+				if (StatsCounters::cancelled()) {
+					err = -ECANCELED;
+				} else if (decrypt) {
+					err = rvth_decrypt_group(aesw,
+						slot.buf_enc.get(), GROUP_SIZE_ENC,
+						slot.buf_dec.get(), GROUP_SIZE_DEC);
+				} else {
+					err = rvth_encrypt_group(aesw,
+						slot.buf_dec.get(), GROUP_SIZE_DEC,
+						slot.buf_enc.get(), GROUP_SIZE_ENC,
+						H3_tbl->h3[slot.g], SHA1_DIGEST_SIZE, zero_group);
+				}
+
+				lock.lock();
+				slot.err = err;
+				slot.status = SlotStatus::Done;
+				m_cond.notify_all();
+			}
+		});
 	}
 
-	// Calculate the H2 hashes for the subgroups.
-	// NOTE: All sectors in this group have the same H2 hashes.
-	sbuf_tmp = sbuf;
-	for (i = 0; i < 8; i += 1, sbuf_tmp += 8) {
-		sha1_update(&sha1, sizeof(sbuf_tmp->hashes.H1), sbuf_tmp->hashes.H1[0]);
-		sha1_digest(&sha1, SHA1_DIGEST_SIZE, sbuf[0].hashes.H2[i]);
+	// Write the output groups in group order.
+	int ret = 0;
+	for (unsigned int g = 0; g < group_count; g++) {
+		GroupSlot &slot = m_slots[g % slot_count];
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cond.wait(lock, [&]() { return slot.status == SlotStatus::Done && slot.g == g; });
+		lock.unlock();
+
+		if (slot.err != 0) {
+			// Read or crypto error.
+			ret = slot.err;
+			break;
+		}
+		ret = write_fn(g, (decrypt ? slot.buf_dec.get() : slot.buf_enc.get()));
+		if (ret != 0) {
+			// Write error or cancellation.
+			break;
+		}
+
+		lock.lock();
+		slot.status = SlotStatus::Free;
+		m_cond.notify_all();
 	}
-	memset(sbuf[0].hashes.pad_H2, 0, sizeof(sbuf[0].hashes.pad_H2));
 
-	// Copy the H2 hashes to all sectors and encrypt the hashes.
-	sbuf_tmp = &sbuf[1];
-	memset(iv, 0, sizeof(iv));
-	for (i = 1; i < 64; i++, sbuf_tmp++) {
-		memcpy(sbuf_tmp->hashes.H2, sbuf[0].hashes.H2, sizeof(sbuf[0].hashes.H2));
-		memset(sbuf_tmp->hashes.pad_H2, 0, sizeof(sbuf_tmp->hashes.pad_H2));
+	// Shut down the threads.
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_abort = true;
+		m_cond.notify_all();
+	}
+	reader_thread.join();
+	for (std::thread &worker : workers) {
+		worker.join();
+	}
 
-		// TODO: Error checking.
-		aesw_set_iv(aesw, iv, sizeof(iv));
-		aesw_encrypt(aesw, (uint8_t*)&sbuf_tmp->hashes, sizeof(sbuf_tmp->hashes));
+	for (AesCtx *p : aesw_ctxs) {
+		aesw_free(p);
 	}
+	return ret;
+}
 
-	// Calculate the H3 hash.
-	sha1_update(&sha1, sizeof(sbuf[0].hashes.H2), sbuf[0].hashes.H2[0]);
-	sha1_digest(&sha1, SHA1_DIGEST_SIZE, pH3);
+/**
+ * Check if a bank can be encrypted or decrypted.
+ * @param entry	[in] Bank entry.
+ * @return 0 if it can; RvtH_Errors if it can't. (errno is set)
+ */
+static int checkCryptBank(const RvtH_BankEntry *entry)
+{
+	switch (entry->type) {
+		case RVTH_BankType_Wii_SL:
+		case RVTH_BankType_Wii_DL:
+			// Bank can be extracted.
+			return 0;
 
-	// Encrypt sector 0's hashes.
-	aesw_set_iv(aesw, iv, sizeof(iv));
-	aesw_encrypt(aesw, (uint8_t*)&sbuf[0].hashes, sizeof(sbuf[0].hashes));
+		case RVTH_BankType_GCN:
+			// No encryption for GameCube.
+			errno = EIO;
+			return RVTH_ERROR_NOT_WII_IMAGE;
 
-	// Encrypt the user data.
-	sbuf_tmp = sbuf;
-	for (i = 0; i < 64; i++, sbuf_tmp++) {
-		// User data IV is stored within the encrypted H2 table.
-		aesw_set_iv(aesw, &sbuf[i].hashes.H2[7][4], 16);
-		aesw_encrypt(aesw, sbuf_tmp->data, sizeof(sbuf_tmp->data));
-	}
+		case RVTH_BankType_Unknown:
+		default:
+			// Unknown bank status...
+			errno = EIO;
+			return RVTH_ERROR_BANK_UNKNOWN;
 
-	// We're done here?
-	return 0;
+		case RVTH_BankType_Empty:
+			// Bank is empty.
+			errno = ENOENT;
+			return RVTH_ERROR_BANK_EMPTY;
+
+		case RVTH_BankType_Wii_DL_Bank2:
+			// Second bank of a dual-layer Wii disc image.
+			// TODO: Automatically select the first bank?
+			errno = EIO;
+			return RVTH_ERROR_BANK_DL_2;
+	}
 }
 
 /**
@@ -164,42 +531,47 @@ static int rvth_encrypt_group(AesCtx *aesw, const uint8_t *pInBuf,
  * using the existing title key. It does *not* change the encryption
  * method or signature, so recryption will be needed afterwards.
  *
+ * Groups are encrypted by a pool of worker threads. The encrypted
+ * groups are written and the progress callback is invoked from the
+ * calling thread, in group order.
+ *
  * @param rvth_dest	[out] Destination RvtH object.
  * @param bank_src	[in] Source bank number. (0-7)
  * @param callback	[in,opt] Progress callback.
  * @param userdata	[in,opt] User data for progress callback.
+ * @param threads	[in,opt] Number of worker threads (0 for auto; 1 for single-threaded)
  * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
  */
 int RvtH::copyToGcm_doCrypt(RvtH *rvth_dest, unsigned int bank_src,
-	RvtH_Progress_Callback callback, void *userdata)
+	RvtH_Progress_Callback callback, void *userdata,
+	unsigned int threads)
 {
+	StatsScope scope(m_stats);
 	uint32_t data_lba_src;	// Game partition, data offset LBA. (source, unencrypted)
 	uint32_t data_lba_dest;	// Game partition, data offset LBA. (dest, encrypted)
 	uint32_t lba_copy_len;	// Number of LBAs to copy. (game partition size)
 
 	// Buffers.
 	RVL_PartitionHeader pthdr;
+	PoolBuffer pool_dec, pool_enc, pool_hdr;
 	uint8_t *buf_dec = NULL;
 	uint8_t *buf_enc = NULL;
 
 	// H3 table.
+	// The partition header and H3 table are contiguous on the disc,
+	// so they share a buffer and are written together.
 	Wii_Disc_H3_t *H3_tbl = NULL;	// H3 hash table.
-	uint8_t *pH3;			// Current H3 hash.
 	RVL_Content_Entry *content;
-	struct sha1_ctx sha1;
+	struct sha1_ctx sha1;		// H3 table hash, updated in group order
 
 	// Current LBA counters.
 	// Relative to the game partition.
 	uint32_t data_offset;	// Partition data offset.
-	uint32_t lba_count_dec;	// Decrypted (source)
-	uint32_t lba_count_enc;	// Encrypted (destination)
-
-	// Highest LBA that can be read from the source without
-	// padding the buffer.
-	uint32_t lba_max_dec;
+	unsigned int group_count;	// Number of groups to encrypt.
 
 	// Callback state.
 	RvtH_Progress_State state;
+	ProgressRate rate;
 
 	int ret = 0;	// errno or RvtH_Errors
 	int err = 0;	// errno setting
@@ -225,34 +597,10 @@ int RvtH::copyToGcm_doCrypt(RvtH *rvth_dest, unsigned int bank_src,
 	}
 
 	// Check if the source bank can be extracted.
-	RvtH_BankEntry *const entry_src = &m_entries[bank_src];
-	switch (entry_src->type) {
-		case RVTH_BankType_Wii_SL:
-		case RVTH_BankType_Wii_DL:
-			// Bank can be extracted.
-			break;
-
-		case RVTH_BankType_GCN:
-			// No encryption for GameCube.
-			errno = EIO;
-			return RVTH_ERROR_NOT_WII_IMAGE;
-
-		case RVTH_BankType_Unknown:
-		default:
-			// Unknown bank status...
-			errno = EIO;
-			return RVTH_ERROR_BANK_UNKNOWN;
-
-		case RVTH_BankType_Empty:
-			// Bank is empty.
-			errno = ENOENT;
-			return RVTH_ERROR_BANK_EMPTY;
-
-		case RVTH_BankType_Wii_DL_Bank2:
-			// Second bank of a dual-layer Wii disc image.
-			// TODO: Automatically select the first bank?
-			errno = EIO;
-			return RVTH_ERROR_BANK_DL_2;
+	RvtH_BankEntry *const entry_src = getBankEntry(bank_src);
+	ret = checkCryptBank(entry_src);
+	if (ret != 0) {
+		return ret;
 	}
 
 	// Find the game partition.
@@ -273,12 +621,14 @@ int RvtH::copyToGcm_doCrypt(RvtH *rvth_dest, unsigned int bank_src,
 	// isn't an update partition, fail.
 
 	// Process 64 sectors at a time.
-	// TODO: Use unique_ptr<>?
-	#define LBA_COUNT_DEC BYTES_TO_LBA(GROUP_SIZE_DEC)
-	#define LBA_COUNT_ENC BYTES_TO_LBA(GROUP_SIZE_ENC)
-	buf_dec = static_cast<uint8_t*>(malloc(GROUP_SIZE_DEC));
-	buf_enc = static_cast<uint8_t*>(malloc(GROUP_SIZE_ENC));
-	H3_tbl = static_cast<Wii_Disc_H3_t*>(calloc(1, sizeof(*H3_tbl)));	// zero initialized
+	pool_dec.reset(GROUP_SIZE_DEC);
+	pool_enc.reset(GROUP_SIZE_ENC);
+	pool_hdr.reset(sizeof(pthdr) + sizeof(*H3_tbl));
+	buf_dec = pool_dec.get();
+	buf_enc = pool_enc.get();
+	if (pool_hdr) {
+		H3_tbl = reinterpret_cast<Wii_Disc_H3_t*>(pool_hdr.get() + sizeof(pthdr));
+	}
 	if (!buf_dec || !buf_enc || !H3_tbl) {
 		// Error allocating memory.
 		err = errno;
@@ -288,6 +638,7 @@ int RvtH::copyToGcm_doCrypt(RvtH *rvth_dest, unsigned int bank_src,
 		ret = -err;
 		goto end;
 	}
+	memset(H3_tbl, 0, sizeof(*H3_tbl));	// unused entries must be zero
 
 	// Initialize encryption.
 	aesw = aesw_new();
@@ -357,10 +708,18 @@ int RvtH::copyToGcm_doCrypt(RvtH *rvth_dest, unsigned int bank_src,
 	entry_src->reader->read(buf_dec, BYTES_TO_LBA(RVL_RegionSetting_ADDRESS), 1);
 	entry_dest->reader->write(buf_dec, BYTES_TO_LBA(RVL_RegionSetting_ADDRESS), 1);
 
-	// Read the partition header.
-	// This will be rewritten later, since we need to update the
-	// content SHA-1 in the TMD.
-	entry_src->reader->read(&pthdr, game_pte->lba_start, BYTES_TO_LBA(sizeof(pthdr)));
+	// Get the partition header.
+	// This is written after the last group, since we need to
+	// update the content SHA-1 in the TMD.
+	{
+		const RVL_PartitionHeader *const pthdr_src = rvth_ptbl_get_header(entry_src, game_pte);
+		if (!pthdr_src) {
+			err = (errno != 0 ? errno : EIO);
+			ret = -err;
+			goto end;
+		}
+		memcpy(&pthdr, pthdr_src, sizeof(pthdr));
+	}
 
 	// Data offset should be 0x8000 for unencrypted partitions.
 	data_offset = be32_to_cpu(pthdr.data_offset) << 2;
@@ -387,10 +746,11 @@ int RvtH::copyToGcm_doCrypt(RvtH *rvth_dest, unsigned int bank_src,
 		state.type = RVTH_PROGRESS_EXTRACT;
 		state.lba_processed = 0;
 		state.lba_total = lba_copy_len;
+		state.digests = nullptr;
 	}
 
 	// Decrypt the title key.
-	ret = decrypt_title_key(&pthdr.ticket, titleKey, &entry_dest->crypto_type);
+	ret = decryptTitleKey(&pthdr.ticket, titleKey, &entry_dest->crypto_type);
 	if (ret != 0) {
 		// Error decrypting the title key.
 		err = EIO;
@@ -398,62 +758,12 @@ int RvtH::copyToGcm_doCrypt(RvtH *rvth_dest, unsigned int bank_src,
 	}
 	aesw_set_key(aesw, titleKey, sizeof(titleKey));
 
-	// TODO: Optimize seeking? (Reader::write() seeks every time.)
-	lba_max_dec = lba_copy_len - (lba_copy_len % LBA_COUNT_DEC);
-	pH3 = H3_tbl->h3[0];
-	for (lba_count_dec = 0, lba_count_enc = 0;
-	     lba_count_dec < lba_max_dec;
-	     lba_count_dec += LBA_COUNT_DEC, lba_count_enc += LBA_COUNT_ENC, pH3 += SHA1_DIGEST_SIZE)
-	{
-		if (callback) {
-			bool bRet;
-			state.lba_processed = lba_count_dec;
-			bRet = callback(&state, userdata);
-			if (!bRet) {
-				// Stop processing.
-				err = ECANCELED;
-				ret = -ECANCELED;
-				goto end;
-			}
-		}
-
-		// TODO: Error handling.
-
-		// Read 64 decrypted sectors.
-		entry_src->reader->read(buf_dec, data_lba_src + lba_count_dec, LBA_COUNT_DEC);
-
-		// Encrypt the sectors. (64*31k -> 64*32k)
-		rvth_encrypt_group(aesw, buf_dec, GROUP_SIZE_DEC, buf_enc, GROUP_SIZE_ENC, pH3, SHA1_DIGEST_SIZE);
-
-		// Write 64 encrypted sectors.
-		entry_dest->reader->write(buf_enc, data_lba_dest + lba_count_enc, LBA_COUNT_ENC);
-	}
-
-	// If we have leftover, write a padded group.
-	if (lba_count_dec < lba_copy_len) {
-		const unsigned int lba_left = lba_copy_len - lba_count_dec;
-
-		if (callback) {
-			bool bRet;
-			state.lba_processed = lba_count_dec;
-			bRet = callback(&state, userdata);
-			if (!bRet) {
-				// Stop processing.
-				err = ECANCELED;
-				ret = -ECANCELED;
-				goto end;
-			}
-		}
-
-		// Read and pad the sectors.
-		entry_src->reader->read(buf_dec, data_lba_src + lba_count_dec, lba_left);
-		memset(&buf_dec[LBA_TO_BYTES(LBA_COUNT_DEC - lba_left)], 0, LBA_TO_BYTES(lba_left));
-
-		// Encrypt the sectors. (64*31k -> 64*32k)
-		rvth_encrypt_group(aesw, buf_dec, GROUP_SIZE_DEC, buf_enc, GROUP_SIZE_ENC, pH3, SHA1_DIGEST_SIZE);
-
-		// Write 64 encrypted sectors.
-		entry_dest->reader->write(buf_enc, data_lba_dest + lba_count_enc, LBA_COUNT_ENC);
+	// Make sure the H3 table has room for all of the groups.
+	group_count = (lba_copy_len + LBA_COUNT_DEC - 1) / LBA_COUNT_DEC;
+	if (group_count == 0 || group_count > ARRAY_SIZE(H3_tbl->h3)) {
+		err = EIO;
+		ret = RVTH_ERROR_PARTITION_TABLE_CORRUPTED;
+		goto end;
 	}
 
 	/** Update the partition header. **/
@@ -469,27 +779,129 @@ int RvtH::copyToGcm_doCrypt(RvtH *rvth_dest, unsigned int bank_src,
 	pthdr.data_size = cpu_to_be32(LBA_TO_BYTES(lba_copy_len) >> 2);
 	assert(pthdr.data_offset == cpu_to_be32(0x20000 >> 2));
 
-	// H3 SHA-1 in the TMD.
+	// H3 SHA-1 in the TMD. This is set after the last group.
 	// FIXME: Figure out the correct content size.
 	// - The Last Story, unencrypted: 4
 	// - The Last Story, RVT-R: 0x3F8000
 	content = (RVL_Content_Entry*)&pthdr.data[sizeof(RVL_TMD_Header)];
 	content->size = cpu_to_be64(0x3F8000);
 	sha1_init(&sha1);
-	sha1_update(&sha1, sizeof(*H3_tbl), (const uint8_t*)H3_tbl);
-	sha1_digest(&sha1, sizeof(content->sha1_hash), content->sha1_hash);
 
-	// Write the partition header and H3 table.
-	// TODO: Specific callback notice?
-	entry_dest->reader->write(&pthdr,
-		game_pte->lba_start, BYTES_TO_LBA(sizeof(pthdr)));
-	entry_dest->reader->write(H3_tbl,
-		game_pte->lba_start + BYTES_TO_LBA(sizeof(pthdr)),
-		BYTES_TO_LBA(sizeof(*H3_tbl)));
+	// Determine the number of worker threads.
+	if (threads == 0) {
+		threads = std::thread::hardware_concurrency();
+		if (threads == 0) {
+			threads = 1;
+		}
+	}
+	if (threads > CRYPT_MAX_THREADS) {
+		threads = CRYPT_MAX_THREADS;
+	}
+	// Each worker has two slots in the pipeline, with an
+	// unencrypted and an encrypted group buffer each.
+	threads = budgetThreads(threads, 2 * (GROUP_SIZE_DEC + GROUP_SIZE_ENC));
+
+	{
+		// Leave a share of the CPUs for other pipelines that are running.
+		ThreadPool::Reservation cpus(threads);
+		threads = cpus.count();
+
+		// Zeroed groups, e.g. in scrubbed images, all have the same
+		// ciphertext, so it only needs to be encrypted once.
+		unique_ptr<EncryptedZeroGroup> zero_group(new EncryptedZeroGroup(titleKey));
+		const EncryptedZeroGroup *const p_zero_group =
+			(zero_group->isValid() ? zero_group.get() : nullptr);
+
+		// Write an encrypted group to the destination.
+		// This is always called from this thread, in group order.
+		// TODO: Optimize seeking? (Reader::write() seeks every time.)
+		ProgressThrottle throttle(&m_progressParams);
+		auto write_group = [&](unsigned int g, const uint8_t *pEncBuf) -> int {
+			if (callback && throttle.ready(LBA_TO_BYTES(static_cast<uint64_t>(g) * LBA_COUNT_DEC))) {
+				state.lba_processed = g * LBA_COUNT_DEC;
+				rate.update(&state);
+				if (!callback(&state, userdata)) {
+					// Stop processing.
+					return -ECANCELED;
+				}
+			}
+
+			// Write 64 encrypted sectors.
+			errno = 0;
+			if (entry_dest->reader->write(pEncBuf, data_lba_dest + (g * LBA_COUNT_ENC), LBA_COUNT_ENC) != LBA_COUNT_ENC) {
+				// Write error.
+				int wret = -errno;
+				if (wret == 0) {
+					wret = -EIO;
+				}
+				return wret;
+			}
+
+			// Hash the H3 table as the groups are written.
+			sha1_update(&sha1, SHA1_DIGEST_SIZE, H3_tbl->h3[g]);
+			if (g + 1 < group_count) {
+				return 0;
+			}
+
+			// Last group. The rest of the H3 table is zero.
+			const size_t H3_used = static_cast<size_t>(group_count) * SHA1_DIGEST_SIZE;
+			sha1_update(&sha1, sizeof(*H3_tbl) - H3_used,
+				reinterpret_cast<const uint8_t*>(H3_tbl) + H3_used);
+			sha1_digest(&sha1, sizeof(content->sha1_hash), content->sha1_hash);
+
+			// Write the partition header and H3 table.
+			// TODO: Specific callback notice?
+			memcpy(pool_hdr.get(), &pthdr, sizeof(pthdr));
+			errno = 0;
+			const uint32_t lba_hdr = BYTES_TO_LBA(sizeof(pthdr) + sizeof(*H3_tbl));
+			if (entry_dest->reader->write(pool_hdr.get(), game_pte->lba_start, lba_hdr) != lba_hdr) {
+				// Write error.
+				int wret = -errno;
+				if (wret == 0) {
+					wret = -EIO;
+				}
+				return wret;
+			}
+			return 0;
+		};
+
+		if (threads > 1 && group_count > 1) {
+			// Multi-threaded encryption.
+			CryptGroupPipeline pipeline(threads);
+			ret = pipeline.run(entry_src->reader, data_lba_src, lba_copy_len,
+				titleKey, p_zero_group, H3_tbl, write_group);
+		} else {
+			// Single-threaded encryption.
+			for (unsigned int g = 0; g < group_count; g++) {
+				// Read 64 decrypted sectors.
+				// The last group is padded if necessary.
+				ret = read_group(entry_src->reader, data_lba_src + (g * LBA_COUNT_DEC),
+					lba_copy_len - (g * LBA_COUNT_DEC), buf_dec, LBA_COUNT_DEC);
+				if (ret != 0)
+					break;
+
+				// Encrypt the sectors. (64*31k -> 64*32k)
+				ret = rvth_encrypt_group(aesw, buf_dec, GROUP_SIZE_DEC,
+					buf_enc, GROUP_SIZE_ENC, H3_tbl->h3[g], SHA1_DIGEST_SIZE,
+					p_zero_group);
+				if (ret != 0)
+					break;
+
+				ret = write_group(g, buf_enc);
+				if (ret != 0)
+					break;
+			}
+		}
+		if (ret != 0) {
+			err = -ret;
+			goto end;
+		}
+	}
 
 	if (callback) {
 		bool bRet;
 		state.lba_processed = lba_copy_len;
+		rate.update(&state);
 		bRet = callback(&state, userdata);
 		if (!bRet) {
 			// Stop processing.
@@ -500,12 +912,340 @@ int RvtH::copyToGcm_doCrypt(RvtH *rvth_dest, unsigned int bank_src,
 	}
 
 	// Finished extracting the disc image.
-	entry_dest->reader->flush();
+	entry_dest->reader->sync();
+
+end:
+	aesw_free(aesw);
+	if (err != 0) {
+		errno = err;
+	}
+	return ret;
+}
+
+/**
+ * Copy a bank from this RVT-H HDD or standalone disc image to a writable standalone disc image.
+ *
+ * This function copies an encrypted Game Partition and decrypts it
+ * into the unencrypted RVT-R layout: The hash blocks are removed,
+ * and the disc header is marked as unencrypted. The ticket and TMD
+ * aren't changed, so the image can be encrypted again using
+ * copyToGcm_doCrypt().
+ *
+ * Groups are decrypted by a pool of worker threads. The unencrypted
+ * groups are written and the progress callback is invoked from the
+ * calling thread, in group order. The destination is written in
+ * increasing LBA order.
+ *
+ * @param rvth_dest	[out] Destination RvtH object.
+ * @param bank_src	[in] Source bank number. (0-7)
+ * @param callback	[in,opt] Progress callback.
+ * @param userdata	[in,opt] User data for progress callback.
+ * @param threads	[in,opt] Number of worker threads (0 for auto; 1 for single-threaded)
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int RvtH::copyToGcm_doDecrypt(RvtH *rvth_dest, unsigned int bank_src,
+	RvtH_Progress_Callback callback, void *userdata,
+	unsigned int threads)
+{
+	StatsScope scope(m_stats);
+	uint32_t data_lba_src;	// Game partition, data offset LBA. (source, encrypted)
+	uint32_t data_lba_dest;	// Game partition, data offset LBA. (dest, unencrypted)
+	uint32_t lba_enc_len;	// Length of the encrypted data, in LBAs.
+	uint32_t lba_dec_len;	// Length of the unencrypted data, in LBAs.
+	uint32_t data_offset;	// Partition data offset. (source)
+	unsigned int group_count;	// Number of groups to decrypt.
+
+	// Buffers.
+	PoolBuffer pool_enc, pool_dec, pool_hdr;
+	RVL_PartitionHeader *pthdr;
+
+	// Callback state.
+	RvtH_Progress_State state;
+	ProgressRate rate;
+
+	int ret = 0;	// errno or RvtH_Errors
+	int err = 0;	// errno setting
+
+	// Destination disc image.
+	RvtH_BankEntry *entry_dest;
+
+	// AES context.
+	AesCtx *aesw = NULL;
+	uint8_t titleKey[16];
+	uint8_t crypto_type;
+
+	if (!rvth_dest) {
+		errno = EINVAL;
+		return -EINVAL;
+	} else if (bank_src >= m_bankCount) {
+		errno = ERANGE;
+		return -ERANGE;
+	} else if (rvth_dest->isHDD() || rvth_dest->bankCount() != 1) {
+		// Destination is not a standalone disc image.
+		errno = EIO;
+		return RVTH_ERROR_IS_HDD_IMAGE;
+	}
+
+	// Check if the source bank can be extracted.
+	RvtH_BankEntry *const entry_src = getBankEntry(bank_src);
+	ret = checkCryptBank(entry_src);
+	if (ret != 0) {
+		return ret;
+	} else if (entry_src->crypto_type == RVL_CryptoType_None) {
+		// Already unencrypted.
+		errno = EIO;
+		return RVTH_ERROR_IS_UNENCRYPTED;
+	}
+
+	// Find the game partition.
+	// Other partitions, e.g. the update partition, aren't copied.
+	const pt_entry_t *const game_pte = rvth_ptbl_find_game(entry_src);
+	if (!game_pte) {
+		// Cannot find the game partition.
+		errno = EIO;
+		return RVTH_ERROR_NO_GAME_PARTITION;
+	}
+
+	pool_enc.reset(GROUP_SIZE_ENC);
+	pool_dec.reset(GROUP_SIZE_DEC);
+	pool_hdr.reset(sizeof(*pthdr));
+	if (!pool_enc || !pool_dec || !pool_hdr) {
+		// Error allocating memory.
+		err = (errno != 0 ? errno : ENOMEM);
+		errno = err;
+		return -err;
+	}
+	pthdr = reinterpret_cast<RVL_PartitionHeader*>(pool_hdr.get());
+
+	// Get the partition header.
+	{
+		const RVL_PartitionHeader *const pthdr_src = rvth_ptbl_get_header(entry_src, game_pte);
+		if (!pthdr_src) {
+			err = (errno != 0 ? errno : EIO);
+			errno = err;
+			return -err;
+		}
+		memcpy(pthdr, pthdr_src, sizeof(*pthdr));
+	}
+
+	// The partition data must start after the partition header.
+	// The data size isn't used, since images encrypted by
+	// copyToGcm_doCrypt() have the unencrypted data size.
+	data_offset = be32_to_cpu(pthdr->data_offset) << 2;
+	if (data_offset < sizeof(*pthdr) || (data_offset % LBA_SIZE) != 0 ||
+	    BYTES_TO_LBA(data_offset) >= game_pte->lba_len)
+	{
+		errno = EIO;
+		return RVTH_ERROR_PARTITION_HEADER_CORRUPTED;
+	}
+	data_lba_src = game_pte->lba_start + BYTES_TO_LBA(data_offset);
+	lba_enc_len = game_pte->lba_len - BYTES_TO_LBA(data_offset);
+
+	// Each 32 KB sector has 31 KB of user data.
+	lba_dec_len = ((lba_enc_len + BYTES_TO_LBA(SECTOR_SIZE_ENC) - 1) / BYTES_TO_LBA(SECTOR_SIZE_ENC))
+		* BYTES_TO_LBA(SECTOR_SIZE_DEC);
+	data_lba_dest = game_pte->lba_start + BYTES_TO_LBA(sizeof(*pthdr));
+	group_count = (lba_enc_len + LBA_COUNT_ENC - 1) / LBA_COUNT_ENC;
+	if (group_count == 0) {
+		errno = EIO;
+		return RVTH_ERROR_PARTITION_TABLE_CORRUPTED;
+	}
+
+	// Decrypt the title key.
+	ret = decryptTitleKey(&pthdr->ticket, titleKey, &crypto_type);
+	if (ret != 0) {
+		// Error decrypting the title key.
+		errno = EIO;
+		return ret;
+	}
+
+	// Initialize decryption.
+	aesw = aesw_new();
+	if (!aesw) {
+		err = (errno != 0 ? errno : EIO);
+		errno = err;
+		return -err;
+	}
+	aesw_set_key(aesw, titleKey, sizeof(titleKey));
+
+	// Copy the bank table information.
+	entry_dest = &rvth_dest->m_entries[0];
+	entry_dest->type	= entry_src->type;
+	entry_dest->region_code	= entry_src->region_code;
+	entry_dest->is_deleted	= false;
+	entry_dest->crypto_type	= RVL_CryptoType_None;
+	entry_dest->ios_version	= entry_src->ios_version;
+	entry_dest->ticket	= entry_src->ticket;
+	entry_dest->tmd		= entry_src->tmd;
+	memcpy(&entry_dest->discHeader, &entry_src->discHeader, sizeof(entry_dest->discHeader));
+	entry_dest->timestamp = (entry_src->timestamp >= 0 ? entry_src->timestamp : time(NULL));
+
+	// Everything up to the partition data is written first,
+	// so the destination is written in increasing LBA order.
+	// The disc header, partition table, and region information
+	// are in the first group's buffer.
+	{
+		uint8_t *const buf = pool_dec.get();
+		const uint32_t lba_region = BYTES_TO_LBA(RVL_RegionSetting_ADDRESS);
+		errno = 0;
+		if (entry_src->reader->read(buf, 0, 1) != 1) {
+			err = (errno != 0 ? errno : EIO);
+			ret = -err;
+			goto end;
+		}
+		buf[0x60] = 1;	// Hashes are disabled
+		buf[0x61] = 1;	// Disc is unencrypted
+
+		// Volume group and partition table with a single entry.
+		uint8_t *const pt_buf = &buf[LBA_TO_BYTES(BYTES_TO_LBA(RVL_VolumeGroupTable_ADDRESS))];
+		memset(pt_buf, 0, LBA_SIZE);
+		RVL_VolumeGroupTable *const vgtbl = (RVL_VolumeGroupTable*)pt_buf;
+		RVL_PartitionTableEntry *const pt = (RVL_PartitionTableEntry*)&pt_buf[sizeof(*vgtbl)];
+		vgtbl->vg[0].count = cpu_to_be32(1);
+		vgtbl->vg[0].addr = cpu_to_be32((uint32_t)((RVL_VolumeGroupTable_ADDRESS + sizeof(*vgtbl)) >> 2));
+		pt->addr = cpu_to_be32((uint32_t)(LBA_TO_BYTES(game_pte->lba_start) >> 2));
+		pt->type = cpu_to_be32(0);
+
+		uint8_t *const region_buf = &buf[LBA_TO_BYTES(lba_region)];
+		errno = 0;
+		if (entry_src->reader->read(region_buf, lba_region, 1) != 1) {
+			err = (errno != 0 ? errno : EIO);
+			ret = -err;
+			goto end;
+		}
+
+		errno = 0;
+		if (entry_dest->reader->write(buf, 0, 1) != 1 ||
+		    entry_dest->reader->write(pt_buf, BYTES_TO_LBA(RVL_VolumeGroupTable_ADDRESS), 1) != 1 ||
+		    entry_dest->reader->write(region_buf, lba_region, 1) != 1)
+		{
+			err = (errno != 0 ? errno : EIO);
+			ret = -err;
+			goto end;
+		}
+	}
+
+	/** Update the partition header. **/
+
+	// No H3 table in unencrypted images.
+	pthdr->h3_table_offset = 0;
+	// Data offset. (0x8000 unencrypted)
+	pthdr->data_offset = cpu_to_be32(static_cast<uint32_t>(sizeof(*pthdr) >> 2));
+	// Data size. (usually 0 in unencrypted images)
+	pthdr->data_size = 0;
+
+	errno = 0;
+	if (entry_dest->reader->write(pool_hdr.get(), game_pte->lba_start, BYTES_TO_LBA(sizeof(*pthdr)))
+	    != BYTES_TO_LBA(sizeof(*pthdr)))
+	{
+		err = (errno != 0 ? errno : EIO);
+		ret = -err;
+		goto end;
+	}
+
+	if (callback) {
+		// Initialize the callback state.
+		state.rvth = this;
+		state.rvth_gcm = rvth_dest;
+		state.bank_rvth = bank_src;
+		state.bank_gcm = 0;
+		state.type = RVTH_PROGRESS_EXTRACT;
+		state.lba_processed = 0;
+		state.lba_total = lba_dec_len;
+		state.digests = nullptr;
+	}
+
+	// Determine the number of worker threads.
+	if (threads == 0) {
+		threads = std::thread::hardware_concurrency();
+		if (threads == 0) {
+			threads = 1;
+		}
+	}
+	if (threads > CRYPT_MAX_THREADS) {
+		threads = CRYPT_MAX_THREADS;
+	}
+	threads = budgetThreads(threads, 2 * (GROUP_SIZE_DEC + GROUP_SIZE_ENC));
+
+	{
+		ThreadPool::Reservation cpus(threads);
+		threads = cpus.count();
+
+		// Write an unencrypted group to the destination.
+		// This is always called from this thread, in group order.
+		// The last group may be shorter than a full group.
+		ProgressThrottle throttle(&m_progressParams);
+		auto write_group = [&](unsigned int g, const uint8_t *pDecBuf) -> int {
+			const uint32_t lba_out = g * LBA_COUNT_DEC;
+			if (callback && throttle.ready(LBA_TO_BYTES(static_cast<uint64_t>(lba_out)))) {
+				state.lba_processed = lba_out;
+				rate.update(&state);
+				if (!callback(&state, userdata)) {
+					// Stop processing.
+					return -ECANCELED;
+				}
+			}
+
+			const uint32_t lba_count = std::min<uint32_t>(LBA_COUNT_DEC, lba_dec_len - lba_out);
+			errno = 0;
+			if (entry_dest->reader->write(pDecBuf, data_lba_dest + lba_out, lba_count) != lba_count) {
+				// Write error.
+				int wret = -errno;
+				if (wret == 0) {
+					wret = -EIO;
+				}
+				return wret;
+			}
+			return 0;
+		};
+
+		if (threads > 1 && group_count > 1) {
+			// Multi-threaded decryption.
+			CryptGroupPipeline pipeline(threads, CryptGroupPipeline::Mode::Decrypt);
+			ret = pipeline.run(entry_src->reader, data_lba_src, lba_enc_len,
+				titleKey, nullptr, nullptr, write_group);
+		} else {
+			// Single-threaded decryption.
+			for (unsigned int g = 0; g < group_count; g++) {
+				// Read 64 encrypted sectors.
+				// The last group is padded if necessary.
+				ret = read_group(entry_src->reader, data_lba_src + (g * LBA_COUNT_ENC),
+					lba_enc_len - (g * LBA_COUNT_ENC), pool_enc.get(), LBA_COUNT_ENC);
+				if (ret != 0)
+					break;
+
+				// Decrypt the sectors. (64*32k -> 64*31k)
+				ret = rvth_decrypt_group(aesw, pool_enc.get(), GROUP_SIZE_ENC,
+					pool_dec.get(), GROUP_SIZE_DEC);
+				if (ret != 0)
+					break;
+
+				ret = write_group(g, pool_dec.get());
+				if (ret != 0)
+					break;
+			}
+		}
+		if (ret != 0) {
+			err = -ret;
+			goto end;
+		}
+	}
+
+	if (callback) {
+		state.lba_processed = lba_dec_len;
+		rate.update(&state);
+		if (!callback(&state, userdata)) {
+			// Stop processing.
+			err = ECANCELED;
+			ret = -ECANCELED;
+			goto end;
+		}
+	}
+
+	// Finished extracting the disc image.
+	entry_dest->reader->sync();
 
 end:
-	free(buf_dec);
-	free(buf_enc);
-	free(H3_tbl);
 	aesw_free(aesw);
 	if (err != 0) {
 		errno = err;
@@ -0,0 +1,281 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * fst.cpp: Access the files in a bank's filesystem.                       *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "rvth.hpp"
+#include "ptbl.h"
+#include "rvth_error.h"
+#include "RefFile.hpp"
+#include "StatsCounters.hpp"
+#include "ProgressRate.hpp"
+#include "BankFileSystem.hpp"
+#include "PartitionDataReader.hpp"
+
+// For LBA_TO_BYTES()
+#include "nhcd_structs.h"
+
+// Reader class
+#include "reader/Reader.hpp"
+
+// libwiicrypto
+#include "libwiicrypto/wii_structs.h"
+
+#include "byteswap.h"
+
+// C includes (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+
+// C++ includes
+#include <memory>
+#include <vector>
+using std::unique_ptr;
+using std::vector;
+
+// Copy buffer size for extracting a file.
+static constexpr uint32_t FILE_BUF_SIZE = 1024U * 1024U;
+
+/**
+ * Open the filesystem of a bank.
+ * @param bank		[in] Bank number (0-7)
+ * @param pFs		[out] Bank filesystem (caller must delete it)
+ * @param cache_groups	[in,opt] Number of decrypted groups to cache (encrypted Wii banks only)
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int RvtH::openFileSystem(unsigned int bank, BankFileSystem **pFs, unsigned int cache_groups)
+{
+	int ret = openPartitionData(bank, pFs, cache_groups);
+	if (ret != 0) {
+		return ret;
+	}
+
+	unique_ptr<BankFileSystem> fs(*pFs);
+	*pFs = nullptr;
+	ret = fs->load();
+	if (ret != 0) {
+		return ret;
+	}
+	*pFs = fs.release();
+	return 0;
+}
+
+/**
+ * Open the user data of a bank for random access by partition offset.
+ * @param bank		[in] Bank number (0-7)
+ * @param pFs		[out] Bank filesystem, with the FST not loaded (caller must delete it)
+ * @param cache_groups	[in,opt] Number of decrypted groups to cache (encrypted Wii banks only)
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int RvtH::openPartitionData(unsigned int bank, BankFileSystem **pFs, unsigned int cache_groups)
+{
+	assert(pFs != nullptr);
+	*pFs = nullptr;
+	if (bank >= m_bankCount) {
+		errno = ERANGE;
+		return -ERANGE;
+	}
+
+	RvtH_BankEntry *const entry = getBankEntry(bank);
+	switch (entry->type) {
+		case RVTH_BankType_Empty:
+			return RVTH_ERROR_BANK_EMPTY;
+		case RVTH_BankType_Unknown:
+		default:
+			return RVTH_ERROR_BANK_UNKNOWN;
+		case RVTH_BankType_Wii_DL_Bank2:
+			return RVTH_ERROR_BANK_DL_2;
+
+		case RVTH_BankType_GCN:
+			// The user data starts at the beginning of the disc.
+			*pFs = new BankFileSystem(
+				new PartitionDataReader(entry->reader, nullptr, 0, entry->lba_len), nullptr, 0);
+			return 0;
+
+		case RVTH_BankType_Wii_SL:
+		case RVTH_BankType_Wii_DL:
+			break;
+	}
+
+	// Find the game partition.
+	int ret = rvth_ptbl_load(entry);
+	if (ret != 0) {
+		return ret;
+	}
+	const pt_entry_t *const game_pte = rvth_ptbl_find_game(entry);
+	if (!game_pte) {
+		return RVTH_ERROR_NO_GAME_PARTITION;
+	}
+
+	// Get the partition header.
+	errno = 0;
+	const RVL_PartitionHeader *const pt_hdr = rvth_ptbl_get_header(entry, game_pte);
+	if (!pt_hdr) {
+		// Read error.
+		ret = (errno != 0 ? -errno : -EIO);
+		return ret;
+	}
+
+	const uint64_t data_offset = static_cast<uint64_t>(be32_to_cpu(pt_hdr->data_offset)) << 2;
+	const uint64_t data_size = static_cast<uint64_t>(be32_to_cpu(pt_hdr->data_size)) << 2;
+	const uint32_t data_lba = game_pte->lba_start + BYTES_TO_LBA(data_offset);
+	if (data_offset == 0 || data_lba >= entry->lba_len) {
+		// Partition header is invalid.
+		return RVTH_ERROR_PARTITION_HEADER_CORRUPTED;
+	}
+	uint32_t data_lba_len = entry->lba_len - data_lba;
+	if (data_size != 0 && BYTES_TO_LBA(data_size) < data_lba_len) {
+		data_lba_len = BYTES_TO_LBA(data_size);
+	}
+
+	AesCtx *aesw = nullptr;
+	if (entry->crypto_type != RVL_CryptoType_None) {
+		// Decrypt the title key.
+		uint8_t title_key[16];
+		uint8_t crypto_type;
+		ret = decryptTitleKey(&pt_hdr->ticket, title_key, &crypto_type);
+		if (ret != 0) {
+			return ret;
+		}
+
+		errno = 0;
+		aesw = aesw_new();
+		if (!aesw) {
+			ret = (errno != 0 ? -errno : -ENOMEM);
+			return ret;
+		}
+		aesw_set_key(aesw, title_key, sizeof(title_key));
+	}
+
+	// Unencrypted Wii partitions store the user data without hash blocks.
+	// The AES context is keyed once here and reused for every read.
+	*pFs = new BankFileSystem(
+		new PartitionDataReader(entry->reader, aesw, data_lba, data_lba_len, cache_groups), aesw, 2);
+	return 0;
+}
+
+/**
+ * List the files in a bank's filesystem.
+ * @param bank	[in] Bank number (0-7)
+ * @param files	[out] Files
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int RvtH::listFiles(unsigned int bank, vector<RvtH_FST_File> &files)
+{
+	StatsScope scope(m_stats);
+	BankFileSystem *fs;
+	int ret = openFileSystem(bank, &fs);
+	if (ret != 0) {
+		return ret;
+	}
+	files = fs->files();
+	delete fs;
+	return 0;
+}
+
+/**
+ * Extract a single file from a bank's filesystem.
+ * @param bank		[in] Bank number (0-7)
+ * @param path		[in] Path, as listed by listFiles(). (A leading '/' is optional.)
+ * @param filename	[in] Destination filename. ("-" for stdout)
+ * @param callback	[in,opt] Progress callback.
+ * @param userdata	[in,opt] User data for progress callback.
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int RvtH::extractFile(unsigned int bank, const char *path, const TCHAR *filename,
+	RvtH_Progress_Callback callback, void *userdata)
+{
+	assert(path != nullptr);
+	assert(filename != nullptr);
+	if (!path || !filename || filename[0] == 0) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	StatsScope scope(m_stats);
+	BankFileSystem *fs;
+	int ret = openFileSystem(bank, &fs);
+	if (ret != 0) {
+		return ret;
+	}
+	unique_ptr<BankFileSystem> fs_ptr(fs);
+
+	// Find the file.
+	const RvtH_FST_File *const file = fs->find(path);
+	if (!file) {
+		errno = ENOENT;
+		return -ENOENT;
+	} else if (file->is_dir) {
+		errno = EISDIR;
+		return -EISDIR;
+	}
+
+	RefFile *const f_dest = new RefFile(filename, true);
+	if (!f_dest->isOpen()) {
+		ret = -f_dest->lastError();
+		f_dest->unref();
+		errno = -ret;
+		return ret;
+	}
+
+	// Progress is reported in LBAs of the file.
+	RvtH_Progress_State state;
+	ProgressRate rate;
+	if (callback) {
+		memset(&state, 0, sizeof(state));
+		state.rvth = this;
+		state.bank_rvth = bank;
+		state.bank_gcm = UINT_MAX;
+		state.type = RVTH_PROGRESS_EXTRACT;
+		state.lba_total = static_cast<uint32_t>((file->size + LBA_SIZE - 1) / LBA_SIZE);
+		rate.update(&state);
+		if (!callback(&state, userdata)) {
+			f_dest->unref();
+			errno = ECANCELED;
+			return -ECANCELED;
+		}
+	}
+
+	unique_ptr<uint8_t[]> buf(new uint8_t[FILE_BUF_SIZE]);
+	for (uint64_t pos = 0; pos < file->size; ) {
+		uint32_t size = FILE_BUF_SIZE;
+		if (size > file->size - pos) {
+			size = static_cast<uint32_t>(file->size - pos);
+		}
+		const int64_t size_read = fs->read(file, buf.get(), pos, size);
+		if (size_read != static_cast<int64_t>(size)) {
+			ret = (size_read < 0 ? static_cast<int>(size_read) : -EIO);
+			break;
+		}
+
+		errno = 0;
+		const size_t written = (f_dest->isStream()
+			? f_dest->write(buf.get(), size)
+			: f_dest->pwrite(buf.get(), size, static_cast<off64_t>(pos)));
+		if (written != size) {
+			ret = (errno != 0 ? -errno : -EIO);
+			break;
+		}
+		pos += size;
+
+		if (callback) {
+			state.lba_processed = static_cast<uint32_t>((pos + LBA_SIZE - 1) / LBA_SIZE);
+			rate.update(&state);
+			if (!callback(&state, userdata)) {
+				ret = -ECANCELED;
+				break;
+			}
+		}
+	}
+
+	f_dest->unref();
+	if (ret != 0) {
+		errno = -ret;
+	}
+	return ret;
+}
@@ -0,0 +1,241 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * junk_data.c: Junk data generator and detector.                          *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "junk_data.h"
+#include "junk_data_hw.h"
+#include "zero_scan_hw.h"
+#include "impl_select.h"
+
+#include "byteswap.h"
+
+#include <string.h>
+
+// Generator step implementation.
+typedef enum {
+	JUNK_FORWARD_IMPL_GENERIC	= 0,
+	JUNK_FORWARD_IMPL_SSE2		= 1,
+	JUNK_FORWARD_IMPL_AVX2		= 2,
+	JUNK_FORWARD_IMPL_NEON		= 3,
+} JunkForward_Impl_e;
+
+// Current generator step implementation. (-1 == not detected yet)
+IMPL_SELECT(junk_forward_impl);
+
+/**
+ * Advance the junk data generator buffer. (portable version)
+ * @param buf	[in,out] Generator buffer. (RVTH_JUNK_K words)
+ */
+static void rvth_junk_forward_generic(uint32_t *buf)
+{
+	unsigned int i;
+	for (i = 0; i < RVTH_JUNK_J; i++) {
+		buf[i] ^= buf[i + RVTH_JUNK_K - RVTH_JUNK_J];
+	}
+	for (; i < RVTH_JUNK_K; i++) {
+		buf[i] ^= buf[i - RVTH_JUNK_J];
+	}
+}
+
+/**
+ * Determine the fastest generator step implementation for this CPU.
+ * @return Generator step implementation. (See JunkForward_Impl_e.)
+ */
+static int junk_forward_detect_impl(void)
+{
+	// Preference order: AVX2, SSE2, NEON, generic.
+#if defined(HAVE_ZERO_SCAN_AVX2) && defined(HAVE_ZERO_SCAN_SSE2)
+	if (rvth_zero_scan_avx2_is_supported()) {
+		return JUNK_FORWARD_IMPL_AVX2;
+	} else if (rvth_zero_scan_sse2_is_supported()) {
+		return JUNK_FORWARD_IMPL_SSE2;
+	}
+#elif defined(HAVE_ZERO_SCAN_NEON)
+	return JUNK_FORWARD_IMPL_NEON;
+#endif
+	return JUNK_FORWARD_IMPL_GENERIC;
+}
+
+/**
+ * Advance the junk data generator buffer.
+ * The fastest implementation supported by the CPU is selected on the first call.
+ * @param buf	[in,out] Generator buffer. (RVTH_JUNK_K words)
+ */
+static void junk_forward(uint32_t *buf)
+{
+	switch (impl_select_get(&junk_forward_impl, junk_forward_detect_impl)) {
+#if defined(HAVE_ZERO_SCAN_AVX2) && defined(HAVE_ZERO_SCAN_SSE2)
+		case JUNK_FORWARD_IMPL_AVX2:
+			rvth_junk_forward_avx2(buf);
+			break;
+		case JUNK_FORWARD_IMPL_SSE2:
+			rvth_junk_forward_sse2(buf);
+			break;
+#elif defined(HAVE_ZERO_SCAN_NEON)
+		case JUNK_FORWARD_IMPL_NEON:
+			rvth_junk_forward_neon(buf);
+			break;
+#endif
+		default:
+			rvth_junk_forward_generic(buf);
+			break;
+	}
+}
+
+/**
+ * Undo junk_forward().
+ * @param buf	[in,out] Generator buffer. (RVTH_JUNK_K words)
+ */
+static void junk_backward(uint32_t *buf)
+{
+	unsigned int i;
+	for (i = RVTH_JUNK_K - 1; i >= RVTH_JUNK_J; i--) {
+		buf[i] ^= buf[i - RVTH_JUNK_J];
+	}
+	for (i = 0; i < RVTH_JUNK_J; i++) {
+		buf[i] ^= buf[i + RVTH_JUNK_K - RVTH_JUNK_J];
+	}
+}
+
+/**
+ * Initialize a junk data generator.
+ * @param gen	[out] Generator.
+ * @param seed	[in] Seed. (RVTH_JUNK_SEED_SIZE bytes, big-endian words)
+ */
+void rvth_junk_init(RvtH_JunkGen *gen, const uint8_t *seed)
+{
+	uint32_t *const buf = gen->buf;
+	unsigned int i;
+
+	for (i = 0; i < RVTH_JUNK_SEED_WORDS; i++) {
+		uint32_t x;
+		memcpy(&x, &seed[i * 4], sizeof(x));
+		buf[i] = be32_to_cpu(x);
+	}
+	for (; i < RVTH_JUNK_K; i++) {
+		buf[i] = (buf[i - 17] << 23) ^ (buf[i - 16] >> 9) ^ buf[i - 1];
+	}
+
+	// The output uses bits 16-23 of each word shifted by 2,
+	// and it's big-endian. Convert the buffer in place so
+	// the output bytes can be copied directly.
+	for (i = 0; i < RVTH_JUNK_K; i++) {
+		const uint32_t x = buf[i];
+		buf[i] = cpu_to_be32((x & 0xFF00FFFF) | ((x >> 2) & 0x00FF0000));
+	}
+	for (i = 0; i < 4; i++) {
+		junk_forward(buf);
+	}
+	gen->pos = 0;
+}
+
+/**
+ * Skip junk data.
+ * @param gen	[in,out] Generator.
+ * @param count	[in] Number of bytes to skip.
+ */
+void rvth_junk_skip(RvtH_JunkGen *gen, size_t count)
+{
+	gen->pos += count;
+	while (gen->pos >= sizeof(gen->buf)) {
+		junk_forward(gen->buf);
+		gen->pos -= sizeof(gen->buf);
+	}
+}
+
+/**
+ * Generate junk data.
+ *
+ * The generator step uses SSE2 or AVX2 on x86 and NEON on arm64,
+ * selected on the first call.
+ *
+ * @param gen	[in,out] Generator.
+ * @param out	[out] Output buffer.
+ * @param count	[in] Number of bytes to generate.
+ */
+void rvth_junk_generate(RvtH_JunkGen *gen, uint8_t *out, size_t count)
+{
+	while (count > 0) {
+		size_t len = sizeof(gen->buf) - gen->pos;
+		if (len > count) {
+			len = count;
+		}
+		memcpy(out, (const uint8_t*)gen->buf + gen->pos, len);
+		gen->pos += len;
+		out += len;
+		count -= len;
+		if (gen->pos == sizeof(gen->buf)) {
+			junk_forward(gen->buf);
+			gen->pos = 0;
+		}
+	}
+}
+
+/**
+ * Check if a buffer contains junk data from the start of a junk block.
+ *
+ * The seed is recovered from the first RVTH_JUNK_K words of the
+ * buffer, and the whole buffer is compared to the regenerated data,
+ * so the disc ID and offset aren't needed. Zero-filled buffers
+ * aren't considered to be junk data.
+ *
+ * @param buf	[in] Buffer. (usually a 32 KB block)
+ * @param size	[in] Size of buf, in bytes. (must be at least RVTH_JUNK_K * 4)
+ * @param seed	[out] Seed. (RVTH_JUNK_SEED_SIZE bytes; only valid if the buffer is junk data)
+ * @return Non-zero if the buffer is junk data; 0 if not.
+ */
+int rvth_junk_detect(const uint8_t *buf, size_t size, uint8_t *seed)
+{
+	RvtH_JunkGen gen;
+	uint32_t x, seed_or = 0;
+	size_t pos;
+	unsigned int i;
+
+	if (size < sizeof(gen.buf)) {
+		return 0;
+	}
+
+	// The first RVTH_JUNK_K words are the generator buffer
+	// after the initial steps. Undo the steps.
+	memcpy(gen.buf, buf, sizeof(gen.buf));
+	for (i = 0; i < 4; i++) {
+		junk_backward(gen.buf);
+	}
+	for (i = 0; i < RVTH_JUNK_SEED_WORDS + 16; i++) {
+		gen.buf[i] = be32_to_cpu(gen.buf[i]);
+	}
+
+	// Recover the seed. The output is missing bits 16-17 of each word,
+	// but they can be calculated from the following words, except for
+	// the first word, where they don't affect the output.
+	for (i = 0; i < RVTH_JUNK_SEED_WORDS; i++) {
+		x = (gen.buf[i] & 0xFF00FFFF) | ((gen.buf[i] << 2) & 0x00FC0000) |
+		    (((gen.buf[i + 16] ^ gen.buf[i + 15]) << 9) & 0x00030000);
+		seed_or |= x;
+		x = cpu_to_be32(x);
+		memcpy(&seed[i * 4], &x, sizeof(x));
+	}
+	if (seed_or == 0) {
+		// Zero seed. The buffer starts with zeroes.
+		return 0;
+	}
+
+	// Regenerate the data and compare it one generator buffer at a time.
+	rvth_junk_init(&gen, seed);
+	for (pos = 0; pos < size; ) {
+		size_t len = sizeof(gen.buf);
+		if (len > size - pos) {
+			len = size - pos;
+		}
+		if (memcmp(&buf[pos], gen.buf, len) != 0) {
+			return 0;
+		}
+		pos += len;
+		junk_forward(gen.buf);
+	}
+	return 1;
+}
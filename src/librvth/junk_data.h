@@ -0,0 +1,87 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * junk_data.h: Junk data generator and detector.                          *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// The disc mastering software fills unused areas of GameCube and Wii
+// discs with pseudo-random "junk" data from a lagged Fibonacci generator.
+// Junk data doesn't compress, but it restarts at every 32 KB block, and
+// each block can be regenerated from a 68-byte seed.
+
+#ifndef __RVTHTOOL_LIBRVTH_JUNK_DATA_H__
+#define __RVTHTOOL_LIBRVTH_JUNK_DATA_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Generator parameters.
+#define RVTH_JUNK_K		521	// Buffer size, in words
+#define RVTH_JUNK_J		32	// Lag
+#define RVTH_JUNK_SEED_WORDS	17
+#define RVTH_JUNK_SEED_SIZE	(RVTH_JUNK_SEED_WORDS * 4)
+
+// Junk data restarts at every block.
+#define RVTH_JUNK_BLOCK_SIZE	0x8000
+
+/**
+ * Junk data generator state.
+ * The buffer is stored in output byte order.
+ */
+typedef struct _RvtH_JunkGen {
+	uint32_t buf[RVTH_JUNK_K];
+	size_t pos;	// Byte position in buf
+} RvtH_JunkGen;
+
+/**
+ * Initialize a junk data generator.
+ * @param gen	[out] Generator.
+ * @param seed	[in] Seed. (RVTH_JUNK_SEED_SIZE bytes, big-endian words)
+ */
+void rvth_junk_init(RvtH_JunkGen *gen, const uint8_t *seed);
+
+/**
+ * Skip junk data.
+ * @param gen	[in,out] Generator.
+ * @param count	[in] Number of bytes to skip.
+ */
+void rvth_junk_skip(RvtH_JunkGen *gen, size_t count);
+
+/**
+ * Generate junk data.
+ *
+ * The generator step uses SSE2 or AVX2 on x86 and NEON on arm64,
+ * selected on the first call.
+ *
+ * @param gen	[in,out] Generator.
+ * @param out	[out] Output buffer.
+ * @param count	[in] Number of bytes to generate.
+ */
+void rvth_junk_generate(RvtH_JunkGen *gen, uint8_t *out, size_t count);
+
+/**
+ * Check if a buffer contains junk data from the start of a junk block.
+ *
+ * The seed is recovered from the first RVTH_JUNK_K words of the
+ * buffer, and the whole buffer is compared to the regenerated data,
+ * so the disc ID and offset aren't needed. Zero-filled buffers
+ * aren't considered to be junk data.
+ *
+ * @param buf	[in] Buffer. (usually a 32 KB block)
+ * @param size	[in] Size of buf, in bytes. (must be at least RVTH_JUNK_K * 4)
+ * @param seed	[out] Seed. (RVTH_JUNK_SEED_SIZE bytes; only valid if the buffer is junk data)
+ * @return Non-zero if the buffer is junk data; 0 if not.
+ */
+int rvth_junk_detect(const uint8_t *buf, size_t size, uint8_t *seed);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_LIBRVTH_JUNK_DATA_H__ */
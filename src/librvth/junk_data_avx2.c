@@ -0,0 +1,39 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * junk_data_avx2.c: Junk data generator step. (AVX2 version)              *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "junk_data_hw.h"
+
+// AVX2 intrinsics
+#include <immintrin.h>
+
+/**
+ * Advance the junk data generator buffer using AVX2.
+ * @param buf	[in,out] Generator buffer. (RVTH_JUNK_K words)
+ */
+void rvth_junk_forward_avx2(uint32_t *buf)
+{
+	unsigned int i;
+
+	// The first J words use the last J words, which haven't been updated yet.
+	for (i = 0; i < RVTH_JUNK_J; i += 8) {
+		__m256i *const p = (__m256i*)&buf[i];
+		_mm256_storeu_si256(p, _mm256_xor_si256(_mm256_loadu_si256(p),
+			_mm256_loadu_si256((const __m256i*)&buf[i + RVTH_JUNK_K - RVTH_JUNK_J])));
+	}
+
+	// The remaining words use the words J before them,
+	// so 8 words can be processed at a time.
+	for (; i + 8 <= RVTH_JUNK_K; i += 8) {
+		__m256i *const p = (__m256i*)&buf[i];
+		_mm256_storeu_si256(p, _mm256_xor_si256(_mm256_loadu_si256(p),
+			_mm256_loadu_si256((const __m256i*)&buf[i - RVTH_JUNK_J])));
+	}
+	for (; i < RVTH_JUNK_K; i++) {
+		buf[i] ^= buf[i - RVTH_JUNK_J];
+	}
+}
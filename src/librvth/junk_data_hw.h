@@ -0,0 +1,54 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * junk_data_hw.h: Junk data generator step. (SIMD backends)               *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// NOTE: Internal header. Only used by the junk data implementation.
+// The SIMD backends are built for the same CPUs as the zero scan
+// backends, so they use the HAVE_ZERO_SCAN_* macros and the zero
+// scan CPU checks. (See zero_scan_hw.h.)
+
+#ifndef __RVTHTOOL_LIBRVTH_JUNK_DATA_HW_H__
+#define __RVTHTOOL_LIBRVTH_JUNK_DATA_HW_H__
+
+#include "config.librvth.h"
+#include "junk_data.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef HAVE_ZERO_SCAN_SSE2
+/**
+ * Advance the junk data generator buffer using SSE2.
+ * @param buf	[in,out] Generator buffer. (RVTH_JUNK_K words)
+ */
+void rvth_junk_forward_sse2(uint32_t *buf);
+#endif /* HAVE_ZERO_SCAN_SSE2 */
+
+#ifdef HAVE_ZERO_SCAN_AVX2
+/**
+ * Advance the junk data generator buffer using AVX2.
+ * @param buf	[in,out] Generator buffer. (RVTH_JUNK_K words)
+ */
+void rvth_junk_forward_avx2(uint32_t *buf);
+#endif /* HAVE_ZERO_SCAN_AVX2 */
+
+#ifdef HAVE_ZERO_SCAN_NEON
+/**
+ * Advance the junk data generator buffer using NEON.
+ * @param buf	[in,out] Generator buffer. (RVTH_JUNK_K words)
+ */
+void rvth_junk_forward_neon(uint32_t *buf);
+#endif /* HAVE_ZERO_SCAN_NEON */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_LIBRVTH_JUNK_DATA_HW_H__ */
@@ -0,0 +1,37 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * junk_data_neon.c: Junk data generator step. (NEON version)              *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "junk_data_hw.h"
+
+// NEON intrinsics
+#include <arm_neon.h>
+
+/**
+ * Advance the junk data generator buffer using NEON.
+ * @param buf	[in,out] Generator buffer. (RVTH_JUNK_K words)
+ */
+void rvth_junk_forward_neon(uint32_t *buf)
+{
+	unsigned int i;
+
+	// The first J words use the last J words, which haven't been updated yet.
+	for (i = 0; i < RVTH_JUNK_J; i += 4) {
+		vst1q_u32(&buf[i], veorq_u32(vld1q_u32(&buf[i]),
+			vld1q_u32(&buf[i + RVTH_JUNK_K - RVTH_JUNK_J])));
+	}
+
+	// The remaining words use the words J before them,
+	// so 4 words can be processed at a time.
+	for (; i + 4 <= RVTH_JUNK_K; i += 4) {
+		vst1q_u32(&buf[i], veorq_u32(vld1q_u32(&buf[i]),
+			vld1q_u32(&buf[i - RVTH_JUNK_J])));
+	}
+	for (; i < RVTH_JUNK_K; i++) {
+		buf[i] ^= buf[i - RVTH_JUNK_J];
+	}
+}
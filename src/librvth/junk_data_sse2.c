@@ -0,0 +1,39 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * junk_data_sse2.c: Junk data generator step. (SSE2 version)              *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "junk_data_hw.h"
+
+// SSE2 intrinsics
+#include <emmintrin.h>
+
+/**
+ * Advance the junk data generator buffer using SSE2.
+ * @param buf	[in,out] Generator buffer. (RVTH_JUNK_K words)
+ */
+void rvth_junk_forward_sse2(uint32_t *buf)
+{
+	unsigned int i;
+
+	// The first J words use the last J words, which haven't been updated yet.
+	for (i = 0; i < RVTH_JUNK_J; i += 4) {
+		__m128i *const p = (__m128i*)&buf[i];
+		_mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p),
+			_mm_loadu_si128((const __m128i*)&buf[i + RVTH_JUNK_K - RVTH_JUNK_J])));
+	}
+
+	// The remaining words use the words J before them,
+	// so 4 words can be processed at a time.
+	for (; i + 4 <= RVTH_JUNK_K; i += 4) {
+		__m128i *const p = (__m128i*)&buf[i];
+		_mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p),
+			_mm_loadu_si128((const __m128i*)&buf[i - RVTH_JUNK_J])));
+	}
+	for (; i < RVTH_JUNK_K; i++) {
+		buf[i] ^= buf[i - RVTH_JUNK_J];
+	}
+}
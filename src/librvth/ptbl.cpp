@@ -67,7 +67,22 @@ static int compar_pt_entry_t(const void *a, const void *b)
  */
 int rvth_ptbl_load(RvtH_BankEntry *entry)
 {
-	ptbl_t pt;	// On-disc partition table.
+	return rvth_ptbl_load_buf(entry, nullptr);
+}
+
+/**
+ * Load the partition table from a Wii disc image, using the volume group
+ * and partition tables from a buffer if they were already read.
+ *
+ * If the partition table was already loaded, this function does nothing.
+ *
+ * @param entry		[in] RvtH_BankEntry*
+ * @param buf		[in,opt] Tables at RVL_VolumeGroupTable_ADDRESS (2 LBAs); if NULL, read from the disc image.
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int rvth_ptbl_load_buf(RvtH_BankEntry *entry, const void *buf)
+{
+	ptbl_t pt_buf;	// On-disc partition table. (fallback buffer)
 
 	assert(entry != nullptr);
 	assert(entry->reader != nullptr);
@@ -90,10 +105,11 @@ int rvth_ptbl_load(RvtH_BankEntry *entry)
 
 	// Load the volume group table and partition table from the disc image.
 	errno = 0;
-	uint32_t lba_size = entry->reader->read(&pt,
-		BYTES_TO_LBA(RVL_VolumeGroupTable_ADDRESS),
-		BYTES_TO_LBA(sizeof(pt)));
-	if (lba_size != BYTES_TO_LBA(sizeof(pt))) {
+	const ptbl_t *const pt = (buf ? static_cast<const ptbl_t*>(buf)
+		: static_cast<const ptbl_t*>(entry->reader->readView(&pt_buf,
+			BYTES_TO_LBA(RVL_VolumeGroupTable_ADDRESS),
+			BYTES_TO_LBA(sizeof(pt_buf)))));
+	if (!pt) {
 		// Read error.
 		if (errno == 0) {
 			errno = EIO;
@@ -102,14 +118,14 @@ int rvth_ptbl_load(RvtH_BankEntry *entry)
 	}
 
 	// Count the total number of partitions.
-	unsigned int pt_total = be32_to_cpu(pt.vgtbl.vg[0].count) +
-	                        be32_to_cpu(pt.vgtbl.vg[1].count) +
-	                        be32_to_cpu(pt.vgtbl.vg[2].count) +
-	                        be32_to_cpu(pt.vgtbl.vg[3].count);
+	unsigned int pt_total = be32_to_cpu(pt->vgtbl.vg[0].count) +
+	                        be32_to_cpu(pt->vgtbl.vg[1].count) +
+	                        be32_to_cpu(pt->vgtbl.vg[2].count) +
+	                        be32_to_cpu(pt->vgtbl.vg[3].count);
 	if (pt_total == 0) {
 		// No partitions...
 		return 0;
-	} else if (pt_total >= ARRAY_SIZE(pt.ptbl)) {
+	} else if (pt_total >= ARRAY_SIZE(pt->ptbl)) {
 		// Too many partitions.
 		errno = EIO;
 		return -EIO;
@@ -128,11 +144,11 @@ int rvth_ptbl_load(RvtH_BankEntry *entry)
 
 	// Process the partition table.
 	unsigned int pt_total_proc = 0;	// Partitions actually processed.
-	for (unsigned int vg_idx = 0; vg_idx < ARRAY_SIZE(pt.vgtbl.vg); vg_idx++) {
+	for (unsigned int vg_idx = 0; vg_idx < ARRAY_SIZE(pt->vgtbl.vg); vg_idx++) {
 		// Partition indexes for the current volume group.
 		unsigned int ptcount;			// Number of partitions in the current VG.
 		// PTE pointers. (first, one past the last, current)
-		RVL_PartitionTableEntry *pte_start, *pte_end, *pte;
+		const RVL_PartitionTableEntry *pte_start, *pte_end, *pte;
 		// Partition table address.
 		int64_t ptbl_addr;
 
@@ -142,23 +158,23 @@ int rvth_ptbl_load(RvtH_BankEntry *entry)
 		// TODO: Zero out the update partitions.
 		unsigned int pt_adj = 0;
 
-		ptcount = be32_to_cpu(pt.vgtbl.vg[vg_idx].count);
+		ptcount = be32_to_cpu(pt->vgtbl.vg[vg_idx].count);
 		if (ptcount == 0) {
 			// No partitions in this volume group.
 			continue;
 		}
 
 		// TODO: Use uint32_t arithmetic instead of int64_t?
-		ptbl_addr = static_cast<int64_t>(be32_to_cpu(pt.vgtbl.vg[vg_idx].addr) << 2);
-		if (ptbl_addr < static_cast<int64_t>(RVL_VolumeGroupTable_ADDRESS + sizeof(pt.vgtbl))) {
+		ptbl_addr = static_cast<int64_t>(be32_to_cpu(pt->vgtbl.vg[vg_idx].addr) << 2);
+		if (ptbl_addr < static_cast<int64_t>(RVL_VolumeGroupTable_ADDRESS + sizeof(pt->vgtbl))) {
 			// Partition table starts *before* the volume group table.
 			// Something's wrong, but we'll just skip it for now.
 			continue;
 		}
 
-		pte_start = &pt.ptbl[((ptbl_addr - (RVL_VolumeGroupTable_ADDRESS + sizeof(pt.vgtbl))) / sizeof(RVL_PartitionTableEntry))];
+		pte_start = &pt->ptbl[((ptbl_addr - (RVL_VolumeGroupTable_ADDRESS + sizeof(pt->vgtbl))) / sizeof(RVL_PartitionTableEntry))];
 		pte_end = pte_start + ptcount;
-		if (pte_end >= &pt.ptbl[ARRAY_SIZE(pt.ptbl)]) {
+		if (pte_end >= &pt->ptbl[ARRAY_SIZE(pt->ptbl)]) {
 			// Partition table is too big.
 			// Something's wrong, but we'll just skip it for now.
 			continue;
@@ -189,8 +205,8 @@ int rvth_ptbl_load(RvtH_BankEntry *entry)
 
 	// Save the original per-table addresses and counts.
 	for (unsigned int vg_idx = 0; vg_idx < 4; vg_idx++) {
-		entry->vg_orig.vg[vg_idx].addr = be32_to_cpu(pt.vgtbl.vg[vg_idx].addr);
-		entry->vg_orig.vg[vg_idx].count = (uint8_t)be32_to_cpu(pt.vgtbl.vg[vg_idx].count);
+		entry->vg_orig.vg[vg_idx].addr = be32_to_cpu(pt->vgtbl.vg[vg_idx].addr);
+		entry->vg_orig.vg[vg_idx].count = (uint8_t)be32_to_cpu(pt->vgtbl.vg[vg_idx].count);
 	}
 
 	// Partition table has been loaded.
@@ -233,6 +249,7 @@ int rvth_ptbl_RemoveUpdates(RvtH_BankEntry *entry)
 
 		// Found an update partition.
 		// Shift all other partitions over.
+		free(pte->hdr);
 		if (i+1 < entry->pt_count) {
 			memmove(pte, pte+1, (entry->pt_count-i-1) * sizeof(*pte));
 		}
@@ -363,3 +380,117 @@ const pt_entry_t *rvth_ptbl_find_game(RvtH_BankEntry *entry)
 	// Not found.
 	return nullptr;
 }
+
+/**
+ * Get a partition header.
+ *
+ * Partition headers are cached in the partition table, so each one
+ * is only read from the disc image once. The cache is freed along
+ * with the partition table. (See rvth_ptbl_free().)
+ *
+ * NOTE: This function is not thread-safe.
+ *
+ * @param entry		[in] RvtH_BankEntry*
+ * @param pte		[in] Partition table entry. (must be in entry->ptbl)
+ * @return Partition header, or NULL on error. (errno is set)
+ */
+const RVL_PartitionHeader *rvth_ptbl_get_header(RvtH_BankEntry *entry, const pt_entry_t *pte)
+{
+	assert(entry != nullptr);
+	assert(entry->reader != nullptr);
+	assert(pte >= entry->ptbl && pte < entry->ptbl + entry->pt_count);
+	if (!entry || !entry->reader || !entry->ptbl ||
+	    pte < entry->ptbl || pte >= entry->ptbl + entry->pt_count)
+	{
+		errno = EINVAL;
+		return nullptr;
+	}
+
+	pt_entry_t *const p = &entry->ptbl[pte - entry->ptbl];
+	if (p->hdr) {
+		// Partition header is already cached.
+		return p->hdr;
+	}
+
+	// Read the partition header.
+	errno = 0;
+	RVL_PartitionHeader *const hdr = static_cast<RVL_PartitionHeader*>(malloc(sizeof(*hdr)));
+	if (!hdr) {
+		// Error allocating memory.
+		if (errno == 0) {
+			errno = ENOMEM;
+		}
+		return nullptr;
+	}
+	const uint32_t lba_size = entry->reader->read(hdr, p->lba_start, BYTES_TO_LBA(sizeof(*hdr)));
+	if (lba_size != BYTES_TO_LBA(sizeof(*hdr))) {
+		// Read error.
+		if (errno == 0) {
+			errno = EIO;
+		}
+		free(hdr);
+		return nullptr;
+	}
+
+	p->hdr = hdr;
+	return hdr;
+}
+
+/**
+ * Update the cached partition header after writing a partition header.
+ * @param entry		[in] RvtH_BankEntry*
+ * @param pte		[in] Partition table entry. (must be in entry->ptbl)
+ * @param hdr		[in,opt] New partition header. (If NULL, the cached header is discarded.)
+ * @return Cached partition header, or NULL if it was discarded or on error.
+ */
+const RVL_PartitionHeader *rvth_ptbl_set_header(RvtH_BankEntry *entry, const pt_entry_t *pte,
+	const RVL_PartitionHeader *hdr)
+{
+	assert(entry != nullptr);
+	assert(pte >= entry->ptbl && pte < entry->ptbl + entry->pt_count);
+	if (!entry || !entry->ptbl ||
+	    pte < entry->ptbl || pte >= entry->ptbl + entry->pt_count)
+	{
+		errno = EINVAL;
+		return nullptr;
+	}
+
+	pt_entry_t *const p = &entry->ptbl[pte - entry->ptbl];
+	if (!hdr) {
+		// Discard the cached partition header.
+		free(p->hdr);
+		p->hdr = nullptr;
+		return nullptr;
+	}
+
+	if (!p->hdr) {
+		p->hdr = static_cast<RVL_PartitionHeader*>(malloc(sizeof(*p->hdr)));
+		if (!p->hdr) {
+			// Error allocating memory.
+			errno = ENOMEM;
+			return nullptr;
+		}
+	}
+	memcpy(p->hdr, hdr, sizeof(*p->hdr));
+	return p->hdr;
+}
+
+/**
+ * Free the partition table and its cached partition headers.
+ * The partition table will be reloaded when it's needed.
+ * @param entry		[in] RvtH_BankEntry*
+ */
+void rvth_ptbl_free(RvtH_BankEntry *entry)
+{
+	assert(entry != nullptr);
+	if (!entry) {
+		return;
+	}
+
+	for (unsigned int i = 0; i < entry->pt_count; i++) {
+		free(entry->ptbl[i].hdr);
+	}
+	free(entry->ptbl);
+	entry->ptbl = nullptr;
+	entry->pt_count = 0;
+}
@@ -29,6 +29,7 @@ typedef struct _pt_entry_t {
 				// if an update partition was
 				// deleted and this partition was
 				// shifted over.
+	RVL_PartitionHeader *hdr;	// Cached partition header. (See rvth_ptbl_get_header().)
 } pt_entry_t;
 
 struct _RvtH_BankEntry;
@@ -47,6 +48,18 @@ struct _RvtH_BankEntry;
  */
 int rvth_ptbl_load(struct _RvtH_BankEntry *entry);
 
+/**
+ * Load the partition table from a Wii disc image, using the volume group
+ * and partition tables from a buffer if they were already read.
+ *
+ * If the partition table was already loaded, this function does nothing.
+ *
+ * @param entry		[in] RvtH_BankEntry*
+ * @param buf		[in,opt] Tables at RVL_VolumeGroupTable_ADDRESS (2 LBAs); if NULL, read from the disc image.
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int rvth_ptbl_load_buf(struct _RvtH_BankEntry *entry, const void *buf);
+
 /**
  * Remove update partitions from a Wii disc image's partition table.
  *
@@ -76,6 +89,38 @@ int rvth_ptbl_write(struct _RvtH_BankEntry *entry);
  */
 const pt_entry_t *rvth_ptbl_find_game(RvtH_BankEntry *entry);
 
+/**
+ * Get a partition header.
+ *
+ * Partition headers are cached in the partition table, so each one
+ * is only read from the disc image once. The cache is freed along
+ * with the partition table. (See rvth_ptbl_free().)
+ *
+ * NOTE: This function is not thread-safe.
+ *
+ * @param entry		[in] RvtH_BankEntry*
+ * @param pte		[in] Partition table entry. (must be in entry->ptbl)
+ * @return Partition header, or NULL on error. (errno is set)
+ */
+const RVL_PartitionHeader *rvth_ptbl_get_header(struct _RvtH_BankEntry *entry, const pt_entry_t *pte);
+
+/**
+ * Update the cached partition header after writing a partition header.
+ * @param entry		[in] RvtH_BankEntry*
+ * @param pte		[in] Partition table entry. (must be in entry->ptbl)
+ * @param hdr		[in,opt] New partition header. (If NULL, the cached header is discarded.)
+ * @return Cached partition header, or NULL if it was discarded or on error.
+ */
+const RVL_PartitionHeader *rvth_ptbl_set_header(struct _RvtH_BankEntry *entry, const pt_entry_t *pte,
+	const RVL_PartitionHeader *hdr);
+
+/**
+ * Free the partition table and its cached partition headers.
+ * The partition table will be reloaded when it's needed.
+ * @param entry		[in] RvtH_BankEntry*
+ */
+void rvth_ptbl_free(struct _RvtH_BankEntry *entry);
+
 #ifdef __cplusplus
 }
 #endif
@@ -8,10 +8,17 @@
 
 #include "query.h"
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+// _tcsdup() wrapper that returns NULL if the input is NULL.
+static inline TCHAR *_tcsdup_null(const TCHAR *s)
+{
+	return (s ? _tcsdup(s) : NULL);
+}
+
 /**
  * Create a full serial number string.
  * This includes the check digit.
@@ -61,6 +68,65 @@ TCHAR *rvth_create_full_serial_number(unsigned int serial)
 	return _tcsdup(buf);
 }
 
+/**
+ * Copy a single RvtH_QueryEntry.
+ * @param src	[in] Source entry
+ * @return Allocated copy (next == NULL), or NULL on error.
+ */
+RvtH_QueryEntry *rvth_query_entry_dup(const RvtH_QueryEntry *src)
+{
+	RvtH_QueryEntry *const entry = malloc(sizeof(*entry));
+	if (!entry) {
+		return NULL;
+	}
+
+	*entry = *src;
+	entry->next = NULL;
+	entry->device_name = _tcsdup_null(src->device_name);
+	entry->usb_vendor = _tcsdup_null(src->usb_vendor);
+	entry->usb_product = _tcsdup_null(src->usb_product);
+	entry->usb_serial = _tcsdup_null(src->usb_serial);
+	entry->hdd_vendor = _tcsdup_null(src->hdd_vendor);
+	entry->hdd_model = _tcsdup_null(src->hdd_model);
+	entry->hdd_fwver = _tcsdup_null(src->hdd_fwver);
+#ifdef RVTH_QUERY_ENABLE_HDD_SERIAL
+	entry->hdd_serial = _tcsdup_null(src->hdd_serial);
+#endif /* RVTH_QUERY_ENABLE_HDD_SERIAL */
+	return entry;
+}
+
+/**
+ * Copy a list of RvtH_QueryEntry objects.
+ * @param list	[in] Source list
+ * @param pErr	[out,opt] Pointer to store positive POSIX error code in on error. (0 on success)
+ * @return Allocated copy, or NULL if the list is empty or on error.
+ */
+RvtH_QueryEntry *rvth_query_list_dup(const RvtH_QueryEntry *list, int *pErr)
+{
+	RvtH_QueryEntry *list_head = NULL;
+	RvtH_QueryEntry *list_tail = NULL;
+
+	for (; list != NULL; list = list->next) {
+		RvtH_QueryEntry *const entry = rvth_query_entry_dup(list);
+		if (!entry) {
+			if (pErr) {
+				*pErr = ENOMEM;
+			}
+			rvth_query_free(list_head);
+			return NULL;
+		}
+
+		if (!list_head) {
+			list_head = entry;
+		} else {
+			list_tail->next = entry;
+		}
+		list_tail = entry;
+	}
+
+	return list_head;
+}
+
 /**
  * Free a list of queried devices.
  */
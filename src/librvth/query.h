@@ -77,6 +77,17 @@ TCHAR *rvth_create_full_serial_number(unsigned int serial);
  */
 RvtH_QueryEntry *rvth_query_devices(int *pErr);
 
+/**
+ * Get the cached results of rvth_query_devices() without scanning.
+ * Results are only cached while a device listener is running, and
+ * the listener keeps them up to date, so this never blocks on device
+ * enumeration. If nothing is cached, call rvth_query_devices(), e.g.
+ * on a background thread.
+ * @param pErr	[out,opt] Pointer to store positive POSIX error code in on error. (0 on success; EAGAIN if nothing is cached)
+ * @return List of matching devices, or NULL if none were found.
+ */
+RvtH_QueryEntry *rvth_query_devices_cached(int *pErr);
+
 /**
  * Get the serial number for the specified RVT-H Reader device.
  * @param filename	[in] RVT-H Reader device filename.
@@ -85,6 +96,21 @@ RvtH_QueryEntry *rvth_query_devices(int *pErr);
  */
 TCHAR *rvth_get_device_serial_number(const TCHAR *filename, int *pErr);
 
+/**
+ * Copy a single RvtH_QueryEntry.
+ * @param src	[in] Source entry
+ * @return Allocated copy (next == NULL), or NULL on error.
+ */
+RvtH_QueryEntry *rvth_query_entry_dup(const RvtH_QueryEntry *src);
+
+/**
+ * Copy a list of RvtH_QueryEntry objects.
+ * @param list	[in] Source list
+ * @param pErr	[out,opt] Pointer to store positive POSIX error code in on error. (0 on success)
+ * @return Allocated copy, or NULL if the list is empty or on error.
+ */
+RvtH_QueryEntry *rvth_query_list_dup(const RvtH_QueryEntry *list, int *pErr);
+
 /**
  * Free a list of queried devices.
  */
@@ -130,8 +156,43 @@ typedef void (*RvtH_DeviceCallback)(RvtH_ListenForDevices *listener,
  */
 RvtH_ListenForDevices *rvth_listen_for_devices(RvtH_DeviceCallback callback, void *userdata);
 
+/**
+ * Listen for new and/or removed devices without a separate thread.
+ *
+ * The caller watches the file descriptor from rvth_listener_get_fd()
+ * in its own event loop, e.g. QSocketNotifier or epoll, and calls
+ * rvth_listener_process_events() when it's readable. The callback
+ * function is called from that thread.
+ *
+ * NOTE: On Windows, there's no fd. The notifications are delivered
+ * by the calling thread's message loop, or by calling
+ * rvth_listener_process_events() if it doesn't have one.
+ *
+ * @param callback Callback function
+ * @param userdata User data
+ * @return Listener object, or nullptr on error.
+ */
+RvtH_ListenForDevices *rvth_listen_for_devices_fd(RvtH_DeviceCallback callback, void *userdata);
+
+/**
+ * Get the file descriptor to watch for an event-loop listener.
+ * @param listener RvtH_ListenForDevices (from rvth_listen_for_devices_fd())
+ * @return File descriptor, or -1 if not available.
+ */
+int rvth_listener_get_fd(const RvtH_ListenForDevices *listener);
+
+/**
+ * Process pending events for an event-loop listener.
+ * This doesn't block. The callback function is called
+ * from the current thread.
+ * @param listener RvtH_ListenForDevices (from rvth_listen_for_devices_fd())
+ * @return Number of events processed, or negative POSIX error code on error.
+ */
+int rvth_listener_process_events(RvtH_ListenForDevices *listener);
+
 /**
  * Stop listening for new and/or removed devices.
+ * Event-loop listeners are freed immediately.
  * @param listener RvtH_ListenForDevices
  */
 void rvth_listener_stop(RvtH_ListenForDevices *listener);
@@ -16,7 +16,9 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdio.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 #include <libudev.h>
 
@@ -30,6 +32,29 @@ static inline char *strdup_null(const char *s)
 	return (s ? strdup(s) : NULL);
 }
 
+// Cached query results.
+// Enumerating devices is slow on systems with many block devices,
+// so the results are cached while a device listener is running.
+// The listener keeps the cache up to date on hotplug events.
+// Without a listener, rvth_query_devices() rescans on each call.
+static RvtH_QueryEntry *s_cache_list = NULL;
+static bool s_cache_valid = false;
+static unsigned int s_cache_listeners = 0;
+// Incremented on each hotplug event, so a scan that raced with
+// an event doesn't replace the cache with stale results.
+static unsigned int s_cache_gen = 0;
+
+#ifdef HAVE_PTHREADS
+static pthread_mutex_t s_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+#  define CACHE_LOCK()		pthread_mutex_lock(&s_cache_mutex)
+#  define CACHE_UNLOCK()	pthread_mutex_unlock(&s_cache_mutex)
+#else /* !HAVE_PTHREADS */
+// Without pthreads, only the event-loop listener is available,
+// which calls back from the thread that processes its events.
+#  define CACHE_LOCK()		do { } while (0)
+#  define CACHE_UNLOCK()	do { } while (0)
+#endif /* HAVE_PTHREADS */
+
 /**
  * Check if a USB device has the correct VID/PID.
  * @param usb_dev USB device.
@@ -178,24 +203,27 @@ static RvtH_QueryEntry *rvth_parse_udev_device(struct udev_device *dev, int *pEr
 }
 
 /**
- * Scan all USB devices for RVT-H Readers.
+ * Scan the USB devices for RVT-H Readers.
+ *
+ * USB devices are matched on the RVT-H Reader's VID/PID first,
+ * and only then are their child block devices resolved. This is
+ * much faster than checking the parents of every block device
+ * on systems with many loop devices, dm targets, etc.
+ *
  * @param pErr	[out,opt] Pointer to store positive POSIX error code in on error. (0 on success)
  * @return List of matching devices, or NULL if none were found.
  */
-RvtH_QueryEntry *rvth_query_devices(int *pErr)
+static RvtH_QueryEntry *rvth_scan_devices(int *pErr)
 {
 	RvtH_QueryEntry *list_head = NULL;
 	RvtH_QueryEntry *list_tail = NULL;
 
 	// Reference: http://www.signal11.us/oss/udev/
 	struct udev *udev;
-	struct udev_enumerate *enumerate;
-	struct udev_list_entry *devices, *dev_list_entry;
-
-	if (pErr) {
-		// No error initially.
-		*pErr = 0;
-	}
+	struct udev_enumerate *usb_enumerate;
+	struct udev_list_entry *usb_devices, *usb_list_entry;
+	char s_vid[8], s_pid[8];
+	int err = 0;
 
 	// Create the udev object.
 	udev = udev_new();
@@ -207,59 +235,164 @@ RvtH_QueryEntry *rvth_query_devices(int *pErr)
 		return NULL;
 	}
 
-	// Create a list of the devices in the 'block' subsystem.
-	enumerate = udev_enumerate_new(udev);
-	udev_enumerate_add_match_subsystem(enumerate, "block");
-	udev_enumerate_scan_devices(enumerate);
-	devices = udev_enumerate_get_list_entry(enumerate);
+	// Create a list of USB devices with the RVT-H Reader's VID/PID.
+	// NOTE: The sysattrs are lowercase hexadecimal without a prefix.
+	snprintf(s_vid, sizeof(s_vid), "%04x", RVTH_READER_VID);
+	snprintf(s_pid, sizeof(s_pid), "%04x", RVTH_READER_PID);
+	usb_enumerate = udev_enumerate_new(udev);
+	udev_enumerate_add_match_subsystem(usb_enumerate, "usb");
+	udev_enumerate_add_match_property(usb_enumerate, "DEVTYPE", "usb_device");
+	udev_enumerate_add_match_sysattr(usb_enumerate, "idVendor", s_vid);
+	udev_enumerate_add_match_sysattr(usb_enumerate, "idProduct", s_pid);
+	udev_enumerate_scan_devices(usb_enumerate);
+	usb_devices = udev_enumerate_get_list_entry(usb_enumerate);
+
+	udev_list_entry_foreach(usb_list_entry, usb_devices) {
+		struct udev_device *usb_dev;
+		struct udev_enumerate *blk_enumerate;
+		struct udev_list_entry *blk_devices, *blk_list_entry;
 
-	// Go over the list of devices and find matching USB devices.
-	udev_list_entry_foreach(dev_list_entry, devices) {
-		RvtH_QueryEntry *entry;
-		struct udev_device *dev;
-		const char *path;
-		int err;
-
-		// Get the filename of the /sys entry for the device
-		// and create a udev_device object (dev) representing it.
-		path = udev_list_entry_get_name(dev_list_entry);
-		dev = udev_device_new_from_syspath(udev, path);
-
-		// Attempt to get an RvtH_QueryEntry from this device node.
-		entry = rvth_parse_udev_device(dev, &err);
-		if (!entry) {
-			// Not an RVT-H Reader.
-			udev_device_unref(dev);
-			if (err == 0)
+		usb_dev = udev_device_new_from_syspath(udev, udev_list_entry_get_name(usb_list_entry));
+		if (!usb_dev) {
+			// Device was probably removed.
+			continue;
+		}
+
+		// Create a list of block devices below this USB device.
+		blk_enumerate = udev_enumerate_new(udev);
+		udev_enumerate_add_match_parent(blk_enumerate, usb_dev);
+		udev_enumerate_add_match_subsystem(blk_enumerate, "block");
+		udev_enumerate_scan_devices(blk_enumerate);
+		blk_devices = udev_enumerate_get_list_entry(blk_enumerate);
+
+		udev_list_entry_foreach(blk_list_entry, blk_devices) {
+			RvtH_QueryEntry *entry;
+			struct udev_device *dev;
+
+			// Get the filename of the /sys entry for the device
+			// and create a udev_device object (dev) representing it.
+			dev = udev_device_new_from_syspath(udev, udev_list_entry_get_name(blk_list_entry));
+			if (!dev) {
 				continue;
+			}
+
+			// Attempt to get an RvtH_QueryEntry from this device node.
+			entry = rvth_parse_udev_device(dev, &err);
+			udev_device_unref(dev);
+			if (!entry) {
+				if (err == 0)
+					continue;
 
-			// An error occurred.
-			if (pErr) {
-				*pErr = err;
+				// An error occurred.
+				break;
 			}
-			rvth_query_free(list_head);
-			list_head = NULL;
-			list_tail = NULL;
-			break;
-		}
 
-		// RvtH_QueryEntry obtained. Add it to the list.
-		if (!list_head) {
-			// New list head.
-			list_head = entry;
-			list_tail = list_head;
-		} else {
-			// Add an entry to the current list.
-			list_tail->next = entry;
+			// RvtH_QueryEntry obtained. Add it to the list.
+			if (!list_head) {
+				// New list head.
+				list_head = entry;
+			} else {
+				// Add an entry to the current list.
+				list_tail->next = entry;
+			}
+			list_tail = entry;
 		}
 
-		// Next device.
-		udev_device_unref(dev);
+		udev_enumerate_unref(blk_enumerate);
+		udev_device_unref(usb_dev);
+		if (err != 0)
+			break;
 	}
 
 	// Free the enumerator object.
-	udev_enumerate_unref(enumerate);
+	udev_enumerate_unref(usb_enumerate);
 	udev_unref(udev);
+
+	if (err != 0) {
+		rvth_query_free(list_head);
+		list_head = NULL;
+	}
+	if (pErr) {
+		*pErr = err;
+	}
+	return list_head;
+}
+
+/**
+ * Scan all USB devices for RVT-H Readers.
+ * @param pErr	[out,opt] Pointer to store positive POSIX error code in on error. (0 on success)
+ * @return List of matching devices, or NULL if none were found.
+ */
+RvtH_QueryEntry *rvth_query_devices(int *pErr)
+{
+	RvtH_QueryEntry *list_head;
+	unsigned int gen;
+	int err = 0;
+
+	if (pErr) {
+		// No error initially.
+		*pErr = 0;
+	}
+
+	CACHE_LOCK();
+	if (s_cache_valid) {
+		// Cached results are up to date.
+		list_head = rvth_query_list_dup(s_cache_list, pErr);
+		CACHE_UNLOCK();
+		return list_head;
+	}
+	gen = s_cache_gen;
+	CACHE_UNLOCK();
+
+	list_head = rvth_scan_devices(&err);
+	if (pErr) {
+		*pErr = err;
+	}
+	if (err != 0) {
+		return list_head;
+	}
+
+	// Cache the results if a listener is running, unless a
+	// hotplug event was received while scanning.
+	CACHE_LOCK();
+	if (s_cache_listeners > 0 && !s_cache_valid && s_cache_gen == gen) {
+		int dup_err = 0;
+		RvtH_QueryEntry *const cache_list = rvth_query_list_dup(list_head, &dup_err);
+		if (dup_err == 0) {
+			s_cache_list = cache_list;
+			s_cache_valid = true;
+		}
+	}
+	CACHE_UNLOCK();
+	return list_head;
+}
+
+/**
+ * Get the cached results of rvth_query_devices() without scanning.
+ * Results are only cached while a device listener is running, and
+ * the listener keeps them up to date, so this never blocks on device
+ * enumeration. If nothing is cached, call rvth_query_devices(), e.g.
+ * on a background thread.
+ * @param pErr	[out,opt] Pointer to store positive POSIX error code in on error. (0 on success; EAGAIN if nothing is cached)
+ * @return List of matching devices, or NULL if none were found.
+ */
+RvtH_QueryEntry *rvth_query_devices_cached(int *pErr)
+{
+	RvtH_QueryEntry *list_head = NULL;
+
+	if (pErr) {
+		// No error initially.
+		*pErr = 0;
+	}
+
+	CACHE_LOCK();
+	if (s_cache_valid) {
+		list_head = rvth_query_list_dup(s_cache_list, pErr);
+	} else if (pErr) {
+		// Nothing is cached.
+		*pErr = EAGAIN;
+	}
+	CACHE_UNLOCK();
 	return list_head;
 }
 
@@ -273,10 +406,22 @@ TCHAR *rvth_get_device_serial_number(const TCHAR *filename, int *pErr)
 {
 	// Reference: http://www.signal11.us/oss/udev/
 	struct udev *udev;
-	struct udev_enumerate *enumerate;
-	struct udev_list_entry *devices, *dev_list_entry;
+	struct udev_device *dev, *usb_dev;
+	struct stat sbuf;
 	TCHAR *s_full_serial = NULL;
 
+	const char *s_usb_serial;
+	unsigned int hw_serial;
+
+	// Get the device number directly instead of enumerating devices.
+	if (stat(filename, &sbuf) != 0 || !S_ISBLK(sbuf.st_mode)) {
+		// Not a block device.
+		if (pErr) {
+			*pErr = ENOENT;
+		}
+		return NULL;
+	}
+
 	// Create the udev object.
 	udev = udev_new();
 	if (!udev) {
@@ -287,86 +432,43 @@ TCHAR *rvth_get_device_serial_number(const TCHAR *filename, int *pErr)
 		return NULL;
 	}
 
-	// TODO: Get the device directly based on `filename`
-	// instead of enumerating devices.
-
-	// Create a list of the devices in the 'block' subsystem.
-	enumerate = udev_enumerate_new(udev);
-	udev_enumerate_add_match_subsystem(enumerate, "block");
-	udev_enumerate_scan_devices(enumerate);
-	devices = udev_enumerate_get_list_entry(enumerate);
-
-	// Go over the list of devices and find matching USB devices.
-	udev_list_entry_foreach(dev_list_entry, devices) {
-		struct udev_device *usb_dev;
-		struct udev_device *dev;
-
-		const char *path;
-		const char *s_devnode;
-
-		const char *s_usb_serial;
-		unsigned int hw_serial;
-
-		// Get the filename of the /sys entry for the device
-		// and create a udev_device object (dev) representing it.
-		path = udev_list_entry_get_name(dev_list_entry);
-		dev = udev_device_new_from_syspath(udev, path);
-
-		// udev_device_get_devnode() returns the path to the device node itself in /dev.
-		s_devnode = udev_device_get_devnode(dev);
-		if (!s_devnode || _tcscmp(filename, s_devnode) != 0) {
-			// No device node, or wrong filename.
-			udev_device_unref(dev);
-			continue;
+	dev = udev_device_new_from_devnum(udev, 'b', sbuf.st_rdev);
+	if (!dev) {
+		// Device not found.
+		udev_unref(udev);
+		if (pErr) {
+			*pErr = ENOENT;
 		}
+		return NULL;
+	}
 
-		// The device pointed to by dev contains information about the
-		// block device. In order to get information about the USB device,
-		// get the parent device with the subsystem/devtype pair of
-		// "usb"/"usb_device". This will be several levels up the tree,
-		// but the function will find it.
-		// NOTE: This device is NOT referenced, and is cleaned up when
-		// dev is cleaned up.
-		usb_dev = udev_device_get_parent_with_subsystem_devtype(dev, "usb", "usb_device");
-		if (!usb_dev) {
-			// Parent USB device is missing.
-			// Not an external HDD.
-			udev_device_unref(dev);
-			continue;
-		}
-	
-		// Check if the VID/PID matches Nintendo RVT-H Reader.
-		if (!is_vid_pid_correct(usb_dev)) {
-			udev_device_unref(dev);
-			continue;
-		}
+	// The device pointed to by dev contains information about the
+	// block device. In order to get information about the USB device,
+	// get the parent device with the subsystem/devtype pair of
+	// "usb"/"usb_device". This will be several levels up the tree,
+	// but the function will find it.
+	// NOTE: This device is NOT referenced, and is cleaned up when
+	// dev is cleaned up.
+	usb_dev = udev_device_get_parent_with_subsystem_devtype(dev, "usb", "usb_device");
 
-		// Get the serial number.
-		s_usb_serial = udev_device_get_sysattr_value(usb_dev, "serial");
-		if (!s_usb_serial) {
-			// No serial number...
-			udev_device_unref(dev);
-			continue;
-		}
+	// Check if the VID/PID matches Nintendo RVT-H Reader,
+	// and get the serial number.
+	s_usb_serial = (usb_dev && is_vid_pid_correct(usb_dev))
+		? udev_device_get_sysattr_value(usb_dev, "serial")
+		: NULL;
+	if (s_usb_serial) {
 		hw_serial = (unsigned int)strtoul(s_usb_serial, NULL, 10);
 
 		// Is the serial number valid?
 		// - Wired:    10xxxxxx
 		// - Wireless: 20xxxxxx
-		if (hw_serial < 10000000 || hw_serial > 29999999) {
-			// Not a valid serial number.
-			udev_device_unref(dev);
-			continue;
+		if (hw_serial >= 10000000 && hw_serial <= 29999999) {
+			// Create the full serial number.
+			s_full_serial = rvth_create_full_serial_number(hw_serial);
 		}
-
-		// Create the full serial number.
-		s_full_serial = rvth_create_full_serial_number(hw_serial);
-		udev_device_unref(dev);
-		break;
 	}
 
-	// Free the enumerator object.
-	udev_enumerate_unref(enumerate);
+	udev_device_unref(dev);
 	udev_unref(udev);
 
 	if (pErr) {
@@ -383,13 +485,13 @@ TCHAR *rvth_get_device_serial_number(const TCHAR *filename, int *pErr)
 
 /** Listen for new devices **/
 
-#ifdef HAVE_PTHREADS
-
-/** pthreads is available; we can listen for devices. */
-
 // NOTE: libudev uses an fd event model.
-// We'll use a separate thread that calls a callback function.
-// The callback function must handle GUI dispatch in a thread-safe manner.
+// - rvth_listen_for_devices() uses a separate thread that calls
+//   a callback function. The callback function must handle GUI
+//   dispatch in a thread-safe manner. (Requires pthreads.)
+// - rvth_listen_for_devices_fd() doesn't create a thread. The caller
+//   watches the monitor fd in its own event loop and calls
+//   rvth_listener_process_events() when it's readable.
 
 // Reference: https://github.com/robertalks/udev-examples/blob/master/udev_example3.c
 
@@ -401,22 +503,143 @@ struct _RvtH_ListenForDevices {
 	struct udev_monitor *mon;
 	int fd;
 
+#ifdef HAVE_PTHREADS
 	pthread_t thread_id;
+	bool has_thread;
+#endif /* HAVE_PTHREADS */
 	bool stop;
 };
 
 /**
- * Main function for the udev thread.
- * @param listener_arg RvtH_ListenForDevices
+ * Release the query cache for a listener that was stopped.
+ * The cache is freed once no listeners are running.
  */
-static void *rvth_listener_thread(void *listener_arg)
+static void rvth_cache_release(void)
+{
+	CACHE_LOCK();
+	assert(s_cache_listeners > 0);
+	if (--s_cache_listeners == 0) {
+		rvth_query_free(s_cache_list);
+		s_cache_list = NULL;
+		s_cache_valid = false;
+	}
+	CACHE_UNLOCK();
+}
+
+/**
+ * Add a device to the query cache, replacing an existing entry
+ * with the same device name.
+ * @param entry	[in] Device entry
+ */
+static void rvth_cache_add(const RvtH_QueryEntry *entry)
+{
+	RvtH_QueryEntry **pp;
+
+	CACHE_LOCK();
+	s_cache_gen++;
+	if (s_cache_valid) {
+		RvtH_QueryEntry *const copy = rvth_query_entry_dup(entry);
+		if (!copy) {
+			// Can't keep the cache up to date.
+			rvth_query_free(s_cache_list);
+			s_cache_list = NULL;
+			s_cache_valid = false;
+			CACHE_UNLOCK();
+			return;
+		}
+
+		for (pp = &s_cache_list; *pp != NULL; pp = &(*pp)->next) {
+			if (!strcmp((*pp)->device_name, entry->device_name)) {
+				// Replace the existing entry.
+				RvtH_QueryEntry *const old = *pp;
+				copy->next = old->next;
+				old->next = NULL;
+				rvth_query_free(old);
+				break;
+			}
+		}
+		*pp = copy;
+	}
+	CACHE_UNLOCK();
+}
+
+/**
+ * Remove a device from the query cache.
+ * @param device_name	[in] Device name
+ */
+static void rvth_cache_remove(const char *device_name)
+{
+	RvtH_QueryEntry **pp;
+
+	CACHE_LOCK();
+	s_cache_gen++;
+	if (s_cache_valid) {
+		for (pp = &s_cache_list; *pp != NULL; pp = &(*pp)->next) {
+			if (!strcmp((*pp)->device_name, device_name)) {
+				RvtH_QueryEntry *const old = *pp;
+				*pp = old->next;
+				old->next = NULL;
+				rvth_query_free(old);
+				break;
+			}
+		}
+	}
+	CACHE_UNLOCK();
+}
+
+/**
+ * Handle a udev event.
+ * @param listener	[in] RvtH_ListenForDevices
+ * @param dev		[in] udev device
+ */
+static void rvth_listener_handle_device(RvtH_ListenForDevices *listener, struct udev_device *dev)
+{
+	// Check if this is "add" or "remove".
+	const char *const action = udev_device_get_action(dev);
+	const char *const s_devnode = udev_device_get_devnode(dev);
+	if (!action || !s_devnode)
+		return;
+
+	if (!strcmp(action, "add")) {
+		// Device added.
+		RvtH_QueryEntry *const entry = rvth_parse_udev_device(dev, NULL);
+		if (entry) {
+			// Update the cache before calling the callback, since
+			// the callback may query the device list again.
+			rvth_cache_add(entry);
+			listener->callback(listener, entry, RVTH_LISTEN_CONNECTED, listener->userdata);
+			rvth_query_free(entry);
+		}
+	} else if (!strcmp(action, "remove")) {
+		// Deivce removed.
+		// NOTE: Can't get the correct parent USB device for
+		// the block device on removal. The caller will have
+		// to verify if this device node is in its list.
+		// TODO: Monitor USB devices too?
+		RvtH_QueryEntry *const entry = calloc(1, sizeof(*entry));
+		rvth_cache_remove(s_devnode);
+		if (entry) {
+			entry->device_name = s_devnode;
+			listener->callback(listener, entry, RVTH_LISTEN_DISCONNECTED, listener->userdata);
+			free(entry);
+		}
+	}
+}
+
+/**
+ * Handle all pending udev events without blocking.
+ * @param listener	[in] RvtH_ListenForDevices
+ * @return Number of events handled.
+ */
+static int rvth_listener_drain(RvtH_ListenForDevices *listener)
 {
-	RvtH_ListenForDevices *const listener = (RvtH_ListenForDevices*)listener_arg;
 	const int fd = listener->fd;
+	int count = 0;
 
 	while (!listener->stop) {
 		fd_set fds;
 		struct timeval tv;
+		struct udev_device *dev;
 		int ret;
 
 		FD_ZERO(&fds);
@@ -425,59 +648,30 @@ static void *rvth_listener_thread(void *listener_arg)
 		tv.tv_usec = 0;
 
 		ret = select(fd + 1, &fds, NULL, NULL, &tv);
-		if (ret > 0 && FD_ISSET(fd, &fds)) do {
-			const char *action;
-
-			struct udev_device *const dev = udev_monitor_receive_device(listener->mon);
-			if (!dev)
-				break;
-
-			// Check if this is "add" or "remove".
-			action = udev_device_get_action(dev);
-			if (!action)
-				break;
+		if (ret <= 0 || !FD_ISSET(fd, &fds))
+			break;
 
-			if (!strcmp(action, "add")) {
-				// Device added.
-				RvtH_QueryEntry *const entry = rvth_parse_udev_device(dev, NULL);
-				if (entry) {
-					listener->callback(listener, entry, RVTH_LISTEN_CONNECTED, listener->userdata);
-					rvth_query_free(entry);
-				}
-			} else if (!strcmp(action, "remove")) {
-				// Deivce removed.
-				// NOTE: Can't get the correct parent USB device for
-				// the block device on removal. The caller will have
-				// to verify if this device node is in its list.
-				// TODO: Monitor USB devices too?
-				RvtH_QueryEntry *const entry = calloc(1, sizeof(*entry));
-				if (entry) {
-					entry->device_name = udev_device_get_devnode(dev);
-					listener->callback(listener, entry, RVTH_LISTEN_DISCONNECTED, listener->userdata);
-					free(entry);
-				}
-			}
-		} while (0);
+		dev = udev_monitor_receive_device(listener->mon);
+		if (!dev)
+			break;
 
-		// Yield the thread and wait 500ms.
-		sched_yield();
-		usleep(500*1000);
+		rvth_listener_handle_device(listener, dev);
+		udev_device_unref(dev);
+		count++;
 	}
 
-	// TODO
-	return NULL;
+	return count;
 }
 
 /**
- * Listen for new and/or removed devices.
+ * Create a listener and its udev monitor.
+ * The listener thread isn't started.
  * @param callback Callback function
  * @param userdata User data
  * @return Listener object, or nullptr on error.
  */
-RvtH_ListenForDevices *rvth_listen_for_devices(RvtH_DeviceCallback callback, void *userdata)
+static RvtH_ListenForDevices *rvth_listener_new(RvtH_DeviceCallback callback, void *userdata)
 {
-	int ret;
-
 	assert(callback != NULL);
 	if (!callback) {
 		// No point in listening with no callback.
@@ -514,34 +708,86 @@ RvtH_ListenForDevices *rvth_listen_for_devices(RvtH_DeviceCallback callback, voi
 		return NULL;
 	}
 
+	listener->callback = callback;
+	listener->userdata = userdata;
+
+	// Hotplug events are received from now on, so the query
+	// results can be cached until the listener is stopped.
+	CACHE_LOCK();
+	s_cache_listeners++;
+	s_cache_gen++;
+	CACHE_UNLOCK();
+	return listener;
+}
+
+/**
+ * Free a listener that doesn't have a running thread.
+ * @param listener RvtH_ListenForDevices
+ */
+static void rvth_listener_free(RvtH_ListenForDevices *listener)
+{
+	rvth_cache_release();
+	udev_monitor_unref(listener->mon);
+	udev_unref(listener->udev);
+	free(listener);
+}
+
+#ifdef HAVE_PTHREADS
+
+/** pthreads is available; we can listen for devices using a thread. */
+
+/**
+ * Main function for the udev thread.
+ * @param listener_arg RvtH_ListenForDevices
+ */
+static void *rvth_listener_thread(void *listener_arg)
+{
+	RvtH_ListenForDevices *const listener = (RvtH_ListenForDevices*)listener_arg;
+
+	while (!listener->stop) {
+		// Handle all pending events.
+		rvth_listener_drain(listener);
+
+		// Yield the thread and wait 500ms.
+		sched_yield();
+		usleep(500*1000);
+	}
+
+	// TODO
+	return NULL;
+}
+
+/**
+ * Listen for new and/or removed devices.
+ * @param callback Callback function
+ * @param userdata User data
+ * @return Listener object, or nullptr on error.
+ */
+RvtH_ListenForDevices *rvth_listen_for_devices(RvtH_DeviceCallback callback, void *userdata)
+{
+	int ret;
+
+	RvtH_ListenForDevices *const listener = rvth_listener_new(callback, userdata);
+	if (!listener) {
+		return NULL;
+	}
+
 	// udev is set up. Create the thread.
 	ret = pthread_create(&listener->thread_id, NULL, rvth_listener_thread, listener);
 	if (ret != 0) {
 		// Error creating the thread.
-		udev_monitor_unref(listener->mon);
-		udev_unref(listener->udev);
-		free(listener);
+		rvth_listener_free(listener);
 		return NULL;
 	}
 
 	// Thread is listening.
-	listener->callback = callback;
-	listener->userdata = userdata;
+	listener->has_thread = true;
 	return listener;
 }
 
-/**
- * Stop listening for new and/or removed devices.
- * @param listener RvtH_ListenForDevices
- */
-void rvth_listener_stop(RvtH_ListenForDevices *listener)
-{
-	// TODO: Kill the thread?
-	listener->stop = true;
-}
 #else /* !HAVE_PTHREADS */
 
-/** pthreads is unavailable. No device listening. */
+/** pthreads is unavailable. Only the event-loop listener is available. */
 
 /**
  * Listen for new and/or removed devices.
@@ -556,13 +802,68 @@ RvtH_ListenForDevices *rvth_listen_for_devices(RvtH_DeviceCallback callback, voi
 	return NULL;
 }
 
+#endif /* HAVE_PTHREADS */
+
+/**
+ * Listen for new and/or removed devices without a separate thread.
+ * @param callback Callback function
+ * @param userdata User data
+ * @return Listener object, or nullptr on error.
+ */
+RvtH_ListenForDevices *rvth_listen_for_devices_fd(RvtH_DeviceCallback callback, void *userdata)
+{
+	return rvth_listener_new(callback, userdata);
+}
+
+/**
+ * Get the file descriptor to watch for an event-loop listener.
+ * @param listener RvtH_ListenForDevices
+ * @return File descriptor, or -1 if not available.
+ */
+int rvth_listener_get_fd(const RvtH_ListenForDevices *listener)
+{
+#ifdef HAVE_PTHREADS
+	if (listener->has_thread) {
+		// The thread owns the fd.
+		return -1;
+	}
+#endif /* HAVE_PTHREADS */
+	return listener->fd;
+}
+
+/**
+ * Process pending events for an event-loop listener.
+ * This doesn't block. The callback function is called
+ * from the current thread.
+ * @param listener RvtH_ListenForDevices
+ * @return Number of events processed, or negative POSIX error code on error.
+ */
+int rvth_listener_process_events(RvtH_ListenForDevices *listener)
+{
+#ifdef HAVE_PTHREADS
+	if (listener->has_thread) {
+		// The thread processes the events.
+		return -EINVAL;
+	}
+#endif /* HAVE_PTHREADS */
+	return rvth_listener_drain(listener);
+}
+
 /**
  * Stop listening for new and/or removed devices.
  * @param listener RvtH_ListenForDevices
  */
 void rvth_listener_stop(RvtH_ListenForDevices *listener)
 {
-	((void)listener);
-}
+#ifdef HAVE_PTHREADS
+	if (listener->has_thread) {
+		// TODO: Kill the thread?
+		listener->stop = true;
+		rvth_cache_release();
+		return;
+	}
+#endif /* HAVE_PTHREADS */
 
-#endif /* HAVE_PTHREADS */
\ No newline at end of file
+	// No thread, so the listener can be freed now.
+	rvth_listener_free(listener);
+}
@@ -12,6 +12,7 @@
 #include "../libwiicrypto/common.h"
 
 // C includes.
+#include <assert.h>
 #include <ctype.h>
 #include <errno.h>
 #include <stdlib.h>
@@ -24,6 +25,11 @@
 #include <winioctl.h>
 #include <devguid.h>
 #include <cfgmgr32.h>
+#include <dbt.h>
+#include <process.h>
+
+// Cache lock
+#include "../libwiicrypto/static_mutex.h"
 
 // _tcsdup() wrapper that returns NULL if the input is NULL.
 static inline TCHAR *_tcsdup_null(const TCHAR *s)
@@ -31,6 +37,43 @@ static inline TCHAR *_tcsdup_null(const TCHAR *s)
 	return (s ? _tcsdup(s) : NULL);
 }
 
+/**
+ * Cached device entry.
+ * The disk's device instance ID is needed to match removal
+ * notifications, since the device can't be opened anymore.
+ */
+typedef struct _Win32_CacheEntry {
+	struct _Win32_CacheEntry *next;
+	TCHAR *instance_id;		// Disk device instance ID
+	RvtH_QueryEntry *entry;		// Query entry
+} Win32_CacheEntry;
+
+// Cached query results.
+// Opening each disk to query its properties is slow on systems with
+// many disks, so the results are cached while a device listener is
+// running. The listener keeps the cache up to date on device
+// notifications. Without a listener, rvth_query_devices() rescans
+// on each call.
+STATIC_MUTEX(s_cache_mutex);
+static Win32_CacheEntry *s_cache_list = NULL;
+static bool s_cache_valid = false;
+static unsigned int s_cache_listeners = 0;
+
+/**
+ * Free a list of cached device entries.
+ * @param list Cached device entries
+ */
+static void win32_cache_free(Win32_CacheEntry *list)
+{
+	while (list) {
+		Win32_CacheEntry *const next = list->next;
+		free(list->instance_id);
+		rvth_query_free(list->entry);
+		free(list);
+		list = next;
+	}
+}
+
 /**
  * Check if a device is a matching USB device.
  * @param pDevInst	[in] Device instance.
@@ -353,73 +396,250 @@ static RvtH_QueryEntry *rvth_parse_devinst(DWORD devInst, int *pErr)
 }
 
 /**
- * Scan all USB devices for RVT-H Readers.
- * @param pErr	[out,opt] Pointer to store positive POSIX error code in on error. (0 on success)
- * @return List of matching devices, or NULL if none were found.
+ * Get a cached device entry for the specified disk device instance.
+ * @param devInst	[in] Disk device instance
+ * @param pErr		[out,opt] Pointer to store positive POSIX error code in on error. (0 on success)
+ * @return Allocated Win32_CacheEntry if it's an RVT-H Reader; NULL if not.
  */
-RvtH_QueryEntry *rvth_query_devices(int *pErr)
+static Win32_CacheEntry *win32_cache_entry_new(DEVINST devInst, int *pErr)
 {
-	RvtH_QueryEntry *list_head = NULL;
-	RvtH_QueryEntry *list_tail = NULL;
+	Win32_CacheEntry *centry;
+	TCHAR s_diskInstanceID[MAX_DEVICE_ID_LEN];
 
-	HDEVINFO hDevInfoSet = NULL;
-	SP_DEVINFO_DATA devInfoData;
-	int devIndex = 0;
+	RvtH_QueryEntry *const entry = rvth_parse_devinst(devInst, pErr);
+	if (!entry)
+		return NULL;
 
-	// Get all USB devices and find one with a matching vendor/device ID.
-	// Once we find it, get GUID_DEVINTERFACE_DISK for that ID.
-	// References:
-	// - https://docs.microsoft.com/en-us/windows/desktop/api/setupapi/nf-setupapi-setupdigetclassdevsw
-	// - https://social.msdn.microsoft.com/Forums/vstudio/en-US/76315dfa-6764-4feb-a3e2-1f173fc5bdfd/how-to-get-usb-vendor-and-product-id-programmatically-in-c?forum=vcgeneral
-	hDevInfoSet = SetupDiGetClassDevs(&GUID_DEVINTERFACE_DISK, NULL,
-		NULL, DIGCF_DEVICEINTERFACE | DIGCF_PRESENT);
-	if (!hDevInfoSet || hDevInfoSet == INVALID_HANDLE_VALUE) {
-		// SetupDiGetClassDevs() failed.
+	if (CM_Get_Device_ID(devInst, s_diskInstanceID, _countof(s_diskInstanceID), 0) != CR_SUCCESS) {
+		rvth_query_free(entry);
+		return NULL;
+	}
+
+	centry = malloc(sizeof(*centry));
+	if (!centry) {
+		if (pErr) {
+			*pErr = ENOMEM;
+		}
+		rvth_query_free(entry);
+		return NULL;
+	}
+	centry->next = NULL;
+	centry->instance_id = _tcsdup(s_diskInstanceID);
+	centry->entry = entry;
+	return centry;
+}
+
+/**
+ * Scan the USB devices for RVT-H Readers.
+ *
+ * USB device instance IDs are matched on the RVT-H Reader's VID/PID
+ * first, and only the disks below matching devices are opened.
+ * This is much faster than opening every disk on systems with
+ * many virtual disks.
+ *
+ * @param pErr	[out,opt] Pointer to store positive POSIX error code in on error. (0 on success)
+ * @return List of cached device entries, or NULL if none were found.
+ */
+static Win32_CacheEntry *win32_scan_devices(int *pErr)
+{
+	Win32_CacheEntry *list_head = NULL;
+	Win32_CacheEntry *list_tail = NULL;
+
+	TCHAR *s_idList, *p;
+	ULONG ulLength = 0;
+	TCHAR s_prefix[32];
+	size_t prefix_len;
+	int err = 0;
+
+	// Get the instance IDs of all USB devices.
+	// These are only strings, so no devices are opened here.
+	if (CM_Get_Device_ID_List_Size(&ulLength, _T("USB"), CM_GETIDLIST_FILTER_ENUMERATOR) != CR_SUCCESS ||
+	    ulLength == 0)
+	{
+		// No USB devices.
+		if (pErr) {
+			*pErr = 0;
+		}
+		return NULL;
+	}
+	s_idList = malloc(ulLength * sizeof(TCHAR));
+	if (!s_idList) {
+		if (pErr) {
+			*pErr = ENOMEM;
+		}
+		return NULL;
+	}
+	if (CM_Get_Device_ID_List(_T("USB"), s_idList, ulLength, CM_GETIDLIST_FILTER_ENUMERATOR) != CR_SUCCESS) {
+		// TODO: Convert the CONFIGRET value?
+		free(s_idList);
 		if (pErr) {
-			// TODO: Convert GetLastError()?
 			*pErr = EIO;
 		}
 		return NULL;
 	}
 
-	memset(&devInfoData, 0, sizeof(devInfoData));
-	devInfoData.cbSize = sizeof(devInfoData);
-	while (SetupDiEnumDeviceInfo(hDevInfoSet, devIndex, &devInfoData)) {
-		RvtH_QueryEntry *entry;
-		int err;
+	// Format: "USB\\VID_%04X&PID_%04X\\%08u"
+	prefix_len = _sntprintf(s_prefix, _countof(s_prefix),
+		_T("USB\\VID_%04X&PID_%04X\\"), RVTH_READER_VID, RVTH_READER_PID);
 
-		// Increment the device index here.
-		devIndex++;
+	for (p = s_idList; *p != _T('\0'); p += _tcslen(p) + 1) {
+		DEVINST usbDevInst, diskDevInst;
+		CONFIGRET cr;
 
-		// Attempt to get an RvtH_QueryEntry from this device instance.
-		entry = rvth_parse_devinst(devInfoData.DevInst, &err);
-		if (!entry) {
+		if (_tcsnicmp(p, s_prefix, prefix_len) != 0) {
 			// Not an RVT-H Reader.
-			if (err == 0)
-				continue;
+			continue;
+		}
+
+		// NOTE: This fails if the device isn't present.
+		if (CM_Locate_DevNode(&usbDevInst, p, CM_LOCATE_DEVNODE_NORMAL) != CR_SUCCESS)
+			continue;
+
+		// The disk is a child of the USB device.
+		for (cr = CM_Get_Child(&diskDevInst, usbDevInst, 0); cr == CR_SUCCESS;
+		     cr = CM_Get_Sibling(&diskDevInst, diskDevInst, 0))
+		{
+			// Attempt to get an RvtH_QueryEntry from this device instance.
+			Win32_CacheEntry *const centry = win32_cache_entry_new(diskDevInst, &err);
+			if (!centry) {
+				if (err == 0)
+					continue;
+
+				// An error occurred.
+				break;
+			}
+
+			// Entry obtained. Add it to the list.
+			if (!list_head) {
+				list_head = centry;
+			} else {
+				list_tail->next = centry;
+			}
+			list_tail = centry;
+		}
 
-			// An error occurred.
+		if (err != 0)
+			break;
+	}
+
+	free(s_idList);
+	if (err != 0) {
+		win32_cache_free(list_head);
+		list_head = NULL;
+	}
+	if (pErr) {
+		*pErr = err;
+	}
+	return list_head;
+}
+
+/**
+ * Copy the query entries from a list of cached device entries.
+ * @param list	[in] Cached device entries
+ * @param pErr	[out,opt] Pointer to store positive POSIX error code in on error. (0 on success)
+ * @return List of query entries, or NULL if the list is empty or on error.
+ */
+static RvtH_QueryEntry *win32_cache_to_query_list(const Win32_CacheEntry *list, int *pErr)
+{
+	RvtH_QueryEntry *list_head = NULL;
+	RvtH_QueryEntry *list_tail = NULL;
+
+	for (; list != NULL; list = list->next) {
+		RvtH_QueryEntry *const entry = rvth_query_entry_dup(list->entry);
+		if (!entry) {
 			if (pErr) {
-				*pErr = err;
+				*pErr = ENOMEM;
 			}
 			rvth_query_free(list_head);
-			list_head = NULL;
-			list_tail = NULL;
-			break;
+			return NULL;
 		}
 
-		// RvtH_QueryEntry obtained. Add it to the list.
 		if (!list_head) {
-			// New list head.
 			list_head = entry;
-			list_tail = list_head;
 		} else {
-			// Add an entry to the current list.
 			list_tail->next = entry;
 		}
+		list_tail = entry;
 	}
 
-	SetupDiDestroyDeviceInfoList(hDevInfoSet);
+	return list_head;
+}
+
+/**
+ * Scan all USB devices for RVT-H Readers.
+ * @param pErr	[out,opt] Pointer to store positive POSIX error code in on error. (0 on success)
+ * @return List of matching devices, or NULL if none were found.
+ */
+RvtH_QueryEntry *rvth_query_devices(int *pErr)
+{
+	RvtH_QueryEntry *list_head;
+	Win32_CacheEntry *scan_list;
+	int err = 0;
+
+	if (pErr) {
+		// No error initially.
+		*pErr = 0;
+	}
+
+	STATIC_MUTEX_LOCK(s_cache_mutex);
+	if (s_cache_valid) {
+		// Cached results are up to date.
+		list_head = win32_cache_to_query_list(s_cache_list, pErr);
+		STATIC_MUTEX_UNLOCK(s_cache_mutex);
+		return list_head;
+	}
+	STATIC_MUTEX_UNLOCK(s_cache_mutex);
+
+	scan_list = win32_scan_devices(&err);
+	if (err != 0) {
+		if (pErr) {
+			*pErr = err;
+		}
+		return NULL;
+	}
+	list_head = win32_cache_to_query_list(scan_list, pErr);
+
+	// Cache the results if a listener is running.
+	// NOTE: Listeners fill the cache when they're created,
+	// so this only happens if that scan failed.
+	STATIC_MUTEX_LOCK(s_cache_mutex);
+	if (s_cache_listeners > 0 && !s_cache_valid) {
+		s_cache_list = scan_list;
+		s_cache_valid = true;
+		scan_list = NULL;
+	}
+	STATIC_MUTEX_UNLOCK(s_cache_mutex);
+
+	win32_cache_free(scan_list);
+	return list_head;
+}
+
+/**
+ * Get the cached results of rvth_query_devices() without scanning.
+ * Results are only cached while a device listener is running, and
+ * the listener keeps them up to date, so this never blocks on device
+ * enumeration. If nothing is cached, call rvth_query_devices(), e.g.
+ * on a background thread.
+ * @param pErr	[out,opt] Pointer to store positive POSIX error code in on error. (0 on success; EAGAIN if nothing is cached)
+ * @return List of matching devices, or NULL if none were found.
+ */
+RvtH_QueryEntry *rvth_query_devices_cached(int *pErr)
+{
+	RvtH_QueryEntry *list_head = NULL;
+
+	if (pErr) {
+		// No error initially.
+		*pErr = 0;
+	}
+
+	STATIC_MUTEX_LOCK(s_cache_mutex);
+	if (s_cache_valid) {
+		list_head = win32_cache_to_query_list(s_cache_list, pErr);
+	} else if (pErr) {
+		// Nothing is cached.
+		*pErr = EAGAIN;
+	}
+	STATIC_MUTEX_UNLOCK(s_cache_mutex);
 	return list_head;
 }
 
@@ -596,7 +816,304 @@ TCHAR *rvth_get_device_serial_number(const TCHAR *filename, int *pErr)
 
 /** Listen for new devices **/
 
-// TODO: Implement this!
+// Device notifications are received by a message-only window.
+// - rvth_listen_for_devices() creates the window in a separate thread
+//   that calls a callback function. The callback function must handle
+//   GUI dispatch in a thread-safe manner.
+// - rvth_listen_for_devices_fd() creates the window in the calling
+//   thread. The thread's message loop delivers the notifications,
+//   so the callback function is called from that thread.
+
+struct _RvtH_ListenForDevices {
+	RvtH_DeviceCallback callback;
+	void *userdata;
+
+	HWND hWnd;
+	HDEVNOTIFY hDevNotify;
+
+	// Listener thread (NULL for event-loop listeners)
+	HANDLE hThread;
+	DWORD dwThreadId;
+	HANDLE hReadyEvent;
+	bool init_ok;
+};
+
+static const TCHAR s_listener_class[] = _T("RvtH_ListenForDevices");
+
+/**
+ * Convert a device interface path to a device instance ID.
+ * - Interface path: \\?\USBSTOR#Disk&Ven_xxx&Prod_xxx&Rev_xxx#xxxxxxxx&0#{53f56307-b6bf-11d0-94f2-00a0c91efb8b}
+ * - Instance ID:    USBSTOR\DISK&VEN_XXX&PROD_XXX&REV_XXX\XXXXXXXX&0
+ * @param buf		[out] Instance ID buffer
+ * @param size		[in] Size of buf, in TCHARs
+ * @param path		[in] Device interface path
+ * @return True on success; false on error.
+ */
+static bool interface_path_to_instance_id(TCHAR *buf, size_t size, const TCHAR *path)
+{
+	TCHAR *p;
+
+	if (_tcsncmp(path, _T("\\\\?\\"), 4) != 0)
+		return false;
+	_tcsncpy(buf, path + 4, size - 1);
+	buf[size - 1] = _T('\0');
+
+	// Remove the interface class GUID.
+	p = _tcsrchr(buf, _T('#'));
+	if (!p)
+		return false;
+	*p = _T('\0');
+
+	for (p = buf; *p != _T('\0'); p++) {
+		if (*p == _T('#')) {
+			*p = _T('\\');
+		}
+	}
+	return true;
+}
+
+/**
+ * Release the query cache for a listener that was stopped.
+ * The cache is freed once no listeners are running.
+ */
+static void win32_cache_release(void)
+{
+	STATIC_MUTEX_LOCK(s_cache_mutex);
+	assert(s_cache_listeners > 0);
+	if (--s_cache_listeners == 0) {
+		win32_cache_free(s_cache_list);
+		s_cache_list = NULL;
+		s_cache_valid = false;
+	}
+	STATIC_MUTEX_UNLOCK(s_cache_mutex);
+}
+
+/**
+ * Handle a device arrival notification.
+ * @param listener	[in] RvtH_ListenForDevices
+ * @param instance_id	[in] Disk device instance ID
+ */
+static void win32_listener_device_added(RvtH_ListenForDevices *listener, const TCHAR *instance_id)
+{
+	DEVINST devInst;
+	Win32_CacheEntry *centry, **pp;
+	RvtH_QueryEntry *entry;
+
+	if (CM_Locate_DevNode(&devInst, (DEVINSTID)instance_id, CM_LOCATE_DEVNODE_NORMAL) != CR_SUCCESS)
+		return;
+	centry = win32_cache_entry_new(devInst, NULL);
+	if (!centry) {
+		// Not an RVT-H Reader.
+		return;
+	}
+
+	// Copy the entry for the callback before the cache takes ownership.
+	entry = rvth_query_entry_dup(centry->entry);
+
+	// Update the cache before calling the callback, since
+	// the callback may query the device list again.
+	STATIC_MUTEX_LOCK(s_cache_mutex);
+	if (s_cache_valid) {
+		for (pp = &s_cache_list; *pp != NULL; pp = &(*pp)->next) {
+			if (!_tcsicmp((*pp)->instance_id, centry->instance_id)) {
+				// Replace the existing entry.
+				Win32_CacheEntry *const old = *pp;
+				centry->next = old->next;
+				old->next = NULL;
+				win32_cache_free(old);
+				break;
+			}
+		}
+		*pp = centry;
+		centry = NULL;
+	}
+	STATIC_MUTEX_UNLOCK(s_cache_mutex);
+	win32_cache_free(centry);
+
+	if (entry) {
+		listener->callback(listener, entry, RVTH_LISTEN_CONNECTED, listener->userdata);
+		rvth_query_free(entry);
+	}
+}
+
+/**
+ * Handle a device removal notification.
+ * @param listener	[in] RvtH_ListenForDevices
+ * @param instance_id	[in] Disk device instance ID
+ */
+static void win32_listener_device_removed(RvtH_ListenForDevices *listener, const TCHAR *instance_id)
+{
+	Win32_CacheEntry *old = NULL, **pp;
+
+	// The device can't be opened anymore, so the
+	// device name has to be looked up in the cache.
+	STATIC_MUTEX_LOCK(s_cache_mutex);
+	for (pp = &s_cache_list; *pp != NULL; pp = &(*pp)->next) {
+		if (!_tcsicmp((*pp)->instance_id, instance_id)) {
+			old = *pp;
+			*pp = old->next;
+			old->next = NULL;
+			break;
+		}
+	}
+	STATIC_MUTEX_UNLOCK(s_cache_mutex);
+
+	if (old) {
+		RvtH_QueryEntry entry;
+		memset(&entry, 0, sizeof(entry));
+		entry.device_name = old->entry->device_name;
+		listener->callback(listener, &entry, RVTH_LISTEN_DISCONNECTED, listener->userdata);
+		win32_cache_free(old);
+	}
+}
+
+/**
+ * Window procedure for the listener window.
+ */
+static LRESULT CALLBACK win32_listener_wndproc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
+{
+	if (uMsg == WM_DEVICECHANGE) {
+		RvtH_ListenForDevices *const listener =
+			(RvtH_ListenForDevices*)GetWindowLongPtr(hWnd, GWLP_USERDATA);
+		const DEV_BROADCAST_HDR *const pHdr = (const DEV_BROADCAST_HDR*)lParam;
+		TCHAR s_instanceID[MAX_DEVICE_ID_LEN];
+
+		if (!listener || !pHdr || pHdr->dbch_devicetype != DBT_DEVTYP_DEVICEINTERFACE)
+			return TRUE;
+		if (wParam != DBT_DEVICEARRIVAL && wParam != DBT_DEVICEREMOVECOMPLETE)
+			return TRUE;
+		if (!interface_path_to_instance_id(s_instanceID, _countof(s_instanceID),
+		     ((const DEV_BROADCAST_DEVICEINTERFACE*)pHdr)->dbcc_name))
+		{
+			return TRUE;
+		}
+
+		if (wParam == DBT_DEVICEARRIVAL) {
+			win32_listener_device_added(listener, s_instanceID);
+		} else {
+			win32_listener_device_removed(listener, s_instanceID);
+		}
+		return TRUE;
+	}
+
+	return DefWindowProc(hWnd, uMsg, wParam, lParam);
+}
+
+/**
+ * Create the listener window in the current thread
+ * and register it for disk notifications.
+ * @param listener RvtH_ListenForDevices
+ * @return True on success; false on error.
+ */
+static bool win32_listener_create_window(RvtH_ListenForDevices *listener)
+{
+	const HINSTANCE hInstance = GetModuleHandle(NULL);
+	DEV_BROADCAST_DEVICEINTERFACE filter;
+	WNDCLASSEX wcex;
+
+	// NOTE: Registering the class again fails with
+	// ERROR_CLASS_ALREADY_EXISTS, which is fine.
+	memset(&wcex, 0, sizeof(wcex));
+	wcex.cbSize = sizeof(wcex);
+	wcex.lpfnWndProc = win32_listener_wndproc;
+	wcex.hInstance = hInstance;
+	wcex.lpszClassName = s_listener_class;
+	RegisterClassEx(&wcex);
+
+	listener->hWnd = CreateWindowEx(0, s_listener_class, NULL, 0,
+		0, 0, 0, 0, HWND_MESSAGE, NULL, hInstance, NULL);
+	if (!listener->hWnd)
+		return false;
+	SetWindowLongPtr(listener->hWnd, GWLP_USERDATA, (LONG_PTR)listener);
+
+	memset(&filter, 0, sizeof(filter));
+	filter.dbcc_size = sizeof(filter);
+	filter.dbcc_devicetype = DBT_DEVTYP_DEVICEINTERFACE;
+	filter.dbcc_classguid = GUID_DEVINTERFACE_DISK;
+	listener->hDevNotify = RegisterDeviceNotification(listener->hWnd,
+		&filter, DEVICE_NOTIFY_WINDOW_HANDLE);
+	if (!listener->hDevNotify) {
+		DestroyWindow(listener->hWnd);
+		listener->hWnd = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Destroy the listener window.
+ * This must be called from the thread that created it.
+ * @param listener RvtH_ListenForDevices
+ */
+static void win32_listener_destroy_window(RvtH_ListenForDevices *listener)
+{
+	if (listener->hDevNotify) {
+		UnregisterDeviceNotification(listener->hDevNotify);
+		listener->hDevNotify = NULL;
+	}
+	if (listener->hWnd) {
+		DestroyWindow(listener->hWnd);
+		listener->hWnd = NULL;
+	}
+}
+
+/**
+ * Register a new listener with the query cache.
+ * The cache is filled now, so removal notifications can
+ * be matched to devices that were already connected.
+ */
+static void win32_cache_acquire(void)
+{
+	bool need_scan;
+
+	STATIC_MUTEX_LOCK(s_cache_mutex);
+	s_cache_listeners++;
+	need_scan = !s_cache_valid;
+	STATIC_MUTEX_UNLOCK(s_cache_mutex);
+
+	if (need_scan) {
+		int err = 0;
+		Win32_CacheEntry *scan_list = win32_scan_devices(&err);
+		if (err == 0) {
+			STATIC_MUTEX_LOCK(s_cache_mutex);
+			if (s_cache_listeners > 0 && !s_cache_valid) {
+				s_cache_list = scan_list;
+				s_cache_valid = true;
+				scan_list = NULL;
+			}
+			STATIC_MUTEX_UNLOCK(s_cache_mutex);
+		}
+		win32_cache_free(scan_list);
+	}
+}
+
+/**
+ * Main function for the listener thread.
+ * @param listener_arg RvtH_ListenForDevices
+ */
+static unsigned int __stdcall win32_listener_thread(void *listener_arg)
+{
+	RvtH_ListenForDevices *const listener = (RvtH_ListenForDevices*)listener_arg;
+	MSG msg;
+
+	listener->init_ok = win32_listener_create_window(listener);
+	SetEvent(listener->hReadyEvent);
+	if (!listener->init_ok) {
+		return 1;
+	}
+
+	// Run the message loop until rvth_listener_stop() posts WM_QUIT.
+	while (GetMessage(&msg, NULL, 0, 0) > 0) {
+		TranslateMessage(&msg);
+		DispatchMessage(&msg);
+	}
+
+	win32_listener_destroy_window(listener);
+	CloseHandle(listener->hThread);
+	free(listener);
+	return 0;
+}
 
 /**
  * Listen for new and/or removed devices.
@@ -606,9 +1123,128 @@ TCHAR *rvth_get_device_serial_number(const TCHAR *filename, int *pErr)
  */
 RvtH_ListenForDevices *rvth_listen_for_devices(RvtH_DeviceCallback callback, void *userdata)
 {
-	((void)callback);
-	((void)userdata);
-	return NULL;
+	RvtH_ListenForDevices *listener;
+	unsigned int threadId;
+
+	assert(callback != NULL);
+	if (!callback) {
+		// No point in listening with no callback.
+		return NULL;
+	}
+
+	listener = calloc(1, sizeof(*listener));
+	if (!listener) {
+		return NULL;
+	}
+	listener->callback = callback;
+	listener->userdata = userdata;
+	listener->hReadyEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (!listener->hReadyEvent) {
+		free(listener);
+		return NULL;
+	}
+
+	win32_cache_acquire();
+
+	// Create the thread and wait for it to create its window.
+	listener->hThread = (HANDLE)_beginthreadex(NULL, 0, win32_listener_thread, listener, 0, &threadId);
+	if (!listener->hThread) {
+		win32_cache_release();
+		CloseHandle(listener->hReadyEvent);
+		free(listener);
+		return NULL;
+	}
+	listener->dwThreadId = threadId;
+	WaitForSingleObject(listener->hReadyEvent, INFINITE);
+	CloseHandle(listener->hReadyEvent);
+	listener->hReadyEvent = NULL;
+
+	if (!listener->init_ok) {
+		// The thread exited without creating its window.
+		win32_cache_release();
+		WaitForSingleObject(listener->hThread, INFINITE);
+		CloseHandle(listener->hThread);
+		free(listener);
+		return NULL;
+	}
+
+	// Thread is listening.
+	return listener;
+}
+
+/**
+ * Listen for new and/or removed devices without a separate thread.
+ * The notifications are delivered by the calling thread's message loop.
+ * @param callback Callback function
+ * @param userdata User data
+ * @return Listener object, or NULL on error.
+ */
+RvtH_ListenForDevices *rvth_listen_for_devices_fd(RvtH_DeviceCallback callback, void *userdata)
+{
+	RvtH_ListenForDevices *listener;
+
+	assert(callback != NULL);
+	if (!callback) {
+		// No point in listening with no callback.
+		return NULL;
+	}
+
+	listener = calloc(1, sizeof(*listener));
+	if (!listener) {
+		return NULL;
+	}
+	listener->callback = callback;
+	listener->userdata = userdata;
+
+	win32_cache_acquire();
+	if (!win32_listener_create_window(listener)) {
+		win32_cache_release();
+		free(listener);
+		return NULL;
+	}
+
+	return listener;
+}
+
+/**
+ * Get the file descriptor to watch for an event-loop listener.
+ * @param listener RvtH_ListenForDevices
+ * @return File descriptor, or -1 if not available.
+ */
+int rvth_listener_get_fd(const RvtH_ListenForDevices *listener)
+{
+	// Notifications are delivered by the thread's message loop.
+	((void)listener);
+	return -1;
+}
+
+/**
+ * Process pending events for an event-loop listener.
+ * This doesn't block. The callback function is called
+ * from the current thread.
+ *
+ * NOTE: This is only needed if the thread doesn't run
+ * a message loop.
+ *
+ * @param listener RvtH_ListenForDevices
+ * @return Number of events processed, or negative POSIX error code on error.
+ */
+int rvth_listener_process_events(RvtH_ListenForDevices *listener)
+{
+	MSG msg;
+	int count = 0;
+
+	if (listener->hThread) {
+		// The thread processes the events.
+		return -EINVAL;
+	}
+
+	while (PeekMessage(&msg, listener->hWnd, 0, 0, PM_REMOVE)) {
+		TranslateMessage(&msg);
+		DispatchMessage(&msg);
+		count++;
+	}
+	return count;
 }
 
 /**
@@ -617,5 +1253,15 @@ RvtH_ListenForDevices *rvth_listen_for_devices(RvtH_DeviceCallback callback, voi
  */
 void rvth_listener_stop(RvtH_ListenForDevices *listener)
 {
-	((void)listener);
+	win32_cache_release();
+
+	if (listener->hThread) {
+		// The thread frees the listener when it exits.
+		PostThreadMessage(listener->dwThreadId, WM_QUIT, 0, 0);
+		return;
+	}
+
+	// No thread, so the listener can be freed now.
+	win32_listener_destroy_window(listener);
+	free(listener);
 }
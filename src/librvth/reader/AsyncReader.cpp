@@ -0,0 +1,837 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * AsyncReader.cpp: Asynchronous reads with multiple requests in flight.   *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "config.librvth.h"
+
+#include "AsyncReader.hpp"
+#include "StatsCounters.hpp"
+
+// For LBA_TO_BYTES()
+#include "nhcd_structs.h"
+
+// C includes (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+#if defined(HAVE_IO_URING)
+#  include <linux/io_uring.h>
+#  include <sched.h>
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#  define HAVE_ASYNC_RING 1
+#elif defined(_WIN32)
+#  include <windows.h>
+#  define HAVE_ASYNC_RING 1
+#endif
+
+// Cached data is dropped in multiples of this alignment. (8 MB)
+static constexpr off64_t DROP_ALIGNMENT = 8U*1024U*1024U;
+
+#ifdef HAVE_ASYNC_RING
+// user_data for completions that don't belong to a request.
+static constexpr uint64_t RING_NOP_TAG = ~static_cast<uint64_t>(0);
+#endif /* HAVE_ASYNC_RING */
+
+#if defined(HAVE_IO_URING)
+
+static inline int sys_io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+}
+
+static inline int sys_io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags)
+{
+	return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+/**
+ * io_uring state.
+ * The liburing helpers aren't used, since liburing might not be
+ * installed; only the kernel interface in <linux/io_uring.h> is needed.
+ */
+struct AsyncReader::Ring {
+	int ring_fd = -1;		// io_uring file descriptor
+	int fd = -1;			// Disc image file descriptor
+	int fd_direct = -1;		// Disc image file descriptor for direct I/O, or -1
+	unsigned int direct_align = 0;	// Direct I/O alignment
+
+	void *sq_ptr = MAP_FAILED;	// Submission queue ring
+	size_t sq_size = 0;
+	void *cq_ptr = MAP_FAILED;	// Completion queue ring (may be the same mapping as sq_ptr)
+	size_t cq_size = 0;
+	struct io_uring_sqe *sqes = static_cast<struct io_uring_sqe*>(MAP_FAILED);
+	size_t sqes_size = 0;
+
+	unsigned int *sq_tail = nullptr;
+	unsigned int *sq_mask = nullptr;
+	unsigned int *sq_array = nullptr;
+	unsigned int *cq_head = nullptr;
+	unsigned int *cq_tail = nullptr;
+	unsigned int *cq_mask = nullptr;
+	struct io_uring_cqe *cqes = nullptr;
+
+	unsigned int inflight = 0;	// Reads submitted to the kernel without a completion
+	bool sync_only = false;		// Read synchronously (IORING_OP_READ isn't supported, or submission failed)
+	uint16_t ioprio = 0;		// ioprio for submitted reads (0 for the default priority)
+
+	~Ring()
+	{
+		if (sqes != MAP_FAILED) {
+			munmap(sqes, sqes_size);
+		}
+		if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr) {
+			munmap(cq_ptr, cq_size);
+		}
+		if (sq_ptr != MAP_FAILED) {
+			munmap(sq_ptr, sq_size);
+		}
+		if (ring_fd >= 0) {
+			close(ring_fd);
+		}
+		if (fd_direct >= 0) {
+			close(fd_direct);
+		}
+		if (fd >= 0) {
+			close(fd);
+		}
+	}
+
+	/**
+	 * Initialize the ring.
+	 * @param file		[in] Disc image file
+	 * @param entries	[in] Number of submission queue entries
+	 * @return True on success; false on error.
+	 */
+	bool init(RefFile *file, unsigned int entries)
+	{
+		fd = file->dupFd(false);
+		if (fd < 0) {
+			return false;
+		}
+		if (file->isDirectIO()) {
+			fd_direct = file->dupFd(true);
+			if (fd_direct >= 0) {
+				direct_align = file->directIOAlignment();
+			}
+		}
+
+		struct io_uring_params p;
+		memset(&p, 0, sizeof(p));
+		ring_fd = sys_io_uring_setup(entries, &p);
+		if (ring_fd < 0) {
+			// io_uring isn't available. (old kernel, or blocked by seccomp)
+			return false;
+		}
+
+		sq_size = p.sq_off.array + (p.sq_entries * sizeof(unsigned int));
+		cq_size = p.cq_off.cqes + (p.cq_entries * sizeof(struct io_uring_cqe));
+		const bool single_mmap = !!(p.features & IORING_FEAT_SINGLE_MMAP);
+		if (single_mmap) {
+			if (cq_size > sq_size) {
+				sq_size = cq_size;
+			}
+			cq_size = sq_size;
+		}
+
+		sq_ptr = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+		if (sq_ptr == MAP_FAILED) {
+			return false;
+		}
+		if (single_mmap) {
+			cq_ptr = sq_ptr;
+		} else {
+			cq_ptr = mmap(nullptr, cq_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+			if (cq_ptr == MAP_FAILED) {
+				return false;
+			}
+		}
+		sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+		sqes = static_cast<struct io_uring_sqe*>(mmap(nullptr, sqes_size,
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES));
+		if (sqes == MAP_FAILED) {
+			return false;
+		}
+
+		uint8_t *const sq8 = static_cast<uint8_t*>(sq_ptr);
+		uint8_t *const cq8 = static_cast<uint8_t*>(cq_ptr);
+		sq_tail = reinterpret_cast<unsigned int*>(sq8 + p.sq_off.tail);
+		sq_mask = reinterpret_cast<unsigned int*>(sq8 + p.sq_off.ring_mask);
+		sq_array = reinterpret_cast<unsigned int*>(sq8 + p.sq_off.array);
+		cq_head = reinterpret_cast<unsigned int*>(cq8 + p.cq_off.head);
+		cq_tail = reinterpret_cast<unsigned int*>(cq8 + p.cq_off.tail);
+		cq_mask = reinterpret_cast<unsigned int*>(cq8 + p.cq_off.ring_mask);
+		cqes = reinterpret_cast<struct io_uring_cqe*>(cq8 + p.cq_off.cqes);
+		return true;
+	}
+
+	/**
+	 * Submit a read.
+	 * @param direct	[in] If true, use direct I/O.
+	 * @param buf		[out] Read buffer
+	 * @param size		[in] Number of bytes to read
+	 * @param offset	[in] File offset
+	 * @param user_data	[in] User data for the completion
+	 * @return True on success; false on error.
+	 */
+	bool submitRead(bool direct, void *buf, uint32_t size, off64_t offset, uint64_t user_data)
+	{
+		// NOTE: This thread is the only producer, so the
+		// tail doesn't need to be loaded atomically.
+		const unsigned int tail = *sq_tail;
+		const unsigned int idx = tail & *sq_mask;
+		struct io_uring_sqe *const sqe = &sqes[idx];
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = IORING_OP_READ;
+		sqe->fd = (direct ? fd_direct : fd);
+		sqe->addr = reinterpret_cast<uintptr_t>(buf);
+		sqe->len = size;
+		sqe->off = static_cast<uint64_t>(offset);
+		sqe->ioprio = ioprio;
+		sqe->user_data = user_data;
+		sq_array[idx] = idx;
+		__atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+		int ret;
+		do {
+			ret = sys_io_uring_enter(ring_fd, 1, 0, 0);
+			if (ret < 0 && (errno == EAGAIN || errno == EBUSY)) {
+				// Kernel resources are temporarily unavailable.
+				sched_yield();
+				continue;
+			}
+		} while (ret < 0 && (errno == EINTR || errno == EAGAIN || errno == EBUSY));
+
+		if (ret < 1) {
+			// The SQE wasn't consumed. Turn it into a NOP so it
+			// doesn't read into the buffer if it's submitted later,
+			// and don't submit anything else, since the next
+			// submission would consume this SQE instead.
+			sqe->opcode = IORING_OP_NOP;
+			sqe->user_data = RING_NOP_TAG;
+			sync_only = true;
+			return false;
+		}
+		inflight++;
+		return true;
+	}
+
+	/**
+	 * Wait for a completion.
+	 * @param pUserData	[out] User data
+	 * @param pRes		[out] Result
+	 * @return True on success; false on error.
+	 */
+	bool waitCqe(uint64_t *pUserData, int *pRes)
+	{
+		// NOTE: This thread is the only consumer, so the
+		// head doesn't need to be loaded atomically.
+		const unsigned int head = *cq_head;
+		while (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+			const int ret = sys_io_uring_enter(ring_fd, 0, 1, IORING_ENTER_GETEVENTS);
+			if (ret < 0 && errno != EINTR) {
+				return false;
+			}
+		}
+
+		const struct io_uring_cqe *const cqe = &cqes[head & *cq_mask];
+		*pUserData = cqe->user_data;
+		*pRes = cqe->res;
+		__atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+		if (*pUserData != RING_NOP_TAG) {
+			assert(inflight > 0);
+			inflight--;
+		}
+		return true;
+	}
+};
+#elif defined(_WIN32)
+/**
+ * Overlapped I/O state.
+ * The file is opened again with FILE_FLAG_OVERLAPPED, and
+ * completions are received from an I/O completion port.
+ */
+struct AsyncReader::Ring {
+	HANDLE hFile = INVALID_HANDLE_VALUE;	// Disc image file
+	HANDLE hDirect = INVALID_HANDLE_VALUE;	// Disc image file for direct I/O (FILE_FLAG_NO_BUFFERING)
+	HANDLE hPort = nullptr;			// I/O completion port
+	unsigned int direct_align = 0;		// Direct I/O alignment
+	std::vector<OVERLAPPED> ovs;		// One OVERLAPPED per request
+
+	unsigned int inflight = 0;	// Reads submitted to the system without a completion
+	bool sync_only = false;		// Read synchronously (submission failed)
+
+	~Ring()
+	{
+		if (hDirect != INVALID_HANDLE_VALUE) {
+			CloseHandle(hDirect);
+		}
+		if (hFile != INVALID_HANDLE_VALUE) {
+			CloseHandle(hFile);
+		}
+		if (hPort) {
+			CloseHandle(hPort);
+		}
+	}
+
+	/**
+	 * Initialize the completion port.
+	 * @param file		[in] Disc image file
+	 * @param entries	[in] Maximum number of reads in flight
+	 * @return True on success; false on error.
+	 */
+	bool init(RefFile *file, unsigned int entries)
+	{
+		// NOTE: File handles can't be switched to overlapped mode
+		// after they're opened, so the file is opened again.
+		// The reads are a sequential scan, so the cache manager
+		// is told to read ahead. (See RefFile::beginScan().)
+		hFile = CreateFile(file->filename(), GENERIC_READ,
+			FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+			OPEN_EXISTING, FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (hFile == INVALID_HANDLE_VALUE) {
+			return false;
+		}
+		hPort = CreateIoCompletionPort(hFile, nullptr, 0, 1);
+		if (!hPort) {
+			return false;
+		}
+
+		if (file->isDirectIO()) {
+			hDirect = CreateFile(file->filename(), GENERIC_READ,
+				FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+				OPEN_EXISTING, FILE_FLAG_OVERLAPPED | FILE_FLAG_NO_BUFFERING, nullptr);
+			if (hDirect != INVALID_HANDLE_VALUE) {
+				if (CreateIoCompletionPort(hDirect, hPort, 0, 0) == hPort) {
+					direct_align = file->directIOAlignment();
+				} else {
+					CloseHandle(hDirect);
+					hDirect = INVALID_HANDLE_VALUE;
+				}
+			}
+		}
+
+		ovs.resize(entries);
+		return true;
+	}
+
+	/**
+	 * Submit a read.
+	 * @param direct	[in] If true, use direct I/O.
+	 * @param buf		[out] Read buffer
+	 * @param size		[in] Number of bytes to read
+	 * @param offset	[in] File offset
+	 * @param user_data	[in] User data for the completion (request index)
+	 * @return True on success; false on error.
+	 */
+	bool submitRead(bool direct, void *buf, uint32_t size, off64_t offset, uint64_t user_data)
+	{
+		assert(user_data < ovs.size());
+		OVERLAPPED *const ov = &ovs[static_cast<size_t>(user_data)];
+		memset(ov, 0, sizeof(*ov));
+		const uint64_t pos = static_cast<uint64_t>(offset);
+		ov->Offset = static_cast<DWORD>(pos);
+		ov->OffsetHigh = static_cast<DWORD>(pos >> 32);
+
+		// NOTE: A completion packet is queued even if
+		// ReadFile() finishes synchronously.
+		if (!ReadFile(direct ? hDirect : hFile, buf, size, nullptr, ov)) {
+			const DWORD dwErr = GetLastError();
+			if (dwErr != ERROR_IO_PENDING) {
+				// Could not submit the read.
+				return false;
+			}
+		}
+		inflight++;
+		return true;
+	}
+
+	/**
+	 * Wait for a completion.
+	 * @param pUserData	[out] User data (request index)
+	 * @param pRes		[out] Result (number of bytes read, or negative POSIX error code)
+	 * @return True on success; false on error.
+	 */
+	bool waitCqe(uint64_t *pUserData, int *pRes)
+	{
+		DWORD dwRead = 0;
+		ULONG_PTR key = 0;
+		OVERLAPPED *ov = nullptr;
+		const BOOL bRet = GetQueuedCompletionStatus(hPort, &dwRead, &key, &ov, INFINITE);
+		if (!ov) {
+			// Wait failed.
+			return false;
+		}
+
+		*pUserData = static_cast<uint64_t>(ov - ovs.data());
+		if (bRet) {
+			*pRes = static_cast<int>(dwRead);
+		} else {
+			// Read failed. End of file is handled as a short read.
+			*pRes = (GetLastError() == ERROR_HANDLE_EOF) ? 0 : -EIO;
+		}
+		assert(inflight > 0);
+		inflight--;
+		return true;
+	}
+};
+#else /* !HAVE_ASYNC_RING */
+struct AsyncReader::Ring { };
+#endif
+
+/**
+ * Create an asynchronous reader.
+ * @param reader	[in] Reader
+ * @param depth		[in] Maximum number of reads in flight. (minimum 1)
+ */
+AsyncReader::AsyncReader(Reader *reader, unsigned int depth)
+	: m_reader(reader)
+	, m_pendingTags(0)
+	, m_pending(0)
+	, m_scanOffset(-1)
+	, m_ring(nullptr)
+{
+	assert(reader != nullptr);
+	if (depth < 1) {
+		depth = 1;
+	}
+	m_reqs.resize(depth);
+	m_freeReqs.reserve(depth);
+	m_syncReqs.reserve(depth);
+	m_syncRanges.reserve(depth);
+	for (unsigned int i = depth; i > 0; i--) {
+		m_freeReqs.push_back(i - 1);
+	}
+
+	// Reads are usually sequential through the whole image, and the
+	// data isn't needed again after it's been read, so tell the OS.
+	// NOTE: This is only done if the image is stored contiguously,
+	// since the file offsets aren't known otherwise.
+	off64_t offset;
+	if (!reader->fileOffset(0, reader->lba_len(), &offset)) {
+		return;
+	}
+	m_scanOffset = offset;
+	reader->file()->beginScan(m_scanOffset, LBA_TO_BYTES(reader->lba_len()));
+
+#ifdef HAVE_ASYNC_RING
+	// Asynchronous reads can only be used if the data
+	// can be read directly from the file.
+
+	Ring *const ring = new Ring();
+	if (!ring->init(reader->file(), depth)) {
+		// Use synchronous reads.
+		delete ring;
+		return;
+	}
+	m_ring = ring;
+#endif /* HAVE_ASYNC_RING */
+}
+
+AsyncReader::~AsyncReader()
+{
+#ifdef HAVE_ASYNC_RING
+	if (m_ring) {
+		// Wait for the reads that are still in flight,
+		// since the kernel is writing to their buffers.
+		while (m_ring->inflight > 0) {
+			uint64_t user_data;
+			int res;
+			if (!m_ring->waitCqe(&user_data, &res)) {
+				// Should not happen... Closing the ring
+				// cancels the remaining reads.
+				break;
+			}
+		}
+		delete m_ring;
+	}
+#endif /* HAVE_ASYNC_RING */
+
+	if (m_scanOffset >= 0) {
+		m_reader->file()->endScan(m_scanOffset, LBA_TO_BYTES(m_reader->lba_len()));
+	}
+}
+
+/**
+ * Read the rest of a request synchronously.
+ * If the read fails, the error is recorded in the request.
+ * @param req Request
+ */
+void AsyncReader::readSync(Request &req)
+{
+	if (req.lba_done < req.lba_len) {
+		errno = 0;
+		req.lba_done += m_reader->read(req.buf + LBA_TO_BYTES(req.lba_done),
+			req.lba_start + req.lba_done, req.lba_len - req.lba_done);
+		if (req.lba_done < req.lba_len && errno != 0) {
+			req.err = -errno;
+		}
+	}
+}
+
+/**
+ * Read the requests in m_syncReqs as one batch.
+ * (See Reader::readv().)
+ */
+void AsyncReader::readSyncBatch(void)
+{
+	const unsigned int count = static_cast<unsigned int>(m_syncReqs.size());
+	m_syncRanges.resize(count);
+	for (unsigned int i = 0; i < count; i++) {
+		const Request &req = m_reqs[m_syncReqs[i]];
+		Reader::ReadRange &range = m_syncRanges[i];
+		range.ptr = req.buf;
+		range.lba_start = req.lba_start;
+		range.lba_len = req.lba_len;
+		range.lba_read = 0;
+	}
+
+	// NOTE: readv() doesn't report errors per range, so the
+	// last error is used for all ranges that weren't read.
+	errno = 0;
+	m_reader->readv(m_syncRanges.data(), count);
+	const int err = errno;
+
+	for (unsigned int i = 0; i < count; i++) {
+		const unsigned int idx = m_syncReqs[i];
+		Request &req = m_reqs[idx];
+		req.lba_done = m_syncRanges[i].lba_read;
+		if (req.lba_done < req.lba_len && err != 0) {
+			req.err = -err;
+		}
+		finishRequest(idx);
+	}
+	m_syncReqs.clear();
+}
+
+/**
+ * Finish a request.
+ * The request is added to the completion queue, and cached data
+ * for the range that was read is dropped.
+ * @param idx Request index
+ */
+void AsyncReader::finishRequest(unsigned int idx)
+{
+	Request &req = m_reqs[idx];
+	off64_t offset;
+	if (m_scanOffset >= 0 && req.lba_done > 0 &&
+	    m_reader->fileOffset(req.lba_start, req.lba_done, &offset))
+	{
+		// The OS may cache the file using large pages that are bigger
+		// than a request, and those pages are only dropped if they're
+		// entirely within the range. Round the range down to the
+		// drop alignment; the rest is dropped with the next request.
+		// NOTE: Pages that are still being read are skipped by the OS.
+		const off64_t scan_end = m_scanOffset + LBA_TO_BYTES(m_reader->lba_len());
+		off64_t drop_start = offset & ~(DROP_ALIGNMENT - 1);
+		off64_t drop_end = offset + LBA_TO_BYTES(req.lba_done);
+		if (drop_end < scan_end) {
+			drop_end &= ~(DROP_ALIGNMENT - 1);
+		}
+		if (drop_start < m_scanOffset) {
+			drop_start = m_scanOffset;
+		}
+		if (drop_end > drop_start) {
+			m_reader->file()->dropCache(drop_start, drop_end - drop_start);
+		}
+	}
+
+	if (req.lba_done < req.lba_len && req.err == 0) {
+		// Short read, e.g. past the end of the file.
+		req.err = -EIO;
+	}
+	m_done.push_back({req.tag, req.lba_done, req.err, std::move(req.callback)});
+	req.callback = nullptr;
+	m_freeReqs.push_back(idx);
+}
+
+/**
+ * Submit the rest of a request to the ring.
+ * If it can't be submitted, it's read synchronously.
+ * @param idx Request index
+ * @return True if submitted; false if it was read synchronously.
+ */
+bool AsyncReader::submitToRing(unsigned int idx)
+{
+	Request &req = m_reqs[idx];
+#ifdef HAVE_ASYNC_RING
+	off64_t offset;
+	const uint32_t lba_left = req.lba_len - req.lba_done;
+	if (!m_ring->sync_only &&
+	    m_reader->fileOffset(req.lba_start + req.lba_done, lba_left, &offset))
+	{
+		uint8_t *const buf = req.buf + LBA_TO_BYTES(req.lba_done);
+		const uint32_t size = static_cast<uint32_t>(LBA_TO_BYTES(lba_left));
+
+		// Use direct I/O if the read is aligned. (See RefFile::pread().)
+		const unsigned int align = m_ring->direct_align;
+		const bool direct = (align != 0 &&
+			(reinterpret_cast<uintptr_t>(buf) % align) == 0 &&
+			(size % align) == 0 &&
+			(static_cast<uint64_t>(offset) % align) == 0);
+
+		// Apply the operation's I/O priority and bandwidth limit.
+		StatsCounters::throttleIO(size);
+#if defined(HAVE_IO_URING)
+		// The priority is set on each read, since io_uring's worker threads
+		// don't follow changes to the submitting thread's priority.
+		StatsCounters *const stats = StatsCounters::current();
+		m_ring->ioprio = (stats ? IoThrottle::linuxIoprio(stats->ioThrottle()->priority()) : 0);
+#endif /* HAVE_IO_URING */
+
+		req.latency_stats = StatsCounters::currentForLatency();
+		if (req.latency_stats) {
+			req.latency_offset = offset;
+			req.latency_size = size;
+			req.submit_time = std::chrono::steady_clock::now();
+		}
+		if (m_ring->submitRead(direct, buf, size, offset, idx)) {
+			return true;
+		}
+		req.latency_stats = nullptr;
+	}
+#endif /* HAVE_ASYNC_RING */
+
+	// Read synchronously.
+	readSync(req);
+	finishRequest(idx);
+	return false;
+}
+
+/**
+ * Submit a read.
+ * If depth() reads are already pending, wait() must be called first.
+ * @param buf		[out] Read buffer. (Must remain valid until the read is returned by wait().)
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @param tag		[in] Caller-defined tag, returned by wait().
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int AsyncReader::submit(void *buf, uint32_t lba_start, uint32_t lba_len, uintptr_t tag)
+{
+	return submit_int(buf, lba_start, lba_len, tag, Callback());
+}
+
+/**
+ * Submit a read with a completion callback.
+ * If depth() reads are already pending, wait() or run() must be called first.
+ * @param buf		[out] Read buffer. (Must remain valid until the callback is invoked.)
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @param callback	[in] Callback, invoked by wait() or run() when the read finishes.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int AsyncReader::submit(void *buf, uint32_t lba_start, uint32_t lba_len, Callback callback)
+{
+	assert(callback != nullptr);
+	if (!callback) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+	return submit_int(buf, lba_start, lba_len, 0, std::move(callback));
+}
+
+/**
+ * Submit a read. (internal function)
+ * @param buf		[out] Read buffer.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @param tag		[in] Caller-defined tag.
+ * @param callback	[in] Completion callback, or empty if the tag is used.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int AsyncReader::submit_int(void *buf, uint32_t lba_start, uint32_t lba_len, uintptr_t tag, Callback &&callback)
+{
+	assert(!m_freeReqs.empty());
+	if (m_freeReqs.empty()) {
+		// Too many reads are pending.
+		errno = EBUSY;
+		return -EBUSY;
+	}
+
+	const unsigned int idx = m_freeReqs.back();
+	m_freeReqs.pop_back();
+	Request &req = m_reqs[idx];
+	req.buf = static_cast<uint8_t*>(buf);
+	req.lba_start = lba_start;
+	req.lba_len = lba_len;
+	req.lba_done = 0;
+	req.err = 0;
+	req.tag = tag;
+	req.callback = std::move(callback);
+	req.latency_stats = nullptr;
+	m_pending++;
+	if (!req.callback) {
+		m_pendingTags++;
+	}
+
+	if (StatsCounters::cancelled()) {
+		// Operation was cancelled. Return the read as failed.
+		req.err = -ECANCELED;
+		finishRequest(idx);
+	} else if (m_ring) {
+		submitToRing(idx);
+	} else {
+		// Read synchronously when wait() is called,
+		// together with the other reads submitted until then.
+		m_syncReqs.push_back(idx);
+	}
+	return 0;
+}
+
+/**
+ * Wait for a read that was submitted with a tag to finish.
+ * Reads may finish in any order. Callbacks of reads that
+ * finish in the meantime are invoked.
+ * @param pTag		[out] Tag of the finished read.
+ * @param pLbaRead	[out] Number of LBAs read. (If less than requested, the read failed.)
+ * @param pErr		[out,opt] Read error. (negative POSIX error code; 0 if the read succeeded)
+ * @return 0 on success; -ENOENT if no reads with a tag are pending.
+ */
+int AsyncReader::wait(uintptr_t *pTag, uint32_t *pLbaRead, int *pErr)
+{
+	while (m_pendingTags > 0) {
+		Completion c;
+		const int ret = wait_int(&c);
+		if (ret != 0) {
+			return ret;
+		}
+		if (c.callback) {
+			if (c.err != 0) {
+				errno = -c.err;
+			}
+			c.callback(c.lba_read);
+			continue;
+		}
+
+		m_pendingTags--;
+		*pTag = c.tag;
+		*pLbaRead = c.lba_read;
+		if (pErr) {
+			*pErr = c.err;
+		}
+		return 0;
+	}
+	return -ENOENT;
+}
+
+/**
+ * Wait for all pending reads to finish, invoking their callbacks.
+ * Reads that are submitted by the callbacks are also waited for.
+ * Reads that were submitted with a tag are discarded.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int AsyncReader::run(void)
+{
+	while (m_pending > 0) {
+		Completion c;
+		const int ret = wait_int(&c);
+		if (ret != 0) {
+			return ret;
+		}
+		if (c.callback) {
+			if (c.err != 0) {
+				errno = -c.err;
+			}
+			c.callback(c.lba_read);
+		} else {
+			m_pendingTags--;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Wait for the next read to finish. (internal function)
+ * @param pCompletion	[out] Completion.
+ * @return 0 on success; -ENOENT if no reads are pending.
+ */
+int AsyncReader::wait_int(Completion *pCompletion)
+{
+	if (m_pending == 0) {
+		return -ENOENT;
+	}
+	if (m_done.empty() && !m_syncReqs.empty()) {
+		readSyncBatch();
+	}
+
+#ifdef HAVE_ASYNC_RING
+	while (m_done.empty()) {
+		// Reads are pending, but none of them have finished yet,
+		// so they must be in flight on the ring.
+		assert(m_ring != nullptr && m_ring->inflight > 0);
+		uint64_t user_data;
+		int res;
+		bool bRet;
+		{
+			StatsTimer timer(StatsCounters::TIMER_IO);
+			bRet = m_ring->waitCqe(&user_data, &res);
+		}
+		if (!bRet) {
+			// Should not happen...
+			return -EIO;
+		}
+		if (user_data == RING_NOP_TAG) {
+			// Cancelled SQE.
+			continue;
+		}
+
+		const unsigned int idx = static_cast<unsigned int>(user_data);
+		assert(idx < m_reqs.size());
+		Request &req = m_reqs[idx];
+		if (req.latency_stats) {
+			// NOTE: This includes the time the read was queued.
+			const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - req.submit_time).count();
+			req.latency_stats->addReadLatency(req.latency_offset, req.latency_size,
+				static_cast<uint64_t>(ns));
+			req.latency_stats = nullptr;
+		}
+		if (res > 0) {
+			// NOTE: Reads on the ring are submitted out of order,
+			// so they aren't counted as seeks.
+			StatsCounters::addIO(static_cast<uint64_t>(res), false, false);
+			// NOTE: A partial LBA can only be read at the end of the file.
+			const uint32_t lba_read = static_cast<uint32_t>(res) / LBA_SIZE;
+			req.lba_done += lba_read;
+			if (req.lba_done < req.lba_len && lba_read > 0 && (res % LBA_SIZE) == 0) {
+				// Short read. Submit the rest of the request.
+				// If it's read synchronously instead, it's
+				// added to m_done by submitToRing().
+				submitToRing(idx);
+				continue;
+			}
+		} else if (res < 0) {
+			if (res == -EINVAL || res == -EOPNOTSUPP) {
+				// IORING_OP_READ isn't supported by this kernel. (added in 5.6)
+				// NOTE: On Windows, errors are always -EIO.
+				m_ring->sync_only = true;
+			}
+			// Retry synchronously. This also handles transient errors.
+			// If the read fails again without an errno, use the
+			// error from the ring.
+			readSync(req);
+			if (req.lba_done < req.lba_len && req.err == 0) {
+				req.err = res;
+			}
+		}
+
+		// Request is finished.
+		finishRequest(idx);
+	}
+#endif /* HAVE_ASYNC_RING */
+
+	assert(!m_done.empty());
+	*pCompletion = std::move(m_done.front());
+	m_done.pop_front();
+	m_pending--;
+	return 0;
+}
@@ -0,0 +1,233 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * AsyncReader.hpp: Asynchronous reads with multiple requests in flight.   *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_READER_ASYNCREADER_HPP__
+#define __RVTHTOOL_LIBRVTH_READER_ASYNCREADER_HPP__
+
+#include "Reader.hpp"
+
+// C++ includes
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <vector>
+
+class StatsCounters;
+
+/**
+ * Asynchronous reads with multiple requests in flight.
+ *
+ * On Linux, reads are submitted to an io_uring, so the device can
+ * work on several requests at once. (USB mass storage bridges and
+ * NVMe both benefit from a queue depth greater than 1.)
+ * On Windows, overlapped ReadFile() requests are used, and completions
+ * are received from an I/O completion port.
+ *
+ * If neither is available, or if the Reader doesn't store the
+ * data contiguously in the file (CISO, WBFS), reads are done
+ * synchronously when wait() is called. All reads that were submitted
+ * since the last wait() are read as one batch using Reader::readv(),
+ * so adjacent reads are merged into a single system call.
+ *
+ * The reads are expected to be a sequential scan of the Reader, so the
+ * OS is told to read ahead, and cached data is dropped after it's read.
+ * (See RefFile::beginScan().)
+ *
+ * Reads can be submitted with a tag, which is returned by wait(), or
+ * with a callback, which is invoked by wait() or run() when the read
+ * finishes. Callbacks may submit more reads, so a sequence of dependent
+ * reads can be written as a chain of callbacks, and a single thread can
+ * keep several such chains in flight.
+ *
+ * The Reader may be used by other threads while reads are in flight,
+ * but this object must only be used by a single thread.
+ * All reads must be completed before the buffers are freed;
+ * the destructor waits for any reads that are still in flight.
+ */
+class AsyncReader
+{
+	public:
+		/**
+		 * Create an asynchronous reader.
+		 * @param reader	[in] Reader
+		 * @param depth		[in] Maximum number of reads in flight. (minimum 1)
+		 */
+		AsyncReader(Reader *reader, unsigned int depth);
+		~AsyncReader();
+
+	private:
+		DISABLE_COPY(AsyncReader)
+
+	public:
+		/**
+		 * Are reads submitted asynchronously? (io_uring or overlapped I/O)
+		 * @return True if reads are asynchronous; false if they're synchronous.
+		 */
+		inline bool isAsync(void) const
+		{
+			return (m_ring != nullptr);
+		}
+
+		/**
+		 * Get the maximum number of reads in flight.
+		 * @return Queue depth.
+		 */
+		inline unsigned int depth(void) const
+		{
+			return static_cast<unsigned int>(m_reqs.size());
+		}
+
+		/**
+		 * Get the number of reads that haven't been returned by wait() yet.
+		 * @return Number of pending reads.
+		 */
+		inline unsigned int pending(void) const
+		{
+			return m_pending;
+		}
+
+		/**
+		 * Submit a read.
+		 * If depth() reads are already pending, wait() must be called first.
+		 * @param buf		[out] Read buffer. (Must remain valid until the read is returned by wait().)
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @param tag		[in] Caller-defined tag, returned by wait().
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int submit(void *buf, uint32_t lba_start, uint32_t lba_len, uintptr_t tag);
+
+		/**
+		 * Read completion callback.
+		 * The read's slot is freed before the callback is invoked,
+		 * so the callback can submit another read.
+		 * If the read failed, errno is set to the read error.
+		 * @param lba_read	[in] Number of LBAs read. (If less than requested, the read failed.)
+		 */
+		typedef std::function<void(uint32_t lba_read)> Callback;
+
+		/**
+		 * Submit a read with a completion callback.
+		 * If depth() reads are already pending, wait() or run() must be called first.
+		 * @param buf		[out] Read buffer. (Must remain valid until the callback is invoked.)
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @param callback	[in] Callback, invoked by wait() or run() when the read finishes.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int submit(void *buf, uint32_t lba_start, uint32_t lba_len, Callback callback);
+
+		/**
+		 * Wait for a read that was submitted with a tag to finish.
+		 * Reads may finish in any order. Callbacks of reads that
+		 * finish in the meantime are invoked.
+		 * @param pTag		[out] Tag of the finished read.
+		 * @param pLbaRead	[out] Number of LBAs read. (If less than requested, the read failed.)
+		 * @param pErr		[out,opt] Read error. (negative POSIX error code; 0 if the read succeeded)
+		 * @return 0 on success; -ENOENT if no reads with a tag are pending.
+		 */
+		int wait(uintptr_t *pTag, uint32_t *pLbaRead, int *pErr = nullptr);
+
+		/**
+		 * Wait for all pending reads to finish, invoking their callbacks.
+		 * Reads that are submitted by the callbacks are also waited for.
+		 * Reads that were submitted with a tag are discarded.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int run(void);
+
+	private:
+		struct Request {
+			uint8_t *buf;		// Read buffer
+			uint32_t lba_start;	// Starting LBA
+			uint32_t lba_len;	// Length, in LBAs
+			uint32_t lba_done;	// Number of LBAs read so far
+			int err;		// Read error (negative POSIX error code)
+			uintptr_t tag;		// Caller-defined tag
+			Callback callback;	// Completion callback, or empty if the tag is used
+
+			// Read latency measurement for reads on the ring.
+			// (See StatsCounters::addReadLatency().)
+			StatsCounters *latency_stats;	// nullptr if not measured
+			int64_t latency_offset;		// File offset
+			uint32_t latency_size;		// Size, in bytes
+			std::chrono::steady_clock::time_point submit_time;
+		};
+
+		struct Completion {
+			uintptr_t tag;		// Caller-defined tag
+			uint32_t lba_read;	// Number of LBAs read
+			int err;		// Read error (negative POSIX error code)
+			Callback callback;	// Completion callback, or empty if the tag is used
+		};
+
+		/**
+		 * Submit a read. (internal function)
+		 * @param buf		[out] Read buffer.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @param tag		[in] Caller-defined tag.
+		 * @param callback	[in] Completion callback, or empty if the tag is used.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int submit_int(void *buf, uint32_t lba_start, uint32_t lba_len, uintptr_t tag, Callback &&callback);
+
+		/**
+		 * Wait for the next read to finish. (internal function)
+		 * @param pCompletion	[out] Completion.
+		 * @return 0 on success; -ENOENT if no reads are pending.
+		 */
+		int wait_int(Completion *pCompletion);
+
+		/**
+		 * Read the rest of a request synchronously.
+		 * If the read fails, the error is recorded in the request.
+		 * @param req Request
+		 */
+		void readSync(Request &req);
+
+		/**
+		 * Read the requests in m_syncReqs as one batch.
+		 * (See Reader::readv().)
+		 */
+		void readSyncBatch(void);
+
+		/**
+		 * Finish a request.
+		 * The request is added to the completion queue, and cached data
+		 * for the range that was read is dropped. If the request is
+		 * incomplete and no error was recorded, the error is -EIO.
+		 * @param idx Request index
+		 */
+		void finishRequest(unsigned int idx);
+
+		/**
+		 * Submit the rest of a request to the ring.
+		 * If it can't be submitted, it's read synchronously.
+		 * @param idx Request index
+		 * @return True if submitted; false if it was read synchronously.
+		 */
+		bool submitToRing(unsigned int idx);
+
+	private:
+		Reader *const m_reader;
+		std::vector<Request> m_reqs;
+		std::vector<unsigned int> m_freeReqs;	// Unused request indexes
+		std::deque<Completion> m_done;		// Finished requests that haven't been returned
+		std::vector<unsigned int> m_syncReqs;	// Synchronous requests that haven't been read yet
+		unsigned int m_pendingTags;		// Pending requests that were submitted with a tag
+		std::vector<Reader::ReadRange> m_syncRanges;	// Ranges for readSyncBatch()
+		unsigned int m_pending;			// Submitted requests that haven't been returned
+		off64_t m_scanOffset;			// File offset of the Reader, or -1 if not contiguous
+
+		// io_uring or overlapped I/O state. (nullptr if reads are synchronous)
+		struct Ring;
+		Ring *m_ring;
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_READER_ASYNCREADER_HPP__ */
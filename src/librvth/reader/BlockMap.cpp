@@ -0,0 +1,169 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * BlockMap.cpp: Extent map for block-based disc image formats.            *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "BlockMap.hpp"
+
+// C includes (C++ namespace)
+#include <cassert>
+
+// C++ includes
+#include <algorithm>
+using std::vector;
+
+const uint32_t BlockMap::EMPTY;
+
+BlockMap::BlockMap()
+	: m_block_lba_len(0)
+	, m_count(0)
+{ }
+
+/**
+ * Build the map from a block table.
+ * @param block_lba_len	[in] Block size, in LBAs.
+ * @param count		[in] Number of logical blocks.
+ * @param physBlock	[in] Returns the physical block number of a logical block, or EMPTY.
+ */
+void BlockMap::assign(uint32_t block_lba_len, uint32_t count,
+	const std::function<uint32_t(uint32_t block)> &physBlock)
+{
+	assert(block_lba_len != 0);
+	m_block_lba_len = block_lba_len;
+	m_count = count;
+	m_runs.clear();
+	for (uint32_t block = 0; block < count; block++) {
+		const uint32_t phys = physBlock(block);
+		if (!m_runs.empty() && continues(m_runs.back(), phys)) {
+			m_runs.back().count++;
+		} else {
+			m_runs.push_back({block, 1, phys});
+		}
+	}
+}
+
+/**
+ * Find the run that contains a logical block.
+ * @param block	[in] Logical block number.
+ * @return Index of the run, or m_runs.size() if out of range.
+ */
+size_t BlockMap::findRun(uint32_t block) const
+{
+	if (block >= m_count) {
+		return m_runs.size();
+	}
+
+	// Find the last run that starts at or before the block.
+	auto iter = std::upper_bound(m_runs.cbegin(), m_runs.cend(), block,
+		[](uint32_t block, const Run &run) { return block < run.block; });
+	assert(iter != m_runs.cbegin());
+	return static_cast<size_t>(iter - m_runs.cbegin()) - 1;
+}
+
+/**
+ * Set the physical block of a logical block, e.g. when
+ * a block is allocated in a new disc image.
+ * @param block	[in] Logical block number. (must be less than the block count)
+ * @param phys	[in] Physical block number, or EMPTY.
+ */
+void BlockMap::set(uint32_t block, uint32_t phys)
+{
+	assert(block < m_count);
+	const size_t idx = findRun(block);
+	if (idx >= m_runs.size()) {
+		return;
+	}
+
+	const Run run = m_runs[idx];
+	const uint32_t offset = block - run.block;
+	if ((run.phys == EMPTY ? EMPTY : run.phys + offset) == phys) {
+		// No change.
+		return;
+	}
+
+	// Split the run around the block.
+	Run parts[3];
+	unsigned int count = 0;
+	if (offset > 0) {
+		parts[count++] = {run.block, offset, run.phys};
+	}
+	const size_t pos = idx + count;
+	parts[count++] = {block, 1, phys};
+	if (offset + 1 < run.count) {
+		parts[count++] = {block + 1, run.count - offset - 1,
+			(run.phys == EMPTY ? EMPTY : run.phys + offset + 1)};
+	}
+	m_runs[idx] = parts[0];
+	m_runs.insert(m_runs.begin() + idx + 1, &parts[1], &parts[count]);
+
+	// Merge the block with the adjacent runs if possible.
+	if (pos + 1 < m_runs.size() && continues(m_runs[pos], m_runs[pos + 1].phys)) {
+		m_runs[pos].count += m_runs[pos + 1].count;
+		m_runs.erase(m_runs.begin() + pos + 1);
+	}
+	if (pos > 0 && continues(m_runs[pos - 1], m_runs[pos].phys)) {
+		m_runs[pos - 1].count += m_runs[pos].count;
+		m_runs.erase(m_runs.begin() + pos);
+	}
+}
+
+/**
+ * Get the physical block of a logical block.
+ * @param block	[in] Logical block number.
+ * @return Physical block number, or EMPTY if the block is empty or out of range.
+ */
+uint32_t BlockMap::physBlock(uint32_t block) const
+{
+	const size_t idx = findRun(block);
+	if (idx >= m_runs.size()) {
+		return EMPTY;
+	}
+	const Run &run = m_runs[idx];
+	return (run.phys == EMPTY ? EMPTY : run.phys + (block - run.block));
+}
+
+/**
+ * Map the start of a range of LBAs.
+ * The mapping ends at the end of the run that contains
+ * lba_start, or at the end of the range.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs. (must not be 0)
+ * @param pMapping	[out] Mapping.
+ * @return True on success; false if lba_start is past the end of the map.
+ */
+bool BlockMap::lookup(uint32_t lba_start, uint32_t lba_len, Mapping *pMapping) const
+{
+	assert(lba_len != 0);
+	const size_t idx = findRun(lba_start / m_block_lba_len);
+	if (idx >= m_runs.size()) {
+		return false;
+	}
+
+	const Run &run = m_runs[idx];
+	const uint64_t run_lba = static_cast<uint64_t>(run.block) * m_block_lba_len;
+	const uint64_t run_lba_end = run_lba + static_cast<uint64_t>(run.count) * m_block_lba_len;
+	pMapping->lba_len = static_cast<uint32_t>(std::min<uint64_t>(lba_len, run_lba_end - lba_start));
+	pMapping->allocated = (run.phys != EMPTY);
+	pMapping->phys_lba = (pMapping->allocated
+		? static_cast<uint64_t>(run.phys) * m_block_lba_len + (lba_start - run_lba)
+		: 0);
+	return true;
+}
+
+/**
+ * Check if a range of LBAs is entirely within empty blocks.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return True if the range is empty; false if not, or if it's out of range.
+ */
+bool BlockMap::isRangeEmpty(uint32_t lba_start, uint32_t lba_len) const
+{
+	Mapping mapping;
+	if (lba_len == 0 || !lookup(lba_start, lba_len, &mapping)) {
+		return false;
+	}
+	return (!mapping.allocated && mapping.lba_len == lba_len);
+}
@@ -0,0 +1,125 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * BlockMap.hpp: Extent map for block-based disc image formats.            *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_READER_BLOCKMAP_HPP__
+#define __RVTHTOOL_LIBRVTH_READER_BLOCKMAP_HPP__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// C++ includes
+#include <functional>
+#include <vector>
+
+/**
+ * Logical to physical block map, stored as a sorted array of runs.
+ *
+ * Each run is a range of logical blocks that are either all empty,
+ * or stored in consecutive physical blocks. The map is decoded once
+ * from the container's block table, so looking up a range of LBAs
+ * is a binary search instead of one table lookup (and byteswap) per
+ * block, and physically contiguous blocks are found without having
+ * to compare neighboring entries.
+ *
+ * Used by the CISO and WBFS readers.
+ */
+class BlockMap
+{
+	public:
+		BlockMap();
+
+	public:
+		// Physical block number of empty blocks.
+		static const uint32_t EMPTY = ~0U;
+
+		/**
+		 * Build the map from a block table.
+		 * @param block_lba_len	[in] Block size, in LBAs.
+		 * @param count		[in] Number of logical blocks.
+		 * @param physBlock	[in] Returns the physical block number of a logical block, or EMPTY.
+		 */
+		void assign(uint32_t block_lba_len, uint32_t count,
+			const std::function<uint32_t(uint32_t block)> &physBlock);
+
+		/**
+		 * Set the physical block of a logical block, e.g. when
+		 * a block is allocated in a new disc image.
+		 * @param block	[in] Logical block number. (must be less than the block count)
+		 * @param phys	[in] Physical block number, or EMPTY.
+		 */
+		void set(uint32_t block, uint32_t phys);
+
+		/**
+		 * Get the physical block of a logical block.
+		 * @param block	[in] Logical block number.
+		 * @return Physical block number, or EMPTY if the block is empty or out of range.
+		 */
+		uint32_t physBlock(uint32_t block) const;
+
+		/**
+		 * Part of a range of LBAs that maps to a single run. (See lookup().)
+		 */
+		struct Mapping {
+			uint32_t lba_len;	// Length, in LBAs
+			bool allocated;		// False if the LBAs are empty
+			uint64_t phys_lba;	// Physical LBA, relative to physical block 0 (if allocated)
+		};
+
+		/**
+		 * Map the start of a range of LBAs.
+		 * The mapping ends at the end of the run that contains
+		 * lba_start, or at the end of the range.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs. (must not be 0)
+		 * @param pMapping	[out] Mapping.
+		 * @return True on success; false if lba_start is past the end of the map.
+		 */
+		bool lookup(uint32_t lba_start, uint32_t lba_len, Mapping *pMapping) const;
+
+		/**
+		 * Check if a range of LBAs is entirely within empty blocks.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return True if the range is empty; false if not, or if it's out of range.
+		 */
+		bool isRangeEmpty(uint32_t lba_start, uint32_t lba_len) const;
+
+	private:
+		struct Run {
+			uint32_t block;		// First logical block
+			uint32_t count;		// Number of blocks
+			uint32_t phys;		// Physical block of the first block, or EMPTY
+		};
+
+		/**
+		 * Find the run that contains a logical block.
+		 * @param block	[in] Logical block number.
+		 * @return Index of the run, or m_runs.size() if out of range.
+		 */
+		size_t findRun(uint32_t block) const;
+
+		/**
+		 * Check if a run can be appended to the previous run.
+		 * @param prev	[in] Previous run.
+		 * @param phys	[in] Physical block of the next logical block, or EMPTY.
+		 * @return True if phys continues prev.
+		 */
+		static inline bool continues(const Run &prev, uint32_t phys)
+		{
+			return (prev.phys == EMPTY)
+				? (phys == EMPTY)
+				: (phys != EMPTY && phys == prev.phys + prev.count);
+		}
+
+	private:
+		uint32_t m_block_lba_len;	// Block size, in LBAs
+		uint32_t m_count;		// Number of logical blocks
+		std::vector<Run> m_runs;	// Runs, in logical block order
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_READER_BLOCKMAP_HPP__ */
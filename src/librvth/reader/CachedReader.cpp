@@ -0,0 +1,326 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * CachedReader.cpp: LRU block cache for another Reader.                   *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "CachedReader.hpp"
+#include "StatsCounters.hpp"
+
+// For LBA_TO_BYTES()
+#include "nhcd_structs.h"
+
+// C includes (C++ namespace)
+#include <cassert>
+#include <cstring>
+
+// C++ includes
+#include <algorithm>
+#include <vector>
+using std::lock_guard;
+using std::mutex;
+using std::unique_lock;
+using std::unique_ptr;
+using std::vector;
+
+const uint32_t CachedReader::BLOCK_LBA_LEN;
+const uint32_t CachedReader::BYPASS_LBA_LEN;
+
+/**
+ * Create a block cache for a Reader.
+ * @param reader	[in] Reader (owned by this object)
+ * @param cache_size	[in] Cache size, in bytes (rounded down to a multiple of the block size)
+ */
+CachedReader::CachedReader(Reader *reader, size_t cache_size)
+	: super(reader->file(), reader->lba_start(), reader->lba_len())
+	, m_reader(reader)
+	, m_maxBlocks(cache_size / LBA_TO_BYTES(static_cast<size_t>(BLOCK_LBA_LEN)))
+{
+	assert(m_maxBlocks != 0);
+	m_type = reader->type();
+	m_map.reserve(m_maxBlocks);
+}
+
+/**
+ * Wrap a Reader in a block cache.
+ * If the cache size is smaller than one block, or if
+ * the Reader couldn't be opened, it's returned as-is.
+ * @param reader	[in] Reader (ownership is transferred)
+ * @param cache_size	[in] Cache size, in bytes
+ * @return Reader to use in place of reader.
+ */
+Reader *CachedReader::wrap(Reader *reader, size_t cache_size)
+{
+	if (!reader || !reader->isOpen() ||
+	    cache_size < LBA_TO_BYTES(static_cast<size_t>(BLOCK_LBA_LEN)))
+	{
+		return reader;
+	}
+	return new CachedReader(reader, cache_size);
+}
+
+/**
+ * Copy a block from the cache, reading it first if necessary.
+ * NOTE: m_mutex must be held by the caller.
+ * @param block		[in] Block number
+ * @param ptr		[out] Destination buffer
+ * @param offset	[in] Starting LBA within the block
+ * @param lba_len	[in] Number of LBAs to copy
+ * @return True on success; false if the block couldn't be read.
+ */
+bool CachedReader::copyBlock_int(uint32_t block, uint8_t *ptr, uint32_t offset, uint32_t lba_len)
+{
+	auto iter = m_map.find(block);
+	if (iter != m_map.end()) {
+		// Move the block to the front of the LRU list.
+		StatsCounters::addCacheLookup(true);
+		m_lru.splice(m_lru.begin(), m_lru, iter->second);
+		memcpy(ptr, &iter->second->data[LBA_TO_BYTES(offset)], LBA_TO_BYTES(lba_len));
+		return true;
+	}
+	StatsCounters::addCacheLookup(false);
+
+	// Reuse the least recently used block's buffer if the cache is full.
+	unique_ptr<uint8_t[]> data;
+	if (m_lru.size() >= m_maxBlocks) {
+		data = std::move(m_lru.back().data);
+		m_map.erase(m_lru.back().block);
+		m_lru.pop_back();
+	} else {
+		data.reset(new uint8_t[LBA_TO_BYTES(static_cast<size_t>(BLOCK_LBA_LEN))]);
+	}
+
+	// The last block may be shorter than the others.
+	const uint32_t block_lba = block * BLOCK_LBA_LEN;
+	const uint32_t block_lba_len = std::min(BLOCK_LBA_LEN, m_lba_len - block_lba);
+	if (m_reader->read(data.get(), block_lba, block_lba_len) != block_lba_len) {
+		// Read error.
+		return false;
+	}
+	memcpy(ptr, &data[LBA_TO_BYTES(offset)], LBA_TO_BYTES(lba_len));
+
+	m_lru.push_front(Block());
+	m_lru.front().block = block;
+	m_lru.front().data = std::move(data);
+	m_map.emplace(block, m_lru.begin());
+	return true;
+}
+
+/**
+ * Drop the cached blocks that overlap a range of LBAs.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ */
+void CachedReader::invalidate(uint32_t lba_start, uint32_t lba_len)
+{
+	if (lba_len == 0) {
+		return;
+	}
+
+	const uint32_t first = lba_start / BLOCK_LBA_LEN;
+	const uint32_t last = static_cast<uint32_t>((static_cast<uint64_t>(lba_start) + lba_len - 1) / BLOCK_LBA_LEN);
+
+	lock_guard<mutex> lock(m_mutex);
+	if (static_cast<uint64_t>(last) - first + 1 > m_lru.size()) {
+		// Large range. Check each cached block instead.
+		for (auto iter = m_lru.begin(); iter != m_lru.end(); ) {
+			if (iter->block >= first && iter->block <= last) {
+				m_map.erase(iter->block);
+				iter = m_lru.erase(iter);
+			} else {
+				++iter;
+			}
+		}
+		return;
+	}
+
+	for (uint32_t block = first; block <= last; block++) {
+		auto iter = m_map.find(block);
+		if (iter != m_map.end()) {
+			m_lru.erase(iter->second);
+			m_map.erase(iter);
+		}
+	}
+}
+
+/**
+ * Read data from the disc image.
+ * @param ptr		[out] Read buffer.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Number of LBAs read, or 0 on error.
+ */
+uint32_t CachedReader::read(void *ptr, uint32_t lba_start, uint32_t lba_len)
+{
+	if (lba_len >= BYPASS_LBA_LEN ||
+	    lba_start >= m_lba_len || lba_len > m_lba_len - lba_start)
+	{
+		// Bulk read, or out of range.
+		return m_reader->read(ptr, lba_start, lba_len);
+	}
+
+	uint8_t *ptr8 = static_cast<uint8_t*>(ptr);
+	const uint32_t lba_end = lba_start + lba_len;
+	uint32_t lba = lba_start;
+
+	unique_lock<mutex> lock(m_mutex);
+	while (lba < lba_end) {
+		const uint32_t offset = lba % BLOCK_LBA_LEN;
+		const uint32_t len = std::min(BLOCK_LBA_LEN - offset, lba_end - lba);
+		if (!copyBlock_int(lba / BLOCK_LBA_LEN, ptr8, offset, len)) {
+			// Read error. Read the rest directly, so a partial
+			// read is reported the same way as without the cache.
+			lock.unlock();
+			return (lba - lba_start) + m_reader->read(ptr8, lba, lba_end - lba);
+		}
+		ptr8 += LBA_TO_BYTES(len);
+		lba += len;
+	}
+	return lba_len;
+}
+
+/**
+ * Read multiple ranges of LBAs from the disc image. (scatter-gather)
+ * Small ranges are read using the cache; the rest are
+ * passed to the underlying Reader in a single call.
+ * @param ranges	[in/out] Ranges. (lba_read is set for each range)
+ * @param count		[in] Number of ranges.
+ * @return Number of ranges that were read completely.
+ */
+unsigned int CachedReader::readv(ReadRange *ranges, unsigned int count)
+{
+	unsigned int complete = 0;
+	vector<ReadRange> bulk;
+	vector<unsigned int> bulk_idx;
+	for (unsigned int i = 0; i < count; i++) {
+		ReadRange &range = ranges[i];
+		if (range.lba_len >= BYPASS_LBA_LEN) {
+			bulk.push_back(range);
+			bulk_idx.push_back(i);
+			continue;
+		}
+		range.lba_read = read(range.ptr, range.lba_start, range.lba_len);
+		if (range.lba_read == range.lba_len) {
+			complete++;
+		}
+	}
+
+	if (!bulk.empty()) {
+		complete += m_reader->readv(bulk.data(), static_cast<unsigned int>(bulk.size()));
+		for (size_t i = 0; i < bulk.size(); i++) {
+			ranges[bulk_idx[i]].lba_read = bulk[i].lba_read;
+		}
+	}
+	return complete;
+}
+
+/**
+ * Get a read-only view of data in the disc image.
+ * Small ranges are copied from the cache into the caller's buffer.
+ * @param buf		[out] Fallback buffer. (Must be at least lba_len LBAs.)
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Pointer to the data, or nullptr on error.
+ */
+const void *CachedReader::readView(void *buf, uint32_t lba_start, uint32_t lba_len)
+{
+	if (lba_len >= BYPASS_LBA_LEN) {
+		return m_reader->readView(buf, lba_start, lba_len);
+	}
+	return super::readView(buf, lba_start, lba_len);
+}
+
+uint32_t CachedReader::extents(uint32_t lba_start, uint32_t lba_len, vector<Extent> &extents) const
+{
+	return m_reader->extents(lba_start, lba_len, extents);
+}
+
+bool CachedReader::isRangeEmpty(uint32_t lba_start, uint32_t lba_len) const
+{
+	return m_reader->isRangeEmpty(lba_start, lba_len);
+}
+
+bool CachedReader::fileOffset(uint32_t lba_start, uint32_t lba_len, off64_t *pOffset) const
+{
+	return m_reader->fileOffset(lba_start, lba_len, pOffset);
+}
+
+off64_t CachedReader::physicalStart(void) const
+{
+	return m_reader->physicalStart();
+}
+
+uint32_t CachedReader::blockSizeLba(void) const
+{
+	return m_reader->blockSizeLba();
+}
+
+/**
+ * Write data to the disc image.
+ * Cached blocks that overlap the range are dropped.
+ * @param ptr		[in] Write buffer.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Number of LBAs written, or 0 on error.
+ */
+uint32_t CachedReader::write(const void *ptr, uint32_t lba_start, uint32_t lba_len)
+{
+	// NOTE: Invalidating even if the write failed,
+	// since part of the range may have been written.
+	const uint32_t ret = m_reader->write(ptr, lba_start, lba_len);
+	invalidate(lba_start, lba_len);
+	return ret;
+}
+
+int CachedReader::makeSparse(void)
+{
+	return m_reader->makeSparse();
+}
+
+int CachedReader::preallocate(void)
+{
+	return m_reader->preallocate();
+}
+
+/**
+ * Deallocate a range of LBAs that only contain zeroes.
+ * Cached blocks that overlap the range are dropped.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return 0 on success; negative POSIX error code on error. (-ENOTSUP if not supported)
+ */
+int CachedReader::discard(uint32_t lba_start, uint32_t lba_len)
+{
+	const int ret = m_reader->discard(lba_start, lba_len);
+	if (ret == 0) {
+		invalidate(lba_start, lba_len);
+	}
+	return ret;
+}
+
+void CachedReader::flush(void)
+{
+	m_reader->flush();
+}
+
+void CachedReader::sync(void)
+{
+	m_reader->sync();
+}
+
+void CachedReader::setDurability(RvtH_Durability durability, uint64_t interval)
+{
+	m_reader->setDurability(durability, interval);
+}
+
+/**
+ * Drop all cached blocks.
+ */
+void CachedReader::invalidateCache(void)
+{
+	lock_guard<mutex> lock(m_mutex);
+	m_map.clear();
+	m_lru.clear();
+}
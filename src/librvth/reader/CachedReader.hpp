@@ -0,0 +1,173 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * CachedReader.hpp: LRU block cache for another Reader.                   *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_READER_CACHEDREADER_HPP__
+#define __RVTHTOOL_LIBRVTH_READER_CACHEDREADER_HPP__
+
+#include "Reader.hpp"
+
+// C++ includes
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+/**
+ * Block cache for another Reader.
+ *
+ * Metadata, e.g. the disc header, partition table, tickets, TMDs,
+ * and the FST, is read a few LBAs at a time, often more than once.
+ * Small reads are served from an LRU cache of 32 KB blocks, so each
+ * block is only read from the image once. Reads of BYPASS_LBA_LEN
+ * LBAs or more, e.g. when copying or verifying, go directly to the
+ * underlying Reader and don't evict anything.
+ *
+ * Writes and discards are passed to the underlying Reader, and the
+ * blocks that they overlap are dropped from the cache. If the image
+ * is modified without using this Reader, invalidateCache() must be
+ * called.
+ *
+ * Cache lookups are counted in the current thread's StatsCounters.
+ *
+ * NOTE: lba_adjust() isn't supported, since it would only adjust
+ * this object and not the underlying Reader.
+ */
+class CachedReader : public Reader
+{
+	public:
+		/**
+		 * Create a block cache for a Reader.
+		 * @param reader	[in] Reader (owned by this object)
+		 * @param cache_size	[in] Cache size, in bytes (rounded down to a multiple of the block size)
+		 */
+		CachedReader(Reader *reader, size_t cache_size);
+
+	private:
+		typedef Reader super;
+		DISABLE_COPY(CachedReader)
+
+	public:
+		// Cache block size, in LBAs. (32 KB)
+		static const uint32_t BLOCK_LBA_LEN = 64;
+
+		// Reads of at least this many LBAs bypass the cache.
+		static const uint32_t BYPASS_LBA_LEN = BLOCK_LBA_LEN * 4;
+
+		/**
+		 * Wrap a Reader in a block cache.
+		 * If the cache size is smaller than one block, or if
+		 * the Reader couldn't be opened, it's returned as-is.
+		 * @param reader	[in] Reader (ownership is transferred)
+		 * @param cache_size	[in] Cache size, in bytes
+		 * @return Reader to use in place of reader.
+		 */
+		static Reader *wrap(Reader *reader, size_t cache_size);
+
+	public:
+		/** I/O functions **/
+
+		/**
+		 * Read data from the disc image.
+		 * @param ptr		[out] Read buffer.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Number of LBAs read, or 0 on error.
+		 */
+		uint32_t read(void *ptr, uint32_t lba_start, uint32_t lba_len) override;
+
+		/**
+		 * Read multiple ranges of LBAs from the disc image. (scatter-gather)
+		 * Small ranges are read using the cache; the rest are
+		 * passed to the underlying Reader in a single call.
+		 * @param ranges	[in/out] Ranges. (lba_read is set for each range)
+		 * @param count		[in] Number of ranges.
+		 * @return Number of ranges that were read completely.
+		 */
+		unsigned int readv(ReadRange *ranges, unsigned int count) override;
+
+		/**
+		 * Get a read-only view of data in the disc image.
+		 * Small ranges are copied from the cache into the caller's buffer.
+		 * @param buf		[out] Fallback buffer. (Must be at least lba_len LBAs.)
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Pointer to the data, or nullptr on error.
+		 */
+		const void *readView(void *buf, uint32_t lba_start, uint32_t lba_len) override;
+
+		uint32_t extents(uint32_t lba_start, uint32_t lba_len, std::vector<Extent> &extents) const override;
+		bool isRangeEmpty(uint32_t lba_start, uint32_t lba_len) const override;
+		bool fileOffset(uint32_t lba_start, uint32_t lba_len, off64_t *pOffset) const override;
+		off64_t physicalStart(void) const override;
+		uint32_t blockSizeLba(void) const override;
+
+		/**
+		 * Write data to the disc image.
+		 * Cached blocks that overlap the range are dropped.
+		 * @param ptr		[in] Write buffer.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Number of LBAs written, or 0 on error.
+		 */
+		uint32_t write(const void *ptr, uint32_t lba_start, uint32_t lba_len) override;
+
+		int makeSparse(void) override;
+		int preallocate(void) override;
+
+		/**
+		 * Deallocate a range of LBAs that only contain zeroes.
+		 * Cached blocks that overlap the range are dropped.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return 0 on success; negative POSIX error code on error. (-ENOTSUP if not supported)
+		 */
+		int discard(uint32_t lba_start, uint32_t lba_len) override;
+
+		void flush(void) override;
+		void sync(void) override;
+		void setDurability(RvtH_Durability durability, uint64_t interval) override;
+
+		/**
+		 * Drop all cached blocks.
+		 */
+		void invalidateCache(void) override;
+
+	private:
+		/**
+		 * Copy a block from the cache, reading it first if necessary.
+		 * NOTE: m_mutex must be held by the caller.
+		 * @param block		[in] Block number
+		 * @param ptr		[out] Destination buffer
+		 * @param offset	[in] Starting LBA within the block
+		 * @param lba_len	[in] Number of LBAs to copy
+		 * @return True on success; false if the block couldn't be read.
+		 */
+		bool copyBlock_int(uint32_t block, uint8_t *ptr, uint32_t offset, uint32_t lba_len);
+
+		/**
+		 * Drop the cached blocks that overlap a range of LBAs.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 */
+		void invalidate(uint32_t lba_start, uint32_t lba_len);
+
+	private:
+		std::unique_ptr<Reader> m_reader;	// Underlying Reader
+		size_t m_maxBlocks;			// Maximum number of cached blocks
+
+		struct Block {
+			uint32_t block;				// Block number
+			std::unique_ptr<uint8_t[]> data;	// Block data (BLOCK_LBA_LEN LBAs)
+		};
+
+		std::mutex m_mutex;
+		std::list<Block> m_lru;			// Cached blocks, most recently used first
+		std::unordered_map<uint32_t, std::list<Block>::iterator> m_map;	// Block number -> m_lru entry
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_READER_CACHEDREADER_HPP__ */
@@ -7,7 +7,10 @@
  ***************************************************************************/
 
 #include "CisoReader.hpp"
+#include "ProbeBuffer.hpp"
+#include "Trace.hpp"
 #include "byteswap.h"
+#include "rvth.hpp"	// for RvtH::isBlockEmpty()
 
 // For LBA_TO_BYTES()
 #include "nhcd_structs.h"
@@ -21,8 +24,13 @@
 #include <cstring>
 
 // C++ includes
+#include <algorithm>
 #include <array>
+#include <memory>
+#include <vector>
 using std::array;
+using std::unique_ptr;
+using std::vector;
 
 // CISO magic
 static const array<char, 4> CISO_MAGIC = {{'C','I','S','O'}};
@@ -91,14 +99,18 @@ bool CisoReader::isSupported(const uint8_t *sbuf, size_t size)
  * @param file		RefFile*.
  * @param lba_start	[in] Starting LBA,
  * @param lba_len	[in] Length, in LBAs.
+ * @param probe		[in,opt] Probe window from Reader::open(), or nullptr to read the headers from the file.
  * @return Reader*, or NULL on error.
  */
-CisoReader::CisoReader(RefFile *file, uint32_t lba_start, uint32_t lba_len)
+CisoReader::CisoReader(RefFile *file, uint32_t lba_start, uint32_t lba_len, const ProbeBuffer *probe)
 	: super(file, lba_start, lba_len)
 	, m_real_lba_len(0)
 	, m_block_size_lba(0)
+	, m_isNew(false)
+	, m_dirty(false)
+	, m_physBlockCount(0)
+	, m_cacheCounter(0)
 {
-	int ret;
 	int err = 0;
 	size_t size;
 	unsigned int i;
@@ -135,16 +147,8 @@ CisoReader::CisoReader(RefFile *file, uint32_t lba_start, uint32_t lba_len)
 	m_real_lba_len = lba_len;
 
 	// Read the CISO header.
-	ret = m_file->seeko(lba_start * LBA_SIZE, SEEK_SET);
-	if (ret != 0) {
-		// Seek error.
-		err = errno;
-		if (err == 0) {
-			err = EIO;
-		}
-		goto fail;
-	}
-	size = m_file->read(cisoHeader, 1, sizeof(*cisoHeader));
+	errno = 0;
+	size = ProbeBuffer::pread(probe, m_file, cisoHeader, sizeof(*cisoHeader), LBA_TO_BYTES(lba_start));
 	if (size != sizeof(*cisoHeader)) {
 		// Short read.
 		err = errno;
@@ -185,6 +189,7 @@ CisoReader::CisoReader(RefFile *file, uint32_t lba_start, uint32_t lba_len)
 
 	// Calculate the image size based on the highest logical block index.
 	m_lba_len = static_cast<uint32_t>(maxLogicalBlockUsed + 1) * m_block_size_lba;
+	decodeBlockMap();
 
 	// Reader initialized.
 	delete cisoHeader;
@@ -199,6 +204,167 @@ fail:
 	errno = err;
 }
 
+/**
+ * Create a CISO reader for a new disc image.
+ * Use Reader::create() instead of calling this directly.
+ *
+ * @param file		RefFile*. (Must be a new, empty file opened for writing.)
+ * @param lba_len	[in] Length, in LBAs.
+ * @return CisoReader*, or NULL on error.
+ */
+CisoReader *CisoReader::create(RefFile *file, uint32_t lba_len)
+{
+	CisoReader *const reader = new CisoReader(file, lba_len);
+	if (!reader->isOpen()) {
+		const int err = errno;
+		delete reader;
+		errno = err;
+		return nullptr;
+	}
+	return reader;
+}
+
+/**
+ * Initialize a CISO reader for a new disc image.
+ * @param file		RefFile*.
+ * @param lba_len	[in] Length, in LBAs.
+ */
+CisoReader::CisoReader(RefFile *file, uint32_t lba_len)
+	: super(file, 0, lba_len)
+	, m_real_lba_len(0)
+	, m_block_size_lba(0)
+	, m_isNew(true)
+	, m_dirty(false)
+	, m_physBlockCount(0)
+	, m_cacheCounter(0)
+{
+	if (!isOpen()) {
+		// File wasn't opened.
+		return;
+	}
+
+	// Select the block size. Start with the default block size,
+	// and double it until the image fits in the block map.
+	const uint64_t size = LBA_TO_BYTES(lba_len);
+	uint32_t block_size = CISO_BLOCK_SIZE_DEFAULT;
+	while (block_size < CISO_BLOCK_SIZE_MAX &&
+	       (size + block_size - 1) / block_size > CISO_MAP_SIZE)
+	{
+		block_size <<= 1;
+	}
+	if (lba_len == 0 || (size + block_size - 1) / block_size > CISO_MAP_SIZE) {
+		// Image is too big for CISO.
+		m_file->unref();
+		m_file = nullptr;
+		errno = (lba_len == 0 ? EINVAL : EFBIG);
+		return;
+	}
+
+	m_block_size_lba = BYTES_TO_LBA(block_size);
+	m_lba_start = BYTES_TO_LBA(CISO_HEADER_SIZE);
+	m_lba_len = lba_len;
+	m_real_lba_len = lba_len + m_lba_start;
+
+	// All blocks are empty initially.
+	memset(m_blockMap, 0xFF, sizeof(m_blockMap));
+	decodeBlockMap();
+
+	// The CISO header will be written when the reader is flushed.
+	m_dirty = true;
+	m_type = RVTH_ImageType_GCM;
+}
+
+CisoReader::~CisoReader()
+{
+	// Write the CISO header if it hasn't been written yet.
+	if (m_dirty) {
+		writeHeader();
+	}
+
+	// Superclass will unreference the file.
+}
+
+/**
+ * Decode m_blockMap into m_blockRuns.
+ */
+void CisoReader::decodeBlockMap(void)
+{
+	m_blockRuns.assign(m_block_size_lba, ARRAY_SIZE(m_blockMap), [this](uint32_t block) -> uint32_t {
+		return (m_blockMap[block] != 0xFFFF ? m_blockMap[block] : BlockMap::EMPTY);
+	});
+}
+
+/**
+ * Read a physically contiguous run of LBAs.
+ * @param ptr		[out] Read buffer.
+ * @param phys_lba	[in] Starting physical LBA, relative to the first CISO block.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return True on success; false on error. (errno is set)
+ */
+bool CisoReader::readPhys(uint8_t *ptr, uint32_t phys_lba, uint32_t lba_len)
+{
+	errno = 0;
+	const size_t size = m_file->pread(ptr, LBA_TO_BYTES(lba_len),
+		LBA_TO_BYTES(static_cast<off64_t>(phys_lba) + m_lba_start));
+	if (size != LBA_TO_BYTES(lba_len)) {
+		// Read error.
+		if (errno == 0) {
+			errno = EIO;
+		}
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Read LBAs within a single cache chunk using the chunk cache.
+ * @param ptr		[out] Read buffer.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs. (Must not cross a chunk boundary.)
+ * @return True on success; false on error. (errno is set)
+ */
+bool CisoReader::readCached(uint8_t *ptr, uint32_t lba_start, uint32_t lba_len)
+{
+	const uint32_t chunk = lba_start / CISO_CACHE_CHUNK_LBA;
+	const uint32_t offset = lba_start % CISO_CACHE_CHUNK_LBA;
+	assert(offset + lba_len <= CISO_CACHE_CHUNK_LBA);
+
+	// Check if the chunk is cached.
+	// If it isn't, replace the least recently used entry.
+	CacheEntry *lru = &m_cache[0];
+	CacheEntry *entry = nullptr;
+	for (CacheEntry &e : m_cache) {
+		if (e.chunk == chunk) {
+			entry = &e;
+			break;
+		} else if (e.last_used < lru->last_used) {
+			lru = &e;
+		}
+	}
+
+	if (!entry) {
+		// Read the chunk.
+		entry = lru;
+		if (!entry->data) {
+			entry->data.reset(new uint8_t[LBA_TO_BYTES(CISO_CACHE_CHUNK_LBA)]);
+		}
+
+		BlockMap::Mapping mapping;
+		if (!m_blockRuns.lookup(chunk * CISO_CACHE_CHUNK_LBA, CISO_CACHE_CHUNK_LBA, &mapping) ||
+		    !readPhys(entry->data.get(), static_cast<uint32_t>(mapping.phys_lba), CISO_CACHE_CHUNK_LBA))
+		{
+			// Read error.
+			entry->chunk = ~0U;
+			return false;
+		}
+		entry->chunk = chunk;
+	}
+
+	entry->last_used = ++m_cacheCounter;
+	memcpy(ptr, &entry->data[LBA_TO_BYTES(offset)], LBA_TO_BYTES(lba_len));
+	return true;
+}
+
 /**
  * Read data from the disc image.
  * @param ptr		[out] Read buffer.
@@ -208,8 +374,7 @@ fail:
  */
 uint32_t CisoReader::read(void *ptr, uint32_t lba_start, uint32_t lba_len)
 {
-	// Return value.
-	uint32_t lbas_read = 0;
+	RVTH_TRACE_SPAN_BYTES("CisoReader::read", LBA_TO_BYTES(lba_len));
 
 	// LBA bounds checking.
 	// TODO: Check for overflow?
@@ -223,39 +388,376 @@ uint32_t CisoReader::read(void *ptr, uint32_t lba_start, uint32_t lba_len)
 		return 0;
 	}
 
-	// TODO: Optimize reading multiple LBAs at once.
-	// For now, we're looking up a single LBA at a time.
 	uint8_t *ptr8 = static_cast<uint8_t*>(ptr);
-	uint32_t lba_end = lba_start + lba_len;
-	for (uint32_t lba = lba_start; lba < lba_end; lba++, ptr8 += LBA_SIZE) {
-		unsigned int physBlockIdx = m_blockMap[lba / m_block_size_lba];
-		if (physBlockIdx == 0xFFFF) {
+	const uint32_t lba_end = lba_start + lba_len;
+
+	// Small reads within a single chunk use the chunk cache.
+	if (lba_len > 0 && lba_len < CISO_CACHE_CHUNK_LBA &&
+	    (lba_start / CISO_CACHE_CHUNK_LBA) == ((lba_end - 1) / CISO_CACHE_CHUNK_LBA))
+	{
+		if (m_blockRuns.physBlock(lba_start / m_block_size_lba) == BlockMap::EMPTY) {
 			// Empty block.
-			memset(ptr8, 0, LBA_SIZE);
-		} else {
-			// Determine the offset.
-			const unsigned int blockStart = physBlockIdx * m_block_size_lba;
-			const unsigned int offset = lba % m_block_size_lba;
-
-			int ret = m_file->seeko(LBA_TO_BYTES(blockStart + offset + m_lba_start), SEEK_SET);
-			if (ret != 0) {
-				// Seek error.
-				if (errno == 0) {
-					errno = EIO;
+			memset(ptr8, 0, LBA_TO_BYTES(lba_len));
+			return lba_len;
+		}
+		return (readCached(ptr8, lba_start, lba_len) ? lba_len : 0);
+	}
+
+	// Split the request into runs using the block map.
+	// Physically contiguous blocks are read using a single read.
+	BlockMap::Mapping mapping;
+	for (uint32_t lba = lba_start; lba < lba_end; lba += mapping.lba_len) {
+		if (!m_blockRuns.lookup(lba, lba_end - lba, &mapping)) {
+			// Out of range.
+			errno = EIO;
+			return 0;
+		}
+
+		if (!mapping.allocated) {
+			// Empty blocks.
+			memset(ptr8, 0, LBA_TO_BYTES(mapping.lba_len));
+		} else if (!readPhys(ptr8, static_cast<uint32_t>(mapping.phys_lba), mapping.lba_len)) {
+			// Read error.
+			return 0;
+		}
+
+		ptr8 += LBA_TO_BYTES(mapping.lba_len);
+	}
+
+	return lba_len;
+}
+
+/**
+ * Read multiple ranges of LBAs from the disc image. (scatter-gather)
+ * All ranges are mapped to CISO blocks before reading, and
+ * blocks that are adjacent in the file are read together.
+ * @param ranges	[in/out] Ranges. (lba_read is set for each range)
+ * @param count		[in] Number of ranges.
+ * @return Number of ranges that were read completely.
+ */
+unsigned int CisoReader::readv(ReadRange *ranges, unsigned int count)
+{
+	vector<ReadExtent> extents;
+	extents.reserve(count);
+	for (unsigned int i = 0; i < count; i++) {
+		ReadRange &range = ranges[i];
+
+		// LBA bounds checking.
+		assert(range.lba_start + range.lba_len <= m_lba_len);
+		if (range.lba_start + range.lba_len > m_lba_len) {
+			// Out of range.
+			errno = EIO;
+			range.lba_read = 0;
+			continue;
+		}
+		range.lba_read = range.lba_len;
+
+		// Split the range into runs using the block map.
+		uint8_t *ptr8 = static_cast<uint8_t*>(range.ptr);
+		const uint32_t lba_end = range.lba_start + range.lba_len;
+		BlockMap::Mapping mapping;
+		for (uint32_t lba = range.lba_start; lba < lba_end; lba += mapping.lba_len) {
+			if (!m_blockRuns.lookup(lba, lba_end - lba, &mapping)) {
+				// Out of range.
+				errno = EIO;
+				range.lba_read = 0;
+				break;
+			}
+
+			if (!mapping.allocated) {
+				// Empty blocks.
+				memset(ptr8, 0, LBA_TO_BYTES(mapping.lba_len));
+			} else {
+				extents.push_back({LBA_TO_BYTES(static_cast<off64_t>(mapping.phys_lba) + m_lba_start),
+					ptr8, static_cast<uint32_t>(LBA_TO_BYTES(mapping.lba_len)), i});
+			}
+
+			ptr8 += LBA_TO_BYTES(mapping.lba_len);
+		}
+	}
+
+	return readExtents(extents, ranges, count);
+}
+
+/**
+ * Check if a range of LBAs is known to be empty without reading it.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return True if the range is entirely within unallocated CISO blocks; false if not.
+ */
+bool CisoReader::isRangeEmpty(uint32_t lba_start, uint32_t lba_len) const
+{
+	if (lba_len == 0 || lba_start + lba_len > m_lba_len) {
+		return false;
+	}
+	return m_blockRuns.isRangeEmpty(lba_start, lba_len);
+}
+
+/**
+ * Get the allocated and unallocated ranges within a range of LBAs.
+ * Unallocated CISO blocks are unallocated.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs. (Clamped to the image length.)
+ * @param extents	[out] Extents.
+ * @return Number of unallocated LBAs.
+ */
+uint32_t CisoReader::extents(uint32_t lba_start, uint32_t lba_len, std::vector<Extent> &extents) const
+{
+	return blockMapExtents(m_blockRuns, lba_start, lba_len, extents);
+}
+
+/**
+ * Get the native block size of the disc image.
+ * @return CISO block size, in LBAs.
+ */
+uint32_t CisoReader::blockSizeLba(void) const
+{
+	return m_block_size_lba;
+}
+
+/**
+ * Write data to the disc image.
+ *
+ * Only new disc images can be written. A block is allocated
+ * the first time non-zero data is written to it.
+ *
+ * @param ptr		[in] Write buffer.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Number of LBAs written, or 0 on error.
+ */
+uint32_t CisoReader::write(const void *ptr, uint32_t lba_start, uint32_t lba_len)
+{
+	RVTH_TRACE_SPAN_BYTES("CisoReader::write", LBA_TO_BYTES(lba_len));
+
+	if (!m_isNew) {
+		// Existing CISO images are read-only.
+		errno = EROFS;
+		return 0;
+	}
+
+	// LBA bounds checking.
+	// TODO: Check for overflow?
+	assert(lba_start + m_lba_start + lba_len <=
+	       m_lba_start + m_lba_len);
+	if (lba_start + m_lba_start + lba_len >
+	    m_lba_start + m_lba_len)
+	{
+		// Out of range.
+		errno = EIO;
+		return 0;
+	}
+
+	const uint8_t *ptr8 = static_cast<const uint8_t*>(ptr);
+	const uint32_t lba_end = lba_start + lba_len;
+	const uint32_t lastBlock = (m_lba_len - 1) / m_block_size_lba;
+	for (uint32_t lba = lba_start; lba < lba_end; ) {
+		// Determine the part of this block that is being written.
+		const uint32_t offset = lba % m_block_size_lba;
+		uint32_t seg_len = m_block_size_lba - offset;
+		if (seg_len > lba_end - lba) {
+			seg_len = lba_end - lba;
+		}
+
+		const uint32_t block = lba / m_block_size_lba;
+		if (m_blockMap[block] == 0xFFFF) {
+			// Empty blocks are only allocated for non-zero data.
+			// The last block is always allocated so the image
+			// size is preserved.
+			if (block != lastBlock &&
+			    RvtH::isBlockEmpty(ptr8, static_cast<unsigned int>(LBA_TO_BYTES(seg_len))))
+			{
+				lba += seg_len;
+				ptr8 += LBA_TO_BYTES(seg_len);
+				continue;
+			}
+			m_blockMap[block] = m_physBlockCount++;
+			m_blockRuns.set(block, m_blockMap[block]);
+			m_dirty = true;
+		}
+
+		const off64_t phys_lba = (static_cast<off64_t>(m_blockMap[block]) * m_block_size_lba) + offset + m_lba_start;
+		errno = 0;
+		size_t size = m_file->pwrite(ptr8, LBA_TO_BYTES(seg_len), LBA_TO_BYTES(phys_lba));
+		if (size != LBA_TO_BYTES(seg_len)) {
+			// Write error.
+			if (errno == 0) {
+				errno = EIO;
+			}
+			return 0;
+		}
+
+		lba += seg_len;
+		ptr8 += LBA_TO_BYTES(seg_len);
+	}
+
+	// Invalidate cached chunks that were overwritten.
+	const uint32_t chunk_start = lba_start / CISO_CACHE_CHUNK_LBA;
+	const uint32_t chunk_end = (lba_end - 1) / CISO_CACHE_CHUNK_LBA;
+	for (CacheEntry &e : m_cache) {
+		if (e.chunk >= chunk_start && e.chunk <= chunk_end) {
+			e.chunk = ~0U;
+		}
+	}
+
+	return lba_len;
+}
+
+/**
+ * Prepare a new disc image for sparse writing.
+ * Blocks are allocated on write, so the file isn't resized.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int CisoReader::makeSparse(void)
+{
+	return m_file->makeSparse(0);
+}
+
+/**
+ * Flush the file buffers.
+ * For new disc images, the CISO header is written first.
+ */
+void CisoReader::flush(void)
+{
+	if (m_dirty) {
+		writeHeader();
+	}
+	super::flush();
+}
+
+/**
+ * Sort the physical blocks of a new disc image into logical order.
+ * CISO requires this, since the block map only indicates
+ * which blocks are used.
+ * @return True on success; false on error. (errno is set)
+ */
+bool CisoReader::sortBlocks(void)
+{
+	// Determine the sorted position of each physical block.
+	vector<uint16_t> dest(m_physBlockCount);
+	bool sorted = true;
+	uint16_t physBlockIdx = 0;
+	for (unsigned int i = 0; i < ARRAY_SIZE(m_blockMap); i++) {
+		if (m_blockMap[i] == 0xFFFF)
+			continue;
+		dest[m_blockMap[i]] = physBlockIdx;
+		if (m_blockMap[i] != physBlockIdx) {
+			sorted = false;
+		}
+		physBlockIdx++;
+	}
+	if (sorted) {
+		// Blocks were allocated in logical order.
+		return true;
+	}
+
+	// Move the blocks into place, one permutation cycle at a time.
+	const size_t block_size = LBA_TO_BYTES(m_block_size_lba);
+	unique_ptr<uint8_t[]> cur_buf(new uint8_t[block_size]);
+	unique_ptr<uint8_t[]> next_buf(new uint8_t[block_size]);
+	vector<bool> done(m_physBlockCount);
+	for (unsigned int start = 0; start < m_physBlockCount; start++) {
+		if (done[start] || dest[start] == start) {
+			continue;
+		}
+
+		// cur_buf contains the data for physical block `cur`.
+		if (!readPhys(cur_buf.get(), start * m_block_size_lba, m_block_size_lba)) {
+			return false;
+		}
+		unsigned int cur = start;
+		while (!done[cur]) {
+			done[cur] = true;
+			const unsigned int d = dest[cur];
+			if (d != start) {
+				// Save the block that's about to be overwritten.
+				if (!readPhys(next_buf.get(), d * m_block_size_lba, m_block_size_lba)) {
+					return false;
 				}
-				return 0;
 			}
-			size_t size = m_file->read(ptr8, LBA_SIZE, 1);
-			if (size != 1) {
-				// Read error.
+
+			errno = 0;
+			size_t size = m_file->pwrite(cur_buf.get(), block_size,
+				LBA_TO_BYTES(static_cast<off64_t>(d) * m_block_size_lba + m_lba_start));
+			if (size != block_size) {
+				// Write error.
 				if (errno == 0) {
 					errno = EIO;
 				}
-				return 0;
+				return false;
+			}
+
+			std::swap(cur_buf, next_buf);
+			cur = d;
+		}
+	}
+
+	// Update the block map.
+	for (uint16_t &physIdx : m_blockMap) {
+		if (physIdx != 0xFFFF) {
+			physIdx = dest[physIdx];
+		}
+	}
+	decodeBlockMap();
+
+	// Cached chunks may refer to moved blocks.
+	for (CacheEntry &e : m_cache) {
+		e.chunk = ~0U;
+	}
+	return true;
+}
+
+/**
+ * Write the CISO header for a new disc image.
+ * The file is extended to cover the last physical block,
+ * and the physical blocks are sorted if necessary.
+ * @return True on success; false on error. (errno is set)
+ */
+bool CisoReader::writeHeader(void)
+{
+	assert(m_isNew);
+	size_t size;
+
+	// Partially-written blocks may end in a hole, so make sure
+	// the file covers the entire last physical block.
+	const off64_t data_end = LBA_TO_BYTES(static_cast<off64_t>(m_physBlockCount) * m_block_size_lba + m_lba_start);
+	if (m_physBlockCount > 0 && m_file->size() < data_end) {
+		static const uint8_t zero_lba[LBA_SIZE] = {0};
+		errno = 0;
+		size = m_file->pwrite(zero_lba, sizeof(zero_lba), data_end - sizeof(zero_lba));
+		if (size != sizeof(zero_lba)) {
+			// Write error.
+			if (errno == 0) {
+				errno = EIO;
 			}
-			lbas_read++;
+			return false;
 		}
 	}
 
-	return lbas_read;
+	if (!sortBlocks()) {
+		// Error sorting the blocks.
+		return false;
+	}
+
+	// Write the CISO header.
+	unique_ptr<CisoHeader> cisoHeader(new CisoHeader);
+	memcpy(cisoHeader->magic, CISO_MAGIC.data(), CISO_MAGIC.size());
+	cisoHeader->block_size = cpu_to_le32(static_cast<uint32_t>(LBA_TO_BYTES(m_block_size_lba)));
+	for (unsigned int i = 0; i < ARRAY_SIZE(m_blockMap); i++) {
+		cisoHeader->map[i] = (m_blockMap[i] != 0xFFFF);
+	}
+
+	errno = 0;
+	size = m_file->pwrite(cisoHeader.get(), sizeof(*cisoHeader),
+		LBA_TO_BYTES(m_lba_start) - sizeof(*cisoHeader));
+	if (size != sizeof(*cisoHeader)) {
+		// Write error.
+		if (errno == 0) {
+			errno = EIO;
+		}
+		return false;
+	}
+
+	m_dirty = false;
+	return true;
 }
@@ -2,7 +2,7 @@
  * RVT-H Tool (librvth)                                                    *
  * CisoReader.hpp: CISO disc image reader class.                           *
  *                                                                         *
- * Copyright (c) 2018-2019 by David Korth.                                 *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
@@ -10,6 +10,14 @@
 #define __RVTHTOOL_LIBRVTH_READER_CISOREADER_HPP__
 
 #include "Reader.hpp"
+#include "BlockMap.hpp"
+
+// For BYTES_TO_LBA()
+#include "nhcd_structs.h"
+
+// C++ includes
+#include <array>
+#include <memory>
 
 class CisoReader : public Reader
 {
@@ -23,8 +31,29 @@ class CisoReader : public Reader
 		 * @param file		RefFile*.
 		 * @param lba_start	[in] Starting LBA,
 		 * @param lba_len	[in] Length, in LBAs.
+		 * @param probe		[in,opt] Probe window from Reader::open(), or nullptr to read the headers from the file.
 		 */
-		CisoReader(RefFile *file, uint32_t lba_start, uint32_t lba_len);
+		CisoReader(RefFile *file, uint32_t lba_start, uint32_t lba_len, const ProbeBuffer *probe = nullptr);
+
+		/**
+		 * Create a CISO reader for a new disc image.
+		 * Use Reader::create() instead of calling this directly.
+		 *
+		 * @param file		RefFile*. (Must be a new, empty file opened for writing.)
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return CisoReader*, or NULL on error.
+		 */
+		static CisoReader *create(RefFile *file, uint32_t lba_len);
+
+		virtual ~CisoReader();
+
+	private:
+		/**
+		 * Initialize a CISO reader for a new disc image.
+		 * @param file		RefFile*.
+		 * @param lba_len	[in] Length, in LBAs.
+		 */
+		CisoReader(RefFile *file, uint32_t lba_len);
 
 	private:
 		typedef Reader super;
@@ -51,6 +80,106 @@ class CisoReader : public Reader
 		 */
 		uint32_t read(void *ptr, uint32_t lba_start, uint32_t lba_len) final;
 
+		/**
+		 * Read multiple ranges of LBAs from the disc image. (scatter-gather)
+		 * All ranges are mapped to CISO blocks before reading, and
+		 * blocks that are adjacent in the file are read together.
+		 * @param ranges	[in/out] Ranges. (lba_read is set for each range)
+		 * @param count		[in] Number of ranges.
+		 * @return Number of ranges that were read completely.
+		 */
+		unsigned int readv(ReadRange *ranges, unsigned int count) final;
+
+		/**
+		 * Check if a range of LBAs is known to be empty without reading it.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return True if the range is entirely within unallocated CISO blocks; false if not.
+		 */
+		bool isRangeEmpty(uint32_t lba_start, uint32_t lba_len) const final;
+
+		/**
+		 * Get the allocated and unallocated ranges within a range of LBAs.
+		 * Unallocated CISO blocks are unallocated.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs. (Clamped to the image length.)
+		 * @param extents	[out] Extents.
+		 * @return Number of unallocated LBAs.
+		 */
+		uint32_t extents(uint32_t lba_start, uint32_t lba_len, std::vector<Extent> &extents) const final;
+
+		/**
+		 * Get the native block size of the disc image.
+		 * @return CISO block size, in LBAs.
+		 */
+		uint32_t blockSizeLba(void) const final;
+
+		/**
+		 * Write data to the disc image.
+		 *
+		 * Only new disc images can be written. A block is allocated
+		 * the first time non-zero data is written to it.
+		 *
+		 * @param ptr		[in] Write buffer.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Number of LBAs written, or 0 on error.
+		 */
+		uint32_t write(const void *ptr, uint32_t lba_start, uint32_t lba_len) final;
+
+		/**
+		 * Prepare a new disc image for sparse writing.
+		 * Blocks are allocated on write, so the file isn't resized.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int makeSparse(void) final;
+
+		/**
+		 * Flush the file buffers.
+		 * For new disc images, the CISO header is written first.
+		 */
+		void flush(void) final;
+
+	private:
+		/**
+		 * Read a physically contiguous run of LBAs.
+		 * @param ptr		[out] Read buffer.
+		 * @param phys_lba	[in] Starting physical LBA, relative to the first CISO block.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return True on success; false on error. (errno is set)
+		 */
+		bool readPhys(uint8_t *ptr, uint32_t phys_lba, uint32_t lba_len);
+
+		/**
+		 * Read LBAs within a single cache chunk using the chunk cache.
+		 * @param ptr		[out] Read buffer.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs. (Must not cross a chunk boundary.)
+		 * @return True on success; false on error. (errno is set)
+		 */
+		bool readCached(uint8_t *ptr, uint32_t lba_start, uint32_t lba_len);
+
+		/**
+		 * Sort the physical blocks of a new disc image into logical order.
+		 * CISO requires this, since the block map only indicates
+		 * which blocks are used.
+		 * @return True on success; false on error. (errno is set)
+		 */
+		bool sortBlocks(void);
+
+		/**
+		 * Decode m_blockMap into m_blockRuns.
+		 */
+		void decodeBlockMap(void);
+
+		/**
+		 * Write the CISO header for a new disc image.
+		 * The file is extended to cover the last physical block,
+		 * and the physical blocks are sorted if necessary.
+		 * @return True on success; false on error. (errno is set)
+		 */
+		bool writeHeader(void);
+
 	private:
 		#define CISO_HEADER_SIZE 0x8000
 		#define CISO_MAP_SIZE (CISO_HEADER_SIZE - sizeof(uint32_t) - (sizeof(char) * 4))
@@ -60,6 +189,10 @@ class CisoReader : public Reader
 		#define CISO_BLOCK_SIZE_MIN (32768)
 		#define CISO_BLOCK_SIZE_MAX (16*1024*1024)
 
+		// Default block size for new disc images.
+		// This is doubled if the image doesn't fit in the block map.
+		#define CISO_BLOCK_SIZE_DEFAULT (2*1024*1024)
+
 		// NOTE: reader.lba_len is the virtual image size.
 		// real_lba_len is the actual image size.
 		uint32_t m_real_lba_len;
@@ -71,6 +204,28 @@ class CisoReader : public Reader
 		// 0x0000 == first block after CISO header.
 		// 0xFFFF == empty block.
 		uint16_t m_blockMap[CISO_MAP_SIZE];
+
+		// Decoded block map, used for reading.
+		BlockMap m_blockRuns;
+
+		// New disc image state.
+		bool m_isNew;			// True if this is a new disc image.
+		bool m_dirty;			// True if the CISO header needs to be written.
+		uint16_t m_physBlockCount;	// Number of allocated physical blocks.
+
+		// Chunk cache for small reads, e.g. disc headers and
+		// partition tables that are read multiple times.
+		// Chunks are 32 KB, which is the minimum CISO block size,
+		// so a chunk never crosses a CISO block boundary.
+		#define CISO_CACHE_CHUNK_LBA BYTES_TO_LBA(CISO_BLOCK_SIZE_MIN)
+		#define CISO_CACHE_COUNT 8
+		struct CacheEntry {
+			std::unique_ptr<uint8_t[]> data;	// Chunk data
+			uint32_t chunk = ~0U;			// Logical chunk index (~0U if unused)
+			uint32_t last_used = 0;			// LRU counter value
+		};
+		std::array<CacheEntry, CISO_CACHE_COUNT> m_cache;
+		uint32_t m_cacheCounter;
 };
 
 #endif /* __RVTHTOOL_LIBRVTH_READER_CISOREADER_HPP__ */
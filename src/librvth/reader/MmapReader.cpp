@@ -0,0 +1,230 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * MmapReader.cpp: Memory-mapped disc image reader class.                  *
+ * Used for plain binary disc images on local storage.                     *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "MmapReader.hpp"
+#include "StatsCounters.hpp"
+#include "Trace.hpp"
+
+// For LBA_TO_BYTES()
+#include "nhcd_structs.h"
+
+// C includes (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+// Window size for 32-bit systems.
+#define MMAP_WINDOW_SIZE (64U*1024U*1024U)
+
+/**
+ * Create a memory-mapped reader for a disc image.
+ *
+ * NOTE: If lba_start == 0 and lba_len == 0, the entire file
+ * will be used.
+ *
+ * @param file		RefFile*.
+ * @param lba_start	[in] Starting LBA,
+ * @param lba_len	[in] Length, in LBAs.
+ */
+MmapReader::MmapReader(RefFile *file, uint32_t lba_start, uint32_t lba_len)
+	: super(file, lba_start, lba_len)
+	, m_map(nullptr)
+	, m_map_offset(0)
+	, m_map_size(0)
+	, m_filesize(0)
+	, m_windowed(sizeof(void*) < 8)
+{
+	if (!isOpen()) {
+		// File wasn't opened.
+		return;
+	}
+
+	// NOTE: The mapped region must not extend past the end of the file.
+	m_filesize = m_file->size();
+	if (m_filesize <= 0 || m_lba_len == 0) {
+		// Empty file. Nothing to map.
+		return;
+	}
+
+	if (!m_windowed) {
+		// Map the entire image.
+		// If this fails, regular file I/O will be used.
+		mapped(m_lba_start, m_lba_len, true);
+	}
+}
+
+MmapReader::~MmapReader()
+{
+	RefFile::unmap(m_map, m_map_size);
+}
+
+/**
+ * Get a pointer to mapped data.
+ * In windowed mode, the window is moved if necessary.
+ * @param lba_start	[in] Starting LBA. (absolute)
+ * @param lba_len	[in] Length, in LBAs.
+ * @param may_remap	[in] If true, the window may be moved.
+ * @return Pointer to the mapped data, or nullptr if it isn't mapped.
+ */
+const uint8_t *MmapReader::mapped(uint32_t lba_start, uint32_t lba_len, bool may_remap)
+{
+	const off64_t offset = LBA_TO_BYTES(static_cast<off64_t>(lba_start));
+	const off64_t end = offset + LBA_TO_BYTES(static_cast<off64_t>(lba_len));
+	if (end > m_filesize) {
+		// Past the end of the file when it was mapped.
+		return nullptr;
+	}
+
+	if (m_map && offset >= m_map_offset &&
+	    end <= m_map_offset + static_cast<off64_t>(m_map_size))
+	{
+		// Data is in the mapped region.
+		return m_map + (offset - m_map_offset);
+	}
+
+	if (!may_remap || (m_map && !m_windowed)) {
+		// Image is already mapped; this data isn't part of it.
+		return nullptr;
+	}
+
+	// Map a new region.
+	const off64_t align = static_cast<off64_t>(RefFile::mapAlignment());
+	off64_t map_offset, map_end;
+	if (m_windowed) {
+		// Map a window starting at the requested data.
+		map_offset = offset - (offset % align);
+		map_end = map_offset + MMAP_WINDOW_SIZE;
+		if (map_end < end) {
+			map_end = end;
+		}
+	} else {
+		// Map the entire image.
+		map_offset = LBA_TO_BYTES(static_cast<off64_t>(m_lba_start));
+		map_offset -= (map_offset % align);
+		map_end = LBA_TO_BYTES(static_cast<off64_t>(m_lba_start) + m_lba_len);
+	}
+	if (map_end > m_filesize) {
+		map_end = m_filesize;
+	}
+
+	RefFile::unmap(m_map, m_map_size);
+	m_map_offset = map_offset;
+	m_map_size = static_cast<size_t>(map_end - map_offset);
+	m_map = m_file->map(m_map_offset, m_map_size);
+	if (!m_map) {
+		// Unable to map the image.
+		// Don't try again in windowed mode.
+		m_map_size = 0;
+		m_windowed = false;
+		m_filesize = 0;
+		return nullptr;
+	}
+
+	return m_map + (offset - m_map_offset);
+}
+
+/**
+ * Read data from the disc image.
+ * @param ptr		[out] Read buffer.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Number of LBAs read, or 0 on error.
+ */
+uint32_t MmapReader::read(void *ptr, uint32_t lba_start, uint32_t lba_len)
+{
+	RVTH_TRACE_SPAN_BYTES("MmapReader::read", LBA_TO_BYTES(lba_len));
+
+	// LBA bounds checking.
+	assert(lba_start + lba_len <= m_lba_len);
+	if (lba_start + lba_len > m_lba_len) {
+		// Out of range.
+		errno = EIO;
+		return 0;
+	} else if (StatsCounters::cancelled()) {
+		// Operation was cancelled.
+		errno = ECANCELED;
+		return 0;
+	}
+
+	// NOTE: In windowed mode, read() doesn't move the window,
+	// since that would invalidate the current view.
+	const uint8_t *const src = mapped(m_lba_start + lba_start, lba_len, false);
+	if (!src) {
+		// Not mapped. Use regular file I/O.
+		return super::read(ptr, lba_start, lba_len);
+	}
+
+	{
+		// NOTE: Reading from the mapping may block on page faults.
+		StatsCounters::throttleIO(LBA_TO_BYTES(lba_len));
+		StatsTimer timer(StatsCounters::TIMER_IO);
+		ReadLatencyTimer latency(LBA_TO_BYTES(static_cast<int64_t>(m_lba_start) + lba_start),
+			LBA_TO_BYTES(lba_len));
+		memcpy(ptr, src, LBA_TO_BYTES(lba_len));
+	}
+	StatsCounters::addIO(LBA_TO_BYTES(lba_len), false, false);
+	return lba_len;
+}
+
+/**
+ * Read multiple ranges of LBAs from the disc image. (scatter-gather)
+ * If the entire image is mapped, each range is copied from the
+ * mapping using read(). Otherwise, PlainReader::readv() is used.
+ * @param ranges	[in/out] Ranges. (lba_read is set for each range)
+ * @param count		[in] Number of ranges.
+ * @return Number of ranges that were read completely.
+ */
+unsigned int MmapReader::readv(ReadRange *ranges, unsigned int count)
+{
+	if (!m_map || m_windowed) {
+		// Not mapped, or read() doesn't move the window.
+		// Use regular file I/O.
+		return super::readv(ranges, count);
+	}
+	return Reader::readv(ranges, count);
+}
+
+/**
+ * Get a read-only view of data in the disc image.
+ *
+ * The data is returned directly from the mapped image.
+ * If it can't be mapped, it's read into the caller's buffer.
+ *
+ * The view remains valid until the next call to readView()
+ * on this Reader, or until the Reader is deleted.
+ *
+ * @param buf		[out] Fallback buffer. (Must be at least lba_len LBAs.)
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Pointer to the data, or nullptr on error.
+ */
+const void *MmapReader::readView(void *buf, uint32_t lba_start, uint32_t lba_len)
+{
+	// LBA bounds checking.
+	assert(lba_start + lba_len <= m_lba_len);
+	if (lba_start + lba_len > m_lba_len) {
+		// Out of range.
+		errno = EIO;
+		return nullptr;
+	} else if (StatsCounters::cancelled()) {
+		// Operation was cancelled.
+		errno = ECANCELED;
+		return nullptr;
+	}
+
+	const uint8_t *const src = mapped(m_lba_start + lba_start, lba_len, true);
+	if (!src) {
+		// Not mapped. Use regular file I/O.
+		return super::readView(buf, lba_start, lba_len);
+	}
+
+	// The pages are read when the caller accesses the view.
+	StatsCounters::throttleIO(LBA_TO_BYTES(lba_len));
+	return src;
+}
@@ -0,0 +1,106 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * MmapReader.hpp: Memory-mapped disc image reader class.                  *
+ * Used for plain binary disc images on local storage.                     *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_READER_MMAPREADER_HPP__
+#define __RVTHTOOL_LIBRVTH_READER_MMAPREADER_HPP__
+
+#include "PlainReader.hpp"
+
+// C includes (C++ namespace)
+#include <cstddef>
+
+/**
+ * Memory-mapped disc image reader.
+ *
+ * On 64-bit systems, the entire image is mapped when the reader
+ * is created. On 32-bit systems, there isn't enough address space
+ * for large images, so readView() maps a window of the image
+ * on demand, and read() uses regular file I/O.
+ *
+ * If the image can't be mapped, this works like PlainReader.
+ * Writes always use regular file I/O.
+ */
+class MmapReader : public PlainReader
+{
+	public:
+		/**
+		 * Create a memory-mapped reader for a disc image.
+		 *
+		 * NOTE: If lba_start == 0 and lba_len == 0, the entire file
+		 * will be used.
+		 *
+		 * @param file		RefFile*.
+		 * @param lba_start	[in] Starting LBA,
+		 * @param lba_len	[in] Length, in LBAs.
+		 */
+		MmapReader(RefFile *file, uint32_t lba_start, uint32_t lba_len);
+		~MmapReader() final;
+
+	private:
+		typedef PlainReader super;
+		DISABLE_COPY(MmapReader)
+
+	public:
+		/** I/O functions **/
+
+		/**
+		 * Read data from the disc image.
+		 * @param ptr		[out] Read buffer.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Number of LBAs read, or 0 on error.
+		 */
+		uint32_t read(void *ptr, uint32_t lba_start, uint32_t lba_len) final;
+
+		/**
+		 * Read multiple ranges of LBAs from the disc image. (scatter-gather)
+		 * If the entire image is mapped, each range is copied from the
+		 * mapping using read(). Otherwise, PlainReader::readv() is used.
+		 * @param ranges	[in/out] Ranges. (lba_read is set for each range)
+		 * @param count		[in] Number of ranges.
+		 * @return Number of ranges that were read completely.
+		 */
+		unsigned int readv(ReadRange *ranges, unsigned int count) final;
+
+		/**
+		 * Get a read-only view of data in the disc image.
+		 *
+		 * The data is returned directly from the mapped image.
+		 * If it can't be mapped, it's read into the caller's buffer.
+		 *
+		 * The view remains valid until the next call to readView()
+		 * on this Reader, or until the Reader is deleted.
+		 *
+		 * @param buf		[out] Fallback buffer. (Must be at least lba_len LBAs.)
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Pointer to the data, or nullptr on error.
+		 */
+		const void *readView(void *buf, uint32_t lba_start, uint32_t lba_len) final;
+
+	private:
+		/**
+		 * Get a pointer to mapped data.
+		 * In windowed mode, the window is moved if necessary.
+		 * @param lba_start	[in] Starting LBA. (absolute)
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @param may_remap	[in] If true, the window may be moved.
+		 * @return Pointer to the mapped data, or nullptr if it isn't mapped.
+		 */
+		const uint8_t *mapped(uint32_t lba_start, uint32_t lba_len, bool may_remap);
+
+	private:
+		const uint8_t *m_map;	// Mapped region
+		off64_t m_map_offset;	// File offset of the mapped region
+		size_t m_map_size;	// Size of the mapped region
+		off64_t m_filesize;	// File size when the reader was created
+		bool m_windowed;	// If true, only a window of the image is mapped.
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_READER_MMAPREADER_HPP__ */
@@ -0,0 +1,119 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * PipeReader.cpp: Write-only "reader" for plain disc images that are      *
+ * streamed to a pipe, e.g. standard output.                               *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "PipeReader.hpp"
+#include "Trace.hpp"
+
+// For LBA_TO_BYTES()
+#include "nhcd_structs.h"
+
+// C includes. (C++ namespace)
+#include <cassert>
+#include <cerrno>
+
+// C++ includes.
+#include <algorithm>
+
+/**
+ * Create a pipe reader for a new plain disc image.
+ * @param file		RefFile*. (Must be a stream.)
+ * @param lba_len	[in] Length, in LBAs.
+ */
+PipeReader::PipeReader(RefFile *file, uint32_t lba_len)
+	: super(file, 0, lba_len)
+	, m_lba_pos(0)
+{
+	assert(!file || file->isStream());
+	m_type = RVTH_ImageType_GCM;
+}
+
+/**
+ * Read data from the disc image.
+ * Not supported; always fails with ESPIPE.
+ * @param ptr		[out] Read buffer.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Number of LBAs read, or 0 on error.
+ */
+uint32_t PipeReader::read(void *ptr, uint32_t lba_start, uint32_t lba_len)
+{
+	RVTH_TRACE_SPAN_BYTES("PipeReader::read", LBA_TO_BYTES(lba_len));
+
+	UNUSED(ptr);
+	UNUSED(lba_start);
+	UNUSED(lba_len);
+	errno = ESPIPE;
+	return 0;
+}
+
+/**
+ * Write zeroes up to the specified LBA.
+ * @param lba_end	[in] Absolute LBA to stop at.
+ * @return True on success; false on error. (check errno)
+ */
+bool PipeReader::fillZero(uint32_t lba_end)
+{
+	static const uint8_t zero[64*1024] = {};
+	while (m_lba_pos < lba_end) {
+		const uint32_t lba_cur = std::min(lba_end - m_lba_pos,
+			static_cast<uint32_t>(BYTES_TO_LBA(sizeof(zero))));
+		const size_t size = static_cast<size_t>(LBA_TO_BYTES(lba_cur));
+		if (m_file->write(zero, size) != size) {
+			return false;
+		}
+		m_lba_pos += lba_cur;
+	}
+	return true;
+}
+
+/**
+ * Write data to the disc image.
+ * @param ptr		[in] Write buffer.
+ * @param lba_start	[in] Starting LBA. (Must not be before the last LBA written.)
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Number of LBAs written, or 0 on error.
+ */
+uint32_t PipeReader::write(const void *ptr, uint32_t lba_start, uint32_t lba_len)
+{
+	RVTH_TRACE_SPAN_BYTES("PipeReader::write", LBA_TO_BYTES(lba_len));
+
+	// LBA bounds checking.
+	lba_start += m_lba_start;
+	assert(lba_start + lba_len <= m_lba_start + m_lba_len);
+	if (lba_start + lba_len > m_lba_start + m_lba_len) {
+		// Out of range.
+		errno = EIO;
+		return 0;
+	} else if (lba_start < m_lba_pos) {
+		// Can't seek backwards in a pipe.
+		errno = ESPIPE;
+		return 0;
+	}
+
+	// Fill the skipped LBAs with zeroes.
+	if (!fillZero(lba_start)) {
+		return 0;
+	}
+
+	// Write the data.
+	const size_t size = m_file->write(ptr, LBA_TO_BYTES(lba_len));
+	const uint32_t lba_written = static_cast<uint32_t>(size / LBA_SIZE);
+	m_lba_pos += lba_written;
+	return lba_written;
+}
+
+/**
+ * Prepare a new disc image for sparse writing.
+ * Nothing needs to be done, since skipped LBAs are zero-filled.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int PipeReader::makeSparse(void)
+{
+	return 0;
+}
@@ -0,0 +1,78 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * PipeReader.hpp: Write-only "reader" for plain disc images that are      *
+ * streamed to a pipe, e.g. standard output.                               *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_READER_PIPEREADER_HPP__
+#define __RVTHTOOL_LIBRVTH_READER_PIPEREADER_HPP__
+
+#include "Reader.hpp"
+
+/**
+ * Plain disc image written to a stream. (See RefFile::isStream().)
+ *
+ * Pipes can't seek, so LBAs must be written in increasing order.
+ * LBAs that are skipped, e.g. sparse blocks, are filled with zeroes
+ * when a later LBA is written, so the caller must write the last LBA.
+ * Reading and rewriting earlier LBAs fails with ESPIPE.
+ */
+class PipeReader : public Reader
+{
+	public:
+		/**
+		 * Create a pipe reader for a new plain disc image.
+		 * @param file		RefFile*. (Must be a stream.)
+		 * @param lba_len	[in] Length, in LBAs.
+		 */
+		PipeReader(RefFile *file, uint32_t lba_len);
+
+	private:
+		typedef Reader super;
+		DISABLE_COPY(PipeReader)
+
+	public:
+		/** I/O functions **/
+
+		/**
+		 * Read data from the disc image.
+		 * Not supported; always fails with ESPIPE.
+		 * @param ptr		[out] Read buffer.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Number of LBAs read, or 0 on error.
+		 */
+		uint32_t read(void *ptr, uint32_t lba_start, uint32_t lba_len) final;
+
+		/**
+		 * Write data to the disc image.
+		 * @param ptr		[in] Write buffer.
+		 * @param lba_start	[in] Starting LBA. (Must not be before the last LBA written.)
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Number of LBAs written, or 0 on error.
+		 */
+		uint32_t write(const void *ptr, uint32_t lba_start, uint32_t lba_len) final;
+
+		/**
+		 * Prepare a new disc image for sparse writing.
+		 * Nothing needs to be done, since skipped LBAs are zero-filled.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int makeSparse(void) final;
+
+	private:
+		/**
+		 * Write zeroes up to the specified LBA.
+		 * @param lba_end	[in] Absolute LBA to stop at.
+		 * @return True on success; false on error. (check errno)
+		 */
+		bool fillZero(uint32_t lba_end);
+
+	private:
+		uint32_t m_lba_pos;	// Next absolute LBA in the stream
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_READER_PIPEREADER_HPP__ */
@@ -8,6 +8,7 @@
  ***************************************************************************/
 
 #include "PlainReader.hpp"
+#include "Trace.hpp"
 
 // For LBA_TO_BYTES()
 #include "nhcd_structs.h"
@@ -19,6 +20,10 @@
 #include <cassert>
 #include <cerrno>
 
+// C++ includes
+#include <vector>
+using std::vector;
+
 /**
  * Create a plain reader for a disc image.
  *
@@ -94,6 +99,8 @@ PlainReader::PlainReader(RefFile *file, uint32_t lba_start, uint32_t lba_len)
  */
 uint32_t PlainReader::read(void *ptr, uint32_t lba_start, uint32_t lba_len)
 {
+	RVTH_TRACE_SPAN_BYTES("PlainReader::read", LBA_TO_BYTES(lba_len));
+
 	// LBA bounds checking.
 	// TODO: Check for overflow?
 	lba_start += m_lba_start;
@@ -104,18 +111,44 @@ uint32_t PlainReader::read(void *ptr, uint32_t lba_start, uint32_t lba_len)
 		return 0;
 	}
 
-	// Seek to lba_start.
-	int ret = m_file->seeko(LBA_TO_BYTES(lba_start), SEEK_SET);
-	if (ret != 0) {
-		// Seek error.
-		if (errno == 0) {
+	// Read the data.
+	const size_t size = m_file->pread(ptr, LBA_TO_BYTES(lba_len), LBA_TO_BYTES(lba_start));
+	return static_cast<uint32_t>(size / LBA_SIZE);
+}
+
+/**
+ * Read multiple ranges of LBAs from the disc image. (scatter-gather)
+ * Ranges that are adjacent in the file are read using a single
+ * RefFile::preadv() call.
+ * @param ranges	[in/out] Ranges. (lba_read is set for each range)
+ * @param count		[in] Number of ranges.
+ * @return Number of ranges that were read completely.
+ */
+unsigned int PlainReader::readv(ReadRange *ranges, unsigned int count)
+{
+	vector<ReadExtent> extents;
+	extents.reserve(count);
+	for (unsigned int i = 0; i < count; i++) {
+		ReadRange &range = ranges[i];
+
+		// LBA bounds checking.
+		assert(range.lba_start + range.lba_len <= m_lba_len);
+		if (range.lba_start + range.lba_len > m_lba_len) {
+			// Out of range.
 			errno = EIO;
+			range.lba_read = 0;
+			continue;
+		}
+
+		range.lba_read = range.lba_len;
+		if (range.lba_len != 0) {
+			extents.push_back({LBA_TO_BYTES(static_cast<off64_t>(m_lba_start) + range.lba_start),
+				static_cast<uint8_t*>(range.ptr),
+				static_cast<uint32_t>(LBA_TO_BYTES(range.lba_len)), i});
 		}
-		return 0;
 	}
 
-	// Read the data.
-	return static_cast<uint32_t>(m_file->read(ptr, LBA_SIZE, lba_len));
+	return readExtents(extents, ranges, count);
 }
 
 /**
@@ -128,6 +161,8 @@ uint32_t PlainReader::read(void *ptr, uint32_t lba_start, uint32_t lba_len)
  */
 uint32_t PlainReader::write(const void *ptr, uint32_t lba_start, uint32_t lba_len)
 {
+	RVTH_TRACE_SPAN_BYTES("PlainReader::write", LBA_TO_BYTES(lba_len));
+
 	// LBA bounds checking.
 	// TODO: Check for overflow?
 	lba_start += m_lba_start;
@@ -138,16 +173,74 @@ uint32_t PlainReader::write(const void *ptr, uint32_t lba_start, uint32_t lba_le
 		return 0;
 	}
 
-	// Seek to lba_start.
-	int ret = m_file->seeko(LBA_TO_BYTES(lba_start), SEEK_SET);
-	if (ret != 0) {
-		// Seek error.
-		if (errno == 0) {
-			errno = EIO;
-		}
-		return 0;
+	// Write the data.
+	const size_t size = m_file->pwrite(ptr, LBA_TO_BYTES(lba_len), LBA_TO_BYTES(lba_start));
+	return static_cast<uint32_t>(size / LBA_SIZE);
+}
+
+/**
+ * Allocate disk space for a new disc image up front.
+ * @return 0 on success; negative POSIX error code on error. (-ENOTSUP if not supported)
+ */
+int PlainReader::preallocate(void)
+{
+	return m_file->preallocate(LBA_TO_BYTES(static_cast<off64_t>(m_lba_start) + m_lba_len));
+}
+
+/**
+ * Deallocate a range of LBAs that only contain zeroes.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return 0 on success; negative POSIX error code on error. (-ENOTSUP if not supported)
+ */
+int PlainReader::discard(uint32_t lba_start, uint32_t lba_len)
+{
+	// LBA bounds checking.
+	if (lba_start > m_lba_len || lba_len > m_lba_len - lba_start) {
+		// Out of range.
+		return -EIO;
 	}
 
-	// Write the data.
-	return static_cast<uint32_t>(m_file->write(ptr, LBA_SIZE, lba_len));
+	return m_file->punchHole(LBA_TO_BYTES(static_cast<off64_t>(m_lba_start) + lba_start),
+		LBA_TO_BYTES(static_cast<off64_t>(lba_len)));
+}
+
+/**
+ * Get the file offset of a range of LBAs.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @param pOffset	[out] File offset, in bytes.
+ * @return True if the range can be read directly from the file; false if not.
+ */
+bool PlainReader::fileOffset(uint32_t lba_start, uint32_t lba_len, off64_t *pOffset) const
+{
+	// LBA bounds checking.
+	if (lba_start > m_lba_len || lba_len > m_lba_len - lba_start) {
+		// Out of range.
+		return false;
+	}
+
+	*pOffset = LBA_TO_BYTES(m_lba_start + lba_start);
+	return true;
+}
+
+/**
+ * Get the allocated and unallocated ranges within a range of LBAs.
+ * Holes in sparse files are unallocated.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs. (Clamped to the image length.)
+ * @param extents	[out] Extents.
+ * @return Number of unallocated LBAs.
+ */
+uint32_t PlainReader::extents(uint32_t lba_start, uint32_t lba_len, vector<Extent> &extents) const
+{
+	extents.clear();
+	if (lba_start >= m_lba_len) {
+		return 0;
+	}
+	if (lba_len > m_lba_len - lba_start) {
+		lba_len = m_lba_len - lba_start;
+	}
+	return addFileExtents(m_file, LBA_TO_BYTES(static_cast<off64_t>(m_lba_start) + lba_start),
+		lba_start, lba_len, extents);
 }
@@ -3,7 +3,7 @@
  * PlainReader.hpp: Plain disc image reader class.                         *
  * Used for plain binary disc images, e.g. .gcm and RVT-H images.          *
  *                                                                         *
- * Copyright (c) 2018-2019 by David Korth.                                 *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
@@ -41,7 +41,17 @@ class PlainReader : public Reader
 		 * @param lba_len	[in] Length, in LBAs.
 		 * @return Number of LBAs read, or 0 on error.
 		 */
-		uint32_t read(void *ptr, uint32_t lba_start, uint32_t lba_len) final;
+		uint32_t read(void *ptr, uint32_t lba_start, uint32_t lba_len) override;
+
+		/**
+		 * Read multiple ranges of LBAs from the disc image. (scatter-gather)
+		 * Ranges that are adjacent in the file are read using a single
+		 * RefFile::preadv() call.
+		 * @param ranges	[in/out] Ranges. (lba_read is set for each range)
+		 * @param count		[in] Number of ranges.
+		 * @return Number of ranges that were read completely.
+		 */
+		unsigned int readv(ReadRange *ranges, unsigned int count) override;
 
 		/**
 		 * Write data to the disc image.
@@ -51,6 +61,39 @@ class PlainReader : public Reader
 		 * @return Number of LBAs read, or 0 on error.
 		 */
 		uint32_t write(const void *ptr, uint32_t lba_start, uint32_t lba_len) final;
+
+		/**
+		 * Allocate disk space for a new disc image up front.
+		 * @return 0 on success; negative POSIX error code on error. (-ENOTSUP if not supported)
+		 */
+		int preallocate(void) final;
+
+		/**
+		 * Deallocate a range of LBAs that only contain zeroes.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return 0 on success; negative POSIX error code on error. (-ENOTSUP if not supported)
+		 */
+		int discard(uint32_t lba_start, uint32_t lba_len) final;
+
+		/**
+		 * Get the file offset of a range of LBAs.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @param pOffset	[out] File offset, in bytes.
+		 * @return True if the range can be read directly from the file; false if not.
+		 */
+		bool fileOffset(uint32_t lba_start, uint32_t lba_len, off64_t *pOffset) const final;
+
+		/**
+		 * Get the allocated and unallocated ranges within a range of LBAs.
+		 * Holes in sparse files are unallocated.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs. (Clamped to the image length.)
+		 * @param extents	[out] Extents.
+		 * @return Number of unallocated LBAs.
+		 */
+		uint32_t extents(uint32_t lba_start, uint32_t lba_len, std::vector<Extent> &extents) const final;
 };
 
 #ifdef __cplusplus
@@ -0,0 +1,71 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * ProbeBuffer.cpp: Start of a disc image, read once for format detection. *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "ProbeBuffer.hpp"
+
+// C includes (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+const size_t ProbeBuffer::PROBE_SIZE;
+
+ProbeBuffer::ProbeBuffer()
+	: m_size(0)
+	, m_offset(0)
+{ }
+
+/**
+ * Read the probe window from a file.
+ * The window may be shorter than PROBE_SIZE if the file is.
+ * @param file		[in] RefFile*
+ * @param offset	[in] File offset of the start of the window.
+ * @return 0 on success; negative POSIX error code on error. (errno is set)
+ */
+int ProbeBuffer::read(RefFile *file, off64_t offset)
+{
+	assert(file != nullptr);
+	if (!m_data) {
+		m_data.reset(new uint8_t[PROBE_SIZE]);
+	}
+
+	m_offset = offset;
+	errno = 0;
+	m_size = file->pread(m_data.get(), PROBE_SIZE, offset);
+	if (m_size != PROBE_SIZE && errno != 0) {
+		// Actual error, not a short file.
+		const int err = errno;
+		m_size = 0;
+		errno = err;
+		return -err;
+	}
+	return 0;
+}
+
+/**
+ * Read data using the probe window if it's entirely within
+ * the window, or from the file if it isn't.
+ * @param probe		[in,opt] ProbeBuffer, or nullptr to always read from the file.
+ * @param file		[in] RefFile* (must be the file the window was read from)
+ * @param ptr		[out] Read buffer.
+ * @param size		[in] Number of bytes to read.
+ * @param offset	[in] File offset.
+ * @return Number of bytes read.
+ */
+size_t ProbeBuffer::pread(const ProbeBuffer *probe, RefFile *file,
+	void *ptr, size_t size, off64_t offset)
+{
+	if (probe && offset >= probe->m_offset &&
+	    static_cast<uint64_t>(offset - probe->m_offset) <= probe->m_size &&
+	    size <= probe->m_size - static_cast<size_t>(offset - probe->m_offset))
+	{
+		memcpy(ptr, &probe->m_data[offset - probe->m_offset], size);
+		return size;
+	}
+	return file->pread(ptr, size, offset);
+}
@@ -0,0 +1,98 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * ProbeBuffer.hpp: Start of a disc image, read once for format detection. *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_READER_PROBEBUFFER_HPP__
+#define __RVTHTOOL_LIBRVTH_READER_PROBEBUFFER_HPP__
+
+#include "RefFile.hpp"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// C++ includes
+#include <memory>
+
+/**
+ * Start of a disc image, read once when the image is opened.
+ *
+ * All of the format checks parse this window from memory, and the
+ * selected Reader reads its container headers from it, so opening
+ * an image is one read instead of several small scattered reads.
+ * This adds up when scanning directories with many disc images.
+ *
+ * Reads that aren't entirely within the window go to the file.
+ */
+class ProbeBuffer
+{
+	public:
+		ProbeBuffer();
+
+	private:
+		DISABLE_COPY(ProbeBuffer)
+
+	public:
+		// Probe window size. This covers the CISO header,
+		// the WBFS header and disc info, and SDK headers.
+		static const size_t PROBE_SIZE = 64*1024;
+
+		/**
+		 * Read the probe window from a file.
+		 * The window may be shorter than PROBE_SIZE if the file is.
+		 * @param file		[in] RefFile*
+		 * @param offset	[in] File offset of the start of the window.
+		 * @return 0 on success; negative POSIX error code on error. (errno is set)
+		 */
+		int read(RefFile *file, off64_t offset);
+
+		/**
+		 * Get the probe window data.
+		 * @return Probe window data.
+		 */
+		inline const uint8_t *data(void) const
+		{
+			return m_data.get();
+		}
+
+		/**
+		 * Get the number of bytes in the probe window.
+		 * @return Number of bytes in the probe window.
+		 */
+		inline size_t size(void) const
+		{
+			return m_size;
+		}
+
+		/**
+		 * Get the file offset of the start of the probe window.
+		 * @return File offset.
+		 */
+		inline off64_t offset(void) const
+		{
+			return m_offset;
+		}
+
+		/**
+		 * Read data using the probe window if it's entirely within
+		 * the window, or from the file if it isn't.
+		 * @param probe		[in,opt] ProbeBuffer, or nullptr to always read from the file.
+		 * @param file		[in] RefFile* (must be the file the window was read from)
+		 * @param ptr		[out] Read buffer.
+		 * @param size		[in] Number of bytes to read.
+		 * @param offset	[in] File offset.
+		 * @return Number of bytes read.
+		 */
+		static size_t pread(const ProbeBuffer *probe, RefFile *file,
+			void *ptr, size_t size, off64_t offset);
+
+	private:
+		std::unique_ptr<uint8_t[]> m_data;	// Probe window
+		size_t m_size;				// Number of bytes in the window
+		off64_t m_offset;			// File offset of the window
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_READER_PROBEBUFFER_HPP__ */
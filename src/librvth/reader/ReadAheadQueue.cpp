@@ -0,0 +1,295 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * ReadAheadQueue.cpp: Asynchronous sequential read-ahead for a Reader.    *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "ReadAheadQueue.hpp"
+#include "AsyncReader.hpp"
+
+// For LBA_TO_BYTES()
+#include "nhcd_structs.h"
+
+// C includes (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+// C++ includes
+#include <system_error>
+using std::lock_guard;
+using std::mutex;
+using std::unique_lock;
+
+/**
+ * Start reading ahead.
+ * @param reader	[in] Source reader.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Number of LBAs to read.
+ * @param lba_chunk	[in] Chunk size, in LBAs.
+ * @param depth		[in] Number of chunk buffers. (minimum 2)
+ * @param used		[in,opt] Chunk map. Chunks marked as unused are
+ *			returned zero-filled without reading the source.
+ * @param alignment	[in,opt] Chunk buffer alignment. (0 for default; otherwise, must be a power of two)
+ */
+ReadAheadQueue::ReadAheadQueue(Reader *reader, uint32_t lba_start, uint32_t lba_len,
+	uint32_t lba_chunk, unsigned int depth, const std::vector<bool> *used,
+	unsigned int alignment)
+	: m_reader(reader)
+	, m_lba_start(lba_start)
+	, m_lba_len(lba_len)
+	, m_lba_chunk(lba_chunk)
+	, m_chunk_count(0)
+	, m_produced(0)
+	, m_consumed(0)
+	, m_holding(false)
+	, m_stop(false)
+	, m_async(false)
+	, m_stats(StatsCounters::current())
+{
+	assert(reader != nullptr);
+	assert(lba_chunk != 0);
+	if (!reader || lba_chunk == 0) {
+		return;
+	}
+	if (depth < 2) {
+		depth = 2;
+	}
+
+	m_chunk_count = (lba_len / lba_chunk) + (lba_len % lba_chunk != 0);
+	if (used) {
+		m_used = *used;
+	}
+	if (depth > m_chunk_count && m_chunk_count >= 2) {
+		// No point in allocating more buffers than chunks.
+		depth = m_chunk_count;
+	}
+
+	// Allocate the chunk buffers.
+	// Default alignment is a 4 KB page.
+	if (alignment == 0) {
+		alignment = 4096;
+	} else if (alignment < sizeof(void*)) {
+		alignment = sizeof(void*);
+	}
+	assert((alignment & (alignment - 1)) == 0);
+	m_bufs.reserve(depth);
+	for (unsigned int i = 0; i < depth; i++) {
+		m_bufs.emplace_back(static_cast<size_t>(LBA_TO_BYTES(lba_chunk)), alignment);
+		if (!m_bufs.back()) {
+			// Error allocating memory.
+			m_bufs.clear();
+			return;
+		}
+	}
+	m_errs.resize(depth);
+
+	// Start the read-ahead thread.
+	// If the thread can't be started, next() will read synchronously.
+	try {
+		m_thread = std::thread(&ReadAheadQueue::readThread, this);
+		m_async = true;
+	} catch (const std::system_error&) {
+		m_async = false;
+	}
+}
+
+ReadAheadQueue::~ReadAheadQueue()
+{
+	if (m_async) {
+		{
+			lock_guard<mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_cond.notify_all();
+		m_thread.join();
+	}
+}
+
+/**
+ * Read-ahead thread function.
+ */
+void ReadAheadQueue::readThread(void)
+{
+	StatsScope scope(m_stats);
+	const uint32_t depth = static_cast<uint32_t>(m_bufs.size());
+
+	// Reads for all free buffers are kept in flight, so the source
+	// device has multiple requests queued if io_uring is available.
+	AsyncReader aio(m_reader, depth);
+	std::vector<bool> done(depth);	// Per-buffer: Chunk has been read
+
+	// If reads are synchronous, wait for more than one free buffer
+	// while the caller still has chunks to process, so adjacent chunks
+	// are read as one batch. (See AsyncReader and Reader::readv().)
+	const uint32_t batch = (aio.isAsync() ? 1 : depth - 1);
+
+	uint32_t submitted = 0;	// Number of chunks submitted
+	uint32_t produced = 0;	// Number of chunks read, in order
+	while (produced < m_chunk_count) {
+		uint32_t free_limit;
+		{
+			// If no reads are in flight, wait for a free buffer.
+			// Chunks [m_consumed, submitted) are either in flight,
+			// waiting to be returned by next(), or held by the caller.
+			unique_lock<mutex> lock(m_mutex);
+			if (submitted == produced) {
+				m_cond.wait(lock, [this, submitted, produced, depth, batch] {
+					if (m_stop)
+						return true;
+					const uint32_t free_bufs = depth - (submitted - m_consumed);
+					const bool starved = (produced - m_consumed) <= (m_holding ? 1U : 0U);
+					return free_bufs >= batch || (free_bufs > 0 && starved);
+				});
+			}
+			if (m_stop)
+				break;
+			free_limit = m_consumed + depth;
+		}
+
+		// Submit reads for all free buffers.
+		for (; submitted < m_chunk_count && submitted < free_limit; submitted++) {
+			uint8_t *const buf = m_bufs[submitted % depth].get();
+			m_errs[submitted % depth] = 0;
+			if (submitted < m_used.size() && !m_used[submitted]) {
+				// Unused chunk.
+				memset(buf, 0, LBA_TO_BYTES(chunkLen(submitted)));
+				done[submitted % depth] = true;
+				continue;
+			}
+			done[submitted % depth] = false;
+			aio.submit(buf, m_lba_start + (submitted * m_lba_chunk), chunkLen(submitted), submitted);
+		}
+
+		// Wait for the next chunk in order.
+		// Read errors are recorded for the chunk's buffer,
+		// and returned by next() when it gets to the chunk.
+		if (produced < submitted && !done[produced % depth]) {
+			uintptr_t tag;
+			uint32_t lba_read;
+			int err;
+			if (aio.wait(&tag, &lba_read, &err) == 0) {
+				const uint32_t chunk = static_cast<uint32_t>(tag);
+				if (lba_read < chunkLen(chunk)) {
+					m_errs[chunk % depth] = (err != 0 ? err : -EIO);
+				}
+				done[chunk % depth] = true;
+			} else {
+				// Should not happen...
+				m_errs[produced % depth] = -EIO;
+				done[produced % depth] = true;
+			}
+		}
+
+		uint32_t ready = produced;
+		while (ready < submitted && done[ready % depth]) {
+			ready++;
+		}
+		if (ready != produced) {
+			produced = ready;
+			{
+				lock_guard<mutex> lock(m_mutex);
+				m_produced = produced;
+			}
+			m_cond.notify_all();
+		}
+	}
+
+	// NOTE: If stopped, the AsyncReader destructor waits for
+	// the reads that are still in flight.
+}
+
+/**
+ * Read a chunk into a buffer.
+ * Unused chunks are zero-filled instead of being read.
+ * @param buf Chunk buffer.
+ * @param chunk Chunk index.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int ReadAheadQueue::readChunk(uint8_t *buf, uint32_t chunk)
+{
+	if (chunk < m_used.size() && !m_used[chunk]) {
+		// Unused chunk.
+		memset(buf, 0, LBA_TO_BYTES(chunkLen(chunk)));
+		return 0;
+	}
+
+	errno = 0;
+	const uint32_t lba_len = chunkLen(chunk);
+	if (m_reader->read(buf, m_lba_start + (chunk * m_lba_chunk), lba_len) != lba_len) {
+		return (errno != 0 ? -errno : -EIO);
+	}
+	return 0;
+}
+
+/**
+ * Get the next chunk.
+ * Blocks until the chunk has been read.
+ *
+ * The buffer returned by the previous call is recycled,
+ * so it must not be accessed after calling this function.
+ * The returned buffer may be modified by the caller.
+ *
+ * If the chunk couldn't be read, nullptr is returned, and
+ * errno is set to the read error. The next call returns
+ * the following chunk.
+ *
+ * @param pLba		[out,opt] Starting LBA of the chunk.
+ * @param pLbaLen	[out,opt] Length of the chunk, in LBAs.
+ * @return Chunk buffer, or nullptr if there are no more chunks (errno == 0) or on error.
+ */
+uint8_t *ReadAheadQueue::next(uint32_t *pLba, uint32_t *pLbaLen)
+{
+	if (m_bufs.empty()) {
+		errno = ENOMEM;
+		return nullptr;
+	}
+	const uint32_t depth = static_cast<uint32_t>(m_bufs.size());
+
+	uint32_t chunk;
+	int err = 0;
+	{
+		unique_lock<mutex> lock(m_mutex);
+		if (m_holding) {
+			// Recycle the previous buffer.
+			m_holding = false;
+			m_consumed++;
+		}
+		chunk = m_consumed;
+		if (chunk >= m_chunk_count) {
+			// No more chunks.
+			lock.unlock();
+			m_cond.notify_all();
+			errno = 0;
+			return nullptr;
+		}
+
+		if (m_async) {
+			// Wait for the read-ahead thread.
+			m_cond.notify_all();
+			m_cond.wait(lock, [this, chunk] { return m_produced > chunk; });
+			err = m_errs[chunk % depth];
+		}
+		m_holding = true;
+	}
+
+	uint8_t *const buf = m_bufs[chunk % depth].get();
+	if (!m_async) {
+		err = readChunk(buf, chunk);
+	}
+	if (err != 0) {
+		// Read error.
+		errno = -err;
+		return nullptr;
+	}
+
+	if (pLba) {
+		*pLba = m_lba_start + (chunk * m_lba_chunk);
+	}
+	if (pLbaLen) {
+		*pLbaLen = chunkLen(chunk);
+	}
+	return buf;
+}
@@ -0,0 +1,134 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * ReadAheadQueue.hpp: Asynchronous sequential read-ahead for a Reader.    *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_READER_READAHEADQUEUE_HPP__
+#define __RVTHTOOL_LIBRVTH_READER_READAHEADQUEUE_HPP__
+
+#include "Reader.hpp"
+#include "BufferPool.hpp"
+#include "StatsCounters.hpp"
+
+// C++ includes
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Sequential read-ahead queue.
+ *
+ * A background thread reads consecutive chunks from a Reader into
+ * a ring of buffers, so the caller can process and write chunk N
+ * while chunk N+1 is being read from the source device.
+ *
+ * Only the background thread accesses the Reader while the queue
+ * is active, so the caller must not use it until the queue is
+ * destroyed.
+ */
+class ReadAheadQueue
+{
+	public:
+		/**
+		 * Start reading ahead.
+		 * @param reader	[in] Source reader.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Number of LBAs to read.
+		 * @param lba_chunk	[in] Chunk size, in LBAs.
+		 * @param depth		[in] Number of chunk buffers. (minimum 2)
+		 * @param used		[in,opt] Chunk map. Chunks marked as unused are
+		 *			returned zero-filled without reading the source.
+		 * @param alignment	[in,opt] Chunk buffer alignment. (0 for default; otherwise, must be a power of two)
+		 */
+		ReadAheadQueue(Reader *reader, uint32_t lba_start, uint32_t lba_len,
+			uint32_t lba_chunk, unsigned int depth = 3,
+			const std::vector<bool> *used = nullptr,
+			unsigned int alignment = 0);
+		~ReadAheadQueue();
+
+	private:
+		DISABLE_COPY(ReadAheadQueue)
+
+	public:
+		/**
+		 * Were the chunk buffers allocated successfully?
+		 * @return True if the queue is usable; false if not.
+		 */
+		inline bool isOpen(void) const
+		{
+			return !m_bufs.empty();
+		}
+
+		/**
+		 * Get the next chunk.
+		 * Blocks until the chunk has been read.
+		 *
+		 * The buffer returned by the previous call is recycled,
+		 * so it must not be accessed after calling this function.
+		 * The returned buffer may be modified by the caller.
+		 *
+		 * If the chunk couldn't be read, nullptr is returned, and
+		 * errno is set to the read error. The next call returns
+		 * the following chunk.
+		 *
+		 * @param pLba		[out,opt] Starting LBA of the chunk.
+		 * @param pLbaLen	[out,opt] Length of the chunk, in LBAs.
+		 * @return Chunk buffer, or nullptr if there are no more chunks (errno == 0) or on error.
+		 */
+		uint8_t *next(uint32_t *pLba = nullptr, uint32_t *pLbaLen = nullptr);
+
+	private:
+		/**
+		 * Read-ahead thread function.
+		 */
+		void readThread(void);
+
+		/**
+		 * Read a chunk into a buffer.
+		 * Unused chunks are zero-filled instead of being read.
+		 * @param buf Chunk buffer.
+		 * @param chunk Chunk index.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int readChunk(uint8_t *buf, uint32_t chunk);
+
+		/**
+		 * Get the length of a chunk.
+		 * @param chunk Chunk index.
+		 * @return Length of the chunk, in LBAs.
+		 */
+		inline uint32_t chunkLen(uint32_t chunk) const
+		{
+			const uint32_t lba_offset = chunk * m_lba_chunk;
+			const uint32_t lba_left = m_lba_len - lba_offset;
+			return (lba_left < m_lba_chunk) ? lba_left : m_lba_chunk;
+		}
+
+	private:
+		Reader *const m_reader;
+		const uint32_t m_lba_start;
+		const uint32_t m_lba_len;
+		const uint32_t m_lba_chunk;
+		uint32_t m_chunk_count;			// Total number of chunks
+		std::vector<bool> m_used;		// Chunk map (empty if all chunks are used)
+
+		std::vector<PoolBuffer> m_bufs;
+		std::vector<int> m_errs;		// Per-buffer: Read error (negative POSIX error code)
+
+		std::mutex m_mutex;
+		std::condition_variable m_cond;
+		uint32_t m_produced;			// Number of chunks read
+		uint32_t m_consumed;			// Number of chunks returned by next()
+		bool m_holding;				// Caller is holding a chunk
+		bool m_stop;				// Stop the read-ahead thread
+
+		std::thread m_thread;
+		bool m_async;				// False if the thread couldn't be started
+		StatsCounters *m_stats;			// Counters of the operation that created this queue
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_READER_READAHEADQUEUE_HPP__ */
@@ -8,8 +8,16 @@
 
 #include "Reader.hpp"
 #include "PlainReader.hpp"
+#include "PipeReader.hpp"
+#include "MmapReader.hpp"
 #include "CisoReader.hpp"
+#include "RvtzReader.hpp"
+#include "WiaReader.hpp"
 #include "WbfsReader.hpp"
+#include "SplitReader.hpp"
+#include "BlockMap.hpp"
+#include "ProbeBuffer.hpp"
+#include "Trace.hpp"
 
 // For LBA_TO_BYTES()
 #include "nhcd_structs.h"
@@ -20,8 +28,11 @@
 #include <cstring>
 
 // C++ includes
+#include <algorithm>
 #include <array>
+#include <vector>
 using std::array;
+using std::vector;
 
 Reader::Reader(RefFile *file, uint32_t lba_start, uint32_t lba_len)
 	: m_file(nullptr)
@@ -75,42 +86,62 @@ Reader *Reader::open(RefFile *file, uint32_t lba_start, uint32_t lba_len)
 	}
 
 	// This is a disc image file.
-	// NOTE: Ignoring errors here because the file may be empty
-	// if we're opening a file for writing.
-
-	// Check for other disc image formats.
-	uint8_t sbuf[4096];
-	int ret = file->seeko(LBA_TO_BYTES(lba_start), SEEK_SET);
-	if (ret != 0) {
-		// Seek error.
-		if (errno == 0) {
-			errno = EIO;
-		}
+	// Read the probe window once for all of the format checks.
+	ProbeBuffer probe;
+	if (probe.read(file, LBA_TO_BYTES(lba_start)) != 0) {
+		// Read error.
 		return nullptr;
 	}
-	errno = 0;
-	size_t size = file->read(sbuf, 1, sizeof(sbuf));
-	if (size != sizeof(sbuf)) {
-		// Short read. May be empty.
-		if (errno != 0) {
-			// Actual error.
-			return nullptr;
-		} else {
-			// Assume it's a new file.
-			// Use the plain disc image reader.
-			file->rewind();
-			return new PlainReader(file, lba_start, lba_len);
-		}
+	return open(file, lba_start, lba_len, probe);
+}
+
+/**
+ * Create a Reader object for a disc image using a probe window
+ * that was already read from the start of the disc image.
+ * The format checks and the selected Reader's header parsing
+ * use the probe window instead of reading the file again.
+ *
+ * NOTE: If lba_start == 0 and lba_len == 0, the entire file
+ * will be used.
+ *
+ * @param file		RefFile*.
+ * @param lba_start	[in] Starting LBA,
+ * @param lba_len	[in] Length, in LBAs.
+ * @param probe		[in] Probe window, read from LBA_TO_BYTES(lba_start).
+ * @return Reader*, or NULL on error.
+ */
+Reader *Reader::open(RefFile *file, uint32_t lba_start, uint32_t lba_len, const ProbeBuffer &probe)
+{
+	assert(file != nullptr);
+	assert(probe.offset() == static_cast<off64_t>(LBA_TO_BYTES(lba_start)));
+	if (file->isDevice()) {
+		// This is an RVT-H Reader system.
+		// Only plain images are supported.
+		return new PlainReader(file, lba_start, lba_len);
 	}
-	file->rewind();
 
+	// NOTE: The probe window may be short because the file
+	// may be empty if we're opening a file for writing.
+	static const size_t PROBE_SIZE_MIN = 4096;
+	const uint8_t *const sbuf = probe.data();
+	if (probe.size() < PROBE_SIZE_MIN) {
+		// Assume it's a new file.
+		// Use the plain disc image reader.
+		return new PlainReader(file, lba_start, lba_len);
+	}
 	// Check the magic number.
-	if (CisoReader::isSupported(sbuf, sizeof(sbuf))) {
+	if (CisoReader::isSupported(sbuf, probe.size())) {
 		// This is a supported CISO image.
-		return new CisoReader(file, lba_start, lba_len);
-	} else if (WbfsReader::isSupported(sbuf, sizeof(sbuf))) {
+		return new CisoReader(file, lba_start, lba_len, &probe);
+	} else if (RvtzReader::isSupported(sbuf, probe.size())) {
+		// This is a supported RVTZ image.
+		return new RvtzReader(file, lba_start, lba_len, &probe);
+	} else if (WiaReader::isSupported(sbuf, probe.size())) {
+		// This is a supported WIA or RVZ image.
+		return new WiaReader(file, lba_start, lba_len, &probe);
+	} else if (WbfsReader::isSupported(sbuf, probe.size())) {
 		// This is a supported WBFS image.
-		return new WbfsReader(file, lba_start, lba_len);
+		return new WbfsReader(file, lba_start, lba_len, &probe);
 	}
 
 	// Check for SDK headers.
@@ -131,10 +162,494 @@ Reader *Reader::open(RefFile *file, uint32_t lba_start, uint32_t lba_len)
 		lba_len -= BYTES_TO_LBA(32768);
 	}
 
+	if (SplitReader::isSplitFilename(file->filename())) {
+		// Plain disc image split into multiple files.
+		return SplitReader::open(file, lba_start);
+	}
+
 	// Use the plain disc image reader.
+	// Read-only local images are memory-mapped if possible.
+	if (!file->isWritable() && !file->isRemote()) {
+		return new MmapReader(file, lba_start, lba_len);
+	}
 	return new PlainReader(file, lba_start, lba_len);
 }
 
+/**
+ * Create a Reader object for a new disc image.
+ *
+ * For CISO and WBFS, blocks are allocated as non-zero data
+ * is written, and the container headers are written when
+ * the Reader is flushed or deleted.
+ *
+ * RVTZ images are compressed on worker threads as they're
+ * written. LBAs must be written in order, and the chunk index
+ * is written when the Reader is flushed or deleted.
+ *
+ * Plain disc images written to a stream (standard output) use
+ * PipeReader, which requires LBAs to be written in order.
+ *
+ * Plain disc images named "*.part0" are split into 4 GB parts.
+ * (See SplitReader.)
+ *
+ * @param file		RefFile*. (Must be a new, empty file opened for writing.)
+ * @param lba_len	[in] Length, in LBAs.
+ * @param format	[in] Container format.
+ * @return Reader*, or NULL on error.
+ */
+Reader *Reader::create(RefFile *file, uint32_t lba_len, RvtH_ImageFormat_e format)
+{
+	assert(file != nullptr);
+	assert(file->isWritable());
+	switch (format) {
+		case RVTH_ImageFormat_Plain:
+			if (file->isStream()) {
+				// Plain disc image written to a pipe.
+				return new PipeReader(file, lba_len);
+			} else if (SplitReader::isSplitFilename(file->filename())) {
+				// Plain disc image split into multiple files.
+				return SplitReader::create(file, lba_len);
+			}
+			return new PlainReader(file, 0, lba_len);
+		case RVTH_ImageFormat_CISO:
+			return CisoReader::create(file, lba_len);
+		case RVTH_ImageFormat_WBFS:
+			return WbfsReader::create(file, lba_len);
+		case RVTH_ImageFormat_RVTZ:
+			return RvtzReader::create(file, lba_len);
+		default:
+			assert(!"Invalid image format.");
+			errno = EINVAL;
+			return nullptr;
+	}
+}
+
+/**
+ * Determine the container format for a new disc image from its filename.
+ * @param filename	[in] Filename.
+ * @return Container format. (RVTH_ImageFormat_Plain if the extension isn't recognized.)
+ */
+RvtH_ImageFormat_e Reader::formatFromFilename(const TCHAR *filename)
+{
+	const TCHAR *const ext = (filename ? _tcsrchr(filename, _T('.')) : nullptr);
+	if (!ext) {
+		return RVTH_ImageFormat_Plain;
+	}
+
+	if (!_tcsicmp(ext, _T(".ciso"))) {
+		return RVTH_ImageFormat_CISO;
+	} else if (!_tcsicmp(ext, _T(".wbfs"))) {
+		return RVTH_ImageFormat_WBFS;
+	} else if (!_tcsicmp(ext, _T(".rvtz"))) {
+		return RVTH_ImageFormat_RVTZ;
+	}
+	return RVTH_ImageFormat_Plain;
+}
+
+/**
+ * Get a read-only view of data in the disc image.
+ *
+ * Base class implementation reads the data into the caller's buffer.
+ *
+ * @param buf		[out] Fallback buffer. (Must be at least lba_len LBAs.)
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Pointer to the data, or nullptr on error.
+ */
+const void *Reader::readView(void *buf, uint32_t lba_start, uint32_t lba_len)
+{
+	const uint32_t lba_size = read(buf, lba_start, lba_len);
+	if (lba_size != lba_len) {
+		// Read error.
+		if (errno == 0) {
+			errno = EIO;
+		}
+		return nullptr;
+	}
+	return buf;
+}
+
+/**
+ * Read multiple ranges of LBAs from the disc image. (scatter-gather)
+ *
+ * The ranges may be specified in any order. Readers that read
+ * directly from the file (plain, CISO, WBFS) map all of the ranges
+ * to file extents first, then read the extents in file order,
+ * merging extents that are adjacent in the file. This allows a
+ * batch of small reads to be done with a few system calls.
+ *
+ * Each range is read independently, so a read error in one
+ * range doesn't affect the others.
+ *
+ * Base class implementation calls read() for each range.
+ *
+ * @param ranges	[in/out] Ranges. (lba_read is set for each range)
+ * @param count		[in] Number of ranges.
+ * @return Number of ranges that were read completely.
+ */
+unsigned int Reader::readv(ReadRange *ranges, unsigned int count)
+{
+	unsigned int complete = 0;
+	for (unsigned int i = 0; i < count; i++) {
+		ReadRange &range = ranges[i];
+		range.lba_read = read(range.ptr, range.lba_start, range.lba_len);
+		if (range.lba_read == range.lba_len) {
+			complete++;
+		}
+	}
+	return complete;
+}
+
+/**
+ * Read file extents for readv().
+ *
+ * The extents are sorted by file offset, and extents that are
+ * adjacent in the file are read using RefFile::preadv().
+ * If an extent can't be read, lba_read is set to 0 for its range,
+ * so lba_read should be set to lba_len for all ranges beforehand.
+ *
+ * @param extents	[in/out] Extents. (sorted by this function)
+ * @param ranges	[in/out] Ranges.
+ * @param count		[in] Number of ranges.
+ * @return Number of ranges that were read completely.
+ */
+unsigned int Reader::readExtents(vector<ReadExtent> &extents, ReadRange *ranges, unsigned int count)
+{
+	std::sort(extents.begin(), extents.end(),
+		[](const ReadExtent &a, const ReadExtent &b) { return a.offset < b.offset; });
+
+	vector<RefFile::IoVec> iov;
+	iov.reserve(extents.size());
+	for (size_t i = 0; i < extents.size(); ) {
+		// Find the extents that are adjacent to this one.
+		off64_t end = extents[i].offset + extents[i].size;
+		size_t run_end = i + 1;
+		while (run_end < extents.size() && extents[run_end].offset == end) {
+			end += extents[run_end].size;
+			run_end++;
+		}
+
+		iov.clear();
+		for (size_t j = i; j < run_end; j++) {
+			iov.push_back({extents[j].ptr, extents[j].size});
+		}
+		errno = 0;
+		size_t size;
+		{
+			RVTH_TRACE_SPAN_BYTES("Reader::readExtents", end - extents[i].offset);
+			size = m_file->preadv(iov.data(), static_cast<unsigned int>(iov.size()), extents[i].offset);
+		}
+
+		// Skip the extents that were read.
+		for (; i < run_end && size >= extents[i].size; i++) {
+			size -= extents[i].size;
+		}
+
+		// Short read. Read the rest of the extents separately,
+		// so a read error only affects the ranges that contain it.
+		for (; i < run_end; i++) {
+			ReadExtent &ext = extents[i];
+			if (ranges[ext.range].lba_read == 0) {
+				// This range already failed.
+				continue;
+			}
+			errno = 0;
+			if (m_file->pread(ext.ptr, ext.size, ext.offset) != ext.size) {
+				if (errno == 0) {
+					errno = EIO;
+				}
+				ranges[ext.range].lba_read = 0;
+			}
+		}
+	}
+
+	unsigned int complete = 0;
+	for (unsigned int i = 0; i < count; i++) {
+		if (ranges[i].lba_read == ranges[i].lba_len) {
+			complete++;
+		}
+	}
+	return complete;
+}
+
+/**
+ * Get the allocated and unallocated ranges within a range of LBAs.
+ *
+ * Base class implementation reports the range as allocated,
+ * since the image format doesn't have a block map.
+ *
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs. (Clamped to the image length.)
+ * @param extents	[out] Extents.
+ * @return Number of unallocated LBAs.
+ */
+uint32_t Reader::extents(uint32_t lba_start, uint32_t lba_len, std::vector<Extent> &extents) const
+{
+	extents.clear();
+	if (lba_start >= m_lba_len) {
+		return 0;
+	}
+	lba_len = std::min(lba_len, m_lba_len - lba_start);
+	addExtent(extents, lba_start, lba_len, true);
+	return 0;
+}
+
+/**
+ * Add a range to an extent list for extents().
+ * The range is merged with the last extent if it has the same allocation state.
+ * @param extents	[in/out] Extents.
+ * @param lba_start	[in] Starting LBA. (must follow the last extent)
+ * @param lba_len	[in] Length, in LBAs.
+ * @param allocated	[in] True if the range is allocated.
+ */
+void Reader::addExtent(std::vector<Extent> &extents, uint32_t lba_start, uint32_t lba_len, bool allocated)
+{
+	if (lba_len == 0) {
+		return;
+	}
+	if (!extents.empty()) {
+		Extent &last = extents.back();
+		assert(last.lba_start + last.lba_len == lba_start);
+		if (last.allocated == allocated) {
+			last.lba_len += lba_len;
+			return;
+		}
+	}
+	extents.push_back({lba_start, lba_len, allocated});
+}
+
+/**
+ * Get the extents of an image that's stored in fixed-size blocks.
+ * Used by the RVTZ reader.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs. (Clamped to the image length.)
+ * @param block_lba_len	[in] Block size, in LBAs.
+ * @param isAllocated	[in] Returns true if a block is allocated.
+ * @param extents	[out] Extents.
+ * @return Number of unallocated LBAs.
+ */
+uint32_t Reader::blockExtents(uint32_t lba_start, uint32_t lba_len, uint32_t block_lba_len,
+	const std::function<bool(uint32_t block)> &isAllocated,
+	std::vector<Extent> &extents) const
+{
+	extents.clear();
+	if (lba_start >= m_lba_len || block_lba_len == 0) {
+		return 0;
+	}
+	const uint32_t lba_end = lba_start + std::min(lba_len, m_lba_len - lba_start);
+
+	uint32_t unallocated = 0;
+	for (uint32_t lba = lba_start; lba < lba_end; ) {
+		const uint32_t block = lba / block_lba_len;
+		const uint32_t lba_next = std::min((block + 1) * block_lba_len, lba_end);
+		const bool allocated = isAllocated(block);
+		addExtent(extents, lba, lba_next - lba, allocated);
+		if (!allocated) {
+			unallocated += lba_next - lba;
+		}
+		lba = lba_next;
+	}
+	return unallocated;
+}
+
+/**
+ * Get the extents of an image using its block map.
+ * Used by the CISO and WBFS readers.
+ * @param map		[in] Block map.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs. (Clamped to the image length.)
+ * @param extents	[out] Extents.
+ * @return Number of unallocated LBAs.
+ */
+uint32_t Reader::blockMapExtents(const BlockMap &map, uint32_t lba_start, uint32_t lba_len,
+	std::vector<Extent> &extents) const
+{
+	extents.clear();
+	if (lba_start >= m_lba_len) {
+		return 0;
+	}
+	const uint32_t lba_end = lba_start + std::min(lba_len, m_lba_len - lba_start);
+
+	uint32_t unallocated = 0;
+	BlockMap::Mapping mapping;
+	for (uint32_t lba = lba_start; lba < lba_end; lba += mapping.lba_len) {
+		if (!map.lookup(lba, lba_end - lba, &mapping)) {
+			// Past the end of the block map.
+			break;
+		}
+		addExtent(extents, lba, mapping.lba_len, mapping.allocated);
+		if (!mapping.allocated) {
+			unallocated += mapping.lba_len;
+		}
+	}
+	return unallocated;
+}
+
+/**
+ * Add the extents of a range of LBAs that's stored contiguously in a file.
+ * Holes in the file are unallocated. If the file system can't
+ * find holes, the range is added as allocated.
+ * Used by the plain and split readers.
+ * @param file		[in] File.
+ * @param offset	[in] File offset of lba_start.
+ * @param lba_start	[in] Starting LBA. (must follow the last extent)
+ * @param lba_len	[in] Length, in LBAs.
+ * @param extents	[in/out] Extents.
+ * @return Number of unallocated LBAs.
+ */
+uint32_t Reader::addFileExtents(RefFile *file, off64_t offset,
+	uint32_t lba_start, uint32_t lba_len, std::vector<Extent> &extents)
+{
+	std::vector<std::pair<off64_t, off64_t> > ranges;
+	if (file->dataRanges(offset, LBA_TO_BYTES(static_cast<off64_t>(lba_len)), ranges) != 0) {
+		// Holes can't be found.
+		addExtent(extents, lba_start, lba_len, true);
+		return 0;
+	}
+
+	// Data ranges are rounded out to whole LBAs.
+	uint32_t unallocated = 0;
+	uint32_t lba = 0;	// relative to lba_start
+	for (const auto &range : ranges) {
+		const off64_t rel = range.first - offset;
+		const uint32_t data_start = static_cast<uint32_t>(rel / LBA_SIZE);
+		const uint32_t data_end = std::min(lba_len,
+			static_cast<uint32_t>((rel + range.second + LBA_SIZE - 1) / LBA_SIZE));
+		if (data_start > lba) {
+			addExtent(extents, lba_start + lba, data_start - lba, false);
+			unallocated += data_start - lba;
+			lba = data_start;
+		}
+		if (data_end > lba) {
+			addExtent(extents, lba_start + lba, data_end - lba, true);
+			lba = data_end;
+		}
+	}
+	if (lba < lba_len) {
+		addExtent(extents, lba_start + lba, lba_len - lba, false);
+		unallocated += lba_len - lba;
+	}
+	return unallocated;
+}
+
+/**
+ * Check if a range of LBAs is known to be empty without reading it.
+ *
+ * Base class implementation checks extents().
+ *
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return True if the range is known to be empty; false if not, or if unknown.
+ */
+bool Reader::isRangeEmpty(uint32_t lba_start, uint32_t lba_len) const
+{
+	if (lba_len == 0 || lba_start + lba_len > m_lba_len) {
+		return false;
+	}
+	std::vector<Extent> ext;
+	return (extents(lba_start, lba_len, ext) == lba_len);
+}
+
+/**
+ * Get the allocation map of a range of equal-sized blocks.
+ *
+ * Each block is checked with isRangeEmpty(), so this doesn't
+ * read any data. Blocks that extend past the end of the image
+ * are never considered empty.
+ *
+ * @param lba_start	[in] Starting LBA of the first block.
+ * @param block_lba_len	[in] Length of each block, in LBAs.
+ * @param count		[in] Number of blocks.
+ * @param map		[out] Per-block flags: 1 if the block is known to be empty.
+ * @return Number of blocks that are known to be empty.
+ */
+unsigned int Reader::getEmptyMap(uint32_t lba_start, uint32_t block_lba_len,
+	unsigned int count, std::vector<uint8_t> &map) const
+{
+	map.assign(count, 0);
+	if (count == 0 || block_lba_len == 0 || lba_start >= m_lba_len) {
+		return 0;
+	}
+
+	// Only complete blocks are checked.
+	const uint64_t lba_end = std::min(static_cast<uint64_t>(lba_start) + (static_cast<uint64_t>(count) * block_lba_len),
+		static_cast<uint64_t>(m_lba_len));
+	std::vector<Extent> ext;
+	if (extents(lba_start, static_cast<uint32_t>(lba_end - lba_start), ext) == 0) {
+		// Everything is allocated.
+		return 0;
+	}
+
+	// A block is empty if it's entirely within an unallocated extent.
+	unsigned int empty = 0;
+	for (const Extent &e : ext) {
+		if (e.allocated)
+			continue;
+		const uint32_t first = (e.lba_start - lba_start + block_lba_len - 1) / block_lba_len;
+		const uint32_t last = (e.lba_start + e.lba_len - lba_start) / block_lba_len;
+		for (uint32_t i = first; i < last && i < count; i++) {
+			map[i] = 1;
+			empty++;
+		}
+	}
+	return empty;
+}
+
+/**
+ * Get the file offset of a range of LBAs.
+ *
+ * This is only supported if the range is stored contiguously
+ * and uncompressed in the file, which allows reading it
+ * directly from the file, e.g. using asynchronous I/O.
+ *
+ * The default implementation doesn't support this.
+ *
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @param pOffset	[out] File offset, in bytes.
+ * @return True if the range can be read directly from the file; false if not.
+ */
+bool Reader::fileOffset(uint32_t lba_start, uint32_t lba_len, off64_t *pOffset) const
+{
+	UNUSED(lba_start);
+	UNUSED(lba_len);
+	UNUSED(pOffset);
+	return false;
+}
+
+/**
+ * Get the file offset where the disc image's data starts.
+ *
+ * This is used to order reads of multiple disc images that
+ * are stored in the same file, e.g. discs in a WBFS partition,
+ * so the file is read from start to end.
+ *
+ * Base class implementation returns the starting LBA.
+ *
+ * @return File offset, in bytes.
+ */
+off64_t Reader::physicalStart(void) const
+{
+	return LBA_TO_BYTES(static_cast<off64_t>(m_lba_start));
+}
+
+/**
+ * Get the native block size of the disc image.
+ *
+ * Formats that store the image in fixed-size blocks return
+ * the block size, so copy loops can use chunks that don't
+ * straddle blocks. Each block starts at a multiple of the
+ * block size from the start of the image.
+ *
+ * Base class implementation returns 0. (no native blocks)
+ *
+ * @return Block size, in LBAs, or 0 if the image isn't stored in blocks.
+ */
+uint32_t Reader::blockSizeLba(void) const
+{
+	return 0;
+}
+
 /**
  * Write data to a disc image.
  *
@@ -158,6 +673,49 @@ uint32_t Reader::write(const void *ptr, uint32_t lba_start, uint32_t lba_len)
 	return 0;
 }
 
+/**
+ * Prepare a new disc image for sparse writing.
+ *
+ * Plain images are marked as sparse and set to their full size.
+ * Subclasses that allocate blocks on write don't resize the file.
+ *
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int Reader::makeSparse(void)
+{
+	return m_file->makeSparse(LBA_TO_BYTES(static_cast<off64_t>(m_lba_start) + m_lba_len));
+}
+
+/**
+ * Allocate disk space for a new disc image up front.
+ *
+ * Base class implementation returns -ENOTSUP.
+ * Container formats that allocate blocks on write
+ * don't support this.
+ *
+ * @return 0 on success; negative POSIX error code on error. (-ENOTSUP if not supported)
+ */
+int Reader::preallocate(void)
+{
+	return -ENOTSUP;
+}
+
+/**
+ * Deallocate a range of LBAs that only contain zeroes.
+ *
+ * Base class implementation returns -ENOTSUP.
+ *
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return 0 on success; negative POSIX error code on error. (-ENOTSUP if not supported)
+ */
+int Reader::discard(uint32_t lba_start, uint32_t lba_len)
+{
+	UNUSED(lba_start);
+	UNUSED(lba_len);
+	return -ENOTSUP;
+}
+
 /**
  * Flush the file buffers.
  */
@@ -165,3 +723,36 @@ void Reader::flush(void)
 {
 	m_file->flush();
 }
+
+/**
+ * Flush the file buffers and sync the files to the media,
+ * e.g. at the end of a job. (See RefFile::sync().)
+ */
+void Reader::sync(void)
+{
+	flush();
+	if (m_file->durability() != RVTH_DURABILITY_CHECKPOINT) {
+		// flush() already synced the file if the policy is CHECKPOINT.
+		m_file->sync();
+	}
+}
+
+/**
+ * Set the durability policy for writes to the image files.
+ * @param durability	[in] Durability policy
+ * @param interval	[in] Sync interval for RVTH_DURABILITY_INTERVAL, in bytes
+ */
+void Reader::setDurability(RvtH_Durability durability, uint64_t interval)
+{
+	m_file->setDurability(durability, interval);
+}
+
+/**
+ * Drop any data that was cached from the image, e.g. after
+ * the image was modified without using this Reader.
+ *
+ * Base class implementation does nothing.
+ */
+void Reader::invalidateCache(void)
+{
+}
@@ -2,7 +2,7 @@
  * RVT-H Tool (librvth)                                                    *
  * Reader.hpp: Disc image reader base class.                               *
  *                                                                         *
- * Copyright (c) 2018-2019 by David Korth.                                 *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
@@ -17,6 +17,13 @@
 
 #ifdef __cplusplus
 
+// C++ includes
+#include <functional>
+#include <vector>
+
+class BlockMap;
+class ProbeBuffer;
+
 class Reader
 {
 	protected:
@@ -51,6 +58,54 @@ class Reader
 		 */
 		static Reader *open(RefFile *file, uint32_t lba_start, uint32_t lba_len);
 
+		/**
+		 * Create a Reader object for a disc image using a probe window
+		 * that was already read from the start of the disc image.
+		 * The format checks and the selected Reader's header parsing
+		 * use the probe window instead of reading the file again.
+		 *
+		 * NOTE: If lba_start == 0 and lba_len == 0, the entire file
+		 * will be used.
+		 *
+		 * @param file		RefFile*.
+		 * @param lba_start	[in] Starting LBA,
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @param probe		[in] Probe window, read from LBA_TO_BYTES(lba_start).
+		 * @return Reader*, or NULL on error.
+		 */
+		static Reader *open(RefFile *file, uint32_t lba_start, uint32_t lba_len, const ProbeBuffer &probe);
+
+		/**
+		 * Create a Reader object for a new disc image.
+		 *
+		 * For CISO and WBFS, blocks are allocated as non-zero data
+		 * is written, and the container headers are written when
+		 * the Reader is flushed or deleted.
+		 *
+		 * RVTZ images are compressed on worker threads as they're
+		 * written. LBAs must be written in order, and the chunk index
+		 * is written when the Reader is flushed or deleted.
+		 *
+		 * Plain disc images written to a stream (standard output) use
+		 * PipeReader, which requires LBAs to be written in order.
+		 *
+		 * Plain disc images named "*.part0" are split into 4 GB parts.
+		 * (See SplitReader.)
+		 *
+		 * @param file		RefFile*. (Must be a new, empty file opened for writing.)
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @param format	[in] Container format.
+		 * @return Reader*, or NULL on error.
+		 */
+		static Reader *create(RefFile *file, uint32_t lba_len, RvtH_ImageFormat_e format);
+
+		/**
+		 * Determine the container format for a new disc image from its filename.
+		 * @param filename	[in] Filename.
+		 * @return Container format. (RVTH_ImageFormat_Plain if the extension isn't recognized.)
+		 */
+		static RvtH_ImageFormat_e formatFromFilename(const TCHAR *filename);
+
 	public:
 		/**
 		 * Is the Reader object open?
@@ -77,6 +132,154 @@ class Reader
 		 */
 		virtual uint32_t read(void *ptr, uint32_t lba_start, uint32_t lba_len) = 0;
 
+		/**
+		 * Range of LBAs for readv().
+		 */
+		struct ReadRange {
+			void *ptr;		// [out] Read buffer
+			uint32_t lba_start;	// [in] Starting LBA
+			uint32_t lba_len;	// [in] Length, in LBAs
+			uint32_t lba_read;	// [out] Number of LBAs read
+		};
+
+		/**
+		 * Read multiple ranges of LBAs from the disc image. (scatter-gather)
+		 *
+		 * The ranges may be specified in any order. Readers that read
+		 * directly from the file (plain, CISO, WBFS) map all of the ranges
+		 * to file extents first, then read the extents in file order,
+		 * merging extents that are adjacent in the file. This allows a
+		 * batch of small reads to be done with a few system calls.
+		 *
+		 * Each range is read independently, so a read error in one
+		 * range doesn't affect the others.
+		 *
+		 * Base class implementation calls read() for each range.
+		 *
+		 * @param ranges	[in/out] Ranges. (lba_read is set for each range)
+		 * @param count		[in] Number of ranges.
+		 * @return Number of ranges that were read completely.
+		 */
+		virtual unsigned int readv(ReadRange *ranges, unsigned int count);
+
+		/**
+		 * Get a read-only view of data in the disc image.
+		 *
+		 * If the Reader can access the data directly (e.g. a memory-mapped
+		 * image), a pointer to the data is returned without copying it.
+		 * Otherwise, the data is read into the caller's buffer, and the
+		 * buffer is returned.
+		 *
+		 * The view remains valid until the next call to readView()
+		 * on this Reader, or until the Reader is deleted.
+		 *
+		 * @param buf		[out] Fallback buffer. (Must be at least lba_len LBAs.)
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Pointer to the data, or nullptr on error.
+		 */
+		virtual const void *readView(void *buf, uint32_t lba_start, uint32_t lba_len);
+
+		/**
+		 * Allocated or unallocated range of LBAs. (See extents().)
+		 */
+		struct Extent {
+			uint32_t lba_start;	// Starting LBA
+			uint32_t lba_len;	// Length, in LBAs
+			bool allocated;		// False if the range is known to be empty
+		};
+
+		/**
+		 * Get the allocated and unallocated ranges within a range of LBAs.
+		 *
+		 * Unallocated ranges are always read as zeroes, so callers can
+		 * skip them without reading or scanning them:
+		 * - CISO, WBFS: Blocks that aren't in the block map.
+		 * - WIA, RVTZ: Chunks that are stored as zeroes.
+		 * - Plain images: Holes in sparse files, if the OS can find them.
+		 *
+		 * Allocated ranges may still contain zeroes. The extents cover
+		 * the entire range in order, and adjacent extents never have
+		 * the same allocation state.
+		 *
+		 * The default implementation reports the range as allocated.
+		 *
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs. (Clamped to the image length.)
+		 * @param extents	[out] Extents.
+		 * @return Number of unallocated LBAs.
+		 */
+		virtual uint32_t extents(uint32_t lba_start, uint32_t lba_len, std::vector<Extent> &extents) const;
+
+		/**
+		 * Check if a range of LBAs is known to be empty without reading it.
+		 *
+		 * This is true if the range is entirely unallocated.
+		 * (See extents().) Such ranges are always read as zeroes.
+		 *
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return True if the range is known to be empty; false if not, or if unknown.
+		 */
+		virtual bool isRangeEmpty(uint32_t lba_start, uint32_t lba_len) const;
+
+		/**
+		 * Get the allocation map of a range of equal-sized blocks.
+		 *
+		 * This is built from extents(), so it doesn't read any data.
+		 * Blocks that extend past the end of the image are never
+		 * considered empty.
+		 *
+		 * @param lba_start	[in] Starting LBA of the first block.
+		 * @param block_lba_len	[in] Length of each block, in LBAs.
+		 * @param count		[in] Number of blocks.
+		 * @param map		[out] Per-block flags: 1 if the block is known to be empty.
+		 * @return Number of blocks that are known to be empty.
+		 */
+		unsigned int getEmptyMap(uint32_t lba_start, uint32_t block_lba_len,
+			unsigned int count, std::vector<uint8_t> &map) const;
+
+		/**
+		 * Get the file offset of a range of LBAs.
+		 *
+		 * This is only supported if the range is stored contiguously
+		 * and uncompressed in the file, which allows reading it
+		 * directly from the file, e.g. using asynchronous I/O.
+		 *
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @param pOffset	[out] File offset, in bytes.
+		 * @return True if the range can be read directly from the file; false if not.
+		 */
+		virtual bool fileOffset(uint32_t lba_start, uint32_t lba_len, off64_t *pOffset) const;
+
+		/**
+		 * Get the file offset where the disc image's data starts.
+		 *
+		 * This is used to order reads of multiple disc images that
+		 * are stored in the same file, e.g. discs in a WBFS partition,
+		 * so the file is read from start to end.
+		 *
+		 * Base class implementation returns the starting LBA.
+		 *
+		 * @return File offset, in bytes.
+		 */
+		virtual off64_t physicalStart(void) const;
+
+		/**
+		 * Get the native block size of the disc image.
+		 *
+		 * Formats that store the image in fixed-size blocks return
+		 * the block size, so copy loops can use chunks that don't
+		 * straddle blocks. Each block starts at a multiple of the
+		 * block size from the start of the image.
+		 *
+		 * Base class implementation returns 0. (no native blocks)
+		 *
+		 * @return Block size, in LBAs, or 0 if the image isn't stored in blocks.
+		 */
+		virtual uint32_t blockSizeLba(void) const;
+
 		/**
 		 * Write data to the disc image.
 		 * @param ptr		[in] Write buffer.
@@ -86,10 +289,64 @@ class Reader
 		 */
 		virtual uint32_t write(const void *ptr, uint32_t lba_start, uint32_t lba_len);
 
+		/**
+		 * Prepare a new disc image for sparse writing.
+		 *
+		 * Plain images are marked as sparse and set to their full size.
+		 * Subclasses that allocate blocks on write don't resize the file.
+		 *
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		virtual int makeSparse(void);
+
+		/**
+		 * Allocate disk space for a new disc image up front.
+		 *
+		 * Base class implementation returns -ENOTSUP.
+		 * Container formats that allocate blocks on write
+		 * don't support this.
+		 *
+		 * @return 0 on success; negative POSIX error code on error. (-ENOTSUP if not supported)
+		 */
+		virtual int preallocate(void);
+
+		/**
+		 * Deallocate a range of LBAs that only contain zeroes.
+		 *
+		 * Base class implementation returns -ENOTSUP.
+		 *
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return 0 on success; negative POSIX error code on error. (-ENOTSUP if not supported)
+		 */
+		virtual int discard(uint32_t lba_start, uint32_t lba_len);
+
 		/**
 		 * Flush the file buffers.
+		 * Subclasses with container headers write them here.
+		 */
+		virtual void flush(void);
+
+		/**
+		 * Flush the file buffers and sync the files to the media,
+		 * e.g. at the end of a job. (See RefFile::sync().)
 		 */
-		void flush(void);
+		virtual void sync(void);
+
+		/**
+		 * Set the durability policy for writes to the image files.
+		 * @param durability	[in] Durability policy
+		 * @param interval	[in] Sync interval for RVTH_DURABILITY_INTERVAL, in bytes
+		 */
+		virtual void setDurability(RvtH_Durability durability, uint64_t interval);
+
+		/**
+		 * Drop any data that was cached from the image, e.g. after
+		 * the image was modified without using this Reader.
+		 *
+		 * Base class implementation does nothing.
+		 */
+		virtual void invalidateCache(void);
 
 	public:
 		/** Accessors **/
@@ -112,6 +369,12 @@ class Reader
 		 */
 		inline RvtH_ImageType_e type(void) const { return m_type; }
 
+		/**
+		 * Get the disc image file.
+		 * @return RefFile*
+		 */
+		inline RefFile *file(void) const { return m_file; }
+
 	public:
 		/** Special functions **/
 
@@ -128,6 +391,83 @@ class Reader
 			m_lba_len -= lba_count;
 		}
 
+	protected:
+		/**
+		 * Add a range to an extent list for extents().
+		 * The range is merged with the last extent if it has the same allocation state.
+		 * @param extents	[in/out] Extents.
+		 * @param lba_start	[in] Starting LBA. (must follow the last extent)
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @param allocated	[in] True if the range is allocated.
+		 */
+		static void addExtent(std::vector<Extent> &extents, uint32_t lba_start, uint32_t lba_len, bool allocated);
+
+		/**
+		 * Get the extents of an image that's stored in fixed-size blocks.
+		 * Used by the RVTZ reader.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs. (Clamped to the image length.)
+		 * @param block_lba_len	[in] Block size, in LBAs.
+		 * @param isAllocated	[in] Returns true if a block is allocated.
+		 * @param extents	[out] Extents.
+		 * @return Number of unallocated LBAs.
+		 */
+		uint32_t blockExtents(uint32_t lba_start, uint32_t lba_len, uint32_t block_lba_len,
+			const std::function<bool(uint32_t block)> &isAllocated,
+			std::vector<Extent> &extents) const;
+
+		/**
+		 * Get the extents of an image using its block map.
+		 * Used by the CISO and WBFS readers.
+		 * @param map		[in] Block map.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs. (Clamped to the image length.)
+		 * @param extents	[out] Extents.
+		 * @return Number of unallocated LBAs.
+		 */
+		uint32_t blockMapExtents(const BlockMap &map, uint32_t lba_start, uint32_t lba_len,
+			std::vector<Extent> &extents) const;
+
+		/**
+		 * Add the extents of a range of LBAs that's stored contiguously in a file.
+		 * Holes in the file are unallocated. If the file system can't
+		 * find holes, the range is added as allocated.
+		 * Used by the plain and split readers.
+		 * @param file		[in] File.
+		 * @param offset	[in] File offset of lba_start.
+		 * @param lba_start	[in] Starting LBA. (must follow the last extent)
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @param extents	[in/out] Extents.
+		 * @return Number of unallocated LBAs.
+		 */
+		static uint32_t addFileExtents(RefFile *file, off64_t offset,
+			uint32_t lba_start, uint32_t lba_len, std::vector<Extent> &extents);
+
+		/**
+		 * File extent for readExtents().
+		 */
+		struct ReadExtent {
+			off64_t offset;		// File offset
+			uint8_t *ptr;		// Read buffer
+			uint32_t size;		// Size, in bytes
+			unsigned int range;	// Index of the ReadRange this extent belongs to
+		};
+
+		/**
+		 * Read file extents for readv().
+		 *
+		 * The extents are sorted by file offset, and extents that are
+		 * adjacent in the file are read using RefFile::preadv().
+		 * If an extent can't be read, lba_read is set to 0 for its range,
+		 * so lba_read should be set to lba_len for all ranges beforehand.
+		 *
+		 * @param extents	[in/out] Extents. (sorted by this function)
+		 * @param ranges	[in/out] Ranges.
+		 * @param count		[in] Number of ranges.
+		 * @return Number of ranges that were read completely.
+		 */
+		unsigned int readExtents(std::vector<ReadExtent> &extents, ReadRange *ranges, unsigned int count);
+
 	protected:
 		RefFile *m_file;		// Disc image file
 		uint32_t m_lba_start;		// Starting LBA
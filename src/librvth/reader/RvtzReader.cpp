@@ -0,0 +1,1254 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * RvtzReader.cpp: RVTZ compressed disc image reader class.                *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "config.librvth.h"
+
+#include "RvtzReader.hpp"
+#include "ProbeBuffer.hpp"
+#include "byteswap.h"
+#include "rvth.hpp"	// for RvtH::isBlockEmpty()
+#include "StatsCounters.hpp"
+#include "Trace.hpp"
+#include "junk_data.h"
+
+// For LBA_TO_BYTES()
+#include "nhcd_structs.h"
+
+// libwiicrypto
+#include "libwiicrypto/aesw.h"
+#include "libwiicrypto/gcn_structs.h"
+#include "libwiicrypto/title_key.h"
+#include "libwiicrypto/wii_sector.h"
+#include "libwiicrypto/wii_structs.h"
+
+// Compression libraries
+#ifdef HAVE_ZSTD
+#  include <zstd.h>
+#endif /* HAVE_ZSTD */
+#ifdef HAVE_LZMA
+#  include <lzma.h>
+#endif /* HAVE_LZMA */
+
+// C includes (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+// C++ includes
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+using std::array;
+using std::deque;
+using std::lock_guard;
+using std::mutex;
+using std::shared_ptr;
+using std::unique_lock;
+using std::unique_ptr;
+using std::vector;
+
+// RVTZ magic
+static const array<char, 4> RVTZ_MAGIC = {{'R','V','T','Z'}};
+// Version 1 doesn't have junk sectors. Version 2 is only written if
+// the disc image has junk sectors, so older versions can read the rest.
+#define RVTZ_VERSION_MIN 1
+#define RVTZ_VERSION 2
+
+// Header size. Compressed chunks start after the header.
+#define RVTZ_HEADER_SIZE 512
+
+// Chunk size for new disc images. (one Wii group)
+// The decrypted sector mask has one bit per 32 KB sector,
+// so chunks can't be larger than 2 MB.
+#define RVTZ_CHUNK_SIZE_MIN SECTOR_SIZE_ENC
+#define RVTZ_CHUNK_SIZE_MAX (64*SECTOR_SIZE_ENC)
+#define RVTZ_CHUNK_SIZE_DEFAULT RVTZ_CHUNK_SIZE_MAX
+
+// Maximum number of partitions with decrypted sectors.
+#define RVTZ_PART_MAX 16
+
+// Compression codecs.
+#define RVTZ_CODEC_NONE	0
+#define RVTZ_CODEC_LZMA	1
+#define RVTZ_CODEC_ZSTD	2
+
+// Compression levels for new disc images.
+#define RVTZ_ZSTD_LEVEL 9
+#define RVTZ_LZMA_PRESET 6
+
+// Chunk flags.
+#define RVTZ_CHUNK_ZERO		(1U << 0)	// Chunk is all zeroes and isn't stored.
+#define RVTZ_CHUNK_STORED	(1U << 1)	// Chunk is stored uncompressed.
+
+// Number of decoded chunks to cache.
+#define RVTZ_CACHE_COUNT 4
+
+/**
+ * RVTZ partition entry.
+ * All fields are little-endian.
+ */
+typedef struct _RvtzPartitionEntry {
+	uint32_t lba_start;		// Partition header
+	uint32_t data_lba_start;	// Start of the decrypted data
+	uint32_t data_lba_len;		// Length of the decrypted data
+} RvtzPartitionEntry;
+ASSERT_STRUCT(RvtzPartitionEntry, 12);
+
+/**
+ * RVTZ header.
+ * All fields are little-endian.
+ */
+typedef struct _RvtzHeader {
+	char magic[4];			// [0x000] "RVTZ"
+	uint32_t version;		// [0x004] Format version
+	uint32_t codec;			// [0x008] Compression codec (RVTZ_CODEC_*)
+	uint32_t chunk_size;		// [0x00C] Chunk size, in bytes
+	uint32_t lba_len;		// [0x010] Disc image size, in LBAs
+	uint32_t chunk_count;		// [0x014] Number of chunks
+	uint64_t index_offset;		// [0x018] Chunk index offset, relative to the header
+	uint32_t part_count;		// [0x020] Number of partition entries
+	uint32_t reserved;		// [0x024]
+	RvtzPartitionEntry parts[RVTZ_PART_MAX];	// [0x028]
+	uint8_t pad[RVTZ_HEADER_SIZE - 0x28 - (RVTZ_PART_MAX * sizeof(RvtzPartitionEntry))];
+} RvtzHeader;
+ASSERT_STRUCT(RvtzHeader, RVTZ_HEADER_SIZE);
+
+/**
+ * RVTZ chunk index entry.
+ * All fields are little-endian.
+ */
+typedef struct _RvtzIndexEntry {
+	uint64_t offset;	// Chunk offset, relative to the header
+	uint32_t size;		// Compressed size
+	uint32_t flags;		// Chunk flags (RVTZ_CHUNK_*)
+	uint64_t dec_mask;	// Decrypted sectors (bit 0 == first 32 KB sector)
+	uint64_t junk_mask;	// Junk sectors (v2) (stored as the junk data seed)
+} RvtzIndexEntry;
+ASSERT_STRUCT(RvtzIndexEntry, 32);
+
+// Index entry size for each version.
+#define RVTZ_INDEX_ENTRY_SIZE_V1 24
+#define RVTZ_INDEX_ENTRY_SIZE_V2 32
+
+/** Compression codecs **/
+
+/**
+ * Codec for new disc images.
+ */
+#if defined(HAVE_ZSTD)
+static const uint32_t codec_default = RVTZ_CODEC_ZSTD;
+#elif defined(HAVE_LZMA)
+static const uint32_t codec_default = RVTZ_CODEC_LZMA;
+#else
+static const uint32_t codec_default = RVTZ_CODEC_NONE;
+#endif
+
+/**
+ * Is a compression codec supported by this build?
+ * @param codec Codec (RVTZ_CODEC_*)
+ * @return True if supported; false if not.
+ */
+static bool isCodecSupported(uint32_t codec)
+{
+	switch (codec) {
+		case RVTZ_CODEC_NONE:
+			return true;
+#ifdef HAVE_LZMA
+		case RVTZ_CODEC_LZMA:
+			return true;
+#endif /* HAVE_LZMA */
+#ifdef HAVE_ZSTD
+		case RVTZ_CODEC_ZSTD:
+			return true;
+#endif /* HAVE_ZSTD */
+		default:
+			return false;
+	}
+}
+
+/**
+ * Compress a chunk.
+ * @param codec		[in] Codec (RVTZ_CODEC_*)
+ * @param in		[in] Chunk data
+ * @param in_size	[in] Size of the chunk data
+ * @param out		[out] Output buffer
+ * @param out_size	[in] Size of the output buffer
+ * @return Compressed size, or 0 if the chunk doesn't fit in the output buffer.
+ */
+static size_t compressChunk(uint32_t codec, const uint8_t *in, size_t in_size, uint8_t *out, size_t out_size)
+{
+	switch (codec) {
+		default:
+		case RVTZ_CODEC_NONE:
+			break;
+#ifdef HAVE_LZMA
+		case RVTZ_CODEC_LZMA: {
+			size_t out_pos = 0;
+			if (lzma_easy_buffer_encode(RVTZ_LZMA_PRESET, LZMA_CHECK_NONE, nullptr,
+			    in, in_size, out, &out_pos, out_size) == LZMA_OK)
+			{
+				return out_pos;
+			}
+			break;
+		}
+#endif /* HAVE_LZMA */
+#ifdef HAVE_ZSTD
+		case RVTZ_CODEC_ZSTD: {
+			const size_t ret = ZSTD_compress(out, out_size, in, in_size, RVTZ_ZSTD_LEVEL);
+			if (!ZSTD_isError(ret)) {
+				return ret;
+			}
+			break;
+		}
+#endif /* HAVE_ZSTD */
+	}
+
+	// Not compressed.
+	return 0;
+}
+
+/**
+ * Decompress a chunk.
+ * @param codec		[in] Codec (RVTZ_CODEC_*)
+ * @param in		[in] Compressed data
+ * @param in_size	[in] Size of the compressed data
+ * @param out		[out] Output buffer
+ * @param out_size	[in] Size of the output buffer (chunk size)
+ * @return True if the chunk was decompressed to exactly out_size bytes; false if not.
+ */
+static bool decompressChunk(uint32_t codec, const uint8_t *in, size_t in_size, uint8_t *out, size_t out_size)
+{
+	switch (codec) {
+		default:
+			break;
+#ifdef HAVE_LZMA
+		case RVTZ_CODEC_LZMA: {
+			uint64_t memlimit = UINT64_MAX;
+			size_t in_pos = 0, out_pos = 0;
+			return (lzma_stream_buffer_decode(&memlimit, 0, nullptr,
+				in, &in_pos, in_size, out, &out_pos, out_size) == LZMA_OK &&
+				out_pos == out_size);
+		}
+#endif /* HAVE_LZMA */
+#ifdef HAVE_ZSTD
+		case RVTZ_CODEC_ZSTD: {
+			const size_t ret = ZSTD_decompress(out, out_size, in, in_size);
+			return (!ZSTD_isError(ret) && ret == out_size);
+		}
+#endif /* HAVE_ZSTD */
+	}
+	return false;
+}
+
+/**
+ * Get the name of the compression codec used for new images.
+ * If neither zstd nor LZMA is available, chunks are stored
+ * uncompressed, and only empty chunks are removed.
+ * @return Codec name, e.g. "zstd".
+ */
+const char *RvtzReader::codecName(void)
+{
+	switch (codec_default) {
+		case RVTZ_CODEC_LZMA:
+			return "LZMA";
+		case RVTZ_CODEC_ZSTD:
+			return "zstd";
+		default:
+			return "none";
+	}
+}
+
+/** Wii sector encryption **/
+
+/**
+ * Find the partition containing a complete encrypted sector.
+ * @param parts	[in] Partitions
+ * @param lba	[in] First LBA of the sector
+ * @return Partition, or nullptr if the sector isn't in a partition with a known title key.
+ */
+static const RvtzReader::Partition *findPartition(const vector<RvtzReader::Partition> &parts, uint32_t lba)
+{
+	static constexpr uint32_t sector_lba = BYTES_TO_LBA(SECTOR_SIZE_ENC);
+	for (const auto &part : parts) {
+		if (part.has_key && lba >= part.data_lba_start &&
+		    lba - part.data_lba_start + sector_lba <= part.data_lba_len)
+		{
+			return &part;
+		}
+	}
+	return nullptr;
+}
+
+/**
+ * Decrypt a Wii sector in place.
+ * The data IV is the encrypted end of the hash block, so it's
+ * saved before the hash block is decrypted.
+ * @param aes		[in] AES context
+ * @param title_key	[in] Title key
+ * @param sector	[in,out] Sector (32 KB)
+ */
+static void decryptSector(AesCtx *aes, const uint8_t *title_key, uint8_t *sector)
+{
+	static const uint8_t iv_zero[16] = {0};
+	uint8_t iv_data[16];
+	memcpy(iv_data, &sector[0x3D0], sizeof(iv_data));
+
+	aesw_set_key(aes, title_key, 16);
+	aesw_set_iv(aes, iv_zero, sizeof(iv_zero));
+	aesw_decrypt(aes, sector, sizeof(Wii_Disc_Hashes_t));
+	aesw_set_iv(aes, iv_data, sizeof(iv_data));
+	aesw_decrypt(aes, &sector[sizeof(Wii_Disc_Hashes_t)], SECTOR_SIZE_DEC);
+}
+
+/**
+ * Encrypt a Wii sector in place.
+ * This reverses decryptSector().
+ * @param aes		[in] AES context
+ * @param title_key	[in] Title key
+ * @param sector	[in,out] Sector (32 KB)
+ */
+static void encryptSector(AesCtx *aes, const uint8_t *title_key, uint8_t *sector)
+{
+	static const uint8_t iv_zero[16] = {0};
+
+	aesw_set_key(aes, title_key, 16);
+	aesw_set_iv(aes, iv_zero, sizeof(iv_zero));
+	aesw_encrypt(aes, sector, sizeof(Wii_Disc_Hashes_t));
+	aesw_set_iv(aes, &sector[0x3D0], 16);
+	aesw_encrypt(aes, &sector[sizeof(Wii_Disc_Hashes_t)], SECTOR_SIZE_DEC);
+}
+
+/** RvtzReader **/
+
+// Chunk cache for reading.
+struct RvtzReader::Cache {
+	struct Entry {
+		shared_ptr<const uint8_t> data;	// Decoded chunk
+		uint32_t chunk = ~0U;		// Chunk index (~0U if unused)
+		uint32_t last_used = 0;		// LRU counter value
+	};
+
+	mutex lock;
+	array<Entry, RVTZ_CACHE_COUNT> entries;
+	uint32_t counter = 0;
+};
+
+// Compression state for new disc images.
+struct RvtzReader::WriteState {
+	// Chunk that's currently being filled by write().
+	uint8_t *cur = nullptr;		// Chunk buffer (nullptr if nothing was written yet)
+	uint32_t cur_chunk = 0;		// Chunk index
+	bool ptbl_loaded = false;	// True if the partition table was checked
+	bool finished = false;		// True if finish() was called
+
+	// Chunks waiting for a worker thread.
+	struct Job {
+		uint8_t *buf;		// Chunk buffer
+		uint32_t chunk;		// Chunk index
+		uint32_t size;		// Chunk size (smaller for the last chunk)
+		vector<Partition> parts;	// Partitions known when the chunk was submitted
+	};
+	deque<Job> jobs;
+
+	// Chunk buffers. There are two buffers per worker thread,
+	// so write() can fill a chunk while the others are compressed.
+	vector<unique_ptr<uint8_t[]> > bufs;
+	vector<uint8_t*> free_bufs;
+
+	vector<std::thread> workers;
+	StatsCounters *stats = nullptr;
+
+	// Protects everything below, plus jobs, free_bufs, and m_index.
+	mutex lock;
+	std::condition_variable job_cond;	// Signaled when a job is added
+	std::condition_variable free_cond;	// Signaled when a buffer is freed
+	uint64_t data_end = RVTZ_HEADER_SIZE;	// End of the compressed data, relative to the header
+	int err = 0;				// First write error
+	bool stop = false;			// Workers exit when the job queue is empty
+};
+
+/**
+ * Is a given disc image supported by the RVTZ reader?
+ * @param sbuf	[in] Sector buffer. (first LBA of the disc)
+ * @param size	[in] Size of sbuf. (should be 512 or larger)
+ * @return True if supported; false if not.
+ */
+bool RvtzReader::isSupported(const uint8_t *sbuf, size_t size)
+{
+	assert(sbuf != nullptr);
+	assert(size >= LBA_SIZE);
+	if (!sbuf || size < LBA_SIZE) {
+		return false;
+	}
+
+	const RvtzHeader *const header = reinterpret_cast<const RvtzHeader*>(sbuf);
+	return (!memcmp(header->magic, RVTZ_MAGIC.data(), RVTZ_MAGIC.size()) &&
+		le32_to_cpu(header->version) >= RVTZ_VERSION_MIN &&
+		le32_to_cpu(header->version) <= RVTZ_VERSION);
+}
+
+/**
+ * Create an RVTZ reader for a disc image.
+ *
+ * NOTE: If lba_start == 0 and lba_len == 0, the entire file
+ * will be used.
+ *
+ * @param file		RefFile*.
+ * @param lba_start	[in] Starting LBA,
+ * @param lba_len	[in] Length, in LBAs.
+ * @param probe		[in,opt] Probe window from Reader::open(), or nullptr to read the headers from the file.
+ */
+RvtzReader::RvtzReader(RefFile *file, uint32_t lba_start, uint32_t lba_len, const ProbeBuffer *probe)
+	: super(file, lba_start, lba_len)
+	, m_file_base(LBA_TO_BYTES(static_cast<uint64_t>(lba_start)))
+	, m_chunk_lba(0)
+	, m_codec(RVTZ_CODEC_NONE)
+	, m_cache(new Cache)
+{
+	int err = 0;
+	size_t size;
+	uint32_t chunk_size, chunk_count, part_count;
+	size_t entry_size;
+	vector<uint8_t> index;
+	unique_ptr<uint8_t[]> chunk_buf;
+
+	if (!isOpen()) {
+		// File wasn't opened.
+		return;
+	}
+
+	// Read the RVTZ header.
+	RvtzHeader header;
+	errno = 0;
+	size = ProbeBuffer::pread(probe, m_file, &header, sizeof(header), m_file_base);
+	if (size != sizeof(header)) {
+		// Short read.
+		err = (errno != 0 ? errno : EIO);
+		goto fail;
+	}
+	if (!isSupported(reinterpret_cast<const uint8_t*>(&header), sizeof(header))) {
+		// Not a valid RVTZ header.
+		err = EIO;
+		goto fail;
+	}
+
+	// Validate the header.
+	chunk_size = le32_to_cpu(header.chunk_size);
+	chunk_count = le32_to_cpu(header.chunk_count);
+	part_count = le32_to_cpu(header.part_count);
+	m_codec = le32_to_cpu(header.codec);
+	m_lba_len = le32_to_cpu(header.lba_len);
+	if (chunk_size < RVTZ_CHUNK_SIZE_MIN || chunk_size > RVTZ_CHUNK_SIZE_MAX ||
+	    (chunk_size & (chunk_size - 1)) != 0 || m_lba_len == 0 ||
+	    part_count > RVTZ_PART_MAX)
+	{
+		err = EIO;
+		goto fail;
+	}
+	m_chunk_lba = BYTES_TO_LBA(chunk_size);
+	if (chunk_count != (m_lba_len + m_chunk_lba - 1) / m_chunk_lba) {
+		err = EIO;
+		goto fail;
+	} else if (!isCodecSupported(m_codec)) {
+		// Compression codec isn't available in this build.
+		err = ENOTSUP;
+		goto fail;
+	}
+
+	// Read the chunk index.
+	entry_size = (le32_to_cpu(header.version) >= 2
+		? RVTZ_INDEX_ENTRY_SIZE_V2
+		: RVTZ_INDEX_ENTRY_SIZE_V1);
+	index.resize(static_cast<size_t>(chunk_count) * entry_size);
+	errno = 0;
+	size = ProbeBuffer::pread(probe, m_file, index.data(), index.size(),
+		m_file_base + le64_to_cpu(header.index_offset));
+	if (size != index.size()) {
+		// Short read.
+		err = (errno != 0 ? errno : EIO);
+		goto fail;
+	}
+	m_index.resize(chunk_count);
+	for (size_t i = 0; i < m_index.size(); i++) {
+		RvtzIndexEntry ie;
+		memset(&ie, 0, sizeof(ie));
+		memcpy(&ie, &index[i * entry_size], entry_size);
+
+		ChunkEntry &entry = m_index[i];
+		entry.offset = le64_to_cpu(ie.offset);
+		entry.size = le32_to_cpu(ie.size);
+		entry.flags = le32_to_cpu(ie.flags);
+		entry.dec_mask = le64_to_cpu(ie.dec_mask);
+		entry.junk_mask = le64_to_cpu(ie.junk_mask);
+		if ((entry.dec_mask & entry.junk_mask) != 0) {
+			err = EIO;
+			goto fail;
+		}
+		if (!(entry.flags & RVTZ_CHUNK_ZERO) && entry.size > chunk_size) {
+			err = EIO;
+			goto fail;
+		}
+	}
+
+	// Get the title keys for the decrypted partitions.
+	// The partition headers aren't decrypted, so the chunks
+	// containing the tickets can be read without the keys.
+	chunk_buf.reset(new uint8_t[chunk_size]);
+	for (unsigned int i = 0; i < part_count; i++) {
+		Partition part;
+		part.lba_start = le32_to_cpu(header.parts[i].lba_start);
+		part.data_lba_start = le32_to_cpu(header.parts[i].data_lba_start);
+		part.data_lba_len = le32_to_cpu(header.parts[i].data_lba_len);
+		part.has_key = false;
+
+		const uint32_t chunk = part.lba_start / m_chunk_lba;
+		const uint32_t offset = static_cast<uint32_t>(LBA_TO_BYTES(part.lba_start % m_chunk_lba));
+		if (chunk < chunk_count && offset + sizeof(RVL_Ticket) <= chunk_size &&
+		    decodeChunk(chunk, chunk_buf.get(), false))
+		{
+			uint8_t crypto_type;
+			const RVL_Ticket *const ticket = reinterpret_cast<const RVL_Ticket*>(&chunk_buf[offset]);
+			part.has_key = (decrypt_title_key(ticket, part.title_key, &crypto_type) == 0);
+		}
+		// NOTE: If the title key can't be decrypted, reading the
+		// partition's decrypted sectors will fail.
+		m_parts.push_back(part);
+	}
+
+	// Reader initialized.
+	m_type = RVTH_ImageType_GCM;
+	return;
+
+fail:
+	// Failed to initialize the reader.
+	m_file->unref();
+	m_file = nullptr;
+	errno = err;
+}
+
+/**
+ * Create an RVTZ reader for a new disc image.
+ * Use Reader::create() instead of calling this directly.
+ *
+ * @param file		RefFile*. (Must be a new, empty file opened for writing.)
+ * @param lba_len	[in] Length, in LBAs.
+ * @return RvtzReader*, or NULL on error.
+ */
+RvtzReader *RvtzReader::create(RefFile *file, uint32_t lba_len)
+{
+	RvtzReader *const reader = new RvtzReader(file, lba_len);
+	if (!reader->isOpen()) {
+		const int err = errno;
+		delete reader;
+		errno = err;
+		return nullptr;
+	}
+	return reader;
+}
+
+/**
+ * Initialize an RVTZ reader for a new disc image.
+ * @param file		RefFile*.
+ * @param lba_len	[in] Length, in LBAs.
+ */
+RvtzReader::RvtzReader(RefFile *file, uint32_t lba_len)
+	: super(file, 0, lba_len)
+	, m_file_base(0)
+	, m_chunk_lba(BYTES_TO_LBA(RVTZ_CHUNK_SIZE_DEFAULT))
+	, m_codec(codec_default)
+	, m_cache(new Cache)
+	, m_write(new WriteState)
+{
+	if (!isOpen()) {
+		// File wasn't opened.
+		return;
+	} else if (lba_len == 0) {
+		m_file->unref();
+		m_file = nullptr;
+		errno = EINVAL;
+		return;
+	}
+
+	// All chunks are empty until they're written.
+	ChunkEntry zero_entry;
+	zero_entry.offset = 0;
+	zero_entry.size = 0;
+	zero_entry.flags = RVTZ_CHUNK_ZERO;
+	zero_entry.dec_mask = 0;
+	zero_entry.junk_mask = 0;
+	m_index.assign((lba_len + m_chunk_lba - 1) / m_chunk_lba, zero_entry);
+	m_type = RVTH_ImageType_GCM;
+}
+
+RvtzReader::~RvtzReader()
+{
+	// Write the index and header if they haven't been written yet.
+	if (m_write && isOpen()) {
+		finish();
+	}
+
+	// Superclass will unreference the file.
+}
+
+/**
+ * Read and decompress a chunk.
+ * @param chunk		[in] Chunk index.
+ * @param buf		[out] Chunk buffer. (must be the chunk size)
+ * @param encrypt	[in] If true, encrypt the sectors that were decrypted.
+ * @return True on success; false on error. (errno is set)
+ */
+bool RvtzReader::decodeChunk(uint32_t chunk, uint8_t *buf, bool encrypt)
+{
+	const ChunkEntry &entry = m_index[chunk];
+	const size_t chunk_size = LBA_TO_BYTES(m_chunk_lba);
+	if (entry.flags & RVTZ_CHUNK_ZERO) {
+		memset(buf, 0, chunk_size);
+		return true;
+	}
+
+	// Read the chunk.
+	unique_ptr<uint8_t[]> cbuf;
+	uint8_t *rbuf = buf;
+	if (!(entry.flags & RVTZ_CHUNK_STORED)) {
+		cbuf.reset(new uint8_t[entry.size]);
+		rbuf = cbuf.get();
+	}
+	errno = 0;
+	if (m_file->pread(rbuf, entry.size, m_file_base + entry.offset) != entry.size) {
+		// Read error.
+		if (errno == 0) {
+			errno = EIO;
+		}
+		return false;
+	}
+
+	// The last chunk may be shorter than the chunk size.
+	const uint32_t lba_chunk = chunk * m_chunk_lba;
+	const size_t size = LBA_TO_BYTES(std::min(m_chunk_lba, m_lba_len - lba_chunk));
+	if (cbuf) {
+		if (!decompressChunk(m_codec, cbuf.get(), entry.size, buf, size)) {
+			errno = EIO;
+			return false;
+		}
+	} else if (entry.size != size) {
+		errno = EIO;
+		return false;
+	}
+	if (size < chunk_size) {
+		memset(&buf[size], 0, chunk_size - size);
+	}
+
+	// Regenerate the junk sectors from their seeds.
+	for (unsigned int i = 0; entry.junk_mask != 0 && i < 64; i++) {
+		if (!(entry.junk_mask & (1ULL << i))) {
+			continue;
+		}
+		if ((i + 1) * SECTOR_SIZE_ENC > size) {
+			errno = EIO;
+			return false;
+		}
+		uint8_t *const sector = &buf[i * SECTOR_SIZE_ENC];
+		RvtH_JunkGen junk;
+		rvth_junk_init(&junk, sector);
+		rvth_junk_generate(&junk, sector, SECTOR_SIZE_ENC);
+	}
+
+	if (!encrypt || entry.dec_mask == 0) {
+		return true;
+	}
+
+	// Encrypt the sectors that were decrypted.
+	StatsTimer timer(StatsCounters::TIMER_AES);
+	AesCtx *const aes = aesw_new();
+	if (!aes) {
+		errno = ENOMEM;
+		return false;
+	}
+	bool ok = true;
+	for (unsigned int i = 0; i < 64; i++) {
+		if (!(entry.dec_mask & (1ULL << i))) {
+			continue;
+		}
+		const Partition *const part = findPartition(m_parts,
+			lba_chunk + (i * BYTES_TO_LBA(SECTOR_SIZE_ENC)));
+		if (!part) {
+			// Title key isn't available.
+			errno = EIO;
+			ok = false;
+			break;
+		}
+		encryptSector(aes, part->title_key, &buf[i * SECTOR_SIZE_ENC]);
+	}
+	aesw_free(aes);
+	return ok;
+}
+
+/**
+ * Get a decoded chunk using the chunk cache.
+ * @param chunk	[in] Chunk index.
+ * @return Chunk data, or nullptr on error. (errno is set)
+ */
+shared_ptr<const uint8_t> RvtzReader::loadChunk(uint32_t chunk)
+{
+	{
+		lock_guard<mutex> lock(m_cache->lock);
+		for (auto &e : m_cache->entries) {
+			if (e.chunk == chunk) {
+				e.last_used = ++m_cache->counter;
+				return e.data;
+			}
+		}
+	}
+
+	// Decode the chunk without holding the lock,
+	// so other threads can decode chunks at the same time.
+	shared_ptr<uint8_t> data(new uint8_t[LBA_TO_BYTES(m_chunk_lba)], std::default_delete<uint8_t[]>());
+	if (!decodeChunk(chunk, data.get(), true)) {
+		return nullptr;
+	}
+
+	// Replace the least recently used entry.
+	lock_guard<mutex> lock(m_cache->lock);
+	auto *lru = &m_cache->entries[0];
+	for (auto &e : m_cache->entries) {
+		if (e.last_used < lru->last_used) {
+			lru = &e;
+		}
+	}
+	lru->data = data;
+	lru->chunk = chunk;
+	lru->last_used = ++m_cache->counter;
+	return data;
+}
+
+/**
+ * Read data from the disc image.
+ * @param ptr		[out] Read buffer.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Number of LBAs read, or 0 on error.
+ */
+uint32_t RvtzReader::read(void *ptr, uint32_t lba_start, uint32_t lba_len)
+{
+	RVTH_TRACE_SPAN_BYTES("RvtzReader::read", LBA_TO_BYTES(lba_len));
+
+	// LBA bounds checking.
+	// TODO: Check for overflow?
+	assert(lba_start + lba_len <= m_lba_len);
+	if (lba_start + lba_len > m_lba_len) {
+		// Out of range.
+		errno = EIO;
+		return 0;
+	} else if (m_write && !m_write->finished) {
+		// New disc images can't be read until they're finished.
+		errno = EIO;
+		return 0;
+	}
+
+	uint8_t *ptr8 = static_cast<uint8_t*>(ptr);
+	const uint32_t lba_end = lba_start + lba_len;
+	for (uint32_t lba = lba_start; lba < lba_end; ) {
+		const uint32_t chunk = lba / m_chunk_lba;
+		const uint32_t offset = lba % m_chunk_lba;
+		const uint32_t seg_len = std::min(m_chunk_lba - offset, lba_end - lba);
+
+		if (m_index[chunk].flags & RVTZ_CHUNK_ZERO) {
+			// Empty chunk.
+			memset(ptr8, 0, LBA_TO_BYTES(seg_len));
+		} else {
+			const shared_ptr<const uint8_t> data = loadChunk(chunk);
+			if (!data) {
+				// Read error.
+				return 0;
+			}
+			memcpy(ptr8, data.get() + LBA_TO_BYTES(offset), LBA_TO_BYTES(seg_len));
+		}
+
+		lba += seg_len;
+		ptr8 += LBA_TO_BYTES(seg_len);
+	}
+	return lba_len;
+}
+
+/**
+ * Check if a range of LBAs is known to be empty without reading it.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return True if the range is entirely within empty chunks; false if not.
+ */
+bool RvtzReader::isRangeEmpty(uint32_t lba_start, uint32_t lba_len) const
+{
+	if (lba_len == 0 || lba_start + lba_len > m_lba_len || m_write) {
+		return false;
+	}
+
+	const uint32_t first = lba_start / m_chunk_lba;
+	const uint32_t last = (lba_start + lba_len - 1) / m_chunk_lba;
+	for (uint32_t i = first; i <= last; i++) {
+		if (!(m_index[i].flags & RVTZ_CHUNK_ZERO)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Get the allocated and unallocated ranges within a range of LBAs.
+ * Empty chunks are unallocated.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs. (Clamped to the image length.)
+ * @param extents	[out] Extents.
+ * @return Number of unallocated LBAs.
+ */
+uint32_t RvtzReader::extents(uint32_t lba_start, uint32_t lba_len, std::vector<Extent> &extents) const
+{
+	if (m_write) {
+		// New disc image. Chunks are still being written.
+		return super::extents(lba_start, lba_len, extents);
+	}
+	return blockExtents(lba_start, lba_len, m_chunk_lba,
+		[this](uint32_t block) { return !(m_index[block].flags & RVTZ_CHUNK_ZERO); }, extents);
+}
+
+/**
+ * Get the native block size of the disc image.
+ * @return RVTZ chunk size, in LBAs.
+ */
+uint32_t RvtzReader::blockSizeLba(void) const
+{
+	return m_chunk_lba;
+}
+
+/**
+ * Find new Wii partitions in a chunk of a new disc image.
+ * @param buf		[in] Chunk data.
+ * @param chunk		[in] Chunk index.
+ */
+void RvtzReader::findPartitions(const uint8_t *buf, uint32_t chunk)
+{
+	WriteState *const ws = m_write.get();
+	const size_t chunk_size = LBA_TO_BYTES(m_chunk_lba);
+
+	if (!ws->ptbl_loaded) {
+		// The partition table is in the first chunk.
+		// Unencrypted discs don't need to be decrypted.
+		ws->ptbl_loaded = true;
+		const GCN_DiscHeader *const discHeader = reinterpret_cast<const GCN_DiscHeader*>(buf);
+		if (chunk != 0 || discHeader->magic_wii != cpu_to_be32(WII_MAGIC) ||
+		    discHeader->disc_noCrypt != 0)
+		{
+			return;
+		}
+
+		const RVL_VolumeGroupTable *const vgtbl =
+			reinterpret_cast<const RVL_VolumeGroupTable*>(&buf[RVL_VolumeGroupTable_ADDRESS]);
+		for (const auto &vg : vgtbl->vg) {
+			const uint32_t count = be32_to_cpu(vg.count);
+			const uint64_t addr = static_cast<uint64_t>(be32_to_cpu(vg.addr)) << 2;
+			if (count == 0 || addr + (count * sizeof(RVL_PartitionTableEntry)) > chunk_size) {
+				continue;
+			}
+
+			const RVL_PartitionTableEntry *const pte =
+				reinterpret_cast<const RVL_PartitionTableEntry*>(&buf[addr]);
+			for (uint32_t i = 0; i < count && m_parts.size() < RVTZ_PART_MAX; i++) {
+				const uint64_t part_addr = static_cast<uint64_t>(be32_to_cpu(pte[i].addr)) << 2;
+				if (part_addr % SECTOR_SIZE_ENC != 0 || part_addr >= LBA_TO_BYTES(static_cast<uint64_t>(m_lba_len))) {
+					// Sectors aren't aligned, or out of range.
+					continue;
+				}
+				Partition part;
+				memset(&part, 0, sizeof(part));
+				part.lba_start = static_cast<uint32_t>(BYTES_TO_LBA(part_addr));
+				m_parts.push_back(part);
+			}
+		}
+	}
+
+	// Get the title keys for partitions that start in this chunk.
+	const uint32_t lba_chunk = chunk * m_chunk_lba;
+	for (auto &part : m_parts) {
+		if (part.has_key || part.lba_start < lba_chunk ||
+		    part.lba_start - lba_chunk >= m_chunk_lba)
+		{
+			continue;
+		}
+		const size_t offset = LBA_TO_BYTES(part.lba_start - lba_chunk);
+		if (offset + offsetof(RVL_PartitionHeader, data) > chunk_size) {
+			// Partition header is split across chunks.
+			continue;
+		}
+
+		const RVL_PartitionHeader *const ptHdr = reinterpret_cast<const RVL_PartitionHeader*>(&buf[offset]);
+		const uint64_t data_offset = static_cast<uint64_t>(be32_to_cpu(ptHdr->data_offset)) << 2;
+		const uint64_t data_size = static_cast<uint64_t>(be32_to_cpu(ptHdr->data_size)) << 2;
+		const uint64_t data_end = LBA_TO_BYTES(static_cast<uint64_t>(part.lba_start)) + data_offset + data_size;
+		if (data_offset % SECTOR_SIZE_ENC != 0 || data_size == 0 ||
+		    data_end > LBA_TO_BYTES(static_cast<uint64_t>(m_lba_len)))
+		{
+			// Invalid data area.
+			continue;
+		}
+
+		uint8_t crypto_type;
+		if (decrypt_title_key(&ptHdr->ticket, part.title_key, &crypto_type) != 0) {
+			// Unable to decrypt the title key.
+			continue;
+		}
+		part.data_lba_start = part.lba_start + static_cast<uint32_t>(BYTES_TO_LBA(data_offset));
+		part.data_lba_len = static_cast<uint32_t>(BYTES_TO_LBA(data_size));
+		part.has_key = true;
+	}
+}
+
+/**
+ * Compression worker thread for new disc images.
+ * Chunks are compressed and appended to the file in any order.
+ */
+void RvtzReader::compressWorker(void)
+{
+	WriteState *const ws = m_write.get();
+	StatsScope scope(ws->stats);
+	AesCtx *const aes = aesw_new();
+	unique_ptr<uint8_t[]> out(new uint8_t[LBA_TO_BYTES(m_chunk_lba)]);
+
+	for (;;) {
+		WriteState::Job job;
+		{
+			unique_lock<mutex> lock(ws->lock);
+			ws->job_cond.wait(lock, [ws]() { return !ws->jobs.empty() || ws->stop; });
+			if (ws->jobs.empty()) {
+				// No more chunks.
+				break;
+			}
+			job = std::move(ws->jobs.front());
+			ws->jobs.pop_front();
+		}
+
+		ChunkEntry entry;
+		entry.offset = 0;
+		entry.size = 0;
+		entry.flags = RVTZ_CHUNK_ZERO;
+		entry.dec_mask = 0;
+		entry.junk_mask = 0;
+		int err = 0;
+
+		if (!RvtH::isBlockEmpty(job.buf, job.size)) {
+			// Decrypt the encrypted sectors so they can be compressed.
+			// Empty sectors aren't encrypted, so they're left as-is.
+			entry.flags = 0;
+			const uint32_t lba_chunk = job.chunk * m_chunk_lba;
+			if (aes && !job.parts.empty()) {
+				StatsTimer timer(StatsCounters::TIMER_AES);
+				for (unsigned int i = 0; i < job.size / SECTOR_SIZE_ENC; i++) {
+					uint8_t *const sector = &job.buf[i * SECTOR_SIZE_ENC];
+					const Partition *const part = findPartition(job.parts,
+						lba_chunk + (i * BYTES_TO_LBA(SECTOR_SIZE_ENC)));
+					if (!part || RvtH::isBlockEmpty(sector, SECTOR_SIZE_ENC)) {
+						continue;
+					}
+					decryptSector(aes, part->title_key, sector);
+					entry.dec_mask |= (1ULL << i);
+				}
+			}
+
+			// Replace junk sectors with their seeds, since junk data
+			// doesn't compress. This only finds junk data in sectors
+			// that weren't encrypted, e.g. GameCube discs.
+			for (unsigned int i = 0; i < job.size / SECTOR_SIZE_ENC; i++) {
+				if (entry.dec_mask & (1ULL << i)) {
+					continue;
+				}
+				uint8_t *const sector = &job.buf[i * SECTOR_SIZE_ENC];
+				uint8_t seed[RVTH_JUNK_SEED_SIZE];
+				if (!rvth_junk_detect(sector, SECTOR_SIZE_ENC, seed)) {
+					continue;
+				}
+				memcpy(sector, seed, sizeof(seed));
+				memset(&sector[sizeof(seed)], 0, SECTOR_SIZE_ENC - sizeof(seed));
+				entry.junk_mask |= (1ULL << i);
+			}
+
+			// Store the chunk uncompressed if it doesn't get smaller.
+			const uint8_t *data = out.get();
+			size_t size = compressChunk(m_codec, job.buf, job.size, out.get(), job.size);
+			if (size == 0) {
+				data = job.buf;
+				size = job.size;
+				entry.flags = RVTZ_CHUNK_STORED;
+			}
+			entry.size = static_cast<uint32_t>(size);
+
+			// Append the chunk to the file.
+			{
+				lock_guard<mutex> lock(ws->lock);
+				entry.offset = ws->data_end;
+				ws->data_end += size;
+			}
+			errno = 0;
+			if (m_file->pwrite(data, size, m_file_base + entry.offset) != size) {
+				// Write error.
+				err = (errno != 0 ? errno : EIO);
+			}
+		}
+
+		{
+			lock_guard<mutex> lock(ws->lock);
+			m_index[job.chunk] = entry;
+			if (err != 0 && ws->err == 0) {
+				ws->err = err;
+			}
+			ws->free_bufs.push_back(job.buf);
+		}
+		ws->free_cond.notify_one();
+	}
+
+	aesw_free(aes);
+}
+
+/**
+ * Submit the current chunk of a new disc image for compression.
+ * @return True on success; false on error. (errno is set)
+ */
+bool RvtzReader::submitChunk(void)
+{
+	WriteState *const ws = m_write.get();
+	if (ws->cur) {
+		// Find partitions before the chunk is decrypted,
+		// since the partition data may start in this chunk.
+		findPartitions(ws->cur, ws->cur_chunk);
+
+		WriteState::Job job;
+		job.buf = ws->cur;
+		job.chunk = ws->cur_chunk;
+		job.size = static_cast<uint32_t>(LBA_TO_BYTES(
+			std::min(m_chunk_lba, m_lba_len - (ws->cur_chunk * m_chunk_lba))));
+		job.parts = m_parts;
+		{
+			lock_guard<mutex> lock(ws->lock);
+			ws->jobs.push_back(std::move(job));
+		}
+		ws->job_cond.notify_one();
+		ws->cur = nullptr;
+	}
+	// NOTE: Chunks that weren't written are already marked as empty.
+	ws->cur_chunk++;
+
+	lock_guard<mutex> lock(ws->lock);
+	if (ws->err != 0) {
+		errno = ws->err;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Write data to the disc image.
+ *
+ * Only new disc images can be written, and LBAs must be
+ * written in increasing order. Skipped LBAs are zero.
+ *
+ * @param ptr		[in] Write buffer.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Number of LBAs written, or 0 on error.
+ */
+uint32_t RvtzReader::write(const void *ptr, uint32_t lba_start, uint32_t lba_len)
+{
+	RVTH_TRACE_SPAN_BYTES("RvtzReader::write", LBA_TO_BYTES(lba_len));
+
+	WriteState *const ws = m_write.get();
+	if (!ws || ws->finished) {
+		// Existing RVTZ images are read-only.
+		errno = EROFS;
+		return 0;
+	}
+
+	// LBA bounds checking.
+	// TODO: Check for overflow?
+	assert(lba_start + lba_len <= m_lba_len);
+	if (lba_start + lba_len > m_lba_len) {
+		// Out of range.
+		errno = EIO;
+		return 0;
+	} else if (lba_start / m_chunk_lba < ws->cur_chunk) {
+		// Chunk was already compressed.
+		errno = ESPIPE;
+		return 0;
+	}
+
+	if (ws->workers.empty()) {
+		// Start the worker threads.
+		unsigned int threads = std::thread::hardware_concurrency();
+		if (threads == 0) {
+			threads = 1;
+		}
+		ws->stats = StatsCounters::current();
+		for (unsigned int i = 0; i < threads * 2; i++) {
+			ws->bufs.emplace_back(new uint8_t[LBA_TO_BYTES(m_chunk_lba)]);
+			ws->free_bufs.push_back(ws->bufs.back().get());
+		}
+		for (unsigned int i = 0; i < threads; i++) {
+			ws->workers.emplace_back(&RvtzReader::compressWorker, this);
+		}
+	}
+
+	const uint8_t *ptr8 = static_cast<const uint8_t*>(ptr);
+	const uint32_t lba_end = lba_start + lba_len;
+	for (uint32_t lba = lba_start; lba < lba_end; ) {
+		const uint32_t chunk = lba / m_chunk_lba;
+		if (chunk > ws->cur_chunk) {
+			// Finished with the current chunk.
+			if (!submitChunk()) {
+				return 0;
+			}
+			continue;
+		}
+
+		if (!ws->cur) {
+			// Get a free chunk buffer.
+			unique_lock<mutex> lock(ws->lock);
+			ws->free_cond.wait(lock, [ws]() { return !ws->free_bufs.empty() || ws->err != 0; });
+			if (ws->err != 0) {
+				errno = ws->err;
+				return 0;
+			}
+			ws->cur = ws->free_bufs.back();
+			ws->free_bufs.pop_back();
+			lock.unlock();
+			memset(ws->cur, 0, LBA_TO_BYTES(m_chunk_lba));
+		}
+
+		const uint32_t offset = lba % m_chunk_lba;
+		const uint32_t seg_len = std::min(m_chunk_lba - offset, lba_end - lba);
+		memcpy(&ws->cur[LBA_TO_BYTES(offset)], ptr8, LBA_TO_BYTES(seg_len));
+		lba += seg_len;
+		ptr8 += LBA_TO_BYTES(seg_len);
+	}
+	return lba_len;
+}
+
+/**
+ * Prepare a new disc image for sparse writing.
+ * Empty chunks aren't stored, so the file isn't resized.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int RvtzReader::makeSparse(void)
+{
+	return 0;
+}
+
+/**
+ * Finish writing a new disc image.
+ * The worker threads are stopped, and the index and header are written.
+ * @return True on success; false on error. (errno is set)
+ */
+bool RvtzReader::finish(void)
+{
+	WriteState *const ws = m_write.get();
+	if (ws->finished) {
+		return (ws->err == 0);
+	}
+	ws->finished = true;
+
+	// Compress the last chunk and wait for the workers.
+	if (ws->cur) {
+		submitChunk();
+	}
+	{
+		lock_guard<mutex> lock(ws->lock);
+		ws->stop = true;
+	}
+	ws->job_cond.notify_all();
+	for (std::thread &worker : ws->workers) {
+		worker.join();
+	}
+	ws->workers.clear();
+	ws->bufs.clear();
+	ws->free_bufs.clear();
+	if (ws->err != 0) {
+		errno = ws->err;
+		return false;
+	}
+
+	// Write the chunk index after the compressed chunks.
+	uint32_t version = RVTZ_VERSION_MIN;
+	for (const ChunkEntry &entry : m_index) {
+		if (entry.junk_mask != 0) {
+			version = 2;
+			break;
+		}
+	}
+	const size_t entry_size = (version >= 2
+		? RVTZ_INDEX_ENTRY_SIZE_V2
+		: RVTZ_INDEX_ENTRY_SIZE_V1);
+	vector<uint8_t> index(m_index.size() * entry_size);
+	for (size_t i = 0; i < m_index.size(); i++) {
+		RvtzIndexEntry ie;
+		ie.offset = cpu_to_le64(m_index[i].offset);
+		ie.size = cpu_to_le32(m_index[i].size);
+		ie.flags = cpu_to_le32(m_index[i].flags);
+		ie.dec_mask = cpu_to_le64(m_index[i].dec_mask);
+		ie.junk_mask = cpu_to_le64(m_index[i].junk_mask);
+		memcpy(&index[i * entry_size], &ie, entry_size);
+	}
+	const size_t index_size = index.size();
+	errno = 0;
+	if (m_file->pwrite(index.data(), index_size, m_file_base + ws->data_end) != index_size) {
+		ws->err = (errno != 0 ? errno : EIO);
+		errno = ws->err;
+		return false;
+	}
+
+	// Write the header.
+	RvtzHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, RVTZ_MAGIC.data(), RVTZ_MAGIC.size());
+	header.version = cpu_to_le32(version);
+	header.codec = cpu_to_le32(m_codec);
+	header.chunk_size = cpu_to_le32(static_cast<uint32_t>(LBA_TO_BYTES(m_chunk_lba)));
+	header.lba_len = cpu_to_le32(m_lba_len);
+	header.chunk_count = cpu_to_le32(static_cast<uint32_t>(m_index.size()));
+	header.index_offset = cpu_to_le64(ws->data_end);
+	unsigned int part_count = 0;
+	for (const auto &part : m_parts) {
+		if (!part.has_key) {
+			continue;
+		}
+		header.parts[part_count].lba_start = cpu_to_le32(part.lba_start);
+		header.parts[part_count].data_lba_start = cpu_to_le32(part.data_lba_start);
+		header.parts[part_count].data_lba_len = cpu_to_le32(part.data_lba_len);
+		part_count++;
+	}
+	header.part_count = cpu_to_le32(part_count);
+
+	errno = 0;
+	if (m_file->pwrite(&header, sizeof(header), m_file_base) != sizeof(header)) {
+		ws->err = (errno != 0 ? errno : EIO);
+		errno = ws->err;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Flush the file buffers.
+ * For new disc images, the remaining chunks are compressed,
+ * and the chunk index and header are written. The image
+ * can't be written after it's flushed.
+ */
+void RvtzReader::flush(void)
+{
+	if (m_write && isOpen()) {
+		finish();
+	}
+	super::flush();
+}
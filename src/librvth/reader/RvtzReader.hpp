@@ -0,0 +1,236 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * RvtzReader.hpp: RVTZ compressed disc image reader class.                *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_READER_RVTZREADER_HPP__
+#define __RVTHTOOL_LIBRVTH_READER_RVTZREADER_HPP__
+
+#include "Reader.hpp"
+
+// C++ includes
+#include <memory>
+#include <vector>
+
+/**
+ * RVTZ compressed disc image.
+ *
+ * The disc image is split into 2 MB chunks, and each chunk is
+ * compressed separately using zstd or LZMA. A chunk index at the
+ * end of the file allows random access. Chunks that only contain
+ * zeroes aren't stored at all.
+ *
+ * Encrypted Wii partition sectors are decrypted before compression,
+ * since encrypted data doesn't compress, and encrypted again when
+ * they're read. AES-CBC decryption is reversible for any input, so
+ * the original image is always reproduced exactly.
+ *
+ * Unencrypted sectors filled with junk data, e.g. the unused areas
+ * of GameCube discs, are stored as their junk data seeds.
+ *
+ * New images are compressed on worker threads, one chunk per thread.
+ * LBAs must be written in increasing order, as when extracting a bank.
+ */
+class RvtzReader : public Reader
+{
+	public:
+		/**
+		 * Create an RVTZ reader for a disc image.
+		 *
+		 * NOTE: If lba_start == 0 and lba_len == 0, the entire file
+		 * will be used.
+		 *
+		 * @param file		RefFile*.
+		 * @param lba_start	[in] Starting LBA,
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @param probe		[in,opt] Probe window from Reader::open(), or nullptr to read the headers from the file.
+		 */
+		RvtzReader(RefFile *file, uint32_t lba_start, uint32_t lba_len, const ProbeBuffer *probe = nullptr);
+
+		/**
+		 * Create an RVTZ reader for a new disc image.
+		 * Use Reader::create() instead of calling this directly.
+		 *
+		 * @param file		RefFile*. (Must be a new, empty file opened for writing.)
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return RvtzReader*, or NULL on error.
+		 */
+		static RvtzReader *create(RefFile *file, uint32_t lba_len);
+
+		virtual ~RvtzReader();
+
+	private:
+		/**
+		 * Initialize an RVTZ reader for a new disc image.
+		 * @param file		RefFile*.
+		 * @param lba_len	[in] Length, in LBAs.
+		 */
+		RvtzReader(RefFile *file, uint32_t lba_len);
+
+	private:
+		typedef Reader super;
+		DISABLE_COPY(RvtzReader)
+
+	public:
+		/**
+		 * Is a given disc image supported by the RVTZ reader?
+		 * @param sbuf	[in] Sector buffer. (first LBA of the disc)
+		 * @param size	[in] Size of sbuf. (should be 512 or larger)
+		 * @return True if supported; false if not.
+		 */
+		static bool isSupported(const uint8_t *sbuf, size_t size);
+
+		/**
+		 * Get the name of the compression codec used for new images.
+		 * If neither zstd nor LZMA is available, chunks are stored
+		 * uncompressed, and only empty chunks are removed.
+		 * @return Codec name, e.g. "zstd".
+		 */
+		static const char *codecName(void);
+
+	public:
+		/** I/O functions **/
+
+		/**
+		 * Read data from the disc image.
+		 * @param ptr		[out] Read buffer.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Number of LBAs read, or 0 on error.
+		 */
+		uint32_t read(void *ptr, uint32_t lba_start, uint32_t lba_len) final;
+
+		/**
+		 * Check if a range of LBAs is known to be empty without reading it.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return True if the range is entirely within empty chunks; false if not.
+		 */
+		bool isRangeEmpty(uint32_t lba_start, uint32_t lba_len) const final;
+
+		/**
+		 * Get the allocated and unallocated ranges within a range of LBAs.
+		 * Empty chunks are unallocated.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs. (Clamped to the image length.)
+		 * @param extents	[out] Extents.
+		 * @return Number of unallocated LBAs.
+		 */
+		uint32_t extents(uint32_t lba_start, uint32_t lba_len, std::vector<Extent> &extents) const final;
+
+		/**
+		 * Get the native block size of the disc image.
+		 * @return RVTZ chunk size, in LBAs.
+		 */
+		uint32_t blockSizeLba(void) const final;
+
+		/**
+		 * Write data to the disc image.
+		 *
+		 * Only new disc images can be written, and LBAs must be
+		 * written in increasing order. Skipped LBAs are zero.
+		 *
+		 * @param ptr		[in] Write buffer.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Number of LBAs written, or 0 on error.
+		 */
+		uint32_t write(const void *ptr, uint32_t lba_start, uint32_t lba_len) final;
+
+		/**
+		 * Prepare a new disc image for sparse writing.
+		 * Empty chunks aren't stored, so the file isn't resized.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int makeSparse(void) final;
+
+		/**
+		 * Flush the file buffers.
+		 * For new disc images, the remaining chunks are compressed,
+		 * and the chunk index and header are written. The image
+		 * can't be written after it's flushed.
+		 */
+		void flush(void) final;
+
+	public:
+		// Wii partition with decrypted sectors.
+		struct Partition {
+			uint32_t lba_start;		// Partition header
+			uint32_t data_lba_start;	// Start of the encrypted data
+			uint32_t data_lba_len;		// Length of the encrypted data
+			uint8_t title_key[16];		// Decrypted title key
+			bool has_key;			// True if the data range and title key are known
+		};
+
+		// Chunk index entry.
+		struct ChunkEntry {
+			uint64_t offset;	// File offset of the compressed chunk
+			uint32_t size;		// Size of the compressed chunk
+			uint32_t flags;		// Chunk flags (RVTZ_CHUNK_*)
+			uint64_t dec_mask;	// Sectors that were decrypted (one bit per 32 KB)
+			uint64_t junk_mask;	// Sectors stored as junk data seeds (one bit per 32 KB)
+		};
+
+	private:
+		/**
+		 * Read and decompress a chunk.
+		 * @param chunk		[in] Chunk index.
+		 * @param buf		[out] Chunk buffer. (must be the chunk size)
+		 * @param encrypt	[in] If true, encrypt the sectors that were decrypted.
+		 * @return True on success; false on error. (errno is set)
+		 */
+		bool decodeChunk(uint32_t chunk, uint8_t *buf, bool encrypt);
+
+		/**
+		 * Get a decoded chunk using the chunk cache.
+		 * @param chunk	[in] Chunk index.
+		 * @return Chunk data, or nullptr on error. (errno is set)
+		 */
+		std::shared_ptr<const uint8_t> loadChunk(uint32_t chunk);
+
+		/**
+		 * Submit the current chunk of a new disc image for compression.
+		 * @return True on success; false on error. (errno is set)
+		 */
+		bool submitChunk(void);
+
+		/**
+		 * Compression worker thread for new disc images.
+		 * Chunks are compressed and appended to the file in any order.
+		 */
+		void compressWorker(void);
+
+		/**
+		 * Find new Wii partitions in a chunk of a new disc image.
+		 * @param buf		[in] Chunk data.
+		 * @param chunk		[in] Chunk index.
+		 */
+		void findPartitions(const uint8_t *buf, uint32_t chunk);
+
+		/**
+		 * Finish writing a new disc image.
+		 * The worker threads are stopped, and the index and header are written.
+		 * @return True on success; false on error. (errno is set)
+		 */
+		bool finish(void);
+
+	private:
+		uint64_t m_file_base;		// File offset of the RVTZ header
+		uint32_t m_chunk_lba;		// Chunk size, in LBAs
+		uint32_t m_codec;		// Compression codec
+		std::vector<ChunkEntry> m_index;
+		std::vector<Partition> m_parts;
+
+		// Chunk cache for reading. (See RvtzReader.cpp.)
+		struct Cache;
+		std::unique_ptr<Cache> m_cache;
+
+		// Compression state for new disc images. (See RvtzReader.cpp.)
+		struct WriteState;
+		std::unique_ptr<WriteState> m_write;
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_READER_RVTZREADER_HPP__ */
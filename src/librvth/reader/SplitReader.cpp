@@ -0,0 +1,468 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * SplitReader.cpp: Split disc image reader class.                         *
+ * Used for plain disc images stored in multiple part files.               *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "SplitReader.hpp"
+#include "Trace.hpp"
+
+// For LBA_TO_BYTES()
+#include "nhcd_structs.h"
+
+// C includes. (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+// C++ includes
+#include <algorithm>
+#include <thread>
+using std::tstring;
+using std::vector;
+
+/**
+ * Initialize a split reader.
+ * @param file		RefFile*. (first part)
+ * @param part_lba_len	[in] Size of each part, in LBAs.
+ */
+SplitReader::SplitReader(RefFile *file, uint32_t part_lba_len)
+	: super(file, 0, 0)
+	, m_part_lba_len(part_lba_len)
+{
+	if (!isOpen()) {
+		// File wasn't opened.
+		return;
+	}
+
+	// The first part is owned by the base class.
+	m_parts.push_back(m_file);
+}
+
+SplitReader::~SplitReader()
+{
+	for (size_t i = 1; i < m_parts.size(); i++) {
+		m_parts[i]->unref();
+	}
+}
+
+/**
+ * Open a split disc image.
+ * Use Reader::open() instead of calling this directly.
+ *
+ * @param file		RefFile*. (first part)
+ * @param lba_start	[in] Starting LBA. (nonzero if the image has an SDK header)
+ * @return SplitReader*, or NULL on error.
+ */
+SplitReader *SplitReader::open(RefFile *file, uint32_t lba_start)
+{
+	// The first part determines the part size.
+	errno = 0;
+	const off64_t part0_size = file->size();
+	if (part0_size <= 0 || part0_size % LBA_SIZE != 0 ||
+	    part0_size > LBA_TO_BYTES(UINT32_MAX))
+	{
+		// Not a valid split image.
+		if (errno == 0) {
+			errno = EIO;
+		}
+		return nullptr;
+	}
+
+	SplitReader *const reader = new SplitReader(file, BYTES_TO_LBA(part0_size));
+	if (!reader->isOpen()) {
+		const int err = errno;
+		delete reader;
+		errno = err;
+		return nullptr;
+	}
+
+	// Open the rest of the parts.
+	// The image ends after the first part that's smaller than
+	// the first part, or before the first part that's missing.
+	uint64_t lba_total = reader->m_part_lba_len;
+	for (off64_t size = part0_size; size == part0_size; ) {
+		RefFile *const part = new RefFile(reader->partFilename(
+			static_cast<unsigned int>(reader->m_parts.size())).c_str());
+		if (!part->isOpen()) {
+			part->unref();
+			break;
+		}
+
+		size = part->size();
+		if (size <= 0 || size > part0_size || size % LBA_SIZE != 0) {
+			// Parts after the first one can't be larger than it.
+			part->unref();
+			delete reader;
+			errno = EIO;
+			return nullptr;
+		}
+		reader->m_parts.push_back(part);
+		lba_total += BYTES_TO_LBA(size);
+	}
+
+	if (lba_total > UINT32_MAX || lba_start >= lba_total) {
+		// Too large, or only contains the SDK header.
+		delete reader;
+		errno = EIO;
+		return nullptr;
+	}
+	reader->m_lba_start = lba_start;
+	reader->m_lba_len = static_cast<uint32_t>(lba_total - lba_start);
+	reader->m_type = (lba_start == 0
+		? RVTH_ImageType_GCM
+		: RVTH_ImageType_GCM_SDK);
+	return reader;
+}
+
+/**
+ * Create a split reader for a new disc image.
+ * Use Reader::create() instead of calling this directly.
+ *
+ * @param file		RefFile*. (Must be a new, empty file opened for writing.)
+ * @param lba_len	[in] Length, in LBAs.
+ * @return SplitReader*, or NULL on error.
+ */
+SplitReader *SplitReader::create(RefFile *file, uint32_t lba_len)
+{
+	SplitReader *const reader = new SplitReader(file, PART_LBA_LEN);
+	if (!reader->isOpen()) {
+		const int err = errno;
+		delete reader;
+		errno = err;
+		return nullptr;
+	}
+	reader->m_lba_len = lba_len;
+	reader->m_type = RVTH_ImageType_GCM;
+
+	// Create the rest of the parts.
+	const unsigned int part_count = std::max(1U, (lba_len + PART_LBA_LEN - 1) / PART_LBA_LEN);
+	for (unsigned int i = 1; i < part_count; i++) {
+		RefFile *const part = new RefFile(reader->partFilename(i).c_str(), true);
+		if (!part->isOpen()) {
+			// Error creating the part.
+			int err = part->lastError();
+			if (err == 0) {
+				err = EIO;
+			}
+			part->unref();
+			delete reader;
+			errno = err;
+			return nullptr;
+		}
+		reader->m_parts.push_back(part);
+	}
+	return reader;
+}
+
+/**
+ * Is a filename the first part of a split disc image?
+ * @param filename	[in] Filename.
+ * @return True if the filename ends with ".part0"; false if not.
+ */
+bool SplitReader::isSplitFilename(const TCHAR *filename)
+{
+	static const TCHAR suffix[] = _T(".part0");
+	static const size_t suffix_len = ARRAY_SIZE(suffix) - 1;
+	if (!filename) {
+		return false;
+	}
+	const size_t len = _tcslen(filename);
+	return (len > suffix_len && !_tcsicmp(&filename[len - suffix_len], suffix));
+}
+
+/**
+ * Get the filename of a part.
+ * @param index	[in] Part index.
+ * @return Filename.
+ */
+tstring SplitReader::partFilename(unsigned int index) const
+{
+	// Replace the '0' in ".part0" with the part index.
+	tstring filename(m_file->filename());
+	filename.resize(filename.size() - 1);
+
+	TCHAR buf[16];
+	_sntprintf(buf, ARRAY_SIZE(buf), _T("%u"), index);
+	filename += buf;
+	return filename;
+}
+
+/**
+ * Get the size of a part.
+ * @param index	[in] Part index.
+ * @return Size, in bytes.
+ */
+off64_t SplitReader::partSize(unsigned int index) const
+{
+	const uint64_t lba_total = static_cast<uint64_t>(m_lba_start) + m_lba_len;
+	const uint64_t lba_part_start = static_cast<uint64_t>(index) * m_part_lba_len;
+	return LBA_TO_BYTES(std::min<uint64_t>(m_part_lba_len, lba_total - lba_part_start));
+}
+
+/**
+ * Get a part file for writing.
+ * If the first part was reopened as writable, e.g. for recryption,
+ * this part is reopened as writable, too.
+ * @param index	[in] Part index.
+ * @return RefFile*, or nullptr on error.
+ */
+RefFile *SplitReader::writablePart(unsigned int index)
+{
+	RefFile *const part = m_parts[index];
+	if (index > 0 && m_file->isWritable() && !part->isWritable()) {
+		const int ret = part->makeWritable();
+		if (ret != 0) {
+			errno = -ret;
+			return nullptr;
+		}
+	}
+	return part;
+}
+
+/**
+ * Run a function for each part concurrently.
+ * Separate files can be written in parallel, so large
+ * transfers such as allocation and fsync() overlap.
+ * @param func	[in] Function. (Takes the part index; returns 0 or a negative POSIX error code.)
+ * @return 0 on success; first negative POSIX error code on error.
+ */
+int SplitReader::forEachPart(const std::function<int(unsigned int)> &func)
+{
+	const unsigned int part_count = static_cast<unsigned int>(m_parts.size());
+	if (part_count == 1) {
+		return func(0);
+	}
+
+	vector<int> rets(part_count, 0);
+	vector<std::thread> threads;
+	threads.reserve(part_count - 1);
+	for (unsigned int i = 1; i < part_count; i++) {
+		threads.emplace_back([&func, &rets, i]() {
+			rets[i] = func(i);
+		});
+	}
+	rets[0] = func(0);
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+
+	for (int ret : rets) {
+		if (ret != 0) {
+			return ret;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Read data from the disc image.
+ * @param ptr		[out] Read buffer.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Number of LBAs read, or 0 on error.
+ */
+uint32_t SplitReader::read(void *ptr, uint32_t lba_start, uint32_t lba_len)
+{
+	RVTH_TRACE_SPAN_BYTES("SplitReader::read", LBA_TO_BYTES(lba_len));
+
+	// LBA bounds checking.
+	assert(lba_start + lba_len <= m_lba_len);
+	if (lba_start > m_lba_len || lba_len > m_lba_len - lba_start) {
+		// Out of range.
+		errno = EIO;
+		return 0;
+	}
+
+	// Read from each part that contains the range.
+	uint8_t *p = static_cast<uint8_t*>(ptr);
+	uint32_t lba = m_lba_start + lba_start;
+	uint32_t lba_done = 0;
+	while (lba_done < lba_len) {
+		const unsigned int index = lba / m_part_lba_len;
+		const uint32_t part_lba = lba % m_part_lba_len;
+		const uint32_t lba_count = std::min(lba_len - lba_done, m_part_lba_len - part_lba);
+
+		const size_t size = m_parts[index]->pread(p, LBA_TO_BYTES(lba_count), LBA_TO_BYTES(part_lba));
+		const uint32_t lba_read = static_cast<uint32_t>(size / LBA_SIZE);
+		lba_done += lba_read;
+		if (lba_read != lba_count) {
+			// Short read.
+			break;
+		}
+		p += LBA_TO_BYTES(lba_count);
+		lba += lba_count;
+	}
+	return lba_done;
+}
+
+/**
+ * Write data to the disc image.
+ * @param ptr		[in] Write buffer.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Number of LBAs written, or 0 on error.
+ */
+uint32_t SplitReader::write(const void *ptr, uint32_t lba_start, uint32_t lba_len)
+{
+	RVTH_TRACE_SPAN_BYTES("SplitReader::write", LBA_TO_BYTES(lba_len));
+
+	// LBA bounds checking.
+	assert(lba_start + lba_len <= m_lba_len);
+	if (lba_start > m_lba_len || lba_len > m_lba_len - lba_start) {
+		// Out of range.
+		errno = EIO;
+		return 0;
+	}
+
+	// Write to each part that contains the range.
+	const uint8_t *p = static_cast<const uint8_t*>(ptr);
+	uint32_t lba = m_lba_start + lba_start;
+	uint32_t lba_done = 0;
+	while (lba_done < lba_len) {
+		const unsigned int index = lba / m_part_lba_len;
+		const uint32_t part_lba = lba % m_part_lba_len;
+		const uint32_t lba_count = std::min(lba_len - lba_done, m_part_lba_len - part_lba);
+
+		RefFile *const part = writablePart(index);
+		if (!part) {
+			break;
+		}
+		const size_t size = part->pwrite(p, LBA_TO_BYTES(lba_count), LBA_TO_BYTES(part_lba));
+		const uint32_t lba_written = static_cast<uint32_t>(size / LBA_SIZE);
+		lba_done += lba_written;
+		if (lba_written != lba_count) {
+			// Short write.
+			break;
+		}
+		p += LBA_TO_BYTES(lba_count);
+		lba += lba_count;
+	}
+	return lba_done;
+}
+
+/**
+ * Prepare a new disc image for sparse writing.
+ * Each part is set to its full size.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int SplitReader::makeSparse(void)
+{
+	return forEachPart([this](unsigned int index) -> int {
+		RefFile *const part = writablePart(index);
+		return (part ? part->makeSparse(partSize(index)) : -errno);
+	});
+}
+
+/**
+ * Allocate disk space for a new disc image up front.
+ * The parts are allocated concurrently.
+ * @return 0 on success; negative POSIX error code on error. (-ENOTSUP if not supported)
+ */
+int SplitReader::preallocate(void)
+{
+	return forEachPart([this](unsigned int index) -> int {
+		RefFile *const part = writablePart(index);
+		return (part ? part->preallocate(partSize(index)) : -errno);
+	});
+}
+
+/**
+ * Deallocate a range of LBAs that only contain zeroes.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return 0 on success; negative POSIX error code on error. (-ENOTSUP if not supported)
+ */
+int SplitReader::discard(uint32_t lba_start, uint32_t lba_len)
+{
+	// LBA bounds checking.
+	if (lba_start > m_lba_len || lba_len > m_lba_len - lba_start) {
+		// Out of range.
+		return -EIO;
+	}
+
+	uint32_t lba = m_lba_start + lba_start;
+	const uint32_t lba_end = lba + lba_len;
+	while (lba < lba_end) {
+		const unsigned int index = lba / m_part_lba_len;
+		const uint32_t part_lba = lba % m_part_lba_len;
+		const uint32_t lba_count = std::min(lba_end - lba, m_part_lba_len - part_lba);
+
+		const int ret = m_parts[index]->punchHole(LBA_TO_BYTES(part_lba), LBA_TO_BYTES(lba_count));
+		if (ret != 0) {
+			return ret;
+		}
+		lba += lba_count;
+	}
+	return 0;
+}
+
+/**
+ * Get the allocated and unallocated ranges within a range of LBAs.
+ * Holes in sparse part files are unallocated.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs. (Clamped to the image length.)
+ * @param extents	[out] Extents.
+ * @return Number of unallocated LBAs.
+ */
+uint32_t SplitReader::extents(uint32_t lba_start, uint32_t lba_len, std::vector<Extent> &extents) const
+{
+	extents.clear();
+	if (lba_start >= m_lba_len) {
+		return 0;
+	}
+	lba_len = std::min(lba_len, m_lba_len - lba_start);
+
+	uint32_t unallocated = 0;
+	uint32_t lba = m_lba_start + lba_start;
+	const uint32_t lba_end = lba + lba_len;
+	while (lba < lba_end) {
+		const unsigned int index = lba / m_part_lba_len;
+		const uint32_t part_lba = lba % m_part_lba_len;
+		const uint32_t lba_count = std::min(lba_end - lba, m_part_lba_len - part_lba);
+
+		unallocated += addFileExtents(m_parts[index], LBA_TO_BYTES(static_cast<off64_t>(part_lba)),
+			lba - m_lba_start, lba_count, extents);
+		lba += lba_count;
+	}
+	return unallocated;
+}
+
+/**
+ * Flush the file buffers.
+ * The parts are flushed concurrently.
+ */
+void SplitReader::flush(void)
+{
+	forEachPart([this](unsigned int index) -> int {
+		m_parts[index]->flush();
+		return 0;
+	});
+}
+
+/**
+ * Flush the file buffers and sync the files to the media.
+ * The parts are synced concurrently.
+ */
+void SplitReader::sync(void)
+{
+	forEachPart([this](unsigned int index) -> int {
+		m_parts[index]->sync();
+		return 0;
+	});
+}
+
+/**
+ * Set the durability policy for writes to the part files.
+ * @param durability	[in] Durability policy
+ * @param interval	[in] Sync interval for RVTH_DURABILITY_INTERVAL, in bytes
+ */
+void SplitReader::setDurability(RvtH_Durability durability, uint64_t interval)
+{
+	for (RefFile *part : m_parts) {
+		part->setDurability(durability, interval);
+	}
+}
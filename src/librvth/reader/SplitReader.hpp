@@ -0,0 +1,189 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * SplitReader.hpp: Split disc image reader class.                         *
+ * Used for plain disc images stored in multiple part files.               *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_READER_SPLITREADER_HPP__
+#define __RVTHTOOL_LIBRVTH_READER_SPLITREADER_HPP__
+
+#include "Reader.hpp"
+
+// C++ includes
+#include <functional>
+#include <vector>
+
+/**
+ * Plain disc image split into multiple part files, for file systems
+ * that can't store files larger than 4 GB. (FAT32)
+ *
+ * The part files are named "disc.gcm.part0", "disc.gcm.part1", etc.
+ * All parts except the last one are the same size. Opening or creating
+ * the ".part0" file uses all of the parts.
+ */
+class SplitReader : public Reader
+{
+	public:
+		/**
+		 * Open a split disc image.
+		 * Use Reader::open() instead of calling this directly.
+		 *
+		 * @param file		RefFile*. (first part)
+		 * @param lba_start	[in] Starting LBA. (nonzero if the image has an SDK header)
+		 * @return SplitReader*, or NULL on error.
+		 */
+		static SplitReader *open(RefFile *file, uint32_t lba_start);
+
+		/**
+		 * Create a split reader for a new disc image.
+		 * Use Reader::create() instead of calling this directly.
+		 *
+		 * @param file		RefFile*. (Must be a new, empty file opened for writing.)
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return SplitReader*, or NULL on error.
+		 */
+		static SplitReader *create(RefFile *file, uint32_t lba_len);
+
+		virtual ~SplitReader();
+
+	private:
+		/**
+		 * Initialize a split reader.
+		 * @param file		RefFile*. (first part)
+		 * @param part_lba_len	[in] Size of each part, in LBAs.
+		 */
+		SplitReader(RefFile *file, uint32_t part_lba_len);
+
+	private:
+		typedef Reader super;
+		DISABLE_COPY(SplitReader)
+
+	public:
+		/**
+		 * Size of each part for new split images: 4 GB - 32 KB.
+		 * This is the largest multiple of the Wii encryption
+		 * group size that fits on FAT32.
+		 */
+		static const uint32_t PART_LBA_LEN = 0x7FFFC0;
+
+		/**
+		 * Is a filename the first part of a split disc image?
+		 * @param filename	[in] Filename.
+		 * @return True if the filename ends with ".part0"; false if not.
+		 */
+		static bool isSplitFilename(const TCHAR *filename);
+
+	public:
+		/** I/O functions **/
+
+		/**
+		 * Read data from the disc image.
+		 * @param ptr		[out] Read buffer.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Number of LBAs read, or 0 on error.
+		 */
+		uint32_t read(void *ptr, uint32_t lba_start, uint32_t lba_len) final;
+
+		/**
+		 * Write data to the disc image.
+		 * @param ptr		[in] Write buffer.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Number of LBAs written, or 0 on error.
+		 */
+		uint32_t write(const void *ptr, uint32_t lba_start, uint32_t lba_len) final;
+
+		/**
+		 * Prepare a new disc image for sparse writing.
+		 * Each part is set to its full size.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int makeSparse(void) final;
+
+		/**
+		 * Allocate disk space for a new disc image up front.
+		 * The parts are allocated concurrently.
+		 * @return 0 on success; negative POSIX error code on error. (-ENOTSUP if not supported)
+		 */
+		int preallocate(void) final;
+
+		/**
+		 * Deallocate a range of LBAs that only contain zeroes.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return 0 on success; negative POSIX error code on error. (-ENOTSUP if not supported)
+		 */
+		int discard(uint32_t lba_start, uint32_t lba_len) final;
+
+		/**
+		 * Get the allocated and unallocated ranges within a range of LBAs.
+		 * Holes in sparse part files are unallocated.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs. (Clamped to the image length.)
+		 * @param extents	[out] Extents.
+		 * @return Number of unallocated LBAs.
+		 */
+		uint32_t extents(uint32_t lba_start, uint32_t lba_len, std::vector<Extent> &extents) const final;
+
+		/**
+		 * Flush the file buffers.
+		 * The parts are flushed concurrently.
+		 */
+		void flush(void) final;
+
+		/**
+		 * Flush the file buffers and sync the files to the media.
+		 * The parts are synced concurrently.
+		 */
+		void sync(void) final;
+
+		/**
+		 * Set the durability policy for writes to the part files.
+		 * @param durability	[in] Durability policy
+		 * @param interval	[in] Sync interval for RVTH_DURABILITY_INTERVAL, in bytes
+		 */
+		void setDurability(RvtH_Durability durability, uint64_t interval) final;
+
+	private:
+		/**
+		 * Get the filename of a part.
+		 * @param index	[in] Part index.
+		 * @return Filename.
+		 */
+		std::tstring partFilename(unsigned int index) const;
+
+		/**
+		 * Get the size of a part.
+		 * @param index	[in] Part index.
+		 * @return Size, in bytes.
+		 */
+		off64_t partSize(unsigned int index) const;
+
+		/**
+		 * Get a part file for writing.
+		 * If the first part was reopened as writable, e.g. for recryption,
+		 * this part is reopened as writable, too.
+		 * @param index	[in] Part index.
+		 * @return RefFile*, or nullptr on error.
+		 */
+		RefFile *writablePart(unsigned int index);
+
+		/**
+		 * Run a function for each part concurrently.
+		 * Separate files can be written in parallel, so large
+		 * transfers such as allocation and fsync() overlap.
+		 * @param func	[in] Function. (Takes the part index; returns 0 or a negative POSIX error code.)
+		 * @return 0 on success; first negative POSIX error code on error.
+		 */
+		int forEachPart(const std::function<int(unsigned int)> &func);
+
+	private:
+		std::vector<RefFile*> m_parts;	// Part files. (m_parts[0] == m_file)
+		uint32_t m_part_lba_len;	// Size of each part, in LBAs
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_READER_SPLITREADER_HPP__ */
@@ -7,7 +7,10 @@
  ***************************************************************************/
 
 #include "WbfsReader.hpp"
+#include "ProbeBuffer.hpp"
+#include "Trace.hpp"
 #include "byteswap.h"
+#include "rvth.hpp"	// for RvtH::isBlockEmpty()
 
 // For LBA_TO_BYTES()
 #include "nhcd_structs.h"
@@ -18,11 +21,14 @@
 // C includes (C++ namespace)
 #include <cassert>
 #include <cerrno>
+#include <cstddef>
 #include <cstring>
 
 // C++ includes
 #include <array>
+#include <vector>
 using std::array;
+using std::vector;
 
 #include "libwbfs.h"
 
@@ -76,13 +82,48 @@ static inline uint8_t size_to_shift(uint32_t size)
 
 #define ALIGN_LBA(x) (((x)+p->hd_sec_sz-1)&(~(size_t)(p->hd_sec_sz-1)))
 
+/**
+ * Calculate the WBFS geometry from the WBFS header.
+ * p->head, p->hd_sec_sz, p->hd_sec_sz_s, and p->n_hd_sec must be set.
+ * @param p wbfs_t struct.
+ */
+static void initWbfsGeometry(wbfs_t *p)
+{
+	const wbfs_head_t *const head = p->head;
+
+	// Constants.
+	p->wii_sec_sz = 0x8000;
+	p->wii_sec_sz_s = size_to_shift(0x8000);
+	p->n_wii_sec = (p->n_hd_sec/0x8000)*p->hd_sec_sz;
+	p->n_wii_sec_per_disc = 143432*2;	// support for dual-layer discs
+
+	// WBFS sector size.
+	p->wbfs_sec_sz_s = head->wbfs_sec_sz_s;
+	p->wbfs_sec_sz = (1 << head->wbfs_sec_sz_s);
+
+	// Disc size.
+	p->n_wbfs_sec = p->n_wii_sec >> (p->wbfs_sec_sz_s - p->wii_sec_sz_s);
+	p->n_wbfs_sec_per_disc = p->n_wii_sec_per_disc >> (p->wbfs_sec_sz_s - p->wii_sec_sz_s);
+	p->disc_info_sz = (uint16_t)ALIGN_LBA(sizeof(wbfs_disc_info_t) + p->n_wbfs_sec_per_disc*2);
+
+	// Free blocks table.
+	p->freeblks_lba = (p->wbfs_sec_sz - p->n_wbfs_sec/8) >> p->hd_sec_sz_s;
+	p->freeblks = nullptr;
+	p->max_disc = (p->freeblks_lba-1) / (p->disc_info_sz >> p->hd_sec_sz_s);
+	if (p->max_disc > (p->hd_sec_sz - sizeof(wbfs_head_t)))
+		p->max_disc = (uint16_t)(p->hd_sec_sz - sizeof(wbfs_head_t));
+
+	p->n_disc_open = 0;
+}
+
 /**
  * Read the WBFS header.
  * @param file		RefFile*.
  * @param lba_start	[in] Starting LBA,
+ * @param probe		[in,opt] Probe window, or nullptr.
  * @return wbfs_t*, or NULL on error.
  */
-static wbfs_t *readWbfsHeader(RefFile *file, uint32_t lba_start)
+static wbfs_t *readWbfsHeader(RefFile *file, uint32_t lba_start, const ProbeBuffer *probe)
 {
 	wbfs_head_t *head = nullptr;
 	wbfs_t *p = nullptr;
@@ -100,12 +141,7 @@ static wbfs_t *readWbfsHeader(RefFile *file, uint32_t lba_start)
 	}
 
 	// Read the WBFS header.
-	ret = file->seeko(LBA_TO_BYTES(lba_start), SEEK_SET);
-	if (ret != 0) {
-		// Seek error.
-		goto end;
-	}
-	size = file->read(head, 1, hd_sec_sz);
+	size = ProbeBuffer::pread(probe, file, head, hd_sec_sz, LBA_TO_BYTES(lba_start));
 	if (size != hd_sec_sz) {
 		// Read error.
 		ret = -1;
@@ -144,12 +180,7 @@ static wbfs_t *readWbfsHeader(RefFile *file, uint32_t lba_start)
 		}
 
 		// Re-read the WBFS header.
-		ret = file->seeko(LBA_TO_BYTES(lba_start), SEEK_SET);
-		if (ret != 0) {
-			// Seek error.
-			goto end;
-		}
-		size = file->read(head, 1, hd_sec_sz);
+		size = ProbeBuffer::pread(probe, file, head, hd_sec_sz, LBA_TO_BYTES(lba_start));
 		if (size != hd_sec_sz) {
 			// Read error.
 			ret = -1;
@@ -160,29 +191,9 @@ static wbfs_t *readWbfsHeader(RefFile *file, uint32_t lba_start)
 	// Save the wbfs_head_t in the wbfs_t struct.
 	p->head = head;
 
-	// Constants.
-	p->wii_sec_sz = 0x8000;
-	p->wii_sec_sz_s = size_to_shift(0x8000);
-	p->n_wii_sec = (p->n_hd_sec/0x8000)*p->hd_sec_sz;
-	p->n_wii_sec_per_disc = 143432*2;	// support for dual-layer discs
-
-	// WBFS sector size.
-	p->wbfs_sec_sz_s = head->wbfs_sec_sz_s;
-	p->wbfs_sec_sz = (1 << head->wbfs_sec_sz_s);
-
-	// Disc size.
-	p->n_wbfs_sec = p->n_wii_sec >> (p->wbfs_sec_sz_s - p->wii_sec_sz_s);
-	p->n_wbfs_sec_per_disc = p->n_wii_sec_per_disc >> (p->wbfs_sec_sz_s - p->wii_sec_sz_s);
-	p->disc_info_sz = (uint16_t)ALIGN_LBA(sizeof(wbfs_disc_info_t) + p->n_wbfs_sec_per_disc*2);
-
-	// Free blocks table.
-	p->freeblks_lba = (p->wbfs_sec_sz - p->n_wbfs_sec/8) >> p->hd_sec_sz_s;
-	p->freeblks = nullptr;
-	p->max_disc = (p->freeblks_lba-1) / (p->disc_info_sz >> p->hd_sec_sz_s);
-	if (p->max_disc > (p->hd_sec_sz - sizeof(wbfs_head_t)))
-		p->max_disc = (uint16_t)(p->hd_sec_sz - sizeof(wbfs_head_t));
-
-	p->n_disc_open = 0;
+	// Calculate the WBFS geometry.
+	initWbfsGeometry(p);
+	ret = 0;
 
 end:
 	if (ret != 0) {
@@ -196,6 +207,74 @@ end:
 	return p;
 }
 
+/**
+ * Create a WBFS header for a new disc image.
+ * The WBFS is sized to hold a single disc of the specified length.
+ * @param lba_len	[in] Disc length, in LBAs.
+ * @return wbfs_t*, or NULL on error. (errno is set)
+ */
+static wbfs_t *createWbfsHeader(uint32_t lba_len)
+{
+	// Use 512-byte HDD sectors and 2 MB WBFS blocks.
+	static const uint8_t hd_sec_sz_s = 9;
+	static const uint8_t wbfs_sec_sz_s = 21;
+	const uint32_t block_size_lba = BYTES_TO_LBA(1U << wbfs_sec_sz_s);
+
+	// WBFS block 0 contains the headers, so one more block is needed.
+	const uint32_t n_wbfs_sec = ((lba_len + block_size_lba - 1) / block_size_lba) + 1;
+	if (n_wbfs_sec - 1 > (143432*2) >> (wbfs_sec_sz_s - 15)) {
+		// Disc is too big for WBFS.
+		errno = EFBIG;
+		return nullptr;
+	}
+
+	wbfs_head_t *const head = (wbfs_head_t*)calloc(1, 1U << hd_sec_sz_s);
+	wbfs_t *const p = (wbfs_t*)malloc(sizeof(wbfs_t));
+	if (!head || !p) {
+		free(head);
+		free(p);
+		errno = ENOMEM;
+		return nullptr;
+	}
+
+	memcpy(&head->magic, WBFS_MAGIC.data(), WBFS_MAGIC.size());
+	head->n_hd_sec = cpu_to_be32(n_wbfs_sec << (wbfs_sec_sz_s - hd_sec_sz_s));
+	head->hd_sec_sz_s = hd_sec_sz_s;
+	head->wbfs_sec_sz_s = wbfs_sec_sz_s;
+	head->disc_table[0] = 1;
+
+	p->head = head;
+	p->hd_sec_sz = (1 << hd_sec_sz_s);
+	p->hd_sec_sz_s = hd_sec_sz_s;
+	p->n_hd_sec = be32_to_cpu(head->n_hd_sec);
+	initWbfsGeometry(p);
+	return p;
+}
+
+/**
+ * Copy a WBFS header.
+ * The copy doesn't have any open discs.
+ * @param src wbfs_t struct.
+ * @return wbfs_t*, or NULL on error. (errno is set)
+ */
+static wbfs_t *copyWbfsHeader(const wbfs_t *src)
+{
+	wbfs_head_t *const head = (wbfs_head_t*)malloc(src->hd_sec_sz);
+	wbfs_t *const p = (wbfs_t*)malloc(sizeof(wbfs_t));
+	if (!head || !p) {
+		free(head);
+		free(p);
+		errno = ENOMEM;
+		return nullptr;
+	}
+
+	memcpy(head, src->head, src->hd_sec_sz);
+	memcpy(p, src, sizeof(wbfs_t));
+	p->head = head;
+	p->n_disc_open = 0;
+	return p;
+}
+
 /**
  * Free an allocated WBFS header.
  * This frees all associated structs.
@@ -219,9 +298,11 @@ static void freeWbfsHeader(wbfs_t *p)
  * @param lba_start	[in] Starting LBA,
  * @param p		wbfs_t struct.
  * @param index		[in] Disc index.
+ * @param probe		[in,opt] Probe window, or nullptr.
  * @return Allocated wbfs_disc_t on success; non-zero on error.
  */
-static wbfs_disc_t *openWbfsDisc(RefFile *file, uint32_t lba_start, wbfs_t *p, uint32_t index)
+static wbfs_disc_t *openWbfsDisc(RefFile *file, uint32_t lba_start, wbfs_t *p, uint32_t index,
+	const ProbeBuffer *probe)
 {
 	// Based on libwbfs.c's wbfs_open_disc()
 	// and wbfs_get_disc_info().
@@ -232,7 +313,6 @@ static wbfs_disc_t *openWbfsDisc(RefFile *file, uint32_t lba_start, wbfs_t *p, u
 		if (head->disc_table[i]) {
 			if (count++ == index) {
 				// Found the disc table index.
-				int ret;
 				size_t size;
 
 				wbfs_disc_t *disc = (wbfs_disc_t*)malloc(sizeof(wbfs_disc_t));
@@ -251,13 +331,8 @@ static wbfs_disc_t *openWbfsDisc(RefFile *file, uint32_t lba_start, wbfs_t *p, u
 					return nullptr;
 				}
 
-				ret = file->seeko(LBA_TO_BYTES(lba_start) + p->hd_sec_sz + (i*p->disc_info_sz), SEEK_SET);
-				if (ret != 0) {
-					// Seek error.
-					free(disc);
-					return nullptr;
-				}
-				size = file->read(disc->header, 1, p->disc_info_sz);
+				size = ProbeBuffer::pread(probe, file, disc->header, p->disc_info_sz,
+					LBA_TO_BYTES(lba_start) + p->hd_sec_sz + (i*p->disc_info_sz));
 				if (size != p->disc_info_sz) {
 					// Error reading the disc information.
 					free(disc->header);
@@ -265,11 +340,6 @@ static wbfs_disc_t *openWbfsDisc(RefFile *file, uint32_t lba_start, wbfs_t *p, u
 					return nullptr;
 				}
 
-				// TODO: Byteswap wlba_table[] here?
-				// Removes unnecessary byteswaps when reading,
-				// but may not be necessary if we're not reading
-				// the entire disc.
-
 				// Disc information read successfully.
 				p->n_disc_open++;
 				return disc;
@@ -299,6 +369,25 @@ static void closeWbfsDisc(wbfs_disc_t *disc)
 	free(disc);
 }
 
+/**
+ * Get the wlba table from a WBFS disc header.
+ *
+ * wbfs_disc_info_t is packed, so taking the address of wlba_table[]
+ * directly triggers -Waddress-of-packed-member. The header is always
+ * allocated with malloc(), and the table's offset is a multiple of 2,
+ * so the table itself is properly aligned for be16_t.
+ *
+ * @param header	[in] WBFS disc header
+ * @return wlba table
+ */
+static inline be16_t *getWlbaTable(wbfs_disc_info_t *header)
+{
+	static_assert(offsetof(wbfs_disc_info_t, wlba_table) % sizeof(be16_t) == 0,
+		"wbfs_disc_info_t::wlba_table is not 16-bit aligned");
+	return reinterpret_cast<be16_t*>(
+		reinterpret_cast<uint8_t*>(header) + offsetof(wbfs_disc_info_t, wlba_table));
+}
+
 /**
  * Get the non-sparse size of an open WBFS disc, in bytes.
  * This scans the block table to find the first block
@@ -331,14 +420,18 @@ static off64_t getWbfsDiscSize(const be16_t *wlba_table, const wbfs_disc_t *disc
  * @param file		RefFile*.
  * @param lba_start	[in] Starting LBA,
  * @param lba_len	[in] Length, in LBAs.
+ * @param probe		[in,opt] Probe window from Reader::open(), or nullptr to read the headers from the file.
  */
-WbfsReader::WbfsReader(RefFile *file, uint32_t lba_start, uint32_t lba_len)
+WbfsReader::WbfsReader(RefFile *file, uint32_t lba_start, uint32_t lba_len, const ProbeBuffer *probe)
 	: super(file, lba_start, lba_len)
 	, m_real_lba_len(0)
 	, m_block_size_lba(0)
 	, m_wbfs(nullptr)
 	, m_wbfs_disc(nullptr)
 	, m_wlba_table(nullptr)
+	, m_isNew(false)
+	, m_dirty(false)
+	, m_nextPhysBlock(0)
 {
 	int err = 0;
 
@@ -373,37 +466,315 @@ WbfsReader::WbfsReader(RefFile *file, uint32_t lba_start, uint32_t lba_len)
 	m_real_lba_len = lba_len;
 
 	// Read the WBFS header.
-	m_wbfs = readWbfsHeader(file, lba_start);
+	m_wbfs = readWbfsHeader(file, lba_start, probe);
 	if (!m_wbfs) {
 		// Error reading the WBFS header.
 		goto fail;
 	}
 
 	// Open the first disc.
-	m_wbfs_disc = openWbfsDisc(file, lba_start, m_wbfs, 0);
+	m_wbfs_disc = openWbfsDisc(file, lba_start, m_wbfs, 0, probe);
 	if (!m_wbfs_disc) {
 		// Error opening the WBFS disc.
 		goto fail;
 	}
 
+	// Reader initialized.
+	initDisc();
+	return;
+
+fail:
+	// Failed to initialize the reader.
+	if (m_wbfs_disc) {
+		closeWbfsDisc(m_wbfs_disc);
+		m_wbfs_disc = nullptr;
+	}
+	if (m_wbfs) {
+		freeWbfsHeader(m_wbfs);
+		m_wbfs = nullptr;
+	}
+	m_file->unref();
+	m_file = nullptr;
+	errno = err;
+	return;
+}
+
+/**
+ * Initialize a WBFS reader for a disc whose disc information was already read.
+ * Used by openDiscs(). The WBFS header and disc information are copied.
+ * @param file		RefFile*.
+ * @param lba_start	[in] Starting LBA,
+ * @param lba_len	[in] Length, in LBAs.
+ * @param wbfs		[in] WBFS header.
+ * @param slot		[in] Disc table slot.
+ * @param discInfo	[in] Disc information. (wbfs->disc_info_sz bytes)
+ */
+WbfsReader::WbfsReader(RefFile *file, uint32_t lba_start, uint32_t lba_len,
+	const wbfs_t *wbfs, uint32_t slot, const void *discInfo)
+	: super(file, lba_start, lba_len)
+	, m_real_lba_len(lba_len)
+	, m_block_size_lba(0)
+	, m_wbfs(nullptr)
+	, m_wbfs_disc(nullptr)
+	, m_wlba_table(nullptr)
+	, m_isNew(false)
+	, m_dirty(false)
+	, m_nextPhysBlock(0)
+{
+	int err = 0;
+
+	if (!isOpen()) {
+		// File wasn't opened.
+		return;
+	}
+	m_lba_len = 0;	// will be set from the disc information
+
+	m_wbfs = copyWbfsHeader(wbfs);
+	if (!m_wbfs) {
+		err = errno;
+		goto fail;
+	}
+
+	m_wbfs_disc = (wbfs_disc_t*)malloc(sizeof(wbfs_disc_t));
+	if (!m_wbfs_disc) {
+		err = ENOMEM;
+		goto fail;
+	}
+	m_wbfs_disc->p = m_wbfs;
+	m_wbfs_disc->i = slot;
+	m_wbfs_disc->header = (wbfs_disc_info_t*)malloc(m_wbfs->disc_info_sz);
+	if (!m_wbfs_disc->header) {
+		free(m_wbfs_disc);
+		m_wbfs_disc = nullptr;
+		err = ENOMEM;
+		goto fail;
+	}
+	memcpy(m_wbfs_disc->header, discInfo, m_wbfs->disc_info_sz);
+	m_wbfs->n_disc_open++;
+
+	// Reader initialized.
+	initDisc();
+	return;
+
+fail:
+	// Failed to initialize the reader.
+	if (m_wbfs) {
+		freeWbfsHeader(m_wbfs);
+		m_wbfs = nullptr;
+	}
+	m_file->unref();
+	m_file = nullptr;
+	errno = err;
+}
+
+/**
+ * Initialize the block map and disc size from the disc information.
+ * m_wbfs and m_wbfs_disc must be set.
+ */
+void WbfsReader::initDisc(void)
+{
 	// Save important values for later.
-	m_wlba_table = m_wbfs_disc->header->wlba_table;
+	m_wlba_table = getWlbaTable(m_wbfs_disc->header);
 	// TODO: Convert to shift amount?
 	m_block_size_lba = BYTES_TO_LBA(m_wbfs->wbfs_sec_sz);
 
 	// Get the size of the WBFS disc.
 	m_lba_len = BYTES_TO_LBA(getWbfsDiscSize(m_wlba_table, m_wbfs_disc));
 
-	// Reader initialized.
+	// Decode the block table. (0 == empty block)
+	m_blockMap.assign(m_block_size_lba, m_wbfs->n_wbfs_sec_per_disc, [this](uint32_t block) -> uint32_t {
+		const unsigned int physBlockIdx = be16_to_cpu(m_wlba_table[block]);
+		return (physBlockIdx != 0 ? physBlockIdx : BlockMap::EMPTY);
+	});
+
+	m_type = RVTH_ImageType_GCM;
+}
+
+/**
+ * Open all discs in a WBFS partition.
+ *
+ * The WBFS header is read once, and the disc information of
+ * all discs is read with a single read. One reader is created
+ * for each disc, in disc table order.
+ *
+ * NOTE: If lba_start == 0 and lba_len == 0, the entire file
+ * will be used.
+ *
+ * @param file		RefFile*.
+ * @param lba_start	[in] Starting LBA,
+ * @param lba_len	[in] Length, in LBAs.
+ * @param probe		[in,opt] Probe window from Reader::open(), or nullptr to read the headers from the file.
+ * @param readers	[out] Readers, one for each disc. (The caller takes ownership.)
+ * @return Number of discs on success; negative POSIX error code on error.
+ */
+int WbfsReader::openDiscs(RefFile *file, uint32_t lba_start, uint32_t lba_len,
+	const ProbeBuffer *probe, vector<Reader*> &readers)
+{
+	readers.clear();
+	if (lba_start == 0 && lba_len == 0) {
+		// Determine the maximum LBA.
+		// NOTE: If not a multiple of the LBA size,
+		// the partial LBA will be ignored.
+		const off64_t offset = file->size();
+		if (offset <= 0) {
+			// Empty file and/or seek error.
+			const int err = (errno != 0 ? errno : EIO);
+			errno = err;
+			return -err;
+		}
+		lba_len = (uint32_t)(offset / LBA_SIZE);
+	}
+
+	// Read the WBFS header.
+	wbfs_t *const p = readWbfsHeader(file, lba_start, probe);
+	if (!p) {
+		// Error reading the WBFS header.
+		errno = EIO;
+		return -EIO;
+	}
+
+	// Find the used disc table slots.
+	vector<uint32_t> slots;
+	for (uint32_t i = 0; i < p->max_disc; i++) {
+		if (p->head->disc_table[i]) {
+			slots.push_back(i);
+		}
+	}
+	if (slots.empty()) {
+		// No discs.
+		freeWbfsHeader(p);
+		errno = ENOENT;
+		return -ENOENT;
+	}
+
+	// Read the disc information up to the last used slot.
+	// The slots are contiguous in the file, so this is a single read.
+	const size_t discInfoTblSize = static_cast<size_t>(slots.back() + 1) * p->disc_info_sz;
+	vector<uint8_t> discInfoTbl(discInfoTblSize);
+	errno = 0;
+	const size_t size = ProbeBuffer::pread(probe, file, discInfoTbl.data(), discInfoTblSize,
+		LBA_TO_BYTES(lba_start) + p->hd_sec_sz);
+	if (size != discInfoTblSize) {
+		// Error reading the disc information.
+		const int err = (errno != 0 ? errno : EIO);
+		freeWbfsHeader(p);
+		errno = err;
+		return -err;
+	}
+
+	// Create a reader for each disc.
+	int err = 0;
+	readers.reserve(slots.size());
+	for (uint32_t slot : slots) {
+		WbfsReader *const reader = new WbfsReader(file, lba_start, lba_len, p, slot,
+			&discInfoTbl[static_cast<size_t>(slot) * p->disc_info_sz]);
+		if (!reader->isOpen()) {
+			err = (errno != 0 ? errno : EIO);
+			delete reader;
+			break;
+		}
+		readers.push_back(reader);
+	}
+	freeWbfsHeader(p);
+
+	if (err != 0) {
+		// Error creating a reader.
+		for (Reader *reader : readers) {
+			delete reader;
+		}
+		readers.clear();
+		errno = err;
+		return -err;
+	}
+	return static_cast<int>(readers.size());
+}
+
+/**
+ * Create a WBFS reader for a new disc image.
+ * Use Reader::create() instead of calling this directly.
+ *
+ * @param file		RefFile*. (Must be a new, empty file opened for writing.)
+ * @param lba_len	[in] Length, in LBAs.
+ * @return WbfsReader*, or NULL on error.
+ */
+WbfsReader *WbfsReader::create(RefFile *file, uint32_t lba_len)
+{
+	WbfsReader *const reader = new WbfsReader(file, lba_len);
+	if (!reader->isOpen()) {
+		const int err = errno;
+		delete reader;
+		errno = err;
+		return nullptr;
+	}
+	return reader;
+}
+
+/**
+ * Initialize a WBFS reader for a new disc image.
+ * @param file		RefFile*.
+ * @param lba_len	[in] Length, in LBAs.
+ */
+WbfsReader::WbfsReader(RefFile *file, uint32_t lba_len)
+	: super(file, 0, lba_len)
+	, m_real_lba_len(0)
+	, m_block_size_lba(0)
+	, m_wbfs(nullptr)
+	, m_wbfs_disc(nullptr)
+	, m_wlba_table(nullptr)
+	, m_isNew(true)
+	, m_dirty(false)
+	, m_nextPhysBlock(1)	// block 0 contains the headers
+{
+	int err = 0;
+
+	if (!isOpen()) {
+		// File wasn't opened.
+		return;
+	}
+	if (lba_len == 0) {
+		err = EINVAL;
+		goto fail;
+	}
+
+	// Create the WBFS header.
+	m_wbfs = createWbfsHeader(lba_len);
+	if (!m_wbfs) {
+		err = errno;
+		goto fail;
+	}
+
+	// Create the disc information. All blocks are empty initially.
+	m_wbfs_disc = (wbfs_disc_t*)malloc(sizeof(wbfs_disc_t));
+	if (!m_wbfs_disc) {
+		err = ENOMEM;
+		goto fail;
+	}
+	m_wbfs_disc->p = m_wbfs;
+	m_wbfs_disc->i = 0;
+	m_wbfs_disc->header = (wbfs_disc_info_t*)calloc(1, m_wbfs->disc_info_sz);
+	if (!m_wbfs_disc->header) {
+		free(m_wbfs_disc);
+		m_wbfs_disc = nullptr;
+		err = ENOMEM;
+		goto fail;
+	}
+	m_wbfs->n_disc_open++;
+
+	m_wlba_table = getWlbaTable(m_wbfs_disc->header);
+	m_block_size_lba = BYTES_TO_LBA(m_wbfs->wbfs_sec_sz);
+	m_blockMap.assign(m_block_size_lba, m_wbfs->n_wbfs_sec_per_disc,
+		[](uint32_t) { return BlockMap::EMPTY; });
+	m_lba_start = 0;
+	m_lba_len = lba_len;
+	m_real_lba_len = lba_len;
+
+	// The WBFS headers will be written when the reader is flushed.
+	m_dirty = true;
 	m_type = RVTH_ImageType_GCM;
 	return;
 
 fail:
 	// Failed to initialize the reader.
-	if (m_wbfs_disc) {
-		closeWbfsDisc(m_wbfs_disc);
-		m_wbfs_disc = nullptr;
-	}
 	if (m_wbfs) {
 		freeWbfsHeader(m_wbfs);
 		m_wbfs = nullptr;
@@ -411,11 +782,15 @@ fail:
 	m_file->unref();
 	m_file = nullptr;
 	errno = err;
-	return;
 }
 
 WbfsReader::~WbfsReader()
 {
+	// Write the WBFS headers if they haven't been written yet.
+	if (m_dirty) {
+		writeHeader();
+	}
+
 	// Free the WBFS structs.
 	if (m_wbfs_disc) {
 		closeWbfsDisc(m_wbfs_disc);
@@ -436,8 +811,7 @@ WbfsReader::~WbfsReader()
  */
 uint32_t WbfsReader::read(void *ptr, uint32_t lba_start, uint32_t lba_len)
 {
-	// Return value.
-	uint32_t lbas_read = 0;
+	RVTH_TRACE_SPAN_BYTES("WbfsReader::read", LBA_TO_BYTES(lba_len));
 
 	// LBA bounds checking.
 	// TODO: Check for overflow?
@@ -451,39 +825,328 @@ uint32_t WbfsReader::read(void *ptr, uint32_t lba_start, uint32_t lba_len)
 		return 0;
 	}
 
-	// TODO: Optimize reading multiple LBAs at once.
-	// For now, we're looking up a single LBA at a time.
+	// Split the request into runs using the block map.
+	// Physically contiguous blocks are read using a single read,
+	// and runs of empty blocks are cleared using a single memset().
 	uint8_t *ptr8 = static_cast<uint8_t*>(ptr);
-	uint32_t lba_end = lba_start + lba_len;
-	for (uint32_t lba = lba_start; lba < lba_end; lba++, ptr8 += LBA_SIZE) {
-		unsigned int physBlockIdx = be16_to_cpu(m_wlba_table[lba / m_block_size_lba]);
-		if (physBlockIdx == 0) {
-			// Empty block.
-			memset(ptr8, 0, LBA_SIZE);
-		} else {
-			// Determine the offset.
-			const unsigned int blockStart = physBlockIdx * m_block_size_lba;
-			const unsigned int offset = lba % m_block_size_lba;
+	const uint32_t lba_end = lba_start + lba_len;
+	BlockMap::Mapping mapping;
+	for (uint32_t lba = lba_start; lba < lba_end; lba += mapping.lba_len) {
+		if (!m_blockMap.lookup(lba, lba_end - lba, &mapping)) {
+			// Out of range.
+			errno = EIO;
+			return 0;
+		}
 
-			int ret = m_file->seeko(LBA_TO_BYTES(blockStart + offset + m_lba_start), SEEK_SET);
-			if (ret != 0) {
-				// Seek error.
-				if (errno == 0) {
-					errno = EIO;
-				}
-				return 0;
-			}
-			size_t size = m_file->read(ptr8, LBA_SIZE, 1);
-			if (size != 1) {
+		if (!mapping.allocated) {
+			// Empty blocks.
+			memset(ptr8, 0, LBA_TO_BYTES(mapping.lba_len));
+		} else {
+			// Read the run.
+			const off64_t phys_lba = static_cast<off64_t>(mapping.phys_lba) + m_lba_start;
+			errno = 0;
+			size_t size = m_file->pread(ptr8, LBA_TO_BYTES(mapping.lba_len), LBA_TO_BYTES(phys_lba));
+			if (size != LBA_TO_BYTES(mapping.lba_len)) {
 				// Read error.
 				if (errno == 0) {
 					errno = EIO;
 				}
 				return 0;
 			}
-			lbas_read++;
+		}
+
+		ptr8 += LBA_TO_BYTES(mapping.lba_len);
+	}
+
+	return lba_len;
+}
+
+/**
+ * Read multiple ranges of LBAs from the disc image. (scatter-gather)
+ * All ranges are mapped to WBFS blocks before reading, and
+ * blocks that are adjacent in the file are read together.
+ * @param ranges	[in/out] Ranges. (lba_read is set for each range)
+ * @param count		[in] Number of ranges.
+ * @return Number of ranges that were read completely.
+ */
+unsigned int WbfsReader::readv(ReadRange *ranges, unsigned int count)
+{
+	vector<ReadExtent> extents;
+	extents.reserve(count);
+	for (unsigned int i = 0; i < count; i++) {
+		ReadRange &range = ranges[i];
+
+		// LBA bounds checking.
+		assert(range.lba_start + range.lba_len <= m_lba_len);
+		if (range.lba_start + range.lba_len > m_lba_len) {
+			// Out of range.
+			errno = EIO;
+			range.lba_read = 0;
+			continue;
+		}
+		range.lba_read = range.lba_len;
+
+		// Split the range into runs using the block map.
+		uint8_t *ptr8 = static_cast<uint8_t*>(range.ptr);
+		const uint32_t lba_end = range.lba_start + range.lba_len;
+		BlockMap::Mapping mapping;
+		for (uint32_t lba = range.lba_start; lba < lba_end; lba += mapping.lba_len) {
+			if (!m_blockMap.lookup(lba, lba_end - lba, &mapping)) {
+				// Out of range.
+				errno = EIO;
+				range.lba_read = 0;
+				break;
+			}
+
+			if (!mapping.allocated) {
+				// Empty blocks.
+				memset(ptr8, 0, LBA_TO_BYTES(mapping.lba_len));
+			} else {
+				const off64_t phys_lba = static_cast<off64_t>(mapping.phys_lba) + m_lba_start;
+				extents.push_back({LBA_TO_BYTES(phys_lba), ptr8,
+					static_cast<uint32_t>(LBA_TO_BYTES(mapping.lba_len)), i});
+			}
+
+			ptr8 += LBA_TO_BYTES(mapping.lba_len);
 		}
 	}
 
-	return lbas_read;
+	return readExtents(extents, ranges, count);
+}
+
+/**
+ * Check if a range of LBAs is known to be empty without reading it.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return True if the range is entirely within unallocated WBFS blocks; false if not.
+ */
+bool WbfsReader::isRangeEmpty(uint32_t lba_start, uint32_t lba_len) const
+{
+	if (lba_len == 0 || lba_start + lba_len > m_lba_len) {
+		return false;
+	}
+	return m_blockMap.isRangeEmpty(lba_start, lba_len);
+}
+
+/**
+ * Get the allocated and unallocated ranges within a range of LBAs.
+ * Unallocated WBFS blocks are unallocated.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs. (Clamped to the image length.)
+ * @param extents	[out] Extents.
+ * @return Number of unallocated LBAs.
+ */
+uint32_t WbfsReader::extents(uint32_t lba_start, uint32_t lba_len, std::vector<Extent> &extents) const
+{
+	return blockMapExtents(m_blockMap, lba_start, lba_len, extents);
+}
+
+/**
+ * Get the native block size of the disc image.
+ * @return WBFS block size, in LBAs.
+ */
+uint32_t WbfsReader::blockSizeLba(void) const
+{
+	return m_block_size_lba;
+}
+
+/**
+ * Get the file offset where the disc image's data starts.
+ * This is the lowest allocated WBFS block of the disc.
+ * @return File offset, in bytes.
+ */
+off64_t WbfsReader::physicalStart(void) const
+{
+	// NOTE: A block table entry of 0 means empty block.
+	unsigned int firstPhysBlock = ~0U;
+	for (uint32_t block = 0; block < m_wbfs->n_wbfs_sec_per_disc; block++) {
+		const unsigned int physBlockIdx = be16_to_cpu(m_wlba_table[block]);
+		if (physBlockIdx != 0 && physBlockIdx < firstPhysBlock) {
+			firstPhysBlock = physBlockIdx;
+		}
+	}
+	if (firstPhysBlock == ~0U) {
+		// No allocated blocks.
+		return super::physicalStart();
+	}
+	return LBA_TO_BYTES((static_cast<off64_t>(firstPhysBlock) * m_block_size_lba) + m_lba_start);
+}
+
+/**
+ * Write data to the disc image.
+ *
+ * Only new disc images can be written. A block is allocated
+ * the first time non-zero data is written to it.
+ *
+ * @param ptr		[in] Write buffer.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Number of LBAs written, or 0 on error.
+ */
+uint32_t WbfsReader::write(const void *ptr, uint32_t lba_start, uint32_t lba_len)
+{
+	RVTH_TRACE_SPAN_BYTES("WbfsReader::write", LBA_TO_BYTES(lba_len));
+
+	if (!m_isNew) {
+		// Existing WBFS images are read-only.
+		errno = EROFS;
+		return 0;
+	}
+
+	// LBA bounds checking.
+	// TODO: Check for overflow?
+	assert(lba_start + m_lba_start + lba_len <=
+	       m_lba_start + m_lba_len);
+	if (lba_start + m_lba_start + lba_len >
+	    m_lba_start + m_lba_len)
+	{
+		// Out of range.
+		errno = EIO;
+		return 0;
+	}
+
+	// m_wlba_table points into m_wbfs_disc->header, which we own.
+	be16_t *const wlba_table = const_cast<be16_t*>(m_wlba_table);
+	const uint8_t *ptr8 = static_cast<const uint8_t*>(ptr);
+	const uint32_t lba_end = lba_start + lba_len;
+	const uint32_t lastBlock = (m_lba_len - 1) / m_block_size_lba;
+	for (uint32_t lba = lba_start; lba < lba_end; ) {
+		// Determine the part of this block that is being written.
+		const uint32_t offset = lba % m_block_size_lba;
+		uint32_t seg_len = m_block_size_lba - offset;
+		if (seg_len > lba_end - lba) {
+			seg_len = lba_end - lba;
+		}
+
+		const uint32_t block = lba / m_block_size_lba;
+		unsigned int physBlockIdx = m_blockMap.physBlock(block);
+		if (physBlockIdx == BlockMap::EMPTY) {
+			// Empty blocks are only allocated for non-zero data.
+			// The last block is always allocated so the image
+			// size is preserved.
+			if (block != lastBlock &&
+			    RvtH::isBlockEmpty(ptr8, static_cast<unsigned int>(LBA_TO_BYTES(seg_len))))
+			{
+				lba += seg_len;
+				ptr8 += LBA_TO_BYTES(seg_len);
+				continue;
+			}
+			physBlockIdx = m_nextPhysBlock++;
+			wlba_table[block] = cpu_to_be16(static_cast<uint16_t>(physBlockIdx));
+			m_blockMap.set(block, physBlockIdx);
+			m_dirty = true;
+		}
+
+		const off64_t phys_lba = (static_cast<off64_t>(physBlockIdx) * m_block_size_lba) + offset + m_lba_start;
+		errno = 0;
+		size_t size = m_file->pwrite(ptr8, LBA_TO_BYTES(seg_len), LBA_TO_BYTES(phys_lba));
+		if (size != LBA_TO_BYTES(seg_len)) {
+			// Write error.
+			if (errno == 0) {
+				errno = EIO;
+			}
+			return 0;
+		}
+
+		lba += seg_len;
+		ptr8 += LBA_TO_BYTES(seg_len);
+	}
+
+	if (lba_start == 0) {
+		// Keep the disc header copy up to date.
+		memcpy(m_wbfs_disc->header->disc_header_copy, ptr,
+			sizeof(m_wbfs_disc->header->disc_header_copy));
+		m_dirty = true;
+	}
+
+	return lba_len;
+}
+
+/**
+ * Prepare a new disc image for sparse writing.
+ * Blocks are allocated on write, so the file isn't resized.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int WbfsReader::makeSparse(void)
+{
+	return m_file->makeSparse(0);
+}
+
+/**
+ * Flush the file buffers.
+ * For new disc images, the WBFS headers are written first.
+ */
+void WbfsReader::flush(void)
+{
+	if (m_dirty) {
+		writeHeader();
+	}
+	super::flush();
+}
+
+/**
+ * Write the WBFS header, disc information, and free blocks
+ * table for a new disc image.
+ * @return True on success; false on error. (errno is set)
+ */
+bool WbfsReader::writeHeader(void)
+{
+	assert(m_isNew);
+	const wbfs_t *const p = m_wbfs;
+	const off64_t wbfs_start = LBA_TO_BYTES(m_lba_start);
+
+	// Partially-written blocks may end in a hole, so make sure
+	// the file covers the entire last physical block.
+	const off64_t data_end = wbfs_start +
+		LBA_TO_BYTES(static_cast<off64_t>(m_nextPhysBlock) * m_block_size_lba);
+	if (m_file->size() < data_end) {
+		static const uint8_t zero_lba[LBA_SIZE] = {0};
+		errno = 0;
+		size_t size = m_file->pwrite(zero_lba, sizeof(zero_lba), data_end - sizeof(zero_lba));
+		if (size != sizeof(zero_lba)) {
+			// Write error.
+			if (errno == 0) {
+				errno = EIO;
+			}
+			return false;
+		}
+	}
+
+	// Free blocks table. Bit n represents block n+1; 1 == free.
+	// Blocks are allocated sequentially, so all blocks starting
+	// with m_nextPhysBlock are free.
+	vector<be32_t> freeblks(ALIGN_LBA(p->n_wbfs_sec / 8) / sizeof(be32_t));
+	for (unsigned int i = m_nextPhysBlock; i < p->n_wbfs_sec; i++) {
+		freeblks[(i - 1) / 32] |= (1U << ((i - 1) % 32));
+	}
+	for (be32_t &v : freeblks) {
+		v = cpu_to_be32(v);
+	}
+
+	// Write the WBFS header, disc information, and free blocks table.
+	const struct {
+		const void *data;
+		size_t size;
+		off64_t offset;
+	} regions[] = {
+		{p->head, p->hd_sec_sz, wbfs_start},
+		{m_wbfs_disc->header, p->disc_info_sz,
+			wbfs_start + p->hd_sec_sz + (static_cast<off64_t>(m_wbfs_disc->i) * p->disc_info_sz)},
+		{freeblks.data(), freeblks.size() * sizeof(be32_t),
+			wbfs_start + (static_cast<off64_t>(p->freeblks_lba) << p->hd_sec_sz_s)},
+	};
+	for (const auto &region : regions) {
+		errno = 0;
+		size_t size = m_file->pwrite(region.data, region.size, region.offset);
+		if (size != region.size) {
+			// Write error.
+			if (errno == 0) {
+				errno = EIO;
+			}
+			return false;
+		}
+	}
+
+	m_dirty = false;
+	return true;
 }
@@ -2,7 +2,7 @@
  * RVT-H Tool (librvth)                                                    *
  * WbfsReader.hpp: WBFS disc image reader class.                           *
  *                                                                         *
- * Copyright (c) 2018-2019 by David Korth.                                 *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
@@ -10,6 +10,7 @@
 #define __RVTHTOOL_LIBRVTH_READER_WBFSREADER_HPP__
 
 #include "Reader.hpp"
+#include "BlockMap.hpp"
 
 struct wbfs_s;
 typedef struct wbfs_s wbfs_t;
@@ -29,12 +30,70 @@ class WbfsReader : public Reader
 		 * @param file		RefFile*.
 		 * @param lba_start	[in] Starting LBA,
 		 * @param lba_len	[in] Length, in LBAs.
+		 * @param probe		[in,opt] Probe window from Reader::open(), or nullptr to read the headers from the file.
 		 * @return Reader*, or NULL on error.
 		 */
-		WbfsReader(RefFile *file, uint32_t lba_start, uint32_t lba_len);
+		WbfsReader(RefFile *file, uint32_t lba_start, uint32_t lba_len, const ProbeBuffer *probe = nullptr);
+
+		/**
+		 * Create a WBFS reader for a new disc image.
+		 * Use Reader::create() instead of calling this directly.
+		 *
+		 * @param file		RefFile*. (Must be a new, empty file opened for writing.)
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return WbfsReader*, or NULL on error.
+		 */
+		static WbfsReader *create(RefFile *file, uint32_t lba_len);
+
+		/**
+		 * Open all discs in a WBFS partition.
+		 *
+		 * The WBFS header is read once, and the disc information of
+		 * all discs is read with a single read. One reader is created
+		 * for each disc, in disc table order.
+		 *
+		 * NOTE: If lba_start == 0 and lba_len == 0, the entire file
+		 * will be used.
+		 *
+		 * @param file		RefFile*.
+		 * @param lba_start	[in] Starting LBA,
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @param probe		[in,opt] Probe window from Reader::open(), or nullptr to read the headers from the file.
+		 * @param readers	[out] Readers, one for each disc. (The caller takes ownership.)
+		 * @return Number of discs on success; negative POSIX error code on error.
+		 */
+		static int openDiscs(RefFile *file, uint32_t lba_start, uint32_t lba_len,
+			const ProbeBuffer *probe, std::vector<Reader*> &readers);
 
 		virtual ~WbfsReader();
 
+	private:
+		/**
+		 * Initialize a WBFS reader for a new disc image.
+		 * @param file		RefFile*.
+		 * @param lba_len	[in] Length, in LBAs.
+		 */
+		WbfsReader(RefFile *file, uint32_t lba_len);
+
+		/**
+		 * Initialize a WBFS reader for a disc whose disc information was already read.
+		 * Used by openDiscs(). The WBFS header and disc information are copied.
+		 * @param file		RefFile*.
+		 * @param lba_start	[in] Starting LBA,
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @param wbfs		[in] WBFS header.
+		 * @param slot		[in] Disc table slot.
+		 * @param discInfo	[in] Disc information. (wbfs->disc_info_sz bytes)
+		 */
+		WbfsReader(RefFile *file, uint32_t lba_start, uint32_t lba_len,
+			const wbfs_t *wbfs, uint32_t slot, const void *discInfo);
+
+		/**
+		 * Initialize the block map and disc size from the disc information.
+		 * m_wbfs and m_wbfs_disc must be set.
+		 */
+		void initDisc(void);
+
 	private:
 		typedef Reader super;
 		DISABLE_COPY(WbfsReader);
@@ -60,6 +119,81 @@ class WbfsReader : public Reader
 		 */
 		uint32_t read(void *ptr, uint32_t lba_start, uint32_t lba_len) final;
 
+		/**
+		 * Read multiple ranges of LBAs from the disc image. (scatter-gather)
+		 * All ranges are mapped to WBFS blocks before reading, and
+		 * blocks that are adjacent in the file are read together.
+		 * @param ranges	[in/out] Ranges. (lba_read is set for each range)
+		 * @param count		[in] Number of ranges.
+		 * @return Number of ranges that were read completely.
+		 */
+		unsigned int readv(ReadRange *ranges, unsigned int count) final;
+
+		/**
+		 * Check if a range of LBAs is known to be empty without reading it.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return True if the range is entirely within unallocated WBFS blocks; false if not.
+		 */
+		bool isRangeEmpty(uint32_t lba_start, uint32_t lba_len) const final;
+
+		/**
+		 * Get the allocated and unallocated ranges within a range of LBAs.
+		 * Unallocated WBFS blocks are unallocated.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs. (Clamped to the image length.)
+		 * @param extents	[out] Extents.
+		 * @return Number of unallocated LBAs.
+		 */
+		uint32_t extents(uint32_t lba_start, uint32_t lba_len, std::vector<Extent> &extents) const final;
+
+		/**
+		 * Get the native block size of the disc image.
+		 * @return WBFS block size, in LBAs.
+		 */
+		uint32_t blockSizeLba(void) const final;
+
+		/**
+		 * Get the file offset where the disc image's data starts.
+		 * This is the lowest allocated WBFS block of the disc.
+		 * @return File offset, in bytes.
+		 */
+		off64_t physicalStart(void) const final;
+
+		/**
+		 * Write data to the disc image.
+		 *
+		 * Only new disc images can be written. A block is allocated
+		 * the first time non-zero data is written to it.
+		 *
+		 * @param ptr		[in] Write buffer.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Number of LBAs written, or 0 on error.
+		 */
+		uint32_t write(const void *ptr, uint32_t lba_start, uint32_t lba_len) final;
+
+		/**
+		 * Prepare a new disc image for sparse writing.
+		 * Blocks are allocated on write, so the file isn't resized.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int makeSparse(void) final;
+
+		/**
+		 * Flush the file buffers.
+		 * For new disc images, the WBFS headers are written first.
+		 */
+		void flush(void) final;
+
+	private:
+		/**
+		 * Write the WBFS header, disc information, and free blocks
+		 * table for a new disc image.
+		 * @return True on success; false on error. (errno is set)
+		 */
+		bool writeHeader(void);
+
 	private:
 		// NOTE: reader.lba_len is the virtual image size.
 		// real_lba_len is the actual image size.
@@ -73,6 +207,12 @@ class WbfsReader : public Reader
 		wbfs_disc_t *m_wbfs_disc;	// Current disc.
 
 		const be16_t *m_wlba_table;	// Pointer to m_wbfs_disc->disc->header->wlba_table.
+		BlockMap m_blockMap;		// Decoded wlba_table.
+
+		// New disc image state.
+		bool m_isNew;			// True if this is a new disc image.
+		bool m_dirty;			// True if the WBFS headers need to be written.
+		uint16_t m_nextPhysBlock;	// Next physical block to allocate.
 };
 
 #endif /* __RVTHTOOL_LIBRVTH_READER_WBFSREADER_HPP__ */
@@ -0,0 +1,1326 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * WiaReader.cpp: WIA/RVZ disc image reader class.                         *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "config.librvth.h"
+
+#include "WiaReader.hpp"
+#include "ProbeBuffer.hpp"
+#include "byteswap.h"
+#include "StatsCounters.hpp"
+#include "Trace.hpp"
+#include "junk_data.h"
+
+// For LBA_TO_BYTES()
+#include "nhcd_structs.h"
+
+// libwiicrypto
+#include "libwiicrypto/aesw.h"
+#include "libwiicrypto/wii_hash_tree.h"
+#include "libwiicrypto/wii_sector.h"
+
+// Compression libraries
+#ifdef HAVE_ZSTD
+#  include <zstd.h>
+#endif /* HAVE_ZSTD */
+#ifdef HAVE_LZMA
+#  include <lzma.h>
+#endif /* HAVE_LZMA */
+#ifdef HAVE_BZIP2
+#  include <bzlib.h>
+#endif /* HAVE_BZIP2 */
+
+// C includes (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+// C++ includes
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+using std::array;
+using std::deque;
+using std::lock_guard;
+using std::mutex;
+using std::shared_ptr;
+using std::unique_lock;
+using std::vector;
+
+// Magic numbers. ("WIA\x01", "RVZ\x01")
+#define WIA_MAGIC 0x57494101
+#define RVZ_MAGIC 0x525A5601
+
+// Supported format versions.
+// Images written by newer versions are accepted as long as
+// they're marked as compatible with these versions.
+#define WIA_VERSION			0x01000000
+#define WIA_VERSION_READ_COMPATIBLE	0x00080000
+#define RVZ_VERSION			0x01000000
+#define RVZ_VERSION_READ_COMPATIBLE	0x00030000
+
+// Compression codecs.
+#define WIA_COMPRESSION_NONE	0
+#define WIA_COMPRESSION_PURGE	1
+#define WIA_COMPRESSION_BZIP2	2
+#define WIA_COMPRESSION_LZMA	3
+#define WIA_COMPRESSION_LZMA2	4
+#define WIA_COMPRESSION_ZSTD	5
+
+// Disc types.
+#define WIA_DISC_TYPE_GCN	1
+#define WIA_DISC_TYPE_WII	2
+
+// Maximum size of a hash exception list. Each list covers up to
+// 64 sectors, and each sector has 0x400 bytes of hashes.
+#define WIA_EXCEPTION_SIZE	(2 + RVL_SHA1_DIGEST_SIZE)
+#define WIA_EXCEPTION_LIST_MAX	(2 + (WII_HASH_TREE_SECTORS_PER_GROUP * \
+	(sizeof(Wii_Disc_Hashes_t) / RVL_SHA1_DIGEST_SIZE) * WIA_EXCEPTION_SIZE))
+
+// RVZ packed data: junk data flag in the segment size.
+#define RVZ_PACKED_JUNK		0x80000000U
+
+// Unit keys for Wii partition groups have this bit set.
+// Unit keys for raw data are the group index.
+#define UNIT_KEY_WII		(1ULL << 63)
+
+/**
+ * WIA header. (Header 1)
+ * All fields are big-endian.
+ */
+#pragma pack(1)
+typedef struct PACKED _WIA_Header1 {
+	uint32_t magic;			// [0x000] WIA_MAGIC or RVZ_MAGIC
+	uint32_t version;		// [0x004] Format version
+	uint32_t version_compatible;	// [0x008] Oldest version that can read this file
+	uint32_t header2_size;		// [0x00C] Size of WIA_Header2
+	uint8_t header2_hash[20];	// [0x010] SHA-1 of WIA_Header2
+	uint64_t iso_file_size;		// [0x024] Size of the original disc image
+	uint64_t wia_file_size;		// [0x02C] Size of this file
+	uint8_t header1_hash[20];	// [0x034] SHA-1 of the preceding fields
+} WIA_Header1;
+ASSERT_STRUCT(WIA_Header1, 0x48);
+#pragma pack()
+
+/**
+ * WIA disc information. (Header 2)
+ * Located immediately after WIA_Header1.
+ * All fields are big-endian.
+ */
+#pragma pack(1)
+typedef struct PACKED _WIA_Header2 {
+	uint32_t disc_type;		// [0x000] WIA_DISC_TYPE_*
+	uint32_t compression;		// [0x004] WIA_COMPRESSION_*
+	int32_t compression_level;	// [0x008]
+	uint32_t chunk_size;		// [0x00C] Group size, in bytes
+	uint8_t disc_header[0x80];	// [0x010] First 0x80 bytes of the disc
+	uint32_t part_count;		// [0x090] Number of partition entries
+	uint32_t part_entry_size;	// [0x094] Size of each partition entry
+	uint64_t part_offset;		// [0x098] Partition entries (not compressed)
+	uint8_t part_hash[20];		// [0x0A0]
+	uint32_t raw_data_count;	// [0x0B4] Number of raw data entries
+	uint64_t raw_data_offset;	// [0x0B8] Raw data entries (compressed)
+	uint32_t raw_data_size;		// [0x0C0] Stored size of the raw data entries
+	uint32_t group_count;		// [0x0C4] Number of group entries
+	uint64_t group_offset;		// [0x0C8] Group entries (compressed)
+	uint32_t group_size;		// [0x0D0] Stored size of the group entries
+	uint8_t compr_data_len;		// [0x0D4] Length of compr_data
+	uint8_t compr_data[7];		// [0x0D5] Compressor properties
+} WIA_Header2;
+ASSERT_STRUCT(WIA_Header2, 0xDC);
+#pragma pack()
+
+/**
+ * WIA partition data entry.
+ * All fields are big-endian.
+ */
+typedef struct _WIA_PartitionData {
+	uint32_t first_sector;		// [0x000] First 32 KB sector
+	uint32_t sector_count;		// [0x004] Number of sectors
+	uint32_t group_index;		// [0x008] First group
+	uint32_t group_count;		// [0x00C] Number of groups
+} WIA_PartitionData;
+ASSERT_STRUCT(WIA_PartitionData, 16);
+
+/**
+ * WIA partition entry.
+ * All fields are big-endian.
+ */
+typedef struct _WIA_Partition {
+	uint8_t title_key[16];		// [0x000] Decrypted title key
+	WIA_PartitionData data[2];	// [0x010]
+} WIA_Partition;
+ASSERT_STRUCT(WIA_Partition, 0x30);
+
+/**
+ * WIA raw data entry.
+ * All fields are big-endian.
+ */
+#pragma pack(1)
+typedef struct PACKED _WIA_RawData {
+	uint64_t data_offset;		// [0x000] Disc offset
+	uint64_t data_size;		// [0x008] Size, in bytes
+	uint32_t group_index;		// [0x010] First group
+	uint32_t group_count;		// [0x014] Number of groups
+} WIA_RawData;
+ASSERT_STRUCT(WIA_RawData, 0x18);
+#pragma pack()
+
+/**
+ * WIA group entry.
+ * All fields are big-endian.
+ */
+typedef struct _WIA_Group {
+	uint32_t data_offset;		// [0x000] File offset, divided by 4
+	uint32_t data_size;		// [0x004] Stored size (0 == all zeroes)
+} WIA_Group;
+ASSERT_STRUCT(WIA_Group, 8);
+
+/**
+ * RVZ group entry.
+ * All fields are big-endian.
+ */
+typedef struct _RVZ_Group {
+	uint32_t data_offset;		// [0x000] File offset, divided by 4
+	uint32_t data_size;		// [0x004] Stored size; bit 31 set if compressed
+	uint32_t packed_size;		// [0x008] Size of the packed data (0 if not packed)
+} RVZ_Group;
+ASSERT_STRUCT(RVZ_Group, 12);
+
+/** Compression codecs **/
+
+/**
+ * Is a compression codec supported by this build?
+ * @param codec Codec (WIA_COMPRESSION_*)
+ * @return True if supported; false if not.
+ */
+static bool isCodecSupported(uint32_t codec)
+{
+	switch (codec) {
+		case WIA_COMPRESSION_NONE:
+		case WIA_COMPRESSION_PURGE:
+			return true;
+#ifdef HAVE_BZIP2
+		case WIA_COMPRESSION_BZIP2:
+			return true;
+#endif /* HAVE_BZIP2 */
+#ifdef HAVE_LZMA
+		case WIA_COMPRESSION_LZMA:
+		case WIA_COMPRESSION_LZMA2:
+			return true;
+#endif /* HAVE_LZMA */
+#ifdef HAVE_ZSTD
+		case WIA_COMPRESSION_ZSTD:
+			return true;
+#endif /* HAVE_ZSTD */
+		default:
+			return false;
+	}
+}
+
+/**
+ * Decompress data.
+ * @param codec		[in] Codec (WIA_COMPRESSION_*, except NONE and PURGE)
+ * @param props		[in] Compressor properties
+ * @param props_len	[in] Length of props
+ * @param in		[in] Compressed data
+ * @param in_size	[in] Size of the compressed data
+ * @param out		[out] Output buffer
+ * @param out_size	[in] Size of the output buffer
+ * @param out_len	[out] Decompressed size
+ * @return True on success; false on error.
+ */
+static bool decompress(uint32_t codec, const uint8_t *props, unsigned int props_len,
+	const uint8_t *in, size_t in_size, uint8_t *out, size_t out_size, size_t *out_len)
+{
+	UNUSED(props);
+	UNUSED(props_len);
+
+	switch (codec) {
+		default:
+			break;
+#ifdef HAVE_BZIP2
+		case WIA_COMPRESSION_BZIP2: {
+			unsigned int dest_len = static_cast<unsigned int>(out_size);
+			if (BZ2_bzBuffToBuffDecompress(reinterpret_cast<char*>(out), &dest_len,
+			    const_cast<char*>(reinterpret_cast<const char*>(in)),
+			    static_cast<unsigned int>(in_size), 0, 0) != BZ_OK)
+			{
+				return false;
+			}
+			*out_len = dest_len;
+			return true;
+		}
+#endif /* HAVE_BZIP2 */
+#ifdef HAVE_LZMA
+		case WIA_COMPRESSION_LZMA:
+		case WIA_COMPRESSION_LZMA2: {
+			// Raw LZMA stream. The filter properties are in the header.
+			lzma_filter filters[2];
+			filters[0].id = (codec == WIA_COMPRESSION_LZMA ? LZMA_FILTER_LZMA1 : LZMA_FILTER_LZMA2);
+			filters[0].options = nullptr;
+			filters[1].id = LZMA_VLI_UNKNOWN;
+			filters[1].options = nullptr;
+			if (lzma_properties_decode(&filters[0], nullptr, props, props_len) != LZMA_OK) {
+				return false;
+			}
+
+			lzma_stream strm = LZMA_STREAM_INIT;
+			lzma_ret ret = lzma_raw_decoder(&strm, filters);
+			free(filters[0].options);
+			if (ret != LZMA_OK) {
+				return false;
+			}
+			strm.next_in = in;
+			strm.avail_in = in_size;
+			strm.next_out = out;
+			strm.avail_out = out_size;
+			do {
+				ret = lzma_code(&strm, LZMA_FINISH);
+			} while (ret == LZMA_OK && strm.avail_in > 0 && strm.avail_out > 0);
+			*out_len = out_size - strm.avail_out;
+			const bool ok = (ret == LZMA_STREAM_END ||
+				((ret == LZMA_OK || ret == LZMA_BUF_ERROR) && strm.avail_in == 0));
+			lzma_end(&strm);
+			return ok;
+		}
+#endif /* HAVE_LZMA */
+#ifdef HAVE_ZSTD
+		case WIA_COMPRESSION_ZSTD: {
+			const size_t ret = ZSTD_decompress(out, out_size, in, in_size);
+			if (ZSTD_isError(ret)) {
+				return false;
+			}
+			*out_len = ret;
+			return true;
+		}
+#endif /* HAVE_ZSTD */
+	}
+
+	return false;
+}
+
+/**
+ * Decode "purged" data.
+ * The data is a list of segments that aren't all zero,
+ * followed by a SHA-1 hash.
+ * @param in		[in] Purged data
+ * @param in_size	[in] Size of the purged data
+ * @param out		[out] Output buffer (must be zeroed)
+ * @param out_size	[in] Size of the output buffer
+ * @return True on success; false on error.
+ */
+static bool purgeDecode(const uint8_t *in, size_t in_size, uint8_t *out, size_t out_size)
+{
+	if (in_size < RVL_SHA1_DIGEST_SIZE) {
+		return false;
+	}
+
+	const size_t end = in_size - RVL_SHA1_DIGEST_SIZE;
+	size_t pos = 0;
+	while (pos < end) {
+		if (pos + 8 > end) {
+			return false;
+		}
+		uint32_t seg[2];
+		memcpy(seg, &in[pos], sizeof(seg));
+		const uint32_t seg_offset = be32_to_cpu(seg[0]);
+		const uint32_t seg_size = be32_to_cpu(seg[1]);
+		pos += 8;
+		if (seg_size > end - pos || seg_offset > out_size || seg_size > out_size - seg_offset) {
+			return false;
+		}
+		memcpy(&out[seg_offset], &in[pos], seg_size);
+		pos += seg_size;
+	}
+	return true;
+}
+
+/**
+ * Unpack RVZ packed data.
+ * The data is a list of segments. Each segment is either
+ * stored as-is or generated by the junk data generator.
+ * @param in		[in] Packed data
+ * @param in_size	[in] Size of the packed data
+ * @param out		[out] Output buffer
+ * @param out_size	[in] Size of the output buffer
+ * @param data_offset	[in] Data offset of the output buffer
+ * @return True on success; false on error.
+ */
+static bool rvzUnpack(const uint8_t *in, size_t in_size, uint8_t *out, size_t out_size, uint64_t data_offset)
+{
+	RvtH_JunkGen junk;
+	size_t pos = 0, out_pos = 0;
+	while (out_pos < out_size) {
+		if (pos + 4 > in_size) {
+			return false;
+		}
+		uint32_t seg_size;
+		memcpy(&seg_size, &in[pos], sizeof(seg_size));
+		seg_size = be32_to_cpu(seg_size);
+		pos += 4;
+		const bool is_junk = !!(seg_size & RVZ_PACKED_JUNK);
+		seg_size &= ~RVZ_PACKED_JUNK;
+		if (seg_size > out_size - out_pos) {
+			return false;
+		}
+
+		if (is_junk) {
+			// Junk data restarts at every 32 KB block.
+			if (pos + RVTH_JUNK_SEED_SIZE > in_size) {
+				return false;
+			}
+			rvth_junk_init(&junk, &in[pos]);
+			rvth_junk_skip(&junk, (data_offset + out_pos) % RVTH_JUNK_BLOCK_SIZE);
+			rvth_junk_generate(&junk, &out[out_pos], seg_size);
+			pos += RVTH_JUNK_SEED_SIZE;
+		} else {
+			if (seg_size > in_size - pos) {
+				return false;
+			}
+			memcpy(&out[out_pos], &in[pos], seg_size);
+			pos += seg_size;
+		}
+		out_pos += seg_size;
+	}
+	return true;
+}
+
+/**
+ * Encrypt a Wii sector in place.
+ * @param aes		[in] AES context (title key must be set)
+ * @param sector	[in,out] Sector
+ */
+static void encryptSector(AesCtx *aes, Wii_Disc_Sector_t *sector)
+{
+	static const uint8_t iv_zero[16] = {0};
+	uint8_t *const hashes = reinterpret_cast<uint8_t*>(&sector->hashes);
+
+	aesw_set_iv(aes, iv_zero, sizeof(iv_zero));
+	aesw_encrypt(aes, hashes, sizeof(sector->hashes));
+	aesw_set_iv(aes, &hashes[0x3D0], 16);
+	aesw_encrypt(aes, sector->data, sizeof(sector->data));
+}
+
+/** Caches **/
+
+/**
+ * LRU cache of values that are being built or were built.
+ * Each entry is a future, so a thread that needs a value that's
+ * still being built waits for it instead of building it again.
+ */
+template<typename T>
+class FutureCache
+{
+	public:
+		typedef shared_ptr<const T> value_type;
+		typedef std::shared_future<value_type> future_type;
+		typedef std::packaged_task<value_type()> task_type;
+
+		explicit FutureCache(size_t capacity)
+			: m_entries(capacity)
+			, m_counter(0)
+		{ }
+
+		/**
+		 * Look up a value. If it isn't cached, a task to build it
+		 * is added to the cache. The caller must run the task.
+		 * @param key	[in] Key.
+		 * @param make	[in] Function that builds the value.
+		 * @param f	[out] Future for the value.
+		 * @return Task to run, or nullptr if the value was already cached.
+		 */
+		template<typename F>
+		shared_ptr<task_type> lookup(uint64_t key, F make, future_type &f)
+		{
+			lock_guard<mutex> lock(m_lock);
+			Entry *lru = &m_entries[0];
+			for (Entry &e : m_entries) {
+				if (e.key == key && e.f.valid()) {
+					e.last_used = ++m_counter;
+					f = e.f;
+					return nullptr;
+				}
+				if (e.last_used < lru->last_used) {
+					lru = &e;
+				}
+			}
+
+			shared_ptr<task_type> task = std::make_shared<task_type>(make);
+			f = task->get_future().share();
+			lru->key = key;
+			lru->f = f;
+			lru->last_used = ++m_counter;
+			return task;
+		}
+
+		/**
+		 * Get a value, building it on this thread if it isn't cached.
+		 * @param key	[in] Key.
+		 * @param make	[in] Function that builds the value.
+		 * @return Value.
+		 */
+		template<typename F>
+		value_type get(uint64_t key, F make)
+		{
+			future_type f;
+			shared_ptr<task_type> task = lookup(key, make, f);
+			if (task) {
+				(*task)();
+			}
+			return f.get();
+		}
+
+	private:
+		struct Entry {
+			uint64_t key = ~0ULL;
+			future_type f;
+			uint32_t last_used = 0;
+		};
+
+		mutex m_lock;
+		vector<Entry> m_entries;
+		uint32_t m_counter;
+};
+
+// Caches and prefetch threads.
+struct WiaReader::Threads {
+	explicit Threads(unsigned int count)
+		: count(count)
+		, units(count * 2 + 2)
+		, chunks(count + 2)
+	{ }
+
+	unsigned int count;		// Number of worker threads
+	FutureCache<Unit> units;	// Disc data
+	FutureCache<Chunk> chunks;	// Decompressed partition groups
+
+	vector<std::thread> workers;
+	StatsCounters *stats = nullptr;
+
+	mutex lock;
+	std::condition_variable cond;
+	deque<shared_ptr<FutureCache<Unit>::task_type> > jobs;
+	bool stop = false;
+};
+
+/** WiaReader **/
+
+/**
+ * Is a given disc image supported by the WIA/RVZ reader?
+ * @param sbuf	[in] Sector buffer. (first LBA of the disc)
+ * @param size	[in] Size of sbuf. (should be 512 or larger)
+ * @return True if supported; false if not.
+ */
+bool WiaReader::isSupported(const uint8_t *sbuf, size_t size)
+{
+	assert(sbuf != nullptr);
+	assert(size >= LBA_SIZE);
+	if (!sbuf || size < LBA_SIZE) {
+		return false;
+	}
+
+	const WIA_Header1 *const header = reinterpret_cast<const WIA_Header1*>(sbuf);
+	return (header->magic == cpu_to_be32(WIA_MAGIC) ||
+		header->magic == cpu_to_be32(RVZ_MAGIC));
+}
+
+/**
+ * Create a WIA/RVZ reader for a disc image.
+ *
+ * NOTE: If lba_start == 0 and lba_len == 0, the entire file
+ * will be used.
+ *
+ * @param file		RefFile*.
+ * @param lba_start	[in] Starting LBA,
+ * @param lba_len	[in] Length, in LBAs.
+ * @param probe		[in,opt] Probe window from Reader::open(), or nullptr to read the headers from the file.
+ */
+WiaReader::WiaReader(RefFile *file, uint32_t lba_start, uint32_t lba_len, const ProbeBuffer *probe)
+	: super(file, lba_start, lba_len)
+	, m_file_base(LBA_TO_BYTES(static_cast<uint64_t>(lba_start)))
+	, m_iso_size(0)
+	, m_isRvz(false)
+	, m_codec(WIA_COMPRESSION_NONE)
+	, m_chunk_size(0)
+	, m_codec_props_len(0)
+{
+	int err = 0;
+	size_t size;
+	uint32_t version, version_compatible, part_entry_size;
+	vector<uint8_t> part_buf;
+
+	memset(m_disc_header, 0, sizeof(m_disc_header));
+	memset(m_codec_props, 0, sizeof(m_codec_props));
+	if (!isOpen()) {
+		// File wasn't opened.
+		return;
+	}
+
+	// Read the headers.
+	WIA_Header1 header1;
+	WIA_Header2 header2;
+	errno = 0;
+	size = ProbeBuffer::pread(probe, m_file, &header1, sizeof(header1), m_file_base);
+	if (size != sizeof(header1)) {
+		// Short read.
+		err = (errno != 0 ? errno : EIO);
+		goto fail;
+	}
+	if (!isSupported(reinterpret_cast<const uint8_t*>(&header1), LBA_SIZE) ||
+	    be32_to_cpu(header1.header2_size) < sizeof(header2))
+	{
+		// Not a valid WIA/RVZ header.
+		err = EIO;
+		goto fail;
+	}
+	m_isRvz = (header1.magic == cpu_to_be32(RVZ_MAGIC));
+	version = be32_to_cpu(header1.version);
+	version_compatible = be32_to_cpu(header1.version_compatible);
+	if (m_isRvz) {
+		if (version_compatible > RVZ_VERSION || version < RVZ_VERSION_READ_COMPATIBLE) {
+			err = ENOTSUP;
+			goto fail;
+		}
+	} else {
+		if (version_compatible > WIA_VERSION || version < WIA_VERSION_READ_COMPATIBLE) {
+			err = ENOTSUP;
+			goto fail;
+		}
+	}
+
+	errno = 0;
+	size = ProbeBuffer::pread(probe, m_file, &header2, sizeof(header2), m_file_base + sizeof(header1));
+	if (size != sizeof(header2)) {
+		// Short read.
+		err = (errno != 0 ? errno : EIO);
+		goto fail;
+	}
+
+	// Validate the disc information.
+	m_iso_size = be64_to_cpu(header1.iso_file_size);
+	m_codec = be32_to_cpu(header2.compression);
+	m_chunk_size = be32_to_cpu(header2.chunk_size);
+	if (m_iso_size == 0 || BYTES_TO_LBA(m_iso_size + LBA_SIZE - 1) > 0xFFFFFFFFULL ||
+	    m_chunk_size < SECTOR_SIZE_ENC || m_chunk_size % SECTOR_SIZE_ENC != 0 ||
+	    (m_chunk_size < GROUP_SIZE_ENC ? (GROUP_SIZE_ENC % m_chunk_size != 0)
+	                                   : (m_chunk_size % GROUP_SIZE_ENC != 0)) ||
+	    header2.compr_data_len > sizeof(header2.compr_data))
+	{
+		err = EIO;
+		goto fail;
+	} else if (!isCodecSupported(m_codec)) {
+		// Compression codec isn't available in this build.
+		err = ENOTSUP;
+		goto fail;
+	}
+	m_lba_len = static_cast<uint32_t>(BYTES_TO_LBA(m_iso_size + LBA_SIZE - 1));
+	memcpy(m_disc_header, header2.disc_header, sizeof(m_disc_header));
+	memcpy(m_codec_props, header2.compr_data, header2.compr_data_len);
+	m_codec_props_len = header2.compr_data_len;
+
+	// Partition entries. These aren't compressed.
+	part_entry_size = be32_to_cpu(header2.part_entry_size);
+	if (header2.part_count != 0) {
+		const uint32_t part_count = be32_to_cpu(header2.part_count);
+		if (be32_to_cpu(header2.disc_type) != WIA_DISC_TYPE_WII ||
+		    part_entry_size < sizeof(WIA_Partition) || part_count > 1024)
+		{
+			err = EIO;
+			goto fail;
+		}
+		part_buf.resize(static_cast<size_t>(part_count) * part_entry_size);
+		errno = 0;
+		size = ProbeBuffer::pread(probe, m_file, part_buf.data(), part_buf.size(),
+			m_file_base + be64_to_cpu(header2.part_offset));
+		if (size != part_buf.size()) {
+			err = (errno != 0 ? errno : EIO);
+			goto fail;
+		}
+
+		for (uint32_t i = 0; i < part_count; i++) {
+			WIA_Partition wpart;
+			memcpy(&wpart, &part_buf[i * part_entry_size], sizeof(wpart));
+
+			Partition part;
+			memcpy(part.title_key, wpart.title_key, sizeof(part.title_key));
+			part.first_sector = ~0U;
+			part.end_sector = 0;
+			for (unsigned int d = 0; d < 2; d++) {
+				auto &pd = part.data[d];
+				pd.first_sector = be32_to_cpu(wpart.data[d].first_sector);
+				pd.sector_count = be32_to_cpu(wpart.data[d].sector_count);
+				pd.group_index = be32_to_cpu(wpart.data[d].group_index);
+				pd.group_count = be32_to_cpu(wpart.data[d].group_count);
+				if (pd.sector_count == 0) {
+					continue;
+				}
+				const uint64_t end = static_cast<uint64_t>(pd.first_sector) + pd.sector_count;
+				if (end * SECTOR_SIZE_ENC > m_iso_size + SECTOR_SIZE_ENC ||
+				    static_cast<uint64_t>(pd.group_index) + pd.group_count > be32_to_cpu(header2.group_count))
+				{
+					err = EIO;
+					goto fail;
+				}
+				part.first_sector = std::min(part.first_sector, pd.first_sector);
+				part.end_sector = std::max(part.end_sector, static_cast<uint32_t>(end));
+			}
+			if (part.end_sector != 0) {
+				m_parts.push_back(part);
+			}
+		}
+	}
+
+	// Raw data entries and group entries are compressed.
+	{
+		auto readTable = [this](uint64_t offset, uint32_t stored_size, void *out, size_t out_size) -> bool {
+			vector<uint8_t> in(stored_size);
+			errno = 0;
+			if (m_file->pread(in.data(), in.size(), m_file_base + offset) != in.size()) {
+				if (errno == 0) {
+					errno = EIO;
+				}
+				return false;
+			}
+
+			uint8_t *const out8 = static_cast<uint8_t*>(out);
+			size_t out_len = 0;
+			errno = EIO;
+			switch (m_codec) {
+				case WIA_COMPRESSION_NONE:
+					if (in.size() < out_size) {
+						return false;
+					}
+					memcpy(out8, in.data(), out_size);
+					return true;
+				case WIA_COMPRESSION_PURGE:
+					memset(out8, 0, out_size);
+					return purgeDecode(in.data(), in.size(), out8, out_size);
+				default:
+					return (decompress(m_codec, m_codec_props, m_codec_props_len,
+						in.data(), in.size(), out8, out_size, &out_len) &&
+						out_len == out_size);
+			}
+		};
+
+		const uint32_t raw_count = be32_to_cpu(header2.raw_data_count);
+		const uint32_t group_count = be32_to_cpu(header2.group_count);
+		if (raw_count > 0x10000 || group_count > 0x1000000) {
+			err = EIO;
+			goto fail;
+		}
+
+		vector<WIA_RawData> raw(raw_count);
+		if (!readTable(be64_to_cpu(header2.raw_data_offset), be32_to_cpu(header2.raw_data_size),
+		               raw.data(), raw.size() * sizeof(WIA_RawData)))
+		{
+			err = errno;
+			goto fail;
+		}
+		for (const WIA_RawData &wraw : raw) {
+			RawData rd;
+			rd.start = be64_to_cpu(wraw.data_offset);
+			rd.end = rd.start + be64_to_cpu(wraw.data_size);
+			rd.group_start = rd.start - (rd.start % SECTOR_SIZE_ENC);
+			rd.group_index = be32_to_cpu(wraw.group_index);
+			rd.group_count = be32_to_cpu(wraw.group_count);
+			if (rd.end < rd.start || rd.end > m_iso_size ||
+			    static_cast<uint64_t>(rd.group_index) + rd.group_count > group_count)
+			{
+				err = EIO;
+				goto fail;
+			}
+			if (rd.end > rd.start) {
+				m_raw.push_back(rd);
+			}
+		}
+
+		m_groups.resize(group_count);
+		if (m_isRvz) {
+			vector<RVZ_Group> groups(group_count);
+			if (!readTable(be64_to_cpu(header2.group_offset), be32_to_cpu(header2.group_size),
+			               groups.data(), groups.size() * sizeof(RVZ_Group)))
+			{
+				err = errno;
+				goto fail;
+			}
+			for (size_t i = 0; i < groups.size(); i++) {
+				const uint32_t data_size = be32_to_cpu(groups[i].data_size);
+				m_groups[i].offset = static_cast<uint64_t>(be32_to_cpu(groups[i].data_offset)) << 2;
+				m_groups[i].size = data_size & 0x7FFFFFFF;
+				m_groups[i].packed_size = be32_to_cpu(groups[i].packed_size);
+				m_groups[i].compressed = !!(data_size & 0x80000000);
+			}
+		} else {
+			vector<WIA_Group> groups(group_count);
+			if (!readTable(be64_to_cpu(header2.group_offset), be32_to_cpu(header2.group_size),
+			               groups.data(), groups.size() * sizeof(WIA_Group)))
+			{
+				err = errno;
+				goto fail;
+			}
+			for (size_t i = 0; i < groups.size(); i++) {
+				m_groups[i].offset = static_cast<uint64_t>(be32_to_cpu(groups[i].data_offset)) << 2;
+				m_groups[i].size = be32_to_cpu(groups[i].data_size);
+				m_groups[i].packed_size = 0;
+				// NONE and PURGE groups are stored as-is.
+				m_groups[i].compressed = (m_codec > WIA_COMPRESSION_PURGE);
+			}
+		}
+	}
+
+	// Caches for decompressed data.
+	{
+		unsigned int threads = std::thread::hardware_concurrency();
+		threads = std::max(1U, std::min(threads, 8U));
+		m_threads.reset(new Threads(threads));
+	}
+
+	// Reader initialized.
+	m_type = RVTH_ImageType_GCM;
+	return;
+
+fail:
+	// Failed to initialize the reader.
+	m_file->unref();
+	m_file = nullptr;
+	errno = (err != 0 ? err : EIO);
+}
+
+WiaReader::~WiaReader()
+{
+	// Stop the prefetch threads.
+	if (m_threads && !m_threads->workers.empty()) {
+		{
+			lock_guard<mutex> lock(m_threads->lock);
+			m_threads->stop = true;
+		}
+		m_threads->cond.notify_all();
+		for (std::thread &worker : m_threads->workers) {
+			worker.join();
+		}
+	}
+
+	// Superclass will unreference the file.
+}
+
+/**
+ * Find the unit containing a disc offset.
+ * @param offset	[in] Disc offset.
+ * @return Location.
+ */
+WiaReader::Location WiaReader::locate(uint64_t offset) const
+{
+	Location loc;
+	loc.key = 0;
+	loc.start = offset;
+
+	// Start of the next stored area, if the offset isn't stored.
+	uint64_t next = (offset < m_iso_size ? m_iso_size : ~0ULL);
+
+	for (size_t p = 0; p < m_parts.size(); p++) {
+		const Partition &part = m_parts[p];
+		const uint64_t start = static_cast<uint64_t>(part.first_sector) * SECTOR_SIZE_ENC;
+		const uint64_t end = static_cast<uint64_t>(part.end_sector) * SECTOR_SIZE_ENC;
+		if (offset >= start && offset < end) {
+			// Hash groups are relative to the start of the partition data.
+			const uint64_t g = (offset - start) / GROUP_SIZE_ENC;
+			loc.kind = Location::WII;
+			loc.key = UNIT_KEY_WII | (static_cast<uint64_t>(p) << 32) | g;
+			loc.start = start + (g * GROUP_SIZE_ENC);
+			loc.end = std::min(end, loc.start + GROUP_SIZE_ENC);
+			return loc;
+		} else if (start > offset && start < next) {
+			next = start;
+		}
+	}
+
+	for (const RawData &raw : m_raw) {
+		if (offset >= raw.start && offset < raw.end) {
+			const uint64_t i = (offset - raw.group_start) / m_chunk_size;
+			loc.start = raw.group_start + (i * m_chunk_size);
+			loc.end = std::min(raw.end, loc.start + m_chunk_size);
+			const uint64_t group_index = raw.group_index + i;
+			if (i >= raw.group_count || m_groups[group_index].size == 0) {
+				// Group is empty.
+				loc.kind = Location::ZERO;
+			} else {
+				loc.kind = Location::RAW;
+				loc.key = group_index;
+			}
+			return loc;
+		} else if (raw.start > offset && raw.start < next) {
+			next = raw.start;
+		}
+	}
+
+	// Not stored.
+	loc.kind = Location::NONE;
+	loc.end = next;
+	return loc;
+}
+
+/**
+ * Read and decompress a group.
+ * @param group_index	[in] Group index.
+ * @param size		[in] Decompressed size, excluding hash exceptions.
+ * @param list_count	[in] Number of hash exception lists. (0 for raw data)
+ * @param first_sector	[in] Disc sector of the first hash exception list.
+ * @param data_offset	[in] Data offset of the group, for RVZ junk data.
+ * @return Chunk, or nullptr on error. (errno is set)
+ */
+shared_ptr<WiaReader::Chunk> WiaReader::decodeGroup(uint32_t group_index, size_t size,
+	unsigned int list_count, uint32_t first_sector, uint64_t data_offset)
+{
+	assert(group_index < m_groups.size());
+	const Group &group = m_groups[group_index];
+	shared_ptr<Chunk> chunk = std::make_shared<Chunk>();
+	if (group.size == 0) {
+		// Group is all zeroes.
+		chunk->data.assign(size, 0);
+		return chunk;
+	}
+
+	// Read the stored group.
+	vector<uint8_t> in(group.size);
+	errno = 0;
+	if (m_file->pread(in.data(), in.size(), m_file_base + group.offset) != in.size()) {
+		if (errno == 0) {
+			errno = EIO;
+		}
+		return nullptr;
+	}
+
+	const uint8_t *p = in.data();
+	size_t len = in.size();
+	vector<uint8_t> dec;
+	if (group.compressed) {
+		// The hash exception lists are compressed along with the data.
+		dec.resize((group.packed_size != 0 ? group.packed_size : size) +
+			(list_count * WIA_EXCEPTION_LIST_MAX));
+		if (!decompress(m_codec, m_codec_props, m_codec_props_len,
+		    in.data(), in.size(), dec.data(), dec.size(), &len))
+		{
+			errno = EIO;
+			return nullptr;
+		}
+		p = dec.data();
+	}
+
+	// Hash exception lists. Offsets are relative to the hash block
+	// of the first sector covered by each list.
+	size_t pos = 0;
+	for (unsigned int l = 0; l < list_count; l++) {
+		if (pos + 2 > len) {
+			errno = EIO;
+			return nullptr;
+		}
+		const unsigned int count = (p[pos] << 8) | p[pos+1];
+		pos += 2;
+		if (count * WIA_EXCEPTION_SIZE > len - pos) {
+			errno = EIO;
+			return nullptr;
+		}
+		for (unsigned int i = 0; i < count; i++, pos += WIA_EXCEPTION_SIZE) {
+			const unsigned int offset = (p[pos] << 8) | p[pos+1];
+			HashException exc;
+			exc.sector = first_sector + (l * WII_HASH_TREE_SECTORS_PER_GROUP) +
+				(offset / sizeof(Wii_Disc_Hashes_t));
+			exc.offset = static_cast<uint16_t>(offset % sizeof(Wii_Disc_Hashes_t));
+			if (exc.offset + RVL_SHA1_DIGEST_SIZE > static_cast<int>(sizeof(Wii_Disc_Hashes_t))) {
+				errno = EIO;
+				return nullptr;
+			}
+			memcpy(exc.hash, &p[pos+2], sizeof(exc.hash));
+			chunk->exceptions.push_back(exc);
+		}
+	}
+	if (list_count > 0 && !group.compressed) {
+		// Uncompressed data is aligned to 4 bytes.
+		pos = ALIGN_BYTES(4, pos);
+	}
+	if (pos > len) {
+		errno = EIO;
+		return nullptr;
+	}
+	p += pos;
+	len -= pos;
+
+	// Group data.
+	bool ok;
+	if (!group.compressed && m_codec == WIA_COMPRESSION_PURGE) {
+		chunk->data.assign(size, 0);
+		ok = purgeDecode(p, len, chunk->data.data(), size);
+	} else if (group.packed_size != 0) {
+		chunk->data.resize(size);
+		ok = (group.packed_size <= len &&
+			rvzUnpack(p, group.packed_size, chunk->data.data(), size, data_offset));
+	} else {
+		ok = (len >= size);
+		if (ok) {
+			chunk->data.assign(p, p + size);
+		}
+	}
+	if (!ok) {
+		errno = EIO;
+		return nullptr;
+	}
+	return chunk;
+}
+
+/**
+ * Get a decompressed partition group using the chunk cache.
+ * @param part		[in] Partition.
+ * @param d		[in] Partition data entry index.
+ * @param i		[in] Group index within the data entry.
+ * @return Chunk, or nullptr on error. (errno is set)
+ */
+shared_ptr<const WiaReader::Chunk> WiaReader::getPartitionChunk(const Partition &part, unsigned int d, uint32_t i)
+{
+	const auto &pd = part.data[d];
+	if (i >= pd.group_count) {
+		errno = EIO;
+		return nullptr;
+	}
+
+	// Partition groups have one hash exception list per 2 MB.
+	const uint32_t sectors_per_chunk = m_chunk_size / SECTOR_SIZE_ENC;
+	const uint32_t first_sector = pd.first_sector + (i * sectors_per_chunk);
+	const uint32_t sector_count = std::min(sectors_per_chunk, pd.sector_count - (i * sectors_per_chunk));
+	const unsigned int list_count = std::max(1U, m_chunk_size / static_cast<uint32_t>(GROUP_SIZE_ENC));
+	const uint64_t data_offset = static_cast<uint64_t>(first_sector - part.first_sector) * SECTOR_SIZE_DEC;
+	const uint32_t group_index = pd.group_index + i;
+
+	return m_threads->chunks.get(group_index, [=]() -> shared_ptr<const Chunk> {
+		return decodeGroup(group_index, static_cast<size_t>(sector_count) * SECTOR_SIZE_DEC,
+			list_count, first_sector, data_offset);
+	});
+}
+
+/**
+ * Build a unit: decompress a raw group, or rebuild and
+ * encrypt a 2 MB group of Wii partition sectors.
+ * @param key	[in] Unit key.
+ * @return Unit, or nullptr on error. (errno is set)
+ */
+shared_ptr<const WiaReader::Unit> WiaReader::buildUnit(uint64_t key)
+{
+	shared_ptr<Unit> unit = std::make_shared<Unit>();
+
+	if (!(key & UNIT_KEY_WII)) {
+		// Raw data group.
+		const uint32_t group_index = static_cast<uint32_t>(key);
+		for (const RawData &raw : m_raw) {
+			if (group_index < raw.group_index || group_index - raw.group_index >= raw.group_count) {
+				continue;
+			}
+			unit->disc_offset = raw.group_start +
+				(static_cast<uint64_t>(group_index - raw.group_index) * m_chunk_size);
+			const size_t size = static_cast<size_t>(
+				std::min<uint64_t>(m_chunk_size, raw.end - unit->disc_offset));
+			shared_ptr<Chunk> chunk = decodeGroup(group_index, size, 0, 0, unit->disc_offset);
+			if (!chunk) {
+				return nullptr;
+			}
+			unit->data = std::move(chunk->data);
+			return unit;
+		}
+		errno = EIO;
+		return nullptr;
+	}
+
+	// Wii partition group.
+	const Partition &part = m_parts[static_cast<size_t>((key & ~UNIT_KEY_WII) >> 32)];
+	const uint32_t g = static_cast<uint32_t>(key);
+	const uint32_t s0 = part.first_sector + (g * WII_HASH_TREE_SECTORS_PER_GROUP);
+	const uint32_t count = std::min<uint32_t>(WII_HASH_TREE_SECTORS_PER_GROUP, part.end_sector - s0);
+	const uint32_t sectors_per_chunk = m_chunk_size / SECTOR_SIZE_ENC;
+
+	// Copy the user data into the sectors. Sectors after the end
+	// of the partition are hashed as zeroes.
+	unit->disc_offset = static_cast<uint64_t>(s0) * SECTOR_SIZE_ENC;
+	unit->data.resize(GROUP_SIZE_ENC);
+	Wii_Disc_Sector_t *const sectors = reinterpret_cast<Wii_Disc_Sector_t*>(unit->data.data());
+	vector<HashException> exceptions;
+	shared_ptr<const Chunk> chunk;
+	unsigned int chunk_d = ~0U;
+	uint32_t chunk_i = ~0U;
+	for (uint32_t s = s0; s < s0 + count; s++) {
+		unsigned int d;
+		for (d = 0; d < 2; d++) {
+			if (s >= part.data[d].first_sector && s - part.data[d].first_sector < part.data[d].sector_count) {
+				break;
+			}
+		}
+		if (d >= 2) {
+			// Sector isn't stored.
+			continue;
+		}
+
+		const uint32_t rel = s - part.data[d].first_sector;
+		const uint32_t i = rel / sectors_per_chunk;
+		const uint32_t j = rel % sectors_per_chunk;
+		if (d != chunk_d || i != chunk_i) {
+			chunk = getPartitionChunk(part, d, i);
+			if (!chunk) {
+				return nullptr;
+			}
+			chunk_d = d;
+			chunk_i = i;
+			exceptions.insert(exceptions.end(), chunk->exceptions.begin(), chunk->exceptions.end());
+		}
+		if ((static_cast<size_t>(j) + 1) * SECTOR_SIZE_DEC > chunk->data.size()) {
+			errno = EIO;
+			return nullptr;
+		}
+		memcpy(sectors[s - s0].data, &chunk->data[j * SECTOR_SIZE_DEC], SECTOR_SIZE_DEC);
+	}
+
+	// Regenerate the hashes, then apply the hash exceptions.
+	{
+		StatsTimer timer(StatsCounters::TIMER_SHA1);
+		uint8_t h3[RVL_SHA1_DIGEST_SIZE];
+		wii_hash_tree_build_group(sectors, h3);
+	}
+	for (const HashException &exc : exceptions) {
+		if (exc.sector >= s0 && exc.sector - s0 < count) {
+			uint8_t *const hashes = reinterpret_cast<uint8_t*>(&sectors[exc.sector - s0].hashes);
+			memcpy(&hashes[exc.offset], exc.hash, sizeof(exc.hash));
+		}
+	}
+
+	// Encrypt the sectors.
+	{
+		StatsTimer timer(StatsCounters::TIMER_AES);
+		AesCtx *const aes = aesw_new();
+		if (!aes) {
+			errno = ENOMEM;
+			return nullptr;
+		}
+		aesw_set_key(aes, part.title_key, sizeof(part.title_key));
+		for (uint32_t s = 0; s < count; s++) {
+			encryptSector(aes, &sectors[s]);
+		}
+		aesw_free(aes);
+	}
+
+	unit->data.resize(static_cast<size_t>(count) * SECTOR_SIZE_ENC);
+	return unit;
+}
+
+/**
+ * Get a unit using the unit cache.
+ * @param key	[in] Unit key.
+ * @return Unit, or nullptr on error. (errno is set)
+ */
+shared_ptr<const WiaReader::Unit> WiaReader::getUnit(uint64_t key)
+{
+	return m_threads->units.get(key, [this, key]() { return buildUnit(key); });
+}
+
+/**
+ * Worker thread for prefetching units.
+ */
+void WiaReader::prefetchWorker(void)
+{
+	Threads *const th = m_threads.get();
+	StatsScope scope(th->stats);
+
+	for (;;) {
+		shared_ptr<FutureCache<Unit>::task_type> job;
+		{
+			unique_lock<mutex> lock(th->lock);
+			th->cond.wait(lock, [th]() { return !th->jobs.empty() || th->stop; });
+			if (th->stop) {
+				break;
+			}
+			job = std::move(th->jobs.front());
+			th->jobs.pop_front();
+		}
+		(*job)();
+	}
+}
+
+/**
+ * Decompress the units after a read on the worker threads.
+ * @param offset	[in] Disc offset after the read.
+ */
+void WiaReader::prefetch(uint64_t offset)
+{
+	Threads *const th = m_threads.get();
+	if (th->workers.empty()) {
+		// Start the worker threads.
+		th->stats = StatsCounters::current();
+		for (unsigned int i = 0; i < th->count; i++) {
+			th->workers.emplace_back(&WiaReader::prefetchWorker, this);
+		}
+	}
+
+	// Queue up to one unit per worker thread.
+	unsigned int queued = 0;
+	while (queued < th->count && offset < m_iso_size) {
+		const Location loc = locate(offset);
+		offset = loc.end;
+		if (loc.kind != Location::RAW && loc.kind != Location::WII) {
+			continue;
+		}
+
+		FutureCache<Unit>::future_type f;
+		const uint64_t key = loc.key;
+		shared_ptr<FutureCache<Unit>::task_type> task =
+			th->units.lookup(key, [this, key]() { return buildUnit(key); }, f);
+		if (task) {
+			lock_guard<mutex> lock(th->lock);
+			th->jobs.push_back(std::move(task));
+		}
+		queued++;
+	}
+	if (queued > 0) {
+		th->cond.notify_all();
+	}
+}
+
+/**
+ * Read data from the disc image.
+ * @param ptr		[out] Read buffer.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Number of LBAs read, or 0 on error.
+ */
+uint32_t WiaReader::read(void *ptr, uint32_t lba_start, uint32_t lba_len)
+{
+	RVTH_TRACE_SPAN_BYTES("WiaReader::read", LBA_TO_BYTES(lba_len));
+
+	// LBA bounds checking.
+	// TODO: Check for overflow?
+	assert(lba_start + lba_len <= m_lba_len);
+	if (lba_start + lba_len > m_lba_len) {
+		// Out of range.
+		errno = EIO;
+		return 0;
+	}
+
+	uint8_t *ptr8 = static_cast<uint8_t*>(ptr);
+	const uint64_t start = LBA_TO_BYTES(static_cast<uint64_t>(lba_start));
+	const uint64_t end = start + LBA_TO_BYTES(static_cast<uint64_t>(lba_len));
+	for (uint64_t offset = start; offset < end; ) {
+		const Location loc = locate(offset);
+		const size_t seg_len = static_cast<size_t>(std::min(end, loc.end) - offset);
+
+		if (loc.kind == Location::NONE || loc.kind == Location::ZERO) {
+			// Not stored, or empty.
+			memset(ptr8, 0, seg_len);
+		} else {
+			const shared_ptr<const Unit> unit = getUnit(loc.key);
+			const size_t pos = (unit ? static_cast<size_t>(offset - unit->disc_offset) : 0);
+			if (!unit || pos + seg_len > unit->data.size()) {
+				// Decompression error.
+				errno = EIO;
+				return 0;
+			}
+			memcpy(ptr8, &unit->data[pos], seg_len);
+		}
+
+		ptr8 += seg_len;
+		offset += seg_len;
+	}
+
+	// The first 0x80 bytes are stored in the header.
+	if (start < sizeof(m_disc_header)) {
+		memcpy(ptr, &m_disc_header[start],
+			static_cast<size_t>(std::min<uint64_t>(sizeof(m_disc_header), end) - start));
+	}
+
+	prefetch(end);
+	return lba_len;
+}
+
+/**
+ * Check if a range of LBAs is known to be empty without reading it.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return True if the range is entirely within unstored or empty groups; false if not.
+ */
+bool WiaReader::isRangeEmpty(uint32_t lba_start, uint32_t lba_len) const
+{
+	if (lba_len == 0 || lba_start + lba_len > m_lba_len) {
+		return false;
+	}
+
+	const uint64_t start = LBA_TO_BYTES(static_cast<uint64_t>(lba_start));
+	const uint64_t end = start + LBA_TO_BYTES(static_cast<uint64_t>(lba_len));
+	if (start < sizeof(m_disc_header)) {
+		// The disc header is never empty.
+		return false;
+	}
+	for (uint64_t offset = start; offset < end; ) {
+		const Location loc = locate(offset);
+		if (loc.kind != Location::NONE && loc.kind != Location::ZERO) {
+			return false;
+		}
+		offset = loc.end;
+	}
+	return true;
+}
+
+/**
+ * Get the allocated and unallocated ranges within a range of LBAs.
+ * Unstored or empty groups are unallocated.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs. (Clamped to the image length.)
+ * @param extents	[out] Extents.
+ * @return Number of unallocated LBAs.
+ */
+uint32_t WiaReader::extents(uint32_t lba_start, uint32_t lba_len, std::vector<Extent> &extents) const
+{
+	extents.clear();
+	if (lba_start >= m_lba_len) {
+		return 0;
+	}
+	lba_len = std::min(lba_len, m_lba_len - lba_start);
+
+	// The disc header is never empty.
+	const uint64_t start = LBA_TO_BYTES(static_cast<uint64_t>(lba_start));
+	const uint64_t end = start + LBA_TO_BYTES(static_cast<uint64_t>(lba_len));
+	uint64_t offset = start;
+	if (offset < sizeof(m_disc_header)) {
+		offset = std::min(end, static_cast<uint64_t>(LBA_TO_BYTES(BYTES_TO_LBA(sizeof(m_disc_header)))));
+		addExtent(extents, lba_start, static_cast<uint32_t>(BYTES_TO_LBA(offset) - lba_start), true);
+	}
+
+	// Locations may end in the middle of an LBA. Partial LBAs
+	// are only unallocated if the whole LBA is unallocated.
+	uint32_t unallocated = 0;
+	uint32_t lba = static_cast<uint32_t>(BYTES_TO_LBA(offset));
+	while (offset < end) {
+		const Location loc = locate(offset);
+		const bool allocated = (loc.kind != Location::NONE && loc.kind != Location::ZERO);
+		offset = std::min(loc.end, end);
+
+		uint32_t lba_next;
+		if (allocated) {
+			// Round up.
+			lba_next = static_cast<uint32_t>((offset + LBA_SIZE - 1) / LBA_SIZE);
+		} else {
+			// Round down.
+			lba_next = static_cast<uint32_t>(offset / LBA_SIZE);
+		}
+		if (lba_next > lba) {
+			addExtent(extents, lba, lba_next - lba, allocated);
+			if (!allocated) {
+				unallocated += lba_next - lba;
+			}
+			lba = lba_next;
+		}
+	}
+	return unallocated;
+}
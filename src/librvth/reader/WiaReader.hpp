@@ -0,0 +1,227 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * WiaReader.hpp: WIA/RVZ disc image reader class.                         *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_READER_WIAREADER_HPP__
+#define __RVTHTOOL_LIBRVTH_READER_WIAREADER_HPP__
+
+#include "Reader.hpp"
+
+// C++ includes
+#include <memory>
+#include <vector>
+
+/**
+ * WIA and RVZ disc images, as written by wit and Dolphin.
+ *
+ * Wii partition data is stored decrypted and without hash blocks.
+ * When reading, the hash blocks are regenerated one 2 MB group at
+ * a time, the stored hash exceptions are applied, and the sectors
+ * are encrypted again, so the original disc image is reproduced.
+ *
+ * Groups are decompressed on worker threads. Groups after the most
+ * recent read are decompressed ahead of time, so sequential reads
+ * (verify, import, extract) don't wait on the decompressor.
+ *
+ * WIA and RVZ images are read-only.
+ */
+class WiaReader : public Reader
+{
+	public:
+		/**
+		 * Create a WIA/RVZ reader for a disc image.
+		 *
+		 * NOTE: If lba_start == 0 and lba_len == 0, the entire file
+		 * will be used.
+		 *
+		 * @param file		RefFile*.
+		 * @param lba_start	[in] Starting LBA,
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @param probe		[in,opt] Probe window from Reader::open(), or nullptr to read the headers from the file.
+		 */
+		WiaReader(RefFile *file, uint32_t lba_start, uint32_t lba_len, const ProbeBuffer *probe = nullptr);
+
+		virtual ~WiaReader();
+
+	private:
+		typedef Reader super;
+		DISABLE_COPY(WiaReader)
+
+	public:
+		/**
+		 * Is a given disc image supported by the WIA/RVZ reader?
+		 * @param sbuf	[in] Sector buffer. (first LBA of the disc)
+		 * @param size	[in] Size of sbuf. (should be 512 or larger)
+		 * @return True if supported; false if not.
+		 */
+		static bool isSupported(const uint8_t *sbuf, size_t size);
+
+	public:
+		/** I/O functions **/
+
+		/**
+		 * Read data from the disc image.
+		 * @param ptr		[out] Read buffer.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Number of LBAs read, or 0 on error.
+		 */
+		uint32_t read(void *ptr, uint32_t lba_start, uint32_t lba_len) final;
+
+		/**
+		 * Check if a range of LBAs is known to be empty without reading it.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return True if the range is entirely within unstored or empty groups; false if not.
+		 */
+		bool isRangeEmpty(uint32_t lba_start, uint32_t lba_len) const final;
+
+		/**
+		 * Get the allocated and unallocated ranges within a range of LBAs.
+		 * Unstored or empty groups are unallocated.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs. (Clamped to the image length.)
+		 * @param extents	[out] Extents.
+		 * @return Number of unallocated LBAs.
+		 */
+		uint32_t extents(uint32_t lba_start, uint32_t lba_len, std::vector<Extent> &extents) const final;
+
+	public:
+		// Wii partition. Sector numbers are 32 KB disc sectors.
+		struct Partition {
+			uint8_t title_key[16];		// Decrypted title key
+			uint32_t first_sector;		// First encrypted sector
+			uint32_t end_sector;		// Last encrypted sector + 1
+			struct {
+				uint32_t first_sector;
+				uint32_t sector_count;
+				uint32_t group_index;
+				uint32_t group_count;
+			} data[2];
+		};
+
+		// Raw (unencrypted) data area. Offsets are in bytes.
+		struct RawData {
+			uint64_t group_start;		// Start of the first group (aligned to 32 KB)
+			uint64_t start;			// Start of the data
+			uint64_t end;			// End of the data
+			uint32_t group_index;
+			uint32_t group_count;
+		};
+
+		// Group entry.
+		struct Group {
+			uint64_t offset;		// File offset
+			uint32_t size;			// Stored size (0 if the group is all zeroes)
+			uint32_t packed_size;		// RVZ: Size of the packed data (0 if not packed)
+			bool compressed;		// True if the group is compressed
+		};
+
+		// Hash exception: replaces a hash in a regenerated hash block.
+		struct HashException {
+			uint32_t sector;		// Disc sector
+			uint16_t offset;		// Offset in the sector's hash block
+			uint8_t hash[20];
+		};
+
+		// Decompressed group.
+		struct Chunk {
+			std::vector<uint8_t> data;
+			std::vector<HashException> exceptions;
+		};
+
+		// Disc data for a raw group or a Wii partition group.
+		struct Unit {
+			uint64_t disc_offset;
+			std::vector<uint8_t> data;
+		};
+
+	private:
+		/**
+		 * Location of a disc offset.
+		 */
+		struct Location {
+			enum Kind { NONE, ZERO, RAW, WII } kind;
+			uint64_t key;		// Unit key (RAW, WII)
+			uint64_t start;		// Start of the unit
+			uint64_t end;		// End of the unit (or of the unstored/empty area)
+		};
+
+		/**
+		 * Find the unit containing a disc offset.
+		 * @param offset	[in] Disc offset.
+		 * @return Location.
+		 */
+		Location locate(uint64_t offset) const;
+
+		/**
+		 * Read and decompress a group.
+		 * @param group_index	[in] Group index.
+		 * @param size		[in] Decompressed size, excluding hash exceptions.
+		 * @param list_count	[in] Number of hash exception lists. (0 for raw data)
+		 * @param first_sector	[in] Disc sector of the first hash exception list.
+		 * @param data_offset	[in] Data offset of the group, for RVZ junk data.
+		 * @return Chunk, or nullptr on error. (errno is set)
+		 */
+		std::shared_ptr<Chunk> decodeGroup(uint32_t group_index, size_t size,
+			unsigned int list_count, uint32_t first_sector, uint64_t data_offset);
+
+		/**
+		 * Get a decompressed partition group using the chunk cache.
+		 * @param part		[in] Partition.
+		 * @param d		[in] Partition data entry index.
+		 * @param i		[in] Group index within the data entry.
+		 * @return Chunk, or nullptr on error. (errno is set)
+		 */
+		std::shared_ptr<const Chunk> getPartitionChunk(const Partition &part, unsigned int d, uint32_t i);
+
+		/**
+		 * Build a unit: decompress a raw group, or rebuild and
+		 * encrypt a 2 MB group of Wii partition sectors.
+		 * @param key	[in] Unit key.
+		 * @return Unit, or nullptr on error. (errno is set)
+		 */
+		std::shared_ptr<const Unit> buildUnit(uint64_t key);
+
+		/**
+		 * Get a unit using the unit cache.
+		 * @param key	[in] Unit key.
+		 * @return Unit, or nullptr on error. (errno is set)
+		 */
+		std::shared_ptr<const Unit> getUnit(uint64_t key);
+
+		/**
+		 * Decompress the units after a read on the worker threads.
+		 * @param offset	[in] Disc offset after the read.
+		 */
+		void prefetch(uint64_t offset);
+
+		/**
+		 * Worker thread for prefetching units.
+		 */
+		void prefetchWorker(void);
+
+	private:
+		uint64_t m_file_base;		// File offset of the WIA header
+		uint64_t m_iso_size;		// Size of the original disc image
+		bool m_isRvz;			// True for RVZ; false for WIA
+		uint32_t m_codec;		// Compression codec
+		uint32_t m_chunk_size;		// Group size, in bytes (encrypted for partition data)
+		uint8_t m_disc_header[0x80];	// First 0x80 bytes of the disc
+		uint8_t m_codec_props[7];	// Compressor properties (LZMA, LZMA2)
+		uint8_t m_codec_props_len;
+
+		std::vector<Partition> m_parts;
+		std::vector<RawData> m_raw;
+		std::vector<Group> m_groups;
+
+		// Caches and prefetch threads. (See WiaReader.cpp.)
+		struct Threads;
+		std::unique_ptr<Threads> m_threads;
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_READER_WIAREADER_HPP__ */
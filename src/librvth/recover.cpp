@@ -0,0 +1,359 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * recover.cpp: Scan an RVT-H HDD for lost banks.                          *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "rvth.hpp"
+#include "rvth_error.h"
+#include "disc_header.hpp"
+#include "ProgressRate.hpp"
+#include "ProgressThrottle.hpp"
+#include "StatsCounters.hpp"
+
+// For LBA_TO_BYTES()
+#include "nhcd_structs.h"
+
+// Reader class
+#include "reader/PlainReader.hpp"
+#include "reader/ReadAheadQueue.hpp"
+
+#include "RefFile.hpp"
+
+// libwiicrypto
+#include "libwiicrypto/byteswap.h"
+
+// C includes (C++ namespace)
+#include <cassert>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+
+// C++ includes
+#include <algorithm>
+#include <vector>
+using std::vector;
+
+// Scan chunk size
+static constexpr unsigned int SCAN_CHUNK_SIZE = 4U * 1024U * 1024U;
+// Number of scan chunk buffers
+static constexpr unsigned int SCAN_CHUNK_COUNT = 4;
+
+// Candidate scores
+static constexpr int SCORE_IDENTIFIED = 10;	// rvth_disc_header_identify() recognized the header
+static constexpr int SCORE_VERIFIED = 10;	// rvth_disc_header_get() recognized the disc image
+static constexpr int SCORE_BANK_ADDRESS = 20;	// Starts at a standard bank address
+static constexpr int SCORE_GAME_ID = 5;		// Game ID is alphanumeric
+static constexpr int SCORE_TITLE = 3;		// Game title is printable
+static constexpr int SCORE_NESTED = -25;	// Inside a better candidate's disc image
+
+/**
+ * Get the standard bank number for an LBA.
+ * @param lba		[in] LBA
+ * @param bank_count	[in] Number of banks on the HDD
+ * @return Bank number (0-based), or -1 if the LBA isn't a standard bank address.
+ */
+static int bankForLba(uint32_t lba, unsigned int bank_count)
+{
+	if (lba == NHCD_EXTBANKTABLE_BANK_1_OFFSET_LBA) {
+		// Bank 1 is relocated for extended bank tables.
+		return 0;
+	} else if (lba < NHCD_BANK_START_LBA(0, 8)) {
+		return -1;
+	}
+
+	const uint32_t offset = lba - NHCD_BANK_START_LBA(0, 8);
+	if (offset % NHCD_BANK_SIZE_LBA != 0) {
+		return -1;
+	}
+	const unsigned int bank = offset / NHCD_BANK_SIZE_LBA;
+	return (bank < bank_count ? static_cast<int>(bank) : -1);
+}
+
+/**
+ * Get the maximum size of a disc image.
+ * @param type Bank type
+ * @return Maximum size, in LBAs.
+ */
+static uint32_t maxImageSize(uint8_t type)
+{
+	switch (type) {
+		case RVTH_BankType_GCN:
+			return NHCD_BANK_GCN_SIZE_RETAIL_LBA;
+		case RVTH_BankType_Wii_DL:
+			return NHCD_BANK_SIZE_LBA * 2;
+		default:
+			return NHCD_BANK_SIZE_LBA;
+	}
+}
+
+/**
+ * Check if a disc header has a magic number.
+ * @param discHeader Disc header
+ * @return True if the GameCube or Wii magic number is present.
+ */
+static inline bool hasMagic(const GCN_DiscHeader *discHeader)
+{
+	return (discHeader->magic_wii == cpu_to_be32(WII_MAGIC) ||
+		discHeader->magic_gcn == cpu_to_be32(GCN_MAGIC));
+}
+
+/**
+ * Score a candidate's disc header.
+ * @param candidate	[in,out] Candidate
+ */
+static void scoreDiscHeader(RvtH_Bank_Candidate *candidate)
+{
+	const GCN_DiscHeader *const discHeader = &candidate->discHeader;
+	if (rvth_disc_header_identify(discHeader) > RVTH_BankType_Unknown) {
+		candidate->score += SCORE_IDENTIFIED;
+	}
+
+	bool valid = true;
+	for (unsigned int i = 0; i < sizeof(discHeader->id6); i++) {
+		if (!isupper((unsigned char)discHeader->id6[i]) &&
+		    !isdigit((unsigned char)discHeader->id6[i]))
+		{
+			valid = false;
+			break;
+		}
+	}
+	if (valid) {
+		candidate->score += SCORE_GAME_ID;
+	}
+
+	valid = (discHeader->game_title[0] != 0);
+	for (unsigned int i = 0; i < sizeof(discHeader->game_title) && discHeader->game_title[i] != 0; i++) {
+		// NOTE: Japanese titles are Shift-JIS, so high bytes are allowed.
+		const unsigned char chr = (unsigned char)discHeader->game_title[i];
+		if (chr < 0x20 || chr == 0x7F) {
+			valid = false;
+			break;
+		}
+	}
+	if (valid) {
+		candidate->score += SCORE_TITLE;
+	}
+}
+
+/**
+ * Scan an RVT-H HDD for disc images, e.g. if the bank table is damaged.
+ *
+ * The whole HDD is read sequentially in large chunks, using a
+ * background thread, and every LBA is checked for the GameCube
+ * and Wii disc header magic numbers. Standard bank addresses are
+ * also checked for deleted banks, which have zeroed disc headers.
+ *
+ * Candidates are ranked using rvth_disc_header_identify() and
+ * rvth_disc_header_get(), plus whether the disc image starts at a
+ * standard bank address, whether the game ID and title are valid,
+ * and whether the disc image is nested inside a better candidate.
+ *
+ * @param candidates	[out] Candidates, sorted by score (highest first)
+ * @param callback	[in,opt] Progress callback
+ * @param userdata	[in,opt] User data for progress callback
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int RvtH::scanForBanks(vector<RvtH_Bank_Candidate> &candidates,
+	RvtH_Progress_Callback callback, void *userdata)
+{
+	StatsScope scope(m_stats);
+	candidates.clear();
+	if (!isHDD()) {
+		// Standalone disc image. No banks to recover.
+		errno = EINVAL;
+		return RVTH_ERROR_NOT_HDD_IMAGE;
+	}
+
+	// Determine the number of LBAs to scan.
+	// NOTE: LBAs are 32-bit, so only the first 2 TB can be scanned.
+	const off64_t hdd_size = m_file->size();
+	if (hdd_size <= 0) {
+		int err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		errno = err;
+		return -err;
+	}
+	const uint32_t lba_total = static_cast<uint32_t>(
+		std::min<off64_t>(BYTES_TO_LBA(hdd_size), UINT32_MAX));
+
+	// Callback state.
+	RvtH_Progress_State state;
+	ProgressRate rate;
+	if (callback) {
+		state.rvth = this;
+		state.rvth_gcm = nullptr;
+		state.bank_rvth = ~0U;
+		state.bank_gcm = ~0U;
+		state.type = RVTH_PROGRESS_RECOVER;
+		state.lba_processed = 0;
+		state.lba_total = lba_total;
+		state.digests = nullptr;
+	}
+
+	// Read the HDD sequentially in the background, and check
+	// every LBA for a disc header magic number.
+	static constexpr uint32_t LBA_COUNT_CHUNK = BYTES_TO_LBA(SCAN_CHUNK_SIZE);
+	ProgressThrottle throttle(&m_progressParams);
+	{
+		PlainReader reader(m_file, 0, lba_total);
+		m_file->beginScan(0, 0);
+		ReadAheadQueue raq(&reader, 0, lba_total, LBA_COUNT_CHUNK, SCAN_CHUNK_COUNT);
+		if (!raq.isOpen()) {
+			m_file->endScan(0, 0);
+			errno = ENOMEM;
+			return -ENOMEM;
+		}
+
+		uint32_t lba_chunk, lba_chunk_len;
+		const uint8_t *buf;
+		while ((buf = raq.next(&lba_chunk, &lba_chunk_len)) != nullptr) {
+			if (callback && throttle.ready(LBA_TO_BYTES(static_cast<uint64_t>(lba_chunk)))) {
+				state.lba_processed = lba_chunk;
+				rate.update(&state);
+				if (!callback(&state, userdata)) {
+					// Stop processing.
+					m_file->endScan(0, 0);
+					candidates.clear();
+					errno = ECANCELED;
+					return -ECANCELED;
+				}
+			}
+
+			for (uint32_t i = 0; i < lba_chunk_len; i++) {
+				const GCN_DiscHeader *const discHeader =
+					reinterpret_cast<const GCN_DiscHeader*>(&buf[LBA_TO_BYTES(i)]);
+				if (!hasMagic(discHeader)) {
+					continue;
+				}
+
+				RvtH_Bank_Candidate candidate;
+				memset(&candidate, 0, sizeof(candidate));
+				candidate.lba_start = lba_chunk + i;
+				candidate.type = RVTH_BankType_Unknown;
+				memcpy(&candidate.discHeader, discHeader, sizeof(candidate.discHeader));
+				candidates.push_back(candidate);
+			}
+		}
+		if (errno != 0) {
+			// Read error.
+			const int err = errno;
+			m_file->endScan(0, 0);
+			candidates.clear();
+			return -err;
+		}
+		m_file->endScan(0, 0);
+	}
+
+	// Check the standard bank addresses for deleted banks.
+	// Deleted banks have zeroed disc headers, so they weren't found
+	// by the magic number scan.
+	const unsigned int bank_count = std::max(m_bankCount,
+		std::min(32U, (lba_total > NHCD_BANK_START_LBA(0, 8))
+			? ((lba_total - NHCD_BANK_START_LBA(0, 8)) / NHCD_BANK_SIZE_LBA)
+			: 0U));
+	// NOTE: Bank 1 may be relocated for extended bank tables.
+	vector<uint32_t> bank_lbas;
+	bank_lbas.reserve(bank_count + 1);
+	bank_lbas.push_back(NHCD_EXTBANKTABLE_BANK_1_OFFSET_LBA);
+	for (unsigned int bank = 0; bank < bank_count; bank++) {
+		const uint32_t lba_start = NHCD_BANK_START_LBA(0, 8) + (NHCD_BANK_SIZE_LBA * bank);
+		if (lba_start >= lba_total) {
+			break;
+		}
+		bank_lbas.push_back(lba_start);
+	}
+	for (const uint32_t lba_start : bank_lbas) {
+		const bool found = std::any_of(candidates.cbegin(), candidates.cend(),
+			[lba_start](const RvtH_Bank_Candidate &c) { return c.lba_start == lba_start; });
+		if (found) {
+			continue;
+		}
+
+		RvtH_Bank_Candidate candidate;
+		memset(&candidate, 0, sizeof(candidate));
+		candidate.lba_start = lba_start;
+		candidate.type = RVTH_BankType_Unknown;
+		bool isDeleted = false;
+		const int type = rvth_disc_header_get(m_file, lba_start, &candidate.discHeader, &isDeleted);
+		if (type > RVTH_BankType_Unknown && isDeleted) {
+			candidate.type = static_cast<uint8_t>(type);
+			candidate.is_deleted = true;
+			candidates.push_back(candidate);
+		}
+	}
+
+	// Rank the candidates.
+	const bool has_nhcd = (m_NHCD_status == NHCD_STATUS_OK);
+	for (RvtH_Bank_Candidate &candidate : candidates) {
+		candidate.bank = bankForLba(candidate.lba_start, bank_count);
+		if (candidate.bank >= 0) {
+			candidate.score += SCORE_BANK_ADDRESS;
+		}
+
+		if (!candidate.is_deleted) {
+			GCN_DiscHeader discHeader;
+			const int type = rvth_disc_header_get(m_file, candidate.lba_start, &discHeader, nullptr);
+			if (type > RVTH_BankType_Unknown) {
+				candidate.type = static_cast<uint8_t>(type);
+				candidate.score += SCORE_VERIFIED;
+			} else {
+				const int type_hdr = rvth_disc_header_identify(&candidate.discHeader);
+				if (type_hdr > RVTH_BankType_Unknown) {
+					candidate.type = static_cast<uint8_t>(type_hdr);
+				}
+			}
+		} else {
+			candidate.score += SCORE_VERIFIED;
+		}
+		scoreDiscHeader(&candidate);
+
+		if (has_nhcd && candidate.bank >= 0 && static_cast<unsigned int>(candidate.bank) < m_bankCount) {
+			const RvtH_BankEntry *const entry = bankEntry(candidate.bank);
+			candidate.in_nhcd = (entry && entry->lba_start == candidate.lba_start &&
+				entry->type > RVTH_BankType_Unknown);
+		}
+	}
+
+	// Disc images can contain other disc headers, e.g. embedded
+	// disc images or random data, so candidates inside a better
+	// candidate's disc image are ranked lower.
+	std::sort(candidates.begin(), candidates.end(),
+		[](const RvtH_Bank_Candidate &a, const RvtH_Bank_Candidate &b) {
+			return (a.score != b.score) ? (a.score > b.score) : (a.lba_start < b.lba_start);
+		});
+	for (size_t i = 1; i < candidates.size(); i++) {
+		RvtH_Bank_Candidate &candidate = candidates[i];
+		for (size_t j = 0; j < i; j++) {
+			const RvtH_Bank_Candidate &better = candidates[j];
+			if (better.score < candidate.score || better.lba_start >= candidate.lba_start) {
+				continue;
+			}
+			if (candidate.lba_start - better.lba_start < maxImageSize(better.type)) {
+				candidate.score += SCORE_NESTED;
+				break;
+			}
+		}
+	}
+	std::stable_sort(candidates.begin(), candidates.end(),
+		[](const RvtH_Bank_Candidate &a, const RvtH_Bank_Candidate &b) {
+			return (a.score > b.score);
+		});
+
+	if (callback) {
+		state.lba_processed = lba_total;
+		rate.update(&state);
+		if (!callback(&state, userdata)) {
+			// Stop processing.
+			errno = ECANCELED;
+			return -ECANCELED;
+		}
+	}
+
+	return 0;
+}
@@ -2,13 +2,16 @@
  * RVT-H Tool (librvth)                                                    *
  * recrypt.cpp: RVT-H "recryption" functions.                              *
  *                                                                         *
- * Copyright (c) 2018-2022 by David Korth.                                 *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
 #include "rvth.hpp"
 #include "ptbl.h"
 #include "rvth_error.h"
+#include "StatsCounters.hpp"
+#include "ThreadPool.hpp"
+#include "ProgressRate.hpp"
 
 // For LBA_TO_BYTES()
 #include "nhcd_structs.h"
@@ -34,9 +37,18 @@
 // C includes (C++ namespace)
 #include <cassert>
 #include <cerrno>
+#include <climits>
 #include <cstddef>
 #include <cstring>
 
+// C++ includes
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+using std::unique_ptr;
+using std::vector;
+
 // Sector buffer. (1 LBA)
 typedef union _sbuf1_t {
 	uint8_t u8[LBA_SIZE];
@@ -140,167 +152,398 @@ static int rvth_create_id(uint8_t *id, size_t size,
 	return rsaw_encrypt(id, size, id_pub, sizeof(id_pub), id_exp, buf, sizeof(buf));
 }
 
+/**
+ * Write the import identifier to a bank.
+ * @param bank	[in] Bank number. (0-7)
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
 int RvtH::recryptID(unsigned int bank)
 {
-	int err = 0;	// errno
+	return recryptIDBanks(&bank, 1);
+}
 
-	// Sector buffer.
-	unsigned int lba_size;
-	sbuf1_t sbuf;
-	GCN_DiscHeader gcn;
+// Identifier to write. (RvtH::recryptIDBanks())
+typedef struct _IDSlot {
+	unsigned int job;		// Index in the bank list
+	const pt_entry_t *pte;		// Partition table entry (Wii only)
+	uint32_t lba;			// LBA containing the identifier, relative to the bank
+	uint64_t lba_abs;		// Absolute LBA, for ordering the writes
+	unsigned int id_offset;		// Offset of the identifier in buf[]
+	char extra[24];			// Extra string (Wii only)
+	uint8_t buf[LBA_SIZE];		// LBA data
+} IDSlot;
 
-	if (bank >= m_bankCount) {
-		// Bank number is out of range.
-		errno = ERANGE;
-		return -ERANGE;
+/**
+ * Write the import identifier to multiple banks.
+ *
+ * This is done in three passes: the disc headers and identifier areas
+ * of all banks are read, the identifiers are created in parallel, and
+ * then all of the identifiers are written in LBA order and flushed once.
+ * Identifier areas that aren't empty aren't changed.
+ *
+ * @param banks		[in] Bank numbers. (0-7)
+ * @param count		[in] Number of banks.
+ * @param results	[out,opt] Array of `count` error codes, one for each bank.
+ * @return Error code of the first bank that failed, or 0 if all banks succeeded.
+ *         (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int RvtH::recryptIDBanks(const unsigned int *banks, unsigned int count, int *results)
+{
+	StatsScope scope(m_stats);
+	if (!banks || count == 0) {
+		errno = EINVAL;
+		return -EINVAL;
 	}
 
-	// Check the bank type.
-	RvtH_BankEntry *const entry = &m_entries[bank];
-	bool is_wii;
-	switch (entry->type) {
-		case RVTH_BankType_GCN:
-			is_wii = false;
-			break;
-
-		case RVTH_BankType_Wii_SL:
-		case RVTH_BankType_Wii_DL:
-			is_wii = true;
-			break;
-
-		case RVTH_BankType_Unknown:
-		default:
-			// Unknown bank status...
-			return RVTH_ERROR_BANK_UNKNOWN;
-
-		case RVTH_BankType_Empty:
-			// Bank is empty.
-			return RVTH_ERROR_BANK_EMPTY;
+	vector<int> rets(count, 0);
+	for (unsigned int i = 0; i < count; i++) {
+		if (banks[i] >= m_bankCount) {
+			// Bank number is out of range.
+			rets[i] = -ERANGE;
+			continue;
+		}
 
-		case RVTH_BankType_Wii_DL_Bank2:
-			// Second bank of a dual-layer Wii disc image.
-			// TODO: Automatically select the first bank?
-			return RVTH_ERROR_BANK_DL_2;
+		// Check the bank type.
+		switch (getBankEntry(banks[i])->type) {
+			case RVTH_BankType_GCN:
+			case RVTH_BankType_Wii_SL:
+			case RVTH_BankType_Wii_DL:
+				break;
+
+			case RVTH_BankType_Unknown:
+			default:
+				// Unknown bank status...
+				rets[i] = RVTH_ERROR_BANK_UNKNOWN;
+				break;
+
+			case RVTH_BankType_Empty:
+				// Bank is empty.
+				rets[i] = RVTH_ERROR_BANK_EMPTY;
+				break;
+
+			case RVTH_BankType_Wii_DL_Bank2:
+				// Second bank of a dual-layer Wii disc image.
+				// TODO: Automatically select the first bank?
+				rets[i] = RVTH_ERROR_BANK_DL_2;
+				break;
+		}
 	}
 
 	// Make the RVT-H object writable.
 	int ret = this->makeWritable();
 	if (ret != 0) {
 		// Could not make the RVT-H object writable.
-		if (ret < 0) {
-			err = -ret;
-		} else {
-			err = EROFS;
-		}
-		errno = err;
-		return ret;
+		std::fill(rets.begin(), rets.end(), ret);
 	}
 
-	// Get the GCN disc header.
-	Reader *const reader = entry->reader;
-	errno = 0;
-	lba_size = reader->read(&sbuf.u8, 0, 1);
-	if (lba_size != 1) {
-		// Unable to read the disc header.
-		err = errno;
-		if (err == 0) {
-			err = EIO;
+	// Read the disc headers and the identifier areas.
+	vector<GCN_DiscHeader> gcn(count);
+	vector<IDSlot> slots;
+	auto ioError = [](void) -> int {
+		const int err = errno;
+		return (err != 0 ? -err : -EIO);
+	};
+	for (unsigned int i = 0; i < count; i++) {
+		if (rets[i] != 0) {
+			continue;
 		}
-		errno = err;
-		return ret;
-	}
 
-	memcpy(&gcn, &sbuf.gcn, sizeof(gcn));
-	if (!is_wii) {
-		// GCN. Write at 0x480.
+		RvtH_BankEntry *const entry = getBankEntry(banks[i]);
+		Reader *const reader = entry->reader;
+		sbuf1_t sbuf;
 		errno = 0;
-		lba_size = reader->read(&sbuf.u8, BYTES_TO_LBA(0x400), 1);
-		if (lba_size != 1) {
-			err = errno;
-			if (err == 0) {
-				err = EIO;
-			}
-			errno = err;
-			return ret;
+		if (reader->read(&sbuf.u8, 0, 1) != 1) {
+			// Unable to read the disc header.
+			rets[i] = ioError();
+			continue;
 		}
-		reader->flush();
-
-		// Only if this area is empty!
-		if (isBlockEmpty(&sbuf.u8[0x80], 256)) {
-			rvth_create_id(&sbuf.u8[0x80], 256, &gcn, NULL);
+		memcpy(&gcn[i], &sbuf.gcn, sizeof(gcn[i]));
+
+		IDSlot slot;
+		slot.job = i;
+		slot.pte = nullptr;
+		slot.extra[0] = 0;
+		if (entry->type == RVTH_BankType_GCN) {
+			// GCN. Write at 0x480.
+			slot.lba = BYTES_TO_LBA(0x400);
+			slot.id_offset = 0x80;
 			errno = 0;
-			lba_size = reader->write(&sbuf.u8, BYTES_TO_LBA(0x400), 1);
-			if (lba_size != 1) {
-				err = errno;
-				if (err == 0) {
-					err = EIO;
-				}
-				errno = err;
-				return ret;
+			if (reader->read(slot.buf, slot.lba, 1) != 1) {
+				rets[i] = ioError();
+				continue;
 			}
-			reader->flush();
+
+			// Only if this area is empty!
+			if (isBlockEmpty(&slot.buf[slot.id_offset], 256)) {
+				slot.lba_abs = reader->lba_start() + slot.lba;
+				slots.push_back(slot);
+			}
+			continue;
 		}
-	} else {
-		// Wii. Write at the end of the partition header.
 
-		// Make sure the partition table is loaded.
+		// Wii. Write at the end of each partition header.
 		ret = rvth_ptbl_load(entry);
 		if (ret != 0 || entry->pt_count == 0 || !entry->ptbl) {
 			// Unable to load the partition table.
-			err = -ret;
-			errno = err;
-			return ret;
+			rets[i] = (ret != 0 ? ret : -EIO);
+			continue;
 		}
 
-		// Write the ID at the end of each partition header.
 		const pt_entry_t *pte = entry->ptbl;
-		for (unsigned int i = 0; i < entry->pt_count; i++, pte++) {
-			uint8_t id_buf[512];	// need to read the LBA
-			const uint32_t lba_id = pte->lba_start + BYTES_TO_LBA(0x7E00);
-
+		for (unsigned int j = 0; j < entry->pt_count; j++, pte++) {
 			// Read the last LBA of the partition header.
+			slot.pte = pte;
+			slot.lba = pte->lba_start + BYTES_TO_LBA(0x7E00);
+			slot.id_offset = 256;
 			errno = 0;
-			lba_size = reader->read(id_buf, lba_id, BYTES_TO_LBA(sizeof(id_buf)));
-			if (lba_size != BYTES_TO_LBA(sizeof(id_buf))) {
-				// Read error.
-				err = errno;
-				if (err == 0) {
-					err = EIO;
-				}
-				errno = err;
-				return -err;
+			if (reader->read(slot.buf, slot.lba, 1) != 1) {
+				rets[i] = ioError();
+				break;
 			}
 
 			// Only if this area is empty!
-			if (!isBlockEmpty(&id_buf[256], 256))
+			if (!isBlockEmpty(&slot.buf[slot.id_offset], 256))
 				continue;
 
-			// Write the identifier.
-			char ptid_buf[24];
-			snprintf(ptid_buf, sizeof(ptid_buf), "%up%u -> %up%u",
+			snprintf(slot.extra, sizeof(slot.extra), "%up%u -> %up%u",
 				pte->vg, pte->pt_orig,
 				pte->vg, pte->pt);
-			rvth_create_id(&id_buf[256], 256, &gcn, ptid_buf);
+			slot.lba_abs = reader->lba_start() + slot.lba;
+			slots.push_back(slot);
+		}
+	}
 
-			// Write the updated LBA.
-			errno = 0;
-			lba_size = reader->write(id_buf, lba_id, BYTES_TO_LBA(sizeof(id_buf)));
-			if (lba_size != BYTES_TO_LBA(sizeof(id_buf))) {
-				// Write error.
-				err = errno;
-				if (err == 0) {
-					err = EIO;
-					errno = err;
-				}
-				return -err;
-			}
-			reader->flush();
+	// Create the identifiers.
+	// The RSA encryption is the slow part, so it's done in parallel.
+	// Each worker only writes to its own slots.
+	vector<int> slot_rets(slots.size(), 0);
+	std::atomic<size_t> next(0);
+	auto worker_fn = [&]() {
+		size_t i;
+		while ((i = next.fetch_add(1, std::memory_order_relaxed)) < slots.size()) {
+			IDSlot &slot = slots[i];
+			slot_rets[i] = rvth_create_id(&slot.buf[slot.id_offset], 256, &gcn[slot.job],
+				(slot.extra[0] != 0 ? slot.extra : nullptr));
+		}
+	};
+
+	ThreadPool::instance().run(static_cast<unsigned int>(std::min<size_t>(slots.size(), UINT_MAX)), worker_fn);
+
+	// Don't write anything to a bank if any of its identifiers failed.
+	for (size_t i = 0; i < slots.size(); i++) {
+		if (slot_rets[i] != 0 && rets[slots[i].job] == 0) {
+			rets[slots[i].job] = slot_rets[i];
 		}
 	}
 
+	// Write the identifiers in LBA order, so the device is written sequentially.
+	vector<size_t> order(slots.size());
+	for (size_t i = 0; i < order.size(); i++) {
+		order[i] = i;
+	}
+	std::sort(order.begin(), order.end(), [&slots](size_t a, size_t b) {
+		return slots[a].lba_abs < slots[b].lba_abs;
+	});
+
+	bool written = false;
+	for (size_t i : order) {
+		const IDSlot &slot = slots[i];
+		if (rets[slot.job] != 0) {
+			continue;
+		}
+
+		RvtH_BankEntry *const entry = getBankEntry(banks[slot.job]);
+		if (slot.pte) {
+			// This is part of the partition header, so the cached copy is discarded.
+			rvth_ptbl_set_header(entry, slot.pte, nullptr);
+		}
+		errno = 0;
+		if (entry->reader->write(slot.buf, slot.lba, 1) != 1) {
+			// Write error.
+			rets[slot.job] = ioError();
+			continue;
+		}
+		written = true;
+	}
+
+	if (written) {
+		// Flush everything at once.
+		// HDD banks share the device, so it only needs to be flushed once.
+		if (isHDD()) {
+			m_file->sync();
+		} else {
+			m_entries[0].reader->sync();
+		}
+	}
+
+	ret = 0;
+	for (unsigned int i = 0; i < count; i++) {
+		if (results) {
+			results[i] = rets[i];
+		}
+		if (ret == 0 && rets[i] != 0) {
+			ret = rets[i];
+		}
+	}
+	if (ret < 0) {
+		errno = -ret;
+	}
 	return ret;
 }
 
+// Parameters for rebuilding partition headers.
+typedef struct _RecryptParams {
+	RVL_AES_Keys_e toKey;		// New encryption key
+	int ios_force;			// IOS version to force (-1 to use the existing IOS)
+	const GCN_DiscHeader *gcn;	// GameCube disc header (for the identifier)
+
+	// Certificates.
+	const RVL_Cert_RSA2048 *cert_ticket;
+	const RVL_Cert_RSA4096_RSA2048 *cert_CA;
+	const RVL_Cert_RSA2048 *cert_TMD;
+	const char *issuer_TMD;
+} RecryptParams;
+
+/**
+ * Rebuild a partition header using a new encryption key.
+ *
+ * This function doesn't touch any shared state, so it can be
+ * called from multiple threads.
+ *
+ * @param params	[in] Recryption parameters
+ * @param pte		[in] Partition table entry
+ * @param hdr_orig	[in] Original partition header
+ * @param hdr_new	[out] Rebuilt partition header
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+static int rvth_recrypt_partition_header(const RecryptParams *params,
+	const pt_entry_t *pte, const RVL_PartitionHeader *hdr_orig,
+	RVL_PartitionHeader *hdr_new)
+{
+	int ret;
+	uint32_t data_pos;		// Current position in hdr_new->u8[].
+	uint32_t tmd_size, tmd_offset_orig;
+	RVL_TMD_Header *tmdHeader;
+	uint32_t cert_chain_size_new;
+	uint8_t *p_cert_chain;
+
+	// TODO: Check if the partition is already encrypted with the target keys.
+	// If it is, skip it.
+	memset(hdr_new, 0, sizeof(*hdr_new));
+
+	// Copy in the ticket.
+	memcpy(&hdr_new->ticket, &hdr_orig->ticket, sizeof(hdr_new->ticket));
+	// Recrypt the ticket. (This also updates the issuer.)
+	ret = sig_recrypt_ticket(&hdr_new->ticket, params->toKey);
+	if (ret != 0) {
+		// Error recrypting the ticket.
+		return (ret < 0 ? ret : -EIO);
+	}
+	// Sign the ticket.
+	// TODO: Error checking.
+	// TODO: Support larger tickets.
+	if (likely(params->toKey != RVL_KEY_DEBUG)) {
+		// Retail: Fakesign the ticket.
+		// Dolphin and cIOSes ignore the signature anyway.
+		cert_fakesign_ticket((uint8_t*)&hdr_new->ticket, sizeof(hdr_new->ticket));
+	} else {
+		// Debug: Use the real signing keys.
+		// Debug IOS requires a valid signature.
+		cert_realsign_ticketOrTMD((uint8_t*)&hdr_new->ticket, sizeof(hdr_new->ticket), &rvth_privkey_RVL_dpki_ticket);
+	}
+
+	// Starting position.
+	data_pos = offsetof(RVL_PartitionHeader, data);
+	data_pos = ALIGN_BYTES(64, data_pos);
+
+	// Copy in the TMD.
+	tmd_size = be32_to_cpu(hdr_orig->tmd_size);
+	tmd_offset_orig = be32_to_cpu(hdr_orig->tmd_offset) << 2;
+	if (data_pos + tmd_size > sizeof(*hdr_new)) {
+		// Invalid...
+		return RVTH_ERROR_PARTITION_HEADER_CORRUPTED;
+	}
+	memcpy(&hdr_new->u8[data_pos], &hdr_orig->u8[tmd_offset_orig], tmd_size);
+
+	// Change the issuer.
+	tmdHeader = (RVL_TMD_Header*)&hdr_new->u8[data_pos];
+	// NOTE: MSVC Secure Overloads will change strncpy() to strncpy_s(),
+	// which doesn't clear the buffer. Hence, we'll need to explicitly
+	// clear the buffer first.
+	memset(tmdHeader->issuer, 0, sizeof(tmdHeader->issuer));
+	strncpy(tmdHeader->issuer, params->issuer_TMD, sizeof(tmdHeader->issuer));
+
+	// Change the IOS if necessary.
+	if (params->ios_force >= 3) {
+		uint32_t ios_uint = static_cast<uint32_t>(params->ios_force);
+		if (ios_uint != be32_to_cpu(tmdHeader->sys_version.lo)) {
+			tmdHeader->sys_version.lo = cpu_to_be32(ios_uint);
+		}
+	}
+
+	// Sign the TMD.
+	// TODO: Error checking.
+	if (likely(params->toKey != RVL_KEY_DEBUG)) {
+		// Retail: Fakesign the TMD.
+		// Dolphin and cIOSes ignore the signature anyway.
+		cert_fakesign_tmd(&hdr_new->u8[data_pos], tmd_size);
+	} else {
+		// Debug: Use the real signing keys.
+		// Debug IOS requires a valid signature.
+		cert_realsign_ticketOrTMD(&hdr_new->u8[data_pos], tmd_size, &rvth_privkey_RVL_dpki_tmd);
+	}
+
+	// TMD parameters.
+	hdr_new->tmd_size = hdr_orig->tmd_size;
+	hdr_new->tmd_offset = cpu_to_be32(data_pos >> 2);
+	data_pos += ALIGN_BYTES(64, tmd_size);
+
+	// Write the new certificate chain.
+	// NOTE: RVT-H images usually have a development certificate,
+	// which makes the debug cert chain 0xC40 bytes. The retail
+	// cert chain is 0xA00 bytes.
+	cert_chain_size_new = sizeof(*params->cert_ticket) + sizeof(*params->cert_CA) + sizeof(*params->cert_TMD);
+	if (data_pos + cert_chain_size_new > sizeof(*hdr_new)) {
+		// Invalid...
+		return RVTH_ERROR_PARTITION_HEADER_CORRUPTED;
+	}
+
+	// Certificate chain order for retail is Ticket, CA, TMD.
+	// TODO: Verify for debug! (and write the dev cert?)
+	// NOTE: WAD cert chain order is CA, Ticket, TMD...
+	// (CA, Ticket, TMD, Dev for debug)
+	// TODO: Verify all of this.
+	p_cert_chain = &hdr_new->u8[data_pos];
+	memcpy(p_cert_chain, params->cert_ticket, sizeof(*params->cert_ticket));
+	p_cert_chain += sizeof(*params->cert_ticket);
+	memcpy(p_cert_chain, params->cert_CA, sizeof(*params->cert_CA));
+	p_cert_chain += sizeof(*params->cert_CA);
+	memcpy(p_cert_chain, params->cert_TMD, sizeof(*params->cert_TMD));
+
+	hdr_new->cert_chain_size = cpu_to_be32(cert_chain_size_new);
+	hdr_new->cert_chain_offset = cpu_to_be32(data_pos >> 2);
+
+	// H3 table offset.
+	// Copied as-is, since we're not changing it.
+	hdr_new->h3_table_offset = hdr_orig->h3_table_offset;
+
+	// Data offset and size.
+	// TODO: If data size is 0, calculate it.
+	hdr_new->data_offset = hdr_orig->data_offset;
+	hdr_new->data_size = hdr_orig->data_size;
+
+	// Write the identifier.
+	// (Only if this area is empty!)
+	if (RvtH::isBlockEmpty(&hdr_new->data[sizeof(hdr_new->data)-256], 256)) {
+		char ptid_buf[24];
+		snprintf(ptid_buf, sizeof(ptid_buf), "%up%u -> %up%u",
+			pte->vg, pte->pt_orig,
+			pte->vg, pte->pt);
+		rvth_create_id(&hdr_new->data[sizeof(hdr_new->data)-256], 256, params->gcn, ptid_buf);
+	}
+	return 0;
+}
+
 /**
  * Re-encrypt partitions in a Wii disc image.
  *
@@ -326,6 +569,7 @@ int RvtH::recryptWiiPartitions(unsigned int bank,
 	RvtH_Progress_Callback callback, void *userdata,
 	int ios_force)
 {
+	StatsScope scope(m_stats);
 	uint32_t lba_size;
 
 	int ret = 0;	// errno or RvtH_Errors
@@ -340,14 +584,9 @@ int RvtH::recryptWiiPartitions(unsigned int bank,
 	sbuf1_t sbuf;
 	GCN_DiscHeader gcn;
 
-	// Partitions to re-encrypt.
-	// NOTE: This only contains the LBA starting address.
-	// The actual partition length is in the partition header.
-	// TODO: Unencrypted partitions will need special handling.
-	const pt_entry_t *pte;
-
 	// Callback state.
 	RvtH_Progress_State state;
+	ProgressRate rate;
 
 	if (cryptoType < RVL_CryptoType_Debug ||
 	    cryptoType >= RVL_CryptoType_MAX)
@@ -361,7 +600,7 @@ int RvtH::recryptWiiPartitions(unsigned int bank,
 	}
 
 	// Check the bank type.
-	RvtH_BankEntry *const entry = &m_entries[bank];
+	RvtH_BankEntry *const entry = getBankEntry(bank);
 	switch (entry->type) {
 		case RVTH_BankType_Wii_SL:
 		case RVTH_BankType_Wii_DL:
@@ -432,6 +671,10 @@ int RvtH::recryptWiiPartitions(unsigned int bank,
 		return ret;
 	}
 
+	// Only the partition headers are rewritten, and the title keys
+	// don't change, so the verification map is still valid afterwards.
+	BankWriteScope trackWrites(this, bank);
+
 	if (callback) {
 		// Initialize the callback state.
 		state.rvth = this;
@@ -444,6 +687,8 @@ int RvtH::recryptWiiPartitions(unsigned int bank,
 		state.type = RVTH_PROGRESS_RECRYPT;
 		state.lba_processed = 0;
 		state.lba_total = 1;
+		state.digests = nullptr;
+		rate.update(&state);
 		callback(&state, userdata);
 	}
 
@@ -503,23 +748,27 @@ int RvtH::recryptWiiPartitions(unsigned int bank,
 		issuer_TMD	= RVL_Cert_Issuers[RVL_CERT_ISSUER_DPKI_TMD];
 	}
 
-	// Process the other partitions.
-	pte = entry->ptbl;
-	for (unsigned int i = 0; i < entry->pt_count; i++, pte++) {
-		RVL_PartitionHeader hdr_orig;	// Original header
-		RVL_PartitionHeader hdr_new;	// Rebuilt header
-		uint32_t data_pos;		// Current position in hdr_new.u8[].
-		uint32_t tmd_size, tmd_offset_orig;
-		RVL_TMD_Header *tmdHeader;
-		uint32_t cert_chain_size_new;
-		uint8_t *p_cert_chain;
-
-		//uint32_t tmd_size, tmd_offset;
+	// Read all of the partition headers, rebuild them in parallel,
+	// then write them back in LBA order. This keeps the number of
+	// round trips to the RVT-H Reader to a minimum.
+	const unsigned int pt_count = entry->pt_count;
+	unique_ptr<RVL_PartitionHeader[]> hdr_orig(new RVL_PartitionHeader[pt_count]);
+	unique_ptr<RVL_PartitionHeader[]> hdr_new(new RVL_PartitionHeader[pt_count]);
+
+	// Partition indexes, sorted by starting LBA.
+	vector<unsigned int> order(pt_count);
+	for (unsigned int i = 0; i < pt_count; i++) {
+		order[i] = i;
+	}
+	std::sort(order.begin(), order.end(), [entry](unsigned int a, unsigned int b) {
+		return entry->ptbl[a].lba_start < entry->ptbl[b].lba_start;
+	});
 
-		// Read the partition header.
+	// Get the partition headers.
+	for (unsigned int i : order) {
 		errno = 0;
-		lba_size = reader->read(&hdr_orig, pte->lba_start, BYTES_TO_LBA(sizeof(hdr_orig.u8)));
-		if (lba_size != BYTES_TO_LBA(sizeof(hdr_orig))) {
+		const RVL_PartitionHeader *const hdr = rvth_ptbl_get_header(entry, &entry->ptbl[i]);
+		if (!hdr) {
 			// Read error.
 			int err = errno;
 			if (err == 0) {
@@ -528,133 +777,48 @@ int RvtH::recryptWiiPartitions(unsigned int bank,
 			}
 			return -err;
 		}
+		memcpy(&hdr_orig[i], hdr, sizeof(hdr_orig[i]));
+	}
 
-		// TODO: Check if the partition is already encrypted with the target keys.
-		// If it is, skip it.
-		memset(&hdr_new, 0, sizeof(hdr_new));
-
-		// Copy in the ticket.
-		memcpy(&hdr_new.ticket, &hdr_orig.ticket, sizeof(hdr_new.ticket));
-		// Recrypt the ticket. (This also updates the issuer.)
-		ret = sig_recrypt_ticket(&hdr_new.ticket, toKey);
-		if (ret != 0) {
-			// Error recrypting the ticket.
-			int err = errno;
-			if (err == 0) {
-				err = EIO;
-				errno = EIO;
-			}
-			return -err;
-		}
-		// Sign the ticket.
-		// TODO: Error checking.
-		// TODO: Support larger tickets.
-		if (likely(toKey != RVL_KEY_DEBUG)) {
-			// Retail: Fakesign the ticket.
-			// Dolphin and cIOSes ignore the signature anyway.
-			cert_fakesign_ticket((uint8_t*)&hdr_new.ticket, sizeof(hdr_new.ticket));
-		} else {
-			// Debug: Use the real signing keys.
-			// Debug IOS requires a valid signature.
-			cert_realsign_ticketOrTMD((uint8_t*)&hdr_new.ticket, sizeof(hdr_new.ticket), &rvth_privkey_RVL_dpki_ticket);
-		}
-
-		// Starting position.
-		data_pos = offsetof(RVL_PartitionHeader, data);
-		data_pos = ALIGN_BYTES(64, data_pos);
-
-		// Copy in the TMD.
-		tmd_size = be32_to_cpu(hdr_orig.tmd_size);
-		tmd_offset_orig = be32_to_cpu(hdr_orig.tmd_offset) << 2;
-		if (data_pos + tmd_size > sizeof(hdr_new)) {
-			// Invalid...
-			errno = EIO;
-			return RVTH_ERROR_PARTITION_HEADER_CORRUPTED;
-		}
-		memcpy(&hdr_new.u8[data_pos], &hdr_orig.u8[tmd_offset_orig], tmd_size);
-
-		// Change the issuer.
-		tmdHeader = (RVL_TMD_Header*)&hdr_new.u8[data_pos];
-		// NOTE: MSVC Secure Overloads will change strncpy() to strncpy_s(),
-		// which doesn't clear the buffer. Hence, we'll need to explicitly
-		// clear the buffer first.
-		memset(tmdHeader->issuer, 0, sizeof(tmdHeader->issuer));
-		strncpy(tmdHeader->issuer, issuer_TMD, sizeof(tmdHeader->issuer));
-
-		// Change the IOS if necessary.
-		if (ios_force >= 3) {
-			uint32_t ios_uint = static_cast<uint32_t>(ios_force);
-			if (ios_uint != be32_to_cpu(tmdHeader->sys_version.lo)) {
-				tmdHeader->sys_version.lo = cpu_to_be32(ios_uint);
-			}
-		}
-
-		// Sign the TMD.
-		// TODO: Error checking.
-		if (likely(toKey != RVL_KEY_DEBUG)) {
-			// Retail: Fakesign the TMD.
-			// Dolphin and cIOSes ignore the signature anyway.
-			cert_fakesign_tmd(&hdr_new.u8[data_pos], tmd_size);
-		} else {
-			// Debug: Use the real signing keys.
-			// Debug IOS requires a valid signature.
-			cert_realsign_ticketOrTMD(&hdr_new.u8[data_pos], tmd_size, &rvth_privkey_RVL_dpki_tmd);
+	// Rebuild the partition headers.
+	// Signing is the slow part, so each partition is handled by a
+	// separate worker. Each worker only writes to its own header.
+	RecryptParams params;
+	params.toKey = toKey;
+	params.ios_force = ios_force;
+	params.gcn = &gcn;
+	params.cert_ticket = cert_ticket;
+	params.cert_CA = cert_CA;
+	params.cert_TMD = cert_TMD;
+	params.issuer_TMD = issuer_TMD;
+
+	vector<int> rets(pt_count, 0);
+	std::atomic<unsigned int> next(0);
+	auto worker_fn = [&]() {
+		unsigned int i;
+		while ((i = next.fetch_add(1, std::memory_order_relaxed)) < pt_count) {
+			rets[i] = rvth_recrypt_partition_header(&params,
+				&entry->ptbl[i], &hdr_orig[i], &hdr_new[i]);
 		}
+	};
 
-		// TMD parameters.
-		hdr_new.tmd_size = hdr_orig.tmd_size;
-		hdr_new.tmd_offset = cpu_to_be32(data_pos >> 2);
-		data_pos += ALIGN_BYTES(64, tmd_size);
-
-		// Write the new certificate chain.
-		// NOTE: RVT-H images usually have a development certificate,
-		// which makes the debug cert chain 0xC40 bytes. The retail
-		// cert chain is 0xA00 bytes.
-		cert_chain_size_new = sizeof(*cert_ticket) + sizeof(*cert_CA) + sizeof(*cert_TMD);
-		if (data_pos + cert_chain_size_new > sizeof(hdr_new)) {
-			// Invalid...
-			errno = EIO;
-			return RVTH_ERROR_PARTITION_HEADER_CORRUPTED;
-		}
+	ThreadPool::instance().run(pt_count, worker_fn);
 
-		// Certificate chain order for retail is Ticket, CA, TMD.
-		// TODO: Verify for debug! (and write the dev cert?)
-		// NOTE: WAD cert chain order is CA, Ticket, TMD...
-		// (CA, Ticket, TMD, Dev for debug)
-		// TODO: Verify all of this.
-		p_cert_chain = &hdr_new.u8[data_pos];
-		memcpy(p_cert_chain, cert_ticket, sizeof(*cert_ticket));
-		p_cert_chain += sizeof(*cert_ticket);
-		memcpy(p_cert_chain, cert_CA, sizeof(*cert_CA));
-		p_cert_chain += sizeof(*cert_CA);
-		memcpy(p_cert_chain, cert_TMD, sizeof(*cert_TMD));
-
-		hdr_new.cert_chain_size = cpu_to_be32(cert_chain_size_new);
-		hdr_new.cert_chain_offset = cpu_to_be32(data_pos >> 2);
-
-		// H3 table offset.
-		// Copied as-is, since we're not changing it.
-		hdr_new.h3_table_offset = hdr_orig.h3_table_offset;
-
-		// Data offset and size.
-		// TODO: If data size is 0, calculate it.
-		hdr_new.data_offset = hdr_orig.data_offset;
-		hdr_new.data_size = hdr_orig.data_size;
-
-		// Write the identifier.
-		// (Only if this area is empty!)
-		if (isBlockEmpty(&hdr_new.data[sizeof(hdr_new.data)-256], 256)) {
-			char ptid_buf[24];
-			snprintf(ptid_buf, sizeof(ptid_buf), "%up%u -> %up%u",
-				pte->vg, pte->pt_orig,
-				pte->vg, pte->pt);
-			rvth_create_id(&hdr_new.data[sizeof(hdr_new.data)-256], 256, &gcn, ptid_buf);
+	// Don't write anything if any of the partitions failed.
+	for (unsigned int i = 0; i < pt_count; i++) {
+		if (rets[i] != 0) {
+			errno = (rets[i] < 0 ? -rets[i] : EIO);
+			return rets[i];
 		}
+	}
 
-		// Write the new partition header.
+	// Write the new partition headers.
+	// The cached partition headers are updated as they're written.
+	for (unsigned int i : order) {
 		errno = 0;
-		lba_size = reader->write(&hdr_new, pte->lba_start, BYTES_TO_LBA(sizeof(hdr_new.u8)));
-		if (lba_size != BYTES_TO_LBA(sizeof(hdr_new))) {
+		rvth_ptbl_set_header(entry, &entry->ptbl[i], nullptr);
+		lba_size = reader->write(&hdr_new[i], entry->ptbl[i].lba_start, BYTES_TO_LBA(sizeof(hdr_new[i].u8)));
+		if (lba_size != BYTES_TO_LBA(sizeof(hdr_new[i]))) {
 			// Write error.
 			int err = errno;
 			if (err == 0) {
@@ -663,6 +827,7 @@ int RvtH::recryptWiiPartitions(unsigned int bank,
 			}
 			return -err;
 		}
+		rvth_ptbl_set_header(entry, &entry->ptbl[i], &hdr_new[i]);
 	}
 
 	// Update the bank entry.
@@ -725,10 +890,11 @@ int RvtH::recryptWiiPartitions(unsigned int bank,
 	}
 
 	// Finished processing the disc image.
-	reader->flush();
+	reader->sync();
 
 	if (callback) {
 		state.lba_processed = 1;
+		rate.update(&state);
 		callback(&state, userdata);
 	}
 
@@ -0,0 +1,575 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * repair.cpp: Repair the hash trees of encrypted Wii partitions.          *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "rvth.hpp"
+#include "ptbl.h"
+#include "rvth_error.h"
+#include "StatsCounters.hpp"
+#include "ThreadPool.hpp"
+#include "Trace.hpp"
+#include "zero_scan.h"
+
+// Reader class
+#include "reader/Reader.hpp"
+
+// Buffer pool
+#include "BufferPool.hpp"
+
+// Progress callback throttling
+#include "ProgressRate.hpp"
+#include "ProgressThrottle.hpp"
+
+// libwiicrypto
+#include "libwiicrypto/cert.h"
+#include "libwiicrypto/priv_key_store.h"
+#include "libwiicrypto/wii_sector.h"
+#include "libwiicrypto/wii_structs.h"
+#include "libwiicrypto/wii_hash_tree.h"
+
+// Encryption
+#include "aesw.h"
+#include <nettle/sha1.h>
+
+#include "byteswap.h"
+
+// C includes (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+// C++ includes
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+using std::vector;
+
+// Number of LBAs in an encrypted group.
+#define LBAS_PER_GROUP BYTES_TO_LBA(GROUP_SIZE_ENC)
+// Number of LBAs in an encrypted sector.
+#define LBAS_PER_SECTOR BYTES_TO_LBA(SECTOR_SIZE_ENC)
+
+// Maximum number of repair worker threads.
+#define REPAIR_MAX_THREADS 16
+
+/**
+ * Repair the hash tree of a group.
+ *
+ * The user data is decrypted, the H0-H2 tables are rebuilt from it,
+ * and the sectors whose hash tables changed are encrypted again.
+ * Sectors past max_sector are treated as zeroes, like the padding
+ * of the last group when encrypting an unencrypted image.
+ *
+ * This function doesn't touch any shared state, so it can be
+ * called from multiple threads as long as each thread has its
+ * own AES context and group buffers.
+ *
+ * @param aesw		[in] AES context (title key must be set)
+ * @param gdata		[in/out] Encrypted group (64 sectors); repaired sectors are encrypted on return
+ * @param gwork		[out] Work buffer (64 sectors)
+ * @param max_sector	[in] Number of sectors in the group
+ * @param pH3		[out] H3 hash for this group
+ * @return Bitfield of sectors that were changed. (bit 0 == first sector)
+ */
+static uint64_t repair_group(AesCtx *aesw,
+	Wii_Disc_Sector_t *gdata, Wii_Disc_Sector_t *gwork,
+	unsigned int max_sector, uint8_t pH3[SHA1_DIGEST_SIZE])
+{
+	RVTH_TRACE_SPAN_BYTES("repair_group", max_sector * sizeof(Wii_Disc_Sector_t));
+
+	const uint8_t *pIV[64];
+	uint8_t *pData[64];
+	uint8_t iv[16];
+	unsigned int i;
+
+	// Decrypt the user data and the hash tables into the work buffer.
+	// The user data IV is stored within the encrypted H2 table.
+	memcpy(gwork, gdata, max_sector * sizeof(Wii_Disc_Sector_t));
+	{
+		StatsTimer timer(StatsCounters::TIMER_AES);
+		for (i = 0; i < max_sector; i++) {
+			pIV[i] = &gdata[i].hashes.H2[7][4];
+			pData[i] = gwork[i].data;
+		}
+		aesw_decrypt_multi(aesw, pIV, pData, sizeof(gwork[0].data), max_sector);
+
+		memset(iv, 0, sizeof(iv));
+		for (i = 0; i < max_sector; i++) {
+			pIV[i] = iv;
+			pData[i] = reinterpret_cast<uint8_t*>(&gwork[i].hashes);
+		}
+		aesw_decrypt_multi(aesw, pIV, pData, sizeof(gwork[0].hashes), max_sector);
+	}
+	for (i = max_sector; i < 64; i++) {
+		memset(&gwork[i], 0, sizeof(gwork[i]));
+	}
+
+	// Rebuild the hash tables in gdata, keeping the
+	// stored hash tables in gwork for comparison.
+	for (i = 0; i < 64; i++) {
+		memcpy(gdata[i].data, gwork[i].data, sizeof(gdata[i].data));
+	}
+	{
+		StatsTimer timer(StatsCounters::TIMER_SHA1);
+		wii_hash_tree_build_group(gdata, pH3);
+	}
+
+	// Find the sectors whose hash tables changed.
+	uint64_t changed = 0;
+	unsigned int count = 0;
+	for (i = 0; i < max_sector; i++) {
+		if (memcmp(&gdata[i].hashes, &gwork[i].hashes, sizeof(gdata[i].hashes)) != 0) {
+			changed |= (1ULL << i);
+			pData[count++] = reinterpret_cast<uint8_t*>(&gdata[i].hashes);
+		}
+	}
+	if (count == 0) {
+		return 0;
+	}
+
+	// Encrypt the changed sectors. (hashes first, since the
+	// user data IV is taken from the encrypted H2 table)
+	StatsTimer timer(StatsCounters::TIMER_AES);
+	for (i = 0; i < count; i++) {
+		pIV[i] = iv;
+	}
+	aesw_encrypt_multi(aesw, pIV, pData, sizeof(gdata[0].hashes), count);
+	count = 0;
+	for (i = 0; i < max_sector; i++) {
+		if (changed & (1ULL << i)) {
+			pIV[count] = &gdata[i].hashes.H2[7][4];
+			pData[count] = gdata[i].data;
+			count++;
+		}
+	}
+	aesw_encrypt_multi(aesw, pIV, pData, sizeof(gdata[0].data), count);
+	return changed;
+}
+
+/**
+ * Get the TMD from a partition header.
+ * @param pt_hdr	[in] Partition header
+ * @param pTmdSize	[out] TMD size
+ * @return TMD, or nullptr if the TMD is invalid.
+ */
+static uint8_t *get_tmd(RVL_PartitionHeader *pt_hdr, unsigned int *pTmdSize)
+{
+	// TMD must be located within the partition header,
+	// and it must have exactly one content entry.
+	const unsigned int tmd_offset = be32_to_cpu(pt_hdr->tmd_offset) << 2;
+	const unsigned int tmd_size = be32_to_cpu(pt_hdr->tmd_size);
+	if (tmd_offset == 0 || tmd_offset >= sizeof(*pt_hdr) ||
+	    tmd_size < (sizeof(RVL_TMD_Header) + sizeof(RVL_Content_Entry)) ||
+	    tmd_size > sizeof(*pt_hdr) - tmd_offset)
+	{
+		return nullptr;
+	}
+	const RVL_TMD_Header *const pTmd = reinterpret_cast<const RVL_TMD_Header*>(&pt_hdr->u8[tmd_offset]);
+	if (pTmd->nbr_cont != cpu_to_be16(1)) {
+		return nullptr;
+	}
+	*pTmdSize = tmd_size;
+	return &pt_hdr->u8[tmd_offset];
+}
+
+/**
+ * Repair the hash trees of the encrypted partitions in a Wii bank.
+ *
+ * This is used after patching the user data of an image, e.g. with a
+ * hex editor, which leaves the hash tables stale. The user data is
+ * assumed to be correct. For each group, the H0-H2 tables are rebuilt
+ * from the decrypted user data, and only the sectors whose hash tables
+ * changed are encrypted again and written back. The H3 table and the
+ * TMD content hash (H4) are updated if they changed, and the TMD is
+ * signed again. (debug signature for debug TMDs; fakesigned otherwise)
+ *
+ * Groups are repaired on the thread pool. Groups that are all zeroes,
+ * e.g. in scrubbed images, can't be repaired and are skipped.
+ *
+ * @param bank		[in] Bank number (0-7)
+ * @param result	[out,opt] Repair result
+ * @param callback	[in,opt] Progress callback
+ * @param userdata	[in,opt] User data for progress callback
+ * @param threads	[in,opt] Number of worker threads (0 for auto; 1 for single-threaded)
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.) [-ECANCELED if cancelled]
+ */
+int RvtH::repairWiiPartitions(unsigned int bank, RvtH_Repair_Result *result,
+	RvtH_Progress_Callback callback, void *userdata,
+	unsigned int threads)
+{
+	StatsScope scope(m_stats);
+	RvtH_Repair_Result local_result;
+	if (!result) {
+		result = &local_result;
+	}
+	memset(result, 0, sizeof(*result));
+
+	if (bank >= m_bankCount) {
+		// Bank number is out of range.
+		errno = ERANGE;
+		return -ERANGE;
+	}
+
+	// Make sure this is an encrypted Wii disc.
+	RvtH_BankEntry *const entry = getBankEntry(bank);
+	switch (entry->type) {
+		case RVTH_BankType_Wii_SL:
+		case RVTH_BankType_Wii_DL:
+			// Repair is possible.
+			break;
+
+		case RVTH_BankType_Unknown:
+		default:
+			// Unknown bank status...
+			return RVTH_ERROR_BANK_UNKNOWN;
+
+		case RVTH_BankType_Empty:
+			// Bank is empty.
+			return RVTH_ERROR_BANK_EMPTY;
+
+		case RVTH_BankType_GCN:
+			// Operation is not supported for GCN images.
+			return RVTH_ERROR_NOT_WII_IMAGE;
+
+		case RVTH_BankType_Wii_DL_Bank2:
+			// Second bank of a dual-layer Wii disc image.
+			// TODO: Automatically select the first bank?
+			return RVTH_ERROR_BANK_DL_2;
+	}
+	if (entry->crypto_type <= RVL_CryptoType_None ||
+	    entry->crypto_type >= RVL_CryptoType_MAX)
+	{
+		// Not encrypted.
+		return RVTH_ERROR_IS_UNENCRYPTED;
+	}
+
+	// Make sure the partition table is loaded.
+	int ret = rvth_ptbl_load(entry);
+	if (ret != 0 || entry->pt_count == 0 || !entry->ptbl) {
+		// Unable to load the partition table.
+		errno = -ret;
+		return ret;
+	}
+
+	// Make the RVT-H object writable.
+	// Plain disc images can be repaired in place, since
+	// only the existing sectors are rewritten.
+	Reader *const reader = entry->reader;
+	if (!isHDD() && reader->type() == RVTH_ImageType_GCM) {
+		ret = m_file->makeWritable();
+	} else {
+		ret = this->makeWritable();
+	}
+	if (ret != 0) {
+		// Could not make the RVT-H object writable.
+		errno = (ret < 0 ? -ret : EROFS);
+		return ret;
+	}
+
+	// Determine the number of worker threads.
+	if (threads == 0) {
+		threads = std::thread::hardware_concurrency();
+		if (threads == 0) {
+			threads = 1;
+		}
+	}
+	if (threads > REPAIR_MAX_THREADS) {
+		threads = REPAIR_MAX_THREADS;
+	}
+	ThreadPool::Reservation cpus(threads);
+	threads = cpus.count();
+	// Each worker has an encrypted group and a work buffer.
+	threads = budgetThreads(threads, 2 * GROUP_SIZE_ENC);
+
+	// Partition header and H3 table buffers.
+	PoolBuffer pt_hdr_buf(sizeof(RVL_PartitionHeader));
+	PoolBuffer H3_buf(sizeof(Wii_Disc_H3_t));
+	if (!pt_hdr_buf || !H3_buf) {
+		errno = ENOMEM;
+		return -ENOMEM;
+	}
+	RVL_PartitionHeader *const pt_hdr = pt_hdr_buf.as<RVL_PartitionHeader>();
+	Wii_Disc_H3_t *const H3_tbl = H3_buf.as<Wii_Disc_H3_t>();
+	static const uint32_t pt_hdr_lba_len = BYTES_TO_LBA(sizeof(RVL_PartitionHeader));
+	static const uint32_t h3_lba_len = BYTES_TO_LBA(sizeof(Wii_Disc_H3_t));
+
+	// Callback state.
+	// Progress is counted in groups, across all partitions.
+	RvtH_Progress_State state;
+	ProgressRate rate;
+	ProgressThrottle throttle(&m_progressParams);
+	if (callback) {
+		uint64_t lba_total = 0;
+		for (unsigned int pt_idx = 0; pt_idx < entry->pt_count; pt_idx++) {
+			lba_total += entry->ptbl[pt_idx].lba_len;
+		}
+		state.rvth = this;
+		state.rvth_gcm = nullptr;
+		state.bank_rvth = bank;
+		state.bank_gcm = ~0U;
+		state.type = RVTH_PROGRESS_REPAIR;
+		state.lba_processed = 0;
+		state.lba_total = static_cast<uint32_t>(std::min<uint64_t>(lba_total, UINT32_MAX));
+		state.digests = nullptr;
+	}
+	uint32_t lba_done = 0;	// LBAs processed in previous partitions
+
+	for (unsigned int pt_idx = 0; pt_idx < entry->pt_count && ret == 0; pt_idx++) {
+		const pt_entry_t *const pte = &entry->ptbl[pt_idx];
+
+		// Get the partition header.
+		{
+			errno = 0;
+			const RVL_PartitionHeader *const hdr = rvth_ptbl_get_header(entry, pte);
+			if (!hdr) {
+				const int err = (errno != 0 ? errno : EIO);
+				errno = err;
+				return -err;
+			}
+			memcpy(pt_hdr, hdr, sizeof(*pt_hdr));
+		}
+		unsigned int tmd_size = 0;
+		uint8_t *const tmd = get_tmd(pt_hdr, &tmd_size);
+		if (!tmd) {
+			errno = EIO;
+			return RVTH_ERROR_PARTITION_HEADER_CORRUPTED;
+		}
+
+		// Decrypt the title key.
+		uint8_t title_key[16];
+		uint8_t crypto_type;
+		ret = decryptTitleKey(&pt_hdr->ticket, title_key, &crypto_type);
+		if (ret != 0) {
+			return ret;
+		}
+
+		// Read the H3 table.
+		const uint32_t h3_tbl_lba = BYTES_TO_LBA(be32_to_cpu(pt_hdr->h3_table_offset) << 2);
+		const uint32_t data_lba = BYTES_TO_LBA(static_cast<uint64_t>(be32_to_cpu(pt_hdr->data_offset)) << 2);
+		if (h3_tbl_lba < pt_hdr_lba_len || h3_tbl_lba + h3_lba_len > pte->lba_len ||
+		    data_lba < pt_hdr_lba_len || data_lba >= pte->lba_len)
+		{
+			errno = EIO;
+			return RVTH_ERROR_PARTITION_HEADER_CORRUPTED;
+		}
+		errno = 0;
+		if (reader->read(H3_tbl, pte->lba_start + h3_tbl_lba, h3_lba_len) != h3_lba_len) {
+			const int err = (errno != 0 ? errno : EIO);
+			errno = err;
+			return -err;
+		}
+
+		// Determine the number of groups. The data size in the partition
+		// header is used if it's set, as in verifyWiiPartitions().
+		uint32_t lba_data_len = pte->lba_len - data_lba;
+		if (pt_hdr->data_size != 0) {
+			const uint64_t data_size = static_cast<uint64_t>(be32_to_cpu(pt_hdr->data_size)) << 2;
+			lba_data_len = static_cast<uint32_t>(std::min<uint64_t>(lba_data_len, BYTES_TO_LBA(data_size)));
+		}
+		const unsigned int group_count = std::min<unsigned int>(
+			(lba_data_len + LBAS_PER_GROUP - 1) / LBAS_PER_GROUP,
+			ARRAY_SIZE(H3_tbl->h3));
+		const uint32_t lba_data_start = pte->lba_start + data_lba;
+
+		// Repair the groups.
+		// Reads and writes go through one Reader, so they're
+		// serialized; decryption and hashing run in parallel.
+		std::mutex io_mutex;
+		std::atomic<unsigned int> next(0);
+		std::atomic<bool> h3_changed(false);
+		std::atomic<bool> stop(false);
+		std::atomic<unsigned int> groups_checked(0), groups_skipped(0);
+		std::atomic<unsigned int> groups_repaired(0), sectors_written(0);
+		int worker_err = 0;	// protected by io_mutex
+
+		auto worker_fn = [&]() {
+			StatsScope scope(m_stats);
+			PoolBuffer gbuf(GROUP_SIZE_ENC), wbuf(GROUP_SIZE_ENC);
+			AesCtx *const aesw = aesw_new();
+			int err = 0;
+			if (!gbuf || !wbuf || !aesw) {
+				err = -ENOMEM;
+			} else {
+				aesw_set_key(aesw, title_key, sizeof(title_key));
+			}
+
+			Wii_Disc_Sector_t *const gdata = gbuf.as<Wii_Disc_Sector_t>();
+			Wii_Disc_Sector_t *const gwork = wbuf.as<Wii_Disc_Sector_t>();
+			unsigned int g;
+			while (err == 0 && !stop.load(std::memory_order_relaxed) &&
+			       (g = next.fetch_add(1, std::memory_order_relaxed)) < group_count)
+			{
+				if (StatsCounters::cancelled()) {
+					err = -ECANCELED;
+					break;
+				}
+
+				const uint32_t lba_group = g * LBAS_PER_GROUP;
+				const uint32_t lba_len = std::min<uint32_t>(LBAS_PER_GROUP, lba_data_len - lba_group);
+				const unsigned int max_sector = lba_len / LBAS_PER_SECTOR;
+				if (max_sector == 0) {
+					groups_skipped++;
+					continue;
+				}
+
+				{
+					std::lock_guard<std::mutex> lock(io_mutex);
+					errno = 0;
+					if (reader->read(gdata, lba_data_start + lba_group, lba_len) != lba_len) {
+						err = (errno != 0 ? -errno : -EIO);
+						break;
+					}
+				}
+
+				bool is_zero;
+				{
+					StatsTimer timer(StatsCounters::TIMER_ZERO_SCAN);
+					is_zero = rvth_is_zero(reinterpret_cast<const uint8_t*>(gdata),
+						max_sector * sizeof(Wii_Disc_Sector_t));
+				}
+				if (is_zero) {
+					// Not present in the image.
+					groups_skipped++;
+					continue;
+				}
+
+				uint8_t H3[SHA1_DIGEST_SIZE];
+				const uint64_t changed = repair_group(aesw, gdata, gwork, max_sector, H3);
+				const bool h3_differs = (memcmp(H3_tbl->h3[g], H3, sizeof(H3)) != 0);
+				groups_checked++;
+				if (changed != 0 || h3_differs) {
+					// The group has to be verified again.
+					markBankWritten(bank, lba_data_start + lba_group, lba_len);
+				}
+				if (h3_differs) {
+					// Each group has its own H3 table entry,
+					// so no locking is needed here.
+					memcpy(H3_tbl->h3[g], H3, sizeof(H3));
+					h3_changed = true;
+				}
+				if (changed == 0) {
+					if (h3_differs) {
+						groups_repaired++;
+					}
+					continue;
+				}
+				groups_repaired++;
+
+				// Write back runs of changed sectors.
+				std::lock_guard<std::mutex> lock(io_mutex);
+				for (unsigned int i = 0; i < max_sector && err == 0; ) {
+					if (!(changed & (1ULL << i))) {
+						i++;
+						continue;
+					}
+					unsigned int j = i + 1;
+					while (j < max_sector && (changed & (1ULL << j))) {
+						j++;
+					}
+					const uint32_t lba_count = (j - i) * LBAS_PER_SECTOR;
+					errno = 0;
+					if (reader->write(&gdata[i], lba_data_start + lba_group + (i * LBAS_PER_SECTOR), lba_count) != lba_count) {
+						err = (errno != 0 ? -errno : -EIO);
+						break;
+					}
+					sectors_written += (j - i);
+					i = j;
+				}
+				if (err != 0)
+					break;
+
+				if (callback && throttle.ready(LBA_TO_BYTES(static_cast<uint64_t>(lba_done) + lba_group))) {
+					state.lba_processed = lba_done + lba_group;
+					rate.update(&state);
+					if (!callback(&state, userdata)) {
+						err = -ECANCELED;
+					}
+				}
+			}
+
+			aesw_free(aesw);
+			if (err != 0) {
+				std::lock_guard<std::mutex> lock(io_mutex);
+				if (worker_err == 0) {
+					worker_err = err;
+				}
+				stop = true;
+			}
+		};
+
+		ThreadPool::instance().run(std::min(threads, std::max(group_count, 1U)), worker_fn);
+
+		result->groups_checked += groups_checked;
+		result->groups_skipped += groups_skipped;
+		result->groups_repaired += groups_repaired;
+		result->sectors_written += sectors_written;
+		if (worker_err != 0) {
+			reader->sync();
+			errno = -worker_err;
+			return worker_err;
+		}
+		lba_done += pte->lba_len;
+
+		// Update the H3 table and the TMD content hash (H4).
+		RVL_Content_Entry *const content = reinterpret_cast<RVL_Content_Entry*>(tmd + sizeof(RVL_TMD_Header));
+		uint8_t H4[SHA1_DIGEST_SIZE];
+		struct sha1_ctx sha1;
+		sha1_init(&sha1);
+		sha1_update(&sha1, sizeof(*H3_tbl), reinterpret_cast<const uint8_t*>(H3_tbl));
+		sha1_digest(&sha1, sizeof(H4), H4);
+		if (!h3_changed && !memcmp(content->sha1_hash, H4, sizeof(H4))) {
+			// Hash tree is correct.
+			continue;
+		}
+
+		if (h3_changed) {
+			errno = 0;
+			if (reader->write(H3_tbl, pte->lba_start + h3_tbl_lba, h3_lba_len) != h3_lba_len) {
+				const int err = (errno != 0 ? errno : EIO);
+				errno = err;
+				return -err;
+			}
+		}
+		memcpy(content->sha1_hash, H4, sizeof(H4));
+		if (entry->tmd.sig_type == RVL_SigType_Debug) {
+			// Debug IOS requires a valid signature.
+			cert_realsign_ticketOrTMD(tmd, tmd_size, &rvth_privkey_RVL_dpki_tmd);
+		} else {
+			// Retail: Fakesign the TMD.
+			cert_fakesign_tmd(tmd, tmd_size);
+		}
+
+		// Write the partition header.
+		// The cached partition header is updated once it's written.
+		rvth_ptbl_set_header(entry, pte, nullptr);
+		errno = 0;
+		if (reader->write(pt_hdr, pte->lba_start, pt_hdr_lba_len) != pt_hdr_lba_len) {
+			const int err = (errno != 0 ? errno : EIO);
+			errno = err;
+			return -err;
+		}
+		rvth_ptbl_set_header(entry, pte, pt_hdr);
+		result->partitions_updated++;
+	}
+
+	if (result->partitions_updated > 0) {
+		entry->tmd.sig_status = (entry->tmd.sig_type == RVL_SigType_Debug
+			? RVL_SigStatus_OK : RVL_SigStatus_Fake);
+	}
+
+	// Finished repairing the bank.
+	reader->sync();
+
+	if (callback) {
+		state.lba_processed = state.lba_total;
+		rate.update(&state);
+		callback(&state, userdata);
+	}
+	return 0;
+}
@@ -2,7 +2,7 @@
  * RVT-H Tool (librvth)                                                    *
  * rvth.cpp: RVT-H image handler.                                          *
  *                                                                         *
- * Copyright (c) 2018-2022 by David Korth.                                 *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
@@ -12,8 +12,18 @@
 #include "disc_header.hpp"
 #include "ptbl.h"
 #include "bank_init.h"
+#include "BankCache.hpp"
+#include "VerifyCache.hpp"
+#include "VerifyMap.hpp"
+#include "TitleKeyStore.hpp"
+#include "ThreadPool.hpp"
+#include "StatsCounters.hpp"
+#include "Trace.hpp"
 #include "rvth_error.h"
 #include "reader/Reader.hpp"
+#include "reader/CachedReader.hpp"
+#include "reader/ProbeBuffer.hpp"
+#include "reader/WbfsReader.hpp"
 
 #include "libwiicrypto/byteswap.h"
 #include "libwiicrypto/cert.h"
@@ -28,33 +38,110 @@
 #include <stdlib.h>
 #include <string.h>
 
+// C++ includes
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+using std::lock_guard;
+using std::mutex;
+using std::vector;
+
+// Maximum number of bank initialization worker threads.
+static const unsigned int BANK_INIT_MAX_THREADS = 8;
+
+// Default block cache size for each HDD bank, in KB.
+static const unsigned int BLOCK_CACHE_DEFAULT = 1024;
+
+/**
+ * Initialize a bank entry for a standalone disc image.
+ * @param entry		[out] Bank entry.
+ * @param reader	[in] Disc image reader.
+ * @param f_img		[in] RefFile*
+ * @param probe		[in] Probe window.
+ * @param mtime		[in] Timestamp. (file mtime, without the local timezone offset)
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+static int init_BankEntry_gcm(RvtH_BankEntry *entry, Reader *reader,
+	RefFile *f_img, const ProbeBuffer &probe, time_t mtime)
+{
+	// Disc header.
+	union {
+		GCN_DiscHeader gcn;
+		uint8_t sbuf[LBA_SIZE];
+	} discHeader;
+
+	// Read the GCN disc header.
+	// NOTE: Since this is a standalone disc image, we'll just
+	// read the header directly. If it's stored as-is in the
+	// file, e.g. plain and CISO images, use the probe window.
+	off64_t offset;
+	if (!reader->fileOffset(0, 1, &offset) ||
+	    ProbeBuffer::pread(&probe, f_img, discHeader.sbuf, sizeof(discHeader.sbuf), offset) != sizeof(discHeader.sbuf))
+	{
+		int ret = reader->read(discHeader.sbuf, 0, 1);
+		if (ret < 0) {
+			// Error...
+			return ret;
+		}
+	}
+
+	// Identify the disc type.
+	uint8_t type = rvth_disc_header_identify(&discHeader.gcn);
+	if (type == RVTH_BankType_Wii_SL &&
+	    reader->lba_len() > NHCD_BANK_WII_SL_SIZE_RVTR_LBA)
+	{
+		// Dual-layer image.
+		type = RVTH_BankType_Wii_DL;
+	}
+
+	// Initialize the bank entry.
+	// NOTE: Not using rvth_init_BankEntry() here.
+	entry->lba_start = reader->lba_start();
+	entry->lba_len = reader->lba_len();
+	entry->type = type;
+	entry->is_deleted = false;
+	entry->reader = reader;
+	entry->timestamp = mtime;
+
+	if (type != RVTH_BankType_Empty) {
+		// Copy the disc header.
+		memcpy(&entry->discHeader, &discHeader.gcn, sizeof(entry->discHeader));
+
+		// TODO: Error handling.
+		// Initialize the region code, encryption status,
+		// and AppLoader error status.
+		rvth_init_BankEntry_image(entry);
+	}
+
+	return RVTH_ERROR_SUCCESS;
+}
+
 /**
  * Open a Wii or GameCube disc image.
+ *
+ * WBFS partitions can contain multiple discs.
+ * Each disc is opened as a separate bank.
+ *
  * @param f_img	[in] RefFile*
  * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
  */
 int RvtH::openGcm(RefFile *f_img)
 {
-	RvtH_BankEntry *entry;
 	int ret = 0;	// errno or RvtH_Errors
 	int err = 0;	// errno setting
 
-	Reader *reader = nullptr;
+	vector<Reader*> readers;
+	ProbeBuffer probe;
 	off64_t len;
-	uint8_t type;
-
-	// Disc header.
-	union {
-		GCN_DiscHeader gcn;
-		uint8_t sbuf[LBA_SIZE];
-	} discHeader;
+	time_t mtime;
 
 	// Get the file length.
 	// FIXME: This is obtained in rvth_open().
 	// Pass it as a parameter?
-	ret = f_img->seeko(0, SEEK_END);
-	if (ret != 0) {
-		// Seek error.
+	len = f_img->size();
+	if (len < 0) {
+		// Unable to get the file size.
 		err = errno;
 		if (err == 0) {
 			err = EIO;
@@ -62,52 +149,41 @@ int RvtH::openGcm(RefFile *f_img)
 		ret = -err;
 		goto fail;
 	}
-	len = f_img->tello();
 
-	// Rewind back to the beginning of the file.
-	ret = f_img->seeko(0, SEEK_SET);
+	// Read the start of the file once. The format checks, the
+	// container headers, and usually the disc header are all
+	// parsed from this probe window.
+	ret = probe.read(f_img, 0);
 	if (ret != 0) {
-		// Seek error.
-		err = errno;
-		if (err == 0) {
-			err = EIO;
-		}
-		ret = -err;
+		// Read error.
+		err = -ret;
 		goto fail;
 	}
 
-	// Initialize the disc image reader.
+	// Initialize the disc image reader(s).
 	// We need to do this before anything else in order to
 	// handle CISO and WBFS images.
-	reader = Reader::open(f_img, 0, BYTES_TO_LBA(len));
-	if (!reader) {
-		// Unable to open the reader.
-		goto fail;
-	}
-
-	// Read the GCN disc header.
-	// NOTE: Since this is a standalone disc image, we'll just
-	// read the header directly.
-	ret = reader->read(discHeader.sbuf, 0, 1);
-	if (ret < 0) {
-		// Error...
-		err = -ret;
-		goto fail;
-	}
-
-	// Identify the disc type.
-	type = rvth_disc_header_identify(&discHeader.gcn);
-	if (type == RVTH_BankType_Wii_SL &&
-	    reader->lba_len() > NHCD_BANK_WII_SL_SIZE_RVTR_LBA)
-	{
-		// Dual-layer image.
-		type = RVTH_BankType_Wii_DL;
+	if (probe.size() >= LBA_SIZE && WbfsReader::isSupported(probe.data(), probe.size())) {
+		// WBFS partition. Each disc is a separate bank.
+		ret = WbfsReader::openDiscs(f_img, 0, BYTES_TO_LBA(len), &probe, readers);
+		if (ret < 0) {
+			// Unable to open the discs.
+			err = -ret;
+			goto fail;
+		}
+		ret = 0;
+	} else {
+		Reader *const reader = Reader::open(f_img, 0, BYTES_TO_LBA(len), probe);
+		if (!reader) {
+			// Unable to open the reader.
+			goto fail;
+		}
+		readers.push_back(reader);
 	}
 
-	// Allocate memory for a single RvtH_BankEntry object.
-	m_bankCount = 1;
-	m_imageType = reader->type();
-	m_entries = (RvtH_BankEntry*)calloc(1, sizeof(RvtH_BankEntry));
+	// Allocate memory for the RvtH_BankEntry objects.
+	m_imageType = readers[0]->type();
+	m_entries = (RvtH_BankEntry*)calloc(readers.size(), sizeof(RvtH_BankEntry));
 	if (!m_entries) {
 		// Error allocating memory.
 		err = errno;
@@ -118,53 +194,40 @@ int RvtH::openGcm(RefFile *f_img)
 		goto fail;
 	};
 
-	// Initialize the bank entry.
-	// NOTE: Not using rvth_init_BankEntry() here.
-	m_file = f_img->ref();
-	m_NHCD_status = NHCD_STATUS_MISSING;
-	entry = m_entries;
-	entry->lba_start = reader->lba_start();
-	entry->lba_len = reader->lba_len();
-	entry->type = type;
-	entry->is_deleted = false;
-	entry->reader = reader;
-
 	// Timestamp. (using file mtime)
 	// NOTE: RVT-H doesn't use timezones, so we need to
 	// remove the local timezone offset.
 	// TODO: _r() functions if available.
-	{
-		time_t mtime = f_img->mtime();
-		if (mtime != -1) {
-			struct tm tmbuf_local;
-			mtime = timegm(localtime_r(&mtime, &tmbuf_local));
-		}
-		entry->timestamp = mtime;
+	mtime = f_img->mtime();
+	if (mtime != -1) {
+		struct tm tmbuf_local;
+		mtime = timegm(localtime_r(&mtime, &tmbuf_local));
 	}
 
-	if (type != RVTH_BankType_Empty) {
-		// Copy the disc header.
-		memcpy(&entry->discHeader, &discHeader.gcn, sizeof(entry->discHeader));
-
-		// TODO: Error handling.
-		// Initialize the region code.
-		rvth_init_BankEntry_region(entry);
-		// Initialize the encryption status.
-		rvth_init_BankEntry_crypto(entry);
-		// Initialize the AppLoader error status.
-		rvth_init_BankEntry_AppLoader(entry);
+	// Initialize the bank entries.
+	for (size_t i = 0; i < readers.size(); i++) {
+		ret = init_BankEntry_gcm(&m_entries[i], readers[i], f_img, probe, mtime);
+		if (ret != 0) {
+			if (ret < 0) {
+				err = -ret;
+			}
+			goto fail;
+		}
 	}
 
 	// Disc image loaded.
+	m_file = f_img->ref();
+	m_NHCD_status = NHCD_STATUS_MISSING;
+	m_bankCount = static_cast<unsigned int>(readers.size());
 	return RVTH_ERROR_SUCCESS;
 
 fail:
 	// Failed to open the disc image.
-	delete reader;
-	if (m_file) {
-		m_file->unref();
-		m_file = nullptr;
+	for (Reader *reader : readers) {
+		delete reader;
 	}
+	free(m_entries);
+	m_entries = nullptr;
 	if (err != 0) {
 		errno = err;
 	}
@@ -180,13 +243,16 @@ fail:
  */
 int RvtH::checkMBR(RefFile *f_img, bool *pMBR, bool *pGPT)
 {
-	uint8_t sector_buffer[LBA_SIZE];
+	// LBA 0 and both possible locations of LBA 1 are read at once.
+	// Note that LBA 1 might be either 512 or 4096, depending on
+	// the drive's sector size.
+	uint8_t probe_buffer[4096 + LBA_SIZE];
 	*pMBR = false;
 	*pGPT = false;
 
-	// Read LBA 0.
-	size_t size = f_img->seekoAndRead(LBA_TO_BYTES(0), SEEK_SET, sector_buffer, 1, sizeof(sector_buffer));
-	if (size != sizeof(sector_buffer)) {
+	errno = 0;
+	size_t size = f_img->pread(probe_buffer, sizeof(probe_buffer), LBA_TO_BYTES(0));
+	if (size != sizeof(probe_buffer)) {
 		// Short read.
 		int err = errno;
 		if (err == 0) {
@@ -195,15 +261,16 @@ int RvtH::checkMBR(RefFile *f_img, bool *pMBR, bool *pGPT)
 		return -err;
 	}
 
-	if (sector_buffer[0x1FE] == 0x55 && sector_buffer[0x1FF] == 0xAA) {
+	const uint8_t *const mbr = &probe_buffer[0];
+	if (mbr[0x1FE] == 0x55 && mbr[0x1FF] == 0xAA) {
 		// Found an MBR signature.
 		*pMBR = true;
 
 		// Check for a protective GPT partition.
-		if (sector_buffer[0x1BE + 4] == 0xEE ||
-		    sector_buffer[0x1CE + 4] == 0xEE ||
-		    sector_buffer[0x1DE + 4] == 0xEE ||
-		    sector_buffer[0x1EE + 4] == 0xEE)
+		if (mbr[0x1BE + 4] == 0xEE ||
+		    mbr[0x1CE + 4] == 0xEE ||
+		    mbr[0x1DE + 4] == 0xEE ||
+		    mbr[0x1EE + 4] == 0xEE)
 		{
 			// Found a protective GPT partition.
 			*pGPT = true;
@@ -212,38 +279,11 @@ int RvtH::checkMBR(RefFile *f_img, bool *pMBR, bool *pGPT)
 	}
 
 	// Check for "EFI PART" at LBA 1.
-	// Note that LBA 1 might be either 512 or 4096, depending on
-	// the drive's sector size. We'll check both.
-
-	// Check 512. (512-byte sectors)
-	size = f_img->seekoAndRead(512, SEEK_SET, sector_buffer, 1, sizeof(sector_buffer));
-	if (size != sizeof(sector_buffer)) {
-		// Short read.
-		int err = errno;
-		if (err == 0) {
-			err = EIO;
-		}
-		return err;
-	}
-
-	if (!memcmp(&sector_buffer[0], "EFI PART", 8)) {
-		// Found "EFI PART".
-		*pGPT = true;
-		return 0;
-	}
-
-	// Check 4096. (4k sectors)
-	size = f_img->seekoAndRead(4096, SEEK_SET, sector_buffer, 1, sizeof(sector_buffer));
-	if (size != sizeof(sector_buffer)) {
-		// Short read.
-		int err = errno;
-		if (err == 0) {
-			err = EIO;
-		}
-		return err;
-	}
-
-	if (!memcmp(&sector_buffer[0], "EFI PART", 8)) {
+	// - 512: 512-byte sectors
+	// - 4096: 4k sectors
+	if (!memcmp(&probe_buffer[512], "EFI PART", 8) ||
+	    !memcmp(&probe_buffer[4096], "EFI PART", 8))
+	{
 		// Found "EFI PART".
 		*pGPT = true;
 		return 0;
@@ -268,9 +308,13 @@ int RvtH::openHDD(RefFile *f_img)
 	off64_t addr;
 	size_t size;
 
+	// Bank table and bank metadata reads are scattered across
+	// the whole HDD, so disable read-ahead.
+	f_img->setAccessHint(RefFile::AccessHint::Random);
+
 	// Check the bank table header.
-	size = f_img->seekoAndRead(LBA_TO_BYTES(NHCD_BANKTABLE_ADDRESS_LBA), SEEK_SET,
-		&nhcd_header, 1, sizeof(nhcd_header));
+	size = f_img->pread(&nhcd_header, sizeof(nhcd_header),
+		LBA_TO_BYTES(NHCD_BANKTABLE_ADDRESS_LBA));
 	if (size != sizeof(nhcd_header)) {
 		// Short read.
 		err = errno;
@@ -326,13 +370,23 @@ int RvtH::openHDD(RefFile *f_img)
 		}
 
 		m_file = f_img->ref();
+		m_pendingBanks.resize(m_bankCount);
 		rvth_entry = m_entries;
 		lba_start = NHCD_BANK_START_LBA(0, 8);
 		for (i = 0; i < m_bankCount; i++, rvth_entry++, lba_start += NHCD_BANK_SIZE_LBA) {
 			// Use "Empty" so we can try to detect the actual bank type.
-			rvth_init_BankEntry(rvth_entry, f_img,
-				RVTH_BankType_Empty,
-				lba_start, NHCD_BANK_SIZE_LBA, 0);
+			PendingBank &pb = m_pendingBanks[i];
+			pb.lba_start = lba_start;
+			pb.lba_len = NHCD_BANK_SIZE_LBA;
+			pb.type = RVTH_BankType_Empty;
+			pb.has_nhcd = false;
+			pb.pending = true;
+			pb.header_only = false;
+
+			rvth_entry->lba_start = lba_start;
+			rvth_entry->lba_len = NHCD_BANK_SIZE_LBA;
+			rvth_entry->type = RVTH_BankType_Empty;
+			rvth_entry->timestamp = -1;
 		}
 
 		// RVT-H image loaded.
@@ -368,32 +422,28 @@ int RvtH::openHDD(RefFile *f_img)
 	};
 
 	m_file = f_img->ref();
-	rvth_entry = m_entries;
+	m_pendingBanks.resize(m_bankCount);
+
+	// Load the bank metadata cache.
+	// Banks that haven't changed since the last time this
+	// RVT-H Reader was opened don't need to be parsed again.
+	m_bankCache = new BankCache();
+	m_bankCache->load(f_img, m_bankCount);
+
+	// Load the verification result cache.
+	m_verifyCache = new VerifyCache();
+	m_verifyCache->load(f_img, m_bankCount);
+	m_verifyMap = new VerifyMap();
+	m_verifyMap->load(f_img, m_bankCount);
+
 	// FIXME: Why cast to uint32_t?
 	addr = (uint32_t)(LBA_TO_BYTES(NHCD_BANKTABLE_ADDRESS_LBA) + NHCD_BLOCK_SIZE);
-	for (i = 0; i < m_bankCount; i++, rvth_entry++, addr += 512) {
-		NHCD_BankEntry nhcd_entry;
-		uint32_t lba_start = 0, lba_len = 0;
-		uint8_t type = RVTH_BankType_Unknown;
+	for (i = 0; i < m_bankCount; i++, addr += 512) {
+		PendingBank &pb = m_pendingBanks[i];
+		NHCD_BankEntry &nhcd_entry = pb.nhcd_entry;
 
-		if (i > 0 && (rvth_entry-1)->type == RVTH_BankType_Wii_DL) {
-			// Second bank for a dual-layer Wii image.
-			rvth_entry->type = RVTH_BankType_Wii_DL_Bank2;
-			rvth_entry->timestamp = -1;
-			continue;
-		}
-
-		ret = f_img->seeko(addr, SEEK_SET);
-		if (ret != 0) {
-			// Seek error.
-			err = errno;
-			if (err == 0) {
-				err = EIO;
-			}
-			ret = -err;
-			goto fail;
-		}
-		size = f_img->read(&nhcd_entry, 1, sizeof(nhcd_entry));
+		errno = 0;
+		size = f_img->pread(&nhcd_entry, sizeof(nhcd_entry), addr);
 		if (size != sizeof(nhcd_entry)) {
 			// Short read.
 			err = errno;
@@ -404,47 +454,10 @@ int RvtH::openHDD(RefFile *f_img)
 			goto fail;
 		}
 
-		// Check the type.
-		switch (be32_to_cpu(nhcd_entry.type)) {
-			default:
-				// Unknown bank type...
-				type = RVTH_BankType_Unknown;
-				break;
-			case NHCD_BankType_Empty:
-				// "Empty" bank. May have a deleted image.
-				type = RVTH_BankType_Empty;
-				break;
-			case NHCD_BankType_GCN:
-				// GameCube
-				type = RVTH_BankType_GCN;
-				break;
-			case NHCD_BankType_Wii_SL:
-				// Wii (single-layer)
-				type = RVTH_BankType_Wii_SL;
-				break;
-			case NHCD_BankType_Wii_DL:
-				// Wii (dual-layer)
-				// TODO: Cannot start in Bank 8.
-				type = RVTH_BankType_Wii_DL;
-				break;
-		}
-
-		// For valid types, use the listed LBAs if they're non-zero.
-		if (type >= RVTH_BankType_GCN) {
-			lba_start = be32_to_cpu(nhcd_entry.lba_start);
-			lba_len = be32_to_cpu(nhcd_entry.lba_len);
-		}
-
-		if (lba_start == 0 || lba_len == 0) {
-			// Invalid LBAs. Use the default starting offset.
-			// Bank size will be determined by rvth_init_BankEntry().
-			lba_start = NHCD_BANK_START_LBA(i, m_bankCount);
-			lba_len = 0;
-		}
-
-		// Initialize the bank entry.
-		rvth_init_BankEntry(rvth_entry, f_img, type,
-			lba_start, lba_len, nhcd_entry.timestamp);
+		// The rest of the bank entry will be initialized
+		// by getBankEntry() when it's accessed.
+		pb.has_nhcd = true;
+		resetPendingBank_int(i);
 	}
 
 	// RVT-H image loaded.
@@ -452,6 +465,13 @@ int RvtH::openHDD(RefFile *f_img)
 
 fail:
 	// Failed to open the HDD image.
+	m_pendingBanks.clear();
+	delete m_bankCache;
+	m_bankCache = nullptr;
+	delete m_verifyCache;
+	m_verifyCache = nullptr;
+	delete m_verifyMap;
+	m_verifyMap = nullptr;
 	if (m_file) {
 		m_file->unref();
 		m_file = nullptr;
@@ -473,6 +493,14 @@ RvtH::RvtH(const TCHAR *filename, int *pErr)
 	, m_imageType(RVTH_ImageType_Unknown)
 	, m_NHCD_status(NHCD_STATUS_UNKNOWN)
 	, m_entries(nullptr)
+	, m_bankCache(nullptr)
+	, m_verifyCache(nullptr)
+	, m_verifyMap(nullptr)
+	, m_txnActive(false)
+	, m_copyParams()
+	, m_sharedDurability(false)
+	, m_progressParams()
+	, m_stats(new StatsCounters())
 {
 	// Open the disk image.
 	RefFile *const f_img = new RefFile(filename);
@@ -519,24 +547,175 @@ RvtH::RvtH(const TCHAR *filename, int *pErr)
 	f_img->unref();
 }
 
+/**
+ * Open an RVT-H disk image using an open file.
+ * Check isOpen() after constructing the object.
+ * @param f_img	[in] RefFile*
+ * @param pErr	[out,opt] Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+RvtH::RvtH(RefFile *f_img, int *pErr)
+	: m_file(nullptr)
+	, m_bankCount(0)
+	, m_imageType(RVTH_ImageType_Unknown)
+	, m_NHCD_status(NHCD_STATUS_UNKNOWN)
+	, m_entries(nullptr)
+	, m_bankCache(nullptr)
+	, m_verifyCache(nullptr)
+	, m_verifyMap(nullptr)
+	, m_txnActive(false)
+	, m_copyParams()
+	, m_sharedDurability(false)
+	, m_progressParams()
+	, m_stats(new StatsCounters())
+{
+	errno = 0;
+	int err = openHDD(f_img);
+	if (pErr) {
+		*pErr = err;
+	}
+}
+
 RvtH::~RvtH()
 {
 	// Close all bank entry files.
 	// RefFile has a reference count, so we have to clear the count.
 	for (unsigned int i = 0; i < m_bankCount; i++) {
 		delete m_entries[i].reader;
-		free(m_entries[i].ptbl);
+		rvth_ptbl_free(&m_entries[i]);
 	}
 
 	// Free the bank entries array.
 	free(m_entries);
 
+	// Save the bank cache.
+	// Errors are ignored, since the cache is only an optimization.
+	if (m_bankCache) {
+		m_bankCache->save();
+		delete m_bankCache;
+	}
+	if (m_verifyCache) {
+		m_verifyCache->save();
+		delete m_verifyCache;
+	}
+	if (m_verifyMap) {
+		m_verifyMap->save();
+		delete m_verifyMap;
+	}
+
+	delete m_stats;
+
 	// Clear the main file reference.
 	if (m_file) {
 		m_file->unref();
 	}
 }
 
+/**
+ * Set the progress callback throttling parameters.
+ * These are used for extracting, importing, wiping, and verifying.
+ * @param params	[in] Progress parameters.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int RvtH::setProgressParams(const RvtH_ProgressParams *params)
+{
+	if (!params) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	m_progressParams = *params;
+	return 0;
+}
+
+/**
+ * Get the performance statistics.
+ * Counters accumulate over all operations on this object
+ * until resetStats() is called.
+ * @param stats	[out] Statistics.
+ */
+void RvtH::getStats(RvtH_Stats *stats) const
+{
+	m_stats->get(stats);
+}
+
+/**
+ * Reset the performance statistics.
+ * This also resets the read latency statistics.
+ */
+void RvtH::resetStats(void)
+{
+	m_stats->reset();
+}
+
+/**
+ * Get the read latency statistics.
+ * Latency is measured for each read of the device or disk image
+ * file if RvtH_CopyParams::slow_read_ms is set.
+ * @param latency	[out] Read latency statistics.
+ * @return 0 on success; -ENOTSUP if read latency isn't being measured.
+ */
+int RvtH::getReadLatency(RvtH_Read_Latency *latency) const
+{
+	return m_stats->getReadLatency(latency);
+}
+
+/**
+ * Set the cancellation token for operations on this object.
+ *
+ * While a token is set, calling CancelToken::cancel() from any
+ * thread stops the running operation, e.g. extract, import,
+ * verify, or recrypt, at the next read, write, or group. If an
+ * operation fails after its token was cancelled, it was cancelled;
+ * the error code may be -ECANCELED or the error from the stage
+ * that was interrupted, e.g. a short read.
+ *
+ * Only one token can be set at a time. (See AsyncJob.)
+ *
+ * @param token	[in,opt] Cancellation token. (nullptr to remove it; must remain valid until removed)
+ * @return 0 on success; -EBUSY if a different token is already set.
+ */
+int RvtH::setCancelToken(const CancelToken *token)
+{
+	return m_stats->setCancelToken(token);
+}
+
+/**
+ * Use a title key store that's shared with other RvtH objects.
+ * By default, each RvtH object has its own title key store.
+ * @param store	[in] Title key store.
+ */
+void RvtH::setTitleKeyStore(const std::shared_ptr<TitleKeyStore> &store)
+{
+	lock_guard<mutex> lock(m_titleKeyMutex);
+	m_titleKeys = store;
+}
+
+/**
+ * Decrypt a Wii title key.
+ * Decrypted title keys are cached in the title key store,
+ * so repeated operations on the same bank don't need to decrypt
+ * the title key again. (See setTitleKeyStore().)
+ *
+ * This function is thread-safe.
+ *
+ * @param ticket	[in] Ticket.
+ * @param titleKey	[out] Output buffer for the title key. (Must be 16 bytes.)
+ * @param crypto_type	[out] Encryption type. (See RVL_CryptoType_e.)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int RvtH::decryptTitleKey(const RVL_Ticket *ticket, uint8_t *titleKey, uint8_t *crypto_type) const
+{
+	std::shared_ptr<TitleKeyStore> store;
+	{
+		lock_guard<mutex> lock(m_titleKeyMutex);
+		if (!m_titleKeys) {
+			m_titleKeys = std::make_shared<TitleKeyStore>();
+		}
+		store = m_titleKeys;
+	}
+	return store->decrypt(ticket, titleKey, crypto_type);
+}
+
 /**
  * Is this RVT-H object an RVT-H Reader / HDD image, or a standalone disc image?
  * @param rvth RVT-H object.
@@ -560,9 +739,10 @@ bool RvtH::isHDD(void) const
  * Get a bank table entry.
  * @param bank	[in] Bank number. (0-7)
  * @param pErr	[out,opt] Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ * @param level	[in,opt] Initialization level. (See RvtH_BankInit_Level.)
  * @return Bank table entry, or NULL if out of range.
  */
-const RvtH_BankEntry *RvtH::bankEntry(unsigned int bank, int *pErr) const
+const RvtH_BankEntry *RvtH::bankEntry(unsigned int bank, int *pErr, RvtH_BankInit_Level level) const
 {
 	if (bank >= m_bankCount) {
 		errno = ERANGE;
@@ -572,5 +752,395 @@ const RvtH_BankEntry *RvtH::bankEntry(unsigned int bank, int *pErr) const
 		return nullptr;
 	}
 
+	return getBankEntry(bank, level);
+}
+
+/**
+ * Fill a bank summary from a bank entry.
+ * @param summary	[out] Bank summary.
+ * @param entry		[in] Bank entry.
+ */
+static void rvth_fill_BankSummary(RvtH_BankSummary *summary, const RvtH_BankEntry *entry)
+{
+	summary->lba_start = entry->lba_start;
+	summary->lba_len = entry->lba_len;
+	summary->timestamp = entry->timestamp;
+	summary->type = entry->type;
+	summary->region_code = entry->region_code;
+	summary->is_deleted = entry->is_deleted;
+	summary->disc_number = entry->discHeader.disc_number;
+	summary->revision = entry->discHeader.revision;
+	memcpy(summary->id6, entry->discHeader.id6, sizeof(summary->id6));
+}
+
+/**
+ * Get a bank summary.
+ * The bank entry is initialized with RVTH_BANK_INIT_HEADER if necessary.
+ * @param bank		[in] Bank number. (0-7)
+ * @param summary	[out] Bank summary.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int RvtH::bankSummary(unsigned int bank, RvtH_BankSummary *summary) const
+{
+	if (bank >= m_bankCount) {
+		errno = ERANGE;
+		return -ERANGE;
+	}
+
+	rvth_fill_BankSummary(summary, getBankEntry(bank, RVTH_BANK_INIT_HEADER));
+	return 0;
+}
+
+/**
+ * Get summaries of all banks.
+ * @param summaries	[out] Bank summaries, in bank order.
+ * @param threads	[in,opt] Number of worker threads (0 for auto; 1 for single-threaded)
+ * @return Number of banks.
+ */
+unsigned int RvtH::bankSummaries(vector<RvtH_BankSummary> &summaries, unsigned int threads) const
+{
+	initBankEntries(threads, RVTH_BANK_INIT_HEADER);
+
+	summaries.resize(m_bankCount);
+	for (unsigned int bank = 0; bank < m_bankCount; bank++) {
+		rvth_fill_BankSummary(&summaries[bank], getBankEntry(bank, RVTH_BANK_INIT_HEADER));
+	}
+	return m_bankCount;
+}
+
+/**
+ * Reset an HDD bank entry to its pending state using the bank table entry.
+ * The bank entry will be initialized by getBankEntry() when it's accessed.
+ * NOTE: m_bankInitMutex must be held by the caller, if necessary.
+ * NOTE 2: The RvtH_BankEntry must be cleared by the caller.
+ * @param bank	[in] Bank number. (0-7)
+ */
+void RvtH::resetPendingBank_int(unsigned int bank) const
+{
+	PendingBank &pb = m_pendingBanks[bank];
+	if (pb.has_nhcd) {
+		const NHCD_BankEntry &nhcd_entry = pb.nhcd_entry;
+		uint32_t lba_start = 0, lba_len = 0;
+		uint8_t type = RVTH_BankType_Unknown;
+
+		// Check the type.
+		switch (be32_to_cpu(nhcd_entry.type)) {
+			default:
+				// Unknown bank type...
+				type = RVTH_BankType_Unknown;
+				break;
+			case NHCD_BankType_Empty:
+				// "Empty" bank. May have a deleted image.
+				type = RVTH_BankType_Empty;
+				break;
+			case NHCD_BankType_GCN:
+				// GameCube
+				type = RVTH_BankType_GCN;
+				break;
+			case NHCD_BankType_Wii_SL:
+				// Wii (single-layer)
+				type = RVTH_BankType_Wii_SL;
+				break;
+			case NHCD_BankType_Wii_DL:
+				// Wii (dual-layer)
+				// TODO: Cannot start in Bank 8.
+				type = RVTH_BankType_Wii_DL;
+				break;
+		}
+
+		// For valid types, use the listed LBAs if they're non-zero.
+		if (type >= RVTH_BankType_GCN) {
+			lba_start = be32_to_cpu(nhcd_entry.lba_start);
+			lba_len = be32_to_cpu(nhcd_entry.lba_len);
+		}
+
+		if (lba_start == 0 || lba_len == 0) {
+			// Invalid LBAs. Use the default starting offset.
+			// Bank size will be determined by rvth_init_BankEntry().
+			lba_start = NHCD_BANK_START_LBA(bank, m_bankCount);
+			lba_len = 0;
+		}
+
+		pb.lba_start = lba_start;
+		pb.lba_len = lba_len;
+		pb.type = type;
+	}
+	pb.pending = true;
+	pb.header_only = false;
+
+	RvtH_BankEntry *const rvth_entry = &m_entries[bank];
+	rvth_entry->lba_start = pb.lba_start;
+	rvth_entry->lba_len = pb.lba_len;
+	rvth_entry->type = pb.type;
+	rvth_entry->timestamp = -1;
+}
+
+/**
+ * Check if an HDD bank is the second bank of a dual-layer Wii image.
+ * If it is, the bank entry is set to RVTH_BankType_Wii_DL_Bank2.
+ * NOTE: m_bankInitMutex must be held by the caller.
+ * NOTE 2: The previous bank must have already been initialized.
+ * @param bank	[in] Bank number. (0-7)
+ * @return True if this is the second bank of a dual-layer Wii image.
+ */
+bool RvtH::checkBankEntryDL2_int(unsigned int bank) const
+{
+	if (bank == 0 || !m_pendingBanks[bank].has_nhcd ||
+	    m_entries[bank-1].type != RVTH_BankType_Wii_DL)
+	{
+		return false;
+	}
+
+	// Second bank for a dual-layer Wii image.
+	RvtH_BankEntry *const rvth_entry = &m_entries[bank];
+	delete rvth_entry->reader;
+	rvth_ptbl_free(rvth_entry);
+	memset(rvth_entry, 0, sizeof(*rvth_entry));
+	rvth_entry->type = RVTH_BankType_Wii_DL_Bank2;
+	rvth_entry->timestamp = -1;
+	return true;
+}
+
+/**
+ * Load an HDD bank entry from the bank metadata cache.
+ * NOTE: m_bankInitMutex must be held by the caller.
+ * @param bank	[in] Bank number. (0-7)
+ * @return True if the bank entry was loaded; false if not.
+ */
+bool RvtH::loadBankEntryFromCache_int(unsigned int bank) const
+{
+	const PendingBank &pb = m_pendingBanks[bank];
+	if (!pb.has_nhcd || !m_bankCache) {
+		return false;
+	}
+
+	RvtH_BankEntry *const rvth_entry = &m_entries[bank];
+	if (!m_bankCache->lookup(bank, &pb.nhcd_entry, rvth_entry)) {
+		return false;
+	}
+	if (rvth_init_BankEntry_reader(rvth_entry, m_file) != 0) {
+		// Unable to open the reader.
+		return false;
+	}
+	cacheBankReader_int(bank);
+
+	// Cached bank entry is usable.
+	return true;
+}
+
+/**
+ * Initialize an HDD bank entry if it hasn't been initialized yet.
+ * NOTE: m_bankInitMutex must be held by the caller.
+ * @param bank	[in] Bank number. (0-7)
+ * @param level	[in] Initialization level. (See RvtH_BankInit_Level.)
+ */
+void RvtH::initBankEntry_int(unsigned int bank, RvtH_BankInit_Level level) const
+{
+	PendingBank &pb = m_pendingBanks[bank];
+	if (!pb.pending) {
+		if (pb.header_only && level == RVTH_BANK_INIT_FULL) {
+			// Finish initializing the bank entry.
+			pb.header_only = false;
+			storeBankEntryInCache_int(bank, rvth_init_BankEntry_full(&m_entries[bank]));
+		}
+		return;
+	}
+	pb.pending = false;
+
+	if (bank > 0 && pb.has_nhcd) {
+		// If the previous bank has a dual-layer Wii image,
+		// this is its second bank. The previous bank must be
+		// initialized if it might have a deleted image.
+		// NOTE: The header is enough to determine the bank type.
+		const uint8_t prev_type = m_pendingBanks[bank-1].type;
+		if (prev_type == RVTH_BankType_Wii_DL || prev_type == RVTH_BankType_Empty) {
+			initBankEntry_int(bank-1, RVTH_BANK_INIT_HEADER);
+		}
+		if (checkBankEntryDL2_int(bank)) {
+			return;
+		}
+	}
+
+	// Check the bank cache first.
+	if (loadBankEntryFromCache_int(bank)) {
+		return;
+	}
+
+	// Initialize the bank entry.
+	// TODO: Error handling.
+	const int ret = rvth_init_BankEntry(&m_entries[bank], m_file, pb.type,
+		pb.lba_start, pb.lba_len,
+		(pb.has_nhcd ? pb.nhcd_entry.timestamp : nullptr), level);
+	cacheBankReader_int(bank);
+	if (level == RVTH_BANK_INIT_HEADER) {
+		// Partially-initialized entries aren't cached.
+		pb.header_only = true;
+		return;
+	}
+	storeBankEntryInCache_int(bank, ret);
+}
+
+/**
+ * Add a block cache to an HDD bank entry's reader.
+ * The cache size is set by RvtH_CopyParams::block_cache.
+ * @param bank	[in] Bank number. (0-7)
+ */
+void RvtH::cacheBankReader_int(unsigned int bank) const
+{
+	const unsigned int block_cache = m_copyParams.block_cache;
+	if (block_cache == RVTH_BLOCK_CACHE_DISABLED) {
+		return;
+	}
+
+	RvtH_BankEntry *const entry = &m_entries[bank];
+	entry->reader = CachedReader::wrap(entry->reader,
+		static_cast<size_t>(block_cache != 0 ? block_cache : BLOCK_CACHE_DEFAULT) * 1024U);
+}
+
+/**
+ * Update the bank metadata cache after initializing an HDD bank entry.
+ * NOTE: m_bankInitMutex must be held by the caller.
+ * @param bank	[in] Bank number. (0-7)
+ * @param ret	[in] rvth_init_BankEntry() return value.
+ */
+void RvtH::storeBankEntryInCache_int(unsigned int bank, int ret) const
+{
+	const PendingBank &pb = m_pendingBanks[bank];
+	if (!pb.has_nhcd || !m_bankCache) {
+		return;
+	}
+
+	if (ret == 0) {
+		m_bankCache->store(bank, &pb.nhcd_entry, &m_entries[bank]);
+	} else {
+		m_bankCache->invalidate(bank);
+	}
+}
+
+/**
+ * Initialize all HDD bank entries that haven't been initialized yet.
+ *
+ * Bank entries are normally initialized on first access. If all banks
+ * are going to be accessed, e.g. when listing the bank table, this
+ * function initializes them concurrently, so the signature checks for
+ * one bank overlap the disk reads for the other banks.
+ *
+ * @param threads	[in,opt] Number of worker threads (0 for auto; 1 for single-threaded)
+ * @param level		[in,opt] Initialization level. (See RvtH_BankInit_Level.)
+ */
+void RvtH::initBankEntries(unsigned int threads, RvtH_BankInit_Level level) const
+{
+	RVTH_TRACE_SPAN("RvtH::initBankEntries");
+
+	if (m_pendingBanks.empty()) {
+		// Not an HDD, or all banks are initialized.
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(m_bankInitMutex);
+
+	// Banks that are in the bank metadata cache don't need
+	// to be read from the disk.
+	// Banks that were only partially initialized are finished here.
+	vector<unsigned int> banks;
+	banks.reserve(m_bankCount);
+	for (unsigned int bank = 0; bank < m_bankCount; bank++) {
+		const PendingBank &pb = m_pendingBanks[bank];
+		if (pb.pending) {
+			if (!loadBankEntryFromCache_int(bank)) {
+				banks.push_back(bank);
+			}
+		} else if (pb.header_only && level == RVTH_BANK_INIT_FULL) {
+			banks.push_back(bank);
+		}
+	}
+
+	// Determine the number of worker threads.
+	if (threads == 0) {
+		threads = std::thread::hardware_concurrency();
+		if (threads == 0) {
+			threads = 1;
+		}
+	}
+	if (threads > BANK_INIT_MAX_THREADS) {
+		threads = BANK_INIT_MAX_THREADS;
+	}
+	if (threads > banks.size()) {
+		threads = static_cast<unsigned int>(banks.size());
+	}
+
+	// Initialize the remaining banks.
+	// Each worker only writes to its own bank entries, so the only
+	// shared state is the index of the next bank to initialize.
+	// NOTE: The second bank of a dual-layer Wii image is initialized
+	// like any other bank here. It's handled below, since it depends
+	// on the previous bank's type.
+	vector<int> rets(m_bankCount, 0);
+	std::atomic<unsigned int> next(0);
+	auto worker_fn = [&]() {
+		unsigned int idx;
+		while ((idx = next.fetch_add(1, std::memory_order_relaxed)) < banks.size()) {
+			const unsigned int bank = banks[idx];
+			const PendingBank &pb = m_pendingBanks[bank];
+			if (!pb.pending) {
+				rets[bank] = rvth_init_BankEntry_full(&m_entries[bank]);
+				continue;
+			}
+			rets[bank] = rvth_init_BankEntry(&m_entries[bank], m_file, pb.type,
+				pb.lba_start, pb.lba_len,
+				(pb.has_nhcd ? pb.nhcd_entry.timestamp : nullptr), level);
+			cacheBankReader_int(bank);
+		}
+	};
+
+	// Bank initialization is usually waited on by the UI.
+	ThreadPool::instance().run(threads, worker_fn, ThreadPool::PRIORITY_HIGH);
+
+	// Finish initialization in bank order.
+	auto iter = banks.cbegin();
+	for (unsigned int bank = 0; bank < m_bankCount; bank++) {
+		PendingBank &pb = m_pendingBanks[bank];
+		const bool was_read = (iter != banks.cend() && *iter == bank);
+		if (was_read) {
+			++iter;
+		}
+		if (!pb.pending) {
+			if (was_read && pb.header_only) {
+				// Partially-initialized bank was finished.
+				pb.header_only = false;
+				storeBankEntryInCache_int(bank, rets[bank]);
+			}
+			continue;
+		}
+		pb.pending = false;
+
+		if (checkBankEntryDL2_int(bank)) {
+			continue;
+		}
+		if (was_read) {
+			if (level == RVTH_BANK_INIT_HEADER) {
+				// Partially-initialized entries aren't cached.
+				pb.header_only = true;
+			} else {
+				storeBankEntryInCache_int(bank, rets[bank]);
+			}
+		}
+	}
+}
+
+/**
+ * Get a bank table entry, initializing it if necessary.
+ * NOTE: The bank number is NOT range-checked.
+ * @param bank	[in] Bank number. (0-7)
+ * @param level	[in] Initialization level. (See RvtH_BankInit_Level.)
+ * @return Bank table entry.
+ */
+RvtH_BankEntry *RvtH::getBankEntry(unsigned int bank, RvtH_BankInit_Level level) const
+{
+	assert(bank < m_bankCount);
+	if (!m_pendingBanks.empty()) {
+		std::lock_guard<std::mutex> lock(m_bankInitMutex);
+		initBankEntry_int(bank, level);
+	}
 	return &m_entries[bank];
 }
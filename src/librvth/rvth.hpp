@@ -2,7 +2,7 @@
  * RVT-H Tool (librvth)                                                    *
  * rvth.hpp: RVT-H image handler.                                          *
  *                                                                         *
- * Copyright (c) 2018-2022 by David Korth.                                 *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
@@ -82,12 +82,33 @@ typedef struct _RvtH_BankEntry {
 	RvtH_SigInfo ticket;	// Ticket encryption/signature.
 	RvtH_SigInfo tmd;	// TMD encryption/signature.
 
+	// Build fingerprint: SHA-1 of the disc header fields and the
+	// game partition's TMD content table (Wii) or the boot block (GCN).
+	// All zeroes if not available. (See init_BankEntry_fingerprint().)
+	uint8_t fingerprint[20];
+
 	// Wii partition table
 	RVL_VolumeGroupTable vg_orig;	// Original volume group table, in host-endian.
 	unsigned int pt_count;		// Number of entries in ptbl.
 	struct _pt_entry_t *ptbl;	// Partition table.
 } RvtH_BankEntry;
 
+// Compact bank summary, for listing, sorting, and scheduling banks.
+// Only has fields that are available at RVTH_BANK_INIT_HEADER, so
+// getting a summary doesn't check the encryption or signatures.
+// (See RvtH::bankSummaries().)
+typedef struct _RvtH_BankSummary {
+	uint32_t lba_start;	// Starting LBA. (512-byte sectors)
+	uint32_t lba_len;	// Length, in 512-byte sectors.
+	time_t timestamp;	// Timestamp. (no timezone information)
+	uint8_t type;		// Bank type. (See RvtH_BankType_e.)
+	uint8_t region_code;	// Region code. (See GCN_Region_Code.)
+	bool is_deleted;	// If true, this entry was deleted.
+	uint8_t disc_number;	// Disc number.
+	uint8_t revision;	// Revision.
+	char id6[6];		// Game ID. (not NULL-terminated)
+} RvtH_BankSummary;
+
 /** Progress callback for write functions **/
 
 // Progress callback type.
@@ -96,8 +117,22 @@ typedef enum {
 	RVTH_PROGRESS_EXTRACT,		// Extract image
 	RVTH_PROGRESS_IMPORT,		// Import image
 	RVTH_PROGRESS_RECRYPT,		// Recrypt image
+	RVTH_PROGRESS_WIPE,		// Wipe bank
+	RVTH_PROGRESS_RECOVER,		// Scan for lost banks
+	RVTH_PROGRESS_SCAN,		// Scan read latency
+	RVTH_PROGRESS_COMPARE,		// Compare banks
+	RVTH_PROGRESS_CONVERT,		// Convert image format
+	RVTH_PROGRESS_REPAIR,		// Repair hash trees
+	RVTH_PROGRESS_IDENTIFY,		// Calculate bank digests
 } RvtH_Progress_Type;
 
+// Disc image digests. (RVTH_EXTRACT_DIGESTS, RVTH_IMPORT_DIGESTS)
+typedef struct _RvtH_Image_Digests {
+	uint32_t crc32;
+	uint8_t md5[16];
+	uint8_t sha1[20];
+} RvtH_Image_Digests;
+
 // General progress callback status.
 typedef struct _RvtH_Progress_State {
 	// RvtH objects.
@@ -118,6 +153,19 @@ typedef struct _RvtH_Progress_State {
 	// Otherwise, we're encrypting/decrypting.
 	uint32_t lba_processed;
 	uint32_t lba_total;
+
+	// Throughput and estimated time remaining, computed by librvth
+	// so all frontends display the same values.
+	// bytes_per_sec is smoothed over several updates; 0 if not known yet.
+	// eta_sec is -1 if not known yet, and 0 once processing is complete.
+	double bytes_per_sec;
+	int64_t eta_sec;
+
+	// Digests of the disc image as it was copied.
+	// Only set in the final progress update for an extract or import,
+	// if digests were requested; otherwise, NULL.
+	// NOTE: Recryption and SDK headers aren't included.
+	const RvtH_Image_Digests *digests;
 } RvtH_Progress_State;
 
 /**
@@ -128,6 +176,166 @@ typedef struct _RvtH_Progress_State {
  */
 typedef bool (*RvtH_Progress_Callback)(const RvtH_Progress_State *state, void *userdata);
 
+// Copy buffer parameters for extracting and importing.
+// Fields set to 0 use the default or automatically-tuned value.
+typedef struct _RvtH_CopyParams {
+	unsigned int buf_size;	// Chunk buffer size, in bytes. (multiple of 64 KB; 0 for auto)
+	unsigned int buf_count;	// Number of chunk buffers. (minimum 2; 0 for default)
+	unsigned int alignment;	// Chunk buffer alignment, in bytes. (power of two; 0 for default)
+	unsigned int direct_io;	// If non-zero, use direct I/O for RVT-H Reader devices. (bypasses the page cache)
+	unsigned int hole_size;	// Minimum run of empty blocks left unwritten in sparse writes, in bytes. (multiple of 4 KB; 0 for default)
+	unsigned int slow_read_ms;	// If non-zero, measure read latency, and record reads slower than this. (See RvtH::getReadLatency().)
+	unsigned int mem_budget;	// Memory budget for in-flight buffers, in MB. (0 for no limit; see RvtH::setCopyParams().)
+	unsigned int io_priority;	// I/O priority. (See RvtH_IO_Priority.)
+	unsigned int bw_limit;		// Bandwidth limit for file reads and writes, in KB/s. (0 for no limit)
+	unsigned int readback_window;	// Distance that read-back verification trails the writer by, in MB. (0 for default)
+	unsigned int durability;	// Durability policy for writes. (See RvtH_Durability.)
+	unsigned int sync_interval;	// Sync interval for RVTH_DURABILITY_INTERVAL, in MB. (0 for default)
+	unsigned int block_cache;	// Block cache size for each HDD bank, in KB. (multiple of 32 KB; 0 for default)
+} RvtH_CopyParams;
+
+// Copy buffer size limits.
+#define RVTH_COPY_BUF_SIZE_MIN		(64U * 1024U)
+#define RVTH_COPY_BUF_SIZE_MAX		(64U * 1024U * 1024U)
+#define RVTH_COPY_BUF_COUNT_MAX		16U
+#define RVTH_COPY_ALIGNMENT_MAX		(1U * 1024U * 1024U)
+#define RVTH_COPY_HOLE_SIZE_MIN		4096U
+#define RVTH_MEM_BUDGET_MIN		8U	// MB
+#define RVTH_READBACK_WINDOW_MAX	(64U * 1024U)	// MB
+#define RVTH_BLOCK_CACHE_MAX		(64U * 1024U)	// KB
+#define RVTH_BLOCK_CACHE_DISABLED	0xFFFFFFFFU	// RvtH_CopyParams::block_cache value that disables the cache
+
+// Benchmark results. (RvtH::benchmark())
+// Throughput values are in bytes per second; 0 if not measured.
+typedef struct _RvtH_Bench_Results {
+	double seq_read;	// Sequential read throughput of the bank
+	double rand_read;	// Random read throughput of the bank (32 KB reads)
+	double rand_iops;	// Random reads per second
+	double aes_decrypt;	// AES-128-CBC decryption throughput (one thread)
+	double sha1;		// SHA-1 throughput, using 1 KB blocks (one thread)
+	double verify;		// Decryption and H0 hashing throughput, as when verifying (one thread)
+	double write;		// Write throughput of the test file, including flushing it to disk
+	unsigned int buf_size;	// Copy buffer size used for sequential reads and writes
+	const char *aes_impl;	// AES implementation name
+	const char *sha1_impl;	// SHA-1 implementation name
+} RvtH_Bench_Results;
+
+// Performance statistics. (RvtH::getStats())
+// Counters accumulate over all operations on an RvtH object until
+// RvtH::resetStats() is called. Times are added up over all threads,
+// so they may be longer than the operation itself.
+typedef struct _RvtH_Stats {
+	uint64_t bytes_read;	// Bytes read
+	uint64_t bytes_written;	// Bytes written
+	uint64_t read_calls;	// Number of reads
+	uint64_t write_calls;	// Number of writes
+	uint64_t seeks;		// Reads and writes that didn't continue the previous one on the same file
+	uint64_t sparse_bytes;	// Empty blocks that were skipped or deallocated when writing, in bytes
+	uint64_t cache_hits;	// Block cache lookups that were found in the cache
+	uint64_t cache_misses;	// Block cache lookups that had to be read from the image
+	uint64_t io_ns;		// Time blocked in reads and writes, in nanoseconds
+	uint64_t aes_ns;	// Time in AES encryption and decryption, in nanoseconds
+	uint64_t sha1_ns;	// Time in SHA-1 hashing, in nanoseconds
+	uint64_t zero_scan_ns;	// Time checking for empty blocks, in nanoseconds
+} RvtH_Stats;
+
+// Read latency histogram buckets. (RvtH_Read_Latency)
+// Bucket 0 counts reads that took less than 16 us, and each following
+// bucket doubles the limit, i.e. bucket i counts reads that took less
+// than RVTH_LATENCY_BUCKET_LIMIT_US(i). The last bucket counts the rest.
+#define RVTH_LATENCY_BUCKETS		20
+#define RVTH_LATENCY_BUCKET_LIMIT_US(i)	(16ULL << (i))
+
+// Maximum number of slow read ranges. (RvtH_Read_Latency)
+#define RVTH_SLOW_READS_MAX		256
+
+// Slow read range. (RvtH_Read_Latency)
+// Adjacent slow reads are merged into a single range.
+typedef struct _RvtH_Slow_Read {
+	uint32_t lba_start;	// Starting LBA in the device or disk image file
+	uint32_t lba_len;	// Length, in LBAs
+	uint32_t latency_ms;	// Latency of the slowest read in this range, in milliseconds
+} RvtH_Slow_Read;
+
+// Read latency statistics. (RvtH::getReadLatency())
+// Only measured if RvtH_CopyParams::slow_read_ms is set.
+// Like RvtH_Stats, this accumulates until RvtH::resetStats() is called.
+typedef struct _RvtH_Read_Latency {
+	uint64_t hist[RVTH_LATENCY_BUCKETS];	// Number of reads in each bucket
+	uint64_t reads;			// Number of reads measured
+	uint64_t max_us;		// Latency of the slowest read, in microseconds
+	uint64_t total_us;		// Total latency of all measured reads, in microseconds
+	uint64_t slow_reads;		// Number of reads that took at least slow_read_ms
+	unsigned int slow_read_ms;	// Slow read threshold
+	unsigned int slow_count;	// Number of ranges in slow[] (ranges after RVTH_SLOW_READS_MAX are dropped)
+	RvtH_Slow_Read slow[RVTH_SLOW_READS_MAX];	// Slow read ranges, in the order they were read
+} RvtH_Read_Latency;
+
+// Latency map entry. (RvtH::scanLatency())
+typedef struct _RvtH_Latency_Chunk {
+	uint32_t lba_start;	// Starting LBA
+	uint32_t lba_len;	// Length, in LBAs
+	uint32_t latency_us;	// Read latency, in microseconds
+	int err;		// 0 on success; negative POSIX error code if the read failed
+} RvtH_Latency_Chunk;
+
+// Lost bank candidate. (RvtH::scanForBanks())
+typedef struct _RvtH_Bank_Candidate {
+	uint32_t lba_start;		// Starting LBA of the disc image
+	int bank;			// Bank number if lba_start is a standard bank address (0-based); otherwise, -1
+	uint8_t type;			// Bank type (See RvtH_BankType_e.)
+	bool is_deleted;		// True if the disc header was zeroed, i.e. the bank was deleted
+	bool in_nhcd;			// True if the bank table has an entry for this disc image
+	int score;			// Confidence score (higher is more likely to be a real bank)
+	GCN_DiscHeader discHeader;	// Disc header
+} RvtH_Bank_Candidate;
+
+// Type of difference between two banks. (RvtH::compareBank())
+typedef enum {
+	RVTH_COMPARE_RAW	= 0,	// Data differs
+	RVTH_COMPARE_DECRYPTED	= 1,	// Decrypted Wii partition sectors differ
+	RVTH_COMPARE_LENGTH	= 2,	// Only in one of the banks (the banks have different lengths)
+} RvtH_Compare_Type;
+
+// Region that differs between two banks. (RvtH::compareBank())
+typedef struct _RvtH_Compare_Diff {
+	uint32_t lba_start;	// Starting LBA, relative to the start of the bank
+	uint32_t lba_len;	// Length, in LBAs
+	uint8_t type;		// Type of difference (See RvtH_Compare_Type.)
+	int pt_index;		// Partition index for RVTH_COMPARE_DECRYPTED; otherwise, -1
+} RvtH_Compare_Diff;
+
+// Multi-bank extract job. (RvtH::extractBanks())
+typedef struct _RvtH_Extract_Job {
+	unsigned int bank;		// Source bank number (0-based)
+	const TCHAR *filename;		// Destination filename
+	int result;			// [out] Error code (-ECANCELED if the job wasn't run)
+} RvtH_Extract_Job;
+
+// Multi-bank import job. (RvtH::importBanks())
+typedef struct _RvtH_Import_Job {
+	unsigned int bank;		// Destination bank number (0-based), or RVTH_IMPORT_BANK_AUTO
+	const TCHAR *filename;		// Source disc image filename
+	int result;			// [out] Error code (-ECANCELED if the job wasn't run)
+} RvtH_Import_Job;
+
+// Import job bank number: Use the next free bank. (RvtH::importBanksParallel())
+// The assigned bank number is written back to the job.
+#define RVTH_IMPORT_BANK_AUTO		(~0U)
+
+// Progress callback throttling parameters.
+// Intermediate progress updates are skipped until one of the intervals
+// has elapsed since the last update that was delivered. The initial and
+// final updates of each operation (and of each partition, when verifying)
+// are always delivered. Fields set to 0 are disabled; if both intervals
+// are 0, all progress updates are delivered.
+// NOTE: Cancellation is only checked when progress updates are delivered.
+typedef struct _RvtH_ProgressParams {
+	unsigned int interval_ms;	// Minimum time between progress updates, in milliseconds.
+	uint32_t interval_bytes;	// Minimum amount of data processed between progress updates, in bytes.
+	unsigned int error_batch;	// Maximum number of verification errors per RVTH_VERIFY_ERROR_BATCH. (0 to report errors individually)
+} RvtH_ProgressParams;
+
 // Verify progress callback type.
 // NOTE: This indicates the message type, whereas the
 // regular progress type indicates the operation type.
@@ -135,6 +343,8 @@ typedef enum {
 	RVTH_VERIFY_UNKNOWN = 0,
 	RVTH_VERIFY_STATUS,		// Current status
 	RVTH_VERIFY_ERROR_REPORT,	// Reporting an error
+	RVTH_VERIFY_ERROR_BATCH,	// Reporting multiple errors (see RvtH_ProgressParams)
+	RVTH_VERIFY_GROUPS_MISSING,	// Groups aren't present in the image (unallocated CISO/WBFS blocks)
 } RvtH_Verify_Progress_Type;
 
 typedef enum {
@@ -143,6 +353,16 @@ typedef enum {
 	RVTH_VERIFY_ERROR_TABLE_COPY,	// Sector's hash table copy doesn't match base sector.
 } RvtH_Verify_Error_Type;
 
+// Verification error. (RVTH_VERIFY_ERROR_BATCH)
+typedef struct _RvtH_Verify_Error {
+	unsigned int group;	// 2 MB group index
+	uint8_t hash_level;	// 0, 1, 2, 3, 4
+	uint8_t sector;		// Sector 0-63 in the group
+	uint8_t kb;		// Kilobyte 1-31 (H0 only) [KB 0 == hashes]
+	uint8_t err_type;	// Error type (see RvtH_Verify_Error_Type)
+	bool is_zero;		// If true, sector is zeroed. (scrubbed/truncated)
+} RvtH_Verify_Error;
+
 // Verification progress callback status.
 typedef struct _RvtH_Verify_Progress_State {
 	const RvtH *rvth;
@@ -167,6 +387,16 @@ typedef struct _RvtH_Verify_Progress_State {
 	uint8_t kb;		// Kilobyte 1-31 (H0 only) [KB 0 == hashes]
 	uint8_t err_type;	// Error type (see RvtH_Verify_Error_Type)
 	bool is_zero;		// If true, sector is zeroed. (scrubbed/truncated)
+
+	// If RVTH_VERIFY_ERROR_BATCH, the errors in this batch,
+	// in group/sector order. All errors are in the current partition.
+	const RvtH_Verify_Error *errors;
+	unsigned int error_count;
+
+	// If RVTH_VERIFY_GROUPS_MISSING, the number of consecutive
+	// groups starting at group_cur that aren't present in the
+	// image. Each group is counted as one H3 error.
+	unsigned int missing_count;
 } RvtH_Verify_Progress_State;
 
 /**
@@ -177,14 +407,82 @@ typedef struct _RvtH_Verify_Progress_State {
  */
 typedef bool (*RvtH_Verify_Progress_Callback)(const RvtH_Verify_Progress_State *state, void *userdata);
 
+// Verification result for a single bank. (verifyAllWiiPartitions())
+typedef struct _RvtH_Verify_Bank_Result {
+	unsigned int bank;		// Bank number (0-7)
+	int ret;			// verifyWiiPartitions() return value
+	unsigned int error_count[5];	// Error counts for all 5 hash tables
+	bool cached;			// True if this is a cached result (RVTH_VERIFY_USE_CACHE)
+	time_t verify_time;		// Time of the verification
+} RvtH_Verify_Bank_Result;
+
+// Cached verification result. (getCachedVerifyResult())
+typedef struct _RvtH_Verify_Cached_Result {
+	time_t verify_time;		// Time of the verification
+	unsigned int flags;		// Verification flags (RVTH_VERIFY_QUICK, RVTH_VERIFY_SKIP_KNOWN_PARTITIONS)
+	unsigned int error_count[5];	// Error counts for all 5 hash tables
+} RvtH_Verify_Cached_Result;
+
+// Hash tree repair result. (repairWiiPartitions())
+typedef struct _RvtH_Repair_Result {
+	unsigned int groups_checked;		// Groups that were checked
+	unsigned int groups_skipped;		// Groups that were skipped (zeroed or missing)
+	unsigned int groups_repaired;		// Groups with stale hash tables
+	unsigned int sectors_written;		// Sectors that were encrypted again and written
+	unsigned int partitions_updated;	// Partitions whose H3 table and TMD were updated
+} RvtH_Repair_Result;
+
+/**
+ * Bank verification callback.
+ * Called once for each bank as soon as it has been verified.
+ * @param rvth		[in] RvtH object.
+ * @param result	[in] Verification result for this bank.
+ * @param userdata	[in] User data specified when calling the RVT-H function.
+ * @return True to continue; false to skip the remaining banks.
+ */
+typedef bool (*RvtH_Verify_Bank_Callback)(const RvtH *rvth, const RvtH_Verify_Bank_Result *result, void *userdata);
+
 #ifdef __cplusplus
 }
 #endif
 
 #ifdef __cplusplus
 
+// C++ includes
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class BankCache;
+class BankFileSystem;
+class CancelToken;
+class CopyJournal;
+class HashIndex;
+class StatsCounters;
+class TitleKeyStore;
+class VerifyCache;
+class VerifyMap;
+struct PartitionRef;
+
+// File in a bank's filesystem. (RvtH::listFiles())
+struct RvtH_FST_File {
+	std::string path;	// Path, e.g. "sys/main.dol" or "files/opening.bnr" (directories end with '/')
+	uint64_t offset;	// Offset in the user data of the disc or game partition
+	uint64_t size;		// Size, in bytes (0 for directories)
+	bool is_dir;		// True if this is a directory
+};
+
 /** Main class **/
 
+// NOTE: Read-only operations (e.g. verifyWiiPartitions()) on *different*
+// banks may be run concurrently from multiple threads. All banks share
+// one RefFile, which uses positional I/O and atomic reference counting.
+// Operations on the same bank, and operations that modify the bank
+// table, must not be run concurrently.
+// NOTE 2: HDD bank entries are initialized on first access. This is
+// serialized internally, so it's safe to access different banks from
+// multiple threads.
 class RvtH {
 	public:
 		/**
@@ -202,18 +500,44 @@ class RvtH {
 		/**
 		 * Create a writable RVT-H disc image object.
 		 *
+		 * If the filename ends with ".ciso" or ".wbfs", a CISO or WBFS
+		 * image is created. Otherwise, a plain disc image is created.
+		 *
 		 * Check isOpen() after constructing the object to determine
 		 * if the file was opened successfully.
 		 *
 		 * @param filename	[in] Filename.
 		 * @param lba_len	[in] LBA length. (Will NOT be allocated initially.)
 		 * @param pErr		[out,opt] Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 * @param keep		[in,opt] If true, open an existing plain disc image without truncating it, e.g. to resume a copy.
+		 */
+		RvtH(const TCHAR *filename, uint32_t lba_len, int *pErr = nullptr, bool keep = false);
+
+		/**
+		 * Create an empty RVT-H disk image.
+		 *
+		 * The image is created as a sparse file with the full size of
+		 * an RVT-H HDD and a bank table with 8 empty banks. Unlike an
+		 * HDD image that was opened with RvtH(), the returned object
+		 * is writable, so banks can be imported into it.
+		 *
+		 * @param filename	[in] Filename.
+		 * @param pErr		[out,opt] Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 * @return RvtH object, or nullptr on error.
 		 */
-		RvtH(const TCHAR *filename, uint32_t lba_len, int *pErr = nullptr);
+		static RvtH *createHDD(const TCHAR *filename, int *pErr = nullptr);
 
 		~RvtH();
 
 	private:
+		/**
+		 * Open an RVT-H disk image using an open file.
+		 * Check isOpen() after constructing the object.
+		 * @param f_img	[in] RefFile*
+		 * @param pErr	[out,opt] Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		RvtH(RefFile *f_img, int *pErr);
+
 		/** Constructor functions (rvth.cpp) **/
 
 		/**
@@ -239,13 +563,72 @@ class RvtH {
 		 */
 		int openHDD(RefFile *f_img);
 
+		/**
+		 * Initialize an HDD bank entry if it hasn't been initialized yet.
+		 * NOTE: m_bankInitMutex must be held by the caller.
+		 * @param bank	[in] Bank number. (0-7)
+		 * @param level	[in] Initialization level. (See RvtH_BankInit_Level.)
+		 */
+		void initBankEntry_int(unsigned int bank, RvtH_BankInit_Level level = RVTH_BANK_INIT_FULL) const;
+
+		/**
+		 * Reset an HDD bank entry to its pending state using the bank table entry.
+		 * The bank entry will be initialized by getBankEntry() when it's accessed.
+		 * NOTE: m_bankInitMutex must be held by the caller, if necessary.
+		 * NOTE 2: The RvtH_BankEntry must be cleared by the caller.
+		 * @param bank	[in] Bank number. (0-7)
+		 */
+		void resetPendingBank_int(unsigned int bank) const;
+
+		/**
+		 * Check if an HDD bank is the second bank of a dual-layer Wii image.
+		 * If it is, the bank entry is set to RVTH_BankType_Wii_DL_Bank2.
+		 * NOTE: m_bankInitMutex must be held by the caller.
+		 * NOTE 2: The previous bank must have already been initialized.
+		 * @param bank	[in] Bank number. (0-7)
+		 * @return True if this is the second bank of a dual-layer Wii image.
+		 */
+		bool checkBankEntryDL2_int(unsigned int bank) const;
+
+		/**
+		 * Load an HDD bank entry from the bank metadata cache.
+		 * NOTE: m_bankInitMutex must be held by the caller.
+		 * @param bank	[in] Bank number. (0-7)
+		 * @return True if the bank entry was loaded; false if not.
+		 */
+		bool loadBankEntryFromCache_int(unsigned int bank) const;
+
+		/**
+		 * Update the bank metadata cache after initializing an HDD bank entry.
+		 * NOTE: m_bankInitMutex must be held by the caller.
+		 * @param bank	[in] Bank number. (0-7)
+		 * @param ret	[in] rvth_init_BankEntry() return value.
+		 */
+		void storeBankEntryInCache_int(unsigned int bank, int ret) const;
+
+		/**
+		 * Add a block cache to an HDD bank entry's reader.
+		 * The cache size is set by RvtH_CopyParams::block_cache.
+		 * @param bank	[in] Bank number. (0-7)
+		 */
+		void cacheBankReader_int(unsigned int bank) const;
+
+		/**
+		 * Get a bank table entry, initializing it if necessary.
+		 * NOTE: The bank number is NOT range-checked.
+		 * @param bank	[in] Bank number. (0-7)
+		 * @param level	[in] Initialization level. (See RvtH_BankInit_Level.)
+		 * @return Bank table entry.
+		 */
+		RvtH_BankEntry *getBankEntry(unsigned int bank, RvtH_BankInit_Level level = RVTH_BANK_INIT_FULL) const;
+
 	public:
 		/** General utility functions. **/
 		// TODO: Move out of RvtH?
 		/**
 		 * Check if a block is empty.
 		 * @param block Block.
-		 * @param size Block size. (Must be a multiple of 64 bytes.)
+		 * @param size Block size.
 		 * @return True if the block is all zeroes; false if not.
 		 */
 		static bool isBlockEmpty(const uint8_t *block, unsigned int size);
@@ -261,12 +644,48 @@ class RvtH {
 
 		/**
 		 * Write a bank table entry to disk.
+		 * If a bank table transaction is active, the entry is staged
+		 * instead, and it's written by commitBankTableTransaction().
+		 * Otherwise, the RVT-H device is flushed after writing the entry.
 		 * @param bank		[in] Bank number. (0-7)
 		 * @param pTimestamp	[out,opt] Timestamp written to the bank entry.
 		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
 		 */
 		int writeBankEntry(unsigned int bank, time_t *pTimestamp = nullptr);
 
+		/**
+		 * Track writes to a bank while in scope, so the verification map
+		 * is kept when the bank table entry is written. Group data that's
+		 * written must be marked with markBankWritten().
+		 * This must be created before anything is written to the bank.
+		 */
+		class BankWriteScope
+		{
+			public:
+				/**
+				 * Start tracking writes to a bank.
+				 * @param rvth	[in] RVT-H object
+				 * @param bank	[in] Bank number. (0-7)
+				 */
+				BankWriteScope(RvtH *rvth, unsigned int bank);
+				~BankWriteScope();
+
+			private:
+				DISABLE_COPY(BankWriteScope)
+
+			private:
+				RvtH *const m_rvth;
+				const unsigned int m_bank;
+		};
+
+		/**
+		 * Mark a range of a bank as written in the verification map.
+		 * @param bank		[in] Bank number. (0-7)
+		 * @param lba_start	[in] Starting LBA, relative to the bank
+		 * @param lba_len	[in] Length, in LBAs
+		 */
+		void markBankWritten(unsigned int bank, uint32_t lba_start, uint32_t lba_len);
+
 	private:
 		DISABLE_COPY(RvtH)
 
@@ -316,11 +735,55 @@ class RvtH {
 
 		/**
 		 * Get a bank table entry.
+		 *
+		 * With RVTH_BANK_INIT_HEADER, HDD bank entries that haven't been
+		 * accessed yet only have the fields from the bank table and the
+		 * disc header. The encryption, signature, and AppLoader fields
+		 * are initialized when the bank is accessed with RVTH_BANK_INIT_FULL.
+		 *
 		 * @param bank	[in] Bank number. (0-7)
 		 * @param pErr	[out,opt] Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 * @param level	[in,opt] Initialization level. (See RvtH_BankInit_Level.)
 		 * @return Bank table entry.
 		 */
-		const RvtH_BankEntry *bankEntry(unsigned int bank, int *pErr = nullptr) const;
+		const RvtH_BankEntry *bankEntry(unsigned int bank, int *pErr = nullptr,
+			RvtH_BankInit_Level level = RVTH_BANK_INIT_FULL) const;
+
+		/**
+		 * Initialize all HDD bank entries that haven't been initialized yet.
+		 *
+		 * Bank entries are normally initialized on first access. If all banks
+		 * are going to be accessed, e.g. when listing the bank table, this
+		 * function initializes them concurrently, so the signature checks for
+		 * one bank overlap the disk reads for the other banks.
+		 *
+		 * @param threads	[in,opt] Number of worker threads (0 for auto; 1 for single-threaded)
+		 * @param level		[in,opt] Initialization level. (See RvtH_BankInit_Level.)
+		 */
+		void initBankEntries(unsigned int threads = 0, RvtH_BankInit_Level level = RVTH_BANK_INIT_FULL) const;
+
+		/**
+		 * Get a bank summary.
+		 * The bank entry is initialized with RVTH_BANK_INIT_HEADER if necessary.
+		 * @param bank		[in] Bank number. (0-7)
+		 * @param summary	[out] Bank summary.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int bankSummary(unsigned int bank, RvtH_BankSummary *summary) const;
+
+		/**
+		 * Get summaries of all banks.
+		 *
+		 * This is cheaper than calling bankEntry() for each bank if only
+		 * the bank type, LBAs, and game ID are needed: The bank entries
+		 * are initialized concurrently with RVTH_BANK_INIT_HEADER, and the
+		 * summaries are stored contiguously.
+		 *
+		 * @param summaries	[out] Bank summaries, in bank order.
+		 * @param threads	[in,opt] Number of worker threads (0 for auto; 1 for single-threaded)
+		 * @return Number of banks.
+		 */
+		unsigned int bankSummaries(std::vector<RvtH_BankSummary> &summaries, unsigned int threads = 0) const;
 
 	public:
 		/** Write functions (write.cpp) **/
@@ -339,6 +802,275 @@ class RvtH {
 		 */
 		int undeleteBank(unsigned int bank);
 
+		/**
+		 * Wipe a bank on an RVT-H device by zeroing the entire bank.
+		 *
+		 * The OS's zeroing primitive is used if available, e.g. BLKZEROOUT
+		 * on Linux or FSCTL_SET_ZERO_DATA for disk image files on Windows.
+		 * Otherwise, zeroes are written to the bank.
+		 *
+		 * The bank must be empty or deleted. A deleted image can't be
+		 * undeleted after its bank is wiped.
+		 *
+		 * Once a bank is wiped, images can be imported into it using
+		 * RVTH_IMPORT_SKIP_EMPTY, which skips writing empty blocks.
+		 *
+		 * @param bank		[in] Bank number. (0-7)
+		 * @param callback	[in,opt] Progress callback.
+		 * @param userdata	[in,opt] User data for progress callback.
+		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		int wipeBank(unsigned int bank,
+			RvtH_Progress_Callback callback = nullptr,
+			void *userdata = nullptr);
+
+		/**
+		 * Begin a bank table transaction.
+		 *
+		 * While a transaction is active, bank table changes made by
+		 * deleteBank(), undeleteBank(), wipeBank(), copyToHDD(), and
+		 * recryptWiiPartitions() are staged in memory instead of being
+		 * written to the disk immediately. commitBankTableTransaction()
+		 * writes all staged entries with a single write and flush.
+		 *
+		 * NOTE: Only the bank table is deferred. Disc image data,
+		 * e.g. from importing or wiping, is written immediately.
+		 *
+		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		int beginBankTableTransaction(void);
+
+		/**
+		 * Commit the active bank table transaction.
+		 * If the bank table can't be written, the transaction is
+		 * rolled back, and the bank entries are reloaded from disk.
+		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		int commitBankTableTransaction(void);
+
+		/**
+		 * Roll back the active bank table transaction.
+		 * Staged bank table entries are discarded, and the affected
+		 * bank entries are reloaded from disk.
+		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		int rollbackBankTableTransaction(void);
+
+		/**
+		 * Is a bank table transaction active?
+		 * @return True if a bank table transaction is active; false if not.
+		 */
+		inline bool inBankTableTransaction(void) const
+		{
+			return m_txnActive;
+		}
+
+		/**
+		 * Check if the bank table was changed by another program or host.
+		 *
+		 * The bank table is read from the disk with a single read, bypassing
+		 * the OS cache, and compared with the bank table entries that were
+		 * loaded when the device was opened. Banks whose entries changed,
+		 * e.g. a new timestamp after an import, are cleared and will be
+		 * reinitialized when they're accessed. Other banks are kept as-is.
+		 *
+		 * NOTE: Banks that are cleared must not be in use by another thread.
+		 *
+		 * @param changed	[out,opt] Banks that were cleared, in order. (If a dual-layer bank changed, the next bank is also cleared.)
+		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 *         -ESTALE if the bank table header changed; the device must be reopened.
+		 */
+		int pollBankTable(std::vector<unsigned int> *changed = nullptr);
+
+	private:
+		/**
+		 * End the active bank table transaction.
+		 * @param reload	[in] If true, reload the staged bank entries from disk.
+		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		int endBankTableTransaction_int(bool reload);
+
+		/**
+		 * Reload a bank table entry from disk and clear the bank entry.
+		 * The bank entry will be reinitialized when it's accessed.
+		 * NOTE: m_bankInitMutex must be held by the caller.
+		 * @param bank	[in] Bank number.
+		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		int reloadBankEntry_int(unsigned int bank);
+
+		/**
+		 * Clear a bank entry using the bank table entry in m_pendingBanks.
+		 * The bank entry will be reinitialized when it's accessed.
+		 * NOTE: m_bankInitMutex must be held by the caller.
+		 * @param bank	[in] Bank number.
+		 */
+		void clearBankEntry_int(unsigned int bank);
+
+	public:
+		/** Copy parameters (extract.cpp) **/
+
+		/**
+		 * Set the copy buffer parameters for extracting and importing.
+		 *
+		 * If the buffer size is 0, it's selected automatically:
+		 * - If neither image is a device, 1 MB buffers are used.
+		 * - If the source is a device, the read throughput of the
+		 *   first few MB is measured for a few buffer sizes.
+		 * - If only the destination is a device, 4 MB buffers are used.
+		 * - If the source image is stored in blocks (CISO, WBFS, RVTZ),
+		 *   the buffer size is rounded up to a multiple of the block size.
+		 *
+		 * If direct_io is set and this is an RVT-H Reader device, direct I/O
+		 * is enabled for the device, and the buffer alignment is increased
+		 * to the device's sector size if necessary. This is also used when
+		 * verifying. If direct I/O isn't available, buffered I/O is used.
+		 *
+		 * If slow_read_ms is set, the latency of each read of the device
+		 * or disk image file is measured. (See getReadLatency().)
+		 *
+		 * If mem_budget is set, each operation on this object keeps its
+		 * in-flight buffers within the budget: the number of worker threads
+		 * for verification and encryption, the number of reader threads
+		 * for latency scans, and the number of copy buffers are reduced,
+		 * and then the copy buffer size. This overrides the buffer count
+		 * and size if they don't fit. If no limit is set, the defaults are
+		 * sized for the host. The process-wide BufferPool's idle cache is
+		 * also limited to the budget, so the most recent budget applies.
+		 *
+		 * io_priority and bw_limit apply to all file reads and writes by
+		 * operations on this object, including reads on io_uring and the
+		 * destination of an extract or import. The bandwidth limit is
+		 * shared by all of the operation's threads, and reads and writes
+		 * both count towards it. On Linux, the I/O priority is set using
+		 * ioprio_set(); on Windows, using background thread mode.
+		 *
+		 * durability applies to this object's file, e.g. when recrypting
+		 * or writing the bank table, and to the destination of an extract,
+		 * conversion, or import, including the destination's bank table.
+		 *
+		 * readback_window is used by imports with RVTH_IMPORT_READBACK.
+		 * Chunks are read back once the writer is this far past them,
+		 * so reads don't compete with the writes that are in progress.
+		 *
+		 * block_cache is the size of the block cache for small reads,
+		 * e.g. of the partition tables, tickets, and TMDs, from each
+		 * HDD bank. It applies to banks that are initialized after
+		 * it's set. Set it to RVTH_BLOCK_CACHE_DISABLED to read
+		 * everything directly from the device.
+		 *
+		 * @param params	[in] Copy parameters.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int setCopyParams(const RvtH_CopyParams *params);
+
+		/**
+		 * Get the copy buffer parameters.
+		 * @return Copy parameters.
+		 */
+		inline const RvtH_CopyParams *copyParams(void) const { return &m_copyParams; }
+
+		/**
+		 * Set the progress callback throttling parameters.
+		 * These are used for extracting, importing, wiping, and verifying.
+		 * @param params	[in] Progress parameters.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int setProgressParams(const RvtH_ProgressParams *params);
+
+		/**
+		 * Get the progress callback throttling parameters.
+		 * @return Progress parameters.
+		 */
+		inline const RvtH_ProgressParams *progressParams(void) const { return &m_progressParams; }
+
+		/**
+		 * Get the performance statistics.
+		 * Counters accumulate over all operations on this object
+		 * until resetStats() is called.
+		 * @param stats	[out] Statistics.
+		 */
+		void getStats(RvtH_Stats *stats) const;
+
+		/**
+		 * Reset the performance statistics.
+		 * This also resets the read latency statistics.
+		 */
+		void resetStats(void);
+
+		/**
+		 * Get the read latency statistics.
+		 * Latency is measured for each read of the device or disk image
+		 * file if RvtH_CopyParams::slow_read_ms is set.
+		 * @param latency	[out] Read latency statistics.
+		 * @return 0 on success; -ENOTSUP if read latency isn't being measured.
+		 */
+		int getReadLatency(RvtH_Read_Latency *latency) const;
+
+		/**
+		 * Set the cancellation token for operations on this object.
+		 *
+		 * While a token is set, calling CancelToken::cancel() from any
+		 * thread stops the running operation, e.g. extract, import,
+		 * verify, or recrypt, at the next read, write, or group. If an
+		 * operation fails after its token was cancelled, it was cancelled;
+		 * the error code may be -ECANCELED or the error from the stage
+		 * that was interrupted, e.g. a short read.
+		 *
+		 * Only one token can be set at a time. (See AsyncJob.)
+		 *
+		 * @param token	[in,opt] Cancellation token. (nullptr to remove it; must remain valid until removed)
+		 * @return 0 on success; -EBUSY if a different token is already set.
+		 */
+		int setCancelToken(const CancelToken *token);
+
+		/**
+		 * Use a title key store that's shared with other RvtH objects.
+		 * By default, each RvtH object has its own title key store.
+		 * @param store	[in] Title key store.
+		 */
+		void setTitleKeyStore(const std::shared_ptr<TitleKeyStore> &store);
+
+	private:
+		/**
+		 * Resolve the copy buffer parameters for a copy operation.
+		 * Automatic values are replaced with the actual values.
+		 * @param reader_src	[in] Source reader.
+		 * @param file_dest	[in] Destination file.
+		 * @param params	[out] Resolved copy parameters.
+		 */
+		void resolveCopyParams(Reader *reader_src, const RefFile *file_dest, RvtH_CopyParams *params) const;
+
+		/**
+		 * Limit the number of worker threads to the memory budget.
+		 * @param threads		[in] Number of worker threads.
+		 * @param bytes_per_thread	[in] Buffer memory used by each worker, in bytes.
+		 * @return Number of worker threads that fit in the budget. (at least 1)
+		 */
+		unsigned int budgetThreads(unsigned int threads, size_t bytes_per_thread) const;
+
+		/**
+		 * Apply the durability policy to the destination of a copy operation.
+		 * Does nothing if m_sharedDurability is set.
+		 * @param reader_dest	[in] Destination reader.
+		 */
+		void applyDurability(Reader *reader_dest) const;
+
+		/**
+		 * Decrypt a Wii title key.
+		 * Decrypted title keys are cached in the title key store,
+		 * so repeated operations on the same bank don't need to decrypt
+		 * the title key again. (See setTitleKeyStore().)
+		 *
+		 * This function is thread-safe.
+		 *
+		 * @param ticket	[in] Ticket.
+		 * @param titleKey	[out] Output buffer for the title key. (Must be 16 bytes.)
+		 * @param crypto_type	[out] Encryption type. (See RVL_CryptoType_e.)
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int decryptTitleKey(const RVL_Ticket *ticket, uint8_t *titleKey, uint8_t *crypto_type) const;
+
 	public:
 		/** Extract functions (extract.cpp, extract_crypt.cpp) **/
 
@@ -346,13 +1078,24 @@ class RvtH {
 		 * Copy a bank from this RVT-H HDD or standalone disc image to a writable standalone disc image.
 		 * @param rvth_dest	[out] Destination RvtH object.
 		 * @param bank_src	[in] Source bank number. (0-7)
+		 * @param flags		[in] Flags. (See RvtH_Extract_Flags; only RVTH_EXTRACT_SCRUB, RVTH_EXTRACT_DIGESTS, RVTH_EXTRACT_SPARSE, and RVTH_EXTRACT_PREALLOCATE are used.)
 		 * @param callback	[in,opt] Progress callback.
 		 * @param userdata	[in,opt] User data for progress callback.
+		 * @param pDigests	[out,opt] Image digests. (Only set if RVTH_EXTRACT_DIGESTS is set.)
+		 * @param pHashIndex	[in,out,opt] Initialized hash index to update with the copied data.
+		 * @param pOmit		[in,opt] Partitions to leave out of the destination image. (They're still read for the digests and hash index.)
+		 * @param rvth_base	[in,opt] Base image. Groups that are identical in the base image are copied from it instead.
+		 * @param journal	[in,out,opt] Opened progress journal. If it was loaded, copying resumes where the journal left off.
 		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
 		 */
-		int copyToGcm(RvtH *rvth_dest, unsigned int bank_src,
+		int copyToGcm(RvtH *rvth_dest, unsigned int bank_src, unsigned int flags = 0,
 			RvtH_Progress_Callback callback = nullptr,
-			void *userdata = nullptr);
+			void *userdata = nullptr,
+			RvtH_Image_Digests *pDigests = nullptr,
+			HashIndex *pHashIndex = nullptr,
+			const std::vector<PartitionRef> *pOmit = nullptr,
+			RvtH *rvth_base = nullptr,
+			CopyJournal *journal = nullptr);
 
 		/**
 		 * Copy a bank from this RVT-H HDD or standalone disc image to a writable standalone disc image.
@@ -361,46 +1104,234 @@ class RvtH {
 		 * using the existing title key. It does *not* change the encryption
 		 * method or signature, so recryption will be needed afterwards.
 		 *
+		 * Groups are encrypted by a pool of worker threads. The encrypted
+		 * groups are written and the progress callback is invoked from the
+		 * calling thread, in group order.
+		 *
 		 * @param rvth_dest	[out] Destination RvtH object.
 		 * @param bank_src	[in] Source bank number. (0-7)
 		 * @param callback	[in,opt] Progress callback.
 		 * @param userdata	[in,opt] User data for progress callback.
+		 * @param threads	[in,opt] Number of worker threads (0 for auto; 1 for single-threaded)
 		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
 		 */
 		int copyToGcm_doCrypt(RvtH *rvth_dest, unsigned int bank_src,
 			RvtH_Progress_Callback callback = nullptr,
-			void *userdata = nullptr);
+			void *userdata = nullptr,
+			unsigned int threads = 0);
+
+		/**
+		 * Copy a bank from this RVT-H HDD or standalone disc image to a writable standalone disc image.
+		 *
+		 * This function copies an encrypted Game Partition and decrypts it
+		 * into the unencrypted RVT-R layout: The hash blocks are removed,
+		 * and the disc header is marked as unencrypted. The ticket and TMD
+		 * aren't changed, so the image can be encrypted again using
+		 * copyToGcm_doCrypt().
+		 *
+		 * Groups are decrypted by a pool of worker threads. The unencrypted
+		 * groups are written and the progress callback is invoked from the
+		 * calling thread, in group order. The destination is written in
+		 * increasing LBA order.
+		 *
+		 * @param rvth_dest	[out] Destination RvtH object.
+		 * @param bank_src	[in] Source bank number. (0-7)
+		 * @param callback	[in,opt] Progress callback.
+		 * @param userdata	[in,opt] User data for progress callback.
+		 * @param threads	[in,opt] Number of worker threads (0 for auto; 1 for single-threaded)
+		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		int copyToGcm_doDecrypt(RvtH *rvth_dest, unsigned int bank_src,
+			RvtH_Progress_Callback callback = nullptr,
+			void *userdata = nullptr,
+			unsigned int threads = 0);
 
 		/**
 		 * Extract a disc image from this RVT-H disk image.
 		 * Compatibility wrapper; this function creates a new RvtH
 		 * using the GCM constructor and then copyToGcm().
+		 * The destination format is selected by the file extension.
 		 * @param bank		[in] Bank number. (0-7)
 		 * @param filename	[in] Destination filename.
 		 * @param recrypt_key	[in] Key for recryption. (-1 for default; otherwise, see RVL_CryptoType_e)
 		 * @param flags		[in] Flags. (See RvtH_Extract_Flags.)
 		 * @param callback	[in,opt] Progress callback.
 		 * @param userdata	[in,opt] User data for progress callback.
+		 * @param store_dir	[in,opt] Partition store directory. (Required for RVTH_EXTRACT_STORE_UPDATES.)
+		 * @param base_filename	[in,opt] Base image, e.g. an older dump. Identical groups are copied from it.
 		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
 		 */
 		int extract(unsigned int bank, const TCHAR *filename,
 			int recrypt_key, unsigned int flags,
+			RvtH_Progress_Callback callback = nullptr,
+			void *userdata = nullptr,
+			const TCHAR *store_dir = nullptr,
+			const TCHAR *base_filename = nullptr);
+
+		/**
+		 * Extract multiple banks from this RVT-H disk image.
+		 *
+		 * The banks are read one at a time, in the order they're stored on
+		 * the device, so the device is read sequentially. This also applies
+		 * to discs in a WBFS partition. If the images are recrypted, each
+		 * image is recrypted on a worker thread while the next bank is being
+		 * read. Recryption on the worker thread doesn't report progress.
+		 * If a job fails, the remaining jobs are still run.
+		 *
+		 * @param jobs		[in,out] Extract jobs.
+		 * @param count		[in] Number of jobs.
+		 * @param recrypt_key	[in] Key for recryption. (-1 for default; otherwise, see RVL_CryptoType_e)
+		 * @param flags		[in] Flags. (See RvtH_Extract_Flags.)
+		 * @param callback	[in,opt] Progress callback.
+		 * @param userdata	[in,opt] User data for progress callback.
+		 * @param store_dir	[in,opt] Partition store directory. (Required for RVTH_EXTRACT_STORE_UPDATES.)
+		 * @return Error code of the first job that failed, or 0 if all jobs succeeded.
+		 *         (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		int extractBanks(RvtH_Extract_Job *jobs, unsigned int count,
+			int recrypt_key, unsigned int flags,
+			RvtH_Progress_Callback callback = nullptr,
+			void *userdata = nullptr,
+			const TCHAR *store_dir = nullptr);
+
+		/**
+		 * Extract a disc image from this RVT-H disk image to multiple destinations.
+		 *
+		 * The bank is read from the device once. Each destination is written
+		 * by its own thread with its own queue, so a slow destination falls
+		 * behind by up to its queue limit without holding up the device read.
+		 * If a destination fails, the other destinations continue.
+		 *
+		 * Destinations can be anything that extract() can create, including
+		 * "-" for standard output, but the bank can't be recrypted.
+		 *
+		 * @param bank		[in] Bank number. (0-7)
+		 * @param filenames	[in] Destination filenames.
+		 * @param count		[in] Number of destinations.
+		 * @param flags		[in] Flags. (See RvtH_Extract_Flags; only RVTH_EXTRACT_PREPEND_SDK_HEADER, RVTH_EXTRACT_SCRUB, RVTH_EXTRACT_DIGESTS, RVTH_EXTRACT_SPARSE, and RVTH_EXTRACT_PREALLOCATE are supported.)
+		 * @param callback	[in,opt] Progress callback.
+		 * @param userdata	[in,opt] User data for progress callback.
+		 * @param results	[out,opt] Array of `count` error codes, one for each destination.
+		 * @return Error code of the first destination that failed, or 0 if all destinations succeeded.
+		 *         (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		int extractTee(unsigned int bank, const TCHAR *const *filenames, unsigned int count,
+			unsigned int flags,
+			RvtH_Progress_Callback callback = nullptr,
+			void *userdata = nullptr,
+			int *results = nullptr);
+
+		/**
+		 * Convert this standalone disc image to another container format,
+		 * e.g. WBFS to a plain disc image, or a plain disc image to CISO.
+		 *
+		 * The image is copied as-is from its Reader to a new Reader for the
+		 * destination, without any bank processing: the bank type isn't
+		 * checked, the disc header isn't restored, and nothing is recrypted.
+		 * The destination format is selected by the file extension.
+		 * (See Reader::create().)
+		 *
+		 * Unallocated areas of the source image aren't read, empty blocks
+		 * aren't written, and chunks are read ahead while the current chunk
+		 * is being written. Digests are calculated on a worker thread, and
+		 * RVTZ images are compressed on worker threads. If both images are
+		 * plain files on a file system that supports it, the source image's
+		 * blocks are shared instead of copied.
+		 *
+		 * @param filename	[in] Destination filename. ("-" for standard output)
+		 * @param flags		[in] Flags. (See RvtH_Extract_Flags; only RVTH_EXTRACT_DIGESTS, RVTH_EXTRACT_SPARSE, and RVTH_EXTRACT_PREALLOCATE are used.)
+		 * @param callback	[in,opt] Progress callback. (RVTH_PROGRESS_CONVERT)
+		 * @param userdata	[in,opt] User data for progress callback.
+		 * @param pDigests	[out,opt] Image digests. (Only set if RVTH_EXTRACT_DIGESTS is set.)
+		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		int convert(const TCHAR *filename, unsigned int flags = 0,
+			RvtH_Progress_Callback callback = nullptr,
+			void *userdata = nullptr,
+			RvtH_Image_Digests *pDigests = nullptr);
+
+		/**
+		 * Calculate the digests of a bank without extracting it.
+		 *
+		 * The digests are the same as the digests calculated by extract()
+		 * without recryption or an SDK header: the disc header is restored
+		 * if it was zeroed, and the entire bank is hashed. They can then be
+		 * matched against a DAT file. (See DatIndex.)
+		 *
+		 * Unallocated areas of the image aren't read, and chunks are read
+		 * ahead while the current chunk is being hashed.
+		 *
+		 * @param bank		[in] Bank number. (0-7)
+		 * @param pDigests	[out] Image digests.
+		 * @param callback	[in,opt] Progress callback. (RVTH_PROGRESS_IDENTIFY)
+		 * @param userdata	[in,opt] User data for progress callback.
+		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		int digestBank(unsigned int bank, RvtH_Image_Digests *pDigests,
+			RvtH_Progress_Callback callback = nullptr,
+			void *userdata = nullptr);
+
+	private:
+		/**
+		 * Extract a disc image from this RVT-H disk image.
+		 * If ppRecrypt is specified, the destination image isn't recrypted.
+		 * Instead, if it needs to be recrypted, it's returned in ppRecrypt,
+		 * and the caller must recrypt it and delete it.
+		 * @param bank		[in] Bank number. (0-7)
+		 * @param filename	[in] Destination filename.
+		 * @param recrypt_key	[in] Key for recryption. (-1 for default; otherwise, see RVL_CryptoType_e)
+		 * @param flags		[in] Flags. (See RvtH_Extract_Flags.)
+		 * @param callback	[in,opt] Progress callback.
+		 * @param userdata	[in,opt] User data for progress callback.
+		 * @param store_dir	[in,opt] Partition store directory. (Required for RVTH_EXTRACT_STORE_UPDATES.)
+		 * @param base_filename	[in,opt] Base image, e.g. an older dump. Identical groups are copied from it.
+		 * @param ppRecrypt	[out,opt] Destination image to recrypt. (nullptr if it doesn't need to be recrypted)
+		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		int extract_int(unsigned int bank, const TCHAR *filename,
+			int recrypt_key, unsigned int flags,
+			RvtH_Progress_Callback callback, void *userdata,
+			const TCHAR *store_dir, const TCHAR *base_filename,
+			RvtH **ppRecrypt);
+
+	public:
+		/**
+		 * Reconstruct a full disc image from this archived disc image.
+		 * This must be a standalone disc image that was extracted using
+		 * RVTH_EXTRACT_STORE_UPDATES. The image is copied to the destination,
+		 * and the stored partitions listed in its .prefs file are copied
+		 * from the partition store.
+		 * NOTE: SDK headers aren't copied to the destination.
+		 * @param filename	[in] Destination filename.
+		 * @param store_dir	[in] Partition store directory.
+		 * @param callback	[in,opt] Progress callback.
+		 * @param userdata	[in,opt] User data for progress callback.
+		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		int reconstruct(const TCHAR *filename, const TCHAR *store_dir,
 			RvtH_Progress_Callback callback = nullptr,
 			void *userdata = nullptr);
 
 		/**
 		 * Copy a bank from this HDD or standalone disc image to an RVT-H system.
+		 *
+		 * If the destination is an RVT-H disk image file, it's kept sparse:
+		 * empty blocks are deallocated instead of written.
+		 *
 		 * @param rvth_dest	[in] Destination RvtH object.
 		 * @param bank_dest	[in] Destination bank number. (0-7)
 		 * @param bank_src	[in] Source bank number. (0-7)
+		 * @param flags		[in] Flags. (See RvtH_Import_Flags.)
 		 * @param callback	[in,opt] Progress callback.
 		 * @param userdata	[in,opt] User data for progress callback.
+		 * @param pDigests	[out,opt] Image digests. (Only set if RVTH_IMPORT_DIGESTS is set.)
 		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
 		 */
 		int copyToHDD(RvtH *rvth_dest, unsigned int bank_dest,
-			unsigned int bank_src,
+			unsigned int bank_src, unsigned int flags = 0,
 			RvtH_Progress_Callback callback = nullptr,
-			void *userdata = nullptr);
+			void *userdata = nullptr,
+			RvtH_Image_Digests *pDigests = nullptr);
 
 		/**
 		 * Import a disc image into this RVT-H disk image.
@@ -411,18 +1342,196 @@ class RvtH {
 		 * @param callback	[in,opt] Progress callback.
 		 * @param userdata	[in,opt] User data for progress callback.
 		 * @param ios_force	[in,opt] IOS version to force. (-1 to use the existing IOS)
+		 * @param flags		[in,opt] Flags. (See RvtH_Import_Flags.)
 		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
 		 */
 		int import(unsigned int bank, const TCHAR *filename,
 			RvtH_Progress_Callback callback = nullptr,
 			void *userdata = nullptr,
-			int ios_force = -1);
+			int ios_force = -1,
+			unsigned int flags = 0);
+
+		/**
+		 * Check if a disc image can be imported into this RVT-H disk image.
+		 * Nothing is written, and only the image's metadata is read.
+		 * @param bank		[in] Bank number. (0-7)
+		 * @param filename	[in] Source GCM filename.
+		 * @param ios_force	[in,opt] IOS version to force. (-1 to use the existing IOS)
+		 * @param flags		[in,opt] Flags. (See RvtH_Import_Flags.)
+		 * @return 0 if the image can be imported; otherwise, the error import() would fail with.
+		 *         (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		int checkImport(unsigned int bank, const TCHAR *filename,
+			int ios_force = -1,
+			unsigned int flags = 0);
+
+		/**
+		 * Import multiple disc images into this RVT-H disk image.
+		 *
+		 * The jobs are run in order. While one image is being imported, the
+		 * next image is opened and its data is prefetched in the background.
+		 * The bank table is updated once, after all of the images have been
+		 * imported. If a job fails, the remaining jobs are skipped, and the
+		 * bank table entries for the images that were imported are written.
+		 *
+		 * @param jobs		[in,out] Import jobs.
+		 * @param count		[in] Number of jobs.
+		 * @param callback	[in,opt] Progress callback.
+		 * @param userdata	[in,opt] User data for progress callback.
+		 * @param ios_force	[in,opt] IOS version to force. (-1 to use the existing IOS)
+		 * @param flags		[in,opt] Flags. (See RvtH_Import_Flags.)
+		 * @return Error code of the first job that failed, or the bank table write.
+		 *         (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		int importBanks(RvtH_Import_Job *jobs, unsigned int count,
+			RvtH_Progress_Callback callback = nullptr,
+			void *userdata = nullptr,
+			int ios_force = -1,
+			unsigned int flags = 0);
+
+		/**
+		 * Import multiple disc images into this RVT-H disk image concurrently.
+		 *
+		 * Each job is run on its own worker thread, so this should only
+		 * be used if the RVT-H disk image is on storage that handles
+		 * concurrent writes well, e.g. an image file on an SSD. All of
+		 * the source images are opened before any data is written.
+		 *
+		 * Jobs with the bank number set to RVTH_IMPORT_BANK_AUTO are
+		 * assigned to the next free banks, in order. Dual-layer Wii
+		 * images use two banks.
+		 *
+		 * The bank table is updated once, after all of the jobs have
+		 * finished. If a job fails, the other jobs continue, and the
+		 * bank table entries for the images that were imported are written.
+		 *
+		 * NOTE: Progress callbacks are serialized, but they're called
+		 * from the worker threads. Check bank_rvth to see which job
+		 * the update is for.
+		 *
+		 * @param jobs		[in,out] Import jobs.
+		 * @param count		[in] Number of jobs.
+		 * @param callback	[in,opt] Progress callback.
+		 * @param userdata	[in,opt] User data for progress callback.
+		 * @param ios_force	[in,opt] IOS version to force. (-1 to use the existing IOS)
+		 * @param flags		[in,opt] Flags. (See RvtH_Import_Flags.)
+		 * @return Error code of the first job that failed, or the bank table write.
+		 *         (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		int importBanksParallel(RvtH_Import_Job *jobs, unsigned int count,
+			RvtH_Progress_Callback callback = nullptr,
+			void *userdata = nullptr,
+			int ios_force = -1,
+			unsigned int flags = 0);
+
+		/**
+		 * Clone this RVT-H device or disk image to another RVT-H device or disk image.
+		 *
+		 * Every bank with a disc image is copied to the same bank number in
+		 * the destination using copyToHDD(), so the source is read ahead while
+		 * the destination is written. Empty and deleted banks aren't copied.
+		 * The bank table is updated once, after all of the banks have been copied.
+		 *
+		 * When the banks have been copied, each one is compared with the
+		 * source using compareBank(), which reads both units at the same time.
+		 * Banks that don't match are deleted in the destination.
+		 *
+		 * Both units must have the same number of banks. Destination banks
+		 * that receive a disc image must be empty or deleted, as must the
+		 * destination banks that are empty or deleted in the source.
+		 *
+		 * @param rvth_dest	[in] Destination RvtH object.
+		 * @param flags		[in,opt] Flags. (See RvtH_Import_Flags; only RVTH_IMPORT_SKIP_EMPTY is used.)
+		 * @param callback	[in,opt] Progress callback. (RVTH_PROGRESS_IMPORT, then RVTH_PROGRESS_COMPARE)
+		 * @param userdata	[in,opt] User data for progress callback.
+		 * @return Error code of the first bank that failed, or the bank table write.
+		 *         (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 *         RVTH_ERROR_READBACK_MISMATCH if a bank doesn't match the source.
+		 */
+		int cloneHDD(RvtH *rvth_dest, unsigned int flags = 0,
+			RvtH_Progress_Callback callback = nullptr,
+			void *userdata = nullptr);
+
+	private:
+		/**
+		 * Open a standalone disc image for importing.
+		 * @param filename	[in] Source GCM filename.
+		 * @param prefetch	[in] If true, initialize the bank entry and prefetch the start of the image.
+		 * @param pErr		[out] Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 * @return RvtH object, or nullptr on error.
+		 */
+		static RvtH *openImportSource(const TCHAR *filename, bool prefetch, int *pErr);
+
+		/**
+		 * Check if a bank from this HDD or standalone disc image can be copied
+		 * to an RVT-H system. Nothing is written.
+		 * Only the bank entries are used, i.e. the disc headers and the image
+		 * sizes from the readers, so this doesn't read any image data.
+		 * errno is set on error.
+		 * @param rvth_dest	[in] Destination RvtH object.
+		 * @param bank_dest	[in] Destination bank number. (0-7)
+		 * @param bank_src	[in] Source bank number. (0-7)
+		 * @param flags		[in] Flags. (See RvtH_Import_Flags.)
+		 * @return 0 if the bank can be copied; negative POSIX error code or RvtH_Errors if not.
+		 */
+		int checkCopyToHDD(RvtH *rvth_dest, unsigned int bank_dest,
+			unsigned int bank_src, unsigned int flags);
+
+		/**
+		 * Check if an opened standalone disc image can be imported into this RVT-H disk image.
+		 * Nothing is written. Only the disc header, the partition table, and the
+		 * image size from the reader's block map are used, so this is fast even
+		 * for images that are on slow storage.
+		 * @param bank		[in] Bank number. (0-7)
+		 * @param rvth_src	[in] Source disc image, opened by openImportSource().
+		 * @param ios_force	[in] IOS version to force. (-1 to use the existing IOS)
+		 * @param flags		[in] Flags. (See RvtH_Import_Flags.)
+		 * @return 0 if the image can be imported; otherwise, the error import() would fail with.
+		 *         (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		int checkImport_int(unsigned int bank, RvtH *rvth_src, int ios_force, unsigned int flags);
+
+		/**
+		 * Import an opened standalone disc image into this RVT-H disk image.
+		 * @param bank		[in] Bank number. (0-7)
+		 * @param rvth_src	[in] Source disc image, opened by openImportSource().
+		 * @param filename	[in] Source GCM filename.
+		 * @param callback	[in,opt] Progress callback.
+		 * @param userdata	[in,opt] User data for progress callback.
+		 * @param ios_force	[in] IOS version to force. (-1 to use the existing IOS)
+		 * @param flags		[in] Flags. (See RvtH_Import_Flags.)
+		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		int importFrom_int(unsigned int bank, RvtH *rvth_src, const TCHAR *filename,
+			RvtH_Progress_Callback callback, void *userdata,
+			int ios_force, unsigned int flags, bool *pNeedsID = nullptr);
 
 	public:
 		/** Recryption functions (recrypt.cpp) **/
 
+		/**
+		 * Write the import identifier to a bank.
+		 * @param bank	[in] Bank number. (0-7)
+		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
 		int recryptID(unsigned int bank);
 
+		/**
+		 * Write the import identifier to multiple banks.
+		 *
+		 * This is done in three passes: the disc headers and identifier areas
+		 * of all banks are read, the identifiers are created in parallel, and
+		 * then all of the identifiers are written in LBA order and flushed once.
+		 * Identifier areas that aren't empty aren't changed.
+		 *
+		 * @param banks		[in] Bank numbers. (0-7)
+		 * @param count		[in] Number of banks.
+		 * @param results	[out,opt] Array of `count` error codes, one for each bank.
+		 * @return Error code of the first bank that failed, or 0 if all banks succeeded.
+		 *         (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		int recryptIDBanks(const unsigned int *banks, unsigned int count, int *results = nullptr);
+
 		/**
 		 * Re-encrypt partitions in a Wii disc image.
 		 *
@@ -468,16 +1577,263 @@ class RvtH {
 		 * NOTE: Assuming the TMD signature is valid, which means
 		 * the H4 hash is correct.
 		 *
+		 * If RVTH_VERIFY_QUICK is set, only the hash tables are
+		 * decrypted, and H0 is only checked for a random sample
+		 * of groups.
+		 *
+		 * If RVTH_VERIFY_SKIP_KNOWN_PARTITIONS is set, the user data of
+		 * update partitions in the known partitions database isn't checked.
+		 * Update partitions that pass a full verification without errors
+		 * are added to the database. (See KnownPartitions.)
+		 *
+		 * If RVTH_VERIFY_USE_CACHE is set and the bank hasn't been
+		 * rewritten since it was last verified, the cached result is
+		 * returned without verifying the bank again. Otherwise, groups
+		 * that were clean the last time and haven't been written since
+		 * are skipped. Results are always cached for RVT-H Readers and
+		 * HDD images.
+		 *
+		 * Groups are decrypted and verified by a pool of worker threads.
+		 * Progress callbacks are always invoked from the calling thread,
+		 * in the same group/sector order as single-threaded verification.
+		 *
 		 * @param bank		[in] Bank number (0-7)
 		 * @param errors	[out] Error counts for all 5 hash tables
 		 * @param callback	[in,opt] Progress callback
 		 * @param userdata	[in,opt] User data for progress callback
+		 * @param threads	[in,opt] Number of worker threads (0 for auto; 1 for single-threaded)
+		 * @param flags		[in,opt] Flags (See RvtH_Verify_Flags.)
 		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
 		 */
 		int verifyWiiPartitions(unsigned int bank,
 			unsigned int error_count[5] = nullptr,
 			RvtH_Verify_Progress_Callback callback = nullptr,
-			void *userdata = nullptr);
+			void *userdata = nullptr,
+			unsigned int threads = 0,
+			unsigned int flags = 0);
+
+		/**
+		 * Verify partitions in all Wii banks.
+		 *
+		 * Each bank is verified using verifyWiiPartitions() on a pool of
+		 * worker threads, with one bank per thread. Banks that can't be
+		 * verified (empty, GameCube, unencrypted, etc.) are not scheduled;
+		 * their results have the corresponding RvtH_Errors code.
+		 *
+		 * The bank callback is always invoked from the calling thread,
+		 * in the order that banks finish verification.
+		 *
+		 * If RVTH_VERIFY_USE_CACHE is set, banks that haven't been
+		 * rewritten since they were last verified report their cached
+		 * results without being verified again.
+		 *
+		 * @param results	[out,opt] Array of bankCount() results, in bank order
+		 * @param callback	[in,opt] Bank callback
+		 * @param userdata	[in,opt] User data for bank callback
+		 * @param threads	[in,opt] Number of worker threads (0 for auto; 1 for single-threaded)
+		 * @param flags		[in,opt] Flags (See RvtH_Verify_Flags.)
+		 * @return Number of banks that were verified, or negative POSIX error code on error.
+		 */
+		int verifyAllWiiPartitions(RvtH_Verify_Bank_Result *results = nullptr,
+			RvtH_Verify_Bank_Callback callback = nullptr,
+			void *userdata = nullptr,
+			unsigned int threads = 0,
+			unsigned int flags = 0);
+
+		/**
+		 * Get the cached verification result for a bank.
+		 *
+		 * Results are cached by verifyWiiPartitions(), and are only
+		 * valid if the bank hasn't been rewritten since it was verified.
+		 * This reads the partition headers, but not the partition data.
+		 *
+		 * @param bank		[in] Bank number (0-7)
+		 * @param result	[out] Cached verification result
+		 * @param flags		[in,opt] Flags (Quick verification results are only returned if RVTH_VERIFY_QUICK is set, and results that skipped known partitions if RVTH_VERIFY_QUICK or RVTH_VERIFY_SKIP_KNOWN_PARTITIONS is set.)
+		 * @return 0 on success; -ENOENT if no result is cached; other error code on error.
+		 */
+		int getCachedVerifyResult(unsigned int bank, RvtH_Verify_Cached_Result *result, unsigned int flags = 0);
+
+	public:
+		/** Hash tree repair (repair.cpp) **/
+
+		/**
+		 * Repair the hash trees of the encrypted partitions in a Wii bank.
+		 *
+		 * The user data is assumed to be correct. For each group, the H0-H2
+		 * tables are rebuilt from the decrypted user data, and only the
+		 * sectors whose hash tables changed are encrypted again and written
+		 * back. The H3 table and the TMD content hash (H4) are updated if
+		 * they changed, and the TMD is signed again. Groups are repaired on
+		 * the thread pool; zeroed groups are skipped.
+		 *
+		 * @param bank		[in] Bank number (0-7)
+		 * @param result	[out,opt] Repair result
+		 * @param callback	[in,opt] Progress callback (RVTH_PROGRESS_REPAIR)
+		 * @param userdata	[in,opt] User data for progress callback
+		 * @param threads	[in,opt] Number of worker threads (0 for auto; 1 for single-threaded)
+		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.) [-ECANCELED if cancelled]
+		 */
+		int repairWiiPartitions(unsigned int bank, RvtH_Repair_Result *result = nullptr,
+			RvtH_Progress_Callback callback = nullptr, void *userdata = nullptr,
+			unsigned int threads = 0);
+
+	public:
+		/** Benchmark (bench.cpp) **/
+
+		/**
+		 * Measure the throughput of each stage of the extract and verify pipelines.
+		 *
+		 * - Sequential and random reads of the bank, using the same Reader
+		 *   and copy parameters as extracting. Cached data for the bank is
+		 *   dropped first, so the reads come from the device if possible.
+		 * - AES decryption, SHA-1, and combined verification throughput of the
+		 *   active libwiicrypto implementations, using one thread.
+		 * - Write throughput of a new file, if a filename is specified.
+		 *
+		 * @param bank			[in] Bank number (0-7)
+		 * @param write_filename	[in,opt] Temporary file for measuring writes (must not exist; deleted afterwards)
+		 * @param results		[out] Benchmark results
+		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		int benchmark(unsigned int bank, const TCHAR *write_filename, RvtH_Bench_Results *results);
+
+	public:
+		/** Filesystem functions (fst.cpp) **/
+
+		/**
+		 * Open the filesystem of a bank for random access to its files.
+		 * For Wii banks, the game partition is used. See BankFileSystem.
+		 *
+		 * @param bank		[in] Bank number (0-7)
+		 * @param pFs		[out] Bank filesystem (caller must delete it)
+		 * @param cache_groups	[in,opt] Number of decrypted groups to cache (encrypted Wii banks only)
+		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		int openFileSystem(unsigned int bank, BankFileSystem **pFs, unsigned int cache_groups = 1);
+
+		/**
+		 * Open the user data of a bank for random access by partition offset,
+		 * e.g. for a debugger. For Wii banks, the game partition is used.
+		 *
+		 * The FST isn't loaded, so only BankFileSystem::readData() can be used.
+		 * Only the sectors overlapping a read are decrypted, and they're kept
+		 * in the decrypted group cache on top of the bank's block cache, so
+		 * repeated small reads in the same area don't read or decrypt again.
+		 *
+		 * @param bank		[in] Bank number (0-7)
+		 * @param pFs		[out] Bank filesystem, with the FST not loaded (caller must delete it)
+		 * @param cache_groups	[in,opt] Number of decrypted groups to cache (encrypted Wii banks only)
+		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		int openPartitionData(unsigned int bank, BankFileSystem **pFs, unsigned int cache_groups = 1);
+
+		/**
+		 * List the files in a bank's filesystem.
+		 *
+		 * For Wii banks, the game partition is used. Only the boot block,
+		 * the apploader and main.dol headers, and the FST are read, and
+		 * only the sectors containing them are decrypted.
+		 *
+		 * System files are listed in "sys/": boot.bin, bi2.bin,
+		 * apploader.img, main.dol, and fst.bin. Files in the FST are
+		 * listed in "files/", in FST order.
+		 *
+		 * @param bank	[in] Bank number (0-7)
+		 * @param files	[out] Files and directories
+		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		int listFiles(unsigned int bank, std::vector<RvtH_FST_File> &files);
+
+		/**
+		 * Extract a single file from a bank's filesystem.
+		 * Only the sectors overlapping the file are read and decrypted.
+		 *
+		 * @param bank		[in] Bank number (0-7)
+		 * @param path		[in] Path, as listed by listFiles(). (A leading '/' is optional.)
+		 * @param filename	[in] Destination filename ("-" for stdout)
+		 * @param callback	[in,opt] Progress callback (RVTH_PROGRESS_EXTRACT)
+		 * @param userdata	[in,opt] User data for progress callback
+		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		int extractFile(unsigned int bank, const char *path, const TCHAR *filename,
+			RvtH_Progress_Callback callback = nullptr, void *userdata = nullptr);
+
+	public:
+		/** Recovery functions (recover.cpp) **/
+
+		/**
+		 * Scan an RVT-H HDD for disc images, e.g. if the bank table is damaged.
+		 *
+		 * The whole HDD is read sequentially in large chunks, using a
+		 * background thread, and every LBA is checked for the GameCube
+		 * and Wii disc header magic numbers. Standard bank addresses are
+		 * also checked for deleted banks, which have zeroed disc headers.
+		 *
+		 * Candidates are ranked using rvth_disc_header_identify() and
+		 * rvth_disc_header_get(), plus whether the disc image starts at a
+		 * standard bank address, whether the game ID and title are valid,
+		 * and whether the disc image is nested inside a better candidate.
+		 *
+		 * @param candidates	[out] Candidates, sorted by score (highest first)
+		 * @param callback	[in,opt] Progress callback
+		 * @param userdata	[in,opt] User data for progress callback
+		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		int scanForBanks(std::vector<RvtH_Bank_Candidate> &candidates,
+			RvtH_Progress_Callback callback = nullptr, void *userdata = nullptr);
+
+	public:
+		/** Read latency scan (scan.cpp) **/
+
+		/**
+		 * Read the whole device or disk image file and measure the
+		 * read latency of each chunk, e.g. to find failing sectors.
+		 *
+		 * Chunks are read by the specified number of threads. Each chunk
+		 * is read independently, so the scan continues after read errors.
+		 * Read latency is also added to the read latency statistics if
+		 * RvtH_CopyParams::slow_read_ms is set.
+		 *
+		 * @param map		[out] Latency map, one entry per chunk, in LBA order
+		 * @param chunk_size	[in] Chunk size, in bytes (multiple of 64 KB; 0 for 4 MB)
+		 * @param threads	[in] Number of reader threads (0 for 1)
+		 * @param callback	[in,opt] Progress callback (RVTH_PROGRESS_SCAN)
+		 * @param userdata	[in,opt] User data for progress callback
+		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		int scanLatency(std::vector<RvtH_Latency_Chunk> &map, unsigned int chunk_size,
+			unsigned int threads, RvtH_Progress_Callback callback = nullptr, void *userdata = nullptr);
+
+	public:
+		/** Bank comparison (compare.cpp) **/
+
+		/**
+		 * Compare a bank with a bank in another RVT-H device or disc image.
+		 *
+		 * Wii partitions that are at the same location in both banks are
+		 * compared using their H3 tables first. Only the groups whose H3
+		 * entries differ are decrypted, and the differing sectors are
+		 * reported as RVTH_COMPARE_DECRYPTED. Groups with matching H3 entries
+		 * are compared directly if both banks use the same title key; if the
+		 * title keys differ, they're assumed to be identical, so banks with
+		 * different encryption keys can be compared.
+		 *
+		 * Everything else is read from both banks concurrently, in large
+		 * chunks, and compared directly. Differences are merged into
+		 * contiguous regions, sorted by LBA.
+		 *
+		 * @param bank		[in] Bank number in this object (0-7)
+		 * @param other		[in] Other RvtH object (may be this object)
+		 * @param bank_other	[in] Bank number in the other object (0-7)
+		 * @param diffs		[out] Differences (empty if the banks are identical)
+		 * @param callback	[in,opt] Progress callback (RVTH_PROGRESS_COMPARE)
+		 * @param userdata	[in,opt] User data for progress callback
+		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		int compareBank(unsigned int bank, RvtH *other, unsigned int bank_other,
+			std::vector<RvtH_Compare_Diff> &diffs,
+			RvtH_Progress_Callback callback = nullptr, void *userdata = nullptr);
 
 	private:
 		// Reference-counted FILE*.
@@ -496,6 +1852,56 @@ class RvtH {
 
 		// BankEntry objects.
 		RvtH_BankEntry *m_entries;
+
+		// Deferred HDD bank initialization.
+		// openHDD() only reads the bank table. The disc header,
+		// encryption, signatures, and apploader are checked
+		// when a bank is accessed for the first time.
+		struct PendingBank {
+			NHCD_BankEntry nhcd_entry;	// Bank table entry
+			uint32_t lba_start;		// Starting LBA
+			uint32_t lba_len;		// Length, in LBAs (0 for default)
+			uint8_t type;			// Bank type from the bank table (See RvtH_BankType_e.)
+			bool has_nhcd;			// True if nhcd_entry is valid
+			bool pending;			// True if the bank hasn't been initialized yet
+			bool header_only;		// True if only RVTH_BANK_INIT_HEADER was initialized
+		};
+		mutable std::vector<PendingBank> m_pendingBanks;	// Empty if not an HDD
+		mutable std::mutex m_bankInitMutex;
+
+		// Bank metadata cache. (HDDs with a valid bank table only)
+		BankCache *m_bankCache;
+
+		// Verification result cache and per-group status. (HDDs only)
+		// Both are protected by m_verifyCacheMutex.
+		VerifyCache *m_verifyCache;
+		VerifyMap *m_verifyMap;
+		std::mutex m_verifyCacheMutex;
+
+		// Bank table transaction. (HDDs only)
+		// While a transaction is active, writeBankEntry() stages
+		// bank table entries here instead of writing them to disk.
+		bool m_txnActive;
+		std::vector<NHCD_BankEntry> m_txnEntries;
+		std::vector<bool> m_txnDirty;
+
+		// Copy buffer parameters.
+		RvtH_CopyParams m_copyParams;
+
+		// If true, the durability policy of m_file was set by the owner
+		// of a shared file, e.g. for parallel import workers, and copy
+		// operations must not change it while other threads are writing.
+		bool m_sharedDurability;
+
+		// Progress callback throttling parameters.
+		RvtH_ProgressParams m_progressParams;
+
+		// Performance counters. (See RvtH_Stats.)
+		StatsCounters *m_stats;
+
+		// Title key store. (allocated on demand; may be shared)
+		mutable std::shared_ptr<TitleKeyStore> m_titleKeys;
+		mutable std::mutex m_titleKeyMutex;
 };
 
 #endif /* __cplusplus */
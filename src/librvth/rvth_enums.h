@@ -2,7 +2,7 @@
  * RVT-H Tool (librvth)                                                    *
  * rvth_enums.h: RVT-H enums.                                              *
  *                                                                         *
- * Copyright (c) 2018-2019 by David Korth.                                 *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
@@ -27,6 +27,19 @@ typedef enum {
 	RVTH_BankType_MAX
 } RvtH_BankType_e;
 
+// HDD bank entry initialization levels.
+// Bank entries are initialized on first access. Lower levels
+// read less data, which is faster if only some fields are needed.
+typedef enum {
+	// Bank table and disc header: type, LBAs, timestamp,
+	// deleted status, disc header, and region code.
+	RVTH_BANK_INIT_HEADER	= 0,
+
+	// Everything: Also checks the encryption, ticket and TMD
+	// signatures, and AppLoader. (default)
+	RVTH_BANK_INIT_FULL	= 1,
+} RvtH_BankInit_Level;
+
 // RVT-H image type.
 typedef enum {
 	RVTH_ImageType_Unknown = 0,
@@ -43,13 +56,157 @@ typedef enum {
 	RVTH_ImageType_MAX
 } RvtH_ImageType_e;
 
+// Container formats for new standalone disc images.
+typedef enum {
+	RVTH_ImageFormat_Plain = 0,	// Plain disc image (.gcm, .iso)
+	RVTH_ImageFormat_CISO,		// Compact ISO (.ciso)
+	RVTH_ImageFormat_WBFS,		// WBFS disc image (.wbfs)
+	RVTH_ImageFormat_RVTZ,		// RVTZ compressed disc image (.rvtz)
+
+	RVTH_ImageFormat_MAX
+} RvtH_ImageFormat_e;
+
 // RVT-H extraction flags.
 typedef enum {
 	// Prepend a 32 KB SDK header.
 	// Required for rvtwriter, NDEV ODEM, etc.
 	RVTH_EXTRACT_PREPEND_SDK_HEADER		= (1 << 0),
+
+	// Skip the unused areas of encrypted Wii partitions.
+	// Only groups referenced by the FST are copied.
+	RVTH_EXTRACT_SCRUB			= (1 << 1),
+
+	// Calculate CRC32, MD5, and SHA-1 digests of the disc image
+	// while it's being copied, and write them to a sidecar file.
+	// NOTE: Not supported when converting unencrypted images
+	// to encrypted images.
+	RVTH_EXTRACT_DIGESTS			= (1 << 2),
+
+	// Write a hash index file with per-group SHA-1 digests and
+	// H3 tables of the Wii partitions, for later comparisons.
+	// NOTE: Offsets don't include the SDK header, if present.
+	// NOTE: Not supported when converting unencrypted images
+	// to encrypted images.
+	RVTH_EXTRACT_HASH_INDEX			= (1 << 3),
+
+	// Archival extraction: Write update partitions to a partition
+	// store instead of the disc image, and write a .prefs file with
+	// references to the stored partitions. Use RvtH::reconstruct()
+	// to rebuild the full disc image.
+	// NOTE: Not supported when recrypting or converting unencrypted
+	// images to encrypted images.
+	RVTH_EXTRACT_STORE_UPDATES		= (1 << 4),
+
+	// Destination allocation. If neither flag is set, the destination
+	// file system determines the allocation method: File systems that
+	// fragment sparse files (ext4, NTFS) and file systems that don't
+	// support sparse files (FAT, exFAT) use preallocation.
+	// Only plain disc images can be preallocated.
+
+	// Write the destination image sparsely. Empty blocks aren't written.
+	RVTH_EXTRACT_SPARSE			= (1 << 5),
+
+	// Preallocate the destination image and write it sequentially,
+	// then deallocate the empty areas after copying.
+	// Local files are written through a memory-mapped window.
+	RVTH_EXTRACT_PREALLOCATE		= (1 << 6),
+
+	// Decrypt the game partition of an encrypted Wii image into the
+	// unencrypted RVT-R layout. Other partitions aren't copied.
+	// The image can be encrypted again by recrypting it.
+	// NOTE: Not supported with recryption, digests, hash indexes,
+	// archival extraction, or delta extraction.
+	RVTH_EXTRACT_DECRYPT			= (1 << 7),
+
+	// Record the copy's progress in a journal next to the destination
+	// image ("<image>.rjnl"), and resume an interrupted copy if the
+	// journal matches the source. Only plain disc images are supported.
+	// NOTE: Not supported with digests, hash indexes, archival
+	// extraction, decryption, or converting unencrypted images to
+	// encrypted images.
+	RVTH_EXTRACT_RESUME			= (1 << 8),
 } RvtH_Extract_Flags;
 
+// Import flags.
+typedef enum {
+	// Don't write empty (all-zero) blocks to the destination bank.
+	// The destination bank must already be zeroed, e.g. using
+	// RvtH::wipeBank(); otherwise, the old data will show through.
+	RVTH_IMPORT_SKIP_EMPTY			= (1 << 0),
+
+	// Calculate CRC32, MD5, and SHA-1 digests of the disc image
+	// while it's being copied, and write them to a sidecar file.
+	RVTH_IMPORT_DIGESTS			= (1 << 1),
+
+	// Differential import: Only write the data that differs from
+	// the destination bank. Encrypted Wii partitions are compared
+	// using their H3 tables; everything else is read back from the
+	// destination and compared. The destination bank may contain
+	// an image of the same type, which will be overwritten.
+	RVTH_IMPORT_DIFFERENTIAL		= (1 << 2),
+
+	// Record the import's progress in a journal in the cache directory,
+	// and resume an interrupted import into the same bank if the
+	// journal matches the source.
+	// NOTE: Not supported with digests.
+	RVTH_IMPORT_RESUME			= (1 << 3),
+
+	// Read back each chunk from the destination after it has been
+	// flushed, trailing the writer by RvtH_CopyParams::readback_window,
+	// and compare it to the data that was written. The import fails
+	// with RVTH_ERROR_READBACK_MISMATCH if it doesn't match.
+	RVTH_IMPORT_READBACK			= (1 << 4),
+} RvtH_Import_Flags;
+
+// Verification flags.
+typedef enum {
+	// Quick verification: Only decrypt the hash tables and check
+	// the H1-H4 hashes. User data (H0) is only checked for a
+	// random sample of groups.
+	RVTH_VERIFY_QUICK			= (1 << 0),
+
+	// Checkpoints: Periodically save the verification progress
+	// in the user's cache directory, and resume from the last
+	// checkpoint if the bank and its H3 tables are unchanged.
+	RVTH_VERIFY_CHECKPOINT			= (1 << 1),
+
+	// Cached results: If the bank hasn't been rewritten since it
+	// was last verified, return the cached result instead of
+	// verifying it again. Otherwise, skip the groups that were
+	// clean and haven't been written since they were verified.
+	// (RVT-H Readers and HDD images only)
+	RVTH_VERIFY_USE_CACHE			= (1 << 2),
+
+	// Known partitions: Don't decrypt and hash the user data of
+	// update partitions that previously passed a full verification
+	// on any disc. (See KnownPartitions.) The H4 hash and the hash
+	// tables are still checked.
+	RVTH_VERIFY_SKIP_KNOWN_PARTITIONS	= (1 << 3),
+} RvtH_Verify_Flags;
+
+// I/O priority for reads and writes. (RvtH_CopyParams::io_priority)
+typedef enum {
+	RVTH_IOPRIO_NORMAL	= 0,	// Default priority.
+	RVTH_IOPRIO_LOW		= 1,	// Lowest best-effort priority.
+	RVTH_IOPRIO_IDLE	= 2,	// Only use the device when it's otherwise idle. (Same as LOW on Windows.)
+
+	RVTH_IOPRIO_MAX
+} RvtH_IO_Priority;
+
+// Durability policy for writes. (RvtH_CopyParams::durability)
+// Each policy decides when written data is synced to the media,
+// i.e. flushed from the OS cache and the device's write cache.
+// The bank table is synced after it's written, except with NONE.
+typedef enum {
+	RVTH_DURABILITY_CHECKPOINT	= 0,	// Sync at each checkpoint, e.g. after each imported chunk, and at the end of the job. (default)
+	RVTH_DURABILITY_NONE		= 1,	// Never sync. Data may be lost if the device is unplugged.
+	RVTH_DURABILITY_END_OF_JOB	= 2,	// Only sync at the end of the job.
+	RVTH_DURABILITY_INTERVAL	= 3,	// Sync after every sync_interval MB, and at the end of the job.
+	RVTH_DURABILITY_WRITE_THROUGH	= 4,	// Sync after every write.
+
+	RVTH_DURABILITY_MAX
+} RvtH_Durability;
+
 #ifdef __cplusplus
 }
 #endif
@@ -87,6 +87,11 @@ const char *rvth_error(int err)
 
 		// tr: RVTH_ERROR_NDEV_GCN_NOT_SUPPORTED
 		"NDEV headers for GCN are currently unsupported.",
+
+		// 'import' command: Read-back verification.
+
+		// tr: RVTH_ERROR_READBACK_MISMATCH
+		"Data read back from the destination bank doesn't match what was written",
 	};
 	static_assert(ARRAY_SIZE(errtbl) == RVTH_ERROR_MAX, "Missing error descriptions!");
 
@@ -46,6 +46,9 @@ typedef enum {
 	// NDEV option.
 	RVTH_ERROR_NDEV_GCN_NOT_SUPPORTED	= 26,	// NDEV headers for GCN are currently unsupported.
 
+	// 'import' command: Read-back verification.
+	RVTH_ERROR_READBACK_MISMATCH		= 27,	// Data read back from the destination doesn't match what was written.
+
 	RVTH_ERROR_MAX
 } RvtH_Errors;
 
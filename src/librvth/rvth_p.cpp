@@ -2,15 +2,20 @@
  * RVT-H Tool (librvth)                                                    *
  * rvth_p.cpp: RVT-H image handler. (PRIVATE FUNCTIONS)                    *
  *                                                                         *
- * Copyright (c) 2018-2020 by David Korth.                                 *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
 #include "rvth.hpp"
 
 #include "RefFile.hpp"
+#include "BankCache.hpp"
+#include "VerifyCache.hpp"
+#include "VerifyMap.hpp"
 #include "rvth_time.h"
 #include "rvth_error.h"
+#include "StatsCounters.hpp"
+#include "zero_scan.h"
 
 #include "byteswap.h"
 #include "nhcd_structs.h"
@@ -54,32 +59,13 @@ int RvtH::makeWritable(void)
 /**
  * Check if a block is empty.
  * @param block Block.
- * @param size Block size. (Must be a multiple of 64 bytes.)
+ * @param size Block size.
  * @return True if the block is all zeroes; false if not.
  */
 bool RvtH::isBlockEmpty(const uint8_t *block, unsigned int size)
 {
-	// Process the block using 64-bit pointers.
-	const uint64_t *block64 = (const uint64_t*)block;
-	unsigned int i;
-	assert(size % 64 == 0);
-	for (i = size/8/8; i > 0; i--, block64 += 8) {
-		uint64_t x = block64[0];
-		x |= block64[1];
-		x |= block64[2];
-		x |= block64[3];
-		x |= block64[4];
-		x |= block64[5];
-		x |= block64[6];
-		x |= block64[7];
-		if (x != 0) {
-			// Non-zero block.
-			return false;
-		}
-	}
-
-	// Block is all zeroes.
-	return true;
+	StatsTimer timer(StatsCounters::TIMER_ZERO_SCAN);
+	return rvth_is_zero(block, size);
 }
 
 /**
@@ -113,7 +99,7 @@ int RvtH::writeBankEntry(unsigned int bank, time_t *pTimestamp)
 
 	// If the bank entry is deleted, then it should be
 	// all zeroes, so skip all of this.
-	RvtH_BankEntry *const rvth_entry = &m_entries[bank];
+	RvtH_BankEntry *const rvth_entry = getBankEntry(bank);
 	if (!rvth_entry->is_deleted) {
 		// Bank entry is not deleted.
 		// Construct the NHCD bank entry.
@@ -150,12 +136,14 @@ int RvtH::writeBankEntry(unsigned int bank, time_t *pTimestamp)
 			memset(nhcd_entry.all_zero, '0', sizeof(nhcd_entry.all_zero));
 
 			// Timestamp.
+			// The bank entry's timestamp is updated to match,
+			// since the verification map is keyed on it.
+			// NOTE: We can't just use the value from time(nullptr) because
+			// that's in UTC/GMT, and we need localtime here.
 			rvth_timestamp_create(nhcd_entry.timestamp, sizeof(nhcd_entry.timestamp), time(nullptr));
+			rvth_entry->timestamp = rvth_timestamp_parse(nhcd_entry.timestamp);
 			if (pTimestamp) {
-				// Convert the timestamp back.
-				// NOTE: We can't just use the value from time(nullptr) because
-				// that's in UTC/GMT, and we need localtime here.
-				*pTimestamp = rvth_timestamp_parse(nhcd_entry.timestamp);
+				*pTimestamp = rvth_entry->timestamp;
 			}
 
 			// LBA start and length.
@@ -164,16 +152,46 @@ int RvtH::writeBankEntry(unsigned int bank, time_t *pTimestamp)
 		}
 	}
 
-	// Write the bank entry.
-	ret = m_file->seeko(LBA_TO_BYTES(NHCD_BANKTABLE_ADDRESS_LBA + bank+1), SEEK_SET);
-	if (ret != 0) {
-		// Seek error.
-		if (errno == 0) {
-			errno = EIO;
+	// Remove the bank from the bank metadata cache.
+	// The new bank table entry won't match the cached entry
+	// unless it was written within the same second, so this
+	// is mostly a safeguard for quick successive operations.
+	// NOTE: If a transaction is active, the caches are saved
+	// when the transaction is committed or rolled back.
+	if (m_bankCache) {
+		m_bankCache->invalidate(bank);
+		if (!m_txnActive) {
+			m_bankCache->save();
+		}
+	}
+	if (m_verifyCache) {
+		std::lock_guard<std::mutex> lock(m_verifyCacheMutex);
+		m_verifyCache->invalidate(bank);
+		if (!m_txnActive) {
+			m_verifyCache->save();
+		}
+	}
+	if (m_verifyMap) {
+		// The group status is kept if the writes were tracked.
+		std::lock_guard<std::mutex> lock(m_verifyCacheMutex);
+		m_verifyMap->bankWritten(bank, rvth_entry);
+		if (!m_txnActive) {
+			m_verifyMap->save();
 		}
-		return -errno;
 	}
-	size_t size = m_file->write(&nhcd_entry, 1, sizeof(nhcd_entry));
+
+	if (m_txnActive) {
+		// Stage the bank entry.
+		// It will be written by commitBankTableTransaction().
+		m_txnEntries[bank] = nhcd_entry;
+		m_txnDirty[bank] = true;
+		return 0;
+	}
+
+	// Write the bank entry.
+	errno = 0;
+	size_t size = m_file->pwrite(&nhcd_entry, sizeof(nhcd_entry),
+		LBA_TO_BYTES(NHCD_BANKTABLE_ADDRESS_LBA + bank+1));
 	if (size != sizeof(nhcd_entry)) {
 		// Write error.
 		if (errno == 0) {
@@ -183,5 +201,53 @@ int RvtH::writeBankEntry(unsigned int bank, time_t *pTimestamp)
 	}
 
 	// Bank entry written successfully.
+	m_file->sync();
+
+	// Keep the loaded bank table in sync for pollBankTable().
+	if (bank < m_pendingBanks.size()) {
+		std::lock_guard<std::mutex> lock(m_bankInitMutex);
+		m_pendingBanks[bank].nhcd_entry = nhcd_entry;
+	}
 	return 0;
 }
+
+/**
+ * Start tracking writes to a bank.
+ * @param rvth	[in] RVT-H object
+ * @param bank	[in] Bank number. (0-7)
+ */
+RvtH::BankWriteScope::BankWriteScope(RvtH *rvth, unsigned int bank)
+	: m_rvth(rvth)
+	, m_bank(bank)
+{
+	if (!rvth->m_verifyMap || bank >= rvth->m_bankCount)
+		return;
+
+	const RvtH_BankEntry *const entry = rvth->getBankEntry(bank);
+	std::lock_guard<std::mutex> lock(rvth->m_verifyCacheMutex);
+	rvth->m_verifyMap->beginWrite(bank, entry);
+}
+
+RvtH::BankWriteScope::~BankWriteScope()
+{
+	if (!m_rvth->m_verifyMap || m_bank >= m_rvth->m_bankCount)
+		return;
+
+	std::lock_guard<std::mutex> lock(m_rvth->m_verifyCacheMutex);
+	m_rvth->m_verifyMap->endWrite(m_bank);
+}
+
+/**
+ * Mark a range of a bank as written in the verification map.
+ * @param bank		[in] Bank number. (0-7)
+ * @param lba_start	[in] Starting LBA, relative to the bank
+ * @param lba_len	[in] Length, in LBAs
+ */
+void RvtH::markBankWritten(unsigned int bank, uint32_t lba_start, uint32_t lba_len)
+{
+	if (!m_verifyMap || bank >= m_bankCount)
+		return;
+
+	std::lock_guard<std::mutex> lock(m_verifyCacheMutex);
+	m_verifyMap->markWritten(bank, lba_start, lba_len);
+}
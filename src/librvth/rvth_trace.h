@@ -0,0 +1,49 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * rvth_trace.h: Span tracing. (Chrome trace event format)                 *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_RVTH_TRACE_H__
+#define __RVTHTOOL_LIBRVTH_RVTH_TRACE_H__
+
+#include "tcharx.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Start recording a trace.
+ *
+ * Spans are recorded in memory by each thread, and written to the
+ * file as Chrome trace event JSON when rvth_trace_stop() is called.
+ * The file can be opened in Perfetto or chrome://tracing.
+ *
+ * If librvth was built without ENABLE_TRACING, this fails with -ENOTSUP.
+ *
+ * @param filename	[in] Trace filename.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rvth_trace_start(const TCHAR *filename);
+
+/**
+ * Start recording a trace if the RVTH_TRACE environment variable is set.
+ * RVTH_TRACE contains the trace filename.
+ * @return 0 on success or if RVTH_TRACE isn't set; negative POSIX error code on error.
+ */
+int rvth_trace_start_from_env(void);
+
+/**
+ * Stop recording and write the trace file.
+ * @return 0 on success; negative POSIX error code on error. (-EBADF if not recording)
+ */
+int rvth_trace_stop(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_LIBRVTH_RVTH_TRACE_H__ */
@@ -0,0 +1,202 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * scan.cpp: Read latency scan.                                            *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "rvth.hpp"
+#include "ProgressRate.hpp"
+#include "ProgressThrottle.hpp"
+#include "StatsCounters.hpp"
+#include "RefFile.hpp"
+#include "aligned_malloc.h"
+
+// For LBA_TO_BYTES()
+#include "nhcd_structs.h"
+
+// C includes (C++ namespace)
+#include <cerrno>
+
+// C++ includes
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+using std::unique_ptr;
+using std::vector;
+
+// Default chunk size.
+static constexpr unsigned int SCAN_LATENCY_CHUNK_SIZE = 4U * 1024U * 1024U;
+// Maximum number of reader threads.
+static constexpr unsigned int SCAN_LATENCY_THREADS_MAX = 16;
+// Minimum buffer alignment. (for direct I/O)
+static constexpr size_t SCAN_LATENCY_ALIGN = 4096;
+
+/**
+ * Read the whole device or disk image file and measure the
+ * read latency of each chunk, e.g. to find failing sectors.
+ *
+ * Chunks are read by the specified number of threads. Each chunk
+ * is read independently, so the scan continues after read errors.
+ * Read latency is also added to the read latency statistics if
+ * RvtH_CopyParams::slow_read_ms is set.
+ *
+ * @param map		[out] Latency map, one entry per chunk, in LBA order
+ * @param chunk_size	[in] Chunk size, in bytes (multiple of 64 KB; 0 for 4 MB)
+ * @param threads	[in] Number of reader threads (0 for 1)
+ * @param callback	[in,opt] Progress callback (RVTH_PROGRESS_SCAN)
+ * @param userdata	[in,opt] User data for progress callback
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int RvtH::scanLatency(vector<RvtH_Latency_Chunk> &map, unsigned int chunk_size,
+	unsigned int threads, RvtH_Progress_Callback callback, void *userdata)
+{
+	StatsScope scope(m_stats);
+	map.clear();
+
+	if (chunk_size == 0) {
+		chunk_size = SCAN_LATENCY_CHUNK_SIZE;
+	} else if (chunk_size % RVTH_COPY_BUF_SIZE_MIN != 0 || chunk_size > RVTH_COPY_BUF_SIZE_MAX) {
+		// Invalid chunk size.
+		errno = EINVAL;
+		return -EINVAL;
+	}
+	threads = std::max(1U, std::min(threads, SCAN_LATENCY_THREADS_MAX));
+	threads = budgetThreads(threads, chunk_size);
+
+	// Determine the number of LBAs to scan.
+	// NOTE: LBAs are 32-bit, so only the first 2 TB can be scanned.
+	const off64_t file_size = m_file->size();
+	if (file_size <= 0) {
+		int err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		errno = err;
+		return -err;
+	}
+	const uint32_t lba_total = static_cast<uint32_t>(
+		std::min<off64_t>(BYTES_TO_LBA(file_size), UINT32_MAX));
+	const uint32_t lba_chunk = BYTES_TO_LBA(chunk_size);
+	const size_t chunk_count = (static_cast<size_t>(lba_total) + lba_chunk - 1) / lba_chunk;
+	map.resize(chunk_count);
+
+	// Reads should come from the device, not from the OS cache
+	// or from the OS reading ahead.
+	const RefFile::AccessHint prevHint = m_file->accessHint();
+	m_file->setAccessHint(RefFile::AccessHint::Random);
+	m_file->dropCache(0, file_size);
+
+	// Reader threads take the next chunk until all chunks have been read.
+	const size_t align = std::max<size_t>(SCAN_LATENCY_ALIGN, m_copyParams.alignment);
+	std::atomic<size_t> next_chunk(0);
+	std::atomic<uint64_t> lba_done(0);
+	std::atomic<bool> cancel(false);
+	std::atomic<int> thread_err(0);
+	std::mutex mutex;
+	std::condition_variable cond;
+	unsigned int threads_running = threads;
+
+	auto worker = [&]() {
+		StatsScope thread_scope(m_stats);
+		unique_ptr<uint8_t, aligned_deleter> buf(
+			static_cast<uint8_t*>(aligned_malloc(align, chunk_size)));
+		if (!buf) {
+			thread_err = -ENOMEM;
+			cancel = true;
+		}
+
+		while (!cancel.load(std::memory_order_relaxed)) {
+			const size_t i = next_chunk.fetch_add(1);
+			if (i >= chunk_count)
+				break;
+
+			RvtH_Latency_Chunk &chunk = map[i];
+			chunk.lba_start = static_cast<uint32_t>(i * lba_chunk);
+			chunk.lba_len = std::min(lba_chunk, lba_total - chunk.lba_start);
+			const size_t size = static_cast<size_t>(LBA_TO_BYTES(chunk.lba_len));
+
+			errno = 0;
+			const auto start = std::chrono::steady_clock::now();
+			const size_t n = m_file->pread(buf.get(), size, LBA_TO_BYTES(chunk.lba_start));
+			const int err = errno;
+			const auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now() - start).count();
+			chunk.latency_us = static_cast<uint32_t>(std::min<int64_t>(us, UINT32_MAX));
+			chunk.err = (n == size ? 0 : (err != 0 ? -err : -EIO));
+			lba_done.fetch_add(chunk.lba_len, std::memory_order_relaxed);
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		threads_running--;
+		cond.notify_one();
+	};
+
+	vector<std::thread> workers;
+	workers.reserve(threads);
+	for (unsigned int i = 0; i < threads; i++) {
+		workers.emplace_back(worker);
+	}
+
+	// Report progress while the threads are reading.
+	RvtH_Progress_State state;
+	ProgressRate rate;
+	ProgressThrottle throttle(&m_progressParams);
+	if (callback) {
+		state.rvth = this;
+		state.rvth_gcm = nullptr;
+		state.bank_rvth = ~0U;
+		state.bank_gcm = ~0U;
+		state.type = RVTH_PROGRESS_SCAN;
+		state.lba_processed = 0;
+		state.lba_total = lba_total;
+		state.digests = nullptr;
+	}
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		while (threads_running > 0) {
+			cond.wait_for(lock, std::chrono::milliseconds(100));
+			if (!callback || cancel.load(std::memory_order_relaxed))
+				continue;
+
+			const uint64_t lba = lba_done.load(std::memory_order_relaxed);
+			if (threads_running > 0 && throttle.ready(LBA_TO_BYTES(lba))) {
+				state.lba_processed = static_cast<uint32_t>(lba);
+				rate.update(&state);
+				lock.unlock();
+				if (!callback(&state, userdata)) {
+					// Stop processing.
+					cancel = true;
+				}
+				lock.lock();
+			}
+		}
+	}
+	for (std::thread &th : workers) {
+		th.join();
+	}
+	m_file->setAccessHint(prevHint);
+
+	int ret = thread_err.load();
+	if (ret == 0 && cancel) {
+		ret = -ECANCELED;
+	}
+	if (ret != 0) {
+		map.clear();
+		errno = -ret;
+		return ret;
+	}
+
+	if (callback) {
+		state.lba_processed = lba_total;
+		rate.update(&state);
+		callback(&state, userdata);
+	}
+	return 0;
+}
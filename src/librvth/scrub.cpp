@@ -0,0 +1,267 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * scrub.cpp: Determine which areas of a Wii disc image are used.          *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "scrub.h"
+#include "ptbl.h"
+#include "rvth_error.h"
+#include "PartitionDataReader.hpp"
+
+// For LBA_TO_BYTES()
+#include "nhcd_structs.h"
+
+// Reader class
+#include "reader/Reader.hpp"
+
+// libwiicrypto
+#include "libwiicrypto/gcn_structs.h"
+#include "libwiicrypto/wii_structs.h"
+#include "libwiicrypto/wii_sector.h"
+#include "libwiicrypto/title_key.h"
+
+// Encryption
+#include "aesw.h"
+
+#include "byteswap.h"
+
+// C includes (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+// C++ includes
+#include <memory>
+#include <vector>
+using std::unique_ptr;
+using std::vector;
+
+// Maximum FST size. Larger FSTs are assumed to be invalid.
+static constexpr uint32_t FST_SIZE_MAX = 64U * 1024U * 1024U;
+
+/**
+ * Mark the groups containing a range of decrypted partition data as used.
+ * @param groups	[in,out] Group map.
+ * @param offset	[in] Offset in the decrypted partition data.
+ * @param size		[in] Size, in bytes.
+ */
+static void mark_groups_used(vector<bool> &groups, uint64_t offset, uint64_t size)
+{
+	if (size == 0) {
+		return;
+	}
+
+	const uint64_t group_first = offset / GROUP_SIZE_DEC;
+	uint64_t group_last = (offset + size - 1) / GROUP_SIZE_DEC;
+	if (group_first >= groups.size()) {
+		return;
+	} else if (group_last >= groups.size()) {
+		group_last = groups.size() - 1;
+	}
+
+	for (uint64_t g = group_first; g <= group_last; g++) {
+		groups[static_cast<size_t>(g)] = true;
+	}
+}
+
+/**
+ * Determine which groups of an encrypted Wii partition are used.
+ * @param pdr		[in] Partition data reader.
+ * @param groups	[in,out] Group map. (must be initialized to false)
+ * @return True if the partition was parsed; false if not.
+ */
+static bool parse_partition_groups(PartitionDataReader &pdr, vector<bool> &groups)
+{
+	// Read the boot block. (0x420)
+	GCN_Boot_Block bb2;
+	if (!pdr.read(&bb2, 0x420, sizeof(bb2))) {
+		return false;
+	}
+	const uint64_t dol_offset = static_cast<uint64_t>(be32_to_cpu(bb2.bootFilePosition)) << 2;
+	const uint64_t fst_offset = static_cast<uint64_t>(be32_to_cpu(bb2.FSTPosition)) << 2;
+	const uint64_t fst_size = static_cast<uint64_t>(be32_to_cpu(bb2.FSTLength)) << 2;
+	if (fst_size < sizeof(GCN_FST_Entry) || fst_size > FST_SIZE_MAX) {
+		// FST size is invalid.
+		return false;
+	}
+
+	// Determine the size of main.dol from its section table.
+	DOL_Header dol;
+	if (!pdr.read(&dol, dol_offset, sizeof(dol))) {
+		return false;
+	}
+	uint64_t dol_size = sizeof(dol);
+	for (unsigned int i = 0; i < ARRAY_SIZE(dol.textData); i++) {
+		const uint64_t end = static_cast<uint64_t>(be32_to_cpu(dol.textData[i])) + be32_to_cpu(dol.textLen[i]);
+		if (end > dol_size) {
+			dol_size = end;
+		}
+	}
+	for (unsigned int i = 0; i < ARRAY_SIZE(dol.dataData); i++) {
+		const uint64_t end = static_cast<uint64_t>(be32_to_cpu(dol.dataData[i])) + be32_to_cpu(dol.dataLen[i]);
+		if (end > dol_size) {
+			dol_size = end;
+		}
+	}
+
+	// System area: Disc header, bi2.bin, and the apploader,
+	// i.e. everything before main.dol and the FST.
+	mark_groups_used(groups, 0, (dol_offset < fst_offset ? dol_offset : fst_offset));
+	mark_groups_used(groups, dol_offset, dol_size);
+	mark_groups_used(groups, fst_offset, fst_size);
+
+	// Read the FST.
+	const uint32_t fst_count_max = static_cast<uint32_t>(fst_size / sizeof(GCN_FST_Entry));
+	unique_ptr<GCN_FST_Entry[]> fst(new GCN_FST_Entry[fst_count_max]);
+	if (!pdr.read(fst.get(), fst_offset, fst_count_max * sizeof(GCN_FST_Entry))) {
+		return false;
+	}
+
+	// The root directory's "next entry index" is the total number of entries.
+	const uint32_t fst_count = be32_to_cpu(fst[0].file_size);
+	if (fst_count == 0 || fst_count > fst_count_max) {
+		// FST entry count is invalid.
+		return false;
+	}
+
+	// Mark the files as used.
+	for (uint32_t i = 1; i < fst_count; i++) {
+		const GCN_FST_Entry *const fst_entry = &fst[i];
+		if ((be32_to_cpu(fst_entry->type_name_offset) >> 24) != 0) {
+			// Directory.
+			continue;
+		}
+		mark_groups_used(groups,
+			static_cast<uint64_t>(be32_to_cpu(fst_entry->file_offset)) << 2,
+			be32_to_cpu(fst_entry->file_size));
+	}
+
+	return true;
+}
+
+/**
+ * Build a map of the chunks in a bank that contain used data.
+ *
+ * Areas outside of the Wii partitions' data areas, e.g. the disc header,
+ * partition table, and partition headers, are always used. Within an
+ * encrypted partition's data area, only the groups that contain the
+ * boot block, apploader, main.dol, FST, and files listed in the FST
+ * are used.
+ *
+ * If a partition can't be parsed, its entire data area is used.
+ * GameCube and unencrypted banks are always used in their entirety.
+ *
+ * @param entry		[in] RvtH_BankEntry*
+ * @param lba_chunk	[in] Chunk size, in LBAs.
+ * @param used		[out] Chunk map. (true == chunk contains used data)
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int rvth_scrub_build_chunk_map(RvtH_BankEntry *entry, uint32_t lba_chunk, vector<bool> &used)
+{
+	assert(entry != nullptr);
+	assert(lba_chunk != 0);
+	if (!entry || lba_chunk == 0) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	// All chunks are used initially.
+	const uint32_t chunk_count = (entry->lba_len / lba_chunk) + (entry->lba_len % lba_chunk != 0);
+	used.assign(chunk_count, true);
+
+	if ((entry->type != RVTH_BankType_Wii_SL && entry->type != RVTH_BankType_Wii_DL) ||
+	    entry->crypto_type == RVL_CryptoType_None)
+	{
+		// Only encrypted Wii partitions can be scrubbed.
+		return 0;
+	}
+
+	// Make sure the partition table is loaded.
+	int ret = rvth_ptbl_load(entry);
+	if (ret != 0) {
+		return ret;
+	}
+
+	// Initialize the AES context.
+	errno = 0;
+	AesCtx *const aesw = aesw_new();
+	if (!aesw) {
+		ret = -errno;
+		if (ret == 0) {
+			ret = -ENOMEM;
+		}
+		return ret;
+	}
+
+	Reader *const reader = entry->reader;
+	for (unsigned int pt_idx = 0; pt_idx < entry->pt_count; pt_idx++) {
+		const pt_entry_t *const pte = &entry->ptbl[pt_idx];
+
+		// Get the partition header.
+		const RVL_PartitionHeader *const pt_hdr = rvth_ptbl_get_header(entry, pte);
+		if (!pt_hdr) {
+			// Read error. The partition will be copied as-is.
+			continue;
+		}
+
+		const uint64_t data_offset = static_cast<uint64_t>(be32_to_cpu(pt_hdr->data_offset)) << 2;
+		const uint64_t data_size = static_cast<uint64_t>(be32_to_cpu(pt_hdr->data_size)) << 2;
+		if (data_offset == 0 || data_size == 0 || data_size > 9ULL*1024*1024*1024) {
+			// Partition header is invalid.
+			continue;
+		}
+		const uint32_t data_lba = pte->lba_start + BYTES_TO_LBA(data_offset);
+		uint32_t data_lba_end = data_lba + BYTES_TO_LBA(data_size);
+		if (data_lba >= entry->lba_len) {
+			// Partition data is out of range.
+			continue;
+		} else if (data_lba_end > entry->lba_len) {
+			data_lba_end = entry->lba_len;
+		}
+
+		// Decrypt the title key.
+		uint8_t title_key[16];
+		uint8_t crypto_type;
+		if (decrypt_title_key(&pt_hdr->ticket, title_key, &crypto_type) != 0) {
+			// Unable to decrypt the title key.
+			continue;
+		}
+		aesw_set_key(aesw, title_key, sizeof(title_key));
+
+		// Determine which groups are used.
+		const uint32_t group_count = static_cast<uint32_t>(
+			(data_size / GROUP_SIZE_ENC) + (data_size % GROUP_SIZE_ENC != 0));
+		vector<bool> groups(group_count, false);
+		PartitionDataReader pdr(reader, aesw, data_lba, data_lba_end - data_lba);
+		if (!parse_partition_groups(pdr, groups)) {
+			// Unable to parse the partition.
+			// The partition will be copied as-is.
+			continue;
+		}
+
+		// Update the chunks that are entirely within the partition data.
+		// Partially-covered chunks are always used.
+		static const uint32_t GROUP_LBA = BYTES_TO_LBA(GROUP_SIZE_ENC);
+		const uint32_t chunk_first = (data_lba + lba_chunk - 1) / lba_chunk;
+		const uint32_t chunk_end = data_lba_end / lba_chunk;
+		for (uint32_t chunk = chunk_first; chunk < chunk_end; chunk++) {
+			const uint32_t lba = chunk * lba_chunk;
+			const uint32_t group_first = (lba - data_lba) / GROUP_LBA;
+			const uint32_t group_last = (lba + lba_chunk - 1 - data_lba) / GROUP_LBA;
+			bool chunk_used = false;
+			for (uint32_t g = group_first; g <= group_last && g < group_count; g++) {
+				if (groups[g]) {
+					chunk_used = true;
+					break;
+				}
+			}
+			used[chunk] = chunk_used;
+		}
+	}
+
+	aesw_free(aesw);
+	return 0;
+}
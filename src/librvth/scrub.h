@@ -0,0 +1,41 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * scrub.h: Determine which areas of a Wii disc image are used.            *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_SCRUB_H__
+#define __RVTHTOOL_LIBRVTH_SCRUB_H__
+
+#include "rvth.hpp"
+#include <stdint.h>
+
+#ifdef __cplusplus
+
+// C++ includes
+#include <vector>
+
+/**
+ * Build a map of the chunks in a bank that contain used data.
+ *
+ * Areas outside of the Wii partitions' data areas, e.g. the disc header,
+ * partition table, and partition headers, are always used. Within an
+ * encrypted partition's data area, only the groups that contain the
+ * boot block, apploader, main.dol, FST, and files listed in the FST
+ * are used.
+ *
+ * If a partition can't be parsed, its entire data area is used.
+ * GameCube and unencrypted banks are always used in their entirety.
+ *
+ * @param entry		[in] RvtH_BankEntry*
+ * @param lba_chunk	[in] Chunk size, in LBAs.
+ * @param used		[out] Chunk map. (true == chunk contains used data)
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int rvth_scrub_build_chunk_map(RvtH_BankEntry *entry, uint32_t lba_chunk, std::vector<bool> &used);
+
+#endif /* __cplusplus */
+
+#endif /* __RVTHTOOL_LIBRVTH_SCRUB_H__ */
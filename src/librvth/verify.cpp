@@ -9,12 +9,32 @@
 #include "rvth.hpp"
 #include "ptbl.h"
 #include "rvth_error.h"
+#include "StatsCounters.hpp"
+#include "ThreadPool.hpp"
+#include "Trace.hpp"
+#include "zero_scan.h"
 
 // For LBA_TO_BYTES()
 #include "nhcd_structs.h"
 
 // Reader class
 #include "reader/Reader.hpp"
+#include "reader/AsyncReader.hpp"
+
+// Buffer pool
+#include "BufferPool.hpp"
+
+// Zeroed groups
+#include "EncryptedZeroGroup.hpp"
+
+// Verification checkpoints and cached results
+#include "VerifyCheckpoint.hpp"
+#include "VerifyCache.hpp"
+#include "KnownPartitions.hpp"
+#include "VerifyMap.hpp"
+
+// Progress callback throttling
+#include "ProgressThrottle.hpp"
 
 // libwiicrypto
 #include "libwiicrypto/gcn_structs.h"
@@ -23,6 +43,7 @@
 #include "libwiicrypto/sig_tools.h"
 #include "libwiicrypto/wii_sector.h"
 #include "libwiicrypto/title_key.h"
+#include "libwiicrypto/wii_hash_tree.h"
 
 // Encryption and hashing
 #include "aesw.h"
@@ -38,12 +59,22 @@
 #include <cerrno>
 #include <cstddef>
 #include <cstring>
+#include <ctime>
 
 // C++ includes
+#include <algorithm>
 #include <array>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
 using std::array;
 using std::unique_ptr;
+using std::vector;
 
 // Sector buffer. (1 LBA)
 typedef union _sbuf1_t {
@@ -65,73 +96,810 @@ typedef union _sbuf2_t {
 	};
 } sbuf2_t;
 
+// Verification error report.
+// Reports are buffered per group so they can be delivered
+// to the progress callback in group/sector order, regardless
+// of which thread processed the group.
+struct VerifyErrorReport {
+	uint8_t hash_level;	// 0, 1, 2, 3, 4
+	uint8_t sector;		// Sector 0-63 in the current group
+	uint8_t kb;		// Kilobyte 1-31 (H0 only) [KB 0 == hashes]
+	uint8_t err_type;	// Error type (see RvtH_Verify_Error_Type)
+	bool is_zero;		// If true, sector is zeroed. (scrubbed/truncated)
+};
+
+/**
+ * Add an error report to a group's report list.
+ * @param reports	[in/out] Report list
+ * @param hash_level	[in] Hash level
+ * @param sector	[in] Sector
+ * @param kb		[in] Kilobyte (H0 only)
+ * @param err_type	[in] Error type
+ * @param is_zero	[in] True if the sector (or KB) is zeroed
+ */
+static inline void add_report(vector<VerifyErrorReport> &reports,
+	uint8_t hash_level, uint8_t sector, uint8_t kb,
+	RvtH_Verify_Error_Type err_type, bool is_zero)
+{
+	VerifyErrorReport report;
+	report.hash_level = hash_level;
+	report.sector = sector;
+	report.kb = kb;
+	report.err_type = static_cast<uint8_t>(err_type);
+	report.is_zero = is_zero;
+	reports.push_back(report);
+}
+
+// Zero map for a 2 MB group.
+// Computed from the encrypted group before it's decrypted in place,
+// so error reports can indicate if a sector was zeroed.
+struct GroupZeroMap {
+	uint64_t sectors;	// Bit n: Sector n is all zero
+	uint32_t kb[64];	// Bit n: KB n of sector data is all zero
+};
+
+/**
+ * Build a zero map for an encrypted group.
+ *
+ * Encrypted data is effectively random, so the zero checks
+ * usually stop at the first word of each block.
+ *
+ * @tparam FullGroup	If true, the group has 64 sectors, and max_sector is ignored.
+ * @param gdata		[in] Encrypted group (64 sectors)
+ * @param max_sector_in	[in] Number of sectors to check
+ * @param zmap		[out] Zero map
+ */
+template<bool FullGroup>
+static void build_zero_map(const Wii_Disc_Sector_t *gdata,
+	unsigned int max_sector_in, GroupZeroMap *zmap)
+{
+	const unsigned int max_sector = (FullGroup ? 64U : max_sector_in);
+	StatsTimer timer(StatsCounters::TIMER_ZERO_SCAN);
+	zmap->sectors = 0;
+	for (unsigned int sector = 0; sector < max_sector; sector++) {
+		if (rvth_is_zero(reinterpret_cast<const uint8_t*>(&gdata[sector]), sizeof(gdata[sector]))) {
+			zmap->sectors |= (1ULL << sector);
+			zmap->kb[sector] = (1U << 31) - 1;
+			continue;
+		}
+
+		uint32_t kb_mask = 0;
+		for (unsigned int kb = 0; kb < 31; kb++) {
+			if (rvth_is_zero(&gdata[sector].data[kb * 1024], 1024)) {
+				kb_mask |= (1U << kb);
+			}
+		}
+		zmap->kb[sector] = kb_mask;
+	}
+}
+
+/**
+ * Get the number of LBAs to read for a 2 MB group.
+ * @param pte			[in] Partition table entry
+ * @param lba			[in] Starting LBA of the group
+ * @param is_last_group		[in] True if this is the last group in the partition
+ * @param pLbaLen		[out] Number of LBAs to read
+ * @param pMaxSector		[in/out] Number of sectors to check
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int group_read_len(const pt_entry_t *pte, uint32_t lba,
+	bool is_last_group, uint32_t *pLbaLen, unsigned int *pMaxSector)
+{
+#define LBAS_PER_GROUP BYTES_TO_LBA(GROUP_SIZE_ENC)
+	if (unlikely(lba + LBAS_PER_GROUP > pte->lba_start + pte->lba_len)) {
+		// Incomplete group. Attempting to read it will
+		// result in an assertion. I'm not sure how this
+		// would work on real hardware, but some SDK update
+		// images have incomplete groups.
+		if (!is_last_group) {
+			// Should not happen if this isn't the last group!
+			assert(!"Group is truncated, but it isn't the last group.");
+			return -EIO;
+		}
+		const uint32_t lba_remain = pte->lba_len - lba;
+		*pLbaLen = lba_remain;
+
+		const unsigned int tmp_max_sector = lba_remain / 64;
+		if (tmp_max_sector < *pMaxSector) {
+			*pMaxSector = tmp_max_sector;
+		}
+	} else {
+		// Read a full group.
+		*pLbaLen = LBAS_PER_GROUP;
+	}
+
+	return 0;
+}
+
+/**
+ * Read a 2 MB group from a partition.
+ * @param reader		[in] Reader
+ * @param pte			[in] Partition table entry
+ * @param lba			[in] Starting LBA of the group
+ * @param is_last_group		[in] True if this is the last group in the partition
+ * @param gdata_enc		[out] Group buffer (64 sectors)
+ * @param pMaxSector		[in/out] Number of sectors to check
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int read_group(Reader *reader, const pt_entry_t *pte, uint32_t lba,
+	bool is_last_group, Wii_Disc_Sector_t *gdata_enc, unsigned int *pMaxSector)
+{
+	uint32_t lba_len;
+	int ret = group_read_len(pte, lba, is_last_group, &lba_len, pMaxSector);
+	if (ret != 0) {
+		return ret;
+	}
+
+	const uint32_t lba_size = reader->read(gdata_enc, lba, lba_len);
+	if (lba_size != lba_len) {
+		// Read error.
+		return -EIO;
+	}
+	return 0;
+}
+
 /**
- * Is a block of data all zero bytes?
- * @param pData Data block
- * @param size Size of data block, in bytes
- * @return True if the data is all zero; false if not.
+ * Decrypt and verify a 2 MB group. (internal function)
+ *
+ * Only the last group of a partition can be shorter than 64 sectors,
+ * so the sector count is a compile-time constant for every other
+ * group. The per-sector loops then have a fixed trip count, and the
+ * subgroup clamping for the last subgroup is removed entirely.
+ *
+ * @tparam FullGroup	If true, the group has 64 sectors, and max_sector_in is ignored.
+ * @param aesw		[in] AES context (title key must be set)
+ * @param gdata		[in/out] Encrypted group (64 sectors); decrypted on return
+ * @param max_sector_in	[in] Number of sectors to check
+ * @param H3_entry	[in] H3 table entry for this group
+ * @param zero_group	[in,opt] Encrypted zeroed group for this title key
+ * @param check_data	[in] If true, decrypt the user data and check H0.
+ * @param reports	[out] Error reports
  */
-static bool is_block_zero(const uint8_t *pData, size_t size)
+template<bool FullGroup>
+static void verify_group_int(AesCtx *aesw,
+	Wii_Disc_Sector_t *gdata, unsigned int max_sector_in, const uint8_t *H3_entry,
+	const EncryptedZeroGroup *zero_group, bool check_data,
+	vector<VerifyErrorReport> &reports)
 {
-	// Vectorize to uintptr_t.
-	// TODO: Handle unaligned architectures?
-	const uintptr_t *pData32 = reinterpret_cast<const uintptr_t*>(pData);
-	for (; size > sizeof(uintptr_t)-1; size -= sizeof(uintptr_t), pData32++) {
-		if (*pData32 != 0) {
-			// Not zero.
-			return false;
+	const unsigned int max_sector = (FullGroup ? 64U : max_sector_in);
+	RVTH_TRACE_SPAN_BYTES("verify_group", max_sector * sizeof(Wii_Disc_Sector_t));
+
+	array<uint8_t, RVL_SHA1_DIGEST_SIZE> digest;
+
+	if (zero_group &&
+	    memcmp(H3_entry, zero_group->H3(), RVL_SHA1_DIGEST_SIZE) == 0 &&
+	    zero_group->matches(gdata, max_sector))
+	{
+		// Encrypted zeroed group with a matching H3 hash.
+		// The hash tree is known to be valid.
+		return;
+	}
+
+	// Zero IV for decrypting hashes.
+	uint8_t zero_iv[16];
+	memset(zero_iv, 0, sizeof(zero_iv));
+
+	// Check for zeroed sectors before decrypting.
+	GroupZeroMap zmap;
+	build_zero_map<FullGroup>(gdata, max_sector, &zmap);
+
+	// Decrypt the user data and calculate the H0 hashes.
+	// Each kilobyte is hashed right after it's decrypted, while
+	// it's still in cache.
+	// User data IV is stored within the encrypted H2 table,
+	// so decrypt the user data first, *then* the hashes.
+	uint8_t H0_calc[64][31][RVL_SHA1_DIGEST_SIZE];
+	if (check_data) {
+		// NOTE: Counted as AES, since the H0 hashes are
+		// calculated while the user data is decrypted.
+		StatsTimer timer(StatsCounters::TIMER_AES);
+		wii_hash_tree_decrypt_calc_H0(aesw, gdata, max_sector, H0_calc);
+	}
+
+	// Decrypt hashes. (IV == 0)
+	// Each sector is an independent CBC stream, so all sectors
+	// are decrypted in one batch to keep the AES pipeline full.
+	array<const uint8_t*, 64> pIV;
+	array<uint8_t*, 64> pData;
+	for (unsigned int i = 0; i < max_sector; i++) {
+		pIV[i] = zero_iv;
+		pData[i] = reinterpret_cast<uint8_t*>(&gdata[i].hashes);
+	}
+	{
+		StatsTimer timer(StatsCounters::TIMER_AES);
+		aesw_decrypt_multi(aesw, pIV.data(), pData.data(), sizeof(gdata[0].hashes), max_sector);
+	}
+
+	// Calculate the H3 hash. (hash of H2 table in sector 0)
+	{
+		StatsTimer timer(StatsCounters::TIMER_SHA1);
+		wii_hash_tree_calc_H3(&gdata[0], digest.data());
+	}
+	if (memcmp(H3_entry, digest.data(), digest.size()) != 0) {
+		add_report(reports, 3, 0, 0, RVTH_VERIFY_ERROR_BAD_HASH,
+			!!(zmap.sectors & (1ULL << 0)));
+	}
+
+	// Make sure sectors 1-63 have the same H2 table as sector 0.
+	for (unsigned int sector = 1; sector < max_sector; sector++) {
+		if (memcmp(gdata[0].hashes.H2,
+			   gdata[sector].hashes.H2,
+		           sizeof(gdata[0].hashes.H2)) != 0)
+		{
+			add_report(reports, 2, sector, 0, RVTH_VERIFY_ERROR_TABLE_COPY,
+				!!(zmap.sectors & (1ULL << sector)));
 		}
 	}
-	if (unlikely(size > 0)) {
-		pData = reinterpret_cast<const uint8_t*>(pData32);
-		for (; size > 0; size--, pData++) {
-			if (*pData != 0) {
-				// Not zero.
-				return false;
+
+	// Verify the H2 hashes. (hash of H1 tables in each subgroup of 8 sectors)
+	uint8_t H2_calc[8][RVL_SHA1_DIGEST_SIZE];
+	{
+		StatsTimer timer(StatsCounters::TIMER_SHA1);
+		wii_hash_tree_calc_H2(gdata, (max_sector + 7) / 8, H2_calc);
+	}
+	for (unsigned int sector = 0; sector < max_sector; sector += 8) {
+		const unsigned int sg = sector / 8;
+		if (memcmp(gdata[0].hashes.H2[sg], H2_calc[sg], sizeof(H2_calc[sg])) != 0) {
+			add_report(reports, 2, sector, 0, RVTH_VERIFY_ERROR_BAD_HASH,
+				!!(zmap.sectors & (1ULL << sector)));
+		}
+	}
+
+	// Make sure sectors in each subgroup have the same H1 table as
+	// sectors 0, 8, 16, 24, 32, 40, 48, 56.
+	for (unsigned int sector_start = 0; sector_start < max_sector; sector_start += 8) {
+		unsigned int sector_end = sector_start + 8;
+		if (sector_end > max_sector) {
+			sector_end = max_sector;
+		}
+		for (unsigned int sector = sector_start; sector < sector_end; sector++) {
+			if (memcmp(gdata[sector_start].hashes.H1,
+			           gdata[sector].hashes.H1,
+			           sizeof(gdata[0].hashes.H1)) != 0)
+			{
+				add_report(reports, 1, sector, 0, RVTH_VERIFY_ERROR_TABLE_COPY,
+					!!(zmap.sectors & (1ULL << sector)));
 			}
 		}
 	}
 
-	// It's all zero.
-	return true;
+	// Verify the H1 hashes. (hash of H0 tables in each block of 31 KB)
+	uint8_t H1_calc[64][RVL_SHA1_DIGEST_SIZE];
+	{
+		StatsTimer timer(StatsCounters::TIMER_SHA1);
+		wii_hash_tree_calc_H1(gdata, max_sector, H1_calc);
+	}
+	for (unsigned int sector = 0; sector < max_sector; sector++) {
+		if (memcmp(gdata[sector].hashes.H1[sector % 8], H1_calc[sector], sizeof(H1_calc[sector])) != 0) {
+			add_report(reports, 1, sector, 0, RVTH_VERIFY_ERROR_BAD_HASH,
+				!!(zmap.sectors & (1ULL << sector)));
+		}
+	}
+
+	if (!check_data) {
+		// Quick verification. User data isn't checked.
+		return;
+	}
+
+	// H0 tables are unique per block.
+	// Verify the H0 hashes. (Now we're actually checking the data!)
+	for (unsigned int sector = 0; sector < max_sector; sector++) {
+		for (unsigned int kb = 0; kb < 31; kb++) {
+			if (memcmp(gdata[sector].hashes.H0[kb], H0_calc[sector][kb], sizeof(H0_calc[sector][kb])) != 0) {
+				add_report(reports, 0, sector, kb+1, RVTH_VERIFY_ERROR_BAD_HASH,
+					!!(zmap.kb[sector] & (1U << kb)));
+			}
+		}
+	}
 }
 
 /**
- * Verify partitions in a Wii disc image.
+ * Decrypt and verify a 2 MB group.
  *
- * NOTE: This function only supports encrypted Wii disc images,
- * either retail or debug encryption.
+ * This function doesn't touch any shared state, so it can be
+ * called from multiple threads as long as each thread has its
+ * own AES context and group buffers.
  *
- * This will check all five levels of hashes:
- * - H4: Hash of H3 table (stored in the TMD)
- * - H3: Hash of all H2 tables (H2 table = 2 MB group)
- * - H2: Hash of all H1 tables (H1 table = 256 KB subgroup)
- * - H1: Hash of all H0 tables (H0 table = 32 KB block)
- * - H0: Hash of a single KB   (H0 = 1 KB)
+ * The group is decrypted in place. If check_data is false,
+ * only the hash tables are decrypted, and H0 isn't checked.
  *
- * NOTE: Assuming the TMD signature is valid, which means
- * the H4 hash is correct.
+ * @param aesw		[in] AES context (title key must be set)
+ * @param gdata		[in/out] Encrypted group (64 sectors); decrypted on return
+ * @param max_sector	[in] Number of sectors to check
+ * @param H3_entry	[in] H3 table entry for this group
+ * @param zero_group	[in,opt] Encrypted zeroed group for this title key
+ * @param check_data	[in] If true, decrypt the user data and check H0.
+ * @param reports	[out] Error reports
+ */
+static void verify_group(AesCtx *aesw,
+	Wii_Disc_Sector_t *gdata, unsigned int max_sector, const uint8_t *H3_entry,
+	const EncryptedZeroGroup *zero_group, bool check_data,
+	vector<VerifyErrorReport> &reports)
+{
+	if (likely(max_sector == 64)) {
+		verify_group_int<true>(aesw, gdata, 64, H3_entry, zero_group, check_data, reports);
+	} else {
+		verify_group_int<false>(aesw, gdata, max_sector, H3_entry, zero_group, check_data, reports);
+	}
+}
+
+// Maximum number of verification worker threads.
+#define VERIFY_MAX_THREADS 16
+
+/**
+ * Partition verification job.
  *
- * @param bank		[in] Bank number (0-7)
- * @param errors	[out] Error counts for all 5 hash tables
- * @param callback	[in,opt] Progress callback
- * @param userdata	[in,opt] User data for progress callback
- * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ * All partitions are prepared before verification starts, so the
+ * group pipeline can continue into the next partition without
+ * waiting for its partition header and H3 table to be read.
  */
-int RvtH::verifyWiiPartitions(unsigned int bank,
-	unsigned int error_count[5],
-	RvtH_Verify_Progress_Callback callback,
-	void *userdata)
+struct VerifyPartitionJob {
+	unsigned int pt_idx = 0;		// Partition index
+	const pt_entry_t *pte = nullptr;	// Partition table entry
+	uint32_t lba_data = 0;			// Starting LBA of the first group
+	unsigned int group_start = 0;		// First group to verify
+	unsigned int group_count = 0;		// Number of groups
+	unsigned int last_group_sectors = 0;	// Number of sectors in the last group (0 for a full group)
+	uint64_t data_size = 0;			// Data size from the partition header, in bytes (0 if unknown)
+
+	// Known partitions. (See KnownPartitions.)
+	bool known = false;			// If true, the user data isn't checked.
+	unsigned int error_count = 0;		// Number of errors, including missing groups
+
+	uint8_t title_key[16];			// Decrypted title key
+	unique_ptr<EncryptedZeroGroup> zero_group;	// Encrypted zeroed group (nullptr if invalid)
+	PoolBuffer H3_buf;			// H3 table
+	vector<uint8_t> check_data;		// Per-group flags: check user data (if empty, check all groups)
+	vector<uint8_t> missing;		// Per-group flags: not present in the image (if empty, all groups are present)
+	vector<uint8_t> skip;			// Per-group flags: clean in the verification map (if empty, no groups are skipped)
+
+	// Verification map.
+	uint8_t key_hash[VerifyMap::KEY_HASH_SIZE];	// Title key hash
+	vector<uint8_t> status;			// Group status (VerifyMap::GroupStatus)
+
+	// Errors to report before verifying the groups:
+	// the H4 error, or the errors replayed from the checkpoint.
+	vector<VerifyCheckpoint::Error> pre_errors;
+	bool record_pre_errors = false;		// If true, add pre_errors to the checkpoint.
+
+	inline const Wii_Disc_H3_t *H3(void) const
+	{
+		return H3_buf.as<Wii_Disc_H3_t>();
+	}
+
+	inline const EncryptedZeroGroup *zeroGroup(void) const
+	{
+		return (zero_group && zero_group->isValid() ? zero_group.get() : nullptr);
+	}
+
+	inline const uint8_t *checkData(void) const
+	{
+		return (!check_data.empty() ? check_data.data() : nullptr);
+	}
+
+	inline bool isMissing(unsigned int g) const
+	{
+		return (!missing.empty() && missing[g]);
+	}
+
+	inline bool isSkipped(unsigned int g) const
+	{
+		return (!skip.empty() && skip[g]);
+	}
+
+	/**
+	 * Is a group read and verified?
+	 * Missing groups and groups that were clean in the
+	 * verification map are neither read nor verified.
+	 */
+	inline bool isVerified(unsigned int g) const
+	{
+		return !isMissing(g) && !isSkipped(g);
+	}
+};
+
+/**
+ * Group verification pipeline.
+ *
+ * A reader thread prefetches groups into a bounded set of slots,
+ * and worker threads decrypt and verify the groups out of order.
+ * The calling thread collects the results in group order, so
+ * progress callbacks are always invoked from the calling thread
+ * in the same order as single-threaded verification.
+ *
+ * The pipeline runs across partition boundaries: the reader thread
+ * reads the groups of all partitions in partition table order, which
+ * is sorted by LBA, so device access stays sequential and the workers
+ * don't drain at the end of each partition.
+ *
+ * Groups that aren't present in the image or were skipped using
+ * the verification map are neither read nor verified. They don't
+ * use a slot, and are passed to the result handler with no reports.
+ */
+class VerifyGroupPipeline {
+	public:
+		/**
+		 * Partition handler.
+		 * Called from the calling thread before and after a partition's groups.
+		 * @param j		[in] Job index
+		 * @param finished	[in] False if the partition is starting; true if it's finished.
+		 */
+		typedef std::function<void(unsigned int j, bool finished)> PartitionFn;
+
+		/**
+		 * Group result handler.
+		 * Called from the calling thread in group order.
+		 * @param j		[in] Job index
+		 * @param g		[in] Group index
+		 * @param reports	[in] Error reports for this group
+		 * @return True to continue; false to cancel verification.
+		 */
+		typedef std::function<bool(unsigned int j, unsigned int g, const vector<VerifyErrorReport> &reports)> ResultFn;
+
+		/**
+		 * Create a group verification pipeline.
+		 * @param threads	[in] Number of worker threads (must be >= 2)
+		 */
+		explicit VerifyGroupPipeline(unsigned int threads)
+			: m_threads(threads)
+			, m_slots(threads * 2)
+		{
+			for (GroupSlot &slot : m_slots) {
+				slot.gdata.reset(sizeof(Wii_Disc_Sector_t) * 64);	// 2 MB, one group
+			}
+		}
+
+	private:
+		DISABLE_COPY(VerifyGroupPipeline)
+
+	public:
+		/**
+		 * Verify all groups in a list of partitions.
+		 * @param reader	[in] Reader
+		 * @param jobs		[in] Partition jobs, in LBA order
+		 * @param partition_fn	[in] Partition handler
+		 * @param result_fn	[in] Group result handler
+		 * @return 0 on success; -ECANCELED if cancelled; negative POSIX error code on error.
+		 */
+		int run(Reader *reader, const vector<unique_ptr<VerifyPartitionJob> > &jobs,
+			const PartitionFn &partition_fn, const ResultFn &result_fn);
+
+	private:
+		// Group slot status.
+		enum class SlotStatus {
+			Free,		// Available for reading
+			Reading,	// Reader thread is reading the group
+			Ready,		// Group has been read; waiting for a worker
+			Busy,		// Worker is verifying the group
+			Done,		// Results are available
+		};
+
+		struct GroupSlot {
+			PoolBuffer gdata;			// Group (decrypted in place)
+			vector<VerifyErrorReport> reports;
+			size_t seq = ~static_cast<size_t>(0);	// Sequence number across all jobs
+			unsigned int j = ~0U;			// Job index
+			unsigned int g = ~0U;			// Group index
+			unsigned int max_sector = 0;		// Number of sectors to check
+			uint32_t lba_len = 0;			// Number of LBAs read
+			int err = 0;				// Read error
+			SlotStatus status = SlotStatus::Free;
+		};
+
+		unsigned int m_threads;
+		vector<GroupSlot> m_slots;
+
+		// Shared state. Protected by m_mutex.
+		std::mutex m_mutex;
+		std::condition_variable m_cond;
+		std::deque<unsigned int> m_ready;	// Slot indexes ready for verification
+		bool m_readDone = false;
+		bool m_abort = false;
+};
+
+/**
+ * Verify all groups in a list of partitions.
+ * @param reader	[in] Reader
+ * @param jobs		[in] Partition jobs, in LBA order
+ * @param partition_fn	[in] Partition handler
+ * @param result_fn	[in] Group result handler
+ * @return 0 on success; -ECANCELED if cancelled; negative POSIX error code on error.
+ */
+int VerifyGroupPipeline::run(Reader *reader, const vector<unique_ptr<VerifyPartitionJob> > &jobs,
+	const PartitionFn &partition_fn, const ResultFn &result_fn)
 {
-	int ret = 0;	// errno or RvtH_Errors
-	if (error_count) {
-		for (unsigned int i = 0; i < 5; i++) {
-			error_count[i] = 0;
+	// Make sure the group buffers were allocated.
+	for (const GroupSlot &slot : m_slots) {
+		if (!slot.gdata) {
+			return -ENOMEM;
+		}
+	}
+
+	// Initialize the AES contexts. (one per worker)
+	// The title key is set when a worker gets its first group
+	// from each partition.
+	vector<AesCtx*> aesw_ctxs;
+	aesw_ctxs.reserve(m_threads);
+	for (unsigned int i = 0; i < m_threads; i++) {
+		errno = 0;
+		AesCtx *const aesw = aesw_new();
+		if (!aesw) {
+			int ret = -errno;
+			if (ret == 0) {
+				ret = -ENOMEM;
+			}
+			for (AesCtx *p : aesw_ctxs) {
+				aesw_free(p);
+			}
+			return ret;
+		}
+		aesw_ctxs.push_back(aesw);
+	}
+
+	// Reset the shared state.
+	for (GroupSlot &slot : m_slots) {
+		slot.seq = ~static_cast<size_t>(0);
+		slot.status = SlotStatus::Free;
+	}
+	m_ready.clear();
+	m_readDone = false;
+	m_abort = false;
+
+	const unsigned int slot_count = static_cast<unsigned int>(m_slots.size());
+	const unsigned int job_count = static_cast<unsigned int>(jobs.size());
+
+	// Reader thread: Prefetch groups into free slots.
+	// Reads for all free slots are kept in flight, so the source
+	// device has multiple requests queued if io_uring is available.
+	// The reader and the workers are counted as part of this operation.
+	StatsCounters *const stats = StatsCounters::current();
+
+	std::thread reader_thread([&]() {
+		StatsScope scope(stats);
+		AsyncReader aio(reader, slot_count);
+		bool stop = false;
+
+		// Wait for a read to finish, and hand the group to the workers.
+		auto finish_read = [&]() {
+			uintptr_t tag;
+			uint32_t lba_read;
+			int err;
+			if (aio.wait(&tag, &lba_read, &err) != 0) {
+				// Should not happen...
+				return;
+			}
+
+			GroupSlot &slot = m_slots[tag];
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (lba_read != slot.lba_len) {
+				// Read error. The calling thread will
+				// handle it once it reaches this group.
+				slot.err = (err != 0 ? err : -EIO);
+				slot.status = SlotStatus::Done;
+				stop = true;
+			} else {
+				slot.status = SlotStatus::Ready;
+				m_ready.push_back(static_cast<unsigned int>(tag));
+			}
+			m_cond.notify_all();
+		};
+
+		size_t seq = 0;
+		for (unsigned int j = 0; j < job_count && !stop; j++) {
+			const VerifyPartitionJob &job = *jobs[j];
+			uint32_t lba = job.lba_data + (job.group_start * LBAS_PER_GROUP);
+			for (unsigned int g = job.group_start; g < job.group_count; g++, lba += LBAS_PER_GROUP) {
+				if (!job.isVerified(g))
+					continue;
+				const unsigned int idx = static_cast<unsigned int>(seq % slot_count);
+				GroupSlot &slot = m_slots[idx];
+
+				// Wait for the slot to be free.
+				// Slots can't be freed until the groups before them are
+				// verified, so finish the reads in flight while waiting.
+				std::unique_lock<std::mutex> lock(m_mutex);
+				while (!m_abort && slot.status != SlotStatus::Free) {
+					if (aio.pending() == 0) {
+						m_cond.wait(lock, [&]() { return m_abort || slot.status == SlotStatus::Free; });
+					} else {
+						lock.unlock();
+						finish_read();
+						lock.lock();
+					}
+				}
+				if (m_abort || stop) {
+					stop = true;
+					break;
+				}
+
+				const bool is_last_group = (g == (job.group_count - 1));
+				unsigned int max_sector = 64;
+				if (job.last_group_sectors != 0 && is_last_group) {
+					max_sector = job.last_group_sectors;
+				}
+				uint32_t lba_len = 0;
+				const int err = group_read_len(job.pte, lba, is_last_group, &lba_len, &max_sector);
+
+				slot.seq = seq;
+				slot.j = j;
+				slot.g = g;
+				slot.max_sector = max_sector;
+				slot.lba_len = lba_len;
+				slot.err = err;
+				if (err != 0) {
+					// Invalid group. The calling thread will
+					// handle it once it reaches this group.
+					slot.status = SlotStatus::Done;
+					m_cond.notify_all();
+					stop = true;
+					break;
+				}
+				slot.status = SlotStatus::Reading;
+				lock.unlock();
+
+				aio.submit(slot.gdata.get(), lba, lba_len, idx);
+				seq++;
+			}
+		}
+
+		// Finish the reads that are still in flight.
+		while (aio.pending() > 0) {
+			finish_read();
+		}
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_readDone = true;
+		m_cond.notify_all();
+	});
+
+	// Worker threads: Verify groups as they become available.
+	vector<std::thread> workers;
+	workers.reserve(m_threads);
+	for (unsigned int i = 0; i < m_threads; i++) {
+		AesCtx *const aesw = aesw_ctxs[i];
+		workers.emplace_back([this, stats, aesw, &jobs]() {
+			StatsScope scope(stats);
+			unsigned int key_j = ~0U;	// Job whose title key is set
+
+			std::unique_lock<std::mutex> lock(m_mutex);
+			while (true) {
+				m_cond.wait(lock, [this]() {
+					return m_abort || !m_ready.empty() || m_readDone;
+				});
+				if (m_abort || m_ready.empty())
+					break;
+
+				const unsigned int idx = m_ready.front();
+				m_ready.pop_front();
+				GroupSlot &slot = m_slots[idx];
+				slot.status = SlotStatus::Busy;
+				lock.unlock();
+
+				const VerifyPartitionJob &job = *jobs[slot.j];
+				if (slot.j != key_j) {
+					aesw_set_key(aesw, job.title_key, sizeof(job.title_key));
+					key_j = slot.j;
+				}
+
+				const uint8_t *const check_data = job.checkData();
+				slot.reports.clear();
+				if (StatsCounters::cancelled()) {
+					slot.err = -ECANCELED;
+				} else {
+					verify_group(aesw, slot.gdata.as<Wii_Disc_Sector_t>(),
+						slot.max_sector, job.H3()->h3[slot.g], job.zeroGroup(),
+						(!check_data || check_data[slot.g]), slot.reports);
+				}
+
+				lock.lock();
+				slot.status = SlotStatus::Done;
+				m_cond.notify_all();
+			}
+		});
+	}
+
+	// Collect the results in group order.
+	int ret = 0;
+	size_t seq = 0;
+	for (unsigned int j = 0; j < job_count && ret == 0; j++) {
+		const VerifyPartitionJob &job = *jobs[j];
+		partition_fn(j, false);
+
+		for (unsigned int g = job.group_start; g < job.group_count; g++) {
+			if (!job.isVerified(g)) {
+				if (!result_fn(j, g, vector<VerifyErrorReport>())) {
+					// Cancelled.
+					ret = -ECANCELED;
+					break;
+				}
+				continue;
+			}
+
+			GroupSlot &slot = m_slots[seq % slot_count];
+
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_cond.wait(lock, [&]() { return slot.status == SlotStatus::Done && slot.seq == seq; });
+			lock.unlock();
+
+			if (slot.err != 0) {
+				// Read error.
+				ret = slot.err;
+				break;
+			}
+			if (!result_fn(j, g, slot.reports)) {
+				// Cancelled.
+				ret = -ECANCELED;
+				break;
+			}
+
+			lock.lock();
+			slot.status = SlotStatus::Free;
+			m_cond.notify_all();
+			seq++;
+		}
+
+		if (ret == 0) {
+			partition_fn(j, true);
 		}
 	}
 
-	// Make sure this is a Wii disc.
-	RvtH_BankEntry *const entry = &m_entries[bank];
+	// Shut down the threads.
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_abort = true;
+		m_cond.notify_all();
+	}
+	reader_thread.join();
+	for (std::thread &worker : workers) {
+		worker.join();
+	}
+
+	for (AesCtx *p : aesw_ctxs) {
+		aesw_free(p);
+	}
+	return ret;
+}
+
+// Quick verification: User data is checked in about 1 of every N groups.
+#define VERIFY_QUICK_SAMPLE_RATE 32
+
+// Checkpoints: Save the progress every N groups. (128 MB)
+#define VERIFY_CHECKPOINT_INTERVAL 64
+
+/**
+ * Select a random sample of groups for quick verification.
+ * The user data is only checked in the selected groups.
+ * At least one group is always selected.
+ * @param rng		[in/out] Random number generator
+ * @param group_count	[in] Number of groups
+ * @param check_data	[out] Per-group flags: check user data
+ */
+static void select_sample_groups(std::minstd_rand &rng,
+	unsigned int group_count, vector<uint8_t> &check_data)
+{
+	check_data.assign(group_count, 0);
+	if (group_count == 0)
+		return;
+
+	bool any = false;
+	for (unsigned int g = 0; g < group_count; g++) {
+		if (rng() % VERIFY_QUICK_SAMPLE_RATE == 0) {
+			check_data[g] = 1;
+			any = true;
+		}
+	}
+	if (!any) {
+		check_data[rng() % group_count] = 1;
+	}
+}
+
+/**
+ * Check if a bank can be verified by verifyWiiPartitions().
+ * @param entry		[in] Bank entry
+ * @return 0 if the bank can be verified; RvtH_Errors code if not.
+ */
+static int check_bank_verifiable(const RvtH_BankEntry *entry)
+{
 	switch (entry->type) {
 		case RVTH_BankType_Wii_SL:
 		case RVTH_BankType_Wii_DL:
@@ -157,12 +925,196 @@ int RvtH::verifyWiiPartitions(unsigned int bank,
 			return RVTH_ERROR_BANK_DL_2;
 	}
 
-	// Make sure it's encrypted.
-	if (entry->crypto_type <= RVL_CryptoType_None ||
-	    entry->crypto_type >= RVL_CryptoType_MAX)
-	{
-		// Not encrypted.
-		return RVTH_ERROR_IS_UNENCRYPTED;
+	// Make sure it's encrypted.
+	if (entry->crypto_type <= RVL_CryptoType_None ||
+	    entry->crypto_type >= RVL_CryptoType_MAX)
+	{
+		// Not encrypted.
+		return RVTH_ERROR_IS_UNENCRYPTED;
+	}
+
+	return 0;
+}
+
+/**
+ * Get the TMD content entry from a partition header.
+ * @param pt_hdr	[in] Partition header
+ * @return Content entry, or nullptr if the TMD is invalid.
+ */
+static const RVL_Content_Entry *get_content_entry(const RVL_PartitionHeader *pt_hdr)
+{
+	// TMD must be located within the partition header.
+	const unsigned int tmd_offset = be32_to_cpu(pt_hdr->tmd_offset) << 2;
+	const unsigned int tmd_size = be32_to_cpu(pt_hdr->tmd_size);
+	if (tmd_offset == 0 || tmd_offset > sizeof(RVL_PartitionHeader) ||
+	    tmd_size < (sizeof(RVL_TMD_Header) + sizeof(RVL_Content_Entry)))
+	{
+		// TMD offset and/or size is invalid.
+		return nullptr;
+	}
+	const RVL_TMD_Header *const pTmd = reinterpret_cast<const RVL_TMD_Header*>(
+		reinterpret_cast<const uint8_t*>(pt_hdr) + tmd_offset);
+	if (pTmd->nbr_cont != cpu_to_be16(1)) {
+		// Disc partitions should only have one content in the TMD!
+		return nullptr;
+	}
+	return reinterpret_cast<const RVL_Content_Entry*>(
+		reinterpret_cast<const uint8_t*>(pt_hdr) + tmd_offset + sizeof(RVL_TMD_Header));
+}
+
+/**
+ * Hash the TMD content hashes (H4) of all partitions in a bank.
+ * This is used as the key for cached verification results.
+ * @param entry		[in] Bank entry (partition table must be loaded)
+ * @param content_hash	[out] SHA-1 of all content hashes, in partition table order
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int get_bank_content_hash(RvtH_BankEntry *entry, uint8_t content_hash[SHA1_DIGEST_SIZE])
+{
+	struct sha1_ctx sha1;
+	sha1_init(&sha1);
+	for (unsigned int pt_idx = 0; pt_idx < entry->pt_count; pt_idx++) {
+		const RVL_PartitionHeader *const pt_hdr = rvth_ptbl_get_header(entry, &entry->ptbl[pt_idx]);
+		if (!pt_hdr) {
+			// Read error.
+			int err = errno;
+			if (err == 0) {
+				err = EIO;
+				errno = EIO;
+			}
+			return -err;
+		}
+
+		const RVL_Content_Entry *const pContentEntry = get_content_entry(pt_hdr);
+		if (!pContentEntry) {
+			errno = EIO;
+			return -EIO;
+		}
+		sha1_update(&sha1, sizeof(pContentEntry->sha1_hash), pContentEntry->sha1_hash);
+	}
+	sha1_digest(&sha1, SHA1_DIGEST_SIZE, content_hash);
+	return 0;
+}
+
+/**
+ * Get the cached verification result for a bank.
+ *
+ * Results are cached by verifyWiiPartitions(), and are only
+ * valid if the bank hasn't been rewritten since it was verified.
+ * This reads the partition headers, but not the partition data.
+ *
+ * @param bank		[in] Bank number (0-7)
+ * @param result	[out] Cached verification result
+ * @param flags		[in,opt] Flags (Quick verification results are only returned if RVTH_VERIFY_QUICK is set, and results that skipped known partitions if RVTH_VERIFY_QUICK or RVTH_VERIFY_SKIP_KNOWN_PARTITIONS is set.)
+ * @return 0 on success; -ENOENT if no result is cached; other error code on error.
+ */
+int RvtH::getCachedVerifyResult(unsigned int bank, RvtH_Verify_Cached_Result *result, unsigned int flags)
+{
+	if (!m_verifyCache) {
+		// Results are only cached for HDDs.
+		errno = ENOENT;
+		return -ENOENT;
+	}
+
+	RvtH_BankEntry *const entry = getBankEntry(bank);
+	int ret = check_bank_verifiable(entry);
+	if (ret != 0) {
+		return ret;
+	}
+
+	// Make sure the partition table is loaded.
+	ret = rvth_ptbl_load(entry);
+	if (ret != 0 || entry->pt_count == 0 || !entry->ptbl) {
+		// Unable to load the partition table.
+		errno = -ret;
+		return ret;
+	}
+
+	uint8_t content_hash[SHA1_DIGEST_SIZE];
+	ret = get_bank_content_hash(entry, content_hash);
+	if (ret != 0) {
+		return ret;
+	}
+
+	std::lock_guard<std::mutex> lock(m_verifyCacheMutex);
+	if (!m_verifyCache->lookup(bank, entry, content_hash, flags, result)) {
+		errno = ENOENT;
+		return -ENOENT;
+	}
+	return 0;
+}
+
+/**
+ * Verify partitions in a Wii disc image.
+ *
+ * NOTE: This function only supports encrypted Wii disc images,
+ * either retail or debug encryption.
+ *
+ * This will check all five levels of hashes:
+ * - H4: Hash of H3 table (stored in the TMD)
+ * - H3: Hash of all H2 tables (H2 table = 2 MB group)
+ * - H2: Hash of all H1 tables (H1 table = 256 KB subgroup)
+ * - H1: Hash of all H0 tables (H0 table = 32 KB block)
+ * - H0: Hash of a single KB   (H0 = 1 KB)
+ *
+ * NOTE: Assuming the TMD signature is valid, which means
+ * the H4 hash is correct.
+ *
+ * If RVTH_VERIFY_QUICK is set, only the hash tables are
+ * decrypted, and H0 is only checked for a random sample
+ * of groups.
+ *
+ * If RVTH_VERIFY_SKIP_KNOWN_PARTITIONS is set, the user data of
+ * update partitions in the known partitions database isn't checked.
+ * Update partitions that pass a full verification without errors
+ * are added to the database. (See KnownPartitions.)
+ *
+ * If RVTH_VERIFY_CHECKPOINT is set, the progress is saved every
+ * VERIFY_CHECKPOINT_INTERVAL groups, and if verification is cancelled
+ * or fails due to a read error. The next verification with this flag
+ * resumes from the checkpoint, and replays the errors that were
+ * reported before it.
+ *
+ * If RVTH_VERIFY_USE_CACHE is set and the bank hasn't been
+ * rewritten since it was last verified, the cached result is
+ * returned without verifying the bank again. Otherwise, groups
+ * that were clean the last time and haven't been written since
+ * are skipped. Results are always cached for RVT-H Readers and
+ * HDD images.
+ *
+ * If the progress callback returns false, verification is cancelled.
+ *
+ * @param bank		[in] Bank number (0-7)
+ * @param errors	[out] Error counts for all 5 hash tables
+ * @param callback	[in,opt] Progress callback
+ * @param userdata	[in,opt] User data for progress callback
+ * @param threads	[in,opt] Number of worker threads (0 for auto; 1 for single-threaded)
+ * @param flags		[in,opt] Flags (See RvtH_Verify_Flags.)
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.) [-ECANCELED if cancelled]
+ */
+int RvtH::verifyWiiPartitions(unsigned int bank,
+	unsigned int error_count[5],
+	RvtH_Verify_Progress_Callback callback,
+	void *userdata,
+	unsigned int threads,
+	unsigned int flags)
+{
+	StatsScope scope(m_stats);
+	int ret = 0;	// errno or RvtH_Errors
+	unsigned int local_error_count[5];
+	if (!error_count) {
+		// Error counts are needed for the verification cache.
+		error_count = local_error_count;
+	}
+	for (unsigned int i = 0; i < 5; i++) {
+		error_count[i] = 0;
+	}
+
+	// Make sure this is an encrypted Wii disc.
+	RvtH_BankEntry *const entry = getBankEntry(bank);
+	ret = check_bank_verifiable(entry);
+	if (ret != 0) {
+		return ret;
 	}
 
 	// Make sure the partition table is loaded.
@@ -173,6 +1125,32 @@ int RvtH::verifyWiiPartitions(unsigned int bank,
 		return ret;
 	}
 
+	// Check for a cached result.
+	if ((flags & RVTH_VERIFY_USE_CACHE) && m_verifyCache) {
+		RvtH_Verify_Cached_Result cached;
+		if (getCachedVerifyResult(bank, &cached, flags) == 0) {
+			memcpy(error_count, cached.error_count, sizeof(cached.error_count));
+			return 0;
+		}
+	}
+
+	// Determine the number of worker threads.
+	if (threads == 0) {
+		threads = std::thread::hardware_concurrency();
+		if (threads == 0) {
+			threads = 1;
+		}
+	}
+	if (threads > VERIFY_MAX_THREADS) {
+		threads = VERIFY_MAX_THREADS;
+	}
+	// Share the CPUs with other pipelines, e.g. other banks
+	// being verified by verifyAllWiiPartitions().
+	ThreadPool::Reservation cpus(threads);
+	threads = cpus.count();
+	// Each worker has two group slots in the pipeline.
+	threads = budgetThreads(threads, 2 * GROUP_SIZE_ENC);
+
 	// Callback state.
 	RvtH_Verify_Progress_State state;
 
@@ -191,35 +1169,201 @@ int RvtH::verifyWiiPartitions(unsigned int bank,
 		state.kb = 0;
 		state.err_type = RVTH_VERIFY_ERROR_UNKNOWN;
 		state.is_zero = false;
+		state.errors = nullptr;
+		state.error_count = 0;
+		state.missing_count = 0;
 	}
 
-	struct sha1_ctx sha1;
-	array<uint8_t, SHA1_DIGEST_SIZE> digest;
-	unique_ptr<RVL_PartitionHeader> pt_hdr(new RVL_PartitionHeader);
-	unique_ptr<Wii_Disc_H3_t> H3_tbl(new Wii_Disc_H3_t);
-	// NOTE: Retaining the encrypted version in order to do zero checks.
-	unique_ptr<Wii_Disc_Sector_t[]> gdata_enc(new Wii_Disc_Sector_t[64]);	// 2 MB, one group
-	unique_ptr<Wii_Disc_Sector_t[]> gdata(new Wii_Disc_Sector_t[64]);	// 2 MB, one group
-
-	// Initialize the AES context.
-	errno = 0;
-	AesCtx *const aesw = aesw_new();
-	if (!aesw) {
-		int ret = -errno;
-		if (ret == 0) {
-			ret = -EIO;
+	// Progress callback throttling.
+	// Group status updates are throttled, and errors are
+	// reported in batches if requested by the progress parameters.
+	ProgressThrottle throttle(&m_progressParams);
+	const unsigned int error_batch_max = (callback ? m_progressParams.error_batch : 0);
+	vector<RvtH_Verify_Error> error_batch;
+	if (error_batch_max > 0) {
+		error_batch.reserve(std::min(error_batch_max, 256U));
+	}
+
+	// Verification checkpoint.
+	const bool use_checkpoint = !!(flags & RVTH_VERIFY_CHECKPOINT);
+	VerifyCheckpoint checkpoint;
+	if (use_checkpoint) {
+		checkpoint.load(m_file, bank, entry, (flags & RVTH_VERIFY_QUICK));
+	}
+	unsigned int pt_cur = 0;	// Current partition
+	unsigned int groups_done = 0;	// Number of groups verified in the current partition
+
+	// Consecutive groups that aren't present in the image.
+	// These are reported in bulk once the run ends.
+	unsigned int missing_start = 0;
+	unsigned int missing_count = 0;
+
+	// Deliver the pending batch of errors.
+	// This must be called before delivering any other updates.
+	auto flush_errors = [&]() {
+		if (error_batch.empty())
+			return;
+		state.type = RVTH_VERIFY_ERROR_BATCH;
+		state.errors = error_batch.data();
+		state.error_count = static_cast<unsigned int>(error_batch.size());
+		callback(&state, userdata);
+		state.errors = nullptr;
+		state.error_count = 0;
+		error_batch.clear();
+	};
+
+	// Deliver the pending run of missing groups.
+	// This must be called before delivering any other updates
+	// for later groups.
+	auto flush_missing = [&]() {
+		if (missing_count == 0)
+			return;
+		if (callback) {
+			flush_errors();
+			state.group_cur = missing_start;
+			state.type = RVTH_VERIFY_GROUPS_MISSING;
+			state.is_zero = true;
+			state.missing_count = missing_count;
+			callback(&state, userdata);
+			state.missing_count = 0;
 		}
-		return ret;
+		missing_count = 0;
+	};
+
+	// Add a group that isn't present in the image.
+	// The group isn't read, so it's counted as a single H3 error
+	// instead of an error for every sector.
+	auto add_missing = [&](unsigned int g) {
+		if (missing_count != 0 && missing_start + missing_count != g) {
+			flush_missing();
+		}
+		if (missing_count == 0) {
+			missing_start = g;
+		}
+		missing_count++;
+		error_count[3]++;
+	};
+
+	// Report a single error.
+	auto report_error = [&](unsigned int g, const VerifyErrorReport &report) {
+		flush_missing();
+		state.is_zero = report.is_zero;
+		error_count[report.hash_level]++;
+		if (error_batch_max > 0) {
+			// Add the error to the current batch.
+			RvtH_Verify_Error err;
+			err.group = g;
+			err.hash_level = report.hash_level;
+			err.sector = report.sector;
+			err.kb = (report.hash_level == 0 ? report.kb : 0);
+			err.err_type = report.err_type;
+			err.is_zero = report.is_zero;
+			error_batch.push_back(err);
+			if (error_batch.size() >= error_batch_max) {
+				flush_errors();
+			}
+		} else if (callback) {
+			state.group_cur = g;
+			state.type = RVTH_VERIFY_ERROR_REPORT;
+			state.hash_level = report.hash_level;
+			state.sector = report.sector;
+			if (report.hash_level == 0) {
+				state.kb = report.kb;
+			}
+			state.err_type = report.err_type;
+			callback(&state, userdata);
+		}
+	};
+
+	// Record an error in the checkpoint.
+	auto checkpoint_error = [&](unsigned int g, const VerifyErrorReport &report) {
+		VerifyCheckpoint::Error err;
+		memset(&err, 0, sizeof(err));
+		err.pt_idx = pt_cur;
+		err.group = g;
+		err.hash_level = report.hash_level;
+		err.sector = report.sector;
+		err.kb = report.kb;
+		err.err_type = report.err_type;
+		err.is_zero = report.is_zero;
+		checkpoint.addError(err);
+	};
+
+	// Report the results for a single group.
+	// This is always called from this thread, in group order.
+	// Missing groups have no reports; they're reported once the run ends.
+	// Skipped groups have no reports, since they were clean.
+	auto report_group = [&](VerifyPartitionJob &job, unsigned int g, const vector<VerifyErrorReport> &reports) -> bool {
+		const bool missing = job.isMissing(g);
+		if (job.isVerified(g)) {
+			// Update the verification map.
+			// If the group's user data wasn't checked, a group without
+			// errors keeps its previous status.
+			const uint8_t *const p_check_data = job.checkData();
+			if (!reports.empty()) {
+				job.status[g] = VerifyMap::GROUP_BAD;
+			} else if (!p_check_data || p_check_data[g]) {
+				const EncryptedZeroGroup *const zero_group = job.zeroGroup();
+				job.status[g] = (zero_group && !memcmp(job.H3()->h3[g], zero_group->H3(), SHA1_DIGEST_SIZE))
+					? VerifyMap::GROUP_ZEROED
+					: VerifyMap::GROUP_CLEAN;
+			}
+		}
+
+		if (missing) {
+			add_missing(g);
+			job.error_count++;
+		} else {
+			flush_missing();
+		}
+		job.error_count += static_cast<unsigned int>(reports.size());
+
+		// Update the status.
+		bool keep_going = true;
+		if (callback && !missing && throttle.ready(static_cast<uint64_t>(g) * GROUP_SIZE_ENC)) {
+			flush_errors();
+			state.group_cur = g;
+			state.type = RVTH_VERIFY_STATUS;
+			keep_going = callback(&state, userdata);
+		}
+
+		for (const VerifyErrorReport &report : reports) {
+			report_error(g, report);
+			if (use_checkpoint) {
+				checkpoint_error(g, report);
+			}
+		}
+
+		groups_done = g + 1;
+		if (use_checkpoint && keep_going && (groups_done % VERIFY_CHECKPOINT_INTERVAL) == 0) {
+			checkpoint.save(pt_cur, groups_done);
+		}
+		return keep_going;
+	};
+
+	// Quick verification: Groups whose user data will be checked.
+	const bool quick = !!(flags & RVTH_VERIFY_QUICK);
+	std::minstd_rand rng;
+	if (quick) {
+		rng.seed(std::random_device()());
 	}
 
-	// Zero IV for decrypting hashes.
-	uint8_t zero_iv[16];
-	memset(zero_iv, 0, sizeof(zero_iv));
+	struct sha1_ctx sha1;
+	array<uint8_t, SHA1_DIGEST_SIZE> digest;
+	vector<array<uint8_t, SHA1_DIGEST_SIZE> > content_hashes(entry->pt_count);	// for the verification cache
+	PoolBuffer pt_hdr_buf(sizeof(RVL_PartitionHeader));
+	if (!pt_hdr_buf) {
+		errno = ENOMEM;
+		return -ENOMEM;
+	}
 
-	// Verify partitions.
+	// Prepare a partition for verification.
+	// This reads the partition header and the H3 table, and checks the H4 hash.
 	Reader *const reader = entry->reader;
-	for (unsigned int pt_idx = 0; pt_idx < entry->pt_count; pt_idx++) {
+	auto prepare_job = [&](unsigned int pt_idx, VerifyPartitionJob *job) -> int {
 		const pt_entry_t *const pte = &entry->ptbl[pt_idx];
+		job->pt_idx = pt_idx;
+		job->pte = pte;
 
 		// Initial group count will be calculated based on data size.
 		// NOTE: LBA length is in 512-byte (2^9) blocks. Groups are 2 MB (2^21).
@@ -234,32 +1378,45 @@ int RvtH::verifyWiiPartitions(unsigned int bank,
 			last_group_sectors = (pte->lba_len & 0xFFF) / 64;
 		}
 
-		if (callback) {
-			// Starting the next partition.
-			state.pt_type = pte->type;
-			state.pt_current = pt_idx;
-
-			// NOTE: Determining number of groups by searching for the first
-			// all-zero hash in the H3 table, not by using the data size.
-			// TODO: Compare the two?
-			state.group_cur = 0;
-			state.group_total = group_count;
-
-			state.type = RVTH_VERIFY_STATUS;
-			callback(&state, userdata);
+		// Read the partition header and the H3 table.
+		// NOTE: Each partition needs its own copy of the H3 table, since
+		// the H3 tables of all partitions are in use while the pipeline
+		// is running.
+		if (!job->H3_buf.reset(sizeof(Wii_Disc_H3_t))) {
+			errno = ENOMEM;
+			return -ENOMEM;
 		}
 
-		// Read the partition header.
-		size_t lba_size = reader->read(pt_hdr.get(), pte->lba_start, BYTES_TO_LBA(sizeof(RVL_PartitionHeader)));
-		if (lba_size != BYTES_TO_LBA(sizeof(RVL_PartitionHeader))) {
-			// Read error.
-			int err = errno;
-			if (err == 0) {
-				err = EIO;
-				errno = EIO;
+		// The H3 table is usually right after the partition header,
+		// so both are read at once, unless the partition header is
+		// already cached. If the H3 table is somewhere else, or if it
+		// wasn't read yet, it's read once the header has been checked.
+		static const uint32_t pt_hdr_lba_len = BYTES_TO_LBA(sizeof(RVL_PartitionHeader));
+		static const uint32_t h3_lba_len = BYTES_TO_LBA(sizeof(Wii_Disc_H3_t));
+		Reader::ReadRange ranges[2] = {
+			{pt_hdr_buf.get(), pte->lba_start, pt_hdr_lba_len, 0},
+			{job->H3_buf.get(), pte->lba_start + pt_hdr_lba_len, h3_lba_len, 0},
+		};
+		const RVL_PartitionHeader *pt_hdr = pte->hdr;
+		if (!pt_hdr) {
+			const bool h3_in_range = (pte->lba_start + pt_hdr_lba_len + h3_lba_len <= reader->lba_len());
+			errno = 0;
+			reader->readv(ranges, (h3_in_range ? 2 : 1));
+			if (ranges[0].lba_read != pt_hdr_lba_len) {
+				// Read error.
+				int err = errno;
+				if (err == 0) {
+					err = EIO;
+					errno = EIO;
+				}
+				return -err;
+			}
+
+			// Cache the partition header.
+			pt_hdr = rvth_ptbl_set_header(entry, pte, pt_hdr_buf.as<RVL_PartitionHeader>());
+			if (!pt_hdr) {
+				pt_hdr = pt_hdr_buf.as<RVL_PartitionHeader>();
 			}
-			aesw_free(aesw);
-			return -err;
 		}
 
 		// Use the data length in the partition header to determine
@@ -272,56 +1429,41 @@ int RvtH::verifyWiiPartitions(unsigned int bank,
 				// Cannot be more than 9 GiB!
 				// H3 table is limited to 9,830.4 MiB,
 				// but dual-layer discs are limited to ~8 GiB.
-				aesw_free(aesw);
 				errno = EIO;
 				return -EIO;
 			}
+			job->data_size = data_size;
 			group_count = static_cast<uint32_t>(data_size / GROUP_SIZE_ENC);
 			if (data_size % GROUP_SIZE_ENC != 0) {
 				group_count++;
 				last_group_sectors = static_cast<uint32_t>((data_size % GROUP_SIZE_ENC) / 32768);
 			}
-			if (callback) {
-				state.group_total = group_count;
-				state.type = RVTH_VERIFY_STATUS;
-				callback(&state, userdata);
-			}
 		}
 
-		// TMD must be located within the partition header.
-		const unsigned int tmd_offset = be32_to_cpu(pt_hdr->tmd_offset) << 2;
-		const unsigned int tmd_size = be32_to_cpu(pt_hdr->tmd_size);
-		if (tmd_offset == 0 || tmd_offset > sizeof(RVL_PartitionHeader) ||
-		    tmd_size < (sizeof(RVL_TMD_Header) + sizeof(RVL_Content_Entry)))
-		{
-			// TMD offset and/or size is invalid.
-			// TODO: More specific error?
-			aesw_free(aesw);
-			errno = EIO;
-			return -EIO;
-		}
-		const RVL_TMD_Header *const pTmd = reinterpret_cast<const RVL_TMD_Header*>(
-			reinterpret_cast<const uint8_t*>(pt_hdr.get()) + tmd_offset);
-		if (pTmd->nbr_cont != cpu_to_be16(1)) {
-			// Disc partitions should only have one content in the TMD!
+		// Get the TMD content entry.
+		const RVL_Content_Entry *const pContentEntry = get_content_entry(pt_hdr);
+		if (!pContentEntry) {
+			// TMD is invalid.
 			// TODO: More specific error?
-			aesw_free(aesw);
 			errno = EIO;
 			return -EIO;
 		}
-		const RVL_Content_Entry *const pContentEntry = reinterpret_cast<const RVL_Content_Entry*>(
-			reinterpret_cast<const uint8_t*>(pt_hdr.get()) + tmd_offset + sizeof(RVL_TMD_Header));
+		memcpy(content_hashes[pt_idx].data(), pContentEntry->sha1_hash, SHA1_DIGEST_SIZE);
 
 		// Decrypt the title key.
-		uint8_t title_key[16];
+		// NOTE: Title keys are cached, so re-verifying a bank
+		// doesn't need to decrypt the title key again.
 		uint8_t crypto_type;	// not used yet?
-		ret = decrypt_title_key(&pt_hdr->ticket, title_key, &crypto_type);
-		if (ret != 0) {
+		const int tk_ret = decryptTitleKey(&pt_hdr->ticket, job->title_key, &crypto_type);
+		if (tk_ret != 0) {
 			// Error decrypting title key.
 			// TODO: Indicate the error.
-			return ret;
+			return tk_ret;
 		}
-		aesw_set_key(aesw, title_key, sizeof(title_key));
+
+		// Zeroed groups, e.g. in scrubbed images, all have the same
+		// ciphertext, so they can be verified with memcmp().
+		job->zero_group.reset(new EncryptedZeroGroup(job->title_key));
 
 		// Get the H3 table offset. (usually 0x8000)
 		// NOTE: It's shifted right by 2, so un-shift, then convert to LBA.
@@ -330,23 +1472,24 @@ int RvtH::verifyWiiPartitions(unsigned int bank,
 		if (h3_tbl_lba == 0) {
 			// Invalid H3 table LBA.
 			// TODO: Return a better error code.
-			aesw_free(aesw);
 			errno = EIO;
 			return -EIO;
 		}
 
-		// Read the H3 table.
-		lba_size = reader->read(H3_tbl.get(), pte->lba_start + h3_tbl_lba, BYTES_TO_LBA(sizeof(Wii_Disc_H3_t)));
-		if (lba_size != BYTES_TO_LBA(sizeof(Wii_Disc_H3_t))) {
-			// Read error.
-			aesw_free(aesw);
-			int err = errno;
-			if (err == 0) {
-				err = EIO;
-				errno = EIO;
+		// Read the H3 table if it wasn't read with the partition header.
+		if (h3_tbl_lba != pt_hdr_lba_len || ranges[1].lba_read != h3_lba_len) {
+			errno = 0;
+			if (reader->read(job->H3_buf.get(), pte->lba_start + h3_tbl_lba, h3_lba_len) != h3_lba_len) {
+				// Read error.
+				int err = errno;
+				if (err == 0) {
+					err = EIO;
+					errno = EIO;
+				}
+				return -err;
 			}
-			return -err;
 		}
+		const Wii_Disc_H3_t *const H3_tbl = job->H3();
 
 		// Unlikely: Partition header's data size is 0.
 		// If so, fall back to checking the H3 table.
@@ -362,247 +1505,325 @@ int RvtH::verifyWiiPartitions(unsigned int bank,
 
 				// Found an H3 entry that starts with 0.
 				// Check the rest of the entry.
-				if (is_block_zero(H3_entry, sizeof(H3_tbl->h3[0]))) {
+				if (rvth_is_zero(H3_entry, sizeof(H3_tbl->h3[0]))) {
 					// Found an all-zero entry.
 					break;
 				}
 			}
-			if (callback) {
-				state.group_total = group_count;
-				callback(&state, userdata);
-			}
 		}
 
-		// Verify the H4 hash. (H3 table)
+		// Hash the H3 table.
 		sha1_init(&sha1);
-		sha1_update(&sha1, sizeof(Wii_Disc_H3_t), reinterpret_cast<const uint8_t*>(H3_tbl.get()));
+		sha1_update(&sha1, sizeof(Wii_Disc_H3_t), reinterpret_cast<const uint8_t*>(H3_tbl));
 		sha1_digest(&sha1, digest.size(), digest.data());
-		if (memcmp(pContentEntry->sha1_hash, digest.data(), SHA1_DIGEST_SIZE) != 0) {
-			state.is_zero = is_block_zero((const uint8_t*)H3_tbl.get(), 512);	// only check one LBA
-			if (error_count) {
-				error_count[4]++;
+
+		unsigned int group_start = 0;
+		if (use_checkpoint && checkpoint.resumePartition(pt_idx, digest.data(), &group_start)) {
+			// Resuming from the checkpoint.
+			// Replay the errors that were already reported for this partition,
+			// including the H4 error, if any.
+			for (const VerifyCheckpoint::Error &err : checkpoint.errors()) {
+				if (err.pt_idx == pt_idx) {
+					job->pre_errors.push_back(err);
+				}
 			}
-			if (callback) {
-				state.type = RVTH_VERIFY_ERROR_REPORT;
-				state.hash_level = 4;
-				state.sector = 0;	// irrelevant for H4
-				state.err_type = RVTH_VERIFY_ERROR_BAD_HASH;
-				callback(&state, userdata);
+			if (group_start > group_count) {
+				group_start = group_count;
 			}
+		} else if (memcmp(pContentEntry->sha1_hash, digest.data(), SHA1_DIGEST_SIZE) != 0) {
+			// H4 hash (H3 table) is incorrect.
+			VerifyCheckpoint::Error err;
+			memset(&err, 0, sizeof(err));
+			err.pt_idx = pt_idx;
+			err.group = 0;
+			err.hash_level = 4;
+			err.sector = 0;		// irrelevant for H4
+			err.kb = 0;
+			err.err_type = RVTH_VERIFY_ERROR_BAD_HASH;
+			err.is_zero = rvth_is_zero((const uint8_t*)H3_tbl, 512);	// only check one LBA
+			job->pre_errors.push_back(err);
+			job->record_pre_errors = use_checkpoint;
+		}
+
+		// Known-good update partitions only need the hash tables checked.
+		// This requires a correct H4 hash, since the database is keyed
+		// by the TMD content hash.
+		// NOTE: pte->type == 1 is an update partition.
+		if ((flags & RVTH_VERIFY_SKIP_KNOWN_PARTITIONS) && pte->type == 1 &&
+		    job->pre_errors.empty() && job->data_size != 0 &&
+		    !memcmp(pContentEntry->sha1_hash, digest.data(), SHA1_DIGEST_SIZE) &&
+		    KnownPartitions::instance()->contains(digest.data(), job->data_size))
+		{
+			job->known = true;
+			job->check_data.assign(group_count, 0);
+		}
+
+		// Select the groups to check for quick verification.
+		// NOTE: The full groups are still read, since reading
+		// only the hash blocks would require 64 reads per group.
+		if (quick && !job->known) {
+			select_sample_groups(rng, group_count, job->check_data);
 		}
 
-		// Process the 2 MB blocks.
 		// FIXME: Check for an incomplete final block.
-#define LBAS_PER_GROUP BYTES_TO_LBA(GROUP_SIZE_ENC)
-		const uint8_t *H3_entry = H3_tbl->h3[0];
-		uint32_t lba = pte->lba_start + BYTES_TO_LBA(static_cast<uint64_t>(be32_to_cpu(pt_hdr->data_offset)) << 2);
-		for (unsigned int g = 0; g < group_count; g++, lba += LBAS_PER_GROUP) {
-			const bool is_last_group = (g == (group_count - 1));
+		job->lba_data = pte->lba_start + BYTES_TO_LBA(static_cast<uint64_t>(be32_to_cpu(pt_hdr->data_offset)) << 2);
 
-			unsigned int max_sector = 64;
-			if (last_group_sectors != 0 && is_last_group) {
-				max_sector = last_group_sectors;
+		// Groups in unallocated CISO/WBFS blocks are read as zeroes,
+		// so they're reported as missing without reading them.
+		if (reader->getEmptyMap(job->lba_data, LBAS_PER_GROUP, group_count, job->missing) == 0) {
+			job->missing.clear();
+		}
+
+		// Check the verification map. Groups that were clean
+		// aren't verified again if cached results are allowed.
+		sha1_init(&sha1);
+		sha1_update(&sha1, sizeof(job->title_key), job->title_key);
+		sha1_digest(&sha1, sizeof(job->key_hash), job->key_hash);
+		bool have_map = false;
+		if (m_verifyMap) {
+			std::lock_guard<std::mutex> lock(m_verifyCacheMutex);
+			have_map = m_verifyMap->getGroups(bank, entry,
+				job->lba_data, group_count, job->key_hash, job->status);
+		}
+		if (!have_map) {
+			job->status.assign(group_count, VerifyMap::GROUP_UNKNOWN);
+		} else if (flags & RVTH_VERIFY_USE_CACHE) {
+			job->skip.resize(group_count);
+			for (unsigned int g = 0; g < group_count; g++) {
+				job->skip[g] = (job->status[g] == VerifyMap::GROUP_CLEAN ||
+				                job->status[g] == VerifyMap::GROUP_ZEROED);
 			}
+		}
+		job->group_start = group_start;
+		job->group_count = group_count;
+		job->last_group_sectors = last_group_sectors;
+		return 0;
+	};
+
+	// Prepare all partitions before verifying any groups.
+	// NOTE: The partition table is sorted by LBA, so verifying the
+	// partitions in order keeps device access mostly sequential.
+	// If a partition can't be prepared, the partitions before it
+	// are still verified, and then the error is returned.
+	vector<unique_ptr<VerifyPartitionJob> > jobs;
+	jobs.reserve(entry->pt_count);
+	int prep_ret = 0;
+	unsigned int groups_remaining = 0;
+	for (unsigned int pt_idx = 0; pt_idx < entry->pt_count; pt_idx++) {
+		unique_ptr<VerifyPartitionJob> job(new VerifyPartitionJob());
+		prep_ret = prepare_job(pt_idx, job.get());
+		if (prep_ret != 0)
+			break;
+		groups_remaining += (job->group_count - job->group_start);
+		jobs.push_back(std::move(job));
+	}
 
+	// Start or finish a partition.
+	// This is always called from this thread, in partition order.
+	auto partition_fn = [&](unsigned int j, bool finished) {
+		const VerifyPartitionJob &job = *jobs[j];
+		if (finished) {
 			// Update the status.
+			flush_missing();
 			if (callback) {
-				state.group_cur = g;
+				flush_errors();
+				state.group_cur = job.group_count;
 				state.type = RVTH_VERIFY_STATUS;
 				callback(&state, userdata);
 			}
+			return;
+		}
 
-			if (unlikely(lba + LBAS_PER_GROUP > pte->lba_start + pte->lba_len)) {
-				// Incomplete group. Attempting to read it will
-				// result in an assertion. I'm not sure how this
-				// would work on real hardware, but some SDK update
-				// images have incomplete groups.
-				if (!is_last_group) {
-					// Should not happen if this isn't the last group!
-					assert(!"Group is truncated, but it isn't the last group.");
-					aesw_free(aesw);
-					errno = EIO;
-					return -EIO;
-				}
-				const uint32_t lba_remain = pte->lba_len - lba;
-				lba_size = reader->read(gdata_enc.get(), lba, lba_remain);
-				if (lba_size != lba_remain) {
-					// Read error.
-					aesw_free(aesw);
-					errno = EIO;
-					return -EIO;
-				}
+		pt_cur = job.pt_idx;
+		groups_done = job.group_start;
+		if (callback) {
+			// Starting the next partition.
+			state.pt_type = job.pte->type;
+			state.pt_current = job.pt_idx;
+			state.group_cur = 0;
+			state.group_total = job.group_count;
+			state.type = RVTH_VERIFY_STATUS;
+			callback(&state, userdata);
+			throttle.delivered(0);
+		}
 
-				const unsigned int tmp_max_sector = lba_remain / 64;
-				if (tmp_max_sector < max_sector) {
-					max_sector = tmp_max_sector;
-				}
-			} else {
-				// Read a full group;
-				lba_size = reader->read(gdata_enc.get(), lba, LBAS_PER_GROUP);
-				if (lba_size != LBAS_PER_GROUP) {
-					// Read error.
-					aesw_free(aesw);
-					errno = EIO;
-					return -EIO;
+		// Missing groups aren't saved in the checkpoint, since the
+		// allocation map is checked again. Report the ones before the
+		// checkpoint in group order with the replayed errors.
+		unsigned int g_missing = 0;
+		auto replay_missing = [&](unsigned int g_end) {
+			for (; g_missing < g_end; g_missing++) {
+				if (job.isMissing(g_missing)) {
+					add_missing(g_missing);
 				}
 			}
+		};
 
-			// Decrypt the blocks.
-			// User data IV is stored within the encrypted H2 table,
-			// so decrypt the user data first, *then* the hashes.
-			memcpy(gdata.get(), gdata_enc.get(), GROUP_SIZE_ENC);
-			for (unsigned int i = 0; i < max_sector; i++) {
-				// Decrypt user data.
-				aesw_set_iv(aesw, &gdata[i].hashes.H2[7][4], 16);
-				aesw_decrypt(aesw, gdata[i].data, sizeof(gdata[i].data));
-
-				// Decrypt hashes. (IV == 0)
-				aesw_set_iv(aesw, zero_iv, sizeof(zero_iv));
-				aesw_decrypt(aesw, (uint8_t*)&gdata[i].hashes, sizeof(gdata[i].hashes));
-			}
-
-			// Verify the H3 hash. (hash of H2 table in sector 0)
-			sha1_init(&sha1);
-			sha1_update(&sha1, sizeof(gdata[0].hashes.H2), gdata[0].hashes.H2[0]);
-			sha1_digest(&sha1, digest.size(), digest.data());
-			if (memcmp(H3_entry, digest.data(), digest.size()) != 0) {
-				state.is_zero = is_block_zero((const uint8_t*)&gdata_enc[0], sizeof(gdata_enc[0]));
-				if (error_count) {
-					error_count[3]++;
-				}
-				if (callback) {
-					state.type = RVTH_VERIFY_ERROR_REPORT;
-					state.hash_level = 3;
-					state.sector = 0;
-					state.err_type = RVTH_VERIFY_ERROR_BAD_HASH;
-					callback(&state, userdata);
-				}
+		for (const VerifyCheckpoint::Error &err : job.pre_errors) {
+			replay_missing(std::min<unsigned int>(err.group, job.group_start));
+			VerifyErrorReport report;
+			report.hash_level = err.hash_level;
+			report.sector = err.sector;
+			report.kb = err.kb;
+			report.err_type = err.err_type;
+			report.is_zero = !!err.is_zero;
+			report_error(err.group, report);
+			if (job.record_pre_errors) {
+				checkpoint.addError(err);
 			}
-			H3_entry += digest.size();
-
-			// Make sure sectors 1-63 have the same H2 table as sector 0.
-			for (unsigned int sector = 1; sector < max_sector; sector++) {
-				if (memcmp(gdata[0].hashes.H2,
-					   gdata[sector].hashes.H2,
-				           sizeof(gdata[0].hashes.H2)) != 0)
-				{
-					state.is_zero = is_block_zero((const uint8_t*)&gdata_enc[sector], sizeof(gdata_enc[sector]));
-					if (error_count) {
-						error_count[2]++;
-					}
-					if (callback) {
-						state.type = RVTH_VERIFY_ERROR_REPORT;
-						state.hash_level = 2;
-						state.sector = sector;
-						state.err_type = RVTH_VERIFY_ERROR_TABLE_COPY;
-						callback(&state, userdata);
-					}
-				}
+		}
+		replay_missing(job.group_start);
+	};
+
+	// Verify the partitions.
+	if (threads > 1 && groups_remaining > 1) {
+		// Multi-threaded verification.
+		VerifyGroupPipeline pipeline(threads);
+		ret = pipeline.run(reader, jobs, partition_fn,
+			[&](unsigned int j, unsigned int g, const vector<VerifyErrorReport> &reports) {
+				return report_group(*jobs[j], g, reports);
+			});
+	} else {
+		// Single-threaded verification.
+		PoolBuffer gdata(sizeof(Wii_Disc_Sector_t) * 64);	// 2 MB, one group (decrypted in place)
+		if (!gdata) {
+			errno = ENOMEM;
+			return -ENOMEM;
+		}
+		vector<VerifyErrorReport> reports;
+
+		// Initialize the AES context.
+		errno = 0;
+		AesCtx *const aesw = aesw_new();
+		if (!aesw) {
+			int ret = -errno;
+			if (ret == 0) {
+				ret = -EIO;
 			}
+			return ret;
+		}
 
-			// Verify the H2 hashes. (hash of H1 tables in each subgroup of 8 sectors)
-			for (unsigned int sector = 0; sector < max_sector; sector += 8) {
-				const unsigned int sg = sector / 8;
-				sha1_init(&sha1);
-				sha1_update(&sha1, sizeof(gdata[sector].hashes.H1), gdata[sector].hashes.H1[0]);
-				sha1_digest(&sha1, digest.size(), digest.data());
-				if (memcmp(gdata[0].hashes.H2[sg], digest.data(), digest.size()) != 0) {
-					state.is_zero = is_block_zero((const uint8_t*)&gdata_enc[sector], sizeof(gdata_enc[sector]));
-					if (error_count) {
-						error_count[2]++;
-					}
-					if (callback) {
-						state.type = RVTH_VERIFY_ERROR_REPORT;
-						state.hash_level = 2;
-						state.sector = sector;
-						state.err_type = RVTH_VERIFY_ERROR_BAD_HASH;
-						callback(&state, userdata);
+		const unsigned int job_count = static_cast<unsigned int>(jobs.size());
+		for (unsigned int j = 0; j < job_count && ret == 0; j++) {
+			VerifyPartitionJob &job = *jobs[j];
+			const uint8_t *const p_check_data = job.checkData();
+			aesw_set_key(aesw, job.title_key, sizeof(job.title_key));
+			partition_fn(j, false);
+
+			uint32_t lba = job.lba_data + (job.group_start * LBAS_PER_GROUP);
+			for (unsigned int g = job.group_start; g < job.group_count; g++, lba += LBAS_PER_GROUP) {
+				reports.clear();
+				if (!job.isVerified(g)) {
+					if (!report_group(job, g, reports)) {
+						// Cancelled.
+						ret = -ECANCELED;
+						break;
 					}
+					continue;
 				}
-			}
 
-			// Make sure sectors in each subgroup have the same H1 table as
-			// sectors 0, 8, 16, 24, 32, 40, 48, 56.
-			for (unsigned int sector_start = 0; sector_start < max_sector; sector_start += 8) {
-				unsigned int sector_end = sector_start + 8;
-				if (sector_end > max_sector) {
-					sector_end = max_sector;
-				}
-				for (unsigned int sector = sector_start; sector < sector_end; sector++) {
-					if (memcmp(gdata[sector_start].hashes.H1,
-					           gdata[sector].hashes.H1,
-					           sizeof(gdata[0].hashes.H1)) != 0)
-					{
-						state.is_zero = is_block_zero((const uint8_t*)&gdata_enc[sector], sizeof(gdata_enc[sector]));
-						if (error_count) {
-							error_count[1]++;
-						}
-						if (callback) {
-							state.type = RVTH_VERIFY_ERROR_REPORT;
-							state.hash_level = 1;
-							state.sector = sector;
-							state.err_type = RVTH_VERIFY_ERROR_TABLE_COPY;
-							callback(&state, userdata);
-						}
-					}
+				const bool is_last_group = (g == (job.group_count - 1));
+
+				unsigned int max_sector = 64;
+				if (job.last_group_sectors != 0 && is_last_group) {
+					max_sector = job.last_group_sectors;
 				}
-			}
 
-			// Verify the H1 hashes. (hash of H0 tables in each block of 31 KB)
-			for (unsigned int sector = 0; sector < max_sector; sector++) {
-				sha1_init(&sha1);
-				sha1_update(&sha1, sizeof(gdata[sector].hashes.H0), gdata[sector].hashes.H0[0]);
-				sha1_digest(&sha1, digest.size(), digest.data());
-				if (memcmp(gdata[sector].hashes.H1[sector % 8], digest.data(), digest.size()) != 0) {
-					state.is_zero = is_block_zero((const uint8_t*)&gdata_enc[sector], sizeof(gdata_enc[sector]));
-					if (error_count) {
-						error_count[1]++;
-					}
-					if (callback) {
-						state.type = RVTH_VERIFY_ERROR_REPORT;
-						state.hash_level = 1;
-						state.sector = sector;
-						state.err_type = RVTH_VERIFY_ERROR_BAD_HASH;
-						callback(&state, userdata);
-					}
+				ret = read_group(reader, job.pte, lba, is_last_group, gdata.as<Wii_Disc_Sector_t>(), &max_sector);
+				if (ret != 0) {
+					// Read error.
+					break;
+				}
+				verify_group(aesw, gdata.as<Wii_Disc_Sector_t>(),
+					max_sector, job.H3()->h3[g], job.zeroGroup(),
+					(!p_check_data || p_check_data[g]), reports);
+				if (!report_group(job, g, reports)) {
+					// Cancelled.
+					ret = -ECANCELED;
+					break;
 				}
 			}
 
-			// H0 tables are unique per block.
-			// Verify the H0 hashes. (Now we're actually checking the data!)
-			for (unsigned int sector = 0; sector < max_sector; sector++) {
-				const uint8_t *pData = gdata[sector].data;
-				for (unsigned int kb = 0; kb < 31; kb++, pData += 1024) {
-					sha1_init(&sha1);
-					sha1_update(&sha1, 1024, pData);
-					sha1_digest(&sha1, digest.size(), digest.data());
-					if (memcmp(gdata[sector].hashes.H0[kb], digest.data(), digest.size()) != 0) {
-						state.is_zero = is_block_zero(&gdata_enc[sector].data[kb * 1024], 1024);
-						if (error_count) {
-							error_count[0]++;
-						}
-						if (callback) {
-							state.type = RVTH_VERIFY_ERROR_REPORT;
-							state.hash_level = 0;
-							state.sector = sector;
-							state.kb = kb+1;
-							state.err_type = RVTH_VERIFY_ERROR_BAD_HASH;
-							callback(&state, userdata);
-						}
-					}
-				}
+			if (ret == 0) {
+				partition_fn(j, true);
 			}
 		}
 
-		// Update the status.
+		aesw_free(aesw);
+	}
+
+	if (m_verifyMap) {
+		// Save the group status, even if verification didn't finish.
+		// Groups that weren't verified keep their previous status.
+		std::lock_guard<std::mutex> lock(m_verifyCacheMutex);
+		for (const auto &job : jobs) {
+			m_verifyMap->setGroups(bank, entry, job->lba_data,
+				job->group_count, job->key_hash, job->status);
+		}
+	}
+
+	if (ret != 0) {
+		// Read error, or cancelled.
+		flush_missing();
 		if (callback) {
-			state.group_cur = group_count;
-			state.type = RVTH_VERIFY_STATUS;
-			callback(&state, userdata);
+			flush_errors();
+		}
+		if (use_checkpoint) {
+			checkpoint.save(pt_cur, groups_done);
+		}
+		errno = -ret;
+		return ret;
+	} else if (prep_ret != 0) {
+		// A partition couldn't be prepared.
+		if (prep_ret < 0) {
+			errno = -prep_ret;
 		}
+		return prep_ret;
 	}
 
 	// Finished verifying the disc.
+	if (use_checkpoint) {
+		checkpoint.remove();
+	}
+
+	// Add update partitions that passed a full verification
+	// to the known partitions database.
+	bool any_known = false;
+	bool added_known = false;
+	for (const auto &job : jobs) {
+		if (job->known) {
+			any_known = true;
+		} else if (!quick && job->pte->type == 1 && job->data_size != 0 &&
+		           job->group_start == 0 && job->error_count == 0 &&
+		           job->pre_errors.empty())
+		{
+			KnownPartitions::instance()->add(content_hashes[job->pt_idx].data(), job->data_size);
+			added_known = true;
+		}
+	}
+	if (added_known) {
+		// Errors are ignored, since the database is only an optimization.
+		KnownPartitions::instance()->save();
+	}
+
+	if (m_verifyCache) {
+		// Cache the result.
+		// If a known partition's user data wasn't checked,
+		// the result is marked as such.
+		RvtH_Verify_Cached_Result cached;
+		cached.verify_time = time(nullptr);
+		cached.flags = (flags & ~RVTH_VERIFY_SKIP_KNOWN_PARTITIONS) |
+			(any_known ? RVTH_VERIFY_SKIP_KNOWN_PARTITIONS : 0);
+		memcpy(cached.error_count, error_count, sizeof(cached.error_count));
+		sha1_init(&sha1);
+		for (const auto &content_hash : content_hashes) {
+			sha1_update(&sha1, content_hash.size(), content_hash.data());
+		}
+		sha1_digest(&sha1, digest.size(), digest.data());
+
+		std::lock_guard<std::mutex> lock(m_verifyCacheMutex);
+		m_verifyCache->store(bank, entry, digest.data(), &cached);
+	}
 	if (callback) {
 		state.pt_current = entry->pt_count;
 		callback(&state, userdata);
@@ -610,3 +1831,165 @@ int RvtH::verifyWiiPartitions(unsigned int bank,
 
 	return ret;
 }
+
+/**
+ * Verify partitions in all Wii banks.
+ *
+ * Each bank is verified using verifyWiiPartitions() on a pool of
+ * worker threads, with one bank per thread. Banks that can't be
+ * verified (empty, GameCube, unencrypted, etc.) are not scheduled;
+ * their results have the corresponding RvtH_Errors code.
+ *
+ * The bank callback is always invoked from the calling thread,
+ * in the order that banks finish verification.
+ *
+ * If RVTH_VERIFY_USE_CACHE is set, banks that haven't been
+ * rewritten since they were last verified report their cached
+ * results without being verified again.
+ *
+ * @param results	[out,opt] Array of bankCount() results, in bank order
+ * @param callback	[in,opt] Bank callback
+ * @param userdata	[in,opt] User data for bank callback
+ * @param threads	[in,opt] Number of worker threads (0 for auto; 1 for single-threaded)
+ * @param flags		[in,opt] Flags (See RvtH_Verify_Flags.)
+ * @return Number of banks that were verified, or negative POSIX error code on error.
+ */
+int RvtH::verifyAllWiiPartitions(RvtH_Verify_Bank_Result *results,
+	RvtH_Verify_Bank_Callback callback,
+	void *userdata,
+	unsigned int threads,
+	unsigned int flags)
+{
+	StatsScope scope(m_stats);
+	if (m_bankCount == 0) {
+		errno = ENOENT;
+		return -ENOENT;
+	}
+
+	// Initialize the results and determine which banks can be verified.
+	// Only Wii banks need to be fully initialized to check the encryption.
+	vector<RvtH_BankSummary> summaries;
+	bankSummaries(summaries, threads);
+	vector<RvtH_Verify_Bank_Result> bank_results(m_bankCount);
+	vector<unsigned int> banks;
+	banks.reserve(m_bankCount);
+	for (unsigned int bank = 0; bank < m_bankCount; bank++) {
+		RvtH_Verify_Bank_Result &result = bank_results[bank];
+		result.bank = bank;
+		memset(result.error_count, 0, sizeof(result.error_count));
+		result.cached = false;
+		result.verify_time = -1;
+		const uint8_t type = summaries[bank].type;
+		result.ret = check_bank_verifiable(getBankEntry(bank,
+			(type == RVTH_BankType_Wii_SL || type == RVTH_BankType_Wii_DL)
+				? RVTH_BANK_INIT_FULL : RVTH_BANK_INIT_HEADER));
+		if (result.ret == 0) {
+			// Bank can be verified. If verification is
+			// aborted before this bank is reached, it will
+			// be reported as canceled.
+			result.ret = -ECANCELED;
+			banks.push_back(bank);
+		}
+	}
+
+	// Determine the number of worker threads.
+	if (threads == 0) {
+		threads = std::thread::hardware_concurrency();
+		if (threads == 0) {
+			threads = 1;
+		}
+	}
+	if (threads > VERIFY_MAX_THREADS) {
+		threads = VERIFY_MAX_THREADS;
+	}
+	// Each group worker has two group slots in its bank's pipeline,
+	// and each bank needs at least one group buffer.
+	threads = budgetThreads(threads, 2 * GROUP_SIZE_ENC);
+
+	// One bank per worker thread. If there are more threads than
+	// banks, the remaining threads are split between the banks
+	// for group verification.
+	const unsigned int bank_threads = std::max(1U,
+		std::min(threads, static_cast<unsigned int>(banks.size())));
+	const unsigned int group_threads = std::max(1U, threads / bank_threads);
+
+	std::mutex mtx;
+	std::condition_variable cond;
+	std::deque<unsigned int> finished;	// Banks that finished verification
+	unsigned int next = 0;			// Next index in `banks`
+	unsigned int running = 0;		// Number of running worker threads
+	bool abort = false;
+
+	auto worker_fn = [&]() {
+		std::unique_lock<std::mutex> lock(mtx);
+		while (!abort && next < banks.size()) {
+			const unsigned int bank = banks[next++];
+			lock.unlock();
+
+			RvtH_Verify_Bank_Result &result = bank_results[bank];
+			RvtH_Verify_Cached_Result cached;
+			if ((flags & RVTH_VERIFY_USE_CACHE) &&
+			    getCachedVerifyResult(bank, &cached, flags) == 0)
+			{
+				// Bank hasn't changed since it was last verified.
+				result.ret = 0;
+				result.cached = true;
+				result.verify_time = cached.verify_time;
+				memcpy(result.error_count, cached.error_count, sizeof(result.error_count));
+			} else {
+				result.ret = verifyWiiPartitions(bank, result.error_count,
+					nullptr, nullptr, group_threads, flags);
+				result.verify_time = time(nullptr);
+			}
+
+			lock.lock();
+			finished.push_back(bank);
+			cond.notify_all();
+		}
+		running--;
+		cond.notify_all();
+	};
+
+	vector<std::thread> workers;
+	if (!banks.empty()) {
+		workers.reserve(bank_threads);
+		running = bank_threads;
+		for (unsigned int i = 0; i < bank_threads; i++) {
+			workers.emplace_back(worker_fn);
+		}
+	}
+
+	// Report the banks as they finish.
+	int verified = 0;
+	std::unique_lock<std::mutex> lock(mtx);
+	while (true) {
+		cond.wait(lock, [&]() { return !finished.empty() || running == 0; });
+		if (finished.empty())
+			break;
+
+		const unsigned int bank = finished.front();
+		finished.pop_front();
+		lock.unlock();
+
+		verified++;
+		if (callback) {
+			if (!callback(this, &bank_results[bank], userdata)) {
+				// Skip the remaining banks.
+				lock.lock();
+				abort = true;
+				continue;
+			}
+		}
+		lock.lock();
+	}
+	lock.unlock();
+
+	for (std::thread &worker : workers) {
+		worker.join();
+	}
+
+	if (results) {
+		memcpy(results, bank_results.data(), m_bankCount * sizeof(*results));
+	}
+	return verified;
+}
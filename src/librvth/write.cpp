@@ -8,6 +8,11 @@
 
 #include "rvth.hpp"
 #include "rvth_error.h"
+#include "ptbl.h"
+#include "BankCache.hpp"
+#include "VerifyCache.hpp"
+#include "VerifyMap.hpp"
+#include "StatsCounters.hpp"
 
 #include "byteswap.h"
 #include "nhcd_structs.h"
@@ -15,6 +20,11 @@
 // Disc image reader
 #include "reader/Reader.hpp"
 
+// Progress callback throttling
+#include "BufferPool.hpp"
+#include "ProgressRate.hpp"
+#include "ProgressThrottle.hpp"
+
 // C includes
 #include <stdlib.h>
 
@@ -24,22 +34,38 @@
 #include <cstring>
 #include <ctime>
 
+// C++ includes
+#include <algorithm>
+#include <vector>
+
 /**
  * Create a writable RVT-H disc image object.
  *
+ * If the filename ends with ".ciso" or ".wbfs", a CISO or WBFS
+ * image is created. Otherwise, a plain disc image is created.
+ *
  * Check isOpen() after constructing the object to determine
  * if the file was opened successfully.
  *
  * @param filename	[in] Filename.
  * @param lba_len	[in] LBA length. (Will NOT be allocated initially.)
  * @param pErr		[out,opt] Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ * @param keep		[in,opt] If true, open an existing plain disc image without truncating it, e.g. to resume a copy.
  */
-RvtH::RvtH(const TCHAR *filename, uint32_t lba_len, int *pErr)
+RvtH::RvtH(const TCHAR *filename, uint32_t lba_len, int *pErr, bool keep)
 	: m_file(nullptr)
 	, m_bankCount(0)
 	, m_imageType(RVTH_ImageType_Unknown)
 	, m_NHCD_status(NHCD_STATUS_UNKNOWN)
 	, m_entries(nullptr)
+	, m_bankCache(nullptr)
+	, m_verifyCache(nullptr)
+	, m_verifyMap(nullptr)
+	, m_txnActive(false)
+	, m_copyParams()
+	, m_sharedDurability(false)
+	, m_progressParams()
+	, m_stats(new StatsCounters())
 {
 	RvtH_BankEntry *entry;
 
@@ -68,7 +94,7 @@ RvtH::RvtH(const TCHAR *filename, uint32_t lba_len, int *pErr)
 	};
 
 	// Attempt to create the file.
-	m_file = new RefFile(filename, true);
+	m_file = new RefFile(filename, !keep);
 	if (!m_file->isOpen()) {
 		// Error creating the file.
 		err = m_file->lastError();
@@ -77,6 +103,12 @@ RvtH::RvtH(const TCHAR *filename, uint32_t lba_len, int *pErr)
 		}
 		goto fail;
 	}
+	if (keep) {
+		err = -m_file->makeWritable();
+		if (err != 0) {
+			goto fail;
+		}
+	}
 
 	// Initialize the bank entry.
 	// NOTE: Not using rvth_init_BankEntry() here.
@@ -91,7 +123,8 @@ RvtH::RvtH(const TCHAR *filename, uint32_t lba_len, int *pErr)
 	entry->timestamp = time(nullptr);
 
 	// Initialize the disc image reader.
-	entry->reader = Reader::open(m_file, entry->lba_start, entry->lba_len);
+	// The container format is selected by the file extension.
+	entry->reader = Reader::create(m_file, entry->lba_len, Reader::formatFromFilename(filename));
 	if (!entry->reader) {
 		// Error creating the disc image reader.
 		err = errno;
@@ -117,6 +150,105 @@ fail:
 	errno = err;
 }
 
+/**
+ * Create an empty RVT-H disk image.
+ *
+ * The image is created as a sparse file with the full size of
+ * an RVT-H HDD and a bank table with 8 empty banks. Unlike an
+ * HDD image that was opened with RvtH(), the returned object
+ * is writable, so banks can be imported into it.
+ *
+ * @param filename	[in] Filename.
+ * @param pErr		[out,opt] Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ * @return RvtH object, or nullptr on error.
+ */
+RvtH *RvtH::createHDD(const TCHAR *filename, int *pErr)
+{
+	if (!filename || filename[0] == 0) {
+		// Invalid parameters.
+		if (pErr) {
+			*pErr = -EINVAL;
+		}
+		errno = EINVAL;
+		return nullptr;
+	}
+
+	// Create the file.
+	RefFile *const f_img = new RefFile(filename, true);
+	if (!f_img->isOpen()) {
+		// Error creating the file.
+		int err = f_img->lastError();
+		if (err == 0) {
+			err = EIO;
+		}
+		f_img->unref();
+		if (pErr) {
+			*pErr = -err;
+		}
+		errno = err;
+		return nullptr;
+	}
+
+	// Set the file size to the end of the last bank.
+	// The banks aren't allocated until they're written.
+	const off64_t hdd_size = LBA_TO_BYTES(NHCD_BANK_START_LBA(NHCD_BANK_COUNT, NHCD_BANK_COUNT));
+	int ret = f_img->makeSparse(hdd_size);
+	if (ret != 0) {
+		f_img->unref();
+		if (pErr) {
+			*pErr = ret;
+		}
+		errno = -ret;
+		return nullptr;
+	}
+
+	// Write the bank table with all banks empty.
+	NHCD_BankTable nhcd_table;
+	memset(&nhcd_table, 0, sizeof(nhcd_table));
+	nhcd_table.header.magic = cpu_to_be32(NHCD_BANKTABLE_MAGIC);
+	nhcd_table.header.x004 = cpu_to_be32(0x00000001);
+	nhcd_table.header.bank_count = cpu_to_be32(NHCD_BANK_COUNT);
+	nhcd_table.header.x010 = cpu_to_be32(0x002FF000);
+	errno = 0;
+	size_t size = f_img->pwrite(&nhcd_table, sizeof(nhcd_table),
+		LBA_TO_BYTES(NHCD_BANKTABLE_ADDRESS_LBA));
+	if (size != sizeof(nhcd_table)) {
+		// Write error.
+		int err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		f_img->unref();
+		if (pErr) {
+			*pErr = -err;
+		}
+		errno = err;
+		return nullptr;
+	}
+	f_img->sync();
+
+	// Open the new RVT-H disk image.
+	// NOTE: The file was created writable, so makeWritable()
+	// doesn't require a device file for this object.
+	RvtH *const rvth = new RvtH(f_img, &ret);
+	f_img->unref();
+	if (!rvth->isOpen()) {
+		delete rvth;
+		if (ret == 0) {
+			ret = -EIO;
+		}
+		if (pErr) {
+			*pErr = ret;
+		}
+		return nullptr;
+	}
+
+	if (pErr) {
+		*pErr = 0;
+	}
+	return rvth;
+}
+
 /**
  * Delete a bank on an RVT-H device.
  * @param bank	[in] Bank number. (0-7)
@@ -142,7 +274,7 @@ int RvtH::deleteBank(unsigned int bank)
 	}
 
 	// Is the bank deleted?
-	RvtH_BankEntry *const rvth_entry = &m_entries[bank];
+	RvtH_BankEntry *const rvth_entry = getBankEntry(bank);
 	if (rvth_entry->is_deleted) {
 		// Bank is already deleted.
 		return RVTH_ERROR_BANK_IS_DELETED;
@@ -175,7 +307,6 @@ int RvtH::deleteBank(unsigned int bank)
 	rvth_entry->is_deleted = true;
 	rvth_entry->timestamp = -1;
 	ret = this->writeBankEntry(bank);
-	m_file->flush();
 	if (ret != 0) {
 		// Error deleting the bank...
 		rvth_entry->is_deleted = false;
@@ -208,7 +339,7 @@ int RvtH::undeleteBank(unsigned int bank)
 	}
 
 	// Is the bank deleted?
-	RvtH_BankEntry *const rvth_entry = &m_entries[bank];
+	RvtH_BankEntry *const rvth_entry = getBankEntry(bank);
 	if (!rvth_entry->is_deleted) {
 		// Bank is not deleted.
 		return RVTH_ERROR_BANK_NOT_DELETED;
@@ -254,10 +385,522 @@ int RvtH::undeleteBank(unsigned int bank)
 	// Undelete the bank and write the entry.
 	rvth_entry->is_deleted = false;
 	ret = this->writeBankEntry(bank, &rvth_entry->timestamp);
-	m_file->flush();
 	if (ret != 0) {
 		// Error undeleting the bank...
 		rvth_entry->is_deleted = true;
 	}
 	return ret;
 }
+
+/**
+ * Wipe a bank on an RVT-H device by zeroing the entire bank.
+ *
+ * The OS's zeroing primitive is used if available, e.g. BLKZEROOUT
+ * on Linux or FSCTL_SET_ZERO_DATA for disk image files on Windows.
+ * Otherwise, zeroes are written to the bank.
+ *
+ * The bank must be empty or deleted. A deleted image can't be
+ * undeleted after its bank is wiped.
+ *
+ * Once a bank is wiped, images can be imported into it using
+ * RVTH_IMPORT_SKIP_EMPTY, which skips writing empty blocks.
+ *
+ * @param bank		[in] Bank number. (0-7)
+ * @param callback	[in,opt] Progress callback.
+ * @param userdata	[in,opt] User data for progress callback.
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int RvtH::wipeBank(unsigned int bank, RvtH_Progress_Callback callback, void *userdata)
+{
+	StatsScope scope(m_stats);
+	if (!isHDD()) {
+		// Standalone disc image. No bank table.
+		errno = EINVAL;
+		return RVTH_ERROR_NOT_HDD_IMAGE;
+	} else if (bank >= m_bankCount) {
+		// Bank number is out of range.
+		errno = ERANGE;
+		return -ERANGE;
+	}
+
+	// Check the bank type.
+	RvtH_BankEntry *const rvth_entry = getBankEntry(bank);
+	switch (rvth_entry->type) {
+		case RVTH_BankType_Empty:
+			// Bank can be wiped.
+			break;
+
+		case RVTH_BankType_GCN:
+		case RVTH_BankType_Wii_SL:
+		case RVTH_BankType_Wii_DL:
+			// Bank can only be wiped if it's deleted.
+			if (!rvth_entry->is_deleted) {
+				errno = EEXIST;
+				return RVTH_ERROR_BANK_NOT_EMPTY_OR_DELETED;
+			}
+			break;
+
+		case RVTH_BankType_Unknown:
+		default:
+			// Unknown bank status...
+			return RVTH_ERROR_BANK_UNKNOWN;
+
+		case RVTH_BankType_Wii_DL_Bank2:
+			// Second bank of a dual-layer Wii disc image.
+			// TODO: Automatically select the first bank?
+			return RVTH_ERROR_BANK_DL_2;
+	}
+
+	// Make the RVT-H object writable.
+	int ret = this->makeWritable();
+	if (ret != 0) {
+		// Could not make the RVT-H object writable.
+		return ret;
+	}
+
+	// Determine the area to wipe.
+	// NOTE: Bank 1 is smaller if the bank table is extended.
+	// NOTE: Deleted dual-layer images also occupy the next bank.
+	RvtH_BankEntry *rvth_entry2 = nullptr;
+	uint32_t lba_wipe_len = (rvth_entry->lba_start < NHCD_BANKTABLE_ADDRESS_LBA)
+		? NHCD_EXTBANKTABLE_BANK_1_SIZE_LBA
+		: NHCD_BANK_SIZE_LBA;
+	if (rvth_entry->type == RVTH_BankType_Wii_DL && bank + 1 < m_bankCount) {
+		rvth_entry2 = getBankEntry(bank + 1);
+		if (rvth_entry2->type != RVTH_BankType_Empty &&
+		    rvth_entry2->type != RVTH_BankType_Wii_DL_Bank2)
+		{
+			// The next bank has its own image. Don't touch it.
+			rvth_entry2 = nullptr;
+		} else {
+			lba_wipe_len += NHCD_BANK_SIZE_LBA;
+		}
+	}
+
+	// Callback state.
+	RvtH_Progress_State state;
+	ProgressRate rate;
+	if (callback) {
+		state.rvth = this;
+		state.rvth_gcm = nullptr;
+		state.bank_rvth = bank;
+		state.bank_gcm = ~0U;
+		state.type = RVTH_PROGRESS_WIPE;
+		state.lba_processed = 0;
+		state.lba_total = lba_wipe_len;
+		state.digests = nullptr;
+	}
+
+	// The bank is zeroed using the OS's zeroing primitive if possible,
+	// e.g. BLKZEROOUT, in chunks so progress can be reported.
+	// If that isn't supported, zeroes are written using large aligned
+	// writes, which can use direct I/O.
+	static constexpr unsigned int WIPE_BUF_SIZE = 4U * 1024U * 1024U;
+	static constexpr uint32_t LBA_COUNT_WIPE_BUF = BYTES_TO_LBA(WIPE_BUF_SIZE);
+	static constexpr uint32_t LBA_COUNT_ZERO_CHUNK = BYTES_TO_LBA(64U * 1024U * 1024U);
+	bool use_zeroRange = true;
+	PoolBuffer zbuf;
+
+	ProgressThrottle throttle(&m_progressParams);
+	uint32_t lba_count = 0;
+	while (lba_count < lba_wipe_len) {
+		if (callback && throttle.ready(LBA_TO_BYTES(static_cast<uint64_t>(lba_count)))) {
+			state.lba_processed = lba_count;
+			rate.update(&state);
+			if (!callback(&state, userdata)) {
+				// Stop processing.
+				errno = ECANCELED;
+				return -ECANCELED;
+			}
+		}
+
+		if (use_zeroRange) {
+			const uint32_t lba_len = std::min(LBA_COUNT_ZERO_CHUNK, lba_wipe_len - lba_count);
+			ret = m_file->zeroRange(LBA_TO_BYTES(static_cast<off64_t>(rvth_entry->lba_start) + lba_count),
+				LBA_TO_BYTES(static_cast<off64_t>(lba_len)));
+			if (ret == 0) {
+				lba_count += lba_len;
+				continue;
+			} else if (ret != -ENOTSUP) {
+				// Error zeroing the bank.
+				errno = -ret;
+				return ret;
+			}
+
+			// Not supported. Write zeroes instead.
+			use_zeroRange = false;
+			zbuf.reset(WIPE_BUF_SIZE, std::max(m_file->directIOAlignment(), 4096U));
+			if (!zbuf) {
+				errno = ENOMEM;
+				return -ENOMEM;
+			}
+			memset(zbuf.get(), 0, WIPE_BUF_SIZE);
+		}
+
+		const uint32_t lba_len = std::min(LBA_COUNT_WIPE_BUF, lba_wipe_len - lba_count);
+		const size_t size = static_cast<size_t>(LBA_TO_BYTES(lba_len));
+		size_t sz_written = m_file->pwrite(zbuf.get(), size,
+			LBA_TO_BYTES(static_cast<off64_t>(rvth_entry->lba_start) + lba_count));
+		if (sz_written != size) {
+			// Write error.
+			int err = errno;
+			if (err == 0) {
+				err = EIO;
+			}
+			errno = err;
+			return -err;
+		}
+		lba_count += lba_len;
+	}
+	m_file->sync();
+	if (rvth_entry->reader) {
+		// The bank was wiped without using its reader.
+		rvth_entry->reader->invalidateCache();
+	}
+
+	if (callback) {
+		state.lba_processed = lba_wipe_len;
+		rate.update(&state);
+		if (!callback(&state, userdata)) {
+			// Stop processing.
+			errno = ECANCELED;
+			return -ECANCELED;
+		}
+	}
+
+	// The bank is now empty.
+	rvth_entry->type = RVTH_BankType_Empty;
+	rvth_entry->is_deleted = false;
+	rvth_entry->timestamp = -1;
+	rvth_entry->region_code = 0xFF;
+	rvth_entry->crypto_type = RVL_CryptoType_Unknown;
+	rvth_entry->ios_version = 0;
+	memset(&rvth_entry->discHeader, 0, sizeof(rvth_entry->discHeader));
+	memset(&rvth_entry->ticket, 0, sizeof(rvth_entry->ticket));
+	memset(&rvth_entry->tmd, 0, sizeof(rvth_entry->tmd));
+	rvth_ptbl_free(rvth_entry);
+
+	if (rvth_entry2 && rvth_entry2->type == RVTH_BankType_Wii_DL_Bank2) {
+		// Second bank of the deleted dual-layer image.
+		// NOTE: The second bank table entry is already empty,
+		// so it only has to be updated in memory.
+		rvth_entry2->type = RVTH_BankType_Empty;
+		rvth_entry2->timestamp = -1;
+		rvth_entry2->region_code = 0xFF;
+	}
+
+	ret = this->writeBankEntry(bank);
+	return ret;
+}
+
+/**
+ * Begin a bank table transaction.
+ *
+ * While a transaction is active, bank table changes made by
+ * deleteBank(), undeleteBank(), wipeBank(), copyToHDD(), and
+ * recryptWiiPartitions() are staged in memory instead of being
+ * written to the disk immediately. commitBankTableTransaction()
+ * writes all staged entries with a single write and flush.
+ *
+ * NOTE: Only the bank table is deferred. Disc image data,
+ * e.g. from importing or wiping, is written immediately.
+ *
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int RvtH::beginBankTableTransaction(void)
+{
+	if (!isHDD()) {
+		// Standalone disc image. No bank table.
+		errno = EINVAL;
+		return RVTH_ERROR_NOT_HDD_IMAGE;
+	} else if (m_txnActive) {
+		// Transactions can't be nested.
+		errno = EBUSY;
+		return -EBUSY;
+	}
+
+	// Make the RVT-H object writable.
+	// This is done here so the commit doesn't fail halfway through
+	// a batch of changes because the device is read-only.
+	int ret = this->makeWritable();
+	if (ret != 0) {
+		// Could not make the RVT-H object writable.
+		return ret;
+	}
+
+	m_txnEntries.assign(m_bankCount, NHCD_BankEntry());
+	m_txnDirty.assign(m_bankCount, false);
+	m_txnActive = true;
+	return 0;
+}
+
+/**
+ * End the active bank table transaction.
+ * @param reload	[in] If true, reload the staged bank entries from disk.
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int RvtH::endBankTableTransaction_int(bool reload)
+{
+	int ret = 0;
+	m_txnActive = false;
+
+	if (reload) {
+		std::lock_guard<std::mutex> lock(m_bankInitMutex);
+		for (unsigned int bank = 0; bank < m_bankCount; bank++) {
+			// If a dual-layer Wii image was changed, its second bank
+			// was also changed in memory, so reload it, too.
+			if (!m_txnDirty[bank] && (bank == 0 || !m_txnDirty[bank-1])) {
+				continue;
+			}
+
+			const int ret_bank = reloadBankEntry_int(bank);
+			if (ret == 0) {
+				ret = ret_bank;
+			}
+		}
+	}
+
+	// Save the caches.
+	// writeBankEntry() invalidated the staged banks.
+	if (m_bankCache) {
+		m_bankCache->save();
+	}
+	if (m_verifyCache) {
+		std::lock_guard<std::mutex> lock(m_verifyCacheMutex);
+		m_verifyCache->save();
+		if (m_verifyMap) {
+			m_verifyMap->save();
+		}
+	}
+
+	m_txnEntries.clear();
+	m_txnDirty.clear();
+	return ret;
+}
+
+/**
+ * Reload a bank table entry from disk and clear the bank entry.
+ * The bank entry will be reinitialized when it's accessed.
+ * NOTE: m_bankInitMutex must be held by the caller.
+ * @param bank	[in] Bank number.
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int RvtH::reloadBankEntry_int(unsigned int bank)
+{
+	int ret = 0;
+	PendingBank &pb = m_pendingBanks[bank];
+	if (pb.has_nhcd) {
+		NHCD_BankEntry nhcd_entry;
+		errno = 0;
+		size_t size = m_file->pread(&nhcd_entry, sizeof(nhcd_entry),
+			LBA_TO_BYTES(NHCD_BANKTABLE_ADDRESS_LBA + bank+1));
+		if (size == sizeof(nhcd_entry)) {
+			pb.nhcd_entry = nhcd_entry;
+		} else {
+			// Read error. Keep the bank table entry
+			// that was loaded when the device was opened.
+			ret = (errno != 0 ? -errno : -EIO);
+		}
+	}
+
+	// Clear the bank entry.
+	// It will be reinitialized when it's accessed.
+	clearBankEntry_int(bank);
+	return ret;
+}
+
+/**
+ * Clear a bank entry using the bank table entry in m_pendingBanks.
+ * The bank entry will be reinitialized when it's accessed.
+ * NOTE: m_bankInitMutex must be held by the caller.
+ * @param bank	[in] Bank number.
+ */
+void RvtH::clearBankEntry_int(unsigned int bank)
+{
+	RvtH_BankEntry *const rvth_entry = &m_entries[bank];
+	delete rvth_entry->reader;
+	rvth_ptbl_free(rvth_entry);
+	memset(rvth_entry, 0, sizeof(*rvth_entry));
+	resetPendingBank_int(bank);
+}
+
+/**
+ * Commit the active bank table transaction.
+ * If the bank table can't be written and synced, the transaction is
+ * rolled back, and the bank entries are reloaded from disk.
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int RvtH::commitBankTableTransaction(void)
+{
+	if (!m_txnActive) {
+		// No transaction is active.
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	// Find the range of staged bank entries.
+	unsigned int bank_first = m_bankCount, bank_last = 0;
+	for (unsigned int bank = 0; bank < m_bankCount; bank++) {
+		if (m_txnDirty[bank]) {
+			bank_first = std::min(bank_first, bank);
+			bank_last = bank;
+		}
+	}
+	if (bank_first >= m_bankCount) {
+		// Nothing to write.
+		return endBankTableTransaction_int(false);
+	}
+
+	// Read the current bank table entries in the range, then
+	// overlay the staged entries so the whole range can be
+	// written at once.
+	const unsigned int bank_count = bank_last - bank_first + 1;
+	const off64_t addr = LBA_TO_BYTES(NHCD_BANKTABLE_ADDRESS_LBA + bank_first+1);
+	const size_t size = bank_count * sizeof(NHCD_BankEntry);
+	std::vector<NHCD_BankEntry> table(bank_count);
+	errno = 0;
+	size_t sz = m_file->pread(table.data(), size, addr);
+	if (sz == size) {
+		for (unsigned int i = 0; i < bank_count; i++) {
+			if (m_txnDirty[bank_first + i]) {
+				table[i] = m_txnEntries[bank_first + i];
+			}
+		}
+
+		errno = 0;
+		sz = m_file->pwrite(table.data(), size, addr);
+		if (sz == size && m_file->sync() != 0) {
+			// Sync error. The bank table might not have
+			// reached the media, so don't report success.
+			sz = 0;
+		}
+		if (sz == size) {
+			// Keep the loaded bank table in sync for pollBankTable().
+			std::lock_guard<std::mutex> lock(m_bankInitMutex);
+			for (unsigned int i = 0; i < bank_count; i++) {
+				m_pendingBanks[bank_first + i].nhcd_entry = table[i];
+			}
+		}
+	}
+	if (sz != size) {
+		// Read, write, or sync error.
+		// Reload the bank entries from disk so the in-memory
+		// state matches the bank table.
+		int err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		endBankTableTransaction_int(true);
+		errno = err;
+		return -err;
+	}
+
+	// Bank table written successfully.
+	return endBankTableTransaction_int(false);
+}
+
+/**
+ * Roll back the active bank table transaction.
+ * Staged bank table entries are discarded, and the affected
+ * bank entries are reloaded from disk.
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int RvtH::rollbackBankTableTransaction(void)
+{
+	if (!m_txnActive) {
+		// No transaction is active.
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	return endBankTableTransaction_int(true);
+}
+
+/**
+ * Check if the bank table was changed by another program or host.
+ *
+ * The bank table is read from the disk with a single read, bypassing
+ * the OS cache, and compared with the bank table entries that were
+ * loaded when the device was opened. Banks whose entries changed,
+ * e.g. a new timestamp after an import, are cleared and will be
+ * reinitialized when they're accessed. Other banks are kept as-is.
+ *
+ * NOTE: Banks that are cleared must not be in use by another thread.
+ *
+ * @param changed	[out,opt] Banks that were cleared, in order. (If a dual-layer bank changed, the next bank is also cleared.)
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ *         -ESTALE if the bank table header changed; the device must be reopened.
+ */
+int RvtH::pollBankTable(std::vector<unsigned int> *changed)
+{
+	if (changed) {
+		changed->clear();
+	}
+	if (!isHDD()) {
+		// Standalone disc image. No bank table.
+		errno = EINVAL;
+		return RVTH_ERROR_NOT_HDD_IMAGE;
+	} else if (m_txnActive) {
+		// The staged entries haven't been written yet.
+		errno = EBUSY;
+		return -EBUSY;
+	} else if (m_NHCD_status != NHCD_STATUS_OK) {
+		// No bank table. Nothing can change it.
+		return 0;
+	}
+
+	// Read the header and the bank table entries.
+	// The bank table might have been written by another host,
+	// so make sure it's read from the disk.
+	const off64_t addr = LBA_TO_BYTES(NHCD_BANKTABLE_ADDRESS_LBA);
+	const size_t size = (m_bankCount + 1) * NHCD_BLOCK_SIZE;
+	std::vector<NHCD_BankEntry> table(m_bankCount + 1);
+	m_file->dropCache(addr, size);
+	errno = 0;
+	if (m_file->pread(table.data(), size, addr) != size) {
+		// Read error.
+		int err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		errno = err;
+		return -err;
+	}
+
+	// Check the header.
+	const NHCD_BankTable_Header *const header =
+		reinterpret_cast<const NHCD_BankTable_Header*>(table.data());
+	if (header->magic != be32_to_cpu(NHCD_BANKTABLE_MAGIC) ||
+	    be32_to_cpu(header->bank_count) != m_bankCount)
+	{
+		// The bank table was reformatted.
+		errno = ESTALE;
+		return -ESTALE;
+	}
+
+	std::lock_guard<std::mutex> lock(m_bankInitMutex);
+	std::vector<bool> dirty(m_bankCount, false);
+	for (unsigned int bank = 0; bank < m_bankCount; bank++) {
+		PendingBank &pb = m_pendingBanks[bank];
+		if (memcmp(&pb.nhcd_entry, &table[bank+1], sizeof(pb.nhcd_entry)) != 0) {
+			pb.nhcd_entry = table[bank+1];
+			dirty[bank] = true;
+		}
+	}
+
+	for (unsigned int bank = 0; bank < m_bankCount; bank++) {
+		// If a dual-layer Wii image was changed, the next bank
+		// might have been its second bank, so clear it, too.
+		if (!dirty[bank] && (bank == 0 || !dirty[bank-1])) {
+			continue;
+		}
+
+		// Clear the bank entry.
+		// It will be reinitialized when it's accessed.
+		clearBankEntry_int(bank);
+		if (changed) {
+			changed->push_back(bank);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,180 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * zero_scan.c: Find the first non-zero byte in a buffer.                  *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "zero_scan.h"
+#include "zero_scan_hw.h"
+#include "impl_select.h"
+
+#include <errno.h>
+
+// Current zero scan implementation. (-1 == not detected yet)
+IMPL_SELECT(zero_scan_impl);
+
+/**
+ * Find the first non-zero byte in a buffer. (portable version)
+ * @param buf	[in] Buffer.
+ * @param size	[in] Size of buf, in bytes.
+ * @return Offset of the first non-zero byte, or size if the buffer is all zeroes.
+ */
+static size_t rvth_zero_scan_generic(const uint8_t *buf, size_t size)
+{
+	size_t i = 0;
+
+	// Check bytes until the buffer is aligned to uintptr_t.
+	for (; i < size && ((uintptr_t)&buf[i] % sizeof(uintptr_t)) != 0; i++) {
+		if (buf[i] != 0)
+			return i;
+	}
+
+	// Check 8 words at a time.
+	for (; size - i >= 8*sizeof(uintptr_t); i += 8*sizeof(uintptr_t)) {
+		const uintptr_t *const p = (const uintptr_t*)&buf[i];
+		uintptr_t x = p[0];
+		x |= p[1];
+		x |= p[2];
+		x |= p[3];
+		x |= p[4];
+		x |= p[5];
+		x |= p[6];
+		x |= p[7];
+		if (x != 0)
+			break;
+	}
+
+	// Find the exact offset in the remaining bytes.
+	return rvth_zero_scan_bytes(buf, i, size);
+}
+
+/**
+ * Check if a zero scan implementation is supported by the CPU.
+ * @param impl Implementation. (See RvtH_ZeroScan_Impl_e.)
+ * @return True if supported; false if not.
+ */
+static int zero_scan_is_impl_supported(int impl)
+{
+	switch (impl) {
+		case RVTH_ZERO_SCAN_IMPL_GENERIC:
+			return 1;
+#ifdef HAVE_ZERO_SCAN_SSE2
+		case RVTH_ZERO_SCAN_IMPL_SSE2:
+			return rvth_zero_scan_sse2_is_supported();
+#endif /* HAVE_ZERO_SCAN_SSE2 */
+#ifdef HAVE_ZERO_SCAN_AVX2
+		case RVTH_ZERO_SCAN_IMPL_AVX2:
+			return rvth_zero_scan_avx2_is_supported();
+#endif /* HAVE_ZERO_SCAN_AVX2 */
+#ifdef HAVE_ZERO_SCAN_NEON
+		case RVTH_ZERO_SCAN_IMPL_NEON:
+			return 1;
+#endif /* HAVE_ZERO_SCAN_NEON */
+		default:
+			break;
+	}
+	return 0;
+}
+
+/**
+ * Determine the best zero scan implementation for this CPU.
+ * @return Implementation. (See RvtH_ZeroScan_Impl_e.)
+ */
+static int zero_scan_detect_impl(void)
+{
+	// Preference order: AVX2, SSE2, NEON, generic.
+	if (zero_scan_is_impl_supported(RVTH_ZERO_SCAN_IMPL_AVX2)) {
+		return RVTH_ZERO_SCAN_IMPL_AVX2;
+	} else if (zero_scan_is_impl_supported(RVTH_ZERO_SCAN_IMPL_SSE2)) {
+		return RVTH_ZERO_SCAN_IMPL_SSE2;
+	} else if (zero_scan_is_impl_supported(RVTH_ZERO_SCAN_IMPL_NEON)) {
+		return RVTH_ZERO_SCAN_IMPL_NEON;
+	}
+	return RVTH_ZERO_SCAN_IMPL_GENERIC;
+}
+
+/**
+ * Get the current zero scan implementation.
+ * @return Implementation. (See RvtH_ZeroScan_Impl_e.)
+ */
+static inline int zero_scan_get_impl(void)
+{
+	return impl_select_get(&zero_scan_impl, zero_scan_detect_impl);
+}
+
+/**
+ * Get the name of the active zero scan implementation.
+ * @return Implementation name.
+ */
+const char *rvth_zero_scan_get_impl_name(void)
+{
+	switch (zero_scan_get_impl()) {
+		default:
+		case RVTH_ZERO_SCAN_IMPL_GENERIC:
+			return "generic";
+		case RVTH_ZERO_SCAN_IMPL_SSE2:
+			return "SSE2";
+		case RVTH_ZERO_SCAN_IMPL_AVX2:
+			return "AVX2";
+		case RVTH_ZERO_SCAN_IMPL_NEON:
+			return "NEON";
+	}
+}
+
+/**
+ * Select a zero scan implementation.
+ * This is intended for testing and benchmarking.
+ * NOTE: Not thread-safe. Don't call this while scanning.
+ * @param impl Implementation. (See RvtH_ZeroScan_Impl_e.)
+ * @return 0 on success; negative POSIX error code on error. (-ENOTSUP if not supported by the CPU)
+ */
+int rvth_zero_scan_set_impl(int impl)
+{
+	if (impl == RVTH_ZERO_SCAN_IMPL_AUTO) {
+		impl_select_store(&zero_scan_impl, -1);
+		return 0;
+	} else if (impl < 0 || impl >= RVTH_ZERO_SCAN_IMPL_MAX) {
+		return -EINVAL;
+	}
+
+	if (!zero_scan_is_impl_supported(impl)) {
+		return -ENOTSUP;
+	}
+	impl_select_store(&zero_scan_impl, impl);
+	return 0;
+}
+
+/**
+ * Find the first non-zero byte in a buffer.
+ *
+ * The fastest implementation supported by the CPU is selected
+ * on the first call. (SSE2 or AVX2 on x86; NEON on arm64)
+ *
+ * @param buf	[in] Buffer.
+ * @param size	[in] Size of buf, in bytes.
+ * @return Offset of the first non-zero byte, or size if the buffer is all zeroes.
+ */
+size_t rvth_zero_scan(const uint8_t *buf, size_t size)
+{
+	switch (zero_scan_get_impl()) {
+		default:
+		case RVTH_ZERO_SCAN_IMPL_GENERIC:
+			break;
+#ifdef HAVE_ZERO_SCAN_SSE2
+		case RVTH_ZERO_SCAN_IMPL_SSE2:
+			return rvth_zero_scan_sse2(buf, size);
+#endif /* HAVE_ZERO_SCAN_SSE2 */
+#ifdef HAVE_ZERO_SCAN_AVX2
+		case RVTH_ZERO_SCAN_IMPL_AVX2:
+			return rvth_zero_scan_avx2(buf, size);
+#endif /* HAVE_ZERO_SCAN_AVX2 */
+#ifdef HAVE_ZERO_SCAN_NEON
+		case RVTH_ZERO_SCAN_IMPL_NEON:
+			return rvth_zero_scan_neon(buf, size);
+#endif /* HAVE_ZERO_SCAN_NEON */
+	}
+
+	return rvth_zero_scan_generic(buf, size);
+}
@@ -0,0 +1,72 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * zero_scan.h: Find the first non-zero byte in a buffer.                  *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_ZERO_SCAN_H__
+#define __RVTHTOOL_LIBRVTH_ZERO_SCAN_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Zero scan implementations.
+typedef enum {
+	RVTH_ZERO_SCAN_IMPL_AUTO	= -1,	// Automatically select the best implementation.
+	RVTH_ZERO_SCAN_IMPL_GENERIC	= 0,	// Word-at-a-time (portable)
+	RVTH_ZERO_SCAN_IMPL_SSE2	= 1,	// x86 SSE2
+	RVTH_ZERO_SCAN_IMPL_AVX2	= 2,	// x86 AVX2
+	RVTH_ZERO_SCAN_IMPL_NEON	= 3,	// ARM NEON
+
+	RVTH_ZERO_SCAN_IMPL_MAX
+} RvtH_ZeroScan_Impl_e;
+
+/**
+ * Find the first non-zero byte in a buffer.
+ *
+ * The fastest implementation supported by the CPU is selected
+ * on the first call. (SSE2 or AVX2 on x86; NEON on arm64)
+ *
+ * @param buf	[in] Buffer.
+ * @param size	[in] Size of buf, in bytes.
+ * @return Offset of the first non-zero byte, or size if the buffer is all zeroes.
+ */
+size_t rvth_zero_scan(const uint8_t *buf, size_t size);
+
+/**
+ * Check if a buffer is all zeroes.
+ * @param buf	[in] Buffer.
+ * @param size	[in] Size of buf, in bytes.
+ * @return Non-zero if the buffer is all zeroes; 0 if not.
+ */
+static inline int rvth_is_zero(const uint8_t *buf, size_t size)
+{
+	return (rvth_zero_scan(buf, size) == size);
+}
+
+/**
+ * Get the name of the active zero scan implementation.
+ * @return Implementation name.
+ */
+const char *rvth_zero_scan_get_impl_name(void);
+
+/**
+ * Select a zero scan implementation.
+ * This is intended for testing and benchmarking.
+ * NOTE: Not thread-safe. Don't call this while scanning.
+ * @param impl Implementation. (See RvtH_ZeroScan_Impl_e.)
+ * @return 0 on success; negative POSIX error code on error. (-ENOTSUP if not supported by the CPU)
+ */
+int rvth_zero_scan_set_impl(int impl);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_LIBRVTH_ZERO_SCAN_H__ */
@@ -0,0 +1,95 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * zero_scan_avx2.c: Zero scan functions. (AVX2 version)                   *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "zero_scan_hw.h"
+
+// AVX2 intrinsics
+#include <immintrin.h>
+
+// CPUID
+#ifdef _MSC_VER
+#  include <intrin.h>
+#else /* !_MSC_VER */
+#  include <cpuid.h>
+#endif /* _MSC_VER */
+
+// CPUID.01H:ECX.OSXSAVE[bit 27], CPUID.01H:ECX.AVX[bit 28]
+#define CPUID_ECX_OSXSAVE (1U << 27)
+#define CPUID_ECX_AVX (1U << 28)
+// CPUID.07H.0H:EBX.AVX2[bit 5]
+#define CPUID_7_EBX_AVX2 (1U << 5)
+
+/**
+ * Check if AVX2 is supported by the CPU and OS.
+ * @return Non-zero if supported; 0 if not.
+ */
+int rvth_zero_scan_avx2_is_supported(void)
+{
+	unsigned int ebx7, ecx1;
+	unsigned long long xcr0;
+#ifdef _MSC_VER
+	int regs[4];
+	__cpuid(regs, 0);
+	if (regs[0] < 7) {
+		return 0;
+	}
+	__cpuid(regs, 1);
+	ecx1 = (unsigned int)regs[2];
+	__cpuidex(regs, 7, 0);
+	ebx7 = (unsigned int)regs[1];
+#else /* !_MSC_VER */
+	unsigned int eax, ebx, ecx, edx;
+	if (__get_cpuid_max(0, NULL) < 7) {
+		return 0;
+	}
+	__cpuid(1, eax, ebx, ecx, edx);
+	ecx1 = ecx;
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	ebx7 = ebx;
+#endif /* _MSC_VER */
+
+	if (!(ecx1 & CPUID_ECX_OSXSAVE) || !(ecx1 & CPUID_ECX_AVX) || !(ebx7 & CPUID_7_EBX_AVX2)) {
+		return 0;
+	}
+
+	// Make sure the OS saves the YMM registers.
+#ifdef _MSC_VER
+	xcr0 = _xgetbv(0);
+#else /* !_MSC_VER */
+	{
+		unsigned int xcr0_lo, xcr0_hi;
+		__asm__ ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+		xcr0 = ((unsigned long long)xcr0_hi << 32) | xcr0_lo;
+	}
+#endif /* _MSC_VER */
+	return ((xcr0 & 6) == 6);
+}
+
+/**
+ * Find the first non-zero byte in a buffer using AVX2.
+ * @param buf	[in] Buffer.
+ * @param size	[in] Size of buf, in bytes.
+ * @return Offset of the first non-zero byte, or size if the buffer is all zeroes.
+ */
+size_t rvth_zero_scan_avx2(const uint8_t *buf, size_t size)
+{
+	size_t i = 0;
+
+	// Check 128 bytes at a time.
+	for (; size - i >= 128; i += 128) {
+		const __m256i *const p = (const __m256i*)&buf[i];
+		const __m256i x = _mm256_or_si256(
+			_mm256_or_si256(_mm256_loadu_si256(&p[0]), _mm256_loadu_si256(&p[1])),
+			_mm256_or_si256(_mm256_loadu_si256(&p[2]), _mm256_loadu_si256(&p[3])));
+		if (!_mm256_testz_si256(x, x))
+			break;
+	}
+
+	// Find the exact offset in the remaining bytes.
+	return rvth_zero_scan_bytes(buf, i, size);
+}
@@ -0,0 +1,87 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * zero_scan_hw.h: Zero scan functions. (SIMD backends)                    *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// NOTE: Internal header. Only used by the zero_scan implementation.
+
+#ifndef __RVTHTOOL_LIBRVTH_ZERO_SCAN_HW_H__
+#define __RVTHTOOL_LIBRVTH_ZERO_SCAN_HW_H__
+
+#include "config.librvth.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Find the first non-zero byte in a buffer, starting at a given offset.
+ * Used to finish a scan after the vectorized loop.
+ * @param buf	[in] Buffer.
+ * @param i	[in] Starting offset.
+ * @param size	[in] Size of buf, in bytes.
+ * @return Offset of the first non-zero byte, or size if the rest of the buffer is all zeroes.
+ */
+static inline size_t rvth_zero_scan_bytes(const uint8_t *buf, size_t i, size_t size)
+{
+	for (; i < size; i++) {
+		if (buf[i] != 0)
+			break;
+	}
+	return i;
+}
+
+#ifdef HAVE_ZERO_SCAN_SSE2
+/**
+ * Check if SSE2 is supported by the CPU.
+ * @return Non-zero if supported; 0 if not.
+ */
+int rvth_zero_scan_sse2_is_supported(void);
+
+/**
+ * Find the first non-zero byte in a buffer using SSE2.
+ * @param buf	[in] Buffer.
+ * @param size	[in] Size of buf, in bytes.
+ * @return Offset of the first non-zero byte, or size if the buffer is all zeroes.
+ */
+size_t rvth_zero_scan_sse2(const uint8_t *buf, size_t size);
+#endif /* HAVE_ZERO_SCAN_SSE2 */
+
+#ifdef HAVE_ZERO_SCAN_AVX2
+/**
+ * Check if AVX2 is supported by the CPU and OS.
+ * @return Non-zero if supported; 0 if not.
+ */
+int rvth_zero_scan_avx2_is_supported(void);
+
+/**
+ * Find the first non-zero byte in a buffer using AVX2.
+ * @param buf	[in] Buffer.
+ * @param size	[in] Size of buf, in bytes.
+ * @return Offset of the first non-zero byte, or size if the buffer is all zeroes.
+ */
+size_t rvth_zero_scan_avx2(const uint8_t *buf, size_t size);
+#endif /* HAVE_ZERO_SCAN_AVX2 */
+
+#ifdef HAVE_ZERO_SCAN_NEON
+/**
+ * Find the first non-zero byte in a buffer using NEON.
+ * NEON is always available on arm64.
+ * @param buf	[in] Buffer.
+ * @param size	[in] Size of buf, in bytes.
+ * @return Offset of the first non-zero byte, or size if the buffer is all zeroes.
+ */
+size_t rvth_zero_scan_neon(const uint8_t *buf, size_t size);
+#endif /* HAVE_ZERO_SCAN_NEON */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_LIBRVTH_ZERO_SCAN_HW_H__ */
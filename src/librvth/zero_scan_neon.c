@@ -0,0 +1,36 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * zero_scan_neon.c: Zero scan functions. (NEON version)                   *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "zero_scan_hw.h"
+
+// NEON intrinsics
+#include <arm_neon.h>
+
+/**
+ * Find the first non-zero byte in a buffer using NEON.
+ * NEON is always available on arm64.
+ * @param buf	[in] Buffer.
+ * @param size	[in] Size of buf, in bytes.
+ * @return Offset of the first non-zero byte, or size if the buffer is all zeroes.
+ */
+size_t rvth_zero_scan_neon(const uint8_t *buf, size_t size)
+{
+	size_t i = 0;
+
+	// Check 64 bytes at a time.
+	for (; size - i >= 64; i += 64) {
+		const uint8x16_t x = vorrq_u8(
+			vorrq_u8(vld1q_u8(&buf[i]), vld1q_u8(&buf[i+16])),
+			vorrq_u8(vld1q_u8(&buf[i+32]), vld1q_u8(&buf[i+48])));
+		if (vmaxvq_u8(x) != 0)
+			break;
+	}
+
+	// Find the exact offset in the remaining bytes.
+	return rvth_zero_scan_bytes(buf, i, size);
+}
@@ -0,0 +1,75 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * zero_scan_sse2.c: Zero scan functions. (SSE2 version)                   *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "zero_scan_hw.h"
+
+// SSE2 intrinsics
+#include <emmintrin.h>
+
+#if !defined(__x86_64__) && !defined(_M_X64)
+// CPUID
+#  ifdef _MSC_VER
+#    include <intrin.h>
+#  else /* !_MSC_VER */
+#    include <cpuid.h>
+#  endif /* _MSC_VER */
+
+// CPUID.01H:EDX.SSE2[bit 26]
+#  define CPUID_EDX_SSE2 (1U << 26)
+#endif /* !__x86_64__ && !_M_X64 */
+
+/**
+ * Check if SSE2 is supported by the CPU.
+ * @return Non-zero if supported; 0 if not.
+ */
+int rvth_zero_scan_sse2_is_supported(void)
+{
+#if defined(__x86_64__) || defined(_M_X64)
+	// SSE2 is always supported on amd64.
+	return 1;
+#else /* !__x86_64__ && !_M_X64 */
+	unsigned int edx1;
+#  ifdef _MSC_VER
+	int regs[4];
+	__cpuid(regs, 1);
+	edx1 = (unsigned int)regs[3];
+#  else /* !_MSC_VER */
+	unsigned int eax, ebx, ecx, edx;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+		return 0;
+	}
+	edx1 = edx;
+#  endif /* _MSC_VER */
+	return !!(edx1 & CPUID_EDX_SSE2);
+#endif /* __x86_64__ || _M_X64 */
+}
+
+/**
+ * Find the first non-zero byte in a buffer using SSE2.
+ * @param buf	[in] Buffer.
+ * @param size	[in] Size of buf, in bytes.
+ * @return Offset of the first non-zero byte, or size if the buffer is all zeroes.
+ */
+size_t rvth_zero_scan_sse2(const uint8_t *buf, size_t size)
+{
+	const __m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+
+	// Check 64 bytes at a time.
+	for (; size - i >= 64; i += 64) {
+		const __m128i *const p = (const __m128i*)&buf[i];
+		const __m128i x = _mm_or_si128(
+			_mm_or_si128(_mm_loadu_si128(&p[0]), _mm_loadu_si128(&p[1])),
+			_mm_or_si128(_mm_loadu_si128(&p[2]), _mm_loadu_si128(&p[3])));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, zero)) != 0xFFFF)
+			break;
+	}
+
+	// Find the exact offset in the remaining bytes.
+	return rvth_zero_scan_bytes(buf, i, size);
+}
@@ -2,7 +2,7 @@
  * RVT-H Tool (libwiicrypto)                                               *
  * aesw.h: AES wrapper functions.                                          *
  *                                                                         *
- * Copyright (c) 2018 by David Korth.                                      *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
@@ -21,6 +21,14 @@ extern "C" {
 struct _AesCtx;
 typedef struct _AesCtx AesCtx;
 
+/**
+ * Get the name of the active AES implementation.
+ * This may be a hardware-accelerated implementation
+ * if supported by the CPU.
+ * @return AES implementation name.
+ */
+const char *aesw_get_impl_name(void);
+
 /**
  * Create an AES context.
  * @return AES context, or NULL on error.
@@ -69,6 +77,61 @@ size_t aesw_encrypt(AesCtx *aesw, uint8_t *pData, size_t size);
  */
 size_t aesw_decrypt(AesCtx *aesw, uint8_t *pData, size_t size);
 
+/**
+ * Encrypt multiple independent blocks of data, each with its own IV.
+ * The streams are processed in lockstep if hardware acceleration
+ * is available, which is faster than encrypting them one at a time.
+ *
+ * NOTE: The context's IV is neither used nor updated.
+ *
+ * @param aesw		[in] AES context.
+ * @param ppIV		[in] IVs. (16 bytes each)
+ * @param ppData	[in/out] Data blocks. (Must not overlap.)
+ * @param size		[in] Length of each data block. (Must be a multiple of 16.)
+ * @param count		[in] Number of data blocks.
+ * @return Total number of bytes encrypted on success; 0 on error.
+ */
+size_t aesw_encrypt_multi(AesCtx *aesw, const uint8_t *const *ppIV,
+	uint8_t *const *ppData, size_t size, unsigned int count);
+
+/**
+ * Decrypt multiple independent blocks of data, each with its own IV.
+ * The streams are processed in lockstep if hardware acceleration
+ * is available, which is faster than decrypting them one at a time.
+ *
+ * NOTE: The context's IV is neither used nor updated.
+ *
+ * @param aesw		[in] AES context.
+ * @param ppIV		[in] IVs. (16 bytes each)
+ * @param ppData	[in/out] Data blocks. (Must not overlap.)
+ * @param size		[in] Length of each data block. (Must be a multiple of 16.)
+ * @param count		[in] Number of data blocks.
+ * @return Total number of bytes decrypted on success; 0 on error.
+ */
+size_t aesw_decrypt_multi(AesCtx *aesw, const uint8_t *const *ppIV,
+	uint8_t *const *ppData, size_t size, unsigned int count);
+
+// Defined in nettle/sha1.h, but let's not include it here.
+struct sha1_ctx;
+
+/**
+ * Decrypt a block of data using the current parameters
+ * and update a SHA-1 hash with the decrypted data.
+ *
+ * The data is decrypted and hashed in small chunks, so each chunk
+ * is hashed while it's still in cache instead of decrypting the
+ * whole block first and then reading it again to hash it.
+ *
+ * @param aesw		[in] AES context.
+ * @param sha1		[in/out] SHA-1 context. (nettle)
+ * @param pData		[in/out] Data block.
+ * @param size		[in] Length of data block. (Must be a multiple of 16.)
+ * @param hash_size	[in] Number of decrypted bytes to hash. (Must be <= size.)
+ * @return Number of bytes decrypted on success; 0 on error.
+ */
+size_t aesw_decrypt_sha1(AesCtx *aesw, struct sha1_ctx *sha1,
+	uint8_t *pData, size_t size, size_t hash_size);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,274 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * aesw_aesni.c: AES wrapper functions. (AES-NI version)                   *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "aesw_hw.h"
+
+// AES-NI intrinsics
+#include <emmintrin.h>
+#include <wmmintrin.h>
+
+// CPUID
+#ifdef _MSC_VER
+#  include <intrin.h>
+#else /* !_MSC_VER */
+#  include <cpuid.h>
+#endif /* _MSC_VER */
+
+// CPUID.01H:ECX.AES[bit 25]
+#define CPUID_ECX_AES (1U << 25)
+
+/**
+ * Check if AES-NI is supported by the CPU.
+ * @return Non-zero if supported; 0 if not.
+ */
+int aesw_aesni_is_supported(void)
+{
+#ifdef _MSC_VER
+	int regs[4];
+	__cpuid(regs, 1);
+	return !!((unsigned int)regs[2] & CPUID_ECX_AES);
+#else /* !_MSC_VER */
+	unsigned int eax, ebx, ecx, edx;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+		// CPUID leaf 1 is not available.
+		return 0;
+	}
+	return !!(ecx & CPUID_ECX_AES);
+#endif /* _MSC_VER */
+}
+
+/**
+ * AES-128 key expansion step.
+ * @param key Previous round key.
+ * @param keygened Output of _mm_aeskeygenassist_si128().
+ * @return Next round key.
+ */
+static inline __m128i aes128_keyexpand(__m128i key, __m128i keygened)
+{
+	keygened = _mm_shuffle_epi32(keygened, _MM_SHUFFLE(3,3,3,3));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	return _mm_xor_si128(key, keygened);
+}
+
+// NOTE: _mm_aeskeygenassist_si128() requires an immediate value.
+#define AES128_KEYEXPAND(k, rcon) aes128_keyexpand((k), _mm_aeskeygenassist_si128((k), (rcon)))
+
+/**
+ * Expand an AES-128 key for encryption and decryption.
+ * @param rk_enc	[out] Encryption round keys. (AESW_HW_ROUND_KEYS_SIZE bytes)
+ * @param rk_dec	[out] Decryption round keys. (AESW_HW_ROUND_KEYS_SIZE bytes)
+ * @param pKey		[in] Key data. (16 bytes)
+ */
+void aesw_aesni_set_key(uint8_t *rk_enc, uint8_t *rk_dec, const uint8_t *pKey)
+{
+	__m128i ek[11];
+	unsigned int i;
+
+	ek[0] = _mm_loadu_si128((const __m128i*)pKey);
+	ek[1] = AES128_KEYEXPAND(ek[0], 0x01);
+	ek[2] = AES128_KEYEXPAND(ek[1], 0x02);
+	ek[3] = AES128_KEYEXPAND(ek[2], 0x04);
+	ek[4] = AES128_KEYEXPAND(ek[3], 0x08);
+	ek[5] = AES128_KEYEXPAND(ek[4], 0x10);
+	ek[6] = AES128_KEYEXPAND(ek[5], 0x20);
+	ek[7] = AES128_KEYEXPAND(ek[6], 0x40);
+	ek[8] = AES128_KEYEXPAND(ek[7], 0x80);
+	ek[9] = AES128_KEYEXPAND(ek[8], 0x1B);
+	ek[10] = AES128_KEYEXPAND(ek[9], 0x36);
+
+	// Decryption round keys are the encryption round keys in
+	// reverse order, with InvMixColumns applied to rounds 1-9.
+	_mm_storeu_si128((__m128i*)&rk_dec[0], ek[10]);
+	for (i = 1; i < 10; i++) {
+		_mm_storeu_si128((__m128i*)&rk_dec[i*16], _mm_aesimc_si128(ek[10-i]));
+	}
+	_mm_storeu_si128((__m128i*)&rk_dec[10*16], ek[0]);
+
+	for (i = 0; i < 11; i++) {
+		_mm_storeu_si128((__m128i*)&rk_enc[i*16], ek[i]);
+	}
+}
+
+/**
+ * Encrypt a block of data using AES-128-CBC.
+ * @param rk_enc	[in] Encryption round keys.
+ * @param iv		[in/out] IV. (Updated for chaining.)
+ * @param pData		[in/out] Data block.
+ * @param size		[in] Length of data block. (Must be a multiple of 16.)
+ */
+void aesw_aesni_cbc_encrypt(const uint8_t *rk_enc, uint8_t *iv, uint8_t *pData, size_t size)
+{
+	__m128i k[11];
+	__m128i block;
+	unsigned int i;
+
+	for (i = 0; i < 11; i++) {
+		k[i] = _mm_loadu_si128((const __m128i*)&rk_enc[i*16]);
+	}
+
+	// NOTE: CBC encryption is inherently serial.
+	block = _mm_loadu_si128((const __m128i*)iv);
+	for (; size >= 16; size -= 16, pData += 16) {
+		block = _mm_xor_si128(block, _mm_loadu_si128((const __m128i*)pData));
+		block = _mm_xor_si128(block, k[0]);
+		for (i = 1; i < 10; i++) {
+			block = _mm_aesenc_si128(block, k[i]);
+		}
+		block = _mm_aesenclast_si128(block, k[10]);
+		_mm_storeu_si128((__m128i*)pData, block);
+	}
+	_mm_storeu_si128((__m128i*)iv, block);
+}
+
+/**
+ * Decrypt a block of data using AES-128-CBC.
+ * @param rk_dec	[in] Decryption round keys.
+ * @param iv		[in/out] IV. (Updated for chaining.)
+ * @param pData		[in/out] Data block.
+ * @param size		[in] Length of data block. (Must be a multiple of 16.)
+ */
+void aesw_aesni_cbc_decrypt(const uint8_t *rk_dec, uint8_t *iv, uint8_t *pData, size_t size)
+{
+	__m128i k[11];
+	__m128i prev;
+	unsigned int i;
+
+	for (i = 0; i < 11; i++) {
+		k[i] = _mm_loadu_si128((const __m128i*)&rk_dec[i*16]);
+	}
+
+	prev = _mm_loadu_si128((const __m128i*)iv);
+
+	// CBC decryption can be parallelized, since each block only
+	// depends on the previous ciphertext block. Decrypt four blocks
+	// at a time to keep the AES pipeline full.
+	for (; size >= 64; size -= 64, pData += 64) {
+		const __m128i c0 = _mm_loadu_si128((const __m128i*)&pData[ 0]);
+		const __m128i c1 = _mm_loadu_si128((const __m128i*)&pData[16]);
+		const __m128i c2 = _mm_loadu_si128((const __m128i*)&pData[32]);
+		const __m128i c3 = _mm_loadu_si128((const __m128i*)&pData[48]);
+		__m128i b0 = _mm_xor_si128(c0, k[0]);
+		__m128i b1 = _mm_xor_si128(c1, k[0]);
+		__m128i b2 = _mm_xor_si128(c2, k[0]);
+		__m128i b3 = _mm_xor_si128(c3, k[0]);
+		for (i = 1; i < 10; i++) {
+			b0 = _mm_aesdec_si128(b0, k[i]);
+			b1 = _mm_aesdec_si128(b1, k[i]);
+			b2 = _mm_aesdec_si128(b2, k[i]);
+			b3 = _mm_aesdec_si128(b3, k[i]);
+		}
+		b0 = _mm_aesdeclast_si128(b0, k[10]);
+		b1 = _mm_aesdeclast_si128(b1, k[10]);
+		b2 = _mm_aesdeclast_si128(b2, k[10]);
+		b3 = _mm_aesdeclast_si128(b3, k[10]);
+		_mm_storeu_si128((__m128i*)&pData[ 0], _mm_xor_si128(b0, prev));
+		_mm_storeu_si128((__m128i*)&pData[16], _mm_xor_si128(b1, c0));
+		_mm_storeu_si128((__m128i*)&pData[32], _mm_xor_si128(b2, c1));
+		_mm_storeu_si128((__m128i*)&pData[48], _mm_xor_si128(b3, c2));
+		prev = c3;
+	}
+
+	// Remaining blocks.
+	for (; size >= 16; size -= 16, pData += 16) {
+		const __m128i c = _mm_loadu_si128((const __m128i*)pData);
+		__m128i b = _mm_xor_si128(c, k[0]);
+		for (i = 1; i < 10; i++) {
+			b = _mm_aesdec_si128(b, k[i]);
+		}
+		b = _mm_aesdeclast_si128(b, k[10]);
+		_mm_storeu_si128((__m128i*)pData, _mm_xor_si128(b, prev));
+		prev = c;
+	}
+
+	_mm_storeu_si128((__m128i*)iv, prev);
+}
+
+/**
+ * Encrypt AESW_HW_STREAMS independent blocks of data using AES-128-CBC.
+ * CBC encryption is serial within a stream, so the streams are
+ * encrypted in lockstep to keep the AES pipeline full.
+ * @param rk_enc	[in] Encryption round keys.
+ * @param ppIV		[in] IVs. (Not updated.)
+ * @param ppData	[in/out] Data blocks.
+ * @param size		[in] Length of each data block. (Must be a multiple of 16.)
+ */
+void aesw_aesni_cbc_encrypt_x8(const uint8_t *rk_enc, const uint8_t *const *ppIV,
+	uint8_t *const *ppData, size_t size)
+{
+	__m128i k[11];
+	__m128i b[AESW_HW_STREAMS];
+	size_t pos;
+	unsigned int i, j;
+
+	for (i = 0; i < 11; i++) {
+		k[i] = _mm_loadu_si128((const __m128i*)&rk_enc[i*16]);
+	}
+	for (j = 0; j < AESW_HW_STREAMS; j++) {
+		b[j] = _mm_loadu_si128((const __m128i*)ppIV[j]);
+	}
+
+	for (pos = 0; pos + 16 <= size; pos += 16) {
+		for (j = 0; j < AESW_HW_STREAMS; j++) {
+			b[j] = _mm_xor_si128(b[j], _mm_loadu_si128((const __m128i*)&ppData[j][pos]));
+			b[j] = _mm_xor_si128(b[j], k[0]);
+		}
+		for (i = 1; i < 10; i++) {
+			for (j = 0; j < AESW_HW_STREAMS; j++) {
+				b[j] = _mm_aesenc_si128(b[j], k[i]);
+			}
+		}
+		for (j = 0; j < AESW_HW_STREAMS; j++) {
+			b[j] = _mm_aesenclast_si128(b[j], k[10]);
+			_mm_storeu_si128((__m128i*)&ppData[j][pos], b[j]);
+		}
+	}
+}
+
+/**
+ * Decrypt AESW_HW_STREAMS independent blocks of data using AES-128-CBC.
+ * @param rk_dec	[in] Decryption round keys.
+ * @param ppIV		[in] IVs. (Not updated.)
+ * @param ppData	[in/out] Data blocks.
+ * @param size		[in] Length of each data block. (Must be a multiple of 16.)
+ */
+void aesw_aesni_cbc_decrypt_x8(const uint8_t *rk_dec, const uint8_t *const *ppIV,
+	uint8_t *const *ppData, size_t size)
+{
+	__m128i k[11];
+	__m128i prev[AESW_HW_STREAMS];
+	__m128i c[AESW_HW_STREAMS];
+	__m128i b[AESW_HW_STREAMS];
+	size_t pos;
+	unsigned int i, j;
+
+	for (i = 0; i < 11; i++) {
+		k[i] = _mm_loadu_si128((const __m128i*)&rk_dec[i*16]);
+	}
+	for (j = 0; j < AESW_HW_STREAMS; j++) {
+		prev[j] = _mm_loadu_si128((const __m128i*)ppIV[j]);
+	}
+
+	for (pos = 0; pos + 16 <= size; pos += 16) {
+		for (j = 0; j < AESW_HW_STREAMS; j++) {
+			c[j] = _mm_loadu_si128((const __m128i*)&ppData[j][pos]);
+			b[j] = _mm_xor_si128(c[j], k[0]);
+		}
+		for (i = 1; i < 10; i++) {
+			for (j = 0; j < AESW_HW_STREAMS; j++) {
+				b[j] = _mm_aesdec_si128(b[j], k[i]);
+			}
+		}
+		for (j = 0; j < AESW_HW_STREAMS; j++) {
+			b[j] = _mm_aesdeclast_si128(b[j], k[10]);
+			_mm_storeu_si128((__m128i*)&ppData[j][pos], _mm_xor_si128(b[j], prev[j]));
+			prev[j] = c[j];
+		}
+	}
+}
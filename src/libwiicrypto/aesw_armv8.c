@@ -0,0 +1,266 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * aesw_armv8.c: AES wrapper functions. (ARMv8 Crypto Extensions version)  *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "aesw_hw.h"
+
+// ARMv8 Crypto Extensions intrinsics
+#include <arm_neon.h>
+
+// Runtime CPU feature detection
+#if defined(_WIN32)
+#  include <windows.h>
+#elif defined(__linux__)
+#  include <sys/auxv.h>
+#  ifndef HWCAP_AES
+#    define HWCAP_AES (1UL << 3)
+#  endif
+#endif
+
+/**
+ * Check if the ARMv8 Cryptography Extensions are supported by the CPU.
+ * @return Non-zero if supported; 0 if not.
+ */
+int aesw_armv8_is_supported(void)
+{
+#if defined(_WIN32)
+	return !!IsProcessorFeaturePresent(PF_ARM_V8_CRYPTO_INSTRUCTIONS_AVAILABLE);
+#elif defined(__APPLE__)
+	// All Apple ARM64 CPUs support the Crypto Extensions.
+	return 1;
+#elif defined(__linux__)
+	return !!(getauxval(AT_HWCAP) & HWCAP_AES);
+#else
+	// TODO: Other operating systems.
+	return 0;
+#endif
+}
+
+/**
+ * Apply the AES S-box to each byte of a 32-bit word.
+ * @param w Word.
+ * @return SubWord(w)
+ */
+static inline uint32_t aes_subword(uint32_t w)
+{
+	// AESE with an all-zero round key performs ShiftRows and SubBytes.
+	// If all four columns are identical, ShiftRows is a no-op.
+	const uint8x16_t v = vaeseq_u8(vreinterpretq_u8_u32(vdupq_n_u32(w)), vdupq_n_u8(0));
+	return vgetq_lane_u32(vreinterpretq_u32_u8(v), 0);
+}
+
+/**
+ * Expand an AES-128 key for encryption and decryption.
+ * @param rk_enc	[out] Encryption round keys. (AESW_HW_ROUND_KEYS_SIZE bytes)
+ * @param rk_dec	[out] Decryption round keys. (AESW_HW_ROUND_KEYS_SIZE bytes)
+ * @param pKey		[in] Key data. (16 bytes)
+ */
+void aesw_armv8_set_key(uint8_t *rk_enc, uint8_t *rk_dec, const uint8_t *pKey)
+{
+	static const uint8_t rcon[10] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1B, 0x36};
+	uint32_t w[44];
+	unsigned int i;
+
+	// NOTE: Words are little-endian, so byte 0 is the low byte.
+	for (i = 0; i < 4; i++) {
+		w[i] = (uint32_t)pKey[i*4] |
+		       ((uint32_t)pKey[i*4+1] << 8) |
+		       ((uint32_t)pKey[i*4+2] << 16) |
+		       ((uint32_t)pKey[i*4+3] << 24);
+	}
+	for (i = 4; i < 44; i++) {
+		uint32_t tmp = w[i-1];
+		if (i % 4 == 0) {
+			// RotWord, SubWord, Rcon
+			tmp = aes_subword((tmp >> 8) | (tmp << 24)) ^ rcon[i/4 - 1];
+		}
+		w[i] = w[i-4] ^ tmp;
+	}
+	for (i = 0; i < 11; i++) {
+		vst1q_u8(&rk_enc[i*16], vreinterpretq_u8_u32(vld1q_u32(&w[i*4])));
+	}
+
+	// Decryption round keys are the encryption round keys in
+	// reverse order, with InvMixColumns applied to rounds 1-9.
+	vst1q_u8(&rk_dec[0], vld1q_u8(&rk_enc[10*16]));
+	for (i = 1; i < 10; i++) {
+		vst1q_u8(&rk_dec[i*16], vaesimcq_u8(vld1q_u8(&rk_enc[(10-i)*16])));
+	}
+	vst1q_u8(&rk_dec[10*16], vld1q_u8(&rk_enc[0]));
+}
+
+/**
+ * Encrypt a block of data using AES-128-CBC.
+ * @param rk_enc	[in] Encryption round keys.
+ * @param iv		[in/out] IV. (Updated for chaining.)
+ * @param pData		[in/out] Data block.
+ * @param size		[in] Length of data block. (Must be a multiple of 16.)
+ */
+void aesw_armv8_cbc_encrypt(const uint8_t *rk_enc, uint8_t *iv, uint8_t *pData, size_t size)
+{
+	uint8x16_t k[11];
+	uint8x16_t block;
+	unsigned int i;
+
+	for (i = 0; i < 11; i++) {
+		k[i] = vld1q_u8(&rk_enc[i*16]);
+	}
+
+	// NOTE: CBC encryption is inherently serial.
+	block = vld1q_u8(iv);
+	for (; size >= 16; size -= 16, pData += 16) {
+		block = veorq_u8(block, vld1q_u8(pData));
+		for (i = 0; i < 9; i++) {
+			block = vaesmcq_u8(vaeseq_u8(block, k[i]));
+		}
+		block = veorq_u8(vaeseq_u8(block, k[9]), k[10]);
+		vst1q_u8(pData, block);
+	}
+	vst1q_u8(iv, block);
+}
+
+/**
+ * Decrypt a block of data using AES-128-CBC.
+ * @param rk_dec	[in] Decryption round keys.
+ * @param iv		[in/out] IV. (Updated for chaining.)
+ * @param pData		[in/out] Data block.
+ * @param size		[in] Length of data block. (Must be a multiple of 16.)
+ */
+void aesw_armv8_cbc_decrypt(const uint8_t *rk_dec, uint8_t *iv, uint8_t *pData, size_t size)
+{
+	uint8x16_t k[11];
+	uint8x16_t prev;
+	unsigned int i;
+
+	for (i = 0; i < 11; i++) {
+		k[i] = vld1q_u8(&rk_dec[i*16]);
+	}
+
+	prev = vld1q_u8(iv);
+
+	// CBC decryption can be parallelized, since each block only
+	// depends on the previous ciphertext block. Decrypt four blocks
+	// at a time to keep the AES pipeline full.
+	for (; size >= 64; size -= 64, pData += 64) {
+		const uint8x16_t c0 = vld1q_u8(&pData[ 0]);
+		const uint8x16_t c1 = vld1q_u8(&pData[16]);
+		const uint8x16_t c2 = vld1q_u8(&pData[32]);
+		const uint8x16_t c3 = vld1q_u8(&pData[48]);
+		uint8x16_t b0 = c0, b1 = c1, b2 = c2, b3 = c3;
+		for (i = 0; i < 9; i++) {
+			b0 = vaesimcq_u8(vaesdq_u8(b0, k[i]));
+			b1 = vaesimcq_u8(vaesdq_u8(b1, k[i]));
+			b2 = vaesimcq_u8(vaesdq_u8(b2, k[i]));
+			b3 = vaesimcq_u8(vaesdq_u8(b3, k[i]));
+		}
+		b0 = veorq_u8(vaesdq_u8(b0, k[9]), k[10]);
+		b1 = veorq_u8(vaesdq_u8(b1, k[9]), k[10]);
+		b2 = veorq_u8(vaesdq_u8(b2, k[9]), k[10]);
+		b3 = veorq_u8(vaesdq_u8(b3, k[9]), k[10]);
+		vst1q_u8(&pData[ 0], veorq_u8(b0, prev));
+		vst1q_u8(&pData[16], veorq_u8(b1, c0));
+		vst1q_u8(&pData[32], veorq_u8(b2, c1));
+		vst1q_u8(&pData[48], veorq_u8(b3, c2));
+		prev = c3;
+	}
+
+	// Remaining blocks.
+	for (; size >= 16; size -= 16, pData += 16) {
+		const uint8x16_t c = vld1q_u8(pData);
+		uint8x16_t b = c;
+		for (i = 0; i < 9; i++) {
+			b = vaesimcq_u8(vaesdq_u8(b, k[i]));
+		}
+		b = veorq_u8(vaesdq_u8(b, k[9]), k[10]);
+		vst1q_u8(pData, veorq_u8(b, prev));
+		prev = c;
+	}
+
+	vst1q_u8(iv, prev);
+}
+
+/**
+ * Encrypt AESW_HW_STREAMS independent blocks of data using AES-128-CBC.
+ * CBC encryption is serial within a stream, so the streams are
+ * encrypted in lockstep to keep the AES pipeline full.
+ * @param rk_enc	[in] Encryption round keys.
+ * @param ppIV		[in] IVs. (Not updated.)
+ * @param ppData	[in/out] Data blocks.
+ * @param size		[in] Length of each data block. (Must be a multiple of 16.)
+ */
+void aesw_armv8_cbc_encrypt_x8(const uint8_t *rk_enc, const uint8_t *const *ppIV,
+	uint8_t *const *ppData, size_t size)
+{
+	uint8x16_t k[11];
+	uint8x16_t b[AESW_HW_STREAMS];
+	size_t pos;
+	unsigned int i, j;
+
+	for (i = 0; i < 11; i++) {
+		k[i] = vld1q_u8(&rk_enc[i*16]);
+	}
+	for (j = 0; j < AESW_HW_STREAMS; j++) {
+		b[j] = vld1q_u8(ppIV[j]);
+	}
+
+	for (pos = 0; pos + 16 <= size; pos += 16) {
+		for (j = 0; j < AESW_HW_STREAMS; j++) {
+			b[j] = veorq_u8(b[j], vld1q_u8(&ppData[j][pos]));
+		}
+		for (i = 0; i < 9; i++) {
+			for (j = 0; j < AESW_HW_STREAMS; j++) {
+				b[j] = vaesmcq_u8(vaeseq_u8(b[j], k[i]));
+			}
+		}
+		for (j = 0; j < AESW_HW_STREAMS; j++) {
+			b[j] = veorq_u8(vaeseq_u8(b[j], k[9]), k[10]);
+			vst1q_u8(&ppData[j][pos], b[j]);
+		}
+	}
+}
+
+/**
+ * Decrypt AESW_HW_STREAMS independent blocks of data using AES-128-CBC.
+ * @param rk_dec	[in] Decryption round keys.
+ * @param ppIV		[in] IVs. (Not updated.)
+ * @param ppData	[in/out] Data blocks.
+ * @param size		[in] Length of each data block. (Must be a multiple of 16.)
+ */
+void aesw_armv8_cbc_decrypt_x8(const uint8_t *rk_dec, const uint8_t *const *ppIV,
+	uint8_t *const *ppData, size_t size)
+{
+	uint8x16_t k[11];
+	uint8x16_t prev[AESW_HW_STREAMS];
+	uint8x16_t c[AESW_HW_STREAMS];
+	uint8x16_t b[AESW_HW_STREAMS];
+	size_t pos;
+	unsigned int i, j;
+
+	for (i = 0; i < 11; i++) {
+		k[i] = vld1q_u8(&rk_dec[i*16]);
+	}
+	for (j = 0; j < AESW_HW_STREAMS; j++) {
+		prev[j] = vld1q_u8(ppIV[j]);
+	}
+
+	for (pos = 0; pos + 16 <= size; pos += 16) {
+		for (j = 0; j < AESW_HW_STREAMS; j++) {
+			c[j] = vld1q_u8(&ppData[j][pos]);
+			b[j] = c[j];
+		}
+		for (i = 0; i < 9; i++) {
+			for (j = 0; j < AESW_HW_STREAMS; j++) {
+				b[j] = vaesimcq_u8(vaesdq_u8(b[j], k[i]));
+			}
+		}
+		for (j = 0; j < AESW_HW_STREAMS; j++) {
+			b[j] = veorq_u8(vaesdq_u8(b[j], k[9]), k[10]);
+			vst1q_u8(&ppData[j][pos], veorq_u8(b[j], prev[j]));
+			prev[j] = c[j];
+		}
+	}
+}
@@ -0,0 +1,146 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * aesw_hw.h: AES wrapper functions. (hardware-accelerated backends)       *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// NOTE: Internal header. Only used by the aesw implementation.
+// NOTE 2: Currently only supports AES-128-CBC.
+
+#ifndef __RVTHTOOL_LIBWIICRYPTO_AESW_HW_H__
+#define __RVTHTOOL_LIBWIICRYPTO_AESW_HW_H__
+
+#include "config.libwiicrypto.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(HAVE_AESW_AESNI) || defined(HAVE_AESW_ARMV8)
+#  define HAVE_AESW_HW 1
+#endif
+
+// Size of an expanded AES-128 key schedule. (11 round keys)
+#define AESW_HW_ROUND_KEYS_SIZE (11*16)
+
+// Number of independent streams processed by the *_x8() functions.
+#define AESW_HW_STREAMS 8
+
+#ifdef HAVE_AESW_AESNI
+/**
+ * Check if AES-NI is supported by the CPU.
+ * @return Non-zero if supported; 0 if not.
+ */
+int aesw_aesni_is_supported(void);
+
+/**
+ * Expand an AES-128 key for encryption and decryption.
+ * @param rk_enc	[out] Encryption round keys. (AESW_HW_ROUND_KEYS_SIZE bytes)
+ * @param rk_dec	[out] Decryption round keys. (AESW_HW_ROUND_KEYS_SIZE bytes)
+ * @param pKey		[in] Key data. (16 bytes)
+ */
+void aesw_aesni_set_key(uint8_t *rk_enc, uint8_t *rk_dec, const uint8_t *pKey);
+
+/**
+ * Encrypt a block of data using AES-128-CBC.
+ * @param rk_enc	[in] Encryption round keys.
+ * @param iv		[in/out] IV. (Updated for chaining.)
+ * @param pData		[in/out] Data block.
+ * @param size		[in] Length of data block. (Must be a multiple of 16.)
+ */
+void aesw_aesni_cbc_encrypt(const uint8_t *rk_enc, uint8_t *iv, uint8_t *pData, size_t size);
+
+/**
+ * Decrypt a block of data using AES-128-CBC.
+ * @param rk_dec	[in] Decryption round keys.
+ * @param iv		[in/out] IV. (Updated for chaining.)
+ * @param pData		[in/out] Data block.
+ * @param size		[in] Length of data block. (Must be a multiple of 16.)
+ */
+void aesw_aesni_cbc_decrypt(const uint8_t *rk_dec, uint8_t *iv, uint8_t *pData, size_t size);
+
+/**
+ * Encrypt AESW_HW_STREAMS independent blocks of data using AES-128-CBC.
+ * @param rk_enc	[in] Encryption round keys.
+ * @param ppIV		[in] IVs. (Not updated.)
+ * @param ppData	[in/out] Data blocks.
+ * @param size		[in] Length of each data block. (Must be a multiple of 16.)
+ */
+void aesw_aesni_cbc_encrypt_x8(const uint8_t *rk_enc, const uint8_t *const *ppIV,
+	uint8_t *const *ppData, size_t size);
+
+/**
+ * Decrypt AESW_HW_STREAMS independent blocks of data using AES-128-CBC.
+ * @param rk_dec	[in] Decryption round keys.
+ * @param ppIV		[in] IVs. (Not updated.)
+ * @param ppData	[in/out] Data blocks.
+ * @param size		[in] Length of each data block. (Must be a multiple of 16.)
+ */
+void aesw_aesni_cbc_decrypt_x8(const uint8_t *rk_dec, const uint8_t *const *ppIV,
+	uint8_t *const *ppData, size_t size);
+#endif /* HAVE_AESW_AESNI */
+
+#ifdef HAVE_AESW_ARMV8
+/**
+ * Check if the ARMv8 Cryptography Extensions are supported by the CPU.
+ * @return Non-zero if supported; 0 if not.
+ */
+int aesw_armv8_is_supported(void);
+
+/**
+ * Expand an AES-128 key for encryption and decryption.
+ * @param rk_enc	[out] Encryption round keys. (AESW_HW_ROUND_KEYS_SIZE bytes)
+ * @param rk_dec	[out] Decryption round keys. (AESW_HW_ROUND_KEYS_SIZE bytes)
+ * @param pKey		[in] Key data. (16 bytes)
+ */
+void aesw_armv8_set_key(uint8_t *rk_enc, uint8_t *rk_dec, const uint8_t *pKey);
+
+/**
+ * Encrypt a block of data using AES-128-CBC.
+ * @param rk_enc	[in] Encryption round keys.
+ * @param iv		[in/out] IV. (Updated for chaining.)
+ * @param pData		[in/out] Data block.
+ * @param size		[in] Length of data block. (Must be a multiple of 16.)
+ */
+void aesw_armv8_cbc_encrypt(const uint8_t *rk_enc, uint8_t *iv, uint8_t *pData, size_t size);
+
+/**
+ * Decrypt a block of data using AES-128-CBC.
+ * @param rk_dec	[in] Decryption round keys.
+ * @param iv		[in/out] IV. (Updated for chaining.)
+ * @param pData		[in/out] Data block.
+ * @param size		[in] Length of data block. (Must be a multiple of 16.)
+ */
+void aesw_armv8_cbc_decrypt(const uint8_t *rk_dec, uint8_t *iv, uint8_t *pData, size_t size);
+
+/**
+ * Encrypt AESW_HW_STREAMS independent blocks of data using AES-128-CBC.
+ * @param rk_enc	[in] Encryption round keys.
+ * @param ppIV		[in] IVs. (Not updated.)
+ * @param ppData	[in/out] Data blocks.
+ * @param size		[in] Length of each data block. (Must be a multiple of 16.)
+ */
+void aesw_armv8_cbc_encrypt_x8(const uint8_t *rk_enc, const uint8_t *const *ppIV,
+	uint8_t *const *ppData, size_t size);
+
+/**
+ * Decrypt AESW_HW_STREAMS independent blocks of data using AES-128-CBC.
+ * @param rk_dec	[in] Decryption round keys.
+ * @param ppIV		[in] IVs. (Not updated.)
+ * @param ppData	[in/out] Data blocks.
+ * @param size		[in] Length of each data block. (Must be a multiple of 16.)
+ */
+void aesw_armv8_cbc_decrypt_x8(const uint8_t *rk_dec, const uint8_t *const *ppIV,
+	uint8_t *const *ppData, size_t size);
+#endif /* HAVE_AESW_ARMV8 */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_LIBWIICRYPTO_AESW_HW_H__ */
@@ -2,13 +2,15 @@
  * RVT-H Tool (libwiicrypto)                                               *
  * aesw_nettle.c: AES wrapper functions. (nettle version)                  *
  *                                                                         *
- * Copyright (c) 2018 by David Korth.                                      *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
 #include "config.nettle.h"
 
 #include "aesw.h"
+#include "aesw_hw.h"
+#include "impl_select.h"
 
 #include <assert.h>
 #include <errno.h>
@@ -18,21 +20,85 @@
 // Nettle AES functions.
 #include <nettle/aes.h>
 #include <nettle/cbc.h>
+#include <nettle/sha1.h>
+
+// AES implementation.
+typedef enum {
+	AESW_IMPL_NETTLE	= 0,	// GNU Nettle (software)
+	AESW_IMPL_AESNI		= 1,	// x86 AES-NI
+	AESW_IMPL_ARMV8		= 2,	// ARMv8 Crypto Extensions
+} AesW_Impl_e;
 
 // AES context. (GNU Nettle version.)
 struct _AesCtx {
 #ifdef HAVE_NETTLE_3
-	struct aes128_ctx ctx;
+	struct aes128_ctx ctx_enc;
+	struct aes128_ctx ctx_dec;
 #else /* !HAVE_NETTLE_3 */
-	struct aes_ctx ctx;
+	struct aes_ctx ctx_enc;
+	struct aes_ctx ctx_dec;
 #endif /* HAVE_NETTLE_3 */
 
-	// Encryption key.
-	uint8_t key[16];
+#ifdef HAVE_AESW_HW
+	// Expanded round keys for hardware-accelerated AES.
+	uint8_t rk_enc[AESW_HW_ROUND_KEYS_SIZE];
+	uint8_t rk_dec[AESW_HW_ROUND_KEYS_SIZE];
+#endif /* HAVE_AESW_HW */
+
 	// Initialization vector.
 	uint8_t iv[16];
+
+	// AES implementation. (See AesW_Impl_e.)
+	uint8_t impl;
 };
 
+// Current AES implementation. (-1 == not detected yet)
+IMPL_SELECT(aesw_impl);
+
+/**
+ * Determine the best AES implementation for this CPU.
+ * @return AES implementation. (See AesW_Impl_e.)
+ */
+static int aesw_detect_impl(void)
+{
+#if defined(HAVE_AESW_AESNI)
+	if (aesw_aesni_is_supported()) {
+		return AESW_IMPL_AESNI;
+	}
+#elif defined(HAVE_AESW_ARMV8)
+	if (aesw_armv8_is_supported()) {
+		return AESW_IMPL_ARMV8;
+	}
+#endif
+	return AESW_IMPL_NETTLE;
+}
+
+/**
+ * Get the current AES implementation.
+ * @return AES implementation. (See AesW_Impl_e.)
+ */
+static inline AesW_Impl_e aesw_get_impl(void)
+{
+	return (AesW_Impl_e)impl_select_get(&aesw_impl, aesw_detect_impl);
+}
+
+/**
+ * Get the name of the active AES implementation.
+ * @return AES implementation name.
+ */
+const char *aesw_get_impl_name(void)
+{
+	switch (aesw_get_impl()) {
+		default:
+		case AESW_IMPL_NETTLE:
+			return "nettle";
+		case AESW_IMPL_AESNI:
+			return "AES-NI";
+		case AESW_IMPL_ARMV8:
+			return "ARMv8 Crypto Extensions";
+	}
+}
+
 /**
  * Create an AES context.
  * @return AES context, or NULL on error.
@@ -47,6 +113,9 @@ AesCtx *aesw_new(void)
 		return NULL;
 	}
 
+	// Select the AES implementation.
+	aesw->impl = (uint8_t)aesw_get_impl();
+
 	// AES context has been initialized.
 	return aesw;
 }
@@ -73,7 +142,30 @@ int aesw_set_key(AesCtx *aesw, const uint8_t *pKey, size_t size)
 		return -EINVAL;
 	}
 
-	memcpy(aesw->key, pKey, size);
+	// Expand the key schedules once here instead of
+	// on every call to aesw_encrypt() / aesw_decrypt().
+	switch (aesw->impl) {
+		default:
+		case AESW_IMPL_NETTLE:
+#ifdef HAVE_NETTLE_3
+			aes128_set_encrypt_key(&aesw->ctx_enc, pKey);
+			aes128_set_decrypt_key(&aesw->ctx_dec, pKey);
+#else /* !HAVE_NETTLE_3 */
+			aes_set_encrypt_key(&aesw->ctx_enc, size, pKey);
+			aes_set_decrypt_key(&aesw->ctx_dec, size, pKey);
+#endif /* HAVE_NETTLE_3 */
+			break;
+#ifdef HAVE_AESW_AESNI
+		case AESW_IMPL_AESNI:
+			aesw_aesni_set_key(aesw->rk_enc, aesw->rk_dec, pKey);
+			break;
+#endif /* HAVE_AESW_AESNI */
+#ifdef HAVE_AESW_ARMV8
+		case AESW_IMPL_ARMV8:
+			aesw_armv8_set_key(aesw->rk_enc, aesw->rk_dec, pKey);
+			break;
+#endif /* HAVE_AESW_ARMV8 */
+	}
 	return 0;
 }
 
@@ -109,16 +201,28 @@ size_t aesw_encrypt(AesCtx *aesw, uint8_t *pData, size_t size)
 		return 0;
 	}
 
-	// TODO: Only set encrypt key if switching modes?
+	switch (aesw->impl) {
+		default:
+		case AESW_IMPL_NETTLE:
 #ifdef HAVE_NETTLE_3
-	aes128_set_encrypt_key(&aesw->ctx, aesw->key);
-	cbc_encrypt(&aesw->ctx, (nettle_cipher_func*)aes128_encrypt,
-		AES_BLOCK_SIZE, aesw->iv, size, pData, pData);
+			cbc_encrypt(&aesw->ctx_enc, (nettle_cipher_func*)aes128_encrypt,
+				AES_BLOCK_SIZE, aesw->iv, size, pData, pData);
 #else /* !HAVE_NETTLE_3 */
-	aes_set_encrypt_key(&aesw->ctx, sizeof(aesw->key), aesw->key);
-	cbc_encrypt(&aesw->ctx, (nettle_crypt_func*)aes_encrypt,
-		AES_BLOCK_SIZE, aesw->iv, size, pData, pData);
+			cbc_encrypt(&aesw->ctx_enc, (nettle_crypt_func*)aes_encrypt,
+				AES_BLOCK_SIZE, aesw->iv, size, pData, pData);
 #endif /* HAVE_NETTLE_3 */
+			break;
+#ifdef HAVE_AESW_AESNI
+		case AESW_IMPL_AESNI:
+			aesw_aesni_cbc_encrypt(aesw->rk_enc, aesw->iv, pData, size);
+			break;
+#endif /* HAVE_AESW_AESNI */
+#ifdef HAVE_AESW_ARMV8
+		case AESW_IMPL_ARMV8:
+			aesw_armv8_cbc_encrypt(aesw->rk_enc, aesw->iv, pData, size);
+			break;
+#endif /* HAVE_AESW_ARMV8 */
+	}
 
 	return size;
 }
@@ -138,16 +242,191 @@ size_t aesw_decrypt(AesCtx *aesw, uint8_t *pData, size_t size)
 		return 0;
 	}
 
-	// TODO: Only set decrypt key if switching modes?
+	switch (aesw->impl) {
+		default:
+		case AESW_IMPL_NETTLE:
 #ifdef HAVE_NETTLE_3
-	aes128_set_decrypt_key(&aesw->ctx, aesw->key);
-	cbc_decrypt(&aesw->ctx, (nettle_cipher_func*)aes128_decrypt,
-		AES_BLOCK_SIZE, aesw->iv, size, pData, pData);
+			cbc_decrypt(&aesw->ctx_dec, (nettle_cipher_func*)aes128_decrypt,
+				AES_BLOCK_SIZE, aesw->iv, size, pData, pData);
 #else /* !HAVE_NETTLE_3 */
-	aes_set_decrypt_key(&aesw->ctx, sizeof(aesw->key), aesw->key);
-	cbc_decrypt(&aesw->ctx, (nettle_crypt_func*)aes_decrypt,
-		AES_BLOCK_SIZE, aesw->iv, size, pData, pData);
+			cbc_decrypt(&aesw->ctx_dec, (nettle_crypt_func*)aes_decrypt,
+				AES_BLOCK_SIZE, aesw->iv, size, pData, pData);
 #endif /* HAVE_NETTLE_3 */
+			break;
+#ifdef HAVE_AESW_AESNI
+		case AESW_IMPL_AESNI:
+			aesw_aesni_cbc_decrypt(aesw->rk_dec, aesw->iv, pData, size);
+			break;
+#endif /* HAVE_AESW_AESNI */
+#ifdef HAVE_AESW_ARMV8
+		case AESW_IMPL_ARMV8:
+			aesw_armv8_cbc_decrypt(aesw->rk_dec, aesw->iv, pData, size);
+			break;
+#endif /* HAVE_AESW_ARMV8 */
+	}
+
+	return size;
+}
+
+/**
+ * Encrypt multiple independent blocks of data, each with its own IV.
+ * The streams are processed in lockstep if hardware acceleration
+ * is available, which is faster than encrypting them one at a time.
+ *
+ * NOTE: The context's IV is neither used nor updated.
+ *
+ * @param aesw		[in] AES context.
+ * @param ppIV		[in] IVs. (16 bytes each)
+ * @param ppData	[in/out] Data blocks. (Must not overlap.)
+ * @param size		[in] Length of each data block. (Must be a multiple of 16.)
+ * @param count		[in] Number of data blocks.
+ * @return Total number of bytes encrypted on success; 0 on error.
+ */
+size_t aesw_encrypt_multi(AesCtx *aesw, const uint8_t *const *ppIV,
+	uint8_t *const *ppData, size_t size, unsigned int count)
+{
+	uint8_t iv[16];
+	unsigned int i = 0;
+
+	if (!aesw || !ppIV || !ppData || (size % 16 != 0)) {
+		// Invalid parameters.
+		errno = EINVAL;
+		return 0;
+	}
+
+#ifdef HAVE_AESW_HW
+	// Full sets of streams.
+	for (; count - i >= AESW_HW_STREAMS; i += AESW_HW_STREAMS) {
+		switch (aesw->impl) {
+			default:
+				goto single;
+#ifdef HAVE_AESW_AESNI
+			case AESW_IMPL_AESNI:
+				aesw_aesni_cbc_encrypt_x8(aesw->rk_enc, &ppIV[i], &ppData[i], size);
+				break;
+#endif /* HAVE_AESW_AESNI */
+#ifdef HAVE_AESW_ARMV8
+			case AESW_IMPL_ARMV8:
+				aesw_armv8_cbc_encrypt_x8(aesw->rk_enc, &ppIV[i], &ppData[i], size);
+				break;
+#endif /* HAVE_AESW_ARMV8 */
+		}
+	}
+single:
+#endif /* HAVE_AESW_HW */
+
+	// Remaining streams.
+	// NOTE: aesw_encrypt() updates the IV, so save it first.
+	memcpy(iv, aesw->iv, sizeof(iv));
+	for (; i < count; i++) {
+		memcpy(aesw->iv, ppIV[i], sizeof(aesw->iv));
+		aesw_encrypt(aesw, ppData[i], size);
+	}
+	memcpy(aesw->iv, iv, sizeof(iv));
+
+	return size * count;
+}
+
+/**
+ * Decrypt multiple independent blocks of data, each with its own IV.
+ * The streams are processed in lockstep if hardware acceleration
+ * is available, which is faster than decrypting them one at a time.
+ *
+ * NOTE: The context's IV is neither used nor updated.
+ *
+ * @param aesw		[in] AES context.
+ * @param ppIV		[in] IVs. (16 bytes each)
+ * @param ppData	[in/out] Data blocks. (Must not overlap.)
+ * @param size		[in] Length of each data block. (Must be a multiple of 16.)
+ * @param count		[in] Number of data blocks.
+ * @return Total number of bytes decrypted on success; 0 on error.
+ */
+size_t aesw_decrypt_multi(AesCtx *aesw, const uint8_t *const *ppIV,
+	uint8_t *const *ppData, size_t size, unsigned int count)
+{
+	uint8_t iv[16];
+	unsigned int i = 0;
+
+	if (!aesw || !ppIV || !ppData || (size % 16 != 0)) {
+		// Invalid parameters.
+		errno = EINVAL;
+		return 0;
+	}
+
+#ifdef HAVE_AESW_HW
+	// Full sets of streams.
+	for (; count - i >= AESW_HW_STREAMS; i += AESW_HW_STREAMS) {
+		switch (aesw->impl) {
+			default:
+				goto single;
+#ifdef HAVE_AESW_AESNI
+			case AESW_IMPL_AESNI:
+				aesw_aesni_cbc_decrypt_x8(aesw->rk_dec, &ppIV[i], &ppData[i], size);
+				break;
+#endif /* HAVE_AESW_AESNI */
+#ifdef HAVE_AESW_ARMV8
+			case AESW_IMPL_ARMV8:
+				aesw_armv8_cbc_decrypt_x8(aesw->rk_dec, &ppIV[i], &ppData[i], size);
+				break;
+#endif /* HAVE_AESW_ARMV8 */
+		}
+	}
+single:
+#endif /* HAVE_AESW_HW */
+
+	// Remaining streams.
+	// NOTE: aesw_decrypt() updates the IV, so save it first.
+	memcpy(iv, aesw->iv, sizeof(iv));
+	for (; i < count; i++) {
+		memcpy(aesw->iv, ppIV[i], sizeof(aesw->iv));
+		aesw_decrypt(aesw, ppData[i], size);
+	}
+	memcpy(aesw->iv, iv, sizeof(iv));
+
+	return size * count;
+}
+
+// Chunk size for aesw_decrypt_sha1().
+// Small enough that the decrypted chunk is still in L1 when it's hashed.
+#define DECRYPT_SHA1_CHUNK_SIZE (8U * 1024U)
+
+/**
+ * Decrypt a block of data using the current parameters
+ * and update a SHA-1 hash with the decrypted data.
+ *
+ * The data is decrypted and hashed in small chunks, so each chunk
+ * is hashed while it's still in cache instead of decrypting the
+ * whole block first and then reading it again to hash it.
+ *
+ * @param aesw		[in] AES context.
+ * @param sha1		[in/out] SHA-1 context. (nettle)
+ * @param pData		[in/out] Data block.
+ * @param size		[in] Length of data block. (Must be a multiple of 16.)
+ * @param hash_size	[in] Number of decrypted bytes to hash. (Must be <= size.)
+ * @return Number of bytes decrypted on success; 0 on error.
+ */
+size_t aesw_decrypt_sha1(AesCtx *aesw, struct sha1_ctx *sha1,
+	uint8_t *pData, size_t size, size_t hash_size)
+{
+	size_t pos;
+
+	if (!aesw || !sha1 || !pData || (size % 16 != 0) || hash_size > size) {
+		// Invalid parameters.
+		errno = EINVAL;
+		return 0;
+	}
+
+	for (pos = 0; pos < size; pos += DECRYPT_SHA1_CHUNK_SIZE) {
+		const size_t chunk = (size - pos < DECRYPT_SHA1_CHUNK_SIZE
+			? size - pos : DECRYPT_SHA1_CHUNK_SIZE);
+		aesw_decrypt(aesw, &pData[pos], chunk);
+
+		if (pos < hash_size) {
+			const size_t hash_chunk = (hash_size - pos < chunk
+				? hash_size - pos : chunk);
+			sha1_update(sha1, hash_chunk, &pData[pos]);
+		}
+	}
 
 	return size;
 }
@@ -0,0 +1,396 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * aesw_openssl.c: AES wrapper functions. (OpenSSL version)                *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "aesw.h"
+#include "aesw_hw.h"
+#include "impl_select.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+// OpenSSL AES functions.
+#include <openssl/evp.h>
+
+// SHA-1 is still provided by nettle. (See sha1w.h.)
+#include <nettle/sha1.h>
+
+// AES context. (OpenSSL version.)
+struct _AesCtx {
+	// OpenSSL selects its own AES-NI or ARMv8 code paths.
+	EVP_CIPHER_CTX *ctx_enc;
+	EVP_CIPHER_CTX *ctx_dec;
+
+#ifdef HAVE_AESW_HW
+	// Expanded round keys for the multi-stream functions.
+	// OpenSSL doesn't have multi-stream CBC, and CBC encryption
+	// of a single stream can't be parallelized.
+	uint8_t rk_enc[AESW_HW_ROUND_KEYS_SIZE];
+	uint8_t rk_dec[AESW_HW_ROUND_KEYS_SIZE];
+	uint8_t has_hw;
+#endif /* HAVE_AESW_HW */
+
+	// Initialization vector.
+	uint8_t iv[16];
+};
+
+#ifdef HAVE_AESW_HW
+// Is hardware-accelerated AES supported? (-1 == not detected yet)
+IMPL_SELECT(aesw_hw_supported);
+
+/**
+ * Detect hardware-accelerated multi-stream AES support.
+ * @return Non-zero if supported; 0 if not.
+ */
+static int aesw_hw_detect(void)
+{
+#if defined(HAVE_AESW_AESNI)
+	return !!aesw_aesni_is_supported();
+#elif defined(HAVE_AESW_ARMV8)
+	return !!aesw_armv8_is_supported();
+#else
+	return 0;
+#endif
+}
+
+/**
+ * Is hardware-accelerated multi-stream AES supported by this CPU?
+ * @return Non-zero if supported; 0 if not.
+ */
+static inline int aesw_hw_is_supported(void)
+{
+	return impl_select_get(&aesw_hw_supported, aesw_hw_detect);
+}
+#endif /* HAVE_AESW_HW */
+
+/**
+ * Get the name of the active AES implementation.
+ * @return AES implementation name.
+ */
+const char *aesw_get_impl_name(void)
+{
+	return "OpenSSL";
+}
+
+/**
+ * Create an AES context.
+ * @return AES context, or NULL on error.
+ */
+AesCtx *aesw_new(void)
+{
+	// Allocate an AES context.
+	AesCtx *aesw = calloc(1, sizeof(*aesw));
+	if (!aesw) {
+		// Could not allocate memory.
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	aesw->ctx_enc = EVP_CIPHER_CTX_new();
+	aesw->ctx_dec = EVP_CIPHER_CTX_new();
+	if (!aesw->ctx_enc || !aesw->ctx_dec) {
+		// Could not allocate the cipher contexts.
+		aesw_free(aesw);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+#ifdef HAVE_AESW_HW
+	aesw->has_hw = (uint8_t)aesw_hw_is_supported();
+#endif /* HAVE_AESW_HW */
+
+	// AES context has been initialized.
+	return aesw;
+}
+
+/**
+ * Free an AES context
+ * @param aesw AES context.
+ */
+void aesw_free(AesCtx *aesw)
+{
+	if (!aesw)
+		return;
+
+	EVP_CIPHER_CTX_free(aesw->ctx_enc);
+	EVP_CIPHER_CTX_free(aesw->ctx_dec);
+	free(aesw);
+}
+
+/**
+ * Set the AES key.
+ * @param aesw	[in] AES context.
+ * @param pKey	[in] Key data.
+ * @param size	[in] Size of pKey, in bytes.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int aesw_set_key(AesCtx *aesw, const uint8_t *pKey, size_t size)
+{
+	if (!aesw || !pKey || size != 16) {
+		return -EINVAL;
+	}
+
+	// Expand the key schedules once here instead of
+	// on every call to aesw_encrypt() / aesw_decrypt().
+	// The IV is set for each call, since it's stored in the AesCtx.
+	if (!EVP_EncryptInit_ex(aesw->ctx_enc, EVP_aes_128_cbc(), NULL, pKey, NULL) ||
+	    !EVP_DecryptInit_ex(aesw->ctx_dec, EVP_aes_128_cbc(), NULL, pKey, NULL))
+	{
+		return -EIO;
+	}
+	EVP_CIPHER_CTX_set_padding(aesw->ctx_enc, 0);
+	EVP_CIPHER_CTX_set_padding(aesw->ctx_dec, 0);
+
+#ifdef HAVE_AESW_HW
+	if (aesw->has_hw) {
+#if defined(HAVE_AESW_AESNI)
+		aesw_aesni_set_key(aesw->rk_enc, aesw->rk_dec, pKey);
+#elif defined(HAVE_AESW_ARMV8)
+		aesw_armv8_set_key(aesw->rk_enc, aesw->rk_dec, pKey);
+#endif
+	}
+#endif /* HAVE_AESW_HW */
+	return 0;
+}
+
+/**
+ * Set the AES IV.
+ * @param aesw	[in] AES context.
+ * @param pIV	[in] IV data.
+ * @param size	[in] Size of pIV, in bytes.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int aesw_set_iv(AesCtx *aesw, const uint8_t *pIV, size_t size)
+{
+	if (!aesw || !pIV || size != 16) {
+		return -EINVAL;
+	}
+
+	memcpy(aesw->iv, pIV, size);
+	return 0;
+}
+
+/**
+ * Encrypt or decrypt a block of data in place using AES-128-CBC.
+ * @param ctx	[in] Cipher context. (key must be set)
+ * @param iv	[in] IV.
+ * @param pData	[in/out] Data block.
+ * @param size	[in] Length of data block. (Must be a multiple of 16.)
+ * @return 0 on success; non-zero on error.
+ */
+static int aesw_cbc_crypt(EVP_CIPHER_CTX *ctx, const uint8_t *iv, uint8_t *pData, size_t size)
+{
+	if (!EVP_CipherInit_ex(ctx, NULL, NULL, NULL, iv, -1)) {
+		return -1;
+	}
+
+	// EVP_CipherUpdate() takes an int length.
+	while (size > 0) {
+		const int chunk = (size > (INT_MAX & ~15) ? (INT_MAX & ~15) : (int)size);
+		int outl = 0;
+		if (!EVP_CipherUpdate(ctx, pData, &outl, pData, chunk) || outl != chunk) {
+			return -1;
+		}
+		pData += chunk;
+		size -= chunk;
+	}
+	return 0;
+}
+
+/**
+ * Encrypt a block of data using the current parameters.
+ * @param aesw	[in] AES context.
+ * @param pData	[in/out] Data block.
+ * @param size	[in] Length of data block. (Must be a multiple of 16.)
+ * @return Number of bytes encrypted on success; 0 on error.
+ */
+size_t aesw_encrypt(AesCtx *aesw, uint8_t *pData, size_t size)
+{
+	if (!aesw || !pData || (size % 16 != 0)) {
+		// Invalid parameters.
+		errno = EINVAL;
+		return 0;
+	} else if (size == 0) {
+		return 0;
+	}
+
+	if (aesw_cbc_crypt(aesw->ctx_enc, aesw->iv, pData, size) != 0) {
+		errno = EIO;
+		return 0;
+	}
+
+	// Next IV is the last ciphertext block.
+	memcpy(aesw->iv, &pData[size - 16], sizeof(aesw->iv));
+	return size;
+}
+
+/**
+ * Decrypt a block of data using the current parameters.
+ * @param aesw	[in] AES context.
+ * @param pData	[in/out] Data block.
+ * @param size	[in] Length of data block. (Must be a multiple of 16.)
+ * @return Number of bytes encrypted on success; 0 on error.
+ */
+size_t aesw_decrypt(AesCtx *aesw, uint8_t *pData, size_t size)
+{
+	uint8_t next_iv[16];
+
+	if (!aesw || !pData || (size % 16 != 0)) {
+		// Invalid parameters.
+		errno = EINVAL;
+		return 0;
+	} else if (size == 0) {
+		return 0;
+	}
+
+	// Next IV is the last ciphertext block.
+	// Save it before it's decrypted in place.
+	memcpy(next_iv, &pData[size - 16], sizeof(next_iv));
+	if (aesw_cbc_crypt(aesw->ctx_dec, aesw->iv, pData, size) != 0) {
+		errno = EIO;
+		return 0;
+	}
+
+	memcpy(aesw->iv, next_iv, sizeof(aesw->iv));
+	return size;
+}
+
+/**
+ * Encrypt multiple independent blocks of data, each with its own IV.
+ * The streams are processed in lockstep if hardware acceleration
+ * is available, which is faster than encrypting them one at a time.
+ *
+ * NOTE: The context's IV is neither used nor updated.
+ *
+ * @param aesw		[in] AES context.
+ * @param ppIV		[in] IVs. (16 bytes each)
+ * @param ppData	[in/out] Data blocks. (Must not overlap.)
+ * @param size		[in] Length of each data block. (Must be a multiple of 16.)
+ * @param count		[in] Number of data blocks.
+ * @return Total number of bytes encrypted on success; 0 on error.
+ */
+size_t aesw_encrypt_multi(AesCtx *aesw, const uint8_t *const *ppIV,
+	uint8_t *const *ppData, size_t size, unsigned int count)
+{
+	unsigned int i = 0;
+
+	if (!aesw || !ppIV || !ppData || (size % 16 != 0)) {
+		// Invalid parameters.
+		errno = EINVAL;
+		return 0;
+	}
+
+#ifdef HAVE_AESW_HW
+	// Full sets of streams.
+	if (aesw->has_hw) {
+		for (; count - i >= AESW_HW_STREAMS; i += AESW_HW_STREAMS) {
+#if defined(HAVE_AESW_AESNI)
+			aesw_aesni_cbc_encrypt_x8(aesw->rk_enc, &ppIV[i], &ppData[i], size);
+#elif defined(HAVE_AESW_ARMV8)
+			aesw_armv8_cbc_encrypt_x8(aesw->rk_enc, &ppIV[i], &ppData[i], size);
+#endif
+		}
+	}
+#endif /* HAVE_AESW_HW */
+
+	// Remaining streams.
+	for (; i < count; i++) {
+		if (size > 0 && aesw_cbc_crypt(aesw->ctx_enc, ppIV[i], ppData[i], size) != 0) {
+			errno = EIO;
+			return 0;
+		}
+	}
+
+	return size * count;
+}
+
+/**
+ * Decrypt multiple independent blocks of data, each with its own IV.
+ * The streams are processed in lockstep if hardware acceleration
+ * is available, which is faster than decrypting them one at a time.
+ *
+ * NOTE: The context's IV is neither used nor updated.
+ *
+ * @param aesw		[in] AES context.
+ * @param ppIV		[in] IVs. (16 bytes each)
+ * @param ppData	[in/out] Data blocks. (Must not overlap.)
+ * @param size		[in] Length of each data block. (Must be a multiple of 16.)
+ * @param count		[in] Number of data blocks.
+ * @return Total number of bytes decrypted on success; 0 on error.
+ */
+size_t aesw_decrypt_multi(AesCtx *aesw, const uint8_t *const *ppIV,
+	uint8_t *const *ppData, size_t size, unsigned int count)
+{
+	unsigned int i;
+
+	if (!aesw || !ppIV || !ppData || (size % 16 != 0)) {
+		// Invalid parameters.
+		errno = EINVAL;
+		return 0;
+	}
+
+	// NOTE: OpenSSL's CBC decryption already processes
+	// multiple blocks of a single stream in parallel.
+	for (i = 0; i < count; i++) {
+		if (size > 0 && aesw_cbc_crypt(aesw->ctx_dec, ppIV[i], ppData[i], size) != 0) {
+			errno = EIO;
+			return 0;
+		}
+	}
+
+	return size * count;
+}
+
+// Chunk size for aesw_decrypt_sha1().
+// Small enough that the decrypted chunk is still in L1 when it's hashed.
+#define DECRYPT_SHA1_CHUNK_SIZE (8U * 1024U)
+
+/**
+ * Decrypt a block of data using the current parameters
+ * and update a SHA-1 hash with the decrypted data.
+ *
+ * The data is decrypted and hashed in small chunks, so each chunk
+ * is hashed while it's still in cache instead of decrypting the
+ * whole block first and then reading it again to hash it.
+ *
+ * @param aesw		[in] AES context.
+ * @param sha1		[in/out] SHA-1 context. (nettle)
+ * @param pData		[in/out] Data block.
+ * @param size		[in] Length of data block. (Must be a multiple of 16.)
+ * @param hash_size	[in] Number of decrypted bytes to hash. (Must be <= size.)
+ * @return Number of bytes decrypted on success; 0 on error.
+ */
+size_t aesw_decrypt_sha1(AesCtx *aesw, struct sha1_ctx *sha1,
+	uint8_t *pData, size_t size, size_t hash_size)
+{
+	size_t pos;
+
+	if (!aesw || !sha1 || !pData || (size % 16 != 0) || hash_size > size) {
+		// Invalid parameters.
+		errno = EINVAL;
+		return 0;
+	}
+
+	for (pos = 0; pos < size; pos += DECRYPT_SHA1_CHUNK_SIZE) {
+		const size_t chunk = (size - pos < DECRYPT_SHA1_CHUNK_SIZE
+			? size - pos : DECRYPT_SHA1_CHUNK_SIZE);
+		if (aesw_decrypt(aesw, &pData[pos], chunk) != chunk) {
+			return 0;
+		}
+
+		if (pos < hash_size) {
+			const size_t hash_chunk = (hash_size - pos < chunk
+				? hash_size - pos : chunk);
+			sha1_update(sha1, hash_chunk, &pData[pos]);
+		}
+	}
+
+	return size;
+}
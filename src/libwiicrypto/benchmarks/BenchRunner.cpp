@@ -0,0 +1,256 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto/benchmarks)                                    *
+ * BenchRunner.cpp: Benchmark runner with baseline comparison.             *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "BenchRunner.hpp"
+
+// C includes (C++ namespace)
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// C++ includes
+#include <chrono>
+using std::string;
+
+BenchRunner::BenchRunner()
+	: m_filter(nullptr)
+	, m_minTime(0.5)
+	, m_tolerance(0.0)
+	, m_hasBaseline(false)
+	, m_failed(0)
+	, m_compared(0)
+	, m_missing(0)
+{ }
+
+/**
+ * Only run benchmarks whose names contain this string.
+ * @param filter Filter. (NULL for all)
+ */
+void BenchRunner::setFilter(const char *filter)
+{
+	m_filter = filter;
+}
+
+/**
+ * Set the minimum time per benchmark.
+ * @param min_time Minimum time, in seconds.
+ */
+void BenchRunner::setMinTime(double min_time)
+{
+	m_minTime = min_time;
+}
+
+/**
+ * Load a baseline from the output of a previous run.
+ * @param filename	[in] Baseline filename.
+ * @param tolerance	[in] Allowed slowdown, in percent.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int BenchRunner::loadBaseline(const TCHAR *filename, double tolerance)
+{
+	FILE *f = _tfopen(filename, _T("r"));
+	if (!f) {
+		int err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		return -err;
+	}
+
+	m_baseline.clear();
+	m_baselineParams.clear();
+
+	char buf[512];
+	while (fgets(buf, sizeof(buf), f)) {
+		buf[strcspn(buf, "\r\n")] = '\0';
+		if (buf[0] == '#') {
+			// Parameter line: "# key: value"
+			const char *const colon = strstr(buf, ": ");
+			if (buf[1] != ' ' || !colon || strchr(buf, '\t'))
+				continue;
+			m_baselineParams[string(&buf[2], colon - &buf[2])] = string(colon + 2);
+			continue;
+		}
+
+		// Benchmark line: name, iterations, ns/op, MiB/s, rel
+		// Only rel is used. Benchmarks without it aren't compared.
+		char *const tab1 = strchr(buf, '\t');
+		if (!tab1)
+			continue;
+		const char *tab = tab1;
+		for (unsigned int i = 0; i < 3 && tab; i++) {
+			tab = strchr(tab + 1, '\t');
+		}
+		if (!tab)
+			continue;
+		char *endptr;
+		const double rel = strtod(tab + 1, &endptr);
+		if (endptr == tab + 1 || rel <= 0.0)
+			continue;
+		m_baseline[string(buf, tab1 - buf)] = rel;
+	}
+	fclose(f);
+
+	m_tolerance = tolerance;
+	m_hasBaseline = true;
+	return 0;
+}
+
+/**
+ * Print the header line.
+ * @param title		[in] Benchmark suite title.
+ * @param version	[in] Output format version.
+ */
+void BenchRunner::printHeader(const char *title, int version)
+{
+	// Header lines start with '#' so they can be filtered out.
+	printf("# %s benchmark format %d\n", title, version);
+}
+
+/**
+ * Print a parameter line.
+ * @param key	[in] Key.
+ * @param value	[in] Value.
+ */
+void BenchRunner::printParam(const char *key, const char *value)
+{
+	printf("# %s: %s\n", key, value);
+
+	if (m_hasBaseline && m_paramMismatch.empty()) {
+		auto iter = m_baselineParams.find(key);
+		if (iter != m_baselineParams.end() && iter->second != value) {
+			m_paramMismatch = string(key) + ": " + value + " (baseline: " + iter->second + ')';
+		}
+	}
+}
+
+/**
+ * Print the column names.
+ * This should be printed after the header and parameters.
+ */
+void BenchRunner::printColumns(void)
+{
+	fputs("# name\titerations\tns/op\tMiB/s\trel\n", stdout);
+	fflush(stdout);
+}
+
+/**
+ * Run a benchmark and print the result.
+ *
+ * The function is called repeatedly, doubling the number of iterations
+ * each round, until a round takes at least the minimum time. The result
+ * of the last round is printed. If the function fails, "FAILED" is
+ * printed instead.
+ *
+ * @param name		[in] Benchmark name.
+ * @param bytes_per_op	[in] Bytes processed per call. (0 if not applicable)
+ * @param fn		[in] Function to benchmark. (returns 0 on success)
+ * @param ref		[in,opt] Reference benchmark name. (must be run first)
+ */
+void BenchRunner::run(const char *name, uint64_t bytes_per_op, const std::function<int()> &fn,
+	const char *ref)
+{
+	if (m_filter && !strstr(name, m_filter))
+		return;
+
+	// Warm up. This also checks that the function works.
+	int ret = fn();
+
+	uint64_t iters = 1;
+	double secs = 0.0;
+	while (ret == 0) {
+		const auto start = std::chrono::steady_clock::now();
+		for (uint64_t i = 0; i < iters && ret == 0; i++) {
+			ret = fn();
+		}
+		secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (secs >= m_minTime || iters >= (1ULL << 40))
+			break;
+		iters *= 2;
+	}
+	if (ret != 0) {
+		printf("%s\tFAILED (%d)\n", name, ret);
+		fflush(stdout);
+		m_failed++;
+		return;
+	}
+
+	const double ns_per_op = (secs * 1e9) / static_cast<double>(iters);
+	m_results[name] = ns_per_op;
+
+	// Time relative to the reference benchmark from this run.
+	double rel = 0.0;
+	if (ref) {
+		auto iter = m_results.find(ref);
+		if (iter != m_results.end()) {
+			rel = ns_per_op / iter->second;
+		}
+	}
+
+	printf("%s\t%llu\t%.1f\t", name, static_cast<unsigned long long>(iters), ns_per_op);
+	if (bytes_per_op != 0) {
+		const double mib_per_s = (static_cast<double>(bytes_per_op) * static_cast<double>(iters))
+			/ secs / (1024.0 * 1024.0);
+		printf("%.1f\t", mib_per_s);
+	} else {
+		fputs("-\t", stdout);
+	}
+	if (rel > 0.0) {
+		printf("%.4g\n", rel);
+	} else {
+		fputs("-\n", stdout);
+	}
+	fflush(stdout);
+
+	// Compare to the baseline.
+	if (!m_hasBaseline || !m_paramMismatch.empty() || rel <= 0.0)
+		return;
+	auto iter = m_baseline.find(name);
+	if (iter == m_baseline.end()) {
+		m_missing++;
+		return;
+	}
+	m_compared++;
+	const double base_rel = iter->second;
+	if (rel > base_rel * (1.0 + (m_tolerance / 100.0))) {
+		char buf[256];
+		snprintf(buf, sizeof(buf), "%s: %.4g x %s, baseline %.4g (+%.0f%%)",
+			name, rel, ref, base_rel, ((rel / base_rel) - 1.0) * 100.0);
+		m_regressions.emplace_back(buf);
+	}
+}
+
+/**
+ * Finish the run.
+ * If a baseline was loaded, the comparison results are printed.
+ * @return 0 if all benchmarks succeeded without regressions; non-zero if not.
+ */
+int BenchRunner::finish(void)
+{
+	if (m_hasBaseline) {
+		// Comparison results are printed as header lines,
+		// so the output can still be used as a baseline.
+		if (!m_paramMismatch.empty()) {
+			printf("# baseline: not compared; parameters differ: %s\n", m_paramMismatch.c_str());
+		} else {
+			printf("# baseline: %u compared, %u regressed (tolerance %.0f%%), %u not in baseline\n",
+				m_compared, static_cast<unsigned int>(m_regressions.size()),
+				m_tolerance, m_missing);
+			for (const string &s : m_regressions) {
+				printf("# REGRESSED: %s\n", s.c_str());
+			}
+		}
+	}
+	if (m_failed != 0) {
+		printf("# %u benchmark(s) FAILED\n", m_failed);
+	}
+	fflush(stdout);
+
+	return (m_failed == 0 && m_regressions.empty() ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,142 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto/benchmarks)                                    *
+ * BenchRunner.hpp: Benchmark runner with baseline comparison.             *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBWIICRYPTO_BENCHMARKS_BENCHRUNNER_HPP__
+#define __RVTHTOOL_LIBWIICRYPTO_BENCHMARKS_BENCHRUNNER_HPP__
+
+#include "tcharx.h"
+#include <stdint.h>
+
+// C++ includes
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * Benchmark runner.
+ *
+ * Each benchmark is printed as a single tab-separated line:
+ *
+ *   name	iterations	ns/op	MiB/s	rel
+ *
+ * MiB/s is "-" if the benchmark doesn't process a fixed amount of data.
+ * rel is ns/op divided by the ns/op of the benchmark's reference from
+ * the same run, e.g. the generic implementation of the same function.
+ * It's "-" if the benchmark doesn't have a reference, or if the
+ * reference wasn't run.
+ * Header lines start with '#'. Parameter lines ("# key: value") describe
+ * anything that affects the results, e.g. the AES implementation.
+ *
+ * The output of a previous run can be loaded as a baseline. Absolute
+ * timings depend on the machine, so only rel is compared: benchmarks
+ * whose rel is higher than the baseline by more than the tolerance are
+ * reported as regressions when the run is finished. The baseline is only
+ * used if all parameters that are in both the baseline and this run
+ * have the same values.
+ */
+class BenchRunner
+{
+	public:
+		BenchRunner();
+
+	public:
+		/** Options **/
+
+		/**
+		 * Only run benchmarks whose names contain this string.
+		 * @param filter Filter. (NULL for all)
+		 */
+		void setFilter(const char *filter);
+
+		/**
+		 * Set the minimum time per benchmark.
+		 * @param min_time Minimum time, in seconds.
+		 */
+		void setMinTime(double min_time);
+
+		/**
+		 * Get the minimum time per benchmark.
+		 * @return Minimum time, in seconds.
+		 */
+		double minTime(void) const { return m_minTime; }
+
+		/**
+		 * Load a baseline from the output of a previous run.
+		 * @param filename	[in] Baseline filename.
+		 * @param tolerance	[in] Allowed slowdown, in percent.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int loadBaseline(const TCHAR *filename, double tolerance);
+
+	public:
+		/** Output **/
+
+		/**
+		 * Print the header line.
+		 * @param title		[in] Benchmark suite title.
+		 * @param version	[in] Output format version.
+		 */
+		void printHeader(const char *title, int version);
+
+		/**
+		 * Print a parameter line.
+		 * @param key	[in] Key.
+		 * @param value	[in] Value.
+		 */
+		void printParam(const char *key, const char *value);
+
+		/**
+		 * Print the column names.
+		 * This should be printed after the header and parameters.
+		 */
+		void printColumns(void);
+
+		/**
+		 * Run a benchmark and print the result.
+		 *
+		 * The function is called repeatedly, doubling the number of iterations
+		 * each round, until a round takes at least the minimum time. The result
+		 * of the last round is printed. If the function fails, "FAILED" is
+		 * printed instead.
+		 *
+		 * @param name		[in] Benchmark name.
+		 * @param bytes_per_op	[in] Bytes processed per call. (0 if not applicable)
+		 * @param fn		[in] Function to benchmark. (returns 0 on success)
+		 * @param ref		[in,opt] Reference benchmark name. (must be run first)
+		 */
+		void run(const char *name, uint64_t bytes_per_op, const std::function<int()> &fn,
+			const char *ref = nullptr);
+
+		/**
+		 * Finish the run.
+		 * If a baseline was loaded, the comparison results are printed.
+		 * @return 0 if all benchmarks succeeded without regressions; non-zero if not.
+		 */
+		int finish(void);
+
+	private:
+		const char *m_filter;
+		double m_minTime;
+
+		// Baseline. (rel for each benchmark)
+		std::map<std::string, double> m_baseline;
+		std::map<std::string, std::string> m_baselineParams;
+		double m_tolerance;
+		bool m_hasBaseline;
+		std::string m_paramMismatch;	// First parameter that doesn't match the baseline
+
+		// Results.
+		std::map<std::string, double> m_results;	// ns/op for each benchmark
+		unsigned int m_failed;		// Benchmarks that failed
+		unsigned int m_compared;	// Benchmarks compared to the baseline
+		unsigned int m_missing;		// Benchmarks that aren't in the baseline
+		std::vector<std::string> m_regressions;	// Regression descriptions
+};
+
+#endif /* __RVTHTOOL_LIBWIICRYPTO_BENCHMARKS_BENCHRUNNER_HPP__ */
@@ -0,0 +1,382 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto/benchmarks)                                    *
+ * CryptoBenchmark.cpp: libwiicrypto microbenchmarks.                      *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "BenchRunner.hpp"
+
+#include "libwiicrypto/aesw.h"
+#include "libwiicrypto/byteswap.h"
+#include "libwiicrypto/cert.h"
+#include "libwiicrypto/cert_store.h"
+#include "libwiicrypto/crc32w.h"
+#include "libwiicrypto/rsaw.h"
+#include "libwiicrypto/sha1w.h"
+#include "libwiicrypto/wii_hash_tree.h"
+#include "libwiicrypto/wii_structs.h"
+
+// C includes. (C++ namespace)
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// C++ includes.
+#include <memory>
+#include <vector>
+using std::unique_ptr;
+using std::vector;
+
+// Output format version.
+// Increment this if the output format changes.
+#define BENCH_FORMAT_VERSION 2
+
+// Reference for benchmarks that don't have a generic implementation.
+// This is the portable SHA-1 implementation, so it only depends on
+// the speed of the machine.
+static const char REF_GENERIC[] = "sha1w_hash/1KB/generic";
+
+/**
+ * Fill a buffer with a test pattern.
+ * @param buf	[out] Buffer.
+ * @param size	[in] Size of buf.
+ */
+static void fill_pattern(uint8_t *buf, size_t size)
+{
+	for (size_t i = 0; i < size; i++) {
+		buf[i] = static_cast<uint8_t>((i * 151) ^ (i >> 7));
+	}
+}
+
+/**
+ * AES-128-CBC benchmarks.
+ * @param runner	[in] Benchmark runner.
+ */
+static void bench_aes(BenchRunner &runner)
+{
+	static const uint8_t key[16] = {
+		0x00,0x11,0x22,0x33,0x44,0x55,0x66,0x77,
+		0x88,0x99,0xAA,0xBB,0xCC,0xDD,0xEE,0xFF
+	};
+	static const uint8_t iv[16] = {0};
+
+	AesCtx *const aesw = aesw_new();
+	if (!aesw) {
+		fputs("*** ERROR: aesw_new() failed.\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+	aesw_set_key(aesw, key, sizeof(key));
+
+	static const size_t sizes[] = {SECTOR_SIZE_DEC, 1024};
+	static const char *const enc_names[] = {"aesw_encrypt/31KB", "aesw_encrypt/1KB"};
+	static const char *const dec_names[] = {"aesw_decrypt/31KB", "aesw_decrypt/1KB"};
+	vector<uint8_t> buf(SECTOR_SIZE_DEC);
+	fill_pattern(buf.data(), buf.size());
+
+	for (size_t i = 0; i < ARRAY_SIZE(sizes); i++) {
+		const size_t size = sizes[i];
+		runner.run(enc_names[i], size, [&]() -> int {
+			aesw_set_iv(aesw, iv, sizeof(iv));
+			aesw_encrypt(aesw, buf.data(), size);
+			return 0;
+		}, REF_GENERIC);
+		runner.run(dec_names[i], size, [&]() -> int {
+			aesw_set_iv(aesw, iv, sizeof(iv));
+			aesw_decrypt(aesw, buf.data(), size);
+			return 0;
+		}, REF_GENERIC);
+	}
+
+	aesw_free(aesw);
+}
+
+/**
+ * SHA-1 benchmarks.
+ * The generic implementation is run first as the reference.
+ * @param runner	[in] Benchmark runner.
+ */
+static void bench_sha1(BenchRunner &runner)
+{
+	vector<uint8_t> buf(SECTOR_SIZE_DEC);
+	fill_pattern(buf.data(), buf.size());
+	uint8_t digests[31][SHA1W_DIGEST_SIZE];
+
+	static const char *const hash_names[] = {"sha1w_hash/1KB/generic", "sha1w_hash/1KB"};
+	static const char *const strided_names[] = {"sha1w_hash_strided/31x1KB/generic", "sha1w_hash_strided/31x1KB"};
+	for (unsigned int i = 0; i < 2; i++) {
+		sha1w_set_impl(i == 0 ? SHA1W_IMPL_NETTLE : SHA1W_IMPL_AUTO);
+
+		runner.run(hash_names[i], 1024, [&]() -> int {
+			sha1w_hash(buf.data(), 1024, digests[0]);
+			return 0;
+		}, (i == 0 ? nullptr : hash_names[0]));
+
+		// H0 hashes for one sector.
+		runner.run(strided_names[i], SECTOR_SIZE_DEC, [&]() -> int {
+			sha1w_hash_strided(buf.data(), 1024, 1024, 31, digests[0]);
+			return 0;
+		}, (i == 0 ? REF_GENERIC : strided_names[0]));
+	}
+}
+
+/**
+ * CRC32 benchmarks.
+ * The generic implementation is run first as the reference.
+ * @param runner	[in] Benchmark runner.
+ */
+static void bench_crc32(BenchRunner &runner)
+{
+	vector<uint8_t> buf(2*1024*1024);
+	fill_pattern(buf.data(), buf.size());
+	uint32_t crc = 0;
+
+	// Same size as a Wii disc group.
+	static const char *const update_names[] = {"crc32w_update/2MB/generic", "crc32w_update/2MB"};
+	for (unsigned int i = 0; i < 2; i++) {
+		crc32w_set_impl(i == 0 ? CRC32W_IMPL_SOFTWARE : CRC32W_IMPL_AUTO);
+		runner.run(update_names[i], buf.size(), [&]() -> int {
+			crc = crc32w_update(crc, buf.data(), buf.size());
+			return 0;
+		}, (i == 0 ? REF_GENERIC : update_names[0]));
+	}
+
+	runner.run("crc32w_combine/2MB", 0, [&]() -> int {
+		crc = crc32w_combine(crc, 0x12345678, buf.size());
+		return 0;
+	}, REF_GENERIC);
+}
+
+/**
+ * Wii disc group encryption benchmark.
+ * This is the same sequence as librvth's rvth_encrypt_group()
+ * for a group that isn't zeroed: build the hash tree, then
+ * encrypt the hashes and user data for all 64 sectors.
+ * @param runner	[in] Benchmark runner.
+ */
+static void bench_encrypt_group(BenchRunner &runner)
+{
+	static const uint8_t key[16] = {
+		0xFF,0xEE,0xDD,0xCC,0xBB,0xAA,0x99,0x88,
+		0x77,0x66,0x55,0x44,0x33,0x22,0x11,0x00
+	};
+	static const uint8_t zero_iv[16] = {0};
+
+	AesCtx *const aesw = aesw_new();
+	if (!aesw) {
+		fputs("*** ERROR: aesw_new() failed.\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+	aesw_set_key(aesw, key, sizeof(key));
+
+	vector<uint8_t> dec(GROUP_SIZE_DEC);
+	fill_pattern(dec.data(), dec.size());
+	unique_ptr<Wii_Disc_Sector_t[]> sbuf(new Wii_Disc_Sector_t[WII_HASH_TREE_SECTORS_PER_GROUP]);
+
+	runner.run("encrypt_group/2MB", GROUP_SIZE_ENC, [&]() -> int {
+		const uint8_t *pIn = dec.data();
+		for (unsigned int i = 0; i < WII_HASH_TREE_SECTORS_PER_GROUP; i++, pIn += SECTOR_SIZE_DEC) {
+			memcpy(sbuf[i].data, pIn, SECTOR_SIZE_DEC);
+		}
+
+		uint8_t H3[RVL_SHA1_DIGEST_SIZE];
+		wii_hash_tree_build_group(sbuf.get(), H3);
+
+		// Encrypt the hashes. (IV == 0)
+		const uint8_t *pIV[WII_HASH_TREE_SECTORS_PER_GROUP];
+		uint8_t *pData[WII_HASH_TREE_SECTORS_PER_GROUP];
+		for (unsigned int i = 0; i < WII_HASH_TREE_SECTORS_PER_GROUP; i++) {
+			pIV[i] = zero_iv;
+			pData[i] = reinterpret_cast<uint8_t*>(&sbuf[i].hashes);
+		}
+		aesw_encrypt_multi(aesw, pIV, pData, sizeof(sbuf[0].hashes), WII_HASH_TREE_SECTORS_PER_GROUP);
+
+		// Encrypt the user data. (IV is from the encrypted H2 table.)
+		for (unsigned int i = 0; i < WII_HASH_TREE_SECTORS_PER_GROUP; i++) {
+			pIV[i] = &sbuf[i].hashes.H2[7][4];
+			pData[i] = sbuf[i].data;
+		}
+		aesw_encrypt_multi(aesw, pIV, pData, sizeof(sbuf[0].data), WII_HASH_TREE_SECTORS_PER_GROUP);
+		return 0;
+	}, REF_GENERIC);
+
+	aesw_free(aesw);
+}
+
+/**
+ * Certificate verification benchmarks.
+ *
+ * cert_verify() caches results, so the last byte of a copy of the
+ * certificate is changed on every call. The signature check fails,
+ * but the full RSA operation is still done.
+ *
+ * @param runner	[in] Benchmark runner.
+ */
+static void bench_cert_verify(BenchRunner &runner)
+{
+	// Some certificates are shared by multiple platforms.
+	// Only benchmark each issuer name once.
+	vector<const char*> done;
+
+	for (int issuer = RVL_CERT_ISSUER_UNKNOWN + 1; issuer < RVL_CERT_ISSUER_MAX; issuer++) {
+		const RVL_Cert_Issuer cert_id = static_cast<RVL_Cert_Issuer>(issuer);
+		const RVL_Cert *const cert = cert_get(cert_id);
+		const unsigned int cert_size = cert_get_size(cert_id);
+		if (!cert || cert_size == 0)
+			continue;
+
+		// Root certificates can't be verified.
+		const uint8_t *const cert_u8 = reinterpret_cast<const uint8_t*>(cert);
+		if (cert_verify(cert_u8, cert_size) < 0)
+			continue;
+
+		const char *const s_issuer = RVL_Cert_Issuers[cert_id];
+		bool dup = false;
+		for (const char *s : done) {
+			if (!strcmp(s, s_issuer)) {
+				dup = true;
+				break;
+			}
+		}
+		if (dup)
+			continue;
+		done.push_back(s_issuer);
+
+		char name[128];
+		snprintf(name, sizeof(name), "cert_verify/%s", s_issuer);
+
+		vector<uint8_t> copy(cert_u8, cert_u8 + cert_size);
+		uint8_t counter = 0;
+		runner.run(name, 0, [&]() -> int {
+			copy[cert_size - 1] = cert_u8[cert_size - 1] ^ ++counter;
+			if (counter == 0) {
+				// Don't verify the original certificate.
+				copy[cert_size - 2] ^= 0x01;
+			}
+			cert_verify(copy.data(), copy.size());
+			return 0;
+		}, REF_GENERIC);
+	}
+}
+
+/**
+ * Fakesigning benchmarks.
+ *
+ * The number of SHA-1 attempts needed to fakesign varies, so the
+ * title ID is changed on every call to average it out.
+ *
+ * @param runner	[in] Benchmark runner.
+ */
+static void bench_fakesign(BenchRunner &runner)
+{
+	const char *const s_issuer_xs = RVL_Cert_Issuers[RVL_CERT_ISSUER_DPKI_TICKET];
+	const char *const s_issuer_cp = RVL_Cert_Issuers[RVL_CERT_ISSUER_DPKI_TMD];
+
+	RVL_Ticket ticket;
+	memset(&ticket, 0, sizeof(ticket));
+	ticket.signature_type = cpu_to_be32(RVL_CERT_SIGTYPE_RSA2048_SHA1);
+	strncpy(ticket.issuer, s_issuer_xs, sizeof(ticket.issuer)-1);
+	uint32_t ticket_tid = 0;
+	runner.run("cert_fakesign_ticket", 0, [&]() -> int {
+		ticket.title_id.lo = cpu_to_be32(++ticket_tid);
+		cert_fakesign_ticket(reinterpret_cast<uint8_t*>(&ticket), sizeof(ticket));
+		return 0;
+	}, REF_GENERIC);
+
+	RVL_TMD_Header tmd;
+	memset(&tmd, 0, sizeof(tmd));
+	tmd.signature_type = cpu_to_be32(RVL_CERT_SIGTYPE_RSA2048_SHA1);
+	strncpy(tmd.issuer, s_issuer_cp, sizeof(tmd.issuer)-1);
+	uint32_t tmd_tid = 0;
+	runner.run("cert_fakesign_tmd", 0, [&]() -> int {
+		tmd.title_id.lo = cpu_to_be32(++tmd_tid);
+		cert_fakesign_tmd(reinterpret_cast<uint8_t*>(&tmd), sizeof(tmd));
+		return 0;
+	}, REF_GENERIC);
+}
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Print usage information.
+ * @param argv0 Program name.
+ */
+static void print_help(const TCHAR *argv0)
+{
+	_ftprintf(stderr, _T("Usage: %s [options] [filter]\n")
+		_T("\n")
+		_T("Options:\n")
+		_T("  --min-time=SECONDS   Minimum time per benchmark. (default: 0.5)\n")
+		_T("  --baseline=FILE      Compare the results to the output of a previous run.\n")
+		_T("  --tolerance=PERCENT  Allowed slowdown compared to the baseline. (default: 25)\n")
+		_T("                       Times relative to the reference benchmarks are compared.\n")
+		_T("\n")
+		_T("Only benchmarks whose names contain the filter are run.\n"), argv0);
+}
+
+int RVTH_CDECL _tmain(int argc, TCHAR *argv[])
+{
+	BenchRunner runner;
+	const TCHAR *baseline = nullptr;
+	double tolerance = 25.0;
+	static char filter_buf[256];
+
+	for (int i = 1; i < argc; i++) {
+		const TCHAR *const arg = argv[i];
+		if (!_tcsncmp(arg, _T("--min-time="), 11)) {
+			runner.setMinTime(_tcstod(&arg[11], nullptr));
+		} else if (!_tcsncmp(arg, _T("--baseline="), 11)) {
+			baseline = &arg[11];
+		} else if (!_tcsncmp(arg, _T("--tolerance="), 12)) {
+			tolerance = _tcstod(&arg[12], nullptr);
+		} else if (!_tcscmp(arg, _T("--help")) || !_tcscmp(arg, _T("-h"))) {
+			print_help(argv[0]);
+			return EXIT_SUCCESS;
+		} else if (arg[0] == _T('-')) {
+			print_help(argv[0]);
+			return EXIT_FAILURE;
+		} else {
+			// Benchmark names are ASCII.
+			size_t j;
+			for (j = 0; arg[j] != 0 && j < sizeof(filter_buf) - 1; j++) {
+				filter_buf[j] = static_cast<char>(arg[j]);
+			}
+			filter_buf[j] = '\0';
+			runner.setFilter(filter_buf);
+		}
+	}
+	if (tolerance < 0.0 || runner.minTime() <= 0.0) {
+		print_help(argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (baseline) {
+		const int ret = runner.loadBaseline(baseline, tolerance);
+		if (ret != 0) {
+			_ftprintf(stderr, _T("*** ERROR: Unable to load baseline %s: "), baseline);
+			fprintf(stderr, "%s\n", strerror(-ret));
+			return EXIT_FAILURE;
+		}
+	}
+
+	runner.printHeader("libwiicrypto", BENCH_FORMAT_VERSION);
+	runner.printParam("aes", aesw_get_impl_name());
+	runner.printParam("sha1", sha1w_get_impl_name());
+	runner.printParam("crc32", crc32w_get_impl_name());
+	runner.printParam("rsa", rsaw_get_impl_name());
+	runner.printColumns();
+
+	// SHA-1 is first, since its generic implementation is
+	// the reference for most of the other benchmarks.
+	bench_sha1(runner);
+	bench_aes(runner);
+	bench_crc32(runner);
+	bench_encrypt_group(runner);
+	bench_cert_verify(runner);
+	bench_fakesign(runner);
+	return runner.finish();
+}
@@ -2,7 +2,7 @@
  * RVT-H Tool (libwiicrypto)                                               *
  * cert.c: Certificate management.                                         *
  *                                                                         *
- * Copyright (c) 2018-2022 by David Korth.                                 *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
@@ -16,13 +16,17 @@
 #include <assert.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 // RSA and hash functions
 #include "rsaw.h"
+#include "sha1w.h"
 #include <nettle/sha1.h>
 #include <nettle/sha2.h>
 
+#include "static_mutex.h"
+
 /**
  * The signature is stored in PKCS #1 format.
  * References:
@@ -54,16 +58,97 @@ static const uint8_t pkcs1_der_sha256[19] = {
 	0x00,0x04,0x20
 };
 
+/**
+ * Signature verification cache.
+ *
+ * An RVT-H Reader with multiple banks of the same PKI verifies the same
+ * tickets and TMDs over and over, e.g. when re-initializing bank entries
+ * or when multiple banks contain the same title. Verifying an RSA-2048
+ * or RSA-4096 signature is expensive, so results are memoized.
+ *
+ * The key is the SHA-1 of the entire signed object, *including* the
+ * signature, along with its size. The issuer certificate is selected by
+ * the issuer name within the signed object, so it's covered by the hash.
+ *
+ * Only results that required the RSA operation are cached.
+ * Errors that are detected before that (unsupported signature type,
+ * unknown issuer) are cheap and set errno, so they aren't cached.
+ */
+#define CERT_VERIFY_CACHE_SIZE 64
+typedef struct _CertVerifyCacheEntry {
+	uint8_t digest[SHA1_DIGEST_SIZE];	// SHA-1 of the signed object
+	uint32_t size;				// Size of the signed object
+	int ret;				// cert_verify() return value
+} CertVerifyCacheEntry;
+
+static CertVerifyCacheEntry cert_verify_cache[CERT_VERIFY_CACHE_SIZE];
+static unsigned int cert_verify_cache_count = 0;	// Number of valid entries
+static unsigned int cert_verify_cache_next = 0;		// Next entry to replace
+
+STATIC_MUTEX(cert_verify_cache_lock);
+
+/**
+ * Look up a signed object in the signature verification cache.
+ * @param digest	[in] SHA-1 of the signed object.
+ * @param size		[in] Size of the signed object.
+ * @param pRet		[out] Cached cert_verify() return value.
+ * @return True if found; false if not.
+ */
+static bool cert_verify_cache_lookup(const uint8_t *digest, size_t size, int *pRet)
+{
+	bool found = false;
+	unsigned int i;
+
+	STATIC_MUTEX_LOCK(cert_verify_cache_lock);
+	for (i = 0; i < cert_verify_cache_count; i++) {
+		const CertVerifyCacheEntry *const entry = &cert_verify_cache[i];
+		if (entry->size == size && !memcmp(entry->digest, digest, SHA1_DIGEST_SIZE)) {
+			*pRet = entry->ret;
+			found = true;
+			break;
+		}
+	}
+	STATIC_MUTEX_UNLOCK(cert_verify_cache_lock);
+	return found;
+}
+
+/**
+ * Store a result in the signature verification cache.
+ * If the cache is full, the oldest entry is replaced.
+ * @param digest	[in] SHA-1 of the signed object.
+ * @param size		[in] Size of the signed object.
+ * @param ret		[in] cert_verify() return value.
+ */
+static void cert_verify_cache_store(const uint8_t *digest, size_t size, int ret)
+{
+	CertVerifyCacheEntry *entry;
+
+	STATIC_MUTEX_LOCK(cert_verify_cache_lock);
+	entry = &cert_verify_cache[cert_verify_cache_next];
+	memcpy(entry->digest, digest, SHA1_DIGEST_SIZE);
+	entry->size = (uint32_t)size;
+	entry->ret = ret;
+
+	cert_verify_cache_next = (cert_verify_cache_next + 1) % CERT_VERIFY_CACHE_SIZE;
+	if (cert_verify_cache_count < CERT_VERIFY_CACHE_SIZE) {
+		cert_verify_cache_count++;
+	}
+	STATIC_MUTEX_UNLOCK(cert_verify_cache_lock);
+}
+
 /**
  * Verify a ticket or TMD. (internal function)
  *
- * @param issuer_cert Certificate to verify against.
+ * @param issuer Issuer of the certificate to verify against.
  * @param data Data to verify.
  * @param size Size of data.
  * @return Signature status. (Sig_Status if positive; if negative, POSIX error code.)
  */
-static int cert_verify_int(const RVL_Cert *issuer_cert, const uint8_t *data, size_t size)
+static int cert_verify_int(RVL_Cert_Issuer issuer, const uint8_t *data, size_t size)
 {
+	const RVL_Cert *issuer_cert;	// Certificate to verify against.
+	const RsawPubKey *issuer_key;	// Prepared public key.
+
 	// Signature (pointer into `data`)
 	const RVL_Cert *verify_cert;	// Certificate to verify.
 	const uint8_t *sig;
@@ -95,6 +180,12 @@ static int cert_verify_int(const RVL_Cert *issuer_cert, const uint8_t *data, siz
 	const uint8_t *der_data;
 	size_t der_size;
 
+	issuer_cert = cert_get(issuer);
+	assert(issuer_cert != NULL);
+	if (!issuer_cert) {
+		return -EIO;
+	}
+
 	// Determine the signature length.
 	verify_cert = (const RVL_Cert*)data;
 	sig = &data[4];
@@ -178,7 +269,13 @@ static int cert_verify_int(const RVL_Cert *issuer_cert, const uint8_t *data, siz
 	}
 
 	// Decrypt the signature.
-	tmp_ret = rsaw_decrypt_signature(buf, pubkey_mod, pubkey_exp, sig, sig_len);
+	// The issuer's public key is imported once and cached by cert_store.
+	issuer_key = cert_get_pubkey(issuer);
+	if (issuer_key) {
+		tmp_ret = rsaw_decrypt_signature_with_key(buf, issuer_key, sig, sig_len);
+	} else {
+		tmp_ret = rsaw_decrypt_signature(buf, pubkey_mod, pubkey_exp, sig, sig_len);
+	}
 	if (tmp_ret != 0) {
 		// Unable to decrypt the signature.
 		if (tmp_ret == ENOSPC) {
@@ -301,21 +398,12 @@ static int cert_verify_int(const RVL_Cert *issuer_cert, const uint8_t *data, siz
 }
 
 /**
- * Verify a ticket or TMD.
- *
- * Both structs have the same initial layout:
- * - Signature type
- * - Signature
- * - Issuer
- *
- * Both Signature and Issuer are padded for 64-byte alignment.
- * The Signature covers Issuer and everything up to `size`.
- *
+ * Verify a ticket or TMD without using the cache. (internal function)
  * @param data Data to verify.
  * @param size Size of data.
  * @return Signature status. (Sig_Status if positive; if negative, POSIX error code.)
  */
-int cert_verify(const uint8_t *data, size_t size)
+static int cert_verify_uncached(const uint8_t *data, size_t size)
 {
 	// Signature (pointer into `data`)
 	const RVL_Cert *verify_cert;	// Certificate to verify.
@@ -359,44 +447,123 @@ int cert_verify(const uint8_t *data, size_t size)
 	// the Root keys for both PKIs aren't public.
 	if (!strncmp(s_issuer, "Root", 5)) {
 		// Try dpki first.
-		const RVL_Cert *issuer_cert = cert_get(RVL_CERT_ISSUER_DPKI_ROOT);
-		assert(issuer_cert != NULL);
-		if (!issuer_cert) {
-			return -EIO;
-		}
-		ret = cert_verify_int(issuer_cert, data, size);
+		ret = cert_verify_int(RVL_CERT_ISSUER_DPKI_ROOT, data, size);
 		if (ret < 0) {
 			return ret;
 		}
 		if (ret != SIG_STATUS_OK) {
 			// Signature is not valid. Try ppki.
-			issuer_cert = cert_get(RVL_CERT_ISSUER_PPKI_ROOT);
-			assert(issuer_cert != NULL);
-			if (!issuer_cert) {
-				return -EIO;
-			}
-			ret = cert_verify_int(issuer_cert, data, size);
+			ret = cert_verify_int(RVL_CERT_ISSUER_PPKI_ROOT, data, size);
 		}
 	} else {
-		const RVL_Cert *issuer_cert;
-
 		RVL_Cert_Issuer issuer = cert_get_issuer_from_name(s_issuer);
 		if (issuer == RVL_CERT_ISSUER_UNKNOWN) {
 			// Unknown issuer.
 			errno = EINVAL;
 			return SIG_ERROR_UNKNOWN_ISSUER;
 		}
-		issuer_cert = cert_get(issuer);
-		assert(issuer_cert != NULL);
-		if (!issuer_cert) {
-			return -EIO;
-		}
-		ret = cert_verify_int(issuer_cert, data, size);
+		ret = cert_verify_int(issuer, data, size);
 	}
 
 	return ret;
 }
 
+/**
+ * Verify a ticket or TMD.
+ *
+ * Both structs have the same initial layout:
+ * - Signature type
+ * - Signature
+ * - Issuer
+ *
+ * Both Signature and Issuer are padded for 64-byte alignment.
+ * The Signature covers Issuer and everything up to `size`.
+ *
+ * Results are cached, so verifying the same object again
+ * doesn't redo the RSA operation.
+ *
+ * @param data Data to verify.
+ * @param size Size of data.
+ * @return Signature status. (Sig_Status if positive; if negative, POSIX error code.)
+ */
+int cert_verify(const uint8_t *data, size_t size)
+{
+	uint8_t digest[SHA1_DIGEST_SIZE];
+	int ret;
+
+	if (!data || size <= 4) {
+		// Invalid parameters.
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	// Check the cache first.
+	sha1w_hash(data, size, digest);
+	if (cert_verify_cache_lookup(digest, size, &ret)) {
+		return ret;
+	}
+
+	ret = cert_verify_uncached(data, size);
+	if (ret == SIG_STATUS_OK || (ret > 0 && (ret & SIG_ERROR_MASK) == SIG_ERROR_INVALID)) {
+		// The RSA operation was performed. Cache the result.
+		cert_verify_cache_store(digest, size, ret);
+	}
+	return ret;
+}
+
+/**
+ * Brute-force a fakesignature. (internal function)
+ *
+ * The 32-bit value at `fake_offset` is incremented until the SHA-1
+ * of the signed area starts with 0x00. The signed area starts at the
+ * issuer field, which is at `signing_offset`.
+ *
+ * Everything before the modified field is the same for all candidates,
+ * so the SHA-1 context for that part is calculated once and copied for
+ * each candidate. Only the rest of the data is hashed per candidate.
+ *
+ * NOTE: On average, only 256 candidates are needed, so the remaining
+ * work is small enough that using multiple threads wouldn't help.
+ *
+ * NOTE 2: Brute-forcing is done using HOST-endian.
+ *
+ * @param data		[in/out] Ticket or TMD.
+ * @param size		[in] Size of data.
+ * @param signing_offset [in] Start of the signed area.
+ * @param fake_offset	[in] Offset of the 32-bit value to modify.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int cert_fakesign_int(uint8_t *data, size_t size,
+	size_t signing_offset, size_t fake_offset)
+{
+	struct sha1_ctx sha1_base, sha1;
+	uint8_t digest[SHA1_DIGEST_SIZE];
+	uint32_t fake = 0;
+
+	assert(signing_offset <= fake_offset);
+	assert(fake_offset + sizeof(fake) <= size);
+
+	// Hash everything up to the modified field.
+	sha1_init(&sha1_base);
+	sha1_update(&sha1_base, fake_offset - signing_offset, &data[signing_offset]);
+
+	do {
+		// Calculate the SHA-1 of the rest of the data.
+		// If the first byte is 0, we're done.
+		memcpy(&data[fake_offset], &fake, sizeof(fake));
+		sha1 = sha1_base;
+		sha1_update(&sha1, size - fake_offset, &data[fake_offset]);
+		sha1_digest(&sha1, sizeof(digest), digest);
+		if (digest[0] == 0) {
+			return 0;
+		}
+	} while (++fake != 0);
+
+	// No candidate worked.
+	errno = EIO;
+	return -EIO;
+}
+
 /**
  * Fakesign a ticket.
  *
@@ -409,12 +576,9 @@ int cert_verify(const uint8_t *data, size_t size)
  */
 int cert_fakesign_ticket(uint8_t *ticket_u8, size_t size)
 {
-	struct sha1_ctx sha1;
-	uint8_t digest[SHA1_DIGEST_SIZE];
-	uint32_t *fake;
 	RVL_Ticket *const ticket = (RVL_Ticket*)ticket_u8;
 
-	if (!ticket) {
+	if (!ticket || size < sizeof(RVL_Ticket)) {
 		errno = EINVAL;
 		return -EINVAL;
 	}
@@ -433,20 +597,8 @@ int cert_fakesign_ticket(uint8_t *ticket_u8, size_t size)
 	// This area is part of the content access permissions.
 	// Disc partitions only have one content, so the rest is unused.
 	// (Wiimm's ISO Tools uses 0x24C.)
-	// NOTE: Brute-forcing is done using HOST-endian.
-	fake = (uint32_t*)&ticket->content_access_perm[0x3A];
-	*fake = 0;
-	sha1_init(&sha1);
-	do {
-		// Calculate the SHA-1 of the ticket.
-		// If the first byte is 0, we're done.
-		static const size_t signing_offset = offsetof(RVL_Ticket, issuer);
-		sha1_update(&sha1, size - signing_offset, (const uint8_t*)(&ticket_u8[signing_offset]));
-		sha1_digest(&sha1, sizeof(digest), digest);
-	} while (digest[0] != 0 && ++(*fake) != 0);
-
-	// TODO: If the first byte of the hash is not 0, failed.
-	return 0;
+	return cert_fakesign_int(ticket_u8, size, offsetof(RVL_Ticket, issuer),
+		offsetof(RVL_Ticket, content_access_perm) + 0x3A);
 }
 
 /**
@@ -461,10 +613,7 @@ int cert_fakesign_ticket(uint8_t *ticket_u8, size_t size)
  */
 int cert_fakesign_tmd(uint8_t *tmd, size_t size)
 {
-	struct sha1_ctx sha1;
-	uint8_t digest[SHA1_DIGEST_SIZE];
 	RVL_TMD_Header *const tmdHeader = (RVL_TMD_Header*)tmd;
-	uint32_t *fake;
 
 	if (!tmd || size < sizeof(RVL_TMD_Header)) {
 		errno = EINVAL;
@@ -484,42 +633,22 @@ int cert_fakesign_tmd(uint8_t *tmd, size_t size)
 	// Using 0x19C for brute-forcing the SHA-1 hash.
 	// This area is "reserved" and is otherwise unused.
 	// (Wiimm's ISO Tools uses 0x19A.)
-	// NOTE: Brute-forcing is done using HOST-endian.
-	fake = (uint32_t*)&tmdHeader->reserved[2];
-	*fake = 0;
-	sha1_init(&sha1);
-	do {
-		// Calculate the SHA-1 of the TMD.
-		// If the first byte is 0, we're done.
-		sha1_update(&sha1, size - offsetof(RVL_TMD_Header, issuer),
-			&tmd[offsetof(RVL_TMD_Header, issuer)]);
-		sha1_digest(&sha1, sizeof(digest), digest);
-	} while (digest[0] != 0 && ++(*fake) != 0);
-
-	// TODO: If the first byte of the hash is not 0, failed.
-	return 0;
+	return cert_fakesign_int(tmd, size, offsetof(RVL_TMD_Header, issuer),
+		offsetof(RVL_TMD_Header, reserved) + 2);
 }
 
 /**
- * Sign a ticket or TMD with real encryption keys.
- *
- * NOTE: If changing the encryption type, the issuer must be
- * updated *before* calling this function.
- *
- * NOTE 2: For Wii, the full TMD must be signed.
- * For Wii U, only the TMD header is signed.
- *
- * @param data		[in/out] Ticket or TMD to fakesign.
+ * Hash a ticket or TMD for real signing. (internal function)
+ * The signature padding is cleared.
+ * @param data		[in/out] Ticket or TMD to sign.
  * @param size		[in] Size of ticket or TMD.
- * @param key		[in] RSA-2048 private key.
+ * @param hash		[out] Hash. (SHA256_DIGEST_SIZE bytes)
+ * @param pDoSHA256	[out] True if SHA-256; false if SHA-1.
  * @return 0 on success; negative POSIX error code on error.
  */
-int cert_realsign_ticketOrTMD(uint8_t *data, size_t size, const RSA2048PrivateKey *key)
+static int cert_realsign_hash(uint8_t *data, size_t size, uint8_t *hash, bool *pDoSHA256)
 {
-	uint8_t hash[SHA256_DIGEST_SIZE];
-	size_t hash_size;
 	RVL_Sig_RSA2048 *const sig = (RVL_Sig_RSA2048*)data;
-	bool doSHA256;
 
 	// Signature is in the first 0x140 bytes.
 	if (!data || size < 0x140) {
@@ -530,10 +659,10 @@ int cert_realsign_ticketOrTMD(uint8_t *data, size_t size, const RSA2048PrivateKe
 	// Determine the algorithm to use.
 	switch (be32_to_cpu(sig->type)) {
 		case RVL_CERT_SIGTYPE_RSA2048_SHA1:
-			doSHA256 = false;
+			*pDoSHA256 = false;
 			break;
 		case WUP_CERT_SIGTYPE_RSA2048_SHA256:
-			doSHA256 = true;
+			*pDoSHA256 = true;
 			break;
 		default:
 			// Not supported.
@@ -544,10 +673,9 @@ int cert_realsign_ticketOrTMD(uint8_t *data, size_t size, const RSA2048PrivateKe
 	// Zero out the padding.
 	memset(sig->padding, 0, sizeof(sig->padding));
 
-	if (!doSHA256) {
+	if (!*pDoSHA256) {
 		// Calculate the SHA-1 hash.
 		struct sha1_ctx sha1;
-		hash_size = SHA1_DIGEST_SIZE;
 		sha1_init(&sha1);
 		sha1_update(&sha1, size - offsetof(RVL_Sig_RSA2048, issuer),
 			&data[offsetof(RVL_Sig_RSA2048, issuer)]);
@@ -555,15 +683,115 @@ int cert_realsign_ticketOrTMD(uint8_t *data, size_t size, const RSA2048PrivateKe
 	} else {
 		// Calculate the SHA-256 hash.
 		struct sha256_ctx sha256;
-		hash_size = SHA256_DIGEST_SIZE;
 		sha256_init(&sha256);
 		sha256_update(&sha256, size - offsetof(RVL_Sig_RSA2048, issuer),
 			&data[offsetof(RVL_Sig_RSA2048, issuer)]);
 		sha256_digest(&sha256, SHA256_DIGEST_SIZE, hash);
 	}
 
-	// Sign the TMD.
-	// TODO: Check for errors.
-	rsaw_rsa2048_sign(sig->sig, sizeof(sig->sig), key, hash, hash_size, doSHA256);
 	return 0;
 }
+
+/**
+ * Sign a ticket or TMD with real encryption keys.
+ *
+ * NOTE: If changing the encryption type, the issuer must be
+ * updated *before* calling this function.
+ *
+ * NOTE 2: For Wii, the full TMD must be signed.
+ * For Wii U, only the TMD header is signed.
+ *
+ * @param data		[in/out] Ticket or TMD to fakesign.
+ * @param size		[in] Size of ticket or TMD.
+ * @param key		[in] RSA-2048 private key.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int cert_realsign_ticketOrTMD(uint8_t *data, size_t size, const RSA2048PrivateKey *key)
+{
+	uint8_t hash[SHA256_DIGEST_SIZE];
+	RVL_Sig_RSA2048 *const sig = (RVL_Sig_RSA2048*)data;
+	bool doSHA256;
+
+	int ret = cert_realsign_hash(data, size, hash, &doSHA256);
+	if (ret != 0) {
+		return ret;
+	}
+
+	// Sign the ticket or TMD.
+	return rsaw_rsa2048_sign(sig->sig, sizeof(sig->sig), key, hash,
+		(doSHA256 ? SHA256_DIGEST_SIZE : SHA1_DIGEST_SIZE), doSHA256);
+}
+
+/**
+ * Sign multiple tickets or TMDs with the same real encryption key.
+ * The private key is only prepared once.
+ *
+ * All tickets or TMDs must use the same signature type.
+ *
+ * @param data		[in/out] Array of tickets or TMDs to sign.
+ * @param sizes		[in] Array of sizes.
+ * @param count		[in] Number of tickets or TMDs.
+ * @param key		[in] RSA-2048 private key.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int cert_realsign_ticketOrTMD_multi(uint8_t *const *data, const size_t *sizes,
+	unsigned int count, const RSA2048PrivateKey *key)
+{
+	static const size_t sig_size = sizeof(((RVL_Sig_RSA2048*)0)->sig);
+	uint8_t *hashes, *sigs;
+	size_t hash_size = 0;
+	bool doSHA256 = false;
+	unsigned int i;
+	int ret = 0;
+
+	if (!data || !sizes || count == 0) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	hashes = malloc(count * SHA256_DIGEST_SIZE);
+	sigs = malloc(count * sig_size);
+	if (!hashes || !sigs) {
+		ret = -ENOMEM;
+		goto end;
+	}
+
+	// Hash everything first.
+	for (i = 0; i < count; i++) {
+		bool isSHA256;
+		ret = cert_realsign_hash(data[i], sizes[i], &hashes[i * SHA256_DIGEST_SIZE], &isSHA256);
+		if (ret != 0) {
+			goto end;
+		} else if (i == 0) {
+			doSHA256 = isSHA256;
+			hash_size = (doSHA256 ? SHA256_DIGEST_SIZE : SHA1_DIGEST_SIZE);
+		} else if (isSHA256 != doSHA256) {
+			// Signature types don't match.
+			ret = -EINVAL;
+			goto end;
+		}
+
+		// Hashes are packed for rsaw_rsa2048_sign_multi().
+		if (hash_size != SHA256_DIGEST_SIZE) {
+			memmove(&hashes[i * hash_size], &hashes[i * SHA256_DIGEST_SIZE], hash_size);
+		}
+	}
+
+	// Sign all of the hashes.
+	ret = rsaw_rsa2048_sign_multi(sigs, sig_size, key, hashes, hash_size, count, doSHA256);
+	if (ret != 0) {
+		goto end;
+	}
+	for (i = 0; i < count; i++) {
+		RVL_Sig_RSA2048 *const sig = (RVL_Sig_RSA2048*)data[i];
+		memcpy(sig->sig, &sigs[i * sig_size], sig_size);
+	}
+
+end:
+	free(hashes);
+	free(sigs);
+	if (ret != 0) {
+		errno = -ret;
+	}
+	return ret;
+}
@@ -2,7 +2,7 @@
  * RVT-H Tool (libwiicrypto)                                               *
  * cert.h: Certificate management.                                         *
  *                                                                         *
- * Copyright (c) 2018 by David Korth.                                      *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
@@ -123,6 +123,21 @@ int cert_fakesign_tmd(uint8_t *tmd, size_t size);
  */
 int cert_realsign_ticketOrTMD(uint8_t *data, size_t size, const RSA2048PrivateKey *key);
 
+/**
+ * Sign multiple tickets or TMDs with the same real encryption key.
+ * The private key is only prepared once.
+ *
+ * All tickets or TMDs must use the same signature type.
+ *
+ * @param data		[in/out] Array of tickets or TMDs to sign.
+ * @param sizes		[in] Array of sizes.
+ * @param count		[in] Number of tickets or TMDs.
+ * @param key		[in] RSA-2048 private key.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int cert_realsign_ticketOrTMD_multi(uint8_t *const *data, const size_t *sizes,
+	unsigned int count, const RSA2048PrivateKey *key);
+
 #ifdef __cplusplus
 }
 #endif
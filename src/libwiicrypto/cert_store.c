@@ -2,13 +2,14 @@
  * RVT-H Tool (libwiicrypto)                                               *
  * cert_store.c: Certificate store.                                        *
  *                                                                         *
- * Copyright (c) 2018 by David Korth.                                      *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
 // Reference: http://wiibrew.org/wiki/Certificate_chain
 #include "cert_store.h"
 #include "byteswap.h"
+#include "static_mutex.h"
 
 #include <assert.h>
 #include <errno.h>
@@ -133,8 +134,69 @@ const char *const RVL_Cert_Issuers[RVL_CERT_ISSUER_MAX] = {
 	"Root-CA00000003-CP0000000b",	// WUP_CERT_ISSUER_PPKI_TMD (same as 3DS)
 };
 
+// Signature issuer name hashes. (32-bit FNV-1a; see cert_issuer_hash())
+// Issuer lookups compare these first, so only the matching
+// issuer's name has to be compared.
+// NOTE: These must match RVL_Cert_Issuers[]. This is checked by CertVerifyTest.
+static const uint32_t RVL_Cert_Issuer_Hashes[RVL_CERT_ISSUER_MAX] = {
+	0U,		// RVL_CERT_ISSUER_UNKNOWN
+
+	// Root certificates
+	0xA1295A65U,	// RVL_CERT_ISSUER_DPKI_ROOT
+	0xA1295A65U,	// RVL_CERT_ISSUER_PPKI_ROOT
+
+	// Wii: dpki (Debug)
+	0x9A15F5E6U,	// RVL_CERT_ISSUER_DPKI_CA
+	0xC512549AU,	// RVL_CERT_ISSUER_DPKI_TICKET
+	0x45B45E13U,	// RVL_CERT_ISSUER_DPKI_TMD
+	0x54941A6CU,	// RVL_CERT_ISSUER_DPKI_MS
+	0xC3125174U,	// RVL_CERT_ISSUER_DPKI_XS04
+	0x47B46139U,	// RVL_CERT_ISSUER_DPKI_CP05
+
+	// Wii: ppki (Retail)
+	0x9915F453U,	// RVL_CERT_ISSUER_PPKI_CA
+	0xFA046262U,	// RVL_CERT_ISSUER_PPKI_TICKET
+	0x6F7BE0FDU,	// RVL_CERT_ISSUER_PPKI_TMD
+
+	// 3DS: dpki (Debug)
+	0x9C15F90CU,	// CTR_CERT_ISSUER_DPKI_CA
+	0xA264CC31U,	// CTR_CERT_ISSUER_DPKI_TICKET
+	0xEB6C4743U,	// CTR_CERT_ISSUER_DPKI_TMD
+
+	// 3DS: ppki (Retail)
+	0x9B15F779U,	// CTR_CERT_ISSUER_PPKI_CA
+	0x2B820FA4U,	// CTR_CERT_ISSUER_PPKI_TICKET
+	0xEDE2825DU,	// CTR_CERT_ISSUER_PPKI_TMD
+
+	// Wii U: dpki (Debug)
+	0x9C15F90CU,	// WUP_CERT_ISSUER_DPKI_CA (same as 3DS)
+	0xEB653F1CU,	// WUP_CERT_ISSUER_DPKI_TICKET
+	0xA06FA2C9U,	// WUP_CERT_ISSUER_DPKI_TMD
+	0xC62005FFU,	// WUP_CERT_ISSUER_DPKI_SP
+
+	// Wii U: ppki (Retail)
+	0x9B15F779U,	// WUP_CERT_ISSUER_PPKI_CA (same as 3DS)
+	0x2B820FA4U,	// WUP_CERT_ISSUER_PPKI_TICKET (same as 3DS)
+	0xEDE2825DU,	// WUP_CERT_ISSUER_PPKI_TMD (same as 3DS)
+};
+
 /** Certificate access functions. **/
 
+/**
+ * Hash a certificate issuer name.
+ * @param s_issuer Issuer name.
+ * @return 32-bit FNV-1a hash.
+ */
+uint32_t cert_issuer_hash(const char *s_issuer)
+{
+	uint32_t hash = 0x811C9DC5U;
+	for (; *s_issuer != '\0'; s_issuer++) {
+		hash ^= (uint8_t)*s_issuer;
+		hash *= 0x01000193U;
+	}
+	return hash;
+}
+
 /**
  * Convert a certificate issuer name to RVT_Cert_Issuer, with a PKI specification.
  * @param s_issuer Issuer name.
@@ -144,6 +206,7 @@ const char *const RVL_Cert_Issuers[RVL_CERT_ISSUER_MAX] = {
 RVL_Cert_Issuer cert_get_issuer_from_name_with_pki(const char *s_issuer, RVL_PKI pki)
 {
 	unsigned int i;
+	uint32_t hash;
 
 	if (!s_issuer || s_issuer[0] == 0) {
 		// Unknown certificate.
@@ -192,8 +255,9 @@ RVL_Cert_Issuer cert_get_issuer_from_name_with_pki(const char *s_issuer, RVL_PKI
 			break;
 	}
 
+	hash = cert_issuer_hash(s_issuer);
 	for (i = min; i <= max; i++) {
-		if (!strcmp(s_issuer, RVL_Cert_Issuers[i])) {
+		if (RVL_Cert_Issuer_Hashes[i] == hash && !strcmp(s_issuer, RVL_Cert_Issuers[i])) {
 			// Found a match!
 			return (RVL_Cert_Issuer)i;
 		}
@@ -382,3 +446,88 @@ unsigned int cert_get_size(RVL_Cert_Issuer issuer)
 	}
 	return cert_sizes[issuer];
 }
+
+/**
+ * Get the public key of a standard certificate.
+ *
+ * The key is imported on first use and cached for the lifetime
+ * of the process, so the modulus doesn't need to be converted
+ * for every signature that's verified against it.
+ *
+ * This function is thread-safe.
+ *
+ * @param issuer RVL_Cert_Issuer
+ * @return RsawPubKey, or NULL if invalid or not an RSA key.
+ */
+const RsawPubKey *cert_get_pubkey(RVL_Cert_Issuer issuer)
+{
+	static RsawPubKey *pubkeys[RVL_CERT_ISSUER_MAX];
+	STATIC_MUTEX(pubkeys_lock);
+
+	const RVL_Cert *cert;
+	RsawPubKey *key;
+
+	assert(issuer > RVL_CERT_ISSUER_UNKNOWN);
+	assert(issuer < RVL_CERT_ISSUER_MAX);
+	if (issuer <= RVL_CERT_ISSUER_UNKNOWN || issuer >= RVL_CERT_ISSUER_MAX) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	STATIC_MUTEX_LOCK(pubkeys_lock);
+	key = pubkeys[issuer];
+	if (key) {
+		// Key was already imported.
+		STATIC_MUTEX_UNLOCK(pubkeys_lock);
+		return key;
+	}
+
+	// Skip over the certificate's signature.
+	cert = cert_get(issuer);
+	switch (be32_to_cpu(cert->signature_type)) {
+		case RVL_CERT_SIGTYPE_RSA4096_SHA1:
+		case WUP_CERT_SIGTYPE_RSA4096_SHA256:
+			cert = (const RVL_Cert*)((const uint8_t*)cert + sizeof(RVL_Sig_RSA4096));
+			break;
+		case RVL_CERT_SIGTYPE_RSA2048_SHA1:
+		case WUP_CERT_SIGTYPE_RSA2048_SHA256:
+			cert = (const RVL_Cert*)((const uint8_t*)cert + sizeof(RVL_Sig_RSA2048));
+			break;
+		case 0:
+			// Root certificate. (no signature)
+			cert = (const RVL_Cert*)((const uint8_t*)cert + sizeof(RVL_Sig_Dummy));
+			break;
+		default:
+			// Unsupported signature type.
+			cert = NULL;
+			break;
+	}
+
+	// Import the public key.
+	if (cert) {
+		switch (be32_to_cpu(cert->signature_type)) {
+			case RVL_CERT_KEYTYPE_RSA4096: {
+				const RVL_PubKey_RSA4096 *pubkey = (const RVL_PubKey_RSA4096*)cert;
+				key = rsaw_pubkey_new(pubkey->modulus,
+					be32_to_cpu(pubkey->exponent), sizeof(pubkey->modulus));
+				break;
+			}
+			case RVL_CERT_KEYTYPE_RSA2048: {
+				const RVL_PubKey_RSA2048 *pubkey = (const RVL_PubKey_RSA2048*)cert;
+				key = rsaw_pubkey_new(pubkey->modulus,
+					be32_to_cpu(pubkey->exponent), sizeof(pubkey->modulus));
+				break;
+			}
+			default:
+				// Not an RSA key.
+				break;
+		}
+	}
+
+	pubkeys[issuer] = key;
+	STATIC_MUTEX_UNLOCK(pubkeys_lock);
+	if (!key) {
+		errno = ENOTSUP;
+	}
+	return key;
+}
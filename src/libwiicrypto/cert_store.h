@@ -2,7 +2,7 @@
  * RVT-H Tool (libwiicrypto)                                               *
  * cert_store.h: Certificate store.                                        *
  *                                                                         *
- * Copyright (c) 2018 by David Korth.                                      *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
@@ -11,6 +11,7 @@
 
 #include <stdint.h>
 #include "common.h"
+#include "rsaw.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -119,6 +120,13 @@ typedef enum {
 // Signature issuers.
 extern const char *const RVL_Cert_Issuers[RVL_CERT_ISSUER_MAX];
 
+/**
+ * Hash a certificate issuer name.
+ * @param s_issuer Issuer name.
+ * @return 32-bit FNV-1a hash.
+ */
+uint32_t cert_issuer_hash(const char *s_issuer);
+
 /**
  * Convert a certificate issuer name to RVT_Cert_Issuer, with a PKI specification.
  * @param s_issuer Issuer name.
@@ -186,6 +194,20 @@ static inline const RVL_Cert *cert_get_from_name(const char *s_issuer)
  */
 unsigned int cert_get_size(RVL_Cert_Issuer issuer);
 
+/**
+ * Get the public key of a standard certificate.
+ *
+ * The key is imported on first use and cached for the lifetime
+ * of the process, so the modulus doesn't need to be converted
+ * for every signature that's verified against it.
+ *
+ * This function is thread-safe.
+ *
+ * @param issuer RVL_Cert_Issuer
+ * @return RsawPubKey, or NULL if invalid or not an RSA key.
+ */
+const RsawPubKey *cert_get_pubkey(RVL_Cert_Issuer issuer);
+
 // Signature types.
 typedef enum {
 	RVL_CERT_SIGTYPE_RSA4096_SHA1	= 0x00010000,	// RSA-4096 with SHA-1
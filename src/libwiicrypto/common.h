@@ -118,10 +118,13 @@
  * @param x	Byte count to align.
  */
 // FIXME: No __typeof__ in MSVC's C mode...
+// NOTE: __typeof__((x)+0) is used instead of __typeof__(x) to drop
+// const qualifiers; otherwise, casting to a const type triggers
+// -Wignored-qualifiers. It's the same type as ((x)+((a)-1)).
 #if defined(_MSC_VER) && !defined(__cplusplus)
 # define ALIGN_BYTES(a, x)	(((x)+((a)-1)) & ~((uint64_t)((a)-1)))
 #else
-# define ALIGN_BYTES(a, x)	(((x)+((a)-1)) & ~((__typeof__(x))((a)-1)))
+# define ALIGN_BYTES(a, x)	(((x)+((a)-1)) & ~((__typeof__((x)+0))((a)-1)))
 #endif
 
 /**
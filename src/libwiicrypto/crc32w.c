@@ -0,0 +1,269 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * crc32w.c: CRC32 wrapper functions.                                      *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "crc32w.h"
+#include "crc32w_hw.h"
+#include "impl_select.h"
+#include "static_mutex.h"
+
+#include <errno.h>
+
+// CRC32 polynomial. (IEEE 802.3, reflected)
+#define CRC32W_POLY 0xEDB88320U
+
+// Current CRC32 implementation. (-1 == not detected yet)
+IMPL_SELECT(crc32w_impl);
+
+// Lookup tables for slicing-by-8.
+// Initialized on first use. The flag is set with release semantics
+// after the tables are written, so a thread that sees it set (with
+// acquire semantics) also sees the tables.
+static uint32_t crc32w_tables[8][256];
+static long crc32w_tables_init = 0;
+STATIC_MUTEX(crc32w_tables_mutex);
+
+#ifdef _MSC_VER
+// NOTE: Interlocked functions are full barriers.
+#  define TABLES_INIT_LOAD()	_InterlockedOr(&crc32w_tables_init, 0)
+#  define TABLES_INIT_STORE()	_InterlockedExchange(&crc32w_tables_init, 1)
+#else /* !_MSC_VER */
+#  define TABLES_INIT_LOAD()	__atomic_load_n(&crc32w_tables_init, __ATOMIC_ACQUIRE)
+#  define TABLES_INIT_STORE()	__atomic_store_n(&crc32w_tables_init, 1, __ATOMIC_RELEASE)
+#endif /* _MSC_VER */
+
+/**
+ * Initialize the slicing-by-8 lookup tables.
+ */
+static void crc32w_init_tables(void)
+{
+	unsigned int i, j;
+
+	STATIC_MUTEX_LOCK(crc32w_tables_mutex);
+	if (TABLES_INIT_LOAD()) {
+		// Another thread initialized the tables.
+		STATIC_MUTEX_UNLOCK(crc32w_tables_mutex);
+		return;
+	}
+
+	for (i = 0; i < 256; i++) {
+		uint32_t crc = i;
+		for (j = 0; j < 8; j++) {
+			crc = (crc >> 1) ^ ((crc & 1) ? CRC32W_POLY : 0);
+		}
+		crc32w_tables[0][i] = crc;
+	}
+	for (i = 0; i < 256; i++) {
+		for (j = 1; j < 8; j++) {
+			crc32w_tables[j][i] = (crc32w_tables[j-1][i] >> 8) ^
+				crc32w_tables[0][crc32w_tables[j-1][i] & 0xFF];
+		}
+	}
+
+	TABLES_INIT_STORE();
+	STATIC_MUTEX_UNLOCK(crc32w_tables_mutex);
+}
+
+/**
+ * Update a CRC32 using slicing-by-8.
+ * @param crc		[in] Current CRC32. (inverted)
+ * @param pData		[in] Data.
+ * @param size		[in] Size of pData, in bytes.
+ * @return Updated CRC32. (inverted)
+ */
+static uint32_t crc32w_update_software(uint32_t crc, const uint8_t *pData, size_t size)
+{
+	const uint32_t (*const t)[256] = crc32w_tables;
+	if (!TABLES_INIT_LOAD()) {
+		crc32w_init_tables();
+	}
+
+	for (; size >= 8; size -= 8, pData += 8) {
+		const uint32_t lo = crc ^ (pData[0] | (pData[1] << 8) | (pData[2] << 16) | ((uint32_t)pData[3] << 24));
+		const uint32_t hi = pData[4] | (pData[5] << 8) | (pData[6] << 16) | ((uint32_t)pData[7] << 24);
+		crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^
+		      t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+		      t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^
+		      t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+	}
+	for (; size > 0; size--, pData++) {
+		crc = (crc >> 8) ^ t[0][(crc ^ *pData) & 0xFF];
+	}
+	return crc;
+}
+
+/**
+ * Check if a CRC32 implementation is supported by the CPU.
+ * @param impl CRC32 implementation. (See CRC32W_Impl_e.)
+ * @return True if supported; false if not.
+ */
+static int crc32w_is_impl_supported(int impl)
+{
+	switch (impl) {
+		case CRC32W_IMPL_SOFTWARE:
+			return 1;
+#ifdef HAVE_CRC32W_PCLMUL
+		case CRC32W_IMPL_PCLMUL:
+			return crc32w_pclmul_is_supported();
+#endif /* HAVE_CRC32W_PCLMUL */
+#ifdef HAVE_CRC32W_ARMV8
+		case CRC32W_IMPL_ARMV8:
+			return crc32w_armv8_is_supported();
+#endif /* HAVE_CRC32W_ARMV8 */
+		default:
+			break;
+	}
+	return 0;
+}
+
+/**
+ * Determine the best CRC32 implementation for this CPU.
+ * @return CRC32 implementation. (See CRC32W_Impl_e.)
+ */
+static int crc32w_detect_impl(void)
+{
+	// Preference order: PCLMULQDQ or ARMv8, software.
+	if (crc32w_is_impl_supported(CRC32W_IMPL_PCLMUL)) {
+		return CRC32W_IMPL_PCLMUL;
+	} else if (crc32w_is_impl_supported(CRC32W_IMPL_ARMV8)) {
+		return CRC32W_IMPL_ARMV8;
+	}
+	return CRC32W_IMPL_SOFTWARE;
+}
+
+/**
+ * Get the current CRC32 implementation.
+ * @return CRC32 implementation. (See CRC32W_Impl_e.)
+ */
+static inline int crc32w_get_impl(void)
+{
+	return impl_select_get(&crc32w_impl, crc32w_detect_impl);
+}
+
+/**
+ * Get the name of the active CRC32 implementation.
+ * @return CRC32 implementation name.
+ */
+const char *crc32w_get_impl_name(void)
+{
+	switch (crc32w_get_impl()) {
+		default:
+		case CRC32W_IMPL_SOFTWARE:
+			return "slicing-by-8";
+		case CRC32W_IMPL_PCLMUL:
+			return "PCLMULQDQ";
+		case CRC32W_IMPL_ARMV8:
+			return "ARMv8 CRC32";
+	}
+}
+
+/**
+ * Select a CRC32 implementation.
+ * This is intended for testing and benchmarking.
+ * NOTE: Not thread-safe. Don't call this while calculating CRCs.
+ * @param impl CRC32 implementation. (See CRC32W_Impl_e.)
+ * @return 0 on success; negative POSIX error code on error. (-ENOTSUP if not supported by the CPU)
+ */
+int crc32w_set_impl(int impl)
+{
+	if (impl == CRC32W_IMPL_AUTO) {
+		impl_select_store(&crc32w_impl, -1);
+		return 0;
+	} else if (impl < 0 || impl >= CRC32W_IMPL_MAX) {
+		return -EINVAL;
+	}
+
+	if (!crc32w_is_impl_supported(impl)) {
+		return -ENOTSUP;
+	}
+	impl_select_store(&crc32w_impl, impl);
+	return 0;
+}
+
+/**
+ * Update a CRC32.
+ * @param crc		[in] Current CRC32. (0 for new data)
+ * @param pData		[in] Data.
+ * @param size		[in] Size of pData, in bytes.
+ * @return Updated CRC32.
+ */
+uint32_t crc32w_update(uint32_t crc, const uint8_t *pData, size_t size)
+{
+	crc = ~crc;
+	switch (crc32w_get_impl()) {
+#ifdef HAVE_CRC32W_PCLMUL
+		case CRC32W_IMPL_PCLMUL:
+			if (size >= CRC32W_PCLMUL_MIN_SIZE) {
+				// PCLMULQDQ handles multiples of 16 bytes.
+				// The remainder is handled in software.
+				const size_t simd_size = size & ~(size_t)15;
+				crc = crc32w_pclmul_update(crc, pData, simd_size);
+				pData += simd_size;
+				size -= simd_size;
+			}
+			crc = crc32w_update_software(crc, pData, size);
+			break;
+#endif /* HAVE_CRC32W_PCLMUL */
+#ifdef HAVE_CRC32W_ARMV8
+		case CRC32W_IMPL_ARMV8:
+			crc = crc32w_armv8_update(crc, pData, size);
+			break;
+#endif /* HAVE_CRC32W_ARMV8 */
+		default:
+			crc = crc32w_update_software(crc, pData, size);
+			break;
+	}
+	return ~crc;
+}
+
+/**
+ * Multiply two polynomials modulo the CRC32 polynomial.
+ * Polynomials are reflected, so x^0 is the most significant bit.
+ * @param a	[in] First polynomial.
+ * @param b	[in] Second polynomial.
+ * @return (a * b) mod P
+ */
+static uint32_t crc32w_multmodp(uint32_t a, uint32_t b)
+{
+	uint32_t p = 0;
+	uint32_t m;
+
+	for (m = 1U << 31; m != 0; m >>= 1) {
+		if (a & m) {
+			p ^= b;
+			if ((a & (m - 1)) == 0)
+				break;
+		}
+		b = (b & 1) ? ((b >> 1) ^ CRC32W_POLY) : (b >> 1);
+	}
+	return p;
+}
+
+/**
+ * Combine the CRC32s of two consecutive blocks of data.
+ * This allows blocks to be processed out of order, e.g. by
+ * multiple threads, and merged afterwards.
+ * @param crc1		[in] CRC32 of the first block.
+ * @param crc2		[in] CRC32 of the second block.
+ * @param len2		[in] Size of the second block, in bytes.
+ * @return CRC32 of the first block followed by the second block.
+ */
+uint32_t crc32w_combine(uint32_t crc1, uint32_t crc2, uint64_t len2)
+{
+	// Appending len2 bytes multiplies crc1 by x^(8*len2) mod P.
+	// Calculate it by repeated squaring of x^8.
+	uint32_t xn = 1U << 31;		// x^0
+	uint32_t sq = 1U << (31 - 8);	// x^8
+
+	for (; len2 != 0; len2 >>= 1) {
+		if (len2 & 1) {
+			xn = crc32w_multmodp(sq, xn);
+		}
+		sq = crc32w_multmodp(sq, sq);
+	}
+	return crc32w_multmodp(xn, crc1) ^ crc2;
+}
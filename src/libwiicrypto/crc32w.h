@@ -0,0 +1,73 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * crc32w.h: CRC32 wrapper functions.                                      *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// NOTE: This is the standard CRC32 (IEEE 802.3, reflected), as used
+// by zlib, No-Intro/Redump DAT files, and most archive formats.
+// CRC values are passed in and returned in their final form, so an
+// initial CRC of 0 is used for new data, same as zlib's crc32().
+
+#ifndef __RVTHTOOL_LIBWIICRYPTO_CRC32W_H__
+#define __RVTHTOOL_LIBWIICRYPTO_CRC32W_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// CRC32 implementation.
+typedef enum {
+	CRC32W_IMPL_AUTO	= -1,	// Automatically select the best implementation.
+	CRC32W_IMPL_SOFTWARE	= 0,	// Slicing-by-8 (software)
+	CRC32W_IMPL_PCLMUL	= 1,	// x86 PCLMULQDQ folding
+	CRC32W_IMPL_ARMV8	= 2,	// ARMv8 CRC32 instructions
+
+	CRC32W_IMPL_MAX
+} CRC32W_Impl_e;
+
+/**
+ * Get the name of the active CRC32 implementation.
+ * @return CRC32 implementation name.
+ */
+const char *crc32w_get_impl_name(void);
+
+/**
+ * Select a CRC32 implementation.
+ * This is intended for testing and benchmarking.
+ * NOTE: Not thread-safe. Don't call this while calculating CRCs.
+ * @param impl CRC32 implementation. (See CRC32W_Impl_e.)
+ * @return 0 on success; negative POSIX error code on error. (-ENOTSUP if not supported by the CPU)
+ */
+int crc32w_set_impl(int impl);
+
+/**
+ * Update a CRC32.
+ * @param crc		[in] Current CRC32. (0 for new data)
+ * @param pData		[in] Data.
+ * @param size		[in] Size of pData, in bytes.
+ * @return Updated CRC32.
+ */
+uint32_t crc32w_update(uint32_t crc, const uint8_t *pData, size_t size);
+
+/**
+ * Combine the CRC32s of two consecutive blocks of data.
+ * This allows blocks to be processed out of order, e.g. by
+ * multiple threads, and merged afterwards.
+ * @param crc1		[in] CRC32 of the first block.
+ * @param crc2		[in] CRC32 of the second block.
+ * @param len2		[in] Size of the second block, in bytes.
+ * @return CRC32 of the first block followed by the second block.
+ */
+uint32_t crc32w_combine(uint32_t crc1, uint32_t crc2, uint64_t len2);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_LIBWIICRYPTO_CRC32W_H__ */
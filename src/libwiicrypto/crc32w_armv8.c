@@ -0,0 +1,78 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * crc32w_armv8.c: CRC32 wrapper functions. (ARMv8 CRC32 version)          *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "crc32w_hw.h"
+
+#include <string.h>
+
+// ARMv8 CRC32 intrinsics
+#include <arm_acle.h>
+
+// Runtime CPU feature detection
+#if defined(_WIN32)
+#  include <windows.h>
+#elif defined(__linux__)
+#  include <sys/auxv.h>
+#  ifndef HWCAP_CRC32
+#    define HWCAP_CRC32 (1UL << 7)
+#  endif
+#endif
+
+/**
+ * Check if the ARMv8 CRC32 instructions are supported by the CPU.
+ * @return Non-zero if supported; 0 if not.
+ */
+int crc32w_armv8_is_supported(void)
+{
+#if defined(_WIN32)
+	return !!IsProcessorFeaturePresent(PF_ARM_V8_CRC32_INSTRUCTIONS_AVAILABLE);
+#elif defined(__APPLE__)
+	// All Apple ARM64 CPUs support the CRC32 instructions.
+	return 1;
+#elif defined(__linux__)
+	return !!(getauxval(AT_HWCAP) & HWCAP_CRC32);
+#else
+	// TODO: Other operating systems.
+	return 0;
+#endif
+}
+
+/**
+ * Update a CRC32 using the ARMv8 CRC32 instructions.
+ * @param crc		[in] Current CRC32. (inverted)
+ * @param pData		[in] Data.
+ * @param size		[in] Size of pData, in bytes.
+ * @return Updated CRC32. (inverted)
+ */
+uint32_t crc32w_armv8_update(uint32_t crc, const uint8_t *pData, size_t size)
+{
+	// Align the data pointer to 8 bytes.
+	for (; size > 0 && ((uintptr_t)pData & 7) != 0; size--, pData++) {
+		crc = __crc32b(crc, *pData);
+	}
+
+	// Process 32 bytes per iteration.
+	// NOTE: The CRC32 instructions are little-endian.
+	for (; size >= 32; size -= 32, pData += 32) {
+		uint64_t v[4];
+		memcpy(v, pData, sizeof(v));
+		crc = __crc32d(crc, v[0]);
+		crc = __crc32d(crc, v[1]);
+		crc = __crc32d(crc, v[2]);
+		crc = __crc32d(crc, v[3]);
+	}
+	for (; size >= 8; size -= 8, pData += 8) {
+		uint64_t v;
+		memcpy(&v, pData, sizeof(v));
+		crc = __crc32d(crc, v);
+	}
+	for (; size > 0; size--, pData++) {
+		crc = __crc32b(crc, *pData);
+	}
+	return crc;
+}
@@ -0,0 +1,67 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * crc32w_hw.h: CRC32 wrapper functions. (hardware-accelerated backends)   *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// NOTE: Internal header. Only used by the crc32w implementation.
+// CRC values used by these functions are inverted, i.e. the
+// initial value is 0xFFFFFFFF and the result must be inverted.
+
+#ifndef __RVTHTOOL_LIBWIICRYPTO_CRC32W_HW_H__
+#define __RVTHTOOL_LIBWIICRYPTO_CRC32W_HW_H__
+
+#include "config.libwiicrypto.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Minimum size for the PCLMULQDQ implementation.
+// (Four 128-bit lanes are folded in parallel.)
+#define CRC32W_PCLMUL_MIN_SIZE 64
+
+#ifdef HAVE_CRC32W_PCLMUL
+/**
+ * Check if PCLMULQDQ and SSE4.1 are supported by the CPU.
+ * @return Non-zero if supported; 0 if not.
+ */
+int crc32w_pclmul_is_supported(void);
+
+/**
+ * Update a CRC32 using PCLMULQDQ folding.
+ * @param crc		[in] Current CRC32. (inverted)
+ * @param pData		[in] Data.
+ * @param size		[in] Size of pData, in bytes. (multiple of 16; minimum CRC32W_PCLMUL_MIN_SIZE)
+ * @return Updated CRC32. (inverted)
+ */
+uint32_t crc32w_pclmul_update(uint32_t crc, const uint8_t *pData, size_t size);
+#endif /* HAVE_CRC32W_PCLMUL */
+
+#ifdef HAVE_CRC32W_ARMV8
+/**
+ * Check if the ARMv8 CRC32 instructions are supported by the CPU.
+ * @return Non-zero if supported; 0 if not.
+ */
+int crc32w_armv8_is_supported(void);
+
+/**
+ * Update a CRC32 using the ARMv8 CRC32 instructions.
+ * @param crc		[in] Current CRC32. (inverted)
+ * @param pData		[in] Data.
+ * @param size		[in] Size of pData, in bytes.
+ * @return Updated CRC32. (inverted)
+ */
+uint32_t crc32w_armv8_update(uint32_t crc, const uint8_t *pData, size_t size);
+#endif /* HAVE_CRC32W_ARMV8 */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_LIBWIICRYPTO_CRC32W_HW_H__ */
@@ -0,0 +1,141 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * crc32w_pclmul.c: CRC32 wrapper functions. (x86 PCLMULQDQ version)       *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Reference: "Fast CRC Computation for Generic Polynomials Using
+// PCLMULQDQ Instruction", Intel, 2009.
+
+#include "crc32w_hw.h"
+
+#include <assert.h>
+
+// PCLMULQDQ and SSE4.1 intrinsics
+#include <emmintrin.h>
+#include <smmintrin.h>
+#include <wmmintrin.h>
+
+// CPUID
+#ifdef _MSC_VER
+#  include <intrin.h>
+#else /* !_MSC_VER */
+#  include <cpuid.h>
+#endif /* _MSC_VER */
+
+// CPUID.01H:ECX.PCLMULQDQ[bit 1], CPUID.01H:ECX.SSE41[bit 19]
+#define CPUID_ECX_PCLMULQDQ (1U << 1)
+#define CPUID_ECX_SSE41 (1U << 19)
+
+/**
+ * Check if PCLMULQDQ and SSE4.1 are supported by the CPU.
+ * @return Non-zero if supported; 0 if not.
+ */
+int crc32w_pclmul_is_supported(void)
+{
+	unsigned int ecx1;
+#ifdef _MSC_VER
+	int regs[4];
+	__cpuid(regs, 1);
+	ecx1 = (unsigned int)regs[2];
+#else /* !_MSC_VER */
+	unsigned int eax, ebx, ecx, edx;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+		return 0;
+	}
+	ecx1 = ecx;
+#endif /* _MSC_VER */
+
+	return (ecx1 & CPUID_ECX_PCLMULQDQ) &&
+	       (ecx1 & CPUID_ECX_SSE41);
+}
+
+// Folding constants for the reflected CRC32 polynomial.
+// Each pair is (x^(n+32) mod P, x^(n-32) mod P), bit-reflected and shifted left by 1.
+#ifdef _MSC_VER
+#  define ALIGN16(decl) __declspec(align(16)) decl
+#else /* !_MSC_VER */
+#  define ALIGN16(decl) decl __attribute__((aligned(16)))
+#endif /* _MSC_VER */
+static const ALIGN16(uint64_t k1k2[2]) = {0x0154442BD4ULL, 0x01C6E41596ULL};	// Fold by 512 bits
+static const ALIGN16(uint64_t k3k4[2]) = {0x01751997D0ULL, 0x00CCAA009EULL};	// Fold by 128 bits
+static const ALIGN16(uint64_t k5k0[2]) = {0x0163CD6124ULL, 0x0000000000ULL};	// Fold 64 bits to 32
+static const ALIGN16(uint64_t poly[2]) = {0x01DB710641ULL, 0x01F7011641ULL};	// P' and mu (Barrett)
+
+/**
+ * Fold a 128-bit value into the next one.
+ * @param x	[in] Value to fold.
+ * @param k	[in] Folding constants.
+ * @param next	[in] Next 128 bits.
+ * @return Folded value.
+ */
+static inline __m128i fold128(__m128i x, __m128i k, __m128i next)
+{
+	const __m128i lo = _mm_clmulepi64_si128(x, k, 0x00);
+	const __m128i hi = _mm_clmulepi64_si128(x, k, 0x11);
+	return _mm_xor_si128(_mm_xor_si128(lo, hi), next);
+}
+
+/**
+ * Update a CRC32 using PCLMULQDQ folding.
+ * @param crc		[in] Current CRC32. (inverted)
+ * @param pData		[in] Data.
+ * @param size		[in] Size of pData, in bytes. (multiple of 16; minimum CRC32W_PCLMUL_MIN_SIZE)
+ * @return Updated CRC32. (inverted)
+ */
+uint32_t crc32w_pclmul_update(uint32_t crc, const uint8_t *pData, size_t size)
+{
+	const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+	__m128i k, x1, x2, x3, x4, t;
+
+	assert(size >= CRC32W_PCLMUL_MIN_SIZE);
+	assert(size % 16 == 0);
+
+	// Load the first 64 bytes and apply the initial CRC.
+	x1 = _mm_loadu_si128((const __m128i*)(pData + 0x00));
+	x2 = _mm_loadu_si128((const __m128i*)(pData + 0x10));
+	x3 = _mm_loadu_si128((const __m128i*)(pData + 0x20));
+	x4 = _mm_loadu_si128((const __m128i*)(pData + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+	pData += 64;
+	size -= 64;
+
+	// Fold 64 bytes at a time using four independent lanes.
+	k = _mm_load_si128((const __m128i*)k1k2);
+	for (; size >= 64; size -= 64, pData += 64) {
+		x1 = fold128(x1, k, _mm_loadu_si128((const __m128i*)(pData + 0x00)));
+		x2 = fold128(x2, k, _mm_loadu_si128((const __m128i*)(pData + 0x10)));
+		x3 = fold128(x3, k, _mm_loadu_si128((const __m128i*)(pData + 0x20)));
+		x4 = fold128(x4, k, _mm_loadu_si128((const __m128i*)(pData + 0x30)));
+	}
+
+	// Fold the four lanes into one.
+	k = _mm_load_si128((const __m128i*)k3k4);
+	x1 = fold128(x1, k, x2);
+	x1 = fold128(x1, k, x3);
+	x1 = fold128(x1, k, x4);
+
+	// Fold the remaining 16-byte blocks.
+	for (; size >= 16; size -= 16, pData += 16) {
+		x1 = fold128(x1, k, _mm_loadu_si128((const __m128i*)pData));
+	}
+
+	// Fold 128 bits to 64 bits.
+	t = _mm_clmulepi64_si128(x1, k, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), t);
+
+	// Fold 64 bits to 32 bits.
+	k = _mm_loadl_epi64((const __m128i*)k5k0);
+	t = _mm_srli_si128(x1, 4);
+	x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), k, 0x00);
+	x1 = _mm_xor_si128(x1, t);
+
+	// Barrett reduction to the final 32-bit CRC.
+	k = _mm_load_si128((const __m128i*)poly);
+	t = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), k, 0x10);
+	t = _mm_clmulepi64_si128(_mm_and_si128(t, mask32), k, 0x00);
+	x1 = _mm_xor_si128(x1, t);
+	return (uint32_t)_mm_extract_epi32(x1, 1);
+}
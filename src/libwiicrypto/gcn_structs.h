@@ -135,6 +135,22 @@ typedef struct _DOL_Header {
 } DOL_Header;
 ASSERT_STRUCT(DOL_Header, 256);
 
+/**
+ * FST entry.
+ * Reference: http://hitmen.c02.at/files/yagcd/yagcd/chap13.html
+ *
+ * The string table immediately follows the last entry.
+ * The root directory's next entry index is the total number of entries.
+ *
+ * All fields are big-endian.
+ */
+typedef struct _GCN_FST_Entry {
+	uint32_t type_name_offset;	// MSB: Type (0 == file, 1 == directory); low 24 bits: name offset
+	uint32_t file_offset;		// File: Offset (rshifted by 2 on Wii); Directory: parent index
+	uint32_t file_size;		// File: Size; Directory: next entry index
+} GCN_FST_Entry;
+ASSERT_STRUCT(GCN_FST_Entry, 12);
+
 /**
  * AppLoader errors.
  *
@@ -0,0 +1,80 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * impl_select.h: Runtime selection of CPU-specific implementations.       *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// NOTE: This is an internal header. It's used by the wrappers that select
+// a hardware-accelerated implementation based on CPU features.
+//
+// The selected implementation is stored in an IMPL_SELECT() variable,
+// which is -1 until the implementation is detected on first use.
+// Loads and stores are atomic (relaxed), so any thread can use it.
+// If multiple threads detect it at the same time, detection runs more
+// than once, but the result is always the same.
+
+#ifndef __RVTHTOOL_LIBWIICRYPTO_IMPL_SELECT_H__
+#define __RVTHTOOL_LIBWIICRYPTO_IMPL_SELECT_H__
+
+#ifdef _MSC_VER
+#  include <intrin.h>
+#endif /* _MSC_VER */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Declare a selected implementation variable.
+#define IMPL_SELECT(name)	static long name = -1
+
+/**
+ * Load a selected implementation variable.
+ * @param pImpl	[in] Implementation variable.
+ * @return Implementation, or -1 if it hasn't been detected yet.
+ */
+static inline int impl_select_load(long *pImpl)
+{
+#ifdef _MSC_VER
+	return (int)_InterlockedOr((volatile long*)pImpl, 0);
+#else /* !_MSC_VER */
+	return (int)__atomic_load_n(pImpl, __ATOMIC_RELAXED);
+#endif /* _MSC_VER */
+}
+
+/**
+ * Store a selected implementation variable.
+ * @param pImpl	[out] Implementation variable.
+ * @param impl	[in] Implementation. (-1 to detect it again on next use)
+ */
+static inline void impl_select_store(long *pImpl, int impl)
+{
+#ifdef _MSC_VER
+	_InterlockedExchange((volatile long*)pImpl, impl);
+#else /* !_MSC_VER */
+	__atomic_store_n(pImpl, (long)impl, __ATOMIC_RELAXED);
+#endif /* _MSC_VER */
+}
+
+/**
+ * Get the selected implementation, detecting it if necessary.
+ * @param pImpl		[in,out] Implementation variable.
+ * @param detect	[in] Function that returns the best implementation for this CPU.
+ * @return Implementation.
+ */
+static inline int impl_select_get(long *pImpl, int (*detect)(void))
+{
+	int impl = impl_select_load(pImpl);
+	if (impl < 0) {
+		impl = detect();
+		impl_select_store(pImpl, impl);
+	}
+	return impl;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_LIBWIICRYPTO_IMPL_SELECT_H__ */
@@ -16,9 +16,11 @@
 extern "C" {
 #endif
 
-// These private keys consist of p, q, a, b, and c.
-// Technically, only p and q are important, but calculating
-// a, b, and c is a pain.
+// These private keys consist of p, q, and e.
+// The CRT parameters are calculated by the RSA wrapper the first
+// time a key is used, and the prepared key is cached for the rest
+// of the process, so signing with these keys from multiple threads
+// only prepares each key once. (See rsaw_rsa2048_sign_multi().)
 
 extern const RSA2048PrivateKey rvth_privkey_RVL_dpki_ticket;
 extern const RSA2048PrivateKey rvth_privkey_RVL_dpki_tmd;
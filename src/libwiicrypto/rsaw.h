@@ -2,7 +2,7 @@
  * RVT-H Tool (libwiicrypto)                                               *
  * rsaw.h: RSA encryption wrapper functions.                               *
  *                                                                         *
- * Copyright (c) 2018 by David Korth.                                      *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
@@ -16,6 +16,12 @@
 extern "C" {
 #endif
 
+/**
+ * Get the name of the RSA implementation.
+ * @return RSA implementation name.
+ */
+const char *rsaw_get_impl_name(void);
+
 /**
  * Decrypt an RSA signature.
  * @param buf		[out] Output buffer. (Must be `size` bytes.)
@@ -28,6 +34,40 @@ extern "C" {
 int rsaw_decrypt_signature(uint8_t *buf, const uint8_t *modulus,
 	uint32_t exponent, const uint8_t *sig, size_t size);
 
+/** Prepared public keys. **/
+
+// Opaque RSA public key, already imported into the
+// crypto library's internal format.
+struct _RsawPubKey;
+typedef struct _RsawPubKey RsawPubKey;
+
+/**
+ * Import an RSA public key.
+ * @param modulus	[in] Public key modulus. (Must be `size` bytes.)
+ * @param exponent	[in] Public key exponent.
+ * @param size		[in] Modulus size. (256 for RSA-2048; 512 for RSA-4096.)
+ * @return RsawPubKey, or NULL on error.
+ */
+RsawPubKey *rsaw_pubkey_new(const uint8_t *modulus, uint32_t exponent, size_t size);
+
+/**
+ * Free an RSA public key.
+ * @param key RsawPubKey
+ */
+void rsaw_pubkey_free(RsawPubKey *key);
+
+/**
+ * Decrypt an RSA signature using a prepared public key.
+ * The key is not modified, so it can be used by multiple threads.
+ * @param buf		[out] Output buffer. (Must be `size` bytes.)
+ * @param key		[in] Public key.
+ * @param sig		[in] Signature. (Must be `size` bytes.)
+ * @param size		[in] Signature size. (Must match the key size.)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rsaw_decrypt_signature_with_key(uint8_t *buf, const RsawPubKey *key,
+	const uint8_t *sig, size_t size);
+
 /**
  * Encrypt data using an RSA public key.
  * @param buf			[out] Output buffer.
@@ -58,6 +98,26 @@ typedef struct _RSA2048PrivateKey {
 	uint32_t e;
 } RSA2048PrivateKey;
 
+/**
+ * Create RSA-2048 signatures for multiple hashes using an RSA private key.
+ * The private key is only prepared once, so this is faster than calling
+ * rsaw_rsa2048_sign() for each hash.
+ * Prepared private keys are cached, so this function is thread-safe and
+ * only the first signature made with each key has to prepare it.
+ * @param bufs			[out] Output buffers. (count * buf_size bytes)
+ * @param buf_size		[in] Size of each output buffer.
+ * @param priv_key_data		[in] RSA2048PrivateKey struct.
+ * @param pHashes		[in] Hashes. (count * hash_size bytes)
+ * @param hash_size		[in] Hash size. (20 for SHA-1, 32 for SHA-256)
+ * @param count			[in] Number of hashes.
+ * @param doSHA256		[in] If 1, do SHA-256. (TODO: Use an enum.)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rsaw_rsa2048_sign_multi(uint8_t *bufs, size_t buf_size,
+	const RSA2048PrivateKey *priv_key_data,
+	const uint8_t *pHashes, size_t hash_size,
+	unsigned int count, int doSHA256);
+
 /**
  * Create an RSA-2048 signature using an RSA private key.
  * @param buf			[out] Output buffer.
@@ -2,11 +2,12 @@
  * RVT-H Tool (libwiicrypto)                                               *
  * rsaw_nettle.c: RSA encryption wrapper functions. (Nettle/GMP version)   *
  *                                                                         *
- * Copyright (c) 2018 by David Korth.                                      *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
 #include "rsaw.h"
+#include "static_mutex.h"
 
 #include <assert.h>
 #include <errno.h>
@@ -31,41 +32,39 @@
 #define RANDOM_BUFFER_SIZE 1024
 
 /**
- * Decrypt an RSA signature.
+ * Get the name of the RSA implementation.
+ * @return RSA implementation name.
+ */
+const char *rsaw_get_impl_name(void)
+{
+#ifdef NETTLE_USE_MINI_GMP
+	return "nettle (mini-GMP)";
+#else /* !NETTLE_USE_MINI_GMP */
+	return "nettle (GMP)";
+#endif /* NETTLE_USE_MINI_GMP */
+}
+
+/**
+ * Decrypt an RSA signature. (internal function)
  * @param buf		[out] Output buffer. (Must be `size` bytes.)
- * @param modulus	[in] Public key modulus. (Must be `size` bytes.)
+ * @param n		[in] Public key modulus.
  * @param exponent	[in] Public key exponent.
  * @param sig		[in] Signature. (Must be `size` bytes.)
  * @param size		[in] Signature size. (256 for RSA-2048; 512 for RSA-4096.)
  * @return 0 on success; negative POSIX error code on error.
  */
-int rsaw_decrypt_signature(uint8_t *buf, const uint8_t *modulus,
+static int rsaw_decrypt_signature_int(uint8_t *buf, mpz_srcptr n,
 	uint32_t exponent, const uint8_t *sig, size_t size)
 {
 	// F(x) = x^e mod n
-	mpz_t n, x, f;	// modulus, signature, result
-
-	assert(buf != NULL);
-	assert(modulus != NULL);
-	assert(exponent != 0);
-	assert(sig != NULL);
-	assert(size == 256 || size == 512);
-
-	if (!buf || !modulus || exponent == 0 || !sig || (size != 256 && size != 512)) {
-		// Invalid parameters.
-		errno = EINVAL;
-		return -EINVAL;
-	}
+	mpz_t x, f;	// signature, result
 
-	mpz_init(n);
 	mpz_init(x);
 	mpz_init(f);
 
-	mpz_import(n, 1, 1, size, 1, 0, modulus);
 	mpz_import(x, 1, 1, size, 1, 0, sig);
 	mpz_powm_ui(f, x, exponent, n);
 
-	mpz_clear(n);
 	mpz_clear(x);
 
 	// Decrypted signature must not be more than (size*8) bits.
@@ -86,6 +85,119 @@ int rsaw_decrypt_signature(uint8_t *buf, const uint8_t *modulus,
 	return 0;
 }
 
+/**
+ * Decrypt an RSA signature.
+ * @param buf		[out] Output buffer. (Must be `size` bytes.)
+ * @param modulus	[in] Public key modulus. (Must be `size` bytes.)
+ * @param exponent	[in] Public key exponent.
+ * @param sig		[in] Signature. (Must be `size` bytes.)
+ * @param size		[in] Signature size. (256 for RSA-2048; 512 for RSA-4096.)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rsaw_decrypt_signature(uint8_t *buf, const uint8_t *modulus,
+	uint32_t exponent, const uint8_t *sig, size_t size)
+{
+	mpz_t n;	// modulus
+	int ret;
+
+	assert(buf != NULL);
+	assert(modulus != NULL);
+	assert(exponent != 0);
+	assert(sig != NULL);
+	assert(size == 256 || size == 512);
+
+	if (!buf || !modulus || exponent == 0 || !sig || (size != 256 && size != 512)) {
+		// Invalid parameters.
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	mpz_init(n);
+	mpz_import(n, 1, 1, size, 1, 0, modulus);
+	ret = rsaw_decrypt_signature_int(buf, n, exponent, sig, size);
+	mpz_clear(n);
+	return ret;
+}
+
+/** Prepared public keys. **/
+
+struct _RsawPubKey {
+	mpz_t n;		// Modulus
+	uint32_t exponent;	// Exponent
+	unsigned int size;	// Modulus size, in bytes
+};
+
+/**
+ * Import an RSA public key.
+ * @param modulus	[in] Public key modulus. (Must be `size` bytes.)
+ * @param exponent	[in] Public key exponent.
+ * @param size		[in] Modulus size. (256 for RSA-2048; 512 for RSA-4096.)
+ * @return RsawPubKey, or NULL on error.
+ */
+RsawPubKey *rsaw_pubkey_new(const uint8_t *modulus, uint32_t exponent, size_t size)
+{
+	RsawPubKey *key;
+
+	assert(modulus != NULL);
+	assert(exponent != 0);
+	assert(size == 256 || size == 512);
+	if (!modulus || exponent == 0 || (size != 256 && size != 512)) {
+		// Invalid parameters.
+		errno = EINVAL;
+		return NULL;
+	}
+
+	key = malloc(sizeof(*key));
+	if (!key) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	mpz_init(key->n);
+	mpz_import(key->n, 1, 1, size, 1, 0, modulus);
+	key->exponent = exponent;
+	key->size = (unsigned int)size;
+	return key;
+}
+
+/**
+ * Free an RSA public key.
+ * @param key RsawPubKey
+ */
+void rsaw_pubkey_free(RsawPubKey *key)
+{
+	if (!key)
+		return;
+
+	mpz_clear(key->n);
+	free(key);
+}
+
+/**
+ * Decrypt an RSA signature using a prepared public key.
+ * The key is not modified, so it can be used by multiple threads.
+ * @param buf		[out] Output buffer. (Must be `size` bytes.)
+ * @param key		[in] Public key.
+ * @param sig		[in] Signature. (Must be `size` bytes.)
+ * @param size		[in] Signature size. (Must match the key size.)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rsaw_decrypt_signature_with_key(uint8_t *buf, const RsawPubKey *key,
+	const uint8_t *sig, size_t size)
+{
+	assert(buf != NULL);
+	assert(key != NULL);
+	assert(sig != NULL);
+
+	if (!buf || !key || !sig || size != key->size) {
+		// Invalid parameters.
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	return rsaw_decrypt_signature_int(buf, key->n, key->exponent, sig, size);
+}
+
 /**
  * Initialize a yarrow random number context.
  * This seeds the context with data from /dev/urandom.
@@ -171,7 +283,11 @@ static int init_random(struct yarrow256_ctx *yarrow)
 #endif
 
 	// Seed the random number generator.
+#ifdef _WIN32
 	yarrow256_seed(yarrow, size, buf);
+#else /* !_WIN32 */
+	yarrow256_seed(yarrow, total_read, buf);
+#endif /* _WIN32 */
 
 end:
 	free(buf);
@@ -190,6 +306,48 @@ end:
 	return -err;
 }
 
+// Process-wide random number generator.
+// Seeding requires reading from the OS entropy source,
+// so it's only done once, on first use.
+static struct yarrow256_ctx shared_yarrow;
+static int shared_yarrow_seeded = 0;
+STATIC_MUTEX(shared_yarrow_lock);
+
+/**
+ * Make sure the process-wide random number generator is seeded.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int shared_random_init(void)
+{
+	int ret = 0;
+
+	STATIC_MUTEX_LOCK(shared_yarrow_lock);
+	if (!shared_yarrow_seeded) {
+		ret = init_random(&shared_yarrow);
+		if (ret == 0) {
+			shared_yarrow_seeded = 1;
+		}
+	}
+	STATIC_MUTEX_UNLOCK(shared_yarrow_lock);
+	return ret;
+}
+
+/**
+ * Get random data from the process-wide random number generator.
+ * shared_random_init() must have been called first.
+ * This function matches nettle_random_func.
+ * @param ctx		[in] Unused.
+ * @param length	[in] Length of dst.
+ * @param dst		[out] Random data.
+ */
+static void shared_random(void *ctx, size_t length, uint8_t *dst)
+{
+	((void)ctx);
+	STATIC_MUTEX_LOCK(shared_yarrow_lock);
+	yarrow256_random(&shared_yarrow, length, dst);
+	STATIC_MUTEX_UNLOCK(shared_yarrow_lock);
+}
+
 /**
  * Encrypt data using an RSA public key.
  * @param buf			[out] Output buffer.
@@ -207,8 +365,6 @@ int rsaw_encrypt(uint8_t *buf, size_t buf_size,
 	const uint8_t *cleartext, size_t cleartext_size)
 {
 	struct rsa_public_key key;
-	struct yarrow256_ctx yarrow;
-
 	mpz_t ciphertext;
 	int ret = 0;
 
@@ -235,7 +391,7 @@ int rsaw_encrypt(uint8_t *buf, size_t buf_size,
 	mpz_init(ciphertext);
 
 	// Initialize the random number generator.
-	ret = init_random(&yarrow);
+	ret = shared_random_init();
 	if (ret != 0) {
 		// Error initializing the random number generator.
 		goto end;
@@ -251,7 +407,7 @@ int rsaw_encrypt(uint8_t *buf, size_t buf_size,
 	}
 
 	// Encrypt the data.
-	if (!rsa_encrypt(&key, &yarrow, (nettle_random_func*)yarrow256_random,
+	if (!rsa_encrypt(&key, NULL, (nettle_random_func*)shared_random,
 	    cleartext_size, cleartext, ciphertext))
 	{
 		// Error encrypting the data.
@@ -282,21 +438,13 @@ end:
 }
 
 /**
- * Create an RSA-2048 signature using an RSA private key.
- * @param buf			[out] Output buffer.
- * @param buf_size		[in] Size of `buf`.
+ * Prepare an RSA-2048 private key.
+ * @param key			[out] Private key. (Must be initialized by rsa_private_key_init().)
  * @param priv_key_data		[in] RSA2048PrivateKey struct.
- * @param pHash			[in] Hash.
- * @param hash_size		[in] Hash size. (20 for SHA-1, 32 for SHA-256)
- * @param doSHA256		[in] If 1, do SHA-256. (TODO: Use an enum.)
  * @return 0 on success; negative POSIX error code on error.
  */
-int rsaw_rsa2048_sign(uint8_t *buf, size_t buf_size,
-	const RSA2048PrivateKey *priv_key_data,
-	const uint8_t *pHash, size_t hash_size,
-	int doSHA256)
+static int privkey_prepare(struct rsa_private_key *key, const RSA2048PrivateKey *priv_key_data)
 {
-	struct rsa_private_key key;
 	struct {
 		mpz_t e;	// e
 		mpz_t p1;	// p-1
@@ -304,16 +452,171 @@ int rsaw_rsa2048_sign(uint8_t *buf, size_t buf_size,
 		mpz_t phi;	// (p-1)*(q-1)
 		mpz_t d;	// 1 / (e mod phi)
 	} bncalc;
-	mpz_t signature;
 	int ret = 0;
 
-	assert(buf != NULL);
+	// Initialize the temporary bignums.
+	mpz_init(bncalc.e);
+	mpz_init(bncalc.p1);
+	mpz_init(bncalc.q1);
+	mpz_init(bncalc.phi);
+	mpz_init(bncalc.d);
+
+	// Import the private key.
+	mpz_import(key->p, 1, 1, sizeof(priv_key_data->p), 1, 0, priv_key_data->p);
+	mpz_import(key->q, 1, 1, sizeof(priv_key_data->q), 1, 0, priv_key_data->q);
+
+	// Calculate a, b, and c.
+	mpz_sub_ui(bncalc.p1, key->p, 1);
+	mpz_sub_ui(bncalc.q1, key->q, 1);
+	mpz_mul(bncalc.phi, bncalc.p1, bncalc.q1);
+	mpz_set_ui(bncalc.e, priv_key_data->e);
+	mpz_invert(bncalc.d, bncalc.e, bncalc.phi);
+	// a = d % (p - 1)
+	mpz_fdiv_r(key->a, bncalc.d, bncalc.p1);
+	// b = d % (q - 1)
+	mpz_fdiv_r(key->b, bncalc.d, bncalc.q1);
+	// c = q^{-1} (mod p)
+	mpz_invert(key->c, key->q, key->p);
+
+	// NOTE: Newer versions of nettle check the size of c in
+	// rsa_private_key_prepare(), so a, b, and c must be set first.
+	if (!rsa_private_key_prepare(key)) {
+		// Error importing the private key.
+		ret = -EIO;
+	}
+
+	mpz_clear(bncalc.e);
+	mpz_clear(bncalc.p1);
+	mpz_clear(bncalc.q1);
+	mpz_clear(bncalc.phi);
+	mpz_clear(bncalc.d);
+	return ret;
+}
+
+// Process-wide cache of prepared private keys.
+// Preparing a private key requires two modular inversions,
+// which is a significant part of signing a single ticket or TMD.
+// Prepared keys aren't modified when signing, so they can be
+// used by multiple threads at once.
+// Entries are matched by key contents, not by pointer.
+#define PRIVKEY_CACHE_SIZE 8
+typedef struct _PrivKeyCacheEntry {
+	RSA2048PrivateKey data;
+	struct rsa_private_key key;
+} PrivKeyCacheEntry;
+static PrivKeyCacheEntry privkey_cache[PRIVKEY_CACHE_SIZE];
+static unsigned int privkey_cache_count = 0;
+STATIC_MUTEX(privkey_cache_lock);
+
+/**
+ * Find a prepared RSA-2048 private key in the cache.
+ * privkey_cache_lock must be held.
+ * @param priv_key_data		[in] RSA2048PrivateKey struct.
+ * @return Prepared private key, or NULL if it isn't cached.
+ */
+static const struct rsa_private_key *privkey_cache_find(const RSA2048PrivateKey *priv_key_data)
+{
+	unsigned int i;
+	for (i = 0; i < privkey_cache_count; i++) {
+		if (!memcmp(&privkey_cache[i].data, priv_key_data, sizeof(*priv_key_data))) {
+			return &privkey_cache[i].key;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Get a prepared RSA-2048 private key from the cache.
+ * If the key isn't cached yet, it's prepared and added to the cache.
+ *
+ * The key is prepared without holding the lock, so other threads can
+ * use cached keys in the meantime. If another thread adds the same key
+ * first, the key prepared by this thread is discarded.
+ *
+ * @param priv_key_data		[in] RSA2048PrivateKey struct.
+ * @param pKey			[out] Prepared private key, or NULL if the cache is full.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int privkey_cache_get(const RSA2048PrivateKey *priv_key_data,
+	const struct rsa_private_key **pKey)
+{
+	struct rsa_private_key key;
+	int full;
+	int ret;
+
+	STATIC_MUTEX_LOCK(privkey_cache_lock);
+	*pKey = privkey_cache_find(priv_key_data);
+	full = (privkey_cache_count >= PRIVKEY_CACHE_SIZE);
+	STATIC_MUTEX_UNLOCK(privkey_cache_lock);
+	if (*pKey || full) {
+		// Found the key, or the cache is full.
+		return 0;
+	}
+
+	// Prepare the key.
+	rsa_private_key_init(&key);
+	ret = privkey_prepare(&key, priv_key_data);
+	if (ret != 0) {
+		rsa_private_key_clear(&key);
+		return ret;
+	}
+
+	// Add it to the cache.
+	STATIC_MUTEX_LOCK(privkey_cache_lock);
+	*pKey = privkey_cache_find(priv_key_data);
+	if (!*pKey && privkey_cache_count < PRIVKEY_CACHE_SIZE) {
+		// NOTE: The entry takes ownership of the key's mpz_t values,
+		// so the local copy must not be cleared.
+		PrivKeyCacheEntry *const entry = &privkey_cache[privkey_cache_count];
+		memcpy(&entry->data, priv_key_data, sizeof(entry->data));
+		entry->key = key;
+		privkey_cache_count++;
+		*pKey = &entry->key;
+		STATIC_MUTEX_UNLOCK(privkey_cache_lock);
+		return 0;
+	}
+	STATIC_MUTEX_UNLOCK(privkey_cache_lock);
+
+	// Another thread added the same key first, or the cache
+	// filled up in the meantime. Discard this one.
+	rsa_private_key_clear(&key);
+	return 0;
+}
+
+/**
+ * Create RSA-2048 signatures for multiple hashes using an RSA private key.
+ * The private key is only prepared once, so this is faster than calling
+ * rsaw_rsa2048_sign() for each hash.
+ * Prepared private keys are cached, so this function is thread-safe and
+ * only the first signature made with each key has to prepare it.
+ * @param bufs			[out] Output buffers. (count * buf_size bytes)
+ * @param buf_size		[in] Size of each output buffer.
+ * @param priv_key_data		[in] RSA2048PrivateKey struct.
+ * @param pHashes		[in] Hashes. (count * hash_size bytes)
+ * @param hash_size		[in] Hash size. (20 for SHA-1, 32 for SHA-256)
+ * @param count			[in] Number of hashes.
+ * @param doSHA256		[in] If 1, do SHA-256. (TODO: Use an enum.)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rsaw_rsa2048_sign_multi(uint8_t *bufs, size_t buf_size,
+	const RSA2048PrivateKey *priv_key_data,
+	const uint8_t *pHashes, size_t hash_size,
+	unsigned int count, int doSHA256)
+{
+	const struct rsa_private_key *key;
+	struct rsa_private_key uncached_key;
+	int use_uncached_key = 0;
+	mpz_t signature;
+	unsigned int i;
+	int ret;
+
+	assert(bufs != NULL);
 	assert(buf_size != 0);
 	assert(buf_size >= 256);
 	assert(priv_key_data != NULL);
-	assert(pHash != NULL);
+	assert(pHashes != NULL);
 
-	if (!buf || buf_size == 0 || buf_size < 256 || !pHash) {
+	if (!bufs || buf_size == 0 || buf_size < 256 || !priv_key_data || !pHashes) {
 		// Invalid parameters.
 		errno = EINVAL;
 		return -EINVAL;
@@ -333,75 +636,80 @@ int rsaw_rsa2048_sign(uint8_t *buf, size_t buf_size,
 		}
 	}
 
-	// Initialize the temporary bignums.
-	mpz_init(bncalc.e);
-	mpz_init(bncalc.p1);
-	mpz_init(bncalc.q1);
-	mpz_init(bncalc.phi);
-	mpz_init(bncalc.d);
+	mpz_init(signature);
 
-	// Initialize the RSA private key.
-	rsa_private_key_init(&key);
-	mpz_import(key.p, 1, 1, sizeof(priv_key_data->p), 1, 0, priv_key_data->p);
-	mpz_import(key.q, 1, 1, sizeof(priv_key_data->q), 1, 0, priv_key_data->q);
-	if (!rsa_private_key_prepare(&key)) {
+	// Get the prepared private key.
+	ret = privkey_cache_get(priv_key_data, &key);
+	if (ret != 0) {
 		// Error importing the private key.
-		errno = EIO;
-		return -EIO;
+		goto end;
+	} else if (!key) {
+		// Cache is full. Prepare the key just for this call.
+		rsa_private_key_init(&uncached_key);
+		use_uncached_key = 1;
+		ret = privkey_prepare(&uncached_key, priv_key_data);
+		if (ret != 0) {
+			goto end;
+		}
+		key = &uncached_key;
 	}
 
-	// Calculate a, b, and c.
-	mpz_sub_ui(bncalc.p1, key.p, 1);
-	mpz_sub_ui(bncalc.q1, key.q, 1);
-	mpz_mul(bncalc.phi, bncalc.p1, bncalc.q1);
-	mpz_set_ui(bncalc.e, priv_key_data->e);
-	mpz_invert(bncalc.d, bncalc.e, bncalc.phi);
-	// a = d % (p - 1)
-	mpz_fdiv_r(key.a, bncalc.d, bncalc.p1);
-	// b = d % (q - 1)
-	mpz_fdiv_r(key.b, bncalc.d, bncalc.q1);
-	// c = q^{-1} (mod p)
-	mpz_invert(key.c, key.q, key.p);
-
-	// Create the signature.
-	mpz_init(signature);
-	if (!doSHA256) {
-		if (!rsa_sha1_sign_digest(&key, pHash, signature)) {
-			// Error signing the SHA-1 hash.
-			ret = -EIO;
-			goto end;
+	for (i = 0; i < count; i++, bufs += buf_size, pHashes += hash_size) {
+		// Create the signature.
+		if (!doSHA256) {
+			if (!rsa_sha1_sign_digest(key, pHashes, signature)) {
+				// Error signing the SHA-1 hash.
+				ret = -EIO;
+				goto end;
+			}
+		} else {
+			if (!rsa_sha256_sign_digest(key, pHashes, signature)) {
+				// Error signing the SHA-256 hash.
+				ret = -EIO;
+				goto end;
+			}
 		}
-	} else {
-		if (!rsa_sha256_sign_digest(&key, pHash, signature)) {
-			// Error signing the SHA-256 hash.
-			ret = -EIO;
+
+		// Encrypted data must not be more than (buf_size*8) bits.
+		if (mpz_sizeinbase(signature, 2) > (buf_size*8)) {
+			// Encrypted data is too big.
+			ret = -ENOSPC;
 			goto end;
 		}
-	}
 
-	// Encrypted data must not be more than (buf_size*8) bits.
-	if (mpz_sizeinbase(signature, 2) > (buf_size*8)) {
-		// Encrypted data is too big.
-		ret = -ENOSPC;
-		goto end;
+		// NOTE: Invalid signatures may be smaller than the buffer.
+		// Clear the buffer first to ensure that invalid signatures
+		// result in an all-zero buffer.
+		memset(bufs, 0, buf_size);
+		mpz_export(bufs, NULL, 1, buf_size, 1, 0, signature);
 	}
 
-	// NOTE: Invalid signatures may be smaller than the buffer.
-	// Clear the buffer first to ensure that invalid signatures
-	// result in an all-zero buffer.
-	memset(buf, 0, buf_size);
-	mpz_export(buf, NULL, 1, buf_size, 1, 0, signature);
-
 end:
-	rsa_private_key_clear(&key);
+	if (use_uncached_key) {
+		rsa_private_key_clear(&uncached_key);
+	}
 	mpz_clear(signature);
-	mpz_clear(bncalc.e);
-	mpz_clear(bncalc.p1);
-	mpz_clear(bncalc.q1);
-	mpz_clear(bncalc.phi);
-	mpz_clear(bncalc.d);
 	if (ret != 0) {
 		errno = -ret;
 	}
 	return ret;
 }
+
+/**
+ * Create an RSA-2048 signature using an RSA private key.
+ * @param buf			[out] Output buffer.
+ * @param buf_size		[in] Size of `buf`.
+ * @param priv_key_data		[in] RSA2048PrivateKey struct.
+ * @param pHash			[in] Hash.
+ * @param hash_size		[in] Hash size. (20 for SHA-1, 32 for SHA-256)
+ * @param doSHA256		[in] If 1, do SHA-256. (TODO: Use an enum.)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rsaw_rsa2048_sign(uint8_t *buf, size_t buf_size,
+	const RSA2048PrivateKey *priv_key_data,
+	const uint8_t *pHash, size_t hash_size,
+	int doSHA256)
+{
+	return rsaw_rsa2048_sign_multi(buf, buf_size, priv_key_data,
+		pHash, hash_size, 1, doSHA256);
+}
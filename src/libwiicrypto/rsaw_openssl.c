@@ -0,0 +1,703 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * rsaw_openssl.c: RSA encryption wrapper functions. (OpenSSL version)     *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "rsaw.h"
+#include "static_mutex.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+// NOTE: Using the BIGNUM functions directly. The RSA_*() functions
+// are deprecated in OpenSSL 3.0, and the EVP_PKEY functions don't
+// have a way to use raw RSA with an arbitrary exponent that works
+// with both OpenSSL 1.1 and 3.x.
+#include <openssl/bn.h>
+#include <openssl/rand.h>
+
+// Digest sizes.
+#define SHA1_DIGEST_SIZE 20
+#define SHA256_DIGEST_SIZE 32
+
+// PKCS #1 v1.5 DigestInfo prefixes. (RFC 8017, section 9.2)
+static const uint8_t digest_info_sha1[] = {
+	0x30,0x21,0x30,0x09,0x06,0x05,0x2B,0x0E,
+	0x03,0x02,0x1A,0x05,0x00,0x04,0x14,
+};
+static const uint8_t digest_info_sha256[] = {
+	0x30,0x31,0x30,0x0D,0x06,0x09,0x60,0x86,
+	0x48,0x01,0x65,0x03,0x04,0x02,0x01,0x05,
+	0x00,0x04,0x20,
+};
+
+/**
+ * Get the name of the RSA implementation.
+ * @return RSA implementation name.
+ */
+const char *rsaw_get_impl_name(void)
+{
+	return "OpenSSL";
+}
+
+/**
+ * Export a bignum as a fixed-size big-endian number.
+ * @param buf	[out] Output buffer.
+ * @param size	[in] Size of `buf`.
+ * @param bn	[in] Bignum.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int bn_export(uint8_t *buf, size_t size, const BIGNUM *bn)
+{
+	// Number must not be more than (size*8) bits.
+	if ((size_t)BN_num_bytes(bn) > size) {
+		errno = ENOSPC;
+		return -ENOSPC;
+	}
+
+	// NOTE: Invalid signatures may be smaller than the buffer.
+	// BN_bn2binpad() zero-pads the number, so invalid signatures
+	// result in a buffer that's all zero except for the number.
+	if (BN_bn2binpad(bn, buf, (int)size) < 0) {
+		errno = EIO;
+		return -EIO;
+	}
+	return 0;
+}
+
+/**
+ * Decrypt an RSA signature. (internal function)
+ * @param buf		[out] Output buffer. (Must be `size` bytes.)
+ * @param n		[in] Public key modulus.
+ * @param e		[in] Public key exponent.
+ * @param mont		[in,opt] Montgomery context for n.
+ * @param sig		[in] Signature. (Must be `size` bytes.)
+ * @param size		[in] Signature size. (256 for RSA-2048; 512 for RSA-4096.)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int rsaw_decrypt_signature_int(uint8_t *buf, const BIGNUM *n, const BIGNUM *e,
+	BN_MONT_CTX *mont, const uint8_t *sig, size_t size)
+{
+	// F(x) = x^e mod n
+	BN_CTX *ctx = BN_CTX_new();
+	BIGNUM *x = BN_bin2bn(sig, (int)size, NULL);	// signature
+	BIGNUM *f = BN_new();				// result
+	int ret = -EIO;
+
+	if (ctx && x && f && BN_mod_exp_mont(f, x, e, n, ctx, mont)) {
+		ret = bn_export(buf, size, f);
+	} else if (!ctx || !x || !f) {
+		ret = -ENOMEM;
+	}
+
+	BN_free(f);
+	BN_free(x);
+	BN_CTX_free(ctx);
+	if (ret != 0) {
+		memset(buf, 0, size);
+		errno = -ret;
+	}
+	return ret;
+}
+
+/**
+ * Decrypt an RSA signature.
+ * @param buf		[out] Output buffer. (Must be `size` bytes.)
+ * @param modulus	[in] Public key modulus. (Must be `size` bytes.)
+ * @param exponent	[in] Public key exponent.
+ * @param sig		[in] Signature. (Must be `size` bytes.)
+ * @param size		[in] Signature size. (256 for RSA-2048; 512 for RSA-4096.)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rsaw_decrypt_signature(uint8_t *buf, const uint8_t *modulus,
+	uint32_t exponent, const uint8_t *sig, size_t size)
+{
+	BIGNUM *n, *e;
+	int ret;
+
+	assert(buf != NULL);
+	assert(modulus != NULL);
+	assert(exponent != 0);
+	assert(sig != NULL);
+	assert(size == 256 || size == 512);
+
+	if (!buf || !modulus || exponent == 0 || !sig || (size != 256 && size != 512)) {
+		// Invalid parameters.
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	n = BN_bin2bn(modulus, (int)size, NULL);
+	e = BN_new();
+	if (!n || !e || !BN_set_word(e, exponent)) {
+		BN_free(n);
+		BN_free(e);
+		errno = ENOMEM;
+		return -ENOMEM;
+	}
+
+	ret = rsaw_decrypt_signature_int(buf, n, e, NULL, sig, size);
+	BN_free(n);
+	BN_free(e);
+	return ret;
+}
+
+/** Prepared public keys. **/
+
+struct _RsawPubKey {
+	BIGNUM *n;		// Modulus
+	BIGNUM *e;		// Exponent
+	BN_MONT_CTX *mont;	// Montgomery context for n
+	unsigned int size;	// Modulus size, in bytes
+};
+
+/**
+ * Import an RSA public key.
+ * @param modulus	[in] Public key modulus. (Must be `size` bytes.)
+ * @param exponent	[in] Public key exponent.
+ * @param size		[in] Modulus size. (256 for RSA-2048; 512 for RSA-4096.)
+ * @return RsawPubKey, or NULL on error.
+ */
+RsawPubKey *rsaw_pubkey_new(const uint8_t *modulus, uint32_t exponent, size_t size)
+{
+	RsawPubKey *key;
+	BN_CTX *ctx;
+
+	assert(modulus != NULL);
+	assert(exponent != 0);
+	assert(size == 256 || size == 512);
+	if (!modulus || exponent == 0 || (size != 256 && size != 512)) {
+		// Invalid parameters.
+		errno = EINVAL;
+		return NULL;
+	}
+
+	key = calloc(1, sizeof(*key));
+	if (!key) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	// The Montgomery context is only used for reading after
+	// it's been set up, so the key can be used by multiple threads.
+	ctx = BN_CTX_new();
+	key->n = BN_bin2bn(modulus, (int)size, NULL);
+	key->e = BN_new();
+	key->mont = BN_MONT_CTX_new();
+	key->size = (unsigned int)size;
+	if (!ctx || !key->n || !key->e || !key->mont ||
+	    !BN_set_word(key->e, exponent) ||
+	    !BN_MONT_CTX_set(key->mont, key->n, ctx))
+	{
+		BN_CTX_free(ctx);
+		rsaw_pubkey_free(key);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	BN_CTX_free(ctx);
+	return key;
+}
+
+/**
+ * Free an RSA public key.
+ * @param key RsawPubKey
+ */
+void rsaw_pubkey_free(RsawPubKey *key)
+{
+	if (!key)
+		return;
+
+	BN_MONT_CTX_free(key->mont);
+	BN_free(key->n);
+	BN_free(key->e);
+	free(key);
+}
+
+/**
+ * Decrypt an RSA signature using a prepared public key.
+ * The key is not modified, so it can be used by multiple threads.
+ * @param buf		[out] Output buffer. (Must be `size` bytes.)
+ * @param key		[in] Public key.
+ * @param sig		[in] Signature. (Must be `size` bytes.)
+ * @param size		[in] Signature size. (Must match the key size.)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rsaw_decrypt_signature_with_key(uint8_t *buf, const RsawPubKey *key,
+	const uint8_t *sig, size_t size)
+{
+	assert(buf != NULL);
+	assert(key != NULL);
+	assert(sig != NULL);
+
+	if (!buf || !key || !sig || size != key->size) {
+		// Invalid parameters.
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	return rsaw_decrypt_signature_int(buf, key->n, key->e, key->mont, sig, size);
+}
+
+/**
+ * Encrypt data using an RSA public key.
+ * @param buf			[out] Output buffer.
+ * @param buf_size		[in] Size of `buf`.
+ * @param modulus		[in] Public key modulus.
+ * @param modulus_size		[in] Size of `modulus`, in bytes.
+ * @param exponent		[in] Public key exponent.
+ * @param cleartext		[in] Cleartext.
+ * @param cleartext_size	[in] Size of `cleartext`, in bytes.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rsaw_encrypt(uint8_t *buf, size_t buf_size,
+	const uint8_t *modulus, size_t modulus_size,
+	uint32_t exponent,
+	const uint8_t *cleartext, size_t cleartext_size)
+{
+	uint8_t em[512];	// Encoded message
+	size_t ps_len, i;
+	BIGNUM *n = NULL, *e = NULL, *m = NULL, *c = NULL;
+	BN_CTX *ctx = NULL;
+	int ret = 0;
+
+	assert(buf != NULL);
+	assert(buf_size != 0);
+	assert(buf_size >= modulus_size);
+	assert(modulus != NULL);
+	assert(modulus_size == 256 || modulus_size == 512);
+	assert(exponent != 0);
+	assert(cleartext != NULL);
+	assert(cleartext_size != 0);
+
+	if (!buf || buf_size == 0 || buf_size < modulus_size ||
+	    !modulus || (modulus_size != 256 && modulus_size != 512) ||
+	    exponent == 0 || !cleartext || cleartext_size == 0)
+	{
+		// Invalid parameters.
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	// PKCS #1 v1.5 encryption padding: 00 02 PS 00 M
+	// PS is at least 8 non-zero random bytes.
+	if (cleartext_size > modulus_size - 11) {
+		// Cleartext is too big.
+		errno = ENOSPC;
+		return -ENOSPC;
+	}
+	ps_len = modulus_size - 3 - cleartext_size;
+	em[0] = 0x00;
+	em[1] = 0x02;
+	if (RAND_bytes(&em[2], (int)ps_len) != 1) {
+		// Error getting random data.
+		errno = EIO;
+		return -EIO;
+	}
+	for (i = 2; i < 2 + ps_len; i++) {
+		while (em[i] == 0) {
+			if (RAND_bytes(&em[i], 1) != 1) {
+				errno = EIO;
+				return -EIO;
+			}
+		}
+	}
+	em[2 + ps_len] = 0x00;
+	memcpy(&em[3 + ps_len], cleartext, cleartext_size);
+
+	// Encrypt the data.
+	// C = M^e mod n
+	ctx = BN_CTX_new();
+	n = BN_bin2bn(modulus, (int)modulus_size, NULL);
+	e = BN_new();
+	m = BN_bin2bn(em, (int)modulus_size, NULL);
+	c = BN_new();
+	if (!ctx || !n || !e || !m || !c || !BN_set_word(e, exponent)) {
+		ret = -ENOMEM;
+		goto end;
+	}
+	if (!BN_mod_exp(c, m, e, n, ctx)) {
+		// Error encrypting the data.
+		ret = -EIO;
+		goto end;
+	}
+
+	ret = bn_export(buf, buf_size, c);
+
+end:
+	OPENSSL_cleanse(em, sizeof(em));
+	BN_clear_free(m);
+	BN_free(c);
+	BN_free(e);
+	BN_free(n);
+	BN_CTX_free(ctx);
+	if (ret != 0) {
+		errno = -ret;
+	}
+	return ret;
+}
+
+/** Private keys. **/
+
+// Prepared RSA-2048 private key. (CRT parameters)
+typedef struct _RsawPrivKey {
+	BIGNUM *p, *q;		// Primes
+	BIGNUM *dp, *dq;	// d mod (p-1), d mod (q-1)
+	BIGNUM *qinv;		// q^{-1} mod p
+	BN_MONT_CTX *mont_p;	// Montgomery context for p
+	BN_MONT_CTX *mont_q;	// Montgomery context for q
+} RsawPrivKey;
+
+/**
+ * Free a prepared RSA-2048 private key's bignums.
+ * @param key Private key.
+ */
+static void privkey_clear(RsawPrivKey *key)
+{
+	BN_MONT_CTX_free(key->mont_p);
+	BN_MONT_CTX_free(key->mont_q);
+	BN_clear_free(key->p);
+	BN_clear_free(key->q);
+	BN_clear_free(key->dp);
+	BN_clear_free(key->dq);
+	BN_clear_free(key->qinv);
+	memset(key, 0, sizeof(*key));
+}
+
+/**
+ * Prepare an RSA-2048 private key.
+ * @param key			[out] Private key. (Must be zeroed.)
+ * @param priv_key_data		[in] RSA2048PrivateKey struct.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int privkey_prepare(RsawPrivKey *key, const RSA2048PrivateKey *priv_key_data)
+{
+	BN_CTX *ctx = BN_CTX_new();
+	BIGNUM *e = BN_new();
+	BIGNUM *p1 = BN_new();		// p-1
+	BIGNUM *q1 = BN_new();		// q-1
+	BIGNUM *phi = BN_new();		// (p-1)*(q-1)
+	BIGNUM *d = BN_new();		// 1 / (e mod phi)
+	int ret = 0;
+
+	// Import the private key.
+	key->p = BN_bin2bn(priv_key_data->p, sizeof(priv_key_data->p), NULL);
+	key->q = BN_bin2bn(priv_key_data->q, sizeof(priv_key_data->q), NULL);
+	key->dp = BN_new();
+	key->dq = BN_new();
+	key->qinv = BN_new();
+	key->mont_p = BN_MONT_CTX_new();
+	key->mont_q = BN_MONT_CTX_new();
+	if (!ctx || !e || !p1 || !q1 || !phi || !d ||
+	    !key->p || !key->q || !key->dp || !key->dq || !key->qinv ||
+	    !key->mont_p || !key->mont_q)
+	{
+		ret = -ENOMEM;
+		goto end;
+	}
+
+	// Calculate the CRT parameters.
+	if (!BN_set_word(e, priv_key_data->e) ||
+	    !BN_sub(p1, key->p, BN_value_one()) ||
+	    !BN_sub(q1, key->q, BN_value_one()) ||
+	    !BN_mul(phi, p1, q1, ctx) ||
+	    !BN_mod_inverse(d, e, phi, ctx) ||
+	    // dp = d % (p - 1)
+	    !BN_mod(key->dp, d, p1, ctx) ||
+	    // dq = d % (q - 1)
+	    !BN_mod(key->dq, d, q1, ctx) ||
+	    // qinv = q^{-1} (mod p)
+	    !BN_mod_inverse(key->qinv, key->q, key->p, ctx) ||
+	    !BN_MONT_CTX_set(key->mont_p, key->p, ctx) ||
+	    !BN_MONT_CTX_set(key->mont_q, key->q, ctx))
+	{
+		// Error importing the private key.
+		ret = -EIO;
+		goto end;
+	}
+
+	// The private exponents must be used in constant time.
+	BN_set_flags(key->dp, BN_FLG_CONSTTIME);
+	BN_set_flags(key->dq, BN_FLG_CONSTTIME);
+
+end:
+	BN_clear_free(d);
+	BN_clear_free(phi);
+	BN_clear_free(q1);
+	BN_clear_free(p1);
+	BN_free(e);
+	BN_CTX_free(ctx);
+	if (ret != 0) {
+		privkey_clear(key);
+	}
+	return ret;
+}
+
+/**
+ * Create an RSA-2048 signature using a prepared private key.
+ * @param buf		[out] Output buffer.
+ * @param buf_size	[in] Size of `buf`.
+ * @param key		[in] Prepared private key.
+ * @param ctx		[in] BN_CTX
+ * @param pHash		[in] Hash.
+ * @param hash_size	[in] Hash size. (20 for SHA-1, 32 for SHA-256)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int privkey_sign(uint8_t *buf, size_t buf_size, const RsawPrivKey *key,
+	BN_CTX *ctx, const uint8_t *pHash, size_t hash_size)
+{
+	// PKCS #1 v1.5 signature padding: 00 01 FF..FF 00 DigestInfo
+	uint8_t em[256];
+	const uint8_t *digest_info;
+	size_t digest_info_size, t_len;
+	BIGNUM *m, *m1, *m2, *h, *t;
+	int ret = -EIO;
+
+	if (hash_size == SHA1_DIGEST_SIZE) {
+		digest_info = digest_info_sha1;
+		digest_info_size = sizeof(digest_info_sha1);
+	} else {
+		digest_info = digest_info_sha256;
+		digest_info_size = sizeof(digest_info_sha256);
+	}
+	t_len = digest_info_size + hash_size;
+	em[0] = 0x00;
+	em[1] = 0x01;
+	memset(&em[2], 0xFF, sizeof(em) - 3 - t_len);
+	em[sizeof(em) - 1 - t_len] = 0x00;
+	memcpy(&em[sizeof(em) - t_len], digest_info, digest_info_size);
+	memcpy(&em[sizeof(em) - hash_size], pHash, hash_size);
+
+	// S = M^d mod n, using the CRT:
+	// m1 = M^dp mod p; m2 = M^dq mod q
+	// h = qinv * (m1 - m2) mod p
+	// S = m2 + h*q
+	BN_CTX_start(ctx);
+	m = BN_CTX_get(ctx);
+	m1 = BN_CTX_get(ctx);
+	m2 = BN_CTX_get(ctx);
+	h = BN_CTX_get(ctx);
+	t = BN_CTX_get(ctx);
+	if (t && BN_bin2bn(em, sizeof(em), m) &&
+	    BN_mod(t, m, key->p, ctx) &&
+	    BN_mod_exp_mont_consttime(m1, t, key->dp, key->p, ctx, key->mont_p) &&
+	    BN_mod(t, m, key->q, ctx) &&
+	    BN_mod_exp_mont_consttime(m2, t, key->dq, key->q, ctx, key->mont_q) &&
+	    BN_mod_sub(h, m1, m2, key->p, ctx) &&
+	    BN_mod_mul(h, h, key->qinv, key->p, ctx) &&
+	    BN_mul(h, h, key->q, ctx) &&
+	    BN_add(h, h, m2))
+	{
+		ret = bn_export(buf, buf_size, h);
+	}
+	BN_CTX_end(ctx);
+	return ret;
+}
+
+// Process-wide cache of prepared private keys.
+// Preparing a private key requires two modular inversions,
+// which is a significant part of signing a single ticket or TMD.
+// Prepared keys aren't modified when signing, so they can be
+// used by multiple threads at once.
+// Entries are matched by key contents, not by pointer.
+#define PRIVKEY_CACHE_SIZE 8
+typedef struct _PrivKeyCacheEntry {
+	RSA2048PrivateKey data;
+	RsawPrivKey key;
+} PrivKeyCacheEntry;
+static PrivKeyCacheEntry privkey_cache[PRIVKEY_CACHE_SIZE];
+static unsigned int privkey_cache_count = 0;
+STATIC_MUTEX(privkey_cache_lock);
+
+/**
+ * Find a prepared RSA-2048 private key in the cache.
+ * privkey_cache_lock must be held.
+ * @param priv_key_data		[in] RSA2048PrivateKey struct.
+ * @return Prepared private key, or NULL if it isn't cached.
+ */
+static const RsawPrivKey *privkey_cache_find(const RSA2048PrivateKey *priv_key_data)
+{
+	unsigned int i;
+	for (i = 0; i < privkey_cache_count; i++) {
+		if (!memcmp(&privkey_cache[i].data, priv_key_data, sizeof(*priv_key_data))) {
+			return &privkey_cache[i].key;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Get a prepared RSA-2048 private key from the cache.
+ * If the key isn't cached yet, it's prepared and added to the cache.
+ *
+ * The key is prepared without holding the lock, so other threads can
+ * use cached keys in the meantime. If another thread adds the same key
+ * first, the key prepared by this thread is discarded.
+ *
+ * @param priv_key_data		[in] RSA2048PrivateKey struct.
+ * @param pKey			[out] Prepared private key, or NULL if the cache is full.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int privkey_cache_get(const RSA2048PrivateKey *priv_key_data,
+	const RsawPrivKey **pKey)
+{
+	RsawPrivKey key;
+	int full;
+	int ret;
+
+	STATIC_MUTEX_LOCK(privkey_cache_lock);
+	*pKey = privkey_cache_find(priv_key_data);
+	full = (privkey_cache_count >= PRIVKEY_CACHE_SIZE);
+	STATIC_MUTEX_UNLOCK(privkey_cache_lock);
+	if (*pKey || full) {
+		// Found the key, or the cache is full.
+		return 0;
+	}
+
+	// Prepare the key.
+	memset(&key, 0, sizeof(key));
+	ret = privkey_prepare(&key, priv_key_data);
+	if (ret != 0) {
+		return ret;
+	}
+
+	// Add it to the cache.
+	STATIC_MUTEX_LOCK(privkey_cache_lock);
+	*pKey = privkey_cache_find(priv_key_data);
+	if (!*pKey && privkey_cache_count < PRIVKEY_CACHE_SIZE) {
+		// NOTE: The entry takes ownership of the key's BIGNUMs,
+		// so the local copy must not be cleared.
+		PrivKeyCacheEntry *const entry = &privkey_cache[privkey_cache_count];
+		memcpy(&entry->data, priv_key_data, sizeof(entry->data));
+		entry->key = key;
+		privkey_cache_count++;
+		*pKey = &entry->key;
+		STATIC_MUTEX_UNLOCK(privkey_cache_lock);
+		return 0;
+	}
+	STATIC_MUTEX_UNLOCK(privkey_cache_lock);
+
+	// Another thread added the same key first, or the cache
+	// filled up in the meantime. Discard this one.
+	privkey_clear(&key);
+	return 0;
+}
+
+/**
+ * Create RSA-2048 signatures for multiple hashes using an RSA private key.
+ * The private key is only prepared once, so this is faster than calling
+ * rsaw_rsa2048_sign() for each hash.
+ * Prepared private keys are cached, so this function is thread-safe and
+ * only the first signature made with each key has to prepare it.
+ * @param bufs			[out] Output buffers. (count * buf_size bytes)
+ * @param buf_size		[in] Size of each output buffer.
+ * @param priv_key_data		[in] RSA2048PrivateKey struct.
+ * @param pHashes		[in] Hashes. (count * hash_size bytes)
+ * @param hash_size		[in] Hash size. (20 for SHA-1, 32 for SHA-256)
+ * @param count			[in] Number of hashes.
+ * @param doSHA256		[in] If 1, do SHA-256. (TODO: Use an enum.)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rsaw_rsa2048_sign_multi(uint8_t *bufs, size_t buf_size,
+	const RSA2048PrivateKey *priv_key_data,
+	const uint8_t *pHashes, size_t hash_size,
+	unsigned int count, int doSHA256)
+{
+	const RsawPrivKey *key;
+	RsawPrivKey uncached_key;
+	int use_uncached_key = 0;
+	BN_CTX *ctx = NULL;
+	unsigned int i;
+	int ret;
+
+	assert(bufs != NULL);
+	assert(buf_size != 0);
+	assert(buf_size >= 256);
+	assert(priv_key_data != NULL);
+	assert(pHashes != NULL);
+
+	if (!bufs || buf_size == 0 || buf_size < 256 || !priv_key_data || !pHashes) {
+		// Invalid parameters.
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	if (!doSHA256) {
+		// SHA-1: Hash size must be 20.
+		if (hash_size != SHA1_DIGEST_SIZE) {
+			errno = EINVAL;
+			return -EINVAL;
+		}
+	} else {
+		// SHA-256: Hash size must be 32.
+		if (hash_size != SHA256_DIGEST_SIZE) {
+			errno = EINVAL;
+			return -EINVAL;
+		}
+	}
+
+	ctx = BN_CTX_new();
+	if (!ctx) {
+		errno = ENOMEM;
+		return -ENOMEM;
+	}
+
+	// Get the prepared private key.
+	ret = privkey_cache_get(priv_key_data, &key);
+	if (ret != 0) {
+		// Error importing the private key.
+		goto end;
+	} else if (!key) {
+		// Cache is full. Prepare the key just for this call.
+		memset(&uncached_key, 0, sizeof(uncached_key));
+		ret = privkey_prepare(&uncached_key, priv_key_data);
+		if (ret != 0) {
+			goto end;
+		}
+		use_uncached_key = 1;
+		key = &uncached_key;
+	}
+
+	for (i = 0; i < count; i++, bufs += buf_size, pHashes += hash_size) {
+		// Create the signature.
+		ret = privkey_sign(bufs, buf_size, key, ctx, pHashes, hash_size);
+		if (ret != 0) {
+			// Error signing the hash.
+			goto end;
+		}
+	}
+
+end:
+	if (use_uncached_key) {
+		privkey_clear(&uncached_key);
+	}
+	BN_CTX_free(ctx);
+	if (ret != 0) {
+		errno = -ret;
+	}
+	return ret;
+}
+
+/**
+ * Create an RSA-2048 signature using an RSA private key.
+ * @param buf			[out] Output buffer.
+ * @param buf_size		[in] Size of `buf`.
+ * @param priv_key_data		[in] RSA2048PrivateKey struct.
+ * @param pHash			[in] Hash.
+ * @param hash_size		[in] Hash size. (20 for SHA-1, 32 for SHA-256)
+ * @param doSHA256		[in] If 1, do SHA-256. (TODO: Use an enum.)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rsaw_rsa2048_sign(uint8_t *buf, size_t buf_size,
+	const RSA2048PrivateKey *priv_key_data,
+	const uint8_t *pHash, size_t hash_size,
+	int doSHA256)
+{
+	return rsaw_rsa2048_sign_multi(buf, buf_size, priv_key_data,
+		pHash, hash_size, 1, doSHA256);
+}
@@ -0,0 +1,319 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * sha1w.c: SHA-1 wrapper functions.                                       *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "sha1w.h"
+#include "sha1w_hw.h"
+#include "impl_select.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+
+// Nettle SHA-1 functions.
+#include <nettle/sha1.h>
+
+// Current SHA-1 implementation. (-1 == not detected yet)
+IMPL_SELECT(sha1w_impl);
+
+/**
+ * Check if a SHA-1 implementation is supported by the CPU.
+ * @param impl SHA-1 implementation. (See SHA1W_Impl_e.)
+ * @return True if supported; false if not.
+ */
+static int sha1w_is_impl_supported(int impl)
+{
+	switch (impl) {
+		case SHA1W_IMPL_NETTLE:
+			return 1;
+#ifdef HAVE_SHA1W_SHANI
+		case SHA1W_IMPL_SHANI:
+			return sha1w_shani_is_supported();
+#endif /* HAVE_SHA1W_SHANI */
+#ifdef HAVE_SHA1W_AVX2
+		case SHA1W_IMPL_AVX2:
+			return sha1w_avx2_is_supported();
+#endif /* HAVE_SHA1W_AVX2 */
+		default:
+			break;
+	}
+	return 0;
+}
+
+/**
+ * Determine the best SHA-1 implementation for this CPU.
+ * @return SHA-1 implementation. (See SHA1W_Impl_e.)
+ */
+static int sha1w_detect_impl(void)
+{
+	// Preference order: SHA-NI, AVX2, nettle.
+	if (sha1w_is_impl_supported(SHA1W_IMPL_SHANI)) {
+		return SHA1W_IMPL_SHANI;
+	} else if (sha1w_is_impl_supported(SHA1W_IMPL_AVX2)) {
+		return SHA1W_IMPL_AVX2;
+	}
+	return SHA1W_IMPL_NETTLE;
+}
+
+/**
+ * Get the current SHA-1 implementation.
+ * @return SHA-1 implementation. (See SHA1W_Impl_e.)
+ */
+static inline int sha1w_get_impl(void)
+{
+	return impl_select_get(&sha1w_impl, sha1w_detect_impl);
+}
+
+/**
+ * Get the name of the active SHA-1 implementation.
+ * @return SHA-1 implementation name.
+ */
+const char *sha1w_get_impl_name(void)
+{
+	switch (sha1w_get_impl()) {
+		default:
+		case SHA1W_IMPL_NETTLE:
+			return "nettle";
+		case SHA1W_IMPL_SHANI:
+			return "SHA-NI";
+		case SHA1W_IMPL_AVX2:
+			return "AVX2 (8-lane)";
+	}
+}
+
+/**
+ * Select a SHA-1 implementation.
+ * This is intended for testing and benchmarking.
+ * NOTE: Not thread-safe. Don't call this while hashing.
+ * @param impl SHA-1 implementation. (See SHA1W_Impl_e.)
+ * @return 0 on success; negative POSIX error code on error. (-ENOTSUP if not supported by the CPU)
+ */
+int sha1w_set_impl(int impl)
+{
+	if (impl == SHA1W_IMPL_AUTO) {
+		impl_select_store(&sha1w_impl, -1);
+		return 0;
+	} else if (impl < 0 || impl >= SHA1W_IMPL_MAX) {
+		return -EINVAL;
+	}
+
+	if (!sha1w_is_impl_supported(impl)) {
+		return -ENOTSUP;
+	}
+	impl_select_store(&sha1w_impl, impl);
+	return 0;
+}
+
+#if defined(HAVE_SHA1W_SHANI) || defined(HAVE_SHA1W_AVX2)
+// SHA-1 initial state.
+static const uint32_t sha1w_init_state[5] = {
+	0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0
+};
+
+/**
+ * Build the final padded block(s) for a message.
+ * @param tail	[out] Tail buffer. (128 bytes)
+ * @param pData	[in] Message.
+ * @param size	[in] Message size, in bytes.
+ * @return Number of tail blocks. (1 or 2)
+ */
+static unsigned int sha1w_build_tail(uint8_t tail[128], const uint8_t *pData, size_t size)
+{
+	const size_t rem = size % 64;
+	const unsigned int tail_blocks = (rem + 9 > 64) ? 2 : 1;
+	const uint64_t bit_len = (uint64_t)size * 8;
+	uint8_t *const pLen = &tail[tail_blocks*64 - 8];
+	unsigned int i;
+
+	memset(tail, 0, 128);
+	memcpy(tail, pData + (size - rem), rem);
+	tail[rem] = 0x80;
+	for (i = 0; i < 8; i++) {
+		pLen[i] = (uint8_t)(bit_len >> (56 - (i * 8)));
+	}
+	return tail_blocks;
+}
+
+/**
+ * Write a SHA-1 digest in big-endian format.
+ * @param pDigest	[out] Digest.
+ * @param h		[in] SHA-1 state.
+ */
+static inline void sha1w_write_digest(uint8_t *pDigest, const uint32_t h[5])
+{
+	unsigned int i;
+	for (i = 0; i < 5; i++, pDigest += 4) {
+		pDigest[0] = (uint8_t)(h[i] >> 24);
+		pDigest[1] = (uint8_t)(h[i] >> 16);
+		pDigest[2] = (uint8_t)(h[i] >> 8);
+		pDigest[3] = (uint8_t)(h[i]);
+	}
+}
+#endif /* HAVE_SHA1W_SHANI || HAVE_SHA1W_AVX2 */
+
+#ifdef HAVE_SHA1W_SHANI
+/**
+ * Hash a single buffer using the x86 SHA extensions.
+ * @param pData		[in] Data.
+ * @param size		[in] Size of pData, in bytes.
+ * @param pDigest	[out] Digest. (SHA1W_DIGEST_SIZE bytes)
+ */
+static void sha1w_hash_shani(const uint8_t *pData, size_t size, uint8_t *pDigest)
+{
+	uint32_t state[5];
+	uint8_t tail[128];
+	unsigned int tail_blocks;
+
+	memcpy(state, sha1w_init_state, sizeof(state));
+	sha1w_shani_compress(state, pData, size / 64);
+	tail_blocks = sha1w_build_tail(tail, pData, size);
+	sha1w_shani_compress(state, tail, tail_blocks);
+	sha1w_write_digest(pDigest, state);
+}
+#endif /* HAVE_SHA1W_SHANI */
+
+#ifdef HAVE_SHA1W_AVX2
+/**
+ * Hash up to 8 equal-sized buffers using AVX2.
+ * @param ppData	[in] Array of data pointers.
+ * @param size		[in] Size of each buffer, in bytes.
+ * @param count		[in] Number of buffers. (1-8)
+ * @param pDigests	[out] Digests. (count * SHA1W_DIGEST_SIZE bytes)
+ */
+static void sha1w_hash_x8_avx2(const uint8_t *const *ppData, size_t size, unsigned int count, uint8_t *pDigests)
+{
+	uint32_t state[5][SHA1W_AVX2_LANES];
+	const uint8_t *lanes[SHA1W_AVX2_LANES];
+	uint8_t tail[SHA1W_AVX2_LANES][128];
+	unsigned int tail_blocks = 1;
+	unsigned int i, lane;
+
+	assert(count > 0 && count <= SHA1W_AVX2_LANES);
+
+	// Unused lanes duplicate the first buffer.
+	for (lane = 0; lane < SHA1W_AVX2_LANES; lane++) {
+		lanes[lane] = (lane < count) ? ppData[lane] : ppData[0];
+	}
+	for (i = 0; i < 5; i++) {
+		for (lane = 0; lane < SHA1W_AVX2_LANES; lane++) {
+			state[i][lane] = sha1w_init_state[i];
+		}
+	}
+
+	sha1w_avx2_compress_x8(state, lanes, 0, size / 64);
+
+	// All buffers have the same size, so they have the same number of tail blocks.
+	for (lane = 0; lane < SHA1W_AVX2_LANES; lane++) {
+		tail_blocks = sha1w_build_tail(tail[lane], lanes[lane], size);
+		lanes[lane] = tail[lane];
+	}
+	sha1w_avx2_compress_x8(state, lanes, 0, tail_blocks);
+
+	for (lane = 0; lane < count; lane++, pDigests += SHA1W_DIGEST_SIZE) {
+		uint32_t h[5];
+		for (i = 0; i < 5; i++) {
+			h[i] = state[i][lane];
+		}
+		sha1w_write_digest(pDigests, h);
+	}
+}
+#endif /* HAVE_SHA1W_AVX2 */
+
+/**
+ * Hash a single buffer using nettle.
+ * @param pData		[in] Data.
+ * @param size		[in] Size of pData, in bytes.
+ * @param pDigest	[out] Digest. (SHA1W_DIGEST_SIZE bytes)
+ */
+static void sha1w_hash_nettle(const uint8_t *pData, size_t size, uint8_t *pDigest)
+{
+	struct sha1_ctx sha1;
+	sha1_init(&sha1);
+	sha1_update(&sha1, size, pData);
+	sha1_digest(&sha1, SHA1W_DIGEST_SIZE, pDigest);
+}
+
+/**
+ * Hash a single buffer.
+ * @param pData		[in] Data.
+ * @param size		[in] Size of pData, in bytes.
+ * @param pDigest	[out] Digest. (SHA1W_DIGEST_SIZE bytes)
+ */
+void sha1w_hash(const uint8_t *pData, size_t size, uint8_t *pDigest)
+{
+	switch (sha1w_get_impl()) {
+#ifdef HAVE_SHA1W_SHANI
+		case SHA1W_IMPL_SHANI:
+			sha1w_hash_shani(pData, size, pDigest);
+			break;
+#endif /* HAVE_SHA1W_SHANI */
+		default:
+			// NOTE: AVX2 isn't useful for a single buffer.
+			sha1w_hash_nettle(pData, size, pDigest);
+			break;
+	}
+}
+
+/**
+ * Hash multiple equal-sized buffers.
+ * @param ppData	[in] Array of data pointers.
+ * @param size		[in] Size of each buffer, in bytes.
+ * @param count		[in] Number of buffers.
+ * @param pDigests	[out] Digests. (count * SHA1W_DIGEST_SIZE bytes)
+ */
+void sha1w_hash_multi(const uint8_t *const *ppData, size_t size, unsigned int count, uint8_t *pDigests)
+{
+	unsigned int i;
+
+	switch (sha1w_get_impl()) {
+#ifdef HAVE_SHA1W_AVX2
+		case SHA1W_IMPL_AVX2:
+			for (i = 0; i < count; i += SHA1W_AVX2_LANES) {
+				const unsigned int n = (count - i < SHA1W_AVX2_LANES) ? (count - i) : SHA1W_AVX2_LANES;
+				sha1w_hash_x8_avx2(&ppData[i], size, n, &pDigests[i * SHA1W_DIGEST_SIZE]);
+			}
+			break;
+#endif /* HAVE_SHA1W_AVX2 */
+#ifdef HAVE_SHA1W_SHANI
+		case SHA1W_IMPL_SHANI:
+			for (i = 0; i < count; i++) {
+				sha1w_hash_shani(ppData[i], size, &pDigests[i * SHA1W_DIGEST_SIZE]);
+			}
+			break;
+#endif /* HAVE_SHA1W_SHANI */
+		default:
+			for (i = 0; i < count; i++) {
+				sha1w_hash_nettle(ppData[i], size, &pDigests[i * SHA1W_DIGEST_SIZE]);
+			}
+			break;
+	}
+}
+
+/**
+ * Hash multiple equal-sized buffers located at a fixed stride.
+ * Buffer i starts at pData + (i * stride).
+ * @param pData		[in] First buffer.
+ * @param size		[in] Size of each buffer, in bytes.
+ * @param stride	[in] Distance between the start of each buffer, in bytes.
+ * @param count		[in] Number of buffers.
+ * @param pDigests	[out] Digests. (count * SHA1W_DIGEST_SIZE bytes)
+ */
+void sha1w_hash_strided(const uint8_t *pData, size_t size, size_t stride, unsigned int count, uint8_t *pDigests)
+{
+	// Process in chunks of 64 pointers to avoid dynamic allocation.
+	const uint8_t *ptrs[64];
+	while (count > 0) {
+		const unsigned int n = (count < 64) ? count : 64;
+		unsigned int i;
+		for (i = 0; i < n; i++, pData += stride) {
+			ptrs[i] = pData;
+		}
+		sha1w_hash_multi(ptrs, size, n, pDigests);
+		pDigests += n * SHA1W_DIGEST_SIZE;
+		count -= n;
+	}
+}
@@ -0,0 +1,82 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * sha1w.h: SHA-1 wrapper functions.                                       *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// NOTE: These functions are intended for hashing many small buffers
+// of equal length, e.g. the Wii disc hash tree. For general-purpose
+// hashing, use nettle's sha1_*() functions directly.
+
+#ifndef __RVTHTOOL_LIBWIICRYPTO_SHA1W_H__
+#define __RVTHTOOL_LIBWIICRYPTO_SHA1W_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SHA1W_DIGEST_SIZE 20
+
+// SHA-1 implementation.
+typedef enum {
+	SHA1W_IMPL_AUTO		= -1,	// Automatically select the best implementation.
+	SHA1W_IMPL_NETTLE	= 0,	// GNU Nettle (software)
+	SHA1W_IMPL_SHANI	= 1,	// x86 SHA extensions (single-buffer)
+	SHA1W_IMPL_AVX2		= 2,	// x86 AVX2 (8-lane multi-buffer)
+
+	SHA1W_IMPL_MAX
+} SHA1W_Impl_e;
+
+/**
+ * Get the name of the active SHA-1 implementation.
+ * @return SHA-1 implementation name.
+ */
+const char *sha1w_get_impl_name(void);
+
+/**
+ * Select a SHA-1 implementation.
+ * This is intended for testing and benchmarking.
+ * NOTE: Not thread-safe. Don't call this while hashing.
+ * @param impl SHA-1 implementation. (See SHA1W_Impl_e.)
+ * @return 0 on success; negative POSIX error code on error. (-ENOTSUP if not supported by the CPU)
+ */
+int sha1w_set_impl(int impl);
+
+/**
+ * Hash a single buffer.
+ * @param pData		[in] Data.
+ * @param size		[in] Size of pData, in bytes.
+ * @param pDigest	[out] Digest. (SHA1W_DIGEST_SIZE bytes)
+ */
+void sha1w_hash(const uint8_t *pData, size_t size, uint8_t *pDigest);
+
+/**
+ * Hash multiple equal-sized buffers.
+ * @param ppData	[in] Array of data pointers.
+ * @param size		[in] Size of each buffer, in bytes.
+ * @param count		[in] Number of buffers.
+ * @param pDigests	[out] Digests. (count * SHA1W_DIGEST_SIZE bytes)
+ */
+void sha1w_hash_multi(const uint8_t *const *ppData, size_t size, unsigned int count, uint8_t *pDigests);
+
+/**
+ * Hash multiple equal-sized buffers located at a fixed stride.
+ * Buffer i starts at pData + (i * stride).
+ * @param pData		[in] First buffer.
+ * @param size		[in] Size of each buffer, in bytes.
+ * @param stride	[in] Distance between the start of each buffer, in bytes.
+ * @param count		[in] Number of buffers.
+ * @param pDigests	[out] Digests. (count * SHA1W_DIGEST_SIZE bytes)
+ */
+void sha1w_hash_strided(const uint8_t *pData, size_t size, size_t stride, unsigned int count, uint8_t *pDigests);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_LIBWIICRYPTO_SHA1W_H__ */
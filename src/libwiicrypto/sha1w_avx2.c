@@ -0,0 +1,198 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * sha1w_avx2.c: SHA-1 wrapper functions. (AVX2 multi-buffer version)      *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "sha1w_hw.h"
+
+// AVX2 intrinsics
+#include <immintrin.h>
+
+// CPUID
+#ifdef _MSC_VER
+#  include <intrin.h>
+#else /* !_MSC_VER */
+#  include <cpuid.h>
+#endif /* _MSC_VER */
+
+// CPUID.01H:ECX.OSXSAVE[bit 27], CPUID.01H:ECX.AVX[bit 28]
+#define CPUID_ECX_OSXSAVE (1U << 27)
+#define CPUID_ECX_AVX (1U << 28)
+// CPUID.07H.0H:EBX.AVX2[bit 5]
+#define CPUID_7_EBX_AVX2 (1U << 5)
+
+/**
+ * Check if AVX2 is supported by the CPU and OS.
+ * @return Non-zero if supported; 0 if not.
+ */
+int sha1w_avx2_is_supported(void)
+{
+	unsigned int ebx7, ecx1;
+	unsigned long long xcr0;
+#ifdef _MSC_VER
+	int regs[4];
+	__cpuid(regs, 0);
+	if (regs[0] < 7) {
+		return 0;
+	}
+	__cpuid(regs, 1);
+	ecx1 = (unsigned int)regs[2];
+	__cpuidex(regs, 7, 0);
+	ebx7 = (unsigned int)regs[1];
+#else /* !_MSC_VER */
+	unsigned int eax, ebx, ecx, edx;
+	if (__get_cpuid_max(0, NULL) < 7) {
+		return 0;
+	}
+	__cpuid(1, eax, ebx, ecx, edx);
+	ecx1 = ecx;
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	ebx7 = ebx;
+#endif /* _MSC_VER */
+
+	if (!(ecx1 & CPUID_ECX_OSXSAVE) || !(ecx1 & CPUID_ECX_AVX) || !(ebx7 & CPUID_7_EBX_AVX2)) {
+		return 0;
+	}
+
+	// Make sure the OS saves the YMM registers.
+#ifdef _MSC_VER
+	xcr0 = _xgetbv(0);
+#else /* !_MSC_VER */
+	{
+		unsigned int xcr0_lo, xcr0_hi;
+		__asm__ ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+		xcr0 = ((unsigned long long)xcr0_hi << 32) | xcr0_lo;
+	}
+#endif /* _MSC_VER */
+	return ((xcr0 & 6) == 6);
+}
+
+// Rotate each 32-bit lane left.
+#define ROL32(x, n) _mm256_or_si256(_mm256_slli_epi32((x), (n)), _mm256_srli_epi32((x), 32-(n)))
+
+/**
+ * Transpose an 8x8 matrix of 32-bit values.
+ * @param r Rows. (in/out)
+ */
+static inline void transpose8x8(__m256i r[8])
+{
+	const __m256i t0 = _mm256_unpacklo_epi32(r[0], r[1]);
+	const __m256i t1 = _mm256_unpackhi_epi32(r[0], r[1]);
+	const __m256i t2 = _mm256_unpacklo_epi32(r[2], r[3]);
+	const __m256i t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+	const __m256i t4 = _mm256_unpacklo_epi32(r[4], r[5]);
+	const __m256i t5 = _mm256_unpackhi_epi32(r[4], r[5]);
+	const __m256i t6 = _mm256_unpacklo_epi32(r[6], r[7]);
+	const __m256i t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+
+	const __m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+	const __m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+	const __m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+	const __m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+	const __m256i u4 = _mm256_unpacklo_epi64(t4, t6);
+	const __m256i u5 = _mm256_unpackhi_epi64(t4, t6);
+	const __m256i u6 = _mm256_unpacklo_epi64(t5, t7);
+	const __m256i u7 = _mm256_unpackhi_epi64(t5, t7);
+
+	r[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+	r[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+	r[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+	r[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+	r[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+	r[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+	r[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+	r[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+}
+
+/**
+ * Process 64-byte blocks for 8 buffers at once using AVX2.
+ * @param state		[in/out] SHA-1 state. (state[i][lane])
+ * @param ppData	[in] Data pointers, one per lane.
+ * @param offset	[in] Offset into each data buffer.
+ * @param blocks	[in] Number of 64-byte blocks.
+ */
+void sha1w_avx2_compress_x8(uint32_t state[5][SHA1W_AVX2_LANES],
+	const uint8_t *const ppData[SHA1W_AVX2_LANES], size_t offset, size_t blocks)
+{
+	const __m256i BSWAP_MASK = _mm256_set_epi8(
+		12,13,14,15, 8,9,10,11, 4,5,6,7, 0,1,2,3,
+		12,13,14,15, 8,9,10,11, 4,5,6,7, 0,1,2,3);
+	const __m256i K0 = _mm256_set1_epi32(0x5A827999);
+	const __m256i K1 = _mm256_set1_epi32(0x6ED9EBA1);
+	const __m256i K2 = _mm256_set1_epi32((int)0x8F1BBCDC);
+	const __m256i K3 = _mm256_set1_epi32((int)0xCA62C1D6);
+
+	__m256i a = _mm256_loadu_si256((const __m256i*)state[0]);
+	__m256i b = _mm256_loadu_si256((const __m256i*)state[1]);
+	__m256i c = _mm256_loadu_si256((const __m256i*)state[2]);
+	__m256i d = _mm256_loadu_si256((const __m256i*)state[3]);
+	__m256i e = _mm256_loadu_si256((const __m256i*)state[4]);
+
+	for (; blocks > 0; blocks--, offset += 64) {
+		const __m256i a0 = a, b0 = b, c0 = c, d0 = d, e0 = e;
+		__m256i W[16];
+		unsigned int t, lane;
+
+		// Load and transpose the message words.
+		// After transposing, W[t] contains word t for all 8 lanes.
+		for (lane = 0; lane < SHA1W_AVX2_LANES; lane++) {
+			W[lane]   = _mm256_loadu_si256((const __m256i*)&ppData[lane][offset]);
+			W[lane+8] = _mm256_loadu_si256((const __m256i*)&ppData[lane][offset+32]);
+		}
+		transpose8x8(&W[0]);
+		transpose8x8(&W[8]);
+		for (t = 0; t < 16; t++) {
+			W[t] = _mm256_shuffle_epi8(W[t], BSWAP_MASK);
+		}
+
+		for (t = 0; t < 80; t++) {
+			__m256i f, k, tmp;
+			if (t >= 16) {
+				// Message schedule.
+				tmp = _mm256_xor_si256(
+					_mm256_xor_si256(W[(t-3) & 15], W[(t-8) & 15]),
+					_mm256_xor_si256(W[(t-14) & 15], W[t & 15]));
+				W[t & 15] = ROL32(tmp, 1);
+			}
+
+			if (t < 20) {
+				// Ch(b,c,d) = d ^ (b & (c ^ d))
+				f = _mm256_xor_si256(d, _mm256_and_si256(b, _mm256_xor_si256(c, d)));
+				k = K0;
+			} else if (t < 40) {
+				f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+				k = K1;
+			} else if (t < 60) {
+				// Maj(b,c,d) = (b & c) | (d & (b | c))
+				f = _mm256_or_si256(_mm256_and_si256(b, c), _mm256_and_si256(d, _mm256_or_si256(b, c)));
+				k = K2;
+			} else {
+				f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+				k = K3;
+			}
+
+			tmp = _mm256_add_epi32(_mm256_add_epi32(ROL32(a, 5), f),
+				_mm256_add_epi32(_mm256_add_epi32(e, k), W[t & 15]));
+			e = d;
+			d = c;
+			c = ROL32(b, 30);
+			b = a;
+			a = tmp;
+		}
+
+		a = _mm256_add_epi32(a, a0);
+		b = _mm256_add_epi32(b, b0);
+		c = _mm256_add_epi32(c, c0);
+		d = _mm256_add_epi32(d, d0);
+		e = _mm256_add_epi32(e, e0);
+	}
+
+	_mm256_storeu_si256((__m256i*)state[0], a);
+	_mm256_storeu_si256((__m256i*)state[1], b);
+	_mm256_storeu_si256((__m256i*)state[2], c);
+	_mm256_storeu_si256((__m256i*)state[3], d);
+	_mm256_storeu_si256((__m256i*)state[4], e);
+}
@@ -0,0 +1,64 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * sha1w_hw.h: SHA-1 wrapper functions. (hardware-accelerated backends)    *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// NOTE: Internal header. Only used by the sha1w implementation.
+
+#ifndef __RVTHTOOL_LIBWIICRYPTO_SHA1W_HW_H__
+#define __RVTHTOOL_LIBWIICRYPTO_SHA1W_HW_H__
+
+#include "config.libwiicrypto.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Number of lanes in the multi-buffer implementation.
+#define SHA1W_AVX2_LANES 8
+
+#ifdef HAVE_SHA1W_SHANI
+/**
+ * Check if the x86 SHA extensions are supported by the CPU.
+ * @return Non-zero if supported; 0 if not.
+ */
+int sha1w_shani_is_supported(void);
+
+/**
+ * Process 64-byte blocks using the x86 SHA extensions.
+ * @param state		[in/out] SHA-1 state. (H0-H4)
+ * @param pData		[in] Data.
+ * @param blocks	[in] Number of 64-byte blocks.
+ */
+void sha1w_shani_compress(uint32_t state[5], const uint8_t *pData, size_t blocks);
+#endif /* HAVE_SHA1W_SHANI */
+
+#ifdef HAVE_SHA1W_AVX2
+/**
+ * Check if AVX2 is supported by the CPU and OS.
+ * @return Non-zero if supported; 0 if not.
+ */
+int sha1w_avx2_is_supported(void);
+
+/**
+ * Process 64-byte blocks for 8 buffers at once using AVX2.
+ * @param state		[in/out] SHA-1 state. (state[i][lane])
+ * @param ppData	[in] Data pointers, one per lane.
+ * @param offset	[in] Offset into each data buffer.
+ * @param blocks	[in] Number of 64-byte blocks.
+ */
+void sha1w_avx2_compress_x8(uint32_t state[5][SHA1W_AVX2_LANES],
+	const uint8_t *const ppData[SHA1W_AVX2_LANES], size_t offset, size_t blocks);
+#endif /* HAVE_SHA1W_AVX2 */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_LIBWIICRYPTO_SHA1W_HW_H__ */
@@ -0,0 +1,141 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * sha1w_shani.c: SHA-1 wrapper functions. (x86 SHA extensions version)    *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "sha1w_hw.h"
+
+// SHA extensions intrinsics
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <immintrin.h>
+
+// CPUID
+#ifdef _MSC_VER
+#  include <intrin.h>
+#else /* !_MSC_VER */
+#  include <cpuid.h>
+#endif /* _MSC_VER */
+
+// CPUID.07H.0H:EBX.SHA[bit 29]
+#define CPUID_7_EBX_SHA (1U << 29)
+// CPUID.01H:ECX.SSSE3[bit 9], CPUID.01H:ECX.SSE41[bit 19]
+#define CPUID_ECX_SSSE3 (1U << 9)
+#define CPUID_ECX_SSE41 (1U << 19)
+
+/**
+ * Check if the x86 SHA extensions are supported by the CPU.
+ * @return Non-zero if supported; 0 if not.
+ */
+int sha1w_shani_is_supported(void)
+{
+	unsigned int ebx7, ecx1;
+#ifdef _MSC_VER
+	int regs[4];
+	__cpuid(regs, 0);
+	if (regs[0] < 7) {
+		return 0;
+	}
+	__cpuid(regs, 1);
+	ecx1 = (unsigned int)regs[2];
+	__cpuidex(regs, 7, 0);
+	ebx7 = (unsigned int)regs[1];
+#else /* !_MSC_VER */
+	unsigned int eax, ebx, ecx, edx;
+	if (__get_cpuid_max(0, NULL) < 7) {
+		return 0;
+	}
+	__cpuid(1, eax, ebx, ecx, edx);
+	ecx1 = ecx;
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	ebx7 = ebx;
+#endif /* _MSC_VER */
+
+	return (ebx7 & CPUID_7_EBX_SHA) &&
+	       (ecx1 & CPUID_ECX_SSSE3) &&
+	       (ecx1 & CPUID_ECX_SSE41);
+}
+
+/**
+ * Four rounds of SHA-1.
+ * @param r Round group. (0-19; must be a constant)
+ * @param Ecur E value for this round group.
+ * @param Enext E value for the next round group.
+ */
+#define SHA1_NI_ROUNDS(r, Ecur, Enext) do { \
+	if ((r) == 0) { \
+		Ecur = _mm_add_epi32(Ecur, MSG[0]); \
+	} else { \
+		Ecur = _mm_sha1nexte_epu32(Ecur, MSG[(r) % 4]); \
+	} \
+	Enext = ABCD; \
+	if ((r) >= 3 && (r) <= 18) { \
+		MSG[((r)+1) % 4] = _mm_sha1msg2_epu32(MSG[((r)+1) % 4], MSG[(r) % 4]); \
+	} \
+	ABCD = _mm_sha1rnds4_epu32(ABCD, Ecur, (r) / 5); \
+	if ((r) >= 1 && (r) <= 16) { \
+		MSG[((r)+3) % 4] = _mm_sha1msg1_epu32(MSG[((r)+3) % 4], MSG[(r) % 4]); \
+	} \
+	if ((r) >= 2 && (r) <= 17) { \
+		MSG[((r)+2) % 4] = _mm_xor_si128(MSG[((r)+2) % 4], MSG[(r) % 4]); \
+	} \
+} while (0)
+
+/**
+ * Process 64-byte blocks using the x86 SHA extensions.
+ * @param state		[in/out] SHA-1 state. (H0-H4)
+ * @param pData		[in] Data.
+ * @param blocks	[in] Number of 64-byte blocks.
+ */
+void sha1w_shani_compress(uint32_t state[5], const uint8_t *pData, size_t blocks)
+{
+	const __m128i BSWAP_MASK = _mm_set_epi64x(0x0001020304050607ULL, 0x08090A0B0C0D0E0FULL);
+	__m128i ABCD, E0, E1;
+	__m128i MSG[4];
+
+	ABCD = _mm_loadu_si128((const __m128i*)state);
+	ABCD = _mm_shuffle_epi32(ABCD, 0x1B);
+	E0 = _mm_set_epi32((int)state[4], 0, 0, 0);
+
+	for (; blocks > 0; blocks--, pData += 64) {
+		const __m128i ABCD_SAVE = ABCD;
+		const __m128i E0_SAVE = E0;
+
+		MSG[0] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&pData[ 0]), BSWAP_MASK);
+		MSG[1] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&pData[16]), BSWAP_MASK);
+		MSG[2] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&pData[32]), BSWAP_MASK);
+		MSG[3] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&pData[48]), BSWAP_MASK);
+
+		SHA1_NI_ROUNDS( 0, E0, E1);
+		SHA1_NI_ROUNDS( 1, E1, E0);
+		SHA1_NI_ROUNDS( 2, E0, E1);
+		SHA1_NI_ROUNDS( 3, E1, E0);
+		SHA1_NI_ROUNDS( 4, E0, E1);
+		SHA1_NI_ROUNDS( 5, E1, E0);
+		SHA1_NI_ROUNDS( 6, E0, E1);
+		SHA1_NI_ROUNDS( 7, E1, E0);
+		SHA1_NI_ROUNDS( 8, E0, E1);
+		SHA1_NI_ROUNDS( 9, E1, E0);
+		SHA1_NI_ROUNDS(10, E0, E1);
+		SHA1_NI_ROUNDS(11, E1, E0);
+		SHA1_NI_ROUNDS(12, E0, E1);
+		SHA1_NI_ROUNDS(13, E1, E0);
+		SHA1_NI_ROUNDS(14, E0, E1);
+		SHA1_NI_ROUNDS(15, E1, E0);
+		SHA1_NI_ROUNDS(16, E0, E1);
+		SHA1_NI_ROUNDS(17, E1, E0);
+		SHA1_NI_ROUNDS(18, E0, E1);
+		SHA1_NI_ROUNDS(19, E1, E0);
+
+		// Combine the state.
+		E0 = _mm_sha1nexte_epu32(E0, E0_SAVE);
+		ABCD = _mm_add_epi32(ABCD, ABCD_SAVE);
+	}
+
+	ABCD = _mm_shuffle_epi32(ABCD, 0x1B);
+	_mm_storeu_si128((__m128i*)state, ABCD);
+	state[4] = (uint32_t)_mm_extract_epi32(E0, 3);
+}
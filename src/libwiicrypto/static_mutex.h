@@ -0,0 +1,37 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * static_mutex.h: Statically-initialized mutex for internal caches.       *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBWIICRYPTO_STATIC_MUTEX_H__
+#define __RVTHTOOL_LIBWIICRYPTO_STATIC_MUTEX_H__
+
+// NOTE: This is an internal header. It's only used for locking
+// process-wide caches that are held for a very short time.
+
+#ifdef _WIN32
+#  include "win32/Win32_sdk.h"
+
+// NOTE: SRWLOCK requires Vista, and CRITICAL_SECTION can't be
+// statically initialized, so use a simple spinlock.
+#  define STATIC_MUTEX(name)	static volatile LONG name = 0
+#  define STATIC_MUTEX_LOCK(name) do { \
+		while (InterlockedCompareExchange(&(name), 1, 0) != 0) { \
+			Sleep(0); \
+		} \
+	} while (0)
+#  define STATIC_MUTEX_UNLOCK(name)	InterlockedExchange(&(name), 0)
+
+#else /* !_WIN32 */
+#  include <pthread.h>
+
+#  define STATIC_MUTEX(name)	static pthread_mutex_t name = PTHREAD_MUTEX_INITIALIZER
+#  define STATIC_MUTEX_LOCK(name)	pthread_mutex_lock(&(name))
+#  define STATIC_MUTEX_UNLOCK(name)	pthread_mutex_unlock(&(name))
+
+#endif /* _WIN32 */
+
+#endif /* __RVTHTOOL_LIBWIICRYPTO_STATIC_MUTEX_H__ */
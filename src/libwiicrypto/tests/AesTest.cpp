@@ -0,0 +1,204 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto/tests)                                         *
+ * AesTest.cpp: AES wrapper test.                                          *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+
+#include "libwiicrypto/aesw.h"
+
+// C includes. (C++ namespace)
+#include <cstdio>
+#include <cstring>
+
+// C++ includes.
+#include <vector>
+using std::vector;
+
+namespace LibWiiCrypto { namespace Tests {
+
+// Test vectors from NIST SP 800-38A, F.2.1 and F.2.2. (CBC-AES128)
+static const uint8_t aes_key[16] = {
+	0x2B,0x7E,0x15,0x16,0x28,0xAE,0xD2,0xA6,
+	0xAB,0xF7,0x15,0x88,0x09,0xCF,0x4F,0x3C
+};
+static const uint8_t aes_iv[16] = {
+	0x00,0x01,0x02,0x03,0x04,0x05,0x06,0x07,
+	0x08,0x09,0x0A,0x0B,0x0C,0x0D,0x0E,0x0F
+};
+static const uint8_t aes_plaintext[64] = {
+	0x6B,0xC1,0xBE,0xE2,0x2E,0x40,0x9F,0x96,
+	0xE9,0x3D,0x7E,0x11,0x73,0x93,0x17,0x2A,
+	0xAE,0x2D,0x8A,0x57,0x1E,0x03,0xAC,0x9C,
+	0x9E,0xB7,0x6F,0xAC,0x45,0xAF,0x8E,0x51,
+	0x30,0xC8,0x1C,0x46,0xA3,0x5C,0xE4,0x11,
+	0xE5,0xFB,0xC1,0x19,0x1A,0x0A,0x52,0xEF,
+	0xF6,0x9F,0x24,0x45,0xDF,0x4F,0x9B,0x17,
+	0xAD,0x2B,0x41,0x7B,0xE6,0x6C,0x37,0x10
+};
+static const uint8_t aes_ciphertext[64] = {
+	0x76,0x49,0xAB,0xAC,0x81,0x19,0xB2,0x46,
+	0xCE,0xE9,0x8E,0x9B,0x12,0xE9,0x19,0x7D,
+	0x50,0x86,0xCB,0x9B,0x50,0x72,0x19,0xEE,
+	0x95,0xDB,0x11,0x3A,0x91,0x76,0x78,0xB2,
+	0x73,0xBE,0xD6,0xB8,0xE3,0xC1,0x74,0x3B,
+	0x71,0x16,0xE6,0x9E,0x22,0x22,0x95,0x16,
+	0x3F,0xF1,0xCA,0xA1,0x68,0x1F,0xAC,0x09,
+	0x12,0x0E,0xCA,0x30,0x75,0x86,0xE1,0xA7
+};
+
+class AesTest : public ::testing::Test
+{
+	protected:
+		AesTest()
+			: aesw(nullptr) { }
+
+		void SetUp(void) final
+		{
+			aesw = aesw_new();
+			ASSERT_TRUE(aesw != nullptr);
+			ASSERT_EQ(0, aesw_set_key(aesw, aes_key, sizeof(aes_key)));
+		}
+
+		void TearDown(void) final
+		{
+			aesw_free(aesw);
+			aesw = nullptr;
+		}
+
+	public:
+		AesCtx *aesw;
+};
+
+/**
+ * Encrypt the test vector in a single call.
+ */
+TEST_F(AesTest, encryptTest)
+{
+	uint8_t buf[64];
+	memcpy(buf, aes_plaintext, sizeof(buf));
+	ASSERT_EQ(0, aesw_set_iv(aesw, aes_iv, sizeof(aes_iv)));
+	ASSERT_EQ(sizeof(buf), aesw_encrypt(aesw, buf, sizeof(buf)));
+	EXPECT_EQ(0, memcmp(aes_ciphertext, buf, sizeof(buf)));
+}
+
+/**
+ * Decrypt the test vector in a single call.
+ */
+TEST_F(AesTest, decryptTest)
+{
+	uint8_t buf[64];
+	memcpy(buf, aes_ciphertext, sizeof(buf));
+	ASSERT_EQ(0, aesw_set_iv(aesw, aes_iv, sizeof(aes_iv)));
+	ASSERT_EQ(sizeof(buf), aesw_decrypt(aesw, buf, sizeof(buf)));
+	EXPECT_EQ(0, memcmp(aes_plaintext, buf, sizeof(buf)));
+}
+
+/**
+ * Encrypt and decrypt the test vector one block at a time.
+ * The IV must be chained between calls.
+ */
+TEST_F(AesTest, chainedBlockTest)
+{
+	uint8_t buf[64];
+	memcpy(buf, aes_plaintext, sizeof(buf));
+	ASSERT_EQ(0, aesw_set_iv(aesw, aes_iv, sizeof(aes_iv)));
+	for (unsigned int i = 0; i < sizeof(buf); i += 16) {
+		ASSERT_EQ(16U, aesw_encrypt(aesw, &buf[i], 16));
+	}
+	EXPECT_EQ(0, memcmp(aes_ciphertext, buf, sizeof(buf)));
+
+	ASSERT_EQ(0, aesw_set_iv(aesw, aes_iv, sizeof(aes_iv)));
+	for (unsigned int i = 0; i < sizeof(buf); i += 16) {
+		ASSERT_EQ(16U, aesw_decrypt(aesw, &buf[i], 16));
+	}
+	EXPECT_EQ(0, memcmp(aes_plaintext, buf, sizeof(buf)));
+}
+
+/**
+ * Round-trip a buffer that isn't a multiple of 64 bytes.
+ */
+TEST_F(AesTest, roundTripTest)
+{
+	// 31 KB + 16 bytes: Wii sector data size, plus a partial 64-byte chunk.
+	vector<uint8_t> orig(31*1024 + 16);
+	for (size_t i = 0; i < orig.size(); i++) {
+		orig[i] = static_cast<uint8_t>((i * 37) ^ (i >> 8));
+	}
+	vector<uint8_t> buf(orig);
+
+	ASSERT_EQ(0, aesw_set_iv(aesw, aes_iv, sizeof(aes_iv)));
+	ASSERT_EQ(buf.size(), aesw_encrypt(aesw, buf.data(), buf.size()));
+	EXPECT_NE(0, memcmp(orig.data(), buf.data(), buf.size()));
+
+	ASSERT_EQ(0, aesw_set_iv(aesw, aes_iv, sizeof(aes_iv)));
+	ASSERT_EQ(buf.size(), aesw_decrypt(aesw, buf.data(), buf.size()));
+	EXPECT_EQ(0, memcmp(orig.data(), buf.data(), buf.size()));
+}
+
+/**
+ * Encrypt and decrypt multiple streams at once.
+ * 11 streams: one full set of 8, plus 3 remaining streams.
+ * Results must match encrypting each stream separately.
+ */
+TEST_F(AesTest, multiStreamTest)
+{
+	static const unsigned int count = 11;
+	static const size_t size = 1024;
+
+	vector<uint8_t> orig(count * size);
+	for (size_t i = 0; i < orig.size(); i++) {
+		orig[i] = static_cast<uint8_t>((i * 37) ^ (i >> 8));
+	}
+	vector<uint8_t> ivs(count * 16);
+	for (size_t i = 0; i < ivs.size(); i++) {
+		ivs[i] = static_cast<uint8_t>(i * 13 + 5);
+	}
+
+	// Reference: Encrypt each stream separately.
+	vector<uint8_t> expected(orig);
+	for (unsigned int i = 0; i < count; i++) {
+		ASSERT_EQ(0, aesw_set_iv(aesw, &ivs[i * 16], 16));
+		ASSERT_EQ(size, aesw_encrypt(aesw, &expected[i * size], size));
+	}
+
+	vector<uint8_t> buf(orig);
+	const uint8_t *pIV[count];
+	uint8_t *pData[count];
+	for (unsigned int i = 0; i < count; i++) {
+		pIV[i] = &ivs[i * 16];
+		pData[i] = &buf[i * size];
+	}
+
+	ASSERT_EQ(count * size, aesw_encrypt_multi(aesw, pIV, pData, size, count));
+	EXPECT_EQ(0, memcmp(expected.data(), buf.data(), buf.size()));
+
+	ASSERT_EQ(count * size, aesw_decrypt_multi(aesw, pIV, pData, size, count));
+	EXPECT_EQ(0, memcmp(orig.data(), buf.data(), buf.size()));
+}
+
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "libwiicrypto test suite: AES tests.\n\n");
+	fprintf(stderr, "AES implementation: %s\n\n", aesw_get_impl_name());
+	fflush(nullptr);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
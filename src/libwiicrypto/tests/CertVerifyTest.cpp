@@ -2,7 +2,7 @@
  * RVT-H Tool (libwiicrypto/tests)                                         *
  * CertVerifyTest.cpp: Certificate verification test.                      *
  *                                                                         *
- * Copyright (c) 2018 by David Korth.                                      *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
@@ -11,13 +11,20 @@
 
 #include "libwiicrypto/cert_store.h"
 #include "libwiicrypto/cert.h"
+#include "libwiicrypto/byteswap.h"
+#include "libwiicrypto/priv_key_store.h"
 
 // C includes. (C++ namespace)
 #include <cassert>
+#include <cstring>
 
 // C++ includes.
+#include <atomic>
 #include <string>
+#include <thread>
+#include <vector>
 using std::string;
+using std::vector;
 
 #if defined(_MSC_VER) && _MSC_VER < 1700
 # define final sealed
@@ -71,6 +78,96 @@ TEST_P(CertVerifyTest, certVerifyTest)
 	ASSERT_EQ(0, cert_verify(reinterpret_cast<const uint8_t*>(cert), cert_size));
 }
 
+/**
+ * Make sure cached verification results aren't returned
+ * for a modified copy of a certificate.
+ */
+TEST_P(CertVerifyTest, certVerifyCacheTest)
+{
+	const RVL_Cert_Issuer cert_id = GetParam();
+
+	// Get the certificate.
+	const RVL_Cert *const cert = cert_get(cert_id);
+	const unsigned int cert_size = cert_get_size(cert_id);
+	ASSERT_TRUE(cert != nullptr);
+	ASSERT_NE(0U, cert_size);
+
+	// Verify the certificate twice. The second one is cached.
+	const uint8_t *const cert_u8 = reinterpret_cast<const uint8_t*>(cert);
+	ASSERT_EQ(0, cert_verify(cert_u8, cert_size));
+	ASSERT_EQ(0, cert_verify(cert_u8, cert_size));
+
+	// Modify the last byte of a copy. This is covered by the signature.
+	vector<uint8_t> copy(cert_u8, cert_u8 + cert_size);
+	copy[cert_size - 1] ^= 0x01;
+	const int ret = cert_verify(copy.data(), copy.size());
+	EXPECT_EQ(SIG_ERROR_INVALID, ret & SIG_ERROR_MASK);
+	EXPECT_NE(0, ret & SIG_FAIL_HASH_ERROR);
+
+	// The original certificate must still be valid.
+	ASSERT_EQ(0, cert_verify(cert_u8, cert_size));
+}
+
+/**
+ * Look up each issuer by name.
+ * This also checks the precomputed issuer name hashes.
+ */
+TEST(CertIssuerTest, issuerLookupTest)
+{
+	for (int i = RVL_CERT_ISSUER_UNKNOWN+1; i < RVL_CERT_ISSUER_MAX; i++) {
+		const RVL_Cert_Issuer issuer = static_cast<RVL_Cert_Issuer>(i);
+		const RVL_PKI pki = cert_get_pki_from_issuer(issuer);
+		EXPECT_EQ(issuer, cert_get_issuer_from_name_with_pki(RVL_Cert_Issuers[i], pki))
+			<< "Issuer: " << RVL_Cert_Issuers[i];
+	}
+
+	// Issuers that are shared by multiple PKIs return the first one.
+	EXPECT_EQ(CTR_CERT_ISSUER_DPKI_CA, cert_get_issuer_from_name("Root-CA00000004"));
+	EXPECT_EQ(CTR_CERT_ISSUER_PPKI_TMD, cert_get_issuer_from_name("Root-CA00000003-CP0000000b"));
+
+	// Unknown issuers.
+	EXPECT_EQ(RVL_CERT_ISSUER_UNKNOWN, cert_get_issuer_from_name("Root-CA00000002-XS00000005"));
+	EXPECT_EQ(RVL_CERT_ISSUER_UNKNOWN, cert_get_issuer_from_name("Root"));
+	EXPECT_EQ(RVL_CERT_ISSUER_UNKNOWN, cert_get_issuer_from_name_with_pki("Root-CA00000001", RVL_PKI_DPKI));
+}
+
+/**
+ * Realsign a dummy TMD from multiple threads at once.
+ * Prepared private keys are cached and shared by all threads,
+ * so every signature must still be valid.
+ */
+TEST(CertRealsignTest, realsignMultiThreadTest)
+{
+	static const unsigned int THREADS = 4;
+	static const unsigned int SIGS_PER_THREAD = 4;
+	static const size_t TMD_SIZE = sizeof(RVL_Sig_RSA2048) + 0x40;
+
+	std::atomic<unsigned int> valid(0);
+	vector<std::thread> threads;
+	for (unsigned int t = 0; t < THREADS; t++) {
+		threads.emplace_back([t, &valid]() {
+			for (unsigned int i = 0; i < SIGS_PER_THREAD; i++) {
+				vector<uint8_t> tmd(TMD_SIZE);
+				RVL_Sig_RSA2048 *const sig = reinterpret_cast<RVL_Sig_RSA2048*>(tmd.data());
+				sig->type = cpu_to_be32(RVL_CERT_SIGTYPE_RSA2048_SHA1);
+				strncpy(sig->issuer, RVL_Cert_Issuers[RVL_CERT_ISSUER_DPKI_TMD], sizeof(sig->issuer)-1);
+				tmd[TMD_SIZE - 1] = static_cast<uint8_t>(t * SIGS_PER_THREAD + i);
+
+				if (cert_realsign_ticketOrTMD(tmd.data(), tmd.size(), &rvth_privkey_RVL_dpki_tmd) == 0 &&
+				    cert_verify(tmd.data(), tmd.size()) == 0)
+				{
+					valid++;
+				}
+			}
+		});
+	}
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+
+	EXPECT_EQ(THREADS * SIGS_PER_THREAD, valid.load());
+}
+
 /**
  * Test case suffix generator.
  * @param info Test parameter information.
@@ -0,0 +1,191 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto/tests)                                         *
+ * Crc32Test.cpp: CRC32 wrapper test.                                      *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+
+#include "libwiicrypto/crc32w.h"
+
+// C includes. (C++ namespace)
+#include <cerrno>
+#include <cstdio>
+
+// C++ includes.
+#include <string>
+#include <vector>
+using std::string;
+using std::vector;
+
+namespace LibWiiCrypto { namespace Tests {
+
+class Crc32Test : public ::testing::TestWithParam<int>
+{
+	protected:
+		Crc32Test()
+			: supported(false) { }
+
+		void SetUp(void) final
+		{
+			const int ret = crc32w_set_impl(GetParam());
+			if (ret == -ENOTSUP) {
+				// Not supported on this CPU. The tests will be skipped.
+				fprintf(stderr, "*** CRC32 implementation %d is not supported on this CPU; skipping.\n", GetParam());
+				return;
+			}
+			ASSERT_EQ(0, ret);
+			supported = true;
+		}
+
+		void TearDown(void) final
+		{
+			crc32w_set_impl(CRC32W_IMPL_AUTO);
+		}
+
+	public:
+		bool supported;
+
+		/**
+		 * Calculate a reference CRC32 bit by bit.
+		 * @param pData Data.
+		 * @param size Size of pData.
+		 * @return CRC32.
+		 */
+		static uint32_t reference(const uint8_t *pData, size_t size);
+
+		/**
+		 * Test case suffix generator.
+		 * @param info Test parameter information.
+		 * @return Test case suffix.
+		 */
+		static string test_case_suffix_generator(const ::testing::TestParamInfo<int> &info);
+};
+
+/**
+ * Calculate a reference CRC32 bit by bit.
+ * @param pData Data.
+ * @param size Size of pData.
+ * @return CRC32.
+ */
+uint32_t Crc32Test::reference(const uint8_t *pData, size_t size)
+{
+	uint32_t crc = 0xFFFFFFFFU;
+	for (; size > 0; size--, pData++) {
+		crc ^= *pData;
+		for (unsigned int i = 0; i < 8; i++) {
+			crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320U : 0);
+		}
+	}
+	return ~crc;
+}
+
+/**
+ * Calculate the CRC32 of the standard check string.
+ */
+TEST_P(Crc32Test, knownVectorTest)
+{
+	if (!supported)
+		return;
+
+	EXPECT_EQ(0xCBF43926U, crc32w_update(0, reinterpret_cast<const uint8_t*>("123456789"), 9));
+	EXPECT_EQ(0U, crc32w_update(0, reinterpret_cast<const uint8_t*>(""), 0));
+}
+
+/**
+ * Calculate CRC32s with sizes and alignments around the
+ * SIMD block sizes, and compare against the reference.
+ */
+TEST_P(Crc32Test, sizeAlignmentTest)
+{
+	if (!supported)
+		return;
+
+	vector<uint8_t> buf(4096 + 64);
+	for (size_t i = 0; i < buf.size(); i++) {
+		buf[i] = static_cast<uint8_t>((i * 151) ^ (i >> 7));
+	}
+
+	for (size_t offset = 0; offset < 16; offset++) {
+		for (size_t size = 0; size <= 300; size++) {
+			EXPECT_EQ(reference(&buf[offset], size), crc32w_update(0, &buf[offset], size))
+				<< "offset == " << offset << ", size == " << size;
+		}
+		EXPECT_EQ(reference(&buf[offset], 4096), crc32w_update(0, &buf[offset], 4096))
+			<< "offset == " << offset << ", size == 4096";
+	}
+}
+
+/**
+ * Split a buffer into blocks, calculate the CRC32s separately
+ * (both as a continuation and independently), and combine them.
+ */
+TEST_P(Crc32Test, combineTest)
+{
+	if (!supported)
+		return;
+
+	vector<uint8_t> buf(65536 + 37);
+	for (size_t i = 0; i < buf.size(); i++) {
+		buf[i] = static_cast<uint8_t>((i * 151) ^ (i >> 7));
+	}
+	const uint32_t expected = reference(buf.data(), buf.size());
+
+	static const size_t splits[] = {0, 1, 15, 64, 1000, 32768, 65536 + 37};
+	for (size_t split : splits) {
+		const size_t len2 = buf.size() - split;
+		const uint32_t crc1 = crc32w_update(0, buf.data(), split);
+		const uint32_t crc2 = crc32w_update(0, &buf[split], len2);
+
+		EXPECT_EQ(expected, crc32w_update(crc1, &buf[split], len2)) << "split == " << split;
+		EXPECT_EQ(expected, crc32w_combine(crc1, crc2, len2)) << "split == " << split;
+	}
+}
+
+/**
+ * Test case suffix generator.
+ * @param info Test parameter information.
+ * @return Test case suffix.
+ */
+string Crc32Test::test_case_suffix_generator(const ::testing::TestParamInfo<int> &info)
+{
+	switch (info.param) {
+		case CRC32W_IMPL_SOFTWARE:	return "software";
+		case CRC32W_IMPL_PCLMUL:	return "PCLMUL";
+		case CRC32W_IMPL_ARMV8:		return "ARMv8";
+		default:			break;
+	}
+	return "unknown";
+}
+
+INSTANTIATE_TEST_CASE_P(crc32Test, Crc32Test,
+	::testing::Values(
+		CRC32W_IMPL_SOFTWARE,
+		CRC32W_IMPL_PCLMUL,
+		CRC32W_IMPL_ARMV8
+	), Crc32Test::test_case_suffix_generator);
+
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "libwiicrypto test suite: CRC32 tests.\n\n");
+	fprintf(stderr, "CRC32 implementation: %s\n\n", crc32w_get_impl_name());
+	fflush(nullptr);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,192 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto/tests)                                         *
+ * Sha1Test.cpp: SHA-1 wrapper test.                                       *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+
+#include "libwiicrypto/sha1w.h"
+
+// C includes. (C++ namespace)
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+// C++ includes.
+#include <string>
+#include <vector>
+using std::string;
+using std::vector;
+
+namespace LibWiiCrypto { namespace Tests {
+
+// SHA-1("abc") from FIPS 180-2, Appendix A.1.
+static const uint8_t sha1_abc[SHA1W_DIGEST_SIZE] = {
+	0xA9,0x99,0x3E,0x36,0x47,0x06,0x81,0x6A,
+	0xBA,0x3E,0x25,0x71,0x78,0x50,0xC2,0x6C,
+	0x9C,0xD0,0xD8,0x9D
+};
+
+// SHA-1("") (empty string)
+static const uint8_t sha1_empty[SHA1W_DIGEST_SIZE] = {
+	0xDA,0x39,0xA3,0xEE,0x5E,0x6B,0x4B,0x0D,
+	0x32,0x55,0xBF,0xEF,0x95,0x60,0x18,0x90,
+	0xAF,0xD8,0x07,0x09
+};
+
+class Sha1Test : public ::testing::TestWithParam<int>
+{
+	protected:
+		Sha1Test()
+			: supported(false) { }
+
+		void SetUp(void) final
+		{
+			const int ret = sha1w_set_impl(GetParam());
+			if (ret == -ENOTSUP) {
+				// Not supported on this CPU. The tests will be skipped.
+				fprintf(stderr, "*** SHA-1 implementation %d is not supported on this CPU; skipping.\n", GetParam());
+				return;
+			}
+			ASSERT_EQ(0, ret);
+			supported = true;
+		}
+
+		void TearDown(void) final
+		{
+			sha1w_set_impl(SHA1W_IMPL_AUTO);
+		}
+
+	public:
+		bool supported;
+
+		/**
+		 * Calculate reference digests using the software implementation.
+		 * @param pData Data.
+		 * @param size Size of each buffer.
+		 * @param stride Distance between buffers.
+		 * @param count Number of buffers.
+		 * @return Digests.
+		 */
+		vector<uint8_t> reference(const uint8_t *pData, size_t size, size_t stride, unsigned int count);
+
+		/**
+		 * Test case suffix generator.
+		 * @param info Test parameter information.
+		 * @return Test case suffix.
+		 */
+		static string test_case_suffix_generator(const ::testing::TestParamInfo<int> &info);
+};
+
+/**
+ * Calculate reference digests using the software implementation.
+ * @param pData Data.
+ * @param size Size of each buffer.
+ * @param stride Distance between buffers.
+ * @param count Number of buffers.
+ * @return Digests.
+ */
+vector<uint8_t> Sha1Test::reference(const uint8_t *pData, size_t size, size_t stride, unsigned int count)
+{
+	const int impl = GetParam();
+	vector<uint8_t> digests(count * SHA1W_DIGEST_SIZE);
+	sha1w_set_impl(SHA1W_IMPL_NETTLE);
+	for (unsigned int i = 0; i < count; i++, pData += stride) {
+		sha1w_hash(pData, size, &digests[i * SHA1W_DIGEST_SIZE]);
+	}
+	sha1w_set_impl(impl);
+	return digests;
+}
+
+/**
+ * Hash the FIPS 180-2 test vectors.
+ */
+TEST_P(Sha1Test, knownVectorTest)
+{
+	if (!supported)
+		return;
+	uint8_t digest[SHA1W_DIGEST_SIZE];
+
+	sha1w_hash(reinterpret_cast<const uint8_t*>("abc"), 3, digest);
+	EXPECT_EQ(0, memcmp(sha1_abc, digest, sizeof(digest)));
+
+	sha1w_hash(reinterpret_cast<const uint8_t*>(""), 0, digest);
+	EXPECT_EQ(0, memcmp(sha1_empty, digest, sizeof(digest)));
+}
+
+/**
+ * Hash multiple buffers with sizes around the padding boundaries
+ * and the Wii hash table sizes, and compare against the software
+ * implementation.
+ */
+TEST_P(Sha1Test, stridedTest)
+{
+	if (!supported)
+		return;
+
+	static const size_t sizes[] = {0, 1, 55, 56, 63, 64, 65, 160, 620, 1024};
+
+	// 31 buffers of 1,024 bytes: same layout as a Wii sector's user data.
+	vector<uint8_t> buf(31*1024 + 64);
+	for (size_t i = 0; i < buf.size(); i++) {
+		buf[i] = static_cast<uint8_t>((i * 151) ^ (i >> 7));
+	}
+
+	for (size_t size : sizes) {
+		for (unsigned int count = 1; count <= 31; count++) {
+			const vector<uint8_t> expected = reference(buf.data(), size, 1024, count);
+			vector<uint8_t> digests(count * SHA1W_DIGEST_SIZE);
+			sha1w_hash_strided(buf.data(), size, 1024, count, digests.data());
+			EXPECT_EQ(expected, digests) << "size == " << size << ", count == " << count;
+		}
+	}
+}
+
+/**
+ * Test case suffix generator.
+ * @param info Test parameter information.
+ * @return Test case suffix.
+ */
+string Sha1Test::test_case_suffix_generator(const ::testing::TestParamInfo<int> &info)
+{
+	switch (info.param) {
+		case SHA1W_IMPL_NETTLE:	return "nettle";
+		case SHA1W_IMPL_SHANI:	return "SHANI";
+		case SHA1W_IMPL_AVX2:	return "AVX2";
+		default:		break;
+	}
+	return "unknown";
+}
+
+INSTANTIATE_TEST_CASE_P(sha1Test, Sha1Test,
+	::testing::Values(
+		SHA1W_IMPL_NETTLE,
+		SHA1W_IMPL_SHANI,
+		SHA1W_IMPL_AVX2
+	), Sha1Test::test_case_suffix_generator);
+
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "libwiicrypto test suite: SHA-1 tests.\n\n");
+	fprintf(stderr, "SHA-1 implementation: %s\n\n", sha1w_get_impl_name());
+	fflush(nullptr);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
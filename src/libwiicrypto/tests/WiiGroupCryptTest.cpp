@@ -0,0 +1,155 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto/tests)                                         *
+ * WiiGroupCryptTest.cpp: Wii disc group encryption test.                  *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+
+#include "libwiicrypto/aesw.h"
+#include "libwiicrypto/sha1w.h"
+#include "libwiicrypto/wii_group_crypt.h"
+#include "libwiicrypto/wii_hash_tree.h"
+
+// C includes. (C++ namespace)
+#include <cstdio>
+#include <cstring>
+
+// C++ includes.
+#include <memory>
+using std::unique_ptr;
+
+namespace LibWiiCrypto { namespace Tests {
+
+// Number of groups to test.
+static const unsigned int GROUP_COUNT = 3;
+
+class WiiGroupCryptTest : public ::testing::Test
+{
+	protected:
+		void SetUp(void) final
+		{
+			static const uint8_t title_key[16] = {
+				0x0F,0x1E,0x2D,0x3C,0x4B,0x5A,0x69,0x78,
+				0x87,0x96,0xA5,0xB4,0xC3,0xD2,0xE1,0xF0
+			};
+
+			aesw = aesw_new();
+			ASSERT_TRUE(aesw != nullptr);
+			ASSERT_EQ(0, aesw_set_key(aesw, title_key, sizeof(title_key)));
+
+			dec.reset(new Wii_Disc_Group_Dec_t[GROUP_COUNT]);
+			enc.reset(new Wii_Disc_Group_t[GROUP_COUNT]);
+			for (unsigned int g = 0; g < GROUP_COUNT; g++) {
+				uint8_t *const data = &dec[g].data[0][0];
+				for (unsigned int i = 0; i < sizeof(dec[g]); i++) {
+					data[i] = static_cast<uint8_t>((i * 151) ^ (i >> 9) ^ (g * 37));
+				}
+			}
+		}
+
+		void TearDown(void) final
+		{
+			aesw_free(aesw);
+		}
+
+	public:
+		AesCtx *aesw = nullptr;
+		unique_ptr<Wii_Disc_Group_Dec_t[]> dec;
+		unique_ptr<Wii_Disc_Group_t[]> enc;
+};
+
+/**
+ * Encrypt groups and check them against a group encrypted
+ * one sector at a time with the basic AES functions.
+ */
+TEST_F(WiiGroupCryptTest, encrypt)
+{
+	uint8_t H3[GROUP_COUNT][RVL_SHA1_DIGEST_SIZE];
+	ASSERT_EQ(0, wii_group_encrypt(aesw, dec.get(), enc.get(), GROUP_COUNT, H3));
+
+	unique_ptr<Wii_Disc_Group_t> expected(new Wii_Disc_Group_t);
+	for (unsigned int g = 0; g < GROUP_COUNT; g++) {
+		Wii_Disc_Sector_t *const sbuf = expected->sectors;
+		for (unsigned int i = 0; i < WII_HASH_TREE_SECTORS_PER_GROUP; i++) {
+			memcpy(sbuf[i].data, dec[g].data[i], SECTOR_SIZE_DEC);
+		}
+		uint8_t H3_expected[RVL_SHA1_DIGEST_SIZE];
+		wii_hash_tree_build_group(sbuf, H3_expected);
+		EXPECT_EQ(0, memcmp(H3_expected, H3[g], sizeof(H3_expected))) << "group " << g;
+
+		static const uint8_t zero_iv[16] = {0};
+		for (unsigned int i = 0; i < WII_HASH_TREE_SECTORS_PER_GROUP; i++) {
+			aesw_set_iv(aesw, zero_iv, sizeof(zero_iv));
+			aesw_encrypt(aesw, reinterpret_cast<uint8_t*>(&sbuf[i].hashes), sizeof(sbuf[i].hashes));
+			aesw_set_iv(aesw, &sbuf[i].hashes.H2[7][4], 16);
+			aesw_encrypt(aesw, sbuf[i].data, sizeof(sbuf[i].data));
+		}
+		EXPECT_EQ(0, memcmp(expected.get(), &enc[g], sizeof(Wii_Disc_Group_t))) << "group " << g;
+	}
+}
+
+/**
+ * Encrypt groups, then decrypt the user data.
+ */
+TEST_F(WiiGroupCryptTest, decrypt)
+{
+	ASSERT_EQ(0, wii_group_encrypt(aesw, dec.get(), enc.get(), GROUP_COUNT, nullptr));
+
+	unique_ptr<Wii_Disc_Group_Dec_t[]> out(new Wii_Disc_Group_Dec_t[GROUP_COUNT]);
+	ASSERT_EQ(0, wii_group_decrypt(aesw, enc.get(), out.get(), GROUP_COUNT));
+	EXPECT_EQ(0, memcmp(dec.get(), out.get(), sizeof(Wii_Disc_Group_Dec_t) * GROUP_COUNT));
+}
+
+/**
+ * Encrypt groups, then decrypt them in place
+ * and check the hash tree.
+ */
+TEST_F(WiiGroupCryptTest, decrypt_in_place)
+{
+	uint8_t H3[GROUP_COUNT][RVL_SHA1_DIGEST_SIZE];
+	ASSERT_EQ(0, wii_group_encrypt(aesw, dec.get(), enc.get(), GROUP_COUNT, H3));
+	ASSERT_EQ(0, wii_group_decrypt_in_place(aesw, enc.get(), GROUP_COUNT));
+
+	for (unsigned int g = 0; g < GROUP_COUNT; g++) {
+		const Wii_Disc_Sector_t *const sbuf = enc[g].sectors;
+		for (unsigned int i = 0; i < WII_HASH_TREE_SECTORS_PER_GROUP; i++) {
+			EXPECT_EQ(0, memcmp(dec[g].data[i], sbuf[i].data, SECTOR_SIZE_DEC))
+				<< "group " << g << ", sector " << i;
+		}
+
+		uint8_t H3_calc[RVL_SHA1_DIGEST_SIZE];
+		wii_hash_tree_calc_H3(&sbuf[0], H3_calc);
+		EXPECT_EQ(0, memcmp(H3[g], H3_calc, sizeof(H3_calc))) << "group " << g;
+	}
+
+	// Encrypting in place again restores the original ciphertext.
+	unique_ptr<Wii_Disc_Group_t[]> enc2(new Wii_Disc_Group_t[GROUP_COUNT]);
+	ASSERT_EQ(0, wii_group_encrypt(aesw, dec.get(), enc2.get(), GROUP_COUNT, nullptr));
+	ASSERT_EQ(0, wii_group_encrypt_in_place(aesw, enc.get(), GROUP_COUNT));
+	EXPECT_EQ(0, memcmp(enc2.get(), enc.get(), sizeof(Wii_Disc_Group_t) * GROUP_COUNT));
+}
+
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "libwiicrypto test suite: Wii disc group encryption tests.\n\n");
+	fflush(nullptr);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,227 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto/tests)                                         *
+ * WiiHashTreeTest.cpp: Wii disc hash tree test.                           *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+
+#include "libwiicrypto/aesw.h"
+#include "libwiicrypto/sha1w.h"
+#include "libwiicrypto/wii_hash_tree.h"
+
+// C includes. (C++ namespace)
+#include <cstdio>
+#include <cstring>
+
+// C++ includes.
+#include <memory>
+using std::unique_ptr;
+
+namespace LibWiiCrypto { namespace Tests {
+
+class WiiHashTreeTest : public ::testing::Test
+{
+	protected:
+		void SetUp(void) final
+		{
+			group.reset(new Wii_Disc_Sector_t[WII_HASH_TREE_SECTORS_PER_GROUP]);
+			memset(group.get(), 0, sizeof(Wii_Disc_Sector_t) * WII_HASH_TREE_SECTORS_PER_GROUP);
+		}
+
+	public:
+		unique_ptr<Wii_Disc_Sector_t[]> group;
+
+		/**
+		 * Fill a sector's user data with a test pattern.
+		 * @param sector Sector number.
+		 */
+		void fillSector(unsigned int sector);
+
+		/**
+		 * Build the hash tree for the group one hash at a time,
+		 * without any shortcuts, and compare it to
+		 * wii_hash_tree_build_group().
+		 */
+		void checkGroup(void);
+};
+
+/**
+ * Fill a sector's user data with a test pattern.
+ * @param sector Sector number.
+ */
+void WiiHashTreeTest::fillSector(unsigned int sector)
+{
+	uint8_t *const data = group[sector].data;
+	for (unsigned int i = 0; i < sizeof(group[sector].data); i++) {
+		data[i] = static_cast<uint8_t>((i * 151) ^ (i >> 7) ^ sector);
+	}
+}
+
+/**
+ * Build the hash tree for the group one hash at a time,
+ * without any shortcuts, and compare it to
+ * wii_hash_tree_build_group().
+ */
+void WiiHashTreeTest::checkGroup(void)
+{
+	unique_ptr<Wii_Disc_Sector_t[]> expected(new Wii_Disc_Sector_t[WII_HASH_TREE_SECTORS_PER_GROUP]);
+	memcpy(expected.get(), group.get(), sizeof(Wii_Disc_Sector_t) * WII_HASH_TREE_SECTORS_PER_GROUP);
+
+	for (unsigned int i = 0; i < WII_HASH_TREE_SECTORS_PER_GROUP; i++) {
+		Wii_Disc_Hashes_t *const hashes = &expected[i].hashes;
+		memset(hashes, 0, sizeof(*hashes));
+		for (unsigned int kb = 0; kb < 31; kb++) {
+			sha1w_hash(&expected[i].data[kb * 1024], 1024, hashes->H0[kb]);
+		}
+	}
+	for (unsigned int i = 0; i < WII_HASH_TREE_SECTORS_PER_GROUP; i++) {
+		const unsigned int sg = i & ~7U;
+		for (unsigned int j = 0; j < 8; j++) {
+			sha1w_hash(expected[sg + j].hashes.H0[0], sizeof(expected[0].hashes.H0),
+				expected[i].hashes.H1[j]);
+		}
+	}
+	for (unsigned int i = 0; i < WII_HASH_TREE_SECTORS_PER_GROUP; i++) {
+		for (unsigned int sg = 0; sg < 8; sg++) {
+			sha1w_hash(expected[sg * 8].hashes.H1[0], sizeof(expected[0].hashes.H1),
+				expected[i].hashes.H2[sg]);
+		}
+	}
+	uint8_t expected_H3[RVL_SHA1_DIGEST_SIZE];
+	sha1w_hash(expected[0].hashes.H2[0], sizeof(expected[0].hashes.H2), expected_H3);
+
+	uint8_t H3[RVL_SHA1_DIGEST_SIZE];
+	wii_hash_tree_build_group(group.get(), H3);
+	for (unsigned int i = 0; i < WII_HASH_TREE_SECTORS_PER_GROUP; i++) {
+		EXPECT_EQ(0, memcmp(&expected[i].hashes, &group[i].hashes, sizeof(group[i].hashes)))
+			<< "sector == " << i;
+	}
+	EXPECT_EQ(0, memcmp(expected_H3, H3, sizeof(H3)));
+}
+
+/**
+ * Hash a fully-zeroed group.
+ */
+TEST_F(WiiHashTreeTest, zeroGroupTest)
+{
+	checkGroup();
+}
+
+/**
+ * Hash a group with no zeroed data.
+ */
+TEST_F(WiiHashTreeTest, fullGroupTest)
+{
+	for (unsigned int i = 0; i < WII_HASH_TREE_SECTORS_PER_GROUP; i++) {
+		fillSector(i);
+	}
+	checkGroup();
+}
+
+/**
+ * Hash a group with a mix of zeroed kilobytes, sectors, and subgroups.
+ */
+TEST_F(WiiHashTreeTest, mixedGroupTest)
+{
+	for (unsigned int i = 0; i < WII_HASH_TREE_SECTORS_PER_GROUP; i++) {
+		if (i >= 16 && i < 24) {
+			// Zeroed subgroup.
+			continue;
+		} else if (i % 3 == 0) {
+			// Zeroed sector.
+			continue;
+		}
+		fillSector(i);
+
+		// Zero out some of the kilobytes.
+		for (unsigned int kb = i % 5; kb < 31; kb += 4) {
+			memset(&group[i].data[kb * 1024], 0, 1024);
+		}
+	}
+
+	// A single non-zero byte at the end of an otherwise zeroed kilobyte.
+	group[3].data[(2 * 1024) + 1023] = 1;
+
+	checkGroup();
+}
+
+/**
+ * Decrypt sectors and calculate their H0 hashes in one pass,
+ * and compare the results to decrypting and hashing separately.
+ */
+TEST_F(WiiHashTreeTest, decryptCalcH0Test)
+{
+	// Use an odd number of sectors so the single-stream path is tested, too.
+	static const unsigned int count = 11;
+	static const uint8_t key[16] = {
+		0x00,0x11,0x22,0x33,0x44,0x55,0x66,0x77,
+		0x88,0x99,0xAA,0xBB,0xCC,0xDD,0xEE,0xFF
+	};
+
+	for (unsigned int i = 0; i < count; i++) {
+		if (i != 4) {
+			fillSector(i);
+		}
+		// Fake IV in the H2 table.
+		for (unsigned int j = 4; j < RVL_SHA1_DIGEST_SIZE; j++) {
+			group[i].hashes.H2[7][j] = static_cast<uint8_t>(i * 17 + j);
+		}
+	}
+	// Zero out a kilobyte.
+	memset(&group[2].data[5 * 1024], 0, 1024);
+
+	// Expected H0 hashes.
+	uint8_t expected_H0[count][31][RVL_SHA1_DIGEST_SIZE];
+	for (unsigned int i = 0; i < count; i++) {
+		for (unsigned int kb = 0; kb < 31; kb++) {
+			sha1w_hash(&group[i].data[kb * 1024], 1024, expected_H0[i][kb]);
+		}
+	}
+	unique_ptr<Wii_Disc_Sector_t[]> plain(new Wii_Disc_Sector_t[count]);
+	memcpy(plain.get(), group.get(), sizeof(Wii_Disc_Sector_t) * count);
+
+	// Encrypt the user data.
+	AesCtx *const aesw = aesw_new();
+	ASSERT_NE(nullptr, aesw);
+	ASSERT_EQ(0, aesw_set_key(aesw, key, sizeof(key)));
+	for (unsigned int i = 0; i < count; i++) {
+		aesw_set_iv(aesw, &group[i].hashes.H2[7][4], 16);
+		aesw_encrypt(aesw, group[i].data, sizeof(group[i].data));
+	}
+
+	uint8_t H0[count][31][RVL_SHA1_DIGEST_SIZE];
+	wii_hash_tree_decrypt_calc_H0(aesw, group.get(), count, H0);
+	aesw_free(aesw);
+
+	for (unsigned int i = 0; i < count; i++) {
+		EXPECT_EQ(0, memcmp(plain[i].data, group[i].data, sizeof(group[i].data)))
+			<< "sector == " << i;
+		EXPECT_EQ(0, memcmp(expected_H0[i], H0[i], sizeof(H0[i])))
+			<< "sector == " << i;
+	}
+}
+
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "libwiicrypto test suite: Wii hash tree tests.\n\n");
+	fflush(nullptr);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
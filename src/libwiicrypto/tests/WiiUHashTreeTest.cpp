@@ -0,0 +1,256 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto/tests)                                         *
+ * WiiUHashTreeTest.cpp: Wii U hashed content test.                        *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+
+#include "libwiicrypto/aesw.h"
+#include "libwiicrypto/sha1w.h"
+#include "libwiicrypto/wiiu_hash_tree.h"
+
+// C includes. (C++ namespace)
+#include <cstdio>
+#include <cstring>
+
+// C++ includes.
+#include <algorithm>
+#include <memory>
+using std::unique_ptr;
+
+namespace LibWiiCrypto { namespace Tests {
+
+class WiiUHashTreeTest : public ::testing::Test
+{
+	protected:
+		// Two superblocks and one extra block.
+		static const unsigned int BLOCK_COUNT = 33;
+
+		void SetUp(void) final;
+		void TearDown(void) final;
+
+	public:
+		unique_ptr<WiiU_Hash_Block_t[]> blocks;
+		uint8_t H3[WUP_SHA1_DIGEST_SIZE];
+		AesCtx *aesw;
+
+		/**
+		 * Encrypt all blocks.
+		 */
+		void encryptBlocks(void);
+
+		/**
+		 * Decrypt and verify all blocks.
+		 * Blocks are processed in batches of an odd size
+		 * so the batches aren't aligned to superblocks.
+		 * @param errors	[out] Errors.
+		 * @return Number of bad hashes.
+		 */
+		unsigned int verifyBlocks(WiiU_Hash_Tree_Errors_t *errors);
+};
+
+/**
+ * Create a set of blocks with a valid hash tree.
+ */
+void WiiUHashTreeTest::SetUp(void)
+{
+	static const uint8_t key[16] = {
+		0x0F,0x1E,0x2D,0x3C,0x4B,0x5A,0x69,0x78,
+		0x87,0x96,0xA5,0xB4,0xC3,0xD2,0xE1,0xF0
+	};
+	aesw = aesw_new();
+	ASSERT_NE(nullptr, aesw);
+	ASSERT_EQ(0, aesw_set_key(aesw, key, sizeof(key)));
+
+	blocks.reset(new WiiU_Hash_Block_t[BLOCK_COUNT]);
+	memset(blocks.get(), 0, sizeof(WiiU_Hash_Block_t) * BLOCK_COUNT);
+
+	// Data area test pattern.
+	for (unsigned int b = 0; b < BLOCK_COUNT; b++) {
+		uint8_t *const data = blocks[b].data;
+		for (unsigned int i = 0; i < sizeof(blocks[b].data); i++) {
+			data[i] = static_cast<uint8_t>((i * 151) ^ (i >> 9) ^ (b * 7));
+		}
+	}
+
+	// H0 tables: shared by all blocks in a superblock.
+	for (unsigned int b = 0; b < BLOCK_COUNT; b++) {
+		const unsigned int sb = b & ~15U;
+		for (unsigned int j = 0; j < 16 && sb + j < BLOCK_COUNT; j++) {
+			sha1w_hash(blocks[sb + j].data, sizeof(blocks[0].data), blocks[b].hashes.H0[j]);
+		}
+	}
+
+	// H1 table: shared by all blocks in the hyperblock.
+	uint8_t H1[16][WUP_SHA1_DIGEST_SIZE];
+	memset(H1, 0, sizeof(H1));
+	for (unsigned int sb = 0; sb * 16 < BLOCK_COUNT; sb++) {
+		sha1w_hash(blocks[sb * 16].hashes.H0[0], sizeof(blocks[0].hashes.H0), H1[sb]);
+	}
+
+	// H2 table: shared by all blocks in the H3 group.
+	uint8_t H2[16][WUP_SHA1_DIGEST_SIZE];
+	memset(H2, 0, sizeof(H2));
+	sha1w_hash(H1[0], sizeof(H1), H2[0]);
+	for (unsigned int b = 0; b < BLOCK_COUNT; b++) {
+		memcpy(blocks[b].hashes.H1, H1, sizeof(H1));
+		memcpy(blocks[b].hashes.H2, H2, sizeof(H2));
+	}
+
+	// H3 hash.
+	sha1w_hash(H2[0], sizeof(H2), H3);
+}
+
+void WiiUHashTreeTest::TearDown(void)
+{
+	aesw_free(aesw);
+}
+
+/**
+ * Encrypt all blocks.
+ */
+void WiiUHashTreeTest::encryptBlocks(void)
+{
+	static const uint8_t zero_iv[16] = {0};
+	for (unsigned int b = 0; b < BLOCK_COUNT; b++) {
+		// Data IV is the block's H0 hash, so encrypt the data first.
+		aesw_set_iv(aesw, blocks[b].hashes.H0[b % 16], 16);
+		aesw_encrypt(aesw, blocks[b].data, sizeof(blocks[b].data));
+		aesw_set_iv(aesw, zero_iv, sizeof(zero_iv));
+		aesw_encrypt(aesw, reinterpret_cast<uint8_t*>(&blocks[b].hashes), sizeof(blocks[b].hashes));
+	}
+}
+
+/**
+ * Decrypt and verify all blocks.
+ * Blocks are processed in batches of an odd size
+ * so the batches aren't aligned to superblocks.
+ * @param errors	[out] Errors.
+ * @return Number of bad hashes.
+ */
+unsigned int WiiUHashTreeTest::verifyBlocks(WiiU_Hash_Tree_Errors_t *errors)
+{
+	static const unsigned int batch = 7;
+	memset(errors, 0, sizeof(*errors));
+
+	unsigned int bad = 0;
+	for (unsigned int b = 0; b < BLOCK_COUNT; b += batch) {
+		const unsigned int n = std::min(batch, BLOCK_COUNT - b);
+		EXPECT_EQ(0, wiiu_hash_tree_decrypt_blocks(aesw, &blocks[b], b, n));
+		bad += wiiu_hash_tree_verify_blocks(&blocks[b], b, n, H3, 1, errors);
+	}
+	return bad;
+}
+
+/**
+ * Verify a valid hash tree.
+ */
+TEST_F(WiiUHashTreeTest, validTest)
+{
+	unique_ptr<WiiU_Hash_Block_t[]> plain(new WiiU_Hash_Block_t[BLOCK_COUNT]);
+	memcpy(plain.get(), blocks.get(), sizeof(WiiU_Hash_Block_t) * BLOCK_COUNT);
+	encryptBlocks();
+
+	WiiU_Hash_Tree_Errors_t errors;
+	EXPECT_EQ(0U, verifyBlocks(&errors));
+	for (unsigned int i = 0; i < 4; i++) {
+		EXPECT_EQ(0U, errors.bad_count[i]) << "level == " << i;
+		EXPECT_EQ(0U, errors.range_count[i]) << "level == " << i;
+	}
+
+	// Blocks should be fully decrypted.
+	EXPECT_EQ(0, memcmp(plain.get(), blocks.get(), sizeof(WiiU_Hash_Block_t) * BLOCK_COUNT));
+}
+
+/**
+ * Verify a hash tree with bad data and hashes.
+ * Consecutive bad blocks should be merged into ranges.
+ */
+TEST_F(WiiUHashTreeTest, badHashTest)
+{
+	// Bad H0 hashes: blocks 3, 5-9, and 32.
+	blocks[3].data[0] ^= 1;
+	for (unsigned int b = 5; b <= 9; b++) {
+		blocks[b].data[sizeof(blocks[b].data) - 1] ^= 0x80;
+	}
+	blocks[32].data[0x1234] ^= 0x10;
+
+	// Bad H1 hash: superblock 1. (H0 table in block 16)
+	// NOTE: Only the H0 table in the superblock's first block is checked.
+	blocks[16].hashes.H0[1][0] ^= 1;
+
+	// Bad H3 hash.
+	H3[0] ^= 1;
+
+	encryptBlocks();
+
+	WiiU_Hash_Tree_Errors_t errors;
+	EXPECT_EQ(7U + 1U + 1U, verifyBlocks(&errors));
+
+	EXPECT_EQ(7U, errors.bad_count[0]);
+	ASSERT_EQ(3U, errors.range_count[0]);
+	EXPECT_EQ(3U, errors.ranges[0][0].first);
+	EXPECT_EQ(3U, errors.ranges[0][0].last);
+	EXPECT_EQ(5U, errors.ranges[0][1].first);
+	EXPECT_EQ(9U, errors.ranges[0][1].last);
+	EXPECT_EQ(32U, errors.ranges[0][2].first);
+	EXPECT_EQ(32U, errors.ranges[0][2].last);
+
+	EXPECT_EQ(1U, errors.bad_count[1]);
+	ASSERT_EQ(1U, errors.range_count[1]);
+	EXPECT_EQ(1U, errors.ranges[1][0].first);
+	EXPECT_EQ(1U, errors.ranges[1][0].last);
+
+	EXPECT_EQ(0U, errors.bad_count[2]);
+
+	EXPECT_EQ(1U, errors.bad_count[3]);
+	ASSERT_EQ(1U, errors.range_count[3]);
+	EXPECT_EQ(0U, errors.ranges[3][0].first);
+}
+
+/**
+ * Bad hashes past WIIU_HASH_TREE_MAX_BAD_RANGES ranges
+ * should be counted, but not recorded.
+ */
+TEST_F(WiiUHashTreeTest, maxRangesTest)
+{
+	// Every other block is bad.
+	for (unsigned int b = 0; b < BLOCK_COUNT; b += 2) {
+		blocks[b].data[100] ^= 0xFF;
+	}
+	encryptBlocks();
+
+	WiiU_Hash_Tree_Errors_t errors;
+	verifyBlocks(&errors);
+	EXPECT_EQ((BLOCK_COUNT + 1) / 2, errors.bad_count[0]);
+	ASSERT_EQ(static_cast<unsigned int>(WIIU_HASH_TREE_MAX_BAD_RANGES), errors.range_count[0]);
+	for (unsigned int i = 0; i < WIIU_HASH_TREE_MAX_BAD_RANGES; i++) {
+		EXPECT_EQ(i * 2, errors.ranges[0][i].first);
+		EXPECT_EQ(i * 2, errors.ranges[0][i].last);
+	}
+}
+
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "libwiicrypto test suite: Wii U hash tree tests.\n\n");
+	fflush(nullptr);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -2,7 +2,7 @@
  * RVT-H Tool (libwiicrypto)                                               *
  * title_key.c: Title key management.                                      *
  *                                                                         *
- * Copyright (c) 2018-2022 by David Korth.                                 *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
@@ -13,27 +13,39 @@
 #include "sig_tools.h"
 
 // C includes
+#include <assert.h>
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 
+// Number of title keys to cache.
+#define TITLE_KEY_CACHE_ENTRIES 16
+
+typedef struct _TitleKeyCacheEntry {
+	RVL_TitleID_t title_id;		// Title ID (key)
+	uint8_t enc_title_key[16];	// Encrypted title key (key)
+	uint8_t common_key;		// Common key (key; see RVL_AES_Keys_e)
+	uint8_t valid;			// Non-zero if this entry is valid
+
+	uint8_t title_key[16];		// Decrypted title key
+	AesCtx *aesw;			// Title key context (allocated on demand)
+} TitleKeyCacheEntry;
+
+struct _TitleKeyCache {
+	AesCtx *common[RVL_KEY_MAX];	// Common key contexts (allocated on demand)
+	TitleKeyCacheEntry entries[TITLE_KEY_CACHE_ENTRIES];
+	unsigned int next;		// Next entry to replace
+};
+
 /**
- * Decrypt the title key.
- * TODO: Pass in an aesw context for less overhead.
- *
+ * Get the common key for a ticket.
  * @param ticket	[in] Ticket.
- * @param titleKey	[out] Output buffer for the title key. (Must be 16 bytes.)
+ * @param pCommonKey	[out] Common key. (See RVL_AES_Keys_e.)
  * @param crypto_type	[out] Encryption type. (See RVL_CryptoType_e.)
- * @return 0 on success; non-zero on error.
+ * @return 0 on success; negative POSIX error code on error.
  */
-int decrypt_title_key(const RVL_Ticket *ticket, uint8_t *titleKey, uint8_t *crypto_type)
+static int get_common_key(const RVL_Ticket *ticket, RVL_AES_Keys_e *pCommonKey, uint8_t *crypto_type)
 {
-	const uint8_t *commonKey;
-	uint8_t iv[16];	// based on Title ID
-
-	// TODO: Error checking.
-	// TODO: Pass in an aesw context for less overhead.
-	AesCtx *aesw;
-
 	// Check the 'from' key.
 	if (!strncmp(ticket->issuer,
 	    RVL_Cert_Issuers[RVL_CERT_ISSUER_PPKI_TICKET], sizeof(ticket->issuer)))
@@ -42,15 +54,15 @@ int decrypt_title_key(const RVL_Ticket *ticket, uint8_t *titleKey, uint8_t *cryp
 		switch (ticket->common_key_index) {
 			case 0:
 			default:
-				commonKey = RVL_AES_Keys[RVL_KEY_RETAIL];
+				*pCommonKey = RVL_KEY_RETAIL;
 				*crypto_type = RVL_CryptoType_Retail;
 				break;
 			case 1:
-				commonKey = RVL_AES_Keys[RVL_KEY_KOREAN];
+				*pCommonKey = RVL_KEY_KOREAN;
 				*crypto_type = RVL_CryptoType_Korean;
 				break;
 			case 2:
-				commonKey = RVL_AES_Keys[vWii_KEY_RETAIL];
+				*pCommonKey = vWii_KEY_RETAIL;
 				*crypto_type = RVL_CryptoType_vWii;
 				break;
 		}
@@ -62,17 +74,17 @@ int decrypt_title_key(const RVL_Ticket *ticket, uint8_t *titleKey, uint8_t *cryp
 		switch (ticket->common_key_index) {
 			case 0:
 			default:
-				commonKey = RVL_AES_Keys[RVL_KEY_DEBUG];
+				*pCommonKey = RVL_KEY_DEBUG;
 				*crypto_type = RVL_CryptoType_Debug;
 				break;
 			case 1:
 				// TODO: RVL_CryptoType_Korean_Debug?
-				commonKey = RVL_AES_Keys[RVL_KEY_KOREAN_DEBUG];
+				*pCommonKey = RVL_KEY_KOREAN_DEBUG;
 				*crypto_type = RVL_CryptoType_Korean;
 				break;
 			case 2:
 				// TODO: RVL_CryptoType_vWii_Debug?
-				commonKey = RVL_AES_Keys[vWii_KEY_DEBUG];
+				*pCommonKey = vWii_KEY_DEBUG;
 				*crypto_type = RVL_CryptoType_Debug;
 				break;
 		}
@@ -85,28 +97,209 @@ int decrypt_title_key(const RVL_Ticket *ticket, uint8_t *titleKey, uint8_t *cryp
 		return -EIO;
 	}
 
-	// Initialize the AES context.
+	return 0;
+}
+
+/**
+ * Create an AES context with the specified key.
+ * @param pKey	[in] Key. (16 bytes)
+ * @return AES context, or NULL on error.
+ */
+static AesCtx *new_keyed_aesw(const uint8_t *pKey)
+{
+	AesCtx *aesw;
+
 	errno = 0;
 	aesw = aesw_new();
 	if (!aesw) {
-		int ret = -errno;
-		if (ret == 0) {
-			ret = -EIO;
+		if (errno == 0) {
+			errno = EIO;
 		}
-		return ret;
+		return NULL;
 	}
+	aesw_set_key(aesw, pKey, 16);
+	return aesw;
+}
 
-	// IV is the 64-bit title ID, followed by zeroes.
-	memcpy(iv, &ticket->title_id, 8);
-	memset(&iv[8], 0, 8);
+/**
+ * Decrypt a Wii title key.
+ * For repeated decryption, use a TitleKeyCache.
+ *
+ * @param ticket	[in] Ticket.
+ * @param titleKey	[out] Output buffer for the title key. (Must be 16 bytes.)
+ * @param crypto_type	[out] Encryption type. (See RVL_CryptoType_e.)
+ * @return 0 on success; non-zero on error.
+ */
+int decrypt_title_key(const RVL_Ticket *ticket, uint8_t *titleKey, uint8_t *crypto_type)
+{
+	return title_key_cache_decrypt(NULL, ticket, titleKey, crypto_type, NULL);
+}
+
+/**
+ * Create a title key cache.
+ *
+ * The cache stores decrypted title keys, keyed by the ticket's title ID,
+ * encrypted title key, and common key, along with AES contexts that
+ * have the common keys and title keys already set.
+ *
+ * NOTE: The cache is not thread-safe.
+ *
+ * @return Title key cache, or NULL on error.
+ */
+TitleKeyCache *title_key_cache_new(void)
+{
+	TitleKeyCache *const cache = calloc(1, sizeof(*cache));
+	if (!cache) {
+		errno = ENOMEM;
+	}
+	return cache;
+}
 
-	// Decrypt the key with the original common key.
-	memcpy(titleKey, ticket->enc_title_key, 16);
-	aesw_set_key(aesw, commonKey, 16);
-	aesw_set_iv(aesw, iv, sizeof(iv));
-	aesw_decrypt(aesw, titleKey, 16);
+/**
+ * Free a title key cache.
+ * This also frees all AES contexts returned by the cache.
+ * @param cache Title key cache.
+ */
+void title_key_cache_free(TitleKeyCache *cache)
+{
+	unsigned int i;
 
-	// We're done here
-	aesw_free(aesw);
+	if (!cache)
+		return;
+
+	for (i = 0; i < RVL_KEY_MAX; i++) {
+		aesw_free(cache->common[i]);
+	}
+	for (i = 0; i < TITLE_KEY_CACHE_ENTRIES; i++) {
+		aesw_free(cache->entries[i].aesw);
+	}
+	free(cache);
+}
+
+/**
+ * Decrypt a Wii title key using the specified common key.
+ *
+ * If ppAesw is specified, an AES context with the title key set is
+ * returned. It's owned by the cache and is valid until the cache is
+ * freed. The IV must be set before using it.
+ *
+ * @param cache		[in] Title key cache. (If NULL, ppAesw must be NULL.)
+ * @param ticket	[in] Ticket.
+ * @param commonKey	[in] Common key. (See RVL_AES_Keys_e.)
+ * @param titleKey	[out] Output buffer for the title key. (Must be 16 bytes.)
+ * @param ppAesw	[out,opt] AES context with the title key set.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int title_key_cache_decrypt_key(TitleKeyCache *cache, const RVL_Ticket *ticket,
+	int commonKey, uint8_t *titleKey, AesCtx **ppAesw)
+{
+	TitleKeyCacheEntry *entry = NULL;
+	AesCtx *aesw_common;
+	uint8_t iv[16];	// based on Title ID
+	unsigned int i;
+
+	assert(commonKey >= 0 && commonKey < RVL_KEY_MAX);
+	assert(cache != NULL || ppAesw == NULL);
+	if (commonKey < 0 || commonKey >= RVL_KEY_MAX || (!cache && ppAesw)) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	if (cache) {
+		// Check if this title key was already decrypted.
+		for (i = 0; i < TITLE_KEY_CACHE_ENTRIES; i++) {
+			TitleKeyCacheEntry *const p = &cache->entries[i];
+			if (p->valid && p->common_key == commonKey &&
+			    !memcmp(&p->title_id, &ticket->title_id, sizeof(p->title_id)) &&
+			    !memcmp(p->enc_title_key, ticket->enc_title_key, sizeof(p->enc_title_key)))
+			{
+				entry = p;
+				break;
+			}
+		}
+	}
+
+	if (!entry) {
+		// Decrypt the title key with the common key.
+		if (cache) {
+			aesw_common = cache->common[commonKey];
+			if (!aesw_common) {
+				aesw_common = new_keyed_aesw(RVL_AES_Keys[commonKey]);
+				if (!aesw_common) {
+					return -errno;
+				}
+				cache->common[commonKey] = aesw_common;
+			}
+		} else {
+			aesw_common = new_keyed_aesw(RVL_AES_Keys[commonKey]);
+			if (!aesw_common) {
+				return -errno;
+			}
+		}
+
+		// IV is the 64-bit title ID, followed by zeroes.
+		memcpy(iv, &ticket->title_id, 8);
+		memset(&iv[8], 0, 8);
+
+		memcpy(titleKey, ticket->enc_title_key, 16);
+		aesw_set_iv(aesw_common, iv, sizeof(iv));
+		aesw_decrypt(aesw_common, titleKey, 16);
+
+		if (!cache) {
+			// Not caching anything.
+			aesw_free(aesw_common);
+			return 0;
+		}
+
+		// Replace the next cache entry.
+		entry = &cache->entries[cache->next];
+		cache->next = (cache->next + 1) % TITLE_KEY_CACHE_ENTRIES;
+		memcpy(&entry->title_id, &ticket->title_id, sizeof(entry->title_id));
+		memcpy(entry->enc_title_key, ticket->enc_title_key, sizeof(entry->enc_title_key));
+		entry->common_key = (uint8_t)commonKey;
+		memcpy(entry->title_key, titleKey, sizeof(entry->title_key));
+		entry->valid = 1;
+		if (entry->aesw) {
+			// Update the existing context with the new title key.
+			aesw_set_key(entry->aesw, entry->title_key, sizeof(entry->title_key));
+		}
+	} else {
+		memcpy(titleKey, entry->title_key, sizeof(entry->title_key));
+	}
+
+	if (ppAesw) {
+		if (!entry->aesw) {
+			entry->aesw = new_keyed_aesw(entry->title_key);
+			if (!entry->aesw) {
+				return -errno;
+			}
+		}
+		*ppAesw = entry->aesw;
+	}
 	return 0;
 }
+
+/**
+ * Decrypt a Wii title key using the common key for the ticket's issuer.
+ *
+ * If ppAesw is specified, an AES context with the title key set is
+ * returned. It's owned by the cache and is valid until the cache is
+ * freed. The IV must be set before using it.
+ *
+ * @param cache		[in] Title key cache. (If NULL, ppAesw must be NULL.)
+ * @param ticket	[in] Ticket.
+ * @param titleKey	[out] Output buffer for the title key. (Must be 16 bytes.)
+ * @param crypto_type	[out] Encryption type. (See RVL_CryptoType_e.)
+ * @param ppAesw	[out,opt] AES context with the title key set.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int title_key_cache_decrypt(TitleKeyCache *cache, const RVL_Ticket *ticket,
+	uint8_t *titleKey, uint8_t *crypto_type, AesCtx **ppAesw)
+{
+	RVL_AES_Keys_e commonKey;
+	const int ret = get_common_key(ticket, &commonKey, crypto_type);
+	if (ret != 0) {
+		return ret;
+	}
+	return title_key_cache_decrypt_key(cache, ticket, commonKey, titleKey, ppAesw);
+}
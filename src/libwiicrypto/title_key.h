@@ -2,7 +2,7 @@
  * RVT-H Tool (libwiicrypto)                                               *
  * title_key.h: Title key management.                                      *
  *                                                                         *
- * Copyright (c) 2018-2022 by David Korth.                                 *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
@@ -10,14 +10,18 @@
 #define __RVTHTOOL_LIBWIICRYPTO_TITLE_KEY_H__
 
 #include "wii_structs.h"
+#include "aesw.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+struct _TitleKeyCache;
+typedef struct _TitleKeyCache TitleKeyCache;
+
 /**
  * Decrypt a Wii title key.
- * TODO: Pass in an aesw context for less overhead.
+ * For repeated decryption, use a TitleKeyCache.
  *
  * @param ticket	[in] Ticket.
  * @param titleKey	[out] Output buffer for the title key. (Must be 16 bytes.)
@@ -26,6 +30,60 @@ extern "C" {
  */
 int decrypt_title_key(const RVL_Ticket *ticket, uint8_t *titleKey, uint8_t *crypto_type);
 
+/**
+ * Create a title key cache.
+ *
+ * The cache stores decrypted title keys, keyed by the ticket's title ID,
+ * encrypted title key, and common key, along with AES contexts that
+ * have the common keys and title keys already set.
+ *
+ * NOTE: The cache is not thread-safe.
+ *
+ * @return Title key cache, or NULL on error.
+ */
+TitleKeyCache *title_key_cache_new(void);
+
+/**
+ * Free a title key cache.
+ * This also frees all AES contexts returned by the cache.
+ * @param cache Title key cache.
+ */
+void title_key_cache_free(TitleKeyCache *cache);
+
+/**
+ * Decrypt a Wii title key using the specified common key.
+ *
+ * If ppAesw is specified, an AES context with the title key set is
+ * returned. It's owned by the cache and is valid until the cache is
+ * freed. The IV must be set before using it.
+ *
+ * @param cache		[in] Title key cache. (If NULL, ppAesw must be NULL.)
+ * @param ticket	[in] Ticket.
+ * @param commonKey	[in] Common key. (See RVL_AES_Keys_e.)
+ * @param titleKey	[out] Output buffer for the title key. (Must be 16 bytes.)
+ * @param ppAesw	[out,opt] AES context with the title key set.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int title_key_cache_decrypt_key(TitleKeyCache *cache, const RVL_Ticket *ticket,
+	int commonKey, uint8_t *titleKey, AesCtx **ppAesw);
+
+/**
+ * Decrypt a Wii title key using the common key for the ticket's issuer.
+ *
+ * If ppAesw is specified, an AES context with the title key set is
+ * returned. It's owned by the cache and is valid until the cache is
+ * freed. The IV must be set before using it.
+ *
+ * @param cache		[in] Title key cache. (If NULL, ppAesw must be NULL.)
+ * @param ticket	[in] Ticket.
+ * @param titleKey	[out] Output buffer for the title key. (Must be 16 bytes.)
+ * @param crypto_type	[out] Encryption type. (See RVL_CryptoType_e.)
+ * @param ppAesw	[out,opt] AES context with the title key set.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int title_key_cache_decrypt(TitleKeyCache *cache, const RVL_Ticket *ticket,
+	uint8_t *titleKey, uint8_t *crypto_type, AesCtx **ppAesw);
+
 #ifdef __cplusplus
 }
 #endif
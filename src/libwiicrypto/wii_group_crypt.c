@@ -0,0 +1,226 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * wii_group_crypt.c: Wii disc group encryption and decryption.            *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "wii_group_crypt.h"
+#include "wii_hash_tree.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#define SECTORS_PER_GROUP WII_HASH_TREE_SECTORS_PER_GROUP
+
+/**
+ * Encrypt or decrypt the hash tables of a group. (IV == 0)
+ * @param aesw		[in] AES context.
+ * @param pGroup	[in/out] Group.
+ * @param encrypt	[in] True to encrypt; false to decrypt.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int crypt_hashes(AesCtx *aesw, Wii_Disc_Group_t *pGroup, int encrypt)
+{
+	static const uint8_t zero_iv[16] = {0};
+	const uint8_t *pIV[SECTORS_PER_GROUP];
+	uint8_t *pData[SECTORS_PER_GROUP];
+	unsigned int i;
+	size_t ret;
+
+	for (i = 0; i < SECTORS_PER_GROUP; i++) {
+		pIV[i] = zero_iv;
+		pData[i] = (uint8_t*)&pGroup->sectors[i].hashes;
+	}
+	if (encrypt) {
+		ret = aesw_encrypt_multi(aesw, pIV, pData, sizeof(pGroup->sectors[0].hashes), SECTORS_PER_GROUP);
+	} else {
+		ret = aesw_decrypt_multi(aesw, pIV, pData, sizeof(pGroup->sectors[0].hashes), SECTORS_PER_GROUP);
+	}
+	return (ret != 0 ? 0 : -EIO);
+}
+
+/**
+ * Encrypt groups of Wii sectors.
+ * The hash tree of each group is built from its user data,
+ * then the hashes and user data are encrypted.
+ * @param aesw		[in] AES context. (title key must be set)
+ * @param pIn		[in] Decrypted groups. (count entries)
+ * @param pOut		[out] Encrypted groups. (count entries; must not overlap pIn)
+ * @param count		[in] Number of groups.
+ * @param pH3		[out,opt] H3 hash of each group. (count entries)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int wii_group_encrypt(AesCtx *aesw, const Wii_Disc_Group_Dec_t *pIn,
+	Wii_Disc_Group_t *pOut, unsigned int count,
+	uint8_t pH3[][RVL_SHA1_DIGEST_SIZE])
+{
+	unsigned int g, i;
+	uint8_t H3[RVL_SHA1_DIGEST_SIZE];
+
+	assert(aesw != NULL);
+	assert(pIn != NULL);
+	assert(pOut != NULL);
+	if (!aesw || !pIn || !pOut) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	for (g = 0; g < count; g++) {
+		Wii_Disc_Group_t *const pGroup = &pOut[g];
+
+		// Copy the user data.
+		for (i = 0; i < SECTORS_PER_GROUP; i++) {
+			memcpy(pGroup->sectors[i].data, pIn[g].data[i], SECTOR_SIZE_DEC);
+		}
+
+		// Calculate the H0, H1, H2, and H3 hashes.
+		wii_hash_tree_build_group(pGroup->sectors, (pH3 ? pH3[g] : H3));
+	}
+
+	return wii_group_encrypt_in_place(aesw, pOut, count);
+}
+
+/**
+ * Encrypt groups of Wii sectors in place.
+ * The hash tree of each group must already be present.
+ * (See wii_hash_tree_build_group().)
+ * @param aesw		[in] AES context. (title key must be set)
+ * @param pGroups	[in/out] Groups to encrypt. (count entries)
+ * @param count		[in] Number of groups.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int wii_group_encrypt_in_place(AesCtx *aesw, Wii_Disc_Group_t *pGroups, unsigned int count)
+{
+	const uint8_t *pIV[SECTORS_PER_GROUP];
+	uint8_t *pData[SECTORS_PER_GROUP];
+	unsigned int g, i;
+
+	assert(aesw != NULL);
+	assert(pGroups != NULL);
+	if (!aesw || !pGroups) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	for (g = 0; g < count; g++) {
+		Wii_Disc_Sector_t *const sbuf = pGroups[g].sectors;
+		int ret;
+
+		// Encrypt the hashes first, since the user data IV
+		// is stored within the encrypted H2 table.
+		ret = crypt_hashes(aesw, &pGroups[g], 1);
+		if (ret != 0) {
+			errno = -ret;
+			return ret;
+		}
+
+		// Encrypt the user data.
+		for (i = 0; i < SECTORS_PER_GROUP; i++) {
+			pIV[i] = &sbuf[i].hashes.H2[7][4];
+			pData[i] = sbuf[i].data;
+		}
+		if (aesw_encrypt_multi(aesw, pIV, pData, sizeof(sbuf[0].data), SECTORS_PER_GROUP) == 0) {
+			errno = EIO;
+			return -EIO;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Decrypt the user data of groups of Wii sectors.
+ * The hashes are discarded.
+ * @param aesw		[in] AES context. (title key must be set)
+ * @param pIn		[in] Encrypted groups. (count entries)
+ * @param pOut		[out] Decrypted groups. (count entries; must not overlap pIn)
+ * @param count		[in] Number of groups.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int wii_group_decrypt(AesCtx *aesw, const Wii_Disc_Group_t *pIn,
+	Wii_Disc_Group_Dec_t *pOut, unsigned int count)
+{
+	const uint8_t *pIV[SECTORS_PER_GROUP];
+	uint8_t *pData[SECTORS_PER_GROUP];
+	unsigned int g, i;
+
+	assert(aesw != NULL);
+	assert(pIn != NULL);
+	assert(pOut != NULL);
+	if (!aesw || !pIn || !pOut) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	for (g = 0; g < count; g++) {
+		const Wii_Disc_Sector_t *const sbuf = pIn[g].sectors;
+
+		// Copy the encrypted user data.
+		for (i = 0; i < SECTORS_PER_GROUP; i++) {
+			memcpy(pOut[g].data[i], sbuf[i].data, SECTOR_SIZE_DEC);
+		}
+
+		// Decrypt the user data.
+		// User data IV is stored within the encrypted H2 table.
+		for (i = 0; i < SECTORS_PER_GROUP; i++) {
+			pIV[i] = &sbuf[i].hashes.H2[7][4];
+			pData[i] = pOut[g].data[i];
+		}
+		if (aesw_decrypt_multi(aesw, pIV, pData, SECTOR_SIZE_DEC, SECTORS_PER_GROUP) == 0) {
+			errno = EIO;
+			return -EIO;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Decrypt groups of Wii sectors in place, including the hashes.
+ * @param aesw		[in] AES context. (title key must be set)
+ * @param pGroups	[in/out] Groups to decrypt. (count entries)
+ * @param count		[in] Number of groups.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int wii_group_decrypt_in_place(AesCtx *aesw, Wii_Disc_Group_t *pGroups, unsigned int count)
+{
+	const uint8_t *pIV[SECTORS_PER_GROUP];
+	uint8_t *pData[SECTORS_PER_GROUP];
+	unsigned int g, i;
+
+	assert(aesw != NULL);
+	assert(pGroups != NULL);
+	if (!aesw || !pGroups) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	for (g = 0; g < count; g++) {
+		Wii_Disc_Sector_t *const sbuf = pGroups[g].sectors;
+		int ret;
+
+		// Decrypt the user data first, since the user data IV
+		// is stored within the encrypted H2 table.
+		for (i = 0; i < SECTORS_PER_GROUP; i++) {
+			pIV[i] = &sbuf[i].hashes.H2[7][4];
+			pData[i] = sbuf[i].data;
+		}
+		if (aesw_decrypt_multi(aesw, pIV, pData, sizeof(sbuf[0].data), SECTORS_PER_GROUP) == 0) {
+			errno = EIO;
+			return -EIO;
+		}
+
+		// Decrypt the hashes.
+		ret = crypt_hashes(aesw, &pGroups[g], 0);
+		if (ret != 0) {
+			errno = -ret;
+			return ret;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,84 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * wii_group_crypt.h: Wii disc group encryption and decryption.            *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBWIICRYPTO_WII_GROUP_CRYPT_H__
+#define __RVTHTOOL_LIBWIICRYPTO_WII_GROUP_CRYPT_H__
+
+#include "wii_sector.h"
+#include "aesw.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * NOTE: These functions process one or more complete 2 MB groups.
+ * The 64 sectors of each group are encrypted or decrypted in one batch
+ * using aesw_encrypt_multi() or aesw_decrypt_multi(), so the AES
+ * pipeline is kept full if hardware acceleration is available.
+ *
+ * The functions don't have any shared state, so groups can be
+ * processed on multiple threads as long as each thread has its
+ * own AES context.
+ *
+ * Zeroed groups, e.g. in scrubbed images, aren't handled specially.
+ * Check for them before decrypting if they should be kept as zeroes.
+ */
+
+/**
+ * Encrypt groups of Wii sectors.
+ * The hash tree of each group is built from its user data,
+ * then the hashes and user data are encrypted.
+ * @param aesw		[in] AES context. (title key must be set)
+ * @param pIn		[in] Decrypted groups. (count entries)
+ * @param pOut		[out] Encrypted groups. (count entries; must not overlap pIn)
+ * @param count		[in] Number of groups.
+ * @param pH3		[out,opt] H3 hash of each group. (count entries)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int wii_group_encrypt(AesCtx *aesw, const Wii_Disc_Group_Dec_t *pIn,
+	Wii_Disc_Group_t *pOut, unsigned int count,
+	uint8_t pH3[][RVL_SHA1_DIGEST_SIZE]);
+
+/**
+ * Encrypt groups of Wii sectors in place.
+ * The hash tree of each group must already be present.
+ * (See wii_hash_tree_build_group().)
+ * @param aesw		[in] AES context. (title key must be set)
+ * @param pGroups	[in/out] Groups to encrypt. (count entries)
+ * @param count		[in] Number of groups.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int wii_group_encrypt_in_place(AesCtx *aesw, Wii_Disc_Group_t *pGroups, unsigned int count);
+
+/**
+ * Decrypt the user data of groups of Wii sectors.
+ * The hashes are discarded.
+ * @param aesw		[in] AES context. (title key must be set)
+ * @param pIn		[in] Encrypted groups. (count entries)
+ * @param pOut		[out] Decrypted groups. (count entries; must not overlap pIn)
+ * @param count		[in] Number of groups.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int wii_group_decrypt(AesCtx *aesw, const Wii_Disc_Group_t *pIn,
+	Wii_Disc_Group_Dec_t *pOut, unsigned int count);
+
+/**
+ * Decrypt groups of Wii sectors in place, including the hashes.
+ * @param aesw		[in] AES context. (title key must be set)
+ * @param pGroups	[in/out] Groups to decrypt. (count entries)
+ * @param count		[in] Number of groups.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int wii_group_decrypt_in_place(AesCtx *aesw, Wii_Disc_Group_t *pGroups, unsigned int count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_LIBWIICRYPTO_WII_GROUP_CRYPT_H__ */
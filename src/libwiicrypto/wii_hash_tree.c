@@ -0,0 +1,332 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * wii_hash_tree.c: Wii disc hash tree functions.                          *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "wii_hash_tree.h"
+#include "sha1w.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+// Precomputed hashes for all-zero data.
+// Scrubbed and trimmed images have large areas of zeroed user data,
+// so these are used instead of hashing the zeroes every time.
+
+// SHA-1 of 1,024 zero bytes. (H0 hash of a zeroed kilobyte)
+static const uint8_t zero_H0[RVL_SHA1_DIGEST_SIZE] = {
+	0x60,0xCA,0xCB,0xF3,0xD7,0x2E,0x1E,0x78,0x34,0x20,
+	0x3D,0xA6,0x08,0x03,0x7B,0x1B,0xF8,0x3B,0x40,0xE8
+};
+
+// SHA-1 of an H0 table of zero_H0. (H1 hash of a zeroed sector)
+static const uint8_t zero_H1[RVL_SHA1_DIGEST_SIZE] = {
+	0x26,0x94,0x62,0xC3,0xC0,0x85,0xAD,0x49,0x3D,0x26,
+	0xCA,0x70,0xA0,0x0C,0xB7,0x26,0x8C,0x7B,0xA0,0x4C
+};
+
+// SHA-1 of an H1 table of zero_H1. (H2 hash of a zeroed subgroup)
+static const uint8_t zero_H2[RVL_SHA1_DIGEST_SIZE] = {
+	0x9E,0x69,0xB0,0xAC,0x67,0x72,0x95,0xA0,0xB4,0x57,
+	0x14,0xDD,0x84,0xD5,0xFD,0x4D,0x24,0x63,0x93,0x66
+};
+
+// SHA-1 of an H2 table of zero_H2. (H3 hash of a zeroed group)
+static const uint8_t zero_H3[RVL_SHA1_DIGEST_SIZE] = {
+	0xBC,0x0D,0x5A,0x47,0x31,0x54,0x06,0x4E,0x3B,0x33,
+	0x0D,0xC1,0xA5,0x26,0x5D,0x8A,0x67,0x70,0x58,0xBB
+};
+
+/**
+ * Check if a block of memory is all zeroes.
+ * Non-zero data usually exits on the first few bytes.
+ * @param pData	[in] Data.
+ * @param size	[in] Size, in bytes. (must be a multiple of 64)
+ * @return Non-zero if the block is all zeroes; 0 if not.
+ */
+static inline int is_zero_block(const uint8_t *pData, size_t size)
+{
+	assert(size % 64 == 0);
+	for (; size > 0; pData += 64, size -= 64) {
+		uint64_t q[8];
+		memcpy(q, pData, sizeof(q));
+		if ((q[0] | q[1] | q[2] | q[3] | q[4] | q[5] | q[6] | q[7]) != 0)
+			return 0;
+	}
+	return 1;
+}
+
+/**
+ * Check if all entries in a hash table are the same hash.
+ * @param pTable	[in] Hash table.
+ * @param count		[in] Number of entries.
+ * @param pHash		[in] Hash to check for.
+ * @return Non-zero if all entries match; 0 if not.
+ */
+static inline int is_hash_table_filled(const uint8_t pTable[][RVL_SHA1_DIGEST_SIZE],
+	unsigned int count, const uint8_t pHash[RVL_SHA1_DIGEST_SIZE])
+{
+	unsigned int i;
+	for (i = 0; i < count; i++) {
+		if (memcmp(pTable[i], pHash, RVL_SHA1_DIGEST_SIZE) != 0)
+			return 0;
+	}
+	return 1;
+}
+
+/**
+ * Hash multiple equal-sized buffers located at a fixed stride.
+ * Buffers marked as zero aren't hashed; zero_hash is used instead.
+ * Runs of non-zero buffers are hashed together.
+ * @param pData		[in] First buffer.
+ * @param size		[in] Size of each buffer, in bytes.
+ * @param stride	[in] Distance between the start of each buffer, in bytes.
+ * @param count		[in] Number of buffers.
+ * @param is_zero	[in] Zero map. (count entries)
+ * @param zero_hash	[in] Hash of a zero buffer.
+ * @param pDigests	[out] Digests. (count entries)
+ */
+static void hash_strided_zero(const uint8_t *pData, size_t size, size_t stride,
+	unsigned int count, const uint8_t *is_zero,
+	const uint8_t zero_hash[RVL_SHA1_DIGEST_SIZE],
+	uint8_t pDigests[][RVL_SHA1_DIGEST_SIZE])
+{
+	unsigned int i = 0;
+	while (i < count) {
+		unsigned int j;
+		if (is_zero[i]) {
+			memcpy(pDigests[i], zero_hash, RVL_SHA1_DIGEST_SIZE);
+			i++;
+			continue;
+		}
+
+		// Find the end of this run of non-zero buffers.
+		for (j = i + 1; j < count && !is_zero[j]; j++) { }
+		sha1w_hash_strided(pData + (i * stride), size, stride, j - i, pDigests[i]);
+		i = j;
+	}
+}
+
+/**
+ * Calculate the H0 hashes for a sector's user data.
+ * @param pSector	[in] Decrypted sector.
+ * @param pH0		[out] H0 hashes. (31 entries)
+ */
+void wii_hash_tree_calc_H0(const Wii_Disc_Sector_t *pSector,
+	uint8_t pH0[31][RVL_SHA1_DIGEST_SIZE])
+{
+	// One hash for each kilobyte of user data.
+	uint8_t is_zero[31];
+	unsigned int kb;
+	for (kb = 0; kb < 31; kb++) {
+		is_zero[kb] = is_zero_block(&pSector->data[kb * 1024], 1024);
+	}
+	hash_strided_zero(pSector->data, 1024, 1024, 31, is_zero, zero_H0, pH0);
+}
+
+// Number of sectors processed in lockstep by wii_hash_tree_decrypt_calc_H0().
+#define DECRYPT_H0_STREAMS 8
+
+/**
+ * Decrypt the user data of a set of encrypted sectors and calculate
+ * their H0 hashes.
+ *
+ * Each kilobyte is hashed immediately after it's decrypted, while
+ * it's still in the L1 cache, instead of decrypting all of the user
+ * data first and then reading it again to hash it. Up to eight sectors
+ * are processed in lockstep.
+ *
+ * The user data IV is taken from each sector's encrypted H2 table,
+ * so this must be called *before* decrypting the hashes.
+ *
+ * @param aesw		[in] AES context. (title key must be set)
+ * @param pSectors	[in/out] Encrypted sectors. User data is decrypted on return.
+ * @param count		[in] Number of sectors.
+ * @param pH0		[out] H0 hashes. (count entries)
+ */
+void wii_hash_tree_decrypt_calc_H0(AesCtx *aesw,
+	Wii_Disc_Sector_t *pSectors, unsigned int count,
+	uint8_t pH0[][31][RVL_SHA1_DIGEST_SIZE])
+{
+	// CBC IVs for each stream.
+	// The IV for the next kilobyte is the last ciphertext block of
+	// the current kilobyte, which is overwritten when decrypting
+	// in place, so the IVs are double-buffered.
+	uint8_t iv[2][DECRYPT_H0_STREAMS][16];
+	const uint8_t *pIV[DECRYPT_H0_STREAMS];
+	uint8_t *pData[DECRYPT_H0_STREAMS];
+
+	// Non-zero kilobytes to hash.
+	const uint8_t *pHash[DECRYPT_H0_STREAMS];
+	unsigned int hash_idx[DECRYPT_H0_STREAMS];
+	uint8_t digests[DECRYPT_H0_STREAMS][RVL_SHA1_DIGEST_SIZE];
+
+	while (count > 0) {
+		const unsigned int n = (count < DECRYPT_H0_STREAMS ? count : DECRYPT_H0_STREAMS);
+		unsigned int i, kb;
+
+		// Initial IV is stored within the encrypted H2 table.
+		for (i = 0; i < n; i++) {
+			memcpy(iv[0][i], &pSectors[i].hashes.H2[7][4], 16);
+		}
+
+		for (kb = 0; kb < 31; kb++) {
+			const unsigned int cur = (kb & 1);
+			unsigned int hash_count = 0;
+
+			for (i = 0; i < n; i++) {
+				pIV[i] = iv[cur][i];
+				pData[i] = &pSectors[i].data[kb * 1024];
+				memcpy(iv[!cur][i], pData[i] + 1024 - 16, 16);
+			}
+			aesw_decrypt_multi(aesw, pIV, pData, 1024, n);
+
+			// Hash the kilobytes while they're still in cache.
+			for (i = 0; i < n; i++) {
+				if (is_zero_block(pData[i], 1024)) {
+					memcpy(pH0[i][kb], zero_H0, RVL_SHA1_DIGEST_SIZE);
+				} else {
+					pHash[hash_count] = pData[i];
+					hash_idx[hash_count] = i;
+					hash_count++;
+				}
+			}
+			if (hash_count > 0) {
+				sha1w_hash_multi(pHash, 1024, hash_count, digests[0]);
+				for (i = 0; i < hash_count; i++) {
+					memcpy(pH0[hash_idx[i]][kb], digests[i], RVL_SHA1_DIGEST_SIZE);
+				}
+			}
+		}
+
+		pSectors += n;
+		pH0 += n;
+		count -= n;
+	}
+}
+
+/**
+ * Calculate the H1 hashes for a set of sectors.
+ * Each H1 hash is the hash of a sector's H0 table.
+ * @param pSectors	[in] Decrypted sectors.
+ * @param count		[in] Number of sectors.
+ * @param pH1		[out] H1 hashes. (count entries)
+ */
+void wii_hash_tree_calc_H1(const Wii_Disc_Sector_t *pSectors, unsigned int count,
+	uint8_t pH1[][RVL_SHA1_DIGEST_SIZE])
+{
+	// Process up to one group of sectors at a time.
+	uint8_t is_zero[WII_HASH_TREE_SECTORS_PER_GROUP];
+	while (count > 0) {
+		const unsigned int n = (count < WII_HASH_TREE_SECTORS_PER_GROUP
+			? count : WII_HASH_TREE_SECTORS_PER_GROUP);
+		unsigned int i;
+
+		for (i = 0; i < n; i++) {
+			is_zero[i] = is_hash_table_filled(pSectors[i].hashes.H0, 31, zero_H0);
+		}
+		hash_strided_zero(pSectors[0].hashes.H0[0], sizeof(pSectors[0].hashes.H0),
+			sizeof(Wii_Disc_Sector_t), n, is_zero, zero_H1, pH1);
+
+		pSectors += n;
+		pH1 += n;
+		count -= n;
+	}
+}
+
+/**
+ * Calculate the H2 hashes for a set of subgroups.
+ * Each H2 hash is the hash of the H1 table in the subgroup's first sector.
+ * @param pSectors	[in] Decrypted sectors. (first sector of the first subgroup)
+ * @param subgroups	[in] Number of subgroups.
+ * @param pH2		[out] H2 hashes. (subgroups entries)
+ */
+void wii_hash_tree_calc_H2(const Wii_Disc_Sector_t *pSectors, unsigned int subgroups,
+	uint8_t pH2[][RVL_SHA1_DIGEST_SIZE])
+{
+	// Process up to one group of subgroups at a time.
+	uint8_t is_zero[8];
+	while (subgroups > 0) {
+		const unsigned int n = (subgroups < 8 ? subgroups : 8);
+		unsigned int i;
+
+		for (i = 0; i < n; i++) {
+			is_zero[i] = is_hash_table_filled(pSectors[i * 8].hashes.H1, 8, zero_H1);
+		}
+		hash_strided_zero(pSectors[0].hashes.H1[0], sizeof(pSectors[0].hashes.H1),
+			8 * sizeof(Wii_Disc_Sector_t), n, is_zero, zero_H2, pH2);
+
+		pSectors += n * 8;
+		pH2 += n;
+		subgroups -= n;
+	}
+}
+
+/**
+ * Calculate the H3 hash for a group.
+ * This is the hash of the H2 table in the group's first sector.
+ * @param pSector0	[in] First decrypted sector in the group.
+ * @param pH3		[out] H3 hash.
+ */
+void wii_hash_tree_calc_H3(const Wii_Disc_Sector_t *pSector0,
+	uint8_t pH3[RVL_SHA1_DIGEST_SIZE])
+{
+	if (is_hash_table_filled(pSector0->hashes.H2, 8, zero_H2)) {
+		// Zeroed group.
+		memcpy(pH3, zero_H3, RVL_SHA1_DIGEST_SIZE);
+		return;
+	}
+	sha1w_hash(pSector0->hashes.H2[0], sizeof(pSector0->hashes.H2), pH3);
+}
+
+/**
+ * Build the hash tree for a full group of 64 decrypted sectors.
+ * The user data must already be present. All hash tables and
+ * padding are written into the sectors' hash areas.
+ * @param pSectors	[in/out] Decrypted sectors. (64 sectors)
+ * @param pH3		[out] H3 hash for this group.
+ */
+void wii_hash_tree_build_group(Wii_Disc_Sector_t *pSectors,
+	uint8_t pH3[RVL_SHA1_DIGEST_SIZE])
+{
+	unsigned int i, j;
+
+	assert(pSectors != NULL);
+	assert(pH3 != NULL);
+
+	// Calculate the H0 hashes.
+	for (i = 0; i < WII_HASH_TREE_SECTORS_PER_GROUP; i++) {
+		wii_hash_tree_calc_H0(&pSectors[i], pSectors[i].hashes.H0);
+		memset(pSectors[i].hashes.pad_H0, 0, sizeof(pSectors[i].hashes.pad_H0));
+	}
+
+	// Calculate the H1 hashes for each subgroup of 8 sectors.
+	// The results are stored in the first sector's H1 table,
+	// then copied to the other sectors in the subgroup.
+	for (i = 0; i < WII_HASH_TREE_SECTORS_PER_GROUP; i += 8) {
+		Wii_Disc_Sector_t *const pSector0 = &pSectors[i];
+		wii_hash_tree_calc_H1(pSector0, 8, pSector0->hashes.H1);
+		memset(pSector0->hashes.pad_H1, 0, sizeof(pSector0->hashes.pad_H1));
+
+		for (j = i+1; j < i+8; j++) {
+			memcpy(pSectors[j].hashes.H1, pSector0->hashes.H1, sizeof(pSectors[j].hashes.H1));
+			memset(pSectors[j].hashes.pad_H1, 0, sizeof(pSectors[j].hashes.pad_H1));
+		}
+	}
+
+	// Calculate the H2 hashes for the subgroups.
+	// NOTE: All sectors in this group have the same H2 hashes.
+	wii_hash_tree_calc_H2(pSectors, 8, pSectors[0].hashes.H2);
+	memset(pSectors[0].hashes.pad_H2, 0, sizeof(pSectors[0].hashes.pad_H2));
+	for (i = 1; i < WII_HASH_TREE_SECTORS_PER_GROUP; i++) {
+		memcpy(pSectors[i].hashes.H2, pSectors[0].hashes.H2, sizeof(pSectors[i].hashes.H2));
+		memset(pSectors[i].hashes.pad_H2, 0, sizeof(pSectors[i].hashes.pad_H2));
+	}
+
+	// Calculate the H3 hash.
+	wii_hash_tree_calc_H3(&pSectors[0], pH3);
+}
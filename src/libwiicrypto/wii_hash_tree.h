@@ -0,0 +1,94 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * wii_hash_tree.h: Wii disc hash tree functions.                          *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBWIICRYPTO_WII_HASH_TREE_H__
+#define __RVTHTOOL_LIBWIICRYPTO_WII_HASH_TREE_H__
+
+#include "wii_sector.h"
+#include "aesw.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Number of sectors in a group.
+#define WII_HASH_TREE_SECTORS_PER_GROUP 64
+
+/**
+ * Calculate the H0 hashes for a sector's user data.
+ * @param pSector	[in] Decrypted sector.
+ * @param pH0		[out] H0 hashes. (31 entries)
+ */
+void wii_hash_tree_calc_H0(const Wii_Disc_Sector_t *pSector,
+	uint8_t pH0[31][RVL_SHA1_DIGEST_SIZE]);
+
+/**
+ * Decrypt the user data of a set of encrypted sectors and calculate
+ * their H0 hashes.
+ *
+ * Each kilobyte is hashed immediately after it's decrypted, while
+ * it's still in the L1 cache, instead of decrypting all of the user
+ * data first and then reading it again to hash it. Up to eight sectors
+ * are processed in lockstep.
+ *
+ * The user data IV is taken from each sector's encrypted H2 table,
+ * so this must be called *before* decrypting the hashes.
+ *
+ * @param aesw		[in] AES context. (title key must be set)
+ * @param pSectors	[in/out] Encrypted sectors. User data is decrypted on return.
+ * @param count		[in] Number of sectors.
+ * @param pH0		[out] H0 hashes. (count entries)
+ */
+void wii_hash_tree_decrypt_calc_H0(AesCtx *aesw,
+	Wii_Disc_Sector_t *pSectors, unsigned int count,
+	uint8_t pH0[][31][RVL_SHA1_DIGEST_SIZE]);
+
+/**
+ * Calculate the H1 hashes for a set of sectors.
+ * Each H1 hash is the hash of a sector's H0 table.
+ * @param pSectors	[in] Decrypted sectors.
+ * @param count		[in] Number of sectors.
+ * @param pH1		[out] H1 hashes. (count entries)
+ */
+void wii_hash_tree_calc_H1(const Wii_Disc_Sector_t *pSectors, unsigned int count,
+	uint8_t pH1[][RVL_SHA1_DIGEST_SIZE]);
+
+/**
+ * Calculate the H2 hashes for a set of subgroups.
+ * Each H2 hash is the hash of the H1 table in the subgroup's first sector.
+ * @param pSectors	[in] Decrypted sectors. (first sector of the first subgroup)
+ * @param subgroups	[in] Number of subgroups.
+ * @param pH2		[out] H2 hashes. (subgroups entries)
+ */
+void wii_hash_tree_calc_H2(const Wii_Disc_Sector_t *pSectors, unsigned int subgroups,
+	uint8_t pH2[][RVL_SHA1_DIGEST_SIZE]);
+
+/**
+ * Calculate the H3 hash for a group.
+ * This is the hash of the H2 table in the group's first sector.
+ * @param pSector0	[in] First decrypted sector in the group.
+ * @param pH3		[out] H3 hash.
+ */
+void wii_hash_tree_calc_H3(const Wii_Disc_Sector_t *pSector0,
+	uint8_t pH3[RVL_SHA1_DIGEST_SIZE]);
+
+/**
+ * Build the hash tree for a full group of 64 decrypted sectors.
+ * The user data must already be present. All hash tables and
+ * padding are written into the sectors' hash areas.
+ * @param pSectors	[in/out] Decrypted sectors. (64 sectors)
+ * @param pH3		[out] H3 hash for this group.
+ */
+void wii_hash_tree_build_group(Wii_Disc_Sector_t *pSectors,
+	uint8_t pH3[RVL_SHA1_DIGEST_SIZE]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_LIBWIICRYPTO_WII_HASH_TREE_H__ */
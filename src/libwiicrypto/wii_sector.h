@@ -82,4 +82,21 @@ typedef struct _Wii_Disc_Sector_t {
 } Wii_Disc_Sector_t;
 ASSERT_STRUCT(Wii_Disc_Sector_t, 32*1024);
 
+// Encrypted Wii disc group.
+// This is how a group is stored in an encrypted partition.
+// Each sector is encrypted independently, and the H2 table
+// is the same in all 64 sectors.
+typedef struct _Wii_Disc_Group_t {
+	Wii_Disc_Sector_t sectors[64];
+} Wii_Disc_Group_t;
+ASSERT_STRUCT(Wii_Disc_Group_t, GROUP_SIZE_ENC);
+
+// Decrypted Wii disc group. (user data only)
+// This is how a group is stored in an unencrypted RVT-R image:
+// the user data of each sector, without the hashes.
+typedef struct _Wii_Disc_Group_Dec_t {
+	uint8_t data[64][SECTOR_SIZE_DEC];
+} Wii_Disc_Group_Dec_t;
+ASSERT_STRUCT(Wii_Disc_Group_Dec_t, GROUP_SIZE_DEC);
+
 #endif /* __RVTHTOOL_LIBWIICRYPTO_WII_SECTOR_H__ */
@@ -0,0 +1,200 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * wiiu_hash_tree.c: Wii U hashed content functions.                       *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "wiiu_hash_tree.h"
+#include "sha1w.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+
+// Number of blocks processed at once.
+// This is also the number of blocks in a superblock, so each batch
+// has at most one block that starts an H1, H2, or H3 table.
+#define BATCH_BLOCKS 16
+
+/**
+ * Decrypt a set of consecutive hashed content blocks.
+ *
+ * The hash areas are decrypted first, since the data IVs are taken
+ * from the decrypted H0 tables. Up to 16 blocks are processed in
+ * lockstep if hardware acceleration is available.
+ *
+ * @param aesw		[in] AES context. (title key must be set)
+ * @param pBlocks	[in/out] Encrypted blocks. Decrypted on return.
+ * @param block_number	[in] Block number of the first block.
+ * @param count		[in] Number of blocks.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int wiiu_hash_tree_decrypt_blocks(AesCtx *aesw, WiiU_Hash_Block_t *pBlocks,
+	uint32_t block_number, unsigned int count)
+{
+	static const uint8_t zero_iv[16] = {0};
+	const uint8_t *pIV[BATCH_BLOCKS];
+	uint8_t *pData[BATCH_BLOCKS];
+
+	assert(aesw != NULL);
+	assert(pBlocks != NULL || count == 0);
+
+	while (count > 0) {
+		const unsigned int n = (count < BATCH_BLOCKS ? count : BATCH_BLOCKS);
+		unsigned int i;
+
+		// Decrypt the hash areas. (zero IV)
+		for (i = 0; i < n; i++) {
+			pIV[i] = zero_iv;
+			pData[i] = (uint8_t*)&pBlocks[i].hashes;
+		}
+		if (aesw_decrypt_multi(aesw, pIV, pData, sizeof(pBlocks[0].hashes), n) == 0) {
+			return -EIO;
+		}
+
+		// Decrypt the data areas.
+		// The IV is the block's H0 hash.
+		for (i = 0; i < n; i++) {
+			pIV[i] = pBlocks[i].hashes.H0[(block_number + i) % 16];
+			pData[i] = pBlocks[i].data;
+		}
+		if (aesw_decrypt_multi(aesw, pIV, pData, sizeof(pBlocks[0].data), n) == 0) {
+			return -EIO;
+		}
+
+		pBlocks += n;
+		block_number += n;
+		count -= n;
+	}
+
+	return 0;
+}
+
+/**
+ * Record a bad hash.
+ * @param pErrors	[in/out] Errors.
+ * @param level		[in] Hash level. (0-3)
+ * @param index		[in] Index within the level.
+ */
+static void add_bad_hash(WiiU_Hash_Tree_Errors_t *pErrors, unsigned int level, uint32_t index)
+{
+	const unsigned int range_count = pErrors->range_count[level];
+
+	pErrors->bad_count[level]++;
+	if (range_count > 0) {
+		WiiU_Hash_Bad_Range_t *const range = &pErrors->ranges[level][range_count - 1];
+		if (range->last + 1 == index) {
+			// Extend the current range.
+			range->last = index;
+			return;
+		}
+	}
+	if (range_count < WIIU_HASH_TREE_MAX_BAD_RANGES) {
+		// Start a new range.
+		pErrors->ranges[level][range_count].first = index;
+		pErrors->ranges[level][range_count].last = index;
+		pErrors->range_count[level]++;
+	}
+}
+
+/**
+ * Verify the hash tree for a set of consecutive decrypted blocks.
+ *
+ * The H0 hash of every block is checked. The H1, H2, and H3 hashes
+ * are checked in the first block of each superblock, hyperblock, and
+ * H3 group, respectively. Hashes are calculated in batches using
+ * the multi-buffer SHA-1 functions.
+ *
+ * @param pBlocks	[in] Decrypted blocks.
+ * @param block_number	[in] Block number of the first block.
+ * @param count		[in] Number of blocks.
+ * @param pH3		[in] H3 table. (contents of the .h3 file)
+ * @param h3_count	[in] Number of H3 hashes.
+ * @param pErrors	[in/out] Bad hashes are added here.
+ * @return Number of bad hashes found in this set of blocks.
+ */
+unsigned int wiiu_hash_tree_verify_blocks(const WiiU_Hash_Block_t *pBlocks,
+	uint32_t block_number, unsigned int count,
+	const uint8_t *pH3, unsigned int h3_count,
+	WiiU_Hash_Tree_Errors_t *pErrors)
+{
+	uint8_t digests[BATCH_BLOCKS][WUP_SHA1_DIGEST_SIZE];
+	unsigned int bad = 0;
+
+	assert(pBlocks != NULL || count == 0);
+	assert(pErrors != NULL);
+
+	while (count > 0) {
+		const unsigned int n = (count < BATCH_BLOCKS ? count : BATCH_BLOCKS);
+		unsigned int i, level;
+
+		// H0: Hash of each block's data area.
+		sha1w_hash_strided(pBlocks[0].data, sizeof(pBlocks[0].data),
+			sizeof(pBlocks[0]), n, digests[0]);
+		for (i = 0; i < n; i++) {
+			const uint32_t blk = block_number + i;
+			if (memcmp(digests[i], pBlocks[i].hashes.H0[blk % 16], WUP_SHA1_DIGEST_SIZE) != 0) {
+				add_bad_hash(pErrors, 0, blk);
+				bad++;
+			}
+		}
+
+		// H1-H3: Hash of the lower-level table in the
+		// first block of each superblock, hyperblock,
+		// and H3 group.
+		for (level = 1; level <= 3; level++) {
+			const unsigned int shift = level * 4;
+			const uint8_t *pTable[BATCH_BLOCKS];
+			uint32_t table_blk[BATCH_BLOCKS];
+			unsigned int table_count = 0;
+
+			for (i = 0; i < n; i++) {
+				const uint32_t blk = block_number + i;
+				if ((blk & ((1U << shift) - 1)) != 0)
+					continue;
+
+				table_blk[table_count] = blk;
+				switch (level) {
+					case 1:	pTable[table_count] = pBlocks[i].hashes.H0[0]; break;
+					case 2:	pTable[table_count] = pBlocks[i].hashes.H1[0]; break;
+					default:
+					case 3:	pTable[table_count] = pBlocks[i].hashes.H2[0]; break;
+				}
+				table_count++;
+			}
+			if (table_count == 0)
+				continue;
+
+			// All tables are 16 hashes.
+			sha1w_hash_multi(pTable, sizeof(pBlocks[0].hashes.H0), table_count, digests[0]);
+			for (i = 0; i < table_count; i++) {
+				const uint32_t blk = table_blk[i];
+				const uint32_t index = blk >> shift;
+				const WiiU_Hash_Block_t *const pBlock = &pBlocks[blk - block_number];
+				const uint8_t *pExpected;
+
+				switch (level) {
+					case 1:	pExpected = pBlock->hashes.H1[index % 16]; break;
+					case 2:	pExpected = pBlock->hashes.H2[index % 16]; break;
+					default:
+					case 3:
+						// H3 hashes are stored in the .h3 file.
+						pExpected = (index < h3_count ? &pH3[index * WUP_SHA1_DIGEST_SIZE] : NULL);
+						break;
+				}
+				if (!pExpected || memcmp(digests[i], pExpected, WUP_SHA1_DIGEST_SIZE) != 0) {
+					add_bad_hash(pErrors, level, index);
+					bad++;
+				}
+			}
+		}
+
+		pBlocks += n;
+		block_number += n;
+		count -= n;
+	}
+
+	return bad;
+}
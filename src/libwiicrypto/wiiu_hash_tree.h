@@ -0,0 +1,127 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * wiiu_hash_tree.h: Wii U hashed content functions.                       *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBWIICRYPTO_WIIU_HASH_TREE_H__
+#define __RVTHTOOL_LIBWIICRYPTO_WIIU_HASH_TREE_H__
+
+#include <stdint.h>
+#include "common.h"
+#include "aesw.h"
+
+// Defined in nettle/sha1.h, but let's not include it here.
+#define WUP_SHA1_DIGEST_SIZE 20
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Hashed contents are encrypted in 64 KB blocks.
+// Each block has a 1 KB hash area, followed by 63 KB of data.
+// Block: 64 KB [H0]
+// Superblock: 16 blocks == 1 MB [H1]
+// Hyperblock: 16 superblocks == 16 MB [H2]
+// H3 group: 16 hyperblocks == 256 MB [H3; stored in the .h3 file]
+// The SHA-1 hash of the .h3 file (H4) is stored in the TMD content table.
+
+#define WIIU_HASH_BLOCK_SIZE	0x10000
+#define WIIU_HASH_DATA_SIZE	0xFC00
+
+// Hash area. Encrypted using AES-128-CBC with a zero IV.
+typedef struct _WiiU_Hash_Area_t {
+	// 16 H0 hashes, each of which covers the data area of one block.
+	// For every superblock, all blocks have the same H0 hashes.
+	uint8_t H0[16][WUP_SHA1_DIGEST_SIZE];
+	// 16 H1 hashes, each of which covers the H0 table of one superblock.
+	// For every hyperblock, all blocks have the same H1 hashes.
+	uint8_t H1[16][WUP_SHA1_DIGEST_SIZE];
+	// 16 H2 hashes, each of which covers the H1 table of one hyperblock.
+	// For every H3 group, all blocks have the same H2 hashes.
+	uint8_t H2[16][WUP_SHA1_DIGEST_SIZE];
+
+	uint8_t unused[64];
+} WiiU_Hash_Area_t;
+ASSERT_STRUCT(WiiU_Hash_Area_t, 0x400);
+
+// Hashed content block.
+// The data area is encrypted using AES-128-CBC.
+// The IV is the block's own H0 hash (first 16 bytes).
+typedef struct _WiiU_Hash_Block_t {
+	WiiU_Hash_Area_t hashes;
+	uint8_t data[WIIU_HASH_DATA_SIZE];
+} WiiU_Hash_Block_t;
+ASSERT_STRUCT(WiiU_Hash_Block_t, WIIU_HASH_BLOCK_SIZE);
+
+// Maximum number of bad ranges recorded for each hash level.
+#define WIIU_HASH_TREE_MAX_BAD_RANGES 8
+
+// Range of bad hashes. (inclusive)
+typedef struct _WiiU_Hash_Bad_Range_t {
+	uint32_t first;
+	uint32_t last;
+} WiiU_Hash_Bad_Range_t;
+
+/**
+ * Hash verification errors.
+ * Index 0-3 is the hash level. (H0-H3)
+ *
+ * Bad hashes are recorded by their index within the level, i.e.
+ * block for H0, superblock for H1, hyperblock for H2, and
+ * H3 group for H3. Consecutive indexes are merged into ranges.
+ * Only the first WIIU_HASH_TREE_MAX_BAD_RANGES ranges are
+ * recorded, but all bad hashes are counted.
+ *
+ * Must be zeroed before use.
+ */
+typedef struct _WiiU_Hash_Tree_Errors_t {
+	unsigned int bad_count[4];	// Number of bad hashes
+	unsigned int range_count[4];	// Number of recorded ranges
+	WiiU_Hash_Bad_Range_t ranges[4][WIIU_HASH_TREE_MAX_BAD_RANGES];
+} WiiU_Hash_Tree_Errors_t;
+
+/**
+ * Decrypt a set of consecutive hashed content blocks.
+ *
+ * The hash areas are decrypted first, since the data IVs are taken
+ * from the decrypted H0 tables. Up to 16 blocks are processed in
+ * lockstep if hardware acceleration is available.
+ *
+ * @param aesw		[in] AES context. (title key must be set)
+ * @param pBlocks	[in/out] Encrypted blocks. Decrypted on return.
+ * @param block_number	[in] Block number of the first block.
+ * @param count		[in] Number of blocks.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int wiiu_hash_tree_decrypt_blocks(AesCtx *aesw, WiiU_Hash_Block_t *pBlocks,
+	uint32_t block_number, unsigned int count);
+
+/**
+ * Verify the hash tree for a set of consecutive decrypted blocks.
+ *
+ * The H0 hash of every block is checked. The H1, H2, and H3 hashes
+ * are checked in the first block of each superblock, hyperblock, and
+ * H3 group, respectively. Hashes are calculated in batches using
+ * the multi-buffer SHA-1 functions.
+ *
+ * @param pBlocks	[in] Decrypted blocks.
+ * @param block_number	[in] Block number of the first block.
+ * @param count		[in] Number of blocks.
+ * @param pH3		[in] H3 table. (contents of the .h3 file)
+ * @param h3_count	[in] Number of H3 hashes.
+ * @param pErrors	[in/out] Bad hashes are added here.
+ * @return Number of bad hashes found in this set of blocks.
+ */
+unsigned int wiiu_hash_tree_verify_blocks(const WiiU_Hash_Block_t *pBlocks,
+	uint32_t block_number, unsigned int count,
+	const uint8_t *pH3, unsigned int h3_count,
+	WiiU_Hash_Tree_Errors_t *pErrors);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_LIBWIICRYPTO_WIIU_HASH_TREE_H__ */
@@ -30,6 +30,7 @@
 #endif /* _WIN32 */
 
 #include "resign-nus.hpp"
+#include "resign-batch.hpp"
 #include "print-info.hpp"
 
 #ifdef __GNUC__
@@ -79,6 +80,11 @@ static void print_help(const TCHAR *argv0)
 		_T("- Resigns the specified NUS directory in place.\n")
 		_T("  Default converts Retail NUS to Debug, and Debug NUS to retail.\n")
 		_T("\n")
+		_T("resign-batch dir/ [dir2/...]\n")
+		_T("- Searches the specified directory trees for NUS directories\n")
+		_T("  and resigns all of them in place, in parallel.\n")
+		_T("  Titles already signed with the --recrypt key are skipped.\n")
+		_T("\n")
 		_T("verify nusdir/\n")
 		_T(" - Verify the content hashes.\n")
 		_T("\n")
@@ -87,6 +93,10 @@ static void print_help(const TCHAR *argv0)
 		_T("  -k, --recrypt=KEY         Recrypt the WAD using the specified KEY:\n")
 		_T("                            default, retail, debug\n")
 		_T("                            Recrypting to retail will blank out the signatures.\n")
+		_T("  -j, --jobs=N              Use N threads for verify and resign-batch.\n")
+		_T("                            (default is the number of CPUs)\n")
+		_T("      --io-jobs=N           Read at most N contents at once for verify.\n")
+		_T("                            Use 1 for hard drives. (default is 2)\n")
 		_T("  -h, --help                Display this help and exit.\n")
 		_T("\n"), stdout);
 }
@@ -118,6 +128,10 @@ int RVTH_CDECL _tmain(int argc, TCHAR *argv[])
 	// Other values are from RVL_CryptoType_e.
 	int recrypt_key = -1;
 
+	// Number of threads and concurrent reads for verify. (0 for default)
+	unsigned int jobs = 0;
+	unsigned int io_jobs = 0;
+
 	((void)argc);
 	((void)argv);
 
@@ -146,12 +160,14 @@ int RVTH_CDECL _tmain(int argc, TCHAR *argv[])
 	while (true) {
 		static const struct option long_options[] = {
 			{_T("recrypt"),	required_argument,	0, _T('k')},
+			{_T("jobs"),	required_argument,	0, _T('j')},
+			{_T("io-jobs"),	required_argument,	0, _T('I')},
 			{_T("help"),	no_argument,		0, _T('h')},
 
 			{NULL, 0, 0, 0}
 		};
 
-		int c = getopt_long(argc, argv, _T("k:h"), long_options, NULL);
+		int c = getopt_long(argc, argv, _T("k:j:h"), long_options, NULL);
 		if (c == -1)
 			break;
 
@@ -176,6 +192,23 @@ int RVTH_CDECL _tmain(int argc, TCHAR *argv[])
 				}
 				break;
 
+			case _T('j'):
+			case _T('I'): {
+				// Number of threads or concurrent reads.
+				TCHAR *endptr = NULL;
+				const unsigned long n = optarg ? _tcstoul(optarg, &endptr, 10) : 0;
+				if (!optarg || *endptr != 0 || n == 0 || n > 256) {
+					print_error(argv[0], _T("invalid number of jobs '%s'"), optarg ? optarg : _T(""));
+					return EXIT_FAILURE;
+				}
+				if (c == _T('j')) {
+					jobs = (unsigned int)n;
+				} else {
+					io_jobs = (unsigned int)n;
+				}
+				break;
+			}
+
 			case _T('h'):
 				print_help(argv[0]);
 				return EXIT_SUCCESS;
@@ -209,7 +242,7 @@ int RVTH_CDECL _tmain(int argc, TCHAR *argv[])
 
 		ret = 0;
 		for (i = optind+1; i < argc; i++) {
-			ret |= print_nus_info(argv[i], false);
+			ret |= print_nus_info(argv[i], false, 0, 0);
 		}
 	} else if (!_tcscmp(argv[optind], _T("verify"))) {
 		// Verify a WAD.
@@ -221,7 +254,7 @@ int RVTH_CDECL _tmain(int argc, TCHAR *argv[])
 
 		ret = 0;
 		for (i = optind+1; i < argc; i++) {
-			ret |= print_nus_info(argv[i], true);
+			ret |= print_nus_info(argv[i], true, jobs, io_jobs);
 		}
 	} else if (!_tcscmp(argv[optind], _T("resign"))) {
 		// Resign an NUS directory.
@@ -230,6 +263,13 @@ int RVTH_CDECL _tmain(int argc, TCHAR *argv[])
 			return EXIT_FAILURE;
 		}
 		ret = resign_nus(argv[optind+1], recrypt_key);
+	} else if (!_tcscmp(argv[optind], _T("resign-batch"))) {
+		// Resign all NUS directories in one or more directory trees.
+		if (argc < optind+2) {
+			print_error(argv[0], _T("directory not specified"));
+			return EXIT_FAILURE;
+		}
+		ret = resign_nus_batch(&argv[optind+1], argc - (optind+1), recrypt_key, jobs);
 	} else {
 		// If the "command" corresponds to a valid directory,
 		// assume it's a filename and handle it as 'info'.
@@ -238,7 +278,7 @@ int RVTH_CDECL _tmain(int argc, TCHAR *argv[])
 			int i;
 			ret = 0;
 			for (i = optind; i < argc; i++) {
-				ret |= print_nus_info(argv[i], false);
+				ret |= print_nus_info(argv[i], false, 0, 0);
 			}
 		} else {
 			// Not a filename.
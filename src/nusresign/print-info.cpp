@@ -2,7 +2,7 @@
  * RVT-H Tool: WAD Resigner                                                *
  * print-info.c: Print WAD information.                                    *
  *                                                                         *
- * Copyright (c) 2018-2022 by David Korth.                                 *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
@@ -13,6 +13,7 @@
 #include "libwiicrypto/byteswap.h"
 #include "libwiicrypto/cert.h"
 #include "libwiicrypto/sig_tools.h"
+#include "libwiicrypto/wiiu_hash_tree.h"
 #include "libwiicrypto/wiiu_structs.h"
 
 // Nettle
@@ -27,16 +28,32 @@
 #include <string.h>
 
 // C++ includes
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
 using std::array;
+using std::atomic;
+using std::condition_variable;
+using std::lock_guard;
+using std::mutex;
 using std::tstring;
+using std::unique_lock;
 using std::unique_ptr;
+using std::vector;
 
 // Buffer size for verifying contents.
 static constexpr off64_t READ_BUFFER_SIZE = 1024U * 1024U;
 
+// Default maximum number of concurrent reads when verifying contents.
+static constexpr unsigned int DEFAULT_IO_JOBS = 2;
+
 /**
  * Is an issuer retail or debug?
  * @param issuer RVL_Cert_Issuer
@@ -72,90 +89,171 @@ static const char *issuer_type(RVL_Cert_Issuer issuer)
 	}
 }
 
+/**
+ * Limits the number of concurrent reads across all worker threads.
+ * Decryption and hashing aren't limited, so the CPU work can overlap
+ * with reads from other threads without thrashing the storage device.
+ */
+class IoLimiter
+{
+	public:
+		explicit IoLimiter(unsigned int max_io)
+			: m_available(max_io > 0 ? max_io : 1)
+		{ }
+
+	private:
+		IoLimiter(const IoLimiter &) = delete;
+		IoLimiter &operator=(const IoLimiter &) = delete;
+
+	public:
+		/**
+		 * Read data from a file, waiting for an I/O slot if necessary.
+		 * @param ptr	[out] Buffer.
+		 * @param size	[in] Number of bytes to read.
+		 * @param f	[in] File.
+		 * @return Number of bytes read.
+		 */
+		size_t fread(void *ptr, size_t size, FILE *f)
+		{
+			{
+				unique_lock<mutex> lock(m_mutex);
+				m_cond.wait(lock, [this] { return m_available > 0; });
+				m_available--;
+			}
+
+			errno = 0;
+			const size_t ret = ::fread(ptr, 1, size, f);
+			const int err = errno;
+
+			{
+				lock_guard<mutex> lock(m_mutex);
+				m_available++;
+			}
+			m_cond.notify_one();
+			errno = err;
+			return ret;
+		}
+
+	private:
+		mutex m_mutex;
+		condition_variable m_cond;
+		unsigned int m_available;
+};
+
+/**
+ * Content verification result.
+ */
+struct ContentVerifyResult {
+	int ret;		// 0 if verified; 1 if not; negative POSIX error code on error.
+	tstring error;		// Error message, if any.
+
+	bool hasH3;		// True if the content has an H3 table.
+	bool hashed;		// True if the content was hashed. (no errors)
+	WiiU_Hash_Tree_Errors_t hash_errors;	// Bad H0-H3 hashes. (H3 only)
+	array<uint8_t, SHA1_DIGEST_SIZE> digest;	// Actual SHA-1 (H4 if H3 is present)
+
+	ContentVerifyResult()
+		: ret(0)
+		, hasH3(false)
+		, hashed(false)
+	{
+		memset(&hash_errors, 0, sizeof(hash_errors));
+		digest.fill(0);
+	}
+};
+
+/**
+ * Set a content verification error.
+ * @param result	[out] Verification result.
+ * @param err		[in] Negative POSIX error code.
+ * @param action	[in] Action that failed. ("opening" or "reading")
+ * @param cidbuf	[in] Content ID.
+ * @param ext		[in] File extension.
+ * @param msg		[in,opt] Error message. (If NULL, uses the error code.)
+ */
+static void set_verify_error(ContentVerifyResult &result, int err, const TCHAR *action,
+	const TCHAR *cidbuf, const TCHAR *ext, const TCHAR *msg = nullptr)
+{
+	TCHAR buf[256];
+	_sntprintf(buf, ARRAY_SIZE(buf), _T("- *** ERROR %s %s%s: %s\n"),
+		action, cidbuf, ext, (msg ? msg : _tcserror(-err)));
+	result.error = buf;
+	result.ret = err;
+}
+
+/**
+ * Open a content file. If the lowercase filename
+ * isn't found, the uppercase filename is tried.
+ * @param nus_dir	[in] NUS directory.
+ * @param content_id	[in] Content ID.
+ * @param ext		[in] File extension.
+ * @return File, or nullptr on error. (check errno)
+ */
+static FILE *open_content_file(const TCHAR *nus_dir, uint32_t content_id, const TCHAR *ext)
+{
+	TCHAR cidbuf[16];
+	_sntprintf(cidbuf, ARRAY_SIZE(cidbuf), _T("%08x"), content_id);
+	tstring filename = nus_dir;
+	filename += DIR_SEP_CHR;
+	filename += cidbuf;
+	filename += ext;
+
+	FILE *f = _tfopen(filename.c_str(), _T("rb"));
+	if (!f && errno == ENOENT) {
+		// Try again with an uppercase CID.
+		_sntprintf(cidbuf, ARRAY_SIZE(cidbuf), _T("%08X"), content_id);
+		filename = nus_dir;
+		filename += DIR_SEP_CHR;
+		filename += cidbuf;
+		filename += ext;
+		f = _tfopen(filename.c_str(), _T("rb"));
+	}
+	if (!f && errno == 0) {
+		errno = EIO;
+	}
+	return f;
+}
+
 /**
  * Verify a content entry.
  * @param nus_dir	[in] NUS directory.
- * @param title_key	[in] Decrypted title key.
+ * @param aesw		[in] AES context with the title key set.
  * @param entry		[in] Content entry.
- * @return 0 if the content is verified; 1 if not; negative POSIX error code on error.
+ * @param io		[in] I/O limiter.
+ * @param buf		[in] Read buffer. (READ_BUFFER_SIZE)
+ * @param result	[out] Verification result.
  */
-static int verify_content(const TCHAR *nus_dir, const uint8_t title_key[16], const WUP_Content_Entry *entry)
+static void verify_content(const TCHAR *nus_dir, AesCtx *aesw, const WUP_Content_Entry *entry,
+	IoLimiter &io, uint8_t *buf, ContentVerifyResult &result)
 {
 	// Construct the filenames.
 	// FIXME: Content ID or content index?
 	// Assuming content ID for filename, content index for IV.
-	TCHAR cidbuf[16], cidbuf_upper[16];
-	_sntprintf(cidbuf, ARRAY_SIZE(cidbuf), _T("%08x"), be32_to_cpu(entry->content_id));
-	tstring sf_app = nus_dir;
-	sf_app += DIR_SEP_CHR;
-	sf_app += cidbuf;
-	sf_app += _T(".app");
-
-	const bool hasH3 = !!(entry->type & cpu_to_be16(0x0002));
-	tstring sf_h3;
-	if (hasH3) {
-		// H3 file is present.
-		// TODO: How is it checked?
-		sf_h3 = nus_dir;
-		sf_h3 += DIR_SEP_CHR;
-		sf_h3 += cidbuf;
-		sf_h3 += _T(".h3");
-	}
+	const uint32_t content_id = be32_to_cpu(entry->content_id);
+	TCHAR cidbuf[16];
+	_sntprintf(cidbuf, ARRAY_SIZE(cidbuf), _T("%08x"), content_id);
 
-	FILE *f_content = _tfopen(sf_app.c_str(), _T("rb"));
-	if (!f_content) {
-		int err = errno;
-		if (err == ENOENT) {
-			// Try again with an uppercase CID.
-			_sntprintf(cidbuf_upper, ARRAY_SIZE(cidbuf_upper), _T("%08X"), be32_to_cpu(entry->content_id));
-			sf_app = nus_dir;
-			sf_app += DIR_SEP_CHR;
-			sf_app += cidbuf_upper;
-			sf_app += _T(".app");
-
-			f_content = _tfopen(sf_app.c_str(), _T("rb"));
-		}
+	result.hasH3 = !!(entry->type & cpu_to_be16(0x0002));
 
-		if (!f_content) {
-			// Error opening the content file.
-			err = errno;
-			if (err == 0) {
-				err = EIO;
-			}
-			_ftprintf(stderr, _T("- *** ERROR opening %s.app: %s\n"), cidbuf, _tcserror(err));
-			return -err;
-		}
+	FILE *const f_content = open_content_file(nus_dir, content_id, _T(".app"));
+	if (!f_content) {
+		// Error opening the content file.
+		set_verify_error(result, -errno, _T("opening"), cidbuf, _T(".app"));
+		return;
 	}
 
 	// H3 table depends on the size of the contents.
 	// One H3 hash == 256 MB data
 	unique_ptr<uint8_t[]> hash_h3;
 	size_t hash_h3_len = 0;
-	if (hasH3) {
-		FILE *f_h3 = _tfopen(sf_h3.c_str(), _T("rb"));
+	if (result.hasH3) {
+		// H3 file is present.
+		FILE *const f_h3 = open_content_file(nus_dir, content_id, _T(".h3"));
 		if (!f_h3) {
-			int err = errno;
-			if (err == ENOENT) {
-				// Try again with an uppercase CID.
-				_sntprintf(cidbuf_upper, ARRAY_SIZE(cidbuf_upper), _T("%08X"), be32_to_cpu(entry->content_id));
-				sf_h3 = nus_dir;
-				sf_h3 += DIR_SEP_CHR;
-				sf_h3 += cidbuf_upper;
-				sf_h3 += _T(".h3");
-
-				f_h3 = _tfopen(sf_h3.c_str(), _T("rb"));
-			}
-
-			if (!f_h3) {
-				// Error opening the H3 file.
-				fclose(f_content);
-				int err = errno;
-				if (err == 0) {
-					err = EIO;
-				}
-				_ftprintf(stderr, _T("- *** ERROR opening %s.h3: %s\n"), cidbuf, _tcserror(err));
-				return -err;
-			}
+			// Error opening the H3 file.
+			set_verify_error(result, -errno, _T("opening"), cidbuf, _T(".h3"));
+			fclose(f_content);
+			return;
 		}
 
 		// Get the size.
@@ -167,285 +265,256 @@ static int verify_content(const TCHAR *nus_dir, const uint8_t title_key[16], con
 			// Invalid size.
 			fclose(f_h3);
 			fclose(f_content);
-			_ftprintf(stderr, _T("- *** ERROR opening %s.h3: Size is incorrect\n"), cidbuf);
-			return -EIO;
+			set_verify_error(result, -EIO, _T("opening"), cidbuf, _T(".h3"), _T("Size is incorrect"));
+			return;
 		}
 
 		rewind(f_h3);
 		hash_h3.reset(new uint8_t[hash_h3_len]);
-		errno = 0;
-		size_t size = fread(hash_h3.get(), 1, hash_h3_len, f_h3);
+		size_t size = io.fread(hash_h3.get(), hash_h3_len, f_h3);
+		const int err = (errno != 0 ? errno : EIO);
+		fclose(f_h3);
 		if (size != hash_h3_len) {
 			// Read error.
-			int err = errno;
-			if (errno == 0) {
-				err = EIO;
-			}
 			fclose(f_content);
-			_ftprintf(stderr, _T("- *** ERROR opening %s.h3: %s\n"), cidbuf, _tcserror(err));
-			return -err;
+			set_verify_error(result, -err, _T("reading"), cidbuf, _T(".h3"));
+			return;
 		}
 	}
 
-	AesCtx *const aesw = aesw_new();
-	if (!aesw) {
-		// Error initializing AES...
-		fclose(f_content);
-		return -ENOMEM;
-	}
-
 	// IV is the 2-byte content index, followed by zeroes.
 	uint8_t iv[16];
 	memcpy(iv, &entry->index, 2);
 	memset(&iv[2], 0, 14);
-	aesw_set_key(aesw, title_key, 16);
 	aesw_set_iv(aesw, iv, sizeof(iv));
 
-	// Read buffer.
-	unique_ptr<uint8_t[]> buf(new uint8_t[READ_BUFFER_SIZE]);
-
 	// Read the content, decrypt it, and hash it.
 	// TODO: Verify size; check fseeko() errors.
 	off64_t data_sz = be64_to_cpu(entry->size);
 
-	int ret = 0;
-	if (!hasH3) {
+	if (!result.hasH3) {
 		// No H3 table. A single SHA-1 is used for the whole content.
 		struct sha1_ctx sha1;
 		sha1_init(&sha1);
-		for (; data_sz >= READ_BUFFER_SIZE; data_sz -= READ_BUFFER_SIZE) {
-			errno = 0;
-			size_t size = fread(buf.get(), 1, READ_BUFFER_SIZE, f_content);
-			if (size != READ_BUFFER_SIZE) {
-				ret = errno;
-				if (ret == 0) {
-					ret = -EIO;
-				}
-				goto end;
-			}
-
-			// Decrypt the data.
-			aesw_decrypt(aesw, buf.get(), READ_BUFFER_SIZE);
-
-			// Update the SHA-1.
-			sha1_update(&sha1, READ_BUFFER_SIZE, buf.get());
-		}
-
-		// Remaining data.
-		if (data_sz > 0) {
+		while (data_sz > 0) {
 			// NOTE: AES works on 16-byte blocks, so we have to
 			// read and decrypt the full 16-byte block. The SHA-1
 			// is only taken for the actual used data, though.
-			uint32_t data_sz_align = ALIGN_BYTES(16, data_sz);
-
-			errno = 0;
-			size_t size = fread(buf.get(), 1, data_sz_align, f_content);
-			if (size != data_sz_align) {
-				ret = errno;
-				if (ret == 0) {
-					ret = -EIO;
-				}
-				goto end;
+			const size_t hash_sz = static_cast<size_t>(std::min(data_sz, READ_BUFFER_SIZE));
+			const size_t read_sz = ALIGN_BYTES(16, hash_sz);
+			size_t size = io.fread(buf, read_sz, f_content);
+			if (size != read_sz) {
+				set_verify_error(result, (errno != 0 ? -errno : -EIO), _T("reading"), cidbuf, _T(".app"));
+				fclose(f_content);
+				return;
 			}
 
-			// Decrypt the data.
-			aesw_decrypt(aesw, buf.get(), data_sz_align);
-
-			// Update the SHA-1.
-			// NOTE: Only uses the actual content, not the
-			// aligned data required for decryption.
-			sha1_update(&sha1, data_sz, buf.get());
+			// Decrypt the data and update the SHA-1.
+			aesw_decrypt_sha1(aesw, &sha1, buf, read_sz, hash_sz);
+			data_sz -= hash_sz;
 		}
 
 		// Finalize the SHA-1 and compare it.
-		uint8_t digest[SHA1_DIGEST_SIZE];
-		sha1_digest(&sha1, sizeof(digest), digest);
-		_fputts(_T("- Expected SHA-1: "), stdout);
-		for (size_t size = 0; size < sizeof(entry->sha1_hash); size++) {
-			_tprintf(_T("%02x"), entry->sha1_hash[size]);
-		}
-		_fputtc(_T('\n'), stdout);
-		_fputts(_T("- Actual SHA-1:   "), stdout);
-		for (size_t size = 0; size < sizeof(digest); size++) {
-			_tprintf(_T("%02x"), digest[size]);
-		}
-		if (!memcmp(digest, entry->sha1_hash, SHA1_DIGEST_SIZE)) {
-			_fputts(_T(" [OK]\n"), stdout);
-		} else {
-			_fputts(_T(" [ERROR]\n"), stdout);
-			ret = 1;
-		}
+		sha1_digest(&sha1, result.digest.size(), result.digest.data());
+		result.hashed = true;
+		result.ret = (!memcmp(result.digest.data(), entry->sha1_hash, SHA1_DIGEST_SIZE) ? 0 : 1);
 	} else {
 		// Has an H3 table. Content is encrypted in 64 KB blocks.
-		// H3 hash is the hash of all H2 tables for every 256 MB block.
-		// IV starts in hashes[block number % 16].
 		// TODO: Verify that the content is a multiple of 64 KB?
-		struct EncBlock {
-			// One hash block covers a 1 MB superblock.
-			struct {
-				// 16 H0 hashes, each of which covers the data area (63 KB) of one 64 KB block.
-				// For every megabyte of data, all 64 KB blocks have the same H0 hashes.
-				uint8_t h0[16][SHA1_DIGEST_SIZE];
-				// 16 H1 hashes, each of which covers the H0 table for a given 1 MB block.
-				// For every 16 MB of data, all 64 KB blocks have the same H1 hashes.
-				uint8_t h1[16][SHA1_DIGEST_SIZE];
-				// 16 H2 hashes, each of which covers the H1 table for a given 16 MB block.
-				// For every 256 MB of data, all 64 KB blocks have the same H2 hashes.
-				uint8_t h2[16][SHA1_DIGEST_SIZE];
-
-				// Unused
-				uint8_t unused[64];
-			} hashes;
-			uint8_t data[0xFC00];
-		};
-
-		// H0 == hash of a single block
-		// H1 == hash of 16 H0 hashes
-		// H2 == hash of 16 H1 hashes
-		// H3 == hash of all H2 hashes
-		// H4 == hash of the H3 hash, stored in the content entry
-
-		// Were any bad hashes found?
-		array<unsigned int, 4> bad_hash = {{0, 0, 0, 0}};
-
-		static constexpr off64_t ENC_BLOCK_SIZE = 0x10000U;
-		static constexpr off64_t DEC_BLOCK_SIZE = 0xFC00U;
-
-		// Zero IV for hashes.
-		array<uint8_t, 16> zero_iv;
-		zero_iv.fill(0);
-
-		EncBlock *const block = reinterpret_cast<EncBlock*>(buf.get());
-		unsigned int block_number = 0;
-		for (; data_sz >= ENC_BLOCK_SIZE; data_sz -= ENC_BLOCK_SIZE, block_number++) {
-			sha1_ctx sha1;
-			uint8_t digest[SHA1_DIGEST_SIZE];
-
-			errno = 0;
-			size_t size = fread(block, 1, sizeof(*block), f_content);
-			if (size != sizeof(*block)) {
-				ret = errno;
-				if (ret == 0) {
-					ret = -EIO;
-				}
-				goto end;
+		static constexpr off64_t ENC_BLOCK_SIZE = WIIU_HASH_BLOCK_SIZE;
+		static constexpr unsigned int BLOCKS_PER_READ = READ_BUFFER_SIZE / ENC_BLOCK_SIZE;
+		const unsigned int h3_count = static_cast<unsigned int>(hash_h3_len / SHA1_DIGEST_SIZE);
+
+		uint32_t block_number = 0;
+		while (data_sz >= ENC_BLOCK_SIZE) {
+			// Read multiple blocks at once to reduce the number of reads.
+			const unsigned int block_count = static_cast<unsigned int>(
+				std::min<off64_t>(data_sz / ENC_BLOCK_SIZE, BLOCKS_PER_READ));
+			const size_t read_sz = block_count * static_cast<size_t>(ENC_BLOCK_SIZE);
+			size_t size = io.fread(buf, read_sz, f_content);
+			if (size != read_sz) {
+				set_verify_error(result, (errno != 0 ? -errno : -EIO), _T("reading"), cidbuf, _T(".app"));
+				fclose(f_content);
+				return;
 			}
+			data_sz -= read_sz;
 
-			// Decrypt the hashes. (zero IV)
-			aesw_set_iv(aesw, zero_iv.data(), zero_iv.size());
-			aesw_decrypt(aesw, reinterpret_cast<uint8_t*>(&block->hashes), sizeof(block->hashes));
-
-			// Decrypt the data.
-			// IV is one of the decrypted hashes.
-			const uint8_t *const pHashH0_expected = block->hashes.h0[block_number % 16];
-			aesw_set_iv(aesw, pHashH0_expected, 16);
-			aesw_decrypt(aesw, block->data, sizeof(block->data));
-
-			// Verify the H0 hash.
-			sha1_init(&sha1);
-			sha1_update(&sha1, sizeof(block->data), block->data);
-			sha1_digest(&sha1, sizeof(digest), digest);
-			if (memcmp(digest, pHashH0_expected, sizeof(digest)) != 0) {
-				// TODO: Print an error here?
-				//fprintf(stderr, "- *** ERROR: H0 hash bad at block %u\n", block_number);
-				bad_hash[0]++;
-				ret = 1;
+			// Decrypt the blocks and verify the hash tree.
+			WiiU_Hash_Block_t *const blocks = reinterpret_cast<WiiU_Hash_Block_t*>(buf);
+			int ret = wiiu_hash_tree_decrypt_blocks(aesw, blocks, block_number, block_count);
+			if (ret != 0) {
+				set_verify_error(result, ret, _T("decrypting"), cidbuf, _T(".app"));
+				fclose(f_content);
+				return;
 			}
+			wiiu_hash_tree_verify_blocks(blocks, block_number, block_count,
+				hash_h3.get(), h3_count, &result.hash_errors);
+			block_number += block_count;
+		}
 
-			if (block_number % 16 == 0) {
-				// Verify the H1 hash. (New H0 table)
-				// TODO: Verify that the other identical H0 hash tables match.
-				sha1_init(&sha1);
-				sha1_update(&sha1, sizeof(block->hashes.h0), &block->hashes.h0[0][0]);
-				sha1_digest(&sha1, sizeof(digest), digest);
+		// Verify the H4 SHA-1, which is stored in the content entry.
+		sha1_ctx sha1_h4;
+		sha1_init(&sha1_h4);
+		sha1_update(&sha1_h4, hash_h3_len, hash_h3.get());
+		sha1_digest(&sha1_h4, result.digest.size(), result.digest.data());
+		result.hashed = true;
 
-				unsigned int h1_idx = (block_number / 16) % 16;
-				if (memcmp(digest, block->hashes.h1[h1_idx], sizeof(digest)) != 0) {
-					bad_hash[1]++;
-				}
-			}
+		const unsigned int *const bad_count = result.hash_errors.bad_count;
+		result.ret = (bad_count[0] != 0 || bad_count[1] != 0 || bad_count[2] != 0 || bad_count[3] != 0 ||
+		              memcmp(result.digest.data(), entry->sha1_hash, SHA1_DIGEST_SIZE) != 0) ? 1 : 0;
+	}
 
-			if (block_number % (16*16) == 0) {
-				// Verify the H2 hash. (New H1 table)
-				// TODO: Verify that the other identical H1 hash tables match.
-				sha1_init(&sha1);
-				sha1_update(&sha1, sizeof(block->hashes.h1), &block->hashes.h1[0][0]);
-				sha1_digest(&sha1, sizeof(digest), digest);
+	fclose(f_content);
+}
 
-				unsigned int h2_idx = (block_number / (16*16)) % 16;
-				if (memcmp(digest, block->hashes.h2[h2_idx], sizeof(digest)) != 0) {
-					bad_hash[2]++;
-				}
-			}
+/**
+ * Print a content verification result.
+ * @param entry		[in] Content entry.
+ * @param result	[in] Verification result.
+ */
+static void print_verify_result(const WUP_Content_Entry *entry, const ContentVerifyResult &result)
+{
+	if (!result.error.empty()) {
+		_fputts(result.error.c_str(), stderr);
+	}
+	if (!result.hashed) {
+		return;
+	}
 
-			if (block_number % (16*16*16) == 0) {
-				// Verify the H3 hash. (New H2 table)
-				// TODO: Verify that the other identical H2 hash tables match.
-				sha1_init(&sha1);
-				sha1_update(&sha1, sizeof(block->hashes.h2), &block->hashes.h2[0][0]);
-				sha1_digest(&sha1, sizeof(digest), digest);
-
-				unsigned int h3_byte_pos = (block_number / (16*16*16)) * SHA1_DIGEST_SIZE;
-				if (h3_byte_pos + SHA1_DIGEST_SIZE > hash_h3_len) {
-					// Out of bounds...
-					bad_hash[3]++;
+	bool showStatus = true;
+	if (result.hasH3) {
+		// Bad hashes are listed by the block that each hash covers.
+		static const TCHAR *const block_units[4] = {
+			_T("64 KB"), _T("1 MB"), _T("16 MB"), _T("256 MB")
+		};
+		const WiiU_Hash_Tree_Errors_t &errors = result.hash_errors;
+		for (unsigned int i = 0; i < 4; i++) {
+			if (errors.bad_count[i] == 0)
+				continue;
+
+			_tprintf(_T("- ERROR: %u H%u hash(es) were incorrect. (%s blocks: "),
+				errors.bad_count[i], i, block_units[i]);
+			unsigned int listed = 0;
+			for (unsigned int j = 0; j < errors.range_count[i]; j++) {
+				const WiiU_Hash_Bad_Range_t &range = errors.ranges[i][j];
+				if (j > 0) {
+					_fputts(_T(", "), stdout);
+				}
+				if (range.first == range.last) {
+					_tprintf(_T("%u"), range.first);
 				} else {
-					if (memcmp(digest, &hash_h3[h3_byte_pos], sizeof(digest)) != 0) {
-						bad_hash[3]++;
-					}
+					_tprintf(_T("%u-%u"), range.first, range.last);
 				}
+				listed += range.last - range.first + 1;
+			}
+			if (listed < errors.bad_count[i]) {
+				// Not all bad hashes were recorded.
+				_fputts(_T(", ..."), stdout);
 			}
+			_fputts(_T(")\n"), stdout);
+			showStatus = false;
 		}
+	}
 
-		bool showH4status = true;
-		for (unsigned int i = 0; i < 3; i++) {
-			if (bad_hash[i] != 0) {
-				_tprintf(_T("- ERROR: %u H%u hash(es) were incorrect.\n"), bad_hash[i], i);
-				showH4status = false;
-				ret = 1;
-			}
+	const TCHAR *const s_h4 = (result.hasH3 ? _T(" (H4)") : _T(""));
+	_fputts(_T("- Expected SHA-1: "), stdout);
+	for (size_t i = 0; i < sizeof(entry->sha1_hash); i++) {
+		_tprintf(_T("%02x"), entry->sha1_hash[i]);
+	}
+	_tprintf(_T("%s\n"), s_h4);
+	_fputts(_T("- Actual SHA-1:   "), stdout);
+	for (size_t i = 0; i < result.digest.size(); i++) {
+		_tprintf(_T("%02x"), result.digest[i]);
+	}
+	if (showStatus) {
+		if (!memcmp(result.digest.data(), entry->sha1_hash, SHA1_DIGEST_SIZE)) {
+			_tprintf(_T(" [OK]%s\n"), s_h4);
+		} else {
+			_tprintf(_T(" [ERROR]%s\n"), s_h4);
 		}
+	} else {
+		_tprintf(_T("%s\n"), s_h4);
+	}
+}
 
-		// Verify the H4 SHA-1, which is stored in the content entry.
-		array<uint8_t, SHA1_DIGEST_SIZE> digest;
-		sha1_ctx sha1_h4;
-		sha1_init(&sha1_h4);
-		sha1_update(&sha1_h4, hash_h3_len, hash_h3.get());
-		sha1_digest(&sha1_h4, digest.size(), digest.data());
-		_fputts(_T("- Expected SHA-1: "), stdout);
-		for (size_t size = 0; size < sizeof(entry->sha1_hash); size++) {
-			_tprintf(_T("%02x"), entry->sha1_hash[size]);
+/**
+ * Verify multiple content entries in parallel.
+ * @param nus_dir	[in] NUS directory.
+ * @param title_key	[in] Decrypted title key.
+ * @param entries	[in] Content entries.
+ * @param results	[out] Verification results. (same order as entries)
+ * @param threads	[in] Number of worker threads. (0 for auto)
+ * @param io_jobs	[in] Maximum number of concurrent reads. (0 for default)
+ */
+static void verify_contents(const TCHAR *nus_dir, const uint8_t title_key[16],
+	const vector<const WUP_Content_Entry*> &entries, vector<ContentVerifyResult> &results,
+	unsigned int threads, unsigned int io_jobs)
+{
+	results.clear();
+	results.resize(entries.size());
+	if (entries.empty())
+		return;
+
+	if (threads == 0) {
+		threads = std::thread::hardware_concurrency();
+		if (threads == 0) {
+			threads = 1;
 		}
-		_fputts(_T(" (H4)\n"), stdout);
-		_fputts(_T("- Actual SHA-1:   "), stdout);
-		for (size_t size = 0; size < sizeof(digest); size++) {
-			printf("%02x", digest[size]);
+	}
+	threads = std::min(threads, static_cast<unsigned int>(entries.size()));
+	IoLimiter io(io_jobs > 0 ? io_jobs : DEFAULT_IO_JOBS);
+
+	atomic<size_t> next_entry(0);
+	auto worker = [&]() {
+		// Each worker has its own read buffer and AES context.
+		// The title key is set once and reused for all contents.
+		unique_ptr<uint8_t[]> buf(new uint8_t[READ_BUFFER_SIZE]);
+		AesCtx *const aesw = aesw_new();
+		if (aesw) {
+			aesw_set_key(aesw, title_key, 16);
 		}
-		if (showH4status) {
-			if (!memcmp(digest.data(), entry->sha1_hash, SHA1_DIGEST_SIZE)) {
-				_fputts(_T(" [OK] (H4)\n"), stdout);
-			} else {
-				_fputts(_T(" [ERROR] (H4)\n"), stdout);
-				ret = 1;
+
+		while (true) {
+			const size_t idx = next_entry.fetch_add(1);
+			if (idx >= entries.size())
+				break;
+			if (!aesw) {
+				// Error initializing AES...
+				results[idx].ret = -ENOMEM;
+				continue;
 			}
-		} else {
-			_fputts(_T(" (H4)\n"), stdout);
+			verify_content(nus_dir, aesw, entries[idx], io, buf.get(), results[idx]);
 		}
-	}
 
-end:
-	fclose(f_content);
-	aesw_free(aesw);
-	return ret;
+		aesw_free(aesw);
+	};
+
+	vector<std::thread> workers;
+	workers.reserve(threads);
+	try {
+		for (unsigned int i = 1; i < threads; i++) {
+			workers.emplace_back(worker);
+		}
+	} catch (const std::system_error&) {
+		// Unable to start more threads.
+		// Use the ones that have been started.
+	}
+	// The current thread is also used as a worker.
+	worker();
+	for (std::thread &t : workers) {
+		t.join();
+	}
 }
 
 /**
  * 'info' command.
  * @param nus_dir	[in] NUS directory.
- * @param verify	[in] If true, verify the contents. [TODO]
+ * @param verify	[in] If true, verify the contents.
+ * @param threads	[in] Number of threads for verifying contents. (0 for auto)
+ * @param io_jobs	[in] Maximum number of concurrent reads for verifying contents. (0 for default)
  * @return 0 on success; negative POSIX error code or positive ID code on error.
  */
-int print_nus_info(const TCHAR *nus_dir, bool verify)
+int print_nus_info(const TCHAR *nus_dir, bool verify, unsigned int threads, unsigned int io_jobs)
 {
 	// Construct the filenames.
 	tstring sf_tik = nus_dir;
@@ -654,6 +723,7 @@ int print_nus_info(const TCHAR *nus_dir, bool verify)
 			aesw_set_key(aesw, RVL_AES_Keys[encKey], 16);
 			aesw_set_iv(aesw, iv, sizeof(iv));
 			aesw_decrypt(aesw, title_key, sizeof(title_key));
+			aesw_free(aesw);
 		} else {
 			// TODO: Print a warning message indicating we can't decrypt.
 			verify = false;
@@ -670,7 +740,7 @@ int print_nus_info(const TCHAR *nus_dir, bool verify)
 	const WUP_ContentInfo *const cinfo_end = &cinfo[WUP_CONTENTINFO_ENTRIES];
 
 	size_t cstart = sizeof(WUP_TMD_Header) + sizeof(WUP_TMD_ContentInfoTable);
-	int ret = 0;
+	vector<const WUP_Content_Entry*> entries;
 	for (; cinfo < cinfo_end; cinfo++) {
 		const unsigned int indexOffset = be16_to_cpu(cinfo->indexOffset);
 		const unsigned int commandCount = be16_to_cpu(cinfo->commandCount);
@@ -686,36 +756,62 @@ int print_nus_info(const TCHAR *nus_dir, bool verify)
 			continue;
 		}
 
-		// Print the entries.
 		const WUP_Content_Entry *p =
 			reinterpret_cast<const WUP_Content_Entry*>(&tmd_data[pos]);
 		const WUP_Content_Entry *const p_end = &p[commandCount];
 		for (; p < p_end; p++) {
-			// TODO: Show the actual table index, or just the
-			// index field in the entry?
-			uint16_t content_index = be16_to_cpu(p->index);
-			_tprintf(_T("#%d: ID=%08x, type=%04X, size=%u"),
-				be16_to_cpu(p->index),
-				be32_to_cpu(p->content_id),
-				be16_to_cpu(p->type),
-				(uint32_t)be64_to_cpu(p->size));
-			if (content_index == boot_index) {
-				_fputts(_T(", bootable"), stdout);
-			}
-			_fputtc(_T('\n'), stdout);
-
-			if (verify) {
-				// Verify the content.
-				// TODO: Only decrypt the title key once?
-				// TODO: Return failure if any contents fail.
-				int vret = verify_content(nus_dir, title_key, p);
-				if (vret != 0) {
-					ret = 1;
-				}
+			entries.push_back(p);
+		}
+	}
+
+	// Verify the contents in parallel.
+	// The results are printed along with the content entries.
+	vector<ContentVerifyResult> results;
+	if (verify) {
+		verify_contents(nus_dir, title_key, entries, results, threads, io_jobs);
+	}
+
+	// Print the entries.
+	int ret = 0;
+	unsigned int verified_ok = 0;
+	for (size_t i = 0; i < entries.size(); i++) {
+		const WUP_Content_Entry *const p = entries[i];
+
+		// TODO: Show the actual table index, or just the
+		// index field in the entry?
+		uint16_t content_index = be16_to_cpu(p->index);
+		_tprintf(_T("#%d: ID=%08x, type=%04X, size=%u"),
+			be16_to_cpu(p->index),
+			be32_to_cpu(p->content_id),
+			be16_to_cpu(p->type),
+			(uint32_t)be64_to_cpu(p->size));
+		if (content_index == boot_index) {
+			_fputts(_T(", bootable"), stdout);
+		}
+		_fputtc(_T('\n'), stdout);
+
+		if (verify) {
+			// Print the verification result.
+			print_verify_result(p, results[i]);
+			if (results[i].ret != 0) {
+				ret = 1;
+			} else {
+				verified_ok++;
 			}
 		}
 	}
 	_fputtc(_T('\n'), stdout);
 
+	if (verify) {
+		// Combined report.
+		_tprintf(_T("%u/%u content(s) verified successfully.\n"),
+			verified_ok, static_cast<unsigned int>(entries.size()));
+		if (ret != 0) {
+			_tprintf(_T("*** %u content(s) failed verification.\n"),
+				static_cast<unsigned int>(entries.size()) - verified_ok);
+		}
+		_fputtc(_T('\n'), stdout);
+	}
+
 	return ret;
 }
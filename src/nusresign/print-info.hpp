@@ -24,11 +24,18 @@ extern "C" {
 
 /**
  * 'info' command.
+ *
+ * If verify is true, contents are verified in parallel using a pool of
+ * worker threads. Reads are limited to io_jobs at a time across all
+ * threads; use 1 for hard drives and higher values for SSDs.
+ *
  * @param nus_dir	[in] NUS directory.
- * @param verify	[in] If true, verify the contents. [TODO]
+ * @param verify	[in] If true, verify the contents.
+ * @param threads	[in] Number of threads for verifying contents. (0 for auto)
+ * @param io_jobs	[in] Maximum number of concurrent reads for verifying contents. (0 for default)
  * @return 0 on success; negative POSIX error code or positive ID code on error.
  */
-int print_nus_info(const TCHAR *nus_dir, bool verify);
+int print_nus_info(const TCHAR *nus_dir, bool verify, unsigned int threads, unsigned int io_jobs);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,304 @@
+/***************************************************************************
+ * RVT-H Tool: NUS Resigner                                                *
+ * resign-batch.cpp: Re-sign multiple NUS directories in parallel.         *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "resign-batch.hpp"
+#include "resign-nus.hpp"
+
+// libwiicrypto
+#include "libwiicrypto/common.h"
+
+// C includes
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#  include <windows.h>
+#else /* !_WIN32 */
+#  include <dirent.h>
+#endif /* _WIN32 */
+
+// C++ includes
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+using std::tstring;
+using std::vector;
+
+/**
+ * Shared state for all worker threads.
+ */
+struct ResignBatchState {
+	const vector<tstring> *nus_dirs;
+	int recrypt_key;
+
+	std::atomic<size_t> next_job;	// Index of the next job to start
+
+	// Status output.
+	// Status lines are printed while holding this lock,
+	// so lines for different titles aren't interleaved.
+	std::mutex output_lock;
+	unsigned int done;	// Number of jobs finished
+	unsigned int skipped;	// Number of jobs that were already signed
+	unsigned int failed;	// Number of jobs that failed
+};
+
+/**
+ * Check if a path is a directory.
+ * Symbolic links are not followed.
+ * @param path Path
+ * @return True if it's a directory; false if not.
+ */
+static bool is_directory(const TCHAR *path)
+{
+#ifdef _WIN32
+	const DWORD dwAttrs = GetFileAttributes(path);
+	return (dwAttrs != INVALID_FILE_ATTRIBUTES &&
+		(dwAttrs & FILE_ATTRIBUTE_DIRECTORY) &&
+		!(dwAttrs & FILE_ATTRIBUTE_REPARSE_POINT));
+#else /* !_WIN32 */
+	struct stat sbuf;
+	if (lstat(path, &sbuf) != 0)
+		return false;
+	return S_ISDIR(sbuf.st_mode);
+#endif /* _WIN32 */
+}
+
+/**
+ * Check if a file exists and is a regular file.
+ * @param path Path
+ * @return True if it is; false if not.
+ */
+static bool is_file(const tstring &path)
+{
+#ifdef _WIN32
+	const DWORD dwAttrs = GetFileAttributes(path.c_str());
+	return (dwAttrs != INVALID_FILE_ATTRIBUTES && !(dwAttrs & FILE_ATTRIBUTE_DIRECTORY));
+#else /* !_WIN32 */
+	struct stat sbuf;
+	if (stat(path.c_str(), &sbuf) != 0)
+		return false;
+	return S_ISREG(sbuf.st_mode);
+#endif /* _WIN32 */
+}
+
+/**
+ * Search a directory tree for NUS directories.
+ * NUS directories are not searched any further.
+ * @param dir		[in] Directory
+ * @param nus_dirs	[out] List of NUS directories
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int find_nus_directories(const tstring &dir, vector<tstring> &nus_dirs)
+{
+	tstring prefix(dir);
+	if (!prefix.empty() && prefix[prefix.size()-1] != DIR_SEP_CHR
+#ifdef _WIN32
+	    && prefix[prefix.size()-1] != _T('/')
+#endif /* _WIN32 */
+	    )
+	{
+		prefix += DIR_SEP_CHR;
+	}
+
+	if (is_file(prefix + _T("title.tik")) && is_file(prefix + _T("title.tmd"))) {
+		// This is an NUS directory.
+		nus_dirs.emplace_back(dir);
+		return 0;
+	}
+
+	vector<tstring> subdirs;
+#ifdef _WIN32
+	WIN32_FIND_DATA ffd;
+	HANDLE hFind = FindFirstFile((prefix + _T('*')).c_str(), &ffd);
+	if (hFind == INVALID_HANDLE_VALUE) {
+		return -ENOENT;
+	}
+	do {
+		if (!(ffd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ||
+		    (ffd.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+		{
+			continue;
+		}
+		if (!_tcscmp(ffd.cFileName, _T(".")) || !_tcscmp(ffd.cFileName, _T("..")))
+			continue;
+		subdirs.emplace_back(prefix + ffd.cFileName);
+	} while (FindNextFile(hFind, &ffd));
+	FindClose(hFind);
+#else /* !_WIN32 */
+	DIR *const pDir = opendir(dir.c_str());
+	if (!pDir) {
+		int err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		return -err;
+	}
+	const struct dirent *d;
+	while ((d = readdir(pDir)) != nullptr) {
+		if (!strcmp(d->d_name, ".") || !strcmp(d->d_name, ".."))
+			continue;
+		tstring subdir = prefix + d->d_name;
+		if (is_directory(subdir.c_str())) {
+			subdirs.emplace_back(std::move(subdir));
+		}
+	}
+	closedir(pDir);
+#endif /* _WIN32 */
+
+	std::sort(subdirs.begin(), subdirs.end());
+	for (const tstring &subdir : subdirs) {
+		int ret = find_nus_directories(subdir, nus_dirs);
+		if (ret != 0) {
+			return ret;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Worker thread.
+ * @param state Shared state
+ */
+static void resign_thread(ResignBatchState *state)
+{
+	const vector<tstring> &nus_dirs = *state->nus_dirs;
+	const unsigned int total = static_cast<unsigned int>(nus_dirs.size());
+
+	while (true) {
+		const size_t idx = state->next_job.fetch_add(1);
+		if (idx >= nus_dirs.size())
+			break;
+		const tstring &nus_dir = nus_dirs[idx];
+
+		// Errors are captured so they can be printed
+		// along with this title's status line.
+		FILE *f_err = tmpfile();
+		const int ret = resign_nus_ex(nus_dir.c_str(), state->recrypt_key,
+			true, (f_err ? f_err : stderr));
+
+		std::lock_guard<std::mutex> lock(state->output_lock);
+		state->done++;
+		if (ret == 0) {
+			_tprintf(_T("[%u/%u] OK: %s\n"), state->done, total, nus_dir.c_str());
+		} else if (ret == RESIGN_NUS_ALREADY_SIGNED) {
+			state->skipped++;
+			_tprintf(_T("[%u/%u] SKIPPED: %s (already signed)\n"), state->done, total, nus_dir.c_str());
+		} else {
+			state->failed++;
+			if (ret < 0) {
+				_tprintf(_T("[%u/%u] FAILED: %s (%s)\n"), state->done, total,
+					nus_dir.c_str(), _tcserror(-ret));
+			} else {
+				_tprintf(_T("[%u/%u] FAILED: %s (error %d)\n"), state->done, total,
+					nus_dir.c_str(), ret);
+			}
+		}
+		fflush(stdout);
+
+		if (f_err) {
+			// Print the captured errors and warnings.
+			TCHAR buf[1024];
+			rewind(f_err);
+			while (_fgetts(buf, ARRAY_SIZE(buf), f_err)) {
+				_fputts(buf, stderr);
+			}
+			fflush(stderr);
+			fclose(f_err);
+		}
+	}
+}
+
+/**
+ * 'resign-batch' command.
+ *
+ * Each source is searched recursively for NUS directories, i.e.
+ * directories that contain both title.tik and title.tmd.
+ * (NUS directories themselves are not searched any further.)
+ * Symbolic links to directories are not followed.
+ *
+ * NUS directories are resigned in place and in parallel. Titles whose
+ * ticket and TMD are already signed with recrypt_key are skipped.
+ * A status line is printed for each title as it finishes,
+ * followed by a summary.
+ *
+ * @param sources	[in] Sources.
+ * @param source_count	[in] Number of sources.
+ * @param recrypt_key	[in] Key for recryption. (-1 for default)
+ * @param threads	[in] Number of worker threads. (0 for auto)
+ * @return 0 if all NUS directories were resigned or skipped; non-zero on error.
+ */
+int resign_nus_batch(TCHAR *const *sources, int source_count, int recrypt_key, unsigned int threads)
+{
+	// Find the NUS directories.
+	vector<tstring> nus_dirs;
+	for (int i = 0; i < source_count; i++) {
+		const TCHAR *const source = sources[i];
+		int ret;
+		if (!is_directory(source)) {
+			ret = -ENOTDIR;
+		} else {
+			ret = find_nus_directories(source, nus_dirs);
+		}
+		if (ret != 0) {
+			_ftprintf(stderr, _T("*** ERROR reading '%s': %s\n"), source, _tcserror(-ret));
+			return ret;
+		}
+	}
+	if (nus_dirs.empty()) {
+		_fputts(_T("*** ERROR: No NUS directories were found.\n"), stderr);
+		return -ENOENT;
+	}
+
+	// The same directory may have been specified more than once.
+	std::sort(nus_dirs.begin(), nus_dirs.end());
+	nus_dirs.erase(std::unique(nus_dirs.begin(), nus_dirs.end()), nus_dirs.end());
+
+	// Resigning is mostly I/O, so use all CPUs by default.
+	if (threads == 0) {
+		threads = std::thread::hardware_concurrency();
+		if (threads == 0) {
+			threads = 1;
+		}
+	}
+	threads = std::min(threads, static_cast<unsigned int>(nus_dirs.size()));
+
+	_tprintf(_T("Resigning %u NUS directories using %u thread(s)...\n"),
+		static_cast<unsigned int>(nus_dirs.size()), threads);
+	fflush(stdout);
+
+	ResignBatchState state;
+	state.nus_dirs = &nus_dirs;
+	state.recrypt_key = recrypt_key;
+	state.next_job = 0;
+	state.done = 0;
+	state.skipped = 0;
+	state.failed = 0;
+
+	const auto start = std::chrono::steady_clock::now();
+	vector<std::thread> workers;
+	workers.reserve(threads);
+	for (unsigned int i = 0; i < threads; i++) {
+		workers.emplace_back(resign_thread, &state);
+	}
+	for (std::thread &worker : workers) {
+		worker.join();
+	}
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	_tprintf(_T("\n%u/%u NUS directories resigned, %u skipped, %u failed, in %.1f s.\n"),
+		state.done - state.skipped - state.failed, static_cast<unsigned int>(nus_dirs.size()),
+		state.skipped, state.failed, elapsed.count());
+	return (state.failed == 0 ? 0 : EXIT_FAILURE);
+}
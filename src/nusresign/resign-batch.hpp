@@ -0,0 +1,43 @@
+/***************************************************************************
+ * RVT-H Tool: NUS Resigner                                                *
+ * resign-batch.hpp: Re-sign multiple NUS directories in parallel.         *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_NUSRESIGN_RESIGN_BATCH_HPP__
+#define __RVTHTOOL_NUSRESIGN_RESIGN_BATCH_HPP__
+
+#include "tcharx.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 'resign-batch' command.
+ *
+ * Each source is searched recursively for NUS directories, i.e.
+ * directories that contain both title.tik and title.tmd.
+ * (NUS directories themselves are not searched any further.)
+ * Symbolic links to directories are not followed.
+ *
+ * NUS directories are resigned in place and in parallel. Titles whose
+ * ticket and TMD are already signed with recrypt_key are skipped.
+ * A status line is printed for each title as it finishes,
+ * followed by a summary.
+ *
+ * @param sources	[in] Sources.
+ * @param source_count	[in] Number of sources.
+ * @param recrypt_key	[in] Key for recryption. (-1 for default)
+ * @param threads	[in] Number of worker threads. (0 for auto)
+ * @return 0 if all NUS directories were resigned or skipped; non-zero on error.
+ */
+int resign_nus_batch(TCHAR *const *sources, int source_count, int recrypt_key, unsigned int threads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_NUSRESIGN_RESIGN_BATCH_HPP__ */
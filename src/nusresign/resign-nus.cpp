@@ -2,7 +2,7 @@
  * RVT-H Tool: NUS Resigner                                                *
  * resign-nus.cpp: Re-sign an NUS directory. (Wii U)                       *
  *                                                                         *
- * Copyright (c) 2018-2022 by David Korth.                                 *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
@@ -20,16 +20,19 @@
 // C includes
 #include <assert.h>
 #include <errno.h>
+#include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 // C++ includes
-#include <memory>
 #include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
 using std::tstring;
-using std::unique_ptr;
+using std::vector;
 
 /**
  * Update the certs at the end of the ticket or TMD, if present.
@@ -123,92 +126,178 @@ static void updateExtraCerts(uint8_t *data, size_t size, bool isTMD, RVL_PKI pki
 }
 
 /**
- * 'resign' command.
- * @param nus_dir	[in] NUS directory.
- * @param recrypt_key	[in] Key for recryption. (-1 for default)
- * @return 0 on success; negative POSIX error code or positive ID code on error.
+ * Print an informational message to stdout.
+ * @param quiet	[in] If true, nothing is printed.
+ * @param fmt	[in] Format string.
+ * @param ...	[in] Arguments.
  */
-int resign_nus(const TCHAR *nus_dir, int recrypt_key)
+static void info_printf(bool quiet, const TCHAR *fmt, ...)
 {
-	// Print the NUS information.
-	// TODO: Should we verify the hashes?
-	int ret = print_nus_info(nus_dir, false);
-	if (ret != 0) {
-		// Error printing the NUS information.
-		return ret;
-	}
-
-	// Construct the filenames.
-	tstring sf_tik = nus_dir;
-	sf_tik += DIR_SEP_CHR;
-	sf_tik += _T("title.tik");
+	if (quiet)
+		return;
 
-	tstring sf_tmd = nus_dir;
-	sf_tmd += DIR_SEP_CHR;
-	sf_tmd += _T("title.tmd");
+	va_list ap;
+	va_start(ap, fmt);
+	_vtprintf(fmt, ap);
+	va_end(ap);
+}
 
-	// Open the ticket and TMD.
-	FILE *f_tik = _tfopen(sf_tik.c_str(), _T("rb+"));
-	if (!f_tik) {
+/**
+ * Read a ticket or TMD file.
+ * @param filename	[in] Filename.
+ * @param min_size	[in] Minimum size.
+ * @param max_size	[in] Maximum size.
+ * @param desc		[in] Description for error messages. ("ticket" or "TMD")
+ * @param data		[out] File data.
+ * @param f_err		[in] FILE* to print errors to.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int read_title_file(const tstring &filename, size_t min_size, size_t max_size,
+	const TCHAR *desc, vector<uint8_t> &data, FILE *f_err)
+{
+	FILE *const f = _tfopen(filename.c_str(), _T("rb"));
+	if (!f) {
 		int err = errno;
 		if (err == 0) {
 			err = EIO;
 		}
-		_ftprintf(stderr, _T("*** ERROR opening ticket file: %s\n"), _tcserror(err));
+		_ftprintf(f_err, _T("*** ERROR opening %s file: %s\n"), desc, _tcserror(err));
 		return -err;
 	}
 
-	FILE *f_tmd = _tfopen(sf_tmd.c_str(), _T("rb+"));
-	if (!f_tmd) {
-		fclose(f_tik);
+	fseeko(f, 0, SEEK_END);
+	const size_t size = ftello(f);
+	if (size < min_size) {
+		fclose(f);
+		_ftprintf(f_err, _T("*** ERROR reading %s file: Too small.\n"), desc);
+		return -EIO;
+	} else if (size > max_size) {
+		fclose(f);
+		_ftprintf(f_err, _T("*** ERROR reading %s file: Too big.\n"), desc);
+		return -EIO;
+	}
+	rewind(f);
+
+	data.resize(size);
+	errno = 0;
+	const size_t ret = fread(data.data(), 1, size, f);
+	int err = (errno != 0 ? errno : EIO);
+	fclose(f);
+	if (ret != size) {
+		_ftprintf(f_err, _T("*** ERROR reading %s file: %s\n"), desc, _tcserror(err));
+		return -err;
+	}
+	return 0;
+}
 
+/**
+ * Write a file to a temporary file in the same directory.
+ * Use commit_title_file() to replace the original file.
+ * @param filename	[in] Filename.
+ * @param data		[in] File data.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int write_title_file_tmp(const tstring &filename, const vector<uint8_t> &data)
+{
+	const tstring tmp_filename = filename + _T(".tmp");
+	errno = 0;
+	FILE *const f = _tfopen(tmp_filename.c_str(), _T("wb"));
+	if (!f) {
 		int err = errno;
 		if (err == 0) {
 			err = EIO;
 		}
-		_ftprintf(stderr, _T("*** ERROR opening TMD file: %s\n"), _tcserror(err));
 		return -err;
 	}
 
-	// Get the ticket and TMD sizes.
-	fseeko(f_tik, 0, SEEK_END);
-	const size_t tik_size = ftello(f_tik);
-	if (tik_size < sizeof(WUP_Ticket)) {
-		fclose(f_tik);
-		fclose(f_tmd);
-		_fputts(_T("*** ERROR reading ticket file: Too small.\n"), stderr);
-		return -EIO;
-	} else if (tik_size > (64*1024)) {
-		fclose(f_tik);
-		fclose(f_tmd);
-		_fputts(_T("*** ERROR reading ticket file: Too big.\n"), stderr);
-		return -EIO;
+	int err = 0;
+	if (fwrite(data.data(), 1, data.size(), f) != data.size()) {
+		err = (errno != 0 ? errno : EIO);
 	}
-	fseeko(f_tmd, 0, SEEK_END);
-	const size_t tmd_size = ftello(f_tmd);
-	if (tmd_size < (sizeof(WUP_TMD_Header) + sizeof(WUP_TMD_ContentInfoTable))) {
-		fclose(f_tik);
-		fclose(f_tmd);
-		_fputts(_T("*** ERROR reading TMD file: Too small.\n"), stderr);
-		return -EIO;
-	} else if (tmd_size > (128*1024)) {
-		fclose(f_tik);
-		fclose(f_tmd);
-		_fputts(_T("*** ERROR reading TMD file: Too big.\n"), stderr);
-		return -EIO;
+	if (fclose(f) != 0 && err == 0) {
+		err = (errno != 0 ? errno : EIO);
+	}
+	if (err != 0) {
+		_tremove(tmp_filename.c_str());
+		return -err;
 	}
-	rewind(f_tik);
-	rewind(f_tmd);
+	return 0;
+}
 
-	// Read the ticket and TMD.
-	// TODO: Check for errors?
-	unique_ptr<uint8_t[]> tik_data(new uint8_t[tik_size]);
-	fread(tik_data.get(), 1, tik_size, f_tik);
-	WUP_Ticket *const pTicket = reinterpret_cast<WUP_Ticket*>(tik_data.get());
+/**
+ * Replace a file with the temporary file written by write_title_file_tmp().
+ * @param filename	[in] Filename.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int commit_title_file(const tstring &filename)
+{
+	const tstring tmp_filename = filename + _T(".tmp");
+#ifdef _WIN32
+	// rename() doesn't replace existing files on Windows.
+	_tremove(filename.c_str());
+#endif /* _WIN32 */
+	if (_trename(tmp_filename.c_str(), filename.c_str()) != 0) {
+		const int err = (errno != 0 ? errno : EIO);
+		_tremove(tmp_filename.c_str());
+		return -err;
+	}
+	return 0;
+}
+
+/**
+ * 'resign' command. (extended version)
+ * This function is thread-safe, so multiple NUS directories can be resigned at once.
+ *
+ * The new ticket, TMD, and title.cert are written to temporary files,
+ * which replace the original files once all of them have been written.
+ *
+ * @param nus_dir	[in] NUS directory.
+ * @param recrypt_key	[in] Key for recryption. (-1 for default)
+ * @param quiet		[in] If true, don't print the NUS information or progress messages.
+ * @param f_err		[in] FILE* to print errors and warnings to.
+ * @return 0 on success; RESIGN_NUS_ALREADY_SIGNED if the ticket and TMD already
+ *         use recrypt_key; negative POSIX error code or positive ID code on error.
+ */
+int resign_nus_ex(const TCHAR *nus_dir, int recrypt_key, bool quiet, FILE *f_err)
+{
+	if (!quiet) {
+		// Print the NUS information.
+		// TODO: Should we verify the hashes?
+		int ret = print_nus_info(nus_dir, false, 0, 0);
+		if (ret != 0) {
+			// Error printing the NUS information.
+			return ret;
+		}
+	}
+
+	// Construct the filenames.
+	tstring sf_tik = nus_dir;
+	sf_tik += DIR_SEP_CHR;
+	sf_tik += _T("title.tik");
 
-	unique_ptr<uint8_t[]> tmd_data(new uint8_t[tmd_size]);
-	fread(tmd_data.get(), 1, tmd_size, f_tmd);
-	WUP_TMD_Header *const pTmdHeader = reinterpret_cast<WUP_TMD_Header*>(tmd_data.get());
+	tstring sf_tmd = nus_dir;
+	sf_tmd += DIR_SEP_CHR;
+	sf_tmd += _T("title.tmd");
+
+	tstring sf_cert = nus_dir;
+	sf_cert += DIR_SEP_CHR;
+	sf_cert += _T("title.cert");
+
+	// Read the ticket and TMD.
+	vector<uint8_t> tik_data, tmd_data;
+	int ret = read_title_file(sf_tik, sizeof(WUP_Ticket), 64*1024, _T("ticket"), tik_data, f_err);
+	if (ret != 0) {
+		return ret;
+	}
+	ret = read_title_file(sf_tmd, sizeof(WUP_TMD_Header) + sizeof(WUP_TMD_ContentInfoTable),
+		128*1024, _T("TMD"), tmd_data, f_err);
+	if (ret != 0) {
+		return ret;
+	}
+	const size_t tik_size = tik_data.size();
+	const size_t tmd_size = tmd_data.size();
+	WUP_Ticket *const pTicket = reinterpret_cast<WUP_Ticket*>(tik_data.data());
+	WUP_TMD_Header *const pTmdHeader = reinterpret_cast<WUP_TMD_Header*>(tmd_data.data());
 
 	// Check the encryption key.
 	// NOTE: Not checking the TMD key. Assuming it's the same as Ticket.
@@ -227,7 +316,7 @@ int resign_nus(const TCHAR *nus_dir, int recrypt_key)
 			s_fromKey = _T("debug");
 			break;
 		default:
-			_fputts(_T("*** ERROR: NUS ticket has an unknown issuer.\n"), stderr);
+			_fputts(_T("*** ERROR: NUS ticket has an unknown issuer.\n"), f_err);
 			return 1;
 	}
 
@@ -237,12 +326,6 @@ int resign_nus(const TCHAR *nus_dir, int recrypt_key)
 		recrypt_key = (src_key == RVL_CryptoType_Retail)
 			? RVL_CryptoType_Debug
 			: RVL_CryptoType_Retail;
-	} else {
-		// If the specified key matches the current key, fail.
-		if (recrypt_key == src_key) {
-			_fputts(_T("*** ERROR: Cannot recrypt to the same key.\n"), stderr);
-			return 2;
-		}
 	}
 
 	// Determine the new issuers.
@@ -278,7 +361,20 @@ int resign_nus(const TCHAR *nus_dir, int recrypt_key)
 	s_issuer_xs = RVL_Cert_Issuers[issuer_xs];
 	s_issuer_cp = RVL_Cert_Issuers[issuer_cp];
 
-	_tprintf(_T("Converting NUS from %s to %s...\n"), s_fromKey, s_toKey);
+	// If the specified key matches the current key, fail.
+	if (recrypt_key == src_key) {
+		if (!strncmp(pTicket->issuer, s_issuer_xs, sizeof(pTicket->issuer)) &&
+		    !strncmp(pTmdHeader->rvl.issuer, s_issuer_cp, sizeof(pTmdHeader->rvl.issuer)))
+		{
+			// Ticket and TMD are both signed with the new key.
+			// Nothing to do here. The caller decides if this is an error.
+			return RESIGN_NUS_ALREADY_SIGNED;
+		}
+		_fputts(_T("*** ERROR: Cannot recrypt to the same key.\n"), f_err);
+		return 2;
+	}
+
+	info_printf(quiet, _T("Converting NUS from %s to %s...\n"), s_fromKey, s_toKey);
 
 	/** Ticket fixups **/
 
@@ -288,28 +384,24 @@ int resign_nus(const TCHAR *nus_dir, int recrypt_key)
 		case 0x10004:
 			break;
 		case 0x30004:
-			_fputts(_T("*** Changing ticket signature type from Disc to Installable.\n"), stdout);
+			info_printf(quiet, _T("*** Changing ticket signature type from Disc to Installable.\n"));
 			pTicket->signature_type = cpu_to_be32(0x10004);
 			break;
 		default:
-			_ftprintf(stderr, _T("*** ERROR: Ticket has unsupported signature type: 0x%08X\n"),
+			_ftprintf(f_err, _T("*** ERROR: Ticket has unsupported signature type: 0x%08X\n"),
 				be32_to_cpu(pTicket->signature_type));
-			fclose(f_tik);
-			fclose(f_tmd);
 			return 4;
 	}
 	switch (be32_to_cpu(pTmdHeader->rvl.signature_type)) {
 		case 0x10004:
 			break;
 		case 0x30004:
-			_fputts(_T("*** Changing TMD signature type from Disc to Installable.\n"), stdout);
+			info_printf(quiet, _T("*** Changing TMD signature type from Disc to Installable.\n"));
 			pTmdHeader->rvl.signature_type = cpu_to_be32(0x10004);
 			break;
 		default:
-			_ftprintf(stderr, _T("*** ERROR: TMD has unsupported signature type: 0x%08X\n"),
+			_ftprintf(f_err, _T("*** ERROR: TMD has unsupported signature type: 0x%08X\n"),
 				be32_to_cpu(pTmdHeader->rvl.signature_type));
-			fclose(f_tik);
-			fclose(f_tmd);
 			return 5;
 	}
 
@@ -337,22 +429,22 @@ int resign_nus(const TCHAR *nus_dir, int recrypt_key)
 	// Re-encrypt the ticket.
 	sig_recrypt_ticket_WUP(pTicket, toKey);
 
-	// Update the extra certs in the ticket and TMD, if present.
-	// TODO: PKI selection.
-	updateExtraCerts(tik_data.get(), tik_size, false, toPki);
-	updateExtraCerts(tmd_data.get(), tmd_size, true, toPki);
-
-	// Set the new issuers.
-	strncpy(pTicket->issuer, s_issuer_xs, sizeof(pTicket->issuer));
-	strncpy(pTmdHeader->rvl.issuer, s_issuer_cp, sizeof(pTmdHeader->rvl.issuer));
-
 	// Re-sign the ticket and TMD.
+	// The ticket and TMD don't share any data, so the TMD is signed
+	// on a worker thread while the ticket is signed on this thread.
 	// NOTE: TMD signature only covers the TMD header.
-	if (toPki == WUP_PKI_DPKI) {
-		// dpki: Use the real private keys.
-		cert_realsign_ticketOrTMD(tik_data.get(), sizeof(*pTicket), &rvth_privkey_WUP_dpki_ticket);
-		cert_realsign_ticketOrTMD(tmd_data.get(), sizeof(*pTmdHeader), &rvth_privkey_WUP_dpki_tmd);
-	} else /*if (toPki == WUP_PKI_PPKI)*/ {
+	// TODO: PKI selection.
+	auto resign_ticket = [&]() {
+		// Update the extra certs, if present, and set the new issuer.
+		updateExtraCerts(tik_data.data(), tik_size, false, toPki);
+		strncpy(pTicket->issuer, s_issuer_xs, sizeof(pTicket->issuer));
+
+		if (toPki == WUP_PKI_DPKI) {
+			// dpki: Use the real private key.
+			cert_realsign_ticketOrTMD(tik_data.data(), sizeof(*pTicket), &rvth_privkey_WUP_dpki_ticket);
+			return;
+		}
+
 		// ppki: Fill the signature area with 0xD15EA5ED.
 		// Also fill the ticket's ECDH area with 0xFEEDFACE.
 		// This matches FunKiiU.
@@ -363,62 +455,110 @@ int resign_nus(const TCHAR *nus_dir, int recrypt_key)
 			p[2] = 0xD15EA5ED;
 			p[3] = 0xD15EA5ED;
 		}
-		p = reinterpret_cast<uint32_t*>(pTmdHeader->rvl.signature);
+		p = reinterpret_cast<uint32_t*>(pTicket->ecdh_data);
+		for (unsigned int i = sizeof(pTicket->ecdh_data)/sizeof(uint32_t); i > 0; i--, p++) {
+			*p = 0xFEEDFACE;
+		}
+	};
+	auto resign_tmd = [&]() {
+		// Update the extra certs, if present, and set the new issuer.
+		updateExtraCerts(tmd_data.data(), tmd_size, true, toPki);
+		strncpy(pTmdHeader->rvl.issuer, s_issuer_cp, sizeof(pTmdHeader->rvl.issuer));
+
+		if (toPki == WUP_PKI_DPKI) {
+			// dpki: Use the real private key.
+			cert_realsign_ticketOrTMD(tmd_data.data(), sizeof(*pTmdHeader), &rvth_privkey_WUP_dpki_tmd);
+			return;
+		}
+
+		// ppki: Fill the signature area with 0xD15EA5ED.
+		uint32_t *p = reinterpret_cast<uint32_t*>(pTmdHeader->rvl.signature);
 		for (unsigned int i = sizeof(pTmdHeader->rvl.signature)/sizeof(uint32_t)/4; i > 0; i--, p += 4) {
 			p[0] = 0xD15EA5ED;
 			p[1] = 0xD15EA5ED;
 			p[2] = 0xD15EA5ED;
 			p[3] = 0xD15EA5ED;
 		}
-		p = reinterpret_cast<uint32_t*>(pTicket->ecdh_data);
-		for (unsigned int i = sizeof(pTicket->ecdh_data)/sizeof(uint32_t); i > 0; i--, p++) {
-			*p = 0xFEEDFACE;
-		}
-	}
-
-	// Write the new ticket and TMD.
-	rewind(f_tik);
-	rewind(f_tmd);
-	fwrite(tik_data.get(), 1, tik_size, f_tik);
-	fwrite(tmd_data.get(), 1, tmd_size, f_tmd);
-	fclose(f_tik);
-	fclose(f_tmd);
+	};
 
-	// Write title.cert.
-	tstring sf_cert = nus_dir;
-	sf_cert += DIR_SEP_CHR;
-	sf_cert += _T("title.cert");
-	FILE *f_cert = _tfopen(sf_cert.c_str(), _T("wb"));
-	if (!f_cert) {
-		int err = errno;
-		if (err == 0) {
-			err = EIO;
+	std::thread tmd_thread;
+	if (toPki == WUP_PKI_DPKI) {
+		// Only real signatures are worth a thread.
+		try {
+			tmd_thread = std::thread(resign_tmd);
+		} catch (const std::system_error&) {
+			// Unable to start a thread.
+			// The TMD will be signed on this thread.
 		}
-		_ftprintf(stderr, _T("*** ERROR: Unable to write title.cert: %s\n"), _tcserror(err));
-		return -err;
+	}
+	resign_ticket();
+	if (tmd_thread.joinable()) {
+		tmd_thread.join();
+	} else {
+		resign_tmd();
 	}
 
+	// Build title.cert.
 	// Certificate order: CA, CP, XS, SP (dev only)
-	const RVL_Cert *cert_data = cert_get(issuer_ca);
-	size_t cert_size = cert_get_size(issuer_ca);
-	fwrite(cert_data, 1, cert_size, f_cert);
-
-	cert_data = cert_get(issuer_cp);
-	cert_size = cert_get_size(issuer_cp);
-	fwrite(cert_data, 1, cert_size, f_cert);
-
-	cert_data = cert_get(issuer_xs);
-	cert_size = cert_get_size(issuer_xs);
-	fwrite(cert_data, 1, cert_size, f_cert);
-
-	if (issuer_sp != RVL_CERT_ISSUER_UNKNOWN) {
-		cert_data = cert_get(issuer_sp);
-		cert_size = cert_get_size(issuer_sp);
-		fwrite(cert_data, 1, cert_size, f_cert);
+	vector<uint8_t> cert_data;
+	const RVL_Cert_Issuer cert_issuers[] = {issuer_ca, issuer_cp, issuer_xs, issuer_sp};
+	for (RVL_Cert_Issuer issuer : cert_issuers) {
+		if (issuer == RVL_CERT_ISSUER_UNKNOWN)
+			continue;
+		const uint8_t *const pCert = reinterpret_cast<const uint8_t*>(cert_get(issuer));
+		cert_data.insert(cert_data.end(), pCert, pCert + cert_get_size(issuer));
 	}
 
-	fclose(f_cert);
+	// Write the new ticket, TMD, and title.cert to temporary files.
+	// The original files are only replaced once all of them are written,
+	// so an interrupted resign doesn't leave a mismatched title.
+	struct {
+		const tstring *filename;
+		const vector<uint8_t> *data;
+	} const outputs[] = {
+		{&sf_tik, &tik_data},
+		{&sf_tmd, &tmd_data},
+		{&sf_cert, &cert_data},
+	};
+	for (size_t i = 0; i < ARRAY_SIZE(outputs); i++) {
+		ret = write_title_file_tmp(*outputs[i].filename, *outputs[i].data);
+		if (ret != 0) {
+			_ftprintf(f_err, _T("*** ERROR writing '%s': %s\n"),
+				outputs[i].filename->c_str(), _tcserror(-ret));
+			for (size_t j = 0; j < i; j++) {
+				_tremove((*outputs[j].filename + _T(".tmp")).c_str());
+			}
+			return ret;
+		}
+	}
+	for (size_t i = 0; i < ARRAY_SIZE(outputs); i++) {
+		ret = commit_title_file(*outputs[i].filename);
+		if (ret != 0) {
+			_ftprintf(f_err, _T("*** ERROR writing '%s': %s\n"),
+				outputs[i].filename->c_str(), _tcserror(-ret));
+			for (size_t j = i + 1; j < ARRAY_SIZE(outputs); j++) {
+				_tremove((*outputs[j].filename + _T(".tmp")).c_str());
+			}
+			return ret;
+		}
+	}
 
-	_fputts(_T("NUS resigning complete.\n"), stdout);
+	info_printf(quiet, _T("NUS resigning complete.\n"));
 	return 0;
 }
+
+/**
+ * 'resign' command.
+ * @param nus_dir	[in] NUS directory.
+ * @param recrypt_key	[in] Key for recryption. (-1 for default)
+ * @return 0 on success; negative POSIX error code or positive ID code on error.
+ */
+int resign_nus(const TCHAR *nus_dir, int recrypt_key)
+{
+	int ret = resign_nus_ex(nus_dir, recrypt_key, false, stderr);
+	if (ret == RESIGN_NUS_ALREADY_SIGNED) {
+		_fputts(_T("*** ERROR: Cannot recrypt to the same key.\n"), stderr);
+		ret = 2;
+	}
+	return ret;
+}
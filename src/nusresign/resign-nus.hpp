@@ -1,16 +1,18 @@
 /***************************************************************************
- * RVT-H Tool: WAD Resigner                                                *
- * resign-wad.hpp: Re-sign a WAD file.                                     *
+ * RVT-H Tool: NUS Resigner                                                *
+ * resign-nus.hpp: Re-sign an NUS directory. (Wii U)                       *
  *                                                                         *
- * Copyright (c) 2018-2020 by David Korth.                                 *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
 #ifndef __RVTHTOOL_NUSRESIGN_RESIGN_NUS_HPP__
 #define __RVTHTOOL_NUSRESIGN_RESIGN_NUS_HPP__
 
+#include "stdboolx.h"
 #include "tcharx.h"
 #include <stdint.h>
+#include <stdio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -24,6 +26,25 @@ extern "C" {
  */
 int resign_nus(const TCHAR *nus_dir, int recrypt_key);
 
+// resign_nus_ex(): The ticket and TMD are already signed with the requested key.
+#define RESIGN_NUS_ALREADY_SIGNED 6
+
+/**
+ * 'resign' command. (extended version)
+ * This function is thread-safe, so multiple NUS directories can be resigned at once.
+ *
+ * The new ticket, TMD, and title.cert are written to temporary files,
+ * which replace the original files once all of them have been written.
+ *
+ * @param nus_dir	[in] NUS directory.
+ * @param recrypt_key	[in] Key for recryption. (-1 for default)
+ * @param quiet		[in] If true, don't print the NUS information or progress messages.
+ * @param f_err		[in] FILE* to print errors and warnings to.
+ * @return 0 on success; RESIGN_NUS_ALREADY_SIGNED if the ticket and TMD already
+ *         use recrypt_key; negative POSIX error code or positive ID code on error.
+ */
+int resign_nus_ex(const TCHAR *nus_dir, int recrypt_key, bool quiet, FILE *f_err);
+
 #ifdef __cplusplus
 }
 #endif
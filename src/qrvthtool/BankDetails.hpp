@@ -0,0 +1,32 @@
+/***************************************************************************
+ * RVT-H Tool (qrvthtool)                                                  *
+ * BankDetails.hpp: Bank details that require reading from the device.     *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_QRVTHTOOL_BANKDETAILS_HPP__
+#define __RVTHTOOL_QRVTHTOOL_BANKDETAILS_HPP__
+
+// Qt includes.
+#include <QtCore/QMetaType>
+
+// Bank details that require reading from the device.
+// These are loaded by BankDetailsWorker on a background thread.
+// Everything else shown in BankEntryView comes from RvtH_BankEntry.
+struct BankDetails {
+	int err;		// listFiles() error code (0 on success; see rvth_error())
+	unsigned int fileCount;	// Number of files in the filesystem, including system files
+	unsigned int dirCount;	// Number of directories in the filesystem
+	quint64 totalSize;	// Total size of all files, in bytes
+
+	BankDetails()
+		: err(0)
+		, fileCount(0)
+		, dirCount(0)
+		, totalSize(0) { }
+};
+Q_DECLARE_METATYPE(BankDetails)
+
+#endif /* __RVTHTOOL_QRVTHTOOL_BANKDETAILS_HPP__ */
@@ -0,0 +1,232 @@
+/***************************************************************************
+ * RVT-H Tool (qrvthtool)                                                  *
+ * BankDetailsLoader.cpp: Cache of bank details loaded in the background.  *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "BankDetailsLoader.hpp"
+#include "BankDetailsWorker.hpp"
+
+// Qt includes
+#include <QtCore/QHash>
+#include <QtCore/QThread>
+
+/** BankDetailsLoaderPrivate **/
+
+class BankDetailsLoaderPrivate
+{
+	public:
+		explicit BankDetailsLoaderPrivate(BankDetailsLoader *q);
+		~BankDetailsLoaderPrivate();
+
+	protected:
+		BankDetailsLoader *const q_ptr;
+		Q_DECLARE_PUBLIC(BankDetailsLoader)
+	private:
+		Q_DISABLE_COPY(BankDetailsLoaderPrivate)
+
+	public:
+		QThread *thread;
+		BankDetailsWorker *worker;
+
+		// Cached details, by bank number.
+		QHash<unsigned int, BankDetails> cache;
+
+		// Serial number for the next request.
+		int nextSerial;
+
+		// Request currently being loaded. (serial is -1 if none)
+		// If the bank is invalidated while loading, the
+		// result is discarded once it arrives.
+		int inFlightSerial;
+		unsigned int inFlightBank;
+		bool inFlightValid;
+
+		// Bank to load once the in-flight request finishes. (-1 if none)
+		int pendingBank;
+
+		/**
+		 * Send a request to the worker.
+		 * @param bank Bank number
+		 */
+		void startLoad(unsigned int bank);
+};
+
+BankDetailsLoaderPrivate::BankDetailsLoaderPrivate(BankDetailsLoader *q)
+	: q_ptr(q)
+	, thread(new QThread(q))
+	, worker(new BankDetailsWorker())
+	, nextSerial(0)
+	, inFlightSerial(-1)
+	, inFlightBank(~0U)
+	, inFlightValid(false)
+	, pendingBank(-1)
+{
+	qRegisterMetaType<BankDetails>();
+
+	thread->setObjectName(QStringLiteral("bankDetailsThread"));
+	worker->setObjectName(QStringLiteral("bankDetailsWorker"));
+	worker->moveToThread(thread);
+	QObject::connect(worker, &BankDetailsWorker::loaded,
+		q, &BankDetailsLoader::worker_loaded);
+	thread->start();
+}
+
+BankDetailsLoaderPrivate::~BankDetailsLoaderPrivate()
+{
+	// Make sure the thread exits.
+	// The current request, if any, is allowed to finish.
+	thread->quit();
+	do {
+		thread->wait(250);
+	} while (thread->isRunning());
+
+	// The thread has exited, so the worker can be deleted directly.
+	delete worker;
+}
+
+/**
+ * Send a request to the worker.
+ * @param bank Bank number
+ */
+void BankDetailsLoaderPrivate::startLoad(unsigned int bank)
+{
+	inFlightSerial = nextSerial++;
+	inFlightBank = bank;
+	inFlightValid = true;
+	QMetaObject::invokeMethod(worker, "load", Qt::QueuedConnection,
+		Q_ARG(unsigned int, bank), Q_ARG(int, inFlightSerial));
+}
+
+/** BankDetailsLoader **/
+
+BankDetailsLoader::BankDetailsLoader(QObject *parent)
+	: super(parent)
+	, d_ptr(new BankDetailsLoaderPrivate(this))
+{ }
+
+BankDetailsLoader::~BankDetailsLoader()
+{
+	Q_D(BankDetailsLoader);
+	delete d;
+}
+
+/**
+ * Set the RVT-H object.
+ * All cached details are discarded.
+ *
+ * If details are currently being loaded from the previous
+ * RVT-H object, this waits for them to finish, so the
+ * previous object can be deleted afterwards.
+ *
+ * @param rvth RVT-H object
+ */
+void BankDetailsLoader::setRvtH(RvtH *rvth)
+{
+	Q_D(BankDetailsLoader);
+	d->worker->setRvtH(rvth);
+	d->cache.clear();
+	d->inFlightValid = false;
+	d->pendingBank = -1;
+}
+
+/**
+ * Get a bank's cached details.
+ * @param bank Bank number
+ * @return Bank details, or nullptr if they haven't been loaded.
+ */
+const BankDetails *BankDetailsLoader::details(unsigned int bank) const
+{
+	Q_D(const BankDetailsLoader);
+	auto iter = d->cache.constFind(bank);
+	return (iter != d->cache.constEnd() ? &(*iter) : nullptr);
+}
+
+/**
+ * Load a bank's details in the background.
+ * detailsLoaded() is emitted once they're available.
+ * Nothing is done if the details are already cached.
+ * @param bank Bank number
+ */
+void BankDetailsLoader::requestDetails(unsigned int bank)
+{
+	Q_D(BankDetailsLoader);
+	if (d->cache.contains(bank)) {
+		// Already loaded.
+		return;
+	}
+
+	if (d->inFlightSerial < 0) {
+		// Worker is idle.
+		d->startLoad(bank);
+	} else if (d->inFlightBank != bank || !d->inFlightValid) {
+		// Load this bank next.
+		// This replaces any bank that was requested earlier.
+		d->pendingBank = static_cast<int>(bank);
+	} else {
+		// This bank is already being loaded.
+		d->pendingBank = -1;
+	}
+}
+
+/**
+ * Discard a bank's cached details.
+ * This should be called if the bank has been modified.
+ * @param bank Bank number
+ */
+void BankDetailsLoader::invalidate(unsigned int bank)
+{
+	Q_D(BankDetailsLoader);
+	d->cache.remove(bank);
+	if (d->inFlightSerial >= 0 && d->inFlightBank == bank) {
+		// The in-flight request may have read old data.
+		d->inFlightValid = false;
+	}
+}
+
+/**
+ * Is a bank's details being loaded?
+ * The worker is using the RVT-H object while this is true.
+ * @return True if a request is in flight; false if the worker is idle.
+ */
+bool BankDetailsLoader::isLoading(void) const
+{
+	Q_D(const BankDetailsLoader);
+	return (d->inFlightSerial >= 0);
+}
+
+/**
+ * Worker object: A bank's details have been loaded.
+ * @param bank Bank number
+ * @param serial Request serial number
+ * @param details Bank details
+ */
+void BankDetailsLoader::worker_loaded(unsigned int bank, int serial, const BankDetails &details)
+{
+	Q_D(BankDetailsLoader);
+	if (serial != d->inFlightSerial) {
+		// Not the in-flight request.
+		return;
+	}
+
+	const bool valid = d->inFlightValid;
+	d->inFlightSerial = -1;
+	d->inFlightValid = false;
+
+	if (d->pendingBank >= 0) {
+		// Start loading the next bank before notifying
+		// listeners, in case they request another bank.
+		const unsigned int next = static_cast<unsigned int>(d->pendingBank);
+		d->pendingBank = -1;
+		if (!d->cache.contains(next) && (next != bank || !valid)) {
+			d->startLoad(next);
+		}
+	}
+
+	if (valid) {
+		d->cache.insert(bank, details);
+		emit detailsLoaded(bank);
+	}
+}
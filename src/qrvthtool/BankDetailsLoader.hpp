@@ -0,0 +1,103 @@
+/***************************************************************************
+ * RVT-H Tool (qrvthtool)                                                  *
+ * BankDetailsLoader.hpp: Cache of bank details loaded in the background.  *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_QRVTHTOOL_BANKDETAILSLOADER_HPP__
+#define __RVTHTOOL_QRVTHTOOL_BANKDETAILSLOADER_HPP__
+
+// librvth
+#include "librvth/rvth.hpp"
+
+#include "BankDetails.hpp"
+
+// Qt includes.
+#include <QtCore/QObject>
+
+/**
+ * Cache of bank details loaded in the background.
+ *
+ * Details are loaded one bank at a time by a BankDetailsWorker.
+ * If several banks are requested while one is loading, only the
+ * most recently requested bank is loaded next, so scrolling through
+ * the bank list on a slow device doesn't build up a backlog.
+ */
+class BankDetailsLoaderPrivate;
+class BankDetailsLoader : public QObject
+{
+	Q_OBJECT
+	typedef QObject super;
+
+	public:
+		explicit BankDetailsLoader(QObject *parent = nullptr);
+		virtual ~BankDetailsLoader();
+
+	protected:
+		BankDetailsLoaderPrivate *const d_ptr;
+		Q_DECLARE_PRIVATE(BankDetailsLoader)
+	private:
+		Q_DISABLE_COPY(BankDetailsLoader)
+
+	public:
+		/**
+		 * Set the RVT-H object.
+		 * All cached details are discarded.
+		 *
+		 * If details are currently being loaded from the previous
+		 * RVT-H object, this waits for them to finish, so the
+		 * previous object can be deleted afterwards.
+		 *
+		 * @param rvth RVT-H object
+		 */
+		void setRvtH(RvtH *rvth);
+
+		/**
+		 * Get a bank's cached details.
+		 * @param bank Bank number
+		 * @return Bank details, or nullptr if they haven't been loaded.
+		 */
+		const BankDetails *details(unsigned int bank) const;
+
+		/**
+		 * Load a bank's details in the background.
+		 * detailsLoaded() is emitted once they're available.
+		 * Nothing is done if the details are already cached.
+		 * @param bank Bank number
+		 */
+		void requestDetails(unsigned int bank);
+
+		/**
+		 * Discard a bank's cached details.
+		 * This should be called if the bank has been modified.
+		 * @param bank Bank number
+		 */
+		void invalidate(unsigned int bank);
+
+		/**
+		 * Is a bank's details being loaded?
+		 * The worker is using the RVT-H object while this is true.
+		 * @return True if a request is in flight; false if the worker is idle.
+		 */
+		bool isLoading(void) const;
+
+	signals:
+		/**
+		 * A bank's details have been loaded.
+		 * @param bank Bank number
+		 */
+		void detailsLoaded(unsigned int bank);
+
+	private slots:
+		/**
+		 * Worker object: A bank's details have been loaded.
+		 * @param bank Bank number
+		 * @param serial Request serial number
+		 * @param details Bank details
+		 */
+		void worker_loaded(unsigned int bank, int serial, const BankDetails &details);
+};
+
+#endif /* __RVTHTOOL_QRVTHTOOL_BANKDETAILSLOADER_HPP__ */
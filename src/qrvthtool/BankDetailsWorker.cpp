@@ -0,0 +1,109 @@
+/***************************************************************************
+ * RVT-H Tool (qrvthtool)                                                  *
+ * BankDetailsWorker.cpp: Load bank details on a background thread.        *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "BankDetailsWorker.hpp"
+
+// C includes (C++ namespace)
+#include <cerrno>
+
+// C++ includes
+#include <vector>
+using std::vector;
+
+// Qt includes
+#include <QtCore/QMutex>
+#include <QtCore/QMutexLocker>
+
+/** BankDetailsWorkerPrivate **/
+
+class BankDetailsWorkerPrivate
+{
+	public:
+		BankDetailsWorkerPrivate()
+			: rvth(nullptr) { }
+
+	private:
+		Q_DISABLE_COPY(BankDetailsWorkerPrivate)
+
+	public:
+		// Held while details are being loaded, so setRvtH()
+		// doesn't return while the previous object is in use.
+		QMutex mutex;
+		RvtH *rvth;
+};
+
+/** BankDetailsWorker **/
+
+BankDetailsWorker::BankDetailsWorker(QObject *parent)
+	: super(parent)
+	, d_ptr(new BankDetailsWorkerPrivate())
+{ }
+
+BankDetailsWorker::~BankDetailsWorker()
+{
+	Q_D(BankDetailsWorker);
+	delete d;
+}
+
+/**
+ * Set the RVT-H object.
+ *
+ * If details are currently being loaded from the previous
+ * RVT-H object, this waits for them to finish, so the
+ * previous object can be deleted afterwards.
+ *
+ * This can be called from any thread.
+ *
+ * @param rvth RVT-H object
+ */
+void BankDetailsWorker::setRvtH(RvtH *rvth)
+{
+	Q_D(BankDetailsWorker);
+	QMutexLocker locker(&d->mutex);
+	d->rvth = rvth;
+}
+
+/**
+ * Load a bank's details.
+ * loaded() is always emitted, even if this fails.
+ * @param bank Bank number
+ * @param serial Request serial number (returned in loaded())
+ */
+void BankDetailsWorker::load(unsigned int bank, int serial)
+{
+	Q_D(BankDetailsWorker);
+	BankDetails details;
+
+	QMutexLocker locker(&d->mutex);
+	if (!d->rvth) {
+		// The RVT-H object was closed.
+		locker.unlock();
+		details.err = -EBADF;
+		emit loaded(bank, serial, details);
+		return;
+	}
+
+	// Summarize the bank's filesystem.
+	// This reads the FST from the device, which may be slow.
+	vector<RvtH_FST_File> files;
+	details.err = d->rvth->listFiles(bank, files);
+	locker.unlock();
+
+	if (details.err == 0) {
+		for (const RvtH_FST_File &file : files) {
+			if (file.is_dir) {
+				details.dirCount++;
+			} else {
+				details.fileCount++;
+				details.totalSize += file.size;
+			}
+		}
+	}
+
+	emit loaded(bank, serial, details);
+}
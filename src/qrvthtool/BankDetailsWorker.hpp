@@ -0,0 +1,69 @@
+/***************************************************************************
+ * RVT-H Tool (qrvthtool)                                                  *
+ * BankDetailsWorker.hpp: Load bank details on a background thread.        *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_QRVTHTOOL_BANKDETAILSWORKER_HPP__
+#define __RVTHTOOL_QRVTHTOOL_BANKDETAILSWORKER_HPP__
+
+// librvth
+#include "librvth/rvth.hpp"
+
+#include "BankDetails.hpp"
+
+// Qt includes.
+#include <QtCore/QObject>
+
+class BankDetailsWorkerPrivate;
+class BankDetailsWorker : public QObject
+{
+	Q_OBJECT
+	typedef QObject super;
+
+	public:
+		explicit BankDetailsWorker(QObject *parent = nullptr);
+		virtual ~BankDetailsWorker();
+
+	protected:
+		BankDetailsWorkerPrivate *const d_ptr;
+		Q_DECLARE_PRIVATE(BankDetailsWorker)
+	private:
+		Q_DISABLE_COPY(BankDetailsWorker)
+
+	public:
+		/**
+		 * Set the RVT-H object.
+		 *
+		 * If details are currently being loaded from the previous
+		 * RVT-H object, this waits for them to finish, so the
+		 * previous object can be deleted afterwards.
+		 *
+		 * This can be called from any thread.
+		 *
+		 * @param rvth RVT-H object
+		 */
+		void setRvtH(RvtH *rvth);
+
+	signals:
+		/**
+		 * A bank's details have been loaded.
+		 * @param bank Bank number
+		 * @param serial Request serial number, from load()
+		 * @param details Bank details (err is -EBADF if the RVT-H object was closed)
+		 */
+		void loaded(unsigned int bank, int serial, const BankDetails &details);
+
+	public slots:
+		/**
+		 * Load a bank's details.
+		 * loaded() is always emitted, even if this fails.
+		 * @param bank Bank number
+		 * @param serial Request serial number (returned in loaded())
+		 */
+		void load(unsigned int bank, int serial);
+};
+
+#endif /* __RVTHTOOL_QRVTHTOOL_BANKDETAILSWORKER_HPP__ */
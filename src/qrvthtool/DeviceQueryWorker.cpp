@@ -0,0 +1,48 @@
+/***************************************************************************
+ * RVT-H Tool (qrvthtool)                                                  *
+ * DeviceQueryWorker.cpp: Query RVT-H Reader devices in the background.    *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "DeviceQueryWorker.hpp"
+
+// librvth
+#include "librvth/config.librvth.h"
+
+// C includes (C++ namespace)
+#include <cerrno>
+
+DeviceQueryWorker::DeviceQueryWorker(QObject *parent)
+	: super(parent)
+{ }
+
+/**
+ * Query the RVT-H Reader devices.
+ * Enumerating the devices may take a while,
+ * so this should be run on a separate thread.
+ */
+void DeviceQueryWorker::doQuery(void)
+{
+	QList<DeviceQueryData> devices;
+
+#ifdef HAVE_QUERY
+	// NOTE: If a device listener is running, the results
+	// are cached, so the next query won't have to scan.
+	int err = 0;
+	RvtH_QueryEntry *const devs = rvth_query_devices(&err);
+	for (const RvtH_QueryEntry *p = devs; p != nullptr; p = p->next) {
+		if (!p->device_name) {
+			// No device name. Skip it.
+			continue;
+		}
+		devices.append(DeviceQueryData(p));
+	}
+	rvth_query_free(devs);
+#else /* !HAVE_QUERY */
+	const int err = ENOTSUP;
+#endif /* HAVE_QUERY */
+
+	emit finished(devices, err);
+}
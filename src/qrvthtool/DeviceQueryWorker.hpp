@@ -0,0 +1,47 @@
+/***************************************************************************
+ * RVT-H Tool (qrvthtool)                                                  *
+ * DeviceQueryWorker.hpp: Query RVT-H Reader devices in the background.    *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_QRVTHTOOL_DEVICEQUERYWORKER_HPP__
+#define __RVTHTOOL_QRVTHTOOL_DEVICEQUERYWORKER_HPP__
+
+// for DeviceQueryData
+#include "windows/SelectDeviceDialog.hpp"
+
+// Qt includes.
+#include <QtCore/QList>
+#include <QtCore/QObject>
+
+class DeviceQueryWorker : public QObject
+{
+	Q_OBJECT
+	typedef QObject super;
+
+	public:
+		explicit DeviceQueryWorker(QObject *parent = nullptr);
+
+	private:
+		Q_DISABLE_COPY(DeviceQueryWorker)
+
+	signals:
+		/**
+		 * The device query has finished.
+		 * @param devices Devices that were found
+		 * @param err Positive POSIX error code (0 on success)
+		 */
+		void finished(const QList<DeviceQueryData> &devices, int err);
+
+	public slots:
+		/**
+		 * Query the RVT-H Reader devices.
+		 * Enumerating the devices may take a while,
+		 * so this should be run on a separate thread.
+		 */
+		void doQuery(void);
+};
+
+#endif /* __RVTHTOOL_QRVTHTOOL_DEVICEQUERYWORKER_HPP__ */
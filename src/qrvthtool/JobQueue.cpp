@@ -0,0 +1,612 @@
+/***************************************************************************
+ * RVT-H Tool (qrvthtool)                                                  *
+ * JobQueue.cpp: Queue of extract/import/verify jobs.                      *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "JobQueue.hpp"
+#include "WorkerObject.hpp"
+
+// C includes. (C++ namespace)
+#include <cerrno>
+
+// Qt includes.
+#include <QtCore/QFileInfo>
+#include <QtCore/QList>
+#include <QtCore/QSet>
+#include <QtCore/QThread>
+#include <QtCore/QTimer>
+
+// Progress is polled from the workers at this interval, in milliseconds,
+// so the UI is updated at a fixed rate regardless of the I/O speed.
+static const int PROGRESS_POLL_INTERVAL_MS = 100;
+
+/** JobQueuePrivate **/
+
+class JobQueuePrivate
+{
+	public:
+		explicit JobQueuePrivate(JobQueue *q);
+		~JobQueuePrivate();
+
+	protected:
+		JobQueue *const q_ptr;
+		Q_DECLARE_PUBLIC(JobQueue)
+	private:
+		Q_DISABLE_COPY(JobQueuePrivate)
+
+	public:
+		struct Job {
+			int id;
+			JobQueue::JobType type;
+			RvtH *rvth;
+			QString deviceKey;	// Identifies the physical device (see deviceKey())
+			unsigned int bank;
+			QString gcmFilename;
+			int recryptionKey;
+			unsigned int flags;
+			bool lowPriority;
+
+			// Set while the job is running.
+			QThread *thread;
+			WorkerObject *worker;
+		};
+
+		// Queued and running jobs, in the order they were added.
+		QList<Job*> jobs;
+		int nextId;
+
+		// Job whose jobFinished() signal is being emitted.
+		// It's no longer in `jobs`, but the accessors still work.
+		Job *finishing;
+
+		// RVT-H objects that are no longer displayed.
+		// These are deleted once all of their jobs have finished.
+		QSet<RvtH*> released;
+
+		// Progress polling timer. Runs while any job is running.
+		QTimer *progressTimer;
+
+		/**
+		 * Emit jobProgress() for a job if its status has changed.
+		 * @param job Running job
+		 */
+		void pollProgress(Job *job);
+
+		/**
+		 * Get a key that identifies the physical device for a filename,
+		 * so different names for the same device share a queue.
+		 * @param filename Filename
+		 * @return Key
+		 */
+		static QString deviceKey(const QString &filename);
+
+		/**
+		 * Find a job.
+		 * @param id Job ID
+		 * @return Job, or nullptr if not found.
+		 */
+		Job *findJob(int id) const;
+
+		/**
+		 * Find a running job by its worker object.
+		 * @param worker Worker object
+		 * @return Job, or nullptr if not found.
+		 */
+		Job *findJob(const QObject *worker) const;
+
+		/**
+		 * Delete a released RVT-H object if no jobs are using it.
+		 * @param rvth RVT-H object
+		 */
+		void checkReleased(RvtH *rvth);
+
+		/**
+		 * Start every queued job whose device is idle.
+		 * Jobs for the same device are started in order.
+		 */
+		void schedule(void);
+
+		/**
+		 * Start a job.
+		 * @param job Job
+		 */
+		void startJob(Job *job);
+
+		/**
+		 * Stop a job's thread and delete its worker object.
+		 * @param job Job
+		 */
+		static void stopThread(Job *job);
+
+		/**
+		 * Remove a job from the queue and emit jobFinished().
+		 * @param job Job
+		 * @param text Status text
+		 * @param err Error code
+		 */
+		void finishJob(Job *job, const QString &text, int err);
+};
+
+JobQueuePrivate::JobQueuePrivate(JobQueue *q)
+	: q_ptr(q)
+	, nextId(1)
+	, finishing(nullptr)
+	, progressTimer(new QTimer(q))
+{
+	progressTimer->setInterval(PROGRESS_POLL_INTERVAL_MS);
+	QObject::connect(progressTimer, &QTimer::timeout,
+		q, &JobQueue::progressTimer_timeout);
+}
+
+JobQueuePrivate::~JobQueuePrivate()
+{
+	// Cancel all running jobs and wait for them to finish.
+	for (Job *job : jobs) {
+		if (job->worker) {
+			job->worker->cancel();
+		}
+	}
+	for (Job *job : jobs) {
+		if (job->thread) {
+			stopThread(job);
+		}
+		delete job;
+	}
+	jobs.clear();
+
+	qDeleteAll(released);
+	released.clear();
+}
+
+/**
+ * Get a key that identifies the physical device for a filename,
+ * so different names for the same device share a queue.
+ * @param filename Filename
+ * @return Key
+ */
+QString JobQueuePrivate::deviceKey(const QString &filename)
+{
+	// Symlinks, e.g. /dev/disk/by-id/, resolve to the same device.
+	// NOTE: canonicalFilePath() is empty for Windows device paths.
+	const QString canonical = QFileInfo(filename).canonicalFilePath();
+	return (!canonical.isEmpty() ? canonical : filename);
+}
+
+/**
+ * Find a job.
+ * @param id Job ID
+ * @return Job, or nullptr if not found.
+ */
+JobQueuePrivate::Job *JobQueuePrivate::findJob(int id) const
+{
+	if (finishing && finishing->id == id) {
+		return finishing;
+	}
+	for (Job *job : jobs) {
+		if (job->id == id) {
+			return job;
+		}
+	}
+	return nullptr;
+}
+
+/**
+ * Find a running job by its worker object.
+ * @param worker Worker object
+ * @return Job, or nullptr if not found.
+ */
+JobQueuePrivate::Job *JobQueuePrivate::findJob(const QObject *worker) const
+{
+	if (!worker) {
+		return nullptr;
+	}
+	for (Job *job : jobs) {
+		if (job->worker == worker) {
+			return job;
+		}
+	}
+	return nullptr;
+}
+
+/**
+ * Delete a released RVT-H object if no jobs are using it.
+ * @param rvth RVT-H object
+ */
+void JobQueuePrivate::checkReleased(RvtH *rvth)
+{
+	if (!released.contains(rvth)) {
+		return;
+	}
+	for (const Job *job : jobs) {
+		if (job->rvth == rvth) {
+			// Still in use.
+			return;
+		}
+	}
+	released.remove(rvth);
+	delete rvth;
+}
+
+/**
+ * Start every queued job whose device is idle.
+ * Jobs for the same device are started in order.
+ */
+void JobQueuePrivate::schedule(void)
+{
+	// Devices with an earlier job, either running or queued.
+	QSet<QString> busy;
+	for (Job *job : jobs) {
+		if (!job->thread && !busy.contains(job->deviceKey)) {
+			startJob(job);
+		}
+		busy.insert(job->deviceKey);
+	}
+}
+
+/**
+ * Start a job.
+ * @param job Job
+ */
+void JobQueuePrivate::startJob(Job *job)
+{
+	Q_Q(JobQueue);
+
+	job->thread = new QThread(q);
+	job->thread->setObjectName(QStringLiteral("jobThread%1").arg(job->id));
+	job->worker = new WorkerObject();
+	job->worker->setObjectName(QStringLiteral("jobWorker%1").arg(job->id));
+	job->worker->moveToThread(job->thread);
+	job->worker->setRvtH(job->rvth);
+	job->worker->setBank(job->bank);
+	job->worker->setGcmFilename(job->gcmFilename);
+	job->worker->setRecryptionKey(job->recryptionKey);
+	job->worker->setFlags(job->flags);
+	job->worker->setLowPriority(job->lowPriority);
+
+	switch (job->type) {
+		case JobQueue::JOB_EXTRACT:
+			QObject::connect(job->thread, &QThread::started,
+				job->worker, &WorkerObject::doExtract);
+			break;
+		case JobQueue::JOB_IMPORT:
+			QObject::connect(job->thread, &QThread::started,
+				job->worker, &WorkerObject::doImport);
+			break;
+		case JobQueue::JOB_VERIFY:
+			QObject::connect(job->thread, &QThread::started,
+				job->worker, &WorkerObject::doVerify);
+			break;
+	}
+	QObject::connect(job->worker, &WorkerObject::finished,
+		q, &JobQueue::worker_finished);
+
+	// Progress is polled by progressTimer.
+	job->thread->start();
+	if (!progressTimer->isActive()) {
+		progressTimer->start();
+	}
+	emit q->jobStarted(job->id);
+}
+
+/**
+ * Stop a job's thread and delete its worker object.
+ * @param job Job
+ */
+void JobQueuePrivate::stopThread(Job *job)
+{
+	// Make sure the thread exits.
+	// NOTE: Connecting WorkerObject::finished() to QThread::quit()
+	// might not work if the slots get run in the wrong order.
+	job->thread->quit();
+	do {
+		job->thread->wait(250);
+	} while (job->thread->isRunning());
+	job->thread->deleteLater();
+	job->thread = nullptr;
+
+	// NOTE: Need to use deleteLater() to prevent race conditions.
+	job->worker->deleteLater();
+	job->worker = nullptr;
+}
+
+/**
+ * Emit jobProgress() for a job if its status has changed.
+ * @param job Running job
+ */
+void JobQueuePrivate::pollProgress(Job *job)
+{
+	Q_Q(JobQueue);
+	QString text;
+	int progress_value, progress_max;
+	if (job->worker->takeStatus(text, progress_value, progress_max)) {
+		emit q->jobProgress(job->id, text, progress_value, progress_max);
+	}
+
+	if (job->type == JobQueue::JOB_VERIFY) {
+		VerifyMap map;
+		if (job->worker->takeVerifyMap(map)) {
+			emit q->jobVerifyProgress(job->id, map);
+		}
+	}
+}
+
+/**
+ * Remove a job from the queue and emit jobFinished().
+ * @param job Job
+ * @param text Status text
+ * @param err Error code
+ */
+void JobQueuePrivate::finishJob(Job *job, const QString &text, int err)
+{
+	Q_Q(JobQueue);
+
+	// NOTE: The job is removed first so jobCount() and isBusy()
+	// reflect the new state in the jobFinished() handlers.
+	jobs.removeOne(job);
+	finishing = job;
+	emit q->jobFinished(job->id, text, err);
+	finishing = nullptr;
+
+	RvtH *const rvth = job->rvth;
+	delete job;
+	checkReleased(rvth);
+}
+
+/** JobQueue **/
+
+JobQueue::JobQueue(QObject *parent)
+	: super(parent)
+	, d_ptr(new JobQueuePrivate(this))
+{ }
+
+JobQueue::~JobQueue()
+{
+	Q_D(JobQueue);
+	delete d;
+}
+
+/**
+ * Add a job to the queue.
+ * The job is started as soon as its device is idle.
+ *
+ * @param type		[in] Job type
+ * @param rvth		[in] RVT-H object
+ * @param rvthFilename	[in] RVT-H device or disk image filename (used to identify the device)
+ * @param bank		[in] Bank number
+ * @param gcmFilename	[in,opt] GCM filename (extract: destination; import: source)
+ * @param recryptionKey	[in,opt] Recryption key (extract only; -1 for no recryption)
+ * @param flags		[in,opt] Flags (operation-specific)
+ * @param lowPriority	[in,opt] If true, run at a lower CPU and I/O priority (verify only)
+ * @return Job ID.
+ */
+int JobQueue::addJob(JobType type, RvtH *rvth, const QString &rvthFilename, unsigned int bank,
+	const QString &gcmFilename, int recryptionKey, unsigned int flags, bool lowPriority)
+{
+	Q_D(JobQueue);
+
+	JobQueuePrivate::Job *const job = new JobQueuePrivate::Job;
+	job->id = d->nextId++;
+	job->type = type;
+	job->rvth = rvth;
+	job->deviceKey = d->deviceKey(rvthFilename);
+	job->bank = bank;
+	job->gcmFilename = gcmFilename;
+	job->recryptionKey = recryptionKey;
+	job->flags = flags;
+	job->lowPriority = lowPriority;
+	job->thread = nullptr;
+	job->worker = nullptr;
+	d->jobs.append(job);
+
+	// Job description.
+	const QString rvthFilenameOnly = QFileInfo(rvthFilename).fileName();
+	const QString gcmFilenameOnly = QFileInfo(gcmFilename).fileName();
+	QString description;
+	switch (type) {
+		case JOB_EXTRACT:
+			description = tr("Extract Bank %1 of %2 to %3")
+				.arg(bank+1).arg(rvthFilenameOnly, gcmFilenameOnly);
+			break;
+		case JOB_IMPORT:
+			description = tr("Import %1 into Bank %2 of %3")
+				.arg(gcmFilenameOnly).arg(bank+1).arg(rvthFilenameOnly);
+			break;
+		case JOB_VERIFY:
+			description = tr("Verify Bank %1 of %2")
+				.arg(bank+1).arg(rvthFilenameOnly);
+			break;
+	}
+	if (lowPriority) {
+		description = tr("%1 (Low Priority)").arg(description);
+	}
+	emit jobAdded(job->id, description);
+
+	d->schedule();
+	return job->id;
+}
+
+/**
+ * Cancel a job.
+ * Queued jobs are removed immediately; running jobs
+ * are cancelled at the next progress update.
+ * @param id Job ID
+ */
+void JobQueue::cancelJob(int id)
+{
+	Q_D(JobQueue);
+	JobQueuePrivate::Job *const job = d->findJob(id);
+	if (!job) {
+		return;
+	}
+
+	if (job->worker) {
+		// Running. The worker will emit finished().
+		job->worker->cancel();
+		return;
+	}
+
+	// Queued. Remove it now.
+	d->finishJob(job, tr("Cancelled."), -ECANCELED);
+}
+
+/**
+ * Cancel all jobs.
+ */
+void JobQueue::cancelAll(void)
+{
+	Q_D(JobQueue);
+
+	// Cancel the queued jobs first, so the device
+	// queues don't start them when running jobs finish.
+	const QList<JobQueuePrivate::Job*> jobs = d->jobs;
+	for (const JobQueuePrivate::Job *job : jobs) {
+		if (!job->worker) {
+			cancelJob(job->id);
+		}
+	}
+	for (JobQueuePrivate::Job *job : d->jobs) {
+		job->worker->cancel();
+	}
+}
+
+/**
+ * Get the number of queued and running jobs.
+ * @return Number of jobs.
+ */
+int JobQueue::jobCount(void) const
+{
+	Q_D(const JobQueue);
+	return d->jobs.size();
+}
+
+/**
+ * Are any jobs queued or running for the specified RVT-H object?
+ * @param rvth RVT-H object
+ * @return True if the RVT-H object is in use.
+ */
+bool JobQueue::isBusy(const RvtH *rvth) const
+{
+	Q_D(const JobQueue);
+	for (const JobQueuePrivate::Job *job : d->jobs) {
+		if (job->rvth == rvth) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Are any jobs queued or running for the specified bank?
+ * @param rvth RVT-H object
+ * @param bank Bank number
+ * @return True if the bank is in use.
+ */
+bool JobQueue::isBusy(const RvtH *rvth, unsigned int bank) const
+{
+	Q_D(const JobQueue);
+	for (const JobQueuePrivate::Job *job : d->jobs) {
+		if (job->rvth == rvth && job->bank == bank) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Get a job's type.
+ * Valid until jobFinished() has been handled.
+ * @param id Job ID
+ * @return Job type.
+ */
+JobQueue::JobType JobQueue::jobType(int id) const
+{
+	Q_D(const JobQueue);
+	const JobQueuePrivate::Job *const job = d->findJob(id);
+	return (job ? job->type : JOB_EXTRACT);
+}
+
+/**
+ * Get a job's RVT-H object.
+ * Valid until jobFinished() has been handled.
+ * @param id Job ID
+ * @return RVT-H object, or nullptr if the job doesn't exist.
+ */
+RvtH *JobQueue::jobRvtH(int id) const
+{
+	Q_D(const JobQueue);
+	const JobQueuePrivate::Job *const job = d->findJob(id);
+	return (job ? job->rvth : nullptr);
+}
+
+/**
+ * Get a job's bank number.
+ * Valid until jobFinished() has been handled.
+ * @param id Job ID
+ * @return Bank number, or ~0U if the job doesn't exist.
+ */
+unsigned int JobQueue::jobBank(int id) const
+{
+	Q_D(const JobQueue);
+	const JobQueuePrivate::Job *const job = d->findJob(id);
+	return (job ? job->bank : ~0U);
+}
+
+/**
+ * Take ownership of an RVT-H object that's no longer displayed.
+ * It's deleted once all of its jobs have finished.
+ * @param rvth RVT-H object
+ */
+void JobQueue::releaseRvtH(RvtH *rvth)
+{
+	Q_D(JobQueue);
+	if (!rvth) {
+		return;
+	}
+	d->released.insert(rvth);
+	d->checkReleased(rvth);
+}
+
+/** Slots **/
+
+/**
+ * Progress timer: Poll the running jobs.
+ */
+void JobQueue::progressTimer_timeout(void)
+{
+	Q_D(JobQueue);
+	bool anyRunning = false;
+	for (JobQueuePrivate::Job *job : d->jobs) {
+		if (job->worker) {
+			d->pollProgress(job);
+			anyRunning = true;
+		}
+	}
+	if (!anyRunning) {
+		d->progressTimer->stop();
+	}
+}
+
+/**
+ * Worker object: Process is finished.
+ * @param text Status text
+ * @param err Error code. (0 on success)
+ */
+void JobQueue::worker_finished(const QString &text, int err)
+{
+	Q_D(JobQueue);
+	JobQueuePrivate::Job *const job = d->findJob(sender());
+	if (!job) {
+		return;
+	}
+
+	// Deliver the final progress update before the result.
+	d->pollProgress(job);
+	d->stopThread(job);
+	d->finishJob(job, text, err);
+
+	// The device is idle now, so start its next job.
+	d->schedule();
+}
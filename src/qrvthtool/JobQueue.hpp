@@ -0,0 +1,188 @@
+/***************************************************************************
+ * RVT-H Tool (qrvthtool)                                                  *
+ * JobQueue.hpp: Queue of extract/import/verify jobs.                      *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_QRVTHTOOL_JOBQUEUE_HPP__
+#define __RVTHTOOL_QRVTHTOOL_JOBQUEUE_HPP__
+
+// librvth
+#include "librvth/rvth.hpp"
+
+#include "VerifyMap.hpp"
+
+// Qt includes.
+#include <QtCore/QObject>
+
+/**
+ * Queue of extract/import/verify jobs.
+ *
+ * Each job runs in its own WorkerObject and QThread.
+ * Jobs for the same device are run one at a time, in order.
+ * Jobs for different devices are run in parallel.
+ */
+class JobQueuePrivate;
+class JobQueue : public QObject
+{
+	Q_OBJECT
+	typedef QObject super;
+
+	public:
+		explicit JobQueue(QObject *parent = nullptr);
+		virtual ~JobQueue();
+
+	protected:
+		JobQueuePrivate *const d_ptr;
+		Q_DECLARE_PRIVATE(JobQueue)
+	private:
+		Q_DISABLE_COPY(JobQueue)
+
+	public:
+		enum JobType {
+			JOB_EXTRACT,
+			JOB_IMPORT,
+			JOB_VERIFY,
+		};
+
+		/**
+		 * Add a job to the queue.
+		 * The job is started as soon as its device is idle.
+		 *
+		 * @param type		[in] Job type
+		 * @param rvth		[in] RVT-H object
+		 * @param rvthFilename	[in] RVT-H device or disk image filename (used to identify the device)
+		 * @param bank		[in] Bank number
+		 * @param gcmFilename	[in,opt] GCM filename (extract: destination; import: source)
+		 * @param recryptionKey	[in,opt] Recryption key (extract only; -1 for no recryption)
+		 * @param flags		[in,opt] Flags (operation-specific)
+		 * @param lowPriority	[in,opt] If true, run at a lower CPU and I/O priority (verify only)
+		 * @return Job ID.
+		 */
+		int addJob(JobType type, RvtH *rvth, const QString &rvthFilename, unsigned int bank,
+			const QString &gcmFilename = QString(), int recryptionKey = -1, unsigned int flags = 0,
+			bool lowPriority = false);
+
+		/**
+		 * Cancel a job.
+		 * Queued jobs are removed immediately; running jobs
+		 * are cancelled at the next progress update.
+		 * @param id Job ID
+		 */
+		void cancelJob(int id);
+
+		/**
+		 * Cancel all jobs.
+		 */
+		void cancelAll(void);
+
+		/**
+		 * Get the number of queued and running jobs.
+		 * @return Number of jobs.
+		 */
+		int jobCount(void) const;
+
+		/**
+		 * Are any jobs queued or running for the specified RVT-H object?
+		 * @param rvth RVT-H object
+		 * @return True if the RVT-H object is in use.
+		 */
+		bool isBusy(const RvtH *rvth) const;
+
+		/**
+		 * Are any jobs queued or running for the specified bank?
+		 * @param rvth RVT-H object
+		 * @param bank Bank number
+		 * @return True if the bank is in use.
+		 */
+		bool isBusy(const RvtH *rvth, unsigned int bank) const;
+
+		/**
+		 * Get a job's type.
+		 * Valid until jobFinished() has been handled.
+		 * @param id Job ID
+		 * @return Job type.
+		 */
+		JobType jobType(int id) const;
+
+		/**
+		 * Get a job's RVT-H object.
+		 * Valid until jobFinished() has been handled.
+		 * @param id Job ID
+		 * @return RVT-H object, or nullptr if the job doesn't exist.
+		 */
+		RvtH *jobRvtH(int id) const;
+
+		/**
+		 * Get a job's bank number.
+		 * Valid until jobFinished() has been handled.
+		 * @param id Job ID
+		 * @return Bank number, or ~0U if the job doesn't exist.
+		 */
+		unsigned int jobBank(int id) const;
+
+		/**
+		 * Take ownership of an RVT-H object that's no longer displayed.
+		 * It's deleted once all of its jobs have finished.
+		 * @param rvth RVT-H object
+		 */
+		void releaseRvtH(RvtH *rvth);
+
+	signals:
+		/**
+		 * A job has been added to the queue.
+		 * @param id Job ID
+		 * @param description Job description
+		 */
+		void jobAdded(int id, const QString &description);
+
+		/**
+		 * A job has been started.
+		 * @param id Job ID
+		 */
+		void jobStarted(int id);
+
+		/**
+		 * A job's progress has been updated.
+		 * Emitted at most once per job per polling interval,
+		 * with the latest progress; intermediate updates are dropped.
+		 * @param id Job ID
+		 * @param text Status text
+		 * @param progress_value Progress bar value. (If -1, ignore this.)
+		 * @param progress_max Progress bar maximum. (If -1, ignore this.)
+		 */
+		void jobProgress(int id, const QString &text, int progress_value, int progress_max);
+
+		/**
+		 * A verify job's results have been updated.
+		 * Emitted at most once per job per polling interval.
+		 * @param id Job ID
+		 * @param map Verification results so far
+		 */
+		void jobVerifyProgress(int id, const VerifyMap &map);
+
+		/**
+		 * A job has finished, failed, or been cancelled.
+		 * @param id Job ID
+		 * @param text Status text
+		 * @param err Error code. (0 on success; -ECANCELED if cancelled)
+		 */
+		void jobFinished(int id, const QString &text, int err);
+
+	private slots:
+		/**
+		 * Progress timer: Poll the running jobs.
+		 */
+		void progressTimer_timeout(void);
+
+		/**
+		 * Worker object: Process is finished.
+		 * @param text Status text
+		 * @param err Error code. (0 on success)
+		 */
+		void worker_finished(const QString &text, int err);
+};
+
+#endif /* __RVTHTOOL_QRVTHTOOL_JOBQUEUE_HPP__ */
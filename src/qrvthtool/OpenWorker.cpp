@@ -0,0 +1,123 @@
+/***************************************************************************
+ * RVT-H Tool (qrvthtool)                                                  *
+ * OpenWorker.cpp: Worker object for opening RVT-H devices and images.     *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "OpenWorker.hpp"
+
+// C includes (C++ namespace)
+#include <cerrno>
+
+// C++ includes
+#include <atomic>
+
+/** OpenWorkerPrivate **/
+
+class OpenWorkerPrivate
+{
+	public:
+		explicit OpenWorkerPrivate(const QString &filename)
+			: filename(filename)
+			, rvth(nullptr)
+			, taken(false)
+			, cancel(false) { }
+
+	private:
+		Q_DISABLE_COPY(OpenWorkerPrivate)
+
+	public:
+		QString filename;	// Filename (using NATIVE separators)
+		RvtH *rvth;		// RVT-H object
+		bool taken;		// True if takeRvtH() was called
+
+		// Cancel initializing the remaining banks.
+		std::atomic<bool> cancel;
+};
+
+/** OpenWorker **/
+
+/**
+ * Create a worker object for opening an RVT-H device or disk image.
+ * @param filename Filename (using NATIVE separators)
+ * @param parent Parent object
+ */
+OpenWorker::OpenWorker(const QString &filename, QObject *parent)
+	: super(parent)
+	, d_ptr(new OpenWorkerPrivate(filename))
+{ }
+
+OpenWorker::~OpenWorker()
+{
+	Q_D(OpenWorker);
+	if (!d->taken) {
+		delete d->rvth;
+	}
+	delete d;
+}
+
+/**
+ * Take ownership of the RvtH object.
+ * @return RvtH object, or nullptr if it couldn't be opened.
+ */
+RvtH *OpenWorker::takeRvtH(void)
+{
+	Q_D(OpenWorker);
+	d->taken = true;
+	return d->rvth;
+}
+
+/**
+ * Cancel initializing the remaining bank entries.
+ * This can be called from any thread.
+ */
+void OpenWorker::cancel(void)
+{
+	Q_D(OpenWorker);
+	d->cancel = true;
+}
+
+/**
+ * Open the RVT-H device or disk image,
+ * then initialize each bank entry.
+ */
+void OpenWorker::doOpen(void)
+{
+	Q_D(OpenWorker);
+
+	// Reading the bank table may take a while on slow USB hubs.
+	int err = 0;
+#ifdef _WIN32
+	RvtH *const rvth = new RvtH(reinterpret_cast<const wchar_t*>(d->filename.utf16()), &err);
+#else /* !_WIN32 */
+	RvtH *const rvth = new RvtH(d->filename.toUtf8().constData(), &err);
+#endif
+	if (!rvth->isOpen() || err != 0) {
+		delete rvth;
+		emit opened(err != 0 ? err : -EIO);
+		emit finished();
+		return;
+	}
+
+	// NOTE: d->rvth must be set before the signal is emitted,
+	// since the receiver calls takeRvtH().
+	d->rvth = rvth;
+	emit opened(0);
+
+	// Initialize the bank entries one at a time, so the
+	// bank list can be updated as each one is finished.
+	// RvtH::bankEntry() serializes bank initialization,
+	// so the UI thread can access the banks that are done.
+	const unsigned int bankCount = rvth->bankCount();
+	for (unsigned int bank = 0; bank < bankCount; bank++) {
+		if (d->cancel) {
+			break;
+		}
+		rvth->bankEntry(bank);
+		emit bankLoaded(bank);
+	}
+
+	emit finished();
+}
@@ -0,0 +1,89 @@
+/***************************************************************************
+ * RVT-H Tool (qrvthtool)                                                  *
+ * OpenWorker.hpp: Worker object for opening RVT-H devices and images.     *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_QRVTHTOOL_OPENWORKER_HPP__
+#define __RVTHTOOL_QRVTHTOOL_OPENWORKER_HPP__
+
+// librvth
+#include "librvth/rvth.hpp"
+
+// Qt includes.
+#include <QtCore/QObject>
+
+class OpenWorkerPrivate;
+class OpenWorker : public QObject
+{
+	Q_OBJECT
+	typedef QObject super;
+
+	public:
+		/**
+		 * Create a worker object for opening an RVT-H device or disk image.
+		 * @param filename Filename (using NATIVE separators)
+		 * @param parent Parent object
+		 */
+		explicit OpenWorker(const QString &filename, QObject *parent = nullptr);
+		virtual ~OpenWorker();
+
+	protected:
+		OpenWorkerPrivate *const d_ptr;
+		Q_DECLARE_PRIVATE(OpenWorker)
+	private:
+		Q_DISABLE_COPY(OpenWorker)
+
+	public:
+		/**
+		 * Take ownership of the RvtH object.
+		 *
+		 * This should be called from the slot connected to opened().
+		 * The worker continues initializing bank entries after this,
+		 * so the RvtH object must not be deleted until the worker
+		 * thread has finished.
+		 *
+		 * If this isn't called, the RvtH object is deleted
+		 * along with the worker object.
+		 *
+		 * @return RvtH object, or nullptr if it couldn't be opened.
+		 */
+		RvtH *takeRvtH(void);
+
+		/**
+		 * Cancel initializing the remaining bank entries.
+		 * This can be called from any thread.
+		 */
+		void cancel(void);
+
+	signals:
+		/**
+		 * The RVT-H device or disk image has been opened.
+		 * Bank entries haven't been initialized yet.
+		 * @param err Error code. (0 on success; see rvth_error())
+		 */
+		void opened(int err);
+
+		/**
+		 * A bank entry has been initialized.
+		 * Banks are initialized in order.
+		 * @param bank Bank number.
+		 */
+		void bankLoaded(unsigned int bank);
+
+		/**
+		 * All bank entries have been initialized, or loading was cancelled.
+		 */
+		void finished(void);
+
+	public slots:
+		/**
+		 * Open the RVT-H device or disk image,
+		 * then initialize each bank entry.
+		 */
+		void doOpen(void);
+};
+
+#endif /* __RVTHTOOL_QRVTHTOOL_OPENWORKER_HPP__ */
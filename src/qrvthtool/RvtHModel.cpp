@@ -7,6 +7,7 @@
  ***************************************************************************/
 
 #include "RvtHModel.hpp"
+#include "StartupProfiler.hpp"
 
 #include "librvth/rvth.hpp"
 
@@ -16,7 +17,10 @@
 
 // C++ includes
 #include <array>
+#include <utility>
+#include <vector>
 using std::array;
+using std::vector;
 
 // Qt includes.
 #include <QApplication>
@@ -41,6 +45,64 @@ class RvtHModelPrivate
 	public:
 		RvtH *rvth;
 
+		// Banks that have been initialized.
+		// Other banks are shown as placeholder rows.
+		vector<bool> bankLoaded;
+
+		// Cached display data and sort keys for a bank.
+		// Built on first use. forceBankUpdate() rebuilds it and
+		// compares it to the previous data, so only the columns
+		// that actually changed are updated in the views.
+		struct BankData {
+			bool valid;
+			bool loaded;		// Bank entry has been initialized
+			bool is_deleted;	// Bank is deleted
+			uint8_t type;		// Bank type (RVTH_BankType_e)
+			RvtHModel::IconID iconID;	// Icon ID (ICON_MAX for none)
+
+			QString display[RvtHModel::COL_MAX];	// Qt::DisplayRole (null if none)
+			QString text[RvtHModel::COL_MAX];	// Case-folded sort key (text columns only)
+			qint64 number[RvtHModel::COL_MAX];	// Numeric sort key (numeric columns only; -1 if N/A)
+
+			BankData() : valid(false) { }
+		};
+		mutable vector<BankData> bankData;
+
+		/**
+		 * Is the specified column sorted numerically?
+		 * @param column Column number.
+		 * @return True if numeric; false if text.
+		 */
+		static inline bool isNumericColumn(int column);
+
+		/**
+		 * Build the display data and sort keys for the specified bank.
+		 * @param bank	[in] Bank number.
+		 * @param data	[out] Bank data.
+		 */
+		void buildBankData(unsigned int bank, BankData &data) const;
+
+		/**
+		 * Get the cached display data and sort keys for the specified bank.
+		 * @param bank Bank number.
+		 * @return Bank data.
+		 */
+		const BankData &bankDataFor(unsigned int bank) const;
+
+		/**
+		 * Get a bank's title.
+		 * @param entry Bank entry.
+		 * @return Title.
+		 */
+		static QString bankTitle(const RvtH_BankEntry *entry);
+
+		/**
+		 * Get a bank's region.
+		 * @param entry Bank entry.
+		 * @return Region.
+		 */
+		static QString bankRegion(const RvtH_BankEntry *entry);
+
 		// Style variables.
 		struct style_t {
 			/**
@@ -83,13 +145,6 @@ class RvtHModelPrivate
 		 * @return RvtHModel::IconID, or RvtHModel::ICON_MAX on error.
 		 */
 		RvtHModel::IconID iconIDForBank(unsigned int bank) const;
-
-		/**
-		 * Get the icon for the specified bank.
-		 * @param bank Bank number.
-		 * @return QIcon.
-		 */
-		QIcon iconForBank(unsigned int bank) const;
 };
 
 /** RvtHModelPrivate **/
@@ -160,6 +215,7 @@ QIcon RvtHModelPrivate::getIcon(RvtHModel::IconID id)
 			"gcn", "nr", "wii", "rvtr", "rvth"
 		}};
 		static_assert(ARRAY_SIZE(names) == RvtHModel::ICON_MAX, "names[] needs to be updated!");
+		StartupProfiler::Timer timer("load hardware icon");
 		ms_icons[id] = loadIcon(QStringLiteral("hw"), QLatin1String(names[id]));
 		assert(!ms_icons[id].isNull());
 	}
@@ -200,6 +256,9 @@ RvtHModel::IconID RvtHModelPrivate::iconIDForBank(unsigned int bank) const
 	if (!rvth) {
 		// No RVT-H Reader image.
 		return RvtHModel::ICON_MAX;
+	} else if (bank >= bankLoaded.size() || !bankLoaded[bank]) {
+		// Bank entry hasn't been loaded yet.
+		return RvtHModel::ICON_MAX;
 	}
 
 	const RvtH_BankEntry *entry = rvth->bankEntry(bank);
@@ -274,18 +333,141 @@ RvtHModel::IconID RvtHModelPrivate::iconIDForBank(unsigned int bank) const
 }
 
 /**
- * Get the icon for the specified bank.
+ * Is the specified column sorted numerically?
+ * @param column Column number.
+ * @return True if numeric; false if text.
+ */
+inline bool RvtHModelPrivate::isNumericColumn(int column)
+{
+	switch (column) {
+		case RvtHModel::COL_TITLE:
+		case RvtHModel::COL_GAMEID:
+		case RvtHModel::COL_REGION:
+			return false;
+		default:
+			return true;
+	}
+}
+
+/**
+ * Build the display data and sort keys for the specified bank.
+ * @param bank	[in] Bank number.
+ * @param data	[out] Bank data.
+ */
+void RvtHModelPrivate::buildBankData(unsigned int bank, BankData &data) const
+{
+	data.valid = true;
+	data.loaded = (bank < bankLoaded.size() && bankLoaded[bank]);
+	data.is_deleted = false;
+	data.type = RVTH_BankType_Empty;
+	data.iconID = RvtHModel::ICON_MAX;
+	for (int col = 0; col < RvtHModel::COL_MAX; col++) {
+		data.display[col].clear();
+		data.text[col].clear();
+		data.number[col] = -1;
+	}
+	data.display[RvtHModel::COL_BANKNUM] = QString::number(bank + 1);
+	data.number[RvtHModel::COL_BANKNUM] = bank;
+
+	if (!data.loaded) {
+		// Bank entry hasn't been loaded yet.
+		// NOTE: setBankLoaded() rebuilds the bank data.
+		return;
+	}
+
+	const RvtH_BankEntry *const entry = rvth->bankEntry(bank);
+	if (!entry) {
+		return;
+	}
+	data.type = entry->type;
+	data.is_deleted = entry->is_deleted;
+	if (entry->type == RVTH_BankType_Empty) {
+		// Only the bank number is shown.
+		return;
+	} else if (entry->type == RVTH_BankType_Wii_DL_Bank2) {
+		// Shown as part of the previous bank.
+		data.display[RvtHModel::COL_BANKNUM].clear();
+		return;
+	}
+
+	if (entry->type == RVTH_BankType_Wii_DL) {
+		// Print both bank numbers.
+		data.display[RvtHModel::COL_BANKNUM] += QChar(L'\n') + QString::number(bank + 2);
+	}
+
+	data.iconID = iconIDForBank(bank);
+	data.number[RvtHModel::COL_TYPE] = data.iconID;
+
+	data.display[RvtHModel::COL_TITLE] = bankTitle(entry);
+	data.display[RvtHModel::COL_GAMEID] = QString::fromLatin1(
+		entry->discHeader.id6, sizeof(entry->discHeader.id6));
+	data.display[RvtHModel::COL_DISCNUM] = QString::number(entry->discHeader.disc_number);
+	data.number[RvtHModel::COL_DISCNUM] = entry->discHeader.disc_number;
+	// TODO: BCD?
+	data.display[RvtHModel::COL_REVISION] = QString::number(entry->discHeader.revision);
+	data.number[RvtHModel::COL_REVISION] = entry->discHeader.revision;
+	data.display[RvtHModel::COL_REGION] = bankRegion(entry);
+
+	if (entry->type == RVTH_BankType_Wii_SL ||
+	    entry->type == RVTH_BankType_Wii_DL)
+	{
+		// Wii only.
+		data.display[RvtHModel::COL_IOS_VERSION] = QString::number(entry->ios_version);
+		data.number[RvtHModel::COL_IOS_VERSION] = entry->ios_version;
+	}
+
+	// Text sort keys are case-folded so they can be compared directly.
+	for (int col = 0; col < RvtHModel::COL_MAX; col++) {
+		if (!isNumericColumn(col)) {
+			data.text[col] = data.display[col].toCaseFolded();
+		}
+	}
+}
+
+/**
+ * Get the cached display data and sort keys for the specified bank.
  * @param bank Bank number.
- * @return QIcon.
+ * @return Bank data.
  */
-QIcon RvtHModelPrivate::iconForBank(unsigned int bank) const
+const RvtHModelPrivate::BankData &RvtHModelPrivate::bankDataFor(unsigned int bank) const
 {
-	const RvtHModel::IconID iconID = iconIDForBank(bank);
-	if (iconID >= RvtHModel::ICON_MAX) {
-		// No icon.
-		return QIcon();
+	assert(bank < bankData.size());
+	BankData &data = bankData[bank];
+	if (!data.valid) {
+		buildBankData(bank, data);
 	}
-	return getIcon(iconID);
+	return data;
+}
+
+/**
+ * Get a bank's title.
+ * @param entry Bank entry.
+ * @return Title.
+ */
+QString RvtHModelPrivate::bankTitle(const RvtH_BankEntry *entry)
+{
+	// Remove trailing NULL bytes.
+	size_t len = strnlen(entry->discHeader.game_title, sizeof(entry->discHeader.game_title));
+	// TODO: Convert from Japanese if necessary.
+	// Also cp1252.
+	return QString::fromLatin1(entry->discHeader.game_title, (int)len).trimmed();
+}
+
+/**
+ * Get a bank's region.
+ * @param entry Bank entry.
+ * @return Region.
+ */
+QString RvtHModelPrivate::bankRegion(const RvtH_BankEntry *entry)
+{
+	// TODO: Icon?
+	static const char region_code_tbl[7][4] = {
+		"JPN", "USA", "EUR", "ALL", "KOR", "CHN", "TWN"
+	};
+	if (entry->region_code <= GCN_REGION_TWN) {
+		return QLatin1String(region_code_tbl[entry->region_code]);
+	}
+	return QString::number(entry->region_code);
 }
 
 /** RvtHModel **/
@@ -339,14 +521,6 @@ QVariant RvtHModel::data(const QModelIndex& index, int role) const
 		return {};
 	}
 
-	// Get the bank entry.
-	const unsigned int bank = static_cast<unsigned int>(index.row());
-	const RvtH_BankEntry *const entry = d->rvth->bankEntry(bank);
-	if (!entry) {
-		// No entry...
-		return {};
-	}
-
 	// HACK: Increase icon width on Windows.
 	// Figure out a better method later.
 #ifdef Q_OS_WIN
@@ -355,6 +529,74 @@ QVariant RvtHModel::data(const QModelIndex& index, int role) const
 	static const int iconWadj = 0;
 #endif
 
+	const unsigned int bank = static_cast<unsigned int>(index.row());
+	if (role == SortKeyRole || role == SortNumberRole) {
+		// Cached sort keys.
+		if (index.column() >= COL_MAX || bank >= d->bankData.size()) {
+			return {};
+		}
+		const RvtHModelPrivate::BankData &data = d->bankDataFor(bank);
+		if (RvtHModelPrivate::isNumericColumn(index.column())) {
+			if (role == SortNumberRole) {
+				return static_cast<qlonglong>(data.number[index.column()]);
+			}
+		} else if (role == SortKeyRole) {
+			return data.text[index.column()];
+		}
+		return {};
+	}
+
+	if (bank >= d->bankLoaded.size() || !d->bankLoaded[bank]) {
+		// Bank entry hasn't been loaded yet.
+		// NOTE: Don't call bankEntry() here, since that would
+		// initialize the bank on the UI thread.
+		switch (index.column()) {
+			case COL_BANKNUM:
+				switch (role) {
+					case Qt::DisplayRole:
+						return QString::number(bank + 1);
+					case Qt::TextAlignmentRole:
+						return Qt::AlignCenter;
+					default:
+						break;
+				}
+				break;
+
+			case COL_TITLE:
+				switch (role) {
+					case Qt::DisplayRole:
+						return tr("Loading...");
+					case Qt::TextAlignmentRole:
+						return (int)(Qt::AlignLeft | Qt::AlignVCenter);
+					case Qt::FontRole: {
+						QFont font;
+						font.setItalic(true);
+						return font;
+					}
+					default:
+						break;
+				}
+				break;
+
+			case COL_TYPE:
+				if (role == Qt::SizeHintRole) {
+					return QSize(32 + iconWadj, 32);
+				}
+				break;
+
+			default:
+				break;
+		}
+		return {};
+	}
+
+	// Get the bank entry.
+	const RvtH_BankEntry *const entry = d->rvth->bankEntry(bank);
+	if (!entry) {
+		// No entry...
+		return {};
+	}
+
 	switch (entry->type) {
 		case RVTH_BankType_Empty:
 			// Empty slot.
@@ -401,63 +643,24 @@ QVariant RvtHModel::data(const QModelIndex& index, int role) const
 	// TODO: Move some of this to RvtHItemDelegate?
 	switch (role) {
 		case Qt::DisplayRole:
-			// TODO: Cache these?
-			switch (index.column()) {
-				case COL_BANKNUM: {
-					QString banknum = QString::number(bank + 1);
-					if (entry->type == RVTH_BankType_Wii_DL) {
-						// Print both bank numbers.
-						banknum += QChar(L'\n') + QString::number(bank + 2);
-					}
-					return banknum;
-				}
-				case COL_TITLE: {
-					// Remove trailing NULL bytes.
-					size_t len = strnlen(entry->discHeader.game_title, sizeof(entry->discHeader.game_title));
-					// TODO: Convert from Japanese if necessary.
-					// Also cp1252.
-					return QString::fromLatin1(entry->discHeader.game_title, (int)len).trimmed();
-				}
-				case COL_GAMEID:
-					return QLatin1String(entry->discHeader.id6, sizeof(entry->discHeader.id6));
-				case COL_DISCNUM:
-					return QString::number(entry->discHeader.disc_number);
-				case COL_REVISION:
-					// TODO: BCD?
-					return QString::number(entry->discHeader.revision);
-
-				case COL_REGION: {
-					// TODO: Icon?
-					QString s_region;
-					static const char region_code_tbl[7][4] = {
-						"JPN", "USA", "EUR", "ALL", "KOR", "CHN", "TWN"
-					};
-					if (entry->region_code <= GCN_REGION_TWN) {
-						s_region = QLatin1String(region_code_tbl[entry->region_code]);
-					} else {
-						s_region = QString::number(entry->region_code);
-					}
-					return s_region;
+			// Display strings are cached per bank.
+			if (index.column() < COL_MAX) {
+				const QString &s = d->bankDataFor(bank).display[index.column()];
+				if (!s.isNull()) {
+					return s;
 				}
-
-				case COL_IOS_VERSION:
-					// Wii only.
-					if (entry->type == RVTH_BankType_Wii_SL ||
-					    entry->type == RVTH_BankType_Wii_DL)
-					{
-						return QString::number(entry->ios_version);
-					}
-					break;
-
-				default:
-					break;
 			}
 			break;
 
 		case Qt::DecorationRole:
 			if (index.column() == COL_TYPE) {
 				// Get the icon for this bank.
-				return d->iconForBank(bank);
+				// NOTE: The icon ID is cached per bank,
+				// and the icons are cached by getIcon().
+				const RvtHModel::IconID iconID = d->bankDataFor(bank).iconID;
+				if (iconID < ICON_MAX) {
+					return d->getIcon(iconID);
+				}
 			}
 			break;
 
@@ -565,6 +768,11 @@ QVariant RvtHModel::headerData(int section, Qt::Orientation orientation, int rol
 void RvtHModel::setRvtH(RvtH *rvth)
 {
 	Q_D(RvtHModel);
+	if (d->rvth == rvth) {
+		// Same RVT-H object. Nothing to do.
+		// Changed banks are handled by forceBankUpdate().
+		return;
+	}
 
 	// NOTE: No signals, since librvth is a C library.
 
@@ -577,6 +785,8 @@ void RvtHModel::setRvtH(RvtH *rvth)
 		}
 
 		d->rvth = nullptr;
+		d->bankLoaded.clear();
+		d->bankData.clear();
 
 		// Done removing rows.
 		if (bankCount > 0) {
@@ -585,6 +795,9 @@ void RvtHModel::setRvtH(RvtH *rvth)
 	}
 
 	if (rvth) {
+		// NOTE: Bank entries are initialized by the caller,
+		// which calls setBankLoaded() as each one is finished.
+
 		// Notify the view that we're about to add rows.
 		const int bankCount = rvth->bankCount();
 		if (bankCount > 0) {
@@ -592,6 +805,8 @@ void RvtHModel::setRvtH(RvtH *rvth)
 		}
 
 		d->rvth = rvth;
+		d->bankLoaded.assign(bankCount, false);
+		d->bankData.assign(bankCount, RvtHModelPrivate::BankData());
 
 		// Done adding rows.
 		if (bankCount > 0) {
@@ -600,6 +815,37 @@ void RvtHModel::setRvtH(RvtH *rvth)
 	}
 }
 
+/**
+ * Compare two banks using the cached sort keys.
+ * This doesn't allocate anything, so it's suitable for
+ * QSortFilterProxyModel::lessThan().
+ * @param leftRow Left row (bank number).
+ * @param rightRow Right row (bank number).
+ * @param column Column to compare.
+ * @return True if the left bank sorts before the right bank.
+ */
+bool RvtHModel::sortLessThan(int leftRow, int rightRow, int column) const
+{
+	Q_D(const RvtHModel);
+	const int rows = static_cast<int>(d->bankData.size());
+	assert(leftRow >= 0 && leftRow < rows);
+	assert(rightRow >= 0 && rightRow < rows);
+	assert(column >= 0 && column < COL_MAX);
+	if (leftRow < 0 || leftRow >= rows || rightRow < 0 || rightRow >= rows ||
+	    column < 0 || column >= COL_MAX)
+	{
+		return false;
+	}
+
+	const RvtHModelPrivate::BankData &left = d->bankDataFor(static_cast<unsigned int>(leftRow));
+	const RvtHModelPrivate::BankData &right = d->bankDataFor(static_cast<unsigned int>(rightRow));
+	if (RvtHModelPrivate::isNumericColumn(column)) {
+		return (left.number[column] < right.number[column]);
+	}
+	// Keys are already case-folded.
+	return (left.text[column] < right.text[column]);
+}
+
 /**
  * Load an icon.
  * @param id Icon ID.
@@ -635,6 +881,17 @@ void RvtHModel::themeChanged_slot(void)
 	// TODO: Force an update?
 }
 
+/**
+ * Has the specified bank been loaded?
+ * @param bank Bank number.
+ * @return True if the bank entry has been initialized.
+ */
+bool RvtHModel::isBankLoaded(unsigned int bank) const
+{
+	Q_D(const RvtHModel);
+	return (bank < d->bankLoaded.size() && d->bankLoaded[bank]);
+}
+
 /**
  * Force the RVT-H model to update a bank.
  * @param bank Bank number.
@@ -652,10 +909,57 @@ void RvtHModel::forceBankUpdate(unsigned int bank)
 	}
 
 	// Data for this bank is changed.
-	// Force update this bank and the next bank,
+	// Check this bank and the next bank,
 	// in case the bank was previously DL.
 	const unsigned int bank2 = (bank == bankCount-1 ? bank : bank+1);
-	QModelIndex idxStart = index(bank, 0);
-	QModelIndex idxEnd = index(bank2, COL_MAX-1);
-	emit dataChanged(idxStart, idxEnd);
+	for (unsigned int b = bank; b <= bank2; b++) {
+		RvtHModelPrivate::BankData &oldData = d->bankData[b];
+		RvtHModelPrivate::BankData newData;
+		d->buildBankData(b, newData);
+
+		if (!oldData.valid || oldData.loaded != newData.loaded ||
+		    oldData.type != newData.type || oldData.is_deleted != newData.is_deleted)
+		{
+			// The row may not have been shown yet, or other roles
+			// (background, size hint, etc.) have changed.
+			// Update the entire row.
+			oldData = std::move(newData);
+			emit dataChanged(index(b, 0), index(b, COL_MAX-1));
+		} else {
+			// Only update the columns that changed.
+			// Adjacent columns are updated together.
+			int first = -1;
+			for (int col = 0; col <= COL_MAX; col++) {
+				const bool changed = (col < COL_MAX) &&
+					(oldData.display[col] != newData.display[col] ||
+					 (col == COL_TYPE && oldData.iconID != newData.iconID));
+				if (changed) {
+					if (first < 0) {
+						first = col;
+					}
+				} else if (first >= 0) {
+					emit dataChanged(index(b, first), index(b, col-1));
+					first = -1;
+				}
+			}
+			oldData = std::move(newData);
+		}
+
+		emit bankChanged(b);
+	}
+}
+
+/**
+ * A bank entry has been initialized.
+ * The bank's placeholder row is replaced with the bank entry.
+ * @param bank Bank number.
+ */
+void RvtHModel::setBankLoaded(unsigned int bank)
+{
+	Q_D(RvtHModel);
+	if (bank >= d->bankLoaded.size())
+		return;
+
+	d->bankLoaded[bank] = true;
+	forceBankUpdate(bank);
 }
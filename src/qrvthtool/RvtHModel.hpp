@@ -60,6 +60,14 @@ class RvtHModel : public QAbstractListModel
 		// represented as taking up two banks.
 		static const int DualLayerRole = Qt::UserRole;
 
+		// Sort key roles.
+		// Keys are cached per bank until the bank changes.
+		// SortKeyRole: Case-folded text. (Title, Game ID, Region)
+		// SortNumberRole: Number (qlonglong) for all other columns.
+		// -1 if the column doesn't apply to the bank.
+		static const int SortKeyRole = Qt::UserRole + 1;
+		static const int SortNumberRole = Qt::UserRole + 2;
+
 		// Qt Model/View interface.
 		int rowCount(const QModelIndex& parent = QModelIndex()) const final;
 		int columnCount(const QModelIndex& parent = QModelIndex()) const final;
@@ -69,10 +77,32 @@ class RvtHModel : public QAbstractListModel
 
 		/**
 		 * Set the RVT-H Reader disk image to use in this model.
+		 *
+		 * Bank entries are not initialized here. Until setBankLoaded()
+		 * is called for a bank, it's shown as a placeholder row.
+		 *
 		 * @param rvth RVT-H Reader disk image.
 		 */
 		void setRvtH(RvtH *rvth);
 
+		/**
+		 * Has the specified bank been loaded?
+		 * @param bank Bank number.
+		 * @return True if the bank entry has been initialized.
+		 */
+		bool isBankLoaded(unsigned int bank) const;
+
+		/**
+		 * Compare two banks using the cached sort keys.
+		 * This doesn't allocate anything, so it's suitable for
+		 * QSortFilterProxyModel::lessThan().
+		 * @param leftRow Left row (bank number).
+		 * @param rightRow Right row (bank number).
+		 * @param column Column to compare.
+		 * @return True if the left bank sorts before the right bank.
+		 */
+		bool sortLessThan(int leftRow, int rightRow, int column) const;
+
 		/**
 		 * Load an icon.
 		 * @param id Icon ID.
@@ -87,6 +117,14 @@ class RvtHModel : public QAbstractListModel
 		 */
 		IconID iconIDForBank1(void) const;
 
+	signals:
+		/**
+		 * A bank's data has changed. (forceBankUpdate())
+		 * Anything cached for this bank should be discarded.
+		 * @param bank Bank number.
+		 */
+		void bankChanged(unsigned int bank);
+
 	private slots:
 		/**
 		 * The system theme has changed.
@@ -99,6 +137,13 @@ class RvtHModel : public QAbstractListModel
 		 * @param bank Bank number.
 		 */
 		void forceBankUpdate(unsigned int bank);
+
+		/**
+		 * A bank entry has been initialized.
+		 * The bank's placeholder row is replaced with the bank entry.
+		 * @param bank Bank number.
+		 */
+		void setBankLoaded(unsigned int bank);
 };
 
 #endif /* __RVTHTOOL_QRVTHTOOL_RVTHMODEL_HPP__ */
@@ -7,6 +7,7 @@
  ***************************************************************************/
 
 #include "RvtHSortFilterProxyModel.hpp"
+#include "RvtHModel.hpp"
 
 RvtHSortFilterProxyModel::RvtHSortFilterProxyModel(QObject *parent)
 	: super(parent)
@@ -32,6 +33,12 @@ bool RvtHSortFilterProxyModel::lessThan(const QModelIndex &left, const QModelInd
 		return super::lessThan(left, right);
 	}
 
+	const RvtHModel *const rvthModel = qobject_cast<const RvtHModel*>(left.model());
+	if (rvthModel && left.column() == right.column()) {
+		// Use RvtHModel's cached sort keys.
+		return rvthModel->sortLessThan(left.row(), right.row(), left.column());
+	}
+
 	const QVariant vLeft = left.data();
 	const QVariant vRight = right.data();
 
@@ -0,0 +1,58 @@
+/***************************************************************************
+ * RVT-H Tool (qrvthtool)                                                  *
+ * StartupProfiler.cpp: Startup time profiler. (--profile-startup)         *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "StartupProfiler.hpp"
+
+// C includes. (C++ namespace)
+#include <cstdio>
+
+bool StartupProfiler::ms_enabled = false;
+QElapsedTimer StartupProfiler::ms_timer;
+
+/**
+ * Enable the profiler.
+ * This should be called as early as possible,
+ * before any threads are started.
+ */
+void StartupProfiler::enable(void)
+{
+	if (!ms_enabled) {
+		ms_timer.start();
+		ms_enabled = true;
+	}
+}
+
+/**
+ * Record a startup event.
+ * @param event Event description
+ */
+void StartupProfiler::mark(const char *event)
+{
+	if (!ms_enabled)
+		return;
+
+	// NOTE: Each line is written with a single call,
+	// so lines from different threads aren't mixed.
+	const double ms = static_cast<double>(ms_timer.nsecsElapsed()) / 1000000.0;
+	fprintf(stderr, "startup: %9.3f ms  %s\n", ms, event);
+}
+
+/**
+ * Record the duration of some startup work.
+ * @param what Description of the work
+ * @param nsecs Duration, in nanoseconds
+ */
+void StartupProfiler::duration(const char *what, qint64 nsecs)
+{
+	if (!ms_enabled)
+		return;
+
+	const double ms = static_cast<double>(ms_timer.nsecsElapsed()) / 1000000.0;
+	const double took = static_cast<double>(nsecs) / 1000000.0;
+	fprintf(stderr, "startup: %9.3f ms  %s: took %.3f ms\n", ms, what, took);
+}
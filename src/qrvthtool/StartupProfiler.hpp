@@ -0,0 +1,96 @@
+/***************************************************************************
+ * RVT-H Tool (qrvthtool)                                                  *
+ * StartupProfiler.hpp: Startup time profiler. (--profile-startup)         *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_QRVTHTOOL_STARTUPPROFILER_HPP__
+#define __RVTHTOOL_QRVTHTOOL_STARTUPPROFILER_HPP__
+
+// Qt includes.
+#include <QtCore/QtGlobal>
+#include <QtCore/QElapsedTimer>
+
+/**
+ * Startup time profiler.
+ *
+ * If enabled with --profile-startup, each startup event is written to
+ * stderr as it happens, with the time since the program was started.
+ * Durations of work done during startup, including work done on
+ * background threads, are written the same way once the work is done.
+ *
+ * All functions are thread-safe once enable() has been called.
+ */
+class StartupProfiler
+{
+	private:
+		StartupProfiler() = delete;
+		~StartupProfiler() = delete;
+		Q_DISABLE_COPY(StartupProfiler)
+
+	public:
+		/**
+		 * Enable the profiler.
+		 * This should be called as early as possible,
+		 * before any threads are started.
+		 */
+		static void enable(void);
+
+		/**
+		 * Is the profiler enabled?
+		 * @return True if enabled.
+		 */
+		static inline bool isEnabled(void)
+		{
+			return ms_enabled;
+		}
+
+		/**
+		 * Record a startup event.
+		 * @param event Event description
+		 */
+		static void mark(const char *event);
+
+		/**
+		 * Record the duration of some startup work.
+		 * @param what Description of the work
+		 * @param nsecs Duration, in nanoseconds
+		 */
+		static void duration(const char *what, qint64 nsecs);
+
+		/**
+		 * Time a block of code.
+		 * The duration is recorded when the Timer is destroyed.
+		 */
+		class Timer
+		{
+			public:
+				explicit Timer(const char *what)
+					: m_what(what)
+				{
+					if (isEnabled()) {
+						m_timer.start();
+					}
+				}
+
+				~Timer()
+				{
+					if (isEnabled()) {
+						duration(m_what, m_timer.nsecsElapsed());
+					}
+				}
+
+			private:
+				Q_DISABLE_COPY(Timer)
+				const char *const m_what;
+				QElapsedTimer m_timer;
+		};
+
+	private:
+		static bool ms_enabled;
+		static QElapsedTimer ms_timer;	// Started by enable()
+};
+
+#endif /* __RVTHTOOL_QRVTHTOOL_STARTUPPROFILER_HPP__ */
@@ -9,6 +9,7 @@
 #include "TaskbarButtonManager.hpp"
 
 // Qt includes.
+#include <QtCore/QTimer>
 #include <QWidget>
 
 /** TaskbarButtonManagerPrivate **/
@@ -19,6 +20,8 @@ TaskbarButtonManagerPrivate::TaskbarButtonManagerPrivate(TaskbarButtonManager *c
 	, window(nullptr)
 	, progressBarValue(-1)
 	, progressBarMax(-1)
+	, shownPermille(-1)
+	, updateTimer(nullptr)
 { }
 
 TaskbarButtonManagerPrivate::~TaskbarButtonManagerPrivate()
@@ -27,12 +30,33 @@ TaskbarButtonManagerPrivate::~TaskbarButtonManagerPrivate()
 	// in order to prevent vtable screwups.
 }
 
+/**
+ * Get the current progress in 1/1000ths.
+ * @return Progress, or -1 if the progress bar is hidden.
+ */
+int TaskbarButtonManagerPrivate::progressPermille(void) const
+{
+	if (progressBarValue < 0 || progressBarMax <= 0) {
+		return -1;
+	} else if (progressBarValue >= progressBarMax) {
+		return 1000;
+	}
+	return static_cast<int>(static_cast<qint64>(progressBarValue) * 1000 / progressBarMax);
+}
+
 /** TaskbarButtonManager **/
 
 TaskbarButtonManager::TaskbarButtonManager(TaskbarButtonManagerPrivate *d, QObject* parent)
 	: super(parent)
 	, d_ptr(d)
-{ }
+{
+	// NOTE: The timer is created here, since the QObject
+	// isn't constructed yet when the private class is.
+	d->updateTimer = new QTimer(this);
+	d->updateTimer->setSingleShot(true);
+	connect(d->updateTimer, &QTimer::timeout,
+		this, &TaskbarButtonManager::updateTimer_timeout);
+}
 
 TaskbarButtonManager::~TaskbarButtonManager()
 {
@@ -81,7 +105,7 @@ void TaskbarButtonManager::clearProgressBar(void)
 	Q_D(TaskbarButtonManager);
 	d->progressBarValue = -1;
 	d->progressBarMax = -1;
-	this->update();
+	this->requestUpdate();
 }
 
 /**
@@ -103,7 +127,7 @@ void TaskbarButtonManager::setProgressBarValue(int value)
 	Q_D(TaskbarButtonManager);
 	if (d->progressBarValue != value) {
 		d->progressBarValue = value;
-		this->update();
+		this->requestUpdate();
 	}
 }
 
@@ -126,12 +150,65 @@ void TaskbarButtonManager::setProgressBarMax(int max)
 	Q_D(TaskbarButtonManager);
 	if (d->progressBarMax != max) {
 		d->progressBarMax = max;
-		this->update();
+		this->requestUpdate();
+	}
+}
+
+/**
+ * Request a taskbar button update.
+ *
+ * Nothing is sent if the displayed progress didn't change.
+ * Showing or hiding the progress bar is sent immediately;
+ * other changes are sent at most once every UPDATE_INTERVAL_MS.
+ */
+void TaskbarButtonManager::requestUpdate(void)
+{
+	Q_D(TaskbarButtonManager);
+	const int permille = d->progressPermille();
+	if (permille == d->shownPermille) {
+		// No visible change.
+		// A pending update, if any, will send the latest values.
+		return;
+	}
+
+	const bool visibilityChanged = ((permille < 0) != (d->shownPermille < 0));
+	if (!visibilityChanged && d->lastUpdate.isValid()) {
+		const qint64 elapsed = d->lastUpdate.elapsed();
+		if (elapsed < TaskbarButtonManagerPrivate::UPDATE_INTERVAL_MS) {
+			// Too soon. Send the update when the interval expires.
+			if (!d->updateTimer->isActive()) {
+				d->updateTimer->start(TaskbarButtonManagerPrivate::UPDATE_INTERVAL_MS -
+					static_cast<int>(elapsed));
+			}
+			return;
+		}
 	}
+
+	d->updateTimer->stop();
+	d->shownPermille = permille;
+	d->lastUpdate.start();
+	this->update();
 }
 
 /** Slots **/
 
+/**
+ * Pending taskbar button update timer has expired.
+ */
+void TaskbarButtonManager::updateTimer_timeout(void)
+{
+	Q_D(TaskbarButtonManager);
+	const int permille = d->progressPermille();
+	if (permille == d->shownPermille) {
+		// Progress changed back to what's already shown.
+		return;
+	}
+
+	d->shownPermille = permille;
+	d->lastUpdate.start();
+	this->update();
+}
+
 /**
  * Window we're managing was destroyed.
  * @param obj QObject that was destroyed.
@@ -88,7 +88,21 @@ class TaskbarButtonManager : public QObject
 		 */
 		virtual void update(void) = 0;
 
+		/**
+		 * Request a taskbar button update.
+		 *
+		 * Nothing is sent if the displayed progress didn't change.
+		 * Showing or hiding the progress bar is sent immediately;
+		 * other changes are rate-limited.
+		 */
+		void requestUpdate(void);
+
 	private slots:
+		/**
+		 * Pending taskbar button update timer has expired.
+		 */
+		void updateTimer_timeout(void);
+
 		/**
 		 * Window we're managing was destroyed.
 		 * @param obj QObject that was destroyed.
@@ -11,6 +11,10 @@
 
 #include "TaskbarButtonManager.hpp"
 
+// Qt includes.
+#include <QtCore/QElapsedTimer>
+class QTimer;
+
 class TaskbarButtonManagerPrivate
 {
 	public:
@@ -30,6 +34,21 @@ class TaskbarButtonManagerPrivate
 		// Status elements.
 		int progressBarValue;	// Current progress. (-1 for no bar)
 		int progressBarMax;	// Maximum progress.
+
+		// Rate limiting.
+		// Backends talk to the shell over COM or D-Bus, so updates
+		// are only sent if the displayed progress changed, and at
+		// most once every UPDATE_INTERVAL_MS.
+		static const int UPDATE_INTERVAL_MS = 100;
+		int shownPermille;		// Progress last sent to the backend, in 1/1000ths. (-1 for no bar)
+		QElapsedTimer lastUpdate;	// Time the last update was sent.
+		QTimer *updateTimer;		// Pending update. (owned by q)
+
+		/**
+		 * Get the current progress in 1/1000ths.
+		 * @return Progress, or -1 if the progress bar is hidden.
+		 */
+		int progressPermille(void) const;
 };
 
 #endif /* __RVTHTOOL_QRVTHTOOL_TASKBARBUTTONMANAGER_TASKBARBUTTONMANAGER_P_HPP__ */
@@ -2,21 +2,27 @@
  * RVT-H Tool (qrvthtool)                                                  *
  * TranslationManager.cpp: Qt translation manager.                         *
  *                                                                         *
- * Copyright (c) 2014-2023 by David Korth.                                 *
+ * Copyright (c) 2014-2024 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
 #include "config.qrvthtool.h"
 #include "TranslationManager.hpp"
+#include "StartupProfiler.hpp"
 
 // Qt includes.
 #include <QtCore/QTranslator>
 #include <QtCore/QCoreApplication>
+#include <QtCore/QEvent>
 #include <QtCore/QVector>
 #include <QtCore/QString>
 #include <QtCore/QDir>
 #include <QtCore/QLibraryInfo>
 
+// C++ includes.
+#include <system_error>
+#include <thread>
+
 /** TranslationManagerPrivate **/
 
 class TranslationManagerPrivate
@@ -38,9 +44,60 @@ class TranslationManagerPrivate
 		QTranslator *qtTranslator;
 		QTranslator *prgTranslator;
 
+		// Locale of the installed translators.
+		// Only valid if hasLocale is true.
+		QString locale;
+		bool hasLocale;
+
+		// Translation being loaded in the background.
+		// The translators are installed by finishAsync().
+		QTranslator *asyncQtTranslator;
+		QTranslator *asyncPrgTranslator;
+		QString asyncLocale;
+		std::thread asyncThread;
+		bool asyncPending;
+
+		// Available translations.
+		// Enumerated in the background by loadTranslationAsync().
+		mutable QMap<QString, QString> tsMap;
+		mutable std::thread enumThread;
+		mutable bool tsMapValid;
+		bool enumerating;
+
 		// List of paths to check for translations.
 		// NOTE: qtTranslator also checks QLibraryInfo::TranslationsPath.
+		// NOTE: Read by the background threads, so it must not
+		// be modified after the constructor.
 		QVector<QString> pathList;
+
+		/**
+		 * Load a translation.
+		 * This can be called from any thread, as long as
+		 * the QTranslators aren't installed.
+		 * @param locale Locale, e.g. "en_US". (Empty string is untranslated.)
+		 * @param qtTr QTranslator for Qt's translations
+		 * @param prgTr QTranslator for qrvthtool's translations
+		 */
+		void loadTranslators(const QString &locale, QTranslator *qtTr, QTranslator *prgTr) const;
+
+		/**
+		 * Enumerate available translations.
+		 * This can be called from any thread.
+		 * @return Map of available translations. (Key == locale, Value == description)
+		 */
+		QMap<QString, QString> enumerateTranslations(void) const;
+
+		/**
+		 * Install the translation that was loaded in the background.
+		 * If it's still loading, this waits for it to finish.
+		 */
+		void finishAsync(void);
+
+		/**
+		 * Discard the translation that was loaded in the background.
+		 * If it's still loading, this waits for it to finish.
+		 */
+		void discardAsync(void);
 };
 
 // Singleton instance.
@@ -50,6 +107,12 @@ TranslationManagerPrivate::TranslationManagerPrivate(TranslationManager *q)
 	: q_ptr(q)
 	, qtTranslator(new QTranslator())
 	, prgTranslator(new QTranslator())
+	, hasLocale(false)
+	, asyncQtTranslator(nullptr)
+	, asyncPrgTranslator(nullptr)
+	, asyncPending(false)
+	, tsMapValid(false)
+	, enumerating(false)
 {
 	// Install the QTranslators.
 	QCoreApplication::installTranslator(qtTranslator);
@@ -103,37 +166,25 @@ TranslationManagerPrivate::TranslationManagerPrivate(TranslationManager *q)
 
 TranslationManagerPrivate::~TranslationManagerPrivate()
 {
+	discardAsync();
+	if (enumThread.joinable()) {
+		enumThread.join();
+	}
+
 	delete qtTranslator;
 	delete prgTranslator;
 }
 
-/** TranslationManager **/
-
-TranslationManager::TranslationManager(QObject *parent)
-	: super(parent)
-	, d_ptr(new TranslationManagerPrivate(this))
-{ }
-
-TranslationManager::~TranslationManager()
-{
-	delete d_ptr;
-}
-
-TranslationManager* TranslationManager::instance(void)
-{
-	if (!TranslationManagerPrivate::instance)
-		TranslationManagerPrivate::instance = new TranslationManager();
-	return TranslationManagerPrivate::instance;
-}
-
 /**
- * Set the translation.
+ * Load a translation.
+ * This can be called from any thread, as long as
+ * the QTranslators aren't installed.
  * @param locale Locale, e.g. "en_US". (Empty string is untranslated.)
+ * @param qtTr QTranslator for Qt's translations
+ * @param prgTr QTranslator for qrvthtool's translations
  */
-void TranslationManager::setTranslation(const QString &locale)
+void TranslationManagerPrivate::loadTranslators(const QString &locale, QTranslator *qtTr, QTranslator *prgTr) const
 {
-	Q_D(TranslationManager);
-
 	// Initialize the Qt translation system.
 	QString qtLocale = QStringLiteral("qt_") + locale;
 	bool isQtSysTranslator = false;
@@ -141,10 +192,10 @@ void TranslationManager::setTranslation(const QString &locale)
 	// Qt on Unix (but not Mac) is usually installed system-wide.
 	// Check the Qt library path first.
 #  if QT_VERSION >= QT_VERSION_CHECK(6,0,0)
-	isQtSysTranslator = d->qtTranslator->load(qtLocale,
+	isQtSysTranslator = qtTr->load(qtLocale,
 		QLibraryInfo::path(QLibraryInfo::TranslationsPath));
 #  else /* QT_VERSION < QT_VERSION_CHECK(6,0,0) */
-	isQtSysTranslator = d->qtTranslator->load(qtLocale,
+	isQtSysTranslator = qtTr->load(qtLocale,
 		QLibraryInfo::location(QLibraryInfo::TranslationsPath));
 #  endif /* QT_VERSION >= QT_VERSION_CHECK(6,0,0) */
 #else
@@ -154,8 +205,8 @@ void TranslationManager::setTranslation(const QString &locale)
 	if (!isQtSysTranslator) {
 		// System-wide translations aren't installed.
 		// Check other paths.
-		foreach (const QString &path, d->pathList) {
-			if (d->qtTranslator->load(qtLocale, path)) {
+		foreach (const QString &path, pathList) {
+			if (qtTr->load(qtLocale, path)) {
 				break;
 			}
 		}
@@ -163,33 +214,19 @@ void TranslationManager::setTranslation(const QString &locale)
 
 	// Initialize the application translator.
 	QString prgLocale = QStringLiteral("rvthtool_") + locale;
-	foreach (const QString &path, d->pathList) {
-		if (d->prgTranslator->load(prgLocale, path)) {
+	foreach (const QString &path, pathList) {
+		if (prgTr->load(prgLocale, path)) {
 			break;
 		}
 	}
-
-	/** Translation file information. **/
-
-	//: Translation file author. Put your name here.
-	QString tsAuthor = tr("David Korth", "ts-author");
-	Q_UNUSED(tsAuthor)
-	//: Language this translation provides, e.g. "English (US)".
-	QString tsLanguage = tr("Default", "ts-language");
-	Q_UNUSED(tsLanguage)
-	//: Locale name, e.g. "en_US".
-	QString tsLocale = tr("C", "ts-locale");
-	Q_UNUSED(tsLocale)
 }
 
 /**
  * Enumerate available translations.
- * NOTE: This only checks rvthtool translations.
- * If a Qt translation exists but rvthtool doesn't have
- * that translation, it won't show up.
+ * This can be called from any thread.
  * @return Map of available translations. (Key == locale, Value == description)
  */
-QMap<QString, QString> TranslationManager::enumerate(void) const
+QMap<QString, QString> TranslationManagerPrivate::enumerateTranslations(void) const
 {
 	// Name filters.
 	// Remember that compiled translations have the
@@ -205,10 +242,9 @@ QMap<QString, QString> TranslationManager::enumerate(void) const
 	// Search the paths for TS files.
 	static const QDir::Filters filters = (QDir::Files | QDir::Readable);
 
-	Q_D(const TranslationManager);
 	QMap<QString, QString> tsMap;
 	QTranslator tmpTs;
-	foreach (const QString &path, d->pathList) {
+	foreach (const QString &path, pathList) {
 		QDir dir(path);
 		QFileInfoList files = dir.entryInfoList(nameFilters, filters);
 		foreach (const QFileInfo &file, files) {
@@ -231,3 +267,242 @@ QMap<QString, QString> TranslationManager::enumerate(void) const
 	// Translations enumerated.
 	return tsMap;
 }
+
+/**
+ * Install the translation that was loaded in the background.
+ * If it's still loading, this waits for it to finish.
+ */
+void TranslationManagerPrivate::finishAsync(void)
+{
+	if (!asyncPending)
+		return;
+
+	if (asyncThread.joinable()) {
+		StartupProfiler::Timer timer("wait for background translation");
+		asyncThread.join();
+	}
+
+	// Replace the installed translators.
+	QCoreApplication::removeTranslator(qtTranslator);
+	QCoreApplication::removeTranslator(prgTranslator);
+	delete qtTranslator;
+	delete prgTranslator;
+	qtTranslator = asyncQtTranslator;
+	prgTranslator = asyncPrgTranslator;
+	asyncQtTranslator = nullptr;
+	asyncPrgTranslator = nullptr;
+	QCoreApplication::installTranslator(qtTranslator);
+	QCoreApplication::installTranslator(prgTranslator);
+
+	locale = asyncLocale;
+	hasLocale = true;
+	asyncLocale.clear();
+	asyncPending = false;
+
+	// Widgets created before the translation was installed
+	// need to be retranslated. QCoreApplication only sends
+	// LanguageChange if the event loop is running.
+	QEvent event(QEvent::LanguageChange);
+	QCoreApplication::sendEvent(QCoreApplication::instance(), &event);
+}
+
+/**
+ * Discard the translation that was loaded in the background.
+ * If it's still loading, this waits for it to finish.
+ */
+void TranslationManagerPrivate::discardAsync(void)
+{
+	if (!asyncPending)
+		return;
+
+	if (asyncThread.joinable()) {
+		asyncThread.join();
+	}
+	delete asyncQtTranslator;
+	delete asyncPrgTranslator;
+	asyncQtTranslator = nullptr;
+	asyncPrgTranslator = nullptr;
+	asyncLocale.clear();
+	asyncPending = false;
+}
+
+/** TranslationManager **/
+
+TranslationManager::TranslationManager(QObject *parent)
+	: super(parent)
+	, d_ptr(new TranslationManagerPrivate(this))
+{ }
+
+TranslationManager::~TranslationManager()
+{
+	delete d_ptr;
+}
+
+TranslationManager* TranslationManager::instance(void)
+{
+	if (!TranslationManagerPrivate::instance)
+		TranslationManagerPrivate::instance = new TranslationManager();
+	return TranslationManagerPrivate::instance;
+}
+
+/**
+ * Set the translation.
+ * Nothing is done if the translation is already set.
+ * If the translation is being loaded in the background,
+ * this waits for it to finish loading, then installs it.
+ * @param locale Locale, e.g. "en_US". (Empty string is untranslated.)
+ */
+void TranslationManager::setTranslation(const QString &locale)
+{
+	Q_D(TranslationManager);
+
+	if (d->asyncPending) {
+		if (d->asyncLocale == locale) {
+			// This translation is being loaded in the background.
+			d->finishAsync();
+			return;
+		}
+		// A different translation is being loaded.
+		d->discardAsync();
+	}
+
+	if (d->hasLocale && d->locale == locale) {
+		// Translation is already set.
+		return;
+	}
+
+	// NOTE: Loading an installed QTranslator sends LanguageChange
+	// if the event loop is running, so the UI is retranslated.
+	d->loadTranslators(locale, d->qtTranslator, d->prgTranslator);
+	d->locale = locale;
+	d->hasLocale = true;
+
+	/** Translation file information. **/
+
+	//: Translation file author. Put your name here.
+	QString tsAuthor = tr("David Korth", "ts-author");
+	Q_UNUSED(tsAuthor)
+	//: Language this translation provides, e.g. "English (US)".
+	QString tsLanguage = tr("Default", "ts-language");
+	Q_UNUSED(tsLanguage)
+	//: Locale name, e.g. "en_US".
+	QString tsLocale = tr("C", "ts-locale");
+	Q_UNUSED(tsLocale)
+}
+
+/**
+ * Start loading a translation in the background.
+ *
+ * The translation is installed by the next call to setTranslation()
+ * with the same locale, so the translation files can be read while
+ * the main window is being created. The UI is retranslated when
+ * the translation is installed.
+ *
+ * The available translations are also enumerated in the background.
+ * (See isEnumerating().)
+ *
+ * @param locale Locale, e.g. "en_US". (Empty string is untranslated.)
+ */
+void TranslationManager::loadTranslationAsync(const QString &locale)
+{
+	Q_D(TranslationManager);
+
+	if (d->asyncPending && d->asyncLocale == locale) {
+		// Already loading this translation.
+		return;
+	}
+	d->discardAsync();
+
+	if (!(d->hasLocale && d->locale == locale)) {
+		// NOTE: The new QTranslators aren't installed until
+		// finishAsync(), so they can be loaded on another thread.
+		d->asyncQtTranslator = new QTranslator();
+		d->asyncPrgTranslator = new QTranslator();
+		d->asyncLocale = locale;
+		d->asyncPending = true;
+
+		QTranslator *const qtTr = d->asyncQtTranslator;
+		QTranslator *const prgTr = d->asyncPrgTranslator;
+		try {
+			d->asyncThread = std::thread([d, locale, qtTr, prgTr]() {
+				StartupProfiler::Timer timer("load translation (background)");
+				d->loadTranslators(locale, qtTr, prgTr);
+			});
+		} catch (const std::system_error&) {
+			// Unable to start the thread.
+			// Load the translation here instead.
+			d->loadTranslators(locale, qtTr, prgTr);
+		}
+	}
+
+	if (!d->tsMapValid && !d->enumerating) {
+		// Enumerate the available translations.
+		d->enumerating = true;
+		try {
+			d->enumThread = std::thread([this, d]() {
+				{
+					StartupProfiler::Timer timer("enumerate translations (background)");
+					d->tsMap = d->enumerateTranslations();
+				}
+
+				// Notify listeners on the main thread.
+				QMetaObject::invokeMethod(this, "enumerationFinished", Qt::QueuedConnection);
+			});
+		} catch (const std::system_error&) {
+			// Unable to start the thread.
+			// Translations will be enumerated by enumerate().
+			d->enumerating = false;
+		}
+	}
+}
+
+/**
+ * Enumerate available translations.
+ * NOTE: This only checks rvthtool translations.
+ * If a Qt translation exists but rvthtool doesn't have
+ * that translation, it won't show up.
+ * @return Map of available translations. (Key == locale, Value == description)
+ */
+QMap<QString, QString> TranslationManager::enumerate(void) const
+{
+	Q_D(const TranslationManager);
+
+	if (d->enumThread.joinable()) {
+		// Wait for background enumeration to finish.
+		// NOTE: enumerated() is still emitted afterwards.
+		d->enumThread.join();
+		d->tsMapValid = true;
+	} else if (!d->tsMapValid) {
+		d->tsMap = d->enumerateTranslations();
+		d->tsMapValid = true;
+	}
+
+	return d->tsMap;
+}
+
+/**
+ * Are the available translations being enumerated in the background?
+ * If so, enumerated() will be emitted once they're available.
+ * enumerate() can still be called, but it will block until
+ * enumeration is finished.
+ * @return True if enumerating in the background.
+ */
+bool TranslationManager::isEnumerating(void) const
+{
+	Q_D(const TranslationManager);
+	return d->enumerating;
+}
+
+/**
+ * Background enumeration has finished.
+ */
+void TranslationManager::enumerationFinished(void)
+{
+	Q_D(TranslationManager);
+	if (d->enumThread.joinable()) {
+		d->enumThread.join();
+	}
+	d->tsMapValid = true;
+	d->enumerating = false;
+	emit enumerated();
+}
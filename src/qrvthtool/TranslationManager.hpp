@@ -2,7 +2,7 @@
  * RVT-H Tool (qrvthtool)                                                  *
  * TranslationManager.hpp: Qt translation manager.                         *
  *                                                                         *
- * Copyright (c) 2014-2018 by David Korth.                                 *
+ * Copyright (c) 2014-2024 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
@@ -35,10 +35,28 @@ class TranslationManager : public QObject
 
 		/**
 		 * Set the translation.
+		 * Nothing is done if the translation is already set.
+		 * If the translation is being loaded in the background,
+		 * this waits for it to finish loading, then installs it.
 		 * @param locale Locale, e.g. "en_US". (Empty string is untranslated.)
 		 */
 		void setTranslation(const QString &locale);
 
+		/**
+		 * Start loading a translation in the background.
+		 *
+		 * The translation is installed by the next call to setTranslation()
+		 * with the same locale, so the translation files can be read while
+		 * the main window is being created. The UI is retranslated when
+		 * the translation is installed.
+		 *
+		 * The available translations are also enumerated in the background.
+		 * (See isEnumerating().)
+		 *
+		 * @param locale Locale, e.g. "en_US". (Empty string is untranslated.)
+		 */
+		void loadTranslationAsync(const QString &locale);
+
 		// TODO: Add a function to get the current translation?
 
 		/**
@@ -49,6 +67,27 @@ class TranslationManager : public QObject
 		 * @return Map of available translations. (Key == locale, Value == description)
 		 */
 		QMap<QString, QString> enumerate(void) const;
+
+		/**
+		 * Are the available translations being enumerated in the background?
+		 * If so, enumerated() will be emitted once they're available.
+		 * enumerate() can still be called, but it will block until
+		 * enumeration is finished.
+		 * @return True if enumerating in the background.
+		 */
+		bool isEnumerating(void) const;
+
+	signals:
+		/**
+		 * The available translations have been enumerated in the background.
+		 */
+		void enumerated(void);
+
+	private slots:
+		/**
+		 * Background enumeration has finished.
+		 */
+		void enumerationFinished(void);
 };
 
 #endif /* __RVTHTOOL_QRVTHTOOL_TRANSLATIONMANAGER_HPP__ */
@@ -0,0 +1,28 @@
+/***************************************************************************
+ * RVT-H Tool (qrvthtool)                                                  *
+ * VerifyMap.hpp: Per-partition verification results.                      *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_QRVTHTOOL_VERIFYMAP_HPP__
+#define __RVTHTOOL_QRVTHTOOL_VERIFYMAP_HPP__
+
+#include <QtCore/QVector>
+
+// Verification results for a single partition.
+struct VerifyPartitionMap {
+	unsigned int group_total;	// Total number of 2 MB groups
+	unsigned int group_done;	// Number of groups verified so far
+	QVector<unsigned int> errors;	// Error count for each group
+
+	VerifyPartitionMap()
+		: group_total(0)
+		, group_done(0) { }
+};
+
+// Verification results for a bank, indexed by partition number.
+typedef QVector<VerifyPartitionMap> VerifyMap;
+
+#endif /* __RVTHTOOL_QRVTHTOOL_VERIFYMAP_HPP__ */
@@ -2,7 +2,7 @@
  * RVT-H Tool (qrvthtool)                                                  *
  * WorkerObject.cpp: Worker object for extract/import/etc.                 *
  *                                                                         *
- * Copyright (c) 2018-2019 by David Korth.                                 *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
@@ -15,11 +15,30 @@
 #include <cassert>
 #include <cerrno>
 
+#ifdef __linux__
+// ioprio_set()
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#endif /* __linux__ */
+
+// C++ includes.
+#include <atomic>
+
 // Qt includes.
 #include <QtCore/QFileInfo>
+#include <QtCore/QMutex>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QThread>
 
 /** WorkerObjectPrivate **/
 
+// Progress updates are stored in the shared status, which the UI
+// thread polls at its own frame rate. The interval here only limits
+// how often the status text is rebuilt and `cancel` is checked.
+// Verification errors are batched so a badly-damaged bank doesn't
+// lock the verify map once per error.
+static const RvtH_ProgressParams progress_params = {50, 0, 256};
+
 class WorkerObjectPrivate
 {
 	public:
@@ -29,7 +48,12 @@ class WorkerObjectPrivate
 			, bank(~0U)
 			, flags(0U)
 			, recryption_key(-1)
-			, cancel(false) { }
+			, lowPriority(false)
+			, cancel(false)
+			, statusValue(-1)
+			, statusMax(-1)
+			, statusChanged(false)
+			, verifyMapChanged(false) { }
 
 	protected:
 		WorkerObject *const q_ptr;
@@ -45,10 +69,44 @@ class WorkerObjectPrivate
 		unsigned int bank;
 		unsigned int flags;
 		int recryption_key;
+		bool lowPriority;
 
 		// Cancel the current process.
-		// TODO: Mutex?
-		bool cancel;
+		std::atomic<bool> cancel;
+
+		// Latest status, shared with the UI thread.
+		// Only the most recent value is kept; see takeStatus().
+		QMutex statusMutex;
+		QString statusText;
+		int statusValue;
+		int statusMax;
+		std::atomic<bool> statusChanged;
+
+		// Latest verification results, shared with the UI thread.
+		// Protected by statusMutex; see takeVerifyMap().
+		VerifyMap verifyMap;
+		std::atomic<bool> verifyMapChanged;
+
+		/**
+		 * Set the latest status.
+		 * @param text Status text
+		 * @param progress_value Progress bar value. (If -1, ignore this.)
+		 * @param progress_max Progress bar maximum. (If -1, ignore this.)
+		 */
+		void setStatus(const QString &text, int progress_value, int progress_max);
+
+		/**
+		 * Update the verification results.
+		 * @param state		[in] Current verification progress.
+		 */
+		void updateVerifyMap(const RvtH_Verify_Progress_State *state);
+
+		/**
+		 * Lower the calling thread's CPU and I/O priority.
+		 * Threads created afterwards (e.g. the verify pipeline's
+		 * reader and worker threads) inherit the lower priority.
+		 */
+		static void lowerThreadPriority(void);
 
 	public:
 		/**
@@ -58,10 +116,125 @@ class WorkerObjectPrivate
 		 * @return True to continue; false to abort.
 		 */
 		static bool progress_callback(const RvtH_Progress_State *state, void *userdata);
+
+		/**
+		 * RVT-H verify progress callback.
+		 * @param state		[in] Current progress.
+		 * @param userdata	[in] User data specified when calling the RVT-H function.
+		 * @return True to continue; false to abort.
+		 */
+		static bool verify_progress_callback(const RvtH_Verify_Progress_State *state, void *userdata);
 };
 
 /** WorkerObjectPrivate **/
 
+/**
+ * Set the latest status.
+ * @param text Status text
+ * @param progress_value Progress bar value. (If -1, ignore this.)
+ * @param progress_max Progress bar maximum. (If -1, ignore this.)
+ */
+void WorkerObjectPrivate::setStatus(const QString &text, int progress_value, int progress_max)
+{
+	QMutexLocker locker(&statusMutex);
+	statusText = text;
+	if (progress_value >= 0 && progress_max >= 0) {
+		statusValue = progress_value;
+		statusMax = progress_max;
+	}
+	statusChanged = true;
+}
+
+/**
+ * Update the verification results.
+ * @param state		[in] Current verification progress.
+ */
+void WorkerObjectPrivate::updateVerifyMap(const RvtH_Verify_Progress_State *state)
+{
+	QMutexLocker locker(&statusMutex);
+	if (verifyMap.size() < static_cast<int>(state->pt_total)) {
+		verifyMap.resize(state->pt_total);
+	}
+
+	// Partitions before the current one have been verified.
+	const int pt = state->pt_current;
+	for (int i = 0; i < pt && i < verifyMap.size(); i++) {
+		verifyMap[i].group_done = verifyMap[i].group_total;
+	}
+	if (pt >= verifyMap.size()) {
+		// All partitions have been verified.
+		verifyMapChanged = true;
+		return;
+	}
+
+	VerifyPartitionMap &ptMap = verifyMap[pt];
+	switch (state->type) {
+		case RVTH_VERIFY_STATUS:
+			ptMap.group_total = state->group_total;
+			ptMap.group_done = state->group_cur;
+			if (ptMap.errors.size() < static_cast<int>(state->group_total)) {
+				ptMap.errors.resize(state->group_total);
+			}
+			break;
+
+		case RVTH_VERIFY_ERROR_REPORT:
+			if (ptMap.errors.size() <= static_cast<int>(state->group_cur)) {
+				ptMap.errors.resize(state->group_cur + 1);
+			}
+			ptMap.errors[state->group_cur]++;
+			break;
+
+		case RVTH_VERIFY_ERROR_BATCH:
+			for (unsigned int i = 0; i < state->error_count; i++) {
+				const unsigned int group = state->errors[i].group;
+				if (ptMap.errors.size() <= static_cast<int>(group)) {
+					ptMap.errors.resize(group + 1);
+				}
+				ptMap.errors[group]++;
+			}
+			break;
+
+		case RVTH_VERIFY_GROUPS_MISSING: {
+			const unsigned int group_end = state->group_cur + state->missing_count;
+			if (ptMap.errors.size() < static_cast<int>(group_end)) {
+				ptMap.errors.resize(group_end);
+			}
+			for (unsigned int group = state->group_cur; group < group_end; group++) {
+				ptMap.errors[group]++;
+			}
+			break;
+		}
+
+		default:
+			break;
+	}
+	verifyMapChanged = true;
+}
+
+/**
+ * Lower the calling thread's CPU and I/O priority.
+ * Threads created afterwards (e.g. the verify pipeline's
+ * reader and worker threads) inherit the lower priority.
+ */
+void WorkerObjectPrivate::lowerThreadPriority(void)
+{
+	// NOTE: On Linux, IdlePriority uses SCHED_IDLE.
+	QThread::currentThread()->setPriority(QThread::IdlePriority);
+
+#if defined(__linux__) && defined(SYS_ioprio_set)
+	// Use the idle I/O scheduling class so reads from the
+	// RVT-H Reader only use otherwise-idle disk time.
+	// NOTE: glibc doesn't wrap ioprio_set(), so the constants
+	// from <linux/ioprio.h> are defined here.
+	static const int IOPRIO_WHO_PROCESS = 1;	// pid 0 == calling thread
+	static const int IOPRIO_CLASS_IDLE = 3;
+	static const int IOPRIO_CLASS_SHIFT = 13;
+	syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+#endif /* __linux__ && SYS_ioprio_set */
+	// TODO: Windows: THREAD_MODE_BACKGROUND_BEGIN lowers I/O priority,
+	// but it isn't inherited by the verify pipeline's threads.
+}
+
 /**
  * RVT-H progress callback.
  * @param state		[in] Current progress.
@@ -71,7 +244,6 @@ class WorkerObjectPrivate
 bool WorkerObjectPrivate::progress_callback(const RvtH_Progress_State *state, void *userdata)
 {
 	WorkerObjectPrivate *const d = static_cast<WorkerObjectPrivate*>(userdata);
-	WorkerObject *const q = d->q_ptr;
 
 	// TODO: Don't show the bank number if the source image is a standalone disc image.
 	#define MEGABYTE (1048576 / LBA_SIZE)
@@ -112,16 +284,63 @@ bool WorkerObjectPrivate::progress_callback(const RvtH_Progress_State *state, vo
 			return false;
 	}
 
+	// Append the throughput and ETA, as computed by librvth.
+	if (!text.isEmpty() && state->bytes_per_sec > 0.0) {
+		const QString rate = QString::number(state->bytes_per_sec / 1048576.0, 'f', 1);
+		if (state->eta_sec > 0) {
+			const qint64 eta = state->eta_sec;
+			const QChar zero(L'0');
+			const QString etaText = (eta >= 3600)
+				? QStringLiteral("%1:%2:%3").arg(eta / 3600)
+					.arg((eta / 60) % 60, 2, 10, zero).arg(eta % 60, 2, 10, zero)
+				: QStringLiteral("%1:%2").arg(eta / 60).arg(eta % 60, 2, 10, zero);
+			text += WorkerObject::tr(" (%1 MiB/s, %2 remaining)").arg(rate, etaText);
+		} else {
+			text += WorkerObject::tr(" (%1 MiB/s)").arg(rate);
+		}
+	}
+
 	// Update the progress bar.
 	if (state->type != RVTH_PROGRESS_RECRYPT) {
 		// Progress is valid.
-		emit q->updateStatus(text,
+		d->setStatus(text,
 			static_cast<int>(state->lba_processed),
 			static_cast<int>(state->lba_total));
 	} else {
 		// Progress is not useful here.
 		// Specify -1 for the values.
-		emit q->updateStatus(text, -1, -1);
+		d->setStatus(text, -1, -1);
+	}
+
+	// Return `true` to continue.
+	// If `cancel` is set, return `false` to cancel.
+	return !d->cancel;
+}
+
+/**
+ * RVT-H verify progress callback.
+ * @param state		[in] Current progress.
+ * @param userdata	[in] User data specified when calling the RVT-H function.
+ * @return True to continue; false to abort.
+ */
+bool WorkerObjectPrivate::verify_progress_callback(const RvtH_Verify_Progress_State *state, void *userdata)
+{
+	WorkerObjectPrivate *const d = static_cast<WorkerObjectPrivate*>(userdata);
+
+	// Errors are counted by verifyWiiPartitions(), but the
+	// verify map shows where they are.
+	d->updateVerifyMap(state);
+
+	if (state->type == RVTH_VERIFY_STATUS) {
+		const QString text = WorkerObject::tr("Verifying Bank %1: Partition %2 of %3, group %L4 / %L5...")
+			.arg(d->bank+1)
+			.arg(state->pt_current < state->pt_total ? state->pt_current+1 : state->pt_current)
+			.arg(state->pt_total)
+			.arg(state->group_cur)
+			.arg(state->group_total);
+		d->setStatus(text,
+			static_cast<int>(state->group_cur),
+			static_cast<int>(state->group_total));
 	}
 
 	// Return `true` to continue.
@@ -243,6 +462,70 @@ void WorkerObject::setFlags(unsigned int flags)
 	d->flags = flags;
 }
 
+/**
+ * Should the process run at a lower CPU and I/O priority?
+ * @return True if low priority; false if normal priority.
+ */
+bool WorkerObject::lowPriority(void) const
+{
+	Q_D(const WorkerObject);
+	return d->lowPriority;
+}
+
+/**
+ * Set whether the process should run at a lower CPU and I/O priority.
+ * Currently only used by doVerify().
+ * @param lowPriority True for low priority; false for normal priority.
+ */
+void WorkerObject::setLowPriority(bool lowPriority)
+{
+	Q_D(WorkerObject);
+	d->lowPriority = lowPriority;
+}
+
+/**
+ * Get the latest status, if it has changed since the last call.
+ * Intermediate updates are dropped; only the most recent one is returned.
+ * This can be called from any thread.
+ * @param text		[out] Status text
+ * @param progress_value	[out] Progress bar value (-1 if not available)
+ * @param progress_max	[out] Progress bar maximum (-1 if not available)
+ * @return True if the status has changed; false if not.
+ */
+bool WorkerObject::takeStatus(QString &text, int &progress_value, int &progress_max)
+{
+	Q_D(WorkerObject);
+	if (!d->statusChanged.exchange(false)) {
+		// No change.
+		return false;
+	}
+
+	QMutexLocker locker(&d->statusMutex);
+	text = d->statusText;
+	progress_value = d->statusValue;
+	progress_max = d->statusMax;
+	return true;
+}
+
+/**
+ * Get the latest verification results, if they have changed since the last call.
+ * This can be called from any thread.
+ * @param map		[out] Verification results
+ * @return True if the results have changed; false if not.
+ */
+bool WorkerObject::takeVerifyMap(VerifyMap &map)
+{
+	Q_D(WorkerObject);
+	if (!d->verifyMapChanged.exchange(false)) {
+		// No change.
+		return false;
+	}
+
+	QMutexLocker locker(&d->statusMutex);
+	map = d->verifyMap;
+	return true;
+}
+
 /** Worker functions **/
 
 /**
@@ -287,6 +570,7 @@ void WorkerObject::doExtract(void)
 	}
 
 	d->cancel = false;
+	d->rvth->setProgressParams(&progress_params);
 #ifdef _WIN32
 	int ret = d->rvth->extract(d->bank,
 		reinterpret_cast<const wchar_t*>(d->gcmFilename.utf16()),
@@ -337,6 +621,7 @@ void WorkerObject::doImport(void)
 	}
 
 	d->cancel = false;
+	d->rvth->setProgressParams(&progress_params);
 #ifdef _WIN32
 	int ret = d->rvth->import(d->bank,
 		reinterpret_cast<const wchar_t*>(d->gcmFilename.utf16()),
@@ -357,3 +642,69 @@ void WorkerObject::doImport(void)
 			.arg(d->gcmFilenameOnly).arg(d->bank+1).arg(ret), ret);
 	}
 }
+
+/**
+ * Start a verification process.
+ *
+ * The following properties must be set before calling this function:
+ * - rvth
+ * - bank
+ *
+ * Optional parameters:
+ * - flags (RvtH_Verify_Flags; default is 0)
+ * - lowPriority (default is false)
+ */
+void WorkerObject::doVerify(void)
+{
+	// NOTE: Callback is set to use the private class.
+	Q_D(WorkerObject);
+	if (!d->rvth) {
+		emit finished(tr("doVerify() ERROR: rvth object is not set."), -EINVAL);
+		return;
+	} else if (d->bank >= d->rvth->bankCount()) {
+		if (d->bank == ~0U) {
+			emit finished(tr("doVerify() ERROR: Bank number is not set."), -EINVAL);
+		} else {
+			emit finished(tr("doVerify() ERROR: Bank number %1 is out of range.")
+				.arg(d->bank+1), -ERANGE);
+		}
+		return;
+	}
+
+	if (d->lowPriority) {
+		// NOTE: The job's thread is deleted afterwards,
+		// so the priority doesn't need to be restored.
+		d->lowerThreadPriority();
+	}
+
+	d->cancel = false;
+	{
+		QMutexLocker locker(&d->statusMutex);
+		d->verifyMap.clear();
+	}
+	d->rvth->setProgressParams(&progress_params);
+	unsigned int error_count[5] = {0, 0, 0, 0, 0};
+	int ret = d->rvth->verifyWiiPartitions(d->bank, error_count,
+		d->verify_progress_callback, d, 0, d->flags);
+
+	if (ret != 0) {
+		// An error occurred...
+		emit finished(tr("doVerify() ERROR verifying Bank %1: %2")
+			.arg(d->bank+1).arg(ret), ret);
+		return;
+	}
+
+	unsigned int total_errs = 0;
+	for (unsigned int count : error_count) {
+		total_errs += count;
+	}
+	if (total_errs == 0) {
+		// Successfully verified.
+		emit finished(tr("Bank %1 verified successfully. No errors were found.")
+			.arg(d->bank+1), 0);
+	} else {
+		// Hash errors were found.
+		emit finished(tr("Bank %1 has %Ln hash error(s).", "", static_cast<int>(total_errs))
+			.arg(d->bank+1), -EIO);
+	}
+}
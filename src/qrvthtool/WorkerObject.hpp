@@ -12,6 +12,8 @@
 // librvth
 #include "librvth/rvth.hpp"
 
+#include "VerifyMap.hpp"
+
 // Qt includes.
 #include <QtCore/QObject>
 class QLabel;
@@ -27,6 +29,7 @@ class WorkerObject : public QObject
 	Q_PROPERTY(unsigned int bank READ bank WRITE setBank)
 	Q_PROPERTY(QString gcmFilename READ gcmFilename WRITE setGcmFilename)
 	Q_PROPERTY(int recryptionKey READ recryptionKey WRITE setRecryptionKey)
+	Q_PROPERTY(bool lowPriority READ lowPriority WRITE setLowPriority)
 	
 	public:
 		explicit WorkerObject(QObject *parent = nullptr);
@@ -104,16 +107,41 @@ class WorkerObject : public QObject
 		 */
 		void setFlags(unsigned int flags);
 
-	signals:
-		/** Signals **/
+		/**
+		 * Should the process run at a lower CPU and I/O priority?
+		 * @return True if low priority; false if normal priority.
+		 */
+		bool lowPriority(void) const;
 
 		/**
-		 * Update the status bar.
-		 * @param text Status bar text.
-		 * @param progress_value Progress bar value. (If -1, ignore this.)
-		 * @param progress_max Progress bar maximum. (If -1, ignore this.)
+		 * Set whether the process should run at a lower CPU and I/O priority.
+		 * Currently only used by doVerify().
+		 * @param lowPriority True for low priority; false for normal priority.
 		 */
-		void updateStatus(const QString &text, int progress_value, int progress_max);
+		void setLowPriority(bool lowPriority);
+
+	public:
+		/**
+		 * Get the latest status, if it has changed since the last call.
+		 * Intermediate updates are dropped; only the most recent one is returned.
+		 * This can be called from any thread.
+		 * @param text		[out] Status text
+		 * @param progress_value	[out] Progress bar value (-1 if not available)
+		 * @param progress_max	[out] Progress bar maximum (-1 if not available)
+		 * @return True if the status has changed; false if not.
+		 */
+		bool takeStatus(QString &text, int &progress_value, int &progress_max);
+
+		/**
+		 * Get the latest verification results, if they have changed since the last call.
+		 * This can be called from any thread.
+		 * @param map		[out] Verification results
+		 * @return True if the results have changed; false if not.
+		 */
+		bool takeVerifyMap(VerifyMap &map);
+
+	signals:
+		/** Signals **/
 
 		/**
 		 * Process is finished.
@@ -153,6 +181,19 @@ class WorkerObject : public QObject
 		 * - gcmFilename
 		 */
 		void doImport(void);
+
+		/**
+		 * Start a verification process.
+		 *
+		 * The following properties must be set before calling this function:
+		 * - rvth
+		 * - bank
+		 *
+		 * Optional parameters:
+		 * - flags (RvtH_Verify_Flags; default is 0)
+		 * - lowPriority (default is false)
+		 */
+		void doVerify(void);
 };
 
 #endif /* __RVTHTOOL_QRVTHTOOL_WORKEROBJECT_HPP__ */
@@ -13,9 +13,15 @@
 // Qt includes.
 #include <QApplication>
 #include <QtCore/QDir>
+#include <QtCore/QTimer>
+
+// C includes. (C++ namespace)
+#include <cstring>
 
 // TranslationManager
 #include "TranslationManager.hpp"
+// Startup time profiler
+#include "StartupProfiler.hpp"
 
 #ifdef _WIN32
 # include <windows.h>
@@ -65,6 +71,15 @@ static void RegisterTaskbarButtonCreatedMessage(void)
  */
 int main(int argc, char *argv[])
 {
+	// Check for --profile-startup first so the
+	// profiler includes QApplication initialization.
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--profile-startup")) {
+			StartupProfiler::enable();
+			break;
+		}
+	}
+
 	// Set high-DPI mode on Qt 5. (not needed on Qt 6)
 #if QT_VERSION >= QT_VERSION_CHECK(5,0,0) && QT_VERSION < QT_VERSION_CHECK(6,0,0)
 	// Enable High DPI.
@@ -84,6 +99,7 @@ int main(int argc, char *argv[])
 	app->setOrganizationDomain(QStringLiteral("gerbilsoft.com"));
 	app->setOrganizationName(QStringLiteral("GerbilSoft"));
 	app->setApplicationVersion(QStringLiteral(VERSION_STRING));
+	StartupProfiler::mark("QApplication created");
 
 	app->setApplicationDisplayName(QStringLiteral("RVT-H Tool"));
 #if QT_VERSION >= QT_VERSION_CHECK(5,7,0)
@@ -91,8 +107,11 @@ int main(int argc, char *argv[])
 #endif /* QT_VERSION >= QT_VERSION_CHECK(5,7,0) */
 
 	// Initialize the TranslationManager.
+	// The translation is loaded in the background while the main
+	// window is being created, and installed by the Language Menu.
 	TranslationManager *const tsm = TranslationManager::instance();
-	tsm->setTranslation(QLocale::system().name());
+	tsm->loadTranslationAsync(QLocale::system().name());
+	StartupProfiler::mark("translation loading started");
 
 	// TODO: Call QApplication::setWindowIcon().
 
@@ -112,9 +131,11 @@ int main(int argc, char *argv[])
 
 	// Initialize the QRvtHToolWindow.
 	QRvtHToolWindow *window = new QRvtHToolWindow();
+	StartupProfiler::mark("main window created");
 
 	// If a filename was specified, open it.
 	QStringList args = app->arguments();
+	args.removeAll(QStringLiteral("--profile-startup"));
 	if (args.size() >= 2) {
 		// TODO: Better device file check.
 		const QString &filename = args.at(1);
@@ -124,10 +145,17 @@ int main(int argc, char *argv[])
 		bool isDevice = filename.startsWith(QStringLiteral("/dev/"));
 #endif /* _WIN32 */
 		window->openRvtH(QDir::fromNativeSeparators(filename), isDevice);
+		StartupProfiler::mark("file open started");
 	}
 
 	// Show the window.
 	window->show();
+	StartupProfiler::mark("main window shown");
+	if (StartupProfiler::isEnabled()) {
+		QTimer::singleShot(0, []() {
+			StartupProfiler::mark("event loop started");
+		});
+	}
 
 	// Run the Qt UI.
 	return app->exec();
@@ -10,6 +10,7 @@
 
 // For LBA_TO_BYTES()
 #include "nhcd_structs.h"
+#include "librvth/rvth_error.h"
 
 // C includes (C++ namespace)
 #include <cassert>
@@ -40,6 +41,11 @@ class BankEntryViewPrivate
 
 		const RvtH_BankEntry *bankEntry;
 
+		// Details loaded in the background.
+		// If hasDetails is false, they're still loading.
+		BankDetails details;
+		bool hasDetails;
+
 		static inline int calc_frac_part(quint64 size, quint64 mask);
 
 		/**
@@ -67,6 +73,7 @@ class BankEntryViewPrivate
 BankEntryViewPrivate::BankEntryViewPrivate(BankEntryView *q)
 	: q_ptr(q)
 	, bankEntry(nullptr)
+	, hasDetails(false)
 { }
 
 inline int BankEntryViewPrivate::calc_frac_part(quint64 size, quint64 mask)
@@ -322,6 +329,19 @@ void BankEntryViewPrivate::updateWidgetDisplay(void)
 	ui.lblRegion->show();
 	ui.lblRegionTitle->show();
 
+	// Filesystem summary. (loaded in the background)
+	if (!hasDetails) {
+		ui.lblFiles->setText(BankEntryView::tr("Loading..."));
+	} else if (details.err != 0) {
+		ui.lblFiles->setText(BankEntryView::tr("Unable to read the filesystem: %1")
+			.arg(QString::fromUtf8(rvth_error(details.err))));
+	} else {
+		ui.lblFiles->setText(BankEntryView::tr("%Ln file(s), %1", "", static_cast<int>(details.fileCount))
+			.arg(formatFileSize(details.totalSize)));
+	}
+	ui.lblFiles->show();
+	ui.lblFilesTitle->show();
+
 	// Wii-only fields.
 	if (bankEntry->type == RVTH_BankType_Wii_SL ||
 	    bankEntry->type == RVTH_BankType_Wii_DL)
@@ -373,6 +393,11 @@ void BankEntryViewPrivate::updateWidgetDisplay(void)
 			static_cast<RVL_SigStatus_e>(bankEntry->tmd.sig_status)));
 		ui.lblTMDSig->show();
 		ui.lblTMDSigTitle->show();
+
+		// Verification results.
+		const bool hasVerifyMap = !ui.hmVerify->verifyMap().isEmpty();
+		ui.lblVerifyTitle->setVisible(hasVerifyMap);
+		ui.hmVerify->setVisible(hasVerifyMap);
 	} else {
 		// Not Wii. Hide the fields.
 		ui.lblIOSVersionTitle->hide();
@@ -383,6 +408,8 @@ void BankEntryViewPrivate::updateWidgetDisplay(void)
 		ui.lblTicketSig->hide();
 		ui.lblTMDSigTitle->hide();
 		ui.lblTMDSig->hide();
+		ui.lblVerifyTitle->hide();
+		ui.hmVerify->hide();
 	}
 
 	// AppLoader status.
@@ -500,6 +527,40 @@ void BankEntryView::setBankEntry(const RvtH_BankEntry *bankEntry)
 	d->updateWidgetDisplay();
 }
 
+/**
+ * Set the details for the RvtH_BankEntry being displayed.
+ * These are loaded in the background by BankDetailsLoader.
+ * @param details Bank details, or nullptr if they're still loading.
+ */
+void BankEntryView::setBankDetails(const BankDetails *details)
+{
+	Q_D(BankEntryView);
+	if (details) {
+		d->details = *details;
+		d->hasDetails = true;
+	} else {
+		d->details = BankDetails();
+		d->hasDetails = false;
+	}
+	d->updateWidgetDisplay();
+}
+
+/**
+ * Set the verification results for the RvtH_BankEntry being displayed.
+ * These are shown for Wii banks only.
+ * @param map Verification results. (If empty, the heatmap is hidden.)
+ */
+void BankEntryView::setVerifyMap(const VerifyMap &map)
+{
+	Q_D(BankEntryView);
+	const bool wasEmpty = d->ui.hmVerify->verifyMap().isEmpty();
+	d->ui.hmVerify->setVerifyMap(map);
+	if (wasEmpty != map.isEmpty()) {
+		// Show or hide the heatmap.
+		d->updateWidgetDisplay();
+	}
+}
+
 /**
  * Update the currently displayed RvtH_BankEntry.
  */
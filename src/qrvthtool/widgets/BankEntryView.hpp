@@ -13,6 +13,8 @@
 
 // NOTE: Qt6's moc doesn't like incomplete types.
 #include "librvth/rvth.hpp"
+#include "BankDetails.hpp"
+#include "VerifyMap.hpp"
 
 class BankEntryViewPrivate;
 class BankEntryView : public QWidget
@@ -45,6 +47,20 @@ class BankEntryView : public QWidget
 		 */
 		void setBankEntry(const RvtH_BankEntry *bankEntry);
 
+		/**
+		 * Set the details for the RvtH_BankEntry being displayed.
+		 * These are loaded in the background by BankDetailsLoader.
+		 * @param details Bank details, or nullptr if they're still loading.
+		 */
+		void setBankDetails(const BankDetails *details);
+
+		/**
+		 * Set the verification results for the RvtH_BankEntry being displayed.
+		 * These are shown for Wii banks only.
+		 * @param map Verification results. (If empty, the heatmap is hidden.)
+		 */
+		void setVerifyMap(const VerifyMap &map);
+
 		/**
 		 * Update the currently displayed RvtH_BankEntry.
 		 */
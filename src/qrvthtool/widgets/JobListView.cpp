@@ -0,0 +1,283 @@
+/***************************************************************************
+ * RVT-H Tool (qrvthtool)                                                  *
+ * JobListView.cpp: Job list with per-job progress.                        *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "JobListView.hpp"
+#include "JobQueue.hpp"
+
+// C includes (C++ namespace)
+#include <cerrno>
+
+// Qt includes
+#include <QtCore/QEvent>
+#include <QtCore/QHash>
+#include <QAction>
+#include <QtWidgets/QHeaderView>
+#include <QtWidgets/QProgressBar>
+
+/** JobListViewPrivate **/
+
+class JobListViewPrivate
+{
+	public:
+		explicit JobListViewPrivate(JobListView *q);
+
+	protected:
+		JobListView *const q_ptr;
+		Q_DECLARE_PUBLIC(JobListView)
+	private:
+		Q_DISABLE_COPY(JobListViewPrivate)
+
+	public:
+		enum Column {
+			COL_JOB,
+			COL_PROGRESS,
+			COL_STATUS,
+
+			COL_MAX
+		};
+
+		// Item data role for the job ID.
+		static const int JobIdRole = Qt::UserRole;
+
+		JobQueue *jobQueue;
+
+		// Queued and running jobs.
+		// Finished jobs remain in the list until they're cleared.
+		QHash<int, QTreeWidgetItem*> activeItems;
+
+		// Context menu actions.
+		QAction *actionCancel;
+		QAction *actionClearFinished;
+
+		/**
+		 * Retranslate the header and context menu.
+		 */
+		void retranslateUi(void);
+
+		/**
+		 * Get a job's progress bar.
+		 * @param item Job item
+		 * @return Progress bar.
+		 */
+		QProgressBar *progressBar(QTreeWidgetItem *item) const;
+};
+
+JobListViewPrivate::JobListViewPrivate(JobListView *q)
+	: q_ptr(q)
+	, jobQueue(nullptr)
+	, actionCancel(new QAction(q))
+	, actionClearFinished(new QAction(q))
+{ }
+
+/**
+ * Retranslate the header and context menu.
+ */
+void JobListViewPrivate::retranslateUi(void)
+{
+	Q_Q(JobListView);
+	q->setHeaderLabels(QStringList()
+		<< JobListView::tr("Job")
+		<< JobListView::tr("Progress")
+		<< JobListView::tr("Status"));
+	actionCancel->setText(JobListView::tr("&Cancel"));
+	actionClearFinished->setText(JobListView::tr("C&lear Finished Jobs"));
+}
+
+/**
+ * Get a job's progress bar.
+ * @param item Job item
+ * @return Progress bar.
+ */
+QProgressBar *JobListViewPrivate::progressBar(QTreeWidgetItem *item) const
+{
+	Q_Q(const JobListView);
+	return qobject_cast<QProgressBar*>(q->itemWidget(item, COL_PROGRESS));
+}
+
+/** JobListView **/
+
+JobListView::JobListView(QWidget *parent)
+	: super(parent)
+	, d_ptr(new JobListViewPrivate(this))
+{
+	Q_D(JobListView);
+	this->setColumnCount(JobListViewPrivate::COL_MAX);
+	this->setRootIsDecorated(false);
+	this->setAllColumnsShowFocus(true);
+	this->setSelectionMode(QAbstractItemView::ExtendedSelection);
+	this->header()->setStretchLastSection(true);
+
+	// Context menu.
+	this->setContextMenuPolicy(Qt::ActionsContextMenu);
+	this->addAction(d->actionCancel);
+	this->addAction(d->actionClearFinished);
+	connect(d->actionCancel, &QAction::triggered,
+		this, &JobListView::cancelSelectedJobs);
+	connect(d->actionClearFinished, &QAction::triggered,
+		this, &JobListView::clearFinishedJobs);
+
+	d->retranslateUi();
+}
+
+JobListView::~JobListView()
+{
+	Q_D(JobListView);
+	delete d;
+}
+
+/**
+ * Set the job queue to display.
+ * @param jobQueue Job queue
+ */
+void JobListView::setJobQueue(JobQueue *jobQueue)
+{
+	Q_D(JobListView);
+	if (d->jobQueue) {
+		disconnect(d->jobQueue, nullptr, this, nullptr);
+	}
+	d->jobQueue = jobQueue;
+	d->activeItems.clear();
+	this->clear();
+
+	if (jobQueue) {
+		connect(jobQueue, &JobQueue::jobAdded,
+			this, &JobListView::jobQueue_jobAdded);
+		connect(jobQueue, &JobQueue::jobStarted,
+			this, &JobListView::jobQueue_jobStarted);
+		connect(jobQueue, &JobQueue::jobProgress,
+			this, &JobListView::jobQueue_jobProgress);
+		connect(jobQueue, &JobQueue::jobFinished,
+			this, &JobListView::jobQueue_jobFinished);
+	}
+}
+
+/**
+ * Widget state has changed.
+ * @param event State change event.
+ */
+void JobListView::changeEvent(QEvent *event)
+{
+	Q_D(JobListView);
+
+	switch (event->type()) {
+		case QEvent::LanguageChange:
+		case QEvent::LocaleChange:
+			// Retranslate the UI.
+			d->retranslateUi();
+			break;
+
+		default:
+			break;
+	}
+
+	// Pass the event to the base class.
+	super::changeEvent(event);
+}
+
+/** JobQueue slots **/
+
+void JobListView::jobQueue_jobAdded(int id, const QString &description)
+{
+	Q_D(JobListView);
+
+	QTreeWidgetItem *const item = new QTreeWidgetItem(this);
+	item->setText(JobListViewPrivate::COL_JOB, description);
+	item->setData(JobListViewPrivate::COL_JOB, JobListViewPrivate::JobIdRole, id);
+	item->setText(JobListViewPrivate::COL_STATUS, tr("Queued"));
+	d->activeItems.insert(id, item);
+
+	QProgressBar *const progressBar = new QProgressBar();
+	progressBar->setMaximum(100);
+	progressBar->setValue(0);
+	this->setItemWidget(item, JobListViewPrivate::COL_PROGRESS, progressBar);
+
+	this->resizeColumnToContents(JobListViewPrivate::COL_JOB);
+}
+
+void JobListView::jobQueue_jobStarted(int id)
+{
+	Q_D(JobListView);
+	QTreeWidgetItem *const item = d->activeItems.value(id);
+	if (item) {
+		item->setText(JobListViewPrivate::COL_STATUS, tr("Running"));
+	}
+}
+
+void JobListView::jobQueue_jobProgress(int id, const QString &text, int progress_value, int progress_max)
+{
+	Q_D(JobListView);
+	QTreeWidgetItem *const item = d->activeItems.value(id);
+	if (!item) {
+		return;
+	}
+
+	item->setText(JobListViewPrivate::COL_STATUS, text);
+	QProgressBar *const progressBar = d->progressBar(item);
+	if (progressBar && progress_value >= 0 && progress_max >= 0) {
+		if (progressBar->maximum() != progress_max) {
+			progressBar->setMaximum(progress_max);
+		}
+		progressBar->setValue(progress_value);
+	}
+}
+
+void JobListView::jobQueue_jobFinished(int id, const QString &text, int err)
+{
+	Q_D(JobListView);
+	QTreeWidgetItem *const item = d->activeItems.take(id);
+	if (!item) {
+		return;
+	}
+
+	item->setText(JobListViewPrivate::COL_STATUS, text);
+	QProgressBar *const progressBar = d->progressBar(item);
+	if (progressBar) {
+		if (err == 0) {
+			progressBar->setValue(progressBar->maximum());
+		} else if (err == -ECANCELED) {
+			progressBar->setEnabled(false);
+		}
+		// TODO: Change progress bar to red on error?
+	}
+}
+
+/** Context menu actions **/
+
+/**
+ * Cancel the selected jobs.
+ */
+void JobListView::cancelSelectedJobs(void)
+{
+	Q_D(JobListView);
+	if (!d->jobQueue) {
+		return;
+	}
+
+	const QList<QTreeWidgetItem*> items = this->selectedItems();
+	for (const QTreeWidgetItem *item : items) {
+		const int id = item->data(JobListViewPrivate::COL_JOB, JobListViewPrivate::JobIdRole).toInt();
+		if (d->activeItems.contains(id)) {
+			d->jobQueue->cancelJob(id);
+		}
+	}
+}
+
+/**
+ * Remove jobs that are no longer queued or running.
+ */
+void JobListView::clearFinishedJobs(void)
+{
+	Q_D(JobListView);
+	for (int i = this->topLevelItemCount() - 1; i >= 0; i--) {
+		QTreeWidgetItem *const item = this->topLevelItem(i);
+		const int id = item->data(JobListViewPrivate::COL_JOB, JobListViewPrivate::JobIdRole).toInt();
+		if (!d->activeItems.contains(id)) {
+			delete item;
+		}
+	}
+}
@@ -0,0 +1,64 @@
+/***************************************************************************
+ * RVT-H Tool (qrvthtool)                                                  *
+ * JobListView.hpp: Job list with per-job progress.                        *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_QRVTHTOOL_WIDGETS_JOBLISTVIEW_HPP__
+#define __RVTHTOOL_QRVTHTOOL_WIDGETS_JOBLISTVIEW_HPP__
+
+// Qt includes and classes.
+#include <QTreeWidget>
+
+class JobQueue;
+
+class JobListViewPrivate;
+class JobListView : public QTreeWidget
+{
+	Q_OBJECT
+	typedef QTreeWidget super;
+
+	public:
+		explicit JobListView(QWidget *parent = nullptr);
+		virtual ~JobListView();
+
+	protected:
+		JobListViewPrivate *const d_ptr;
+		Q_DECLARE_PRIVATE(JobListView)
+	private:
+		Q_DISABLE_COPY(JobListView)
+
+	public:
+		/**
+		 * Set the job queue to display.
+		 * @param jobQueue Job queue
+		 */
+		void setJobQueue(JobQueue *jobQueue);
+
+	protected:
+		// State change event. (Used for switching the UI language at runtime.)
+		void changeEvent(QEvent *event) final;
+
+	protected slots:
+		/** JobQueue slots **/
+		void jobQueue_jobAdded(int id, const QString &description);
+		void jobQueue_jobStarted(int id);
+		void jobQueue_jobProgress(int id, const QString &text, int progress_value, int progress_max);
+		void jobQueue_jobFinished(int id, const QString &text, int err);
+
+		/** Context menu actions **/
+
+		/**
+		 * Cancel the selected jobs.
+		 */
+		void cancelSelectedJobs(void);
+
+		/**
+		 * Remove jobs that are no longer queued or running.
+		 */
+		void clearFinishedJobs(void);
+};
+
+#endif /* __RVTHTOOL_QRVTHTOOL_WIDGETS_JOBLISTVIEW_HPP__ */
@@ -73,6 +73,11 @@ class LanguageMenuPrivate
 		 */
 		void clear(void);
 
+		/**
+		 * Add the available translations to the Language Menu.
+		 */
+		void addTranslations(void);
+
 		/**
 		 * Retranslate the "System Default" language action.
 		 */
@@ -93,7 +98,30 @@ LanguageMenuPrivate::LanguageMenuPrivate(LanguageMenu *q)
 	q->addAction(actLanguageSysDefault);
 
 	// Add all other translations.
+	// NOTE: If the translations are being enumerated in the
+	// background, they're added once enumeration is finished.
 	q->addSeparator();
+	TranslationManager *const tsm = TranslationManager::instance();
+	if (tsm->isEnumerating()) {
+		q->menuAction()->setVisible(false);
+		QObject::connect(tsm, &TranslationManager::enumerated, q,
+			[this]() { addTranslations(); });
+	} else {
+		addTranslations();
+	}
+}
+
+/**
+ * Add the available translations to the Language Menu.
+ */
+void LanguageMenuPrivate::addTranslations(void)
+{
+	Q_Q(LanguageMenu);
+	if (!hashActions.isEmpty()) {
+		// Translations were already added.
+		return;
+	}
+
 	QMap<QString, QString> tsMap = TranslationManager::instance()->enumerate();
 	hashActions.reserve(tsMap.size());
 	foreach (const QString &locale, tsMap.keys()) {
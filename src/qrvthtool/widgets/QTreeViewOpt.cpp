@@ -34,7 +34,6 @@ void QTreeViewOpt::dataChanged(const QModelIndex &topLeft,
 	const QVector<int> &roles)
 {
 	bool propagateEvent = true;
-	// TODO: Support for checking multiple items.
 	if (topLeft == bottomRight) {
 		// Single item. This might be an icon animation.
 		// If it is, make sure the icon is onscreen.
@@ -47,6 +46,25 @@ void QTreeViewOpt::dataChanged(const QModelIndex &topLeft,
 			// Don't propagate the event.
 			propagateEvent = false;
 		}
+	} else if (topLeft.column() > 0 ||
+		   bottomRight.column() < this->model()->columnCount(topLeft.parent()) - 1)
+	{
+		// Some columns in a range of rows.
+		// Make sure at least one of the rows is onscreen.
+		// NOTE: Updates to entire rows are always propagated,
+		// since they might change the row heights.
+		const QModelIndex top = this->indexAt(QPoint(0, 0));
+		if (top.isValid() && top.parent() == topLeft.parent()) {
+			const QModelIndex bottom = this->indexAt(QPoint(0, this->viewport()->height() - 1));
+			const int lastRow = (bottom.isValid()
+				? bottom.row()
+				: this->model()->rowCount(topLeft.parent()) - 1);
+			if (bottomRight.row() < top.row() || topLeft.row() > lastRow) {
+				// Rows are NOT visible.
+				// Don't propagate the event.
+				propagateEvent = false;
+			}
+		}
 	}
 
 	if (propagateEvent) {
@@ -0,0 +1,293 @@
+/***************************************************************************
+ * RVT-H Tool (qrvthtool)                                                  *
+ * VerifyHeatmap.cpp: Per-partition verification error heatmap.            *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "VerifyHeatmap.hpp"
+
+// C includes (C++ namespace)
+#include <cmath>
+
+// Qt includes
+#include <QtGui/QHelpEvent>
+#include <QtGui/QPainter>
+#include <QtWidgets/QToolTip>
+
+/** VerifyHeatmapPrivate **/
+
+class VerifyHeatmapPrivate
+{
+	public:
+		explicit VerifyHeatmapPrivate(VerifyHeatmap *q);
+
+	protected:
+		VerifyHeatmap *const q_ptr;
+		Q_DECLARE_PUBLIC(VerifyHeatmap)
+	private:
+		Q_DISABLE_COPY(VerifyHeatmapPrivate)
+
+	public:
+		VerifyMap map;
+
+		// Row and cell dimensions, in pixels.
+		static const int ROW_HEIGHT = 10;
+		static const int ROW_SPACING = 2;
+		static const int MIN_CELL_WIDTH = 4;
+
+		/**
+		 * Get the number of cells in a partition's row.
+		 * @param ptMap Partition
+		 * @return Number of cells.
+		 */
+		int cellCount(const VerifyPartitionMap &ptMap) const;
+
+		/**
+		 * Get the range of groups covered by a cell.
+		 * @param ptMap	[in] Partition
+		 * @param cells	[in] Number of cells in the row
+		 * @param cell	[in] Cell index
+		 * @param first	[out] First group
+		 * @param last	[out] Last group, plus one
+		 */
+		static void cellGroups(const VerifyPartitionMap &ptMap, int cells, int cell,
+			unsigned int &first, unsigned int &last);
+
+		/**
+		 * Count the errors in a range of groups.
+		 * @param ptMap Partition
+		 * @param first First group
+		 * @param last Last group, plus one
+		 * @return Number of errors.
+		 */
+		static unsigned int errorCount(const VerifyPartitionMap &ptMap,
+			unsigned int first, unsigned int last);
+
+		/**
+		 * Get the color for a cell.
+		 * @param ptMap Partition
+		 * @param first First group
+		 * @param last Last group, plus one
+		 * @return Cell color.
+		 */
+		QColor cellColor(const VerifyPartitionMap &ptMap,
+			unsigned int first, unsigned int last) const;
+};
+
+VerifyHeatmapPrivate::VerifyHeatmapPrivate(VerifyHeatmap *q)
+	: q_ptr(q)
+{ }
+
+/**
+ * Get the number of cells in a partition's row.
+ * @param ptMap Partition
+ * @return Number of cells.
+ */
+int VerifyHeatmapPrivate::cellCount(const VerifyPartitionMap &ptMap) const
+{
+	Q_Q(const VerifyHeatmap);
+	const int maxCells = q->width() / MIN_CELL_WIDTH;
+	int cells = static_cast<int>(qMin(ptMap.group_total, static_cast<unsigned int>(maxCells)));
+	return (cells > 0 ? cells : 1);
+}
+
+/**
+ * Get the range of groups covered by a cell.
+ * @param ptMap	[in] Partition
+ * @param cells	[in] Number of cells in the row
+ * @param cell	[in] Cell index
+ * @param first	[out] First group
+ * @param last	[out] Last group, plus one
+ */
+void VerifyHeatmapPrivate::cellGroups(const VerifyPartitionMap &ptMap, int cells, int cell,
+	unsigned int &first, unsigned int &last)
+{
+	first = static_cast<unsigned int>(static_cast<quint64>(ptMap.group_total) * cell / cells);
+	last = static_cast<unsigned int>(static_cast<quint64>(ptMap.group_total) * (cell + 1) / cells);
+}
+
+/**
+ * Count the errors in a range of groups.
+ * @param ptMap Partition
+ * @param first First group
+ * @param last Last group, plus one
+ * @return Number of errors.
+ */
+unsigned int VerifyHeatmapPrivate::errorCount(const VerifyPartitionMap &ptMap,
+	unsigned int first, unsigned int last)
+{
+	unsigned int errs = 0;
+	last = qMin(last, static_cast<unsigned int>(ptMap.errors.size()));
+	for (unsigned int g = first; g < last; g++) {
+		errs += ptMap.errors[g];
+	}
+	return errs;
+}
+
+/**
+ * Get the color for a cell.
+ * @param ptMap Partition
+ * @param first First group
+ * @param last Last group, plus one
+ * @return Cell color.
+ */
+QColor VerifyHeatmapPrivate::cellColor(const VerifyPartitionMap &ptMap,
+	unsigned int first, unsigned int last) const
+{
+	Q_Q(const VerifyHeatmap);
+
+	const unsigned int errs = errorCount(ptMap, first, last);
+	if (errs == 0) {
+		if (ptMap.group_total == 0 || last > ptMap.group_done) {
+			// Not verified yet.
+			return q->palette().color(QPalette::Mid);
+		}
+		// Verified with no errors.
+		return QColor(64, 160, 64);
+	}
+
+	// Errors were found. Blend from orange to red based on the
+	// number of errors per group, using a log scale since a
+	// single bad sector can have dozens of hash errors.
+	const unsigned int groups = (last > first ? last - first : 1);
+	float f = std::log2(1.0f + static_cast<float>(errs) / groups) / 8.0f;
+	if (f > 1.0f) {
+		f = 1.0f;
+	}
+	return QColor(255 - static_cast<int>(f * 55), 160 - static_cast<int>(f * 160), 0);
+}
+
+/** VerifyHeatmap **/
+
+VerifyHeatmap::VerifyHeatmap(QWidget *parent)
+	: super(parent)
+	, d_ptr(new VerifyHeatmapPrivate(this))
+{
+	this->setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Fixed);
+}
+
+VerifyHeatmap::~VerifyHeatmap()
+{
+	Q_D(VerifyHeatmap);
+	delete d;
+}
+
+/**
+ * Get the verification results being displayed.
+ * @return Verification results.
+ */
+VerifyMap VerifyHeatmap::verifyMap(void) const
+{
+	Q_D(const VerifyHeatmap);
+	return d->map;
+}
+
+/**
+ * Set the verification results to display.
+ * @param map Verification results. (If empty, nothing is shown.)
+ */
+void VerifyHeatmap::setVerifyMap(const VerifyMap &map)
+{
+	Q_D(VerifyHeatmap);
+	const bool resized = (d->map.size() != map.size());
+	d->map = map;
+	if (resized) {
+		this->updateGeometry();
+	}
+	this->update();
+}
+
+QSize VerifyHeatmap::sizeHint(void) const
+{
+	Q_D(const VerifyHeatmap);
+	const int rows = qMax(static_cast<int>(d->map.size()), 1);
+	return QSize(256, rows * (VerifyHeatmapPrivate::ROW_HEIGHT + VerifyHeatmapPrivate::ROW_SPACING)
+		- VerifyHeatmapPrivate::ROW_SPACING);
+}
+
+QSize VerifyHeatmap::minimumSizeHint(void) const
+{
+	QSize sz = sizeHint();
+	sz.setWidth(64);
+	return sz;
+}
+
+/**
+ * Show a tooltip for the cell under the mouse cursor.
+ * @param event Event
+ */
+bool VerifyHeatmap::event(QEvent *event)
+{
+	if (event->type() != QEvent::ToolTip) {
+		return super::event(event);
+	}
+
+	Q_D(VerifyHeatmap);
+	QHelpEvent *const helpEvent = static_cast<QHelpEvent*>(event);
+	const QPoint pos = helpEvent->pos();
+	const int rowPitch = VerifyHeatmapPrivate::ROW_HEIGHT + VerifyHeatmapPrivate::ROW_SPACING;
+	const int pt = pos.y() / rowPitch;
+	if (pos.x() < 0 || pos.x() >= width() || pt < 0 || pt >= d->map.size() ||
+	    (pos.y() % rowPitch) >= VerifyHeatmapPrivate::ROW_HEIGHT)
+	{
+		QToolTip::hideText();
+		event->ignore();
+		return true;
+	}
+
+	const VerifyPartitionMap &ptMap = d->map[pt];
+	if (ptMap.group_total == 0) {
+		QToolTip::showText(helpEvent->globalPos(),
+			tr("Partition %1: Not verified yet.").arg(pt+1), this);
+		return true;
+	}
+
+	const int cells = d->cellCount(ptMap);
+	const int cell = pos.x() * cells / width();
+	unsigned int first, last;
+	d->cellGroups(ptMap, cells, cell, first, last);
+	const unsigned int errs = d->errorCount(ptMap, first, last);
+
+	QString text;
+	if (last - first <= 1) {
+		text = tr("Partition %1, group %L2: %Ln error(s)", "", static_cast<int>(errs))
+			.arg(pt+1).arg(first);
+	} else {
+		text = tr("Partition %1, groups %L2-%L3: %Ln error(s)", "", static_cast<int>(errs))
+			.arg(pt+1).arg(first).arg(last - 1);
+	}
+	QToolTip::showText(helpEvent->globalPos(), text, this);
+	return true;
+}
+
+/**
+ * Paint the heatmap.
+ * @param event Paint event
+ */
+void VerifyHeatmap::paintEvent(QPaintEvent *event)
+{
+	Q_UNUSED(event)
+	Q_D(VerifyHeatmap);
+
+	QPainter painter(this);
+	const int w = width();
+	int y = 0;
+	for (const VerifyPartitionMap &ptMap : d->map) {
+		const int cells = d->cellCount(ptMap);
+		for (int cell = 0; cell < cells; cell++) {
+			unsigned int first, last;
+			d->cellGroups(ptMap, cells, cell, first, last);
+
+			// Cells share the row's width, so the last
+			// pixel column of each cell is left as a gap.
+			const int x1 = cell * w / cells;
+			const int x2 = (cell + 1) * w / cells;
+			const int cw = (x2 - x1 > 2 ? x2 - x1 - 1 : x2 - x1);
+			painter.fillRect(x1, y, cw, VerifyHeatmapPrivate::ROW_HEIGHT,
+				d->cellColor(ptMap, first, last));
+		}
+		y += VerifyHeatmapPrivate::ROW_HEIGHT + VerifyHeatmapPrivate::ROW_SPACING;
+	}
+}
@@ -0,0 +1,62 @@
+/***************************************************************************
+ * RVT-H Tool (qrvthtool)                                                  *
+ * VerifyHeatmap.hpp: Per-partition verification error heatmap.            *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_QRVTHTOOL_WIDGETS_VERIFYHEATMAP_HPP__
+#define __RVTHTOOL_QRVTHTOOL_WIDGETS_VERIFYHEATMAP_HPP__
+
+#include "VerifyMap.hpp"
+
+// Qt includes and classes.
+#include <QWidget>
+class QPaintEvent;
+
+/**
+ * Per-partition verification error heatmap.
+ *
+ * Each partition is shown as a row of cells spanning the widget's width.
+ * Each cell covers one or more 2 MB groups, and is colored based on
+ * whether its groups have been verified and how many errors were found.
+ */
+class VerifyHeatmapPrivate;
+class VerifyHeatmap : public QWidget
+{
+	Q_OBJECT
+	typedef QWidget super;
+
+	public:
+		explicit VerifyHeatmap(QWidget *parent = nullptr);
+		virtual ~VerifyHeatmap();
+
+	protected:
+		VerifyHeatmapPrivate *const d_ptr;
+		Q_DECLARE_PRIVATE(VerifyHeatmap)
+	private:
+		Q_DISABLE_COPY(VerifyHeatmap)
+
+	public:
+		/**
+		 * Get the verification results being displayed.
+		 * @return Verification results.
+		 */
+		VerifyMap verifyMap(void) const;
+
+		/**
+		 * Set the verification results to display.
+		 * @param map Verification results. (If empty, nothing is shown.)
+		 */
+		void setVerifyMap(const VerifyMap &map);
+
+		QSize sizeHint(void) const final;
+		QSize minimumSizeHint(void) const final;
+
+	protected:
+		bool event(QEvent *event) final;
+		void paintEvent(QPaintEvent *event) final;
+};
+
+#endif /* __RVTHTOOL_QRVTHTOOL_WIDGETS_VERIFYHEATMAP_HPP__ */
@@ -18,15 +18,23 @@
 #include "RvtHModel.hpp"
 #include "RvtHSortFilterProxyModel.hpp"
 #include "MessageSound.hpp"
+#include "StartupProfiler.hpp"
 
 #include "widgets/MessageWidgetStack.hpp"
 #include "windows/SelectDeviceDialog.hpp"
 
 // C includes. (C++ namespace)
 #include <cassert>
+#include <cerrno>
+
+// C++ includes.
+#include <vector>
 
 // Qt includes.
+#include <QtCore/QHash>
+#include <QtCore/QSet>
 #include <QtCore/QThread>
+#include <QtCore/QTimer>
 #include <QtGui/QCloseEvent>
 #include <QtWidgets/QComboBox>
 #include <QtWidgets/QFileDialog>
@@ -37,8 +45,12 @@
 // RVL_CryptoType_e
 #include "libwiicrypto/sig_tools.h"
 
-// Worker object for the worker thread.
-#include "WorkerObject.hpp"
+// Queue of extract/import/verify jobs.
+#include "JobQueue.hpp"
+// Worker object for opening devices and disk images.
+#include "OpenWorker.hpp"
+// Bank details loaded in the background.
+#include "BankDetailsLoader.hpp"
 
 // Taskbar Button Manager.
 #include "TaskbarButtonManager/TaskbarButtonManager.hpp"
@@ -143,21 +155,67 @@ class QRvtHToolWindowPrivate
 		QToolButton *btnCancel;
 		QProgressBar *progressBar;
 
-		// Worker thread.
-		QThread *workerThread;
-		WorkerObject *workerObject;
+		// Extract/import/verify jobs.
+		JobQueue *jobQueue;
+
+		// Import jobs that haven't updated the RVT-H model yet.
+		// The bank entry is changed once the import starts writing.
+		QSet<int> importJobsPendingUpdate;
+
+		// Job shown in the status bar and taskbar button. (-1 for none)
+		// Other jobs only update the job list.
+		int statusJobId;
+
+		// Verification results for the current RVT-H object, by bank.
+		QHash<unsigned int, VerifyMap> verifyMaps;
+
+		/**
+		 * Show the selected bank's verification results in the BankEntryView.
+		 */
+		void updateVerifyMap(void);
+
+		// Bank details that require reading from the device.
+		BankDetailsLoader *detailsLoader;
+
+		/**
+		 * Show the selected bank's details in the BankEntryView.
+		 * If they aren't cached, they're loaded in the background.
+		 */
+		void updateBankDetails(void);
+
+		/**
+		 * Set the BankEntryView's bank entry, verification results,
+		 * and details for the selected bank.
+		 * @param entry Bank entry, or nullptr to clear the BankEntryView.
+		 */
+		void setBankEntry(const RvtH_BankEntry *entry);
+
+		// Loader thread. (opens the device and initializes the banks)
+		QThread *loadThread;
+		OpenWorker *loadWorker;
+
+		/**
+		 * Stop the loader thread, if it's running.
+		 * If the device hasn't finished opening, it's closed.
+		 */
+		void stopLoading(void);
+
+		/**
+		 * Close the RVT-H object.
+		 * If jobs are still using it, the job queue deletes it later.
+		 */
+		void releaseRvtH(void);
 
 		// UI busy counter
 		int uiBusyCounter;
 
+		// Checks the bank table for changes made by other programs
+		// or hosts while an RVT-H Reader or HDD image is open.
+		QTimer *pollTimer;
+
 		// Taskbar Button Manager.
 		TaskbarButtonManager *taskbarButtonManager;
 
-	public:
-		// Update status.
-		bool updateStatus_didInitialUpdate;
-		int updateStatus_bank;
-
 	public:
 		/**
 		 * Get the selected bank number.
@@ -186,31 +244,51 @@ QRvtHToolWindowPrivate::QRvtHToolWindowPrivate(QRvtHToolWindow *q)
 	, lblMessage(nullptr)
 	, btnCancel(nullptr)
 	, progressBar(nullptr)
-	, workerThread(nullptr)
-	, workerObject(nullptr)
+	, jobQueue(new JobQueue())
+	, statusJobId(-1)
+	, detailsLoader(new BankDetailsLoader())
+	, loadThread(nullptr)
+	, loadWorker(nullptr)
 	, uiBusyCounter(0)
+	, pollTimer(new QTimer(q))
 	, taskbarButtonManager(nullptr)
-	, updateStatus_didInitialUpdate(false)
-	, updateStatus_bank(0)
 {
+	// Bank table polling.
+	// Each poll only reads the bank table, so this is cheap.
+	pollTimer->setInterval(5000);
+	QObject::connect(pollTimer, &QTimer::timeout,
+			 q, &QRvtHToolWindow::pollTimer_timeout);
+
+	// Connect the JobQueue slots.
+	QObject::connect(jobQueue, &JobQueue::jobStarted,
+			 q, &QRvtHToolWindow::jobQueue_jobStarted);
+	QObject::connect(jobQueue, &JobQueue::jobProgress,
+			 q, &QRvtHToolWindow::jobQueue_jobProgress);
+	QObject::connect(jobQueue, &JobQueue::jobFinished,
+			 q, &QRvtHToolWindow::jobQueue_jobFinished);
+	QObject::connect(jobQueue, &JobQueue::jobVerifyProgress,
+			 q, &QRvtHToolWindow::jobQueue_jobVerifyProgress);
+
+	// Connect the BankDetailsLoader slots.
+	QObject::connect(detailsLoader, &BankDetailsLoader::detailsLoaded,
+			 q, &QRvtHToolWindow::detailsLoader_detailsLoaded);
+
 	// Connect the RvtHModel slots.
 	QObject::connect(model, &RvtHModel::layoutChanged,
 			 q, &QRvtHToolWindow::rvthModel_layoutChanged);
 	QObject::connect(model, &RvtHModel::rowsInserted,
 			 q, &QRvtHToolWindow::rvthModel_rowsInserted);
+	QObject::connect(model, &RvtHModel::bankChanged,
+			 q, &QRvtHToolWindow::rvthModel_bankChanged);
 }
 
 QRvtHToolWindowPrivate::~QRvtHToolWindowPrivate()
 {
-	if (workerThread) {
-		// Worker thread is still running...
-		// TODO: Cancel it instead of simply quitting.
-		workerThread->quit();
-		do {
-			workerThread->wait(250);
-		} while (workerThread->isRunning());
-	}
-	delete workerObject;
+	// The loader thread and the jobs use rvth, so stop them first.
+	// NOTE: Deleting the job queue cancels all jobs and waits for them.
+	stopLoading();
+	delete jobQueue;
+	delete detailsLoader;
 
 	// NOTE: Delete the RvtHModel first to prevent issues later.
 	delete model;
@@ -317,21 +395,30 @@ void QRvtHToolWindowPrivate::updateActionEnableStatus(void)
 		ui.actionImport->setEnabled(false);
 		ui.actionDelete->setEnabled(false);
 		ui.actionUndelete->setEnabled(false);
+		ui.actionVerify->setEnabled(false);
 	} else {
 		// RVT-H Reader image is loaded.
 		// TODO: Disable open, scan, and save (all) if we're scanning.
 		ui.actionClose->setEnabled(true);
 
 		// If a bank is selected, enable the actions.
-		const RvtH_BankEntry *const entry = ui.bevBankEntryView->bankEntry();
+		// NOTE: Bank actions are disabled while the banks are loading.
+		const RvtH_BankEntry *const entry = (loadWorker ? nullptr : ui.bevBankEntryView->bankEntry());
 		if (entry) {
 			// Enable Extract if the bank is *not* empty.
 			ui.actionExtract->setEnabled(entry->type != RVTH_BankType_Empty);
 
+			// Enable Verify if the bank is a Wii bank.
+			ui.actionVerify->setEnabled(entry->type == RVTH_BankType_Wii_SL ||
+			                            entry->type == RVTH_BankType_Wii_DL);
+
 			// d->write_enabled indicates if we can use writing functions.
 			// True if using an actual RVT-H Reader with valid NHCD table;
 			// false otherwise.
 			if (this->write_enabled) {
+				// Delete and Undelete run on the UI thread,
+				// so they're disabled while jobs use this device.
+				const bool deviceIdle = !jobQueue->isBusy(rvth);
 				if (entry->type == RVTH_BankType_Empty) {
 					// Bank is empty.
 					// Enable Import; disable Delete and Undelete.
@@ -343,8 +430,8 @@ void QRvtHToolWindowPrivate::updateActionEnableStatus(void)
 					// Enable Import and Undelete if the bank is deleted.
 					// Enable Delete if the bank is not deleted.
 					ui.actionImport->setEnabled(entry->is_deleted);
-					ui.actionUndelete->setEnabled(entry->is_deleted);
-					ui.actionDelete->setEnabled(!entry->is_deleted);
+					ui.actionUndelete->setEnabled(deviceIdle && entry->is_deleted);
+					ui.actionDelete->setEnabled(deviceIdle && !entry->is_deleted);
 				}
 			} else {
 				// Not an RVT-H Reader. Disable all writing functions.
@@ -358,6 +445,7 @@ void QRvtHToolWindowPrivate::updateActionEnableStatus(void)
 			ui.actionImport->setEnabled(false);
 			ui.actionDelete->setEnabled(false);
 			ui.actionUndelete->setEnabled(false);
+			ui.actionVerify->setEnabled(false);
 		}
 	}
 }
@@ -544,7 +632,117 @@ int QRvtHToolWindowPrivate::selectedBankNumber(void) const
 const RvtH_BankEntry *QRvtHToolWindowPrivate::selectedBankEntry(void) const
 {
 	const int bank = selectedBankNumber();
-	return (bank >= 0) ? rvth->bankEntry(static_cast<unsigned int>(bank)) : nullptr;
+	if (bank < 0 || !model->isBankLoaded(static_cast<unsigned int>(bank))) {
+		return nullptr;
+	}
+	return rvth->bankEntry(static_cast<unsigned int>(bank));
+}
+
+/**
+ * Stop the loader thread, if it's running.
+ * If the device hasn't finished opening, it's closed.
+ */
+void QRvtHToolWindowPrivate::stopLoading(void)
+{
+	if (!loadThread) {
+		// Not loading.
+		return;
+	}
+
+	// Stop after the current bank, then wait for the thread to exit.
+	// NOTE: Any queued signals from the worker are ignored
+	// by the slots, since loadWorker will no longer match.
+	loadWorker->cancel();
+	loadThread->quit();
+	do {
+		loadThread->wait(250);
+	} while (loadThread->isRunning());
+	loadThread->deleteLater();
+	loadThread = nullptr;
+
+	// The thread has exited, so the worker can be deleted directly.
+	// If takeRvtH() wasn't called, this also closes the device.
+	delete loadWorker;
+	loadWorker = nullptr;
+
+	// Hide the progress bar and cancel button.
+	// If jobs are running, they'll be shown again on the next update.
+	btnCancel->setVisible(false);
+	progressBar->setVisible(false);
+	lblMessage->setText(QString());
+	if (taskbarButtonManager) {
+		taskbarButtonManager->clearProgressBar();
+	}
+}
+
+/**
+ * Close the RVT-H object.
+ * If jobs are still using it, the job queue deletes it later.
+ */
+void QRvtHToolWindowPrivate::releaseRvtH(void)
+{
+	if (!rvth) {
+		return;
+	}
+
+	pollTimer->stop();
+	model->setRvtH(nullptr);
+	detailsLoader->setRvtH(nullptr);
+	verifyMaps.clear();
+	ui.bevBankEntryView->setVerifyMap(VerifyMap());
+	if (jobQueue->isBusy(rvth)) {
+		jobQueue->releaseRvtH(rvth);
+	} else {
+		delete rvth;
+	}
+	rvth = nullptr;
+}
+
+/**
+ * Show the selected bank's verification results in the BankEntryView.
+ */
+void QRvtHToolWindowPrivate::updateVerifyMap(void)
+{
+	const int bank = selectedBankNumber();
+	ui.bevBankEntryView->setVerifyMap(bank >= 0
+		? verifyMaps.value(static_cast<unsigned int>(bank))
+		: VerifyMap());
+}
+
+/**
+ * Show the selected bank's details in the BankEntryView.
+ * If they aren't cached, they're loaded in the background.
+ */
+void QRvtHToolWindowPrivate::updateBankDetails(void)
+{
+	const int bank = selectedBankNumber();
+	if (!rvth || bank < 0) {
+		ui.bevBankEntryView->setBankDetails(nullptr);
+		return;
+	}
+
+	const BankDetails *const details = detailsLoader->details(static_cast<unsigned int>(bank));
+	ui.bevBankEntryView->setBankDetails(details);
+	if (!details && ui.bevBankEntryView->bankEntry() &&
+	    !jobQueue->isBusy(rvth, static_cast<unsigned int>(bank)))
+	{
+		// Load the details in the background.
+		// NOTE: If a job is using this bank, the details are
+		// requested once it finishes. (jobQueue_jobFinished())
+		detailsLoader->requestDetails(static_cast<unsigned int>(bank));
+	}
+}
+
+/**
+ * Set the BankEntryView's bank entry, verification results,
+ * and details for the selected bank.
+ * @param entry Bank entry, or nullptr to clear the BankEntryView.
+ */
+void QRvtHToolWindowPrivate::setBankEntry(const RvtH_BankEntry *entry)
+{
+	ui.bevBankEntryView->setBankEntry(entry);
+	updateVerifyMap();
+	updateBankDetails();
 }
 
 /** QRvtHToolWindow **/
@@ -554,7 +752,10 @@ QRvtHToolWindow::QRvtHToolWindow(QWidget *parent)
 	, d_ptr(new QRvtHToolWindowPrivate(this))
 {
 	Q_D(QRvtHToolWindow);
-	d->ui.setupUi(this);
+	{
+		StartupProfiler::Timer timer("main window setupUi()");
+		d->ui.setupUi(this);
+	}
 
 	// Make sure the window is deleted on close.
 	this->setAttribute(Qt::WA_DeleteOnClose, true);
@@ -576,8 +777,11 @@ QRvtHToolWindow::QRvtHToolWindow(QWidget *parent)
 #endif
 
 	// Initialize the Language Menu.
+	// This also installs the translation that main()
+	// started loading in the background.
 	// TODO: Load/save the language setting somewhere?
 	d->ui.menuLanguage->setLanguage(QString());
+	StartupProfiler::mark("translation installed");
 
 	// Set up the main splitter sizes.
 	// We want the card info panel to be 160px wide at startup.
@@ -641,6 +845,9 @@ QRvtHToolWindow::QRvtHToolWindow(QWidget *parent)
 	d->progressBar->setMinimumWidth(320);
 	d->progressBar->setMaximumWidth(320);
 
+	// Job list.
+	d->ui.lstJobs->setJobQueue(d->jobQueue);
+
 	// Connect the lstBankList selection signal.
 	connect(d->ui.lstBankList->selectionModel(), &QItemSelectionModel::selectionChanged,
 		this, &QRvtHToolWindow::lstBankList_selectionModel_selectionChanged);
@@ -665,10 +872,15 @@ void QRvtHToolWindow::openRvtH(const QString &filename, bool isDevice)
 {
 	Q_D(QRvtHToolWindow);
 
+	// Stop loading the previous device, if it's still loading.
+	d->stopLoading();
 	if (d->rvth) {
-		d->model->setRvtH(nullptr);
-		delete d->rvth;
-		d->rvth = nullptr;
+		d->releaseRvtH();
+		d->filename.clear();
+		d->nhcd_status.clear();
+		d->updateLstBankList();
+		d->updateWindowTitle();
+		d->updateActionEnableStatus();
 	}
 
 	// Processing...
@@ -679,93 +891,36 @@ void QRvtHToolWindow::openRvtH(const QString &filename, bool isDevice)
 		text = tr("Opening disc image file '%1'...").arg(filename);
 	}
 	d->lblMessage->setText(text);
-	markUiBusy();
-
-	// Open the specified RVT-H Reader disk image.
-	// NOTE: RvtH expects native separators.
-
-	int err = 0;
-	const QString filenameNativeSeparators = QDir::toNativeSeparators(filename);
-#ifdef _WIN32
-	RvtH *const rvth_tmp = new RvtH(reinterpret_cast<const wchar_t*>(filenameNativeSeparators.utf16()), &err);
-#else /* !_WIN32 */
-	RvtH *const rvth_tmp = new RvtH(filenameNativeSeparators.toUtf8().constData(), &err);
-#endif
-	if (!rvth_tmp->isOpen() || err != 0) {
-		// Unable to open the RVT-H Reader disk image.
-		const QString errMsg = tr("An error occurred while opening '%1': %2")
-			.arg(d->getDisplayFilename(filename), QString::fromUtf8(rvth_error(err)));
-		d->ui.msgWidget->showMessage(errMsg, MessageWidget::ICON_CRITICAL);
-		delete rvth_tmp;
-		d->lblMessage->setText(QString());
-		markUiNotBusy();
-		return;
-	}
-
-	d->rvth = rvth_tmp;
 	d->filename = filename;
-	d->model->setRvtH(d->rvth);
-
-	d->nhcd_status.clear();
-	d->write_enabled = false;
 
-	// Check the NHCD table status.
-	bool checkNHCD = false;
-	switch (d->rvth->imageType()) {
-		case RVTH_ImageType_HDD_Reader:
-		case RVTH_ImageType_HDD_Image:
-			// NHCD table should be present.
-			checkNHCD = true;
-			break;
-
-		default:
-			// No NHCD table here.
-			break;
-	}
-
-	if (checkNHCD) {
-		QString message;
-		switch (d->rvth->nhcd_status()) {
-			case NHCD_STATUS_OK:
-				if (d->rvth->imageType() == RVTH_ImageType_HDD_Reader) {
-					d->write_enabled = true;
-				}
-				break;
-
-			default:
-			case NHCD_STATUS_UNKNOWN:
-			case NHCD_STATUS_MISSING:
-				message = tr("NHCD table is missing.");
-				d->nhcd_status = QStringLiteral("!NHCD");
-				break;
-
-			case NHCD_STATUS_HAS_MBR:
-				message = tr("This appears to be a PC MBR-partitioned HDD.");
-				d->nhcd_status = QStringLiteral("MBR?");
-				break;
-
-			case NHCD_STATUS_HAS_GPT:
-				message = tr("This appears to be a PC GPT-partitioned HDD.");
-				d->nhcd_status = QStringLiteral("GPT?");
-				break;
-		}
-
-		if (!message.isEmpty()) {
-			message += QChar(L'\n') + tr("Using defaults. Writing will be disabled.");
-			d->ui.msgWidget->showMessage(message, MessageWidget::ICON_CRITICAL);
-		}
-	}
+	// Show the cancel button and a "busy" progress bar
+	// until the bank count is known.
+	d->btnCancel->setVisible(true);
+	d->progressBar->setVisible(true);
+	d->progressBar->setMaximum(0);
+	d->progressBar->setValue(0);
 
-	// Update the UI.
-	d->updateLstBankList();
-	d->updateWindowTitle();
-	d->updateActionEnableStatus();
+	// Open the specified RVT-H Reader disk image on the loader thread.
+	// Reading the bank table and initializing each bank may take a
+	// while on slow devices, so the UI remains usable in the meantime.
+	// NOTE: RvtH expects native separators.
+	d->loadThread = new QThread(this);
+	d->loadThread->setObjectName(QStringLiteral("loadThread"));
+	d->loadWorker = new OpenWorker(QDir::toNativeSeparators(filename));
+	d->loadWorker->setObjectName(QStringLiteral("loadWorker"));
+	d->loadWorker->moveToThread(d->loadThread);
+
+	connect(d->loadThread, &QThread::started,
+		d->loadWorker, &OpenWorker::doOpen);
+	connect(d->loadWorker, &OpenWorker::opened,
+		this, &QRvtHToolWindow::loadWorker_opened);
+	connect(d->loadWorker, &OpenWorker::bankLoaded,
+		this, &QRvtHToolWindow::loadWorker_bankLoaded);
+	connect(d->loadWorker, &OpenWorker::finished,
+		this, &QRvtHToolWindow::loadWorker_finished);
 
-	// FIXME: If a file is opened from the command line,
-	// QTreeView sort-of selects the first file.
-	// (Signal is emitted, but nothing is highlighted.)
-	d->lblMessage->setText(QString());
-	markUiNotBusy();
+	// Start the thread.
+	d->loadThread->start();
 }
 
 /**
@@ -774,14 +929,21 @@ void QRvtHToolWindow::openRvtH(const QString &filename, bool isDevice)
 void QRvtHToolWindow::closeRvtH(void)
 {
 	Q_D(QRvtHToolWindow);
+	if (d->loadWorker && !d->rvth) {
+		// Still opening. Stopping the loader closes the device.
+		d->stopLoading();
+		d->filename.clear();
+		return;
+	}
 	if (!d->rvth) {
 		// Not open...
 		return;
 	}
 
-	d->model->setRvtH(nullptr);
-	delete d->rvth;
-	d->rvth = nullptr;
+	// The loader thread uses rvth, so stop it first.
+	// Queued jobs for this device will still be run.
+	d->stopLoading();
+	d->releaseRvtH();
 
 	// Clear the filename and NHCD status.
 	d->filename.clear();
@@ -854,9 +1016,8 @@ void QRvtHToolWindow::showEvent(QShowEvent *event)
 void QRvtHToolWindow::closeEvent(QCloseEvent *event)
 {
 	Q_D(QRvtHToolWindow);
-	if (d->uiBusyCounter > 0 || d->workerObject ||
-	    (d->workerThread && d->workerThread->isRunning())) {
-		// UI is busy, or the worker thread is running.
+	if (d->uiBusyCounter > 0 || d->jobQueue->jobCount() > 0) {
+		// UI is busy, or jobs are still queued or running.
 		// Ignore the close event.
 		event->ignore();
 		return;
@@ -875,7 +1036,8 @@ void QRvtHToolWindow::closeEvent(QCloseEvent *event)
  * @param result
  * @return
  */
-bool QRvtHToolWindow::nativeEvent(const QByteArray &eventType, void *message, long *result)
+bool QRvtHToolWindow::nativeEvent(const QByteArray &eventType, void *message,
+	native_event_result_t *result)
 {
 	// Reference: http://nicug.blogspot.com/2011/03/windows-7-taskbar-extensions-in-qt.html
 	Q_D(QRvtHToolWindow);
@@ -1064,8 +1226,8 @@ void QRvtHToolWindow::on_actionExtract_triggered(void)
 {
 	Q_D(QRvtHToolWindow);
 
-	if (d->workerObject || (d->workerThread && d->workerThread->isRunning())) {
-		// Worker thread is already running.
+	if (d->loadWorker) {
+		// Banks are still loading.
 		return;
 	}
 
@@ -1090,54 +1252,17 @@ void QRvtHToolWindow::on_actionExtract_triggered(void)
 	if (filename.isEmpty())
 		return;
 
-	// Disable the main UI widgets.
-	markUiBusy();
-
-	// Show the progress bar and cancel button.
-	d->btnCancel->setVisible(true);
-	d->progressBar->setVisible(true);
-	d->progressBar->setMaximum(100);
-	d->progressBar->setValue(0);
-
-	// Initial message.
-	const QString filenameOnly = d->getDisplayFilename(filename);
-	d->lblMessage->setText(tr("Extracting Bank %1 to %2:")
-		.arg(bank+1).arg(filenameOnly));
-
 	// Recryption key.
 	const int recryption_key = d->cboRecryptionKey->currentData().toInt();
 
 	// TODO: NDEV flag?
 	const unsigned int flags = 0;
 
-	// Update status.
-	// NOTE: We don't need to do an initial update for extract.
-	d->updateStatus_didInitialUpdate = true;
-	d->updateStatus_bank = bank;
-
-	// Create the worker thread and object.
-	d->workerThread = new QThread(this);
-	d->workerThread->setObjectName(QStringLiteral("workerThread"));
-	d->workerObject = new WorkerObject();
-	d->workerObject->setObjectName(QStringLiteral("workerObject"));
-	d->workerObject->moveToThread(d->workerThread);
-	d->workerObject->setRvtH(d->rvth);
-	d->workerObject->setBank(bank);
-	d->workerObject->setGcmFilename(filename);
-	d->workerObject->setRecryptionKey(recryption_key);
-	d->workerObject->setFlags(flags);
-
-	connect(d->workerThread, &QThread::started,
-		d->workerObject, &WorkerObject::doExtract);
-	connect(d->workerObject, &WorkerObject::updateStatus,
-		this, &QRvtHToolWindow::workerObject_updateStatus);
-	connect(d->workerObject, &WorkerObject::finished,
-		this, &QRvtHToolWindow::workerObject_finished);
-
-	// Start the thread.
-	// Progress will be updated using callback signals.
-	// TODO: Watchdog timer in case the thread fails?
-	d->workerThread->start();
+	// Queue the job.
+	// Progress will be updated using JobQueue signals.
+	d->jobQueue->addJob(JobQueue::JOB_EXTRACT, d->rvth, QDir::toNativeSeparators(d->filename),
+		bank, filename, recryption_key, flags);
+	d->updateActionEnableStatus();
 }
 
 /**
@@ -1147,8 +1272,8 @@ void QRvtHToolWindow::on_actionImport_triggered(void)
 {
 	Q_D(QRvtHToolWindow);
 
-	if (d->workerObject || (d->workerThread && d->workerThread->isRunning())) {
-		// Worker thread is already running.
+	if (d->loadWorker) {
+		// Banks are still loading.
 		return;
 	}
 
@@ -1174,46 +1299,33 @@ void QRvtHToolWindow::on_actionImport_triggered(void)
 	if (filename.isEmpty())
 		return;
 
-	// Disable the main UI widgets.
-	markUiBusy();
-
-	// Show the progress bar and cancel button.
-	d->btnCancel->setVisible(true);
-	d->progressBar->setVisible(true);
-	d->progressBar->setMaximum(100);
-	d->progressBar->setValue(0);
-
-	// Initial message.
-	const QString filenameOnly = d->getDisplayFilename(filename);
-	d->lblMessage->setText(tr("Importing %1 to Bank %2:")
-		.arg(filenameOnly).arg(bank+1));
-
-	// Update status.
-	// NOTE: We *do* need to do an initial update for import.
-	d->updateStatus_didInitialUpdate = false;
-	d->updateStatus_bank = bank;
-
-	// Create the worker thread and object.
-	d->workerThread = new QThread(this);
-	d->workerThread->setObjectName(QStringLiteral("workerThread"));
-	d->workerObject = new WorkerObject();
-	d->workerObject->setObjectName(QStringLiteral("workerObject"));
-	d->workerObject->moveToThread(d->workerThread);
-	d->workerObject->setRvtH(d->rvth);
-	d->workerObject->setBank(bank);
-	d->workerObject->setGcmFilename(filename);
-
-	connect(d->workerThread, &QThread::started,
-		d->workerObject, &WorkerObject::doImport);
-	connect(d->workerObject, &WorkerObject::updateStatus,
-		this, &QRvtHToolWindow::workerObject_updateStatus);
-	connect(d->workerObject, &WorkerObject::finished,
-		this, &QRvtHToolWindow::workerObject_finished);
+	// Check if the image can be imported before queueing the job.
+	// Only the image's metadata is read, so this is fast.
+	// If other jobs are using this device, the bank entries may change,
+	// so the check is left to the import job itself.
+	if (!d->jobQueue->isBusy(d->rvth)) {
+		const QString nativeFilename = QDir::toNativeSeparators(filename);
+#ifdef _WIN32
+		const int ret = d->rvth->checkImport(bank,
+			reinterpret_cast<const wchar_t*>(nativeFilename.utf16()));
+#else /* !_WIN32 */
+		const int ret = d->rvth->checkImport(bank,
+			nativeFilename.toUtf8().constData());
+#endif /* _WIN32 */
+		if (ret != 0) {
+			const QString errMsg = tr("Cannot import '%1' into Bank %2: %3")
+				.arg(QFileInfo(filename).fileName()).arg(bank+1)
+				.arg(QString::fromUtf8(rvth_error(ret)));
+			d->ui.msgWidget->showMessage(errMsg, MessageWidget::ICON_WARNING);
+			return;
+		}
+	}
 
-	// Start the thread.
-	// Progress will be updated using callback signals.
-	// TODO: Watchdog timer in case the thread fails?
-	d->workerThread->start();
+	// Queue the job.
+	// Progress will be updated using JobQueue signals.
+	d->jobQueue->addJob(JobQueue::JOB_IMPORT, d->rvth, QDir::toNativeSeparators(d->filename),
+		bank, filename);
+	d->updateActionEnableStatus();
 }
 
 /**
@@ -1223,8 +1335,8 @@ void QRvtHToolWindow::on_actionDelete_triggered(void)
 {
 	Q_D(QRvtHToolWindow);
 
-	if (d->workerObject || (d->workerThread && d->workerThread->isRunning())) {
-		// Worker thread is already running.
+	if (d->loadWorker || d->jobQueue->isBusy(d->rvth)) {
+		// Banks are still loading, or jobs are using this device.
 		return;
 	}
 
@@ -1275,8 +1387,8 @@ void QRvtHToolWindow::on_actionUndelete_triggered(void)
 {
 	Q_D(QRvtHToolWindow);
 
-	if (d->workerObject || (d->workerThread && d->workerThread->isRunning())) {
-		// Worker thread is already running.
+	if (d->loadWorker || d->jobQueue->isBusy(d->rvth)) {
+		// Banks are still loading, or jobs are using this device.
 		return;
 	}
 
@@ -1318,6 +1430,39 @@ void QRvtHToolWindow::on_actionUndelete_triggered(void)
 	d->updateActionEnableStatus();
 }
 
+/**
+ * Verify the selected bank.
+ */
+void QRvtHToolWindow::on_actionVerify_triggered(void)
+{
+	Q_D(QRvtHToolWindow);
+
+	if (d->loadWorker) {
+		// Banks are still loading.
+		return;
+	}
+
+	// Only one bank can be selected.
+	QItemSelectionModel *const selectionModel = d->ui.lstBankList->selectionModel();
+	if (!selectionModel->hasSelection())
+		return;
+
+	QModelIndex index = d->ui.lstBankList->selectionModel()->currentIndex();
+	if (!index.isValid())
+		return;
+
+	// TODO: Sort proxy model like in mcrecover.
+	const unsigned int bank = d->proxyModel->mapToSource(index).row();
+
+	// Queue the job.
+	// Banks that haven't changed since they were last verified
+	// report the cached result, same as `rvthtool verify`.
+	d->jobQueue->addJob(JobQueue::JOB_VERIFY, d->rvth, QDir::toNativeSeparators(d->filename),
+		bank, QString(), -1, RVTH_VERIFY_USE_CACHE,
+		d->ui.actionVerifyLowPriority->isChecked());
+	d->updateActionEnableStatus();
+}
+
 /** RvtHModel slots **/
 
 void QRvtHToolWindow::rvthModel_layoutChanged(void)
@@ -1338,6 +1483,33 @@ void QRvtHToolWindow::rvthModel_rowsInserted(void)
 	d->updateLstBankList();
 }
 
+/**
+ * A bank's data has changed.
+ * @param bank Bank number
+ */
+void QRvtHToolWindow::rvthModel_bankChanged(unsigned int bank)
+{
+	Q_D(QRvtHToolWindow);
+	d->detailsLoader->invalidate(bank);
+	if (d->selectedBankNumber() == static_cast<int>(bank)) {
+		d->updateBankDetails();
+	}
+}
+
+/** BankDetailsLoader slots **/
+
+/**
+ * A bank's details have been loaded.
+ * @param bank Bank number
+ */
+void QRvtHToolWindow::detailsLoader_detailsLoaded(unsigned int bank)
+{
+	Q_D(QRvtHToolWindow);
+	if (d->selectedBankNumber() == static_cast<int>(bank)) {
+		d->ui.bevBankEntryView->setBankDetails(d->detailsLoader->details(bank));
+	}
+}
+
 /** lstBankList slots **/
 
 void QRvtHToolWindow::lstBankList_selectionModel_selectionChanged(
@@ -1348,7 +1520,7 @@ void QRvtHToolWindow::lstBankList_selectionModel_selectionChanged(
 
 	if (!d->rvth) {
 		// No RVT-H Reader disk image.
-		d->ui.bevBankEntryView->setBankEntry(nullptr);
+		d->setBankEntry(nullptr);
 		return;
 	}
 
@@ -1361,38 +1533,77 @@ void QRvtHToolWindow::lstBankList_selectionModel_selectionChanged(
 	if (!selList.isEmpty()) {
 		// TODO: Sort proxy model like in mcrecover.
 		bank = d->proxyModel->mapToSource(selList[0]).row();
-		entry = d->rvth->bankEntry(bank);
+		if (d->model->isBankLoaded(static_cast<unsigned int>(bank))) {
+			entry = d->rvth->bankEntry(bank);
+		}
 	}
 
 	// Set the BankView's BankEntry to the selected bank.
 	// NOTE: Only handles the first selected bank.
-	d->ui.bevBankEntryView->setBankEntry(entry);
+	d->setBankEntry(entry);
 
 	// Update the action enable status.
 	d->updateActionEnableStatus();
 }
 
-/** Worker object slots **/
+/** JobQueue slots **/
+
+/**
+ * A job has been started.
+ * @param id Job ID
+ */
+void QRvtHToolWindow::jobQueue_jobStarted(int id)
+{
+	Q_D(QRvtHToolWindow);
+	if (d->jobQueue->jobType(id) == JobQueue::JOB_IMPORT) {
+		// Import changes the bank entry once it starts writing.
+		d->importJobsPendingUpdate.insert(id);
+
+		// Previous verification results no longer apply.
+		if (d->rvth && d->jobQueue->jobRvtH(id) == d->rvth) {
+			d->verifyMaps.remove(d->jobQueue->jobBank(id));
+			d->updateVerifyMap();
+		}
+	}
+}
 
 /**
- * Update the status bar.
- * @param text Status bar text.
+ * A job's progress has been updated.
+ * The status bar shows one job at a time.
+ * @param id Job ID
+ * @param text Status text
  * @param progress_value Progress bar value. (If -1, ignore this.)
  * @param progress_max Progress bar maximum. (If -1, ignore this.)
  */
-void QRvtHToolWindow::workerObject_updateStatus(const QString &text, int progress_value, int progress_max)
+void QRvtHToolWindow::jobQueue_jobProgress(int id, const QString &text, int progress_value, int progress_max)
 {
 	Q_D(QRvtHToolWindow);
+	if (d->importJobsPendingUpdate.remove(id)) {
+		// Update the RVT-H model.
+		if (d->rvth && d->jobQueue->jobRvtH(id) == d->rvth) {
+			d->model->forceBankUpdate(d->jobQueue->jobBank(id));
+		}
+	}
+
+	if (d->loadWorker) {
+		// The status bar is showing the loader's progress.
+		return;
+	}
+
+	// Only one job is shown in the status bar and taskbar button,
+	// so they're updated at most once per polling interval.
+	if (d->statusJobId < 0) {
+		d->statusJobId = id;
+	} else if (d->statusJobId != id) {
+		return;
+	}
+
 	d->lblMessage->setText(text);
+	d->btnCancel->setVisible(true);
+	d->progressBar->setVisible(true);
 
 	// TODO: "Error" state.
 	if (progress_value >= 0 && progress_max >= 0) {
-		if (!d->updateStatus_didInitialUpdate) {
-			// Update the RVT-H model.
-			d->model->forceBankUpdate(d->updateStatus_bank);
-			d->updateStatus_didInitialUpdate = true;
-		}
-
 		if (d->progressBar->maximum() != progress_max) {
 			d->progressBar->setMaximum(progress_max);
 		}
@@ -1408,61 +1619,268 @@ void QRvtHToolWindow::workerObject_updateStatus(const QString &text, int progres
 }
 
 /**
- * Process is finished.
- * @param text Status bar text.
- * @param err Error code. (0 on success)
+ * A verify job's results have been updated.
+ * @param id Job ID
+ * @param map Verification results so far
  */
-void QRvtHToolWindow::workerObject_finished(const QString &text, int err)
+void QRvtHToolWindow::jobQueue_jobVerifyProgress(int id, const VerifyMap &map)
 {
 	Q_D(QRvtHToolWindow);
-	d->lblMessage->setText(text);
+	if (!d->rvth || d->jobQueue->jobRvtH(id) != d->rvth) {
+		// Not the RVT-H object being displayed.
+		return;
+	}
 
-	// Hide the Cancel button.
-	d->btnCancel->setVisible(false);
+	const unsigned int bank = d->jobQueue->jobBank(id);
+	d->verifyMaps.insert(bank, map);
+	if (d->selectedBankNumber() == static_cast<int>(bank)) {
+		d->ui.bevBankEntryView->setVerifyMap(map);
+	}
+}
+
+/**
+ * A job has finished, failed, or been cancelled.
+ * @param id Job ID
+ * @param text Status text
+ * @param err Error code. (0 on success; -ECANCELED if cancelled)
+ */
+void QRvtHToolWindow::jobQueue_jobFinished(int id, const QString &text, int err)
+{
+	Q_D(QRvtHToolWindow);
+	d->importJobsPendingUpdate.remove(id);
+	if (d->statusJobId == id) {
+		// Show the next job that reports progress.
+		d->statusJobId = -1;
+	}
 
 	if (err == 0) {
 		// Process completed.
-		d->progressBar->setValue(d->progressBar->maximum());
 		MessageSound::play(QMessageBox::Information, text, this);
-	} else {
+	} else if (err != -ECANCELED) {
 		// Process failed.
-		// TODO: Change progress bar to red?
 		// TOOD: Critical vs. warning.
 		MessageSound::play(QMessageBox::Warning, text, this);
 	}
 
-	// TODO: Hide the progress bar on success after 5 seconds.
-	// TODO: Same with taskbar button, but for now, just clear it.
+	if (!d->loadWorker) {
+		d->lblMessage->setText(text);
+		if (d->jobQueue->jobCount() == 0) {
+			// Last job. Hide the Cancel button.
+			// TODO: Hide the progress bar on success after 5 seconds.
+			d->btnCancel->setVisible(false);
+			if (err == 0) {
+				d->progressBar->setValue(d->progressBar->maximum());
+			}
+			// TODO: Same with taskbar button, but for now, just clear it.
+			if (d->taskbarButtonManager) {
+				d->taskbarButtonManager->clearProgressBar();
+			}
+		}
+	}
+
+	if (d->rvth && d->jobQueue->jobRvtH(id) == d->rvth) {
+		// Update the RVT-H model and BankEntryView.
+		if (d->jobQueue->jobType(id) == JobQueue::JOB_IMPORT) {
+			d->model->forceBankUpdate(d->jobQueue->jobBank(id));
+		}
+		const RvtH_BankEntry *const entry = d->selectedBankEntry();
+		d->setBankEntry(entry);
+	}
+
+	// Delete and Undelete may be available now.
+	d->updateActionEnableStatus();
+}
+
+/** Open worker slots **/
+
+/**
+ * The RVT-H Reader device or disk image has been opened.
+ * @param err Error code. (0 on success)
+ */
+void QRvtHToolWindow::loadWorker_opened(int err)
+{
+	Q_D(QRvtHToolWindow);
+	if (sender() != d->loadWorker) {
+		// Signal from a loader that was already stopped.
+		return;
+	}
+
+	if (err != 0) {
+		// Unable to open the RVT-H Reader disk image.
+		// NOTE: The thread is cleaned up in loadWorker_finished().
+		const QString errMsg = tr("An error occurred while opening '%1': %2")
+			.arg(d->getDisplayFilename(d->filename), QString::fromUtf8(rvth_error(err)));
+		d->ui.msgWidget->showMessage(errMsg, MessageWidget::ICON_CRITICAL);
+		d->filename.clear();
+		return;
+	}
+	StartupProfiler::mark("file opened");
+
+	// NOTE: The loader continues initializing bank entries,
+	// so rvth must not be deleted until it's stopped.
+	d->rvth = d->loadWorker->takeRvtH();
+	d->model->setRvtH(d->rvth);
+	d->detailsLoader->setRvtH(d->rvth);
+
+	d->nhcd_status.clear();
+	d->write_enabled = false;
+
+	// Check the NHCD table status.
+	bool checkNHCD = false;
+	switch (d->rvth->imageType()) {
+		case RVTH_ImageType_HDD_Reader:
+		case RVTH_ImageType_HDD_Image:
+			// NHCD table should be present.
+			checkNHCD = true;
+			break;
+
+		default:
+			// No NHCD table here.
+			break;
+	}
+
+	if (checkNHCD) {
+		QString message;
+		switch (d->rvth->nhcd_status()) {
+			case NHCD_STATUS_OK:
+				if (d->rvth->imageType() == RVTH_ImageType_HDD_Reader) {
+					d->write_enabled = true;
+				}
+				break;
+
+			default:
+			case NHCD_STATUS_UNKNOWN:
+			case NHCD_STATUS_MISSING:
+				message = tr("NHCD table is missing.");
+				d->nhcd_status = QStringLiteral("!NHCD");
+				break;
+
+			case NHCD_STATUS_HAS_MBR:
+				message = tr("This appears to be a PC MBR-partitioned HDD.");
+				d->nhcd_status = QStringLiteral("MBR?");
+				break;
+
+			case NHCD_STATUS_HAS_GPT:
+				message = tr("This appears to be a PC GPT-partitioned HDD.");
+				d->nhcd_status = QStringLiteral("GPT?");
+				break;
+		}
+
+		if (!message.isEmpty()) {
+			message += QChar(L'\n') + tr("Using defaults. Writing will be disabled.");
+			d->ui.msgWidget->showMessage(message, MessageWidget::ICON_CRITICAL);
+		}
+	}
+
+	// Progress is shown as the number of banks loaded.
+	const int bankCount = static_cast<int>(d->rvth->bankCount());
+	d->progressBar->setMaximum(bankCount);
+	d->progressBar->setValue(0);
+	if (d->taskbarButtonManager) {
+		d->taskbarButtonManager->setProgressBarMax(bankCount);
+		d->taskbarButtonManager->setProgressBarValue(0);
+	}
+	d->lblMessage->setText(tr("Loading banks from '%1'...")
+		.arg(d->getDisplayFilename(d->filename)));
+
+	// Update the UI.
+	d->updateLstBankList();
+	d->updateWindowTitle();
+	d->updateActionEnableStatus();
+}
+
+/**
+ * A bank entry has been initialized.
+ * @param bank Bank number.
+ */
+void QRvtHToolWindow::loadWorker_bankLoaded(unsigned int bank)
+{
+	Q_D(QRvtHToolWindow);
+	if (sender() != d->loadWorker || !d->rvth) {
+		// Signal from a loader that was already stopped.
+		return;
+	}
+
+	d->model->setBankLoaded(bank);
+	d->progressBar->setValue(static_cast<int>(bank + 1));
 	if (d->taskbarButtonManager) {
-		d->taskbarButtonManager->clearProgressBar();
+		d->taskbarButtonManager->setProgressBarValue(static_cast<int>(bank + 1));
+	}
+
+	if (bank == 0) {
+		// The window icon may depend on the first bank.
+		d->updateWindowTitle();
+	}
+
+	if (d->selectedBankNumber() == static_cast<int>(bank)) {
+		// The selected bank is now available.
+		d->setBankEntry(d->selectedBankEntry());
+	}
+}
+
+/**
+ * All bank entries have been initialized, or loading was cancelled.
+ */
+void QRvtHToolWindow::loadWorker_finished(void)
+{
+	Q_D(QRvtHToolWindow);
+	if (sender() != d->loadWorker) {
+		// Signal from a loader that was already stopped.
+		return;
 	}
 
 	// Make sure the thread exits.
-	// NOTE: Connecting WorkerObject::finished() to QThread::quit()
-	// might not work if the slots get run in the wrong order.
-	// NOTE 2: QThread::wait() doesn't return if the thread has
-	// finished before it's called, even though the documentation
-	// says it does...
-	d->workerThread->quit();
-	do {
-		d->workerThread->wait(250);
-	} while (d->workerThread->isRunning());
-	d->workerThread->deleteLater();
-	d->workerThread = nullptr;
-
-	// Delete the worker object. It'll be created again for the next process.
-	// NOTE: Need to use deleteLater() to prevent race conditions.
-	d->workerObject->deleteLater();
-	d->workerObject = nullptr;
-
-	// Update BankEntryView.
-	// TODO: Only if importing?
-	const RvtH_BankEntry *const entry = d->selectedBankEntry();
-	d->ui.bevBankEntryView->setBankEntry(entry);
-
-	// Enable the main UI widgets.
+	d->stopLoading();
+	StartupProfiler::mark("banks loaded");
+
+	// Update the UI.
+	// FIXME: If a file is opened from the command line,
+	// QTreeView sort-of selects the first file.
+	// (Signal is emitted, but nothing is highlighted.)
+	d->updateLstBankList();
+	d->setBankEntry(d->rvth ? d->selectedBankEntry() : nullptr);
+	d->updateActionEnableStatus();
+
+	if (d->rvth && d->rvth->isHDD()) {
+		// Watch for changes made by other programs.
+		d->pollTimer->start();
+	}
+}
+
+/**
+ * Check the bank table for changes made by other programs or hosts.
+ * Only the banks whose bank table entries changed are updated.
+ */
+void QRvtHToolWindow::pollTimer_timeout(void)
+{
+	Q_D(QRvtHToolWindow);
+	if (!d->rvth || d->loadWorker || d->jobQueue->isBusy(d->rvth) ||
+	    d->detailsLoader->isLoading() || d->rvth->inBankTableTransaction())
+	{
+		// The RVT-H object is in use. Check again later.
+		return;
+	}
+
+	std::vector<unsigned int> changed;
+	const int ret = d->rvth->pollBankTable(&changed);
+	if (ret == -ESTALE) {
+		// The bank table was reformatted. Reopen the device.
+		const QString filename = d->filename;
+		openRvtH(filename, d->rvth->imageType() == RVTH_ImageType_HDD_Reader);
+		return;
+	} else if (ret != 0 || changed.empty()) {
+		// Nothing changed, or the bank table couldn't be read.
+		return;
+	}
+
+	for (unsigned int bank : changed) {
+		// Previous verification results no longer apply.
+		d->verifyMaps.remove(bank);
+		d->model->forceBankUpdate(bank);
+	}
+	d->updateVerifyMap();
+	d->setBankEntry(d->selectedBankEntry());
 	d->updateActionEnableStatus();
-	markUiNotBusy();
 }
 
 /**
@@ -1471,11 +1889,17 @@ void QRvtHToolWindow::workerObject_finished(const QString &text, int err)
 void QRvtHToolWindow::btnCancel_clicked(void)
 {
 	Q_D(QRvtHToolWindow);
-	// TODO: Make sure there's no race conditions.
-	if (d->workerObject) {
-		// TODO: Delete the destination .gcm if necessary?
-		// TODO: If importing, restore the old bank entry?
-		// (may need librvth changes)
-		d->workerObject->cancel();
+	if (d->loadWorker) {
+		// Stop loading after the current bank.
+		// Banks that weren't loaded remain as placeholders.
+		d->loadWorker->cancel();
+		return;
 	}
+
+	// Cancel all queued and running jobs.
+	// Individual jobs can be cancelled from the job list.
+	// TODO: Delete the destination .gcm if necessary?
+	// TODO: If importing, restore the old bank entry?
+	// (may need librvth changes)
+	d->jobQueue->cancelAll();
 }
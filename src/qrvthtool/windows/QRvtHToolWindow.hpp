@@ -12,6 +12,9 @@
 class QItemSelection;
 #include <QMainWindow>
 
+// NOTE: Qt6's moc doesn't like incomplete types.
+#include "VerifyMap.hpp"
+
 class QRvtHToolWindowPrivate;
 class QRvtHToolWindow : public QMainWindow
 {
@@ -52,8 +55,15 @@ class QRvtHToolWindow : public QMainWindow
 		void closeEvent(QCloseEvent *event) final;
 
 #ifdef Q_OS_WIN
+#if QT_VERSION >= QT_VERSION_CHECK(6,0,0)
+		typedef qintptr native_event_result_t;
+#else /* QT_VERSION < QT_VERSION_CHECK(6,0,0) */
+		typedef long native_event_result_t;
+#endif /* QT_VERSION >= QT_VERSION_CHECK(6,0,0) */
+
 		// Windows message handler. Used for TaskbarButtonManager.
-		bool nativeEvent(const QByteArray &eventType, void *message, long *result) final;
+		bool nativeEvent(const QByteArray &eventType, void *message,
+			native_event_result_t *result) final;
 #endif /* Q_OS_WIN */
 
 	protected slots:
@@ -76,37 +86,93 @@ class QRvtHToolWindow : public QMainWindow
 		void on_actionImport_triggered(void);
 		void on_actionDelete_triggered(void);
 		void on_actionUndelete_triggered(void);
+		void on_actionVerify_triggered(void);
 
 		// RvtHModel slots
 		void rvthModel_layoutChanged(void);
 		void rvthModel_rowsInserted(void);
 
+		/**
+		 * A bank's data has changed.
+		 * @param bank Bank number
+		 */
+		void rvthModel_bankChanged(unsigned int bank);
+
+		// BankDetailsLoader slots
+
+		/**
+		 * A bank's details have been loaded.
+		 * @param bank Bank number
+		 */
+		void detailsLoader_detailsLoaded(unsigned int bank);
+
 		// lstBankList slots
 		void lstBankList_selectionModel_selectionChanged(
 			const QItemSelection& selected, const QItemSelection& deselected);
 
 	protected slots:
-		/** Worker object slots **/
+		/** JobQueue slots **/
 
 		/**
-		 * Update the status bar.
-		 * @param text Status bar text.
+		 * A job has been started.
+		 * @param id Job ID
+		 */
+		void jobQueue_jobStarted(int id);
+
+		/**
+		 * A job's progress has been updated.
+		 * The status bar shows one job at a time.
+		 * @param id Job ID
+		 * @param text Status text
 		 * @param progress_value Progress bar value. (If -1, ignore this.)
 		 * @param progress_max Progress bar maximum. (If -1, ignore this.)
 		 */
-		void workerObject_updateStatus(const QString &text, int progress_value, int progress_max);
+		void jobQueue_jobProgress(int id, const QString &text, int progress_value, int progress_max);
+
+		/**
+		 * A job has finished, failed, or been cancelled.
+		 * @param id Job ID
+		 * @param text Status text
+		 * @param err Error code. (0 on success; -ECANCELED if cancelled)
+		 */
+		void jobQueue_jobFinished(int id, const QString &text, int err);
 
 		/**
-		 * Process is finished.
-		 * @param text Status bar text.
+		 * A verify job's results have been updated.
+		 * @param id Job ID
+		 * @param map Verification results so far
+		 */
+		void jobQueue_jobVerifyProgress(int id, const VerifyMap &map);
+
+		/** Open worker slots **/
+
+		/**
+		 * The RVT-H Reader device or disk image has been opened.
 		 * @param err Error code. (0 on success)
 		 */
-		void workerObject_finished(const QString &text, int err);
+		void loadWorker_opened(int err);
+
+		/**
+		 * A bank entry has been initialized.
+		 * @param bank Bank number.
+		 */
+		void loadWorker_bankLoaded(unsigned int bank);
+
+		/**
+		 * All bank entries have been initialized, or loading was cancelled.
+		 */
+		void loadWorker_finished(void);
 
 		/**
 		 * Cancel button was pressed.
 		 */
 		void btnCancel_clicked(void);
+
+		/**
+		 * Check the bank table for changes made by other programs or hosts.
+		 * Only the banks whose bank table entries changed are updated.
+		 */
+		void pollTimer_timeout(void);
 };
 
 #endif /* __RVTHTOOL_QRVTHTOOL_WINDOWS_QRVTHTOOLWINDOW_HPP__ */
@@ -14,6 +14,7 @@
 
 // for the RVT-H Reader icon
 #include "../RvtHModel.hpp"
+#include "../DeviceQueryWorker.hpp"
 
 #ifdef _WIN32
 #  include "libwiicrypto/win32/Win32_sdk.h"
@@ -24,11 +25,14 @@
 
 // C includes (C++ namespace)
 #include <cassert>
+#include <cerrno>
 
 // Qt includes
 #include <QtCore/QLocale>
 #include <QPushButton>
 #include <QMetaMethod>
+#include <QSocketNotifier>
+#include <QtCore/QThread>
 
 /** SelectDeviceDialogPrivate **/
 
@@ -58,11 +62,21 @@ class SelectDeviceDialogPrivate
 		QList<DeviceQueryData> lstQueryData;
 
 		// Device listener
+		// The listener's fd is watched by listenerNotifier,
+		// so events are processed in the GUI thread.
 		RvtH_ListenForDevices *listener;
+		QSocketNotifier *listenerNotifier;
 #ifdef _WIN32
 		HDEVNOTIFY hDeviceNotify;
 #endif /* _WIN32 */
 
+		// Background device query
+		// Devices that were removed while the query was running
+		// aren't added from its results.
+		bool querying;
+		bool requery;		// Query again once the current query finishes
+		QStringList removedDuringQuery;
+
 	private:
 		static inline int calc_frac_part(int64_t size, int64_t mask);
 
@@ -73,16 +87,45 @@ class SelectDeviceDialogPrivate
 		*/
 		static QString format_size(int64_t size);
 
+	public:
+		/**
+		 * Find a device in the list.
+		 * @param device_name Device name
+		 * @return Index, or -1 if not found.
+		 */
+		int findDevice(const QString &device_name) const;
+
 		/**
 		 * Add a device to the list.
+		 * If the device is already in the list, its entry is updated.
 		 * @param queryData DeviceQueryData
 		 */
 		void addDevice(const DeviceQueryData &queryData);
 
-	public:
-		// Refresh the device list.
+		/**
+		 * Remove a device from the list.
+		 * @param device_name Device name
+		 */
+		void removeDevice(const QString &device_name);
+
+		/**
+		 * Set the text that's shown if the device list is empty.
+		 * @param err Positive POSIX error code from the device query (0 if none)
+		 */
+		void setNoItemText(int err);
+
+		/**
+		 * Refresh the device list.
+		 * Cached results from the device listener are shown immediately.
+		 * Otherwise, the devices are queried on a background thread.
+		 */
 		void refreshDeviceList(void);
 
+		/**
+		 * Start querying the devices on a background thread.
+		 */
+		void startQuery(void);
+
 		/**
 		 * RvtH device listener callback.
 		 * @param listener Listener
@@ -106,9 +149,12 @@ SelectDeviceDialogPrivate::SelectDeviceDialogPrivate(SelectDeviceDialog *q)
 	: q_ptr(q)
 	, sel_device(nullptr)
 	, listener(nullptr)
+	, listenerNotifier(nullptr)
 #ifdef _WIN32
 	, hDeviceNotify(nullptr)
 #endif /* _WIN32 */
+	, querying(false)
+	, requery(false)
 {
 	// Get the RVT-H Reader icon.
 	rvthReaderIcon = RvtHModel::getIcon(RvtHModel::ICON_RVTH);
@@ -116,6 +162,8 @@ SelectDeviceDialogPrivate::SelectDeviceDialogPrivate(SelectDeviceDialog *q)
 
 SelectDeviceDialogPrivate::~SelectDeviceDialogPrivate()
 {
+	// NOTE: Delete the notifier before the listener closes its fd.
+	delete listenerNotifier;
 	if (listener) {
 		rvth_listener_stop(listener);
 	}
@@ -222,8 +270,26 @@ QString SelectDeviceDialogPrivate::format_size(int64_t size)
 	return sbuf;
 }
 
+/**
+ * Find a device in the list.
+ * @param device_name Device name
+ * @return Index, or -1 if not found.
+ */
+int SelectDeviceDialogPrivate::findDevice(const QString &device_name) const
+{
+	// NOTE: The indexes match the QListWidget indexes.
+	const int list_count = lstQueryData.count();
+	for (int i = 0; i < list_count; i++) {
+		if (lstQueryData[i].device_name == device_name) {
+			return i;
+		}
+	}
+	return -1;
+}
+
 /**
  * Add a device to the list.
+ * If the device is already in the list, its entry is updated.
  * @param queryData DeviceQueryData
  */
 void SelectDeviceDialogPrivate::addDevice(const DeviceQueryData &queryData)
@@ -233,6 +299,14 @@ void SelectDeviceDialogPrivate::addDevice(const DeviceQueryData &queryData)
 		queryData.usb_serial + QChar(L'\n') +
 		format_size(queryData.size);
 
+	const int idx = findDevice(queryData.device_name);
+	if (idx >= 0) {
+		// Device is already in the list.
+		ui.lstDevices->item(idx)->setText(text);
+		lstQueryData[idx] = queryData;
+		return;
+	}
+
 	// Create the QListWidgetItem.
 	// TODO: Verify that QListWidget takes ownership.
 	// TODO: Switch to QListView and use a model.
@@ -243,8 +317,82 @@ void SelectDeviceDialogPrivate::addDevice(const DeviceQueryData &queryData)
 	lstQueryData.append(queryData);
 }
 
+/**
+ * Remove a device from the list.
+ * @param device_name Device name
+ */
+void SelectDeviceDialogPrivate::removeDevice(const QString &device_name)
+{
+	// NOTE: sel_device isn't set until the dialog is accepted,
+	// so we don't have to clear it if the selected device is removed.
+	const int idx = findDevice(device_name);
+	if (idx >= 0) {
+		delete ui.lstDevices->takeItem(idx);
+		lstQueryData.removeAt(idx);
+	}
+}
+
+/**
+ * Set the text that's shown if the device list is empty.
+ * @param err Positive POSIX error code from the device query (0 if none)
+ */
+void SelectDeviceDialogPrivate::setNoItemText(int err)
+{
+#ifdef HAVE_QUERY
+	if (querying) {
+		ui.lstDevices->setNoItemText(
+			SelectDeviceDialog::tr("Searching for RVT-H Reader devices..."));
+		return;
+	}
+
+	// If err is non-zero, this may be a permissions issue.
+	QString s_err;
+	if (err != 0) {
+		// TODO: Enable rich text for the message and bold the first line?
+		s_err = QStringLiteral("*** %1 ***\n")
+			.arg(SelectDeviceDialog::tr("ERROR enumerating RVT-H Reader devices:"));
+		// TODO: Translate strerror().
+		s_err += QString::fromUtf8(strerror(err));
+		if (err == EACCES) {
+#ifdef _WIN32
+			OSVERSIONINFO osvi;
+			osvi.dwOSVersionInfoSize = sizeof(osvi);
+			if (!GetVersionEx(&osvi)) {
+				// GetVersionEx() failed.
+				// Assume it's an old version of Windows.
+				osvi.dwMajorVersion = 0;
+			}
+			if (osvi.dwMajorVersion >= 6) {
+				s_err += QStringLiteral("\n\n") +
+					SelectDeviceDialog::tr("Try rerunning qrvthtool as Administrator.");
+			} else {
+				s_err += QStringLiteral("\n\n") +
+					SelectDeviceDialog::tr("Try rerunning qrvthtool using an Administrator account.");
+			}
+#else /* _WIN32 */
+			s_err += SelectDeviceDialog::tr("Try rerunning qrvthtool as root.");
+#endif /* _WIN32 */
+		}
+	} else {
+		// Not a permissions issue.
+		// We simply didn't find any RVT-H Reader devices.
+		s_err = SelectDeviceDialog::tr("No RVT-H Reader devices found.");
+	}
+
+	ui.lstDevices->setNoItemText(s_err);
+#else /* !HAVE_QUERY */
+	// TODO: Better error message.
+	// TODO: Fall back to /dev/ scanning?
+	Q_UNUSED(err)
+	ui.lstDevices->setNoItemText(
+		SelectDeviceDialog::tr("ERROR: Device querying is not supported in this build."));
+#endif /* HAVE_QUERY */
+}
+
 /**
  * Refresh the device list.
+ * Cached results from the device listener are shown immediately.
+ * Otherwise, the devices are queried on a background thread.
  */
 void SelectDeviceDialogPrivate::refreshDeviceList(void)
 {
@@ -254,57 +402,22 @@ void SelectDeviceDialogPrivate::refreshDeviceList(void)
 	// and will be re-enabled if a device is selected.
 	ui.lstDevices->clear();
 	ui.buttonBox->button(QDialogButtonBox::Ok)->setEnabled(false);
-
-	// TODO: Automatically update on device hotplug?
 	lstQueryData.clear();
 
 #ifdef HAVE_QUERY
+	// The device listener keeps the cached results up to date,
+	// so they don't have to be refreshed if they're available.
 	int err = 0;
-	RvtH_QueryEntry *devs = rvth_query_devices(&err);
-	if (!devs) {
-		// No devices found.
-
-		// If err is non-zero, this may be a permissions issue.
-		QString s_err;
-		if (err != 0) {
-			// TODO: Enable rich text for the message and bold the first line?
-			s_err = QStringLiteral("*** %1 ***\n")
-				.arg(SelectDeviceDialog::tr("ERROR enumerating RVT-H Reader devices:"));
-			// TODO: Translate strerror().
-			s_err += QString::fromUtf8(strerror(err));
-			if (err == EACCES) {
-#ifdef _WIN32
-				OSVERSIONINFO osvi;
-				osvi.dwOSVersionInfoSize = sizeof(osvi);
-				if (!GetVersionEx(&osvi)) {
-					// GetVersionEx() failed.
-					// Assume it's an old version of Windows.
-					osvi.dwMajorVersion = 0;
-				}
-				if (osvi.dwMajorVersion >= 6) {
-					s_err += QStringLiteral("\n\n") +
-						SelectDeviceDialog::tr("Try rerunning qrvthtool as Administrator.");
-				} else {
-					s_err += QStringLiteral("\n\n") +
-						SelectDeviceDialog::tr("Try rerunning qrvthtool using an Administrator account.");
-				}
-#else /* _WIN32 */
-				s_err += SelectDeviceDialog::tr("Try rerunning qrvthtool as root.");
-#endif /* _WIN32 */
-			}
-		} else {
-			// Not a permissions issue.
-			// We simply didn't find any RVT-H Reader devices.
-			s_err = SelectDeviceDialog::tr("No RVT-H Reader devices found.");
-		}
-
-		ui.lstDevices->setNoItemText(s_err);
+	RvtH_QueryEntry *const devs = rvth_query_devices_cached(&err);
+	if (err == EAGAIN) {
+		// Nothing is cached. Enumerating the devices may take
+		// a while, so don't block the GUI thread.
+		startQuery();
+		setNoItemText(0);
 		return;
 	}
 
-	// Found devices.
-	const RvtH_QueryEntry *p = devs;
-	for (; p != NULL; p = p->next) {
+	for (const RvtH_QueryEntry *p = devs; p != nullptr; p = p->next) {
 		if (!p->device_name) {
 			// No device name. Skip it.
 			continue;
@@ -313,16 +426,53 @@ void SelectDeviceDialogPrivate::refreshDeviceList(void)
 		// Add this device.
 		addDevice(DeviceQueryData(p));
 	}
-
 	rvth_query_free(devs);
+	setNoItemText(err);
 #else /* !HAVE_QUERY */
-	// TODO: Better error message.
-	// TODO: Fall back to /dev/ scanning?
-	ui.lstDevices->setNoItemText(
-		SelectDeviceDialog::tr("ERROR: Device querying is not supported in this build."));
+	setNoItemText(ENOTSUP);
 #endif /* HAVE_QUERY */
 }
 
+/**
+ * Start querying the devices on a background thread.
+ */
+void SelectDeviceDialogPrivate::startQuery(void)
+{
+	if (querying) {
+		// Query again once the current query finishes,
+		// since it might have missed the latest changes.
+		requery = true;
+		return;
+	}
+	querying = true;
+	requery = false;
+	removedDuringQuery.clear();
+
+	// The thread and worker delete themselves once the query
+	// is finished, so the dialog can be closed in the meantime.
+	// NOTE: The results are discarded if the dialog is closed,
+	// since the connection is removed along with the dialog.
+	Q_Q(SelectDeviceDialog);
+	QThread *const queryThread = new QThread();
+	queryThread->setObjectName(QStringLiteral("queryThread"));
+	DeviceQueryWorker *const queryWorker = new DeviceQueryWorker();
+	queryWorker->setObjectName(QStringLiteral("queryWorker"));
+	queryWorker->moveToThread(queryThread);
+
+	QObject::connect(queryThread, &QThread::started,
+		queryWorker, &DeviceQueryWorker::doQuery);
+	QObject::connect(queryWorker, &DeviceQueryWorker::finished,
+		q, &SelectDeviceDialog::queryWorker_finished);
+	QObject::connect(queryWorker, &DeviceQueryWorker::finished,
+		queryThread, &QThread::quit);
+	QObject::connect(queryThread, &QThread::finished,
+		queryWorker, &QObject::deleteLater);
+	QObject::connect(queryThread, &QThread::finished,
+		queryThread, &QObject::deleteLater);
+
+	queryThread->start();
+}
+
 void SelectDeviceDialogPrivate::rvth_listener_callback(
 	RvtH_ListenForDevices *listener,
 	const RvtH_QueryEntry *entry,
@@ -334,13 +484,13 @@ void SelectDeviceDialogPrivate::rvth_listener_callback(
 	// NOTE: entry will be deleted once this callback returns.
 	// We'll need to copy the relevant data into a custom QObject.
 
-	// NOTE: This is running in a different thread.
-	// Need to use a QueuedConnection to trigger the Qt slot.
+	// NOTE: The listener is driven by the Qt event loop,
+	// so this is running in the GUI thread.
 	// NOTE: Due to Qt weirdness, the slot uses a const ref
 	// instead of a const pointer.
 	QMetaObject::invokeMethod(static_cast<SelectDeviceDialog*>(userdata),
 		"deviceStateChanged",
-		Qt::QueuedConnection,
+		Qt::DirectConnection,
 		Q_ARG(DeviceQueryData, DeviceQueryData(entry)),
 		Q_ARG(RvtH_Listen_State_e, state));
 }
@@ -358,6 +508,7 @@ SelectDeviceDialog::SelectDeviceDialog(QWidget *parent)
 	d->ui.setupUi(this);
 
 	qRegisterMetaType<DeviceQueryData>();
+	qRegisterMetaType<QList<DeviceQueryData> >();
 	qRegisterMetaType<RvtH_Listen_State_e>();
 
 	// Do NOT delete the window on close.
@@ -383,14 +534,29 @@ SelectDeviceDialog::SelectDeviceDialog(QWidget *parent)
 	// NOTE: Qt automatically interprets this as "Right" if an RTL language is in use.
 	d->ui.lstDevices->setDecorationPosition(QStyleOptionViewItem::Left);
 
-	// Refresh the device list.
-	d->refreshDeviceList();
-
 	// Attempt to create a device listener.
-	// TODO: Callbcak
-	d->listener = rvth_listen_for_devices(d->rvth_listener_callback, this);
+	// NOTE: This is done before refreshing the device list,
+	// since the query results are cached while listening.
+	// The listener doesn't use a separate thread. Its fd is
+	// watched by the Qt event loop instead. (On Windows, there's
+	// no fd; the notifications are delivered by the message loop.)
+	d->listener = rvth_listen_for_devices_fd(d->rvth_listener_callback, this);
 	if (d->listener) {
 		// Device listener was created.
+		const int fd = rvth_listener_get_fd(d->listener);
+		if (fd >= 0) {
+			d->listenerNotifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+#if QT_VERSION >= QT_VERSION_CHECK(6,0,0)
+			// NOTE: Qt6 removed QSocketNotifier::activated(int).
+			connect(d->listenerNotifier, &QSocketNotifier::activated,
+				this, &SelectDeviceDialog::listenerActivated);
+#else /* QT_VERSION < QT_VERSION_CHECK(6,0,0) */
+			// NOTE: Qt 5.15 has two activated() overloads,
+			// so the string-based syntax is used here.
+			connect(d->listenerNotifier, SIGNAL(activated(int)), this, SLOT(listenerActivated()));
+#endif /* QT_VERSION >= QT_VERSION_CHECK(6,0,0) */
+		}
+
 		// Hide the "Refresh" button.
 		btnRefresh->hide();
 	} else {
@@ -415,6 +581,11 @@ SelectDeviceDialog::SelectDeviceDialog(QWidget *parent)
 #endif /* _WIN32 */
 	}
 
+	// Refresh the device list.
+	// If the listener has cached results, they're shown immediately.
+	// Otherwise, the devices are queried in the background.
+	d->refreshDeviceList();
+
 	// Connect the lstDevices selection signal.
 	connect(d->ui.lstDevices->selectionModel(), &QItemSelectionModel::selectionChanged,
 		this, &SelectDeviceDialog::lstDevices_selectionModel_selectionChanged);
@@ -593,6 +764,17 @@ void SelectDeviceDialog::on_lstDevices_doubleClicked(const QModelIndex &index)
 	this->accept();
 }
 
+/**
+ * The device listener has pending events.
+ */
+void SelectDeviceDialog::listenerActivated(void)
+{
+	Q_D(SelectDeviceDialog);
+	if (d->listener) {
+		rvth_listener_process_events(d->listener);
+	}
+}
+
 /**
  * A device state has changed.
  * @param queryData Device query data
@@ -608,25 +790,48 @@ void SelectDeviceDialog::deviceStateChanged(const DeviceQueryData &queryData, Rv
 
 		case RVTH_LISTEN_CONNECTED:
 			// New device connected.
-			// TODO: Verify that this device isn't already present.
+			// If it's already in the list, its entry is updated.
+			d->removedDuringQuery.removeAll(queryData.device_name);
 			d->addDevice(queryData);
 			break;
 
 		case RVTH_LISTEN_DISCONNECTED:
-			// Check if this device is in our list.
-			// NOTE: Need to use indexing in order to match the QListWidget indexes.
-			// NOTE: d->sel_device isn't set until the dialog is accepted,
-			// so we don't have to clear it if the selected device is removed.
-			const int list_count = d->lstQueryData.count();
-			for (int i = 0; i < list_count; i++) {
-				const DeviceQueryData &dev = d->lstQueryData[i];
-				if (dev.device_name == queryData.device_name) {
-					// Found the device.
-					delete d->ui.lstDevices->takeItem(i);
-					d->lstQueryData.removeAt(i);
-					break;
-				}
+			// Remove the device if it's in our list.
+			// If a query is running, it might still return
+			// the device, so remember that it was removed.
+			if (d->querying) {
+				d->removedDuringQuery.append(queryData.device_name);
+			}
+			d->removeDevice(queryData.device_name);
+			if (d->lstQueryData.isEmpty()) {
+				d->setNoItemText(0);
 			}
 			break;
 	}
 }
+
+/**
+ * The background device query has finished.
+ * @param devices Devices that were found
+ * @param err Positive POSIX error code (0 on success)
+ */
+void SelectDeviceDialog::queryWorker_finished(const QList<DeviceQueryData> &devices, int err)
+{
+	Q_D(SelectDeviceDialog);
+	d->querying = false;
+
+	// Devices that were added by the listener while the
+	// query was running are already in the list.
+	for (const DeviceQueryData &dev : devices) {
+		if (!d->removedDuringQuery.contains(dev.device_name)) {
+			d->addDevice(dev);
+		}
+	}
+	d->removedDuringQuery.clear();
+
+	if (d->requery) {
+		// Devices changed while querying.
+		d->startQuery();
+	}
+	d->setNoItemText(err);
+}
@@ -142,12 +142,24 @@ class SelectDeviceDialog : public QDialog
 			const QItemSelection& selected, const QItemSelection& deselected);
 		void on_lstDevices_doubleClicked(const QModelIndex &index);
 
+		/**
+		 * The device listener has pending events.
+		 */
+		void listenerActivated(void);
+
 		/**
 		 * A device state has changed.
 		 * @param queryData Device query data
 		 * @param state Device state
 		 */
 		void deviceStateChanged(const DeviceQueryData &queryData, RvtH_Listen_State_e state);
+
+		/**
+		 * The background device query has finished.
+		 * @param devices Devices that were found
+		 * @param err Positive POSIX error code (0 on success)
+		 */
+		void queryWorker_finished(const QList<DeviceQueryData> &devices, int err);
 };
 
 #endif /* __RVTHTOOL_QRVTHTOOL_WINDOWS_SELECTDEVICEDIALOG_HPP__ */
@@ -0,0 +1,283 @@
+/***************************************************************************
+ * RVT-H Tool: FUSE filesystem                                             *
+ * rvthfs.cpp: Mount an RVT-H device or disk image as a filesystem.        *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#define FUSE_USE_VERSION 31
+#include <fuse3/fuse.h>
+
+#include "config.version.h"
+#include "git.h"
+
+#include "librvth/rvth.hpp"
+#include "librvth/rvth_error.h"
+#include "librvth/VirtualFS.hpp"
+
+// C includes (C++ namespace)
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// C includes
+#include <fcntl.h>
+#include <sys/stat.h>
+
+// C++ includes
+#include <string>
+#include <vector>
+using std::string;
+using std::vector;
+
+// Virtual filesystem. (set in main())
+static VirtualFS *vfs = nullptr;
+
+/**
+ * Get file attributes.
+ * @param path	[in] Path
+ * @param stbuf	[out] Attributes
+ * @param fi	[in,opt] File information
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int rvthfs_getattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi)
+{
+	(void)fi;
+
+	VirtualFS::Stat st;
+	const int ret = vfs->stat(path, &st);
+	if (ret != 0) {
+		return ret;
+	}
+
+	memset(stbuf, 0, sizeof(*stbuf));
+	if (st.is_dir) {
+		stbuf->st_mode = S_IFDIR | 0555;
+		stbuf->st_nlink = 2;
+	} else {
+		stbuf->st_mode = S_IFREG | 0444;
+		stbuf->st_nlink = 1;
+		stbuf->st_size = static_cast<off_t>(st.size);
+		stbuf->st_blocks = static_cast<blkcnt_t>((st.size + 511) / 512);
+	}
+	if (st.mtime != -1) {
+		stbuf->st_mtime = st.mtime;
+		stbuf->st_ctime = st.mtime;
+		stbuf->st_atime = st.mtime;
+	}
+	return 0;
+}
+
+/**
+ * List a directory.
+ * @param path		[in] Path
+ * @param buf		[in] Directory buffer
+ * @param filler	[in] Function to add an entry to buf
+ * @param offset	[in] Offset (unused; all entries are added at once)
+ * @param fi		[in] File information
+ * @param flags		[in] Flags
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int rvthfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+	off_t offset, struct fuse_file_info *fi, enum fuse_readdir_flags flags)
+{
+	(void)offset;
+	(void)fi;
+	(void)flags;
+
+	vector<string> names;
+	const int ret = vfs->readDir(path, names);
+	if (ret != 0) {
+		return ret;
+	}
+
+	filler(buf, ".", nullptr, 0, static_cast<enum fuse_fill_dir_flags>(0));
+	filler(buf, "..", nullptr, 0, static_cast<enum fuse_fill_dir_flags>(0));
+	for (const string &name : names) {
+		filler(buf, name.c_str(), nullptr, 0, static_cast<enum fuse_fill_dir_flags>(0));
+	}
+	return 0;
+}
+
+/**
+ * Open a file.
+ * @param path	[in] Path
+ * @param fi	[in,out] File information
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int rvthfs_open(const char *path, struct fuse_file_info *fi)
+{
+	if ((fi->flags & O_ACCMODE) != O_RDONLY) {
+		// The filesystem is read-only.
+		return -EROFS;
+	}
+
+	VirtualFS::Stat st;
+	const int ret = vfs->stat(path, &st);
+	if (ret != 0) {
+		return ret;
+	} else if (st.is_dir) {
+		return -EISDIR;
+	}
+
+	// File contents never change, so the page cache can be kept.
+	fi->keep_cache = 1;
+	return 0;
+}
+
+/**
+ * Read data from a file.
+ * @param path		[in] Path
+ * @param buf		[out] Output buffer
+ * @param size		[in] Number of bytes to read
+ * @param offset	[in] Offset in the file
+ * @param fi		[in] File information
+ * @return Number of bytes read, or negative POSIX error code on error.
+ */
+static int rvthfs_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
+{
+	(void)fi;
+	if (offset < 0) {
+		return -EINVAL;
+	}
+	if (size > 0x40000000U) {
+		size = 0x40000000U;
+	}
+	return static_cast<int>(vfs->read(path, buf, static_cast<uint64_t>(offset), static_cast<uint32_t>(size)));
+}
+
+/**
+ * Initialize the filesystem.
+ * @param conn	[in] Connection information
+ * @param cfg	[in,out] Configuration
+ * @return Private data (unused)
+ */
+static void *rvthfs_init(struct fuse_conn_info *conn, struct fuse_config *cfg)
+{
+	(void)conn;
+
+	// Attributes never change while the filesystem is mounted.
+	cfg->kernel_cache = 1;
+	cfg->attr_timeout = 3600;
+	cfg->entry_timeout = 3600;
+	cfg->negative_timeout = 3600;
+	return nullptr;
+}
+
+// Command line options.
+struct rvthfs_options {
+	const char *image;		// RVT-H device or disk image
+	unsigned int cache_groups;	// Decrypted groups to cache per bank
+	int show_help;
+	int show_version;
+};
+static struct rvthfs_options options;
+
+#define RVTHFS_OPT(t, p) { t, offsetof(struct rvthfs_options, p), 1 }
+static const struct fuse_opt option_spec[] = {
+	RVTHFS_OPT("--cache=%u", cache_groups),
+	RVTHFS_OPT("-h", show_help),
+	RVTHFS_OPT("--help", show_help),
+	RVTHFS_OPT("-V", show_version),
+	RVTHFS_OPT("--version", show_version),
+	FUSE_OPT_END
+};
+
+/**
+ * Process a command line option that isn't in option_spec.
+ * The first non-option argument is the RVT-H device or disk image.
+ */
+static int rvthfs_opt_proc(void *data, const char *arg, int key, struct fuse_args *outargs)
+{
+	(void)data;
+	(void)outargs;
+
+	if (key == FUSE_OPT_KEY_NONOPT && !options.image) {
+		options.image = strdup(arg);
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * Print program help.
+ * @param argv0 Program name.
+ */
+static void print_help(const char *argv0)
+{
+	printf("Syntax: %s [options] rvth.img mountpoint\n\n"
+		"Mounts an RVT-H Reader device, disk image, or standalone disc image\n"
+		"as a read-only filesystem:\n"
+		"- bank#.gcm: Disc image of each bank, exactly as stored.\n"
+		"- bank#/sys/, bank#/files/: Filesystem of each bank. For Wii banks,\n"
+		"  this is the game partition, decrypted on demand.\n"
+		"\n"
+		"rvthfs options:\n"
+		"    --cache=N              Number of decrypted 2 MiB groups to cache\n"
+		"                           per bank. (default is 16)\n"
+		"\n", argv0);
+}
+
+int main(int argc, char *argv[])
+{
+	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+	options.image = nullptr;
+	options.cache_groups = 16;
+	if (fuse_opt_parse(&args, &options, option_spec, rvthfs_opt_proc) == -1) {
+		return EXIT_FAILURE;
+	}
+
+	if (options.show_version) {
+		puts("RVT-H Tool: FUSE filesystem v" VERSION_STRING);
+#ifdef RP_GIT_VERSION
+		puts(RP_GIT_VERSION);
+#  ifdef RP_GIT_DESCRIBE
+		puts(RP_GIT_DESCRIBE);
+#  endif
+#endif
+		fuse_opt_free_args(&args);
+		return EXIT_SUCCESS;
+	} else if (options.show_help) {
+		// Let FUSE print its own options after ours.
+		print_help(argv[0]);
+		fuse_opt_add_arg(&args, "--help");
+		args.argv[0][0] = '\0';
+		const int ret = fuse_main(args.argc, args.argv, nullptr, nullptr);
+		fuse_opt_free_args(&args);
+		return ret;
+	} else if (!options.image) {
+		fprintf(stderr, "%s: RVT-H device or disk image not specified\n"
+			"Try '%s --help' for more information.\n", argv[0], argv[0]);
+		fuse_opt_free_args(&args);
+		return EXIT_FAILURE;
+	}
+
+	// Open the RVT-H device or disk image.
+	int ret;
+	RvtH *const rvth = new RvtH(options.image, &ret);
+	if (ret != 0 || !rvth->isOpen()) {
+		fprintf(stderr, "*** ERROR opening RVT-H device '%s': %s\n", options.image, rvth_error(ret));
+		delete rvth;
+		fuse_opt_free_args(&args);
+		return EXIT_FAILURE;
+	}
+	vfs = new VirtualFS(rvth, options.cache_groups);
+
+	struct fuse_operations ops;
+	memset(&ops, 0, sizeof(ops));
+	ops.init	= rvthfs_init;
+	ops.getattr	= rvthfs_getattr;
+	ops.readdir	= rvthfs_readdir;
+	ops.open	= rvthfs_open;
+	ops.read	= rvthfs_read;
+	ret = fuse_main(args.argc, args.argv, &ops, nullptr);
+
+	delete vfs;
+	delete rvth;
+	fuse_opt_free_args(&args);
+	free(const_cast<char*>(options.image));
+	return ret;
+}
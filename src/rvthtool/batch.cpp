@@ -0,0 +1,633 @@
+/***************************************************************************
+ * RVT-H Tool                                                              *
+ * batch.cpp: Run a list of jobs on multiple RVT-H Readers in parallel.    *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "batch.h"
+
+#include "librvth/rvth.hpp"
+#include "librvth/rvth_error.h"
+#include "librvth/DeviceReconnect.hpp"
+#include "librvth/nhcd_structs.h"
+
+// C includes (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// C includes
+#include <sys/stat.h>
+
+// C++ includes
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+using std::tstring;
+using std::vector;
+
+typedef std::chrono::steady_clock batch_clock;
+
+// Progress updates are delivered at most 10 times per second.
+static const RvtH_ProgressParams progress_params = {100, 0, 0};
+
+// Job types.
+enum BatchJobType {
+	BATCH_JOB_EXTRACT,
+	BATCH_JOB_IMPORT,
+	BATCH_JOB_VERIFY,
+};
+
+/**
+ * A single job from the job file.
+ */
+struct BatchJob {
+	BatchJobType type;
+	unsigned int line;	// Line number in the job file
+	tstring device;		// RVT-H device or disk image filename
+	unsigned int bank;	// Bank number (0-7)
+	tstring image;		// Disc image filename (extract, import)
+
+	// Results
+	int ret;
+	unsigned int verify_errors;
+	uint64_t bytes;
+	double seconds;
+};
+
+/**
+ * All jobs for a single physical device.
+ * Jobs are run one at a time so they don't compete for the HDD.
+ */
+struct BatchDevice {
+	tstring key;		// Physical device identity (see device_key())
+	tstring name;		// Device filename, as specified in the first job
+	vector<BatchJob*> jobs;
+};
+
+/**
+ * Shared state for all device threads.
+ */
+struct BatchState {
+	const Batch_Options *options;
+	unsigned int verify_threads;	// Verification threads per job
+	RvtH_CopyParams copy_params;	// Copy parameters per job
+
+	// Bytes read or written by all jobs so far.
+	std::atomic<uint64_t> bytes;
+	std::atomic<unsigned int> jobs_done;
+	std::atomic<unsigned int> jobs_failed;
+	std::atomic<unsigned int> devices_active;
+
+	// Serializes console output.
+	std::mutex output_mutex;
+	// Signaled when a device thread finishes.
+	std::condition_variable done_cond;
+};
+
+/**
+ * Progress tracking for a single running job.
+ */
+struct BatchProgress {
+	BatchState *state;
+	uint64_t bytes;		// Bytes processed by this job so far
+
+	// Verification: Last group in the current partition.
+	int pt_current;
+	unsigned int group_cur;
+};
+
+/**
+ * Get a key that identifies the physical device for a filename,
+ * so different names for the same device share a queue.
+ * @param filename Filename
+ * @return Key
+ */
+tstring device_key(const TCHAR *filename)
+{
+#ifdef _WIN32
+	// Device names are case-insensitive.
+	// TODO: Resolve volume paths to \\.\PhysicalDrive#?
+	tstring key(filename);
+	std::transform(key.begin(), key.end(), key.begin(), ::_totupper);
+	return key;
+#else /* !_WIN32 */
+	struct stat sbuf;
+	if (stat(filename, &sbuf) != 0) {
+		// Can't stat the file. Use the filename.
+		return tstring(filename);
+	}
+
+	char buf[64];
+	if (S_ISBLK(sbuf.st_mode)) {
+		// Block device. Symlinks in /dev/disk/by-id/ resolve
+		// to the same device number.
+		snprintf(buf, sizeof(buf), "blk:%llx",
+			static_cast<unsigned long long>(sbuf.st_rdev));
+	} else {
+		// Disk image. Images on the same filesystem share a disk,
+		// but they're still queued separately, since they're often
+		// on faster storage than an RVT-H Reader.
+		snprintf(buf, sizeof(buf), "file:%llx:%llx",
+			static_cast<unsigned long long>(sbuf.st_dev),
+			static_cast<unsigned long long>(sbuf.st_ino));
+	}
+	return tstring(buf);
+#endif /* _WIN32 */
+}
+
+/**
+ * Split a job file line into whitespace-separated tokens.
+ * Tokens may be enclosed in double quotes.
+ * @param line		[in] Line
+ * @param tokens	[out] Tokens
+ * @return 0 on success; -EINVAL if a quote isn't closed.
+ */
+static int tokenize_line(const TCHAR *line, vector<tstring> &tokens)
+{
+	tokens.clear();
+	const TCHAR *p = line;
+	for (;;) {
+		while (*p == _T(' ') || *p == _T('\t') || *p == _T('\r') || *p == _T('\n')) {
+			p++;
+		}
+		if (*p == _T('\0') || *p == _T('#')) {
+			break;
+		}
+
+		tstring token;
+		if (*p == _T('"')) {
+			p++;
+			while (*p != _T('"')) {
+				if (*p == _T('\0')) {
+					// Quote isn't closed.
+					return -EINVAL;
+				}
+				token += *p++;
+			}
+			p++;
+		} else {
+			while (*p != _T('\0') && *p != _T(' ') && *p != _T('\t') &&
+			       *p != _T('\r') && *p != _T('\n'))
+			{
+				token += *p++;
+			}
+		}
+		tokens.push_back(std::move(token));
+	}
+	return 0;
+}
+
+/**
+ * Load the job file.
+ * @param job_filename	[in] Job file. ("-" for stdin)
+ * @param jobs		[out] Jobs
+ * @return 0 on success; non-zero on error.
+ */
+static int load_jobs(const TCHAR *job_filename, vector<BatchJob> &jobs)
+{
+	FILE *f;
+	const bool use_stdin = !_tcscmp(job_filename, _T("-"));
+	if (use_stdin) {
+		f = stdin;
+	} else {
+		f = _tfopen(job_filename, _T("r"));
+		if (!f) {
+			int err = errno;
+			if (err == 0) {
+				err = EIO;
+			}
+			_ftprintf(stderr, _T("*** ERROR opening job file '%s': %s\n"),
+				job_filename, _tcserror(err));
+			return -err;
+		}
+	}
+
+	int ret = 0;
+	TCHAR buf[4096];
+	vector<tstring> tokens;
+	for (unsigned int line = 1; _fgetts(buf, ARRAY_SIZE(buf), f) != nullptr; line++) {
+		if (tokenize_line(buf, tokens) != 0) {
+			_ftprintf(stderr, _T("*** ERROR: Line %u: Unterminated quote.\n"), line);
+			ret = -EINVAL;
+			break;
+		}
+		if (tokens.empty()) {
+			// Blank line or comment.
+			continue;
+		}
+
+		BatchJob job;
+		unsigned int params;
+		if (!_tcscmp(tokens[0].c_str(), _T("extract"))) {
+			job.type = BATCH_JOB_EXTRACT;
+			params = 3;
+		} else if (!_tcscmp(tokens[0].c_str(), _T("import"))) {
+			job.type = BATCH_JOB_IMPORT;
+			params = 3;
+		} else if (!_tcscmp(tokens[0].c_str(), _T("verify"))) {
+			job.type = BATCH_JOB_VERIFY;
+			params = 2;
+		} else {
+			_ftprintf(stderr, _T("*** ERROR: Line %u: Unknown job type '%s'.\n"),
+				line, tokens[0].c_str());
+			ret = -EINVAL;
+			break;
+		}
+		if (tokens.size() != params + 1) {
+			_ftprintf(stderr, _T("*** ERROR: Line %u: '%s' requires %u parameters.\n"),
+				line, tokens[0].c_str(), params);
+			ret = -EINVAL;
+			break;
+		}
+
+		TCHAR *endptr;
+		const unsigned long bank = _tcstoul(tokens[2].c_str(), &endptr, 10);
+		if (*endptr != _T('\0') || bank < 1 || bank > 8) {
+			_ftprintf(stderr, _T("*** ERROR: Line %u: Invalid bank number '%s'.\n"),
+				line, tokens[2].c_str());
+			ret = -EINVAL;
+			break;
+		}
+
+		job.line = line;
+		job.device = tokens[1];
+		job.bank = static_cast<unsigned int>(bank - 1);
+		if (params == 3) {
+			job.image = tokens[3];
+		}
+		job.ret = 0;
+		job.verify_errors = 0;
+		job.bytes = 0;
+		job.seconds = 0;
+		jobs.push_back(std::move(job));
+	}
+
+	if (!use_stdin) {
+		fclose(f);
+	}
+	return ret;
+}
+
+/**
+ * RVT-H progress callback for batch jobs.
+ * @param state		[in] Current progress.
+ * @param userdata	[in] BatchProgress
+ * @return True to continue; false to abort.
+ */
+static bool batch_progress_callback(const RvtH_Progress_State *state, void *userdata)
+{
+	BatchProgress *const progress = static_cast<BatchProgress*>(userdata);
+	if (state->type != RVTH_PROGRESS_EXTRACT && state->type != RVTH_PROGRESS_IMPORT) {
+		// Recryption is part of the copy.
+		return true;
+	}
+
+	const uint64_t bytes = LBA_TO_BYTES(static_cast<uint64_t>(state->lba_processed));
+	if (bytes > progress->bytes) {
+		progress->state->bytes += (bytes - progress->bytes);
+		progress->bytes = bytes;
+	}
+	return true;
+}
+
+/**
+ * RVT-H verify progress callback for batch jobs.
+ * @param state		[in] Current progress.
+ * @param userdata	[in] BatchProgress
+ * @return True to continue; false to abort.
+ */
+static bool batch_verify_progress_callback(const RvtH_Verify_Progress_State *state, void *userdata)
+{
+	BatchProgress *const progress = static_cast<BatchProgress*>(userdata);
+	if (state->type != RVTH_VERIFY_STATUS) {
+		// Errors are counted by verifyWiiPartitions().
+		return true;
+	}
+
+	// group_cur restarts at 0 for each partition.
+	if (state->pt_current != progress->pt_current) {
+		progress->pt_current = state->pt_current;
+		progress->group_cur = 0;
+	}
+	if (state->group_cur > progress->group_cur) {
+		const uint64_t bytes = static_cast<uint64_t>(state->group_cur - progress->group_cur) * (2U * 1024U * 1024U);
+		progress->state->bytes += bytes;
+		progress->bytes += bytes;
+		progress->group_cur = state->group_cur;
+	}
+	return true;
+}
+
+/**
+ * Run a single job on an open RVT-H device or disk image.
+ * @param state		[in] Batch state
+ * @param job		[in,out] Job
+ * @param rvth		[in] RvtH
+ * @param progress	[in] Job progress
+ * @param resume	[in] If true, resume from the job's last checkpoint where possible.
+ * @return Error code (negative POSIX or RvtH_Errors)
+ */
+static int run_job_rvth(BatchState *state, BatchJob *job, RvtH *rvth, BatchProgress *progress, bool resume)
+{
+	const Batch_Options *const options = state->options;
+
+	int ret = rvth->setCopyParams(&state->copy_params);
+	if (ret == 0 && job->bank >= rvth->bankCount()) {
+		ret = -ERANGE;
+	}
+	if (ret != 0) {
+		return ret;
+	}
+
+	rvth->setProgressParams(&progress_params);
+	switch (job->type) {
+		case BATCH_JOB_EXTRACT: {
+			unsigned int flags = options->extract_flags;
+			if (resume && !(flags & RVTH_EXTRACT_RESUME)) {
+				// Resuming isn't supported for all extractions. If it
+				// isn't, the image is extracted from the beginning.
+				ret = rvth->extract(job->bank, job->image.c_str(),
+					options->recrypt_key, flags | RVTH_EXTRACT_RESUME,
+					batch_progress_callback, progress, options->store_dir);
+				if (ret != -ENOTSUP) {
+					break;
+				}
+			}
+			ret = rvth->extract(job->bank, job->image.c_str(),
+				options->recrypt_key, flags,
+				batch_progress_callback, progress, options->store_dir);
+			break;
+		}
+		case BATCH_JOB_IMPORT: {
+			unsigned int flags = options->import_flags;
+			if (resume && !(flags & RVTH_IMPORT_DIGESTS)) {
+				flags |= RVTH_IMPORT_RESUME;
+			}
+			ret = rvth->import(job->bank, job->image.c_str(),
+				batch_progress_callback, progress,
+				options->ios_force, flags);
+			break;
+		}
+		case BATCH_JOB_VERIFY: {
+			unsigned int flags = options->verify_flags;
+			if (resume) {
+				flags |= RVTH_VERIFY_CHECKPOINT;
+			}
+			unsigned int error_count[5] = {0, 0, 0, 0, 0};
+			ret = rvth->verifyWiiPartitions(job->bank, error_count,
+				batch_verify_progress_callback, progress,
+				state->verify_threads, flags);
+			job->verify_errors = 0;
+			for (unsigned int i = 0; i < ARRAY_SIZE(error_count); i++) {
+				job->verify_errors += error_count[i];
+			}
+			break;
+		}
+	}
+	return ret;
+}
+
+/**
+ * Run a single job.
+ * @param state		[in] Batch state
+ * @param job		[in,out] Job
+ * @param reconnect	[in,opt] Reconnect handler for the job's device
+ */
+static void run_job(BatchState *state, BatchJob *job, DeviceReconnect *reconnect)
+{
+	BatchProgress progress;
+	progress.state = state;
+	progress.bytes = 0;
+	progress.pt_current = -1;
+	progress.group_cur = 0;
+
+	const auto start = batch_clock::now();
+	int ret;
+	if (reconnect && reconnect->isEnabled()) {
+		// If the device is disconnected, the job is resumed
+		// from its last checkpoint once it's reconnected.
+		ret = reconnect->run([state, job, reconnect, &progress](RvtH *rvth, unsigned int attempt) -> int {
+			if (attempt > 0) {
+				std::lock_guard<std::mutex> lock(state->output_mutex);
+				printf("\r%-79s\r", "");
+				_tprintf(_T("Line %u: Device reconnected as %s; resuming.\n"),
+					job->line, reconnect->deviceName().c_str());
+			}
+			return run_job_rvth(state, job, rvth, &progress, true);
+		}, state->options->reconnect_timeout * 1000U);
+	} else {
+		RvtH *const rvth = new RvtH(job->device.c_str(), &ret);
+		if (ret == 0 && !rvth->isOpen()) {
+			ret = -EIO;
+		}
+		if (ret == 0) {
+			ret = run_job_rvth(state, job, rvth, &progress, false);
+		}
+		delete rvth;
+	}
+
+	const std::chrono::duration<double> elapsed = batch_clock::now() - start;
+	job->ret = ret;
+	job->bytes = progress.bytes;
+	job->seconds = elapsed.count();
+}
+
+/**
+ * Print the result of a job.
+ * The caller must hold output_mutex.
+ * @param job	[in] Job
+ */
+static void print_job_result(const BatchJob *job)
+{
+	static const TCHAR *const job_names[] = {
+		_T("extract"), _T("import"), _T("verify"),
+	};
+
+	// Clear the status line.
+	printf("\r%-79s\r", "");
+
+	_tprintf(_T("Line %u: %s %s bank %u"), job->line,
+		job_names[job->type], job->device.c_str(), job->bank + 1);
+	if (!job->image.empty()) {
+		_tprintf(_T(" %s %s"), (job->type == BATCH_JOB_IMPORT ? _T("<-") : _T("->")),
+			job->image.c_str());
+	}
+
+	if (job->ret != 0) {
+		printf(": FAILED (%s)\n", rvth_error(job->ret));
+	} else if (job->verify_errors != 0) {
+		printf(": %u error%s\n", job->verify_errors, (job->verify_errors != 1 ? "s" : ""));
+	} else {
+		const double mib = job->bytes / (1024.0 * 1024.0);
+		printf(": OK (%.0f MiB, %.1f MiB/s)\n", mib,
+			(job->seconds > 0 ? mib / job->seconds : 0.0));
+	}
+	fflush(stdout);
+}
+
+/**
+ * Run all jobs for a device, one at a time.
+ * @param state		[in] Batch state
+ * @param device	[in] Device
+ */
+static void device_thread(BatchState *state, BatchDevice *device)
+{
+	// NOTE: The reconnect handler tracks the device's current name,
+	// so the remaining jobs use the new name after a reconnect.
+	std::unique_ptr<DeviceReconnect> reconnect;
+	if (state->options->reconnect_timeout != 0) {
+		reconnect.reset(new DeviceReconnect(device->name.c_str()));
+	}
+
+	for (BatchJob *job : device->jobs) {
+		run_job(state, job, reconnect.get());
+
+		std::lock_guard<std::mutex> lock(state->output_mutex);
+		if (job->ret != 0 || job->verify_errors != 0) {
+			state->jobs_failed++;
+		}
+		state->jobs_done++;
+		print_job_result(job);
+	}
+
+	std::lock_guard<std::mutex> lock(state->output_mutex);
+	state->devices_active--;
+	state->done_cond.notify_all();
+}
+
+/**
+ * 'batch' command.
+ * @param job_filename	[in] Job file. ("-" for stdin)
+ * @param options	[in] Options.
+ * @return 0 if all jobs succeeded; non-zero on error.
+ */
+int batch(const TCHAR *job_filename, const Batch_Options *options)
+{
+	vector<BatchJob> jobs;
+	int ret = load_jobs(job_filename, jobs);
+	if (ret != 0) {
+		return ret;
+	} else if (jobs.empty()) {
+		fputs("*** ERROR: The job file doesn't contain any jobs.\n", stderr);
+		return -EINVAL;
+	}
+
+	// Group the jobs by physical device, keeping the job order.
+	vector<BatchDevice> devices;
+	for (BatchJob &job : jobs) {
+		const tstring key = device_key(job.device.c_str());
+		auto iter = std::find_if(devices.begin(), devices.end(),
+			[&key](const BatchDevice &device) { return device.key == key; });
+		if (iter == devices.end()) {
+			devices.emplace_back();
+			iter = devices.end() - 1;
+			iter->key = key;
+			iter->name = job.device;
+		}
+		iter->jobs.push_back(&job);
+	}
+
+	BatchState state;
+	state.options = options;
+	state.bytes = 0;
+	state.jobs_done = 0;
+	state.jobs_failed = 0;
+	state.devices_active = static_cast<unsigned int>(devices.size());
+
+	// Verification threads are divided between the devices,
+	// since all of them may be verifying at the same time.
+	unsigned int threads = options->threads;
+	if (threads == 0) {
+		threads = std::thread::hardware_concurrency();
+		if (threads == 0) {
+			threads = 1;
+		}
+	}
+	state.verify_threads = std::max(1U, threads / static_cast<unsigned int>(devices.size()));
+
+	// The memory budget is divided the same way.
+	state.copy_params = options->copy_params;
+	if (state.copy_params.mem_budget != 0) {
+		state.copy_params.mem_budget = std::max(RVTH_MEM_BUDGET_MIN,
+			state.copy_params.mem_budget / static_cast<unsigned int>(devices.size()));
+	}
+
+	printf("Running %u job%s on %u device%s.\n\n",
+		static_cast<unsigned int>(jobs.size()), (jobs.size() != 1 ? "s" : ""),
+		static_cast<unsigned int>(devices.size()), (devices.size() != 1 ? "s" : ""));
+	fflush(stdout);
+
+	const auto start = batch_clock::now();
+	vector<std::thread> device_threads;
+	device_threads.reserve(devices.size());
+	for (BatchDevice &device : devices) {
+		device_threads.emplace_back(device_thread, &state, &device);
+	}
+
+	// Print the aggregate throughput once per second
+	// until all devices are finished.
+	uint64_t prev_bytes = 0;
+	auto prev_time = start;
+	{
+		std::unique_lock<std::mutex> lock(state.output_mutex);
+		while (state.devices_active > 0) {
+			state.done_cond.wait_for(lock, std::chrono::seconds(1));
+			if (state.devices_active == 0) {
+				break;
+			}
+
+			const auto now = batch_clock::now();
+			const uint64_t bytes = state.bytes;
+			const std::chrono::duration<double> interval = now - prev_time;
+			if (interval.count() < 0.5) {
+				continue;
+			}
+			printf("\r%u/%u jobs done, %u device%s active: %.1f MiB/s     ",
+				state.jobs_done.load(), static_cast<unsigned int>(jobs.size()),
+				state.devices_active.load(), (state.devices_active != 1 ? "s" : ""),
+				(bytes - prev_bytes) / (1024.0 * 1024.0) / interval.count());
+			fflush(stdout);
+			prev_bytes = bytes;
+			prev_time = now;
+		}
+	}
+	for (std::thread &thread : device_threads) {
+		thread.join();
+	}
+
+	const std::chrono::duration<double> elapsed = batch_clock::now() - start;
+	const double total_mib = state.bytes / (1024.0 * 1024.0);
+	printf("\r%-79s\r", "");
+	printf("\n%u/%u jobs succeeded. %.0f MiB in %.1f s (%.1f MiB/s aggregate)\n",
+		static_cast<unsigned int>(jobs.size()) - state.jobs_failed.load(),
+		static_cast<unsigned int>(jobs.size()),
+		total_mib, elapsed.count(),
+		(elapsed.count() > 0 ? total_mib / elapsed.count() : 0.0));
+
+	// Per-device throughput, to spot a slow unit.
+	if (devices.size() > 1) {
+		for (const BatchDevice &device : devices) {
+			uint64_t bytes = 0;
+			double seconds = 0;
+			for (const BatchJob *job : device.jobs) {
+				bytes += job->bytes;
+				seconds += job->seconds;
+			}
+			const double mib = bytes / (1024.0 * 1024.0);
+			_tprintf(_T("- %s: %.0f MiB, %.1f MiB/s\n"), device.name.c_str(),
+				mib, (seconds > 0 ? mib / seconds : 0.0));
+		}
+	}
+
+	return (state.jobs_failed != 0 ? EXIT_FAILURE : 0);
+}
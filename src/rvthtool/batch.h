@@ -0,0 +1,71 @@
+/***************************************************************************
+ * RVT-H Tool                                                              *
+ * batch.h: Run a list of jobs on multiple RVT-H Readers in parallel.      *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_RVTHTOOL_BATCH_H__
+#define __RVTHTOOL_RVTHTOOL_BATCH_H__
+
+#include "tcharx.h"
+#include "librvth/rvth.hpp"
+
+#ifdef __cplusplus
+// C++ includes
+#include <string>
+
+/**
+ * Get a key that identifies the physical device for a filename,
+ * so different names for the same device share a queue.
+ * @param filename Filename
+ * @return Key
+ */
+std::tstring device_key(const TCHAR *filename);
+#endif /* __cplusplus */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Options for batch jobs.
+ * These are the same options used by the individual commands.
+ */
+typedef struct _Batch_Options {
+	int recrypt_key;		// Key for recryption when extracting. (-1 for default)
+	unsigned int extract_flags;	// Extract flags. (See RvtH_Extract_Flags.)
+	const TCHAR *store_dir;		// Partition store directory. (Required for RVTH_EXTRACT_STORE_UPDATES.)
+	int ios_force;			// IOS version to force when importing. (-1 to use the existing IOS)
+	unsigned int import_flags;	// Import flags. (See RvtH_Import_Flags.)
+	unsigned int verify_flags;	// Verification flags. (See RvtH_Verify_Flags.)
+	unsigned int threads;		// Total number of verification worker threads. (0 for auto)
+	RvtH_CopyParams copy_params;	// Copy buffer and I/O parameters.
+	unsigned int reconnect_timeout;	// Seconds to wait for a disconnected RVT-H Reader to reconnect. (0 to fail the job)
+} Batch_Options;
+
+/**
+ * 'batch' command.
+ *
+ * Each line of the job file is one of the following:
+ * - extract DEVICE BANK IMAGE
+ * - import DEVICE BANK IMAGE
+ * - verify DEVICE BANK
+ * Blank lines and lines starting with '#' are ignored.
+ * Filenames containing spaces must be enclosed in double quotes.
+ *
+ * Jobs for the same device are run one at a time, in order.
+ * Jobs for different devices are run in parallel.
+ *
+ * @param job_filename	[in] Job file. ("-" for stdin)
+ * @param options	[in] Options.
+ * @return 0 if all jobs succeeded; non-zero on error.
+ */
+int batch(const TCHAR *job_filename, const Batch_Options *options);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_RVTHTOOL_BATCH_H__ */
@@ -0,0 +1,192 @@
+/***************************************************************************
+ * RVT-H Tool                                                              *
+ * bench.cpp: Benchmark an RVT-H Reader and the copy pipeline stages.      *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "bench.h"
+#include "list-banks.hpp"
+
+#include "librvth/rvth.hpp"
+#include "librvth/rvth_error.h"
+
+// C includes (C++ namespace)
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+
+// C++ includes
+#include <algorithm>
+#include <thread>
+
+/**
+ * Print a throughput value.
+ * @param name	[in] Stage name
+ * @param rate	[in] Throughput, in bytes per second
+ * @param note	[in,opt] Note, e.g. the implementation name
+ */
+static void print_rate(const char *name, double rate, const char *note = nullptr)
+{
+	printf("  %-24s %9.1f MiB/s", name, rate / (1024.0 * 1024.0));
+	if (note) {
+		printf("  (%s)", note);
+	}
+	putchar('\n');
+}
+
+/**
+ * Pipeline stage for the bottleneck summary.
+ */
+struct BenchStage {
+	const char *name;
+	double rate;
+};
+
+/**
+ * Print the bottleneck of a pipeline.
+ * Stages that weren't measured (rate == 0) are ignored.
+ * @param name		[in] Pipeline name
+ * @param stages	[in] Stages
+ * @param count		[in] Number of stages
+ */
+static void print_bottleneck(const char *name, const BenchStage *stages, unsigned int count)
+{
+	const BenchStage *slowest = nullptr;
+	for (unsigned int i = 0; i < count; i++) {
+		if (stages[i].rate <= 0) {
+			continue;
+		}
+		if (!slowest || stages[i].rate < slowest->rate) {
+			slowest = &stages[i];
+		}
+	}
+	if (!slowest) {
+		return;
+	}
+
+	printf("  %-24s %9.1f MiB/s  (limited by %s)\n", name,
+		slowest->rate / (1024.0 * 1024.0), slowest->name);
+}
+
+/**
+ * 'bench' command.
+ * @param rvth_filename		[in] RVT-H device or disk image filename.
+ * @param s_bank		[in] Bank number (as a string). (If NULL, assumes bank 1.)
+ * @param write_filename	[in,opt] Temporary file for measuring write throughput. (must not exist)
+ * @param threads		[in] Number of verification worker threads. (0 for auto)
+ * @param copy_params		[in] Copy buffer and I/O parameters.
+ * @return 0 on success; non-zero on error.
+ */
+int bench(const TCHAR *rvth_filename, const TCHAR *s_bank, const TCHAR *write_filename,
+	unsigned int threads, const RvtH_CopyParams *copy_params)
+{
+	// Open the RVT-H device or disk image.
+	int ret;
+	RvtH *const rvth = new RvtH(rvth_filename, &ret);
+	if (ret != 0 || !rvth->isOpen()) {
+		_ftprintf(stderr, _T("*** ERROR opening RVT-H device '%s': "), rvth_filename);
+		fputs(rvth_error(ret), stderr);
+		_fputtc(_T('\n'), stderr);
+		delete rvth;
+		return ret;
+	}
+
+	// Set the copy buffer parameters.
+	ret = rvth->setCopyParams(copy_params);
+	if (ret != 0) {
+		fputs("*** ERROR: Invalid copy buffer parameters.\n", stderr);
+		delete rvth;
+		return ret;
+	}
+
+	unsigned int bank;
+	if (s_bank) {
+		// Validate the bank number.
+		TCHAR *endptr;
+		bank = (unsigned int)_tcstoul(s_bank, &endptr, 10) - 1;
+		if (*endptr != 0 || bank > rvth->bankCount()) {
+			_ftprintf(stderr, _T("*** ERROR: Invalid bank number '%s'.\n"), s_bank);
+			delete rvth;
+			return -EINVAL;
+		}
+	} else {
+		// No bank number specified.
+		// Assume 1 bank if this is a standalone disc image.
+		// For HDD images or RVT-H Readers, this is an error.
+		if (rvth->bankCount() != 1) {
+			_ftprintf(stderr, _T("*** ERROR: Must specify a bank number for this RVT-H Reader%s.\n"),
+				rvth->isHDD() ? _T("") : _T(" disk image"));
+			delete rvth;
+			return -EINVAL;
+		}
+		bank = 0;
+	}
+
+	// Print the bank information.
+	print_bank(rvth, bank);
+	putchar('\n');
+
+	fputs("Benchmarking... (this may take a minute)\n", stdout);
+	fflush(stdout);
+	RvtH_Bench_Results results;
+	ret = rvth->benchmark(bank, write_filename, &results);
+	delete rvth;
+	if (ret != 0) {
+		if (ret == -EEXIST && write_filename) {
+			_ftprintf(stderr, _T("*** ERROR: Write test file '%s' already exists.\n"), write_filename);
+		} else {
+			fputs("*** ERROR: Benchmark failed: ", stderr);
+			fputs(rvth_error(ret), stderr);
+			fputc('\n', stderr);
+		}
+		return ret;
+	}
+
+	// Verification uses one worker thread per CPU by default.
+	if (threads == 0) {
+		threads = std::thread::hardware_concurrency();
+		if (threads == 0) {
+			threads = 1;
+		}
+	}
+
+	char s_note[64];
+	printf("\nCopy buffer size: %u KiB\n\n", results.buf_size / 1024U);
+	fputs("Stage throughput:\n", stdout);
+	print_rate("Sequential read", results.seq_read);
+	snprintf(s_note, sizeof(s_note), "%.0f IOPS", results.rand_iops);
+	print_rate("Random read (32 KiB)", results.rand_read, s_note);
+	print_rate("AES-128-CBC decrypt", results.aes_decrypt, results.aes_impl);
+	print_rate("SHA-1", results.sha1, results.sha1_impl);
+	print_rate("Verify (1 thread)", results.verify);
+	if (write_filename) {
+		print_rate("Write", results.write);
+	}
+
+	// Extracting reads and writes the bank in parallel, so the
+	// slowest stage determines the overall throughput.
+	// Verification scales with the number of worker threads.
+	const double verify_mt = results.verify * threads;
+	snprintf(s_note, sizeof(s_note), "verify (%u thread%s)", threads, (threads != 1 ? "s" : ""));
+	const BenchStage extract_stages[] = {
+		{"device reads", results.seq_read},
+		{"destination writes", results.write},
+	};
+	const BenchStage verify_stages[] = {
+		{"device reads", results.seq_read},
+		{s_note, verify_mt},
+	};
+
+	fputs("\nEstimated pipeline throughput:\n", stdout);
+	if (write_filename) {
+		print_bottleneck("Extract", extract_stages, ARRAY_SIZE(extract_stages));
+	}
+	print_bottleneck("Verify", verify_stages, ARRAY_SIZE(verify_stages));
+	if (!write_filename) {
+		fputs("\n(Specify a test file to measure the destination write throughput.)\n", stdout);
+	}
+
+	return 0;
+}
@@ -0,0 +1,35 @@
+/***************************************************************************
+ * RVT-H Tool                                                              *
+ * bench.h: Benchmark an RVT-H Reader and the copy pipeline stages.        *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_RVTHTOOL_BENCH_H__
+#define __RVTHTOOL_RVTHTOOL_BENCH_H__
+
+#include "tcharx.h"
+#include "librvth/rvth.hpp"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 'bench' command.
+ * @param rvth_filename		RVT-H device or disk image filename.
+ * @param s_bank		Bank number (as a string). (If NULL, assumes bank 1.)
+ * @param write_filename	Temporary file for measuring write throughput. (optional; must not exist)
+ * @param threads		Number of verification worker threads. (0 for auto)
+ * @param copy_params		Copy buffer and I/O parameters.
+ * @return 0 on success; non-zero on error.
+ */
+int bench(const TCHAR *rvth_filename, const TCHAR *s_bank, const TCHAR *write_filename,
+	unsigned int threads, const RvtH_CopyParams *copy_params);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_RVTHTOOL_BENCH_H__ */
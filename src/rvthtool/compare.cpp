@@ -0,0 +1,170 @@
+/***************************************************************************
+ * RVT-H Tool                                                              *
+ * compare.cpp: Compare two banks or disc images.                          *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "compare.h"
+#include "librvth/rvth.hpp"
+#include "librvth/rvth_error.h"
+#include "librvth/nhcd_structs.h"
+#include "stats.hpp"
+
+// C includes (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+
+// C++ includes
+#include <vector>
+using std::vector;
+
+/**
+ * Progress callback for comparing.
+ * @param state		[in] Current progress.
+ * @param userdata	[in] User data specified when calling the RVT-H function.
+ * @return True to continue; false to abort.
+ */
+static bool compare_progress_callback(const RvtH_Progress_State *state, void *userdata)
+{
+	UNUSED(userdata);
+	assert(state->type == RVTH_PROGRESS_COMPARE);
+
+	#define MEGABYTE (1048576 / LBA_SIZE)
+	printf("\rComparing: %4u MiB / %4u MiB compared...",
+		state->lba_processed / MEGABYTE,
+		state->lba_total / MEGABYTE);
+	print_progress_rate(stdout, state);
+
+	if (state->lba_processed == state->lba_total) {
+		// Finished processing.
+		putchar('\n');
+	}
+	fflush(stdout);
+	return true;
+}
+
+/**
+ * Open an RVT-H device or disk image and select a bank.
+ * @param filename	[in] RVT-H device or disk image filename.
+ * @param s_bank	[in,opt] Bank number (as a string). (If NULL, assumes bank 1.)
+ * @param pBank		[out] Bank number. (0-7)
+ * @return RvtH object, or nullptr on error. (An error message is printed.)
+ */
+static RvtH *open_bank(const TCHAR *filename, const TCHAR *s_bank, unsigned int *pBank)
+{
+	int ret;
+	RvtH *const rvth = new RvtH(filename, &ret);
+	if (ret != 0 || !rvth->isOpen()) {
+		_ftprintf(stderr, _T("*** ERROR opening RVT-H device '%s': "), filename);
+		fputs(rvth_error(ret), stderr);
+		_fputtc(_T('\n'), stderr);
+		delete rvth;
+		return nullptr;
+	}
+
+	if (s_bank) {
+		// Validate the bank number.
+		TCHAR *endptr;
+		const unsigned int bank = (unsigned int)_tcstoul(s_bank, &endptr, 10) - 1;
+		if (*endptr != 0 || bank >= rvth->bankCount()) {
+			_ftprintf(stderr, _T("*** ERROR: Invalid bank number '%s'.\n"), s_bank);
+			delete rvth;
+			return nullptr;
+		}
+		*pBank = bank;
+	} else {
+		// No bank number specified.
+		// Assume 1 bank if this is a standalone disc image.
+		if (rvth->bankCount() != 1) {
+			_ftprintf(stderr, _T("*** ERROR: Must specify a bank number for '%s'.\n"), filename);
+			delete rvth;
+			return nullptr;
+		}
+		*pBank = 0;
+	}
+	return rvth;
+}
+
+/**
+ * 'compare' command.
+ * @param rvth_filename		[in] RVT-H device or disk image filename.
+ * @param s_bank		[in,opt] Bank number (as a string). (If NULL, assumes bank 1.)
+ * @param other_filename	[in] Other RVT-H device or disk image filename.
+ * @param s_bank_other		[in,opt] Bank number in the other image (as a string). (If NULL, assumes bank 1.)
+ * @param copy_params		[in] Copy buffer and I/O parameters.
+ * @return 0 if the banks are identical; 1 if they differ; negative on error.
+ */
+int compare(const TCHAR *rvth_filename, const TCHAR *s_bank,
+	const TCHAR *other_filename, const TCHAR *s_bank_other,
+	const RvtH_CopyParams *copy_params)
+{
+	unsigned int bank, bank_other;
+	RvtH *const rvth = open_bank(rvth_filename, s_bank, &bank);
+	if (!rvth) {
+		return -EINVAL;
+	}
+	RvtH *const rvth_other = open_bank(other_filename, s_bank_other, &bank_other);
+	if (!rvth_other) {
+		delete rvth;
+		return -EINVAL;
+	}
+
+	int ret = rvth->setCopyParams(copy_params);
+	if (ret == 0) {
+		ret = rvth_other->setCopyParams(copy_params);
+	}
+	if (ret != 0) {
+		fputs("*** ERROR: Invalid copy buffer parameters.\n", stderr);
+		delete rvth_other;
+		delete rvth;
+		return ret;
+	}
+
+	vector<RvtH_Compare_Diff> diffs;
+	ret = rvth->compareBank(bank, rvth_other, bank_other, diffs, compare_progress_callback, nullptr);
+	if (ret != 0) {
+		putchar('\n');
+		fputs("*** ERROR: Compare failed: ", stderr);
+		fputs(rvth_error(ret), stderr);
+		fputc('\n', stderr);
+		delete rvth_other;
+		delete rvth;
+		return ret;
+	}
+
+	if (diffs.empty()) {
+		printf("The banks are identical.\n");
+	} else {
+		const bool a_longer = (rvth->bankEntry(bank)->lba_len > rvth_other->bankEntry(bank_other)->lba_len);
+		uint64_t lba_total = 0;
+		for (const RvtH_Compare_Diff &diff : diffs) {
+			printf("LBA 0x%08X-0x%08X: ", diff.lba_start, diff.lba_start + diff.lba_len - 1);
+			switch (diff.type) {
+				default:
+				case RVTH_COMPARE_RAW:
+					printf("data differs\n");
+					break;
+				case RVTH_COMPARE_DECRYPTED:
+					printf("partition %d data differs (decrypted)\n", diff.pt_index);
+					break;
+				case RVTH_COMPARE_LENGTH:
+					_tprintf(_T("only in '%s'\n"), (a_longer ? rvth_filename : other_filename));
+					break;
+			}
+			lba_total += diff.lba_len;
+		}
+		printf("%u region%s differ%s. (%u MiB)\n",
+			static_cast<unsigned int>(diffs.size()),
+			(diffs.size() != 1 ? "s" : ""),
+			(diffs.size() != 1 ? "" : "s"),
+			static_cast<unsigned int>((lba_total + MEGABYTE - 1) / MEGABYTE));
+		ret = 1;
+	}
+
+	delete rvth_other;
+	delete rvth;
+	return ret;
+}
@@ -0,0 +1,36 @@
+/***************************************************************************
+ * RVT-H Tool                                                              *
+ * compare.h: Compare two banks or disc images.                            *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_RVTHTOOL_COMPARE_H__
+#define __RVTHTOOL_RVTHTOOL_COMPARE_H__
+
+#include "tcharx.h"
+#include "librvth/rvth.hpp"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 'compare' command.
+ * @param rvth_filename		RVT-H device or disk image filename.
+ * @param s_bank		Bank number (as a string). (If NULL, assumes bank 1.)
+ * @param other_filename	Other RVT-H device or disk image filename.
+ * @param s_bank_other		Bank number in the other image (as a string). (If NULL, assumes bank 1.)
+ * @param copy_params		Copy buffer and I/O parameters.
+ * @return 0 if the banks are identical; 1 if they differ; negative on error.
+ */
+int compare(const TCHAR *rvth_filename, const TCHAR *s_bank,
+	const TCHAR *other_filename, const TCHAR *s_bank_other,
+	const RvtH_CopyParams *copy_params);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_RVTHTOOL_COMPARE_H__ */
@@ -0,0 +1,1079 @@
+/***************************************************************************
+ * RVT-H Tool                                                              *
+ * daemon.cpp: Serve requests for RVT-H Readers over a local socket.       *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "daemon.h"
+#include "daemon_metrics.hpp"
+#include "json_report.hpp"
+#include "list-banks.hpp"
+
+#include "librvth/rvth.hpp"
+#include "librvth/rvth_error.h"
+#include "librvth/AsyncJob.hpp"
+#include "librvth/nhcd_structs.h"
+
+// C includes (C++ namespace)
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#ifndef _WIN32
+// C includes
+#  include <poll.h>
+#  include <signal.h>
+#  include <sys/socket.h>
+#  include <sys/stat.h>
+#  include <sys/un.h>
+#  include <unistd.h>
+
+// C++ includes
+#  include <atomic>
+#  include <condition_variable>
+#  include <map>
+#  include <memory>
+#  include <mutex>
+#  include <set>
+#  include <string>
+#  include <thread>
+#  include <utility>
+#  include <vector>
+using std::map;
+using std::shared_ptr;
+using std::string;
+using std::tstring;
+using std::unique_ptr;
+using std::vector;
+#endif /* !_WIN32 */
+
+#ifndef _WIN32
+
+// Maximum length of a request line.
+#define DAEMON_MAX_LINE (64U * 1024U)
+
+// Interval between metrics file updates, in seconds.
+#define DAEMON_METRICS_INTERVAL 10
+
+/**
+ * An RVT-H device or disk image that's kept open between requests.
+ */
+struct DaemonDevice {
+	string name;		// Device filename, as specified in the first request
+	unique_ptr<RvtH> rvth;	// Open device (nullptr if not open yet)
+
+	// Requests for this device are run one at a time, in the order
+	// they were received. Each request takes a ticket when it's
+	// received, and waits until that ticket is being served.
+	std::mutex mutex;
+	std::condition_variable cond;
+	uint64_t next_ticket;
+	uint64_t serving;
+
+	// Metrics. (rvth is only replaced while metrics_mutex
+	// is held, so it can be read while a request is running.)
+	std::mutex metrics_mutex;
+	DeviceMetrics metrics;
+
+	DaemonDevice() : next_ticket(0), serving(0) { }
+};
+
+/**
+ * Client connection.
+ * The socket is closed once the connection and all of its
+ * outstanding requests are finished.
+ */
+struct DaemonClient {
+	int fd;
+	std::mutex write_mutex;	// Serializes responses
+
+	explicit DaemonClient(int fd) : fd(fd) { }
+	~DaemonClient() { close(fd); }
+
+	/**
+	 * Send a response line.
+	 * Errors are ignored, since the client may have disconnected.
+	 * @param line Response line, including the newline
+	 */
+	void send_line(const string &line)
+	{
+		std::lock_guard<std::mutex> lock(write_mutex);
+		const char *p = line.data();
+		size_t size = line.size();
+		while (size > 0) {
+			const ssize_t n = send(fd, p, size, 0);
+			if (n < 0 && errno == EINTR) {
+				continue;
+			} else if (n <= 0) {
+				break;
+			}
+			p += n;
+			size -= n;
+		}
+	}
+};
+
+/**
+ * Request that can be cancelled. (See DaemonState::jobs.)
+ */
+struct DaemonJob {
+	AsyncJob *job;		// Running operation (nullptr if not running)
+	bool cancelled;		// Set by a cancel request
+
+	DaemonJob() : job(nullptr), cancelled(false) { }
+};
+
+// Client and request ID. (See DaemonState::jobs.)
+typedef std::pair<const DaemonClient*, string> DaemonJobKey;
+
+/**
+ * Shared state for all client and request threads.
+ */
+struct DaemonState {
+	const Batch_Options *options;
+	unsigned int verify_threads;	// Verification threads per request
+
+	// Open devices, indexed by device_key().
+	// Entries are never removed, so pointers remain valid.
+	std::mutex devices_mutex;
+	map<tstring, unique_ptr<DaemonDevice> > devices;
+
+	// Set when a shutdown is requested.
+	std::atomic<bool> quit;
+
+	// Client sockets and running threads.
+	// Client sockets are shut down when the daemon exits,
+	// and the daemon waits for all threads to finish.
+	std::mutex threads_mutex;
+	std::condition_variable threads_cond;
+	std::set<int> client_fds;
+	unsigned int threads_active;
+
+	// Outstanding requests, so they can be cancelled by the client
+	// that sent them. Requests are added when they're queued, and
+	// removed once they've been answered.
+	std::mutex jobs_mutex;
+	map<DaemonJobKey, DaemonJob> jobs;
+
+	// Serializes the request log.
+	std::mutex log_mutex;
+};
+
+/**
+ * Parsed JSON request.
+ */
+struct DaemonRequest {
+	string id;		// Request ID, as raw JSON ("null" if not specified)
+	string cmd;		// Command
+	string device;		// RVT-H device or disk image filename
+	string image;		// Disc image filename (extract, import)
+	int bank;		// Bank number (1-8; 0 if not specified)
+	bool quick;		// Quick verification (verify)
+	string target;		// Request ID to cancel, as raw JSON (cancel)
+};
+
+static volatile sig_atomic_t s_interrupted = 0;
+
+/**
+ * Signal handler for SIGINT and SIGTERM.
+ * @param sig Signal number
+ */
+static void daemon_signal_handler(int sig)
+{
+	((void)sig);
+	s_interrupted = 1;
+}
+
+/** JSON request parser **/
+
+/**
+ * Skip whitespace.
+ * @param p String
+ * @return First non-whitespace character
+ */
+static inline const char *skip_ws(const char *p)
+{
+	while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
+		p++;
+	}
+	return p;
+}
+
+/**
+ * Parse four hexadecimal digits.
+ * @param p	[in] String
+ * @param pCp	[out] Value
+ * @return True on success; false if the digits are invalid.
+ */
+static bool parse_hex4(const char *p, unsigned int *pCp)
+{
+	unsigned int cp = 0;
+	for (unsigned int i = 0; i < 4; i++) {
+		const char chr = p[i];
+		cp <<= 4;
+		if (chr >= '0' && chr <= '9') {
+			cp |= (chr - '0');
+		} else if (chr >= 'A' && chr <= 'F') {
+			cp |= (chr - 'A' + 10);
+		} else if (chr >= 'a' && chr <= 'f') {
+			cp |= (chr - 'a' + 10);
+		} else {
+			// NOTE: This also stops at the NULL terminator.
+			return false;
+		}
+	}
+	*pCp = cp;
+	return true;
+}
+
+/**
+ * Parse a JSON string.
+ * @param p	[in] Opening quote
+ * @param out	[out] Decoded UTF-8 string
+ * @return Character after the closing quote, or nullptr on error.
+ */
+static const char *parse_string(const char *p, string &out)
+{
+	out.clear();
+	p++;
+	while (*p != '"') {
+		if (*p == '\0' || static_cast<uint8_t>(*p) < 0x20) {
+			return nullptr;
+		} else if (*p != '\\') {
+			out += *p++;
+			continue;
+		}
+
+		p++;
+		switch (*p++) {
+			case '"':	out += '"'; break;
+			case '\\':	out += '\\'; break;
+			case '/':	out += '/'; break;
+			case 'b':	out += '\b'; break;
+			case 'f':	out += '\f'; break;
+			case 'n':	out += '\n'; break;
+			case 'r':	out += '\r'; break;
+			case 't':	out += '\t'; break;
+			case 'u': {
+				unsigned int cp;
+				if (!parse_hex4(p, &cp)) {
+					return nullptr;
+				}
+				p += 4;
+
+				unsigned int lo;
+				if (cp >= 0xD800 && cp <= 0xDBFF && p[0] == '\\' && p[1] == 'u' &&
+				    parse_hex4(p + 2, &lo))
+				{
+					// Surrogate pair.
+					if (lo >= 0xDC00 && lo <= 0xDFFF) {
+						cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+						p += 6;
+					}
+				}
+
+				// Encode as UTF-8.
+				if (cp < 0x80) {
+					out += static_cast<char>(cp);
+				} else if (cp < 0x800) {
+					out += static_cast<char>(0xC0 | (cp >> 6));
+					out += static_cast<char>(0x80 | (cp & 0x3F));
+				} else if (cp < 0x10000) {
+					out += static_cast<char>(0xE0 | (cp >> 12));
+					out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+					out += static_cast<char>(0x80 | (cp & 0x3F));
+				} else {
+					out += static_cast<char>(0xF0 | (cp >> 18));
+					out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+					out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+					out += static_cast<char>(0x80 | (cp & 0x3F));
+				}
+				break;
+			}
+			default:
+				return nullptr;
+		}
+	}
+	return p + 1;
+}
+
+/**
+ * Parse a JSON request.
+ * Only flat objects are supported. Values may be strings,
+ * numbers, true, false, or null. Unknown keys are ignored.
+ * @param line	[in] Request line
+ * @param req	[out] Request
+ * @return 0 on success; -EINVAL on error.
+ */
+static int parse_request(const char *line, DaemonRequest &req)
+{
+	req.id = "null";
+	req.cmd.clear();
+	req.device.clear();
+	req.image.clear();
+	req.bank = 0;
+	req.quick = false;
+	req.target.clear();
+
+	const char *p = skip_ws(line);
+	if (*p != '{') {
+		return -EINVAL;
+	}
+	p = skip_ws(p + 1);
+	if (*p == '}') {
+		return (*skip_ws(p + 1) == '\0' ? 0 : -EINVAL);
+	}
+
+	string key, value;
+	for (;;) {
+		if (*p != '"') {
+			return -EINVAL;
+		}
+		p = parse_string(p, key);
+		if (!p) {
+			return -EINVAL;
+		}
+		p = skip_ws(p);
+		if (*p != ':') {
+			return -EINVAL;
+		}
+		p = skip_ws(p + 1);
+
+		// Parse the value, keeping the raw JSON for the ID.
+		const char *const raw_start = p;
+		bool is_string = false;
+		if (*p == '"') {
+			p = parse_string(p, value);
+			if (!p) {
+				return -EINVAL;
+			}
+			is_string = true;
+		} else {
+			const size_t len = strcspn(p, ", \t\r\n}");
+			if (len == 0) {
+				return -EINVAL;
+			}
+			value.assign(p, len);
+			if (value != "true" && value != "false" && value != "null" &&
+			    strspn(value.c_str(), "-+.0123456789eE") != len)
+			{
+				// Not a literal or a number.
+				return -EINVAL;
+			}
+			p += len;
+		}
+
+		if (key == "id") {
+			req.id.assign(raw_start, p - raw_start);
+		} else if (key == "cmd" && is_string) {
+			req.cmd = value;
+		} else if (key == "device" && is_string) {
+			req.device = value;
+		} else if (key == "image" && is_string) {
+			req.image = value;
+		} else if (key == "bank") {
+			char *endptr;
+			const long bank = strtol(value.c_str(), &endptr, 10);
+			if (*endptr != '\0' || bank < 1 || bank > NHCD_BANK_COUNT) {
+				return -EINVAL;
+			}
+			req.bank = static_cast<int>(bank);
+		} else if (key == "quick" && !is_string) {
+			req.quick = (value == "true");
+		} else if (key == "target") {
+			req.target.assign(raw_start, p - raw_start);
+		}
+
+		p = skip_ws(p);
+		if (*p == ',') {
+			p = skip_ws(p + 1);
+		} else if (*p == '}') {
+			break;
+		} else {
+			return -EINVAL;
+		}
+	}
+
+	return (*skip_ws(p + 1) == '\0' ? 0 : -EINVAL);
+}
+
+/** Request handlers **/
+
+/**
+ * Append the bank list of a device to a response.
+ * Only the bank table and disc headers are read, since
+ * these are enough for inventory queries.
+ * @param rvth	[in] RVT-H device
+ * @param out	[in,out] Response
+ */
+static void append_bank_list(const RvtH *rvth, string &out)
+{
+	out += (rvth->isHDD() ? ",\"hdd\":true,\"banks\":[" : ",\"hdd\":false,\"banks\":[");
+	rvth->initBankEntries(0, RVTH_BANK_INIT_HEADER);
+
+	const unsigned int bank_count = rvth->bankCount();
+	for (unsigned int bank = 0; bank < bank_count; bank++) {
+		if (bank != 0) {
+			out += ',';
+		}
+		json_append_bank(out, rvth, bank, LIST_FIELDS_HEADER);
+	}
+	out += ']';
+}
+
+static void close_device(DaemonDevice *device);
+
+/**
+ * Open a device if it isn't open already.
+ * If it's already open, the bank table is checked for changes
+ * made by other programs, and the device is reopened if the
+ * bank table was reformatted.
+ * The caller must hold the device mutex.
+ * @param state		[in] Daemon state
+ * @param device	[in,out] Device
+ * @return 0 on success; non-zero on error.
+ */
+static int open_device(DaemonState *state, DaemonDevice *device)
+{
+	if (device->rvth) {
+		// Already open.
+		if (device->rvth->isHDD() &&
+		    device->rvth->pollBankTable() == -ESTALE)
+		{
+			close_device(device);
+		} else {
+			return 0;
+		}
+	}
+
+	int ret = 0;
+	unique_ptr<RvtH> rvth(new RvtH(device->name.c_str(), &ret));
+	if (ret == 0 && !rvth->isOpen()) {
+		ret = -EIO;
+	}
+	if (ret == 0) {
+		ret = rvth->setCopyParams(&state->options->copy_params);
+	}
+	if (ret == 0) {
+		std::lock_guard<std::mutex> lock(device->metrics_mutex);
+		device->rvth = std::move(rvth);
+	}
+	return ret;
+}
+
+/**
+ * Close a device.
+ * Its counters are kept in the device metrics.
+ * @param device	[in,out] Device
+ */
+static void close_device(DaemonDevice *device)
+{
+	std::lock_guard<std::mutex> lock(device->metrics_mutex);
+	if (device->rvth) {
+		device->metrics.add(device->rvth.get());
+		device->rvth.reset();
+	}
+}
+
+/**
+ * Get the device for a filename, creating it if necessary.
+ * @param state	[in] Daemon state
+ * @param name	[in] Device filename
+ * @return Device
+ */
+static DaemonDevice *get_device(DaemonState *state, const string &name)
+{
+	const tstring key = device_key(name.c_str());
+	std::lock_guard<std::mutex> lock(state->devices_mutex);
+	unique_ptr<DaemonDevice> &device = state->devices[key];
+	if (!device) {
+		device.reset(new DaemonDevice);
+		device->name = name;
+		device->metrics.name = name;
+	}
+	return device.get();
+}
+
+/**
+ * Run a request's operation as a job, so it can be cancelled.
+ * @param state		[in] Daemon state
+ * @param key		[in] Client and request ID
+ * @param job		[in] Job (not started)
+ * @return Job result.
+ */
+static int run_job(DaemonState *state, const DaemonJobKey &key, AsyncJob *job)
+{
+	{
+		std::lock_guard<std::mutex> lock(state->jobs_mutex);
+		DaemonJob &entry = state->jobs[key];
+		if (entry.cancelled) {
+			return -ECANCELED;
+		}
+		const int ret = job->start();
+		if (ret != 0) {
+			return ret;
+		}
+		entry.job = job;
+	}
+
+	const int ret = job->wait();
+	std::lock_guard<std::mutex> lock(state->jobs_mutex);
+	state->jobs[key].job = nullptr;
+	return ret;
+}
+
+/**
+ * Cancel a request sent by a client.
+ * If the request is queued, it's cancelled when it reaches
+ * the front of the queue.
+ * @param state		[in] Daemon state
+ * @param key		[in] Client and request ID
+ * @return 0 on success; -ENOENT if the request isn't outstanding.
+ */
+static int cancel_request(DaemonState *state, const DaemonJobKey &key)
+{
+	std::lock_guard<std::mutex> lock(state->jobs_mutex);
+	auto iter = state->jobs.find(key);
+	if (iter == state->jobs.end()) {
+		return -ENOENT;
+	}
+	iter->second.cancelled = true;
+	if (iter->second.job) {
+		iter->second.job->cancel();
+	}
+	return 0;
+}
+
+/**
+ * Get the metrics for all devices.
+ * The counters are read without waiting for running requests.
+ * @param state		[in] Daemon state
+ * @param devices	[out] Device metrics
+ */
+static void collect_metrics(DaemonState *state, vector<DeviceMetrics> &devices)
+{
+	std::lock_guard<std::mutex> lock(state->devices_mutex);
+	devices.clear();
+	devices.reserve(state->devices.size());
+	for (const auto &entry : state->devices) {
+		DaemonDevice *const device = entry.second.get();
+
+		uint64_t depth;
+		{
+			std::lock_guard<std::mutex> devLock(device->mutex);
+			depth = device->next_ticket - device->serving;
+		}
+
+		std::lock_guard<std::mutex> metricsLock(device->metrics_mutex);
+		devices.push_back(device->metrics);
+		DeviceMetrics &metrics = devices.back();
+		if (device->rvth) {
+			metrics.add(device->rvth.get());
+			metrics.open = true;
+		}
+		metrics.running = (depth > 0 ? 1 : 0);
+		metrics.queued = static_cast<unsigned int>(depth - metrics.running);
+	}
+}
+
+/**
+ * Write the metrics file.
+ * If the filename ends with ".prom", the Prometheus text format is
+ * used, e.g. for node_exporter's textfile collector. Otherwise, JSON
+ * is used. The file is replaced atomically.
+ * @param state		[in] Daemon state
+ * @param filename	[in] Metrics filename
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int write_metrics_file(DaemonState *state, const char *filename)
+{
+	vector<DeviceMetrics> devices;
+	collect_metrics(state, devices);
+
+	string out;
+	const size_t len = strlen(filename);
+	if (len >= 5 && !strcmp(&filename[len - 5], ".prom")) {
+		metrics_format_prometheus(out, devices);
+	} else {
+		char buf[64];
+		snprintf(buf, sizeof(buf), "{\"time\":%lld", static_cast<long long>(time(nullptr)));
+		out = buf;
+		metrics_append_json(out, devices);
+		out += "}\n";
+	}
+
+	const string tmp_filename = string(filename) + ".tmp";
+	FILE *f = fopen(tmp_filename.c_str(), "w");
+	if (!f) {
+		return -errno;
+	}
+	int ret = 0;
+	if (fwrite(out.data(), 1, out.size(), f) != out.size()) {
+		ret = -(errno != 0 ? errno : EIO);
+	}
+	if (fclose(f) != 0 && ret == 0) {
+		ret = -errno;
+	}
+	if (ret == 0 && rename(tmp_filename.c_str(), filename) != 0) {
+		ret = -errno;
+	}
+	if (ret != 0) {
+		unlink(tmp_filename.c_str());
+	}
+	return ret;
+}
+
+/**
+ * Run a request for a device.
+ * The caller must hold the device mutex.
+ * @param state		[in] Daemon state
+ * @param device	[in,out] Device
+ * @param req		[in] Request
+ * @param key		[in] Client and request ID
+ * @param out		[in,out] Response
+ * @return 0 on success; non-zero on error.
+ */
+static int run_device_request(DaemonState *state, DaemonDevice *device,
+	const DaemonRequest &req, const DaemonJobKey &key, string &out)
+{
+	const Batch_Options *const options = state->options;
+
+	if (req.cmd == "close") {
+		// Close the device, e.g. if it was modified by another program.
+		close_device(device);
+		return 0;
+	}
+
+	int ret = open_device(state, device);
+	if (ret != 0) {
+		return ret;
+	}
+	RvtH *const rvth = device->rvth.get();
+
+	if (req.cmd == "list") {
+		append_bank_list(rvth, out);
+		return 0;
+	}
+
+	// Other commands need a bank number.
+	// Assume 1 bank if this is a standalone disc image.
+	unsigned int bank;
+	if (req.bank != 0) {
+		bank = static_cast<unsigned int>(req.bank - 1);
+		if (bank >= rvth->bankCount()) {
+			return -ERANGE;
+		}
+	} else if (rvth->bankCount() == 1) {
+		bank = 0;
+	} else {
+		return -EINVAL;
+	}
+
+	char buf[128];
+	if (req.cmd == "extract" || req.cmd == "import") {
+		if (req.image.empty()) {
+			return -EINVAL;
+		}
+		unique_ptr<AsyncJob> job;
+		if (req.cmd == "extract") {
+			const TCHAR *const store_dir = options->store_dir;
+			const tstring image = req.image;
+			job.reset(new AsyncJob(rvth, [=](AsyncJob *pJob) {
+				return rvth->extract(bank, image.c_str(),
+					options->recrypt_key, options->extract_flags,
+					AsyncJob::progressCallback, pJob, store_dir);
+			}));
+		} else {
+			job.reset(AsyncJob::import(rvth, bank, req.image.c_str(),
+				options->ios_force, options->import_flags));
+		}
+		ret = run_job(state, key, job.get());
+		if (ret == 0) {
+			RvtH_BankSummary summary;
+			if (rvth->bankSummary(bank, &summary) != 0) {
+				summary.lba_len = 0;
+			}
+			snprintf(buf, sizeof(buf), ",\"size\":%llu",
+				static_cast<unsigned long long>(LBA_TO_BYTES(static_cast<uint64_t>(summary.lba_len))));
+			out += buf;
+		}
+	} else if (req.cmd == "verify") {
+		unsigned int error_count[5] = {0, 0, 0, 0, 0};
+		unsigned int flags = options->verify_flags;
+		if (req.quick) {
+			flags |= RVTH_VERIFY_QUICK;
+		}
+		unique_ptr<AsyncJob> job(AsyncJob::verify(rvth, bank, state->verify_threads, flags));
+		ret = run_job(state, key, job.get());
+		if (ret == 0) {
+			memcpy(error_count, job->errorCount(), sizeof(error_count));
+			std::lock_guard<std::mutex> lock(device->metrics_mutex);
+			for (unsigned int level = 0; level < 5; level++) {
+				device->metrics.verify_errors[level] += error_count[level];
+			}
+			snprintf(buf, sizeof(buf), ",\"errors\":{\"H0\":%u,\"H1\":%u,\"H2\":%u,\"H3\":%u,\"H4\":%u}",
+				error_count[0], error_count[1], error_count[2], error_count[3], error_count[4]);
+			out += buf;
+		}
+	} else {
+		ret = -ENOTSUP;
+	}
+
+	if (ret == -EIO || ret == -ENODEV || ret == -ENXIO) {
+		// The device may have been disconnected.
+		// Reopen it for the next request.
+		close_device(device);
+	}
+	return ret;
+}
+
+/**
+ * Run a request and send the response.
+ * @param state		[in] Daemon state
+ * @param client	[in] Client
+ * @param req		[in] Request
+ * @param device	[in,opt] Device (nullptr if the request didn't specify one)
+ * @param ticket	[in] Ticket for the device queue
+ */
+static void request_thread(DaemonState *state, shared_ptr<DaemonClient> client,
+	DaemonRequest req, DaemonDevice *device, uint64_t ticket)
+{
+	const DaemonJobKey key(client.get(), req.id);
+	string result;
+	int ret;
+	if (!device) {
+		ret = -EINVAL;
+	} else {
+		std::unique_lock<std::mutex> lock(device->mutex);
+		device->cond.wait(lock, [device, ticket] { return device->serving == ticket; });
+
+		// The ticket serializes requests for this device, so the mutex
+		// isn't held while the request is running. Otherwise, the client
+		// thread would block when queueing the next request, and it
+		// wouldn't be able to handle "cancel" until this one finishes.
+		lock.unlock();
+		ret = run_device_request(state, device, req, key, result);
+		lock.lock();
+		device->serving++;
+		device->cond.notify_all();
+		lock.unlock();
+
+		std::lock_guard<std::mutex> metricsLock(device->metrics_mutex);
+		if (ret == 0) {
+			device->metrics.requests_ok++;
+		} else {
+			device->metrics.requests_failed++;
+		}
+	}
+	{
+		std::lock_guard<std::mutex> lock(state->jobs_mutex);
+		state->jobs.erase(key);
+	}
+
+	string out = "{\"id\":";
+	out += req.id;
+	out += ",\"cmd\":";
+	json_append_string(out, req.cmd.c_str());
+	if (ret == 0) {
+		out += ",\"status\":\"ok\"";
+		out += result;
+	} else {
+		char buf[64];
+		snprintf(buf, sizeof(buf), ",\"status\":\"error\",\"code\":%d,\"message\":", ret);
+		out += buf;
+		json_append_string(out, rvth_error(ret));
+	}
+	out += "}\n";
+	client->send_line(out);
+
+	{
+		std::lock_guard<std::mutex> lock(state->log_mutex);
+		printf("%s %s", req.cmd.c_str(), req.device.c_str());
+		if (req.bank != 0) {
+			printf(" bank %d", req.bank);
+		}
+		if (ret == 0) {
+			fputs(": OK\n", stdout);
+		} else {
+			printf(": FAILED (%s)\n", rvth_error(ret));
+		}
+		fflush(stdout);
+	}
+
+	// Release the client before signaling, so the socket
+	// is closed before the daemon exits.
+	client.reset();
+	std::lock_guard<std::mutex> lock(state->threads_mutex);
+	state->threads_active--;
+	state->threads_cond.notify_all();
+}
+
+/**
+ * Read requests from a client.
+ * Each request is run in its own thread.
+ * @param state	[in] Daemon state
+ * @param fd	[in] Client socket
+ */
+static void client_thread(DaemonState *state, int fd)
+{
+	shared_ptr<DaemonClient> client = std::make_shared<DaemonClient>(fd);
+
+	string buf;
+	char rbuf[4096];
+	DaemonRequest req;
+	for (;;) {
+		const ssize_t n = recv(fd, rbuf, sizeof(rbuf), 0);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n <= 0) {
+			// Disconnected.
+			break;
+		}
+		buf.append(rbuf, n);
+
+		size_t pos;
+		while ((pos = buf.find('\n')) != string::npos) {
+			const string line = buf.substr(0, pos);
+			buf.erase(0, pos + 1);
+			if (line.find_first_not_of(" \t\r") == string::npos) {
+				// Blank line.
+				continue;
+			}
+
+			if (parse_request(line.c_str(), req) != 0) {
+				client->send_line("{\"id\":null,\"status\":\"error\",\"code\":-22,"
+					"\"message\":\"Invalid request\"}\n");
+				continue;
+			} else if (req.cmd == "shutdown") {
+				state->quit = true;
+				client->send_line("{\"id\":" + req.id + ",\"cmd\":\"shutdown\",\"status\":\"ok\"}\n");
+				continue;
+			} else if (req.cmd == "metrics") {
+				// Metrics are answered right away,
+				// even if requests are running.
+				vector<DeviceMetrics> devices;
+				collect_metrics(state, devices);
+				string out = "{\"id\":" + req.id + ",\"cmd\":\"metrics\",\"status\":\"ok\"";
+				metrics_append_json(out, devices);
+				out += "}\n";
+				client->send_line(out);
+				continue;
+			} else if (req.cmd == "cancel") {
+				// Cancel a request from this client.
+				// This is answered right away; the cancelled
+				// request is answered once it stops.
+				const int ret = (req.target.empty() || req.target == "null")
+					? -EINVAL
+					: cancel_request(state, DaemonJobKey(client.get(), req.target));
+				string out = "{\"id\":" + req.id + ",\"cmd\":\"cancel\"";
+				if (ret == 0) {
+					out += ",\"status\":\"ok\"}\n";
+				} else {
+					char buf[64];
+					snprintf(buf, sizeof(buf), ",\"status\":\"error\",\"code\":%d,\"message\":", ret);
+					out += buf;
+					json_append_string(out, rvth_error(ret));
+					out += "}\n";
+				}
+				client->send_line(out);
+				continue;
+			}
+
+			// Queue the request for the device.
+			DaemonDevice *device = nullptr;
+			uint64_t ticket = 0;
+			if (!req.device.empty()) {
+				device = get_device(state, req.device);
+				std::lock_guard<std::mutex> lock(device->mutex);
+				ticket = device->next_ticket++;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(state->jobs_mutex);
+				state->jobs[DaemonJobKey(client.get(), req.id)] = DaemonJob();
+			}
+
+			std::lock_guard<std::mutex> lock(state->threads_mutex);
+			state->threads_active++;
+			std::thread(request_thread, state, client, req, device, ticket).detach();
+		}
+
+		if (buf.size() > DAEMON_MAX_LINE) {
+			// Request is too long.
+			client->send_line("{\"id\":null,\"status\":\"error\",\"code\":-22,"
+				"\"message\":\"Request is too long\"}\n");
+			break;
+		}
+	}
+
+	// Stop reading from this client. The socket is closed
+	// once the outstanding requests have been answered.
+	std::lock_guard<std::mutex> lock(state->threads_mutex);
+	state->client_fds.erase(fd);
+	client.reset();
+	state->threads_active--;
+	state->threads_cond.notify_all();
+}
+
+/**
+ * Create the listening socket.
+ * @param socket_path Socket filename
+ * @return Socket on success; negative POSIX error code on error.
+ */
+static int create_socket(const char *socket_path)
+{
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+		return -ENAMETOOLONG;
+	}
+	strcpy(addr.sun_path, socket_path);
+
+	const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return -errno;
+	}
+
+	struct stat sbuf;
+	if (stat(socket_path, &sbuf) == 0 && S_ISSOCK(sbuf.st_mode)) {
+		// Remove the socket if it was left behind by
+		// a daemon that didn't exit cleanly.
+		if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0) {
+			// Another daemon is using this socket.
+			close(fd);
+			return -EADDRINUSE;
+		}
+		unlink(socket_path);
+	}
+
+	// Clients can extract and import arbitrary files, so only the
+	// owner and group may connect. The umask is set while binding,
+	// since a chmod() afterwards would leave a window where the
+	// socket has the default permissions.
+	// NOTE: umask() is process-wide. This is called before any
+	// other threads are started.
+	const mode_t old_umask = umask(0117);
+	int ret = bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+	umask(old_umask);
+	if (ret == 0) {
+		ret = listen(fd, 16);
+	}
+	if (ret != 0) {
+		const int err = errno;
+		close(fd);
+		return -err;
+	}
+	return fd;
+}
+#endif /* !_WIN32 */
+
+/**
+ * 'daemon' command.
+ * @param socket_path	[in] Socket filename.
+ * @param options	[in] Options. (Same as for batch jobs.)
+ * @param metrics_file	[in,opt] Metrics filename. (nullptr for none)
+ * @return 0 on success; non-zero on error.
+ */
+int run_daemon(const TCHAR *socket_path, const Batch_Options *options, const TCHAR *metrics_file)
+{
+#ifdef _WIN32
+	// Unix domain sockets are required. (See the help text.)
+	((void)socket_path);
+	((void)options);
+	((void)metrics_file);
+	fputs("*** ERROR: 'daemon' is not available on Windows.\n", stderr);
+	return -ENOTSUP;
+#else /* !_WIN32 */
+	const int listen_fd = create_socket(socket_path);
+	if (listen_fd < 0) {
+		fprintf(stderr, "*** ERROR creating socket '%s': %s\n", socket_path, strerror(-listen_fd));
+		return listen_fd;
+	}
+
+	// Responses to disconnected clients shouldn't kill the daemon.
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, daemon_signal_handler);
+	signal(SIGTERM, daemon_signal_handler);
+
+	DaemonState state;
+	state.options = options;
+	state.quit = false;
+	state.threads_active = 0;
+
+	// Verification uses one worker thread per CPU by default.
+	state.verify_threads = options->threads;
+	if (state.verify_threads == 0) {
+		state.verify_threads = std::thread::hardware_concurrency();
+		if (state.verify_threads == 0) {
+			state.verify_threads = 1;
+		}
+	}
+
+	printf("Listening on '%s'.\n", socket_path);
+	fflush(stdout);
+
+	// The socket is polled so shutdown requests
+	// and signals are handled within a second.
+	time_t metrics_time = 0;
+	bool metrics_error = false;
+	while (!state.quit && !s_interrupted) {
+		if (metrics_file) {
+			const time_t now = time(nullptr);
+			if (now - metrics_time >= DAEMON_METRICS_INTERVAL) {
+				metrics_time = now;
+				const int ret = write_metrics_file(&state, metrics_file);
+				if (ret != 0 && !metrics_error) {
+					// Only report the first error.
+					std::lock_guard<std::mutex> lock(state.log_mutex);
+					fprintf(stderr, "*** WARNING: Unable to write metrics file '%s': %s\n",
+						metrics_file, strerror(-ret));
+				}
+				metrics_error = (ret != 0);
+			}
+		}
+
+		struct pollfd pfd;
+		pfd.fd = listen_fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if (poll(&pfd, 1, 1000) <= 0) {
+			continue;
+		}
+
+		const int fd = accept(listen_fd, nullptr, nullptr);
+		if (fd < 0) {
+			continue;
+		}
+
+		std::lock_guard<std::mutex> lock(state.threads_mutex);
+		state.client_fds.insert(fd);
+		state.threads_active++;
+		std::thread(client_thread, &state, fd).detach();
+	}
+
+	// Stop accepting connections and reading requests,
+	// then wait for the running requests to finish.
+	close(listen_fd);
+	unlink(socket_path);
+	fputs("Shutting down.\n", stdout);
+	fflush(stdout);
+	{
+		std::unique_lock<std::mutex> lock(state.threads_mutex);
+		for (int fd : state.client_fds) {
+			shutdown(fd, SHUT_RD);
+		}
+		state.threads_cond.wait(lock, [&state] { return state.threads_active == 0; });
+	}
+	if (metrics_file) {
+		// Write the final counters.
+		write_metrics_file(&state, metrics_file);
+	}
+
+	return 0;
+#endif /* _WIN32 */
+}
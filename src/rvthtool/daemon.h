@@ -0,0 +1,59 @@
+/***************************************************************************
+ * RVT-H Tool                                                              *
+ * daemon.h: Serve requests for RVT-H Readers over a local socket.         *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_RVTHTOOL_DAEMON_H__
+#define __RVTHTOOL_RVTHTOOL_DAEMON_H__
+
+#include "tcharx.h"
+#include "batch.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 'daemon' command.
+ *
+ * Listens on a Unix domain socket for requests, one JSON object per line:
+ * - {"id":1,"cmd":"list","device":"/dev/sdb"}
+ * - {"id":2,"cmd":"extract","device":"/dev/sdb","bank":1,"image":"game.gcm"}
+ * - {"id":3,"cmd":"import","device":"/dev/sdb","bank":2,"image":"game.gcm"}
+ * - {"id":4,"cmd":"verify","device":"/dev/sdb","bank":1,"quick":true}
+ * - {"id":5,"cmd":"close","device":"/dev/sdb"}
+ * - {"id":6,"cmd":"cancel","target":2}
+ * - {"id":7,"cmd":"metrics"}
+ * - {"cmd":"shutdown"}
+ * Each request gets a single JSON line in response, with the same "id".
+ * A client can cancel its own extract, import, and verify requests
+ * while they're queued or running; they fail with -ECANCELED.
+ *
+ * "metrics" is answered right away with the counters for each device
+ * that has been used: requests, verification errors, bytes read and
+ * written, cache hits, read latency (if --slow-read is set), and the
+ * number of running and queued requests. If metrics_file is set, the
+ * same metrics are written to it every 10 seconds, in the Prometheus
+ * text format if its name ends with ".prom", or as JSON otherwise.
+ *
+ * Devices are kept open between requests, so the bank table and the
+ * verification cache only have to be loaded once. Requests for the same
+ * device are run one at a time; different devices run in parallel.
+ *
+ * POSIX only. On Windows, this fails with -ENOTSUP.
+ *
+ * @param socket_path	[in] Socket filename.
+ * @param options	[in] Options. (Same as for batch jobs.)
+ * @param metrics_file	[in,opt] Metrics filename. (nullptr for none)
+ * @return 0 on success; non-zero on error.
+ */
+int run_daemon(const TCHAR *socket_path, const Batch_Options *options, const TCHAR *metrics_file);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_RVTHTOOL_DAEMON_H__ */
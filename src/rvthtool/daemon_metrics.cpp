@@ -0,0 +1,333 @@
+/***************************************************************************
+ * RVT-H Tool                                                              *
+ * daemon_metrics.cpp: Per-device metrics for the daemon.                  *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "daemon_metrics.hpp"
+#include "json_report.hpp"
+
+// C includes (C++ namespace)
+#include <cstdio>
+#include <cstring>
+
+// C++ includes
+#include <memory>
+using std::string;
+using std::vector;
+
+DeviceMetrics::DeviceMetrics()
+	: open(false)
+	, running(0)
+	, queued(0)
+	, requests_ok(0)
+	, requests_failed(0)
+	, has_latency(false)
+	, latency_total_us(0)
+	, latency_max_us(0)
+	, slow_reads(0)
+{
+	memset(verify_errors, 0, sizeof(verify_errors));
+	memset(&stats, 0, sizeof(stats));
+	memset(latency_hist, 0, sizeof(latency_hist));
+}
+
+/**
+ * Add an RvtH object's counters.
+ * @param rvth	[in] RVT-H disk image
+ */
+void DeviceMetrics::add(const RvtH *rvth)
+{
+	RvtH_Stats cur;
+	rvth->getStats(&cur);
+	stats.bytes_read	+= cur.bytes_read;
+	stats.bytes_written	+= cur.bytes_written;
+	stats.read_calls	+= cur.read_calls;
+	stats.write_calls	+= cur.write_calls;
+	stats.seeks		+= cur.seeks;
+	stats.sparse_bytes	+= cur.sparse_bytes;
+	stats.cache_hits	+= cur.cache_hits;
+	stats.cache_misses	+= cur.cache_misses;
+	stats.io_ns		+= cur.io_ns;
+	stats.aes_ns		+= cur.aes_ns;
+	stats.sha1_ns		+= cur.sha1_ns;
+	stats.zero_scan_ns	+= cur.zero_scan_ns;
+
+	// NOTE: RvtH_Read_Latency includes the slow read ranges,
+	// so it's allocated on the heap.
+	std::unique_ptr<RvtH_Read_Latency> latency(new RvtH_Read_Latency);
+	if (rvth->getReadLatency(latency.get()) != 0) {
+		return;
+	}
+	has_latency = true;
+	for (unsigned int i = 0; i < RVTH_LATENCY_BUCKETS; i++) {
+		latency_hist[i] += latency->hist[i];
+	}
+	latency_total_us += latency->total_us;
+	if (latency->max_us > latency_max_us) {
+		latency_max_us = latency->max_us;
+	}
+	slow_reads += latency->slow_reads;
+}
+
+/**
+ * Append a JSON key and an unsigned integer value.
+ * @param out	[in,out] Output buffer
+ * @param key	[in] Key, including the leading comma if needed
+ * @param value	[in] Value
+ */
+static void json_append_u64(string &out, const char *key, uint64_t value)
+{
+	char buf[64];
+	snprintf(buf, sizeof(buf), "%s:%llu", key, static_cast<unsigned long long>(value));
+	out += buf;
+}
+
+/**
+ * Append the metrics to a JSON response, as a "devices" array.
+ * @param out		[in,out] Output buffer
+ * @param devices	[in] Device metrics
+ */
+void metrics_append_json(string &out, const vector<DeviceMetrics> &devices)
+{
+	out += ",\"devices\":[";
+	for (size_t i = 0; i < devices.size(); i++) {
+		const DeviceMetrics &dev = devices[i];
+		if (i != 0) {
+			out += ',';
+		}
+		out += "{\"device\":";
+		json_append_string(out, dev.name.c_str());
+		out += (dev.open ? ",\"open\":true" : ",\"open\":false");
+		json_append_u64(out, ",\"running\"", dev.running);
+		json_append_u64(out, ",\"queued\"", dev.queued);
+		json_append_u64(out, ",\"requests\":{\"ok\"", dev.requests_ok);
+		json_append_u64(out, ",\"error\"", dev.requests_failed);
+		out += '}';
+
+		out += ",\"verify_errors\":{";
+		for (unsigned int level = 0; level < 5; level++) {
+			char key[16];
+			snprintf(key, sizeof(key), "%s\"H%u\"", (level != 0 ? "," : ""), level);
+			json_append_u64(out, key, dev.verify_errors[level]);
+		}
+		out += '}';
+
+		const RvtH_Stats &stats = dev.stats;
+		json_append_u64(out, ",\"bytes_read\"", stats.bytes_read);
+		json_append_u64(out, ",\"bytes_written\"", stats.bytes_written);
+		json_append_u64(out, ",\"read_calls\"", stats.read_calls);
+		json_append_u64(out, ",\"write_calls\"", stats.write_calls);
+		json_append_u64(out, ",\"seeks\"", stats.seeks);
+		json_append_u64(out, ",\"sparse_bytes\"", stats.sparse_bytes);
+		json_append_u64(out, ",\"cache_hits\"", stats.cache_hits);
+		json_append_u64(out, ",\"cache_misses\"", stats.cache_misses);
+		json_append_u64(out, ",\"io_ns\"", stats.io_ns);
+		json_append_u64(out, ",\"aes_ns\"", stats.aes_ns);
+		json_append_u64(out, ",\"sha1_ns\"", stats.sha1_ns);
+		json_append_u64(out, ",\"zero_scan_ns\"", stats.zero_scan_ns);
+
+		if (dev.has_latency) {
+			uint64_t reads = 0;
+			out += ",\"read_latency\":{\"hist\":[";
+			for (unsigned int b = 0; b < RVTH_LATENCY_BUCKETS; b++) {
+				char buf[32];
+				snprintf(buf, sizeof(buf), "%s%llu", (b != 0 ? "," : ""),
+					static_cast<unsigned long long>(dev.latency_hist[b]));
+				out += buf;
+				reads += dev.latency_hist[b];
+			}
+			out += ']';
+			json_append_u64(out, ",\"reads\"", reads);
+			json_append_u64(out, ",\"total_us\"", dev.latency_total_us);
+			json_append_u64(out, ",\"max_us\"", dev.latency_max_us);
+			json_append_u64(out, ",\"slow_reads\"", dev.slow_reads);
+			out += '}';
+		}
+		out += '}';
+	}
+	out += ']';
+}
+
+/**
+ * Append a Prometheus label value, with escaping.
+ * @param out	[in,out] Output buffer
+ * @param str	[in] Label value
+ */
+static void prom_append_label(string &out, const string &str)
+{
+	for (const char chr : str) {
+		switch (chr) {
+			case '\\':	out += "\\\\"; break;
+			case '"':	out += "\\\""; break;
+			case '\n':	out += "\\n"; break;
+			default:	out += chr; break;
+		}
+	}
+}
+
+/**
+ * Append the HELP and TYPE lines for a metric.
+ * @param out	[in,out] Output buffer
+ * @param name	[in] Metric name
+ * @param type	[in] Metric type
+ * @param help	[in] Help text
+ */
+static void prom_append_header(string &out, const char *name, const char *type, const char *help)
+{
+	out += "# HELP ";
+	out += name;
+	out += ' ';
+	out += help;
+	out += "\n# TYPE ";
+	out += name;
+	out += ' ';
+	out += type;
+	out += '\n';
+}
+
+/**
+ * Append a sample.
+ * @param out		[in,out] Output buffer
+ * @param name		[in] Metric name
+ * @param dev		[in] Device
+ * @param extra		[in,opt] Extra labels, e.g. "level=\"H0\"" (nullptr for none)
+ * @param value		[in] Value
+ */
+static void prom_append_sample(string &out, const char *name,
+	const DeviceMetrics &dev, const char *extra, double value)
+{
+	out += name;
+	out += "{device=\"";
+	prom_append_label(out, dev.name);
+	out += '"';
+	if (extra) {
+		out += ',';
+		out += extra;
+	}
+	char buf[64];
+	snprintf(buf, sizeof(buf), "} %.16g\n", value);
+	out += buf;
+}
+
+/**
+ * Format the metrics in the Prometheus text exposition format.
+ * @param out		[out] Output buffer
+ * @param devices	[in] Device metrics
+ */
+void metrics_format_prometheus(string &out, const vector<DeviceMetrics> &devices)
+{
+	// Metrics with one sample per device.
+	struct Metric {
+		const char *name;
+		const char *type;
+		const char *help;
+		double (*value)(const DeviceMetrics &dev);
+	};
+	static const Metric metrics[] = {
+		{"rvth_device_open", "gauge", "Whether the device is open.",
+			[](const DeviceMetrics &dev) { return dev.open ? 1.0 : 0.0; }},
+		{"rvth_device_requests_running", "gauge", "Number of requests running.",
+			[](const DeviceMetrics &dev) { return static_cast<double>(dev.running); }},
+		{"rvth_device_requests_queued", "gauge", "Number of requests waiting to run.",
+			[](const DeviceMetrics &dev) { return static_cast<double>(dev.queued); }},
+		{"rvth_device_read_bytes_total", "counter", "Bytes read.",
+			[](const DeviceMetrics &dev) { return static_cast<double>(dev.stats.bytes_read); }},
+		{"rvth_device_written_bytes_total", "counter", "Bytes written.",
+			[](const DeviceMetrics &dev) { return static_cast<double>(dev.stats.bytes_written); }},
+		{"rvth_device_reads_total", "counter", "Number of reads.",
+			[](const DeviceMetrics &dev) { return static_cast<double>(dev.stats.read_calls); }},
+		{"rvth_device_writes_total", "counter", "Number of writes.",
+			[](const DeviceMetrics &dev) { return static_cast<double>(dev.stats.write_calls); }},
+		{"rvth_device_seeks_total", "counter", "Reads and writes that didn't continue the previous one.",
+			[](const DeviceMetrics &dev) { return static_cast<double>(dev.stats.seeks); }},
+		{"rvth_device_sparse_bytes_total", "counter", "Empty blocks that were skipped or deallocated, in bytes.",
+			[](const DeviceMetrics &dev) { return static_cast<double>(dev.stats.sparse_bytes); }},
+		{"rvth_device_cache_hits_total", "counter", "Block cache lookups that were found in the cache.",
+			[](const DeviceMetrics &dev) { return static_cast<double>(dev.stats.cache_hits); }},
+		{"rvth_device_cache_misses_total", "counter", "Block cache lookups that had to be read.",
+			[](const DeviceMetrics &dev) { return static_cast<double>(dev.stats.cache_misses); }},
+		{"rvth_device_io_seconds_total", "counter", "Time blocked in reads and writes, over all threads.",
+			[](const DeviceMetrics &dev) { return static_cast<double>(dev.stats.io_ns) / 1e9; }},
+		{"rvth_device_aes_seconds_total", "counter", "Time in AES, over all threads.",
+			[](const DeviceMetrics &dev) { return static_cast<double>(dev.stats.aes_ns) / 1e9; }},
+		{"rvth_device_sha1_seconds_total", "counter", "Time in SHA-1, over all threads.",
+			[](const DeviceMetrics &dev) { return static_cast<double>(dev.stats.sha1_ns) / 1e9; }},
+		{"rvth_device_zero_scan_seconds_total", "counter", "Time checking for empty blocks, over all threads.",
+			[](const DeviceMetrics &dev) { return static_cast<double>(dev.stats.zero_scan_ns) / 1e9; }},
+	};
+
+	out.clear();
+	for (const Metric &metric : metrics) {
+		prom_append_header(out, metric.name, metric.type, metric.help);
+		for (const DeviceMetrics &dev : devices) {
+			prom_append_sample(out, metric.name, dev, nullptr, metric.value(dev));
+		}
+	}
+
+	// Requests, by status.
+	prom_append_header(out, "rvth_device_requests_total", "counter", "Requests that were answered.");
+	for (const DeviceMetrics &dev : devices) {
+		prom_append_sample(out, "rvth_device_requests_total", dev, "status=\"ok\"",
+			static_cast<double>(dev.requests_ok));
+		prom_append_sample(out, "rvth_device_requests_total", dev, "status=\"error\"",
+			static_cast<double>(dev.requests_failed));
+	}
+
+	// Verification errors, by hash level.
+	prom_append_header(out, "rvth_device_verify_errors_total", "counter", "Verification errors, by hash level.");
+	for (const DeviceMetrics &dev : devices) {
+		for (unsigned int level = 0; level < 5; level++) {
+			char label[16];
+			snprintf(label, sizeof(label), "level=\"H%u\"", level);
+			prom_append_sample(out, "rvth_device_verify_errors_total", dev, label,
+				static_cast<double>(dev.verify_errors[level]));
+		}
+	}
+
+	// Read latency, if it's being measured. (--slow-read)
+	bool has_latency = false;
+	for (const DeviceMetrics &dev : devices) {
+		has_latency |= dev.has_latency;
+	}
+	if (!has_latency) {
+		return;
+	}
+
+	static const char latency_name[] = "rvth_device_read_latency_seconds";
+	prom_append_header(out, latency_name, "histogram", "Read latency.");
+	for (const DeviceMetrics &dev : devices) {
+		if (!dev.has_latency)
+			continue;
+
+		// Prometheus buckets are cumulative.
+		// The last RvtH bucket is the +Inf bucket.
+		const string bucket_name = string(latency_name) + "_bucket";
+		uint64_t count = 0;
+		for (unsigned int i = 0; i < RVTH_LATENCY_BUCKETS; i++) {
+			count += dev.latency_hist[i];
+			char label[48];
+			if (i < RVTH_LATENCY_BUCKETS - 1) {
+				snprintf(label, sizeof(label), "le=\"%.6f\"",
+					static_cast<double>(RVTH_LATENCY_BUCKET_LIMIT_US(i)) / 1e6);
+			} else {
+				strcpy(label, "le=\"+Inf\"");
+			}
+			prom_append_sample(out, bucket_name.c_str(), dev, label, static_cast<double>(count));
+		}
+		prom_append_sample(out, (string(latency_name) + "_sum").c_str(), dev, nullptr,
+			static_cast<double>(dev.latency_total_us) / 1e6);
+		prom_append_sample(out, (string(latency_name) + "_count").c_str(), dev, nullptr,
+			static_cast<double>(count));
+	}
+
+	prom_append_header(out, "rvth_device_slow_reads_total", "counter", "Reads that took at least the --slow-read threshold.");
+	for (const DeviceMetrics &dev : devices) {
+		if (dev.has_latency) {
+			prom_append_sample(out, "rvth_device_slow_reads_total", dev, nullptr,
+				static_cast<double>(dev.slow_reads));
+		}
+	}
+}
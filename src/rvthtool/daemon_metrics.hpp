@@ -0,0 +1,70 @@
+/***************************************************************************
+ * RVT-H Tool                                                              *
+ * daemon_metrics.hpp: Per-device metrics for the daemon.                  *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_RVTHTOOL_DAEMON_METRICS_HPP__
+#define __RVTHTOOL_RVTHTOOL_DAEMON_METRICS_HPP__
+
+#include "librvth/rvth.hpp"
+
+// C includes
+#include <stdint.h>
+
+// C++ includes
+#include <string>
+#include <vector>
+
+/**
+ * Metrics for a device served by the daemon.
+ *
+ * Counters accumulate for as long as the daemon is running. The RvtH
+ * object's counters are added when the device is closed, so they don't
+ * go backwards if the device is reopened, e.g. after a disconnect.
+ */
+struct DeviceMetrics {
+	std::string name;	// Device filename
+	bool open;		// Is the device open?
+	unsigned int running;	// Number of requests running (0 or 1)
+	unsigned int queued;	// Number of requests waiting to run
+
+	uint64_t requests_ok;		// Requests that succeeded
+	uint64_t requests_failed;	// Requests that failed
+	uint64_t verify_errors[5];	// Verification errors, by hash level (H0-H4)
+
+	RvtH_Stats stats;		// Performance counters
+
+	// Read latency. (only if has_latency is set)
+	bool has_latency;
+	uint64_t latency_hist[RVTH_LATENCY_BUCKETS];
+	uint64_t latency_total_us;
+	uint64_t latency_max_us;
+	uint64_t slow_reads;
+
+	DeviceMetrics();
+
+	/**
+	 * Add an RvtH object's counters.
+	 * @param rvth	[in] RVT-H disk image
+	 */
+	void add(const RvtH *rvth);
+};
+
+/**
+ * Append the metrics to a JSON response, as a "devices" array.
+ * @param out		[in,out] Output buffer
+ * @param devices	[in] Device metrics
+ */
+void metrics_append_json(std::string &out, const std::vector<DeviceMetrics> &devices);
+
+/**
+ * Format the metrics in the Prometheus text exposition format.
+ * @param out		[out] Output buffer
+ * @param devices	[in] Device metrics
+ */
+void metrics_format_prometheus(std::string &out, const std::vector<DeviceMetrics> &devices);
+
+#endif /* __RVTHTOOL_RVTHTOOL_DAEMON_METRICS_HPP__ */
@@ -2,55 +2,80 @@
  * RVT-H Tool                                                              *
  * extract.cpp: Extract/import a bank from/to an RVT-H disk image.         *
  *                                                                         *
- * Copyright (c) 2018-2019 by David Korth.                                 *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
 #include "extract.h"
+#include "identify.h"
 #include "list-banks.hpp"
 
 #include "librvth/rvth.hpp"
 #include "librvth/rvth_error.h"
 #include "librvth/nhcd_structs.h"
+#include "json_report.hpp"
+#include "stats.hpp"
 
 // C includes. (C++ namespace)
 #include <cassert>
 #include <cerrno>
+#include <climits>
 #include <cstdlib>
+#include <cstring>
+
+// C++ includes
+#include <string>
+#include <vector>
+using std::string;
+using std::tstring;
+using std::vector;
+
+// Progress updates are printed at most 10 times per second,
+// since printing every update is slow on some terminals.
+static const RvtH_ProgressParams progress_params = {100, 0, 0};
 
 /**
  * RVT-H progress callback.
  * @param state		[in] Current progress.
- * @param userdata	[in] User data specified when calling the RVT-H function.
+ * @param userdata	[in] FILE* to print progress to, or nullptr for stdout.
  * @return True to continue; false to abort.
  */
 static bool progress_callback(const RvtH_Progress_State *state, void *userdata)
 {
-	UNUSED(userdata);
+	FILE *const f = (userdata ? static_cast<FILE*>(userdata) : stdout);
 
 	#define MEGABYTE (1048576 / LBA_SIZE)
 	switch (state->type) {
 		case RVTH_PROGRESS_EXTRACT:
-			printf("\rExtracting: %4u MiB / %4u MiB copied...",
+			fprintf(f, "\rExtracting: %4u MiB / %4u MiB copied...",
+				state->lba_processed / MEGABYTE,
+				state->lba_total / MEGABYTE);
+			print_progress_rate(f, state);
+			break;
+		case RVTH_PROGRESS_CONVERT:
+			fprintf(f, "\rConverting: %4u MiB / %4u MiB copied...",
 				state->lba_processed / MEGABYTE,
 				state->lba_total / MEGABYTE);
+			print_progress_rate(f, state);
 			break;
 		case RVTH_PROGRESS_IMPORT:
-			printf("\rImporting: %4u MiB / %4u MiB copied...",
+			fprintf(f, "\rImporting: %4u MiB / %4u MiB copied...",
 				state->lba_processed / MEGABYTE,
 				state->lba_total / MEGABYTE);
+			print_progress_rate(f, state);
 			break;
 		case RVTH_PROGRESS_RECRYPT:
 			if (state->lba_total <= 1) {
 				// TODO: Encryption types?
 				if (state->lba_processed == 0) {
-					printf("\rRecrypting the ticket(s) and TMD(s)...");
+					fprintf(f, "\rRecrypting the ticket(s) and TMD(s)...");
 				}
 			} else {
 				// TODO: This doesn't seem to be used yet...
-				printf("\rRecrypting: %4u MiB / %4u MiB processed...",
+				fprintf(f, "\rRecrypting: %4u MiB / %4u MiB processed...",
 					state->lba_processed / MEGABYTE,
 					state->lba_total / MEGABYTE);
+				print_progress_rate(f, state);
 			}
 			break;
 		default:
@@ -61,22 +86,235 @@ static bool progress_callback(const RvtH_Progress_State *state, void *userdata)
 
 	if (state->lba_processed == state->lba_total) {
 		// Finished processing.
-		putchar('\n');
+		fputc('\n', f);
 	}
-	fflush(stdout);
+	if (state->digests) {
+		// Print the image digests.
+		const RvtH_Image_Digests *const digests = state->digests;
+		fprintf(f, "CRC32: %08x\n", digests->crc32);
+		fputs("MD5:   ", f);
+		for (size_t i = 0; i < sizeof(digests->md5); i++) {
+			fprintf(f, "%02x", digests->md5[i]);
+		}
+		fputs("\nSHA-1: ", f);
+		for (size_t i = 0; i < sizeof(digests->sha1); i++) {
+			fprintf(f, "%02x", digests->sha1[i]);
+		}
+		fputc('\n', f);
+
+		// Identify the disc image if a DAT file was specified.
+		print_dat_match(f, digests, LBA_TO_BYTES(static_cast<uint64_t>(state->lba_total)));
+	}
+	fflush(f);
 	return true;
 }
 
+/**
+ * RVT-H progress callback. (JSON reports)
+ * Progress isn't printed; only the digests are saved.
+ * @param state		[in] Current progress.
+ * @param userdata	[in] RvtH_Image_Digests, or nullptr if digests aren't needed.
+ * @return True to continue; false to abort.
+ */
+static bool json_progress_callback(const RvtH_Progress_State *state, void *userdata)
+{
+	if (state->digests && userdata) {
+		*static_cast<RvtH_Image_Digests*>(userdata) = *state->digests;
+	}
+	return true;
+}
+
+/**
+ * Print a hex string as a JSON string.
+ * @param data	[in] Data
+ * @param size	[in] Size of data
+ */
+static void json_print_hex(const uint8_t *data, size_t size)
+{
+	putchar('"');
+	for (size_t i = 0; i < size; i++) {
+		printf("%02x", data[i]);
+	}
+	putchar('"');
+}
+
+/**
+ * Append a disc header field to a filename.
+ * Characters that aren't allowed in filenames are replaced with '_',
+ * and leading and trailing spaces are removed.
+ * @param filename	[in,out] Filename.
+ * @param str		[in] Disc header field. (May not be NULL-terminated.)
+ * @param len		[in] Maximum length of the field.
+ */
+static void append_sanitized(tstring &filename, const char *str, size_t len)
+{
+	string field(str, strnlen(str, len));
+	const size_t first = field.find_first_not_of(' ');
+	if (first == string::npos) {
+		filename += _T('_');
+		return;
+	}
+	field = field.substr(first, field.find_last_not_of(' ') - first + 1);
+
+	for (char chr : field) {
+		// NOTE: Non-ASCII characters are replaced, since the
+		// title's encoding depends on the region.
+		const unsigned char uchr = static_cast<unsigned char>(chr);
+		if (uchr < 0x20 || uchr >= 0x7F || strchr("/\\:*?\"<>|", chr)) {
+			filename += _T('_');
+		} else {
+			filename += static_cast<TCHAR>(chr);
+		}
+	}
+}
+
+/**
+ * Expand a filename template for a bank.
+ * - {bank}: Bank number.
+ * - {id6}: Game ID.
+ * - {title}: Game title.
+ * @param tmpl	[in] Filename template.
+ * @param bank	[in] Bank number. (0-based)
+ * @param entry	[in] Bank entry.
+ * @return Filename.
+ */
+static tstring expand_filename_template(const TCHAR *tmpl, unsigned int bank, const RvtH_BankEntry *entry)
+{
+	tstring filename;
+	for (const TCHAR *p = tmpl; *p != 0; p++) {
+		if (!_tcsncmp(p, _T("{bank}"), 6)) {
+			TCHAR buf[16];
+			_sntprintf(buf, ARRAY_SIZE(buf), _T("%u"), bank+1);
+			filename += buf;
+			p += 5;
+		} else if (!_tcsncmp(p, _T("{id6}"), 5)) {
+			append_sanitized(filename, entry->discHeader.id6, sizeof(entry->discHeader.id6));
+			p += 4;
+		} else if (!_tcsncmp(p, _T("{title}"), 7)) {
+			append_sanitized(filename, entry->discHeader.game_title, sizeof(entry->discHeader.game_title));
+			p += 6;
+		} else {
+			filename += *p;
+		}
+	}
+	return filename;
+}
+
+/**
+ * 'extract' command. (all banks)
+ * @param rvth		[in] RVT-H device or disk image.
+ * @param tmpl		[in] Filename template. (See expand_filename_template().)
+ * @param recrypt_key	[in] Key for recryption. (-1 for default)
+ * @param flags		[in] Flags. (See RvtH_Extract_Flags.)
+ * @param store_dir	[in,opt] Partition store directory. (Required for RVTH_EXTRACT_STORE_UPDATES.)
+ * @param json		[in] If true, print a JSON report instead of text.
+ * @param stats		[in] If true, print performance statistics when finished.
+ * @return 0 on success; non-zero on error.
+ */
+static int extract_all(RvtH *rvth, const TCHAR *tmpl,
+	int recrypt_key, unsigned int flags, const TCHAR *store_dir, bool json, bool stats)
+{
+	// Only banks with a disc image are extracted.
+	// The filenames must be unique, since the images are
+	// written by the same pass.
+	vector<RvtH_BankSummary> summaries;
+	const unsigned int bankCount = rvth->bankSummaries(summaries);
+	vector<tstring> filenames;
+	vector<unsigned int> banks;
+	filenames.reserve(bankCount);
+	banks.reserve(bankCount);
+	for (unsigned int bank = 0; bank < bankCount; bank++) {
+		const RvtH_BankSummary &summary = summaries[bank];
+		if (summary.is_deleted) {
+			continue;
+		}
+		switch (summary.type) {
+			case RVTH_BankType_GCN:
+			case RVTH_BankType_Wii_SL:
+			case RVTH_BankType_Wii_DL:
+				break;
+			default:
+				continue;
+		}
+
+		tstring filename = expand_filename_template(tmpl, bank,
+			rvth->bankEntry(bank, nullptr, RVTH_BANK_INIT_HEADER));
+		for (const tstring &prev : filenames) {
+			if (prev == filename) {
+				_ftprintf(stderr, _T("*** ERROR: Filename template '%s' gives the same filename for more than one bank.\n"), tmpl);
+				_ftprintf(stderr, _T("Use {bank} in the template to make the filenames unique.\n"));
+				return -EINVAL;
+			}
+		}
+		filenames.emplace_back(std::move(filename));
+		banks.push_back(bank);
+	}
+	if (banks.empty()) {
+		fputs("*** ERROR: There are no banks to extract.\n", stderr);
+		return -ENOENT;
+	}
+
+	vector<RvtH_Extract_Job> jobs(banks.size());
+	for (size_t i = 0; i < jobs.size(); i++) {
+		jobs[i].bank = banks[i];
+		jobs[i].filename = filenames[i].c_str();
+		jobs[i].result = 0;
+	}
+
+	if (!json) {
+		_tprintf(_T("Extracting %u bank(s)...\n"), static_cast<unsigned int>(jobs.size()));
+	}
+	const int ret = rvth->extractBanks(jobs.data(), static_cast<unsigned int>(jobs.size()),
+		recrypt_key, flags, json ? json_progress_callback : progress_callback, nullptr, store_dir);
+
+	// Print the results.
+	if (!json) {
+		putchar('\n');
+	}
+	for (const RvtH_Extract_Job &job : jobs) {
+		if (json) {
+			printf("{\"type\":\"extract\",\"bank\":%u,\"image\":", job.bank+1);
+			json_print_string(stdout, job.filename);
+			if (job.result == 0) {
+				printf(",\"status\":\"ok\",\"size\":%llu",
+					static_cast<unsigned long long>(LBA_TO_BYTES(static_cast<uint64_t>(summaries[job.bank].lba_len))));
+			} else {
+				printf(",\"status\":\"error\",\"code\":%d,\"message\":", job.result);
+				json_print_string(stdout, rvth_error(job.result));
+			}
+			fputs("}\n", stdout);
+		} else if (job.result == 0) {
+			_tprintf(_T("Bank %u extracted to '%s' successfully.\n"), job.bank+1, job.filename);
+		} else {
+			_ftprintf(stderr, _T("*** ERROR: Extracting Bank %u to '%s' failed: "), job.bank+1, job.filename);
+			fputs(rvth_error(job.result), stderr);
+			_fputtc(_T('\n'), stderr);
+		}
+	}
+	if (stats) {
+		print_stats(rvth);
+	}
+	print_read_latency(rvth);
+	return ret;
+}
+
 /**
  * 'extract' command.
  * @param rvth_filename	[in] RVT-H device or disk image filename.
  * @param s_bank	[in] Bank number (as a string). (If NULL, assumes bank 1.)
- * @param gcm_filename	[in] Filename for the extracted GCM image.
+ * @param gcm_filename	[in] Filename for the extracted GCM image. ("-" for stdout)
  * @param recrypt_key	[in] Key for recryption. (-1 for default)
  * @param flags		[in] Flags. (See RvtH_Extract_Flags.)
+ * @param store_dir	[in,opt] Partition store directory. (Required for RVTH_EXTRACT_STORE_UPDATES.)
+ * @param base_filename	[in,opt] Base image for delta extraction.
+ * @param copy_params	[in] Copy buffer parameters.
+ * @param json		[in] If true, print a JSON report instead of text.
+ * @param stats		[in] If true, print performance statistics when finished.
  * @return 0 on success; non-zero on error.
  */
-int extract(const TCHAR *rvth_filename, const TCHAR *s_bank, const TCHAR *gcm_filename, int recrypt_key, unsigned int flags)
+int extract(const TCHAR *rvth_filename, const TCHAR *s_bank, const TCHAR *gcm_filename,
+	int recrypt_key, unsigned int flags, const TCHAR *store_dir, const TCHAR *base_filename,
+	const RvtH_CopyParams *copy_params, bool json, bool stats)
 {
 	// Open the RVT-H device or disk image.
 	int ret;
@@ -89,6 +327,35 @@ int extract(const TCHAR *rvth_filename, const TCHAR *s_bank, const TCHAR *gcm_fi
 		return ret;
 	}
 
+	// Set the copy buffer parameters.
+	ret = rvth->setCopyParams(copy_params);
+	if (ret != 0) {
+		fputs("*** ERROR: Invalid copy buffer parameters.\n", stderr);
+		delete rvth;
+		return ret;
+	}
+	rvth->setProgressParams(&progress_params);
+
+	// "-" streams the disc image to stdout, e.g. to pipe it into a compressor,
+	// so all messages are printed to stderr.
+	const bool to_stdout = !_tcscmp(gcm_filename, _T("-"));
+
+	if (s_bank && !_tcsicmp(s_bank, _T("all"))) {
+		// Extract all banks.
+		// gcm_filename is a template.
+		if (to_stdout) {
+			fputs("*** ERROR: All banks can't be extracted to standard output.\n", stderr);
+			ret = -EINVAL;
+		} else if (base_filename) {
+			fputs("*** ERROR: --base can't be used when extracting all banks.\n", stderr);
+			ret = -EINVAL;
+		} else {
+			ret = extract_all(rvth, gcm_filename, recrypt_key, flags, store_dir, json, stats);
+		}
+		delete rvth;
+		return ret;
+	}
+
 	unsigned int bank;
 	if (s_bank) {
 		// Validate the bank number.
@@ -112,13 +379,68 @@ int extract(const TCHAR *rvth_filename, const TCHAR *s_bank, const TCHAR *gcm_fi
 		bank = 0;
 	}
 
+	if (to_stdout) {
+		if (json) {
+			fputs("*** ERROR: --json can't be used when extracting to standard output.\n", stderr);
+			delete rvth;
+			return -EINVAL;
+		}
+
+		fprintf(stderr, "Extracting Bank %u to standard output...\n", bank+1);
+		ret = rvth->extract(bank, gcm_filename, recrypt_key, flags, progress_callback, stderr, store_dir, base_filename);
+		if (ret == 0) {
+			fprintf(stderr, "Bank %u extracted successfully.\n", bank+1);
+		} else {
+			fprintf(stderr, "*** ERROR: rvth_extract() failed: %s\n", rvth_error(ret));
+		}
+
+		if (stats) {
+			print_stats(rvth);
+		}
+		print_read_latency(rvth);
+		delete rvth;
+		return ret;
+	}
+
+	if (json) {
+		// Print a single JSON object when finished.
+		RvtH_Image_Digests digests;
+		memset(&digests, 0, sizeof(digests));
+		ret = rvth->extract(bank, gcm_filename, recrypt_key, flags, json_progress_callback, &digests, store_dir, base_filename);
+
+		printf("{\"type\":\"extract\",\"bank\":%u,\"image\":", bank+1);
+		json_print_string(stdout, gcm_filename);
+		if (ret == 0) {
+			const RvtH_BankEntry *const entry = rvth->bankEntry(bank);
+			printf(",\"status\":\"ok\",\"size\":%llu",
+				(entry ? static_cast<unsigned long long>(LBA_TO_BYTES(static_cast<uint64_t>(entry->lba_len))) : 0ULL));
+			if (flags & RVTH_EXTRACT_DIGESTS) {
+				printf(",\"digests\":{\"crc32\":\"%08x\",\"md5\":", digests.crc32);
+				json_print_hex(digests.md5, sizeof(digests.md5));
+				fputs(",\"sha1\":", stdout);
+				json_print_hex(digests.sha1, sizeof(digests.sha1));
+				putchar('}');
+			}
+		} else {
+			printf(",\"status\":\"error\",\"code\":%d,\"message\":", ret);
+			json_print_string(stdout, rvth_error(ret));
+		}
+		fputs("}\n", stdout);
+		if (stats) {
+			print_stats(rvth);
+		}
+		print_read_latency(rvth);
+		delete rvth;
+		return ret;
+	}
+
 	// Print the bank information.
 	// TODO: Make sure the bank type is valid before printing the newline.
 	print_bank(rvth, bank);
 	putchar('\n');
 
 	_tprintf(_T("Extracting Bank %u into '%s'...\n"), bank+1, gcm_filename);
-	ret = rvth->extract(bank, gcm_filename, recrypt_key, flags, progress_callback);
+	ret = rvth->extract(bank, gcm_filename, recrypt_key, flags, progress_callback, nullptr, store_dir, base_filename);
 	if (ret == 0) {
 		_tprintf(_T("Bank %u extracted to '%s' successfully.\n\n"), bank+1, gcm_filename);
 	} else {
@@ -126,6 +448,182 @@ int extract(const TCHAR *rvth_filename, const TCHAR *s_bank, const TCHAR *gcm_fi
 		fprintf(stderr, "*** ERROR: rvth_extract() failed: %s\n", rvth_error(ret));
 	}
 
+	if (stats) {
+		print_stats(rvth);
+	}
+	print_read_latency(rvth);
+	delete rvth;
+	return ret;
+}
+
+/**
+ * 'extract' command. (multiple destinations)
+ * The bank is read once and written to all of the destinations.
+ * @param rvth_filename	RVT-H device or disk image filename.
+ * @param s_bank	Bank number (as a string).
+ * @param gcm_filenames	Filenames for the extracted GCM images. ("-" for stdout)
+ * @param count		Number of destinations.
+ * @param flags		[in] Flags. (See RvtH_Extract_Flags.)
+ * @param copy_params	[in] Copy buffer parameters.
+ * @param stats		[in] If true, print performance statistics when finished.
+ * @return 0 on success; non-zero on error.
+ */
+int extract_tee(const TCHAR *rvth_filename, const TCHAR *s_bank, const TCHAR *const *gcm_filenames,
+	int count, unsigned int flags, const RvtH_CopyParams *copy_params, bool stats)
+{
+	// Open the RVT-H device or disk image.
+	int ret;
+	RvtH *const rvth = new RvtH(rvth_filename, &ret);
+	if (ret != 0 || !rvth->isOpen()) {
+		_ftprintf(stderr, _T("*** ERROR opening RVT-H device '%s': "), rvth_filename);
+		fputs(rvth_error(ret), stderr);
+		_fputtc(_T('\n'), stderr);
+		delete rvth;
+		return ret;
+	}
+
+	// Set the copy buffer parameters.
+	ret = rvth->setCopyParams(copy_params);
+	if (ret != 0) {
+		fputs("*** ERROR: Invalid copy buffer parameters.\n", stderr);
+		delete rvth;
+		return ret;
+	}
+	rvth->setProgressParams(&progress_params);
+
+	// Validate the bank number.
+	TCHAR *endptr;
+	const unsigned int bank = (unsigned int)_tcstoul(s_bank, &endptr, 10) - 1;
+	if (*endptr != 0 || bank > rvth->bankCount()) {
+		_ftprintf(stderr, _T("*** ERROR: Invalid bank number '%s'.\n"), s_bank);
+		delete rvth;
+		return -EINVAL;
+	}
+
+	// If one of the destinations is stdout, all messages are printed to stderr.
+	FILE *out = stdout;
+	for (int i = 0; i < count; i++) {
+		if (!_tcscmp(gcm_filenames[i], _T("-"))) {
+			out = stderr;
+			break;
+		}
+	}
+
+	_ftprintf(out, _T("Extracting Bank %u to %d destinations...\n"), bank+1, count);
+	vector<int> results(count);
+	ret = rvth->extractTee(bank, gcm_filenames, count, flags, progress_callback,
+		(out == stderr ? stderr : nullptr), results.data());
+
+	// Print the results.
+	for (int i = 0; i < count; i++) {
+		const TCHAR *const filename = (!_tcscmp(gcm_filenames[i], _T("-")) ? _T("standard output") : gcm_filenames[i]);
+		if (results[i] == 0) {
+			_ftprintf(out, _T("Bank %u extracted to '%s' successfully.\n"), bank+1, filename);
+		} else {
+			_ftprintf(stderr, _T("*** ERROR: Extracting Bank %u to '%s' failed: "), bank+1, filename);
+			fputs(rvth_error(results[i]), stderr);
+			_fputtc(_T('\n'), stderr);
+		}
+	}
+
+	if (stats) {
+		print_stats(rvth);
+	}
+	print_read_latency(rvth);
+	delete rvth;
+	return ret;
+}
+
+/**
+ * 'reconstruct' command.
+ * @param archive_filename	[in] Archived disc image filename. (Extracted using --update-store)
+ * @param gcm_filename		[in] Filename for the reconstructed GCM image.
+ * @param store_dir		[in] Partition store directory.
+ * @param copy_params		[in] Copy buffer parameters.
+ * @return 0 on success; non-zero on error.
+ */
+int reconstruct(const TCHAR *archive_filename, const TCHAR *gcm_filename,
+	const TCHAR *store_dir, const RvtH_CopyParams *copy_params)
+{
+	// Open the archived disc image.
+	int ret;
+	RvtH *const rvth = new RvtH(archive_filename, &ret);
+	if (ret != 0 || !rvth->isOpen()) {
+		_ftprintf(stderr, _T("*** ERROR opening disc image '%s': "), archive_filename);
+		fputs(rvth_error(ret), stderr);
+		_fputtc(_T('\n'), stderr);
+		delete rvth;
+		return ret;
+	}
+
+	// Set the copy buffer parameters.
+	ret = rvth->setCopyParams(copy_params);
+	if (ret != 0) {
+		fputs("*** ERROR: Invalid copy buffer parameters.\n", stderr);
+		delete rvth;
+		return ret;
+	}
+	rvth->setProgressParams(&progress_params);
+
+	_tprintf(_T("Reconstructing '%s' into '%s'...\n"), archive_filename, gcm_filename);
+	ret = rvth->reconstruct(gcm_filename, store_dir, progress_callback);
+	if (ret == 0) {
+		_tprintf(_T("'%s' reconstructed successfully.\n"), gcm_filename);
+	} else {
+		fprintf(stderr, "*** ERROR: rvth_reconstruct() failed: %s\n", rvth_error(ret));
+	}
+
+	delete rvth;
+	return ret;
+}
+
+/**
+ * 'convert' command.
+ * @param src_filename	[in] Source disc image filename.
+ * @param dest_filename	[in] Destination disc image filename. ("-" for stdout)
+ * @param flags		[in] Flags. (See RvtH_Extract_Flags.)
+ * @param copy_params	[in] Copy buffer parameters.
+ * @param stats		[in] If true, print performance statistics when finished.
+ * @return 0 on success; non-zero on error.
+ */
+int convert(const TCHAR *src_filename, const TCHAR *dest_filename,
+	unsigned int flags, const RvtH_CopyParams *copy_params, bool stats)
+{
+	// Open the source disc image.
+	int ret;
+	RvtH *const rvth = new RvtH(src_filename, &ret);
+	if (ret != 0 || !rvth->isOpen()) {
+		_ftprintf(stderr, _T("*** ERROR opening disc image '%s': "), src_filename);
+		fputs(rvth_error(ret), stderr);
+		_fputtc(_T('\n'), stderr);
+		delete rvth;
+		return ret;
+	}
+
+	// Set the copy buffer parameters.
+	ret = rvth->setCopyParams(copy_params);
+	if (ret != 0) {
+		fputs("*** ERROR: Invalid copy buffer parameters.\n", stderr);
+		delete rvth;
+		return ret;
+	}
+	rvth->setProgressParams(&progress_params);
+
+	// "-" streams the disc image to stdout,
+	// so all messages are printed to stderr.
+	FILE *const f = (!_tcscmp(dest_filename, _T("-")) ? stderr : stdout);
+	_ftprintf(f, _T("Converting '%s' into '%s'...\n"), src_filename, dest_filename);
+	ret = rvth->convert(dest_filename, flags, progress_callback, f);
+	if (ret == 0) {
+		_ftprintf(f, _T("'%s' converted successfully.\n"), src_filename);
+	} else {
+		fprintf(stderr, "*** ERROR: rvth_convert() failed: %s\n", rvth_error(ret));
+	}
+
+	if (stats) {
+		print_stats(rvth);
+	}
+	print_read_latency(rvth);
 	delete rvth;
 	return ret;
 }
@@ -136,9 +634,13 @@ int extract(const TCHAR *rvth_filename, const TCHAR *s_bank, const TCHAR *gcm_fi
  * @param s_bank	Bank number (as a string).
  * @param gcm_filename	Filename of the GCM image to import.
  * @param ios_force	IOS version to force. (-1 to use the existing IOS)
+ * @param flags		[in] Flags. (See RvtH_Import_Flags.)
+ * @param copy_params	[in] Copy buffer parameters.
+ * @param stats		[in] If true, print performance statistics when finished.
  * @return 0 on success; non-zero on error.
  */
-int import(const TCHAR *rvth_filename, const TCHAR *s_bank, const TCHAR *gcm_filename, int ios_force)
+int import(const TCHAR *rvth_filename, const TCHAR *s_bank, const TCHAR *gcm_filename,
+	int ios_force, unsigned int flags, const RvtH_CopyParams *copy_params, bool stats)
 {
 	// TODO: Verification for overwriting images.
 
@@ -153,6 +655,15 @@ int import(const TCHAR *rvth_filename, const TCHAR *s_bank, const TCHAR *gcm_fil
 		return ret;
 	}
 
+	// Set the copy buffer parameters.
+	ret = rvth->setCopyParams(copy_params);
+	if (ret != 0) {
+		fputs("*** ERROR: Invalid copy buffer parameters.\n", stderr);
+		delete rvth;
+		return ret;
+	}
+	rvth->setProgressParams(&progress_params);
+
 	// Validate the bank number.
 	TCHAR *endptr;
 	unsigned int bank = (unsigned int)_tcstoul(s_bank, &endptr, 10) - 1;
@@ -198,8 +709,18 @@ int import(const TCHAR *rvth_filename, const TCHAR *s_bank, const TCHAR *gcm_fil
 	}
 	delete rvth_src_tmp;
 
+	// Make sure the image can be imported before anything is written.
+	ret = rvth->checkImport(bank, gcm_filename, ios_force, flags);
+	if (ret != 0) {
+		_ftprintf(stderr, _T("*** ERROR: Cannot import '%s' into Bank %u: "), gcm_filename, bank+1);
+		fputs(rvth_error(ret), stderr);
+		_fputtc(_T('\n'), stderr);
+		delete rvth;
+		return ret;
+	}
+
 	_tprintf(_T("Importing '%s' into Bank %u...\n"), gcm_filename, bank+1);
-	ret = rvth->import(bank, gcm_filename, progress_callback, nullptr, ios_force);
+	ret = rvth->import(bank, gcm_filename, progress_callback, nullptr, ios_force, flags);
 	if (ret == 0) {
 		_tprintf(_T("'%s' imported to Bank %u successfully.\n"), gcm_filename, bank+1);
 	} else {
@@ -207,6 +728,361 @@ int import(const TCHAR *rvth_filename, const TCHAR *s_bank, const TCHAR *gcm_fil
 		fprintf(stderr, "*** ERROR: rvth_import() failed: %s\n", rvth_error(ret));
 	}
 
+	if (stats) {
+		print_stats(rvth);
+	}
+	print_read_latency(rvth);
+	delete rvth;
+	return ret;
+}
+
+/**
+ * RVT-H progress callback for importing multiple banks.
+ * Prints a header when the next image is started.
+ * @param state		[in] Current progress.
+ * @param userdata	[in] Import jobs, terminated by an entry with a NULL filename.
+ * @return True to continue; false to abort.
+ */
+static bool import_multi_progress_callback(const RvtH_Progress_State *state, void *userdata)
+{
+	if (state->type == RVTH_PROGRESS_IMPORT && state->lba_processed == 0) {
+		const RvtH_Import_Job *job = static_cast<const RvtH_Import_Job*>(userdata);
+		for (; job->filename != nullptr; job++) {
+			if (job->bank == state->bank_rvth) {
+				_tprintf(_T("\nImporting '%s' into Bank %u...\n"), job->filename, job->bank+1);
+				print_bank(state->rvth_gcm, 0);
+				putchar('\n');
+				break;
+			}
+		}
+	}
+	return progress_callback(state, nullptr);
+}
+
+/**
+ * 'import' command. (multiple banks)
+ * @param rvth_filename	RVT-H device or disk image filename.
+ * @param s_jobs	Import jobs, as "bank#=disc.gcm" strings.
+ * @param job_count	Number of import jobs.
+ * @param ios_force	IOS version to force. (-1 to use the existing IOS)
+ * @param flags		[in] Flags. (See RvtH_Import_Flags.)
+ * @param copy_params	[in] Copy buffer parameters.
+ * @param stats		[in] If true, print performance statistics when finished.
+ * @return 0 on success; non-zero on error.
+ */
+int import_multi(const TCHAR *rvth_filename, const TCHAR *const *s_jobs, int job_count,
+	int ios_force, unsigned int flags, const RvtH_CopyParams *copy_params, bool stats)
+{
+	// Open the RVT-H device or disk image.
+	int ret;
+	RvtH *const rvth = new RvtH(rvth_filename, &ret);
+	if (ret != 0 || !rvth->isOpen()) {
+		_ftprintf(stderr, _T("*** ERROR opening RVT-H device '%s': "), rvth_filename);
+		fputs(rvth_error(ret), stderr);
+		_fputtc(_T('\n'), stderr);
+		delete rvth;
+		return ret;
+	}
+
+	// Set the copy buffer parameters.
+	ret = rvth->setCopyParams(copy_params);
+	if (ret != 0) {
+		fputs("*** ERROR: Invalid copy buffer parameters.\n", stderr);
+		delete rvth;
+		return ret;
+	}
+	rvth->setProgressParams(&progress_params);
+
+	// Parse the jobs.
+	// The job list is terminated by an entry with a NULL filename
+	// for the progress callback.
+	vector<RvtH_Import_Job> jobs(job_count + 1);
+	for (int i = 0; i < job_count; i++) {
+		const TCHAR *const eq = _tcschr(s_jobs[i], _T('='));
+		TCHAR *endptr = nullptr;
+		unsigned int bank = UINT_MAX;
+		if (eq && eq != s_jobs[i] && eq[1] != 0) {
+			bank = (unsigned int)_tcstoul(s_jobs[i], &endptr, 10) - 1;
+		}
+		if (endptr != eq || bank >= rvth->bankCount()) {
+			_ftprintf(stderr, _T("*** ERROR: Invalid import job '%s'. (Expected bank#=disc.gcm)\n"), s_jobs[i]);
+			delete rvth;
+			return -EINVAL;
+		}
+		jobs[i].bank = bank;
+		jobs[i].filename = eq + 1;
+		jobs[i].result = 0;
+	}
+	jobs[job_count].filename = nullptr;
+
+	ret = rvth->importBanks(jobs.data(), job_count, import_multi_progress_callback, jobs.data(), ios_force, flags);
+
+	// Print the results.
+	putchar('\n');
+	for (int i = 0; i < job_count; i++) {
+		const RvtH_Import_Job *const job = &jobs[i];
+		if (job->result == 0) {
+			_tprintf(_T("'%s' imported to Bank %u successfully.\n"), job->filename, job->bank+1);
+		} else if (job->result == -ECANCELED) {
+			_tprintf(_T("'%s' was skipped.\n"), job->filename);
+		} else {
+			_ftprintf(stderr, _T("*** ERROR: Importing '%s' to Bank %u failed: "), job->filename, job->bank+1);
+			fputs(rvth_error(job->result), stderr);
+			_fputtc(_T('\n'), stderr);
+		}
+	}
+	if (ret != 0 && ret != -ECANCELED) {
+		// NOTE: If a job failed, this is the same error.
+		bool reported = false;
+		for (int i = 0; i < job_count; i++) {
+			if (jobs[i].result == ret) {
+				reported = true;
+				break;
+			}
+		}
+		if (!reported) {
+			fprintf(stderr, "*** ERROR: Unable to write the bank table: %s\n", rvth_error(ret));
+		}
+	}
+
+	if (stats) {
+		print_stats(rvth);
+	}
+	print_read_latency(rvth);
+	delete rvth;
+	return ret;
+}
+
+/**
+ * Progress of each bank for create_hdd().
+ */
+struct CreateHDDProgress {
+	uint32_t lba_processed[NHCD_BANK_COUNT];
+	uint32_t lba_total[NHCD_BANK_COUNT];
+	unsigned int job_count;
+	unsigned int jobs_done;
+};
+
+/**
+ * RVT-H progress callback for creating an HDD image.
+ * The banks are imported concurrently, so the total is printed.
+ * @param state		[in] Current progress.
+ * @param userdata	[in] CreateHDDProgress.
+ * @return True to continue; false to abort.
+ */
+static bool create_hdd_progress_callback(const RvtH_Progress_State *state, void *userdata)
+{
+	CreateHDDProgress *const progress = static_cast<CreateHDDProgress*>(userdata);
+	if (state->type != RVTH_PROGRESS_IMPORT || state->bank_rvth >= NHCD_BANK_COUNT) {
+		// Only the image data is counted.
+		return true;
+	}
+
+	progress->lba_processed[state->bank_rvth] = state->lba_processed;
+	progress->lba_total[state->bank_rvth] = state->lba_total;
+	if (state->lba_processed == state->lba_total) {
+		progress->jobs_done++;
+	}
+
+	uint32_t lba_processed = 0, lba_total = 0;
+	for (unsigned int i = 0; i < NHCD_BANK_COUNT; i++) {
+		lba_processed += progress->lba_processed[i];
+		lba_total += progress->lba_total[i];
+	}
+
+	#define MEGABYTE (1048576 / LBA_SIZE)
+	printf("\rImporting: %5u MiB / %5u MiB copied, %u / %u images done...",
+		lba_processed / MEGABYTE, lba_total / MEGABYTE,
+		progress->jobs_done, progress->job_count);
+	if (progress->jobs_done == progress->job_count) {
+		putchar('\n');
+	}
+	fflush(stdout);
+	return true;
+}
+
+/**
+ * 'create-hdd' command.
+ * @param rvth_filename	RVT-H disk image filename.
+ * @param gcm_filenames	Filenames of the disc images to import.
+ * @param gcm_count	Number of disc images.
+ * @param ios_force	IOS version to force. (-1 to use the existing IOS)
+ * @param flags		[in] Flags. (See RvtH_Import_Flags.)
+ * @param copy_params	[in] Copy buffer parameters.
+ * @param stats		[in] If true, print performance statistics when finished.
+ * @return 0 on success; non-zero on error.
+ */
+int create_hdd(const TCHAR *rvth_filename, const TCHAR *const *gcm_filenames, int gcm_count,
+	int ios_force, unsigned int flags, const RvtH_CopyParams *copy_params, bool stats)
+{
+	if (gcm_count > NHCD_BANK_COUNT) {
+		fprintf(stderr, "*** ERROR: An RVT-H disk image can't have more than %d banks.\n", NHCD_BANK_COUNT);
+		return -EINVAL;
+	}
+
+	// Create the RVT-H disk image.
+	int ret;
+	RvtH *const rvth = RvtH::createHDD(rvth_filename, &ret);
+	if (!rvth) {
+		_ftprintf(stderr, _T("*** ERROR creating RVT-H disk image '%s': "), rvth_filename);
+		fputs(rvth_error(ret), stderr);
+		_fputtc(_T('\n'), stderr);
+		return ret;
+	}
+
+	// Set the copy buffer parameters.
+	ret = rvth->setCopyParams(copy_params);
+	if (ret != 0) {
+		fputs("*** ERROR: Invalid copy buffer parameters.\n", stderr);
+		delete rvth;
+		return ret;
+	}
+	rvth->setProgressParams(&progress_params);
+
+	vector<RvtH_Import_Job> jobs(gcm_count);
+	for (int i = 0; i < gcm_count; i++) {
+		jobs[i].bank = RVTH_IMPORT_BANK_AUTO;
+		jobs[i].filename = gcm_filenames[i];
+		jobs[i].result = 0;
+	}
+
+	_tprintf(_T("Creating '%s' with %d disc image(s)...\n"), rvth_filename, gcm_count);
+	CreateHDDProgress progress;
+	memset(&progress, 0, sizeof(progress));
+	progress.job_count = gcm_count;
+	ret = rvth->importBanksParallel(jobs.data(), gcm_count, create_hdd_progress_callback, &progress, ios_force, flags);
+
+	// Print the results.
+	putchar('\n');
+	for (int i = 0; i < gcm_count; i++) {
+		const RvtH_Import_Job *const job = &jobs[i];
+		if (job->result == 0) {
+			_tprintf(_T("'%s' imported to Bank %u successfully.\n"), job->filename, job->bank+1);
+		} else if (job->result == -ECANCELED) {
+			_tprintf(_T("'%s' was skipped.\n"), job->filename);
+		} else if (job->bank == RVTH_IMPORT_BANK_AUTO) {
+			_ftprintf(stderr, _T("*** ERROR: Importing '%s' failed: "), job->filename);
+			fputs(rvth_error(job->result), stderr);
+			_fputtc(_T('\n'), stderr);
+		} else {
+			_ftprintf(stderr, _T("*** ERROR: Importing '%s' to Bank %u failed: "), job->filename, job->bank+1);
+			fputs(rvth_error(job->result), stderr);
+			_fputtc(_T('\n'), stderr);
+		}
+	}
+	if (ret != 0 && ret != -ECANCELED) {
+		// NOTE: If a job failed, this is the same error.
+		bool reported = false;
+		for (int i = 0; i < gcm_count; i++) {
+			if (jobs[i].result == ret) {
+				reported = true;
+				break;
+			}
+		}
+		if (!reported) {
+			fprintf(stderr, "*** ERROR: Unable to write the bank table: %s\n", rvth_error(ret));
+		}
+	}
+
+	if (stats) {
+		print_stats(rvth);
+	}
+	print_read_latency(rvth);
+	delete rvth;
+	return ret;
+}
+
+/**
+ * RVT-H progress callback for cloning.
+ * Prints a header when the next bank is started.
+ * @param state		[in] Current progress.
+ * @param userdata	[in] User data specified when calling the RVT-H function.
+ * @return True to continue; false to abort.
+ */
+static bool clone_progress_callback(const RvtH_Progress_State *state, void *userdata)
+{
+	UNUSED(userdata);
+	if (state->type == RVTH_PROGRESS_IMPORT) {
+		if (state->lba_processed == 0) {
+			_tprintf(_T("\nCopying Bank %u...\n"), state->bank_rvth+1);
+		}
+		return progress_callback(state, nullptr);
+	}
+
+	assert(state->type == RVTH_PROGRESS_COMPARE);
+	if (state->lba_processed == 0) {
+		_tprintf(_T("\nComparing Bank %u with the source...\n"), state->bank_rvth+1);
+	}
+	printf("\rComparing: %4u MiB / %4u MiB compared...",
+		state->lba_processed / MEGABYTE,
+		state->lba_total / MEGABYTE);
+	print_progress_rate(stdout, state);
+	if (state->lba_processed == state->lba_total) {
+		// Finished processing.
+		putchar('\n');
+	}
+	fflush(stdout);
+	return true;
+}
+
+/**
+ * 'clone' command.
+ * @param src_filename	[in] Source RVT-H device or disk image filename.
+ * @param dest_filename	[in] Destination RVT-H device or disk image filename.
+ * @param flags		[in] Flags. (See RvtH_Import_Flags.)
+ * @param copy_params	[in] Copy buffer parameters.
+ * @param stats		[in] If true, print performance statistics when finished.
+ * @return 0 on success; non-zero on error.
+ */
+int clone_hdd(const TCHAR *src_filename, const TCHAR *dest_filename,
+	unsigned int flags, const RvtH_CopyParams *copy_params, bool stats)
+{
+	// Open the RVT-H devices or disk images.
+	int ret;
+	RvtH *const rvth = new RvtH(src_filename, &ret);
+	if (ret != 0 || !rvth->isOpen()) {
+		_ftprintf(stderr, _T("*** ERROR opening RVT-H device '%s': "), src_filename);
+		fputs(rvth_error(ret), stderr);
+		_fputtc(_T('\n'), stderr);
+		delete rvth;
+		return ret;
+	}
+	RvtH *const rvth_dest = new RvtH(dest_filename, &ret);
+	if (ret != 0 || !rvth_dest->isOpen()) {
+		_ftprintf(stderr, _T("*** ERROR opening RVT-H device '%s': "), dest_filename);
+		fputs(rvth_error(ret), stderr);
+		_fputtc(_T('\n'), stderr);
+		delete rvth_dest;
+		delete rvth;
+		return ret;
+	}
+
+	// Set the copy buffer parameters.
+	ret = rvth->setCopyParams(copy_params);
+	if (ret == 0) {
+		ret = rvth_dest->setCopyParams(copy_params);
+	}
+	if (ret != 0) {
+		fputs("*** ERROR: Invalid copy buffer parameters.\n", stderr);
+		delete rvth_dest;
+		delete rvth;
+		return ret;
+	}
+	rvth->setProgressParams(&progress_params);
+
+	_tprintf(_T("Cloning '%s' to '%s'...\n"), src_filename, dest_filename);
+	ret = rvth->cloneHDD(rvth_dest, flags, clone_progress_callback, nullptr);
+	if (ret == 0) {
+		_tprintf(_T("\n'%s' cloned to '%s' successfully.\n"), src_filename, dest_filename);
+	} else {
+		fprintf(stderr, "*** ERROR: Cloning failed: %s\n", rvth_error(ret));
+	}
+
+	if (stats) {
+		print_stats(rvth);
+	}
+	print_read_latency(rvth);
+	delete rvth_dest;
 	delete rvth;
 	return ret;
 }
@@ -2,7 +2,7 @@
  * RVT-H Tool                                                              *
  * extract.h: Extract a bank from an RVT-H disk image.                     *
  *                                                                         *
- * Copyright (c) 2018-2020 by David Korth.                                 *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
@@ -10,6 +10,7 @@
 #define __RVTHTOOL_RVTHTOOL_EXTRACT_H__
 
 #include "tcharx.h"
+#include "librvth/rvth.hpp"
 
 #ifdef __cplusplus
 extern "C" {
@@ -18,13 +19,58 @@ extern "C" {
 /**
  * 'extract' command.
  * @param rvth_filename	RVT-H device or disk image filename.
- * @param s_bank	Bank number (as a string). (If NULL, assumes bank 1.)
- * @param gcm_filename	Filename for the extracted GCM image.
+ * @param s_bank	Bank number (as a string). (If NULL, assumes bank 1; if "all", extracts all banks.)
+ * @param gcm_filename	Filename for the extracted GCM image. (Template if s_bank is "all"; "-" for stdout)
  * @param recrypt_key	[in] Key for recryption. (-1 for default)
  * @param flags		[in] Flags. (See RvtH_Extract_Flags.)
+ * @param store_dir	[in,opt] Partition store directory. (Required for RVTH_EXTRACT_STORE_UPDATES.)
+ * @param base_filename	[in,opt] Base image for delta extraction.
+ * @param copy_params	[in] Copy buffer parameters.
+ * @param json		[in] If true, print a JSON report instead of text.
+ * @param stats		[in] If true, print performance statistics when finished.
  * @return 0 on success; non-zero on error.
  */
-int extract(const TCHAR *rvth_filename, const TCHAR *s_bank, const TCHAR *gcm_filename, int recrypt_key, unsigned int flags);
+int extract(const TCHAR *rvth_filename, const TCHAR *s_bank, const TCHAR *gcm_filename,
+	int recrypt_key, unsigned int flags, const TCHAR *store_dir, const TCHAR *base_filename,
+	const RvtH_CopyParams *copy_params, bool json, bool stats);
+
+/**
+ * 'extract' command. (multiple destinations)
+ * The bank is read once and written to all of the destinations.
+ * @param rvth_filename	RVT-H device or disk image filename.
+ * @param s_bank	Bank number (as a string).
+ * @param gcm_filenames	Filenames for the extracted GCM images. ("-" for stdout)
+ * @param count		Number of destinations.
+ * @param flags		[in] Flags. (See RvtH_Extract_Flags.)
+ * @param copy_params	[in] Copy buffer parameters.
+ * @param stats		[in] If true, print performance statistics when finished.
+ * @return 0 on success; non-zero on error.
+ */
+int extract_tee(const TCHAR *rvth_filename, const TCHAR *s_bank, const TCHAR *const *gcm_filenames,
+	int count, unsigned int flags, const RvtH_CopyParams *copy_params, bool stats);
+
+/**
+ * 'reconstruct' command.
+ * @param archive_filename	[in] Archived disc image filename. (Extracted using --update-store)
+ * @param gcm_filename		[in] Filename for the reconstructed GCM image.
+ * @param store_dir		[in] Partition store directory.
+ * @param copy_params		[in] Copy buffer parameters.
+ * @return 0 on success; non-zero on error.
+ */
+int reconstruct(const TCHAR *archive_filename, const TCHAR *gcm_filename,
+	const TCHAR *store_dir, const RvtH_CopyParams *copy_params);
+
+/**
+ * 'convert' command.
+ * @param src_filename	[in] Source disc image filename.
+ * @param dest_filename	[in] Destination disc image filename. ("-" for stdout)
+ * @param flags		[in] Flags. (See RvtH_Extract_Flags.)
+ * @param copy_params	[in] Copy buffer parameters.
+ * @param stats		[in] If true, print performance statistics when finished.
+ * @return 0 on success; non-zero on error.
+ */
+int convert(const TCHAR *src_filename, const TCHAR *dest_filename,
+	unsigned int flags, const RvtH_CopyParams *copy_params, bool stats);
 
 /**
  * 'import' command.
@@ -32,9 +78,53 @@ int extract(const TCHAR *rvth_filename, const TCHAR *s_bank, const TCHAR *gcm_fi
  * @param s_bank	Bank number (as a string).
  * @param gcm_filename	Filename of the GCM image to import.
  * @param ios_force	IOS version to force. (-1 to use the existing IOS)
+ * @param flags		[in] Flags. (See RvtH_Import_Flags.)
+ * @param copy_params	[in] Copy buffer parameters.
+ * @param stats		[in] If true, print performance statistics when finished.
+ * @return 0 on success; non-zero on error.
+ */
+int import(const TCHAR *rvth_filename, const TCHAR *s_bank, const TCHAR *gcm_filename,
+	int ios_force, unsigned int flags, const RvtH_CopyParams *copy_params, bool stats);
+
+/**
+ * 'import' command. (multiple banks)
+ * @param rvth_filename	RVT-H device or disk image filename.
+ * @param s_jobs	Import jobs, as "bank#=disc.gcm" strings.
+ * @param job_count	Number of import jobs.
+ * @param ios_force	IOS version to force. (-1 to use the existing IOS)
+ * @param flags		[in] Flags. (See RvtH_Import_Flags.)
+ * @param copy_params	[in] Copy buffer parameters.
+ * @param stats		[in] If true, print performance statistics when finished.
+ * @return 0 on success; non-zero on error.
+ */
+int import_multi(const TCHAR *rvth_filename, const TCHAR *const *s_jobs, int job_count,
+	int ios_force, unsigned int flags, const RvtH_CopyParams *copy_params, bool stats);
+
+/**
+ * 'create-hdd' command.
+ * @param rvth_filename	RVT-H disk image filename.
+ * @param gcm_filenames	Filenames of the disc images to import.
+ * @param gcm_count	Number of disc images.
+ * @param ios_force	IOS version to force. (-1 to use the existing IOS)
+ * @param flags		[in] Flags. (See RvtH_Import_Flags.)
+ * @param copy_params	[in] Copy buffer parameters.
+ * @param stats		[in] If true, print performance statistics when finished.
+ * @return 0 on success; non-zero on error.
+ */
+int create_hdd(const TCHAR *rvth_filename, const TCHAR *const *gcm_filenames, int gcm_count,
+	int ios_force, unsigned int flags, const RvtH_CopyParams *copy_params, bool stats);
+
+/**
+ * 'clone' command.
+ * @param src_filename	[in] Source RVT-H device or disk image filename.
+ * @param dest_filename	[in] Destination RVT-H device or disk image filename.
+ * @param flags		[in] Flags. (See RvtH_Import_Flags.)
+ * @param copy_params	[in] Copy buffer parameters.
+ * @param stats		[in] If true, print performance statistics when finished.
  * @return 0 on success; non-zero on error.
  */
-int import(const TCHAR *rvth_filename, const TCHAR *s_bank, const TCHAR *gcm_filename, int ios_force);
+int clone_hdd(const TCHAR *src_filename, const TCHAR *dest_filename,
+	unsigned int flags, const RvtH_CopyParams *copy_params, bool stats);
 
 #ifdef __cplusplus
 }
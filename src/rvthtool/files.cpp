@@ -0,0 +1,188 @@
+/***************************************************************************
+ * RVT-H Tool                                                              *
+ * files.cpp: List or extract files in a bank's filesystem.                *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "files.h"
+#include "librvth/rvth.hpp"
+#include "librvth/rvth_error.h"
+#include "librvth/nhcd_structs.h"
+#include "stats.hpp"
+
+#ifdef _WIN32
+#  include <windows.h>
+#endif /* _WIN32 */
+
+// C includes (C++ namespace)
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+// C++ includes
+#include <string>
+#include <vector>
+using std::string;
+using std::vector;
+
+/**
+ * Open an RVT-H device or disk image and validate the bank number.
+ * @param rvth_filename	[in] RVT-H device or disk image filename.
+ * @param s_bank	[in,opt] Bank number (as a string). (If NULL, assumes bank 1.)
+ * @param pBank		[out] Bank number. (0-based)
+ * @param pRet		[out] Error code.
+ * @return RvtH object, or nullptr on error.
+ */
+static RvtH *open_bank(const TCHAR *rvth_filename, const TCHAR *s_bank, unsigned int *pBank, int *pRet)
+{
+	int ret;
+	RvtH *const rvth = new RvtH(rvth_filename, &ret);
+	if (ret != 0 || !rvth->isOpen()) {
+		_ftprintf(stderr, _T("*** ERROR opening RVT-H device '%s': "), rvth_filename);
+		fputs(rvth_error(ret), stderr);
+		_fputtc(_T('\n'), stderr);
+		delete rvth;
+		*pRet = ret;
+		return nullptr;
+	}
+
+	if (s_bank) {
+		// Validate the bank number.
+		TCHAR *endptr;
+		const unsigned int bank = (unsigned int)_tcstoul(s_bank, &endptr, 10) - 1;
+		if (*endptr != 0 || bank >= rvth->bankCount()) {
+			_ftprintf(stderr, _T("*** ERROR: Invalid bank number '%s'.\n"), s_bank);
+			delete rvth;
+			*pRet = -EINVAL;
+			return nullptr;
+		}
+		*pBank = bank;
+	} else {
+		// No bank number specified.
+		// Assume 1 bank if this is a standalone disc image.
+		// For HDD images or RVT-H Readers, this is an error.
+		if (rvth->bankCount() != 1) {
+			_ftprintf(stderr, _T("*** ERROR: Must specify a bank number for this RVT-H Reader%s.\n"),
+				rvth->isHDD() ? _T("") : _T(" disk image"));
+			delete rvth;
+			*pRet = -EINVAL;
+			return nullptr;
+		}
+		*pBank = 0;
+	}
+
+	*pRet = 0;
+	return rvth;
+}
+
+/**
+ * 'list-files' command.
+ * @param rvth_filename	RVT-H device or disk image filename.
+ * @param s_bank	Bank number (as a string). (If NULL, assumes bank 1.)
+ * @return 0 on success; non-zero on error.
+ */
+int list_files(const TCHAR *rvth_filename, const TCHAR *s_bank)
+{
+	int ret;
+	unsigned int bank;
+	RvtH *const rvth = open_bank(rvth_filename, s_bank, &bank, &ret);
+	if (!rvth) {
+		return ret;
+	}
+
+	vector<RvtH_FST_File> files;
+	ret = rvth->listFiles(bank, files);
+	if (ret != 0) {
+		fprintf(stderr, "*** ERROR: Unable to read the filesystem of Bank %u: %s\n", bank+1, rvth_error(ret));
+		delete rvth;
+		return ret;
+	}
+
+	for (const RvtH_FST_File &file : files) {
+		if (file.is_dir) {
+			printf("%12s  %s\n", "<DIR>", file.path.c_str());
+		} else {
+			printf("%12llu  %s\n", static_cast<unsigned long long>(file.size), file.path.c_str());
+		}
+	}
+
+	delete rvth;
+	return 0;
+}
+
+/**
+ * RVT-H progress callback for extracting a file.
+ * @param state		[in] Current progress.
+ * @param userdata	[in] FILE* to print progress to.
+ * @return True to continue; false to abort.
+ */
+static bool progress_callback(const RvtH_Progress_State *state, void *userdata)
+{
+	FILE *const f = static_cast<FILE*>(userdata);
+
+	#define MEGABYTE (1048576 / LBA_SIZE)
+	fprintf(f, "\rExtracting: %4u MiB / %4u MiB copied...",
+		state->lba_processed / MEGABYTE,
+		state->lba_total / MEGABYTE);
+	print_progress_rate(f, state);
+	if (state->lba_processed == state->lba_total) {
+		// Finished processing.
+		fputc('\n', f);
+	}
+	fflush(f);
+	return true;
+}
+
+/**
+ * 'extract-file' command.
+ * @param rvth_filename	RVT-H device or disk image filename.
+ * @param s_bank	Bank number (as a string). (If NULL, assumes bank 1.)
+ * @param path		Path of the file in the bank's filesystem.
+ * @param out_filename	Output filename. ("-" for stdout)
+ * @return 0 on success; non-zero on error.
+ */
+int extract_file(const TCHAR *rvth_filename, const TCHAR *s_bank,
+	const TCHAR *path, const TCHAR *out_filename)
+{
+	int ret;
+	unsigned int bank;
+	RvtH *const rvth = open_bank(rvth_filename, s_bank, &bank, &ret);
+	if (!rvth) {
+		return ret;
+	}
+
+#ifdef _WIN32
+	// FST paths are 8-bit strings.
+	string s_path;
+	const int len = WideCharToMultiByte(CP_UTF8, 0, path, -1, nullptr, 0, nullptr, nullptr);
+	if (len > 0) {
+		s_path.resize(len);
+		WideCharToMultiByte(CP_UTF8, 0, path, -1, &s_path[0], len, nullptr, nullptr);
+		s_path.resize(len - 1);
+	}
+#else /* !_WIN32 */
+	const string s_path(path);
+#endif /* _WIN32 */
+
+	// "-" writes the file to stdout, so all messages are printed to stderr.
+	const bool to_stdout = !_tcscmp(out_filename, _T("-"));
+	FILE *const f_msg = (to_stdout ? stderr : stdout);
+	_ftprintf(f_msg, _T("Extracting '%s' from Bank %u into '%s'...\n"),
+		path, bank+1, to_stdout ? _T("(stdout)") : out_filename);
+
+	ret = rvth->extractFile(bank, s_path.c_str(), out_filename, progress_callback, f_msg);
+	if (ret == 0) {
+		_ftprintf(f_msg, _T("'%s' extracted successfully.\n"), path);
+	} else if (ret == -ENOENT) {
+		_ftprintf(stderr, _T("*** ERROR: '%s' was not found in Bank %u.\n"), path, bank+1);
+	} else if (ret == -EISDIR) {
+		_ftprintf(stderr, _T("*** ERROR: '%s' is a directory.\n"), path);
+	} else {
+		fprintf(stderr, "*** ERROR: rvth_extract_file() failed: %s\n", rvth_error(ret));
+	}
+
+	delete rvth;
+	return ret;
+}
@@ -0,0 +1,41 @@
+/***************************************************************************
+ * RVT-H Tool                                                              *
+ * files.h: List or extract files in a bank's filesystem.                  *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_RVTHTOOL_FILES_H__
+#define __RVTHTOOL_RVTHTOOL_FILES_H__
+
+#include "tcharx.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 'list-files' command.
+ * @param rvth_filename	RVT-H device or disk image filename.
+ * @param s_bank	Bank number (as a string). (If NULL, assumes bank 1.)
+ * @return 0 on success; non-zero on error.
+ */
+int list_files(const TCHAR *rvth_filename, const TCHAR *s_bank);
+
+/**
+ * 'extract-file' command.
+ * @param rvth_filename	RVT-H device or disk image filename.
+ * @param s_bank	Bank number (as a string). (If NULL, assumes bank 1.)
+ * @param path		Path of the file in the bank's filesystem.
+ * @param out_filename	Output filename. ("-" for stdout)
+ * @return 0 on success; non-zero on error.
+ */
+int extract_file(const TCHAR *rvth_filename, const TCHAR *s_bank,
+	const TCHAR *path, const TCHAR *out_filename);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_RVTHTOOL_FILES_H__ */
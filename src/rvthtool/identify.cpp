@@ -0,0 +1,220 @@
+/***************************************************************************
+ * RVT-H Tool                                                              *
+ * identify.cpp: Identify banks using a DAT file.                          *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "identify.h"
+
+#include "librvth/rvth.hpp"
+#include "librvth/rvth_error.h"
+#include "librvth/nhcd_structs.h"
+#include "librvth/DatIndex.hpp"
+#include "stats.hpp"
+
+// C includes (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+// C++ includes
+#include <memory>
+using std::unique_ptr;
+
+// DAT file loaded using --dat. (nullptr if not specified)
+static unique_ptr<DatIndex> s_datIndex;
+
+/**
+ * Load a DAT file for identifying disc images. (--dat)
+ * Digests printed by extract and import are matched against it.
+ * @param dat_filename	DAT filename.
+ * @return 0 on success; negative POSIX error code on error. (An error message is printed.)
+ */
+int load_dat_file(const TCHAR *dat_filename)
+{
+	unique_ptr<DatIndex> datIndex(new DatIndex());
+	const int ret = datIndex->load(dat_filename);
+	if (ret != 0) {
+		_ftprintf(stderr, _T("*** ERROR loading DAT file '%s': "), dat_filename);
+		if (ret == -EBADMSG) {
+			fputs("No ROM entries with CRC32 or SHA-1 digests were found.\n", stderr);
+		} else {
+			fputs(strerror(-ret), stderr);
+			fputc('\n', stderr);
+		}
+		return ret;
+	}
+
+	s_datIndex = std::move(datIndex);
+	return 0;
+}
+
+/**
+ * Print the DAT entry that matches a disc image's digests.
+ * Nothing is printed if a DAT file wasn't loaded.
+ * @param f		File to print to.
+ * @param digests	Disc image digests.
+ * @param size		Disc image size, in bytes.
+ * @return True if the digests matched a DAT entry; false if not.
+ */
+bool print_dat_match(FILE *f, const RvtH_Image_Digests *digests, uint64_t size)
+{
+	if (!s_datIndex) {
+		return false;
+	}
+
+	DatIndex::Match match;
+	switch (s_datIndex->find(digests, size, &match)) {
+		case DatIndex::MATCH_SHA1:
+			fprintf(f, "DAT:   %s (%s)\n", match.title, match.rom_name);
+			return true;
+		case DatIndex::MATCH_CRC32:
+			fprintf(f, "DAT:   %s (%s) [CRC32 only]\n", match.title, match.rom_name);
+			return true;
+		case DatIndex::MATCH_NONE:
+		default:
+			fputs("DAT:   No match.\n", f);
+			return false;
+	}
+}
+
+/**
+ * Progress callback for identifying.
+ * @param state		[in] Current progress.
+ * @param userdata	[in] User data specified when calling the RVT-H function.
+ * @return True to continue; false to abort.
+ */
+static bool identify_progress_callback(const RvtH_Progress_State *state, void *userdata)
+{
+	UNUSED(userdata);
+	assert(state->type == RVTH_PROGRESS_IDENTIFY);
+
+	#define MEGABYTE (1048576 / LBA_SIZE)
+	printf("\rHashing: %4u MiB / %4u MiB hashed...",
+		state->lba_processed / MEGABYTE,
+		state->lba_total / MEGABYTE);
+	print_progress_rate(stdout, state);
+
+	if (state->lba_processed == state->lba_total) {
+		// Finished processing.
+		putchar('\n');
+	}
+	fflush(stdout);
+	return true;
+}
+
+/**
+ * Identify a single bank.
+ * @param rvth	[in] RvtH object
+ * @param bank	[in] Bank number (0-7)
+ * @return 0 if the bank was identified; 1 if it didn't match; negative POSIX error code or RvtH_Errors code on error.
+ */
+static int identify_bank(RvtH *rvth, unsigned int bank)
+{
+	const RvtH_BankEntry *const entry = rvth->bankEntry(bank);
+	printf("Bank %u: %.6s %.64s\n", bank+1, entry->discHeader.id6, entry->discHeader.game_title);
+
+	RvtH_Image_Digests digests;
+	int ret = rvth->digestBank(bank, &digests, identify_progress_callback, nullptr);
+	if (ret != 0) {
+		printf("*** ERROR hashing bank %u: ", bank+1);
+		puts(rvth_error(ret));
+		return ret;
+	}
+
+	printf("CRC32: %08x\n", digests.crc32);
+	fputs("SHA-1: ", stdout);
+	for (size_t i = 0; i < sizeof(digests.sha1); i++) {
+		printf("%02x", digests.sha1[i]);
+	}
+	putchar('\n');
+	return (print_dat_match(stdout, &digests, LBA_TO_BYTES(static_cast<uint64_t>(entry->lba_len))) ? 0 : 1);
+}
+
+/**
+ * 'identify' command.
+ * Requires a DAT file. (See load_dat_file().)
+ * @param rvth_filename	RVT-H device or disk image filename.
+ * @param s_bank	Bank number (as a string), or "all". (If NULL, all banks are identified.)
+ * @param copy_params	Copy buffer and I/O parameters.
+ * @param stats		If true, print performance statistics when finished.
+ * @return 0 if all banks were identified; 1 if any bank didn't match; negative on error.
+ */
+int identify(const TCHAR *rvth_filename, const TCHAR *s_bank,
+	const RvtH_CopyParams *copy_params, bool stats)
+{
+	if (!s_datIndex) {
+		fputs("*** ERROR: A DAT file must be specified using --dat.\n", stderr);
+		return -EINVAL;
+	}
+
+	// Open the RVT-H device or disk image.
+	int ret;
+	unique_ptr<RvtH> rvth(new RvtH(rvth_filename, &ret));
+	if (ret != 0 || !rvth->isOpen()) {
+		_ftprintf(stderr, _T("*** ERROR opening RVT-H device '%s': "), rvth_filename);
+		fputs(rvth_error(ret), stderr);
+		_fputtc(_T('\n'), stderr);
+		return ret;
+	}
+
+	ret = rvth->setCopyParams(copy_params);
+	if (ret != 0) {
+		fputs("*** ERROR: Invalid copy buffer parameters.\n", stderr);
+		return ret;
+	}
+	static const RvtH_ProgressParams progress_params = {100, 0, 0};
+	rvth->setProgressParams(&progress_params);
+
+	if (s_datIndex->name()[0] != '\0') {
+		printf("DAT file: %s (%u entries)\n\n", s_datIndex->name(),
+			static_cast<unsigned int>(s_datIndex->size()));
+	}
+
+	if (s_bank && _tcsicmp(s_bank, _T("all")) != 0) {
+		// Validate the bank number.
+		TCHAR *endptr;
+		const unsigned int bank = (unsigned int)_tcstoul(s_bank, &endptr, 10) - 1;
+		if (*endptr != 0 || bank >= rvth->bankCount()) {
+			_ftprintf(stderr, _T("*** ERROR: Invalid bank number '%s'.\n"), s_bank);
+			return -EINVAL;
+		}
+		ret = identify_bank(rvth.get(), bank);
+	} else {
+		// Identify all banks with disc images.
+		// The second bank of a dual-layer image is part of the first bank.
+		unsigned int identified = 0, unmatched = 0;
+		ret = 0;
+		for (unsigned int bank = 0; bank < rvth->bankCount(); bank++) {
+			const RvtH_BankEntry *const entry = rvth->bankEntry(bank);
+			if (!entry || entry->type < RVTH_BankType_GCN ||
+			    entry->type == RVTH_BankType_Wii_DL_Bank2)
+			{
+				continue;
+			}
+
+			if (identified + unmatched > 0) {
+				putchar('\n');
+			}
+			const int bank_ret = identify_bank(rvth.get(), bank);
+			if (bank_ret == 0) {
+				identified++;
+			} else {
+				unmatched++;
+				if (bank_ret < 0 || ret == 0) {
+					ret = bank_ret;
+				}
+			}
+		}
+		printf("\n%u of %u bank%s identified.\n", identified, identified + unmatched,
+			(identified + unmatched != 1) ? "s" : "");
+	}
+
+	if (stats) {
+		print_stats(rvth.get());
+	}
+	return ret;
+}
@@ -0,0 +1,56 @@
+/***************************************************************************
+ * RVT-H Tool                                                              *
+ * identify.h: Identify banks using a DAT file.                            *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_RVTHTOOL_IDENTIFY_H__
+#define __RVTHTOOL_RVTHTOOL_IDENTIFY_H__
+
+#include "tcharx.h"
+#include "stdboolx.h"
+#include "librvth/rvth.hpp"
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Load a DAT file for identifying disc images. (--dat)
+ * Digests printed by extract and import are matched against it.
+ * @param dat_filename	DAT filename.
+ * @return 0 on success; negative POSIX error code on error. (An error message is printed.)
+ */
+int load_dat_file(const TCHAR *dat_filename);
+
+/**
+ * Print the DAT entry that matches a disc image's digests.
+ * Nothing is printed if a DAT file wasn't loaded.
+ * @param f		File to print to.
+ * @param digests	Disc image digests.
+ * @param size		Disc image size, in bytes.
+ * @return True if the digests matched a DAT entry; false if not.
+ */
+bool print_dat_match(FILE *f, const RvtH_Image_Digests *digests, uint64_t size);
+
+/**
+ * 'identify' command.
+ * Requires a DAT file. (See load_dat_file().)
+ * @param rvth_filename	RVT-H device or disk image filename.
+ * @param s_bank	Bank number (as a string), or "all". (If NULL, all banks are identified.)
+ * @param copy_params	Copy buffer and I/O parameters.
+ * @param stats		If true, print performance statistics when finished.
+ * @return 0 if all banks were identified; 1 if any bank didn't match; negative on error.
+ */
+int identify(const TCHAR *rvth_filename, const TCHAR *s_bank,
+	const RvtH_CopyParams *copy_params, bool stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_RVTHTOOL_IDENTIFY_H__ */
@@ -0,0 +1,101 @@
+/***************************************************************************
+ * RVT-H Tool                                                              *
+ * json_report.cpp: JSON output helpers for machine-readable reports.      *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "json_report.hpp"
+
+#ifdef _WIN32
+#  include <windows.h>
+#endif /* _WIN32 */
+
+// C++ includes
+#include <algorithm>
+#include <string>
+
+/**
+ * Append a string to a buffer as a quoted JSON string.
+ * @param out	[in,out] Output buffer
+ * @param str	[in] UTF-8 string
+ */
+void json_append_string(std::string &out, const char *str)
+{
+	out += '"';
+	for (const uint8_t *p = reinterpret_cast<const uint8_t*>(str); *p != 0; p++) {
+		switch (*p) {
+			case '"':	out += "\\\""; break;
+			case '\\':	out += "\\\\"; break;
+			case '\b':	out += "\\b"; break;
+			case '\f':	out += "\\f"; break;
+			case '\n':	out += "\\n"; break;
+			case '\r':	out += "\\r"; break;
+			case '\t':	out += "\\t"; break;
+			default:
+				if (*p < 0x20) {
+					char buf[8];
+					snprintf(buf, sizeof(buf), "\\u%04x", *p);
+					out += buf;
+				} else {
+					out += static_cast<char>(*p);
+				}
+				break;
+		}
+	}
+	out += '"';
+}
+
+/**
+ * Print a string as a quoted JSON string.
+ * @param f	[in] Output file
+ * @param str	[in] UTF-8 string
+ */
+void json_print_string(FILE *f, const char *str)
+{
+	std::string out;
+	json_append_string(out, str);
+	fputs(out.c_str(), f);
+}
+
+#ifdef _WIN32
+/**
+ * Print a string as a quoted JSON string.
+ * @param f	[in] Output file
+ * @param str	[in] UTF-16 string
+ */
+void json_print_string(FILE *f, const wchar_t *str)
+{
+	const int len = WideCharToMultiByte(CP_UTF8, 0, str, -1, nullptr, 0, nullptr, nullptr);
+	if (len <= 0) {
+		json_print_string(f, "");
+		return;
+	}
+	std::string u8str(len, '\0');
+	WideCharToMultiByte(CP_UTF8, 0, str, -1, &u8str[0], len, nullptr, nullptr);
+	json_print_string(f, u8str.c_str());
+}
+#endif /* _WIN32 */
+
+/**
+ * Print the runs as a JSON array.
+ * @param f Output file
+ */
+void JsonRunList::print(FILE *f)
+{
+	std::sort(m_idx.begin(), m_idx.end());
+	m_idx.erase(std::unique(m_idx.begin(), m_idx.end()), m_idx.end());
+
+	fputc('[', f);
+	for (size_t i = 0; i < m_idx.size(); ) {
+		const uint32_t start = m_idx[i];
+		size_t j = i + 1;
+		while (j < m_idx.size() && m_idx[j] == m_idx[j-1] + 1) {
+			j++;
+		}
+		fprintf(f, "%s[%u,%u]", (i != 0 ? "," : ""), start, static_cast<unsigned int>(j - i));
+		i = j;
+	}
+	fputc(']', f);
+}
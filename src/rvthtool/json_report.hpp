@@ -0,0 +1,73 @@
+/***************************************************************************
+ * RVT-H Tool                                                              *
+ * json_report.hpp: JSON output helpers for machine-readable reports.      *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_RVTHTOOL_JSON_REPORT_HPP__
+#define __RVTHTOOL_RVTHTOOL_JSON_REPORT_HPP__
+
+#include "tcharx.h"
+
+// C includes
+#include <stdint.h>
+#include <stdio.h>
+
+// C++ includes
+#include <string>
+#include <vector>
+
+/**
+ * Append a string to a buffer as a quoted JSON string.
+ * @param out	[in,out] Output buffer
+ * @param str	[in] UTF-8 string
+ */
+void json_append_string(std::string &out, const char *str);
+
+/**
+ * Print a string as a quoted JSON string.
+ * @param f	[in] Output file
+ * @param str	[in] UTF-8 string
+ */
+void json_print_string(FILE *f, const char *str);
+
+#ifdef _WIN32
+/**
+ * Print a string as a quoted JSON string.
+ * @param f	[in] Output file
+ * @param str	[in] UTF-16 string
+ */
+void json_print_string(FILE *f, const wchar_t *str);
+#endif /* _WIN32 */
+
+/**
+ * Set of indexes, printed as a JSON array of [start, count] runs.
+ * Indexes may be added in any order, and duplicates are ignored.
+ */
+class JsonRunList
+{
+	public:
+		/**
+		 * Add an index.
+		 * @param idx Index
+		 */
+		inline void add(uint32_t idx) { m_idx.push_back(idx); }
+
+		/**
+		 * Remove all indexes.
+		 */
+		inline void clear(void) { m_idx.clear(); }
+
+		/**
+		 * Print the runs as a JSON array.
+		 * @param f Output file
+		 */
+		void print(FILE *f);
+
+	private:
+		std::vector<uint32_t> m_idx;
+};
+
+#endif /* __RVTHTOOL_RVTHTOOL_JSON_REPORT_HPP__ */
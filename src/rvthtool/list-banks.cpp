@@ -2,14 +2,16 @@
  * RVT-H Tool                                                              *
  * list-banks.cpp: List banks in an RVT-H disk image.                      *
  *                                                                         *
- * Copyright (c) 2018-2022 by David Korth.                                 *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
 #include "config.librvth.h"
 #include "list-banks.hpp"
+#include "json_report.hpp"
 
 #include "librvth/rvth.hpp"
+#include "librvth/ImageSet.hpp"
 #include "librvth/rvth_error.h"
 #include "librvth/query.h"
 
@@ -24,8 +26,22 @@
 // C includes (C++ namespace)
 #include <cassert>
 #include <cerrno>
+#include <cstdio>
 #include <cstring>
 
+// C++ includes
+#include <string>
+#include <vector>
+using std::string;
+using std::tstring;
+using std::vector;
+
+// Region codes.
+static const char region_code_tbl[7][4] = {
+	"JPN", "USA", "EUR", "ALL",
+	"KOR", "CHN", "TWN"
+};
+
 /**
  * Trim a game title.
  * @param title Game title.
@@ -41,6 +57,22 @@ static void trim_title(char *title, int size)
 	}
 }
 
+/**
+ * Format a bank's build fingerprint as a hexadecimal string.
+ * @param entry	[in] Bank entry.
+ * @param buf	[out] Output buffer. (41 bytes)
+ * @return True if the fingerprint is available; false if not.
+ */
+static bool format_fingerprint(const RvtH_BankEntry *entry, char buf[41])
+{
+	uint8_t all = 0;
+	for (unsigned int i = 0; i < sizeof(entry->fingerprint); i++) {
+		snprintf(&buf[i*2], 3, "%02x", entry->fingerprint[i]);
+		all |= entry->fingerprint[i];
+	}
+	return (all != 0);
+}
+
 /**
  * Print information for the specified bank.
  * @param rvth	[in] RVT-H disk image.
@@ -49,20 +81,15 @@ static void trim_title(char *title, int size)
  */
 int print_bank(const RvtH *rvth, unsigned int bank)
 {
-	// Region codes.
-	static const TCHAR region_code_tbl[7][4] = {
-		_T("JPN"), _T("USA"), _T("EUR"), _T("ALL"),
-		_T("KOR"), _T("CHN"), _T("TWN")
-	};
-
 	const unsigned int bank_count = rvth->bankCount();
 	if (bank >= bank_count) {
 		// Out of range...
 		return -ERANGE;
 	}
 
-	// Check if this is an HDD image.
-	const bool is_hdd = rvth->isHDD();
+	// Bank numbers are printed for HDD images and for disc images
+	// that contain more than one disc, e.g. WBFS partitions.
+	const bool show_bank_num = rvth->isHDD() || bank_count > 1;
 
 	// TODO: Check the error code.
 	int ret = 0;
@@ -73,7 +100,7 @@ int print_bank(const RvtH *rvth, unsigned int bank)
 			// Error...
 			return ret;
 		}
-		if (is_hdd) {
+		if (show_bank_num) {
 			_tprintf(_T("Bank %u: "), bank+1);
 		} else {
 			_fputts(_T("Disc image: "), stdout);
@@ -118,7 +145,7 @@ int print_bank(const RvtH *rvth, unsigned int bank)
 			break;
 	}
 
-	if (is_hdd) {
+	if (show_bank_num) {
 		_tprintf(_T("Bank %u: "), bank+1);
 	} else {
 		_fputts(_T("Disc image: "), stdout);
@@ -162,7 +189,7 @@ int print_bank(const RvtH *rvth, unsigned int bank)
 	// Region code
 	_fputts(_T("- Region code: "), stdout);
 	if (entry->region_code < ARRAY_SIZE(region_code_tbl)) {
-		_fputts(region_code_tbl[entry->region_code], stdout);
+		fputs(region_code_tbl[entry->region_code], stdout);
 	} else {
 		_tprintf(_T("0x%02X"), entry->region_code);
 	}
@@ -190,6 +217,13 @@ int print_bank(const RvtH *rvth, unsigned int bank)
 			RVL_SigStatus_toString_stsAppend((RVL_SigStatus_e)entry->tmd.sig_status));
 	}
 
+	// Build fingerprint.
+	// Banks with the same fingerprint have the same build.
+	char fingerprint[41];
+	if (format_fingerprint(entry, fingerprint)) {
+		printf("- Fingerprint: %s\n", fingerprint);
+	}
+
 	// Check the AppLoader status.
 	// TODO: Move strings to librvth?
 	if (entry->aplerr > APLERR_OK) {
@@ -258,6 +292,287 @@ int print_bank(const RvtH *rvth, unsigned int bank)
 	return 0;
 }
 
+/** JSON reports (--format=json) **/
+
+/**
+ * Bank field names. (list --fields)
+ */
+static const struct {
+	const TCHAR *name;
+	unsigned int field;
+} list_field_names[] = {
+	{_T("bank"),		0},
+	{_T("type"),		LIST_FIELD_TYPE},
+	{_T("deleted"),		LIST_FIELD_DELETED},
+	{_T("lba_start"),	LIST_FIELD_LBA_START},
+	{_T("lba_len"),		LIST_FIELD_LBA_LEN},
+	{_T("timestamp"),	LIST_FIELD_TIMESTAMP},
+	{_T("id6"),		LIST_FIELD_ID6},
+	{_T("title"),		LIST_FIELD_TITLE},
+	{_T("disc"),		LIST_FIELD_DISC},
+	{_T("revision"),	LIST_FIELD_REVISION},
+	{_T("region"),		LIST_FIELD_REGION},
+	{_T("ios"),		LIST_FIELD_IOS},
+	{_T("crypto"),		LIST_FIELD_CRYPTO},
+	{_T("ticket_sig"),	LIST_FIELD_TICKET_SIG},
+	{_T("tmd_sig"),		LIST_FIELD_TMD_SIG},
+	{_T("apploader"),	LIST_FIELD_APPLOADER},
+	{_T("fingerprint"),	LIST_FIELD_FINGERPRINT},
+	{_T("all"),		LIST_FIELDS_ALL},
+};
+
+/**
+ * Parse a comma-separated list of bank fields.
+ * @param s_fields	[in] Field names, e.g. "id6,title,type"
+ * @return Fields (See ListBankField.), or 0 on error.
+ */
+unsigned int list_parse_fields(const TCHAR *s_fields)
+{
+	unsigned int fields = 0;
+	bool has_bank = false;
+	const TCHAR *p = s_fields;
+	for (;;) {
+		const TCHAR *comma = _tcschr(p, _T(','));
+		const tstring name = (comma ? tstring(p, comma - p) : tstring(p));
+
+		bool found = false;
+		for (const auto &fn : list_field_names) {
+			if (name == fn.name) {
+				fields |= fn.field;
+				has_bank |= (fn.field == 0);
+				found = true;
+				break;
+			}
+		}
+		if (!found) {
+			_ftprintf(stderr, _T("*** ERROR: Unknown field '%s'.\n"), name.c_str());
+			return 0;
+		}
+
+		if (!comma) {
+			break;
+		}
+		p = comma + 1;
+	}
+
+	if (fields == 0 && has_bank) {
+		// Only the bank number was requested.
+		// Use the bank type, since it doesn't need any more reads.
+		fields = LIST_FIELD_TYPE;
+	}
+	return fields;
+}
+
+/**
+ * Get a bank type name for JSON reports.
+ * @param type Bank type (See RvtH_BankType_e.)
+ * @return Bank type name
+ */
+static const char *json_bank_type_name(uint8_t type)
+{
+	switch (type) {
+		case RVTH_BankType_Empty:		return "empty";
+		case RVTH_BankType_GCN:			return "gcn";
+		case RVTH_BankType_Wii_SL:		return "wii_sl";
+		case RVTH_BankType_Wii_DL:		return "wii_dl";
+		case RVTH_BankType_Wii_DL_Bank2:	return "wii_dl_bank2";
+		default:				return "unknown";
+	}
+}
+
+/**
+ * Append the selected fields of a bank to a buffer as a JSON object.
+ * The bank entry is initialized to the level needed for the fields.
+ * @param out		[in,out] Output buffer
+ * @param rvth		[in] RVT-H disk image.
+ * @param bank		[in] Bank number. (0-7)
+ * @param fields	[in] Fields (See ListBankField.)
+ */
+void json_append_bank(string &out, const RvtH *rvth, unsigned int bank, unsigned int fields)
+{
+	char buf[128];
+	snprintf(buf, sizeof(buf), "{\"bank\":%u", bank+1);
+	out += buf;
+
+	int ret = 0;
+	const RvtH_BankEntry *const entry = rvth->bankEntry(bank, &ret,
+		((fields & ~LIST_FIELDS_HEADER) ? RVTH_BANK_INIT_FULL : RVTH_BANK_INIT_HEADER));
+	if (!entry) {
+		if (fields & LIST_FIELD_TYPE) {
+			out += (ret == RVTH_ERROR_BANK_EMPTY ? ",\"type\":\"empty\"}" : ",\"type\":\"unknown\"}");
+		} else {
+			out += '}';
+		}
+		return;
+	}
+
+	if (fields & LIST_FIELD_TYPE) {
+		out += ",\"type\":\"";
+		out += json_bank_type_name(entry->type);
+		out += '"';
+	}
+	if (entry->type == RVTH_BankType_Wii_DL_Bank2) {
+		// Second bank of a dual-layer Wii image.
+		// The other fields belong to the first bank.
+		out += '}';
+		return;
+	}
+	if (fields & LIST_FIELD_DELETED) {
+		out += (entry->is_deleted ? ",\"deleted\":true" : ",\"deleted\":false");
+	}
+	if (fields & LIST_FIELD_LBA_START) {
+		snprintf(buf, sizeof(buf), ",\"lba_start\":%u", entry->lba_start);
+		out += buf;
+	}
+	if (fields & LIST_FIELD_LBA_LEN) {
+		snprintf(buf, sizeof(buf), ",\"lba_len\":%u", entry->lba_len);
+		out += buf;
+	}
+	if (entry->type <= RVTH_BankType_Unknown || entry->type >= RVTH_BankType_MAX) {
+		// No disc header.
+		out += '}';
+		return;
+	}
+
+	if (fields & LIST_FIELD_TIMESTAMP) {
+		if (entry->timestamp != -1) {
+			snprintf(buf, sizeof(buf), ",\"timestamp\":%lld",
+				static_cast<long long>(entry->timestamp));
+			out += buf;
+		} else {
+			out += ",\"timestamp\":null";
+		}
+	}
+	if (fields & LIST_FIELD_ID6) {
+		char id6[7];
+		memcpy(id6, entry->discHeader.id6, 6);
+		id6[6] = 0;
+		out += ",\"id6\":";
+		json_append_string(out, id6);
+	}
+	if (fields & LIST_FIELD_TITLE) {
+		char game_title[65];
+		memcpy(game_title, entry->discHeader.game_title, 64);
+		game_title[64] = 0;
+		trim_title(game_title, 64);
+		out += ",\"title\":";
+		json_append_string(out, game_title);
+	}
+	if (fields & LIST_FIELD_DISC) {
+		snprintf(buf, sizeof(buf), ",\"disc\":%u", entry->discHeader.disc_number);
+		out += buf;
+	}
+	if (fields & LIST_FIELD_REVISION) {
+		snprintf(buf, sizeof(buf), ",\"revision\":%u", entry->discHeader.revision);
+		out += buf;
+	}
+	if (fields & LIST_FIELD_REGION) {
+		if (entry->region_code < ARRAY_SIZE(region_code_tbl)) {
+			snprintf(buf, sizeof(buf), ",\"region\":\"%s\"", region_code_tbl[entry->region_code]);
+		} else {
+			snprintf(buf, sizeof(buf), ",\"region\":%u", entry->region_code);
+		}
+		out += buf;
+	}
+
+	if (entry->type == RVTH_BankType_Wii_SL || entry->type == RVTH_BankType_Wii_DL) {
+		if (fields & LIST_FIELD_IOS) {
+			snprintf(buf, sizeof(buf), ",\"ios\":%u", entry->ios_version);
+			out += buf;
+		}
+		if (fields & LIST_FIELD_CRYPTO) {
+			out += ",\"crypto\":";
+			json_append_string(out, RVL_CryptoType_toString((RVL_CryptoType_e)entry->crypto_type));
+		}
+		if (fields & LIST_FIELD_TICKET_SIG) {
+			snprintf(buf, sizeof(buf), ",\"ticket_sig\":{\"type\":\"%s\",\"status\":\"%s\"}",
+				RVL_SigType_toString((RVL_SigType_e)entry->ticket.sig_type),
+				RVL_SigStatus_toString((RVL_SigStatus_e)entry->ticket.sig_status));
+			out += buf;
+		}
+		if (fields & LIST_FIELD_TMD_SIG) {
+			snprintf(buf, sizeof(buf), ",\"tmd_sig\":{\"type\":\"%s\",\"status\":\"%s\"}",
+				RVL_SigType_toString((RVL_SigType_e)entry->tmd.sig_type),
+				RVL_SigStatus_toString((RVL_SigStatus_e)entry->tmd.sig_status));
+			out += buf;
+		}
+	}
+	if (fields & LIST_FIELD_APPLOADER) {
+		// AppLoader errors are printed as the AppLoader_Error_e value.
+		if (entry->aplerr == APLERR_OK) {
+			out += ",\"apploader\":\"ok\"";
+		} else if (entry->aplerr == APLERR_UNKNOWN) {
+			out += ",\"apploader\":\"unknown\"";
+		} else {
+			snprintf(buf, sizeof(buf), ",\"apploader\":{\"error\":%u,\"values\":[%u,%u,%u]}",
+				entry->aplerr, entry->aplerr_val[0], entry->aplerr_val[1], entry->aplerr_val[2]);
+			out += buf;
+		}
+	}
+	if (fields & LIST_FIELD_FINGERPRINT) {
+		char fingerprint[41];
+		if (format_fingerprint(entry, fingerprint)) {
+			snprintf(buf, sizeof(buf), ",\"fingerprint\":\"%s\"", fingerprint);
+			out += buf;
+		} else {
+			out += ",\"fingerprint\":null";
+		}
+	}
+	out += '}';
+}
+
+/**
+ * Print an RVT-H Bank Table as a JSON object.
+ * @param rvth		[in] RVT-H disk image.
+ * @param rvth_filename	[in] RVT-H device or disk image filename.
+ * @param fields	[in] Fields (See ListBankField.)
+ * @return 0 on success; non-zero on error.
+ */
+static int json_print_bank_table(const RvtH *rvth, const TCHAR *rvth_filename, unsigned int fields)
+{
+	const char *s_type;
+	switch (rvth->imageType()) {
+		case RVTH_ImageType_HDD_Reader:	s_type = "hdd_reader"; break;
+		case RVTH_ImageType_HDD_Image:	s_type = "hdd_image"; break;
+		case RVTH_ImageType_GCM:	s_type = "gcm"; break;
+		case RVTH_ImageType_GCM_SDK:	s_type = "gcm_sdk"; break;
+		default:			s_type = "unknown"; break;
+	}
+
+	const char *s_nhcd = nullptr;
+	if (rvth->isHDD()) {
+		switch (rvth->nhcd_status()) {
+			case NHCD_STATUS_OK:		s_nhcd = "ok"; break;
+			case NHCD_STATUS_HAS_MBR:	s_nhcd = "mbr"; break;
+			case NHCD_STATUS_HAS_GPT:	s_nhcd = "gpt"; break;
+			default:			s_nhcd = "missing"; break;
+		}
+
+		// All banks will be printed, so initialize them now,
+		// but only as far as the requested fields need.
+		rvth->initBankEntries(0, ((fields & ~LIST_FIELDS_HEADER) ? RVTH_BANK_INIT_FULL : RVTH_BANK_INIT_HEADER));
+	}
+
+	fputs("{\"type\":\"list\",\"file\":", stdout);
+	json_print_string(stdout, rvth_filename);
+	printf(",\"image_type\":\"%s\"", s_type);
+	if (s_nhcd) {
+		printf(",\"nhcd_status\":\"%s\"", s_nhcd);
+	}
+
+	string out = ",\"banks\":[";
+	const unsigned int bank_count = rvth->bankCount();
+	for (unsigned int bank = 0; bank < bank_count; bank++) {
+		if (bank != 0) {
+			out += ',';
+		}
+		json_append_bank(out, rvth, bank, fields);
+	}
+	out += "]}\n";
+	fputs(out.c_str(), stdout);
+	return 0;
+}
+
 /**
  * Print an RVT-H Bank Table.
  * @param rvth	[in] RVT-H disk image.
@@ -265,17 +580,17 @@ int print_bank(const RvtH *rvth, unsigned int bank)
  */
 static int print_bank_table(const RvtH *rvth)
 {
-	const unsigned int bank_count = rvth->bankCount();
+	vector<RvtH_BankSummary> summaries;
+	const unsigned int bank_count = rvth->bankSummaries(summaries);
 
 	// Print the entries.
 	for (unsigned int bank = 0; bank < bank_count; bank++) {
 		// TODO: Check for errors?
-		const RvtH_BankEntry *const entry = rvth->bankEntry(bank);
 		print_bank(rvth, bank);
 
 		// Nothing is printed for the second bank of dual-layer Wii discs,
 		// so don't print a newline in that case..
-		if (entry && entry->type != RVTH_BankType_Wii_DL_Bank2) {
+		if (summaries[bank].type != RVTH_BankType_Wii_DL_Bank2) {
 			putchar('\n');
 		}
 	}
@@ -284,21 +599,29 @@ static int print_bank_table(const RvtH *rvth)
 }
 
 /**
- * 'list-banks' command.
- * @param rvth_filename RVT-H device or disk image filename.
+ * Print an error message for an image that couldn't be opened.
+ * @param rvth_filename	[in] RVT-H device or disk image filename.
+ * @param err		[in] Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+static void print_open_error(const TCHAR *rvth_filename, int err)
+{
+	_ftprintf(stderr, _T("*** ERROR opening RVT-H device '%s': "), rvth_filename);
+	fputs(rvth_error(err), stderr);
+	_fputtc(_T('\n'), stderr);
+}
+
+/**
+ * Print the image information and bank table of an opened image.
+ * @param rvth		[in] RVT-H disk image.
+ * @param rvth_filename	[in] RVT-H device or disk image filename.
+ * @param json		[in] If true, print a JSON report instead of text.
+ * @param fields	[in] Fields for the JSON report. (See ListBankField.)
  * @return 0 on success; non-zero on error.
  */
-int list_banks(const TCHAR *rvth_filename)
+static int print_image(const RvtH *rvth, const TCHAR *rvth_filename, bool json, unsigned int fields)
 {
-	// Open the disk image.
-	int ret;
-	RvtH *const rvth = new RvtH(rvth_filename, &ret);
-	if (ret != 0 || !rvth->isOpen()) {
-		_ftprintf(stderr, _T("*** ERROR opening RVT-H device '%s': "), rvth_filename);
-		fputs(rvth_error(ret), stderr);
-		_fputtc(_T('\n'), stderr);
-		delete rvth;
-		return ret;
+	if (json) {
+		return json_print_bank_table(rvth, rvth_filename, fields);
 	}
 
 	_tprintf(_T("File: %s\n"), rvth_filename);
@@ -335,7 +658,6 @@ int list_banks(const TCHAR *rvth_filename)
 		default:
 			// Should not get here...
 			assert(!"Should not get here...");
-			delete rvth;
 			return -EIO;
 	}
 
@@ -386,9 +708,89 @@ int list_banks(const TCHAR *rvth_filename)
 		}
 		_tprintf(_T("RVT-H Bank Table: [%s%u bank%s]\n\n"),
 			extshr, bank_count, (bank_count != 1 ? _T("s") : _T("")));
+
+		// All banks will be printed, so initialize them now.
+		rvth->initBankEntries();
 	}
 
 	print_bank_table(rvth);
-	delete rvth;
 	return 0;
 }
+
+/**
+ * 'list-banks' command.
+ * @param rvth_filename	[in] RVT-H device or disk image filename.
+ * @param json		[in] If true, print a JSON report instead of text.
+ * @param s_fields	[in,opt] Fields for the JSON report. (If NULL, all fields.)
+ * @return 0 on success; non-zero on error.
+ */
+int list_banks(const TCHAR *rvth_filename, bool json, const TCHAR *s_fields)
+{
+	unsigned int fields = LIST_FIELDS_ALL;
+	if (s_fields) {
+		fields = list_parse_fields(s_fields);
+		if (fields == 0) {
+			return -EINVAL;
+		}
+	}
+
+	// Open the disk image.
+	int ret;
+	RvtH *const rvth = new RvtH(rvth_filename, &ret);
+	if (ret != 0 || !rvth->isOpen()) {
+		print_open_error(rvth_filename, ret);
+		delete rvth;
+		return ret;
+	}
+
+	ret = print_image(rvth, rvth_filename, json, fields);
+	delete rvth;
+	return ret;
+}
+
+/**
+ * 'list-banks' command. (multiple images)
+ * The images are opened concurrently, and each image is printed
+ * as soon as it's open, so the images may be printed out of order.
+ * @param filenames	[in] RVT-H device or disk image filenames.
+ * @param count		[in] Number of filenames.
+ * @param json		[in] If true, print a JSON report instead of text.
+ * @param s_fields	[in,opt] Fields for the JSON report. (If NULL, all fields.)
+ * @return 0 on success; non-zero if any image couldn't be listed.
+ */
+int list_images(const TCHAR *const *filenames, unsigned int count, bool json, const TCHAR *s_fields)
+{
+	unsigned int fields = LIST_FIELDS_ALL;
+	if (s_fields) {
+		fields = list_parse_fields(s_fields);
+		if (fields == 0) {
+			return -EINVAL;
+		}
+	}
+
+	// Only initialize the bank entries as far as the listing needs.
+	const RvtH_BankInit_Level level = (json && !(fields & ~LIST_FIELDS_HEADER))
+		? RVTH_BANK_INIT_HEADER : RVTH_BANK_INIT_FULL;
+
+	// Images are closed as soon as they're printed.
+	int ret = 0;
+	ImageSet images;
+	images.open(filenames, count, [&](unsigned int index, RvtH *rvth, int err) {
+		if (!rvth) {
+			print_open_error(filenames[index], err);
+			ret = err;
+			return true;
+		}
+		const int ret_img = print_image(rvth, filenames[index], json, fields);
+		if (ret_img != 0) {
+			ret = ret_img;
+		}
+		if (!json) {
+			putchar('\n');
+		}
+		fflush(stdout);
+		delete images.release(index);
+		return true;
+	}, level);
+	return ret;
+}
@@ -13,6 +13,9 @@
 #include "librvth/rvth.hpp"
 
 #ifdef __cplusplus
+// C++ includes
+#include <string>
+
 /**
  * Print information for the specified bank.
  * @param rvth	[in] RVT-H disk image.
@@ -20,6 +23,49 @@
  * @return 0 on success; non-zero on error.
  */
 int print_bank(const RvtH *rvth, unsigned int bank);
+
+// Bank fields for JSON output. (list --fields)
+// The bank number is always included.
+enum ListBankField {
+	// Bank table and disc header (RVTH_BANK_INIT_HEADER)
+	LIST_FIELD_TYPE		= (1U << 0),
+	LIST_FIELD_DELETED	= (1U << 1),
+	LIST_FIELD_LBA_START	= (1U << 2),
+	LIST_FIELD_LBA_LEN	= (1U << 3),
+	LIST_FIELD_TIMESTAMP	= (1U << 4),
+	LIST_FIELD_ID6		= (1U << 5),
+	LIST_FIELD_TITLE	= (1U << 6),
+	LIST_FIELD_DISC		= (1U << 7),
+	LIST_FIELD_REVISION	= (1U << 8),
+	LIST_FIELD_REGION	= (1U << 9),
+	LIST_FIELDS_HEADER	= (1U << 10) - 1,
+
+	// Encryption and AppLoader checks (RVTH_BANK_INIT_FULL)
+	LIST_FIELD_IOS		= (1U << 10),
+	LIST_FIELD_CRYPTO	= (1U << 11),
+	LIST_FIELD_TICKET_SIG	= (1U << 12),
+	LIST_FIELD_TMD_SIG	= (1U << 13),
+	LIST_FIELD_APPLOADER	= (1U << 14),
+	LIST_FIELD_FINGERPRINT	= (1U << 15),
+	LIST_FIELDS_ALL		= (1U << 16) - 1,
+};
+
+/**
+ * Parse a comma-separated list of bank fields.
+ * @param s_fields	[in] Field names, e.g. "id6,title,type"
+ * @return Fields (See ListBankField.), or 0 on error.
+ */
+unsigned int list_parse_fields(const TCHAR *s_fields);
+
+/**
+ * Append the selected fields of a bank to a buffer as a JSON object.
+ * The bank entry is initialized to the level needed for the fields.
+ * @param out		[in,out] Output buffer
+ * @param rvth		[in] RVT-H disk image.
+ * @param bank		[in] Bank number. (0-7)
+ * @param fields	[in] Fields (See ListBankField.)
+ */
+void json_append_bank(std::string &out, const RvtH *rvth, unsigned int bank, unsigned int fields);
 #endif /* __cplusplus */
 
 #ifdef __cplusplus
@@ -28,10 +74,24 @@ extern "C" {
 
 /**
  * 'list-banks' command.
- * @param rvth_filename RVT-H device or disk image filename.
+ * @param rvth_filename	[in] RVT-H device or disk image filename.
+ * @param json		[in] If true, print a JSON report instead of text.
+ * @param s_fields	[in,opt] Fields for the JSON report. (If NULL, all fields.)
  * @return 0 on success; non-zero on error.
  */
-int list_banks(const TCHAR *rvth_filename);
+int list_banks(const TCHAR *rvth_filename, bool json, const TCHAR *s_fields);
+
+/**
+ * 'list-banks' command. (multiple images)
+ * The images are opened concurrently, and each image is printed
+ * as soon as it's open, so the images may be printed out of order.
+ * @param filenames	[in] RVT-H device or disk image filenames.
+ * @param count		[in] Number of filenames.
+ * @param json		[in] If true, print a JSON report instead of text.
+ * @param s_fields	[in,opt] Fields for the JSON report. (If NULL, all fields.)
+ * @return 0 on success; non-zero if any image couldn't be listed.
+ */
+int list_images(const TCHAR *const *filenames, unsigned int count, bool json, const TCHAR *s_fields);
 
 #ifdef __cplusplus
 }
@@ -10,6 +10,7 @@
 #include "git.h"
 
 // C includes.
+#include <errno.h>
 #include <locale.h>
 #include <stdarg.h>
 #include <stdlib.h>
@@ -18,6 +19,7 @@
 
 #include "librvth/config.librvth.h"
 #include "librvth/rvth.hpp"
+#include "librvth/rvth_trace.h"
 #include "libwiicrypto/cert.h"
 #include "libwiicrypto/sig_tools.h"
 
@@ -27,8 +29,16 @@
 
 #include "list-banks.hpp"
 #include "extract.h"
+#include "files.h"
 #include "undelete.h"
 #include "verify.h"
+#include "bench.h"
+#include "scan.h"
+#include "compare.h"
+#include "identify.h"
+#include "batch.h"
+#include "daemon.h"
+#include "nbd.h"
 #include "query.h"
 
 #ifdef _MSC_VER
@@ -51,6 +61,44 @@
 #  define ATTR_PRINTF(fmt, args)
 #endif
 
+// Long-only options.
+enum {
+	OPT_BUFFER_SIZE = 256,
+	OPT_BUFFER_COUNT,
+	OPT_BUFFER_ALIGN,
+	OPT_QUICK,
+	OPT_SKIP_KNOWN,
+	OPT_RESUME,
+	OPT_FORCE,
+	OPT_DIGESTS,
+	OPT_HASH_INDEX,
+	OPT_JSON,
+	OPT_UPDATE_STORE,
+	OPT_DIRECT_IO,
+	OPT_ALLOC,
+	OPT_HOLE_SIZE,
+	OPT_DIFF,
+	OPT_BASE,
+	OPT_FORMAT,
+	OPT_FIELDS,
+	OPT_STATS,
+	OPT_READAHEAD,
+	OPT_TRACE,
+	OPT_SLOW_READ,
+	OPT_MEM_BUDGET,
+	OPT_IO_PRIORITY,
+	OPT_BW_LIMIT,
+	OPT_DECRYPT,
+	OPT_READBACK,
+	OPT_READBACK_WINDOW,
+	OPT_DURABILITY,
+	OPT_SYNC_INTERVAL,
+	OPT_RECONNECT,
+	OPT_BLOCK_CACHE,
+	OPT_DAT,
+	OPT_METRICS,
+};
+
 // Uncomment this to display hidden options in the help message.
 //#define SHOW_HIDDEN_OPTIONS 1
 
@@ -75,6 +123,96 @@ static void ATTR_PRINTF(2, 3) print_error(const TCHAR *argv0, const TCHAR *fmt,
 	_ftprintf(stderr, _T("Try `%s` --help` for more information.\n"), argv0);
 }
 
+/**
+ * Parse a size, with an optional K or M suffix.
+ * @param str		[in] String.
+ * @param pValue	[out] Size, in bytes.
+ * @return 0 on success; non-zero on error.
+ */
+static int parse_size(const TCHAR *str, unsigned int *pValue)
+{
+	TCHAR *endptr;
+	unsigned long value = _tcstoul(str, &endptr, 10);
+	if (endptr == str) {
+		return -1;
+	}
+
+	switch (*endptr) {
+		case _T('\0'):
+			break;
+		case _T('k'): case _T('K'):
+			value *= 1024UL;
+			endptr++;
+			break;
+		case _T('m'): case _T('M'):
+			value *= 1024UL * 1024UL;
+			endptr++;
+			break;
+		default:
+			return -1;
+	}
+	if (*endptr != _T('\0') || value > 0xFFFFFFFFUL) {
+		return -1;
+	}
+
+	*pValue = (unsigned int)value;
+	return 0;
+}
+
+/**
+ * Write the trace file, if a trace is being recorded.
+ * Registered with atexit(), so the trace is written
+ * regardless of how the program exits.
+ */
+static void stop_trace(void)
+{
+	const int ret = rvth_trace_stop();
+	if (ret != 0 && ret != -EBADF) {
+		fprintf(stderr, "*** WARNING: Unable to write the trace file: %s\n", strerror(-ret));
+	}
+}
+
+/**
+ * Check if the --json or --format=json option was specified.
+ * This is checked before the options are parsed,
+ * since the program information is printed first.
+ * @param argc Number of arguments
+ * @param argv Arguments
+ * @return True if JSON output was requested; false if not.
+ */
+static bool has_json_option(int argc, TCHAR *argv[])
+{
+	for (int i = 1; i < argc; i++) {
+		if (!_tcscmp(argv[i], _T("--"))) {
+			// End of options.
+			break;
+		} else if (!_tcscmp(argv[i], _T("--json")) ||
+			   !_tcscmp(argv[i], _T("--format=json")))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Check if a disc image is written to stdout, i.e. a filename is "-".
+ * This is checked before the options are parsed,
+ * since the program information is printed first.
+ * @param argc Number of arguments
+ * @param argv Arguments
+ * @return True if "-" was specified; false if not.
+ */
+static bool has_stdout_filename(int argc, TCHAR *argv[])
+{
+	for (int i = 1; i < argc; i++) {
+		if (!_tcscmp(argv[i], _T("-"))) {
+			return true;
+		}
+	}
+	return false;
+}
+
 /**
  * Print program help.
  * @param argv0 Program name.
@@ -88,28 +226,158 @@ static void print_help(const TCHAR *argv0)
 	_tprintf(_T("Syntax: %s [options] [command]\n\n"), argv0);
 	_fputts(_T("Supported commands:\n")
 		_T("\n")
-		_T("list rvth.img\n")
+		_T("list rvth.img [rvth2.img...]\n")
 		_T("- List banks in the specified RVT-H device or disk image.\n")
+		_T("  If more than one image is specified, the images are opened\n")
+		_T("  concurrently and listed as they're opened, in any order.\n")
+		_T("  With --format=json, --fields selects the bank fields to print:\n")
+		_T("  type, deleted, lba_start, lba_len, timestamp, id6, title, disc,\n")
+		_T("  revision, region, ios, crypto, ticket_sig, tmd_sig, apploader,\n")
+		_T("  fingerprint (identical builds have the same fingerprint)\n")
+		_T("  Banks are only read as far as needed for the selected fields.\n")
 		_T("\n")
 		_T("extract ") _T(DEVICE_NAME_EXAMPLE) _T(" bank# disc.gcm\n")
 		_T("- Extract the specified bank number from rvth.img to disc.gcm.\n")
+		_T("  Use a .ciso or .wbfs extension to extract to a CISO or WBFS image,\n")
+		_T("  or .rvtz for a compressed image that can be read back by rvthtool.\n")
+		_T("  Use a .part0 extension (e.g. disc.gcm.part0) to split a plain image\n")
+		_T("  into 4 GB parts for FAT32. Split images can be opened using the\n")
+		_T("  .part0 file, e.g. for verify and import.\n")
+		_T("  If bank# is 'all', every bank with a disc image is extracted, and\n")
+		_T("  disc.gcm is a template: {bank}, {id6}, and {title} are replaced with\n")
+		_T("  the bank number, game ID, and game title, e.g. \"{bank}_{id6}.gcm\".\n")
+		_T("  If disc.gcm is '-', a plain disc image is written to stdout, e.g. to\n")
+		_T("  pipe it into a compressor. Empty areas are written as zeroes.\n")
+		_T("  If more than one destination is specified, e.g. disc.gcm disc.rvtz,\n")
+		_T("  the bank is read once and written to each destination by its own\n")
+		_T("  thread. A slow destination buffers up to 256 MB (or --mem-budget)\n")
+		_T("  before the read waits for it. Recryption isn't supported.\n")
+		_T("\n")
+		_T("list-files ") _T(DEVICE_NAME_EXAMPLE) _T(" bank#\n")
+		_T("- List the files in the specified bank's filesystem, with their sizes.\n")
+		_T("  For Wii banks, the game partition is used. System files are listed\n")
+		_T("  in sys/, and files in the FST are listed in files/. Only the boot\n")
+		_T("  block and the FST are read.\n")
+		_T("\n")
+		_T("extract-file ") _T(DEVICE_NAME_EXAMPLE) _T(" bank# path file.bin\n")
+		_T("- Extract a single file, e.g. sys/main.dol, from the specified bank's\n")
+		_T("  filesystem to file.bin. Only the data overlapping the file is read\n")
+		_T("  and decrypted. If file.bin is '-', the file is written to stdout.\n")
+		_T("\n")
+		_T("reconstruct archive.gcm disc.gcm\n")
+		_T("- Rebuild the full disc image disc.gcm from archive.gcm, which was\n")
+		_T("  extracted using --update-store. Requires --update-store.\n")
+		_T("\n")
+		_T("convert disc.wbfs disc.gcm\n")
+		_T("- Convert a standalone disc image to another format, selected by the\n")
+		_T("  destination's extension as for extract, e.g. WBFS to a plain image\n")
+		_T("  or a plain image to CISO. The image is copied as-is: the disc header\n")
+		_T("  isn't restored, and nothing is recrypted. Unallocated areas of the\n")
+		_T("  source image aren't read. --digests and --alloc can be used.\n")
 		_T("\n")
 		_T("import ") _T(DEVICE_NAME_EXAMPLE) _T(" bank# disc.gcm\n")
 		_T("- Import disc.gcm into rvth.img at the specified bank number.\n")
+		_T("  disc.gcm may also be a CISO, WBFS, RVTZ, WIA, or RVZ image.\n")
+		_T("  disc.gcm may be an http:// or https:// URL if the server supports\n")
+		_T("  range requests. The image is streamed without downloading it first.\n")
 		_T("  The destination bank must be either empty or deleted.\n")
 		_T("  [This command only works with RVT-H Readers, not disk images.]\n")
 		_T("\n")
-		_T("delete ") _T(DEVICE_NAME_EXAMPLE) _T(" bank#\n")
-		_T("- Delete the specified bank number from the specified RVT-H device.\n")
-		_T("  This does NOT wipe the disc image.\n")
+		_T("import ") _T(DEVICE_NAME_EXAMPLE) _T(" bank#=disc.gcm [bank#=disc.gcm...]\n")
+		_T("- Import several disc images in one pass. The next image is read ahead\n")
+		_T("  while the current image is imported, and the bank table is updated\n")
+		_T("  once at the end. If an image fails, the remaining images are skipped.\n")
+		_T("\n")
+		_T("create-hdd rvth.img disc.gcm [disc.gcm...]\n")
+		_T("- Create a new RVT-H disk image, rvth.img, as a sparse file, and import\n")
+		_T("  up to 8 disc images into it. The images are assigned to banks in\n")
+		_T("  order and imported concurrently, and the bank table is written once\n")
+		_T("  at the end. Dual-layer Wii images use two banks.\n")
+		_T("\n")
+		_T("clone ") _T(DEVICE_NAME_EXAMPLE) _T(" ") _T(DEVICE_NAME_EXAMPLE) _T("\n")
+		_T("- Copy every bank with a disc image from the first RVT-H device to the\n")
+		_T("  same bank on the second one, e.g. to replace a failing unit, and then\n")
+		_T("  compare each copied bank with the source. Empty and deleted banks\n")
+		_T("  aren't copied. The destination's banks must be empty or deleted.\n")
+		_T("  [This command only works with RVT-H Readers, not disk images.]\n")
+		_T("\n")
+		_T("delete ") _T(DEVICE_NAME_EXAMPLE) _T(" bank# [bank#...]\n")
+		_T("- Delete the specified bank numbers from the specified RVT-H device.\n")
+		_T("  This does NOT wipe the disc images. If any bank can't be deleted,\n")
+		_T("  none of the banks are deleted.\n")
 		_T("  [This command only works with RVT-H Readers, not disk images.]\n")
 		_T("\n")
-		_T("undelete ") _T(DEVICE_NAME_EXAMPLE) _T(" bank#\n")
-		_T("- Undelete the specified bank number from the specified RVT-H device.\n")
+		_T("undelete ") _T(DEVICE_NAME_EXAMPLE) _T(" bank# [bank#...]\n")
+		_T("- Undelete the specified bank numbers from the specified RVT-H device.\n")
+		_T("  If any bank can't be undeleted, none of the banks are undeleted.\n")
+		_T("  [This command only works with RVT-H Readers, not disk images.]\n")
+		_T("\n")
+		_T("recover ") _T(DEVICE_NAME_EXAMPLE) _T("\n")
+		_T("- Scan the entire RVT-H device for disc images, e.g. if the bank table\n")
+		_T("  is damaged, and list the candidates that were found, best first.\n")
+		_T("  Deleted banks at the standard bank addresses are also listed.\n")
+		_T("\n")
+		_T("wipe ") _T(DEVICE_NAME_EXAMPLE) _T(" bank#\n")
+		_T("- Wipe the specified bank number by writing zeroes to the entire bank.\n")
+		_T("  The bank must be either empty or deleted. A wiped bank can be used\n")
+		_T("  with 'import --skip-empty'.\n")
 		_T("  [This command only works with RVT-H Readers, not disk images.]\n")
 		_T("\n")
 		_T("verify ") _T(DEVICE_NAME_EXAMPLE) _T(" bank#\n")
 		_T("- Verify all hashes on an encrypted Wii or RVT-R bank or disc image.\n")
+		_T("  Specify \"all\" as the bank number to verify all Wii banks.\n")
+		_T("\n")
+		_T("repair ") _T(DEVICE_NAME_EXAMPLE) _T(" bank#\n")
+		_T("- Rebuild the hash tables of an encrypted Wii or RVT-R bank or disc\n")
+		_T("  image from its user data, e.g. after patching the decrypted data.\n")
+		_T("  Only the sectors with stale hash tables are rewritten, and the H3\n")
+		_T("  table and TMD are updated. (debug-signed or fakesigned)\n")
+		_T("\n")
+		_T("batch jobfile\n")
+		_T("- Run the extract, import, and verify jobs listed in jobfile, one per\n")
+		_T("  line, e.g. \"extract ") _T(DEVICE_NAME_EXAMPLE) _T(" 1 game.gcm\". Jobs for the\n")
+		_T("  same device run one at a time; different devices run in parallel.\n")
+		_T("  Specify \"-\" to read the job list from stdin.\n")
+		_T("\n")
+		_T("daemon socket\n")
+		_T("- Listen on the specified Unix domain socket for extract, import,\n")
+		_T("  verify, and list requests, one JSON object per line, e.g.\n")
+		_T("  {\"id\":1,\"cmd\":\"list\",\"device\":\"/dev/sdX\"}. Devices are\n")
+		_T("  kept open between requests. Requests for the same device run one at\n")
+		_T("  a time; different devices run in parallel. Send\n")
+		_T("  {\"cmd\":\"cancel\",\"target\":ID} to cancel a queued or running request,\n")
+		_T("  or {\"cmd\":\"metrics\"} to get per-device counters. (See --metrics.)\n")
+		_T("  POSIX systems only; the daemon isn't available on Windows.\n")
+		_T("\n")
+		_T("nbd-server ") _T(DEVICE_NAME_EXAMPLE) _T(" [[host:]port]\n")
+		_T("- Export each bank with a disc image as a read-only NBD device named\n")
+		_T("  bank1-bank8, e.g. for 'nbd-client -N bank2 server /dev/nbd0'. Listens\n")
+		_T("  on all addresses, port 10809 by default. Banks stored contiguously are\n")
+		_T("  sent straight from the page cache, without copying.\n")
+		_T("\n")
+		_T("bench ") _T(DEVICE_NAME_EXAMPLE) _T(" bank# [testfile]\n")
+		_T("- Measure the sequential and random read throughput of the specified\n")
+		_T("  bank, the AES and SHA-1 throughput, and the write throughput of\n")
+		_T("  testfile (if specified; must not exist), and show the bottleneck.\n")
+		_T("\n")
+		_T("scan ") _T(DEVICE_NAME_EXAMPLE) _T(" [mapfile]\n")
+		_T("- Read the whole device in large chunks and measure the latency of each\n")
+		_T("  chunk to find slow or unreadable sectors. The latency map is written to\n")
+		_T("  mapfile as tab-separated values, or printed if mapfile isn't specified.\n")
+		_T("  Use -j to read with multiple threads and --buffer-size to set the chunk\n")
+		_T("  size. (default is 4M)\n")
+		_T("\n")
+		_T("compare ") _T(DEVICE_NAME_EXAMPLE) _T(" bank# disc.gcm|") _T(DEVICE_NAME_EXAMPLE) _T(" [bank#]\n")
+		_T("- Compare the specified bank with a disc image or with a bank on another\n")
+		_T("  RVT-H device, and list the regions that differ. Both are read at the\n")
+		_T("  same time. Wii partitions are compared using their H3 tables first, so\n")
+		_T("  only the groups that differ are decrypted. Exits with 1 if they differ.\n")
+		_T("\n")
+		_T("identify ") _T(DEVICE_NAME_EXAMPLE) _T(" [bank#]\n")
+		_T("- Hash the specified bank, or all banks, and look up the digests in the\n")
+		_T("  DAT file specified using --dat. Each bank is read once, and GameCube\n")
+		_T("  banks can be identified even though they have no hash tree. Exits with\n")
+		_T("  1 if any bank isn't in the DAT file.\n")
 		_T("\n")
 		_T("query\n")
 		_T("- Query all available RVT-H Reader devices and list them.\n")
@@ -128,6 +396,115 @@ static void print_help(const TCHAR *argv0)
 		_T("                            Importing to RVT-H will always use debug keys.\n")
 		_T("  -N, --ndev                Prepend extracted images with a 32 KB header\n")
 		_T("                            required by official SDK tools.\n")
+		_T("  -s, --scrub               Don't copy the unused areas of encrypted Wii\n")
+		_T("                            partitions when extracting.\n")
+		_T("  --decrypt                 Decrypt the game partition of an encrypted Wii\n")
+		_T("                            image when extracting, using the unencrypted\n")
+		_T("                            RVT-R layout. Use --recrypt to encrypt it again.\n")
+		_T("  -z, --skip-empty          Don't write empty blocks when importing.\n")
+		_T("                            The destination bank must already be zeroed,\n")
+		_T("                            e.g. using the 'wipe' command.\n")
+		_T("  --diff                    Only write the data that differs from the\n")
+		_T("                            destination bank when importing. The bank may\n")
+		_T("                            already contain an image of the same type, e.g.\n")
+		_T("                            an older build of the same game.\n")
+		_T("  --readback                Read back each chunk from the destination bank\n")
+		_T("                            after it's flushed when importing, and compare\n")
+		_T("                            it to the data that was written. This runs while\n")
+		_T("                            the rest of the image is being written.\n")
+		_T("  --readback-window=SIZE    Distance that --readback trails the writer by,\n")
+		_T("                            e.g. 256M. (default is 64M)\n")
+		_T("  --base=FILE               Copy the Wii partition data that's identical in\n")
+		_T("                            FILE, e.g. an older dump of the same game, from\n")
+		_T("                            FILE instead of the device when extracting.\n")
+		_T("  --digests                 Calculate the CRC32, MD5, and SHA-1 of the disc\n")
+		_T("                            image while extracting or importing, and write\n")
+		_T("                            them to a .digests file next to the disc image.\n")
+		_T("  --dat=FILE                Look up the digests in a redump-style DAT file,\n")
+		_T("                            e.g. with --digests or 'identify'.\n")
+		_T("  --hash-index              Write a .hidx file with per-group hashes and\n")
+		_T("                            H3 tables of the Wii partitions when extracting.\n")
+		_T("  --alloc=MODE              How extracted plain disc images are allocated:\n")
+		_T("                            sparse (empty blocks aren't written),\n")
+		_T("                            prealloc (allocated up front and written in\n")
+		_T("                            order; empty areas are deallocated afterwards),\n")
+		_T("                            or auto (prealloc on ext4, NTFS, and FAT;\n")
+		_T("                            otherwise sparse). (default is auto)\n")
+		_T("  --update-store=DIR        Archival extraction: Write update partitions to\n")
+		_T("                            a shared store in DIR instead of the extracted\n")
+		_T("                            image, so each update is only stored once. Use\n")
+		_T("                            'reconstruct' to rebuild the full disc image.\n")
+		_T("  --buffer-size=SIZE        Copy buffer size for extracting and importing,\n")
+		_T("                            e.g. 4M. Must be a multiple of 64K.\n")
+		_T("                            (default is auto: 1M for disk images;\n")
+		_T("                            tuned by measuring RVT-H Reader devices)\n")
+		_T("  --buffer-count=N          Number of copy buffers. (default is 3)\n")
+		_T("  --buffer-align=N          Copy buffer alignment. (default is 4K)\n")
+		_T("  --hole-size=SIZE          Minimum run of empty blocks that's skipped when\n")
+		_T("                            writing sparsely. Shorter runs are written along\n")
+		_T("                            with the surrounding data. Must be a multiple\n")
+		_T("                            of 4K. (default is 64K)\n")
+		_T("  --direct-io               Bypass the OS page cache when reading from or\n")
+		_T("                            writing to an RVT-H Reader device.\n")
+		_T("  --mem-budget=SIZE         Limit the memory used for in-flight buffers,\n")
+		_T("                            e.g. 256M. Worker threads and copy buffers are\n")
+		_T("                            reduced to fit. 'batch' divides the budget\n")
+		_T("                            between devices. (minimum is 8M; default is\n")
+		_T("                            no limit)\n")
+		_T("  --io-priority=PRIO        I/O priority for reads and writes: normal, low,\n")
+		_T("                            idle. Use low or idle for background jobs, so\n")
+		_T("                            they don't slow down other users of the device.\n")
+		_T("  --bw-limit=SIZE           Limit reads and writes to SIZE per second,\n")
+		_T("                            e.g. 20M. (default is no limit)\n")
+		_T("  --durability=MODE         When written data is synced to the media:\n")
+		_T("                            checkpoint (e.g. after each imported chunk),\n")
+		_T("                            none, end (at the end of each job), interval\n")
+		_T("                            (every --sync-interval), write-through (after\n")
+		_T("                            every write). The bank table is always synced,\n")
+		_T("                            except with none. (default is checkpoint)\n")
+		_T("  --sync-interval=SIZE      Sync interval for --durability=interval,\n")
+		_T("                            e.g. 1024M. (default is 256M)\n")
+		_T("  --block-cache=SIZE        Cache small reads from each RVT-H bank, e.g. the\n")
+		_T("                            partition tables, in SIZE of memory. Must be a\n")
+		_T("                            multiple of 32K; 0 disables it. (default is 1M)\n")
+		_T("  -j, --threads=N           Use N worker threads for verification.\n")
+		_T("                            (default is one per CPU; 1 is single-threaded)\n")
+		_T("  --quick                   Quick verification: Only check the hash tables,\n")
+		_T("                            plus the user data in a random sample of groups.\n")
+		_T("  --skip-known              Don't check the user data of update partitions\n")
+		_T("                            that passed a previous full verification.\n")
+		_T("                            Their hash tables are still checked.\n")
+		_T("  --resume                  Save verification checkpoints and extract/import\n")
+		_T("                            progress journals, and resume from the last\n")
+		_T("                            checkpoint or journal if the job was stopped.\n")
+		_T("  --reconnect=SECS          'batch': If an RVT-H Reader disconnects during\n")
+		_T("                            a job, wait up to SECS seconds for it to come\n")
+		_T("                            back, possibly with a new device name, then\n")
+		_T("                            resume the job from its last checkpoint.\n")
+		_T("                            (default is 0: the job fails)\n")
+		_T("  --metrics=FILE            'daemon': Write per-device metrics to FILE every\n")
+		_T("                            10 seconds, in the Prometheus text format if\n")
+		_T("                            FILE ends with \".prom\", or as JSON otherwise.\n")
+		_T("  --force                   Verify banks even if they haven't been rewritten\n")
+		_T("                            since they were last verified.\n")
+		_T("  --json                    Print machine-readable JSON reports when verifying\n")
+		_T("                            or extracting. Verification reports include\n")
+		_T("                            per-partition summaries with run-length-encoded\n")
+		_T("                            lists of bad and zeroed sectors.\n")
+		_T("  --format=FORMAT           Output format for 'list': text, json\n")
+		_T("  --fields=FIELD[,FIELD...] Bank fields for 'list --format=json'.\n")
+		_T("  --stats                   Print I/O and processing statistics to stderr\n")
+		_T("                            after extracting, importing, or verifying.\n")
+		_T("  --readahead=SIZE          Per-client read-ahead for 'nbd-server', e.g. 4M.\n")
+		_T("                            0 disables read-ahead. (default is 2M)\n")
+		_T("  --trace=FILE              Record a timeline of I/O, crypto, and bank\n")
+		_T("                            initialization spans, and write it to FILE as\n")
+		_T("                            Chrome trace JSON for Perfetto. The RVTH_TRACE\n")
+		_T("                            environment variable can be used instead.\n")
+		_T("  --slow-read=MS            Measure the latency of each read when extracting\n")
+		_T("                            or verifying, and report reads that took at least\n")
+		_T("                            MS milliseconds, e.g. due to a failing HDD.\n")
+		_T("                            (default for 'scan' is 500)\n")
 #ifdef SHOW_HIDDEN_OPTIONS
 		_T("  -I, --ios=xx              Force IOSxx when importing a disc image to\n")
 		_T("                            an RVT-H Reader.")
@@ -141,6 +518,7 @@ int RVTH_CDECL _tmain(int argc, TCHAR *argv[])
 {
 	int ret;
 	unsigned int flags = 0;
+	unsigned int import_flags = 0;
 
 	// Key to use for recryption.
 	// -1 == default; no recryption, except when importing retail to RVT-H.
@@ -151,6 +529,47 @@ int RVTH_CDECL _tmain(int argc, TCHAR *argv[])
 	// Default is -1, or "use existing IOS".
 	int ios_force = -1;
 
+	// Copy buffer and I/O parameters for extracting, importing, and verifying.
+	// Default is all 0, or "automatic".
+	RvtH_CopyParams copy_params = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+	// Number of worker threads for verification.
+	// Default is 0, or "one per CPU".
+	unsigned int threads = 0;
+
+	// Verification flags.
+	unsigned int verify_flags = RVTH_VERIFY_USE_CACHE;
+
+	// Seconds to wait for a disconnected RVT-H Reader. (batch)
+	unsigned int reconnect_timeout = 0;
+
+	// Print JSON reports instead of text.
+	bool json = false;
+
+	// Partition store directory for archival extraction.
+	const TCHAR *store_dir = NULL;
+
+	// Base image for delta extraction.
+	const TCHAR *base_filename = NULL;
+
+	// DAT file for identifying disc images.
+	const TCHAR *dat_filename = NULL;
+
+	// Metrics file for 'daemon'.
+	const TCHAR *metrics_filename = NULL;
+
+	// Bank fields for 'list --format=json'. (NULL for all)
+	const TCHAR *list_fields = NULL;
+
+	// Print performance statistics.
+	bool stats = false;
+
+	// Per-client read-ahead for 'nbd-server'.
+	unsigned int readahead = NBD_DEFAULT_READAHEAD;
+
+	// Trace file. (NULL to check the RVTH_TRACE environment variable)
+	const TCHAR *trace_filename = NULL;
+
 #ifdef _WIN32
 	// Set Win32 security options.
 	secoptions_init();
@@ -159,17 +578,20 @@ int RVTH_CDECL _tmain(int argc, TCHAR *argv[])
 	// Set the C locale.
 	setlocale(LC_ALL, "");
 
+	// JSON reports and streamed disc images are printed to stdout,
+	// so the program information is printed to stderr instead.
+	FILE *const f_info = ((has_json_option(argc, argv) || has_stdout_filename(argc, argv)) ? stderr : stdout);
 	_fputts(_T("RVT-H Tool v") _T(VERSION_STRING) _T("\n")
 		_T("Copyright (c) 2018-2024 by David Korth.\n")
-		_T("This program is NOT licensed or endorsed by Nintendo Co., Ltd.\n"), stdout);
+		_T("This program is NOT licensed or endorsed by Nintendo Co., Ltd.\n"), f_info);
 #ifdef RP_GIT_VERSION
 	fputs(RP_GIT_VERSION "\n"
 #  ifdef RP_GIT_DESCRIBE
 		RP_GIT_DESCRIBE "\n"
 #  endif /* RP_GIT_DESCRIBE */
-		, stdout);
+		, f_info);
 #endif /* RP_GIT_VERSION */
-	_fputtc(_T('\n'), stdout);
+	_fputtc(_T('\n'), f_info);
 
 	// Unicode getopt() for Windows:
 	// - https://www.codeproject.com/Articles/157001/Full-getopt-Port-for-Unicode-and-Multibyte-Microso
@@ -178,13 +600,50 @@ int RVTH_CDECL _tmain(int argc, TCHAR *argv[])
 		static const struct option long_options[] = {
 			{_T("recrypt"),	required_argument,	0, _T('k')},
 			{_T("ndev"),	no_argument,		0, _T('N')},
+			{_T("scrub"),	no_argument,		0, _T('s')},
+			{_T("decrypt"),	no_argument,		0, OPT_DECRYPT},
+			{_T("skip-empty"), no_argument,		0, _T('z')},
+			{_T("digests"),	no_argument,		0, OPT_DIGESTS},
+			{_T("diff"),	no_argument,		0, OPT_DIFF},
+			{_T("base"),	required_argument,	0, OPT_BASE},
+			{_T("hash-index"), no_argument,		0, OPT_HASH_INDEX},
+			{_T("dat"),	required_argument,	0, OPT_DAT},
+			{_T("json"),	no_argument,		0, OPT_JSON},
+			{_T("format"),	required_argument,	0, OPT_FORMAT},
+			{_T("fields"),	required_argument,	0, OPT_FIELDS},
+			{_T("stats"),	no_argument,		0, OPT_STATS},
+			{_T("readahead"), required_argument,	0, OPT_READAHEAD},
+			{_T("trace"),	required_argument,	0, OPT_TRACE},
+			{_T("slow-read"), required_argument,	0, OPT_SLOW_READ},
+			{_T("mem-budget"), required_argument,	0, OPT_MEM_BUDGET},
+			{_T("io-priority"), required_argument,	0, OPT_IO_PRIORITY},
+			{_T("bw-limit"), required_argument,	0, OPT_BW_LIMIT},
+			{_T("readback"), no_argument,		0, OPT_READBACK},
+			{_T("readback-window"), required_argument, 0, OPT_READBACK_WINDOW},
+			{_T("durability"), required_argument,	0, OPT_DURABILITY},
+			{_T("sync-interval"), required_argument, 0, OPT_SYNC_INTERVAL},
+			{_T("block-cache"), required_argument,	0, OPT_BLOCK_CACHE},
+			{_T("update-store"), required_argument,	0, OPT_UPDATE_STORE},
+			{_T("direct-io"), no_argument,		0, OPT_DIRECT_IO},
+			{_T("alloc"),	required_argument,	0, OPT_ALLOC},
 			{_T("ios"),	required_argument,	0, _T('I')},
+			{_T("threads"),	required_argument,	0, _T('j')},
+			{_T("buffer-size"),	required_argument,	0, OPT_BUFFER_SIZE},
+			{_T("buffer-count"),	required_argument,	0, OPT_BUFFER_COUNT},
+			{_T("buffer-align"),	required_argument,	0, OPT_BUFFER_ALIGN},
+			{_T("hole-size"),	required_argument,	0, OPT_HOLE_SIZE},
+			{_T("quick"),	no_argument,		0, OPT_QUICK},
+			{_T("skip-known"), no_argument,		0, OPT_SKIP_KNOWN},
+			{_T("resume"),	no_argument,		0, OPT_RESUME},
+			{_T("reconnect"), required_argument,	0, OPT_RECONNECT},
+			{_T("metrics"),	required_argument,	0, OPT_METRICS},
+			{_T("force"),	no_argument,		0, OPT_FORCE},
 			{_T("help"),	no_argument,		0, _T('h')},
 
 			{NULL, 0, 0, 0}
 		};
 
-		int c = getopt_long(argc, argv, _T("k:NI:h"), long_options, NULL);
+		int c = getopt_long(argc, argv, _T("k:NszI:j:h"), long_options, NULL);
 		if (c == -1)
 			break;
 
@@ -220,6 +679,83 @@ int RVTH_CDECL _tmain(int argc, TCHAR *argv[])
 				flags |= RVTH_EXTRACT_PREPEND_SDK_HEADER;
 				break;
 
+			case _T('s'):
+				// Skip unused areas of Wii partitions.
+				flags |= RVTH_EXTRACT_SCRUB;
+				break;
+
+			case OPT_DECRYPT:
+				// Decrypt Wii images when extracting.
+				flags |= RVTH_EXTRACT_DECRYPT;
+				break;
+
+			case _T('z'):
+				// Don't write empty blocks when importing.
+				import_flags |= RVTH_IMPORT_SKIP_EMPTY;
+				break;
+
+			case OPT_DIFF:
+				// Differential import.
+				import_flags |= RVTH_IMPORT_DIFFERENTIAL;
+				break;
+
+			case OPT_READBACK:
+				// Read-back verification when importing.
+				import_flags |= RVTH_IMPORT_READBACK;
+				break;
+
+			case OPT_READBACK_WINDOW: {
+				// Read-back verification window.
+				unsigned int window_tmp;
+				if (parse_size(optarg, &window_tmp) != 0 || window_tmp < 1024U*1024U) {
+					print_error(argv[0], _T("read-back window '%s' is not valid"), optarg);
+					return EXIT_FAILURE;
+				}
+				copy_params.readback_window = window_tmp >> 20;
+				break;
+			}
+
+			case OPT_BASE:
+				// Base image for delta extraction.
+				base_filename = optarg;
+				break;
+
+			case OPT_DAT:
+				// DAT file for identifying disc images.
+				dat_filename = optarg;
+				break;
+
+			case OPT_METRICS:
+				// Metrics file for 'daemon'.
+				metrics_filename = optarg;
+				break;
+
+			case OPT_DIGESTS:
+				// Calculate image digests.
+				flags |= RVTH_EXTRACT_DIGESTS;
+				import_flags |= RVTH_IMPORT_DIGESTS;
+				break;
+
+			case OPT_HASH_INDEX:
+				// Write a hash index when extracting.
+				flags |= RVTH_EXTRACT_HASH_INDEX;
+				break;
+
+			case OPT_ALLOC:
+				// Destination allocation when extracting.
+				flags &= ~(RVTH_EXTRACT_SPARSE | RVTH_EXTRACT_PREALLOCATE);
+				if (!_tcsicmp(optarg, _T("auto"))) {
+					// Determined by the destination file system.
+				} else if (!_tcsicmp(optarg, _T("sparse"))) {
+					flags |= RVTH_EXTRACT_SPARSE;
+				} else if (!_tcsicmp(optarg, _T("prealloc"))) {
+					flags |= RVTH_EXTRACT_PREALLOCATE;
+				} else {
+					print_error(argv[0], _T("unknown allocation mode '%s'"), optarg);
+					return EXIT_FAILURE;
+				}
+				break;
+
 			case _T('I'): {
 				// Force an IOS version.
 				TCHAR *endptr;
@@ -235,6 +771,246 @@ int RVTH_CDECL _tmain(int argc, TCHAR *argv[])
 				break;
 			}
 
+			case _T('j'): {
+				// Number of worker threads.
+				TCHAR *endptr;
+				long threads_tmp = _tcstol(optarg, &endptr, 10);
+				if (*endptr != '\0') {
+					print_error(argv[0], _T("unable to parse '%s' as a thread count"), optarg);
+					return EXIT_FAILURE;
+				} else if (threads_tmp < 1 || threads_tmp > 256) {
+					print_error(argv[0], _T("thread count %ld is not valid"), threads_tmp);
+					return EXIT_FAILURE;
+				}
+				threads = (unsigned int)threads_tmp;
+				break;
+			}
+
+			case OPT_BUFFER_SIZE:
+				// Copy buffer size.
+				if (parse_size(optarg, &copy_params.buf_size) != 0 ||
+				    copy_params.buf_size == 0 ||
+				    copy_params.buf_size % RVTH_COPY_BUF_SIZE_MIN != 0 ||
+				    copy_params.buf_size > RVTH_COPY_BUF_SIZE_MAX)
+				{
+					print_error(argv[0], _T("buffer size '%s' is not valid"), optarg);
+					return EXIT_FAILURE;
+				}
+				break;
+
+			case OPT_BUFFER_COUNT: {
+				// Number of copy buffers.
+				TCHAR *endptr;
+				long count_tmp = _tcstol(optarg, &endptr, 10);
+				if (*endptr != '\0' || count_tmp < 2 || count_tmp > (long)RVTH_COPY_BUF_COUNT_MAX) {
+					print_error(argv[0], _T("buffer count '%s' is not valid"), optarg);
+					return EXIT_FAILURE;
+				}
+				copy_params.buf_count = (unsigned int)count_tmp;
+				break;
+			}
+
+			case OPT_BUFFER_ALIGN:
+				// Copy buffer alignment.
+				if (parse_size(optarg, &copy_params.alignment) != 0 ||
+				    copy_params.alignment == 0 ||
+				    (copy_params.alignment & (copy_params.alignment - 1)) != 0 ||
+				    copy_params.alignment > RVTH_COPY_ALIGNMENT_MAX)
+				{
+					print_error(argv[0], _T("buffer alignment '%s' is not valid"), optarg);
+					return EXIT_FAILURE;
+				}
+				break;
+
+			case OPT_HOLE_SIZE:
+				// Minimum hole size for sparse writes.
+				if (parse_size(optarg, &copy_params.hole_size) != 0 ||
+				    copy_params.hole_size == 0 ||
+				    copy_params.hole_size % RVTH_COPY_HOLE_SIZE_MIN != 0 ||
+				    copy_params.hole_size > RVTH_COPY_BUF_SIZE_MAX)
+				{
+					print_error(argv[0], _T("hole size '%s' is not valid"), optarg);
+					return EXIT_FAILURE;
+				}
+				break;
+
+			case OPT_DIRECT_IO:
+				// Use direct I/O for RVT-H Reader devices.
+				copy_params.direct_io = 1;
+				break;
+
+			case OPT_QUICK:
+				// Quick verification.
+				verify_flags |= RVTH_VERIFY_QUICK;
+				break;
+
+			case OPT_SKIP_KNOWN:
+				// Skip known-good update partitions.
+				verify_flags |= RVTH_VERIFY_SKIP_KNOWN_PARTITIONS;
+				break;
+
+			case OPT_RESUME:
+				// Resumable verification, extraction, and import.
+				verify_flags |= RVTH_VERIFY_CHECKPOINT;
+				flags |= RVTH_EXTRACT_RESUME;
+				import_flags |= RVTH_IMPORT_RESUME;
+				break;
+
+			case OPT_RECONNECT: {
+				// Reconnect timeout for batch jobs.
+				TCHAR *endptr;
+				long timeout_tmp = _tcstol(optarg, &endptr, 10);
+				if (*endptr != '\0' || timeout_tmp < 0 || timeout_tmp > 86400) {
+					print_error(argv[0], _T("reconnect timeout '%s' is not valid"), optarg);
+					return EXIT_FAILURE;
+				}
+				reconnect_timeout = (unsigned int)timeout_tmp;
+				break;
+			}
+
+			case OPT_FORCE:
+				// Don't use cached verification results.
+				verify_flags &= ~RVTH_VERIFY_USE_CACHE;
+				break;
+
+			case OPT_JSON:
+				// Print JSON reports.
+				json = true;
+				break;
+
+			case OPT_FORMAT:
+				// Output format.
+				if (!_tcsicmp(optarg, _T("json"))) {
+					json = true;
+				} else if (!_tcsicmp(optarg, _T("text"))) {
+					json = false;
+				} else {
+					print_error(argv[0], _T("unknown output format '%s'"), optarg);
+					return EXIT_FAILURE;
+				}
+				break;
+
+			case OPT_FIELDS:
+				// Bank fields for JSON listings.
+				list_fields = optarg;
+				break;
+
+			case OPT_STATS:
+				// Print performance statistics.
+				stats = true;
+				break;
+
+			case OPT_READAHEAD:
+				// Per-client read-ahead for NBD exports.
+				if (parse_size(optarg, &readahead) != 0) {
+					print_error(argv[0], _T("read-ahead size '%s' is not valid"), optarg);
+					return EXIT_FAILURE;
+				}
+				break;
+
+			case OPT_TRACE:
+				// Record a trace.
+				trace_filename = optarg;
+				break;
+
+			case OPT_SLOW_READ: {
+				// Slow read threshold.
+				TCHAR *endptr;
+				long ms_tmp = _tcstol(optarg, &endptr, 10);
+				if (*endptr != 0 || ms_tmp < 1 || ms_tmp > 3600000) {
+					print_error(argv[0], _T("slow read threshold '%s' is not valid"), optarg);
+					return EXIT_FAILURE;
+				}
+				copy_params.slow_read_ms = (unsigned int)ms_tmp;
+				break;
+			}
+
+			case OPT_MEM_BUDGET: {
+				// Memory budget.
+				unsigned int budget_tmp;
+				if (parse_size(optarg, &budget_tmp) != 0 ||
+				    (budget_tmp >> 20) < RVTH_MEM_BUDGET_MIN)
+				{
+					print_error(argv[0], _T("memory budget '%s' is not valid"), optarg);
+					return EXIT_FAILURE;
+				}
+				copy_params.mem_budget = budget_tmp >> 20;
+				break;
+			}
+
+			case OPT_DURABILITY:
+				// Durability policy.
+				if (!_tcsicmp(optarg, _T("checkpoint"))) {
+					copy_params.durability = RVTH_DURABILITY_CHECKPOINT;
+				} else if (!_tcsicmp(optarg, _T("none"))) {
+					copy_params.durability = RVTH_DURABILITY_NONE;
+				} else if (!_tcsicmp(optarg, _T("end"))) {
+					copy_params.durability = RVTH_DURABILITY_END_OF_JOB;
+				} else if (!_tcsicmp(optarg, _T("interval"))) {
+					copy_params.durability = RVTH_DURABILITY_INTERVAL;
+				} else if (!_tcsicmp(optarg, _T("write-through"))) {
+					copy_params.durability = RVTH_DURABILITY_WRITE_THROUGH;
+				} else {
+					print_error(argv[0], _T("unknown durability mode '%s'"), optarg);
+					return EXIT_FAILURE;
+				}
+				break;
+
+			case OPT_SYNC_INTERVAL: {
+				// Sync interval.
+				unsigned int interval_tmp;
+				if (parse_size(optarg, &interval_tmp) != 0 || interval_tmp < 1024U*1024U) {
+					print_error(argv[0], _T("sync interval '%s' is not valid"), optarg);
+					return EXIT_FAILURE;
+				}
+				copy_params.sync_interval = interval_tmp >> 20;
+				break;
+			}
+
+			case OPT_BLOCK_CACHE: {
+				// Block cache size.
+				unsigned int cache_tmp;
+				if (parse_size(optarg, &cache_tmp) != 0 || cache_tmp % (32U*1024U) != 0 ||
+				    (cache_tmp >> 10) > RVTH_BLOCK_CACHE_MAX)
+				{
+					print_error(argv[0], _T("block cache size '%s' is not valid"), optarg);
+					return EXIT_FAILURE;
+				}
+				copy_params.block_cache = (cache_tmp != 0 ? (cache_tmp >> 10) : RVTH_BLOCK_CACHE_DISABLED);
+				break;
+			}
+
+			case OPT_IO_PRIORITY:
+				// I/O priority.
+				if (!_tcsicmp(optarg, _T("normal"))) {
+					copy_params.io_priority = RVTH_IOPRIO_NORMAL;
+				} else if (!_tcsicmp(optarg, _T("low"))) {
+					copy_params.io_priority = RVTH_IOPRIO_LOW;
+				} else if (!_tcsicmp(optarg, _T("idle"))) {
+					copy_params.io_priority = RVTH_IOPRIO_IDLE;
+				} else {
+					print_error(argv[0], _T("unknown I/O priority '%s'"), optarg);
+					return EXIT_FAILURE;
+				}
+				break;
+
+			case OPT_BW_LIMIT: {
+				// Bandwidth limit.
+				unsigned int bw_tmp;
+				if (parse_size(optarg, &bw_tmp) != 0 || bw_tmp < 1024) {
+					print_error(argv[0], _T("bandwidth limit '%s' is not valid"), optarg);
+					return EXIT_FAILURE;
+				}
+				copy_params.bw_limit = bw_tmp / 1024;
+				break;
+			}
+
+			case OPT_UPDATE_STORE:
+				// Store update partitions when extracting.
+				store_dir = optarg;
+				flags |= RVTH_EXTRACT_STORE_UPDATES;
+				break;
+
 			case _T('h'):
 				print_help(argv[0]);
 				return EXIT_SUCCESS;
@@ -246,6 +1022,20 @@ int RVTH_CDECL _tmain(int argc, TCHAR *argv[])
 		}
 	}
 
+	// Start recording a trace.
+	ret = (trace_filename ? rvth_trace_start(trace_filename) : rvth_trace_start_from_env());
+	if (ret != 0) {
+		_ftprintf(stderr, _T("%s: unable to start the trace: "), argv[0]);
+		fprintf(stderr, "%s\n", strerror(-ret));
+		return EXIT_FAILURE;
+	}
+	atexit(stop_trace);
+
+	if (dat_filename && load_dat_file(dat_filename) != 0) {
+		// Error loading the DAT file. (An error message was printed.)
+		return EXIT_FAILURE;
+	}
+
 	// First argument after getopt-parsed arguments is set in optind.
 	if (optind >= argc) {
 		print_error(argv[0], _T("no parameters specified"));
@@ -264,7 +1054,11 @@ int RVTH_CDECL _tmain(int argc, TCHAR *argv[])
 			print_error(argv[0], _T("RVT-H device or disk image not specified"));
 			return EXIT_FAILURE;
 		}
-		ret = list_banks(argv[optind+1]);
+		if (argc > optind+2) {
+			ret = list_images((const TCHAR *const *)&argv[optind+1], argc - (optind+1), json, list_fields);
+		} else {
+			ret = list_banks(argv[optind+1], json, list_fields);
+		}
 	} else if (!_tcscmp(argv[optind], _T("extract"))) {
 		// Extract a bank.
 		if (argc < optind+3) {
@@ -275,32 +1069,114 @@ int RVTH_CDECL _tmain(int argc, TCHAR *argv[])
 			// Pass NULL as the bank number, which will be
 			// interpreted as bank 1 for single-disc images
 			// and an error for HDD images.
-			ret = extract(argv[optind+1], NULL, argv[optind+2], recrypt_key, flags);
+			ret = extract(argv[optind+1], NULL, argv[optind+2], recrypt_key, flags, store_dir, base_filename, &copy_params, json, stats);
+		} else if (argc == optind+4) {
+			// Three parameters specified.
+			ret = extract(argv[optind+1], argv[optind+2], argv[optind+3], recrypt_key, flags, store_dir, base_filename, &copy_params, json, stats);
+		} else {
+			// Multiple destinations.
+			if (recrypt_key >= 0 || store_dir || base_filename || json ||
+			    (flags & RVTH_EXTRACT_HASH_INDEX))
+			{
+				print_error(argv[0], _T("-k, --hash-index, --update-store, --base, and --json can't be used with multiple destinations"));
+				return EXIT_FAILURE;
+			}
+			ret = extract_tee(argv[optind+1], argv[optind+2], (const TCHAR *const *)&argv[optind+3], argc - (optind+3),
+				flags, &copy_params, stats);
+		}
+	} else if (!_tcscmp(argv[optind], _T("list-files"))) {
+		// List the files in a bank.
+		if (argc < optind+2) {
+			print_error(argv[0], _T("missing parameters for 'list-files'"));
+			return EXIT_FAILURE;
+		}
+		ret = list_files(argv[optind+1], (argc > optind+2 ? argv[optind+2] : NULL));
+	} else if (!_tcscmp(argv[optind], _T("extract-file"))) {
+		// Extract a single file from a bank.
+		if (argc < optind+4) {
+			print_error(argv[0], _T("missing parameters for 'extract-file'"));
+			return EXIT_FAILURE;
+		} else if (argc == optind+4) {
+			// Three parameters specified.
+			// Pass NULL as the bank number, which will be
+			// interpreted as bank 1 for single-disc images
+			// and an error for HDD images.
+			ret = extract_file(argv[optind+1], NULL, argv[optind+2], argv[optind+3]);
 		} else {
-			// Three or more parameters specified.
-			ret = extract(argv[optind+1], argv[optind+2], argv[optind+3], recrypt_key, flags);
+			ret = extract_file(argv[optind+1], argv[optind+2], argv[optind+3], argv[optind+4]);
+		}
+	} else if (!_tcscmp(argv[optind], _T("reconstruct"))) {
+		// Reconstruct an archived disc image.
+		if (argc < optind+3) {
+			print_error(argv[0], _T("missing parameters for 'reconstruct'"));
+			return EXIT_FAILURE;
+		} else if (!store_dir) {
+			print_error(argv[0], _T("'reconstruct' requires --update-store"));
+			return EXIT_FAILURE;
+		}
+		ret = reconstruct(argv[optind+1], argv[optind+2], store_dir, &copy_params);
+	} else if (!_tcscmp(argv[optind], _T("convert"))) {
+		// Convert a disc image to another format.
+		if (argc < optind+3) {
+			print_error(argv[0], _T("missing parameters for 'convert'"));
+			return EXIT_FAILURE;
 		}
+		ret = convert(argv[optind+1], argv[optind+2], flags, &copy_params, stats);
 	} else if (!_tcscmp(argv[optind], _T("import"))) {
 		// Import a bank.
-		if (argc < optind+4) {
+		if (argc >= optind+3 && _tcschr(argv[optind+2], _T('='))) {
+			// Multiple banks. (bank#=disc.gcm)
+			ret = import_multi(argv[optind+1], (const TCHAR *const *)&argv[optind+2], argc - (optind+2),
+				ios_force, import_flags, &copy_params, stats);
+		} else if (argc < optind+4) {
 			print_error(argv[0], _T("missing parameters for 'import'"));
 			return EXIT_FAILURE;
+		} else {
+			ret = import(argv[optind+1], argv[optind+2], argv[optind+3], ios_force, import_flags, &copy_params, stats);
+		}
+	} else if (!_tcscmp(argv[optind], _T("create-hdd"))) {
+		// Create an RVT-H disk image from disc images.
+		if (argc < optind+3) {
+			print_error(argv[0], _T("missing parameters for 'create-hdd'"));
+			return EXIT_FAILURE;
+		}
+		ret = create_hdd(argv[optind+1], (const TCHAR *const *)&argv[optind+2], argc - (optind+2),
+			ios_force, import_flags, &copy_params, stats);
+	} else if (!_tcscmp(argv[optind], _T("clone"))) {
+		// Clone an RVT-H device.
+		if (argc < optind+3) {
+			print_error(argv[0], _T("missing parameters for 'clone'"));
+			return EXIT_FAILURE;
 		}
-		ret = import(argv[optind+1], argv[optind+2], argv[optind+3], ios_force);
+		ret = clone_hdd(argv[optind+1], argv[optind+2], import_flags, &copy_params, stats);
 	} else if (!_tcscmp(argv[optind], _T("delete"))) {
 		// Delete a bank.
-		if (argc < 3) {
+		if (argc < optind+3) {
 			print_error(argv[0], _T("missing parameters for 'delete'"));
 			return EXIT_FAILURE;
 		}
-		ret = delete_bank(argv[optind+1], argv[optind+2]);
+		ret = delete_bank(argv[optind+1], (const TCHAR *const *)&argv[optind+2], argc - (optind+2));
 	} else if (!_tcscmp(argv[optind], _T("undelete"))) {
 		// Undelete a bank.
-		if (argc < 3) {
+		if (argc < optind+3) {
 			print_error(argv[0], _T("missing parameters for 'undelete'"));
 			return EXIT_FAILURE;
 		}
-		ret = undelete_bank(argv[optind+1], argv[optind+2]);
+		ret = undelete_bank(argv[optind+1], (const TCHAR *const *)&argv[optind+2], argc - (optind+2));
+	} else if (!_tcscmp(argv[optind], _T("recover"))) {
+		// Scan for lost banks.
+		if (argc < optind+2) {
+			print_error(argv[0], _T("missing parameters for 'recover'"));
+			return EXIT_FAILURE;
+		}
+		ret = recover_banks(argv[optind+1]);
+	} else if (!_tcscmp(argv[optind], _T("wipe"))) {
+		// Wipe a bank.
+		if (argc < optind+3) {
+			print_error(argv[0], _T("missing parameters for 'wipe'"));
+			return EXIT_FAILURE;
+		}
+		ret = wipe_bank(argv[optind+1], argv[optind+2]);
 	} else if (!_tcscmp(argv[optind], _T("verify"))) {
 		// Verify a bank.
 		if (argc < optind+2) {
@@ -311,11 +1187,97 @@ int RVTH_CDECL _tmain(int argc, TCHAR *argv[])
 			// Pass NULL as the bank number, which will be
 			// interpreted as bank 1 for single-disc images
 			// and an error for HDD images.
-			ret = verify(argv[optind+1], NULL);
+			ret = verify(argv[optind+1], NULL, threads, verify_flags, &copy_params, json, stats);
 		} else {
 			// Two or more parameters specified.
-			ret = verify(argv[optind+1], argv[optind+2]);
+			ret = verify(argv[optind+1], argv[optind+2], threads, verify_flags, &copy_params, json, stats);
+		}
+	} else if (!_tcscmp(argv[optind], _T("repair"))) {
+		// Repair the hash tree of a bank.
+		if (argc < optind+2) {
+			print_error(argv[0], _T("missing parameters for 'repair'"));
+			return EXIT_FAILURE;
+		}
+		ret = repair(argv[optind+1], (argc > optind+2 ? argv[optind+2] : NULL), threads);
+	} else if (!_tcscmp(argv[optind], _T("batch"))) {
+		// Run a job list.
+		Batch_Options batch_options;
+		if (argc < optind+2) {
+			print_error(argv[0], _T("job file not specified"));
+			return EXIT_FAILURE;
+		}
+		batch_options.recrypt_key = recrypt_key;
+		batch_options.extract_flags = flags;
+		batch_options.store_dir = store_dir;
+		batch_options.ios_force = ios_force;
+		batch_options.import_flags = import_flags;
+		batch_options.verify_flags = verify_flags;
+		batch_options.threads = threads;
+		batch_options.copy_params = copy_params;
+		batch_options.reconnect_timeout = reconnect_timeout;
+		ret = batch(argv[optind+1], &batch_options);
+	} else if (!_tcscmp(argv[optind], _T("daemon"))) {
+		// Serve requests over a local socket.
+		Batch_Options daemon_options;
+		if (argc < optind+2) {
+			print_error(argv[0], _T("socket not specified"));
+			return EXIT_FAILURE;
+		}
+		daemon_options.recrypt_key = recrypt_key;
+		daemon_options.extract_flags = flags;
+		daemon_options.store_dir = store_dir;
+		daemon_options.ios_force = ios_force;
+		daemon_options.import_flags = import_flags;
+		daemon_options.verify_flags = verify_flags;
+		daemon_options.threads = threads;
+		daemon_options.copy_params = copy_params;
+		daemon_options.reconnect_timeout = 0;	// Not supported by the daemon.
+		ret = run_daemon(argv[optind+1], &daemon_options, metrics_filename);
+	} else if (!_tcscmp(argv[optind], _T("nbd-server"))) {
+		// Export banks over the network.
+		if (argc < optind+2) {
+			print_error(argv[0], _T("RVT-H device or disk image not specified"));
+			return EXIT_FAILURE;
+		}
+		ret = nbd_server(argv[optind+1], (argc > optind+2 ? argv[optind+2] : NULL), readahead);
+	} else if (!_tcscmp(argv[optind], _T("bench"))) {
+		// Benchmark a bank.
+		if (argc < optind+2) {
+			print_error(argv[0], _T("missing parameters for 'bench'"));
+			return EXIT_FAILURE;
+		} else if (argc == optind+2) {
+			// One parameter specified.
+			// Pass NULL as the bank number, which will be
+			// interpreted as bank 1 for single-disc images
+			// and an error for HDD images.
+			ret = bench(argv[optind+1], NULL, NULL, threads, &copy_params);
+		} else {
+			// Two or more parameters specified.
+			ret = bench(argv[optind+1], argv[optind+2],
+				(argc > optind+3 ? argv[optind+3] : NULL), threads, &copy_params);
+		}
+	} else if (!_tcscmp(argv[optind], _T("scan"))) {
+		// Scan for slow sectors.
+		if (argc < optind+2) {
+			print_error(argv[0], _T("RVT-H device or disk image not specified"));
+			return EXIT_FAILURE;
+		}
+		ret = scan(argv[optind+1], (argc > optind+2 ? argv[optind+2] : NULL), threads, &copy_params);
+	} else if (!_tcscmp(argv[optind], _T("compare"))) {
+		// Compare two banks.
+		if (argc < optind+4) {
+			print_error(argv[0], _T("missing parameters for 'compare'"));
+			return EXIT_FAILURE;
+		}
+		ret = compare(argv[optind+1], argv[optind+2], argv[optind+3],
+			(argc > optind+4 ? argv[optind+4] : NULL), &copy_params);
+	} else if (!_tcscmp(argv[optind], _T("identify"))) {
+		// Identify banks using a DAT file.
+		if (argc < optind+2) {
+			print_error(argv[0], _T("RVT-H device or disk image not specified"));
+			return EXIT_FAILURE;
 		}
+		ret = identify(argv[optind+1], (argc > optind+2 ? argv[optind+2] : NULL), &copy_params, stats);
 	} else if (!_tcscmp(argv[optind], _T("query"))) {
 		// Query RVT-H Reader devices.
 		// NOTE: Not checking HAVE_QUERY. If querying isn't available,
@@ -343,7 +1305,7 @@ int RVTH_CDECL _tmain(int argc, TCHAR *argv[])
 
 		if (isFilename) {
 			// Probably a filename.
-			ret = list_banks(argv[optind]);
+			ret = list_banks(argv[optind], json, list_fields);
 		} else {
 			// Not a filename.
 			print_error(argv[0], _T("unrecognized command '%s'"), argv[optind]);
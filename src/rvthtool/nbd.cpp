@@ -0,0 +1,944 @@
+/***************************************************************************
+ * RVT-H Tool                                                              *
+ * nbd.cpp: Export banks over the network using the NBD protocol.          *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "nbd.h"
+
+#include "librvth/rvth.hpp"
+#include "librvth/rvth_error.h"
+#include "librvth/nhcd_structs.h"
+#include "librvth/reader/Reader.hpp"
+#include "libwiicrypto/byteswap.h"
+
+// C includes (C++ namespace)
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifndef _WIN32
+// C includes
+#  include <netdb.h>
+#  include <netinet/in.h>
+#  include <netinet/tcp.h>
+#  include <poll.h>
+#  include <signal.h>
+#  include <sys/socket.h>
+#  include <unistd.h>
+#  ifdef __linux__
+#    include <sys/sendfile.h>
+#  endif /* __linux__ */
+
+// C++ includes
+#  include <condition_variable>
+#  include <memory>
+#  include <mutex>
+#  include <set>
+#  include <string>
+#  include <thread>
+#  include <vector>
+using std::string;
+using std::unique_ptr;
+using std::vector;
+#endif /* !_WIN32 */
+
+#ifndef _WIN32
+
+// MSG_MORE and MSG_NOSIGNAL aren't available on all systems.
+#ifndef MSG_MORE
+#  define MSG_MORE 0
+#endif
+#ifndef MSG_NOSIGNAL
+#  define MSG_NOSIGNAL 0
+#endif
+
+/** NBD protocol **/
+// Reference: https://github.com/NetworkBlockDevice/nbd/blob/master/doc/proto.md
+
+// Handshake
+#define NBD_MAGIC		0x4E42444D41474943ULL	// "NBDMAGIC"
+#define NBD_IHAVEOPT		0x49484156454F5054ULL	// "IHAVEOPT"
+#define NBD_REP_MAGIC		0x0003E889045565A9ULL
+#define NBD_FLAG_FIXED_NEWSTYLE	(1U << 0)
+#define NBD_FLAG_NO_ZEROES	(1U << 1)
+
+// Options
+#define NBD_OPT_EXPORT_NAME	1
+#define NBD_OPT_ABORT		2
+#define NBD_OPT_LIST		3
+#define NBD_OPT_INFO		6
+#define NBD_OPT_GO		7
+
+// Option replies
+#define NBD_REP_ACK		1
+#define NBD_REP_SERVER		2
+#define NBD_REP_INFO		3
+#define NBD_REP_ERR_UNSUP	0x80000001U
+#define NBD_REP_ERR_INVALID	0x80000003U
+#define NBD_REP_ERR_UNKNOWN	0x80000006U
+
+// Information types for NBD_OPT_INFO and NBD_OPT_GO
+#define NBD_INFO_EXPORT		0
+#define NBD_INFO_BLOCK_SIZE	3
+
+// Transmission flags
+#define NBD_FLAG_HAS_FLAGS	(1U << 0)
+#define NBD_FLAG_READ_ONLY	(1U << 1)
+#define NBD_FLAG_CAN_MULTI_CONN	(1U << 8)
+
+// Transmission
+#define NBD_REQUEST_MAGIC	0x25609513U
+#define NBD_SIMPLE_REPLY_MAGIC	0x67446698U
+#define NBD_CMD_READ		0
+#define NBD_CMD_WRITE		1
+#define NBD_CMD_DISC		2
+#define NBD_CMD_FLUSH		3
+#define NBD_CMD_TRIM		4
+#define NBD_CMD_WRITE_ZEROES	6
+
+// Error values
+#define NBD_EPERM		1
+#define NBD_EIO			5
+#define NBD_EINVAL		22
+
+// Maximum option data length.
+#define NBD_MAX_OPTION_LEN	4096U
+// Maximum read request length.
+#define NBD_MAX_REQUEST_LEN	(32U * 1024U * 1024U)
+// Preferred block size. (Wii sector size)
+#define NBD_PREFERRED_BLOCK_SIZE	32768U
+
+/**
+ * A bank exported by the server.
+ */
+struct NbdExport {
+	string name;		// Export name, e.g. "bank1"
+	Reader *reader;		// Bank reader
+	uint64_t size;		// Export size, in bytes
+
+	// If the bank is stored contiguously in the file, reads are
+	// sent directly from this file descriptor using sendfile().
+	int fd;			// File descriptor, or -1 if reads must use the Reader
+	off64_t file_offset;	// File offset of the start of the bank
+
+	// Serializes reads that use the Reader.
+	std::mutex mutex;
+
+	NbdExport() : reader(nullptr), size(0), fd(-1), file_offset(0) { }
+	~NbdExport() { if (fd >= 0) close(fd); }
+};
+
+/**
+ * Shared state for all client threads.
+ */
+struct NbdServer {
+	vector<unique_ptr<NbdExport> > exports;
+	unsigned int readahead;		// Per-client read-ahead, in bytes
+
+	// Client sockets and running threads.
+	// Client sockets are shut down when the server exits,
+	// and the server waits for all threads to finish.
+	std::mutex threads_mutex;
+	std::condition_variable threads_cond;
+	std::set<int> client_fds;
+	unsigned int threads_active;
+
+	// Serializes the connection log.
+	std::mutex log_mutex;
+};
+
+/**
+ * Client connection.
+ */
+struct NbdClient {
+	int fd;			// Client socket
+	string peer;		// Client address, for the connection log
+	NbdExport *exp;		// Selected export
+
+	// Read buffer for exports that are read using the Reader.
+	// This holds the most recently read window, including
+	// any data that was read ahead.
+	unique_ptr<uint8_t[]> buf;
+	uint32_t buf_size;
+	uint64_t win_offset;	// Offset of the buffered window
+	uint32_t win_len;	// Length of the buffered window (0 if empty)
+
+	uint64_t last_end;	// End of the previous read
+	uint64_t prefetch_end;	// End of the region prefetched for sendfile()
+
+	explicit NbdClient(int fd)
+		: fd(fd), exp(nullptr), buf_size(0), win_offset(0), win_len(0)
+		, last_end(0), prefetch_end(0) { }
+};
+
+static volatile sig_atomic_t s_interrupted = 0;
+
+/**
+ * Signal handler for SIGINT and SIGTERM.
+ * @param sig Signal number
+ */
+static void nbd_signal_handler(int sig)
+{
+	((void)sig);
+	s_interrupted = 1;
+}
+
+/** Big-endian helpers **/
+
+static inline void put_be16(uint8_t *p, uint16_t val)
+{
+	val = cpu_to_be16(val);
+	memcpy(p, &val, sizeof(val));
+}
+
+static inline void put_be32(uint8_t *p, uint32_t val)
+{
+	val = cpu_to_be32(val);
+	memcpy(p, &val, sizeof(val));
+}
+
+static inline void put_be64(uint8_t *p, uint64_t val)
+{
+	val = cpu_to_be64(val);
+	memcpy(p, &val, sizeof(val));
+}
+
+static inline uint16_t get_be16(const uint8_t *p)
+{
+	uint16_t val;
+	memcpy(&val, p, sizeof(val));
+	return be16_to_cpu(val);
+}
+
+static inline uint32_t get_be32(const uint8_t *p)
+{
+	uint32_t val;
+	memcpy(&val, p, sizeof(val));
+	return be32_to_cpu(val);
+}
+
+static inline uint64_t get_be64(const uint8_t *p)
+{
+	uint64_t val;
+	memcpy(&val, p, sizeof(val));
+	return be64_to_cpu(val);
+}
+
+/** Socket I/O **/
+
+/**
+ * Receive exactly len bytes.
+ * @param fd	[in] Socket
+ * @param buf	[out] Buffer
+ * @param len	[in] Number of bytes
+ * @return True on success; false on error or disconnect.
+ */
+static bool recv_all(int fd, void *buf, size_t len)
+{
+	uint8_t *p = static_cast<uint8_t*>(buf);
+	while (len > 0) {
+		const ssize_t n = recv(fd, p, len, 0);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n <= 0) {
+			return false;
+		}
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+/**
+ * Receive and discard len bytes, e.g. the payload of a rejected write.
+ * @param fd	[in] Socket
+ * @param len	[in] Number of bytes
+ * @return True on success; false on error or disconnect.
+ */
+static bool recv_discard(int fd, uint64_t len)
+{
+	uint8_t buf[4096];
+	while (len > 0) {
+		const size_t chunk = (len > sizeof(buf) ? sizeof(buf) : static_cast<size_t>(len));
+		if (!recv_all(fd, buf, chunk)) {
+			return false;
+		}
+		len -= chunk;
+	}
+	return true;
+}
+
+/**
+ * Send exactly len bytes.
+ * @param fd	[in] Socket
+ * @param buf	[in] Buffer
+ * @param len	[in] Number of bytes
+ * @param flags	[in] send() flags, e.g. MSG_MORE
+ * @return True on success; false on error.
+ */
+static bool send_all(int fd, const void *buf, size_t len, int flags = 0)
+{
+	const uint8_t *p = static_cast<const uint8_t*>(buf);
+	while (len > 0) {
+		const ssize_t n = send(fd, p, len, flags | MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n <= 0) {
+			return false;
+		}
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+/**
+ * Send an option reply.
+ * @param fd	[in] Socket
+ * @param opt	[in] Option
+ * @param type	[in] Reply type
+ * @param data	[in,opt] Reply data
+ * @param len	[in] Length of the reply data
+ * @return True on success; false on error.
+ */
+static bool send_option_reply(int fd, uint32_t opt, uint32_t type, const void *data = nullptr, uint32_t len = 0)
+{
+	uint8_t hdr[20];
+	put_be64(&hdr[0], NBD_REP_MAGIC);
+	put_be32(&hdr[8], opt);
+	put_be32(&hdr[12], type);
+	put_be32(&hdr[16], len);
+	return send_all(fd, hdr, sizeof(hdr), (len > 0 ? MSG_MORE : 0)) &&
+	       (len == 0 || send_all(fd, data, len));
+}
+
+/**
+ * Send a simple reply to a transmission request.
+ * @param fd		[in] Socket
+ * @param handle	[in] Request handle, as received
+ * @param error		[in] NBD error value (0 for success)
+ * @param more		[in] True if read data follows the reply
+ * @return True on success; false on error.
+ */
+static bool send_reply(int fd, const uint8_t *handle, uint32_t error, bool more)
+{
+	uint8_t hdr[16];
+	put_be32(&hdr[0], NBD_SIMPLE_REPLY_MAGIC);
+	put_be32(&hdr[4], error);
+	memcpy(&hdr[8], handle, 8);
+	return send_all(fd, hdr, sizeof(hdr), (more ? MSG_MORE : 0));
+}
+
+/** Handshake **/
+
+/**
+ * Find an export by name.
+ * An empty name selects the default export, if there's only one.
+ * @param server	[in] Server state
+ * @param name		[in] Export name
+ * @return Export, or nullptr if not found.
+ */
+static NbdExport *find_export(NbdServer *server, const string &name)
+{
+	if (name.empty()) {
+		return (server->exports.size() == 1 ? server->exports[0].get() : nullptr);
+	}
+	for (const unique_ptr<NbdExport> &exp : server->exports) {
+		if (exp->name == name) {
+			return exp.get();
+		}
+	}
+	return nullptr;
+}
+
+/**
+ * Get the transmission flags for an export.
+ * @return Transmission flags
+ */
+static inline uint16_t transmission_flags(void)
+{
+	// Reads don't depend on the connection, so clients
+	// may use multiple connections to the same export.
+	return NBD_FLAG_HAS_FLAGS | NBD_FLAG_READ_ONLY | NBD_FLAG_CAN_MULTI_CONN;
+}
+
+/**
+ * Handle NBD_OPT_INFO and NBD_OPT_GO.
+ * @param server	[in] Server state
+ * @param fd		[in] Socket
+ * @param opt		[in] Option
+ * @param data		[in] Option data
+ * @param pExp		[out] Export, if it was found
+ * @return True on success; false on error.
+ */
+static bool handle_opt_info(NbdServer *server, int fd, uint32_t opt,
+	const vector<uint8_t> &data, NbdExport **pExp)
+{
+	// Option data: name length, name, number of requests, requests.
+	*pExp = nullptr;
+	if (data.size() < 6) {
+		return send_option_reply(fd, opt, NBD_REP_ERR_INVALID);
+	}
+	const uint32_t name_len = get_be32(&data[0]);
+	if (name_len > data.size() - 6) {
+		return send_option_reply(fd, opt, NBD_REP_ERR_INVALID);
+	}
+	const uint16_t req_count = get_be16(&data[4 + name_len]);
+	if (data.size() != 6 + name_len + (2U * req_count)) {
+		return send_option_reply(fd, opt, NBD_REP_ERR_INVALID);
+	}
+
+	NbdExport *const exp = find_export(server,
+		string(reinterpret_cast<const char*>(&data[4]), name_len));
+	if (!exp) {
+		return send_option_reply(fd, opt, NBD_REP_ERR_UNKNOWN);
+	}
+
+	uint8_t info[14];
+	put_be16(&info[0], NBD_INFO_EXPORT);
+	put_be64(&info[2], exp->size);
+	put_be16(&info[10], transmission_flags());
+	if (!send_option_reply(fd, opt, NBD_REP_INFO, info, 12)) {
+		return false;
+	}
+
+	// Block size constraints are only sent if requested.
+	for (unsigned int i = 0; i < req_count; i++) {
+		if (get_be16(&data[6 + name_len + (i * 2)]) == NBD_INFO_BLOCK_SIZE) {
+			put_be16(&info[0], NBD_INFO_BLOCK_SIZE);
+			put_be32(&info[2], 1);
+			put_be32(&info[6], NBD_PREFERRED_BLOCK_SIZE);
+			put_be32(&info[10], NBD_MAX_REQUEST_LEN);
+			if (!send_option_reply(fd, opt, NBD_REP_INFO, info, 14)) {
+				return false;
+			}
+			break;
+		}
+	}
+
+	if (!send_option_reply(fd, opt, NBD_REP_ACK)) {
+		return false;
+	}
+	*pExp = exp;
+	return true;
+}
+
+/**
+ * Negotiate an export with a client. (fixed newstyle handshake)
+ * @param server	[in] Server state
+ * @param fd		[in] Socket
+ * @return Export, or nullptr if the client disconnected or an error occurred.
+ */
+static NbdExport *negotiate(NbdServer *server, int fd)
+{
+	uint8_t buf[20];
+	put_be64(&buf[0], NBD_MAGIC);
+	put_be64(&buf[8], NBD_IHAVEOPT);
+	put_be16(&buf[16], NBD_FLAG_FIXED_NEWSTYLE | NBD_FLAG_NO_ZEROES);
+	if (!send_all(fd, buf, 18) || !recv_all(fd, buf, 4)) {
+		return nullptr;
+	}
+	const bool no_zeroes = !!(get_be32(buf) & NBD_FLAG_NO_ZEROES);
+
+	vector<uint8_t> data;
+	for (;;) {
+		if (!recv_all(fd, buf, 16)) {
+			return nullptr;
+		}
+		const uint32_t opt = get_be32(&buf[8]);
+		const uint32_t len = get_be32(&buf[12]);
+		if (get_be64(&buf[0]) != NBD_IHAVEOPT || len > NBD_MAX_OPTION_LEN) {
+			return nullptr;
+		}
+		data.resize(len);
+		if (len > 0 && !recv_all(fd, data.data(), len)) {
+			return nullptr;
+		}
+
+		switch (opt) {
+			case NBD_OPT_EXPORT_NAME: {
+				// Old-style export selection. Errors can't be reported,
+				// so the connection is closed if the export isn't found.
+				NbdExport *const exp = find_export(server,
+					string(reinterpret_cast<const char*>(data.data()), len));
+				if (!exp) {
+					return nullptr;
+				}
+				uint8_t reply[10 + 124];
+				memset(reply, 0, sizeof(reply));
+				put_be64(&reply[0], exp->size);
+				put_be16(&reply[8], transmission_flags());
+				if (!send_all(fd, reply, (no_zeroes ? 10 : sizeof(reply)))) {
+					return nullptr;
+				}
+				return exp;
+			}
+
+			case NBD_OPT_ABORT:
+				send_option_reply(fd, opt, NBD_REP_ACK);
+				return nullptr;
+
+			case NBD_OPT_LIST:
+				if (len != 0) {
+					if (!send_option_reply(fd, opt, NBD_REP_ERR_INVALID)) {
+						return nullptr;
+					}
+					break;
+				}
+				for (const unique_ptr<NbdExport> &exp : server->exports) {
+					string reply(4, '\0');
+					put_be32(reinterpret_cast<uint8_t*>(&reply[0]), static_cast<uint32_t>(exp->name.size()));
+					reply += exp->name;
+					if (!send_option_reply(fd, opt, NBD_REP_SERVER, reply.data(), static_cast<uint32_t>(reply.size()))) {
+						return nullptr;
+					}
+				}
+				if (!send_option_reply(fd, opt, NBD_REP_ACK)) {
+					return nullptr;
+				}
+				break;
+
+			case NBD_OPT_INFO:
+			case NBD_OPT_GO: {
+				NbdExport *exp;
+				if (!handle_opt_info(server, fd, opt, data, &exp)) {
+					return nullptr;
+				}
+				if (opt == NBD_OPT_GO && exp) {
+					return exp;
+				}
+				break;
+			}
+
+			default:
+				if (!send_option_reply(fd, opt, NBD_REP_ERR_UNSUP)) {
+					return nullptr;
+				}
+				break;
+		}
+	}
+}
+
+/** Transmission **/
+
+#ifdef __linux__
+/**
+ * Send a read reply directly from the file using sendfile().
+ * @param server	[in] Server state
+ * @param client	[in,out] Client
+ * @param handle	[in] Request handle
+ * @param offset	[in] Offset in the export
+ * @param length	[in] Length, in bytes
+ * @return True on success; false if the connection must be closed.
+ */
+static bool read_sendfile(NbdServer *server, NbdClient *client,
+	const uint8_t *handle, uint64_t offset, uint32_t length)
+{
+	NbdExport *const exp = client->exp;
+	const uint64_t end = offset + length;
+
+	// If this read continues the previous one, have the OS read
+	// the next part of the bank into the page cache.
+	if (server->readahead > 0) {
+		if (offset != client->last_end) {
+			// Random access. Start a new read-ahead window.
+			client->prefetch_end = end;
+		} else {
+			uint64_t ra_end = end + server->readahead;
+			if (ra_end > exp->size) {
+				ra_end = exp->size;
+			}
+			if (ra_end > client->prefetch_end) {
+				const uint64_t ra_start = (client->prefetch_end > end ? client->prefetch_end : end);
+				if (ra_end > ra_start) {
+					exp->reader->file()->prefetch(exp->file_offset + ra_start, ra_end - ra_start);
+				}
+				client->prefetch_end = ra_end;
+			}
+		}
+	}
+
+	if (!send_reply(client->fd, handle, 0, true)) {
+		return false;
+	}
+
+	off_t pos = static_cast<off_t>(exp->file_offset + offset);
+	size_t left = length;
+	while (left > 0) {
+		const ssize_t n = sendfile(client->fd, exp->fd, &pos, left);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n < 0) {
+			// The reply header was already sent,
+			// so the error can't be reported.
+			return false;
+		} else if (n == 0) {
+			// The file is shorter than the bank.
+			// Send zeroes for the rest of it.
+			static const uint8_t zero[4096] = {0};
+			while (left > 0) {
+				const size_t chunk = (left > sizeof(zero) ? sizeof(zero) : left);
+				if (!send_all(client->fd, zero, chunk)) {
+					return false;
+				}
+				left -= chunk;
+			}
+			break;
+		}
+		left -= n;
+	}
+	return true;
+}
+#endif /* __linux__ */
+
+/**
+ * Send a read reply using the Reader.
+ * Reads that continue the previous read are extended by the
+ * read-ahead size, and later reads are sent from the buffer.
+ * @param server	[in] Server state
+ * @param client	[in,out] Client
+ * @param handle	[in] Request handle
+ * @param offset	[in] Offset in the export
+ * @param length	[in] Length, in bytes
+ * @return True on success; false if the connection must be closed.
+ */
+static bool read_buffered(NbdServer *server, NbdClient *client,
+	const uint8_t *handle, uint64_t offset, uint32_t length)
+{
+	NbdExport *const exp = client->exp;
+	if (offset < client->win_offset || offset + length > client->win_offset + client->win_len) {
+		// Not in the buffered window. Read whole LBAs.
+		uint64_t end = offset + length;
+		if (server->readahead > 0 && offset == client->last_end) {
+			end += server->readahead;
+			if (end > exp->size) {
+				end = exp->size;
+			}
+		}
+		const uint32_t lba_start = static_cast<uint32_t>(offset / LBA_SIZE);
+		const uint32_t lba_len = static_cast<uint32_t>((end + LBA_SIZE - 1) / LBA_SIZE) - lba_start;
+		const uint32_t size = static_cast<uint32_t>(LBA_TO_BYTES(lba_len));
+		if (size > client->buf_size) {
+			client->buf.reset(new uint8_t[size]);
+			client->buf_size = size;
+		}
+
+		uint32_t lba_read;
+		{
+			std::lock_guard<std::mutex> lock(exp->mutex);
+			lba_read = exp->reader->read(client->buf.get(), lba_start, lba_len);
+		}
+		if (lba_read != lba_len) {
+			client->win_len = 0;
+			return send_reply(client->fd, handle, NBD_EIO, false);
+		}
+		client->win_offset = LBA_TO_BYTES(lba_start);
+		client->win_len = size;
+	}
+
+	return send_reply(client->fd, handle, 0, true) &&
+	       send_all(client->fd, &client->buf[offset - client->win_offset], length);
+}
+
+/**
+ * Handle transmission requests until the client disconnects.
+ * @param server	[in] Server state
+ * @param client	[in,out] Client
+ */
+static void serve_client(NbdServer *server, NbdClient *client)
+{
+	NbdExport *const exp = client->exp;
+	uint8_t req[28];
+	for (;;) {
+		if (!recv_all(client->fd, req, sizeof(req)) ||
+		    get_be32(&req[0]) != NBD_REQUEST_MAGIC)
+		{
+			break;
+		}
+		const uint16_t type = get_be16(&req[6]);
+		const uint8_t *const handle = &req[8];
+		const uint64_t offset = get_be64(&req[16]);
+		const uint32_t length = get_be32(&req[24]);
+
+		bool ok;
+		switch (type) {
+			case NBD_CMD_READ:
+				if (length == 0 || length > NBD_MAX_REQUEST_LEN ||
+				    offset > exp->size || length > exp->size - offset)
+				{
+					ok = send_reply(client->fd, handle, NBD_EINVAL, false);
+					break;
+				}
+#ifdef __linux__
+				if (exp->fd >= 0) {
+					ok = read_sendfile(server, client, handle, offset, length);
+				} else
+#endif /* __linux__ */
+				{
+					ok = read_buffered(server, client, handle, offset, length);
+				}
+				client->last_end = offset + length;
+				break;
+
+			case NBD_CMD_WRITE:
+				// Read-only export. Discard the payload.
+				ok = recv_discard(client->fd, length) &&
+				     send_reply(client->fd, handle, NBD_EPERM, false);
+				break;
+
+			case NBD_CMD_TRIM:
+			case NBD_CMD_WRITE_ZEROES:
+				ok = send_reply(client->fd, handle, NBD_EPERM, false);
+				break;
+
+			case NBD_CMD_FLUSH:
+				// Nothing to flush.
+				ok = send_reply(client->fd, handle, 0, false);
+				break;
+
+			case NBD_CMD_DISC:
+				ok = false;
+				break;
+
+			default:
+				ok = send_reply(client->fd, handle, NBD_EINVAL, false);
+				break;
+		}
+		if (!ok) {
+			break;
+		}
+	}
+}
+
+/**
+ * Client thread.
+ * @param server	[in] Server state
+ * @param client	[in] Client (owned by this thread)
+ */
+static void client_thread(NbdServer *server, NbdClient *client)
+{
+	unique_ptr<NbdClient> client_ptr(client);
+
+	client->exp = negotiate(server, client->fd);
+	if (client->exp) {
+		{
+			std::lock_guard<std::mutex> lock(server->log_mutex);
+			printf("%s: Connected to '%s'.\n", client->peer.c_str(), client->exp->name.c_str());
+			fflush(stdout);
+		}
+		serve_client(server, client);
+		{
+			std::lock_guard<std::mutex> lock(server->log_mutex);
+			printf("%s: Disconnected.\n", client->peer.c_str());
+			fflush(stdout);
+		}
+	}
+
+	// The socket is closed with the lock held so the server
+	// doesn't shut down a reused file descriptor.
+	std::lock_guard<std::mutex> lock(server->threads_mutex);
+	server->client_fds.erase(client->fd);
+	close(client->fd);
+	server->threads_active--;
+	server->threads_cond.notify_all();
+}
+
+/**
+ * Create the listening socket.
+ * @param address Listening address: "[host:]port" (If NULL, all addresses on the default port.)
+ * @return Socket on success; negative POSIX error code on error.
+ */
+static int create_socket(const char *address)
+{
+	string host;
+	string port = std::to_string(NBD_DEFAULT_PORT);
+	if (address) {
+		const char *const colon = strrchr(address, ':');
+		if (colon) {
+			host.assign(address, colon - address);
+			port = colon + 1;
+		} else {
+			port = address;
+		}
+		if (host.size() >= 2 && host.front() == '[' && host.back() == ']') {
+			// IPv6 address, e.g. "[::1]:10809"
+			host = host.substr(1, host.size() - 2);
+		}
+	}
+
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	struct addrinfo *res = nullptr;
+	if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &res) != 0) {
+		return -EADDRNOTAVAIL;
+	}
+
+	int ret = -EADDRNOTAVAIL;
+	for (const struct addrinfo *ai = res; ai != nullptr; ai = ai->ai_next) {
+		const int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0) {
+			ret = -errno;
+			continue;
+		}
+
+		const int one = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, 16) == 0) {
+			freeaddrinfo(res);
+			return fd;
+		}
+		ret = -errno;
+		close(fd);
+	}
+	freeaddrinfo(res);
+	return ret;
+}
+#endif /* !_WIN32 */
+
+/**
+ * 'nbd-server' command.
+ * @param rvth_filename	[in] RVT-H device or disk image filename.
+ * @param address	[in,opt] Listening address: "[host:]port". (If NULL, all addresses on port 10809.)
+ * @param readahead	[in] Per-client read-ahead, in bytes. (0 to disable)
+ * @return 0 on success; non-zero on error.
+ */
+int nbd_server(const TCHAR *rvth_filename, const TCHAR *address, unsigned int readahead)
+{
+#ifdef _WIN32
+	((void)rvth_filename);
+	((void)address);
+	((void)readahead);
+	fputs("*** ERROR: 'nbd-server' is not available on Windows.\n", stderr);
+	return -ENOTSUP;
+#else /* !_WIN32 */
+	int ret;
+	unique_ptr<RvtH> rvth(new RvtH(rvth_filename, &ret));
+	if (ret != 0 || !rvth->isOpen()) {
+		fprintf(stderr, "*** ERROR opening RVT-H device '%s': %s\n", rvth_filename, rvth_error(ret));
+		return ret;
+	}
+
+	// Export each bank that has a disc image.
+	NbdServer server;
+	server.readahead = readahead;
+	server.threads_active = 0;
+	rvth->initBankEntries(0, RVTH_BANK_INIT_HEADER);
+	const unsigned int bank_count = rvth->bankCount();
+	for (unsigned int bank = 0; bank < bank_count; bank++) {
+		const RvtH_BankEntry *const entry = rvth->bankEntry(bank, nullptr, RVTH_BANK_INIT_HEADER);
+		if (!entry || !entry->reader || entry->lba_len == 0 || entry->is_deleted) {
+			continue;
+		}
+		switch (entry->type) {
+			case RVTH_BankType_GCN:
+			case RVTH_BankType_Wii_SL:
+			case RVTH_BankType_Wii_DL:
+				break;
+			default:
+				continue;
+		}
+
+		unique_ptr<NbdExport> exp(new NbdExport);
+		char name[16];
+		snprintf(name, sizeof(name), "bank%u", bank + 1);
+		exp->name = name;
+		exp->reader = entry->reader;
+		exp->size = LBA_TO_BYTES(entry->lba_len);
+#ifdef __linux__
+		off64_t file_offset;
+		if (entry->reader->fileOffset(0, entry->lba_len, &file_offset)) {
+			exp->fd = entry->reader->file()->dupFd(false);
+			exp->file_offset = file_offset;
+		}
+#endif /* __linux__ */
+		server.exports.push_back(std::move(exp));
+	}
+	if (server.exports.empty()) {
+		fprintf(stderr, "*** ERROR: '%s' doesn't have any banks to export.\n", rvth_filename);
+		return -ENOENT;
+	}
+
+	const int listen_fd = create_socket(address);
+	if (listen_fd < 0) {
+		fprintf(stderr, "*** ERROR listening on '%s': %s\n",
+			(address ? address : "*"), strerror(-listen_fd));
+		return listen_fd;
+	}
+
+	// Disconnected clients shouldn't kill the server.
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, nbd_signal_handler);
+	signal(SIGTERM, nbd_signal_handler);
+
+	for (const unique_ptr<NbdExport> &exp : server.exports) {
+		printf("Exporting '%s': %llu bytes%s\n", exp->name.c_str(),
+			static_cast<unsigned long long>(exp->size),
+			(exp->fd >= 0 ? " (zero-copy)" : ""));
+	}
+	if (address) {
+		printf("Listening on '%s'.\n", address);
+	} else {
+		printf("Listening on port %u.\n", NBD_DEFAULT_PORT);
+	}
+	fflush(stdout);
+
+	// The socket is polled so signals are handled within a second.
+	while (!s_interrupted) {
+		struct pollfd pfd;
+		pfd.fd = listen_fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if (poll(&pfd, 1, 1000) <= 0) {
+			continue;
+		}
+
+		struct sockaddr_storage addr;
+		socklen_t addr_len = sizeof(addr);
+		const int fd = accept(listen_fd, reinterpret_cast<struct sockaddr*>(&addr), &addr_len);
+		if (fd < 0) {
+			continue;
+		}
+
+		// Replies are small and latency-sensitive.
+		const int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+		NbdClient *const client = new NbdClient(fd);
+		char host[NI_MAXHOST], serv[NI_MAXSERV];
+		if (getnameinfo(reinterpret_cast<struct sockaddr*>(&addr), addr_len,
+		                host, sizeof(host), serv, sizeof(serv),
+		                NI_NUMERICHOST | NI_NUMERICSERV) == 0)
+		{
+			client->peer = string(host) + ':' + serv;
+		} else {
+			client->peer = "(unknown)";
+		}
+
+		std::lock_guard<std::mutex> lock(server.threads_mutex);
+		server.client_fds.insert(fd);
+		server.threads_active++;
+		std::thread(client_thread, &server, client).detach();
+	}
+
+	// Stop accepting connections, then disconnect the clients.
+	close(listen_fd);
+	fputs("Shutting down.\n", stdout);
+	fflush(stdout);
+	{
+		std::unique_lock<std::mutex> lock(server.threads_mutex);
+		for (int fd : server.client_fds) {
+			shutdown(fd, SHUT_RDWR);
+		}
+		server.threads_cond.wait(lock, [&server] { return server.threads_active == 0; });
+	}
+
+	return 0;
+#endif /* _WIN32 */
+}
@@ -0,0 +1,46 @@
+/***************************************************************************
+ * RVT-H Tool                                                              *
+ * nbd.h: Export banks over the network using the NBD protocol.            *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_RVTHTOOL_NBD_H__
+#define __RVTHTOOL_RVTHTOOL_NBD_H__
+
+#include "tcharx.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Default NBD port.
+#define NBD_DEFAULT_PORT 10809U
+
+// Default per-client read-ahead, in bytes.
+#define NBD_DEFAULT_READAHEAD (2U * 1024U * 1024U)
+
+/**
+ * 'nbd-server' command.
+ *
+ * Exports each bank containing a disc image as a read-only NBD export
+ * named "bank1" through "bank8", using the fixed newstyle handshake.
+ * If only one bank is exported, it's also the default export.
+ *
+ * Banks that are stored contiguously in the device or disk image are
+ * sent directly from the page cache to the socket using sendfile().
+ * Each client has its own read-ahead window for sequential reads.
+ *
+ * @param rvth_filename	[in] RVT-H device or disk image filename.
+ * @param address	[in,opt] Listening address: "[host:]port". (If NULL, all addresses on port 10809.)
+ * @param readahead	[in] Per-client read-ahead, in bytes. (0 to disable)
+ * @return 0 on success; non-zero on error.
+ */
+int nbd_server(const TCHAR *rvth_filename, const TCHAR *address, unsigned int readahead);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_RVTHTOOL_NBD_H__ */
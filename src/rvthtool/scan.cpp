@@ -0,0 +1,220 @@
+/***************************************************************************
+ * RVT-H Tool                                                              *
+ * scan.cpp: Scan an RVT-H Reader for slow or unreadable sectors.          *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "scan.h"
+#include "librvth/rvth.hpp"
+#include "librvth/rvth_error.h"
+#include "librvth/nhcd_structs.h"
+#include "stats.hpp"
+
+// C includes (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+
+// C++ includes
+#include <algorithm>
+#include <vector>
+using std::vector;
+
+// Default slow read threshold for 'scan', in milliseconds.
+#define SCAN_SLOW_READ_MS_DEFAULT 500
+
+// Latency map size. Each character represents the slowest of
+// one or more chunks, so the map fits in a terminal.
+#define SCAN_MAP_COLUMNS	64
+#define SCAN_MAP_ROWS_MAX	64
+
+/**
+ * Progress callback for scanning.
+ * @param state		[in] Current progress.
+ * @param userdata	[in] User data specified when calling the RVT-H function.
+ * @return True to continue; false to abort.
+ */
+static bool scan_progress_callback(const RvtH_Progress_State *state, void *userdata)
+{
+	UNUSED(userdata);
+	assert(state->type == RVTH_PROGRESS_SCAN);
+
+	#define GIGABYTE (1073741824 / LBA_SIZE)
+	printf("\rScanning: %4u GiB / %4u GiB (%5.1f%%)",
+		state->lba_processed / GIGABYTE,
+		state->lba_total / GIGABYTE,
+		(state->lba_total != 0)
+			? (static_cast<double>(state->lba_processed) * 100.0 / state->lba_total)
+			: 100.0);
+	print_progress_rate(stdout, state);
+
+	if (state->lba_processed == state->lba_total) {
+		// Finished processing.
+		putchar('\n');
+	}
+	fflush(stdout);
+	return true;
+}
+
+/**
+ * Write the latency map as tab-separated values.
+ * @param map_filename	[in] Latency map filename.
+ * @param map		[in] Latency map.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int write_map(const TCHAR *map_filename, const vector<RvtH_Latency_Chunk> &map)
+{
+	FILE *f = _tfopen(map_filename, _T("w"));
+	if (!f) {
+		const int err = errno;
+		return (err != 0 ? -err : -EIO);
+	}
+
+	fputs("lba_start\tlba_len\tlatency_us\terror\n", f);
+	for (const RvtH_Latency_Chunk &chunk : map) {
+		fprintf(f, "%u\t%u\t%u\t%d\n", chunk.lba_start, chunk.lba_len,
+			chunk.latency_us, chunk.err);
+	}
+
+	int ret = 0;
+	if (ferror(f)) {
+		ret = -EIO;
+	}
+	if (fclose(f) != 0 && ret == 0) {
+		ret = (errno != 0 ? -errno : -EIO);
+	}
+	return ret;
+}
+
+/**
+ * Print the latency map.
+ * @param map		[in] Latency map.
+ * @param slow_us	[in] Slow read threshold, in microseconds.
+ */
+static void print_map(const vector<RvtH_Latency_Chunk> &map, uint32_t slow_us)
+{
+	const size_t cells_max = SCAN_MAP_COLUMNS * SCAN_MAP_ROWS_MAX;
+	const size_t per_cell = std::max<size_t>(1, (map.size() + cells_max - 1) / cells_max);
+
+	printf("Latency map: (each character is %u MiB)\n",
+		static_cast<unsigned int>(LBA_TO_BYTES(map[0].lba_len) * per_cell / 1048576));
+	printf("  '.' = < %u ms, 'o' = < %u ms, 'X' = slow, 'E' = read error\n",
+		slow_us / 4000, slow_us / 1000);
+
+	unsigned int col = 0;
+	for (size_t i = 0; i < map.size(); i += per_cell) {
+		if (col == 0) {
+			printf("  %08X ", map[i].lba_start);
+		}
+
+		// Show the slowest chunk in this cell.
+		char c = '.';
+		const size_t end = std::min(i + per_cell, map.size());
+		for (size_t j = i; j < end; j++) {
+			const RvtH_Latency_Chunk &chunk = map[j];
+			if (chunk.err != 0) {
+				c = 'E';
+				break;
+			} else if (chunk.latency_us >= slow_us) {
+				c = 'X';
+			} else if (chunk.latency_us >= slow_us / 4 && c == '.') {
+				c = 'o';
+			}
+		}
+		putchar(c);
+
+		if (++col == SCAN_MAP_COLUMNS) {
+			putchar('\n');
+			col = 0;
+		}
+	}
+	if (col != 0) {
+		putchar('\n');
+	}
+}
+
+/**
+ * 'scan' command.
+ * @param rvth_filename		[in] RVT-H device or disk image filename.
+ * @param map_filename		[in,opt] Latency map filename. (tab-separated values)
+ * @param threads		[in] Number of reader threads. (0 for 1)
+ * @param copy_params		[in] Copy buffer and I/O parameters. (buf_size is the chunk size)
+ * @return 0 on success; non-zero on error.
+ */
+int scan(const TCHAR *rvth_filename, const TCHAR *map_filename,
+	unsigned int threads, const RvtH_CopyParams *copy_params)
+{
+	// Open the RVT-H device or disk image.
+	int ret;
+	RvtH *const rvth = new RvtH(rvth_filename, &ret);
+	if (ret != 0 || !rvth->isOpen()) {
+		_ftprintf(stderr, _T("*** ERROR opening RVT-H device '%s': "), rvth_filename);
+		fputs(rvth_error(ret), stderr);
+		_fputtc(_T('\n'), stderr);
+		delete rvth;
+		return ret;
+	}
+
+	// Read latency is always measured when scanning.
+	RvtH_CopyParams params = *copy_params;
+	if (params.slow_read_ms == 0) {
+		params.slow_read_ms = SCAN_SLOW_READ_MS_DEFAULT;
+	}
+	ret = rvth->setCopyParams(&params);
+	if (ret != 0) {
+		fputs("*** ERROR: Invalid copy buffer parameters.\n", stderr);
+		delete rvth;
+		return ret;
+	}
+
+	vector<RvtH_Latency_Chunk> map;
+	ret = rvth->scanLatency(map, params.buf_size, threads, scan_progress_callback, nullptr);
+	if (ret != 0) {
+		putchar('\n');
+		fputs("*** ERROR: Scan failed: ", stderr);
+		fputs(rvth_error(ret), stderr);
+		fputc('\n', stderr);
+		delete rvth;
+		return ret;
+	}
+
+	if (map_filename) {
+		ret = write_map(map_filename, map);
+		if (ret != 0) {
+			_ftprintf(stderr, _T("*** ERROR writing latency map '%s': "), map_filename);
+			fputs(rvth_error(ret), stderr);
+			_fputtc(_T('\n'), stderr);
+		}
+	} else if (!map.empty()) {
+		print_map(map, params.slow_read_ms * 1000U);
+	}
+
+	// Summary.
+	unsigned int errors = 0, slow = 0;
+	for (const RvtH_Latency_Chunk &chunk : map) {
+		if (chunk.err != 0) {
+			errors++;
+		} else if (chunk.latency_us >= params.slow_read_ms * 1000U) {
+			slow++;
+		}
+	}
+	printf("Scanned %u chunks: %u slow, %u unreadable.\n",
+		static_cast<unsigned int>(map.size()), slow, errors);
+	for (const RvtH_Latency_Chunk &chunk : map) {
+		if (chunk.err != 0) {
+			fprintf(stderr, "*** ERROR: LBA 0x%08X-0x%08X: %s\n",
+				chunk.lba_start, chunk.lba_start + chunk.lba_len - 1,
+				rvth_error(chunk.err));
+		}
+	}
+	fflush(stdout);
+	print_read_latency(rvth);
+	delete rvth;
+
+	if (ret == 0 && errors != 0) {
+		ret = -EIO;
+	}
+	return ret;
+}
@@ -0,0 +1,34 @@
+/***************************************************************************
+ * RVT-H Tool                                                              *
+ * scan.h: Scan an RVT-H Reader for slow or unreadable sectors.            *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_RVTHTOOL_SCAN_H__
+#define __RVTHTOOL_RVTHTOOL_SCAN_H__
+
+#include "tcharx.h"
+#include "librvth/rvth.hpp"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 'scan' command.
+ * @param rvth_filename		RVT-H device or disk image filename.
+ * @param map_filename		Latency map filename. (optional; tab-separated values)
+ * @param threads		Number of reader threads. (0 for 1)
+ * @param copy_params		Copy buffer and I/O parameters. (buf_size is the chunk size)
+ * @return 0 on success; non-zero on error.
+ */
+int scan(const TCHAR *rvth_filename, const TCHAR *map_filename,
+	unsigned int threads, const RvtH_CopyParams *copy_params);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_RVTHTOOL_SCAN_H__ */
@@ -0,0 +1,138 @@
+/***************************************************************************
+ * RVT-H Tool                                                              *
+ * stats.cpp: Print performance statistics. (--stats)                      *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "stats.hpp"
+
+// C includes (C++ namespace)
+#include <cstdio>
+
+/**
+ * Print a byte count in MiB.
+ * @param name	[in] Counter name
+ * @param bytes	[in] Number of bytes
+ * @param calls	[in] Number of calls
+ */
+static void print_bytes(const char *name, uint64_t bytes, uint64_t calls)
+{
+	fprintf(stderr, "  %-20s %10.1f MiB in %llu calls\n", name,
+		static_cast<double>(bytes) / 1048576.0,
+		static_cast<unsigned long long>(calls));
+}
+
+/**
+ * Print a time in seconds.
+ * @param name	[in] Timer name
+ * @param ns	[in] Time, in nanoseconds
+ */
+static void print_time(const char *name, uint64_t ns)
+{
+	fprintf(stderr, "  %-20s %10.3f s\n", name, static_cast<double>(ns) / 1e9);
+}
+
+/**
+ * Print the performance statistics of an RVT-H object.
+ * Statistics are printed to stderr, so they don't get
+ * mixed up with JSON reports.
+ * @param rvth	[in] RVT-H disk image
+ */
+void print_stats(const RvtH *rvth)
+{
+	RvtH_Stats stats;
+	rvth->getStats(&stats);
+
+	fputs("Statistics:\n", stderr);
+	print_bytes("Read:", stats.bytes_read, stats.read_calls);
+	print_bytes("Written:", stats.bytes_written, stats.write_calls);
+	fprintf(stderr, "  %-20s %10llu\n", "Seeks:", static_cast<unsigned long long>(stats.seeks));
+	fprintf(stderr, "  %-20s %10.1f MiB\n", "Sparse (skipped):",
+		static_cast<double>(stats.sparse_bytes) / 1048576.0);
+	if (stats.cache_hits != 0 || stats.cache_misses != 0) {
+		fprintf(stderr, "  %-20s %10llu hits, %llu misses\n", "Block cache:",
+			static_cast<unsigned long long>(stats.cache_hits),
+			static_cast<unsigned long long>(stats.cache_misses));
+	}
+
+	// NOTE: Times are added up over all threads.
+	print_time("Blocked in I/O:", stats.io_ns);
+	print_time("AES:", stats.aes_ns);
+	print_time("SHA-1:", stats.sha1_ns);
+	print_time("Empty block checks:", stats.zero_scan_ns);
+}
+
+/**
+ * Print the read latency statistics of an RVT-H object.
+ * Nothing is printed if read latency wasn't measured. (--slow-read)
+ * Statistics are printed to stderr, so they don't get
+ * mixed up with JSON reports.
+ * @param rvth	[in] RVT-H disk image
+ */
+void print_read_latency(const RvtH *rvth)
+{
+	RvtH_Read_Latency latency;
+	if (rvth->getReadLatency(&latency) != 0 || latency.reads == 0) {
+		return;
+	}
+
+	fprintf(stderr, "Read latency: (%llu reads, max %.1f ms)\n",
+		static_cast<unsigned long long>(latency.reads),
+		static_cast<double>(latency.max_us) / 1000.0);
+	for (unsigned int i = 0; i < RVTH_LATENCY_BUCKETS; i++) {
+		if (latency.hist[i] == 0)
+			continue;
+
+		char label[32];
+		if (i < RVTH_LATENCY_BUCKETS - 1) {
+			snprintf(label, sizeof(label), "< %llu us:",
+				RVTH_LATENCY_BUCKET_LIMIT_US(i));
+		} else {
+			snprintf(label, sizeof(label), ">= %llu us:",
+				RVTH_LATENCY_BUCKET_LIMIT_US(i - 1));
+		}
+		fprintf(stderr, "  %-20s %10llu\n", label,
+			static_cast<unsigned long long>(latency.hist[i]));
+	}
+
+	if (latency.slow_reads == 0) {
+		return;
+	}
+	fprintf(stderr, "WARNING: %llu read(s) took at least %u ms:\n",
+		static_cast<unsigned long long>(latency.slow_reads), latency.slow_read_ms);
+	for (unsigned int i = 0; i < latency.slow_count; i++) {
+		const RvtH_Slow_Read *const slow = &latency.slow[i];
+		fprintf(stderr, "  LBA 0x%08X-0x%08X: %u ms\n",
+			slow->lba_start, slow->lba_start + slow->lba_len - 1, slow->latency_ms);
+	}
+	if (latency.slow_count == RVTH_SLOW_READS_MAX) {
+		fputs("  (additional slow reads not listed)\n", stderr);
+	}
+}
+
+/**
+ * Print the throughput and estimated time remaining of a progress update.
+ * Nothing is printed until librvth has a throughput estimate.
+ * Trailing spaces are printed so a shorter line overwrites a longer one.
+ * @param f	[in] FILE* to print to
+ * @param state	[in] Current progress
+ */
+void print_progress_rate(FILE *f, const RvtH_Progress_State *state)
+{
+	if (state->bytes_per_sec <= 0.0) {
+		return;
+	}
+
+	fprintf(f, " %.1f MiB/s", state->bytes_per_sec / 1048576.0);
+	if (state->eta_sec > 0) {
+		const unsigned long long eta = static_cast<unsigned long long>(state->eta_sec);
+		if (eta >= 3600) {
+			fprintf(f, ", ETA %llu:%02llu:%02llu", eta / 3600, (eta / 60) % 60, eta % 60);
+		} else {
+			fprintf(f, ", ETA %llu:%02llu", eta / 60, eta % 60);
+		}
+	}
+	fputs("    ", f);
+}
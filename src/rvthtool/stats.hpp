@@ -0,0 +1,43 @@
+/***************************************************************************
+ * RVT-H Tool                                                              *
+ * stats.hpp: Print performance statistics. (--stats)                      *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_RVTHTOOL_STATS_HPP__
+#define __RVTHTOOL_RVTHTOOL_STATS_HPP__
+
+#include "librvth/rvth.hpp"
+
+// C includes
+#include <stdio.h>
+
+/**
+ * Print the performance statistics of an RVT-H object.
+ * Statistics are printed to stderr, so they don't get
+ * mixed up with JSON reports.
+ * @param rvth	[in] RVT-H disk image
+ */
+void print_stats(const RvtH *rvth);
+
+/**
+ * Print the read latency statistics of an RVT-H object.
+ * Nothing is printed if read latency wasn't measured. (--slow-read)
+ * Statistics are printed to stderr, so they don't get
+ * mixed up with JSON reports.
+ * @param rvth	[in] RVT-H disk image
+ */
+void print_read_latency(const RvtH *rvth);
+
+/**
+ * Print the throughput and estimated time remaining of a progress update.
+ * Nothing is printed until librvth has a throughput estimate.
+ * Trailing spaces are printed so a shorter line overwrites a longer one.
+ * @param f	[in] FILE* to print to
+ * @param state	[in] Current progress
+ */
+void print_progress_rate(FILE *f, const RvtH_Progress_State *state);
+
+#endif /* __RVTHTOOL_RVTHTOOL_STATS_HPP__ */
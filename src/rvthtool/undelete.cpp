@@ -1,8 +1,8 @@
 /***************************************************************************
  * RVT-H Tool                                                              *
- * undelete.cpp: Delete or undelete a bank in an RVT-H disk image.         *
+ * undelete.cpp: Delete, undelete, wipe, or recover banks in an RVT-H HDD. *
  *                                                                         *
- * Copyright (c) 2018-2019 by David Korth.                                 *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
@@ -10,17 +10,30 @@
 #include "list-banks.hpp"
 #include "librvth/rvth.hpp"
 #include "librvth/rvth_error.h"
+#include "librvth/nhcd_structs.h"
+#include "stats.hpp"
 
+#include <assert.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
+
+// C++ includes
+#include <vector>
+using std::vector;
 
 /**
- * 'delete' command.
+ * Delete or undelete banks.
+ * All bank table changes are committed at once. If any bank can't be
+ * changed, none of the changes are written.
  * @param rvth_filename	RVT-H device or disk image filename.
- * @param s_bank	Bank number (as a string).
+ * @param s_banks	Bank numbers (as strings).
+ * @param bank_count	Number of bank numbers.
+ * @param undelete	If true, undelete the banks; otherwise, delete them.
  * @return 0 on success; non-zero on error.
  */
-int delete_bank(const TCHAR *rvth_filename, const TCHAR *s_bank)
+static int delete_or_undelete_banks(const TCHAR *rvth_filename,
+	const TCHAR *const *s_banks, int bank_count, bool undelete)
 {
 	// Open the disk image.
 	int ret;
@@ -33,40 +46,130 @@ int delete_bank(const TCHAR *rvth_filename, const TCHAR *s_bank)
 		return ret;
 	}
 
-	// Validate the bank number.
-	TCHAR *endptr;
-	unsigned int bank = (unsigned int)_tcstoul(s_bank, &endptr, 10) - 1;
-	if (*endptr != 0 || bank > rvth->bankCount()) {
-		_ftprintf(stderr, _T("*** ERROR: Invalid bank number '%s'.\n"), s_bank);
+	// Validate the bank numbers.
+	vector<unsigned int> banks;
+	banks.reserve(bank_count);
+	for (int i = 0; i < bank_count; i++) {
+		TCHAR *endptr;
+		unsigned int bank = (unsigned int)_tcstoul(s_banks[i], &endptr, 10) - 1;
+		if (*endptr != 0 || bank > rvth->bankCount()) {
+			_ftprintf(stderr, _T("*** ERROR: Invalid bank number '%s'.\n"), s_banks[i]);
+			delete rvth;
+			return -EINVAL;
+		}
+		banks.push_back(bank);
+	}
+
+	// Stage the bank table changes so they're written at once.
+	ret = rvth->beginBankTableTransaction();
+	if (ret != 0) {
+		fprintf(stderr, "*** ERROR: Unable to update the bank table: %s\n", rvth_error(ret));
 		delete rvth;
-		return -EINVAL;
+		return ret;
 	}
 
-	// Print the bank information.
-	// TODO: Make sure the bank type is valid before printing the newline.
-	print_bank(rvth, bank);
-	putchar('\n');
+	for (unsigned int bank : banks) {
+		// Print the bank information.
+		// TODO: Make sure the bank type is valid before printing the newline.
+		print_bank(rvth, bank);
+		putchar('\n');
+
+		// Delete or undelete the bank.
+		if (undelete) {
+			ret = rvth->undeleteBank(bank);
+			if (ret != 0) {
+				fprintf(stderr, "*** ERROR: rvth_undelete() failed: %s\n", rvth_error(ret));
+			}
+		} else {
+			ret = rvth->deleteBank(bank);
+			if (ret != 0) {
+				fprintf(stderr, "*** ERROR: rvth_delete() failed: %s\n", rvth_error(ret));
+			}
+		}
+		if (ret != 0) {
+			break;
+		}
+	}
+
+	if (ret != 0) {
+		// Don't write any of the changes.
+		if (banks.size() > 1) {
+			fputs("*** No banks were changed.\n", stderr);
+		}
+		rvth->rollbackBankTableTransaction();
+		delete rvth;
+		return ret;
+	}
 
-	// Delete the bank.
-	ret = rvth->deleteBank(bank);
+	ret = rvth->commitBankTableTransaction();
 	if (ret == 0) {
-		_tprintf(_T("Bank %u deleted.\n"), bank+1);
+		for (unsigned int bank : banks) {
+			_tprintf(_T("Bank %u %s.\n"), bank+1, (undelete ? _T("undeleted") : _T("deleted")));
+		}
 	} else {
-		// TODO: Delete the gcm file?
-		fprintf(stderr, "*** ERROR: rvth_delete() failed: %s\n", rvth_error(ret));
+		fprintf(stderr, "*** ERROR: Unable to write the bank table: %s\n", rvth_error(ret));
 	}
 
 	delete rvth;
 	return ret;
 }
 
+/**
+ * 'delete' command.
+ * @param rvth_filename	RVT-H device or disk image filename.
+ * @param s_banks	Bank numbers (as strings).
+ * @param bank_count	Number of bank numbers.
+ * @return 0 on success; non-zero on error.
+ */
+int delete_bank(const TCHAR *rvth_filename, const TCHAR *const *s_banks, int bank_count)
+{
+	return delete_or_undelete_banks(rvth_filename, s_banks, bank_count, false);
+}
+
 /**
  * 'undelete' command.
  * @param rvth_filename	RVT-H device or disk image filename.
+ * @param s_banks	Bank numbers (as strings).
+ * @param bank_count	Number of bank numbers.
+ * @return 0 on success; non-zero on error.
+ */
+int undelete_bank(const TCHAR *rvth_filename, const TCHAR *const *s_banks, int bank_count)
+{
+	return delete_or_undelete_banks(rvth_filename, s_banks, bank_count, true);
+}
+
+/**
+ * RVT-H progress callback for wiping a bank.
+ * @param state		[in] Current progress.
+ * @param userdata	[in] User data specified when calling the RVT-H function.
+ * @return True to continue; false to abort.
+ */
+static bool wipe_progress_callback(const RvtH_Progress_State *state, void *userdata)
+{
+	UNUSED(userdata);
+	assert(state->type == RVTH_PROGRESS_WIPE);
+
+	#define MEGABYTE (1048576 / LBA_SIZE)
+	printf("\rWiping: %4u MiB / %4u MiB zeroed...",
+		state->lba_processed / MEGABYTE,
+		state->lba_total / MEGABYTE);
+	print_progress_rate(stdout, state);
+
+	if (state->lba_processed == state->lba_total) {
+		// Finished processing.
+		putchar('\n');
+	}
+	fflush(stdout);
+	return true;
+}
+
+/**
+ * 'wipe' command.
+ * @param rvth_filename	RVT-H device or disk image filename.
  * @param s_bank	Bank number (as a string).
  * @return 0 on success; non-zero on error.
  */
-int undelete_bank(const TCHAR *rvth_filename, const TCHAR *s_bank)
+int wipe_bank(const TCHAR *rvth_filename, const TCHAR *s_bank)
 {
 	// Open the disk image.
 	int ret;
@@ -93,15 +196,134 @@ int undelete_bank(const TCHAR *rvth_filename, const TCHAR *s_bank)
 	print_bank(rvth, bank);
 	putchar('\n');
 
-	// Undelete the bank.
-	ret = rvth->undeleteBank(bank);
+	// Wipe the bank.
+	// Progress updates are printed at most 10 times per second.
+	static const RvtH_ProgressParams progress_params = {100, 0, 0};
+	rvth->setProgressParams(&progress_params);
+	_tprintf(_T("Wiping Bank %u...\n"), bank+1);
+	ret = rvth->wipeBank(bank, wipe_progress_callback);
 	if (ret == 0) {
-		_tprintf(_T("Bank %u undeleted.\n"), bank+1);
+		_tprintf(_T("Bank %u wiped.\n"), bank+1);
 	} else {
-		// TODO: Delete the gcm file?
-		fprintf(stderr, "*** ERROR: rvth_undelete() failed: %s\n", rvth_error(ret));
+		fprintf(stderr, "*** ERROR: rvth_wipe() failed: %s\n", rvth_error(ret));
 	}
 
 	delete rvth;
 	return ret;
 }
+
+/**
+ * RVT-H progress callback for scanning for lost banks.
+ * @param state		[in] Current progress.
+ * @param userdata	[in] User data specified when calling the RVT-H function.
+ * @return True to continue; false to abort.
+ */
+static bool recover_progress_callback(const RvtH_Progress_State *state, void *userdata)
+{
+	UNUSED(userdata);
+	assert(state->type == RVTH_PROGRESS_RECOVER);
+
+	#define GIGABYTE (1073741824 / LBA_SIZE)
+	printf("\rScanning: %4u GiB / %4u GiB (%5.1f%%)...",
+		state->lba_processed / GIGABYTE,
+		state->lba_total / GIGABYTE,
+		(state->lba_total != 0)
+			? (static_cast<double>(state->lba_processed) * 100.0 / state->lba_total)
+			: 100.0);
+
+	if (state->lba_processed == state->lba_total) {
+		// Finished processing.
+		putchar('\n');
+	}
+	fflush(stdout);
+	return true;
+}
+
+/**
+ * 'recover' command.
+ * @param rvth_filename	RVT-H device or disk image filename.
+ * @return 0 on success; non-zero on error.
+ */
+int recover_banks(const TCHAR *rvth_filename)
+{
+	// Open the disk image.
+	int ret;
+	RvtH *const rvth = new RvtH(rvth_filename, &ret);
+	if (ret != 0 || !rvth->isOpen()) {
+		_ftprintf(stderr, _T("*** ERROR opening RVT-H device '%s': "), rvth_filename);
+		fputs(rvth_error(ret), stderr);
+		_fputtc(_T('\n'), stderr);
+		delete rvth;
+		return ret;
+	}
+
+	// Scan the HDD.
+	// Progress updates are printed at most 4 times per second.
+	static const RvtH_ProgressParams progress_params = {250, 0, 0};
+	rvth->setProgressParams(&progress_params);
+	vector<RvtH_Bank_Candidate> candidates;
+	ret = rvth->scanForBanks(candidates, recover_progress_callback);
+	delete rvth;
+	if (ret != 0) {
+		fprintf(stderr, "*** ERROR: rvth_scan_for_banks() failed: %s\n", rvth_error(ret));
+		return ret;
+	}
+
+	if (candidates.empty()) {
+		fputs("No disc images were found.\n", stdout);
+		return 0;
+	}
+
+	printf("\n%u candidate%s found:\n\n", (unsigned int)candidates.size(),
+		(candidates.size() != 1 ? "s" : ""));
+	fputs("Score  LBA         Bank  Type    Status    Game ID  Title\n", stdout);
+	for (const RvtH_Bank_Candidate &c : candidates) {
+		const char *s_type;
+		switch (c.type) {
+			case RVTH_BankType_GCN:
+				s_type = "GCN";
+				break;
+			case RVTH_BankType_Wii_SL:
+				s_type = "Wii SL";
+				break;
+			case RVTH_BankType_Wii_DL:
+				s_type = "Wii DL";
+				break;
+			default:
+				s_type = "Unknown";
+				break;
+		}
+
+		const char *s_status;
+		if (c.in_nhcd) {
+			s_status = "in table";
+		} else if (c.is_deleted) {
+			s_status = "deleted";
+		} else {
+			s_status = "lost";
+		}
+
+		char s_bank[16];
+		if (c.bank >= 0) {
+			snprintf(s_bank, sizeof(s_bank), "%d", c.bank + 1);
+		} else {
+			strcpy(s_bank, "-");
+		}
+
+		// Remove trailing spaces from the title.
+		char game_title[65];
+		memcpy(game_title, c.discHeader.game_title, 64);
+		game_title[64] = 0;
+		for (int i = (int)strlen(game_title) - 1; i >= 0 && game_title[i] == ' '; i--) {
+			game_title[i] = 0;
+		}
+
+		printf("%5d  0x%08X  %-4s  %-7s %-9s %-6.6s   %s\n",
+			c.score, c.lba_start, s_bank, s_type, s_status,
+			c.discHeader.id6, game_title);
+	}
+
+	fputs("\nCandidates at standard bank addresses can be accessed using their\n"
+	      "bank numbers, even if the bank table is missing.\n", stdout);
+	return 0;
+}
@@ -1,8 +1,8 @@
 /***************************************************************************
  * RVT-H Tool                                                              *
- * undelete.h: Delete or undelete a bank in an RVT-H disk image.           *
+ * undelete.h: Delete, undelete, wipe, or recover banks in an RVT-H HDD.   *
  *                                                                         *
- * Copyright (c) 2018-2020 by David Korth.                                 *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
@@ -18,18 +18,35 @@ extern "C" {
 /**
  * 'delete' command.
  * @param rvth_filename	RVT-H device or disk image filename.
- * @param s_bank	Bank number (as a string).
+ * @param s_banks	Bank numbers (as strings).
+ * @param bank_count	Number of bank numbers.
  * @return 0 on success; non-zero on error.
  */
-int delete_bank(const TCHAR *rvth_filename, const TCHAR *s_bank);
+int delete_bank(const TCHAR *rvth_filename, const TCHAR *const *s_banks, int bank_count);
 
 /**
  * 'undelete' command.
  * @param rvth_filename	RVT-H device or disk image filename.
+ * @param s_banks	Bank numbers (as strings).
+ * @param bank_count	Number of bank numbers.
+ * @return 0 on success; non-zero on error.
+ */
+int undelete_bank(const TCHAR *rvth_filename, const TCHAR *const *s_banks, int bank_count);
+
+/**
+ * 'wipe' command.
+ * @param rvth_filename	RVT-H device or disk image filename.
  * @param s_bank	Bank number (as a string).
  * @return 0 on success; non-zero on error.
  */
-int undelete_bank(const TCHAR *rvth_filename, const TCHAR *s_bank);
+int wipe_bank(const TCHAR *rvth_filename, const TCHAR *s_bank);
+
+/**
+ * 'recover' command.
+ * @param rvth_filename	RVT-H device or disk image filename.
+ * @return 0 on success; non-zero on error.
+ */
+int recover_banks(const TCHAR *rvth_filename);
 
 #ifdef __cplusplus
 }
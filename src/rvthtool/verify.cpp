@@ -2,7 +2,7 @@
  * RVT-H Tool                                                              *
  * verify.cpp: Verify a bank in an RVT-H disk image.                       *
  *                                                                         *
- * Copyright (c) 2018-2022 by David Korth.                                 *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
@@ -12,15 +12,72 @@
 #include "librvth/rvth.hpp"
 #include "librvth/rvth_error.h"
 #include "librvth/nhcd_structs.h"
+#include "json_report.hpp"
+#include "stats.hpp"
+#include "time_r.h"
 
 // C includes (C++ namespace)
 #include <cassert>
 #include <cerrno>
+#include <csignal>
 #include <cstdlib>
+#include <cstring>
+#include <ctime>
 
 // C++ includes
+#include <memory>
 #include <numeric>
 
+// Set by the SIGINT handler if verification should be stopped.
+// The checkpoint is saved before verifyWiiPartitions() returns.
+static volatile sig_atomic_t s_interrupted = 0;
+
+/**
+ * SIGINT handler for resumable verification.
+ * @param sig Signal number
+ */
+static void sigint_handler(int sig)
+{
+	UNUSED(sig);
+	s_interrupted = 1;
+}
+
+/**
+ * Print a verification error.
+ * @param pt_current	[in] Partition number
+ * @param err		[in] Error
+ */
+static void print_verify_error(unsigned int pt_current, const RvtH_Verify_Error *err)
+{
+	char s_kb[16];
+	if (err->hash_level == 0) {
+		snprintf(s_kb, sizeof(s_kb), ",%u", err->kb);
+	} else {
+		s_kb[0] = '\0';
+	}
+
+	switch (err->err_type) {
+		default:
+			assert(!"Invalid error type.");
+			break;
+		case RVTH_VERIFY_ERROR_BAD_HASH:
+			printf("\n*** ERROR: Pt%u [%u,%u,%u%s]: H%u hash is invalid.\n",
+				pt_current, err->group,
+				err->sector / 8, err->sector,
+				s_kb, err->hash_level);
+			break;
+		case RVTH_VERIFY_ERROR_TABLE_COPY:
+			printf("\n*** ERROR: Pt%u [%u,%u,%u%s]: H%u table copy doesn't match base sector.\n",
+				pt_current, err->group,
+				err->sector / 8, err->sector,
+				s_kb, err->hash_level);
+			break;
+	}
+	if (err->is_zero) {
+		printf("*** (sector is zeroed; image may be scrubbed or truncated)\n");
+	}
+}
+
 /**
  * RVT-H verify progress callback.
  * @param state		[in] Current progress.
@@ -82,48 +139,397 @@ static bool progress_callback(const RvtH_Verify_Progress_State *state, void *use
 
 		case RVTH_VERIFY_ERROR_REPORT: {
 			// Error report!
-			char s_kb[16];
-			if (state->hash_level == 0) {
-				snprintf(s_kb, sizeof(s_kb), ",%u", state->kb);
+			RvtH_Verify_Error err;
+			err.group = state->group_cur;
+			err.hash_level = state->hash_level;
+			err.sector = state->sector;
+			err.kb = state->kb;
+			err.err_type = state->err_type;
+			err.is_zero = state->is_zero;
+			print_verify_error(state->pt_current, &err);
+			break;
+		}
+
+		case RVTH_VERIFY_ERROR_BATCH:
+			// Multiple error reports.
+			for (unsigned int i = 0; i < state->error_count; i++) {
+				print_verify_error(state->pt_current, &state->errors[i]);
+			}
+			break;
+
+		case RVTH_VERIFY_GROUPS_MISSING:
+			// Groups that aren't present in the image.
+			if (state->missing_count == 1) {
+				printf("\n*** ERROR: Pt%u [%u]: Group is not present in the image.\n",
+					state->pt_current, state->group_cur);
 			} else {
-				s_kb[0] = '\0';
+				printf("\n*** ERROR: Pt%u [%u-%u]: %u groups are not present in the image.\n",
+					state->pt_current, state->group_cur,
+					state->group_cur + state->missing_count - 1, state->missing_count);
 			}
+			printf("*** (unallocated blocks; image may be scrubbed)\n");
+			break;
+	}
 
-			switch (state->err_type) {
-				default:
-					assert(!"Invalid error type.");
-					break;
-				case RVTH_VERIFY_ERROR_BAD_HASH:
-					printf("\n*** ERROR: Pt%u [%u,%u,%u%s]: H%u hash is invalid.\n",
-						state->pt_current, state->group_cur,
-						state->sector / 8, state->sector,
-						s_kb, state->hash_level);
-					break;
-				case RVTH_VERIFY_ERROR_TABLE_COPY:
-					printf("\n*** ERROR: Pt%u [%u,%u,%u%s]: H%u table copy doesn't match base sector.\n",
-						state->pt_current, state->group_cur,
-						state->sector / 8, state->sector,
-						s_kb, state->hash_level);
-					break;
+	fflush(stdout);
+	return !s_interrupted;
+}
+
+/** JSON reports (--json) **/
+
+// Bank callback flag: Print JSON reports. (Not a librvth flag.)
+#define VERIFY_JSON (1U << 31)
+
+// JSON report for the bank being verified.
+// Each partition summary is printed as a separate line as soon as
+// the partition has been verified, followed by the bank result.
+// Sectors are indexed from the start of the partition data,
+// i.e. (group * 64) + sector.
+struct VerifyJsonReport {
+	unsigned int bank;		// Bank number (0-7)
+	bool active;			// True if a partition summary is pending
+	uint8_t pt_current;		// Current partition
+	uint32_t pt_type;		// Current partition type
+	unsigned int group_cur;		// Groups verified in the current partition
+	unsigned int group_total;	// Total groups in the current partition
+	unsigned int error_count[5];	// Error counts in the current partition
+	JsonRunList bad_sectors[3];	// Sectors with bad H0/H1/H2 hashes
+	JsonRunList bad_groups;		// Groups with bad H3 hashes
+	bool bad_h4;			// True if the H4 hash (H3 table) is bad
+	JsonRunList zeroed;		// Zeroed sectors with errors
+	JsonRunList missing;		// Groups that aren't present in the image
+
+	explicit VerifyJsonReport(unsigned int bank)
+		: bank(bank)
+	{
+		reset();
+	}
+
+	/**
+	 * Reset the partition summary.
+	 */
+	void reset(void)
+	{
+		active = false;
+		pt_current = 0;
+		pt_type = 0;
+		group_cur = 0;
+		group_total = 0;
+		memset(error_count, 0, sizeof(error_count));
+		for (JsonRunList &runs : bad_sectors) {
+			runs.clear();
+		}
+		bad_groups.clear();
+		bad_h4 = false;
+		zeroed.clear();
+		missing.clear();
+	}
+
+	/**
+	 * Add an error to the partition summary.
+	 * @param err Error
+	 */
+	void addError(const RvtH_Verify_Error *err)
+	{
+		const uint32_t sector = (err->group * 64) + err->sector;
+		if (err->hash_level < ARRAY_SIZE(error_count)) {
+			error_count[err->hash_level]++;
+		}
+		switch (err->hash_level) {
+			case 0: case 1: case 2:
+				bad_sectors[err->hash_level].add(sector);
+				break;
+			case 3:
+				bad_groups.add(err->group);
+				break;
+			case 4:
+				bad_h4 = true;
+				break;
+			default:
+				break;
+		}
+		if (err->is_zero && err->hash_level < 3) {
+			zeroed.add(sector);
+		}
+	}
+
+	/**
+	 * Print the partition summary, if one is pending.
+	 * @param complete True if the partition was completely verified.
+	 */
+	void printPartition(bool complete)
+	{
+		if (!active)
+			return;
+
+		const char *pt_name;
+		switch (pt_type) {
+			case 0:		pt_name = "\"game\""; break;
+			case 1:		pt_name = "\"update\""; break;
+			case 2:		pt_name = "\"channel\""; break;
+			default:	pt_name = "null"; break;
+		}
+
+		printf("{\"type\":\"partition\",\"bank\":%u,\"partition\":%u,"
+			"\"partition_type\":%u,\"partition_name\":%s,"
+			"\"groups_checked\":%u,\"groups_total\":%u,\"complete\":%s,"
+			"\"errors\":{\"H0\":%u,\"H1\":%u,\"H2\":%u,\"H3\":%u,\"H4\":%u},",
+			bank+1, pt_current, pt_type, pt_name,
+			group_cur, group_total, (complete ? "true" : "false"),
+			error_count[0], error_count[1], error_count[2], error_count[3], error_count[4]);
+		fputs("\"bad_sectors\":{\"H0\":", stdout);
+		bad_sectors[0].print(stdout);
+		fputs(",\"H1\":", stdout);
+		bad_sectors[1].print(stdout);
+		fputs(",\"H2\":", stdout);
+		bad_sectors[2].print(stdout);
+		fputs("},\"bad_groups_H3\":", stdout);
+		bad_groups.print(stdout);
+		printf(",\"bad_H4\":%s,\"zeroed_sectors\":", (bad_h4 ? "true" : "false"));
+		zeroed.print(stdout);
+		fputs(",\"missing_groups\":", stdout);
+		missing.print(stdout);
+		fputs("}\n", stdout);
+		fflush(stdout);
+		reset();
+	}
+};
+
+/**
+ * RVT-H verify progress callback. (JSON reports)
+ * @param state		[in] Current progress.
+ * @param userdata	[in] VerifyJsonReport
+ * @return True to continue; false to abort.
+ */
+static bool json_progress_callback(const RvtH_Verify_Progress_State *state, void *userdata)
+{
+	VerifyJsonReport *const report = static_cast<VerifyJsonReport*>(userdata);
+	if (report->active && state->pt_current != report->pt_current) {
+		// Finished the previous partition.
+		report->printPartition(true);
+	}
+	if (state->pt_current >= state->pt_total) {
+		// Finished verifying the bank.
+		return !s_interrupted;
+	}
+
+	report->active = true;
+	report->pt_current = state->pt_current;
+	report->pt_type = state->pt_type;
+	report->group_total = state->group_total;
+
+	switch (state->type) {
+		default:
+			assert(!"Invalid verify progress state.");
+			break;
+
+		case RVTH_VERIFY_STATUS:
+			report->group_cur = state->group_cur;
+			break;
+
+		case RVTH_VERIFY_ERROR_REPORT: {
+			RvtH_Verify_Error err;
+			err.group = state->group_cur;
+			err.hash_level = state->hash_level;
+			err.sector = state->sector;
+			err.kb = state->kb;
+			err.err_type = state->err_type;
+			err.is_zero = state->is_zero;
+			report->addError(&err);
+			break;
+		}
+
+		case RVTH_VERIFY_ERROR_BATCH:
+			for (unsigned int i = 0; i < state->error_count; i++) {
+				report->addError(&state->errors[i]);
 			}
-			if (state->is_zero) {
-				printf("*** (sector is zeroed; image may be scrubbed or truncated)\n");
+			break;
+
+		case RVTH_VERIFY_GROUPS_MISSING:
+			// Each missing group is counted as an H3 error.
+			for (unsigned int i = 0; i < state->missing_count; i++) {
+				const unsigned int group = state->group_cur + i;
+				report->error_count[3]++;
+				report->bad_groups.add(group);
+				report->missing.add(group);
 			}
 			break;
+	}
+
+	return !s_interrupted;
+}
+
+/**
+ * Print a bank verification result as a JSON object.
+ * @param result	[in] Verification result
+ * @param quick		[in] True if this was a quick verification
+ */
+static void json_print_result(const RvtH_Verify_Bank_Result *result, bool quick)
+{
+	printf("{\"type\":\"result\",\"bank\":%u,", result->bank+1);
+	if (result->ret == 0) {
+		const unsigned int total_errs = std::accumulate(result->error_count,
+			result->error_count + ARRAY_SIZE(result->error_count), 0);
+		printf("\"status\":\"ok\",\"quick\":%s,\"cached\":%s,",
+			(quick ? "true" : "false"), (result->cached ? "true" : "false"));
+		if (result->cached) {
+			printf("\"verify_time\":%lld,", static_cast<long long>(result->verify_time));
 		}
+		printf("\"errors\":{\"H0\":%u,\"H1\":%u,\"H2\":%u,\"H3\":%u,\"H4\":%u},"
+			"\"total_errors\":%u}\n",
+			result->error_count[0], result->error_count[1], result->error_count[2],
+			result->error_count[3], result->error_count[4], total_errs);
+	} else {
+		printf("\"status\":\"%s\",\"code\":%d,\"message\":",
+			(result->ret == -ECANCELED ? "cancelled" : "error"), result->ret);
+		json_print_string(stdout, rvth_error(result->ret));
+		fputs("}\n", stdout);
 	}
+	fflush(stdout);
+}
 
+/**
+ * Format the time of a cached verification result.
+ * @param buf		[out] Output buffer
+ * @param size		[in] Size of buf
+ * @param verify_time	[in] Verification time
+ */
+static void format_verify_time(char *buf, size_t size, time_t verify_time)
+{
+	struct tm tm_verify;
+	if (verify_time == -1 || !localtime_r(&verify_time, &tm_verify)) {
+		snprintf(buf, size, "an unknown time");
+		return;
+	}
+	strftime(buf, size, "%Y/%m/%d %H:%M:%S", &tm_verify);
+}
+
+/**
+ * RVT-H bank verification callback. (verify all banks)
+ * @param rvth		[in] RvtH object.
+ * @param result	[in] Verification result for this bank.
+ * @param userdata	[in] Verification flags, plus VERIFY_JSON if printing JSON reports.
+ * @return True to continue; false to skip the remaining banks.
+ */
+static bool bank_callback(const RvtH *rvth, const RvtH_Verify_Bank_Result *result, void *userdata)
+{
+	UNUSED(rvth);
+	const unsigned int flags = *static_cast<const unsigned int*>(userdata);
+	if (flags & VERIFY_JSON) {
+		json_print_result(result, !!(flags & RVTH_VERIFY_QUICK));
+		return true;
+	}
+
+	if (result->ret == 0) {
+		const unsigned int total_errs = std::accumulate(result->error_count,
+			result->error_count + ARRAY_SIZE(result->error_count), 0);
+		if (result->cached) {
+			char s_time[32];
+			format_verify_time(s_time, sizeof(s_time), result->verify_time);
+			printf("Bank %u verified with %u error%s at %s. (cached)\n", result->bank+1,
+				total_errs, (total_errs != 1) ? "s" : "", s_time);
+		} else {
+			printf("Bank %u verified with %u error%s.\n", result->bank+1,
+				total_errs, (total_errs != 1) ? "s" : "");
+		}
+	} else {
+		printf("Bank %u: *** ERROR: %s\n", result->bank+1, rvth_error(result->ret));
+	}
 	fflush(stdout);
 	return true;
 }
 
+/**
+ * Verify all banks in an RVT-H device or disk image.
+ * @param rvth		[in] RvtH object.
+ * @param threads	[in] Number of worker threads. (0 for auto)
+ * @param flags		[in] Verification flags. (See RvtH_Verify_Flags.)
+ * @param json		[in] If true, print JSON reports instead of text.
+ * @return 0 on success; non-zero on error.
+ */
+static int verify_all(RvtH *rvth, unsigned int threads, unsigned int flags, bool json)
+{
+	const unsigned int bankCount = rvth->bankCount();
+	std::unique_ptr<RvtH_Verify_Bank_Result[]> results(new RvtH_Verify_Bank_Result[bankCount]);
+
+	if (!json) {
+		_fputts(_T("Verifying all banks...\n"), stdout);
+		fflush(stdout);
+	}
+	unsigned int cb_flags = flags | (json ? VERIFY_JSON : 0);
+	int ret = rvth->verifyAllWiiPartitions(results.get(), bank_callback, &cb_flags, threads, flags);
+	if (ret < 0) {
+		fprintf(stderr, "*** ERROR: rvth->verifyAllWiiPartitions() failed: %s\n", rvth_error(ret));
+		return ret;
+	}
+	if (json) {
+		// Results were printed by the bank callback.
+		for (unsigned int bank = 0; bank < bankCount; bank++) {
+			switch (results[bank].ret) {
+				case 0:
+				case RVTH_ERROR_BANK_EMPTY:
+				case RVTH_ERROR_BANK_DL_2:
+				case RVTH_ERROR_NOT_WII_IMAGE:
+				case RVTH_ERROR_IS_UNENCRYPTED:
+					break;
+				default:
+					ret = results[bank].ret;
+					break;
+			}
+		}
+		return ret;
+	}
+
+	// Print the summary table.
+	unsigned int total_errs = 0;
+	ret = 0;
+	printf("\nSummary:\n");
+	printf("Bank     H0     H1     H2     H3     H4  Total\n");
+	for (unsigned int bank = 0; bank < bankCount; bank++) {
+		const RvtH_Verify_Bank_Result *const result = &results[bank];
+		switch (result->ret) {
+			case 0: {
+				const unsigned int bank_errs = std::accumulate(result->error_count,
+					result->error_count + ARRAY_SIZE(result->error_count), 0);
+				printf("%4u %6u %6u %6u %6u %6u %6u\n", bank+1,
+					result->error_count[0], result->error_count[1],
+					result->error_count[2], result->error_count[3],
+					result->error_count[4], bank_errs);
+				total_errs += bank_errs;
+				break;
+			}
+
+			case RVTH_ERROR_BANK_EMPTY:
+			case RVTH_ERROR_BANK_DL_2:
+			case RVTH_ERROR_NOT_WII_IMAGE:
+			case RVTH_ERROR_IS_UNENCRYPTED:
+				// Bank can't be verified. This isn't an error.
+				printf("%4u  (%s)\n", bank+1, rvth_error(result->ret));
+				break;
+
+			default:
+				printf("%4u  *** ERROR: %s\n", bank+1, rvth_error(result->ret));
+				ret = result->ret;
+				break;
+		}
+	}
+	printf("\nAll banks verified with %u error%s.\n", total_errs, (total_errs != 1) ? "s" : "");
+	return ret;
+}
+
 /**
  * 'verify' command.
  * @param rvth_filename	[in] RVT-H device or disk image filename.
- * @param s_bank	[in] Bank number (as a string). (If NULL, assumes bank 1.)
+ * @param s_bank	[in] Bank number (as a string), or "all". (If NULL, assumes bank 1.)
+ * @param threads	[in] Number of worker threads. (0 for auto)
+ * @param flags		[in] Verification flags. (See RvtH_Verify_Flags.)
+ * @param copy_params	[in] I/O parameters. (The copy buffer sizes aren't used.)
+ * @param json		[in] If true, print JSON reports instead of text.
+ * @param stats		[in] If true, print performance statistics when finished.
  * @return 0 on success; non-zero on error.
  */
-int verify(const TCHAR *rvth_filename, const TCHAR *s_bank)
+int verify(const TCHAR *rvth_filename, const TCHAR *s_bank, unsigned int threads, unsigned int flags,
+	const RvtH_CopyParams *copy_params, bool json, bool stats)
 {
 	// Open the RVT-H device or disk image.
 	int ret;
@@ -136,6 +542,36 @@ int verify(const TCHAR *rvth_filename, const TCHAR *s_bank)
 		return ret;
 	}
 
+	// Set the I/O parameters.
+	ret = rvth->setCopyParams(copy_params);
+	if (ret != 0) {
+		fputs("*** ERROR: Invalid copy buffer parameters.\n", stderr);
+		delete rvth;
+		return ret;
+	}
+
+	if ((flags & RVTH_VERIFY_QUICK) && !json) {
+		_fputts(_T("Quick verification: Only checking the hash tables,\n")
+			_T("plus the user data in a random sample of groups.\n\n"), stdout);
+	}
+	if (flags & RVTH_VERIFY_CHECKPOINT) {
+		// Stop at the next group if interrupted, so the
+		// checkpoint contains all of the groups verified so far.
+		s_interrupted = 0;
+		signal(SIGINT, sigint_handler);
+	}
+
+	if (s_bank && !_tcsicmp(s_bank, _T("all"))) {
+		// Verify all banks.
+		ret = verify_all(rvth, threads, flags, json);
+		if (stats) {
+			print_stats(rvth);
+		}
+		print_read_latency(rvth);
+		delete rvth;
+		return ret;
+	}
+
 	unsigned int bank;
 	if (s_bank) {
 		// Validate the bank number.
@@ -159,20 +595,83 @@ int verify(const TCHAR *rvth_filename, const TCHAR *s_bank)
 		bank = 0;
 	}
 
-	// Print the bank information.
-	// TODO: Make sure the bank type is valid before printing the newline.
-	print_bank(rvth, bank);
-	putchar('\n');
+	if (!json) {
+		// Print the bank information.
+		// TODO: Make sure the bank type is valid before printing the newline.
+		print_bank(rvth, bank);
+		putchar('\n');
+	}
 
 	const bool isHDD = rvth->isHDD();
+	if (flags & RVTH_VERIFY_USE_CACHE) {
+		// Check if the bank has already been verified.
+		RvtH_Verify_Cached_Result cached;
+		if (rvth->getCachedVerifyResult(bank, &cached, flags) == 0) {
+			if (json) {
+				RvtH_Verify_Bank_Result result;
+				result.bank = bank;
+				result.ret = 0;
+				memcpy(result.error_count, cached.error_count, sizeof(result.error_count));
+				result.cached = true;
+				result.verify_time = cached.verify_time;
+				json_print_result(&result, !!(cached.flags & RVTH_VERIFY_QUICK));
+				delete rvth;
+				return 0;
+			}
+
+			const unsigned int total_errs = std::accumulate(cached.error_count,
+				cached.error_count + ARRAY_SIZE(cached.error_count), 0);
+			char s_time[32];
+			format_verify_time(s_time, sizeof(s_time), cached.verify_time);
+			printf("Bank %u %sverified with %u error%s at %s.\n"
+				"(The bank hasn't changed since then. Use --force to verify it again.)\n",
+				bank+1, (cached.flags & RVTH_VERIFY_QUICK) ? "quick-" : "",
+				total_errs, (total_errs != 1) ? "s" : "", s_time);
+			delete rvth;
+			return 0;
+		}
+	}
+
 	unsigned int error_count[5] = {0, 0, 0, 0, 0};
+	if (json) {
+		// Errors are collected into the partition summaries,
+		// so they can be delivered in large batches.
+		static const RvtH_ProgressParams json_progress_params = {100, 0, 4096};
+		rvth->setProgressParams(&json_progress_params);
+		VerifyJsonReport report(bank);
+		ret = rvth->verifyWiiPartitions(bank, error_count, json_progress_callback, &report, threads, flags);
+		report.printPartition(ret == 0);
+
+		RvtH_Verify_Bank_Result result;
+		result.bank = bank;
+		result.ret = ret;
+		memcpy(result.error_count, error_count, sizeof(result.error_count));
+		result.cached = false;
+		result.verify_time = 0;
+		json_print_result(&result, !!(flags & RVTH_VERIFY_QUICK));
+		if (ret == -ECANCELED) {
+			_fputts(_T("Verification interrupted. Run it again with --resume to continue.\n"), stderr);
+		}
+		if (stats) {
+			print_stats(rvth);
+		}
+		print_read_latency(rvth);
+		delete rvth;
+		return ret;
+	}
+
 	if (isHDD) {
 		_tprintf(_T("Verifying Bank %u...\n"), bank+1);
 	} else {
 		_fputts(_T("Verifying disc image...\n"), stdout);
 	}
 	fflush(stdout);
-	ret = rvth->verifyWiiPartitions(bank, error_count, progress_callback);
+
+	// Progress updates are printed at most 10 times per second,
+	// and errors are printed in batches.
+	static const RvtH_ProgressParams progress_params = {100, 0, 64};
+	rvth->setProgressParams(&progress_params);
+	ret = rvth->verifyWiiPartitions(bank, error_count, progress_callback, nullptr, threads, flags);
 	if (ret == 0) {
 		// Add up the errors.
 		unsigned int total_errs = std::accumulate(error_count, error_count + ARRAY_SIZE(error_count), 0);
@@ -181,10 +680,117 @@ int verify(const TCHAR *rvth_filename, const TCHAR *s_bank)
 		} else {
 			_tprintf(_T("Disc image verified with %u error%s.\n"), total_errs, (total_errs != 1) ? _T("s") : _T(""));
 		}
+	} else if (ret == -ECANCELED) {
+		_fputts(_T("\nVerification interrupted. Run it again with --resume to continue.\n"), stderr);
 	} else {
 		fprintf(stderr, "*** ERROR: rvth->verifyWiiPartitions() failed: %s\n", rvth_error(ret));
 	}
 
+	if (stats) {
+		print_stats(rvth);
+	}
+	print_read_latency(rvth);
+	delete rvth;
+	return ret;
+}
+
+/**
+ * Progress callback for repairing hash trees.
+ * @param state		[in] Current progress.
+ * @param userdata	[in] User data specified when calling the RVT-H function.
+ * @return True to continue; false to abort.
+ */
+static bool repair_progress_callback(const RvtH_Progress_State *state, void *userdata)
+{
+	UNUSED(userdata);
+	assert(state->type == RVTH_PROGRESS_REPAIR);
+
+	#define MEGABYTE (1048576 / LBA_SIZE)
+	printf("\rRepairing: %4u MiB / %4u MiB checked...",
+		state->lba_processed / MEGABYTE,
+		state->lba_total / MEGABYTE);
+	print_progress_rate(stdout, state);
+
+	if (state->lba_processed == state->lba_total) {
+		// Finished processing.
+		putchar('\n');
+	}
+	fflush(stdout);
+	return true;
+}
+
+/**
+ * 'repair' command.
+ * @param rvth_filename	RVT-H device or disk image filename.
+ * @param s_bank	Bank number (as a string). (If NULL, assumes bank 1.)
+ * @param threads	Number of worker threads. (0 for auto)
+ * @return 0 on success; non-zero on error.
+ */
+int repair(const TCHAR *rvth_filename, const TCHAR *s_bank, unsigned int threads)
+{
+	// Open the RVT-H device or disk image.
+	int ret;
+	RvtH *const rvth = new RvtH(rvth_filename, &ret);
+	if (ret != 0 || !rvth->isOpen()) {
+		_ftprintf(stderr, _T("*** ERROR opening RVT-H device '%s': "), rvth_filename);
+		fputs(rvth_error(ret), stderr);
+		_fputtc(_T('\n'), stderr);
+		delete rvth;
+		return ret;
+	}
+
+	unsigned int bank;
+	if (s_bank) {
+		// Validate the bank number.
+		TCHAR *endptr;
+		bank = (unsigned int)_tcstoul(s_bank, &endptr, 10) - 1;
+		if (*endptr != 0 || bank > rvth->bankCount()) {
+			_ftprintf(stderr, _T("*** ERROR: Invalid bank number '%s'.\n"), s_bank);
+			delete rvth;
+			return -EINVAL;
+		}
+	} else {
+		// No bank number specified.
+		// Assume 1 bank if this is a standalone disc image.
+		// For HDD images or RVT-H Readers, this is an error.
+		if (rvth->bankCount() != 1) {
+			_ftprintf(stderr, _T("*** ERROR: Must specify a bank number for this RVT-H Reader%s.\n"),
+				rvth->isHDD() ? _T("") : _T(" disk image"));
+			delete rvth;
+			return -EINVAL;
+		}
+		bank = 0;
+	}
+
+	// Print the bank information.
+	print_bank(rvth, bank);
+	putchar('\n');
+
+	if (rvth->isHDD()) {
+		_tprintf(_T("Repairing the hash tree of Bank %u...\n"), bank+1);
+	} else {
+		_fputts(_T("Repairing the hash tree of the disc image...\n"), stdout);
+	}
+	fflush(stdout);
+
+	RvtH_Repair_Result result;
+	ret = rvth->repairWiiPartitions(bank, &result, repair_progress_callback, nullptr, threads);
+	if (ret == 0) {
+		printf("%u group%s checked, %u skipped (zeroed).\n",
+			result.groups_checked, (result.groups_checked != 1) ? "s" : "",
+			result.groups_skipped);
+		if (result.groups_repaired == 0 && result.partitions_updated == 0) {
+			fputs("The hash tree is correct. Nothing was changed.\n", stdout);
+		} else {
+			printf("Repaired %u group%s: %u sector%s rewritten, %u partition%s updated.\n",
+				result.groups_repaired, (result.groups_repaired != 1) ? "s" : "",
+				result.sectors_written, (result.sectors_written != 1) ? "s" : "",
+				result.partitions_updated, (result.partitions_updated != 1) ? "s" : "");
+		}
+	} else {
+		fprintf(stderr, "*** ERROR: rvth->repairWiiPartitions() failed: %s\n", rvth_error(ret));
+	}
+
 	delete rvth;
 	return ret;
 }
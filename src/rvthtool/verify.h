@@ -2,7 +2,7 @@
  * RVT-H Tool                                                              *
  * verify.h: Verify a bank in an RVT-H disk image.                         *
  *                                                                         *
- * Copyright (c) 2018-2022 by David Korth.                                 *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
@@ -10,6 +10,8 @@
 #define __RVTHTOOL_RVTHTOOL_VERIFY_H__
 
 #include "tcharx.h"
+#include "stdboolx.h"
+#include "librvth/rvth.hpp"
 
 #ifdef __cplusplus
 extern "C" {
@@ -18,10 +20,25 @@ extern "C" {
 /**
  * 'verify' command.
  * @param rvth_filename	RVT-H device or disk image filename.
+ * @param s_bank	Bank number (as a string), or "all". (If NULL, assumes bank 1.)
+ * @param threads	Number of worker threads. (0 for auto)
+ * @param flags		Verification flags. (See RvtH_Verify_Flags.)
+ * @param copy_params	I/O parameters. (Only direct_io is used.)
+ * @param json		If true, print JSON reports instead of text.
+ * @param stats		If true, print performance statistics when finished.
+ * @return 0 on success; non-zero on error.
+ */
+int verify(const TCHAR *rvth_filename, const TCHAR *s_bank, unsigned int threads, unsigned int flags,
+	const RvtH_CopyParams *copy_params, bool json, bool stats);
+
+/**
+ * 'repair' command.
+ * @param rvth_filename	RVT-H device or disk image filename.
  * @param s_bank	Bank number (as a string). (If NULL, assumes bank 1.)
+ * @param threads	Number of worker threads. (0 for auto)
  * @return 0 on success; non-zero on error.
  */
-int verify(const TCHAR *rvth_filename, const TCHAR *s_bank);
+int repair(const TCHAR *rvth_filename, const TCHAR *s_bank, unsigned int threads);
 
 #ifdef __cplusplus
 }
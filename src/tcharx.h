@@ -2,7 +2,7 @@
  * RVT-H Tool (librvth)                                                    *
  * tcharx.h: TCHAR support for Windows and Linux.                          *
  *                                                                         *
- * Copyright (c) 2018-2022 by David Korth.                                 *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
@@ -35,10 +35,12 @@ typedef char TCHAR;
 // stdio.h
 #define _fputts(s, stream) fputs((s), (stream))
 #define _fputtc(c, stream) fputc((c), (stream))
+#define _fgetts(s, size, stream) fgets((s), (size), (stream))
 
 #define _tfopen(filename, mode)		fopen((filename), (mode))
 #define _tmkdir(path, mode)		mkdir((path), (mode))
 #define _tremove(pathname)		remove(pathname)
+#define _trename(oldpath, newpath)	rename((oldpath), (newpath))
 
 #define _tprintf printf
 #define _ftprintf fprintf
@@ -48,11 +50,13 @@ typedef char TCHAR;
 #define _vsprintf vsprintf
 
 // stdlib.h
+#define _tgetenv(name)			getenv(name)
 #define _tcscmp(s1, s2)			strcmp((s1), (s2))
 #define _tcsicmp(s1, s2)		strcasecmp((s1), (s2))
-#define _tcsnicmp(s1, s2)		strncasecmp((s1), (s2), (n))
+#define _tcsnicmp(s1, s2, n)		strncasecmp((s1), (s2), (n))
 #define _tcstol(nptr, endptr, base)	strtol((nptr), (endptr), (base))
 #define _tcstoul(nptr, endptr, base)	strtoul((nptr), (endptr), (base))
+#define _tcstod(nptr, endptr)		strtod((nptr), (endptr))
 
 // string.h
 #define _tcschr(s, c)			strchr((s), (c))
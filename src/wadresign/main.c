@@ -25,6 +25,7 @@
 
 #include "print-info.h"
 #include "resign-wad.hpp"
+#include "resign-batch.hpp"
 
 #ifdef __GNUC__
 #  define ATTR_PRINTF(fmt, args) __attribute__ ((format (printf, (fmt), (args))))
@@ -75,6 +76,18 @@ static void print_help(const TCHAR *argv0)
 		_T("  Debug WADs to Retail. The format isn't changed unless\n")
 		_T("  the --format parameter is specified.\n")
 		_T("\n")
+		_T("resign --in-place file.wad [file.wad...]\n")
+		_T("- Resigns file.wad in place. Only the certificate chain, ticket,\n")
+		_T("  and TMD are rewritten. The WAD must be a standard WAD, and the\n")
+		_T("  certificate chain must not change size, so this can't be used\n")
+		_T("  to convert between retail and debug.\n")
+		_T("\n")
+		_T("resign-batch dest_dir source [source...]\n")
+		_T("- Resigns multiple WADs in parallel and writes them to dest_dir.\n")
+		_T("  Each source may be a WAD file, a directory containing WAD files,\n")
+		_T("  or @list.txt, where list.txt has one WAD filename per line.\n")
+		_T("  With --in-place, dest_dir is omitted and the WADs are resigned in place.\n")
+		_T("\n")
 		_T("verify file.wad\n")
 		_T("- Verify the content hashes.\n")
 		_T("\n")
@@ -85,6 +98,9 @@ static void print_help(const TCHAR *argv0)
 		_T("                            Recrypting to retail will use fakesigning.\n")
 		_T("  -f, --format=FMT          Use the specified format FMT:\n")
 		_T("                            default, wad, bwf\n")
+		_T("  -j, --jobs=N              Use N threads for resign-batch.\n")
+		_T("                            (default is the number of CPUs)\n")
+		_T("  -i, --in-place            Resign WADs in place.\n")
 		_T("  -h, --help                Display this help and exit.\n")
 		_T("\n"), stdout);
 }
@@ -103,6 +119,12 @@ int RVTH_CDECL _tmain(int argc, TCHAR *argv[])
 	// Other values are from WAD_Format_e.
 	int output_format = -1;
 
+	// Number of threads for resign-batch. (0 for auto)
+	unsigned int jobs = 0;
+
+	// Resign WADs in place?
+	bool in_place = false;
+
 	((void)argc);
 	((void)argv);
 
@@ -132,13 +154,15 @@ int RVTH_CDECL _tmain(int argc, TCHAR *argv[])
 		static const struct option long_options[] = {
 			{_T("recrypt"),	required_argument,	0, _T('k')},
 			{_T("format"),	required_argument,	0, _T('f')},
+			{_T("jobs"),	required_argument,	0, _T('j')},
+			{_T("in-place"),	no_argument,		0, _T('i')},
 			{_T("ndev"),	no_argument,		0, _T('N')},
 			{_T("help"),	no_argument,		0, _T('h')},
 
 			{NULL, 0, 0, 0}
 		};
 
-		int c = getopt_long(argc, argv, _T("k:f:Nh"), long_options, NULL);
+		int c = getopt_long(argc, argv, _T("k:f:j:iNh"), long_options, NULL);
 		if (c == -1)
 			break;
 
@@ -185,6 +209,23 @@ int RVTH_CDECL _tmain(int argc, TCHAR *argv[])
 				}
 				break;
 
+			case _T('j'): {
+				// Number of threads.
+				TCHAR *endptr = NULL;
+				const unsigned long n = optarg ? _tcstoul(optarg, &endptr, 10) : 0;
+				if (!optarg || *endptr != 0 || n == 0 || n > 256) {
+					print_error(argv[0], _T("invalid number of jobs '%s'"), optarg ? optarg : _T(""));
+					return EXIT_FAILURE;
+				}
+				jobs = (unsigned int)n;
+				break;
+			}
+
+			case _T('i'):
+				// Resign in place.
+				in_place = true;
+				break;
+
 			case _T('h'):
 				print_help(argv[0]);
 				return EXIT_SUCCESS;
@@ -235,12 +276,37 @@ int RVTH_CDECL _tmain(int argc, TCHAR *argv[])
 		if (argc < optind+2) {
 			print_error(argv[0], _T("WAD filenames not specified"));
 			ret = EXIT_FAILURE;
+		} else if (in_place) {
+			ret = 0;
+			for (int i = optind+1; i < argc; i++) {
+				ret |= resign_wad(argv[i], NULL, recrypt_key, output_format);
+			}
 		} else if (argc < optind+3) {
 			print_error(argv[0], _T("Output WAD filename not specified"));
 			ret = EXIT_FAILURE;
 		} else {
 			ret = resign_wad(argv[optind+1], argv[optind+2], recrypt_key, output_format);
 		}
+	} else if (!_tcscmp(argv[optind], _T("resign-batch"))) {
+		// Resign multiple WADs.
+		if (in_place) {
+			if (argc < optind+2) {
+				print_error(argv[0], _T("WAD filenames not specified"));
+				ret = EXIT_FAILURE;
+			} else {
+				ret = resign_wad_batch(NULL, &argv[optind+1], argc - (optind+1),
+					recrypt_key, output_format, jobs);
+			}
+		} else if (argc < optind+2) {
+			print_error(argv[0], _T("Destination directory not specified"));
+			ret = EXIT_FAILURE;
+		} else if (argc < optind+3) {
+			print_error(argv[0], _T("WAD filenames not specified"));
+			ret = EXIT_FAILURE;
+		} else {
+			ret = resign_wad_batch(argv[optind+1], &argv[optind+2], argc - (optind+2),
+				recrypt_key, output_format, jobs);
+		}
 	} else {
 		// If the "command" contains a slash or dot (or backslash on Windows),
 		// assume it's a filename and handle it as 'info'.
@@ -2,15 +2,15 @@
  * RVT-H Tool: WAD Resigner                                                *
  * print-info.c: Print WAD information.                                    *
  *                                                                         *
- * Copyright (c) 2018-2022 by David Korth.                                 *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
 #include "print-info.h"
 #include "wad-fns.h"
+#include "verify-contents.hpp"
 
 // libwiicrypto
-#include "libwiicrypto/aesw.h"
 #include "libwiicrypto/byteswap.h"
 #include "libwiicrypto/cert.h"
 #include "libwiicrypto/sig_tools.h"
@@ -19,9 +19,6 @@
 // stdboolx
 #include "stdboolx.h"
 
-// Nettle SHA-1
-#include <nettle/sha1.h>
-
 // C includes
 #include <ctype.h>
 #include <errno.h>
@@ -113,138 +110,28 @@ const TCHAR *identify_wad_type(const uint8_t *buf, size_t buf_len, bool *pIsBWF)
 }
 
 /**
- * Verify a content entry.
- * @param f_wad		[in] Opened WAD file.
- * @param encKey	[in] Encryption key.
- * @param ticket	[in] Ticket.
- * @param content	[in] Content entry.
- * @param content_addr	[in] Content address.
- * @return 0 if the content is verified; 1 if not; negative POSIX error code on error.
+ * Print the expected and actual SHA-1 of a content.
+ * @param expected	[in] Expected SHA-1.
+ * @param actual	[in] Actual SHA-1.
  */
-static int verify_content(FILE *f_wad, RVL_AES_Keys_e encKey,
-	const RVL_Ticket *ticket, const RVL_Content_Entry *content,
-	uint32_t content_addr)
+static void print_sha1_result(const uint8_t *expected, const uint8_t *actual)
 {
-	int ret = 0;
-	size_t size;
-
-	struct sha1_ctx sha1;
-	uint8_t iv[16];
-	uint8_t title_key[16];
-	uint32_t data_sz;
+	unsigned int i;
 
-	// AES context.
-	AesCtx *aesw;
-
-	uint8_t *buf = NULL;	// 1 MB buffer
-	uint8_t digest[SHA1_DIGEST_SIZE];
-
-	// TODO: Pass in an aesw context for less overhead.
-	errno = 0;
-	aesw = aesw_new();
-	if (!aesw) {
-		int ret = -errno;
-		if (ret == 0) {
-			ret = -EIO;
-		}
-		return ret;
-	}
-
-	// IV is the 64-bit title ID, followed by zeroes.
-	memcpy(iv, &ticket->title_id, 8);
-	memset(&iv[8], 0, 8);
-
-	// Decrypt the title key with the common key.
-	memcpy(title_key, ticket->enc_title_key, sizeof(title_key));
-	aesw_set_key(aesw, RVL_AES_Keys[encKey], sizeof(RVL_AES_Keys[encKey]));
-	aesw_set_iv(aesw, iv, sizeof(iv));
-	aesw_decrypt(aesw, title_key, sizeof(title_key));
-
-	// Set the title key and new IV.
-	// IV is the 2-byte content index, followed by zeroes.
-	memcpy(iv, &content->index, 2);
-	memset(&iv[2], 0, 14);
-	aesw_set_key(aesw, title_key, sizeof(title_key));
-	aesw_set_iv(aesw, iv, sizeof(iv));
-
-	// Allocate memory.
-	buf = malloc(READ_BUFFER_SIZE);
-	if (!buf) {
-		aesw_free(aesw);
-		return -ENOMEM;
-	}
-
-	// Read the content, decrypt it, and hash it.
-	// TODO: Verify size; check fseeko() errors.
-	sha1_init(&sha1);
-	data_sz = (uint32_t)be64_to_cpu(content->size);
-	fseeko(f_wad, content_addr, SEEK_SET);
-	for (; data_sz >= READ_BUFFER_SIZE; data_sz -= READ_BUFFER_SIZE) {
-		errno = 0;
-		size = fread(buf, 1, READ_BUFFER_SIZE, f_wad);
-		if (size != READ_BUFFER_SIZE) {
-			ret = errno;
-			if (ret == 0) {
-				ret = -EIO;
-			}
-			goto end;
-		}
-
-		// Decrypt the data.
-		aesw_decrypt(aesw, buf, READ_BUFFER_SIZE);
-
-		// Update the SHA-1.
-		sha1_update(&sha1, READ_BUFFER_SIZE, buf);
-	}
-
-	// Remaining data.
-	if (data_sz > 0) {
-		// NOTE: AES works on 16-byte blocks, so we have to
-		// read and decrypt the full 16-byte block. The SHA-1
-		// is only taken for the actual used data, though.
-		uint32_t data_sz_align = ALIGN_BYTES(16, data_sz);
-
-		errno = 0;
-		size = fread(buf, 1, data_sz_align, f_wad);
-		if (size != data_sz_align) {
-			ret = errno;
-			if (ret == 0) {
-				ret = -EIO;
-			}
-			goto end;
-		}
-
-		// Decrypt the data.
-		aesw_decrypt(aesw, buf, data_sz_align);
-
-		// Update the SHA-1.
-		// NOTE: Only uses the actual content, not the
-		// aligned data required for decryption.
-		sha1_update(&sha1, data_sz, buf);
-	}
-
-	// Finalize the SHA-1 and compare it.
-	sha1_digest(&sha1, sizeof(digest), digest);
 	_fputts(_T("- Expected SHA-1: "), stdout);
-	for (size = 0; size < sizeof(content->sha1_hash); size++) {
-		_tprintf(_T("%02x"), content->sha1_hash[size]);
+	for (i = 0; i < SHA1_DIGEST_SIZE; i++) {
+		_tprintf(_T("%02x"), expected[i]);
 	}
 	_fputtc(_T('\n'), stdout);
 	_fputts(_T("- Actual SHA-1:   "), stdout);
-	for (size = 0; size < sizeof(digest); size++) {
-		_tprintf(_T("%02x"), digest[size]);
+	for (i = 0; i < SHA1_DIGEST_SIZE; i++) {
+		_tprintf(_T("%02x"), actual[i]);
 	}
-	if (!memcmp(digest, content->sha1_hash, SHA1_DIGEST_SIZE)) {
+	if (!memcmp(expected, actual, SHA1_DIGEST_SIZE)) {
 		_fputts(_T(" [OK]\n"), stdout);
 	} else {
 		_fputts(_T(" [ERROR]\n"), stdout);
-		ret = 1;
 	}
-
-end:
-	free(buf);
-	aesw_free(aesw);
-	return ret;
 }
 
 /**
@@ -263,8 +150,14 @@ int print_wad_info_FILE(FILE *f_wad, const TCHAR *wad_filename, bool verify)
 	WAD_Header header;
 	WAD_Info_t wadInfo;
 
-	uint8_t *ticket_u8 = NULL;
-	uint8_t *tmd_u8 = NULL;
+	// Memory-mapped WAD file.
+	// If the file can't be mapped, the ticket and TMD are
+	// read into allocated buffers instead.
+	WAD_View_t view;
+	const uint8_t *ticket_u8 = NULL;
+	const uint8_t *tmd_u8 = NULL;
+	uint8_t *ticket_buf = NULL;
+	uint8_t *tmd_buf = NULL;
 	const RVL_Ticket *ticket = NULL;
 	const RVL_TMD_Header *tmdHeader = NULL;
 	uint16_t title_version;
@@ -289,10 +182,21 @@ int print_wad_info_FILE(FILE *f_wad, const TCHAR *wad_filename, bool verify)
 	uint16_t boot_index;
 	const RVL_Content_Entry *content;
 	uint32_t content_addr, data_size_actual;
+	WAD_Content_Verify_t *vjobs = NULL;
+	unsigned int i;
+
+	// Map the WAD file, so the header, ticket, and TMD
+	// can be accessed without seeking and reading.
+	wad_view_map(f_wad, &view);
 
 	// Read the WAD header.
-	rewind(f_wad);
-	size = fread(&header, 1, sizeof(header), f_wad);
+	if (wad_view_get(&view, 0, sizeof(header))) {
+		memcpy(&header, view.data, sizeof(header));
+		size = sizeof(header);
+	} else {
+		rewind(f_wad);
+		size = fread(&header, 1, sizeof(header), f_wad);
+	}
 	if (size != sizeof(header)) {
 		int err = errno;
 		_ftprintf(stderr, _T("*** ERROR reading WAD file '%s': %s\n"),
@@ -349,15 +253,23 @@ int print_wad_info_FILE(FILE *f_wad, const TCHAR *wad_filename, bool verify)
 	}
 
 	// Load the ticket and TMD.
-	ticket_u8 = malloc(wadInfo.ticket_size);
+	// If the file is mapped, they're accessed directly.
+	ticket_u8 = wad_view_get(&view, wadInfo.ticket_address, wadInfo.ticket_size);
+	if (!ticket_u8) {
+		ticket_u8 = ticket_buf = malloc(wadInfo.ticket_size);
+	}
 	if (!ticket_u8) {
 		_ftprintf(stderr, _T("*** ERROR: Unable to allocate %u bytes for the ticket.\n"),
 			wadInfo.ticket_size);
 		ret = 7;
 		goto end;
 	}
-	fseeko(f_wad, wadInfo.ticket_address, SEEK_SET);
-	size = fread(ticket_u8, 1, wadInfo.ticket_size, f_wad);
+	if (ticket_buf) {
+		fseeko(f_wad, wadInfo.ticket_address, SEEK_SET);
+		size = fread(ticket_buf, 1, wadInfo.ticket_size, f_wad);
+	} else {
+		size = wadInfo.ticket_size;
+	}
 	if (size != wadInfo.ticket_size) {
 		// Read error.
 		_ftprintf(stderr, _T("*** ERROR: WAD file '%s': Unable to read the ticket.\n"),
@@ -367,15 +279,22 @@ int print_wad_info_FILE(FILE *f_wad, const TCHAR *wad_filename, bool verify)
 	}
 	ticket = (const RVL_Ticket*)ticket_u8;
 
-	tmd_u8 = malloc(wadInfo.tmd_size);
+	tmd_u8 = wad_view_get(&view, wadInfo.tmd_address, wadInfo.tmd_size);
+	if (!tmd_u8) {
+		tmd_u8 = tmd_buf = malloc(wadInfo.tmd_size);
+	}
 	if (!tmd_u8) {
 		_ftprintf(stderr, _T("*** ERROR: Unable to allocate %u bytes for the TMD.\n"),
 			wadInfo.tmd_size);
 		ret = 9;
 		goto end;
 	}
-	fseeko(f_wad, wadInfo.tmd_address, SEEK_SET);
-	size = fread(tmd_u8, 1, wadInfo.tmd_size, f_wad);
+	if (tmd_buf) {
+		fseeko(f_wad, wadInfo.tmd_address, SEEK_SET);
+		size = fread(tmd_buf, 1, wadInfo.tmd_size, f_wad);
+	} else {
+		size = wadInfo.tmd_size;
+	}
 	if (size != wadInfo.tmd_size) {
 		// Read error.
 		_ftprintf(stderr, _T("*** ERROR: WAD file '%s': Unable to read the TMD.\n"),
@@ -519,10 +438,38 @@ int print_wad_info_FILE(FILE *f_wad, const TCHAR *wad_filename, bool verify)
 		nbr_cont = nbr_cont_actual;
 	}
 
+	if (verify && nbr_cont > 0) {
+		// Verify all of the contents first.
+		// This is done in parallel, so the results are
+		// printed afterwards in the original order.
+		vjobs = calloc(nbr_cont, sizeof(*vjobs));
+		if (!vjobs) {
+			_ftprintf(stderr, _T("*** ERROR: Unable to allocate memory for content verification.\n"));
+			ret = -ENOMEM;
+			goto end;
+		}
+
+		// Contents are aligned to 64 bytes in WADs.
+		// If BWF, only align to 16 bytes (AES block size).
+		content_addr = wadInfo.data_address;
+		for (i = 0; i < nbr_cont; i++) {
+			vjobs[i].content = &content[i];
+			vjobs[i].content_addr = content_addr;
+			content_addr += (uint32_t)be64_to_cpu(content[i].size);
+			content_addr = ALIGN_BYTES((likely(!isBWF) ? 64 : 16), content_addr);
+		}
+
+		ret = verify_wad_contents(f_wad, &view, ticket, encKey, vjobs, nbr_cont, 0);
+		if (ret != 0) {
+			_ftprintf(stderr, _T("*** ERROR verifying contents: %s\n"), _tcserror(-ret));
+			goto end;
+		}
+	}
+
 	content_addr = wadInfo.data_address;
 	data_size_actual = 0;
 	ret = 0;
-	for (; nbr_cont > 0; nbr_cont--, content++) {
+	for (i = 0; nbr_cont > 0; nbr_cont--, content++, i++) {
 		// TODO: Show the actual table index, or just the
 		// index field in the entry?
 		const uint32_t content_size = (uint32_t)be64_to_cpu(content->size);
@@ -537,28 +484,23 @@ int print_wad_info_FILE(FILE *f_wad, const TCHAR *wad_filename, bool verify)
 		}
 		_fputtc(_T('\n'), stdout);
 
-		if (verify) {
-			// Verify the content.
-			// TODO: Only decrypt the title key once?
-			int vret = verify_content(f_wad, encKey, ticket, content, content_addr);
-			if (vret < 0) {
+		if (vjobs) {
+			// Print the verification result.
+			const WAD_Content_Verify_t *const vjob = &vjobs[i];
+			if (vjob->result < 0) {
 				// Read error.
 				_ftprintf(stderr, _T("*** ERROR reading content #%d: %s\n"),
-					content_index, _tcserror(-vret));
+					content_index, _tcserror(-vjob->result));
 				ret = 1;
-			} else if (vret > 0) {
-				if (ret == 0 && encKey == vWii_KEY_RETAIL) {
-					// Check if this might be valid with the retail common key.
-					vret = verify_content(f_wad, RVL_KEY_RETAIL, ticket, content, content_addr);
-					if (vret < 0) {
-						// Read error.
-						_ftprintf(stderr, _T("*** ERROR reading content #%d: %s\n"),
-							content_index, _tcserror(-vret));
-					} else if (vret == 0) {
+			} else {
+				print_sha1_result(content->sha1_hash, vjob->digest);
+				if (vjob->result > 0) {
+					if (ret == 0 && vjob->retail_ok) {
+						// This is valid with the retail common key.
 						vWii_crypt_error = true;
 					}
+					ret = 1;
 				}
-				ret = 1;
 			}
 		}
 
@@ -609,8 +551,10 @@ int print_wad_info_FILE(FILE *f_wad, const TCHAR *wad_filename, bool verify)
 	}
 
 end:
-	free(ticket_u8);
-	free(tmd_u8);
+	free(vjobs);
+	free(ticket_buf);
+	free(tmd_buf);
+	wad_view_unmap(&view);
 	return ret;
 }
 
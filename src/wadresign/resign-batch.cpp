@@ -0,0 +1,407 @@
+/***************************************************************************
+ * RVT-H Tool: WAD Resigner                                                *
+ * resign-batch.cpp: Re-sign multiple WAD files in parallel.               *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "resign-batch.hpp"
+#include "resign-wad.hpp"
+
+// libwiicrypto
+#include "libwiicrypto/common.h"
+
+// C includes
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#  include <windows.h>
+#else /* !_WIN32 */
+#  include <dirent.h>
+#endif /* _WIN32 */
+
+// C++ includes
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+using std::tstring;
+using std::vector;
+
+#ifdef _WIN32
+#  define DIR_SEP_CHR _T('\\')
+#else /* !_WIN32 */
+#  define DIR_SEP_CHR _T('/')
+#endif /* _WIN32 */
+
+/**
+ * A single WAD to resign.
+ */
+struct ResignJob {
+	tstring src_wad;
+	tstring dest_wad;	// Same as src_wad if resigning in place
+};
+
+/**
+ * Shared state for all worker threads.
+ */
+struct ResignBatchState {
+	const vector<ResignJob> *jobs;
+	int recrypt_key;
+	int output_format;
+	bool in_place;
+
+	std::atomic<size_t> next_job;	// Index of the next job to start
+
+	// Status output.
+	// Status lines are printed while holding this lock,
+	// so lines for different WADs aren't interleaved.
+	std::mutex output_lock;
+	unsigned int done;	// Number of jobs finished
+	unsigned int failed;	// Number of jobs that failed
+};
+
+/**
+ * Check if a path is a directory.
+ * @param path Path
+ * @return True if it's a directory; false if not.
+ */
+static bool is_directory(const TCHAR *path)
+{
+#ifdef _WIN32
+	struct _stati64 sbuf;
+	if (::_tstati64(path, &sbuf) != 0)
+		return false;
+	return !!(sbuf.st_mode & _S_IFDIR);
+#else /* !_WIN32 */
+	struct stat sbuf;
+	if (stat(path, &sbuf) != 0)
+		return false;
+	return S_ISDIR(sbuf.st_mode);
+#endif /* _WIN32 */
+}
+
+/**
+ * Check if a filename has a WAD file extension. (.wad, .bwf)
+ * @param filename Filename
+ * @return True if it does; false if not.
+ */
+static bool has_wad_extension(const tstring &filename)
+{
+	const size_t dot_pos = filename.rfind(_T('.'));
+	if (dot_pos == tstring::npos)
+		return false;
+	const TCHAR *const ext = filename.c_str() + dot_pos;
+	return (!_tcsicmp(ext, _T(".wad")) || !_tcsicmp(ext, _T(".bwf")));
+}
+
+/**
+ * Add all WAD files in a directory to a list.
+ * Subdirectories are not searched.
+ * @param dir	[in] Directory
+ * @param files	[out] List of WAD filenames, sorted
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int list_wad_directory(const tstring &dir, vector<tstring> &files)
+{
+	tstring prefix(dir);
+	if (!prefix.empty() && prefix[prefix.size()-1] != DIR_SEP_CHR
+#ifdef _WIN32
+	    && prefix[prefix.size()-1] != _T('/')
+#endif /* _WIN32 */
+	    )
+	{
+		prefix += DIR_SEP_CHR;
+	}
+
+	vector<tstring> found;
+#ifdef _WIN32
+	WIN32_FIND_DATA ffd;
+	HANDLE hFind = FindFirstFile((prefix + _T('*')).c_str(), &ffd);
+	if (hFind == INVALID_HANDLE_VALUE) {
+		return -ENOENT;
+	}
+	do {
+		if (ffd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			continue;
+		tstring filename(ffd.cFileName);
+		if (has_wad_extension(filename)) {
+			found.emplace_back(prefix + filename);
+		}
+	} while (FindNextFile(hFind, &ffd));
+	FindClose(hFind);
+#else /* !_WIN32 */
+	DIR *const pDir = opendir(dir.c_str());
+	if (!pDir) {
+		int err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		return -err;
+	}
+	const struct dirent *d;
+	while ((d = readdir(pDir)) != nullptr) {
+		tstring filename(d->d_name);
+		if (!has_wad_extension(filename))
+			continue;
+		filename = prefix + filename;
+		if (!is_directory(filename.c_str())) {
+			found.emplace_back(std::move(filename));
+		}
+	}
+	closedir(pDir);
+#endif /* _WIN32 */
+
+	std::sort(found.begin(), found.end());
+	files.insert(files.end(), found.begin(), found.end());
+	return 0;
+}
+
+/**
+ * Add all WAD files in a list file to a list.
+ * Blank lines and lines starting with '#' are ignored.
+ * @param list_filename	[in] List file
+ * @param files		[out] List of WAD filenames
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int read_wad_list(const TCHAR *list_filename, vector<tstring> &files)
+{
+	FILE *const f = _tfopen(list_filename, _T("r"));
+	if (!f) {
+		int err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		return -err;
+	}
+
+	TCHAR buf[4096];
+	while (_fgetts(buf, ARRAY_SIZE(buf), f)) {
+		// Trim leading and trailing whitespace, including the newline.
+		tstring line(buf);
+		const size_t first = line.find_first_not_of(_T(" \t\r\n"));
+		if (first == tstring::npos || line[first] == _T('#'))
+			continue;
+		const size_t last = line.find_last_not_of(_T(" \t\r\n"));
+		files.emplace_back(line.substr(first, last - first + 1));
+	}
+	fclose(f);
+	return 0;
+}
+
+/**
+ * Get the destination filename for a WAD.
+ * @param dest_dir	[in] Destination directory
+ * @param src_wad	[in] Source WAD filename
+ * @param output_format	[in] Output format (-1 for default)
+ * @return Destination WAD filename.
+ */
+static tstring get_dest_filename(const TCHAR *dest_dir, const tstring &src_wad, int output_format)
+{
+	// Get the filename portion of the source.
+	size_t slash_pos = src_wad.rfind(DIR_SEP_CHR);
+#ifdef _WIN32
+	const size_t fwd_slash_pos = src_wad.rfind(_T('/'));
+	if (fwd_slash_pos != tstring::npos &&
+	    (slash_pos == tstring::npos || fwd_slash_pos > slash_pos))
+	{
+		slash_pos = fwd_slash_pos;
+	}
+#endif /* _WIN32 */
+	tstring filename = (slash_pos != tstring::npos ? src_wad.substr(slash_pos + 1) : src_wad);
+
+	// Change the extension if the output format was specified.
+	if (output_format != -1) {
+		const size_t dot_pos = filename.rfind(_T('.'));
+		if (dot_pos != tstring::npos) {
+			filename.resize(dot_pos);
+		}
+		filename += (output_format == WAD_Format_BroadOn ? _T(".bwf") : _T(".wad"));
+	}
+
+	tstring dest(dest_dir);
+	if (!dest.empty() && dest[dest.size()-1] != DIR_SEP_CHR) {
+		dest += DIR_SEP_CHR;
+	}
+	dest += filename;
+	return dest;
+}
+
+/**
+ * Worker thread.
+ * @param state Shared state
+ */
+static void resign_thread(ResignBatchState *state)
+{
+	const vector<ResignJob> &jobs = *state->jobs;
+	const unsigned int total = static_cast<unsigned int>(jobs.size());
+
+	while (true) {
+		const size_t idx = state->next_job.fetch_add(1);
+		if (idx >= jobs.size())
+			break;
+		const ResignJob &job = jobs[idx];
+
+		// Errors are captured so they can be printed
+		// along with this WAD's status line.
+		FILE *f_err = tmpfile();
+		const int ret = resign_wad_ex(job.src_wad.c_str(),
+			(state->in_place ? nullptr : job.dest_wad.c_str()),
+			state->recrypt_key, state->output_format, true, (f_err ? f_err : stderr));
+
+		std::lock_guard<std::mutex> lock(state->output_lock);
+		state->done++;
+		if (ret == 0) {
+			_tprintf(_T("[%u/%u] OK: %s\n"), state->done, total, job.src_wad.c_str());
+		} else {
+			state->failed++;
+			if (ret < 0) {
+				_tprintf(_T("[%u/%u] FAILED: %s (%s)\n"), state->done, total,
+					job.src_wad.c_str(), _tcserror(-ret));
+			} else {
+				_tprintf(_T("[%u/%u] FAILED: %s (error %d)\n"), state->done, total,
+					job.src_wad.c_str(), ret);
+			}
+		}
+		fflush(stdout);
+
+		if (f_err) {
+			// Print the captured errors and warnings.
+			TCHAR buf[1024];
+			rewind(f_err);
+			while (_fgetts(buf, ARRAY_SIZE(buf), f_err)) {
+				_fputts(buf, stderr);
+			}
+			fflush(stderr);
+			fclose(f_err);
+		}
+	}
+}
+
+/**
+ * 'resign-batch' command.
+ *
+ * Each source may be one of the following:
+ * - A WAD file.
+ * - A directory. All .wad and .bwf files in the directory are resigned.
+ *   (Subdirectories are not searched.)
+ * - A list file, prefixed with '@'. Each line is a WAD filename.
+ *   Blank lines and lines starting with '#' are ignored.
+ *
+ * Destination WADs are written to dest_dir using the source filenames.
+ * If output_format is specified, the file extension is changed to match.
+ * If dest_dir is NULL, the WADs are resigned in place. (See resign_wad_ex().)
+ *
+ * WADs are resigned in parallel. A status line is printed for each WAD
+ * as it finishes, followed by a summary.
+ *
+ * @param dest_dir	[in] Destination directory. (NULL to resign in place)
+ * @param sources	[in] Sources.
+ * @param source_count	[in] Number of sources.
+ * @param recrypt_key	[in] Key for recryption. (-1 for default)
+ * @param output_format	[in] Output format. (-1 for default)
+ * @param threads	[in] Number of worker threads. (0 for auto)
+ * @return 0 if all WADs were resigned; non-zero on error.
+ */
+int resign_wad_batch(const TCHAR *dest_dir, TCHAR *const *sources, int source_count,
+	int recrypt_key, int output_format, unsigned int threads)
+{
+	const bool in_place = (dest_dir == nullptr);
+	if (!in_place && !is_directory(dest_dir)) {
+		_ftprintf(stderr, _T("*** ERROR: Destination '%s' is not a directory.\n"), dest_dir);
+		return -ENOTDIR;
+	}
+
+	// Expand the sources into a list of WADs.
+	vector<tstring> src_wads;
+	for (int i = 0; i < source_count; i++) {
+		const TCHAR *const source = sources[i];
+		int ret = 0;
+		if (source[0] == _T('@')) {
+			ret = read_wad_list(&source[1], src_wads);
+		} else if (is_directory(source)) {
+			ret = list_wad_directory(source, src_wads);
+		} else {
+			src_wads.emplace_back(source);
+		}
+		if (ret != 0) {
+			_ftprintf(stderr, _T("*** ERROR reading '%s': %s\n"), source, _tcserror(-ret));
+			return ret;
+		}
+	}
+	if (src_wads.empty()) {
+		_fputts(_T("*** ERROR: No WAD files were found.\n"), stderr);
+		return -ENOENT;
+	}
+
+	vector<ResignJob> jobs;
+	jobs.reserve(src_wads.size());
+	for (tstring &src_wad : src_wads) {
+		ResignJob job;
+		job.dest_wad = (in_place ? src_wad : get_dest_filename(dest_dir, src_wad, output_format));
+		job.src_wad = std::move(src_wad);
+		jobs.emplace_back(std::move(job));
+	}
+
+	// Two jobs writing to the same destination would corrupt it.
+	vector<const tstring*> dests;
+	dests.reserve(jobs.size());
+	for (const ResignJob &job : jobs) {
+		dests.push_back(&job.dest_wad);
+	}
+	std::sort(dests.begin(), dests.end(),
+		[](const tstring *a, const tstring *b) { return *a < *b; });
+	for (size_t i = 1; i < dests.size(); i++) {
+		if (*dests[i] == *dests[i-1]) {
+			_ftprintf(stderr, _T("*** ERROR: Multiple WADs would be written to '%s'.\n"),
+				dests[i]->c_str());
+			return -EEXIST;
+		}
+	}
+
+	// Resigning is mostly I/O, so use all CPUs by default.
+	if (threads == 0) {
+		threads = std::thread::hardware_concurrency();
+		if (threads == 0) {
+			threads = 1;
+		}
+	}
+	threads = std::min(threads, static_cast<unsigned int>(jobs.size()));
+
+	_tprintf(_T("Resigning %u WAD(s) using %u thread(s)...\n"),
+		static_cast<unsigned int>(jobs.size()), threads);
+	fflush(stdout);
+
+	ResignBatchState state;
+	state.jobs = &jobs;
+	state.recrypt_key = recrypt_key;
+	state.output_format = output_format;
+	state.in_place = in_place;
+	state.next_job = 0;
+	state.done = 0;
+	state.failed = 0;
+
+	const auto start = std::chrono::steady_clock::now();
+	vector<std::thread> workers;
+	workers.reserve(threads);
+	for (unsigned int i = 0; i < threads; i++) {
+		workers.emplace_back(resign_thread, &state);
+	}
+	for (std::thread &worker : workers) {
+		worker.join();
+	}
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	_tprintf(_T("\n%u/%u WAD(s) resigned, %u failed, in %.1f s.\n"),
+		state.done - state.failed, static_cast<unsigned int>(jobs.size()),
+		state.failed, elapsed.count());
+	return (state.failed == 0 ? 0 : EXIT_FAILURE);
+}
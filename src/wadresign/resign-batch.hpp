@@ -0,0 +1,50 @@
+/***************************************************************************
+ * RVT-H Tool: WAD Resigner                                                *
+ * resign-batch.hpp: Re-sign multiple WAD files in parallel.               *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_WADRESIGN_RESIGN_BATCH_HPP__
+#define __RVTHTOOL_WADRESIGN_RESIGN_BATCH_HPP__
+
+#include "tcharx.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 'resign-batch' command.
+ *
+ * Each source may be one of the following:
+ * - A WAD file.
+ * - A directory. All .wad and .bwf files in the directory are resigned.
+ *   (Subdirectories are not searched.)
+ * - A list file, prefixed with '@'. Each line is a WAD filename.
+ *   Blank lines and lines starting with '#' are ignored.
+ *
+ * Destination WADs are written to dest_dir using the source filenames.
+ * If output_format is specified, the file extension is changed to match.
+ * If dest_dir is NULL, the WADs are resigned in place. (See resign_wad_ex().)
+ *
+ * WADs are resigned in parallel. A status line is printed for each WAD
+ * as it finishes, followed by a summary.
+ *
+ * @param dest_dir	[in] Destination directory. (NULL to resign in place)
+ * @param sources	[in] Sources.
+ * @param source_count	[in] Number of sources.
+ * @param recrypt_key	[in] Key for recryption. (-1 for default)
+ * @param output_format	[in] Output format. (-1 for default)
+ * @param threads	[in] Number of worker threads. (0 for auto)
+ * @return 0 if all WADs were resigned; non-zero on error.
+ */
+int resign_wad_batch(const TCHAR *dest_dir, TCHAR *const *sources, int source_count,
+	int recrypt_key, int output_format, unsigned int threads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_WADRESIGN_RESIGN_BATCH_HPP__ */
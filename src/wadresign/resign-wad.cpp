@@ -18,15 +18,22 @@
 #include "libwiicrypto/sig_tools.h"
 #include "libwiicrypto/wii_wad.h"
 
+#include "config.wadresign.h"
+
 // C includes
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef HAVE_COPY_FILE_RANGE
+#  include <unistd.h>
+#endif /* HAVE_COPY_FILE_RANGE */
 
 // C++ includes
+#include <algorithm>
 #include <memory>
 using std::unique_ptr;
 
@@ -43,6 +50,23 @@ typedef union _rdbuf_t {
 	RVL_Ticket ticket;
 } rdbuf_t;
 
+/**
+ * Print an informational message to stdout.
+ * @param quiet	[in] If true, nothing is printed.
+ * @param fmt	[in] Format string.
+ * @param ...	[in] Arguments.
+ */
+static void info_printf(bool quiet, const TCHAR *fmt, ...)
+{
+	if (quiet)
+		return;
+
+	va_list ap;
+	va_start(ap, fmt);
+	_vtprintf(fmt, ap);
+	va_end(ap);
+}
+
 /**
  * Align the file pointer to the next 64-byte boundary.
  * @param fp File pointer.
@@ -57,14 +81,96 @@ static inline void fpAlign(FILE *fp)
 }
 
 /**
- * 'resign' command.
+ * Copy data from one file to another.
+ * Both files are read or written at their current positions,
+ * and the positions are advanced by the number of bytes copied.
+ *
+ * If copy_file_range() is available, the kernel copies the data
+ * directly, and may share the extents on filesystems that support
+ * reflinks. Otherwise, or if the files don't support it, the data
+ * is copied through buf.
+ *
+ * @param f_src		[in] Source file.
+ * @param f_dest	[in] Destination file.
+ * @param size		[in] Number of bytes to copy.
+ * @param buf		[in] Copy buffer.
+ * @param buf_size	[in] Size of buf.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int copy_file_data(FILE *f_src, FILE *f_dest, uint64_t size, uint8_t *buf, size_t buf_size)
+{
+#ifdef HAVE_COPY_FILE_RANGE
+	// Flush the destination so the file descriptor's contents
+	// match the stream. The source stream's read buffer doesn't
+	// matter, since explicit offsets are used.
+	if (size > 0 && fflush(f_dest) == 0) {
+		loff_t off_in = ftello(f_src);
+		loff_t off_out = ftello(f_dest);
+		int err = 0;
+		while (size > 0) {
+			const size_t len = static_cast<size_t>(std::min<uint64_t>(size, 1024U*1024U*1024U));
+			const ssize_t n = copy_file_range(fileno(f_src), &off_in, fileno(f_dest), &off_out, len, 0);
+			if (n <= 0) {
+				// n == 0 indicates EOF, which means the source is truncated.
+				err = (n == 0 ? EIO : errno);
+				break;
+			}
+			size -= static_cast<uint64_t>(n);
+		}
+
+		// Move the streams past the copied data.
+		fseeko(f_src, off_in, SEEK_SET);
+		fseeko(f_dest, off_out, SEEK_SET);
+		if (size == 0) {
+			return 0;
+		}
+
+		switch (err) {
+			case EXDEV: case ENOSYS: case EINVAL: case EOPNOTSUPP: case EBADF:
+				// copy_file_range() isn't supported for these files.
+				// Copy the rest of the data through the buffer.
+				break;
+			default:
+				return -err;
+		}
+	}
+#endif /* HAVE_COPY_FILE_RANGE */
+
+	while (size > 0) {
+		const size_t len = static_cast<size_t>(std::min<uint64_t>(size, buf_size));
+		errno = 0;
+		if (fread(buf, 1, len, f_src) != len) {
+			const int err = errno;
+			return (err != 0 ? -err : -EIO);
+		}
+		errno = 0;
+		if (fwrite(buf, 1, len, f_dest) != len) {
+			const int err = errno;
+			return (err != 0 ? -err : -EIO);
+		}
+		size -= len;
+	}
+	return 0;
+}
+
+/**
+ * 'resign' command. (extended version)
+ *
+ * If dest_wad is NULL, src_wad is resigned in place: only the header,
+ * certificate chain, ticket, and TMD are rewritten. This requires
+ * a standard WAD, and the certificate chain's aligned size must not
+ * change. (Retail and debug certificate chains have different sizes.)
+ *
  * @param src_wad	[in] Source WAD.
- * @param dest_wad	[in] Destination WAD.
+ * @param dest_wad	[in] Destination WAD. (NULL to resign src_wad in place)
  * @param recrypt_key	[in] Key for recryption. (-1 for default)
  * @param output_format	[in] Output format. (-1 for default)
+ * @param quiet		[in] If true, don't print the WAD information or progress messages.
+ * @param f_err		[in] FILE* to print errors and warnings to.
  * @return 0 on success; negative POSIX error code or positive ID code on error.
  */
-int resign_wad(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int output_format)
+int resign_wad_ex(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int output_format,
+	bool quiet, FILE *f_err)
 {
 	int ret;
 	size_t size;
@@ -73,6 +179,7 @@ int resign_wad(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int
 
 	bool isSrcBwf = false;
 	bool isDestBwf = false;
+	const bool inPlace = (dest_wad == NULL);
 
 	// Data offset:
 	// - 0: Based on 64-byte alignment values. (WAD)
@@ -104,28 +211,34 @@ int resign_wad(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int
 	unsigned int nbr_cont, nbr_cont_actual;
 	const RVL_Content_Entry *content;
 	uint32_t data_size_actual;
+	uint64_t data_copy_size;
 
 	// Read buffer
 	unique_ptr<rdbuf_t> buf(new rdbuf_t);
 
 	// Open the source WAD file.
 	errno = 0;
-	f_src_wad = _tfopen(src_wad, _T("rb"));
+	f_src_wad = _tfopen(src_wad, (inPlace ? _T("r+b") : _T("rb")));
 	if (unlikely(!f_src_wad)) {
 		int err = errno;
 		if (err == 0) {
 			err = EIO;
 		}
-		_ftprintf(stderr, _T("*** ERROR opening source WAD file '%s': %s\n"), src_wad, _tcserror(err));
+		_ftprintf(f_err, _T("*** ERROR opening source WAD file '%s': %s\n"), src_wad, _tcserror(err));
 		return -err;
 	}
 
 	// Print the WAD information.
 	// TODO: Should we verify the SHA-1s?
-	ret = print_wad_info_FILE(f_src_wad, src_wad, false);
-	if (ret != 0) {
-		// Error printing the WAD information.
-		return ret;
+	// NOTE: The WAD header is validated again below,
+	// so this can be skipped in quiet mode.
+	if (!quiet) {
+		ret = print_wad_info_FILE(f_src_wad, src_wad, false);
+		if (ret != 0) {
+			// Error printing the WAD information.
+			fclose(f_src_wad);
+			return ret;
+		}
 	}
 
 	// Re-read the WAD header and parse the addresses.
@@ -137,7 +250,7 @@ int resign_wad(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int
 		if (err == 0) {
 			err = EIO;
 		}
-		_ftprintf(stderr, _T("*** ERROR reading WAD file '%s': %s\n"),
+		_ftprintf(f_err, _T("*** ERROR reading WAD file '%s': %s\n"),
 			src_wad, _tcserror(err));
 		ret = -err;
 		goto end;
@@ -149,7 +262,7 @@ int resign_wad(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int
 	// it's a BroadOn WAD or not.
 	if (identify_wad_type((const uint8_t*)&srcHeader, sizeof(srcHeader), &isSrcBwf) == NULL) {
 		// Unrecognized WAD type.
-		_ftprintf(stderr, _T("*** ERROR: WAD file '%s' is not valid."), src_wad);
+		_ftprintf(f_err, _T("*** ERROR: WAD file '%s' is not valid.\n"), src_wad);
 		ret = 1;
 		goto end;
 	}
@@ -162,36 +275,36 @@ int resign_wad(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int
 	}
 	if (ret != 0) {
 		// Unable to get WAD information.
-		_ftprintf(stderr, _T("*** ERROR: WAD file '%s' is not valid."), src_wad);
+		_ftprintf(f_err, _T("*** ERROR: WAD file '%s' is not valid.\n"), src_wad);
 		ret = 2;
 		goto end;
 	}
 
 	// Verify the various sizes.
 	if (wadInfo.ticket_size < sizeof(RVL_Ticket)) {
-		_ftprintf(stderr, _T("*** ERROR: WAD file '%s' ticket size is too small. (%u; should be %u)\n"),
+		_ftprintf(f_err, _T("*** ERROR: WAD file '%s' ticket size is too small. (%u; should be %u)\n"),
 			src_wad, wadInfo.ticket_size, static_cast<uint32_t>(sizeof(RVL_Ticket)));
 		ret = 3;
 		goto end;
 	} else if (wadInfo.ticket_size > WAD_TICKET_SIZE_MAX) {
-		_ftprintf(stderr, _T("*** ERROR: WAD file '%s' ticket size is too big. (%u; should be %u)\n"),
+		_ftprintf(f_err, _T("*** ERROR: WAD file '%s' ticket size is too big. (%u; should be %u)\n"),
 			src_wad, wadInfo.ticket_size, static_cast<uint32_t>(sizeof(RVL_Ticket)));
 		ret = 4;
 		goto end;
 	} else if (wadInfo.tmd_size < sizeof(RVL_TMD_Header)) {
-		_ftprintf(stderr, _T("*** ERROR: WAD file '%s' TMD size is too small. (%u; should be at least %u)\n"),
+		_ftprintf(f_err, _T("*** ERROR: WAD file '%s' TMD size is too small. (%u; should be at least %u)\n"),
 			src_wad, wadInfo.tmd_size, static_cast<uint32_t>(sizeof(RVL_TMD_Header)));
 		ret = 5;
 		goto end;
 	} else if (wadInfo.tmd_size > WAD_TMD_SIZE_MAX) {
 		// Too big.
-		_ftprintf(stderr, _T("*** ERROR: WAD file '%s' TMD size is too big. (%u; should be less than 1 MiB)\n"),
+		_ftprintf(f_err, _T("*** ERROR: WAD file '%s' TMD size is too big. (%u; should be less than 1 MiB)\n"),
 			src_wad, wadInfo.tmd_size);
 		ret = 6;
 		goto end;
 	} else if (wadInfo.meta_size > WAD_META_SIZE_MAX) {
 		// Too big.
-		_ftprintf(stderr, _T("*** ERROR: WAD file '%s' ' metadata size is too big. (%u; should be less than 1 MB)\n"),
+		_ftprintf(f_err, _T("*** ERROR: WAD file '%s' ' metadata size is too big. (%u; should be less than 1 MB)\n"),
 			src_wad, wadInfo.meta_size);
 		ret = 7;
 		goto end;
@@ -205,7 +318,7 @@ int resign_wad(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int
 		// Data size is the rest of the file.
 		if (src_file_size < wadInfo.data_address) {
 			// Not valid...
-			_ftprintf(stderr, _T("*** ERROR: WAD file '%s' data size is invalid.\n"), src_wad);
+			_ftprintf(f_err, _T("*** ERROR: WAD file '%s' data size is invalid.\n"), src_wad);
 			ret = 8;
 			goto end;
 		}
@@ -214,12 +327,12 @@ int resign_wad(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int
 		// Verify the data size.
 		if (src_file_size < wadInfo.data_address) {
 			// File is too small.
-			_ftprintf(stderr, _T("*** ERROR: WAD file '%s' data address is invalid.\n"), src_wad);
+			_ftprintf(f_err, _T("*** ERROR: WAD file '%s' data address is invalid.\n"), src_wad);
 			ret = 9;
 			goto end;
 		} else if (src_file_size - wadInfo.data_address < wadInfo.data_size) {
 			// Data size is too small.
-			_ftprintf(stderr, _T("*** ERROR: WAD file '%s' data size is invalid.\n"), src_wad);
+			_ftprintf(f_err, _T("*** ERROR: WAD file '%s' data size is invalid.\n"), src_wad);
 			ret = 10;
 			goto end;
 		}
@@ -229,7 +342,7 @@ int resign_wad(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int
 
 	if (wadInfo.data_size > WAD_DATA_SIZE_MAX) {
 		// Maximum of 256 MB.
-		_ftprintf(stderr, _T("*** ERROR: WAD file '%s' data size is too big. (%u; should be less than 128 MiB)\n"),
+		_ftprintf(f_err, _T("*** ERROR: WAD file '%s' data size is too big. (%u; should be less than 128 MiB)\n"),
 			src_wad, wadInfo.data_size);
 		ret = 11;
 		goto end;
@@ -240,7 +353,7 @@ int resign_wad(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int
 	size = fread(buf->u8, 1, wadInfo.ticket_size, f_src_wad);
 	if (size != wadInfo.ticket_size) {
 		// Read error.
-		_ftprintf(stderr, _T("*** ERROR: WAD file '%s': Unable to read the ticket.\n"), src_wad);
+		_ftprintf(f_err, _T("*** ERROR: WAD file '%s': Unable to read the ticket.\n"), src_wad);
 		ret = 13;
 		goto end;
 	}
@@ -283,7 +396,7 @@ int resign_wad(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int
 			s_fromKey = _T("debug");
 			break;
 		default:
-			_ftprintf(stderr, _T("*** ERROR: WAD file '%s': Unknown issuer.\n"), src_wad);
+			_ftprintf(f_err, _T("*** ERROR: WAD file '%s': Unknown issuer.\n"), src_wad);
 			ret = 14;
 			goto end;
 	}
@@ -305,7 +418,7 @@ int resign_wad(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int
 			default:
 				// Should not happen...
 				assert(!"src_key: Invalid cryptoType.");
-				_fputts(_T("*** ERROR: Unable to select encryption key.\n"), stderr);
+				_fputts(_T("*** ERROR: Unable to select encryption key.\n"), f_err);
 				ret = 15;
 				goto end;
 		}
@@ -328,11 +441,21 @@ int resign_wad(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int
 		isDestBwf = false;
 	}
 
+	if (inPlace && (isSrcBwf || isDestBwf)) {
+		// BroadOn WADs have an explicit data offset, and the
+		// metadata isn't copied correctly yet.
+		_ftprintf(f_err, _T("*** ERROR: WAD file '%s': In-place resigning is only supported for standard WADs.\n"),
+			src_wad);
+		ret = 18;
+		goto end;
+	}
+
 	if (static_cast<RVL_CryptoType_e>(recrypt_key) == src_key) {
-		// Allow the same key only if converting to a different format.
-		if (isSrcBwf == isDestBwf) {
+		// Allow the same key only if converting to a different format,
+		// or if resigning in place. (This updates the signatures.)
+		if (isSrcBwf == isDestBwf && !inPlace) {
 			// No point in recrypting to the same key and format...
-			_fputts(_T("*** ERROR: Cannot recrypt to the same key and format.\n"), stderr);
+			_fputts(_T("*** ERROR: Cannot recrypt to the same key and format.\n"), f_err);
 			ret = 16;
 			goto end;
 		}
@@ -362,26 +485,27 @@ int resign_wad(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int
 			// Invalid key index.
 			// This should not happen...
 			assert(!"recrypt_key: Invalid key index.");
-			_fputts(_T("*** ERROR: Invalid recrypt_key value.\n"), stderr);
+			_fputts(_T("*** ERROR: Invalid recrypt_key value.\n"), f_err);
 			ret = 17;
 			goto end;
 	}
 
-	_fputtc(_T('\n'), stdout);
-	_tprintf(_T("Converting from %s to %s [%s->%s]...\n"),
+	info_printf(quiet, _T("\n"));
+	info_printf(quiet, _T("Converting from %s to %s [%s->%s]...\n"),
 		s_fromKey, s_toKey,
 		isSrcBwf  ? _T("bwf") : _T("wad"),
 		isDestBwf ? _T("bwf") : _T("wad"));
 
 	// Open the destination WAD file.
+	// If resigning in place, the source WAD file is used.
 	errno = 0;
-	f_dest_wad = _tfopen(dest_wad, _T("wb"));
+	f_dest_wad = (inPlace ? f_src_wad : _tfopen(dest_wad, _T("wb")));
 	if (!f_dest_wad) {
 		int err = errno;
 		if (err == 0) {
 			err = EIO;
 		}
-		_ftprintf(stderr, _T("*** ERROR opening destination WAD file '%s' for write: %s\n"),
+		_ftprintf(f_err, _T("*** ERROR opening destination WAD file '%s' for write: %s\n"),
 			dest_wad, _tcserror(err));
 		ret = -err;
 		goto end;
@@ -410,6 +534,14 @@ int resign_wad(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int
 		cert_chain_size	= static_cast<uint32_t>(sizeof(*cert_CA) + sizeof(*cert_TMD) + sizeof(*cert_ticket) + sizeof(*cert_ms));
 	}
 
+	if (inPlace && ALIGN_BYTES(64, cert_chain_size) != ALIGN_BYTES(64, wadInfo.cert_chain_size)) {
+		// The ticket, TMD, and contents would have to be moved.
+		_ftprintf(f_err, _T("*** ERROR: WAD file '%s': Cannot resign in place, since the certificate chain size would change. (0x%X -> 0x%X)\n"),
+			src_wad, wadInfo.cert_chain_size, cert_chain_size);
+		ret = 19;
+		goto end;
+	}
+
 	// Determine the data offset.
 	if (isDestBwf) {
 		// TODO: Add meta.
@@ -427,7 +559,7 @@ int resign_wad(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int
 	if (isSrcBwf) {
 		if (!isDestBwf) {
 			// bwf->wad
-			_tprintf(_T("Converting the BroadOn WAD header to standard WAD format...\n"));
+			info_printf(quiet, _T("Converting the BroadOn WAD header to standard WAD format...\n"));
 			data_offset = 0;
 
 			// Type is 'Is' for most WADs, 'ib' for boot2.
@@ -461,7 +593,7 @@ int resign_wad(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int
 	} else /*if (!isSrcBwf)*/ {
 		if (isDestBwf) {
 			// wad->bwf
-			_tprintf(_T("Converting the standard WAD header to BroadOn WAD format...\n"));
+			info_printf(quiet, _T("Converting the standard WAD header to BroadOn WAD format...\n"));
 
 			outHeader.bwf.header_size = cpu_to_be32(sizeof(outHeader));
 			outHeader.bwf.data_offset = cpu_to_be32(data_offset);
@@ -481,25 +613,27 @@ int resign_wad(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int
 	}
 
 	// Write the initial header. It will be rewritten later.
-	size = fwrite(&outHeader, 1, sizeof(outHeader), f_dest_wad);
-	if (size != sizeof(outHeader)) {
+	// If resigning in place, only the final header is written.
+	if (inPlace) {
+		fseeko(f_dest_wad, wadInfo.cert_chain_address, SEEK_SET);
+	} else if (fwrite(&outHeader, 1, sizeof(outHeader), f_dest_wad) != sizeof(outHeader)) {
 		int err = errno;
 		if (err == 0) {
 			err = EIO;
 		}
-		_ftprintf(stderr, _T("*** ERROR writing initial destination WAD header: %s\n"),
+		_ftprintf(f_err, _T("*** ERROR writing initial destination WAD header: %s\n"),
 			_tcserror(err));
 		ret = -err;
 		goto end;
 	}
 
-	if (!isDestBwf) {
+	if (!isDestBwf && !inPlace) {
 		// 64-byte alignment. (WAD only)
 		fpAlign(f_dest_wad);
 	}
 
 	// Write the certificates.
-	_tprintf(_T("Writing certificate chain...\n"));
+	info_printf(quiet, _T("Writing certificate chain...\n"));
 	errno = 0;
 	size = fwrite(cert_CA, 1, sizeof(*cert_CA), f_dest_wad);
 	if (size != sizeof(*cert_CA)) {
@@ -507,7 +641,7 @@ int resign_wad(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int
 		if (err == 0) {
 			err = EIO;
 		}
-		_ftprintf(stderr, _T("*** ERROR writing destination WAD certificate chain: %s\n"),
+		_ftprintf(f_err, _T("*** ERROR writing destination WAD certificate chain: %s\n"),
 			_tcserror(err));
 		ret = -err;
 		goto end;
@@ -519,7 +653,7 @@ int resign_wad(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int
 		if (err == 0) {
 			err = EIO;
 		}
-		_ftprintf(stderr, _T("*** ERROR writing destination WAD certificate chain: %s\n"),
+		_ftprintf(f_err, _T("*** ERROR writing destination WAD certificate chain: %s\n"),
 			_tcserror(err));
 		ret = -err;
 		goto end;
@@ -531,7 +665,7 @@ int resign_wad(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int
 		if (err == 0) {
 			err = EIO;
 		}
-		_ftprintf(stderr, _T("*** ERROR writing destination WAD certificate chain: %s\n"),
+		_ftprintf(f_err, _T("*** ERROR writing destination WAD certificate chain: %s\n"),
 			_tcserror(err));
 		ret = -err;
 		goto end;
@@ -544,14 +678,31 @@ int resign_wad(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int
 			if (err == 0) {
 				err = EIO;
 			}
-			_ftprintf(stderr, _T("*** ERROR writing destination WAD certificate chain: %s\n"),
+			_ftprintf(f_err, _T("*** ERROR writing destination WAD certificate chain: %s\n"),
 				_tcserror(err));
 			ret = -err;
 			goto end;
 		}
 	}
 
-	if (!isDestBwf) {
+	if (inPlace) {
+		// Clear the padding, in case the old certificate chain was larger.
+		static const uint8_t zero_padding[64] = {0};
+		const size_t count = ALIGN_BYTES(64, cert_chain_size) - cert_chain_size;
+		if (count > 0 && fwrite(zero_padding, 1, count, f_dest_wad) != count) {
+			int err = errno;
+			if (err == 0) {
+				err = EIO;
+			}
+			_ftprintf(f_err, _T("*** ERROR writing destination WAD certificate chain: %s\n"),
+				_tcserror(err));
+			ret = -err;
+			goto end;
+		}
+
+		// The ticket follows the CRL, if present.
+		fseeko(f_dest_wad, wadInfo.ticket_address, SEEK_SET);
+	} else if (!isDestBwf) {
 		// 64-byte alignment. (WAD only)
 		fpAlign(f_dest_wad);
 	}
@@ -561,7 +712,7 @@ int resign_wad(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int
 	assert(wadInfo.crl_size == 0);
 
 	// Recrypt the ticket and TMD.
-	_tprintf(_T("Recrypting the ticket and TMD...\n"));
+	info_printf(quiet, _T("Recrypting the ticket and TMD...\n"));
 
 	// Ticket is already loaded, so recrypt and resign it.
 	errno = 0;
@@ -572,7 +723,7 @@ int resign_wad(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int
 		if (err == 0) {
 			err = EIO;
 		}
-		_ftprintf(stderr, _T("*** ERROR recrypting the ticket: %s\n"), _tcserror(err));
+		_ftprintf(f_err, _T("*** ERROR recrypting the ticket: %s\n"), _tcserror(err));
 		ret = -err;
 		goto end;
 	}
@@ -596,7 +747,7 @@ int resign_wad(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int
 		if (err == 0) {
 			err = EIO;
 		}
-		_ftprintf(stderr, _T("*** ERROR writing destination WAD ticket: %s\n"), _tcserror(err));
+		_ftprintf(f_err, _T("*** ERROR writing destination WAD ticket: %s\n"), _tcserror(err));
 		ret = -err;
 		goto end;
 	}
@@ -616,7 +767,7 @@ int resign_wad(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int
 		if (err == 0) {
 			err = EIO;
 		}
-		_ftprintf(stderr, _T("*** ERROR reading source WAD TMD: %s\n"), _tcserror(err));
+		_ftprintf(f_err, _T("*** ERROR reading source WAD TMD: %s\n"), _tcserror(err));
 		ret = -err;
 		goto end;
 	}
@@ -650,6 +801,10 @@ int resign_wad(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int
 	}
 
 	// Write the TMD.
+	if (inPlace) {
+		// Switching from reading to writing requires a seek.
+		fseeko(f_dest_wad, wadInfo.tmd_address, SEEK_SET);
+	}
 	errno = 0;
 	size = fwrite(tmd_buf.get(), 1, wadInfo.tmd_size, f_dest_wad);
 	if (size != wadInfo.tmd_size) {
@@ -657,7 +812,7 @@ int resign_wad(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int
 		if (err == 0) {
 			err = EIO;
 		}
-		_ftprintf(stderr, _T("*** ERROR writing destination WAD TMD: %s\n"), _tcserror(err));
+		_ftprintf(f_err, _T("*** ERROR writing destination WAD TMD: %s\n"), _tcserror(err));
 		ret = -err;
 		goto end;
 	}
@@ -675,24 +830,35 @@ int resign_wad(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int
 			if (err == 0) {
 				err = EIO;
 			}
-			_ftprintf(stderr, _T("*** ERROR seeking in destination WAD: %s\n"), _tcserror(err));
+			_ftprintf(f_err, _T("*** ERROR seeking in destination WAD: %s\n"), _tcserror(err));
 			ret = -err;
 			goto end;
 		}
 	}
 
-	// Copy each content, one megabyte at a time.
+	// Copy the contents.
+	// NOTE: Contents are encrypted with the title key, which is the same
+	// regardless of the common key, so only the title key in the ticket
+	// needs to be recrypted. The contents are copied as-is, and the
+	// content SHA-1s in the TMD (which are calculated over the
+	// decrypted contents) don't change, so there's no per-content
+	// AES or hashing to do when changing the key class.
+	// The contents are contiguous in both the source and the destination,
+	// so they're copied in a single operation after calculating the size.
+	// If resigning in place, the contents aren't touched at all.
 	// TODO: Show progress? (WADs are small enough that this probably isn't needed...)
-	// TODO: Check for errors.
 	fseeko(f_src_wad, wadInfo.data_address, SEEK_SET);
 	data_size_actual = 0;
+	data_copy_size = 0;
 	for (; nbr_cont > 0; nbr_cont--, content++) {
 		// TODO: Show the actual table index, or just the
 		// index field in the entry?
 		const uint32_t content_size = static_cast<uint32_t>(be64_to_cpu(content->size));
 		uint32_t size_to_copy = ALIGN_BYTES(16, content_size);
 		uint16_t content_index = be16_to_cpu(content->index);
-		_tprintf(_T("Copying WAD content #%d...\n"), content_index);
+		if (!inPlace) {
+			info_printf(quiet, _T("Copying WAD content #%d...\n"), content_index);
+		}
 
 		// Contents are always physically AES-aligned (16 bytes), but the
 		// data size in the header does not include extra bytes at the end
@@ -715,68 +881,21 @@ int resign_wad(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int
 			}
 		}
 
-		for (; size_to_copy >= sizeof(buf->u8); size_to_copy -= sizeof(buf->u8)) {
-			errno = 0;
-			size = fread(buf->u8, 1, sizeof(buf->u8), f_src_wad);
-			if (size != sizeof(buf->u8)) {
-				int err = errno;
-				if (err == 0) {
-					err = EIO;
-				}
-				_ftprintf(stderr, _T("*** ERROR reading source WAD data: %s\n"),
-					_tcserror(err));
-				ret = -err;
-				goto end;
-			}
-
-			errno = 0;
-			size = fwrite(buf->u8, 1, sizeof(buf->u8), f_dest_wad);
-			if (size != sizeof(buf->u8)) {
-				int err = errno;
-				if (err == 0) {
-					err = EIO;
-				}
-				_ftprintf(stderr, _T("*** ERROR writing destination WAD data: %s\n"),
-					_tcserror(err));
-				ret = -err;
-				goto end;
-			}
-		}
-
-		// Remaining data.
-		if (size_to_copy > 0) {
-			errno = 0;
-			size = fread(buf->u8, 1, size_to_copy, f_src_wad);
-			if (size != size_to_copy) {
-				int err = errno;
-				if (err == 0) {
-					err = EIO;
-				}
-				_ftprintf(stderr, _T("*** ERROR reading source WAD data: %s\n"),
-					_tcserror(err));
-				ret = -err;
-				goto end;
-			}
+		data_copy_size += size_to_copy;
+	}
 
-			errno = 0;
-			size = fwrite(buf->u8, 1, size_to_copy, f_dest_wad);
-			if (size != size_to_copy) {
-				int err = errno;
-				if (err == 0) {
-					err = EIO;
-				}
-				_ftprintf(stderr, _T("*** ERROR writing destination WAD data: %s\n"),
-					_tcserror(err));
-				ret = -err;
-				goto end;
-			}
+	if (!inPlace) {
+		ret = copy_file_data(f_src_wad, f_dest_wad, data_copy_size, buf->u8, sizeof(buf->u8));
+		if (ret != 0) {
+			_ftprintf(f_err, _T("*** ERROR copying WAD contents: %s\n"), _tcserror(-ret));
+			goto end;
 		}
 	}
 
 	// Copy the metadata.
 	// FIXME: Copy before the data if the output format is BWF.
-	if (wadInfo.meta_size != 0) {
-		_tprintf(_T("Copying the WAD metadata...\n"));
+	if (wadInfo.meta_size != 0 && !inPlace) {
+		info_printf(quiet, _T("Copying the WAD metadata...\n"));
 
 		fseeko(f_src_wad, wadInfo.meta_address, SEEK_SET);
 		errno = 0;
@@ -786,7 +905,7 @@ int resign_wad(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int
 			if (err == 0) {
 				err = EIO;
 			}
-			_ftprintf(stderr, _T("*** ERROR reading source WAD metadata: %s\n"),
+			_ftprintf(f_err, _T("*** ERROR reading source WAD metadata: %s\n"),
 				_tcserror(err));
 			ret = -err;
 			goto end;
@@ -804,7 +923,7 @@ int resign_wad(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int
 			if (err == 0) {
 				err = EIO;
 			}
-			_ftprintf(stderr, _T("*** ERROR writing destination WAD metadata: %s\n"),
+			_ftprintf(f_err, _T("*** ERROR writing destination WAD metadata: %s\n"),
 				_tcserror(err));
 			ret = -err;
 			goto end;
@@ -815,7 +934,7 @@ int resign_wad(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int
 	// It seems Nintendo never used the CRL feature...
 	assert(wadInfo.crl_size == 0);
 
-	if (!isDestBwf) {
+	if (!isDestBwf && !inPlace) {
 		// Make sure the file a multiple of 64 bytes. (WAD only)
 		offset = ftello(f_dest_wad);
 		if (offset % 64 != 0) {
@@ -831,7 +950,7 @@ int resign_wad(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int
 				if (err == 0) {
 					err = EIO;
 				}
-				_ftprintf(stderr, _T("*** ERROR writing destination WAD padding: %s\n"),
+				_ftprintf(f_err, _T("*** ERROR writing destination WAD padding: %s\n"),
 					_tcserror(err));
 				ret = -err;
 				goto end;
@@ -841,7 +960,7 @@ int resign_wad(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int
 
 	// Do we need to update the data size?
 	if (likely(!isDestBwf) && unlikely(wadInfo.data_size != data_size_actual)) {
-		_ftprintf(stderr, _T("*** Fixing WAD header's data size field:\n")
+		_ftprintf(f_err, _T("*** Fixing WAD header's data size field:\n")
 		                  _T("    Old: 0x%08X, New: 0x%08X\n"),
 			wadInfo.data_size, data_size_actual);
 		outHeader.wad.data_size = cpu_to_be32(data_size_actual);
@@ -856,17 +975,17 @@ int resign_wad(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int
 		if (err == 0) {
 			err = EIO;
 		}
-		_ftprintf(stderr, _T("*** ERROR writing destination WAD header: %s\n"),
+		_ftprintf(f_err, _T("*** ERROR writing destination WAD header: %s\n"),
 			_tcserror(err));
 		ret = -err;
 		goto end;
 	}
 
-	_tprintf(_T("WAD resigning complete.\n"));
+	info_printf(quiet, _T("WAD resigning complete.\n"));
 	ret = 0;
 
 end:
-	if (f_dest_wad) {
+	if (f_dest_wad && f_dest_wad != f_src_wad) {
 		// TODO: Delete if an error occurred?
 		fclose(f_dest_wad);
 	}
@@ -875,3 +994,16 @@ end:
 	}
 	return ret;
 }
+
+/**
+ * 'resign' command.
+ * @param src_wad	[in] Source WAD.
+ * @param dest_wad	[in] Destination WAD. (NULL to resign src_wad in place)
+ * @param recrypt_key	[in] Key for recryption. (-1 for default)
+ * @param output_format	[in] Output format. (-1 for default)
+ * @return 0 on success; negative POSIX error code or positive ID code on error.
+ */
+int resign_wad(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int output_format)
+{
+	return resign_wad_ex(src_wad, dest_wad, recrypt_key, output_format, false, stderr);
+}
@@ -9,8 +9,10 @@
 #ifndef __RVTHTOOL_WADRESIGN_RESIGN_WAD_HPP__
 #define __RVTHTOOL_WADRESIGN_RESIGN_WAD_HPP__
 
+#include "stdboolx.h"
 #include "tcharx.h"
 #include <stdint.h>
+#include <stdio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -27,13 +29,33 @@ typedef enum {
 /**
  * 'resign' command.
  * @param src_wad	[in] Source WAD.
- * @param dest_wad	[in] Destination WAD.
+ * @param dest_wad	[in] Destination WAD. (NULL to resign src_wad in place)
  * @param recrypt_key	[in] Key for recryption. (-1 for default)
  * @param output_format	[in] Output format. (-1 for default)
  * @return 0 on success; negative POSIX error code or positive ID code on error.
  */
 int resign_wad(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int output_format);
 
+/**
+ * 'resign' command. (extended version)
+ * This function is thread-safe, so multiple WADs can be resigned at once.
+ *
+ * If dest_wad is NULL, src_wad is resigned in place: only the header,
+ * certificate chain, ticket, and TMD are rewritten. This requires
+ * a standard WAD, and the certificate chain's aligned size must not
+ * change. (Retail and debug certificate chains have different sizes.)
+ *
+ * @param src_wad	[in] Source WAD.
+ * @param dest_wad	[in] Destination WAD. (NULL to resign src_wad in place)
+ * @param recrypt_key	[in] Key for recryption. (-1 for default)
+ * @param output_format	[in] Output format. (-1 for default)
+ * @param quiet		[in] If true, don't print the WAD information or progress messages.
+ * @param f_err		[in] FILE* to print errors and warnings to.
+ * @return 0 on success; negative POSIX error code or positive ID code on error.
+ */
+int resign_wad_ex(const TCHAR *src_wad, const TCHAR *dest_wad, int recrypt_key, int output_format,
+	bool quiet, FILE *f_err);
+
 #ifdef __cplusplus
 }
 #endif
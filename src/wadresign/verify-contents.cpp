@@ -0,0 +1,241 @@
+/***************************************************************************
+ * RVT-H Tool: WAD Resigner                                                *
+ * verify-contents.cpp: Verify WAD contents in parallel.                   *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "verify-contents.hpp"
+#include "wad-fns.h"
+
+// libwiicrypto
+#include "libwiicrypto/aesw.h"
+#include "libwiicrypto/byteswap.h"
+#include "libwiicrypto/common.h"
+#include "libwiicrypto/title_key.h"
+
+// C includes
+#include <errno.h>
+#include <string.h>
+
+// C++ includes
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+using std::unique_ptr;
+
+/**
+ * Shared state for all worker threads.
+ */
+struct VerifyState {
+	FILE *f_wad;
+	const WAD_View_t *view;
+	const RVL_Ticket *ticket;
+	RVL_AES_Keys_e encKey;
+	WAD_Content_Verify_t *jobs;
+	unsigned int count;
+
+	std::atomic<unsigned int> next_job;	// Index of the next job to start
+	std::mutex read_lock;			// Serializes reads from f_wad
+};
+
+/**
+ * Read data from the WAD file.
+ * @param state	[in] Shared state.
+ * @param addr	[in] Address.
+ * @param buf	[out] Buffer.
+ * @param size	[in] Number of bytes to read.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int read_wad_data(VerifyState *state, uint32_t addr, uint8_t *buf, uint32_t size)
+{
+	if (state->view) {
+		const uint8_t *const p = wad_view_get(state->view, addr, size);
+		if (p) {
+			// The mapping can be read from multiple threads.
+			memcpy(buf, p, size);
+			return 0;
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(state->read_lock);
+	errno = 0;
+	if (fseeko(state->f_wad, addr, SEEK_SET) != 0 ||
+	    fread(buf, 1, size, state->f_wad) != size)
+	{
+		const int err = errno;
+		return (err != 0 ? -err : -EIO);
+	}
+	return 0;
+}
+
+/**
+ * Decrypt and hash a content.
+ * @param state		[in] Shared state.
+ * @param cache		[in] Title key cache. (per thread)
+ * @param encKey	[in] Encryption key.
+ * @param job		[in] Verification job.
+ * @param buf		[in] Read buffer. (READ_BUFFER_SIZE)
+ * @param digest	[out] SHA-1 digest.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int hash_content(VerifyState *state, TitleKeyCache *cache, RVL_AES_Keys_e encKey,
+	const WAD_Content_Verify_t *job, uint8_t *buf, uint8_t *digest)
+{
+	// Get the AES context with the title key set.
+	// The title key is only decrypted once per thread and common key;
+	// subsequent contents reuse the cached AES context.
+	uint8_t title_key[16];
+	AesCtx *aesw = nullptr;
+	int ret = title_key_cache_decrypt_key(cache, state->ticket, encKey, title_key, &aesw);
+	if (ret != 0) {
+		return ret;
+	}
+
+	// Set the content IV.
+	// IV is the 2-byte content index, followed by zeroes.
+	uint8_t iv[16];
+	memcpy(iv, &job->content->index, 2);
+	memset(&iv[2], 0, 14);
+	aesw_set_iv(aesw, iv, sizeof(iv));
+
+	// Read the content, decrypt it, and hash it.
+	// NOTE: AES works on 16-byte blocks, so the last block has to be
+	// read and decrypted in full. The SHA-1 is only taken for the
+	// actual used data, though.
+	struct sha1_ctx sha1;
+	sha1_init(&sha1);
+	uint32_t addr = job->content_addr;
+	uint32_t data_sz = static_cast<uint32_t>(be64_to_cpu(job->content->size));
+	while (data_sz > 0) {
+		const uint32_t hash_sz = std::min<uint32_t>(data_sz, READ_BUFFER_SIZE);
+		const uint32_t read_sz = ALIGN_BYTES(16, hash_sz);
+		ret = read_wad_data(state, addr, buf, read_sz);
+		if (ret != 0) {
+			return ret;
+		}
+
+		// Decrypt the data and update the SHA-1.
+		aesw_decrypt_sha1(aesw, &sha1, buf, read_sz, hash_sz);
+		addr += read_sz;
+		data_sz -= hash_sz;
+	}
+
+	sha1_digest(&sha1, SHA1_DIGEST_SIZE, digest);
+	return 0;
+}
+
+/**
+ * Worker thread.
+ * @param state Shared state
+ */
+static void verify_thread(VerifyState *state)
+{
+	// Each thread has its own read buffer and title key cache,
+	// so the AES contexts aren't shared between threads.
+	unique_ptr<uint8_t[]> buf(new uint8_t[READ_BUFFER_SIZE]);
+	TitleKeyCache *const cache = title_key_cache_new();
+
+	while (true) {
+		const unsigned int idx = state->next_job.fetch_add(1);
+		if (idx >= state->count)
+			break;
+		WAD_Content_Verify_t *const job = &state->jobs[idx];
+		job->retail_ok = false;
+		if (!cache) {
+			job->result = -ENOMEM;
+			continue;
+		}
+
+		int ret = hash_content(state, cache, state->encKey, job, buf.get(), job->digest);
+		if (ret == 0) {
+			ret = (!memcmp(job->digest, job->content->sha1_hash, SHA1_DIGEST_SIZE) ? 0 : 1);
+		}
+		if (ret == 1 && state->encKey == vWii_KEY_RETAIL) {
+			// Check if this might be valid with the retail common key.
+			uint8_t digest[SHA1_DIGEST_SIZE];
+			if (hash_content(state, cache, RVL_KEY_RETAIL, job, buf.get(), digest) == 0) {
+				job->retail_ok = !memcmp(digest, job->content->sha1_hash, SHA1_DIGEST_SIZE);
+			}
+		}
+		job->result = ret;
+	}
+
+	title_key_cache_free(cache);
+}
+
+/**
+ * Verify WAD contents.
+ *
+ * Contents are verified in parallel. If view is mapped, the contents
+ * are copied from the mapping; otherwise, reads from f_wad are
+ * serialized. Decryption and hashing run concurrently. Each worker thread
+ * reuses its own read buffer and pre-keyed AES context.
+ *
+ * If a content can't be verified with vWii_KEY_RETAIL, it's also
+ * checked with RVL_KEY_RETAIL, since a good number of vWii WADs
+ * are incorrectly encrypted with the retail common key.
+ *
+ * @param f_wad		[in] Opened WAD file.
+ * @param view		[in,opt] Memory-mapped view of f_wad.
+ * @param ticket	[in] Ticket.
+ * @param encKey	[in] Encryption key.
+ * @param jobs		[in/out] Verification jobs.
+ * @param count		[in] Number of jobs.
+ * @param threads	[in] Number of worker threads. (0 for auto)
+ * @return 0 on success; negative POSIX error code on error.
+ *         (Per-content results, including read errors, are stored in jobs.)
+ */
+int verify_wad_contents(FILE *f_wad, const WAD_View_t *view, const RVL_Ticket *ticket, RVL_AES_Keys_e encKey,
+	WAD_Content_Verify_t *jobs, unsigned int count, unsigned int threads)
+{
+	if (count == 0) {
+		return 0;
+	}
+
+	if (threads == 0) {
+		threads = std::thread::hardware_concurrency();
+		if (threads == 0) {
+			threads = 1;
+		}
+	}
+	threads = std::min(threads, count);
+
+	VerifyState state;
+	state.f_wad = f_wad;
+	state.view = (view && view->data ? view : nullptr);
+	state.ticket = ticket;
+	state.encKey = encKey;
+	state.jobs = jobs;
+	state.count = count;
+	state.next_job = 0;
+
+	if (threads == 1) {
+		// No need to start a thread.
+		verify_thread(&state);
+		return 0;
+	}
+
+	std::vector<std::thread> workers;
+	workers.reserve(threads);
+	try {
+		for (unsigned int i = 0; i < threads; i++) {
+			workers.emplace_back(verify_thread, &state);
+		}
+	} catch (const std::system_error&) {
+		// Unable to start more threads.
+		// Use the ones that have been started.
+		if (workers.empty()) {
+			verify_thread(&state);
+		}
+	}
+	for (std::thread &worker : workers) {
+		worker.join();
+	}
+	return 0;
+}
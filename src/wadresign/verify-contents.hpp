@@ -0,0 +1,68 @@
+/***************************************************************************
+ * RVT-H Tool: WAD Resigner                                                *
+ * verify-contents.hpp: Verify WAD contents in parallel.                   *
+ *                                                                         *
+ * Copyright (c) 2018-2024 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_WADRESIGN_VERIFY_CONTENTS_HPP__
+#define __RVTHTOOL_WADRESIGN_VERIFY_CONTENTS_HPP__
+
+#include "stdboolx.h"
+#include <stdint.h>
+#include <stdio.h>
+
+#include "wad-fns.h"
+#include "libwiicrypto/cert_store.h"
+#include "libwiicrypto/wii_structs.h"
+
+// Nettle SHA-1
+#include <nettle/sha1.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Content verification job.
+ */
+typedef struct _WAD_Content_Verify_t {
+	const RVL_Content_Entry *content;	// [in] Content entry
+	uint32_t content_addr;			// [in] Content address
+
+	int result;		// [out] 0 if verified; 1 if not; negative POSIX error code on error.
+	bool retail_ok;		// [out] If the vWii key failed: true if the retail key works.
+	uint8_t digest[SHA1_DIGEST_SIZE];	// [out] Actual SHA-1
+} WAD_Content_Verify_t;
+
+/**
+ * Verify WAD contents.
+ *
+ * Contents are verified in parallel. If view is mapped, the contents
+ * are copied from the mapping; otherwise, reads from f_wad are
+ * serialized. Decryption and hashing run concurrently. Each worker thread
+ * reuses its own read buffer and pre-keyed AES context.
+ *
+ * If a content can't be verified with vWii_KEY_RETAIL, it's also
+ * checked with RVL_KEY_RETAIL, since a good number of vWii WADs
+ * are incorrectly encrypted with the retail common key.
+ *
+ * @param f_wad		[in] Opened WAD file.
+ * @param view		[in,opt] Memory-mapped view of f_wad.
+ * @param ticket	[in] Ticket.
+ * @param encKey	[in] Encryption key.
+ * @param jobs		[in/out] Verification jobs.
+ * @param count		[in] Number of jobs.
+ * @param threads	[in] Number of worker threads. (0 for auto)
+ * @return 0 on success; negative POSIX error code on error.
+ *         (Per-content results, including read errors, are stored in jobs.)
+ */
+int verify_wad_contents(FILE *f_wad, const WAD_View_t *view, const RVL_Ticket *ticket, RVL_AES_Keys_e encKey,
+	WAD_Content_Verify_t *jobs, unsigned int count, unsigned int threads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_WADRESIGN_VERIFY_CONTENTS_HPP__ */
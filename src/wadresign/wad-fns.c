@@ -7,10 +7,23 @@
  ***************************************************************************/
 
 #include "wad-fns.h"
+#include "config.wadresign.h"
 
 #include "libwiicrypto/byteswap.h"
 #include "libwiicrypto/common.h"
 
+// C includes
+#include <errno.h>
+#include <string.h>
+
+#ifdef _WIN32
+#  include <windows.h>
+#  include <io.h>
+#elif defined(HAVE_MMAP)
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#endif
+
 /**
  * Get WAD info for a standard WAD file.
  * @param pWadHeader	[in] WAD header.
@@ -113,3 +126,93 @@ int getWadInfo_BWF(const Wii_WAD_Header_BWF *pWadHeader, WAD_Info_t *pWadInfo)
 	pWadInfo->data_size = 0;
 	return 0;
 }
+
+/**
+ * Map a WAD file into memory.
+ * @param f_wad	[in] Opened WAD file.
+ * @param pView	[out] WAD view. (data is NULL on error)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int wad_view_map(FILE *f_wad, WAD_View_t *pView)
+{
+#ifdef _WIN32
+	HANDLE hFile, hMapping;
+	LARGE_INTEGER fileSize;
+	void *ptr;
+#elif defined(HAVE_MMAP)
+	struct stat sbuf;
+	void *ptr;
+#endif
+
+	pView->data = NULL;
+	pView->size = 0;
+
+#ifdef _WIN32
+	hFile = (HANDLE)_get_osfhandle(_fileno(f_wad));
+	if (!GetFileSizeEx(hFile, &fileSize)) {
+		return -EIO;
+	} else if (fileSize.QuadPart <= 0 || (uint64_t)fileSize.QuadPart > (uint64_t)SIZE_MAX) {
+		// Empty files can't be mapped.
+		return -ENOTSUP;
+	}
+
+	hMapping = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!hMapping) {
+		return -EIO;
+	}
+
+	// NOTE: The view keeps the file mapping object open,
+	// so the mapping handle can be closed immediately.
+	ptr = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, (SIZE_T)fileSize.QuadPart);
+	CloseHandle(hMapping);
+	if (!ptr) {
+		return -ENOMEM;
+	}
+
+	pView->data = (const uint8_t*)ptr;
+	pView->size = (size_t)fileSize.QuadPart;
+	return 0;
+#elif defined(HAVE_MMAP)
+	if (fstat(fileno(f_wad), &sbuf) != 0) {
+		int err = errno;
+		return (err != 0 ? -err : -EIO);
+	} else if (!S_ISREG(sbuf.st_mode) || sbuf.st_size <= 0 ||
+	           (uint64_t)sbuf.st_size > (uint64_t)SIZE_MAX)
+	{
+		// Only non-empty regular files can be mapped.
+		return -ENOTSUP;
+	}
+
+	ptr = mmap(NULL, (size_t)sbuf.st_size, PROT_READ, MAP_SHARED, fileno(f_wad), 0);
+	if (ptr == MAP_FAILED) {
+		int err = errno;
+		return (err != 0 ? -err : -EIO);
+	}
+
+	pView->data = (const uint8_t*)ptr;
+	pView->size = (size_t)sbuf.st_size;
+	return 0;
+#else /* !HAVE_MMAP */
+	// Memory mapping isn't available.
+	UNUSED(f_wad);
+	return -ENOTSUP;
+#endif
+}
+
+/**
+ * Unmap a WAD file that was mapped using wad_view_map().
+ * @param pView	[in/out] WAD view.
+ */
+void wad_view_unmap(WAD_View_t *pView)
+{
+	if (!pView->data)
+		return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(pView->data);
+#elif defined(HAVE_MMAP)
+	munmap((void*)pView->data, pView->size);
+#endif
+	pView->data = NULL;
+	pView->size = 0;
+}
@@ -9,7 +9,9 @@
 #ifndef __RVTHTOOL_WADRESIGN_WAD_FNS_H__
 #define __RVTHTOOL_WADRESIGN_WAD_FNS_H__
 
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #include "libwiicrypto/wii_wad.h"
 
@@ -67,6 +69,46 @@ int getWadInfo(const Wii_WAD_Header *pWadHeader, WAD_Info_t *pWadInfo);
  */
 int getWadInfo_BWF(const Wii_WAD_Header_BWF *pWadHeader, WAD_Info_t *pWadInfo);
 
+/**
+ * Read-only memory-mapped view of a WAD file.
+ * If the file couldn't be mapped, data is NULL,
+ * and the file must be read using stdio.
+ *
+ * NOTE: The file must not be truncated while it's mapped.
+ */
+typedef struct _WAD_View_t {
+	const uint8_t *data;	// Mapped file data, or NULL if not mapped.
+	size_t size;		// Size of the mapped file data.
+} WAD_View_t;
+
+/**
+ * Map a WAD file into memory.
+ * @param f_wad	[in] Opened WAD file.
+ * @param pView	[out] WAD view. (data is NULL on error)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int wad_view_map(FILE *f_wad, WAD_View_t *pView);
+
+/**
+ * Unmap a WAD file that was mapped using wad_view_map().
+ * @param pView	[in/out] WAD view.
+ */
+void wad_view_unmap(WAD_View_t *pView);
+
+/**
+ * Get a pointer to a region of a mapped WAD file.
+ * @param pView		[in] WAD view.
+ * @param address	[in] Address.
+ * @param size		[in] Size.
+ * @return Pointer to the region, or NULL if not mapped or out of range.
+ */
+static inline const uint8_t *wad_view_get(const WAD_View_t *pView, uint32_t address, uint32_t size)
+{
+	if (!pView->data || address > pView->size || size > pView->size - address)
+		return NULL;
+	return &pView->data[address];
+}
+
 #ifdef __cplusplus
 }
 #endif